@@ -0,0 +1,302 @@
+// engine_benchmarks: microbenchmarks of the CPU hot paths, and the comparison of them and of a
+// --benchmark run (see benchmark.h) against a baseline recorded on the same machine. No window,
+// no GL context.
+//
+//   engine_benchmarks [--macro <benchmark.csv>] [--baseline <file>] [--tolerance <fraction>]
+//                     [--write-baseline <file>] [--filter <suite>]
+//
+// The baseline is CSV, "group,name,value": nanoseconds per operation for the micro group, the
+// p50 in milliseconds of the macro run's frame and scope rows. A result more than tolerance
+// (0.10 by default) over its baseline is a regression and the exit code is 1. Baselines are per
+// machine, so none is checked in: write one with --write-baseline (update_benchmark_baseline) on
+// the machine that compares against it. A --baseline that is missing or empty fails with exit
+// code 2 rather than passing with nothing compared.
+#include "frustum.h"
+#include "entity_manager.h"
+#include "draw_list.h"
+#include "image_ops.h"
+#include "mesh_loader.h"
+#include "camera.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Globals main.cpp owns for the rest of the engine
+glm::mat4 view;
+glm::mat4 projection;
+Camera global_camera;
+unsigned int total_triangles = 0;
+GLuint default_texture_id = 0;
+
+#define MICRO_SAMPLES 9          // Timed samples per benchmark, the median is reported
+#define MICRO_SAMPLE_MS 20.0     // Minimum length of a sample
+#define DEFAULT_TOLERANCE 0.10
+
+// Keeps results the compiler would otherwise drop
+static volatile uint64_t sink = 0;
+
+using Clock = std::chrono::steady_clock;
+
+// Nanoseconds per operation, fn running ops_per_call of them
+static double measure(size_t ops_per_call, const std::function<void()>& fn) {
+    // Enough calls per sample to swamp the clock's resolution
+    size_t calls = 1;
+    for (;;) {
+        const auto start = Clock::now();
+        for (size_t i = 0; i < calls; ++i) fn();
+        const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (ms >= MICRO_SAMPLE_MS) break;
+        calls *= ms < MICRO_SAMPLE_MS / 8.0 ? 8 : 2;
+    }
+
+    std::vector<double> samples;
+    for (int sample = 0; sample < MICRO_SAMPLES; ++sample) {
+        const auto start = Clock::now();
+        for (size_t i = 0; i < calls; ++i) fn();
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        samples.push_back(ns / (double)(calls * ops_per_call));
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+struct Result {
+    std::string group, name;
+    double value;
+};
+
+// ============================================================================
+// MICROBENCHMARKS
+// ============================================================================
+
+static void frustumBenchmarks(std::vector<Result>& results) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> coord(-100.0f, 100.0f);
+    const glm::mat4 proj = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+    std::vector<glm::mat4> view_projections;
+    for (int i = 0; i < 64; ++i) {
+        const glm::vec3 eye(coord(rng), coord(rng) * 0.1f, coord(rng));
+        view_projections.push_back(proj * glm::lookAt(eye, eye + glm::vec3(coord(rng), 0.0f, coord(rng)), glm::vec3(0, 1, 0)));
+    }
+
+    Frustum frustum;
+    results.push_back({"micro", "frustum_extract", measure(view_projections.size(), [&]() {
+        for (const glm::mat4& vp : view_projections) {
+            frustum.extractFromMatrix(vp);
+            sink += (uint64_t)(frustum.planes[5].w * 1000.0f);
+        }
+    })});
+
+    std::vector<glm::vec4> spheres(4096);
+    for (glm::vec4& sphere : spheres) sphere = glm::vec4(coord(rng), coord(rng) * 0.1f, coord(rng), 1.0f + (coord(rng) + 100.0f) * 0.02f);
+    frustum.extractFromMatrix(view_projections[0]);
+    results.push_back({"micro", "frustum_sphere_test", measure(spheres.size(), [&]() {
+        uint64_t inside = 0;
+        for (const glm::vec4& sphere : spheres) inside += frustum.sphereInFrustum(glm::vec3(sphere), sphere.w);
+        sink += inside;
+    })});
+}
+
+static void entityBenchmarks(std::vector<Result>& results) {
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> value(-50.0f, 50.0f);
+    std::vector<Entity> entities(1024);
+    for (Entity& entity : entities) {
+        entity.position = glm::vec3(value(rng), value(rng), value(rng));
+        entity.rotation = glm::vec3(value(rng), value(rng) * 3.0f, value(rng));
+        entity.scale = glm::vec3(1.0f + value(rng) * 0.01f);
+    }
+    results.push_back({"micro", "entity_model_matrix", measure(entities.size(), [&]() {
+        float sum = 0.0f;
+        for (Entity& entity : entities) sum += entity.getModelMatrix(&entity)[3][0];
+        sink += (uint64_t)sum;
+    })});
+}
+
+static void batchBenchmarks(std::vector<Result>& results) {
+    // Keys shaped like the main pass's: few states and meshes, depth in the low bits
+    std::mt19937_64 rng(3);
+    std::vector<DrawList::Packet> source(16384), packets, scratch;
+    for (size_t i = 0; i < source.size(); ++i) {
+        const uint64_t state = rng() % 48, vao = rng() % 6, mesh = rng() % 200, depth = rng() % (1 << 14);
+        source[i] = {(state << 45) | (vao << 31) | (mesh << 14) | depth, (uint32_t)i};
+    }
+    results.push_back({"micro", "draw_packet_sort", measure(source.size(), [&]() {
+        packets = source;
+        DrawList::radixSort(packets, scratch);
+        sink += packets.front().instance;
+    })});
+}
+
+static void ormBenchmarks(std::vector<Result>& results) {
+    const size_t pixels = 1024 * 1024;
+    std::vector<unsigned char> ao(pixels), roughness(pixels), height(pixels), out(pixels * 4);
+    for (size_t i = 0; i < pixels; ++i) {
+        ao[i] = (unsigned char)(i * 7);
+        roughness[i] = (unsigned char)(i * 13);
+        height[i] = (unsigned char)(i * 31);
+    }
+    ChannelSource sources[4];
+    sources[0] = {ao.data(), 255, false};
+    sources[1] = {roughness.data(), 0, false};
+    sources[2] = {nullptr, 0, false};
+    sources[3] = {height.data(), 128, true};
+    results.push_back({"micro", "orm_interleave_pixel", measure(pixels, [&]() {
+        interleaveRGBA(sources, out.data(), 0, pixels);
+        sink += out[pixels * 2];
+    })});
+}
+
+static void vertexBenchmarks(std::vector<Result>& results) {
+    // A sub-mesh as the importer leaves it: positions, normals, tangents and one UV set
+    const unsigned int vertex_count = 65536;
+    aiMesh mesh;
+    mesh.mNumVertices = vertex_count;
+    mesh.mVertices = new aiVector3D[vertex_count];
+    mesh.mNormals = new aiVector3D[vertex_count];
+    mesh.mTangents = new aiVector3D[vertex_count];
+    mesh.mBitangents = new aiVector3D[vertex_count];
+    mesh.mTextureCoords[0] = new aiVector3D[vertex_count];
+    mesh.mNumUVComponents[0] = 2;
+    for (unsigned int v = 0; v < vertex_count; ++v) {
+        const float a = v * 0.001f;
+        mesh.mVertices[v] = aiVector3D(std::cos(a) * 10.0f, v * 0.0001f, std::sin(a) * 10.0f);
+        mesh.mNormals[v] = aiVector3D(std::cos(a), 0.0f, std::sin(a));
+        mesh.mTangents[v] = aiVector3D(-std::sin(a), 0.0f, std::cos(a));
+        mesh.mBitangents[v] = aiVector3D(0.0f, 1.0f, 0.0f);
+        mesh.mTextureCoords[0][v] = aiVector3D(a, v * 0.0001f, 0.0f);
+    }
+
+    std::vector<unsigned char> bytes;
+    for (bool packed : {false, true}) {
+        use_packed_vertices = packed;
+        const VertexLayout layout = getVertexLayout(chooseVertexFormat(&mesh));
+        results.push_back({"micro", packed ? "vertex_encode_packed" : "vertex_encode_float", measure(vertex_count, [&]() {
+            encodeVertices(&mesh, layout, bytes);
+            sink += bytes[bytes.size() / 2];
+        })});
+    }
+    use_packed_vertices = true;
+}
+
+// ============================================================================
+// MACRO RESULTS AND BASELINES
+// ============================================================================
+
+// The frame and scope p50s of a --benchmark CSV
+static bool readMacro(const std::string& path, std::vector<Result>& results) {
+    std::ifstream file(path);
+    if (!file) {
+        printf("Can't read %s\n", path.c_str());
+        return false;
+    }
+    std::string line;
+    std::getline(file, line); // Header: group,name,samples,mean,p50,p95,p99,max
+    while (std::getline(file, line)) {
+        std::vector<std::string> fields;
+        std::stringstream row(line);
+        for (std::string field; std::getline(row, field, ',');) fields.push_back(field);
+        if (fields.size() < 5 || fields[0] == "counters") continue;
+        results.push_back({"macro", fields[0] + "/" + fields[1], atof(fields[4].c_str())});
+    }
+    return true;
+}
+
+static std::map<std::string, double> readBaseline(const std::string& path) {
+    std::map<std::string, double> baseline;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        const size_t second = line.find(',', line.find(',') + 1);
+        if (second == std::string::npos) continue;
+        baseline[line.substr(0, second)] = atof(line.c_str() + second + 1);
+    }
+    return baseline;
+}
+
+static bool writeBaseline(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        printf("Can't write %s\n", path.c_str());
+        return false;
+    }
+    file << "# engine_benchmarks baseline: group,name,value (micro ns per op, macro p50 ms)\n";
+    char value[32];
+    for (const Result& result : results) {
+        snprintf(value, sizeof(value), "%.4f", result.value);
+        file << result.group << "," << result.name << "," << value << "\n";
+    }
+    printf("Baseline written to %s\n", path.c_str());
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string macro_file, baseline_file, write_file, filter;
+    double tolerance = DEFAULT_TOLERANCE;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            printf("%s needs a value\n", arg.c_str());
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--macro") macro_file = value;
+        else if (arg == "--baseline") baseline_file = value;
+        else if (arg == "--write-baseline") write_file = value;
+        else if (arg == "--filter") filter = value;
+        else if (arg == "--tolerance") tolerance = std::max(0.0, atof(value));
+        else {
+            printf("Unknown argument %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    const std::pair<const char*, void (*)(std::vector<Result>&)> suites[] = {
+        {"frustum", frustumBenchmarks}, {"entity", entityBenchmarks}, {"batch", batchBenchmarks},
+        {"orm", ormBenchmarks},         {"vertex", vertexBenchmarks},
+    };
+    for (const auto& [name, run] : suites) {
+        if (filter.empty() || filter == name) run(results);
+    }
+    if (!macro_file.empty() && !readMacro(macro_file, results)) return 2;
+
+    const std::map<std::string, double> baseline = baseline_file.empty() ? std::map<std::string, double>() : readBaseline(baseline_file);
+    if (!baseline_file.empty() && baseline.empty()) {
+        printf("No baseline in %s, record one with --write-baseline (update_benchmark_baseline)\n", baseline_file.c_str());
+        return 2;
+    }
+
+    int regressions = 0;
+    printf("%-6s %-40s %12s %12s %8s\n", "group", "name", "value", "baseline", "change");
+    for (const Result& result : results) {
+        auto base = baseline.find(result.group + "," + result.name);
+        if (base == baseline.end() || base->second <= 0.0) {
+            printf("%-6s %-40s %12.4f %12s\n", result.group.c_str(), result.name.c_str(), result.value, "-");
+            continue;
+        }
+        const double change = result.value / base->second - 1.0;
+        const bool regressed = change > tolerance;
+        regressions += regressed;
+        printf("%-6s %-40s %12.4f %12.4f %+7.1f%%%s\n", result.group.c_str(), result.name.c_str(), result.value, base->second,
+               change * 100.0, regressed ? "  REGRESSION" : "");
+    }
+
+    if (!write_file.empty() && !writeBaseline(write_file, results)) return 2;
+    if (regressions > 0) {
+        printf("%d results over their baseline by more than %.0f%%\n", regressions, tolerance * 100.0);
+        return 1;
+    }
+    return 0;
+}
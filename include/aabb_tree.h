@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+struct Frustum;
+
+#define AABB_TREE_NULL 0xffffffffu
+#define AABB_TREE_MARGIN 0.1f // Leaves are fattened by this fraction of their extent (plus a little)
+
+// Dynamic bounding volume hierarchy over axis-aligned boxes, leaves carry a user value.
+// Leaves store a fattened box, so small movements only need a containment check and the
+// tree is only restructured when an object leaves its fat box. Insertion picks the sibling
+// by surface-area cost and rotations keep the tree balanced, so queries stay O(log n).
+class AabbTree {
+public:
+    // Returns the proxy id, stable until remove()
+    uint32_t insert(const glm::vec3& bmin, const glm::vec3& bmax, uint32_t user);
+    void remove(uint32_t proxy);
+    // Re-inserts only when the box left the proxy's fat box, returns whether it did
+    bool move(uint32_t proxy, const glm::vec3& bmin, const glm::vec3& bmax);
+    void setUser(uint32_t proxy, uint32_t user) { nodes[proxy].user = user; }
+    void clear();
+
+    // Appends the user value of every leaf whose fat box touches the frustum / box.
+    // Callers still test the exact bounds, the fat boxes are a superset. Queries may run on
+    // several threads at once while nothing modifies the tree.
+    void queryFrustum(const Frustum& frustum, std::vector<uint32_t>& out) const;
+    void queryBox(const glm::vec3& bmin, const glm::vec3& bmax, std::vector<uint32_t>& out) const;
+    // Appends the distance at which the ray enters each fat box it crosses within max_distance,
+    // with the leaf's user value, in no particular order. direction needn't be normalised, the
+    // distances are then in multiples of it.
+    void queryRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance, std::vector<std::pair<float, uint32_t>>& out) const;
+
+    // Where a ray enters the box, 0 from inside, -1 when it misses it within max_distance
+    static float rayEntry(const glm::vec3& bmin, const glm::vec3& bmax, const glm::vec3& origin, const glm::vec3& inverse_direction, float max_distance);
+
+    size_t leafCount() const { return leaf_count; }
+    int height() const { return root == AABB_TREE_NULL ? 0 : nodes[root].height; }
+
+private:
+    struct Node {
+        glm::vec3 bmin{0.0f}, bmax{0.0f};
+        uint32_t parent = AABB_TREE_NULL; // Next free node while on the free list
+        uint32_t child1 = AABB_TREE_NULL, child2 = AABB_TREE_NULL;
+        uint32_t user = 0;
+        int height = -1; // 0 for leaves, -1 when free
+
+        bool isLeaf() const { return child1 == AABB_TREE_NULL; }
+    };
+
+    uint32_t allocateNode();
+    void freeNode(uint32_t node);
+    void insertLeaf(uint32_t leaf);
+    void removeLeaf(uint32_t leaf);
+    uint32_t balance(uint32_t node);
+    void collectLeaves(uint32_t node, std::vector<uint32_t>& out) const;
+
+    std::vector<Node> nodes;
+    uint32_t root = AABB_TREE_NULL;
+    uint32_t free_list = AABB_TREE_NULL;
+    size_t leaf_count = 0;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct emscripten_fetch_t;
+
+#define ASSET_FETCH_MAX_IN_FLIGHT 6 // Concurrent downloads, about what a browser gives one origin
+
+// Lower values download first
+enum AssetPriority {
+    ASSET_PRIORITY_CRITICAL = 0, // Needed before the first frame
+    ASSET_PRIORITY_SCENE,
+    ASSET_PRIORITY_BACKGROUND,
+};
+
+// On-demand downloads of res/ for the web build. Only shaders, the settings file and a manifest of
+// everything else are preloaded; fetchPrefix() queues the manifest's files under a directory, and
+// each one is fetched on its own, written into MEMFS at its res/ path and kept in IndexedDB, so a
+// reload reads it from there instead of the network. The manifest lists every file's size and
+// modification time, the time goes into the URL so an edited file isn't served from a stale cache.
+// With a pack (asset_pack.h) the manifest only names it: its index is read with two range
+// requests and each file is a range request into the pack, cached per entry.
+// Natively the files are already on disk and every prefix is ready. GL thread only.
+class AssetFetcher {
+public:
+    // Reads the manifest, false natively or when there isn't one (everything is then assumed present)
+    bool init(const std::string& manifest_path);
+
+    // Queues the files under prefix ("res/scene_models/level/"), a queued file moves up to a higher priority
+    void fetchPrefix(const std::string& prefix, AssetPriority priority);
+    // Starts queued downloads while fewer than ASSET_FETCH_MAX_IN_FLIGHT are running
+    void update();
+    // Every file under prefix is in MEMFS, or failed to download
+    bool ready(const std::string& prefix) const;
+    // Downloads until prefix is ready, yielding to the browser between checks
+    void wait(const std::string& prefix);
+    // Gives the browser a turn so finished downloads can call back
+    void yield();
+
+    size_t queuedCount() const { return queue.size() + in_flight; }
+    uint64_t bytesFetched() const { return bytes_fetched; }
+
+private:
+    enum FileState { FILE_REMOTE, FILE_QUEUED, FILE_FETCHING, FILE_LOCAL, FILE_FAILED };
+    struct File {
+        std::string path;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        uint64_t offset = 0; // Into the pack
+        FileState state = FILE_REMOTE;
+        AssetPriority priority = ASSET_PRIORITY_BACKGROUND;
+    };
+    struct Queued {
+        AssetPriority priority;
+        uint64_t order; // Request order within a priority
+        size_t file;
+    };
+
+    void start(size_t file);
+#ifdef __EMSCRIPTEN__
+    bool loadPackIndex();
+    static void onSuccess(emscripten_fetch_t* fetch);
+    static void onError(emscripten_fetch_t* fetch);
+#endif
+
+    bool active = false;
+    std::string pack_url; // Empty when the files are fetched one by one
+    std::vector<File> files;
+    std::deque<Queued> queue; // Sorted by priority, then order
+    uint64_t next_order = 0;
+    int in_flight = 0;
+    uint64_t bytes_fetched = 0;
+};
+
+extern AssetFetcher asset_fetch;
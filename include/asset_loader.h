@@ -0,0 +1,82 @@
+#pragma once
+
+#include "mesh_loader.h"
+#include "asset_fetch.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+
+class Mesh;
+
+// Handle returned by loadMeshAsync(). meshes is filled on the GL thread once ready is set.
+struct MeshRequest {
+    std::string filepath;
+    std::vector<std::shared_ptr<Mesh>> meshes;
+    std::vector<MeshNodeInstance> instances; // See requestNodeInstancing(), empty for flat models
+    bool ready = false;
+    bool failed = false;
+    bool lazy = false; // From declareMesh() and not required yet, nothing is loading
+    AssetPriority priority = ASSET_PRIORITY_SCENE;
+};
+
+// Imports meshes on the job system and uploads the staged results on the GL thread.
+// Workers only produce MeshStaging records; every GL call happens in processUploads().
+// Models already in mesh_registry, or already queued, are handed out without re-importing.
+// On the web a model's directory is fetched first (asset_fetch), at the given priority, and its
+// import waits until the files are there. Every model uploaded is handed to asset_watcher with the
+// files it was built from.
+class AssetLoader {
+public:
+    std::shared_ptr<MeshRequest> loadMeshAsync(const std::string& filepath, AssetPriority priority = ASSET_PRIORITY_SCENE);
+    // A handle to a model that costs nothing until require() (or a loadMeshAsync() of the same
+    // path) starts it, so models the scene may never show aren't downloaded, imported or
+    // uploaded. Resident models are handed out ready. Declaring a path again returns the same
+    // handle while it is held.
+    std::shared_ptr<MeshRequest> declareMesh(const std::string& filepath, AssetPriority priority = ASSET_PRIORITY_SCENE);
+    // Starts a declared model loading at its priority, nothing for any other request
+    void require(const std::shared_ptr<MeshRequest>& request);
+    // Imports a resident model again and moves the result into its existing meshes
+    // (MeshRegistry::replace), for asset_watcher. Nothing happens if it's already queued.
+    void reloadMeshAsync(const std::string& filepath);
+
+    // Uploads staged sub-meshes until budget_ms has been spent (at least one per call).
+    // Call once per frame from the GL thread.
+    void processUploads(double budget_ms);
+
+    // Blocks until every queued request is imported and uploaded
+    void finishAll();
+
+    size_t pendingCount() const { return pending; }
+    // Requests finished, failed ones included, and all requests made, for loading progress
+    size_t completedCount() const { return completed; }
+    size_t requestedCount() const { return completed + pending; }
+
+private:
+    struct PendingMesh {
+        std::shared_ptr<MeshRequest> request;
+        std::string fetch_prefix; // Files that must be downloaded before the import
+        MeshStaging staging;
+        bool imported = false;
+        bool reload = false; // Replaces the resident meshes instead of registering new ones
+        size_t next_submesh = 0;
+    };
+
+    void start(const std::shared_ptr<MeshRequest>& request, AssetPriority priority);
+    void submitImport(const std::shared_ptr<PendingMesh>& entry);
+
+    std::mutex staged_mutex;
+    std::condition_variable staged_cv;
+    std::deque<std::shared_ptr<PendingMesh>> staged;   // Imported, waiting for the GL thread
+    std::deque<std::shared_ptr<PendingMesh>> uploading; // GL thread only
+    std::deque<std::shared_ptr<PendingMesh>> fetching;  // GL thread only, waiting on asset_fetch
+    size_t pending = 0;                                 // GL thread only
+    size_t completed = 0;                               // GL thread only
+    std::unordered_map<std::string, std::shared_ptr<MeshRequest>> in_flight; // GL thread only, by normalized path
+    std::unordered_map<std::string, std::weak_ptr<MeshRequest>> declared;   // GL thread only, lazy ones by normalized path
+};
+
+extern AssetLoader asset_loader;
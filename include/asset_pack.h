@@ -0,0 +1,75 @@
+#pragma once
+
+#include "filesystem.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+#define ASSET_PACK_MAGIC "RPAK"
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGNMENT 4096 // Entry data starts on a page, so a mapped entry is its own run of pages
+#define ASSET_PACK_FILE "res.pak"
+
+// How an entry's bytes are stored
+enum AssetPackCompression : uint32_t {
+    ASSET_PACK_STORED = 0,
+};
+
+// At offset 0, the index follows it
+struct AssetPackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t reserved;
+    uint64_t index_size; // Bytes of index after the header
+};
+
+struct AssetPackEntry {
+    std::string path; // "res/shaders/pbr.fs", relative to the executable path
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    int64_t mtime = 0; // The source file's, so caches keyed on it stay valid
+    uint32_t compression = ASSET_PACK_STORED;
+};
+
+// All of res/ in one indexed file, with what was cooked into cache/ (see tools/asset_cooker.cpp).
+// --write-pack <file> packs res/ and cache/ and exits; at startup res.pak next to the executable
+// is mapped if it exists, and from then on MappedFile, getFileModifiedTime and everything reading
+// through them (stb, the shader loader, Assimp, KTX2) find res/ and cache/ paths in the pack
+// before the disk. One open and one mapping replace a file open per asset, and entries sit
+// contiguously in path order. The web build fetches entries out of the pack with range requests
+// instead, see asset_fetch.h. Rewrite the pack after editing res/, a stale one shadows the edits.
+// Read-only once open, safe from any thread.
+class AssetPack {
+public:
+    // --write-pack at argv[i]: how many arguments it took, 0 when it isn't one, -1 on a bad value
+    int parseArg(int argc, char** argv, int i);
+    bool writeRequested() const { return !write_path.empty(); }
+    // Packs every file under res/ and cache/ into the requested file
+    bool write() const;
+
+    // Maps a pack, false when there isn't one at path or it's damaged
+    bool open(const std::string& path);
+    bool isOpen() const { return file.isOpen(); }
+
+    // The packed bytes of path (absolute or relative to the executable path), false when it isn't packed
+    bool find(const std::string& path, const unsigned char*& data, size_t& size) const;
+    // 0 when path isn't packed
+    int64_t modifiedTime(const std::string& path) const;
+
+    // The index of a pack whose first bytes are data, false when they aren't one. The header
+    // alone tells how many bytes of index follow it.
+    static bool readHeader(const unsigned char* data, size_t size, AssetPackHeader& header);
+    static bool readIndex(const unsigned char* data, size_t size, uint32_t count, std::vector<AssetPackEntry>& entries);
+
+private:
+    const AssetPackEntry* lookup(const std::string& path) const;
+
+    std::string write_path;
+    MappedFile file;
+    std::vector<AssetPackEntry> entries;
+    std::unordered_map<std::string, size_t> by_path;
+};
+
+extern AssetPack asset_pack;
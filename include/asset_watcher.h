@@ -0,0 +1,45 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#define ASSET_WATCH_INTERVAL_MS 500 // Between polls of the watched files
+
+// Edit-and-see for res/ without a restart. Owners (a model, a set of shader variants) are watched
+// with the files they were built from; update() polls those files' modification times and calls
+// each owner's reload once when any of its files changed. Textures built from a changed file are
+// evicted from texture_cache first, so a reload decodes the edit instead of reusing the resident
+// copy. Models re-import on the job system and move into their existing meshes (asset_loader.h),
+// shader variants recompile in the background and swap in once linked (shader_variants.h).
+// Polling instead of OS file notifications keeps it portable, it costs a stat per watched file
+// per interval. Native only. GL thread only.
+class AssetWatcher {
+public:
+    // Replaces an earlier watch of the same owner, whose files may have changed with the reload
+    void watch(const std::string& owner, const std::vector<std::string>& paths, std::function<void()> reload);
+    void unwatch(const std::string& owner);
+
+    // Once a frame, polls every ASSET_WATCH_INTERVAL_MS
+    void update();
+
+    bool enabled = true;
+    size_t watchedFiles() const { return files.size(); }
+    size_t reloadCount() const { return reloads; }
+
+private:
+    struct Owner {
+        std::vector<std::string> paths;
+        std::function<void()> reload;
+    };
+
+    std::unordered_map<std::string, Owner> owners;
+    std::unordered_map<std::string, int64_t> files; // Modification time last seen, by path
+    std::chrono::steady_clock::time_point last_poll;
+    size_t reloads = 0;
+};
+
+extern AssetWatcher asset_watcher;
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+
+class Shader;
+
+extern bool use_atmosphere;                // Off draws the cloud cubemap and keeps its ambient
+extern float atmosphere_time_of_day;       // Hours, the sun rises at 6 and sets at 18
+extern float atmosphere_sun_azimuth;       // Degrees the sun's path is turned about +y
+extern float atmosphere_sun_illuminance;   // Brings the sky into the range of the scene's lights
+
+#define ATMOSPHERE_TRANSMITTANCE_WIDTH 256 // The LUT sizes match atmosphere.glsl
+#define ATMOSPHERE_TRANSMITTANCE_HEIGHT 64
+#define ATMOSPHERE_MULTISCATTER_SIZE 32
+#define ATMOSPHERE_SKY_VIEW_WIDTH 192
+#define ATMOSPHERE_SKY_VIEW_HEIGHT 108
+#define ATMOSPHERE_ENVIRONMENT_SIZE 128    // Faces of the cube the IBL is rebuilt from
+#define ATMOSPHERE_SUN_TILT 30.0f          // Degrees the noon sun stands off the zenith
+#define ATMOSPHERE_SUN_DISK_DEGREES 0.53f  // Angular diameter
+#define ATMOSPHERE_CHANGE_EPSILON 1e-4f    // Smaller sun moves don't redraw anything
+
+// A physically based sky in place of the cubemap, after Hillaire 2020. The transmittance and
+// multiple scattering LUTs depend only on the atmosphere and are drawn once. The sky-view LUT,
+// the sky around a viewer at a fixed altitude, and an environment cube for the IBL are redrawn
+// only when the sun changes; then the sky pass is a lookup per pixel where a dynamic sky would
+// march every one. Needs float colour targets, WebGL2 without EXT_color_buffer_float stays on
+// the cubemap. GL thread only.
+class Atmosphere {
+public:
+    Atmosphere() = default;
+    ~Atmosphere();
+
+    Atmosphere(const Atmosphere&) = delete;
+    Atmosphere& operator=(const Atmosphere&) = delete;
+
+    // Shaders, LUTs and the once-only passes. False leaves the sky to the cubemap.
+    bool init();
+    void release();
+    bool ready() const { return transmittance_lut != 0; }
+
+    // Towards the sun for atmosphere_time_of_day and atmosphere_sun_azimuth
+    static glm::vec3 sunDirection();
+    // Redraws the sky-view LUT, the environment cube and the IBL when the sun moved. Returns
+    // true when it did, so whatever captured the old sky can follow.
+    bool update();
+    // The next update() redraws even if the sun stayed, e.g. after the cubemap's ambient was back
+    void invalidate() { illuminance = -1.0f; }
+    // The sky on the far plane in the skybox's place, false when off or not ready so the caller
+    // draws the cubemap
+    bool render();
+
+private:
+    void drawFullscreen(GLuint target, int width, int height);
+
+    std::unique_ptr<Shader> sky_view_shader;
+    std::unique_ptr<Shader> sky_shader;
+    std::unique_ptr<Shader> environment_shader;
+    GLuint transmittance_lut = 0;
+    GLuint multiscatter_lut = 0;
+    GLuint sky_view_lut = 0;
+    GLuint environment = 0;
+    GLuint fbo = 0;
+    GLuint vao = 0;
+    bool failed = false;
+
+    glm::vec3 sun{0.0f};       // What the LUT and the IBL were drawn for
+    float illuminance = -1.0f;
+};
+
+extern Atmosphere atmosphere;
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "camera.h"
+#include "render_view.h"
+#include "frame_readback.h"
+#include <glad/glad.h>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define BATCH_RENDER_DEFAULT_SIZE 512 // Image side without --render-size
+
+// One image to render: where it goes and the camera it's seen from
+struct BatchRenderJob {
+    std::string output;
+    glm::vec3 position = glm::vec3(0.0f);
+    float yaw = -90.0f;
+    float pitch = 0.0f;
+    float fov = 45.0f; // Degrees, vertical
+};
+
+// --render-jobs <file> renders one image per job into an offscreen target, for thumbnail and
+// preview servers. The scene, its meshes, textures and shaders load once and every job after the
+// first only moves the camera, so a process renders any number of images. Jobs are one per line,
+// "output x y z yaw pitch [fov]" in degrees, '#' starts a comment; with "-" they're read from
+// stdin as they come, and the run ends at EOF. Each image goes through the post pass into the
+// target, its pixels come back through a FrameReadback a couple of jobs later, so the GPU never
+// idles on a readback, and the job system writes it out as a binary PPM off the GL thread; a
+// batch waits for the writers rather than dropping an image. The window stays hidden and the UI
+// is never drawn; at the end the images per second, the headline number of a batch, are printed.
+// Native only.
+//
+//   --render-size WxH   Image size, BATCH_RENDER_DEFAULT_SIZE square by default
+//   --render-frames N   Frames per job, the last one saved; more let TAA and texture streaming
+//                       settle. 1 by default, which turns TAA off.
+//   --egl               Creates the context through EGL instead of GLX, for GPU servers whose
+//                       driver only offers EGL. GLFW still needs a display (Xvfb will do).
+class BatchRender {
+public:
+    // A batch option at argv[i]: how many arguments it took, 0 when it isn't one, -1 on a bad
+    // value after printing why
+    int parseArg(int argc, char** argv, int i);
+
+    bool active() const { return enabled; }
+    bool egl() const { return use_egl; }
+    int width() const { return image_width; }
+    int height() const { return image_height; }
+
+    // Once the scene is loaded: opens the jobs and makes the target. False when it can't run.
+    bool start();
+    // The fixed step of a batch frame
+    float beginFrame() const;
+    // Puts the camera where the current job wants it
+    void moveCamera(Camera& camera) const;
+    // Where the post pass draws instead of the window
+    GLuint outputFramebuffer() const { return target.framebuffer(); }
+    // After the post pass: saves the image on the job's last frame and moves to the next job
+    void endFrame();
+    bool finished() const { return done; }
+    // Waits for the queued images, prints the throughput and frees the target. False if an
+    // image couldn't be written.
+    bool finish();
+
+private:
+    bool nextJob();
+
+    bool enabled = false;
+    bool use_egl = false;
+    std::string jobs_file;
+    std::ifstream jobs_stream;
+    int image_width = BATCH_RENDER_DEFAULT_SIZE;
+    int image_height = BATCH_RENDER_DEFAULT_SIZE;
+    int frames_per_job = 1;
+
+    BatchRenderJob job;
+    int job_frame = 0;
+    int line_number = 0;
+    bool done = false;
+
+    ViewTarget target;
+    FrameReadback readback;
+    std::atomic<int> written{0};
+    std::atomic<int> failed{0};
+    int rendered = 0;
+    double start_seconds = 0.0;
+};
+
+extern BatchRender batch_render;
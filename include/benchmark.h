@@ -0,0 +1,111 @@
+#pragma once
+
+#include "camera.h"
+#include "profiler.h"
+#include "renderer.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+#define BENCHMARK_STEP (1.0f / 60.0f)  // Simulated seconds per frame, whatever the frame took
+#define BENCHMARK_WARMUP_FRAMES 120    // Rendered first at the path's start and not measured
+#define CAMERA_RECORD_INTERVAL 0.1f    // Seconds between recorded keys
+
+// A camera path for benchmark runs, one key per line: "time x y z yaw pitch" in seconds and
+// degrees, '#' starts a comment. Keys are splined through (Catmull-Rom), so a few hand-placed
+// ones and a dense recording both play back smoothly.
+struct CameraPathKey {
+    float time = 0.0f;
+    glm::vec3 position = glm::vec3(0.0f);
+    float yaw = -90.0f;
+    float pitch = 0.0f;
+};
+
+class CameraPath {
+public:
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+
+    // Keys go in time order
+    void add(float time, const Camera& camera);
+    // Pose at time seconds from the first key, held at the ends
+    void apply(float time, Camera& camera) const;
+    float duration() const { return keys.empty() ? 0.0f : keys.back().time - keys.front().time; }
+    bool empty() const { return keys.empty(); }
+
+private:
+    std::vector<CameraPathKey> keys;
+};
+
+// --benchmark <scene> <path> runs a built-in scene, forest or stress, through a camera path at
+// fixed simulation steps, with no input and in a hidden window, then writes mean, p50, p95, p99
+// and max of every frame's wall, CPU and GPU time, of every profiler scope and of the RenderStats
+// counters. The output is JSON, or CSV when its name ends in .csv. --record-path <path> saves the camera of an
+// interactive session as a path instead, res/benchmark/forest_flythrough.path is a hand-made one.
+// The stress scene takes the --stress options of stress_scene.h, 10k instances by default.
+// Native only.
+//
+//   --frames N        Measured frames, the path's length at BENCHMARK_STEP by default
+//   --warmup N        Unmeasured frames first, BENCHMARK_WARMUP_FRAMES by default
+//   --output <file>   benchmark.json by default
+class Benchmark {
+public:
+    // A benchmark option at argv[i]: how many arguments it took, 0 when it isn't one, -1 on a
+    // bad value after printing why
+    int parseArg(int argc, char** argv, int i);
+    // Once every option is parsed, false on a combination it can't run after printing why
+    bool validate() const;
+
+    bool active() const { return enabled; }
+    bool recording() const { return !record_path.empty(); }
+    const std::string& scene() const { return scene_name; }
+
+    // Once the scene is loaded. Loads the path and makes the run reproducible: profiler on,
+    // resolution fixed. False when it can't run.
+    bool start();
+    // After gpu_queries.beginFrame(), the fixed step that replaces the measured frame time
+    float beginFrame();
+    // Puts the camera where the path is this frame, instead of the keyboard
+    void moveCamera(Camera& camera) const;
+    // After the frame's swap, with the counters it left behind
+    void endFrame(const Renderer::RenderStats& stats);
+    // Measured frames done and their GPU times collected
+    bool finished() const { return frame >= warmup_frames + measured_frames + GPU_QUERY_FRAMES; }
+    // The statistics to the output file, false when it can't or the run didn't finish
+    bool write() const;
+
+    // Appends the interactive camera every CAMERA_RECORD_INTERVAL seconds
+    void recordCamera(float frame_time, const Camera& camera);
+    bool saveRecording() const;
+
+private:
+    // A metric's per-frame values over the measured frames
+    using Samples = std::vector<double>;
+
+    void profiledFrame(const FrameProfiler::Frame& profiled);
+
+    bool enabled = false;
+    std::string scene_name;
+    std::string path_file;
+    std::string output_file = "benchmark.json";
+    std::string gl_renderer;
+    CameraPath path;
+    int measured_frames = 0;
+    int warmup_frames = BENCHMARK_WARMUP_FRAMES;
+    int frame = 0; // Frames ended so far, warmup included
+    uint64_t first_gpu_frame = UINT64_MAX; // gpu_queries.frame() of the first measured frame
+    double last_frame_end = -1.0; // Seconds, steady clock
+
+    Samples wall_ms, cpu_ms, gpu_ms;
+    std::map<std::string, Samples> scope_cpu_ms, scope_gpu_ms; // By profiler scope name
+    std::vector<Samples> counters; // In the order of the counter table
+    int gpu_frames_missing = 0;
+
+    std::string record_path;
+    CameraPath recorded;
+    float record_time = 0.0f;
+    float record_next = 0.0f;
+};
+
+extern Benchmark benchmark;
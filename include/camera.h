@@ -18,6 +18,7 @@ typedef struct {
     float far_plane;
     float speed_multiplier;
     float friction;
+    glm::vec2 jitter; // Sub-pixel offset in NDC, moves the image without moving the camera (TAA)
 } Camera;
 
 inline Camera create_camera(float aspect) {
@@ -35,6 +36,7 @@ inline Camera create_camera(float aspect) {
     cam.far_plane = 200.0f; 
     cam.speed_multiplier = 0.5f;
     cam.friction = 0.9f;
+    cam.jitter = glm::vec2(0.0f);
     return cam;
 }
 
@@ -49,7 +51,11 @@ inline void camera_update_vectors(Camera* cam) {
 }
 
 inline glm::mat4 camera_get_projection(Camera* cam) {
-    return glm::perspective(cam->fov, cam->aspect_ratio, cam->near_plane, cam->far_plane);
+    glm::mat4 projection = glm::perspective(cam->fov, cam->aspect_ratio, cam->near_plane, cam->far_plane);
+    // Clip w is -z, so the z column shifts NDC by minus what it holds
+    projection[2][0] -= cam->jitter.x;
+    projection[2][1] -= cam->jitter.y;
+    return projection;
 }
 
 inline glm::mat4 camera_get_view_matrix(Camera* cam) {
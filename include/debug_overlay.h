@@ -0,0 +1,41 @@
+#pragma once
+
+#include "imgui.h"
+#include <vector>
+
+#define DEBUG_OVERLAY_MAX_HZ 120.0f
+
+// The debug windows rebuilt at debug_overlay_hz instead of every frame, the frames between
+// drawing a copy of the last build's vertices. Building them walks the renderer's stats and
+// every open window's widgets, which on big scenes cost enough CPU to move the frame times they
+// show. Input only reaches the windows on rebuilds. 0 rebuilds every frame.
+extern float debug_overlay_hz;
+
+// GL thread only.
+class DebugOverlay {
+public:
+    DebugOverlay() = default;
+    ~DebugOverlay();
+
+    DebugOverlay(const DebugOverlay&) = delete;
+    DebugOverlay& operator=(const DebugOverlay&) = delete;
+
+    // Whether to build the windows this frame, between ImGui::NewFrame() and ImGui::Render().
+    // now in seconds.
+    bool due(double now);
+    // After ImGui::Render() when rebuilt, draws its data and keeps a copy. Otherwise draws the
+    // copy, or nothing without one.
+    void present(bool rebuilt);
+    // Drops the copy, the next due() rebuilds
+    void invalidate();
+
+    int rebuilds() const { return rebuild_count; } // Since startup
+
+private:
+    ImDrawData cached;
+    std::vector<ImDrawList*> lists; // Owned clones cached points at
+    double last_build = 0.0;
+    int rebuild_count = 0;
+};
+
+extern DebugOverlay debug_overlay;
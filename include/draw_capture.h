@@ -0,0 +1,103 @@
+#pragma once
+
+#include "camera.h"
+#include "draw_list.h"
+#include "gpu_queries.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class Mesh;
+
+#define DRAW_REPLAY_REPEAT 10  // Issues of the captured draws per frame, unless told otherwise
+#define DRAW_REPLAY_FRAMES 120 // Frames timed before the summary and exit
+
+// Render-command capture and replay, to tell GPU regressions from CPU ones. F11 writes the next
+// frame's opaque main-pass draws, as culling and batching left them, to draws_frame<N>.bin: the
+// camera, then per draw the model path, sub-mesh and LOD that find its mesh again, its shading
+// tier and its instances' transforms and fades. --replay-draws <file> [repeat] loads the usual
+// scene, holds the captured camera, and every frame issues the captured draws `repeat` times
+// after the opaque pass, between two GPU timestamps. After DRAW_REPLAY_FRAMES it prints the
+// replay's GPU times and exits. Draws and bound state are the same from run to run, so a change
+// in those times comes from shaders or GL state, not from culling or batching.
+// Only meshes mesh_registry knows are captured (not the stress scene's variants), and only the
+// CPU-listed path (not GPU culling). Timestamps make the replay native only. GL thread only.
+class DrawCapture {
+public:
+    struct ReplayDraw {
+        std::shared_ptr<Mesh> mesh;
+        bool far_shading = false;
+        uint32_t first_instance = 0; // Into replayMatrices() and replayFades()
+        uint32_t instance_count = 0;
+    };
+
+    // --replay-draws at argv[i]: how many arguments it took, 0 when it isn't one, -1 on a bad value
+    int parseArg(int argc, char** argv, int i);
+
+    // The next frame's list goes to path
+    void request(const std::string& path);
+    bool capturePending() const { return !capture_path.empty() && !replay_active; }
+    // Renderer, once the opaque list is uploaded. far_shading reads the tier back from a draw's state.
+    void capture(const DrawList& list, const std::function<bool(const DrawList::Draw&)>& far_shading);
+    // After the frame rendered: writes what capture() took, seen from camera
+    void endFrame(const Camera& camera);
+
+    bool replayRequested() const { return !replay_path.empty(); }
+    // Once the scene is loaded: reads the file and finds its meshes. False when it can't replay.
+    bool startReplay(Camera& camera);
+    bool replaying() const { return replay_active; }
+    // Holds the captured camera instead of the keyboard
+    void moveCamera(Camera& camera) const;
+
+    const std::vector<ReplayDraw>& replayDraws() const { return draws; }
+    const std::vector<glm::mat4>& replayMatrices() const { return matrices; }
+    const std::vector<float>& replayFades() const { return fades; }
+    int repeatCount() const { return repeat; }
+
+    // Renderer, around the repeated submits
+    void beginReplay();
+    void endReplay();
+    // After gpu_queries.beginFrame(), takes the replay times that came back
+    void collect();
+    // Replayed frames done and their times collected
+    bool finished() const { return replay_active && frames_replayed >= DRAW_REPLAY_FRAMES + GPU_QUERY_FRAMES; }
+    // The summary to the console, false when a replay ran but timed nothing
+    bool report() const;
+
+private:
+    struct Pending {
+        uint64_t frame;
+        int begin, end; // Timestamp indices
+    };
+
+    bool write(const std::string& path, const Camera& camera) const;
+
+    // The capture or the replay
+    glm::vec3 camera_position = glm::vec3(0.0f);
+    float camera_yaw = 0.0f, camera_pitch = 0.0f;
+    std::vector<std::string> models;
+    struct CapturedDraw {
+        uint32_t model, submesh, lod; // LOD 0 is the mesh itself, n its lods[n - 1]
+        uint32_t far_shading;
+        uint32_t instance_count;
+    };
+    std::vector<CapturedDraw> captured;
+    std::vector<ReplayDraw> draws;
+    std::vector<glm::mat4> matrices;
+    std::vector<float> fades;
+
+    std::string capture_path;
+    bool captured_this_frame = false;
+
+    std::string replay_path;
+    int repeat = DRAW_REPLAY_REPEAT;
+    bool replay_active = false;
+    int frames_replayed = 0;
+    int begin_timestamp = -1;
+    std::vector<Pending> pending;
+    std::vector<double> replay_ms;
+};
+
+extern DrawCapture draw_capture;
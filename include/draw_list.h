@@ -0,0 +1,177 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include "instance_ring.h"
+#include "mesh_pool.h"
+#include "vertex_pulling.h"
+#include "meshlets.h"
+
+class Mesh;
+
+// Submit passes through glMultiDrawElementsIndirect when the driver has it (GL 4.3)
+extern bool use_multi_draw_indirect;
+// Batches above this many instances are split into several draws of the same state, 0 = never.
+// Some drivers (mostly WebGL2 on mobile) degrade on very large instance counts per draw.
+extern int max_instances_per_draw;
+
+#define DRAW_JOB_GRAIN 4096          // Packets per job_system range in upload()'s parallel steps
+#define DRAW_PARALLEL_SORT_MIN 16384 // Fewer packets sort on the calling thread
+#define DRAW_SORT_MAX_CHUNKS 16
+
+// The vertex streams a DrawList's draws read
+enum DrawStream {
+    DRAW_STREAM_FULL,   // The interleaved vertices
+    DRAW_STREAM_DEPTH,  // Position and UV only (use_depth_streams), for the prepass
+    DRAW_STREAM_SHADOW, // The same with quantized positions where meshes have them, shadow casters only
+};
+
+// Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// One pass's instanced draws, queued as one packet per instance. upload() radix-sorts the packets
+// by a 64-bit key (state, cull mode, VAO, index type, mesh, quantized depth), merges runs of the
+// same mesh and state into instanced draws, and packs every instance straight into one reservation
+// in the frame's instance ring, a slice per VAO, each draw addressing its part of the slice through
+// a base instance. Key building, the sort and the packing spread over job_system for large lists.
+// Packets carry the mesh's mesh_pool handle, so everything past add() reads the pool's dense
+// records rather than the Mesh objects; meshes without a record are skipped. submit() then
+// issues consecutive draws sharing state and VAO as one multi-draw, or as a loop of base-vertex
+// draws on GL 3.3 / WebGL2 (base instance as an attribute offset when the driver lacks it).
+// Depth streams whose meshes are all in the vertex pulling pool (vertex_pulling.h) instead pack
+// their instances into the list's own storage buffer and draw every run of one state as a single
+// glMultiDrawArraysIndirect, whatever VAO or index type the meshes have.
+// An instance added with meshlet ranges (meshlets.h) is a draw of its own that issues one
+// command per range, so only its visible clusters are drawn.
+// GL thread only, apart from recordParallel()'s jobs, which only ever see their own Recorder.
+class DrawList {
+public:
+    struct Draw {
+        Mesh* mesh = nullptr;
+        MeshHandle handle = MESH_HANDLE_NULL; // The mesh's record, which sorting and submitting read
+        const void* state = nullptr; // Pass-defined, e.g. the material or albedo texture
+        int cull_mode = 0;
+        uint32_t first_instance = 0; // Into the VAO's slice
+        uint32_t instance_count = 0;
+        uint32_t first_packet = 0;   // Into the sorted packets
+        const MeshletRange* ranges = nullptr; // The instance's visible clusters, null for the whole mesh
+        uint32_t range_count = 0;
+        uint32_t index_count = 0;    // Per instance, of the ranges when it has them
+        uint32_t first_command = 0;  // Into the indirect commands, one per range or one
+        uint32_t command_count = 0;
+    };
+
+    struct PacketSource {
+        MeshHandle mesh;
+        const void* state;
+        uint32_t state_id;
+        float depth;
+        const MeshletRange* ranges;
+        uint32_t range_count;
+    };
+
+    // Packets one recordParallel() job queued, appended to the list once every job is done
+    class Recorder {
+    public:
+        void add(Mesh* mesh, const void* state, uint32_t state_id, const glm::mat4& matrix, float fade, float depth = 0.0f,
+                 const MeshletRange* ranges = nullptr, uint32_t range_count = 0);
+
+    private:
+        friend class DrawList;
+        void clear();
+
+        std::vector<PacketSource> sources;
+        std::vector<glm::mat4> matrices;
+        std::vector<float> fades;
+        float max_depth = 0.0f;
+    };
+
+    DrawList() = default;
+    ~DrawList();
+
+    DrawList(const DrawList&) = delete;
+    DrawList& operator=(const DrawList&) = delete;
+
+    void clear();
+    // state_id orders the states (e.g. a material index or texture name), equal ids must mean
+    // equal state. depth sorts the instances of a draw front to back, any unit. ranges, when
+    // given, are the only parts of the mesh this instance draws (cullMeshlets()); they must stay
+    // valid until submit(), and are only honoured on the multi-draw and base instance paths.
+    void add(Mesh* mesh, const void* state, uint32_t state_id, const glm::mat4& matrix, float fade, float depth = 0.0f,
+             const MeshletRange* ranges = nullptr, uint32_t range_count = 0);
+    // Records count items across the job system, grain per job. Each job adds its range's
+    // packets through its own Recorder, so record must not touch the list or anything else
+    // shared. The packets land as if add() had been called in item order.
+    void recordParallel(size_t count, size_t grain, const std::function<void(size_t begin, size_t end, Recorder& recorder)>& record);
+
+    // Sorts and merges the packets, then writes instances to instance_ring and uploads the
+    // indirect commands. Submit within the same frame. stream is what submit() then draws from;
+    // the depth streams are for passes whose programs read only the position and UV, and
+    // DRAW_STREAM_SHADOW folds each quantized mesh's dequantization into its instance transforms.
+    void upload(DrawStream stream = DRAW_STREAM_FULL);
+
+    // apply_state runs before the first draw and whenever the state or cull mode changes.
+    // Returns the number of GL draw calls issued.
+    int submit(const std::function<void(const Draw&)>& apply_state);
+    // Whether the last upload() took the pulled path, apply_state then has to use pulled programs
+    bool pulling() const { return pulled; }
+
+    const std::vector<Draw>& getDraws() const { return draws; }
+
+    struct Packet {
+        uint64_t key;
+        uint32_t instance; // Into the staging arrays below
+    };
+    // upload()'s sort, by key, stable. Large arrays sort across job_system.
+    static void radixSort(std::vector<Packet>& packets, std::vector<Packet>& scratch);
+
+    // A draw's instances in the order upload() laid them out, until the next upload()
+    const glm::mat4& instanceMatrix(const Draw& draw, uint32_t instance) const;
+    float instanceFade(const Draw& draw, uint32_t instance) const;
+
+private:
+    void uploadPulled();
+    int submitPulled(const std::function<void(const Draw&)>& apply_state);
+
+    // Instances of one VAO, laid out in draw order
+    struct Segment {
+        GLuint instance_vbo = 0; // The VAO's own buffers, pointed back at after drawing
+        GLuint fade_vbo = 0;
+        uint32_t count = 0;
+        uint32_t base = 0; // Into the list's reservation
+        InstanceRing::Range range;
+    };
+
+    std::vector<Draw> draws;
+    DrawStream stream = DRAW_STREAM_FULL; // Of the last upload()
+    std::vector<PacketSource> packet_sources;
+    std::vector<Packet> packets, sort_scratch;
+    std::vector<uint32_t> slots; // Per sorted packet, its instance in the reservation
+    std::vector<glm::mat4> staged_matrices;
+    std::vector<float> staged_fades;
+    float max_depth = 0.0f;
+    std::unordered_map<GLuint, Segment> segments;
+    std::vector<DrawElementsIndirectCommand> commands;
+    bool commands_uploaded = false; // By the last upload(), for submit() to take the multi-draw path
+    std::vector<Recorder> recorders; // One per recordParallel() range, reused across frames
+
+    GLuint indirect_buffer = 0;
+
+    // The pulled path: instances in draw order, the fade in normal_scale[3] as a half
+    bool pulled = false; // Of the last upload()
+    std::vector<InstanceTransform> pulled_instances;
+    std::vector<DrawArraysIndirectCommand> pulled_commands;
+    GLuint pulled_instance_buffer = 0;
+    GLuint pulled_indirect_buffer = 0;
+};
@@ -3,9 +3,33 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_map>
+#include <mutex>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include "mesh.h"
+#include "aabb_tree.h"
+#include "render_prototype.h"
+
+struct Impostor;
+
+// Authored LOD distances are converted to screen sizes with this projection, so levels switch
+// where they were tuned at the default 45 degree, 600px-high window and adapt to anything else
+#define LOD_REFERENCE_FOV_DEGREES 45.0f
+#define LOD_REFERENCE_VIEWPORT_HEIGHT 600.0f
+
+// Pixels per world unit at distance 1 for a vertical fov (radians) and viewport height
+inline float lodProjectionScale(float fov, float viewportHeight) {
+    return viewportHeight / (2.0f * std::tan(fov * 0.5f));
+}
+
+// Projected diameter in pixels of a sphere at the given distance
+inline float lodScreenSize(float radius, float distance, float projectionScale) {
+    return 2.0f * radius * projectionScale / std::max(distance, radius);
+}
 
 struct Entity {
     std::string name;
@@ -15,31 +39,118 @@ struct Entity {
     std::vector<std::shared_ptr<Mesh>> meshes;
     int active;
 
-    // Dynamic LOD system
-    struct LODLevel {
-        std::vector<std::shared_ptr<Mesh>> meshes;
-        float maxDistance;  // Use this LOD up to this distance
-    };
-    
-    std::vector<LODLevel> lod_levels;
-
-    // Helper function to get appropriate LOD based on distance
-    const std::vector<std::shared_ptr<Mesh>>& getMeshesForDistance(float distance) const {
-        // Find the appropriate LOD level
-        for (const auto& level : lod_levels) {
-            if (distance <= level.maxDistance) {
-                return level.meshes;
-            }
+    // Dynamic LOD system, the levels shared with the other entities of its template
+    using LODLevel = RenderLODLevel;
+    uint32_t prototype = RENDER_PROTOTYPE_NONE; // See RenderPrototypes
+
+    const std::vector<LODLevel>& lodLevels() const { return render_prototypes.levels(prototype); }
+    // Projected bounding-sphere diameter in pixels the level needs, from its authored distance
+    float lodMinScreenSize(size_t level) const {
+        static const float referenceScale = lodProjectionScale(glm::radians(LOD_REFERENCE_FOV_DEGREES), LOD_REFERENCE_VIEWPORT_HEIGHT);
+        return lodScreenSize(getWorldRadius(), lodLevels()[level].maxDistance, referenceScale);
+    }
+
+    // Local-space bounds of the LOD0 meshes, the coarser levels lie within them.
+    // Radius 0 = no bounds, a 5-unit sphere is assumed. World-space copies live in EntityManager.
+    glm::vec3 bounds_center{0.0f};
+    float bounds_radius = 0.0f;
+    glm::vec3 bounds_min{0.0f}, bounds_max{0.0f};
+
+    // Chosen once per frame by Renderer::selectLODs() so every pass draws the same level
+    int current_lod = 0;
+    // Level the shadow views draw, chosen alongside current_lod (see selectShadowLOD())
+    int shadow_lod = 0;
+    // Casts from this level or a coarser one whatever the view draws, a cheap proxy for foliage
+    // and the like (-1 = none)
+    int shadow_proxy_lod = -1;
+
+    // Cross-fade from fade_from_lod to current_lod, lod_fade runs 0 -> 1 (-1 = no transition)
+    int fade_from_lod = -1;
+    float lod_fade = 1.0f;
+
+    // Calls fn(level, fade) for every level to draw this frame. fade is 0 for a plain draw, otherwise
+    // both levels are drawn with complementary screen-door masks: the incoming level gets +t and
+    // keeps pixels whose dither threshold is below t, the outgoing one gets -t and keeps the rest.
+    template <typename Fn>
+    void forEachLODLevel(Fn&& fn) const {
+        const std::vector<LODLevel>& lod_levels = lodLevels();
+        if (lod_levels.empty()) return;
+        const LODLevel& current = lod_levels[std::min<size_t>(current_lod, lod_levels.size() - 1)];
+        if (fade_from_lod < 0 || fade_from_lod >= (int)lod_levels.size() || fade_from_lod == current_lod) {
+            fn(current, 0.0f);
+            return;
+        }
+
+        // Never exactly 0, which would mean "not fading"
+        float t = std::min(std::max(lod_fade, 1.0f / 64.0f), 1.0f);
+        fn(current, t);
+        fn(lod_levels[fade_from_lod], -t);
+    }
+
+    // forEachLODLevel() flattened to fn(mesh, fade), impostor levels have no meshes
+    template <typename Fn>
+    void forEachLODMesh(Fn&& fn) const {
+        forEachLODLevel([&](const LODLevel& level, float fade) {
+            for (const auto& mesh : level.meshes) fn(mesh, fade);
+        });
+    }
+
+    const std::vector<std::shared_ptr<Mesh>>& getCurrentLODMeshes() const {
+        const std::vector<LODLevel>& lod_levels = lodLevels();
+        if (lod_levels.empty()) {
+            static std::vector<std::shared_ptr<Mesh>> empty;
+            return empty;
         }
-        
-        // If beyond all LOD ranges, use the lowest detail (last one)
-        if (!lod_levels.empty()) {
-            return lod_levels.back().meshes;
+        return lod_levels[std::min<size_t>(current_lod, lod_levels.size() - 1)].meshes;
+    }
+
+    const std::vector<std::shared_ptr<Mesh>>& getShadowLODMeshes() const {
+        const std::vector<LODLevel>& lod_levels = lodLevels();
+        if (lod_levels.empty()) {
+            static std::vector<std::shared_ptr<Mesh>> empty;
+            return empty;
         }
-        
-        // Fallback to empty (shouldn't happen)
-        static std::vector<std::shared_ptr<Mesh>> empty;
-        return empty;
+        return lod_levels[std::min<size_t>(shadow_lod, lod_levels.size() - 1)].meshes;
+    }
+
+    float getWorldRadius() const {
+        float radius = bounds_radius > 0.0f ? bounds_radius : 5.0f;
+        return radius * std::max(std::abs(scale.x), std::max(std::abs(scale.y), std::abs(scale.z)));
+    }
+
+    // Hysteresis widens the band around the current level's boundaries (0.1 = 10%)
+    int pickLOD(float screenSize, float hysteresis, int current) const {
+        const std::vector<LODLevel>& lod_levels = lodLevels();
+        int target = (int)lod_levels.size() - 1;
+        for (size_t i = 0; i + 1 < lod_levels.size(); ++i) {
+            if (screenSize >= lodMinScreenSize(i)) { target = (int)i; break; }
+        }
+
+        // Only switch once the size is clearly past the boundary being crossed
+        current = std::min(current, (int)lod_levels.size() - 1);
+        if (target > current && screenSize >= lodMinScreenSize(current) * (1.0f - hysteresis)) {
+            target = current;
+        } else {
+            while (target < current && screenSize < lodMinScreenSize(target) * (1.0f + hysteresis)) ++target;
+        }
+        return target;
+    }
+
+    void selectLOD(float screenSize, float hysteresis) {
+        if (lodLevels().empty()) return;
+        current_lod = pickLOD(screenSize, hysteresis, current_lod);
+    }
+
+    // Call after selectLOD() with the shadow-biased screen size. Never finer than current_lod or
+    // the proxy, and never an impostor tier, which has nothing to cast with: the nearest mesh
+    // level stands in for it.
+    void selectShadowLOD(float screenSize, float hysteresis) {
+        const std::vector<LODLevel>& lod_levels = lodLevels();
+        if (lod_levels.empty()) return;
+        int target = std::max(pickLOD(screenSize, hysteresis, shadow_lod), std::max(current_lod, shadow_proxy_lod));
+        target = std::min(target, (int)lod_levels.size() - 1);
+        while (target > 0 && lod_levels[target].meshes.empty()) --target;
+        shadow_lod = target;
     }
     
     glm::mat4 getModelMatrix(Entity* entity) {
@@ -54,35 +165,273 @@ struct Entity {
     }
 };
 
+#define ENTITY_FLAG_ACTIVE 1
+#define ENTITY_FLAG_LIGHT_PROXY 2 // Drawn unlit by the light loop, skipped by the lit passes
+#define ENTITY_FLAG_TRANSFORM_DIRTY 4 // Local transform changed, world arrays are stale until updateTransforms()
+#define ENTITY_FLAG_WORLD_CHANGED 8   // Set during updateTransforms() so children know to follow
+#define ENTITY_FLAG_STATIC 16         // Never moves, drawn from baked chunks (see StaticBatches)
+#define ENTITY_FLAG_ANIMATED 32       // Moved by updateEntity() or setTransforms() since it was created
+
+// What EntityManager::query() selects on, derived from the flags and the entity's LOD levels
+#define ENTITY_COMPONENT_RENDERABLE 1u     // Has LOD levels and isn't a light proxy, the lit passes draw it
+#define ENTITY_COMPONENT_STATIC 2u         // See EntityManager::setStatic()
+#define ENTITY_COMPONENT_LIGHT_PROXY 4u    // See EntityManager::setLightProxy()
+#define ENTITY_COMPONENT_SHADOW_CASTER 8u  // Renderable with a level that has meshes, impostors cast nothing
+#define ENTITY_COMPONENT_ANIMATED 16u      // ENTITY_FLAG_ANIMATED
+#define ENTITY_COMPONENT_BLENDED 32u       // A level has blended meshes, sorted on the CPU
+
+#define ENTITY_NO_PARENT 0xffffffffu
+#define TRANSFORM_PROPAGATION_GRAIN 512 // Entities per parallelFor range in updateTransforms()
+
+// Stable reference to an entity, unaffected by compaction. Goes stale once the entity is removed
+// or the manager cleared, after which lookups return nullptr instead of whatever reuses the slot.
+struct EntityHandle {
+    uint32_t index = 0;      // Slot in the handle table, not the entity's position in the arrays
+    uint32_t generation = 0; // 0 = null handle
+
+    bool isNull() const { return generation == 0; }
+};
+
+// Local position, rotation (degrees) and scale
+struct EntityTransform {
+    glm::vec3 position{0.0f};
+    glm::vec3 rotation{0.0f};
+    glm::vec3 scale{1.0f};
+};
+
+// Parts of an EntityTransform setTransforms() writes, the others keep their values
+enum TransformComponents : uint8_t {
+    TRANSFORM_POSITION = 1,
+    TRANSFORM_ROTATION = 2,
+    TRANSFORM_SCALE = 4,
+    TRANSFORM_ALL = TRANSFORM_POSITION | TRANSFORM_ROTATION | TRANSFORM_SCALE,
+};
+
+// Read-only view of one of EntityManager's per-entity arrays
+template <typename T>
+struct EntitySpan {
+    const T* items = nullptr;
+    size_t count = 0;
+
+    const T& operator[](size_t i) const { return items[i]; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+    size_t size() const { return count; }
+};
+
 class EntityManager {
 private:
+    // Live entities only, compacted on removal so passes never walk dead ones
     std::vector<Entity> entities;
+
+    // Hot data as parallel arrays, [i] belongs to entities[i]. Passes stream these for culling
+    // and batching and only touch the Entity (names, mesh lists, LODs) once something survives.
+    std::vector<glm::mat4> world_matrices;
+    std::vector<glm::mat4> previous_world_matrices; // As of the last frame, for motion vectors
+    std::vector<glm::vec4> world_spheres; // xyz centre, w radius
+    std::vector<glm::vec3> world_mins;
+    std::vector<glm::vec3> world_maxs;
+    std::vector<uint8_t> flags;
+    std::vector<uint32_t> dense_slots; // Handle slot of entities[i]
+    std::vector<uint32_t> proxies;     // Leaf of entities[i] in spatial_tree
+    std::vector<uint32_t> parents;     // Handle slot of the parent, ENTITY_NO_PARENT for roots
+
+    // Hierarchy in breadth-first order, rebuilt when links or the layout change. Roots aren't
+    // listed; depth d + 1 is hierarchy_order[level_starts[d], level_starts[d + 1]), so every
+    // level only depends on the one before it and can be spread across workers.
+    std::vector<uint32_t> hierarchy_order;  // Dense indices
+    std::vector<uint32_t> hierarchy_parent; // Dense index of each one's parent
+    std::vector<size_t> level_starts;
+    bool hierarchy_dirty = false;
+    size_t parented_count = 0;
+    std::vector<uint32_t> dirty_roots; // Dense indices, the parented ones are found by the level walk
+    std::vector<uint32_t> moved;       // Dense indices whose world matrix the last updateTransforms() changed
+    std::mutex dirty_mutex;            // setTransforms() callers queueing into dirty_roots at once
+
+    // World AABBs of every entity, leaves carry the handle slot so compaction doesn't touch them.
+    // Static entities get their own tree, so passes drawing them from chunks never walk them.
+    AabbTree spatial_tree;
+    AabbTree static_tree;
+    uint64_t static_version = 0; // Bumped when a static entity is added, removed or moved
+
+    // Handles point here, compaction only rewrites the dense index
+    struct HandleSlot {
+        uint32_t dense = 0;
+        uint32_t generation = 0; // 0 = free
+    };
+    std::vector<HandleSlot> handle_slots;
+    std::vector<uint32_t> free_slots;
+
+    // Every add gets a fresh generation, so handles from before a clear() never match
+    uint32_t next_generation = 1;
+    // Names aren't unique (every tree is "tree"), each maps to its handle slots in creation order
+    std::unordered_map<std::string, std::vector<uint32_t>> name_index;
+    // Bumped whenever entities are added, removed or moved, which invalidates Entity pointers
+    uint64_t layout_version = 0;
+
+    // query() results by (all << 32 | none), valid while their version is structure_version
+    struct CachedQuery {
+        std::vector<uint32_t> indices;
+        uint64_t version = 0;
+    };
+    std::unordered_map<uint64_t, CachedQuery> query_cache;
+    // Bumped by anything a query selects on: the layout, the static and light proxy flags,
+    // parenting, an entity's first move and mesh reloads
+    uint64_t structure_version = 1;
+
+    // Drops inactive entities, moving the live ones down in order and releasing their handles
+    void compact();
+
+    // Recomputes the arrays and tree leaf right away, for entities being added
+    void refreshTransform(size_t index);
+    // World matrix and bounds of one entity, touches nothing else so workers can run it in parallel
+    void computeWorld(size_t index, const glm::mat4* parent_world);
+    void markDirty(size_t index);
+    AabbTree& treeOf(size_t index) { return (flags[index] & ENTITY_FLAG_STATIC) ? static_tree : spatial_tree; }
+    void rebuildHierarchy();
     
 public:
-    size_t addEntity(Entity&& entity);
-    int findEntity(std::string name);
-    bool updateEntity(std::string name, const glm::vec3& pos, const glm::vec3& rot, const glm::vec3& scale);
+    // Static entities go straight into the static tree, see setStatic()
+    EntityHandle addEntity(Entity&& entity, bool is_static = false);
+    // Grows every per-entity array ahead of a bulk add
+    void reserve(size_t count);
+    // Name lookups go through a hash index, but per-frame code should keep the handle
+    int findEntity(const std::string& name) const;
+    EntityHandle findHandle(const std::string& name) const;
+    bool updateEntity(const std::string& name, const glm::vec3& pos, const glm::vec3& rot, const glm::vec3& scale);
+    bool updateEntity(EntityHandle handle, const glm::vec3& pos, const glm::vec3& rot, const glm::vec3& scale);
     void updateEntity(size_t index, const glm::vec3& pos, const glm::vec3& rot, const glm::vec3& scale);
+    // Batch form for many movers a frame: entity k takes the components in mask from
+    // transforms[k], stale handles are skipped. Jobs may call it at once for disjoint entities,
+    // each call takes one lock to queue its dirty roots. Nothing else may touch the manager
+    // meanwhile. Returns the entities written.
+    size_t setTransforms(const EntityHandle* handles, const EntityTransform* transforms, size_t count, uint8_t mask = TRANSFORM_ALL);
+
+    // The child's position, rotation and scale become relative to the parent. A null parent
+    // detaches it. Fails on stale handles and on links that would form a cycle. Children of a
+    // removed entity become roots, keeping their local transform.
+    bool setParent(EntityHandle child, EntityHandle parent);
+    EntityHandle getParent(EntityHandle child) const;
+
+    // Brings the world arrays up to date after updateEntity()/setParent(), parents before
+    // children. Only dirty entities and their descendants are recomputed. Call once per frame
+    // before anything reads worldMatrices() or the spatial queries.
+    void updateTransforms();
     size_t size() const;
     Entity* getEntityAt(size_t index);
+    Entity* get(EntityHandle handle);
+    // Marks the entity as a light's visible proxy, set once when the light is created
+    void setLightProxy(EntityHandle handle);
+    // Marks scenery that never moves, right after creation. Refused for light proxies and
+    // entities with blended meshes, which need per-entity sorting.
+    bool setStatic(EntityHandle handle);
+    uint64_t staticVersion() const { return static_version; }
+    bool isValid(EntityHandle handle) const {
+        return !handle.isNull() && handle.index < handle_slots.size() && handle_slots[handle.index].generation == handle.generation;
+    }
+    uint64_t layoutVersion() const { return layout_version; }
+    // A resident model's meshes were reloaded in place: everything baked from them (static
+    // chunks, GPU culling tables, cached shadows) is rebuilt
+    void meshesReloaded() {
+        static_version++;
+        layout_version++;
+        structure_version++;
+    }
+
+    // Dense indices of the active entities with every component in all and none of those in
+    // none, ascending, so a system walks exactly its entities through the hot arrays instead of
+    // scanning and filtering all of them. Each distinct query is cached and only rebuilt after a
+    // structural change (see structure_version), not per frame. GL thread only; the span lasts
+    // until the next structural change.
+    EntitySpan<uint32_t> query(uint32_t all, uint32_t none = 0);
+    // The EntityComponent bits of the entity at an index
+    uint32_t componentsOf(size_t index) const;
+
+    // Indices (for getEntityAt() and the arrays) of the entities whose world AABB may touch the
+    // frustum or box, in ascending order. Candidates only: fattened tree boxes let a few extra
+    // through, so callers still run their exact test. Any thread may query, several at once,
+    // while nothing modifies the manager.
+    void queryFrustum(const Frustum& frustum, std::vector<uint32_t>& out, bool include_static = true) const;
+    void queryBox(const glm::vec3& bmin, const glm::vec3& bmax, std::vector<uint32_t>& out) const;
+    // Candidates along a ray as (distance it enters the fattened box, index), nearest first
+    void queryRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance,
+                  std::vector<std::pair<float, uint32_t>>& out, bool include_static = true) const;
+    void clear();
+    // The world origin moved by delta (world_origin.h): every root moves by -delta and the
+    // children follow. The world and previous matrices move with them, so nothing reads as
+    // motion; static entities rebake their chunks.
+    void shiftOrigin(const glm::vec3& delta);
     
     template <typename Pred>
     void removeEntities(Pred&& pred);
+
+    EntitySpan<glm::mat4> worldMatrices() const { return { world_matrices.data(), world_matrices.size() }; }
+    // Each entity's world matrix a frame ago, equal to worldMatrices() for those that didn't move.
+    // Added entities start at rest, and compaction brings every mover to rest.
+    EntitySpan<glm::mat4> previousWorldMatrices() const { return { previous_world_matrices.data(), previous_world_matrices.size() }; }
+    // The entities whose previous and current world matrices differ
+    EntitySpan<uint32_t> movedEntities() const { return { moved.data(), moved.size() }; }
+    EntitySpan<glm::vec4> worldSpheres() const { return { world_spheres.data(), world_spheres.size() }; }
+    EntitySpan<glm::vec3> worldMins() const { return { world_mins.data(), world_mins.size() }; }
+    EntitySpan<glm::vec3> worldMaxs() const { return { world_maxs.data(), world_maxs.size() }; }
+    EntitySpan<uint8_t> entityFlags() const { return { flags.data(), flags.size() }; }
+
+    // Index into the arrays for an entity pointer from getEntityAt(), or for a valid handle
+    size_t indexOf(const Entity* entity) const { return (size_t)(entity - entities.data()); }
+    size_t indexOf(EntityHandle handle) const { return handle_slots[handle.index].dense; }
+    // The handle of the entity at an index into the arrays
+    EntityHandle handleAt(size_t index) const { return { dense_slots[index], handle_slots[dense_slots[index]].generation }; }
 };
 
 extern EntityManager entity_manager;
 
-void createEntity(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs, glm::vec3 pos, glm::vec3 rotation, glm::vec3 scale, std::vector<int> cull_modes);
+// Everything createEntities() shares between the instances it spawns
+struct EntityTemplate {
+    std::string name;
+    std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>> lod_specs;
+    std::vector<int> cull_modes; // Per mesh index, missing ones are CULL_NONE
+    // Per mesh index, replaces the material in every level (null keeps the LOD0 one)
+    std::vector<const Material*> material_overrides;
+    std::shared_ptr<Impostor> impostor; // Extra level past the last spec's distance
+    bool is_static = false;             // See EntityManager::setStatic()
+    int shadow_proxy_lod = -1;          // See Entity::shadow_proxy_lod
+};
+
+// The template's meshes are set up once (materials, cull modes, bounds), then each transform
+// gets its own entity. Storage is reserved up front and only a summary is logged.
+std::vector<EntityHandle> createEntities(const EntityTemplate& entity_template, const EntityTransform* transforms, size_t count);
+inline std::vector<EntityHandle> createEntities(const EntityTemplate& entity_template, const std::vector<EntityTransform>& transforms) {
+    return createEntities(entity_template, transforms.data(), transforms.size());
+}
+
+// Entities for a model imported with node instancing (MeshNodeInstance), each node's placement
+// under root. entity_template's specs, cull modes and overrides are indexed by sub-mesh as for
+// the flat model; every sub-mesh's placements are created together from it narrowed to that
+// sub-mesh, so they share its geometry and draw as one instanced batch. A placement's shear is
+// dropped, entities only take position, rotation and scale.
+std::vector<EntityHandle> createNodeEntities(const EntityTemplate& entity_template, const std::vector<MeshNodeInstance>& instances,
+                                             const EntityTransform& root);
+
+// impostor, when given, becomes an extra level past the last spec's distance
+EntityHandle createEntity(const std::string& name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs, glm::vec3 pos, glm::vec3 rotation, glm::vec3 scale, const std::vector<int>& cull_modes,
+                  std::shared_ptr<Impostor> impostor = nullptr);
+
+// LOD specs built from each mesh's generated chain (Mesh::lods): level i draws lods[i - 1], or the
+// coarsest one available. Levels no mesh has are folded into the last real one.
+std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>> generatedLODSpecs(const std::vector<std::shared_ptr<Mesh>>& meshes, const std::vector<float>& distances);
 
 // Template implementation must be in header
 template <typename Pred>
 void EntityManager::removeEntities(Pred&& pred) {
     extern unsigned int total_triangles;
-    for (Entity& entity : entities) {
+    bool removed = false;
+    for (size_t i = 0; i < entities.size(); ++i) {
+        Entity& entity = entities[i];
         if (entity.active && pred(entity)) {
             for (const auto& mesh : entity.meshes) total_triangles -= mesh->TRIANGLE_COUNT;
-            entity.meshes.clear();
             entity.active = false;
+            removed = true;
         }
     }
+    if (removed) compact();
 }
\ No newline at end of file
@@ -2,10 +2,44 @@
 
 #include <string>
 #include <filesystem>
+#include <cstddef>
+#include <cstdint>
 
 // Filesystem operations
 std::filesystem::path getExecutablePath();
 std::string buildAssetPath(const std::string& relative_path);
 std::string resolveTexturePath(const std::string& modelPath, const std::string& textureName);
 
-extern std::filesystem::path executable_path;
\ No newline at end of file
+// Returns 0 if the file doesn't exist, packed files give the time they were packed with
+int64_t getFileModifiedTime(const std::string& path);
+
+extern std::filesystem::path executable_path;
+
+// Read-only memory-mapped view of a file (falls back to a heap copy where mmap isn't available).
+// Files in the open asset pack are views into it, see asset_pack.h.
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path) { open(path); }
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return data_ptr != nullptr; }
+    const unsigned char* data() const { return data_ptr; }
+    size_t size() const { return data_size; }
+
+private:
+    const unsigned char* data_ptr = nullptr;
+    size_t data_size = 0;
+    bool heap_copy = false;
+    bool borrowed = false; // Points into the asset pack
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
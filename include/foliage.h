@@ -0,0 +1,195 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class Mesh;
+class Shader;
+class GeometryArena;
+struct Impostor;
+struct Frustum;
+
+extern bool use_foliage;               // Off skips every layer, they stay scattered
+extern bool use_gpu_foliage_culling;   // Per-instance culling in a compute pass where GpuCulling::supported()
+extern float foliage_wind_strength;    // Scales every layer's bend, 0 stills them
+extern glm::vec2 foliage_wind_direction; // World xz, normalised when used
+
+#define FOLIAGE_CELL_SIZE 16.0f        // Metres along a cell's side, the unit of the CPU culling and tiers
+#define FOLIAGE_MAX_SCALE 4.0f         // Instance scales are stored as a fraction of it
+#define FOLIAGE_MAX_TIERS 4            // Mesh levels plus the impostor, per layer. Matches foliage_cull.comp
+#define FOLIAGE_CULL_GROUP_SIZE 64     // Matches local_size_x in foliage_cull.comp
+
+// One scattered instance, 16 bytes where an entity's transform takes 60 in the instance buffers.
+// Foliage stands upright, so a yaw and a uniform scale are all the rotation and scale it gets.
+struct FoliageInstance {
+    glm::vec3 position{0.0f}; // Of the mesh's origin
+    uint16_t yaw = 0;         // Turns, unorm16
+    uint16_t scale = 0;       // Over FOLIAGE_MAX_SCALE, unorm16
+};
+static_assert(sizeof(FoliageInstance) == 16, "foliage.glsl and foliage_cull.comp read this layout");
+
+// What a layer scatters and how it draws. The density where both the map and the rule give 1,
+// scaled down by either where they give less.
+struct FoliageLayerDesc {
+    std::string name;
+    // Mesh levels finest first, each drawn out to its camera distance, like EntityTemplate::lod_specs
+    std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>> lod_specs;
+    std::vector<int> cull_modes;        // By mesh index within a level, missing ones keep the mesh's
+    std::shared_ptr<Impostor> impostor; // Past the last level, out to impostor_distance
+    float impostor_distance = 0.0f;
+    glm::vec2 area_min{0.0f}, area_max{0.0f}; // World xz scattered over, on the y = 0 ground
+    float density = 0.0f;               // Instances per square metre
+    std::string density_map;            // Greyscale image stretched over the area, optional
+    std::function<float(const glm::vec2&)> rule; // 0 to 1 by world xz, optional
+    float min_scale = 1.0f, max_scale = 1.0f;
+    float wind = 0.0f;                  // Metres the top leans at full foliage_wind_strength, 0 is rigid
+    bool casts_shadows = true;
+    uint32_t seed = 1;
+};
+
+// Grass and trees by the hundred thousand, none of them entities. Each layer is scattered once
+// into FOLIAGE_CELL_SIZE cells, a jittered grid per cell thinned by the density, and its compact
+// instances go up in one buffer, cell after cell. Per frame each cell picks a tier, a mesh level
+// or the impostor, from the camera distance to its box and is frustum tested; neighbouring cells
+// on the same tier draw as one instanced range. Where compute is available the camera view
+// instead culls and tiers every instance on the GPU into indirect commands, while the shadow
+// views keep to the cells. Meshes sway in the wind in the vertex shaders (foliage.glsl), the
+// impostor cards don't. Drawn forward after the deferred lighting like the skinned meshes, so
+// foliage isn't in the depth prepass, SSAO or Hi-Z, nor in picking or physics.
+// GL thread only, the scatter itself runs across the job system.
+class Foliage {
+public:
+    struct Draw {
+        Mesh* mesh = nullptr;
+        int cull_mode = 0;
+        uint32_t source = 0;  // Into sources
+        uint32_t command = 0; // Of the layer's indirect commands
+    };
+    // apply_state binds a mesh's program and state and returns the program, which gets the wind
+    using ApplyMesh = std::function<const Shader&(const Mesh& mesh, int cull_mode)>;
+    using ApplyImpostor = std::function<void(const Impostor& impostor)>;
+
+    Foliage() = default;
+    ~Foliage();
+
+    Foliage(const Foliage&) = delete;
+    Foliage& operator=(const Foliage&) = delete;
+
+    // Scatters and uploads a layer, false when it has no valid mesh or nothing landed
+    bool addLayer(const FoliageLayerDesc& desc);
+    void clear();
+
+    // Advances the wind and picks each cell's tier from the camera, before the shadow passes
+    void update(float dt, const glm::vec3& camera_position);
+    // Camera view: marks the cells in the frustum and gathers each tier's ranges, or with the
+    // compute path culls every instance for it
+    void cull(const Frustum& frustum, const glm::vec3& camera_position);
+
+    // The camera view's meshes and impostor cards. Return the GL draw calls.
+    int submit(const ApplyMesh& apply_state);
+    int submitImpostors(const ApplyImpostor& apply_state);
+    // The cells inside a shadow view at their tier's mesh level, the last one for impostor cells
+    int submitShadows(const Frustum& frustum, const ApplyMesh& apply_state);
+
+    // Every mesh a layer draws, so the renderer can register the materials
+    void forEachMesh(const std::function<void(const Mesh&)>& fn) const;
+
+    bool empty() const { return layers.empty(); }
+    size_t layerCount() const { return layers.size(); }
+    size_t instanceCount() const;
+    size_t cellCount() const;
+    size_t visibleCells() const;
+    bool gpuCulled() const { return gpu_culled; }
+    // The last submit()'s instances and triangles, CPU path only: the compute path's counts stay on the GPU
+    int drawnInstances() const { return drawn_instances; }
+    int drawnTriangles() const { return drawn_triangles; }
+
+private:
+    struct Tier {
+        std::vector<Draw> draws; // Empty for the impostor tier
+        Impostor* impostor = nullptr;
+        float end_distance = 0.0f;
+        uint32_t first_command = 0;
+    };
+    struct Cell {
+        glm::vec3 bmin{0.0f}, bmax{0.0f};
+        uint32_t first = 0, count = 0; // Instances
+        int tier = -1;                 // -1 past the last tier
+        bool visible = false;
+    };
+    struct Run {
+        uint32_t first = 0, count = 0;
+    };
+    struct Layer {
+        std::string name;
+        std::vector<Tier> tiers;
+        int mesh_tiers = 0;
+        std::vector<Cell> cells;
+        std::vector<std::vector<Run>> runs; // Per tier, this frame's visible cells
+        size_t instance_count = 0;
+        GLuint instance_vbo = 0;
+        glm::vec4 bounds{0.0f}; // Mesh-space centre and radius over every level, at scale 1
+        float height = 1.0f;    // Top of the finest level, where the bend is measured
+        float wind = 0.0f;
+        bool casts_shadows = true;
+        std::vector<std::shared_ptr<Mesh>> meshes; // Keeps the draws' meshes alive
+        std::shared_ptr<Impostor> impostor;
+
+        // The compute path's: tiers' regions of visible instances and their indirect commands
+        GLuint visible_vbo = 0;
+        GLuint command_buffer = 0;
+        GLuint command_template = 0; // Zero counts, copied over command_buffer before each cull
+        size_t command_bytes = 0;
+    };
+    // One vertex buffer (an arena, or a standalone mesh) behind a VAO of ours, whose slots 6 and
+    // 7 read foliage instances
+    struct Source {
+        GLuint vao = 0;
+        GLuint vbo = 0;
+        GLuint ebo = 0;
+        uint32_t vertex_format = 0;
+        std::shared_ptr<GeometryArena> arena;
+        std::shared_ptr<Mesh> mesh; // Standalone meshes only
+        GLuint instances = 0;       // What slots 6 and 7 point at
+        size_t first = 0;
+    };
+
+    uint32_t sourceFor(const std::shared_ptr<Mesh>& mesh);
+    void bindSource(Source& source, GLuint instances, size_t first);
+    void bindQuad(GLuint instances, size_t first);
+    bool gpuCullingReady();
+    void cullGpu(Layer& layer, const Frustum& frustum, const glm::vec3& camera_position);
+    int drawMeshes(const Layer& layer, const Tier& tier, const std::vector<Run>& runs, const ApplyMesh& apply_state, bool indirect);
+
+    std::vector<Layer> layers;
+    std::vector<Source> sources;
+    std::unordered_map<GLuint, uint32_t> source_index; // By vertex buffer
+    std::vector<std::vector<Run>> shadow_runs;
+
+    // The impostor cards: a quad of corners in slot 0, instances as the meshes have them
+    GLuint quad_vao = 0, quad_vbo = 0, quad_ebo = 0;
+    GLuint quad_instances = 0;
+    size_t quad_first = 0;
+
+    std::unique_ptr<Shader> cull_shader;
+    bool cull_shader_failed = false;
+    bool gpu_culled = false; // The last cull() went through compute
+
+    float wind_time = 0.0f;
+    int drawn_instances = 0;
+    int drawn_triangles = 0;
+};
+
+extern Foliage foliage;
+
+// A clump of crossed grass blades, segments quads up each blade, for grass layers without a
+// model. Its material is plain green. GL thread.
+std::shared_ptr<Mesh> createGrassMesh(int segments);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+#define FRAME_ARENA_BLOCK_BYTES (1024 * 1024)
+
+// Bump allocator for data that dies with the frame. Nothing is freed individually, reset() at
+// the end of the frame drops everything at once. A frame that outgrows the block spills into
+// extra blocks, which reset() merges into one big enough for it, so steady-state frames never
+// touch the general heap. Main thread only, and nothing from it may be kept across reset().
+class FrameArena {
+public:
+    FrameArena() = default;
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment);
+    void reset();
+
+    size_t bytesUsed() const { return used; }
+    size_t peakBytes() const { return peak; }
+    size_t capacity() const;
+
+private:
+    struct Block {
+        uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+
+    void addBlock(size_t min_bytes);
+
+    std::vector<Block> blocks;
+    size_t offset = 0; // Into blocks.back()
+    size_t used = 0;
+    size_t peak = 0;
+};
+
+extern FrameArena frame_arena;
+
+// STL adapter over frame_arena, deallocate is a no-op
+template <typename T>
+struct FrameAllocator {
+    using value_type = T;
+
+    FrameAllocator() noexcept = default;
+    template <typename U> FrameAllocator(const FrameAllocator<U>&) noexcept {}
+
+    T* allocate(size_t count) { return static_cast<T*>(frame_arena.allocate(count * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) noexcept {}
+
+    template <typename U> bool operator==(const FrameAllocator<U>&) const noexcept { return true; }
+    template <typename U> bool operator!=(const FrameAllocator<U>&) const noexcept { return false; }
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+template <typename K, typename V>
+using FrameMap = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>, FrameAllocator<std::pair<const K, V>>>;
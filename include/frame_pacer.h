@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <chrono>
+
+#define FRAME_PACER_MAX_IN_FLIGHT 3
+#define FRAME_PACER_SPIN_MS 1.5     // The cap sleeps until this close to the deadline, then spins
+#define FRAME_PACER_LATENCY_SMOOTHING 0.1f // Weight of each new sample in the latency average
+
+extern int max_frames_in_flight; // 1 to FRAME_PACER_MAX_IN_FLIGHT, 0 lets the driver queue as it likes
+extern float frame_rate_cap;     // Frames per second, 0 = uncapped
+
+// Keeps the CPU from running ahead of the GPU. Without vsync the driver queues frames for as
+// long as it's allowed, and every queued frame is input latency. endFrame() fences each frame
+// after its swap, and beginFrame() waits for the one max_frames_in_flight back before the next
+// frame reads any input. An optional frame rate cap then sleeps until shortly before the frame's
+// deadline and spins the rest, since sleeps overshoot by a millisecond or more.
+// The latency estimate is from the input poll a frame read until the pacer saw its fence signal:
+// it includes the queueing but not the scanout. Native only, the browser paces the web build.
+// GL thread only.
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    FramePacer() = default;
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    // Before the frame reads input
+    void beginFrame();
+    // Right after the swap
+    void endFrame();
+    // Right after glfwPollEvents(), the input the next frame reads
+    void inputPolled() { last_poll = Clock::now(); }
+
+    // --frames-in-flight <1-3>, --fps-cap <fps>. Returns the arguments taken, 0 if it isn't
+    // one, -1 on a bad value.
+    int parseArg(int argc, char** argv, int i);
+
+    float latencyMs() const { return latency_ms; }  // Smoothed, 0 until a frame was measured
+    float waitedMs() const { return waited_ms; }    // Blocked in the last beginFrame()
+    void release();
+
+private:
+    struct InFlight {
+        GLsync fence = nullptr;
+        Clock::time_point input; // The poll the frame read
+    };
+
+    // Retires fences that have signalled, waiting for the oldest too if more than keep are out
+    void retire(int keep);
+
+    InFlight frames[FRAME_PACER_MAX_IN_FLIGHT];
+    int oldest = 0, count = 0; // Ring of the frames in flight
+    Clock::time_point last_poll = Clock::now();
+    Clock::time_point frame_input = last_poll;
+    Clock::time_point deadline;
+    float latency_ms = 0.0f;
+    float waited_ms = 0.0f;
+};
+
+extern FramePacer frame_pacer;
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define FRAME_READBACK_SLOTS 4      // Captures in flight on the GPU, each in its own pixel buffer
+#define FRAME_READBACK_MAX_QUEUED 8 // Frames with the consumer before captures drop or wait
+
+// One captured frame, RGBA8 with the rows bottom up as GL reads them
+struct ReadbackFrame {
+    std::vector<uint8_t> pixels;
+    int width = 0;
+    int height = 0;
+    uint64_t frame = 0;
+    std::string name; // Whatever the capture was given, e.g. the file it goes to
+};
+
+// Frames out of the engine without stalling it: capture() queues a glReadPixels into the next of
+// a ring of pixel pack buffers and fences it, poll() maps the buffers whose fence has passed,
+// usually a frame or two later, and the job system hands the pixels to the consumer off the GL
+// thread, where encoding or streaming them costs the frame nothing. When the GPU or the consumer
+// falls behind, a non-blocking capture drops the frame, so recording never halves the frame
+// rate; a blocking one waits instead, for runs where every frame counts. GL thread only, the
+// consumer runs on a worker.
+class FrameReadback {
+public:
+    using Consumer = std::function<void(const ReadbackFrame& frame)>;
+
+    FrameReadback() = default;
+    ~FrameReadback();
+
+    FrameReadback(const FrameReadback&) = delete;
+    FrameReadback& operator=(const FrameReadback&) = delete;
+
+    void setConsumer(Consumer consumer) { consume = std::move(consumer); }
+    // Queues a copy of the framebuffer's first colour attachment, or the back buffer for 0.
+    // Returns false when the frame was dropped.
+    bool capture(GLuint framebuffer, int width, int height, uint64_t frame, const std::string& name, bool block = false);
+    // Once per frame: the captures that landed go to the consumer
+    void poll();
+    // Every capture to the consumer and the consumer done with them
+    void flush();
+    void release();
+
+    uint64_t capturedCount() const { return captured; }
+    uint64_t droppedCount() const { return dropped; }
+    int deliveredCount() const { return delivered.load(); }
+
+private:
+    struct Slot {
+        GLuint pbo = 0;
+        GLsync fence = nullptr;
+        size_t capacity = 0;
+        int width = 0;
+        int height = 0;
+        uint64_t frame = 0;
+        std::string name;
+    };
+
+    // Maps the slot's pixels and hands them over, wait blocks on its fence
+    bool deliver(Slot& slot, bool wait);
+
+    Consumer consume;
+    Slot slots[FRAME_READBACK_SLOTS];
+    int next_slot = 0;
+    uint64_t captured = 0;
+    uint64_t dropped = 0;
+    std::atomic<int> queued{0};
+    std::atomic<int> delivered{0};
+};
+
+// Writes a frame as a binary PPM, top down and without alpha
+bool writeFramePPM(const std::string& path, const ReadbackFrame& frame);
+
+extern bool use_frame_recording;
+extern std::string frame_recording_dir;
+
+// --record-frames <dir> records every presented frame into dir as frame_NNNNNN.ppm from the
+// start, F10 toggles it in a session. The window's image after the post pass, before the UI.
+// Frames the writers can't keep up with are dropped rather than slowing the session down. Other
+// consumers, a video encoder or a network stream, would take the recorder's readback the same
+// way. Native only.
+class FrameRecorder {
+public:
+    int parseArg(int argc, char** argv, int i);
+    // After the post pass, with the back buffer bound
+    void captureFrame(int width, int height, uint64_t frame);
+    void release();
+
+    uint64_t recordedCount() const { return (uint64_t)readback.deliveredCount(); }
+    uint64_t droppedCount() const { return readback.droppedCount(); }
+
+private:
+    FrameReadback readback;
+    bool consumer_set = false;
+    std::string created_dir;
+};
+
+extern FrameRecorder frame_recorder;
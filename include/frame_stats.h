@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#define FRAME_STATS_HISTORY 600       // Frames kept per series, ten seconds at 60 Hz
+#define FRAME_STATS_HISTOGRAM_BINS 48
+
+// Rolling frame times, so stutters show up where the one-second FPS average hides them. Three
+// series: wall time between frames, the CPU's share (frame start until the swap) and the GPU's
+// (the timed passes, as gpu_queries collects them a few frames late). Frames over
+// frame_hitch_threshold_ms count as hitches. Main thread only.
+extern float frame_hitch_threshold_ms;
+
+class FrameTimeSeries {
+public:
+    struct Summary {
+        size_t samples = 0;
+        float mean = 0.0f, p50 = 0.0f, p95 = 0.0f, p99 = 0.0f, max = 0.0f;
+        size_t hitches = 0; // Over the threshold within the window
+    };
+
+    void push(float ms);
+    void clear();
+    // The newest sample, 0 while empty
+    float latest() const;
+
+    Summary summarize(float hitch_threshold_ms) const;
+    // Frames per bin, bins of equal width from 0 to range_ms, the last one also counting anything slower
+    void histogram(float range_ms, float* bins, int bin_count) const;
+
+    // Oldest first from offset() once full, for ImGui::PlotLines' values_offset
+    const float* data() const { return samples.data(); }
+    int size() const { return (int)samples.size(); }
+    int offset() const { return (int)next; }
+    uint64_t hitchesTotal() const { return hitches_total; } // Since the last clear()
+
+private:
+    std::vector<float> samples; // Ring
+    size_t next = 0;
+    uint64_t hitches_total = 0;
+};
+
+struct FrameStats {
+    FrameTimeSeries wall, cpu, gpu;
+
+    void clear() {
+        wall.clear();
+        cpu.clear();
+        gpu.clear();
+    }
+};
+
+extern FrameStats frame_stats;
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "shadowmap.h"
+
+#define FRAME_UNIFORMS_MAX_LIGHTS 8 // MAX_LIGHTS in the shaders, the rest are clustered (light_clusters.h)
+#define REFLECTION_PROBE_SLOTS 2     // Reflection probes blended per frame (reflection_probes.h), a sampler each in pbr.fs
+
+// Binding points of the per-frame blocks, the same in every program
+#define CAMERA_BLOCK_BINDING 0
+#define LIGHT_BLOCK_BINDING 1
+#define SHADOW_BLOCK_BINDING 2
+
+class Shader;
+
+// std140 mirrors of the shader blocks, must match the declarations in res/shaders
+struct CameraBlock {
+    glm::mat4 view{1.0f};
+    glm::mat4 projection{1.0f};
+    glm::mat4 view_projection{1.0f};
+    glm::vec3 view_position{0.0f};
+    float pad = 0.0f;
+};
+
+struct GpuLight {
+    glm::vec4 position{0.0f};  // w = type (DIR_LIGHT, POINT_LIGHT, SPOT_LIGHT)
+    glm::vec4 color{0.0f};     // w = intensity
+    glm::vec4 direction{0.0f}; // w = inner cutoff cosine
+    glm::vec4 cutoff{0.0f};    // x = outer cutoff cosine, y = frame light index or -1 (clustered), z = range
+};
+
+// The frame lights: directional lights first, then the local lights most worth a shadow. Only the
+// directional ones are shaded from here, every local light goes through the clusters, which point
+// back with cutoff.y for the shadow. The shadow views are planned over these.
+struct LightBlock {
+    GpuLight lights[FRAME_UNIFORMS_MAX_LIGHTS];
+    int32_t count = 0;
+    int32_t cluster_light_count = 0;
+    float cluster_depth_scale = 0.0f; // LightClusters::depthScale() and depthBias()
+    float cluster_depth_bias = 0.0f;
+    // Image-based ambient (ibl.h): irradiance SH, its scale and the prefiltered cube's last mip
+    // (0 = diffuse only)
+    glm::vec4 ambient_sh[9] = {};
+    float ambient_intensity = 0.0f;
+    float ambient_specular_lod = 0.0f;
+    int32_t reflection_probe_count = 0;
+    int32_t volumetric_fog = 0; // 1 when the froxel volume (volumetric_fog.h) is bound this frame
+    glm::vec4 reflection_probes[REFLECTION_PROBE_SLOTS] = {}; // xyz centre, w radius of the bound probes
+    // The froxel volume's w from view depth: log(depth) * scale + bias
+    float volumetric_depth_scale = 0.0f;
+    float volumetric_depth_bias = 0.0f;
+    float pad2 = 0.0f;
+    float pad3 = 0.0f;
+};
+
+// How a shadowed light's views are laid out, ShadowBlock::lights[].z
+#define SHADOW_KIND_SINGLE 0   // Spot light, one view
+#define SHADOW_KIND_CASCADES 1 // Directional light, a view per cascade
+#define SHADOW_KIND_CUBE 2     // Point light, a view per cube face
+
+struct ShadowBlock {
+    glm::mat4 light_space[SHADOW_MAX_VIEWS];
+    glm::vec4 tiles[SHADOW_MAX_VIEWS];       // Atlas tile in uv: xy corner, z size, w layer
+    glm::vec4 view_params[SHADOW_MAX_VIEWS]; // x world receiver offset scaled to the tile's texels, y view depth where a cascade ends
+    glm::ivec4 lights[FRAME_UNIFORMS_MAX_LIGHTS]; // Per light: x first view, y view count (0 = unshadowed), z SHADOW_KIND_*
+    int32_t view_count = 0;
+    int32_t filter_quality = 0; // SHADOW_FILTER_*
+    glm::vec2 moment_exponents{0.0f}; // SHADOW_FILTER_MOMENTS: shadow_moment_exponents
+    int32_t max_filter_taps = 1;      // The PCF filters' cap
+    int32_t pad0 = 0;
+    int32_t pad1 = 0;
+    int32_t pad2 = 0;
+};
+
+// Camera, light and shadow globals for every program, in one uniform buffer with a range per
+// block. update() rewrites all three once per frame (orphaned, like the instance ring's
+// fallback path); programs pick the blocks up through bindFrameUniformBlocks() at link time.
+// GL thread only.
+class FrameUniforms {
+public:
+    FrameUniforms() = default;
+    ~FrameUniforms();
+
+    FrameUniforms(const FrameUniforms&) = delete;
+    FrameUniforms& operator=(const FrameUniforms&) = delete;
+
+    CameraBlock camera;
+    LightBlock lights;
+    ShadowBlock shadow;
+
+    // Uploads the blocks above, the first call creates the buffer and binds the ranges
+    void update();
+    void release();
+
+private:
+    void create();
+
+    GLuint buffer = 0;
+    size_t light_offset = 0;
+    size_t shadow_offset = 0;
+    size_t total_bytes = 0;
+    std::vector<uint8_t> staging;
+};
+
+extern FrameUniforms frame_uniforms;
+
+// Points the program's CameraBlock, LightBlock and ShadowBlock (whichever it declares) at the
+// shared binding points
+void bindFrameUniformBlocks(const Shader& shader);
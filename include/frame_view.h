@@ -0,0 +1,25 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include "frustum.h"
+
+// The camera's matrices for this frame, worked out once after the TAA jitter is picked instead
+// of in every pass that needs them: culling, the frame uniforms, Hi-Z and occlusion queries,
+// terrain and foliage selection, light proxies, motion vectors and the deferred lighting.
+// Projections are the jittered ones the frame draws with. Extra views (render_view.h, shadow
+// views) build their own. Main thread only.
+struct FrameView {
+    glm::mat4 view{1.0f};
+    glm::mat4 projection{1.0f};
+    glm::mat4 view_projection{1.0f};
+    glm::mat4 inverse_view_projection{1.0f};
+    glm::mat4 previous_view_projection{1.0f}; // Last update()'s, this one's on the first
+    glm::vec3 position{0.0f};
+    Frustum frustum; // Of view_projection, planes normalized
+    uint64_t frame = 0; // update() calls so far
+
+    void update(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& position);
+};
+
+extern FrameView frame_view;
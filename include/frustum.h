@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+
+// View frustum planes (xyz normal, w distance), pointing inwards
+struct Frustum {
+    glm::vec4 planes[6];
+    
+    void extractFromMatrix(const glm::mat4& vp) {
+        planes[0] = glm::vec4(vp[0][3] + vp[0][0], vp[1][3] + vp[1][0], vp[2][3] + vp[2][0], vp[3][3] + vp[3][0]);
+        planes[1] = glm::vec4(vp[0][3] - vp[0][0], vp[1][3] - vp[1][0], vp[2][3] - vp[2][0], vp[3][3] - vp[3][0]);
+        planes[2] = glm::vec4(vp[0][3] + vp[0][1], vp[1][3] + vp[1][1], vp[2][3] + vp[2][1], vp[3][3] + vp[3][1]);
+        planes[3] = glm::vec4(vp[0][3] - vp[0][1], vp[1][3] - vp[1][1], vp[2][3] - vp[2][1], vp[3][3] - vp[3][1]);
+        planes[4] = glm::vec4(vp[0][3] + vp[0][2], vp[1][3] + vp[1][2], vp[2][3] + vp[2][2], vp[3][3] + vp[3][2]);
+        planes[5] = glm::vec4(vp[0][3] - vp[0][2], vp[1][3] - vp[1][2], vp[2][3] - vp[2][2], vp[3][3] - vp[3][2]);
+        
+        for (int i = 0; i < 6; i++) {
+            float len = glm::length(glm::vec3(planes[i]));
+            planes[i] /= len;
+        }
+    }
+    
+    bool sphereInFrustum(const glm::vec3& center, float radius) const {
+        for (int i = 0; i < 6; i++) {
+            if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius) 
+                return false;
+        }
+        return true;
+    }
+
+    // sphereInFrustum() over count spheres (xyz centre, w radius), spheres[indices[k]] for each k.
+    // Sets visible[k] to 1 when the sphere is inside or touching, else 0. Four spheres a step
+    // with SSE2, NEON or WASM SIMD, transposed to one register per component against splatted
+    // planes (frustum.cpp).
+    void spheresInFrustum(const glm::vec4* spheres, const uint32_t* indices, size_t count, uint8_t* visible) const;
+
+    // Rejects the box only when it lies fully behind one plane
+    bool aabbInFrustum(const glm::vec3& bmin, const glm::vec3& bmax) const {
+        for (int i = 0; i < 6; i++) {
+            glm::vec3 normal(planes[i]);
+            // The corner furthest along the plane normal
+            glm::vec3 p(normal.x >= 0.0f ? bmax.x : bmin.x, normal.y >= 0.0f ? bmax.y : bmin.y, normal.z >= 0.0f ? bmax.z : bmin.z);
+            if (glm::dot(normal, p) + planes[i].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
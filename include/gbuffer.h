@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "render_graph.h"
+
+// Deferred shading: the opaques write their surface into a G-buffer under the prepass depth, then
+// one fullscreen pass lights every pixel once with the directional and clustered lights. Impostors
+// and blended materials stay forward. Off by default.
+extern bool use_deferred_shading;
+
+// Three targets over a copy of the scene depth, all renderable on GL 3.3 and WebGL2 without
+// extensions in the compact formats (renderTargetFormats()):
+//   0 RGBA8    albedo, ambient occlusion
+//   1 RGB10_A2 octahedral normal, roughness, 1 where an opaque wrote. RGBA16F with the Full preset.
+//   2 RGBA8    emissive as e / (1 + e), metallic
+// They are render graph transients, live from the opaques to the lighting, so the depth copy is
+// free for the transparents' afterwards. GL thread only.
+class GBuffer {
+public:
+    struct Targets {
+        RenderResource albedo = RENDER_RESOURCE_NONE;
+        RenderResource normal = RENDER_RESOURCE_NONE;
+        RenderResource material = RENDER_RESOURCE_NONE;
+        RenderResource depth = RENDER_RESOURCE_NONE;
+    };
+
+    // This frame's targets at the scene's render size, for the opaque pass to write
+    Targets declare(RenderGraph& graph, int width, int height) const;
+
+    // After the depth prepass, with the scene framebuffer bound. Copies its depth, clears the
+    // targets and leaves them bound. False leaves everything as it was.
+    bool begin(RenderGraph::Context& context, const Targets& targets);
+    // Rebinds the scene framebuffer and puts targets 0-2 on first_unit onwards, the depth on
+    // first_unit + 3
+    void end(RenderGraph::Context& context, const Targets& targets, int first_unit);
+
+    // False once its framebuffer turned out incomplete
+    bool available() const { return !failed; }
+
+private:
+    int width = 0, height = 0;
+    bool failed = false;
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+struct VertexLayout;
+
+// Sub-allocate every mesh of the same vertex format out of one shared VBO/EBO behind a single VAO.
+// Off on WebGL2, which has no base-vertex draws; meshes then keep their own buffers.
+extern bool use_geometry_arena;
+
+// Depth-only passes (the prepass and shadow casters) read only the position, and the UV for
+// masked materials. With this on, uploads also keep both as separate tightly packed streams
+// behind a depth VAO, so those passes fetch 12 + 4..8 bytes a vertex instead of the whole
+// interleaved vertex. Affects meshes uploaded after it changes.
+extern bool use_depth_streams;
+
+// Shadow casters share their depth with no other pass, so they can trade position precision for
+// bandwidth. With this and use_depth_streams on, uploads also keep the positions as unorm16 across
+// the mesh's own bounds (6 bytes a vertex instead of 12) behind a shadow VAO, and DrawList folds
+// each mesh's dequantization into the instance transforms it packs for shadow casters. The step
+// is the mesh's extent over 65535, so small meshes get finer positions; ones wider than
+// SHADOW_POSITION_MAX_STEP allows keep the float stream. The prepass stays on floats, the main
+// pass tests against its depth with GL_EQUAL. Affects meshes uploaded after it changes.
+extern bool use_quantized_shadow_positions;
+
+#define SHADOW_POSITION_MAX_STEP 0.001f // Metres between neighbouring quantized positions, at most
+
+#define GEOMETRY_ARENA_INITIAL_VERTICES (256 * 1024)
+#define GEOMETRY_ARENA_INITIAL_INDEX_BYTES (4 * 1024 * 1024)
+
+struct GeometryRange {
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+// A quantized shadow position is offset + scale * unorm16, per axis
+struct PositionQuantization {
+    glm::vec3 offset{0.0f};
+    glm::vec3 scale{0.0f}; // All zero: no quantized stream
+
+    bool valid() const { return scale != glm::vec3(0.0f); }
+};
+
+struct GeometryAllocation {
+    GeometryRange vertices; // In vertices, offset is the draw's base vertex
+    GeometryRange indices;  // In bytes, offset is the draw's index pointer
+};
+
+// First-fit free list over a linear range. Offsets and sizes are in the owner's units.
+class RangeAllocator {
+public:
+    size_t capacity() const { return total; }
+    size_t used() const { return used_size; }
+
+    bool allocate(size_t size, size_t& offset);
+    void free(const GeometryRange& range);
+    // Extends the range, the new space is appended to the free list
+    void grow(size_t new_capacity);
+
+private:
+    void insertFree(const GeometryRange& range);
+
+    std::vector<GeometryRange> free_ranges; // Sorted by offset, never adjacent
+    size_t total = 0;
+    size_t used_size = 0;
+};
+
+// One vertex format's shared buffers. Index data of both widths lives in the same EBO,
+// each range aligned to 4 bytes. The instance buffers are shared by every mesh in the arena,
+// so each draw uploads its own instances first. GL thread only.
+class GeometryArena {
+public:
+    explicit GeometryArena(uint32_t vertex_format);
+    ~GeometryArena();
+
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+    // Copies the data in, growing the buffers if needed. vertex_bytes must be a multiple of the stride.
+    // quantization is set when the vertices also went into the shadow stream.
+    bool allocate(const void* vertices, size_t vertex_bytes, const void* indices, size_t index_bytes,
+                  GeometryAllocation& allocation, PositionQuantization& quantization);
+    void free(const GeometryAllocation& allocation);
+
+    uint32_t format;
+    uint32_t stride;
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint ebo = 0;
+    // Position and UV streams at the same vertex offsets, when created with use_depth_streams
+    GLuint depth_vao = 0;
+    GLuint position_vbo = 0;
+    GLuint depth_uv_vbo = 0;
+    uint32_t depth_uv_size = 0;
+    // Quantized positions at the same vertex offsets with the depth UVs, when created with
+    // use_quantized_shadow_positions. Only meshes whose bounds allowed it have theirs filled in.
+    GLuint shadow_vao = 0;
+    GLuint quantized_position_vbo = 0;
+    GLuint instance_vbo = 0; // Single instance, batches stream through instance_ring
+    GLuint fade_vbo = 0;
+
+    size_t allocations = 0;
+    RangeAllocator vertex_ranges;
+    RangeAllocator index_ranges;
+
+private:
+    void growVertices(size_t min_vertices);
+    void setupDepthVertexArray();
+    void growIndices(size_t min_bytes);
+};
+
+// Arenas by vertex format. Meshes hold a reference to theirs, so an arena outlives clear()
+// until its last mesh is freed.
+class GeometryArenas {
+public:
+    std::shared_ptr<GeometryArena> get(uint32_t vertex_format);
+    void clear() { arenas.clear(); }
+    void printStats() const;
+
+private:
+    std::unordered_map<uint32_t, std::shared_ptr<GeometryArena>> arenas;
+};
+
+extern GeometryArenas geometry_arenas;
+
+// Attribute setup shared by arena and standalone mesh VAOs, for the bound VAO.
+// setupVertexAttributes() reads from the buffer bound to GL_ARRAY_BUFFER.
+void setupVertexAttributes(const VertexLayout& layout);
+// The depth VAO's attributes, position (0) and UV (2) from their own buffers at byte offsets
+void setupDepthAttributes(const VertexLayout& layout, GLuint position_vbo, size_t position_offset, GLuint uv_vbo,
+                          size_t uv_offset);
+// The shadow VAO's attributes, quantized position (0) and UV (2) from their own buffers at byte offsets
+void setupShadowAttributes(const VertexLayout& layout, GLuint position_vbo, size_t position_offset, GLuint uv_vbo,
+                           size_t uv_offset);
+// The positions as unorm16 triples across their bounds. False, leaving quantization invalid,
+// when the bounds are too wide for SHADOW_POSITION_MAX_STEP.
+bool quantizePositions(const std::vector<glm::vec3>& positions, std::vector<uint16_t>& out, PositionQuantization& quantization);
+// Splits count interleaved vertices into the depth streams, UVs in the layout's own format
+void extractDepthStreams(const VertexLayout& layout, const void* vertices, size_t count, std::vector<glm::vec3>& positions,
+                         std::vector<unsigned char>& uvs);
+// Bytes of one vertex's UV in the depth stream
+uint32_t depthUVSize(const VertexLayout& layout);
+void createInstanceBuffers(GLuint& instance_vbo, GLuint& fade_vbo, size_t max_instances);
+// Points the instance attributes (6-10) at first_instance, for draws without a base instance
+void pointInstanceAttributes(GLuint instance_vbo, GLuint fade_vbo, size_t first_instance);
+// Same, at byte offsets into any buffers
+void pointInstanceBytes(GLuint matrix_vbo, size_t matrix_offset, GLuint fade_vbo, size_t fade_offset);
+
+// A model matrix as the instance attributes carry it (slots 6-9), 56 bytes instead of a mat4's 64.
+// Model matrices are affine, so only the top three rows go. The normal matrix of a
+// translate * rotate * scale matrix is its upper columns times their inverse squared lengths;
+// those come along as halves, relative to the largest since normals are renormalised anyway, so
+// vertex shaders get it without any per-vertex work (res/shaders/include/instance.glsl). A relative
+// scale is floored at the smallest normal half, 2^-14: past 128:1 between axes the normals bend
+// less than they should, rather than an axis going to zero once halves flush (about 4000:1).
+struct InstanceTransform {
+    glm::vec4 rows[3];
+    uint16_t normal_scale[4]; // w unused, keeps the stride a multiple of 4 as WebGL wants
+};
+static_assert(sizeof(InstanceTransform) == 56, "instance.glsl and gpu_cull.comp read this layout");
+
+InstanceTransform packInstanceTransform(const glm::mat4& model);
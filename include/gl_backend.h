@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+
+// Buffer and texture creation through one of two paths, picked by gl_extensions.direct_state_access:
+//   - GL 4.5 / ARB_direct_state_access: glCreate*, immutable storage and glTexture*/glNamedBuffer*
+//     calls on the object's name, so nothing is bound and no binding is disturbed
+//   - GL 3.3, GL 4.1 (macOS) and WebGL2: the same done bind-to-edit. The object is left bound to
+//     its target (texture on the active unit, element buffer into the bound vertex array), and
+//     the later calls on a texture expect it still bound there.
+// DSA objects have immutable storage: they may still be updated, bound to edit or not, but never
+// re-specified with glTexImage2D or glBufferData. Loader side, like the direct GL calls it replaces: runs outside the
+// gl_state window or calls gl_state.invalidate() after. GL thread only.
+
+// Storage for bytes, filled from data when not null. Only dynamic buffers may be updated later.
+GLuint createBuffer(GLenum target, size_t bytes, const void* data, bool dynamic = false);
+
+// levels of storage for a 2D texture. Without texture storage the fallback only creates the
+// name, the level uploads below allocate each level as they go.
+GLuint createTexture2D(GLsizei levels, GLenum internal_format, GLsizei width, GLsizei height);
+void uploadTexture2D(GLuint texture, GLint level, GLenum internal_format, GLsizei width, GLsizei height, GLenum format, GLenum type,
+                     const void* pixels);
+void uploadCompressedTexture2D(GLuint texture, GLint level, GLenum internal_format, GLsizei width, GLsizei height, GLsizei bytes,
+                               const void* data);
+void setTextureParameter(GLuint texture, GLenum target, GLenum name, GLint value);
+void generateTextureMipmap(GLuint texture, GLenum target);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Deferred destruction of GL objects. Meshes and other owners queue their buffers, vertex arrays
+// and textures here instead of deleting them where the last reference happens to drop, which may
+// be mid-frame while this frame's draws still read them, or on a worker thread with no context.
+// endFrame() fences what the frame queued and deletes the batches whose fence has signalled, so
+// an object outlives every frame that could have drawn from it. defer() queues other GL-thread
+// bookkeeping (pool slots, arena ranges, texture references) with the same lifetime.
+// Queuing is thread-safe; endFrame() and release() are GL thread only.
+class GLDeletionQueue {
+public:
+    GLDeletionQueue() = default;
+    GLDeletionQueue(const GLDeletionQueue&) = delete;
+    GLDeletionQueue& operator=(const GLDeletionQueue&) = delete;
+
+    // Any thread, 0 is ignored. Buffers are untracked from gpu_memory when deleted.
+    void deleteBuffer(GLuint buffer);
+    void deleteVertexArray(GLuint vertex_array);
+    void deleteTexture(GLuint texture);
+    // Any thread, runs on the GL thread before the batch's objects are deleted
+    void defer(std::function<void()> release);
+
+    // Right after the swap. Deleted names may be handed out again, gl_state's caches are
+    // invalidated at the start of the next frame.
+    void endFrame();
+    // Deletes everything queued at once, at shutdown
+    void release();
+
+    size_t pendingCount() const;
+
+private:
+    struct Batch {
+        std::vector<GLuint> buffers;
+        std::vector<GLuint> vertex_arrays;
+        std::vector<GLuint> textures;
+        std::vector<std::function<void()>> releases;
+        GLsync fence = nullptr;
+
+        bool empty() const { return buffers.empty() && vertex_arrays.empty() && textures.empty() && releases.empty(); }
+    };
+
+    static void destroy(Batch& batch);
+
+    mutable std::mutex mutex;
+    Batch pending;               // Queued since the last endFrame()
+    std::deque<Batch> in_flight; // Fenced, oldest first
+};
+
+extern GLDeletionQueue gl_deletion_queue;
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Entry points newer than the GL 3.3 core that glad was generated for.
+// Loaded at startup; each is null when the driver doesn't provide it, so check the
+// matching flag in gl_extensions before calling.
+
+typedef void (APIENTRYP PFN_glTexStorage2D)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP PFN_glDrawElementsInstancedBaseVertexBaseInstance)(GLenum mode, GLsizei count, GLenum type, const void* indices,
+                                                                          GLsizei instancecount, GLint basevertex, GLuint baseinstance);
+typedef void (APIENTRYP PFN_glMultiDrawElementsIndirect)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP PFN_glMultiDrawArraysIndirect)(GLenum mode, const void* indirect, GLsizei drawcount, GLsizei stride);
+
+typedef void (APIENTRYP PFN_glDispatchCompute)(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (APIENTRYP PFN_glMemoryBarrier)(GLbitfield barriers);
+typedef void (APIENTRYP PFN_glBufferStorage)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+typedef void (APIENTRYP PFN_glGetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFN_glProgramBinary)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFN_glProgramParameteri)(GLuint program, GLenum pname, GLint value);
+
+typedef void (APIENTRYP PFN_glCreateBuffers)(GLsizei n, GLuint* buffers);
+typedef void (APIENTRYP PFN_glNamedBufferStorage)(GLuint buffer, GLsizeiptr size, const void* data, GLbitfield flags);
+typedef void (APIENTRYP PFN_glCreateTextures)(GLenum target, GLsizei n, GLuint* textures);
+typedef void (APIENTRYP PFN_glTextureStorage2D)(GLuint texture, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP PFN_glTextureSubImage2D)(GLuint texture, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
+                                                 GLenum format, GLenum type, const void* pixels);
+typedef void (APIENTRYP PFN_glCompressedTextureSubImage2D)(GLuint texture, GLint level, GLint xoffset, GLint yoffset, GLsizei width,
+                                                           GLsizei height, GLenum format, GLsizei imageSize, const void* data);
+typedef void (APIENTRYP PFN_glTextureParameteri)(GLuint texture, GLenum pname, GLint param);
+typedef void (APIENTRYP PFN_glGenerateTextureMipmap)(GLuint texture);
+typedef void (APIENTRYP PFN_glBindTextureUnit)(GLuint unit, GLuint texture);
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS
+#define GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS 0x90D6
+#endif
+#ifndef GL_PIXEL_BUFFER_BARRIER_BIT
+#define GL_PIXEL_BUFFER_BARRIER_BIT 0x00000080
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+#ifndef GL_VERTEX_SHADER_INVOCATIONS_ARB
+#define GL_VERTEX_SHADER_INVOCATIONS_ARB 0x82F0
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#define GL_CLIPPING_INPUT_PRIMITIVES_ARB 0x82F6
+#define GL_CLIPPING_OUTPUT_PRIMITIVES_ARB 0x82F7
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_DYNAMIC_STORAGE_BIT
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+
+struct GLExtensions {
+    int major = 3;
+    int minor = 3;
+    bool texture_storage = false; // GL 4.2 / ARB_texture_storage / GLES 3.0
+    bool base_instance = false; // GL 4.2 / ARB_base_instance / WEBGL_draw_instanced_base_vertex_base_instance
+    bool multi_draw_indirect = false; // GL 4.3 / ARB_multi_draw_indirect, also requires base_instance
+    bool compute_shader = false; // GL 4.3 core only, the shaders use #version 430
+    bool shader_draw_parameters = false; // GL 4.6 / ARB_shader_draw_parameters, gl_BaseInstanceARB in vertex shaders
+    bool buffer_storage = false; // GL 4.4 / ARB_buffer_storage, persistent mapping
+    bool layered_rendering = false; // GL 3.2 core, geometry shaders writing gl_Layer. Not in WebGL
+    bool geometry_shader_invocations = false; // GL 4.0 / ARB_gpu_shader5, the shaders use #version 400
+    bool timer_query = false; // GL 3.3 core / EXT_disjoint_timer_query_webgl2, GL_TIME_ELAPSED queries
+    bool timestamp_query = false; // GL 3.3 core, glQueryCounter. Not in WebGL
+    bool parallel_shader_compile = false; // KHR/ARB_parallel_shader_compile, GL_COMPLETION_STATUS_KHR polls a program
+    bool program_binary = false; // GL 4.1 / ARB_get_program_binary with at least one format. Not in WebGL
+    bool pipeline_statistics = false; // GL 4.6 / ARB_pipeline_statistics_query. Not in WebGL
+    bool direct_state_access = false; // GL 4.5 / ARB_direct_state_access, see gl_backend.h. Not on macOS (4.1) or in WebGL
+
+    PFN_glTexStorage2D TexStorage2D = nullptr;
+    PFN_glDrawElementsInstancedBaseVertexBaseInstance DrawElementsInstancedBaseVertexBaseInstance = nullptr;
+    PFN_glMultiDrawElementsIndirect MultiDrawElementsIndirect = nullptr;
+    PFN_glMultiDrawArraysIndirect MultiDrawArraysIndirect = nullptr; // With multi_draw_indirect
+    PFN_glDispatchCompute DispatchCompute = nullptr;
+    PFN_glMemoryBarrier MemoryBarrier = nullptr;
+    PFN_glBufferStorage BufferStorage = nullptr;
+    PFN_glGetProgramBinary GetProgramBinary = nullptr;
+    PFN_glProgramBinary ProgramBinary = nullptr;
+    PFN_glProgramParameteri ProgramParameteri = nullptr;
+    // With direct_state_access
+    PFN_glCreateBuffers CreateBuffers = nullptr;
+    PFN_glNamedBufferStorage NamedBufferStorage = nullptr;
+    PFN_glCreateTextures CreateTextures = nullptr;
+    PFN_glTextureStorage2D TextureStorage2D = nullptr;
+    PFN_glTextureSubImage2D TextureSubImage2D = nullptr;
+    PFN_glCompressedTextureSubImage2D CompressedTextureSubImage2D = nullptr;
+    PFN_glTextureParameteri TextureParameteri = nullptr;
+    PFN_glGenerateTextureMipmap GenerateTextureMipmap = nullptr;
+    PFN_glBindTextureUnit BindTextureUnit = nullptr;
+};
+
+extern GLExtensions gl_extensions;
+
+// Call once after gladLoadGLLoader with the same loader
+void loadGLExtensions(GLADloadproc load);
+
+bool hasGLExtension(const char* name);
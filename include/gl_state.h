@@ -0,0 +1,122 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstdint>
+
+#define GL_STATE_TEXTURE_UNITS 16
+
+// Calls that reached GL and calls dropped because the state was already set
+struct GLStateCounters {
+    int changes = 0;
+    int skipped = 0;
+    // glUniform calls through Shader's setters, and the ones its shadow copies dropped
+    int uniforms = 0;
+    int uniforms_skipped = 0;
+};
+
+// Cull mode of a pipeline whose draws set their own (meshes carry one each)
+#define PIPELINE_CULL_PER_DRAW -1
+
+// Program, vertex array and fixed-function state a pass draws with, built once and applied whole
+// by GLState::apply(), which only issues what differs from the current state. Defaults are the
+// frame's baseline: depth test LESS with writes, colour writes, no blending, back faces culled.
+// The builders return modified copies, so passes define theirs as constants:
+//   static constexpr PipelineState PIPELINE_SHADOW_CASTERS = PipelineState().colorWrite(false).cull(PIPELINE_CULL_PER_DRAW);
+// Program and vertex array 0 leave whatever is bound, for passes that pick them per draw.
+struct PipelineState {
+    GLuint program = 0;
+    GLuint vertex_array = 0;
+    bool depth_test = true;
+    GLenum depth_func = GL_LESS;
+    bool depth_write = true;
+    bool color_write = true;
+    bool blend = false;
+    GLenum blend_source = GL_SRC_ALPHA, blend_destination = GL_ONE_MINUS_SRC_ALPHA;
+    GLenum blend_source_alpha = GL_SRC_ALPHA, blend_destination_alpha = GL_ONE_MINUS_SRC_ALPHA;
+    int cull_mode = 1; // CullMode, CULL_BACK
+
+    constexpr PipelineState withProgram(GLuint id) const { PipelineState s = *this; s.program = id; return s; }
+    constexpr PipelineState withVertexArray(GLuint id) const { PipelineState s = *this; s.vertex_array = id; return s; }
+    constexpr PipelineState depth(bool test, GLenum func = GL_LESS) const { PipelineState s = *this; s.depth_test = test; s.depth_func = func; return s; }
+    constexpr PipelineState depthWrite(bool write) const { PipelineState s = *this; s.depth_write = write; return s; }
+    constexpr PipelineState colorWrite(bool write) const { PipelineState s = *this; s.color_write = write; return s; }
+    constexpr PipelineState blending(GLenum source, GLenum destination) const { return blending(source, destination, source, destination); }
+    constexpr PipelineState blending(GLenum source_rgb, GLenum destination_rgb, GLenum source_alpha, GLenum destination_alpha) const {
+        PipelineState s = *this;
+        s.blend = true;
+        s.blend_source = source_rgb;
+        s.blend_destination = destination_rgb;
+        s.blend_source_alpha = source_alpha;
+        s.blend_destination_alpha = destination_alpha;
+        return s;
+    }
+    constexpr PipelineState cull(int mode) const { PipelineState s = *this; s.cull_mode = mode; return s; }
+};
+
+// Shadow copy of the GL state the render passes touch: program, VAO, textures per unit (2D, 2D
+// array and cube map), cull, depth, blend and colour mask. Redundant calls are filtered out. Everything
+// drawn between invalidate() and the end of the frame must go through it, code that calls GL
+// directly (loaders, ImGui) runs outside that window or calls invalidate() after. GL thread only.
+class GLState {
+public:
+    GLState() { invalidate(); }
+
+    // Forgets everything, the next call of each kind goes through
+    void invalidate();
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    // Also leaves unit active, for glTexParameter and friends on the bound texture
+    void bindTexture(unsigned int unit, GLenum target, GLuint texture);
+    // For sampling only: one glBindTextureUnit with direct_state_access, which leaves the active
+    // unit alone, bindTexture() without. Same filter either way.
+    void bindTextureUnit(unsigned int unit, GLenum target, GLuint texture);
+
+    void enable(GLenum capability) { setEnabled(capability, true); }
+    void disable(GLenum capability) { setEnabled(capability, false); }
+    void setEnabled(GLenum capability, bool enabled); // GL_CULL_FACE, GL_DEPTH_TEST, GL_BLEND
+    bool isEnabled(GLenum capability);
+
+    // CULL_NONE disables face culling, CULL_BACK / CULL_FRONT cull that face
+    void setCullMode(int cull_mode);
+    void cullFace(GLenum face);
+    void depthFunc(GLenum func);
+    void depthMask(bool write);
+    void blendFunc(GLenum source, GLenum destination) { blendFuncSeparate(source, destination, source, destination); }
+    void blendFuncSeparate(GLenum source_rgb, GLenum destination_rgb, GLenum source_alpha, GLenum destination_alpha);
+    void colorMask(bool write);
+
+    // Everything state sets, through the filters above
+    void apply(const PipelineState& state);
+
+    // Shader's setters report here, uniforms being per-program state it shadows itself
+    void countUniform(bool issued) { issued ? counters.uniforms++ : counters.uniforms_skipped++; }
+
+    const GLStateCounters& getCounters() const { return counters; }
+    void resetCounters() { counters = GLStateCounters(); }
+
+private:
+    enum Capability { CAP_CULL_FACE, CAP_DEPTH_TEST, CAP_BLEND, CAP_COUNT, CAP_UNTRACKED = CAP_COUNT };
+    static Capability capabilityIndex(GLenum capability);
+    GLuint* boundTexture(unsigned int unit, GLenum target); // Shadow slot, null when untracked
+
+    // ~0 / -1 = unknown
+    static constexpr GLuint UNKNOWN = ~0u;
+    GLuint program = UNKNOWN;
+    GLuint vao = UNKNOWN;
+    GLuint active_unit = UNKNOWN;
+    GLuint textures_2d[GL_STATE_TEXTURE_UNITS];
+    GLuint textures_cube[GL_STATE_TEXTURE_UNITS];
+    GLuint textures_2d_array[GL_STATE_TEXTURE_UNITS];
+    int8_t enabled[CAP_COUNT];
+    GLenum cull_face = UNKNOWN;
+    GLenum depth_func = UNKNOWN;
+    int8_t depth_mask = -1;
+    GLenum blend_source = UNKNOWN, blend_destination = UNKNOWN;
+    GLenum blend_source_alpha = UNKNOWN, blend_destination_alpha = UNKNOWN;
+    int8_t color_mask = -1;
+
+    GLStateCounters counters;
+};
+
+extern GLState gl_state;
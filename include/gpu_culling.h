@@ -0,0 +1,106 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include "shader.h"
+
+class Mesh;
+class Material;
+class EntityManager;
+template <typename T> struct EntitySpan;
+struct Entity;
+class HiZBuffer;
+
+// GPU-driven culling and LOD selection, needs GL 4.3 compute and multi-draw indirect.
+// Off by default; when on, the prepass, opaque and shadow passes draw compute-built lists.
+extern bool use_gpu_culling;
+#define GPU_CULL_GROUP_SIZE 64 // Matches local_size_x in gpu_cull.comp
+
+// Entity transforms, bounds and LOD tables live in SSBOs. Each cull() is one dispatch that
+// frustum-tests every entity, picks its LOD from the projected size (with hysteresis, kept on the
+// GPU) and appends its transform to each of the level's draws, bumping their indirect counts.
+// Cross-fades and impostor tiers stay on the CPU path; here the coarsest mesh level covers them.
+// Blended meshes aren't included, the renderer still sorts those on the CPU.
+class GpuCulling {
+public:
+    // One indirect draw: a mesh and the material it binds with
+    struct Slot {
+        Mesh* mesh = nullptr;
+        const Material* material = nullptr;
+    };
+
+    GpuCulling(); // Throws like Shader if the compute program fails
+    ~GpuCulling();
+
+    GpuCulling(const GpuCulling&) = delete;
+    GpuCulling& operator=(const GpuCulling&) = delete;
+
+    static bool supported();
+
+    // Rebuilds the tables when the entity layout changed, then uploads this frame's transforms.
+    // members are the dense indices culled here at all, an EntityManager::query() (lights are
+    // drawn separately).
+    void update(EntityManager& entity_manager, EntitySpan<uint32_t> members);
+    void invalidate() { tables_valid = false; }
+
+    // Fills the indirect commands and instances for one view. Only the camera view should pass
+    // update_lod. Other views (shadows) draw a level no finer than its last choice, nor than the
+    // entity's shadow proxy, picked with their own projection_scale. occlusion is optional.
+    // Entities whose screen size under projection_scale falls below min_screen_size are dropped
+    // after their LOD is picked. Leaves the cull program bound, so the draw program has to be
+    // bound after it, not before.
+    void cull(const glm::mat4& view_projection, const glm::vec3& camera_position, float projection_scale,
+              float hysteresis, bool update_lod, const HiZBuffer* occlusion = nullptr, float min_screen_size = 0.0f);
+
+    // Draws the last cull() output. apply_state runs for the first slot and whenever the
+    // material or cull mode changes, and has to bind the program.
+    // Returns the number of GL draw calls issued.
+    int submit(const std::function<void(const Slot&)>& apply_state);
+
+    size_t entityCount() const { return entities.size(); }
+    size_t slotCount() const { return slots.size(); }
+
+private:
+    struct GpuEntity {
+        glm::mat4 model;
+        glm::vec4 sphere;
+        uint32_t lod_first;
+        uint32_t lod_count;
+        uint32_t shadow_lod_min; // Entity::shadow_proxy_lod among the mesh levels
+        uint32_t pad;
+    };
+
+    struct GpuLODLevel {
+        float min_screen_size;
+        uint32_t slot_first;
+        uint32_t slot_count;
+        uint32_t pad;
+    };
+
+    void rebuild(EntityManager& entity_manager, EntitySpan<uint32_t> members);
+    void uploadBuffer(GLuint& buffer, const void* data, size_t bytes);
+
+    std::unique_ptr<Shader> cull_shader;
+
+    bool tables_valid = false;
+    uint64_t source_layout_version = 0; // EntityManager::layoutVersion() the tables were built for
+    std::vector<Entity*> entities;
+    std::vector<GpuEntity> entity_data;
+    std::vector<Slot> slots;
+    size_t instance_capacity = 0;
+
+    GLuint entity_buffer = 0;
+    GLuint level_buffer = 0;
+    GLuint level_slot_buffer = 0;
+    GLuint command_template_buffer = 0; // Zero counts, copied over command_buffer before each cull
+    GLuint command_buffer = 0;
+    GLuint instance_buffer = 0;
+    GLuint fade_buffer = 0; // All zero, the instance attributes need one alongside the matrices
+    GLuint lod_state_buffer = 0;
+    GLuint capacity_buffer = 0;
+    size_t command_bytes = 0;
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+// Where the engine's GPU memory goes. Every buffer and texture creation site reports the size
+// it asked for, tagged with a category and the asset it belongs to, and every deletion gives it
+// back, so the totals are what the engine allocated rather than what the driver reports (which
+// GL can't tell us portably). The debug panel lists them by category and by asset. Textures'
+// sizes assume the driver keeps 3-channel formats padded to 4 bytes. GL thread only.
+enum GpuMemoryCategory {
+    GPU_MEMORY_GEOMETRY = 0,  // Vertex and index buffers, arenas included
+    GPU_MEMORY_INSTANCES,     // Per-mesh and per-arena instance attribute buffers
+    GPU_MEMORY_TEXTURES,      // Material textures, streamed or not
+    GPU_MEMORY_SHADOWS,       // Shadow atlas, its static cache and the moments targets
+    GPU_MEMORY_SKYBOX,        // Environment cubemaps
+    GPU_MEMORY_STREAMING,     // Texture streaming's staging PBOs
+    GPU_MEMORY_PARTICLES,     // Particle state and the soft particles' depth copy
+    GPU_MEMORY_RENDER_TARGETS, // The render graph's pooled transient targets
+    GPU_MEMORY_CATEGORY_COUNT,
+};
+extern const char* const GPU_MEMORY_CATEGORY_NAMES[GPU_MEMORY_CATEGORY_COUNT];
+extern uint64_t gpu_memory_budget; // Bytes, going over it warns once. 0 turns the warning off.
+
+// Bytes of one level of an uncompressed texture, 0 for formats it doesn't know
+uint64_t textureLevelBytes(GLenum internal_format, int width, int height, int depth = 1);
+// A full mip chain down to 1x1 from the given base level size, as glGenerateMipmap makes it
+uint64_t textureMipChainBytes(GLenum internal_format, int width, int height, int depth = 1);
+
+class GpuMemoryTracker {
+public:
+    struct Allocation {
+        GpuMemoryCategory category = GPU_MEMORY_GEOMETRY;
+        std::string asset;
+        uint64_t bytes = 0;
+    };
+
+    // A new size for a buffer or texture replaces the one tracked for it, as glBufferData does
+    void trackBuffer(GLuint buffer, uint64_t bytes, GpuMemoryCategory category, const std::string& asset);
+    void trackTexture(GLuint texture, uint64_t bytes, GpuMemoryCategory category, const std::string& asset);
+    // Names the asset of an object created before it was known, e.g. by the texture cache's key
+    void tagBuffer(GLuint buffer, const std::string& asset);
+    void tagTexture(GLuint texture, const std::string& asset);
+    // A tracked texture whose resident levels changed, keeping its category and asset
+    void resizeTexture(GLuint texture, uint64_t bytes);
+    // Right before glDeleteBuffers / glDeleteTextures, untracked names are ignored
+    void releaseBuffer(GLuint buffer);
+    void releaseTexture(GLuint texture);
+
+    uint64_t total() const { return total_bytes; }
+    uint64_t peak() const { return peak_bytes; }
+    uint64_t categoryBytes(GpuMemoryCategory category) const { return category_bytes[category]; }
+    size_t count() const { return allocations.size(); }
+    bool overBudget() const { return gpu_memory_budget != 0 && total_bytes > gpu_memory_budget; }
+    // A category's bytes summed per asset, largest first
+    std::vector<std::pair<std::string, uint64_t>> assets(GpuMemoryCategory category) const;
+
+private:
+    // Buffers and textures have separate name spaces, textures live in the key's upper half
+    static uint64_t textureKey(GLuint texture) { return (uint64_t)texture | (1ull << 32); }
+    void track(uint64_t key, uint64_t bytes, GpuMemoryCategory category, const std::string& asset);
+    void tag(uint64_t key, const std::string& asset);
+    void release(uint64_t key);
+
+    std::unordered_map<uint64_t, Allocation> allocations;
+    uint64_t category_bytes[GPU_MEMORY_CATEGORY_COUNT] = {};
+    uint64_t total_bytes = 0;
+    uint64_t peak_bytes = 0;
+    bool warned = false; // Over the budget since the last warning
+};
+
+extern GpuMemoryTracker gpu_memory;
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#define GPU_QUERY_FRAMES 4 // Frames in flight before a frame still busy is dropped
+
+// Timer queries that never stall the CPU. Each frame's queries come from one of GPU_QUERY_FRAMES
+// slots, and beginFrame() collects the frames whose results are back, polled with
+// GL_QUERY_RESULT_AVAILABLE. A frame still busy when its slot comes round again is dropped
+// instead of waited on. Elapsed queries bracket one pass at a time; timestamps mark a point and
+// so nest, native only. WebGL2 times passes through EXT_disjoint_timer_query_webgl2, and drops
+// the frames in flight whenever the GPU reports a disjoint. Without timer queries every call is
+// a no-op returning -1 and nothing is collected. GL thread only.
+class GpuQueryPool {
+public:
+    struct Frame {
+        uint64_t id = 0;    // frame() while it recorded
+        bool valid = false; // Dropped or disjoint frames have no results
+        std::vector<double> elapsed_ms;   // By the index beginElapsed() returned
+        std::vector<uint64_t> timestamps; // GPU clock nanoseconds, by the index timestamp() returned
+    };
+
+    GpuQueryPool() = default;
+    ~GpuQueryPool();
+
+    GpuQueryPool(const GpuQueryPool&) = delete;
+    GpuQueryPool& operator=(const GpuQueryPool&) = delete;
+
+    // Collects what finished, then starts recording the next frame
+    void beginFrame();
+    void endFrame();
+    void release();
+
+    // The frame recording, or the last one
+    uint64_t frame() const { return current_frame; }
+
+    // Index into the frame's elapsed_ms, -1 when not timing. One open at a time.
+    int beginElapsed();
+    void endElapsed();
+    // Index into the frame's timestamps, -1 when not timing
+    int timestamp();
+
+    // Frames beginFrame() just collected or dropped, oldest first, until the next beginFrame()
+    const std::vector<const Frame*>& collected() const { return collected_frames; }
+    // Newest valid frame, null until one comes back
+    const Frame* latest() const { return latest_frame.valid ? &latest_frame : nullptr; }
+
+private:
+    struct Slot {
+        std::vector<GLuint> elapsed, timestamps; // Query objects, kept for the slot's next frames
+        size_t elapsed_used = 0, timestamps_used = 0;
+        uint64_t frame = 0;
+        bool waiting = false;
+        Frame result;
+    };
+
+    bool finished(const Slot& slot) const;
+    void collect(Slot& slot, bool valid);
+
+    Slot slots[GPU_QUERY_FRAMES];
+    int current = -1; // Into slots while recording
+    bool elapsed_open = false;
+    uint64_t current_frame = 0;
+    uint64_t next_frame = 0;
+    std::vector<const Frame*> collected_frames;
+    Frame latest_frame;
+};
+
+extern GpuQueryPool gpu_queries;
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+#include "shader.h"
+
+// Occlusion cull against a max-depth pyramid of the depth prepass. Off on WebGL2, which can't
+// render to R32F without EXT_color_buffer_float or map buffers for the readback.
+extern bool use_occlusion_culling;
+#define HIZ_READBACK_WIDTH 160 // CPU tests use the first pyramid level at most this wide
+
+// Hierarchical-Z buffer. build() copies the prepass depth and reduces it into an R32F mip chain
+// where every texel holds the farthest depth it covers. The GPU cull samples the pyramid
+// directly, the CPU path reads back one small level asynchronously. Both test against the
+// pyramid with the view-projection it was built with, so results lag a frame or two and
+// stay conservative: anything nearer than the stored depth (or off the old view) is visible.
+class HiZBuffer {
+public:
+    HiZBuffer() = default;
+    ~HiZBuffer();
+
+    HiZBuffer(const HiZBuffer&) = delete;
+    HiZBuffer& operator=(const HiZBuffer&) = delete;
+
+    // Call right after the depth prepass, with the scene framebuffer still bound
+    void build(const glm::mat4& view_projection);
+
+    // Sphere test against the last CPU readback, false when there's nothing to test against
+    bool isOccluded(const glm::vec3& center, float radius) const;
+
+    bool gpuReady() const { return built; }
+    GLuint getTexture() const { return pyramid; }
+    int getLevels() const { return level_count; }
+    const glm::mat4& getViewProjection() const { return built_view_projection; }
+    // The world origin moved by delta (world_origin.h): the stored view-projections follow, so
+    // the pyramids still test the right places
+    void shiftOrigin(const glm::vec3& delta);
+
+private:
+    struct Readback {
+        GLuint pbo = 0;
+        glm::mat4 view_projection{1.0f};
+        bool pending = false;
+    };
+
+    bool init(int width, int height);
+    void release();
+    void readBack(const glm::mat4& view_projection);
+
+    std::unique_ptr<Shader> downsample_shader;
+    GLuint vao = 0;
+    GLuint pyramid_fbo = 0, pyramid = 0;
+    int width = 0, height = 0, level_count = 0;
+    bool built = false;
+    bool failed = false;
+    glm::mat4 built_view_projection{1.0f};
+
+    // Readback level and a two-frame PBO ring so mapping never waits on the GPU
+    int readback_level = 0;
+    int readback_width = 0, readback_height = 0;
+    Readback readbacks[2];
+    int readback_index = 0;
+
+    // CPU copy of the pyramid from readback_level down
+    std::vector<std::vector<float>> cpu_levels;
+    std::vector<glm::ivec2> cpu_sizes;
+    glm::mat4 cpu_view_projection{1.0f};
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+class Mesh;
+
+// Hierarchical LOD for the static chunks (static_batches.h): past the coarsest level of its
+// members, a chunk switches to proxies of its own, its members merged into one world-space mesh
+// per material and simplified together. Takes effect at the next bake.
+extern bool use_hlod;
+
+#define HLOD_MIN_MEMBERS 4         // Smaller chunks keep drawing their members
+#define HLOD_LEVELS 2              // Proxy levels per chunk, each coarser than the last
+#define HLOD_SCREEN_PIXELS 24.0f   // Member size on screen below which the first proxy takes over
+#define HLOD_LEVEL_SCREEN_STEP 0.4f // The next proxy takes over below this share of the previous size
+#define HLOD_TRIANGLE_RATIO 0.35f  // Triangles each level keeps of the one before
+#define HLOD_MAX_ERROR 0.01f       // Per level, relative to the chunk's extent, see simplifyMesh()
+
+// A member mesh and where the chunk places it
+struct HlodPart {
+    std::shared_ptr<Mesh> mesh;
+    std::vector<glm::mat4> models;
+};
+
+// One proxy of a chunk, drawn with an identity transform
+struct HlodProxy {
+    std::shared_ptr<Mesh> mesh;
+    const Mesh* source = nullptr; // A part it merged, whose material and cull mode it draws with
+};
+
+// The proxies of every level, levels[0] the finest. Parts sharing a mesh's material, cull mode
+// and vertex format merge, their vertices read back from the GPU and moved into world space in
+// that format. Empty when a part can't be merged (skinned, lightmapped or blended, or not
+// readable), so the chunk keeps its own levels. GL thread only.
+std::vector<std::vector<HlodProxy>> buildHlodLevels(const std::vector<HlodPart>& parts);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct LightBlock;
+
+// Image-based ambient from the skybox: diffuse irradiance as nine SH coefficients, specular as a
+// GGX-prefiltered cube whose mips go up in roughness, and the split-sum BRDF LUT. pbr.fs reads
+// them for a fixed-cost ambient term in place of fill lights.
+extern float ibl_intensity; // Scales both terms, 0 is unlit ambient
+#define IBL_SPECULAR_SIZE 128  // Prefiltered cube's top mip, roughness 0
+#define IBL_SPECULAR_MIPS 5    // Roughness (mip / (IBL_SPECULAR_MIPS - 1)) per level
+#define IBL_LUT_SIZE 64        // BRDF LUT, NdotV across, roughness up
+#define IBL_SAMPLES 64         // GGX samples per texel, prefilter and LUT alike
+#define IBL_SH_FACE_SAMPLES 64 // SH projection reads at most this many texels per face side
+
+// Results are cached in cache/ibl/ under a hash of the face images, with COOKED_IBL_VERSION.
+// A stale or missing entry is rebuilt and rewritten.
+#define COOKED_IBL_VERSION 1
+
+// GL thread only.
+class ImageBasedLighting {
+public:
+    ImageBasedLighting() = default;
+    ~ImageBasedLighting();
+
+    ImageBasedLighting(const ImageBasedLighting&) = delete;
+    ImageBasedLighting& operator=(const ImageBasedLighting&) = delete;
+
+    // faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X order, the same images cubemap was loaded from.
+    // The prefilter reads the cubemap's own mips. Without the specular half (its shader or
+    // framebuffer failing) the ambient is diffuse only.
+    void build(const char* const faces[6], GLuint cubemap);
+    // The same from a sky rendered on the GPU (atmosphere.h), a linear float cube of the given
+    // size with mips: the SH from a readback of a small mip, then the prefilter. Not cached.
+    void buildFromCubemap(GLuint cubemap, int size);
+
+    // LightBlock's ambient: the SH and the flags pbr.fs branches on. Before build() a flat 0.03.
+    void fillLightBlock(LightBlock& block) const;
+    // Prefiltered cube on unit, LUT on unit + 1
+    void bind(int unit) const;
+
+private:
+    bool loadCache(const std::string& path, uint64_t hash);
+    void writeCache(const std::string& path, uint64_t hash) const;
+    // Returns the faces' size, 0 if one couldn't be read
+    int projectSH(const char* const faces[6]);
+    void finishSH(const glm::vec3 coefficients[9], float totalWeight);
+    void computeBrdfLut();
+    // read_back keeps the texels in specular for the cache
+    bool prefilter(GLuint cubemap, int source_size, bool read_back = true);
+    void uploadSpecular();
+    void uploadLut();
+
+    // Irradiance over pi per coefficient, with the basis constants folded in (pbr.fs' irradianceSH)
+    glm::vec3 sh[9] = {};
+    bool sh_valid = false;
+
+    std::vector<float> lut;             // RG per texel
+    std::vector<unsigned char> specular; // RGBA8 per texel, mip by mip, faces in order, gamma 2.2
+    GLuint specular_texture = 0;
+    GLuint lut_texture = 0;
+};
+
+extern ImageBasedLighting ibl;
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+// One output channel for interleaveRGBA: a greyscale plane or a constant, optionally inverted
+struct ChannelSource {
+    const unsigned char* plane = nullptr; // nullptr = use constant
+    unsigned char constant = 0;
+    bool invert = false;                  // 255 - value
+};
+
+// Interleaves four channel sources into RGBA8 for pixels [begin, end).
+// SSE2/NEON/wasm SIMD where available, scalar otherwise.
+void interleaveRGBA(const ChannelSource sources[4], unsigned char* out, size_t begin, size_t end);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+class Mesh;
+
+// Hemi-octahedral impostor atlas: IMPOSTOR_FRAMES x IMPOSTOR_FRAMES views over the upper
+// hemisphere, each IMPOSTOR_FRAME_SIZE pixels square. Frame (x, y) looks along
+// -impostorFrameDirection(x, y) with the basis from impostorFrameBasis(), matching impostor.vs.
+#define IMPOSTOR_FRAMES 8
+#define IMPOSTOR_FRAME_SIZE 128
+
+struct Impostor {
+    GLuint albedo_atlas = 0;       // RGB albedo, A coverage
+    GLuint normal_depth_atlas = 0; // RGB mesh-space normal * 0.5 + 0.5, A depth along the view (0.5 = centre)
+    glm::vec3 center{0.0f};        // Mesh-space bounding sphere the frames are fitted to
+    float radius = 0.0f;
+    int frames = IMPOSTOR_FRAMES;
+
+    Impostor() = default;
+    ~Impostor();
+    Impostor(const Impostor&) = delete;
+    Impostor& operator=(const Impostor&) = delete;
+};
+
+// Direction from the object towards the viewer for a frame, y up
+glm::vec3 impostorFrameDirection(int x, int y, int frames);
+void impostorFrameBasis(const glm::vec3& direction, glm::vec3& right, glm::vec3& up);
+
+// Renders the meshes into a new atlas, GL thread only. Textures still streaming in are baked
+// from whatever levels are resident; at frame size the small tail mips are what gets sampled anyway.
+std::shared_ptr<Impostor> bakeImpostor(const std::vector<std::shared_ptr<Mesh>>& meshes);
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "geometry_arena.h" // InstanceTransform
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#define INSTANCE_RING_FRAMES 3
+#define INSTANCE_RING_INITIAL_BYTES (4 * 1024 * 1024) // Per frame, grows on overflow
+
+// Per-frame instance data (matrices and LOD fades) for every pass, appended into one buffer
+// instead of rewriting each mesh's own instance buffers several times a frame.
+// With ARB_buffer_storage the buffer is persistently mapped and split into one region per frame
+// in flight, each fenced before it is rewritten. Otherwise (GL 3.3, WebGL2) it is orphaned at
+// the start of the frame and written with glBufferSubData. GL thread only.
+class InstanceRing {
+public:
+    // Where a write() landed, valid until the next beginFrame()
+    struct Range {
+        GLuint buffer = 0;
+        size_t matrix_offset = 0; // Bytes
+        size_t fade_offset = 0;   // Bytes
+        size_t count = 0;
+    };
+
+    InstanceRing() = default;
+    ~InstanceRing();
+
+    InstanceRing(const InstanceRing&) = delete;
+    InstanceRing& operator=(const InstanceRing&) = delete;
+
+    // Waits until the GPU is done with the region this frame writes, endFrame() fences it
+    void beginFrame();
+    void endFrame();
+    void release();
+
+    // fades may be null, the instances then draw fully faded in. The matrices go in packed
+    // (InstanceTransform in geometry_arena.h).
+    Range write(const glm::mat4* matrices, const float* fades, size_t count);
+    // Per-instance data for attributes past 10, beside a write() for the same instances
+    struct Block {
+        GLuint buffer = 0;
+        size_t offset = 0; // Bytes
+    };
+    Block writeBytes(const void* data, size_t bytes);
+
+    // Room for count instances that the caller fills in place, from any thread: the mapped
+    // buffer itself when persistent, otherwise staging that commit() uploads. Reserving and
+    // committing are GL thread only. The pointers last until the next reserveInstances(),
+    // write() or writeBytes().
+    struct Reservation {
+        Range range;
+        InstanceTransform* transforms = nullptr;
+        float* fades = nullptr;
+    };
+    Reservation reserveInstances(size_t count);
+    void commit(const Reservation& reservation);
+
+    bool persistent() const { return mapped != nullptr; }
+    size_t frameBytes() const { return region_bytes; }
+    size_t bytesWritten() const { return head; }
+
+private:
+    void allocate(size_t bytes);
+    // Room for bytes in the current region, growing the ring if needed. Returns the offset.
+    size_t reserve(size_t bytes);
+
+    GLuint buffer = 0;
+    uint8_t* mapped = nullptr;
+    size_t region_bytes = 0;
+    size_t region = 0;
+    size_t head = 0; // Into the current region
+    GLsync fences[INSTANCE_RING_FRAMES] = {};
+    std::vector<GLuint> retired; // Outgrown this frame, passes may still draw from them
+    std::vector<InstanceTransform> packed; // Scratch for glBufferSubData writes
+    std::vector<float> packed_fades;       // reserveInstances()' staging, with packed
+};
+
+extern InstanceRing instance_ring;
+
+// Points the bound VAO's instance attributes (6-10) at a ring range, first_instance into it
+void pointInstanceRange(const InstanceRing::Range& range, size_t first_instance = 0);
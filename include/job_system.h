@@ -0,0 +1,84 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Outstanding spawn()ed jobs, wait() returns once they have all finished
+struct JobCounter {
+    std::atomic<unsigned int> pending{0};
+
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+// Fixed-size worker pool for CPU-only work. Jobs must never touch GL - hand results back to the
+// main thread instead. Without init() (and on Emscripten without WEB_THREADS) jobs run inline on the caller.
+//
+// Three kinds of work:
+//  - submit(): long background jobs (file I/O, decoding), one shared FIFO.
+//  - spawn(): short frame work. Each thread pushes to its own deque and pops its newest job,
+//    idle workers steal the oldest from the others. Waiting threads run these while they wait,
+//    never background jobs, so a frame never stalls behind an import.
+//  - spawnLong(): frame work the caller overlaps with its own (the CPU light clusters). A
+//    shared FIFO workers take ahead of background jobs. A waiting thread only runs one inline
+//    when it waits on that job's own counter, so an unrelated short wait never picks it up.
+class JobSystem {
+public:
+    ~JobSystem() { shutdown(); }
+
+    // 0 = one worker per hardware thread, minus the main thread
+    void init(unsigned int thread_count = 0);
+    void shutdown();
+
+    void submit(std::function<void()> job);
+    void waitIdle();
+
+    void spawn(std::function<void()> job, JobCounter& counter);
+    void spawnLong(std::function<void()> job, JobCounter& counter);
+    // Runs spawned jobs until the counter drains. Safe from inside a job, jobs can wait on
+    // the counters of the jobs they depend on.
+    void wait(JobCounter& counter);
+
+    // Splits [0, count) into grain-sized ranges run across the pool. The caller executes
+    // ranges too and only waits for ranges already in flight, so it is safe from inside a job.
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t begin, size_t end)>& fn);
+
+    unsigned int workerCount() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+    struct StealableJob {
+        std::function<void()> fn;
+        JobCounter* counter = nullptr;
+    };
+
+    // One per worker plus one shared by every other thread (the main thread), at the end
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<StealableJob> jobs;
+    };
+
+    void workerLoop(unsigned int index);
+    size_t queueIndex() const;
+    bool popStealable(size_t own, StealableJob& job);
+    bool popLong(const JobCounter& counter, StealableJob& job);
+    void runStealable(StealableJob& job);
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> work_queues;
+    std::atomic<unsigned int> stealable{0}; // Jobs sitting in work_queues
+
+    std::deque<std::function<void()>> queue; // Background jobs
+    std::deque<StealableJob> long_jobs;      // spawnLong(), under queue_mutex
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable idle_cv;
+    unsigned int active_jobs = 0;
+    bool stopping = false;
+};
+
+extern JobSystem job_system;
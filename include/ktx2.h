@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+#include <cstdint>
+
+struct ImageData;
+
+// Minimal KTX2 container support: a single 2D image or cubemap, no array layers,
+// block-compressed vkFormats plus R8G8B8A8_UNORM, no supercompression (Basis/zstd files are rejected).
+
+// Returns 0 for vkFormats we can't map to a GL compressed format
+GLenum ktx2FormatToGL(uint32_t vk_format);
+uint32_t glFormatToKTX2(GLenum gl_format);
+
+// Fills image.compressed_format/levels (RGBA8 files fill levels or pixels instead);
+// false if the file is missing, malformed or unsupported
+bool readKTX2(const std::string& path, ImageData& image);
+bool writeKTX2(const std::string& path, const ImageData& image);
+
+// The same for the six faces of a cube, in GL_TEXTURE_CUBE_MAP_POSITIVE_X order. Faces must
+// agree in size, format and mip count.
+bool readKTX2Cubemap(const std::string& path, ImageData faces[6]);
+bool writeKTX2Cubemap(const std::string& path, const ImageData faces[6]);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "entity_manager.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+struct MeshRequest;
+
+#define LAZY_PLACEHOLDER_COLOR glm::vec3(0.5f) // Flat grey, lit like any other mesh
+
+// The entity template for a model once it is in, built from its meshes
+using LazyTemplateFn = std::function<EntityTemplate(const std::vector<std::shared_ptr<Mesh>>& meshes)>;
+
+// Entities of models that may not be loaded yet (AssetLoader::declareMesh()). Creating them is
+// the model's first use and starts its import. Until it is in, each entity draws as a placeholder,
+// a unit box at its transform; then the placeholders still alive are swapped for entities made
+// from build(meshes), taking over where they stood by then. Models nothing creates are never
+// loaded, and ones whose entities are all gone leave on their own, as mesh_registry only holds
+// weak references. GL thread only.
+class LazyEntities {
+public:
+    LazyEntities() = default;
+
+    LazyEntities(const LazyEntities&) = delete;
+    LazyEntities& operator=(const LazyEntities&) = delete;
+
+    // Entities straight away when the model is ready, otherwise the placeholders' handles.
+    // Either way the handles go stale once the real entities replace the placeholders.
+    std::vector<EntityHandle> create(const std::shared_ptr<MeshRequest>& request, LazyTemplateFn build,
+                                     const std::vector<EntityTransform>& transforms);
+
+    // Once a frame after AssetLoader::processUploads(), replaces the placeholders of models now in
+    void update();
+    // Drops the waiting entries and the placeholder mesh, before GL goes away
+    void release();
+
+    size_t waitingCount() const { return waiting.size(); }
+    size_t placeholderCount() const;
+
+private:
+    struct Waiting {
+        std::shared_ptr<MeshRequest> request;
+        LazyTemplateFn build;
+        std::vector<EntityHandle> placeholders;
+    };
+
+    std::shared_ptr<Mesh> placeholderMesh();
+
+    std::vector<Waiting> waiting;
+    std::shared_ptr<Mesh> placeholder;
+};
+
+extern LazyEntities lazy_entities;
@@ -8,13 +8,23 @@
 #include <vector>
 #include <memory>
 #include <cmath>
+#include "entity_manager.h" // createEntity()
+#include "frame_uniforms.h" // GpuLight
 
 // Forward declarations
 class Mesh;
 class EntityManager;
 extern EntityManager entity_manager;
 
-#define MAX_LIGHTS 8
+// Scene lights. Local ones are clustered (CLUSTER_MAX_LIGHTS), up to FRAME_UNIFORMS_MAX_LIGHTS
+// of them a frame cast shadows.
+#define MAX_LIGHTS 1024
+// Local lights reach until their 1/d^2 radiance drops below LIGHT_CUTOFF_RADIANCE, never past
+// LIGHT_MAX_RANGE. pbr.fs windows the falloff to zero there, so the clusters, shadow views and
+// light culling all stop at the same sphere.
+#define LIGHT_CUTOFF_RADIANCE 0.01f
+#define LIGHT_MAX_RANGE 100.0f
+#define LIGHT_MIN_RANGE 1.0f // Keeps the shadow projections' far plane past their near one
 
 typedef enum {
     DIR_LIGHT = 0,
@@ -33,24 +43,54 @@ typedef struct {
     int type;
     
     std::string entity_name;
+    EntityHandle entity; // Visible proxy, null for lights without meshes
+
+    // Already in the lightmaps (lightmap.h): lightmapped surfaces skip it, everything else still
+    // shades it. Moving a baked light leaves its old contribution there until the next bake.
+    bool baked = false;
 } Light;
 
 extern std::vector<Light> lights;
+
+// Index into lights, which only ever grows, so a handle stays valid. Null when the create failed.
+struct LightHandle {
+    uint32_t index = UINT32_MAX;
+
+    bool isNull() const { return index == UINT32_MAX; }
+};
+
+// GpuLight copies of lights, index for index, kept in step by the functions below. Each change
+// widens a dirty range, and only that range is uploaded (LightClusters::uploadLights()) instead
+// of repacking every light each frame. Code writing lights[] directly calls markLightDirty().
+const std::vector<GpuLight>& gpuLights();
+void markLightDirty(size_t index);
+// The range changed since the last call, empty when begin == end
+void takeDirtyLights(size_t& begin, size_t& end);
+// The light's LightBlock slot this frame (cutoff.y), only dirties it when the slot moved
+void setLightFrameIndex(size_t index, int frame_index);
+void setLightBaked(size_t index, bool baked);
+
+// Radius of a local light's influence, from its intensity and brightest channel
+float lightRange(const Light& light);
 extern unsigned int SHADOW_WIDTH;
 extern unsigned int SHADOW_HEIGHT;
 
-// Forward declarations for functions that will be defined in main.cpp
-// These are called by light functions
-void createEntity(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs, glm::vec3 pos, glm::vec3 rotation, glm::vec3 scale, std::vector<int> cull_modes);
 
 // Light system functions
 glm::vec3 convertVecToEuler(glm::vec3 direction, glm::vec3 offset);
 
-void createDirLight(std::string name, glm::vec3 direction, glm::vec3 color, int intensity);
-void createSpotlight(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs, glm::vec3 position, glm::vec3 color, int intensity,
+LightHandle createDirLight(std::string name, glm::vec3 direction, glm::vec3 color, int intensity);
+LightHandle createSpotlight(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs, glm::vec3 position, glm::vec3 color, int intensity,
                     glm::vec3 direction, float inner_angle_deg, float outer_angle_deg,
                     glm::vec3 scale, std::vector<int> cull_mode);
-void createPointLight(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs,
+LightHandle createPointLight(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs,
                       glm::vec3 position, glm::vec3 color, int intensity,
                       glm::vec3 scale, std::vector<int> cull_mode);
-void updateLight(std::string name, glm::vec3 position, glm::vec3 color, int intensity, glm::vec3 rotation);
\ No newline at end of file
+// Lights whose proxy is parented to another entity take the proxy's world position, so a lamp
+// attached to something moves with it. Run after EntityManager::updateTransforms().
+void syncLightsToProxies();
+// Linear over lights, per-frame code should keep the handle
+LightHandle findLight(const std::string& name);
+// NaN components and a negative intensity keep the current value
+void updateLight(LightHandle handle, glm::vec3 position, glm::vec3 color, int intensity, glm::vec3 rotation);
+void updateLight(const std::string& name, glm::vec3 position, glm::vec3 color, int intensity, glm::vec3 rotation);
\ No newline at end of file
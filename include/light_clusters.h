@@ -0,0 +1,112 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "job_system.h"
+#include "shader.h"
+
+struct GpuLight;
+
+// Clustered forward shading for the local (point and spot) lights. The view frustum is cut into
+// CLUSTER_X x CLUSTER_Y screen tiles and CLUSTER_Z depth slices, exponential between the near
+// and far planes, and every cluster lists the lights whose range reaches it. pbr.fs only
+// walks its fragment's list. Assignment runs on the job system, or in a compute shader with
+// use_gpu_light_clusters on GL 4.3. The job system's assignment only needs the camera and the
+// lights, so update() starts it on the workers and returns; the shadow pass, culling and prepass
+// are submitted meanwhile, and bind() waits for it and uploads the result.
+extern bool use_gpu_light_clusters;
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define CLUSTER_MAX_LIGHTS 1024    // Scene lights the clusters can index, MAX_LIGHTS in light.h
+#define CLUSTER_INDEX_WIDTH 1024   // Texels per row of the index list
+#define CLUSTER_MAX_INDICES (CLUSTER_INDEX_WIDTH * 256) // Light references over every cluster
+#define CLUSTER_GROUP_SIZE 64      // Matches local_size_x in light_clusters.comp
+
+// Three textures that GL 3.3 and WebGL2 can both texelFetch: the lights (RGBA32F, a row of four
+// texels per scene light, GpuLight's layout, rewritten only where lights changed), the clusters
+// (RG32UI, offset and count into the index list, a row per slice) and the index list itself
+// (R32UI, CLUSTER_INDEX_WIDTH wide, scene light indices). The compute path writes the last two
+// into buffers and unpacks them into the textures on the GPU.
+// GL thread only.
+class LightClusters {
+public:
+    LightClusters() = default;
+    ~LightClusters();
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // Rows [begin, end) of the light texture from gpuLights() (light.h), the whole list the
+    // first time
+    void uploadLights(const std::vector<GpuLight>& lights, size_t begin, size_t end);
+    // Assigns this frame's visible local lights, indices into lights below CLUSTER_MAX_LIGHTS.
+    // GpuLight::cutoff.z must hold the light's range. On the CPU path it only starts the jobs.
+    void update(const std::vector<GpuLight>& lights, const uint32_t* visible, size_t visible_count,
+                const glm::mat4& view, const glm::mat4& projection, float near_plane, float far_plane);
+    // Waits for the assignment update() started and uploads it, nothing when none is running
+    void finish();
+
+    // Binds the lights, clusters and indices on first_unit and the two units after it, after finish()
+    void bind(int first_unit);
+
+    // pbr.fs' slice from view depth: floor(log(depth) * scale + bias)
+    float depthScale() const { return depth_scale; }
+    float depthBias() const { return depth_bias; }
+
+    int lightCount() const { return light_count; }
+    // CPU path only, 0 when the compute shader assigned. Up to date after finish().
+    int indexCount() const { return index_count; }
+    int maxClusterLights() const { return max_cluster_lights; }
+
+private:
+    struct ClusterBounds {
+        glm::vec4 min; // View space, w unused
+        glm::vec4 max;
+    };
+
+    bool init();
+    void release();
+    // View-space boxes of every cluster, only when the projection changed
+    void buildBounds(const glm::mat4& projection, float near_plane, float far_plane);
+    // Runs as a job: only the scratch below, spheres and bounds, no GL
+    void assignOnCpu();
+    void uploadCpuAssignment();
+    bool assignOnGpu(const std::vector<glm::vec4>& spheres);
+
+    GLuint light_texture = 0;
+    GLuint grid_texture = 0;
+    GLuint index_texture = 0;
+    bool initialized = false;
+    bool lights_uploaded = false; // The texture holds every light, later uploads are ranges
+
+    std::vector<ClusterBounds> bounds;
+    glm::mat4 bounds_projection{0.0f};
+    float bounds_near = 0.0f;
+    float bounds_far = 0.0f;
+    float depth_scale = 0.0f;
+    float depth_bias = 0.0f;
+
+    // CPU assignment scratch, the job's own until finish()
+    std::vector<glm::vec4> spheres; // View space by scene index, negative radius for none
+    JobCounter cpu_job;
+    bool cpu_pending = false;
+    std::vector<std::vector<uint32_t>> slice_lights;  // Per slice, the lights reaching its depth range
+    std::vector<std::vector<uint32_t>> slice_indices; // Per slice, its clusters' lists back to back
+    std::vector<glm::uvec2> grid;
+    std::vector<uint32_t> indices;
+
+    // Compute path, created on first use
+    std::unique_ptr<Shader> assign_shader;
+    bool gpu_failed = false;
+    GLuint sphere_buffer = 0, bounds_buffer = 0, grid_buffer = 0, index_buffer = 0, counter_buffer = 0;
+    bool bounds_uploaded = false;
+
+    int light_count = 0; // Visible this frame
+    int index_count = 0;
+    int max_cluster_lights = 0;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "shader.h"
+
+struct SubMeshStaging;
+struct GpuLight;
+
+// Baked lighting for static geometry. Meshes requested before they load get a second UV set of
+// non-overlapping charts at import (cooked along with the mesh). Renderer::bakeLightmaps() then
+// renders the current lights into one atlas layer per mesh, and pbr.fs reads that in place of
+// every baked light (Light::baked), so their cost on those surfaces no longer grows with the
+// light count. Indirect light stays with the image-based ambient.
+extern bool use_lightmaps; // Off shades every light dynamically again, the bake is kept
+#define LIGHTMAP_SIZE 1024        // Texels per atlas layer side, one mesh per layer
+#define LIGHTMAP_MAX_LAYERS 16    // Meshes past this stay dynamically lit
+#define LIGHTMAP_PADDING 2        // Texels around each chart, filled by dilation
+#define LIGHTMAP_RGBM_RANGE 8.0f  // Largest irradiance / pi the RGBA8 texels hold, must match pbr.fs
+#define LIGHTMAP_BAKE_TILE 256    // Rows per bake draw, keeps long light lists from stalling the GPU
+
+// Import side. Paths are keyed like MeshRegistry. Safe from the import workers.
+void requestLightmapUVs(const std::string& filepath);
+bool wantsLightmapUVs(const std::string& filepath);
+
+// Box-projects the sub-mesh into charts (triangles sharing vertices and a dominant axis), splits
+// the vertices on chart borders and shelf-packs the charts into LIGHTMAP_SIZE with padding.
+// Adds VERTEX_LIGHTMAP_UV to the format. False leaves the sub-mesh as it was.
+bool generateLightmapUVs(const char* name, SubMeshStaging& sub);
+
+// The atlas and the bake's scratch targets. GL thread only.
+class LightmapAtlas {
+public:
+    LightmapAtlas() = default;
+    ~LightmapAtlas();
+
+    LightmapAtlas(const LightmapAtlas&) = delete;
+    LightmapAtlas& operator=(const LightmapAtlas&) = delete;
+
+    // Fresh atlas of at most LIGHTMAP_MAX_LAYERS layers, false if it or the shaders can't be made
+    bool begin(int layer_count);
+    int layers() const { return layer_count; }
+
+    // The bake lights as four RGBA32F texels each, like the light clusters, bound on unit
+    void uploadLights(const std::vector<GpuLight>& lights, int unit);
+    // Binds and clears the scratch target at LIGHTMAP_SIZE, the caller draws into it
+    void beginLayer();
+    // Dilates the scratch target into the layer, scratch_unit is free for the read
+    void endLayer(int layer, int scratch_unit);
+
+    void bind(int unit) const;
+    bool empty() const { return texture == 0; }
+    void release();
+
+private:
+    bool init();
+
+    std::unique_ptr<Shader> dilate_shader;
+    GLuint texture = 0;        // RGBA8 RGBM array, a layer per mesh
+    GLuint scratch_texture = 0; // RGBA8 RGBM, alpha 0 where no chart covers
+    GLuint scratch_fbo = 0;
+    GLuint layer_fbo = 0;
+    GLuint lights_texture = 0;
+    GLuint vao = 0;
+    int lights_capacity = 0;
+    int layer_count = 0;
+    bool failed = false;
+};
+
+extern LightmapAtlas lightmap_atlas;
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+// Where loading time goes, per asset and per stage. LoadTimer brackets one stage and records its
+// exclusive time (nested timers, e.g. the decodes inside an ORM pack, are subtracted from their
+// parent) against the asset of the innermost LoadAssetScope on its thread. report() prints the
+// assets slowest first once loading is done, and writes them as JSON with --load-report <file>.
+// glGenerateMipmap is timed on the CPU only, the driver may finish it later. Thread-safe.
+enum LoadStage {
+    LOAD_STAGE_COOKED_READ = 0, // Cooked mesh cache
+    LOAD_STAGE_MESH_DECODE,     // Cooked vertex and index codecs
+    LOAD_STAGE_ASSIMP_READ,     // Importer::ReadFile
+    LOAD_STAGE_VERTEX_ENCODE,   // Interleaving vertices, gathering indices
+    LOAD_STAGE_MESH_PROCESS,    // Lightmap UVs, optimisation, LODs
+    LOAD_STAGE_COOK_WRITE,      // Writing the cooked mesh
+    LOAD_STAGE_IMAGE_READ,      // stbi_load and KTX2 reads
+    LOAD_STAGE_ORM_PACK,
+    LOAD_STAGE_TEXTURE_COMPRESS,
+    LOAD_STAGE_MIP_CHAIN,       // CPU-built mip chains
+    LOAD_STAGE_MESH_UPLOAD,
+    LOAD_STAGE_TEXTURE_UPLOAD,
+    LOAD_STAGE_GENERATE_MIPMAP,
+    LOAD_STAGE_COUNT,
+};
+extern const char* const LOAD_STAGE_NAMES[LOAD_STAGE_COUNT];
+
+class LoadStats {
+public:
+    struct AssetTimes {
+        double ms[LOAD_STAGE_COUNT] = {};
+        double total_ms = 0.0;
+        uint64_t bytes_read = 0, bytes_uploaded = 0;
+    };
+
+    // --load-report <file> at argv[i]: how many arguments it took, 0 when it isn't one, -1 on a bad value
+    int parseArg(int argc, char** argv, int i);
+
+    void record(const std::string& asset, LoadStage stage, double ms, uint64_t bytes_read, uint64_t bytes_uploaded);
+    // The report so far to the console, and to the --load-report file when there is one
+    void report();
+    // Every asset recorded so far summed, and how many there are
+    AssetTimes totals(size_t* asset_count = nullptr) const;
+
+private:
+    AssetTimes sum() const; // With mutex held
+
+    bool writeJson(const std::string& path) const;
+
+    mutable std::mutex mutex;
+    std::map<std::string, AssetTimes> assets;
+    std::string report_file;
+};
+
+extern LoadStats load_stats;
+
+// Names the asset the timers on this thread record against, until it goes out of scope
+class LoadAssetScope {
+public:
+    explicit LoadAssetScope(std::string asset);
+    ~LoadAssetScope();
+
+    // The calling thread's asset, empty outside any scope. Jobs a loader fans out take it along.
+    static std::string current();
+
+    LoadAssetScope(const LoadAssetScope&) = delete;
+    LoadAssetScope& operator=(const LoadAssetScope&) = delete;
+
+private:
+    std::string asset;
+    LoadAssetScope* parent;
+    friend class LoadTimer;
+};
+
+class LoadTimer {
+public:
+    explicit LoadTimer(LoadStage stage);
+    ~LoadTimer();
+
+    LoadTimer(const LoadTimer&) = delete;
+    LoadTimer& operator=(const LoadTimer&) = delete;
+
+    void addBytesRead(uint64_t bytes) { bytes_read += bytes; }
+    void addBytesUploaded(uint64_t bytes) { bytes_uploaded += bytes; }
+
+private:
+    LoadStage stage;
+    std::chrono::steady_clock::time_point start;
+    double child_ms = 0.0; // Spent in timers nested in this one
+    uint64_t bytes_read = 0, bytes_uploaded = 0;
+    LoadTimer* parent;
+};
@@ -8,6 +8,11 @@
 // Forward declaration
 extern GLuint default_texture_id;
 
+// Parallax occlusion layers, must match pbr.fs. pbr.fs takes about one per screen pixel the relief
+// shifts by, at least four, up to the material's cap.
+#define PARALLAX_MAX_LAYERS 64
+#define PARALLAX_DEFAULT_LAYERS 32
+
 enum AlphaMode {
     OPAQUE,   // No transparency - fastest
     MASKED,   // Alpha cutout - No sorting needed
@@ -35,6 +40,9 @@ public:
     
     float height_scale = 0.01f;
     bool invert_height = false;
+    int parallax_max_layers = PARALLAX_DEFAULT_LAYERS; // Quality cap on the height map, 0 = flat
+
+    int lightmap_layer = -1; // In lightmap_atlas once baked (lightmap.h), -1 = lit dynamically
     
     Material() = default;
     Material(const std::string& name) : name(name) {}
@@ -45,6 +53,56 @@ public:
     bool hasEmissiveMap() const { return emissive_map != 0; }
     bool hasHeightMap() const { return height_map != 0; }
     bool hasSpecularMap() const { return specular_map != 0; }
+    bool hasLightmap() const { return lightmap_layer >= 0; }
+
+    // True when binding either material sets the same textures and uniforms
+    bool bindsLike(const Material& other) const {
+        return albedo_map == other.albedo_map && normal_map == other.normal_map && orm_map == other.orm_map &&
+               height_map == other.height_map && emissive_map == other.emissive_map &&
+               base_color == other.base_color && metallic == other.metallic && roughness == other.roughness &&
+               ao == other.ao && emissive == other.emissive && height_scale == other.height_scale &&
+               parallax_max_layers == other.parallax_max_layers && lightmap_layer == other.lightmap_layer;
+    }
+};
+
+// Resolved source description of a material, before any textures are loaded.
+// Stored in cooked mesh files so warm starts can rebuild materials without Assimp.
+struct MaterialDesc {
+    std::string name = "unnamed";
+
+    bool has_base_color = false;
+    glm::vec3 base_color{1.0f, 1.0f, 1.0f};
+    float metallic = 0.0f;
+    float roughness = 0.5f;
+    glm::vec3 emissive{0.0f, 0.0f, 0.0f};
+    float height_scale = 0.01f;
+    bool invert_height = false;
+
+    // Resolved texture paths ("*N" for textures embedded in the source scene)
+    std::string albedo_path;
+    std::string normal_path;
+    std::string emissive_path;
+    std::string ao_path;
+    std::string roughness_path;
+    std::string metallic_path;
+    std::string height_path;
+    std::string specular_path;
+
+    // Source model, only used to key embedded textures in the texture cache (not cooked)
+    std::string model_path;
+
+    bool hasORMSources() const {
+        return !ao_path.empty() || !roughness_path.empty() || !metallic_path.empty() ||
+               !height_path.empty() || !specular_path.empty();
+    }
+
+    bool usesEmbeddedTextures() const {
+        for (const std::string* p : {&albedo_path, &normal_path, &emissive_path, &ao_path,
+                                     &roughness_path, &metallic_path, &height_path, &specular_path}) {
+            if (!p->empty() && (*p)[0] == '*') return true;
+        }
+        return false;
+    }
 };
 
 Material createDefaultMaterial();
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "material.h"
+
+class Mesh;
+
+// Over the fields Material::bindsLike() compares
+struct MaterialHash {
+    size_t operator()(const Material& material) const;
+};
+
+// Binds alike and sorts into the same pass
+struct MaterialEqual {
+    bool operator()(const Material& a, const Material& b) const {
+        return a.alphaMode == b.alphaMode && a.bindsLike(b);
+    }
+};
+
+// Every distinct material the scene was given, interned under a stable id. A material handed in
+// again, from another import or another template's overrides, comes back as the first one's id,
+// and its entry holds references on its textures until clear().
+// Entities wanting a mesh in another material get it from withMaterial(): the mesh itself when
+// it already has it, otherwise one variant (createMeshVariant()) per mesh and material id,
+// shared by every entity asking, rather than the shared mesh being rewritten under the other
+// templates still drawing it. Only weak references to the variants are kept, so they go with
+// their last entity, and refresh() rebuilds them in place when their mesh is reloaded.
+// GL thread only.
+class MaterialRegistry {
+public:
+    MaterialRegistry() = default;
+    MaterialRegistry(const MaterialRegistry&) = delete;
+    MaterialRegistry& operator=(const MaterialRegistry&) = delete;
+
+    uint32_t intern(const Material& material);
+    const Material& material(uint32_t id) const { return materials[id]; }
+    size_t size() const { return materials.size(); }
+
+    std::shared_ptr<Mesh> withMaterial(const std::shared_ptr<Mesh>& mesh, uint32_t id);
+    // After the mesh's contents were swapped for a reload's, see MeshRegistry::replace()
+    void refresh(const std::shared_ptr<Mesh>& mesh);
+    size_t variantCount() const { return variants.size(); }
+
+    // Drops the variants and the materials' texture references, call when the meshes are released
+    void clear();
+
+private:
+    struct VariantKey {
+        const Mesh* mesh;
+        uint32_t material;
+        bool operator==(const VariantKey& other) const { return mesh == other.mesh && material == other.material; }
+    };
+    struct VariantKeyHash {
+        size_t operator()(const VariantKey& key) const {
+            return std::hash<const void*>{}(key.mesh) ^ ((size_t)key.material * 0x9e3779b97f4a7c15ull);
+        }
+    };
+
+    struct Variant {
+        std::weak_ptr<Mesh> source; // A mesh freed since, whose address came back, misses
+        std::weak_ptr<Mesh> mesh;
+    };
+
+    void prune();
+
+    std::vector<Material> materials; // By id
+    std::unordered_map<Material, uint32_t, MaterialHash, MaterialEqual> ids;
+    std::unordered_map<VariantKey, Variant, VariantKeyHash> variants;
+    size_t pruned_size = 0; // Variant count after the last sweep of expired ones
+};
+
+extern MaterialRegistry material_registry;
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class Material;
+
+// Entries in the GPU block, 64 bytes each fills exactly the 16KB uniform block minimum.
+// The last slot is scratch, materials past it are written there as they bind.
+#define MATERIAL_TABLE_SLOTS 256
+#define MATERIAL_BLOCK_BINDING 3 // After the frame_uniforms.h blocks
+
+// Texture presence bits, which pick the pbr.fs variant a material draws with
+#define MATERIAL_FLAG_ALBEDO_MAP   1
+#define MATERIAL_FLAG_NORMAL_MAP   2
+#define MATERIAL_FLAG_ORM_MAP      4
+#define MATERIAL_FLAG_HEIGHT_MAP   8
+#define MATERIAL_FLAG_EMISSIVE_MAP 16
+#define MATERIAL_FLAG_LIGHTMAP     32 // Baked and use_lightmaps on
+
+// std140 array element of MaterialBlock in pbr.fs
+struct GpuMaterial {
+    glm::vec4 base_color{1.0f}; // w = metallic
+    glm::vec4 emissive{0.0f};   // w = roughness
+    float ao = 1.0f;
+    float height_scale = 0.0f;
+    int32_t lightmap_layer = -1;
+    int32_t parallax_max_layers = 0;
+    int32_t albedo_layer = -1; // In the albedo map's texture_atlas array, -1 samples the map itself
+    int32_t padding[3] = {0, 0, 0};
+};
+
+// MATERIAL_FLAG_* for the textures the material has
+uint32_t materialFeatures(const Material& material);
+
+// This frame's distinct materials. Meshes carry their own Material copies, so identical ones
+// (Material::bindsLike) are merged here into one id, which is also the draw sort state. The
+// scalars live in a uniform block, so switching materials is the texture binds plus one index
+// uniform. Rebuilt every frame, materials may change between frames.
+// GL thread only.
+class MaterialTable {
+public:
+    MaterialTable() = default;
+    ~MaterialTable();
+
+    MaterialTable(const MaterialTable&) = delete;
+    MaterialTable& operator=(const MaterialTable&) = delete;
+
+    void beginFrame();
+    // Same id for every material that binds like one seen before this frame
+    uint32_t idFor(const Material& material);
+    // The first material registered under the id
+    const Material* material(uint32_t id) const { return materials[id]; }
+    size_t size() const { return materials.size(); }
+
+    // Uploads entries added since the last upload, call once before the draws
+    void upload();
+    // Block slot to point the shader's materialIndex at. Uploads late entries on the way, and
+    // rewrites the scratch slot for ids past the block.
+    int slotFor(uint32_t id);
+
+    void release();
+
+private:
+    static GpuMaterial pack(const Material& material);
+    void rehash(size_t bucket_count);
+
+    std::vector<const Material*> materials;
+    std::vector<size_t> hashes;    // Per id
+    std::vector<uint32_t> buckets; // Open addressing, id + 1 (0 = empty), power of two sized
+
+    GLuint buffer = 0;
+    size_t uploaded = 0;              // Entries already in the buffer this frame
+    uint32_t scratch_id = UINT32_MAX; // Id in the scratch slot
+};
@@ -1,34 +1,159 @@
 #pragma once
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 #include "material.h"
+#include "texture_cache.h"
+#include "geometry_arena.h"
+#include "gpu_memory.h"
+#include "mesh_pool.h"
+#include "vertex_pulling.h"
+#include "meshlets.h"
+#include "gl_deletion_queue.h"
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 
 typedef struct {
     float u, v;
 } Vec2;
 
+// Interleaved layout: position(3) colour(4) uv(2) normal(3) tangent(3) bitangent(3), then the
+// lightmap uv(2) when the mesh has one
+#define MESH_FLOATS_PER_VERTEX 18
+
+// Packed layout (28 bytes at most instead of 72):
+//   position  3 x float
+//   normal    GL_INT_2_10_10_10_REV (snorm)
+//   tangent   GL_INT_2_10_10_10_REV (snorm), w = bitangent sign
+//   uv        2 x half, or 2 x float when the UVs tile too far for half precision
+//   colour    RGBA8, only when the source has vertex colours
+//   lightmap  2 x unorm16, only for meshes imported with lightmap UVs (lightmap.h)
+//   skin      4 x uint8 bone indices and 4 x unorm8 weights, only for skinned meshes (skinning.h)
+enum VertexFormatFlags : uint32_t {
+    VERTEX_PACKED      = 1 << 0,
+    VERTEX_HALF_UV     = 1 << 1,
+    VERTEX_HAS_COLOR   = 1 << 2,
+    VERTEX_LIGHTMAP_UV = 1 << 3, // Attribute 11, either layout
+    VERTEX_SKINNED     = 1 << 4, // Attributes 13 and 14, either layout
+};
+
+// Meshes with at most this many vertices get 16-bit index buffers. Not 65536: index 0xFFFF is
+// the primitive restart index WebGL2 always has enabled, so it can't name a vertex.
+#define MESH_MAX_16BIT_VERTICES 65535
+
+inline size_t getIndexSize(GLenum index_type) {
+    return index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+// Half UVs lose sub-texel precision past this range
+#define MESH_HALF_UV_LIMIT 2.0f
+
+struct VertexLayout {
+    uint32_t format = VERTEX_HAS_COLOR;
+    uint32_t stride = MESH_FLOATS_PER_VERTEX * sizeof(float);
+    uint32_t uv_offset = 7 * sizeof(float);
+    uint32_t color_offset = 3 * sizeof(float);
+    uint32_t lightmap_uv_offset = 0; // Only with VERTEX_LIGHTMAP_UV
+    uint32_t skin_offset = 0;        // Only with VERTEX_SKINNED, the bone indices then the weights
+};
+
+inline VertexLayout getVertexLayout(uint32_t format) {
+    VertexLayout layout;
+    layout.format = format;
+    if (format & VERTEX_PACKED) {
+        layout.uv_offset = 20;
+        layout.stride = layout.uv_offset + ((format & VERTEX_HALF_UV) ? 4 : 8);
+        layout.color_offset = layout.stride;
+        if (format & VERTEX_HAS_COLOR) layout.stride += 4;
+    }
+
+    if (format & VERTEX_LIGHTMAP_UV) {
+        layout.lightmap_uv_offset = layout.stride;
+        layout.stride += (format & VERTEX_PACKED) ? 2 * sizeof(uint16_t) : 2 * sizeof(float);
+    }
+    if (format & VERTEX_SKINNED) {
+        layout.skin_offset = layout.stride;
+        layout.stride += 8;
+    }
+    return layout;
+}
+
 typedef enum {
     CULL_NONE = 0, CULL_BACK = 1, CULL_FRONT = 2
 } CullMode;
 
+// What a mesh keeps on the CPU once its buffers are uploaded
+enum MeshResidency {
+    MESH_RESIDENCY_NONE,      // Nothing, the GPU copy is the only one
+    MESH_RESIDENCY_POSITIONS, // Positions and indices, for CPU picking and physics
+    MESH_RESIDENCY_FULL,      // The interleaved vertices and indices as uploaded
+};
+
+// Where a node of a model imported with node instancing (requestNodeInstancing() in
+// mesh_loader.h) places one of its sub-meshes, the transform composed down from the root
+struct MeshNodeInstance {
+    uint32_t submesh = 0;
+    glm::mat4 transform{1.0f};
+};
+
 class Mesh {
 public:
-    std::vector<float> vertices_data;
-    std::vector<unsigned int> indices_data;
+    // CPU copies left after upload, per mesh_residency (mesh_loader.h), empty by default
+    std::vector<unsigned char> vertices_data; // Interleaved, see vertex_layout (MESH_RESIDENCY_FULL)
+    std::vector<glm::vec3> positions_data;    // MESH_RESIDENCY_POSITIONS
+    std::vector<unsigned char> indices_data;  // In index_type, with either
+    VertexLayout vertex_layout;
     
     unsigned int TRIANGLE_COUNT;
     unsigned int INDEX_COUNT;
+    GLenum index_type = GL_UNSIGNED_INT; // GL_UNSIGNED_SHORT when every index fits in 16 bits
     GLuint VAO, VBO, EBO, instanceVBO;
+    GLuint instanceFadeVBO = 0; // Per-instance LOD cross-fade (attribute 10), see Entity::forEachLODMesh
+    // Position and UV only, for depth-only passes (use_depth_streams). 0 draws them from VAO.
+    // Shares EBO and the instance buffers; depthVBO holds the positions then the UVs.
+    GLuint depthVAO = 0;
+    GLuint depthVBO = 0;
+    // The depth streams with quantized positions, for shadow casters (use_quantized_shadow_positions).
+    // 0 when the mesh's bounds were too wide, it then draws them from depthVAO. Without an arena the
+    // quantized positions follow the UVs in depthVBO.
+    GLuint shadowVAO = 0;
+    PositionQuantization shadow_quantization;
+    // The copy in vertex_pulling's pool, when it's pooling
+    PulledGeometry pulled;
+    // Clusters of the index buffer for meshlet culling (meshlets.h), null for meshes too small to
+    // split. Shared with variants.
+    std::shared_ptr<const std::vector<Meshlet>> meshlets;
+
+    // Set when the geometry lives in a shared arena. VAO, depthVAO, shadowVAO and the instance buffers are then
+    // the arena's (shared with every mesh of the same format) and VBO/EBO/depthVBO stay 0.
+    std::shared_ptr<GeometryArena> arena;
+    GeometryAllocation geometry;
     Material material;
     int cull_mode;
     bool is_cleaned_up;
+
+    // Generated lower detail levels sharing this mesh's material, coarsest last
+    std::vector<std::shared_ptr<Mesh>> lods;
+    // Set on a variant from createMeshVariant(), whose GL objects and arena range are this
+    // mesh's and only borrowed. Kept alive, and left alone by cleanup().
+    std::shared_ptr<Mesh> geometry_owner;
+    float lod_error = 0.0f; // Simplification error relative to the mesh extent
+
+    // Bounding sphere and AABB in mesh space, radius 0 = no bounds
+    glm::vec3 bounds_center{0.0f};
+    float bounds_radius = 0.0f;
+    glm::vec3 bounds_min{0.0f}, bounds_max{0.0f};
+
+    // Small sequential id for draw sort keys, unique per constructed mesh
+    uint32_t draw_id = nextDrawId();
+    // The mesh's record in mesh_pool once its buffers are uploaded, released by cleanup()
+    MeshHandle pool_handle = MESH_HANDLE_NULL;
     
-    // NEW: Instance buffer properties
-    size_t maxInstances = 1000;
-    
-    Mesh() : TRIANGLE_COUNT(0), VAO(0), VBO(0), EBO(0), instanceVBO(0), 
+    Mesh() : TRIANGLE_COUNT(0), INDEX_COUNT(0), VAO(0), VBO(0), EBO(0), instanceVBO(0), 
              cull_mode(CULL_NONE), is_cleaned_up(false) {
         material = createDefaultMaterial();
     }
@@ -37,21 +162,150 @@ public:
         cleanup();
     }
     
+    static uint32_t nextDrawId() {
+        static std::atomic<uint32_t> next{0};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Trades geometry, GL objects and material with other. Both keep their identity (draw_id, and
+    // the lod Mesh objects, whose contents are traded pairwise). Hot reload moves a new import into
+    // the handles entities already hold this way, other then releases the old contents.
+    void swapContents(Mesh& other) {
+        std::swap(vertices_data, other.vertices_data);
+        std::swap(positions_data, other.positions_data);
+        std::swap(indices_data, other.indices_data);
+        std::swap(vertex_layout, other.vertex_layout);
+        std::swap(TRIANGLE_COUNT, other.TRIANGLE_COUNT);
+        std::swap(INDEX_COUNT, other.INDEX_COUNT);
+        std::swap(index_type, other.index_type);
+        std::swap(VAO, other.VAO);
+        std::swap(VBO, other.VBO);
+        std::swap(EBO, other.EBO);
+        std::swap(instanceVBO, other.instanceVBO);
+        std::swap(instanceFadeVBO, other.instanceFadeVBO);
+        std::swap(depthVAO, other.depthVAO);
+        std::swap(depthVBO, other.depthVBO);
+        std::swap(shadowVAO, other.shadowVAO);
+        std::swap(shadow_quantization, other.shadow_quantization);
+        std::swap(pulled, other.pulled);
+        std::swap(meshlets, other.meshlets);
+        std::swap(arena, other.arena);
+        std::swap(geometry, other.geometry);
+        std::swap(material, other.material);
+        std::swap(cull_mode, other.cull_mode);
+        std::swap(is_cleaned_up, other.is_cleaned_up);
+        std::swap(geometry_owner, other.geometry_owner);
+        std::swap(lod_error, other.lod_error);
+        std::swap(bounds_center, other.bounds_center);
+        std::swap(bounds_radius, other.bounds_radius);
+        std::swap(bounds_min, other.bounds_min);
+        std::swap(bounds_max, other.bounds_max);
+        const size_t shared_lods = std::min(lods.size(), other.lods.size());
+        for (size_t i = 0; i < shared_lods; ++i) lods[i]->swapContents(*other.lods[i]);
+        // Levels the new import added join the chain, ones it dropped keep drawing the old geometry
+        lods.insert(lods.end(), other.lods.begin() + shared_lods, other.lods.end());
+        other.lods.resize(shared_lods);
+        mesh_pool.update(*this);
+        mesh_pool.update(other);
+    }
+
+    // Copies source in with its own references on the textures, cleanup() releases them, and drops
+    // the ones the old material held. Meshes sharing textures must take them this way, a plain
+    // assignment leaves one release too many. GL thread only.
+    void setMaterial(const Material& source) {
+        retainMaterialTextures(source);
+        releaseMaterialTextures(material);
+        material = source;
+    }
+
+    size_t cpuIndexCount() const { return indices_data.size() / getIndexSize(index_type); }
+    uint32_t cpuIndex(size_t i) const {
+        if (index_type == GL_UNSIGNED_SHORT) return reinterpret_cast<const uint16_t*>(indices_data.data())[i];
+        return reinterpret_cast<const uint32_t*>(indices_data.data())[i];
+    }
+
     GLuint getVAO() const { return VAO; }
+    GLuint depthVertexArray() const { return depthVAO != 0 ? depthVAO : VAO; }
+    GLuint shadowVertexArray() const { return shadowVAO != 0 ? shadowVAO : depthVertexArray(); }
     bool isValid() const { return VAO != 0 && TRIANGLE_COUNT > 0 && !is_cleaned_up; }
     
+    // Safe from any thread and mid-frame: the GL side is released through gl_deletion_queue once
+    // the frames that may still draw from it are done
     void cleanup() {
         if (is_cleaned_up) return;
         
         vertices_data.clear();
+        positions_data.clear();
         indices_data.clear();
-        
-        if (VAO != 0) { glDeleteVertexArrays(1, &VAO); VAO = 0; }
-        if (VBO != 0) { glDeleteBuffers(1, &VBO); VBO = 0; }
-        if (EBO != 0) { glDeleteBuffers(1, &EBO); EBO = 0; }
-        if (instanceVBO != 0) { glDeleteBuffers(1, &instanceVBO); instanceVBO = 0; }
+        meshlets.reset();
+
+        if (geometry_owner) {
+            arena.reset();
+            pulled = PulledGeometry();
+            VAO = VBO = EBO = instanceVBO = instanceFadeVBO = depthVAO = depthVBO = shadowVAO = 0;
+            geometry_owner.reset();
+        }
+        if (arena) VAO = instanceVBO = instanceFadeVBO = depthVAO = shadowVAO = 0;
+
+        Material textures = material;
+        material.albedo_map = material.normal_map = material.orm_map = 0;
+        material.height_map = material.emissive_map = material.specular_map = 0;
+        gl_deletion_queue.defer([handle = pool_handle, textures, arena = std::move(arena), geometry = geometry,
+                                 pulled = pulled]() mutable {
+            mesh_pool.release(handle);
+            releaseMaterialTextures(textures);
+            vertex_pulling.free(pulled);
+            if (arena) arena->free(geometry);
+        });
+        pool_handle = MESH_HANDLE_NULL;
+        arena.reset();
+        pulled = PulledGeometry();
 
+        for (GLuint* vertex_array : { &VAO, &depthVAO, &shadowVAO }) {
+            gl_deletion_queue.deleteVertexArray(*vertex_array);
+            *vertex_array = 0;
+        }
+        for (GLuint* buffer : { &VBO, &EBO, &instanceVBO, &instanceFadeVBO, &depthVBO }) {
+            gl_deletion_queue.deleteBuffer(*buffer);
+            *buffer = 0;
+        }
+
+        lods.clear();
         TRIANGLE_COUNT = INDEX_COUNT = 0;
         is_cleaned_up = true;
     }
 };
+
+// Draws the mesh's index range from its bound VAO, at its arena offsets when it has them
+inline void drawMeshElements(const Mesh& mesh, GLsizei instance_count = 1) {
+    const void* first_index = (const void*)(uintptr_t)mesh.geometry.indices.offset;
+#ifdef __EMSCRIPTEN__
+    // No base-vertex draws on WebGL2, arenas are disabled there
+    glDrawElementsInstanced(GL_TRIANGLES, mesh.INDEX_COUNT, mesh.index_type, first_index, instance_count);
+#else
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.INDEX_COUNT, mesh.index_type, first_index, instance_count,
+                                      (GLint)mesh.geometry.vertices.offset);
+#endif
+}
+
+// Union of the meshes' AABBs and a sphere around its centre, returns 0 when none of them have bounds
+inline float computeMeshesBounds(const std::vector<std::shared_ptr<Mesh>>& meshes, glm::vec3& center,
+                                 glm::vec3& bmin, glm::vec3& bmax) {
+    bool has_bounds = false;
+    for (const auto& mesh : meshes) {
+        if (!mesh || mesh->bounds_radius <= 0.0f) continue;
+        bmin = has_bounds ? glm::min(bmin, mesh->bounds_min) : mesh->bounds_min;
+        bmax = has_bounds ? glm::max(bmax, mesh->bounds_max) : mesh->bounds_max;
+        has_bounds = true;
+    }
+    if (!has_bounds) return 0.0f;
+
+    // Either sphere encloses everything, keep the smaller
+    center = (bmin + bmax) * 0.5f;
+    float radius = 0.0f;
+    for (const auto& mesh : meshes) {
+        if (!mesh || mesh->bounds_radius <= 0.0f) continue;
+        radius = std::max(radius, glm::length(mesh->bounds_center - center) + mesh->bounds_radius);
+    }
+    return std::min(radius, glm::length(bmax - bmin) * 0.5f);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "material.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+struct MeshStaging;
+
+// Cooked mesh files live in cache/meshes/ and are keyed by source path, source mtime,
+// Assimp import flags, vertex format, LOD count and COOKED_MESH_VERSION. Any mismatch falls back to a fresh import.
+#define COOKED_MESH_VERSION 11
+
+// Vertex and index blobs are always stored through the mesh codecs (mesh_codec.h); with this on
+// (the default) each also goes through the LZ pass when that makes it smaller. The asset cooker's
+// --no-mesh-lz turns it off for faster cooks.
+extern bool cooked_mesh_lz;
+
+std::string getCookedMeshPath(const std::string& filepath);
+
+// Fills staging with sub-meshes decoded from the mapped cooked file (meshlets still point into
+// it) and decodes their textures. No GL calls, so it is safe on worker threads. Returns false if
+// there is no valid cooked copy.
+bool loadCookedMeshStaging(const std::string& filepath, const std::string& sourcePath, uint32_t importFlags, MeshStaging& staging);
+
+bool writeCookedMesh(const std::string& filepath, const std::string& sourcePath, uint32_t importFlags, const MeshStaging& staging);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Encodings for the cooked mesh blobs (mesh_cache.h), fast enough to decode on the loading
+// workers on every cold start:
+//   vertices - per byte position of the vertex, the deltas from the previous vertex as their own
+//              plane, zigzagged and bit-packed in groups of 16 at 0, 2, 4 or 8 bits (meshoptimizer's
+//              vertex codec in spirit). Positions, normals and UVs of neighbouring vertices differ
+//              in their low bytes, so most groups pack to a few bits.
+//   indices  - zigzagged deltas from the previous index as varints, an optimized triangle order
+//              keeps most of them to one byte
+//   LZ       - an LZ77 byte compressor with 64 KB of history, optionally over either of the two,
+//              where the codec's planes still repeat
+// Decoders check every read and return false on malformed input.
+
+#define MESH_CODEC_GROUP_SIZE 16
+#define MESH_LZ_MIN_MATCH 4
+#define MESH_LZ_HASH_BITS 14
+
+void encodeVertexBuffer(const unsigned char* vertices, size_t vertex_count, size_t stride, std::vector<unsigned char>& out);
+// dst holds vertex_count * stride bytes
+bool decodeVertexBuffer(unsigned char* dst, size_t vertex_count, size_t stride, const unsigned char* src, size_t size);
+
+// index_size is 2 or 4
+void encodeIndexBuffer(const void* indices, size_t index_count, size_t index_size, std::vector<unsigned char>& out);
+bool decodeIndexBuffer(void* dst, size_t index_count, size_t index_size, const unsigned char* src, size_t size);
+
+// The block starts with its decompressed size, so the decoder sizes out itself
+void lzCompress(const unsigned char* data, size_t size, std::vector<unsigned char>& out);
+bool lzDecompress(const unsigned char* src, size_t size, std::vector<unsigned char>& out);
@@ -1,24 +1,162 @@
 #pragma once
 
 #include <assimp/scene.h>
+#include <assimp/postprocess.h>
 #include "material.h"
+#include "texture_loader.h"
+#include "mesh.h"
 #include <string>
 #include <vector>
 #include <memory>
 
-class Mesh;
+class MappedFile;
+namespace Assimp { class Importer; }
+
+// Assimp post-processing used for every import (also part of the cooked-mesh cache key)
+constexpr unsigned int MESH_IMPORT_FLAGS =
+    aiProcess_Triangulate |
+    aiProcess_GenSmoothNormals |
+    aiProcess_JoinIdenticalVertices |
+    aiProcess_ImproveCacheLocality |
+    aiProcess_OptimizeMeshes |
+    aiProcess_CalcTangentSpace |
+    aiProcess_PreTransformVertices;
+
+// Node instancing imports (requestNodeInstancing()) keep the node hierarchy's meshes apart and
+// unmoved, each referenced mesh once however many nodes place it
+constexpr unsigned int MESH_INSTANCED_IMPORT_FLAGS =
+    MESH_IMPORT_FLAGS & ~(aiProcess_PreTransformVertices | aiProcess_OptimizeMeshes);
+
+// Opts a model into node instancing before it is imported. Its unique meshes are uploaded once
+// and MeshStaging::instances records where each node places them, for createNodeEntities()
+// (entity_manager.h). Ignored for models that get lightmap UVs, which need every placement's
+// texels to themselves. Safe from any thread.
+void requestNodeInstancing(const std::string& filepath);
+bool wantsNodeInstancing(const std::string& filepath);
+
+// Use the packed vertex layout for new imports (see VertexFormatFlags in mesh.h)
+extern bool use_packed_vertices;
+
+// CPU copies uploaded meshes keep (MESH_RESIDENCY_NONE by default). The GPU buffers are all
+// rendering needs, and on the web every copy kept grows the heap for good.
+extern MeshResidency mesh_residency;
+
+// Generated LOD chain per sub-mesh (0 disables). Each level targets MESH_LOD_TRIANGLE_RATIO of the
+// previous one's triangles and stops early once the simplification error exceeds MESH_LOD_MAX_ERROR.
+extern unsigned int mesh_lod_levels;
+#define MESH_LOD_TRIANGLE_RATIO 0.5f
+#define MESH_LOD_MAX_ERROR 0.05f // Relative to the sub-mesh extent
+#define MESH_LOD_MIN_TRIANGLES 64
 
 struct ORMResult {
     GLuint textureID;
     bool hasHeightData;
 };
 
-unsigned char* load_greyscale_data(const std::string& path, const aiScene* scene, int& width, int& height);
+struct ORMImage {
+    ImageData image;
+    bool hasHeightData = false;
+};
+
+ImageData load_greyscale_data(const std::string& path, const aiScene* scene);
+
+// The import's vertex layout for a mesh (see VertexFormatFlags in mesh.h), and its vertices in it
+uint32_t chooseVertexFormat(const aiMesh* mesh);
+void encodeVertices(const aiMesh* mesh, const VertexLayout& layout, std::vector<unsigned char>& out_bytes);
+
+// CPU half of ORM packing - safe to call from worker threads
+ORMImage packORMImage(const std::string& current_material_name, const std::string& ao_path,
+                      const std::string& roughness_path, const std::string& metallic_path, const std::string& height_path,
+                      const std::string& specular_path, bool invert_height, const aiScene* scene);
 
 ORMResult packORM(Material& mat, const std::string& current_material_name, const std::string& ao_path,
                   const std::string& roughness_path, const std::string& metallic_path, const std::string& height_path,
                   const std::string& specular_path, const aiScene* scene);
 
+// Material import is split so the description can be cooked and rebuilt without Assimp.
+// buildMaterial() only needs the scene for embedded ("*N") textures and accepts nullptr otherwise.
+MaterialDesc describeMaterialFromAssimp(const std::string& modelPath, aiMaterial* material);
+Material buildMaterial(const MaterialDesc& desc, const aiScene* scene);
 Material createMaterialFromAssimp(std::string modelPath, aiMaterial* material, const aiScene* scene);
 
-std::vector<std::shared_ptr<Mesh>> loadMesh(const std::string& filepath);
\ No newline at end of file
+// Decoded texture data for one material, ready for upload.
+// Images whose key was already in texture_cache are left empty and acquired at upload.
+struct MaterialImages {
+    ImageData albedo;
+    ImageData normal;
+    ImageData emissive;
+    ORMImage orm;
+
+    std::string albedo_key;
+    std::string normal_key;
+    std::string emissive_key;
+    std::string orm_key;
+};
+
+MaterialImages decodeMaterialImages(const MaterialDesc& desc, const aiScene* scene);
+// Where the packed ORM map of orm_key is cooked to, in cache/textures/
+std::string getCookedORMPath(const std::string& orm_key);
+// Consumes the images (streamed uploads take ownership of their mip chains)
+Material buildMaterialFromImages(const MaterialDesc& desc, MaterialImages& images);
+
+// ==== Staged loading ====
+// importMeshStaging() does all file I/O, Assimp and image decoding without touching GL,
+// so it can run on a worker thread. uploadMeshStaging() must run on the GL thread.
+
+struct SubMeshStaging {
+    // Owned data for fresh imports; cooked meshes point into the shared mapping instead
+    std::vector<unsigned char> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<uint16_t> indices16; // Narrowed GPU copy when index_type is GL_UNSIGNED_SHORT
+    uint32_t vertex_format = VERTEX_HAS_COLOR;
+    GLenum index_type = GL_UNSIGNED_INT;
+    const void* vertex_data = nullptr;
+    size_t vertex_bytes = 0;
+    const void* index_data = nullptr;
+    size_t index_bytes = 0;
+    unsigned int triangle_count = 0;
+    float lod_error = 0.0f; // Simplification error relative to the sub-mesh extent
+    glm::vec4 bounds{0.0f}; // Bounding sphere in mesh space, xyz centre and w radius
+    glm::vec3 bounds_min{0.0f}, bounds_max{0.0f}; // AABB in mesh space
+    // Clusters for meshlet culling, empty below MESHLET_MIN_MESH_TRIANGLES. Owned for fresh
+    // imports, cooked ones point meshlet_data into the mapping.
+    std::vector<Meshlet> meshlets;
+    const Meshlet* meshlet_data = nullptr;
+    size_t meshlet_count = 0;
+
+    MaterialDesc material;
+    MaterialImages images;
+
+    // Generated lower detail levels, coarsest last. Only their geometry fields are used.
+    std::vector<SubMeshStaging> lods;
+};
+
+struct MeshStaging {
+    std::string filepath;
+    std::string source_path;
+    bool from_cache = false;
+    std::shared_ptr<MappedFile> mapping;
+    std::vector<SubMeshStaging> submeshes;
+    std::vector<MeshNodeInstance> instances; // Node instancing imports only, empty for flat ones
+};
+
+bool importMeshStaging(const std::string& filepath, MeshStaging& staging);
+// Reads a model with importer, through the asset pack when one is open. Null if it failed, the
+// error printed. The scene lives as long as the importer.
+const aiScene* readAssimpScene(Assimp::Importer& importer, const std::string& source_path, unsigned int flags);
+// Bounds and upload fields of a sub-mesh whose vertices and indices are filled in, its LODs
+// included, narrowing to 16-bit indices when they fit
+void finalizeSubMeshBuffers(SubMeshStaging& sub);
+std::shared_ptr<Mesh> uploadSubMeshStaging(SubMeshStaging& sub);
+std::vector<std::shared_ptr<Mesh>> uploadMeshStaging(MeshStaging& staging);
+void logLoadedMesh(const std::string& filepath, const std::vector<std::shared_ptr<Mesh>>& meshes, bool from_cache);
+
+// Sub-allocates interleaved vertex data in mesh.vertex_layout from its format's geometry arena, or
+// creates a standalone VAO/VBO/EBO and instance buffers when arenas are off
+void uploadMeshBuffers(Mesh& mesh, const void* vertices, size_t vertex_bytes, const void* indices, size_t index_bytes);
+
+std::vector<std::shared_ptr<Mesh>> loadMesh(const std::string& filepath);
+
+// Another Mesh over the same uploaded geometry, LODs included, with its own material and draw
+// id. Costs no GPU memory, it batches and sorts as a different mesh.
+std::shared_ptr<Mesh> createMeshVariant(const std::shared_ptr<Mesh>& source, const Material& material);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Post-import index/vertex reordering, run on worker threads before upload:
+//   1. vertex cache   - Forsyth-style greedy triangle order for the post-transform cache
+//   2. overdraw       - reorder cache-friendly clusters so outward-facing ones draw first
+//   3. vertex fetch   - renumber vertices in first-use order so fetches stream linearly
+// plus quadric-error simplification for generated LOD chains.
+
+extern bool optimize_imported_meshes;
+
+// FIFO cache model used for reporting
+#define MESH_OPT_STATS_CACHE_SIZE 16
+
+struct VertexCacheStats {
+    float acmr = 0.0f; // Cache misses per triangle (0.5 ideal, 3.0 worst)
+    float atvr = 0.0f; // Cache misses per vertex (1.0 ideal)
+};
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t index_count, size_t vertex_count,
+                                    unsigned int cache_size = MESH_OPT_STATS_CACHE_SIZE);
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertex_count);
+
+// positions: float3 at the start of each stride-byte vertex
+void optimizeOverdraw(std::vector<unsigned int>& indices, const unsigned char* vertices, size_t vertex_count,
+                      size_t stride, float threshold = 1.05f);
+
+// Reorders the interleaved vertex buffer in place and rewrites indices to match
+void optimizeVertexFetch(std::vector<unsigned int>& indices, std::vector<unsigned char>& vertices, size_t stride);
+
+// Runs all three and prints ACMR/ATVR before and after
+void optimizeMesh(const char* name, std::vector<unsigned int>& indices, std::vector<unsigned char>& vertices, size_t stride);
+
+// Quadric-error edge collapse (Garland & Heckbert) towards target_index_count, never exceeding
+// target_error (relative to the mesh extent). Vertices are only moved onto existing ones, so
+// attributes are untouched; UV/normal seams and non-manifold vertices are locked, open borders
+// only collapse along themselves, and collapses that flip a face are rejected.
+// Rewrites indices in place and returns the achieved relative error.
+float simplifyMesh(std::vector<unsigned int>& indices, const unsigned char* vertices, size_t vertex_count, size_t stride,
+                   size_t target_index_count, float target_error);
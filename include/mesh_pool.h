@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "geometry_arena.h" // PositionQuantization
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class Mesh;
+
+// 24-bit slot and 8-bit generation, 0 is never handed out
+typedef uint32_t MeshHandle;
+#define MESH_HANDLE_NULL 0u
+#define MESH_HANDLE_SLOT_BITS 24
+#define MESH_HANDLE_SLOT_MASK ((1u << MESH_HANDLE_SLOT_BITS) - 1)
+
+// What drawing a mesh reads, copied out of the Mesh so the draw paths stream these instead of
+// chasing pointers into Mesh objects scattered across the heap
+struct MeshRecord {
+    GLuint vao = 0;
+    GLuint depth_vao = 0; // Mesh::depthVertexArray(), the VAO itself without a depth stream
+    GLuint shadow_vao = 0; // Mesh::shadowVertexArray(), depth_vao without quantized positions
+    PositionQuantization shadow_quantization;
+    uint32_t pulled_first_index = 0; // Mesh::pulled, pulled_index_count 0 when it isn't pooled
+    uint32_t pulled_index_count = 0;
+    GLuint instance_vbo = 0, fade_vbo = 0;
+    GLenum index_type = GL_UNSIGNED_INT;
+    uint32_t index_count = 0;
+    uint32_t first_index = 0; // In indices, into the arena's index buffer or the mesh's own
+    uintptr_t index_offset = 0; // In bytes, the same, as the draw's index pointer
+    int32_t base_vertex = 0;
+    uint32_t draw_id = 0;
+    uint8_t cull_mode = 0;
+    glm::vec3 bounds_min{0.0f}, bounds_max{0.0f};
+    Mesh* mesh = nullptr; // For what the record doesn't carry (material, LODs), null while free
+};
+
+// Dense records of every uploaded mesh, addressed by 32-bit handles. A Mesh creates its record
+// once its buffers are uploaded and releases it in cleanup(); code changing the drawing state of a
+// mesh afterwards (cull mode, swapped contents) calls update(). Ownership stays with the
+// shared_ptrs, the pool is the draw side's view. Released slots are reused under a new
+// generation, so stale handles resolve to nothing.
+// GL thread only.
+class MeshPool {
+public:
+    MeshPool() = default;
+    MeshPool(const MeshPool&) = delete;
+    MeshPool& operator=(const MeshPool&) = delete;
+
+    MeshHandle create(Mesh& mesh);
+    void update(const Mesh& mesh);
+    void release(MeshHandle handle);
+
+    bool isValid(MeshHandle handle) const {
+        const uint32_t slot = handle & MESH_HANDLE_SLOT_MASK;
+        return handle != MESH_HANDLE_NULL && slot < generations.size() && generations[slot] == (handle >> MESH_HANDLE_SLOT_BITS);
+    }
+    // The caller checks the handle, or holds the mesh alive
+    const MeshRecord& operator[](MeshHandle handle) const { return records[handle & MESH_HANDLE_SLOT_MASK]; }
+    size_t size() const { return records.size() - free_slots.size(); }
+
+private:
+    std::vector<MeshRecord> records;
+    std::vector<uint8_t> generations; // Per slot, the live handle's
+    std::vector<uint32_t> free_slots;
+};
+
+extern MeshPool mesh_pool;
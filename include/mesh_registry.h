@@ -0,0 +1,48 @@
+#pragma once
+
+#include "mesh.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+
+// Path-keyed cache of loaded models. Only weak references are kept, so a model is
+// evicted (and its GL objects freed by ~Mesh) as soon as the last entity drops it.
+// GL thread only.
+class MeshRegistry {
+public:
+    static std::string normalizePath(const std::string& filepath);
+
+    // Returns an empty vector if the model isn't resident
+    std::vector<std::shared_ptr<Mesh>> find(const std::string& filepath);
+    void add(const std::string& filepath, const std::vector<std::shared_ptr<Mesh>>& meshes,
+             const std::vector<MeshNodeInstance>& instances = {});
+    // Where a node instancing import places its meshes (MeshStaging::instances), empty for flat
+    // models and ones not resident
+    std::vector<MeshNodeInstance> instances(const std::string& filepath) const;
+
+    // Moves a re-import's contents into the resident meshes of filepath (Mesh::swapContents), so
+    // existing handles draw the new model and fresh ends up holding the old contents. False when
+    // the model isn't resident. Sub-meshes past the shorter of the two lists are left alone.
+    bool replace(const std::string& filepath, const std::vector<std::shared_ptr<Mesh>>& fresh);
+
+    // Synchronous find-or-import
+    std::vector<std::shared_ptr<Mesh>> load(const std::string& filepath);
+
+    // Number of live handles to a model (0 if evicted)
+    long useCount(const std::string& filepath) const;
+
+    // Every model still fully resident, with its meshes in load order
+    void forEach(const std::function<void(const std::string&, const std::vector<std::shared_ptr<Mesh>>&)>& fn) const;
+
+    // Drops entries whose meshes have all been released, returns how many were removed
+    size_t prune();
+    size_t size() const { return entries.size(); }
+
+private:
+    std::unordered_map<std::string, std::vector<std::weak_ptr<Mesh>>> entries;
+    std::unordered_map<std::string, std::vector<MeshNodeInstance>> node_instances; // Instanced entries only
+};
+
+extern MeshRegistry mesh_registry;
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "frustum.h"
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class HiZBuffer;
+
+#define MESHLET_MAX_VERTICES 64        // Per cluster, as mesh shading hardware sizes them
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_MIN_MESH_TRIANGLES 8192 // Smaller meshes aren't split, culling them whole is enough
+
+// Off draws every clustered mesh whole again
+extern bool use_meshlet_culling;
+
+// A run of about a hundred triangles of one mesh, contiguous in its index buffer, with the bounds
+// to cull it by. The normal cone bounds the triangles' facing: seen from anywhere the cone test
+// rejects, every one of them is a back face. Cooked as is (mesh_cache.h).
+struct Meshlet {
+    glm::vec3 center{0.0f}; // Bounding sphere in mesh space
+    float radius = 0.0f;
+    glm::vec3 cone_axis{0.0f};
+    float cone_cutoff = 1.0f; // Sine of the spread left for the view direction, 1 = never back-facing
+    uint32_t first_index = 0; // Into the mesh's indices
+    uint32_t index_count = 0;
+};
+static_assert(sizeof(Meshlet) == 40, "Cooked meshes store this layout");
+
+// What a culled instance draws, merged runs of visible meshlets
+struct MeshletRange {
+    uint32_t first_index = 0; // Into the mesh's indices
+    uint32_t index_count = 0;
+};
+
+// Splits a mesh into meshlets in its current triangle order, which after optimizeMesh() already
+// keeps neighbours together, so the index buffer stays as it is. positions: float3 at the start
+// of each stride-byte vertex.
+void buildMeshlets(const unsigned int* indices, size_t index_count, const unsigned char* vertices, size_t stride,
+                   std::vector<Meshlet>& meshlets);
+
+// The camera a frame's clusters are culled against, hiz null to skip the occlusion test
+struct MeshletView {
+    Frustum frustum;
+    glm::vec3 camera_position{0.0f};
+    const HiZBuffer* hiz = nullptr;
+};
+
+struct MeshletCullStats {
+    int tested = 0;
+    int culled = 0;
+};
+
+// Tests an instance's meshlets against the frustum, the Hi-Z readback and, with back_faces (its
+// cull mode culls back faces), their normal cones. The visible ones go to ranges as merged runs.
+// Returns false when all are visible and the mesh should draw whole, ranges then untouched.
+bool cullMeshlets(const Meshlet* meshlets, size_t count, const glm::mat4& model, bool back_faces, const MeshletView& view,
+                  std::vector<MeshletRange>& ranges, MeshletCullStats& stats);
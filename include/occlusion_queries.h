@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "shader.h"
+
+struct Entity;
+
+// Occlusion queries against the depth prepass, the option for GL 3.3 and WebGL2 where the
+// compute/Hi-Z paths aren't worth it. Off on desktop by default, the Hi-Z test covers it there.
+extern bool use_occlusion_queries;
+#define OCCLUSION_QUERY_KEEP_FRAMES 120 // Queries of entities not tested for this long are deleted
+
+// One GL_ANY_SAMPLES_PASSED query per entity, drawn as its bounding cube after the prepass.
+// Results are read the next frame only once available, so the CPU never waits; an entity
+// hidden last frame is skipped and keeps being queried, so it reappears a frame late at worst.
+class OcclusionQueries {
+public:
+    struct Box {
+        const Entity* entity = nullptr;
+        glm::vec3 center{0.0f};
+        float radius = 0.0f;
+    };
+
+    OcclusionQueries() = default;
+    ~OcclusionQueries();
+
+    OcclusionQueries(const OcclusionQueries&) = delete;
+    OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+
+    // Picks up the results that arrived since last frame, call before culling
+    void collect();
+    // True only if the entity was queried last frame and nothing of it passed the depth test
+    bool wasOccluded(const Entity* entity) const;
+
+    // Call right after the depth prepass with every frustum-visible entity, drawn or not
+    void issue(const std::vector<Box>& boxes, const glm::mat4& view_projection, const glm::vec3& camera_position);
+
+    // Forgets every result, for when Entity pointers were invalidated (EntityManager::layoutVersion())
+    void clear();
+
+    size_t queryCount() const { return queries.size(); }
+
+private:
+    struct Query {
+        GLuint id = 0;
+        bool pending = false;
+        bool occluded = false;
+        uint64_t issued_frame = 0;
+    };
+
+    bool init();
+
+    std::unordered_map<const Entity*, Query> queries;
+    uint64_t frame = 0;
+
+    std::unique_ptr<Shader> box_shader;
+    GLuint vao = 0, vbo = 0;
+    bool failed = false;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <memory>
+#include "render_graph.h"
+#include "shader.h"
+
+// Weighted blended order-independent transparency for BLEND materials, so they batch and
+// instance like opaques instead of drawing one by one back to front. Off on WebGL2, which
+// needs EXT_color_buffer_float to render to the half float targets. Falls back to the sorted
+// path whenever the targets can't be made.
+extern bool use_weighted_oit;
+
+// Fill rate of the weighted OIT pass: the blended meshes and every particle drawn into targets
+// this much smaller against a downsampled copy of the opaque depth, then upsampled onto the
+// scene by depth. The sorted path always draws at full resolution.
+enum TransparentResolution {
+    TRANSPARENT_RESOLUTION_FULL = 0,
+    TRANSPARENT_RESOLUTION_HALF,
+    TRANSPARENT_RESOLUTION_QUARTER,
+    TRANSPARENT_RESOLUTION_COUNT,
+};
+extern TransparentResolution transparent_resolution;
+extern const char* const TRANSPARENT_RESOLUTION_NAMES[TRANSPARENT_RESOLUTION_COUNT];
+
+#define OIT_UPSAMPLE_DEPTH_TOLERANCE 0.05f // Relative view depth difference the upsample still blends across
+#define OIT_LOW_DEPTH_UNIT 11              // The G-buffer's, free once the opaques are lit; 4 stays the shadow map's
+
+// Two half float targets over a copy of the scene depth. Accumulation holds the weighted
+// premultiplied colour sum in rgb and the revealage product in alpha, the second target the
+// weight sum. Fragments only depth test against the opaques, so their order doesn't matter.
+// composite() resolves the average onto the scene framebuffer. The targets are render graph
+// transients, the depth copy shares its texture with the G-buffer's.
+// At a reduced transparent_resolution the two targets shrink, a third holds the additive
+// particles, and they test against the farthest opaque depth of each block of full-resolution
+// pixels, so nothing in front of any of them is lost. The composite then rebuilds each pixel
+// from the four nearest low-resolution texels, bilinearly where their depths agree with the
+// pixel's and from the closest one alone where they don't, so the transparents don't bleed
+// across the opaques' silhouettes.
+class WeightedBlendedOIT {
+public:
+    struct Targets {
+        RenderResource accum = RENDER_RESOURCE_NONE;
+        RenderResource weight = RENDER_RESOURCE_NONE;
+        RenderResource depth = RENDER_RESOURCE_NONE;
+        // Reduced resolution only
+        RenderResource low_depth = RENDER_RESOURCE_NONE;
+        RenderResource additive = RENDER_RESOURCE_NONE;
+        int divisor = 1;
+
+        bool reduced() const { return divisor > 1; }
+    };
+
+    WeightedBlendedOIT() = default;
+    ~WeightedBlendedOIT();
+
+    WeightedBlendedOIT(const WeightedBlendedOIT&) = delete;
+    WeightedBlendedOIT& operator=(const WeightedBlendedOIT&) = delete;
+
+    // This frame's targets for the scene's render size at transparent_resolution, for the
+    // transparent pass to write
+    Targets declare(RenderGraph& graph, int width, int height) const;
+
+    // After the opaques, with the scene framebuffer bound. Copies its depth, clears the
+    // targets and binds them with the accumulate blend state, and the viewport to their size.
+    // False leaves everything as it was.
+    bool begin(RenderGraph::Context& context, const Targets& targets);
+    // Reduced resolution only, after begin(): binds the additive target, which begin() cleared,
+    // over the low-resolution depth for the additive particles
+    void beginAdditive(RenderGraph::Context& context, const Targets& targets);
+    // Blends the resolved transparents over the scene framebuffer, which it leaves bound with
+    // the scene's viewport
+    void composite(RenderGraph::Context& context, const Targets& targets);
+
+    // False once its shader or framebuffer failed
+    bool available() const { return !failed; }
+
+private:
+    bool init();
+
+    std::unique_ptr<Shader> composite_shader;
+    std::unique_ptr<Shader> upsample_shader;   // The composite at reduced resolution
+    std::unique_ptr<Shader> downsample_shader; // Farthest depth of each block
+    GLuint vao = 0;
+    int width = 0, height = 0; // The scene's
+    bool failed = false;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include "camera.h"
+
+#define ON_DEMAND_SETTLE_FRAMES 30    // Redrawn after the last change, TAA and exposure converge over these
+#define ON_DEMAND_WAIT_SECONDS 0.25   // Longest idle wait, so unchanged frames still see timers and uploads
+#define ON_DEMAND_CAMERA_EPSILON 1e-4f // Metres and degrees, smaller drifts of a coasting camera don't count
+
+extern bool use_on_demand_rendering; // Off redraws every frame, as the main loop always did
+
+// Stops redrawing a scene that isn't changing. The main loop reports at the end of every frame
+// whether anything in it moved: the camera (compared against the last frame's), entities,
+// animation, particles, loading. After ON_DEMAND_SETTLE_FRAMES frames without a change the last
+// frame stays on screen and the loop sleeps in glfwWaitEventsTimeout() instead of rendering.
+// A wait that ends before its timeout was woken by an event, mouse, keyboard, resize or expose,
+// any of which can change the frame or the UI, so the loop redraws again from there. Native only,
+// the browser already throttles the web build's requestAnimationFrame in hidden tabs.
+// GL thread only.
+class OnDemandRenderer {
+public:
+    OnDemandRenderer() = default;
+    OnDemandRenderer(const OnDemandRenderer&) = delete;
+    OnDemandRenderer& operator=(const OnDemandRenderer&) = delete;
+
+    // Redraws the next ON_DEMAND_SETTLE_FRAMES frames whatever the scene does
+    void invalidate() { settle = ON_DEMAND_SETTLE_FRAMES; }
+    // At the top of the frame, true when it can be skipped. Waits for events first, so the
+    // caller returns straight after.
+    bool idle();
+    // After the frame's swap, scene_changed when anything but the camera moved during it
+    void endFrame(const Camera& camera, bool scene_changed);
+
+    // --on-demand, returns the arguments taken, 0 if it isn't one
+    int parseArg(int argc, char** argv, int i);
+
+    uint64_t skippedFrames() const { return skipped; }
+    bool sleeping() const { return use_on_demand_rendering && settle == 0; }
+
+private:
+    int settle = ON_DEMAND_SETTLE_FRAMES;
+    bool has_camera = false;
+    glm::vec3 camera_position{0.0f};
+    float camera_yaw = 0.0f, camera_pitch = 0.0f, camera_fov = 0.0f, camera_aspect = 0.0f;
+    uint64_t skipped = 0;
+};
+
+extern OnDemandRenderer on_demand;
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "geometry_arena.h" // RangeAllocator
+#include "shader.h"
+
+#ifdef __EMSCRIPTEN__
+#define PARTICLE_CAPACITY (128 * 1024)
+#else
+#define PARTICLE_CAPACITY (512 * 1024) // Across every emitter, 32 bytes each
+#endif
+#define PARTICLE_MAX_EMITTERS 64
+#define PARTICLE_GROUP_SIZE 64   // Matches local_size_x in particle_update.comp
+#define PARTICLE_DEPTH_UNIT 17   // Texture unit of the soft particles' depth copy
+#define PARTICLE_MAX_STEP 0.1f   // Seconds, longer frames simulate as this
+#define PARTICLE_DEMO_PARTICLES 20000 // The scene's fire and smoke, --particles overrides
+
+extern bool use_particles;
+extern bool use_soft_particles;
+
+enum ParticleBlend {
+    PARTICLE_BLEND_ALPHA = 0, // Smoke and dust, under weighted OIT when it's on, else sorted by emitter
+    PARTICLE_BLEND_ADDITIVE,  // Fire and sparks, order doesn't matter
+};
+
+// What an emitter spawns. Everything per particle is drawn from these ranges on the GPU.
+struct ParticleEmitterDesc {
+    glm::vec3 position{0.0f};
+    float spawn_radius = 0.1f;       // Particles start anywhere within this sphere
+    float rate = 1000.0f;            // Particles per second
+    float lifetime_min = 1.0f, lifetime_max = 2.0f; // Seconds
+    glm::vec3 velocity{0.0f, 1.0f, 0.0f};
+    float velocity_spread = 0.5f;    // Up to this much more in any direction
+    glm::vec3 acceleration{0.0f};    // Gravity, or buoyancy for smoke
+    float drag = 0.0f;               // Fraction of the velocity lost per second
+    float size_start = 0.1f, size_end = 0.3f; // Billboard half-size over the particle's life
+    glm::vec4 color_start{1.0f}, color_end{1.0f, 1.0f, 1.0f, 0.0f}; // Linear, straight alpha
+    ParticleBlend blend = PARTICLE_BLEND_ALPHA;
+    float soft_distance = 0.5f;      // Fades out this close in front of the opaques, 0 = hard edges
+};
+
+enum ParticlePass {
+    PARTICLE_PASS_OIT = 0,   // Alpha emitters into the bound weighted OIT targets
+    PARTICLE_PASS_SORTED,    // Alpha emitters over the scene, farthest emitter first
+    PARTICLE_PASS_ADDITIVE,  // Additive emitters over the scene
+};
+
+// GPU particles. Every particle's position, velocity, age and lifetime live only in one buffer,
+// 32 bytes each, and never come back to the CPU. Emitters are descriptors in a fixed pool, each
+// owning a slice of the buffer sized for its rate times its longest lifetime, used as a ring:
+// every frame the CPU only advances each emitter's spawn cursor, and the simulation respawns the
+// slots the cursor passed (their previous particles have outlived lifetime_max by then) and
+// integrates the rest. On GL 4.3 the simulation is a compute dispatch per emitter updating the
+// buffer in place, on GL 3.3 and WebGL2 a transform feedback pass per emitter from one buffer
+// into a second, swapped after. Drawing is a camera-facing quad per particle, instanced straight
+// from the same buffer. Soft particles fade out against a copy of the scene depth taken once
+// before the transparents. Alpha emitters blend through weighted OIT when the renderer uses it,
+// otherwise they're sorted by emitter only; particles within one emitter draw in buffer order.
+// GL thread only.
+class ParticleSystem {
+public:
+    ParticleSystem() = default;
+
+    ParticleSystem(const ParticleSystem&) = delete;
+    ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+    // Returns the emitter's handle, -1 when the pool or the particle buffer is full
+    int createEmitter(const ParticleEmitterDesc& desc);
+    void destroyEmitter(int emitter);
+    void setPosition(int emitter, const glm::vec3& position);
+    // Stops or resumes spawning, the particles out there live out their lifetimes
+    void setActive(int emitter, bool active);
+    // The world origin moved by delta (world_origin.h). Emitters follow, the particles already out
+    // there live out their short lives where they are.
+    void shiftOrigin(const glm::vec3& delta);
+
+    // Simulates every emitter dt seconds ahead
+    void update(float dt);
+
+    // Before the transparents, with the scene framebuffer bound. Copies the depth the soft
+    // particles fade against, returns false when there's nothing to draw.
+    bool beginDraw();
+    bool hasPass(ParticlePass pass) const;
+    // Draws the emitters of one pass, returns the draw calls issued. The OIT pass draws into
+    // whatever's bound, the others into the scene framebuffer unless the OIT's reduced-resolution
+    // targets are bound, the soft fade scaled to the viewport.
+    int draw(ParticlePass pass, const glm::vec3& camera_position);
+
+    // A fire with smoke rising from it, particles split between the two
+    void spawnFire(const glm::vec3& position, int particles);
+
+    // --particles <count>, returns the arguments taken, 0 if it isn't one, -1 on a bad value
+    int parseArg(int argc, char** argv, int i);
+    int particlesRequested() const { return requested; }
+
+    size_t emitterCount() const;
+    size_t particleCount() const { return particle_ranges.used(); } // Slots held, alive or not
+    bool computeSimulation() const { return compute_shader != nullptr; }
+    void release();
+
+private:
+    struct Emitter {
+        ParticleEmitterDesc desc;
+        bool used = false;
+        bool active = true;
+        GeometryRange range; // In particles
+        uint32_t spawn_cursor = 0; // Into the range, where this frame's spawns start
+        uint32_t spawn_count = 0;
+        float spawn_carry = 0.0f;  // Fraction of a particle owed from earlier frames
+        uint32_t seed = 0;
+    };
+
+    bool init();
+    void simulate(const Emitter& emitter, const Shader& shader, float dt);
+    void clearRange(const GeometryRange& range);
+    bool ensureDepthCopy(int width, int height);
+
+    std::unique_ptr<Shader> compute_shader;  // GL 4.3
+    std::unique_ptr<Shader> feedback_shader; // Otherwise
+    std::unique_ptr<Shader> draw_shader;
+    std::unique_ptr<Shader> draw_oit_shader;
+    GLuint buffers[2] = {0, 0}; // The second only for transform feedback
+    GLuint simulate_vaos[2] = {0, 0}; // Reading buffers[i], transform feedback only
+    GLuint draw_vao = 0; // Re-pointed at each emitter's range
+    int current = 0; // The buffer holding this frame's particles
+    bool failed = false;
+
+    GLuint depth_fbo = 0, depth_texture = 0;
+    int depth_width = 0, depth_height = 0;
+    bool depth_copied = false;
+
+    Emitter emitters[PARTICLE_MAX_EMITTERS];
+    RangeAllocator particle_ranges;
+    std::vector<int> order; // Scratch, emitters by distance
+    int requested = PARTICLE_DEMO_PARTICLES;
+};
+
+extern ParticleSystem particle_system;
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "entity_manager.h"
+
+#define PHYSICS_GRAVITY -9.81f
+#define PHYSICS_SOLVER_ITERATIONS 8
+#define PHYSICS_BAUMGARTE 0.2f          // Fraction of the penetration pushed out per step
+#define PHYSICS_SLOP 0.005f             // Metres of penetration left alone, resting contacts stay touching
+#define PHYSICS_BOUNCE_THRESHOLD 1.0f   // m/s, slower impacts don't bounce
+#define PHYSICS_AABB_MARGIN 0.05f       // Broadphase boxes are fattened by this
+#define PHYSICS_CONTACT_TOLERANCE 0.02f // Points this close to a pair's deepest one join its manifold
+#define PHYSICS_MAX_CONTACTS 4          // Per pair
+#define PHYSICS_WARM_START_DISTANCE 0.05f // A contact within this of last step's reuses its impulses
+#define PHYSICS_HULL_DIRECTIONS 42      // Support directions sampled per hull, at most this many points kept
+#define PHYSICS_MAX_FEATURE_POINTS 64   // Corners gathered per shape for a manifold, above any hull's
+#define PHYSICS_MIN_HALF_EXTENT 0.01f   // Flat bounds still make a box with some thickness
+#define PHYSICS_GROUND_FRICTION 0.6f
+#define PHYSICS_EDGE_AXIS_PREFERENCE 1.05f // Box pairs take an edge axis only when this much shallower
+#define PHYSICS_GJK_ITERATIONS 32
+#define PHYSICS_EPA_ITERATIONS 32
+#define PHYSICS_EPA_TOLERANCE 1e-4f     // Metres, EPA stops once its nearest face is this close to exact
+#define PHYSICS_SLEEP_LINEAR 0.05f      // m/s
+#define PHYSICS_SLEEP_ANGULAR 0.05f     // rad/s
+#define PHYSICS_SLEEP_SECONDS 0.5f      // An island at rest this long sleeps
+#define PHYSICS_BODY_GRAIN 256          // Bodies per parallelFor range
+#define PHYSICS_PAIR_GRAIN 64           // Broadphase proxies and narrowphase pairs per range
+#define PHYSICS_ISLAND_GRAIN 8          // Islands per parallelFor range
+#define PHYSICS_DEMO_HEIGHT 2.0f        // Metres above the ground of the demo pile's bottom layer
+
+extern bool use_physics; // Off freezes every body where it is
+
+enum PhysicsShapeType : uint8_t {
+    PHYSICS_SHAPE_BOX = 0, // The entity's LOD0 AABB
+    PHYSICS_SHAPE_SPHERE,  // Around the AABB's centre, out to its farthest faces
+    PHYSICS_SHAPE_HULL,    // Extreme points of the LOD0 vertices, a box when the meshes keep no CPU copy
+};
+
+struct RigidBodyDesc {
+    PhysicsShapeType shape = PHYSICS_SHAPE_BOX;
+    float mass = 1.0f;              // Kilograms, 0 makes the body static
+    float friction = 0.5f;
+    float restitution = 0.1f;
+    float linear_damping = 0.05f;   // Fraction of the velocity lost per second
+    float angular_damping = 0.1f;
+    glm::vec3 velocity{0.0f};
+    glm::vec3 angular_velocity{0.0f}; // Radians per second, world space
+};
+
+// Rigid bodies moving root entities. A body's shape is fitted to its entity's LOD0 meshes at the
+// entity's scale when it's added. Each step() runs:
+//  - broadphase: sweep and prune, the fattened AABBs sorted along the axis their centres spread
+//    out along most and swept in ranges across the job system, pairs of two bodies that can't
+//    move (static or asleep) skipped;
+//  - narrowphase: separating axes for box pairs, closed forms for spheres against spheres and
+//    boxes, GJK for overlap and EPA for the normal and depth of anything with a hull, then up to
+//    PHYSICS_MAX_CONTACTS points from the shapes' corners near the deepest one. Every pair on
+//    its own across the job system, and contacts close to last step's reuse its impulses;
+//  - islands: dynamic bodies joined through their contacts, static bodies never joining two;
+//  - solver: sequential impulses with friction, each island on its own across the job system,
+//    then integration. An island at rest for PHYSICS_SLEEP_SECONDS sleeps until something awake
+//    touches it.
+// The world runs where simulateFrame() does, on the simulation thread when there is one (see
+// sim_thread.h), in fixed SIM_STEP_SECONDS steps. interpolate() hands the bodies' poses to the GL
+// thread through the snapshot, which writes them with EntityManager::setTransforms().
+// addBody(), removeBody() and clear() are safe from any thread and take effect at the next step.
+class PhysicsWorld {
+public:
+    PhysicsWorld() = default;
+    PhysicsWorld(const PhysicsWorld&) = delete;
+    PhysicsWorld& operator=(const PhysicsWorld&) = delete;
+
+    // Returns the body's id, -1 when the entity is gone, has a parent or no bounds. Reads the
+    // entity, so the GL thread's to call while it owns the entity manager.
+    int addBody(EntityHandle entity, const RigidBodyDesc& desc);
+    void removeBody(int body);
+    void clear();
+    // A static plane everything rests on, at this height
+    void setGround(float height);
+
+    // Advances every awake body dt seconds
+    void step(float dt);
+    // Poses of the bodies that moved since the last call, alpha of the way from the previous
+    // step's to the last one's. Call where step() runs.
+    void interpolate(float alpha, std::vector<EntityHandle>& entities, std::vector<EntityTransform>& transforms);
+
+    // count instances of entity_template dropped in a pile around center, each given a body
+    void spawnPile(const EntityTemplate& entity_template, int count, const glm::vec3& center);
+
+    // --physics <count>, returns the arguments taken, 0 if it isn't one, -1 on a bad value
+    int parseArg(int argc, char** argv, int i);
+    int bodiesRequested() const { return requested; }
+
+    // From the last step, readable from any thread
+    size_t bodyCount() const { return body_count.load(std::memory_order_relaxed); }
+    size_t awakeCount() const { return awake_count.load(std::memory_order_relaxed); }
+    size_t contactCount() const { return contact_count.load(std::memory_order_relaxed); }
+    size_t islandCount() const { return island_count.load(std::memory_order_relaxed); }
+    float stepMs() const { return step_ms.load(std::memory_order_relaxed); }
+
+    // The world's internals, public for physics.cpp's collision routines
+    struct Body {
+        EntityHandle entity;
+        bool used = false;
+        bool asleep = false;
+        bool publish = true; // Moved since interpolate() last wrote it
+        PhysicsShapeType shape = PHYSICS_SHAPE_BOX;
+        glm::vec3 half_extents{0.5f}; // The box, or the hull's AABB
+        float radius = 0.5f;          // Sphere only
+        std::shared_ptr<const std::vector<glm::vec3>> hull; // Body space, around the centre of mass
+        glm::vec3 offset{0.0f}; // Centre of mass in the entity's scaled space
+        glm::vec3 scale{1.0f};  // The entity's, kept as it was
+
+        glm::vec3 position{0.0f}; // Centre of mass
+        glm::quat orientation{1.0f, 0.0f, 0.0f, 0.0f};
+        glm::vec3 previous_position{0.0f};
+        glm::quat previous_orientation{1.0f, 0.0f, 0.0f, 0.0f};
+        glm::vec3 velocity{0.0f}, angular_velocity{0.0f};
+        float inverse_mass = 0.0f;
+        glm::vec3 inverse_inertia{0.0f}; // Body space, diagonal
+        glm::mat3 inverse_inertia_world{0.0f};
+        float friction = 0.5f, restitution = 0.1f;
+        float linear_damping = 0.0f, angular_damping = 0.0f;
+        float rest_time = 0.0f;
+        glm::vec3 aabb_min{0.0f}, aabb_max{0.0f};
+    };
+
+    struct ContactPoint {
+        glm::vec3 position{0.0f}; // World space, halfway between the surfaces
+        glm::vec3 local_a{0.0f};  // In a's body space, matches the point against the next step's
+        float depth = 0.0f;
+        float normal_impulse = 0.0f;
+        float tangent_impulse[2] = {0.0f, 0.0f};
+        glm::vec3 ra{0.0f}, rb{0.0f};
+        float normal_mass = 0.0f, tangent_mass[2] = {0.0f, 0.0f};
+        float bias = 0.0f;
+    };
+
+    // Contacts of one pair, b -1 for the ground. normal points from a to b.
+    struct Manifold {
+        int a = 0, b = -1;
+        glm::vec3 normal{0.0f};
+        glm::vec3 tangents[2];
+        float friction = 0.0f, restitution = 0.0f;
+        int count = 0;
+        ContactPoint points[PHYSICS_MAX_CONTACTS];
+
+        uint64_t key() const { return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b; }
+    };
+
+private:
+    struct Proxy {
+        float min = 0.0f, max = 0.0f; // Along the sweep axis
+        int body = 0;
+    };
+    struct Island {
+        uint32_t first_body = 0, body_count = 0;
+        uint32_t first_manifold = 0, manifold_count = 0;
+    };
+
+    void applyCommands();
+    void broadphase();
+    void narrowphase();
+    void buildIslands();
+    void solveIsland(const Island& island, float dt);
+    bool moving(int body) const { return bodies[body].inverse_mass > 0.0f && !bodies[body].asleep; }
+
+    std::vector<Body> bodies; // Indexed by id, unused slots left behind by removals
+    Body ground_body; // Stands in for the ground in the solver, never moves
+    bool has_ground = false;
+    float ground_height = 0.0f;
+
+    std::vector<Proxy> proxies;
+    std::vector<std::vector<std::pair<int, int>>> range_pairs; // Per broadphase range
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<Manifold> pair_manifolds;  // Per broadphase pair, count 0 when they don't touch
+    std::vector<Manifold> manifolds, previous_manifolds; // Touching ones, sorted by key
+    std::vector<Manifold> ground_manifolds; // Per body, count 0 when it isn't touching
+    std::vector<int> island_parent;         // Union-find over body ids
+    std::vector<int> island_of;             // Per root body, its index in islands, -1 asleep
+    std::vector<uint8_t> island_awake;      // Per root body
+    std::vector<int> island_bodies, island_manifolds;
+    std::vector<Island> islands;
+
+    std::mutex command_mutex;
+    int next_id = 0;
+    std::vector<std::pair<int, Body>> added;
+    std::vector<int> removed;
+    bool clearing = false;
+    bool ground_changed = false;
+    float pending_ground = 0.0f;
+
+    int requested = 0;
+    std::atomic<size_t> body_count{0}, awake_count{0}, contact_count{0}, island_count{0};
+    std::atomic<float> step_ms{0.0f};
+};
+
+extern PhysicsWorld physics_world;
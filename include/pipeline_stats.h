@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "gpu_queries.h"
+#include "shader.h"
+
+// What the GPU actually did, next to RenderStats' CPU-side counts. Both off by default.
+extern bool use_pipeline_statistics; // Per-pass ARB_pipeline_statistics_query counters
+extern bool use_overdraw_view;       // Heat map of shaded fragments per pixel in place of the scene
+
+#define OVERDRAW_LEVELS 8 // Heat map steps from 0, the last also takes every pixel shaded more often
+
+// Per-pass pipeline statistics queries and the overdraw view, never stalling the CPU: like
+// GpuQueryPool, each frame records into one of GPU_QUERY_FRAMES slots and beginFrame() picks up
+// the newest whose results are back, dropping a frame still busy when its slot comes round.
+//
+// Passes are bracketed in the same order as gpu_queries' elapsed queries, so a pass's index is
+// its GpuPass. The overdraw view counts, in the scene target's stencil, every fragment that passes
+// the depth test between beginOverdraw() and endOverdraw() (discarded ones are shaded but not
+// counted, and counts stop at 255). drawOverdraw() then paints each count's pixels a heat colour
+// with a samples-passed query apiece, which gives the average overdraw per covered pixel.
+// Pipeline statistics need GL 4.6 or the ARB extension, and WebGL2 has no sample counts, so there
+// only the heat map is drawn. GL thread only.
+class PipelineStatistics {
+public:
+    struct PassCounts {
+        uint64_t vertices = 0;           // Vertex shader invocations
+        uint64_t primitives = 0;         // Primitives reaching the clipper
+        uint64_t clipped_primitives = 0; // Primitives leaving it, after clipping and culling
+        uint64_t fragments = 0;          // Fragment shader invocations
+    };
+    struct Frame {
+        uint64_t id = 0;                 // gpu_queries' frame() while it recorded
+        std::vector<PassCounts> passes;  // By beginPass() order, empty without pipeline statistics
+        uint64_t overdraw_samples[OVERDRAW_LEVELS] = {}; // Samples at each count, level 0 not measured
+        double overdraw = -1.0;          // Shaded fragments per covered sample, -1 when not measured
+    };
+
+    PipelineStatistics() = default;
+    ~PipelineStatistics();
+
+    PipelineStatistics(const PipelineStatistics&) = delete;
+    PipelineStatistics& operator=(const PipelineStatistics&) = delete;
+
+    // After gpu_queries.beginFrame(), collects what finished and starts recording
+    void beginFrame();
+    void endFrame();
+    void release();
+
+    // Around each of the frame's timed passes, one open at a time
+    void beginPass();
+    void endPass();
+
+    // Around the scene target's shading passes, with the stencil cleared at the frame's start
+    void beginOverdraw();
+    void endOverdraw();
+    // Over the scene target's colour once the scene is drawn, before present()
+    void drawOverdraw(int width, int height);
+
+    // Newest frame with results, null until one comes back
+    const Frame* latest() const { return latest_valid ? &latest_frame : nullptr; }
+
+private:
+    struct Slot {
+        std::vector<GLuint> passes; // Four queries a pass, kept for the slot's next frames
+        size_t passes_used = 0;
+        GLuint overdraw[OVERDRAW_LEVELS] = {};
+        bool overdraw_used = false;
+        uint64_t frame = 0;
+        bool waiting = false;
+    };
+
+    bool finished(const Slot& slot) const;
+    void collect(Slot& slot);
+    bool initOverdraw();
+
+    Slot slots[GPU_QUERY_FRAMES];
+    int current = -1;           // Into slots while recording
+    bool statistics = false;    // Recording pipeline statistics this frame
+    bool pass_open = false;
+    bool overdraw_open = false;
+    bool overdraw_counted = false; // The stencil holds this frame's counts
+    Frame latest_frame;
+    bool latest_valid = false;
+
+    std::unique_ptr<Shader> heat_shader;
+    GLuint vao = 0;
+    bool overdraw_failed = false;
+};
+
+extern PipelineStatistics pipeline_stats;
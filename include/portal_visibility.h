@@ -0,0 +1,93 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class EntityManager;
+
+extern bool use_portal_culling; // Off draws every cell, the cells and sets are kept
+
+#define PORTAL_NO_CELL 0xffffffffu
+#define PORTAL_MAX_DEPTH 32         // Portals deep a walk goes before it stops narrowing
+#define PORTAL_NEAR_W 1e-3f         // Portal corners nearer the eye than this keep the whole rectangle
+#define PORTAL_PVS_SAMPLES 3        // Per axis, the points in a cell the offline sets look from
+#define PORTAL_PVS_NEAR 0.01f
+#define PORTAL_PVS_FAR 10000.0f
+
+// An authored room or block, an axis-aligned box. Cells may overlap, walls usually belong to both.
+struct PortalCell {
+    glm::vec3 bmin{0.0f}, bmax{0.0f};
+};
+
+// A convex quad opening between two cells, corners in order around it. Seen from either side.
+struct Portal {
+    uint32_t cells[2] = { PORTAL_NO_CELL, PORTAL_NO_CELL };
+    glm::vec3 corners[4];
+};
+
+// Cells and portal visibility for interiors and city blocks, where the frustum alone lets every
+// room behind a wall through. Each frame the camera's cell is the smallest one containing it,
+// and a walk through its portals narrows the screen rectangle at each one, reaching only cells
+// seen through the openings on the way. A potentially visible set per cell, computed offline
+// (the scene compiler does it) by walking from sample points in the cell in every direction,
+// keeps the walk to the cells that can be seen from anywhere in it.
+// Each entity belongs to the smallest cell its bounds fit inside. Those in no cell, and every
+// entity while the camera is in no cell, are never culled here. The camera pass tests the walk's
+// cells, the shadow passes the camera cell's set, as casters a room away can still shadow it.
+// Static batch chunks and the GPU-driven path don't know about cells and draw as before.
+// Main thread only.
+class PortalVisibility {
+public:
+    PortalVisibility() = default;
+
+    PortalVisibility(const PortalVisibility&) = delete;
+    PortalVisibility& operator=(const PortalVisibility&) = delete;
+
+    // pvs holds a row of pvsWords(cells.size()) words per cell, bit c of a row set when cell c can
+    // be seen from it. Empty computes them here.
+    void load(std::vector<PortalCell> cells, std::vector<Portal> portals, std::vector<uint32_t> pvs);
+    void clear();
+    // The world origin moved by delta (world_origin.h)
+    void shiftOrigin(const glm::vec3& delta);
+
+    // The offline sets, rows of pvsWords() words per cell
+    static std::vector<uint32_t> computePvs(const std::vector<PortalCell>& cells, const std::vector<Portal>& portals);
+    static size_t pvsWords(size_t cell_count) { return (cell_count + 31) / 32; }
+
+    // This frame's walk from the camera, and the entities that moved or arrived into their cells
+    void update(const EntityManager& entity_manager, const glm::mat4& view_projection, const glm::vec3& camera_position);
+
+    // False when nothing is culled this frame: no cells, turned off, or the camera in no cell
+    bool active() const { return camera_cell != PORTAL_NO_CELL; }
+    // Entity i as of update(), seen through the portals, and in the camera cell's set
+    bool entityVisible(uint32_t i) const { return cellIn(visible, entityCell(i)); }
+    bool entityPotentiallyVisible(uint32_t i) const { return cellIn(potentially_visible, entityCell(i)); }
+
+    bool empty() const { return cells.empty(); }
+    size_t cellCount() const { return cells.size(); }
+    size_t portalCount() const { return portals.size(); }
+    uint32_t cameraCell() const { return camera_cell; }
+    size_t visibleCount() const; // Cells the last walk reached
+
+    // The smallest cell containing the point or the box, PORTAL_NO_CELL for none
+    uint32_t cellAt(const glm::vec3& point) const { return cellContaining(point, point); }
+    uint32_t cellContaining(const glm::vec3& bmin, const glm::vec3& bmax) const;
+
+private:
+    uint32_t entityCell(uint32_t i) const { return i < entity_cells.size() ? entity_cells[i] : PORTAL_NO_CELL; }
+    static bool cellIn(const std::vector<uint8_t>& set, uint32_t cell) { return cell == PORTAL_NO_CELL || set[cell] != 0; }
+    void assignEntities(const EntityManager& entity_manager);
+
+    std::vector<PortalCell> cells;
+    std::vector<Portal> portals;
+    std::vector<std::vector<uint32_t>> cell_portals; // Each cell's portals, either side
+    std::vector<uint32_t> pvs;
+    std::vector<uint8_t> visible, potentially_visible; // Per cell, this frame
+    std::vector<uint32_t> entity_cells;                // Per entity index
+    uint64_t entity_layout = ~0ull;                    // EntityManager::layoutVersion() they match
+    uint32_t camera_cell = PORTAL_NO_CELL;
+};
+
+extern PortalVisibility portal_visibility;
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "gpu_queries.h"
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+// Hierarchical frame profiler. PROFILE_SCOPE("name") times the rest of the enclosing block on the
+// CPU, and on the GPU with a timestamp query at each end, so scopes nest freely where
+// GL_TIME_ELAPSED queries can't. The timestamps come from gpu_queries, a frame waits until the
+// pool collects it, then joins a ring of the last PROFILER_HISTORY_FRAMES that the Profiler window
+// shows as a flame-chart timeline and a per-scope table. Without timestamps (WebGL2, or a frame
+// the pool dropped) only the CPU side is recorded. Scopes only count on the thread that called beginFrame(), the job system's
+// workers show up inside the scope around their parallel loop.
+extern bool use_profiler;
+#define PROFILER_HISTORY_FRAMES 120
+#define PROFILER_MAX_SCOPES 256  // Per frame, the rest are dropped
+
+class FrameProfiler {
+public:
+    struct Scope {
+        const char* name = nullptr; // A literal, scopes with the same one aggregate by pointer
+        int depth = 0;
+        double cpu_start_ms = 0.0, cpu_ms = 0.0; // From the frame's start
+        double gpu_start_ms = 0.0, gpu_ms = -1.0; // -1 without a timestamp
+    };
+    struct Frame {
+        std::vector<Scope> scopes; // In the order they opened, each parent before its children
+        double cpu_ms = 0.0;
+        double gpu_ms = -1.0;
+        uint64_t id = 0; // gpu_queries.frame() it recorded in
+        std::chrono::steady_clock::time_point start; // Where cpu_start_ms counts from
+        uint64_t gpu_start_ns = 0; // GPU clock where gpu_start_ms counts from, 0 without timestamps
+    };
+
+    FrameProfiler() = default;
+
+    FrameProfiler(const FrameProfiler&) = delete;
+    FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+    // Bracket everything the frame does, inside gpu_queries' frame. GL thread only.
+    void beginFrame();
+    void endFrame();
+
+    // Index of the opened scope, -1 when not recording. PROFILE_SCOPE pairs them.
+    int push(const char* name);
+    void pop(int scope);
+
+    // The Profiler window, between ImGui::NewFrame() and ImGui::Render()
+    void drawWindow(float x, float y);
+
+    // Sees every frame as its GPU times come in, frozen or not
+    void addFrameCallback(std::function<void(const Frame&)> callback) { on_frame.push_back(std::move(callback)); }
+
+private:
+    // A frame recording or waiting for its timestamps
+    struct Pending {
+        Frame frame;
+        std::vector<int> stamps; // Pool timestamp indices, frame start and end, then a pair per scope
+        uint64_t gpu_frame = 0;
+        bool waiting = false;
+    };
+
+    // gpu is null when the frame has no GPU times
+    void resolve(Pending& pending, const GpuQueryPool::Frame* gpu);
+    double sinceFrameStart() const;
+
+    Pending pending[GPU_QUERY_FRAMES]; // By the pool's frame id
+    int current = -1; // Into pending while recording
+    std::vector<int> open; // Scopes not popped yet, innermost last
+    std::chrono::steady_clock::time_point frame_start;
+    std::thread::id owner;
+    uint64_t frame_count = 0;
+
+    std::vector<std::function<void(const Frame&)>> on_frame;
+    std::vector<Frame> history; // Ring, oldest first from history_next once full
+    size_t history_next = 0;
+    bool frozen = false;
+    int selected = 0; // Frames back from the newest, for the timeline
+};
+
+extern FrameProfiler profiler;
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name) : index(profiler.push(name)) {}
+    ~ProfileScope() { profiler.pop(index); }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    int index;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
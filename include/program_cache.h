@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define PROGRAM_CACHE_VERSION 1
+
+// Linked program binaries in cache/shaders/, so a launch with unchanged shaders skips compiling
+// and linking. Entries are keyed by a hash of the program's stage sources (defines included) and
+// the driver's vendor, renderer and version strings: an edited shader or an updated driver misses
+// and builds from source, which saves the new binary. A binary the driver rejects is deleted and
+// rebuilt the same way. Needs gl_extensions.program_binary, does nothing otherwise (WebGL has no
+// program binaries). GL thread only.
+class ProgramCache {
+public:
+    // For a program built from these stage sources, in stage order. Absent stages are nullptr.
+    uint64_t key(const std::vector<const std::string*>& sources);
+    // The cached program, linked and ready, or 0
+    GLuint load(uint64_t key);
+    // Before linking a program that store() will save, some drivers only keep a binary when asked
+    void prepare(GLuint program) const;
+    void store(uint64_t key, GLuint program) const;
+
+private:
+    std::string path(uint64_t key) const;
+
+    std::string driver; // Vendor, renderer and version, read on first use
+};
+
+extern ProgramCache program_cache;
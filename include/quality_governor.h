@@ -0,0 +1,64 @@
+#pragma once
+
+#include "shadowmap.h"
+
+// Holds the frame inside a budget by stepping quality down when the CPU or the GPU goes over it,
+// and back up once there's headroom again. Steps are taken in this order and undone in reverse:
+enum QualityStep {
+    QUALITY_STEP_LOD_BIAS = 0,      // lod_bias up by QUALITY_LOD_BIAS_STEP
+    QUALITY_STEP_SHADOW_INTERVAL,   // Cascades refresh at most every QUALITY_SHADOW_INTERVAL frames
+    QUALITY_STEP_SHADOW_RESOLUTION, // Shadow pages at half size, not below 512
+    QUALITY_STEP_SHADOW_TAPS,       // Soft shadows capped at QUALITY_SHADOW_TAPS taps
+    QUALITY_STEP_RESOLUTION,        // Internal resolution (or dynamic resolution's ceiling) scaled by QUALITY_RESOLUTION_SCALE
+    QUALITY_STEP_COUNT,
+};
+extern const char* const QUALITY_STEP_NAMES[QUALITY_STEP_COUNT];
+
+// Off by default. Each step saves the setting it changes and puts it back when undone, edits made
+// in between are overwritten.
+extern bool use_quality_governor;
+extern float quality_budget_ms;
+#define QUALITY_DEGRADE_FRAMES 20       // Consecutive frames over budget before the next step
+#define QUALITY_RESTORE_FRAMES 180      // Consecutive frames under QUALITY_RESTORE_HEADROOM before undoing one
+#define QUALITY_RESTORE_HEADROOM 0.75f  // Of the budget
+#define QUALITY_SETTLE_FRAMES 30        // Ignored after a step, GPU times lag a few frames behind
+#define QUALITY_LOD_BIAS_STEP 1.0f
+#define QUALITY_SHADOW_INTERVAL 4
+#define QUALITY_SHADOW_TAPS 4
+#define QUALITY_RESOLUTION_SCALE 0.75f
+
+// Fed once per frame from the profiling sources: the CPU's share of the last frame and the newest
+// GPU frame time gpu_queries collected (negative when none came back this frame, the previous
+// one is kept). Main thread only.
+class QualityGovernor {
+public:
+    QualityGovernor() = default;
+
+    QualityGovernor(const QualityGovernor&) = delete;
+    QualityGovernor& operator=(const QualityGovernor&) = delete;
+
+    void update(float cpu_ms, double gpu_ms);
+    // Undoes every step, also what turning use_quality_governor off does at the next update()
+    void restoreAll();
+
+    // Steps in effect, the first level() of QualityStep
+    int level() const { return applied; }
+    int degrades() const { return degrade_count; }
+
+private:
+    void apply(QualityStep step);
+    void undo(QualityStep step);
+
+    int applied = 0;
+    int over_frames = 0, under_frames = 0, settle_frames = 0;
+    double gpu_ms = 0.0;
+    int degrade_count = 0; // Since startup
+
+    float saved_lod_bias = 0.0f;
+    int saved_cascade_intervals[SHADOW_CASCADES] = {};
+    unsigned int saved_shadow_resolution = 0;
+    int saved_filter_taps = 0;
+    float saved_resolution_scale = 1.0f;
+};
+
+extern QualityGovernor quality_governor;
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "frame_uniforms.h"
+#include "render_view.h"
+
+class Shader;
+
+extern bool use_reflection_probes;             // Off leaves reflections to the sky, the captures are kept
+extern float reflection_probe_refresh_seconds; // Recaptures each probe this often, 0 only when placed or invalidated
+
+#define REFLECTION_PROBE_SIZE 64            // Face side of the capture and of the prefiltered cube's top mip
+#define REFLECTION_PROBE_MIPS 5             // Roughness (mip / (REFLECTION_PROBE_MIPS - 1)) per level, matches pbr.fs
+#define REFLECTION_PROBE_SAMPLES 32         // GGX samples per prefiltered texel
+#define REFLECTION_PROBE_FACES_PER_FRAME 1  // Captured faces per update(), the rest wait for later frames
+#define REFLECTION_PROBE_NEAR 0.05f
+#define REFLECTION_PROBE_FAR 300.0f
+#define REFLECTION_PROBE_MIN_PIXELS 2.0f    // Entities smaller than this on a face aren't drawn into it
+#define REFLECTION_PROBE_UNIT 20            // First of the REFLECTION_PROBE_SLOTS units the bound cubes go on
+
+// Placed cubemaps of the scene around them, for glossy reflections of what the sky's IBL can't
+// see: walls, the ground, the entities nearby. A probe captures its six faces one per frame into a
+// shared capture cube, through the regular forward shading at a coarser LOD with only the
+// directional lights and no shadows, then prefilters the whole cube at once like ibl.h does the
+// sky, so a half-captured probe is never shown. Captures happen when a probe is placed, on
+// invalidate(), and every reflection_probe_refresh_seconds if set.
+// Per frame the REFLECTION_PROBE_SLOTS probes nearest the camera go into the LightBlock, and
+// pbr.fs blends each fragment's reflection towards those whose sphere it is inside, parallax
+// corrected against the sphere. GL thread only.
+class ReflectionProbes {
+public:
+    // Draws the scene into the face, already cleared, the renderer's part of a capture
+    using CaptureFace = std::function<void(const RenderView& face)>;
+
+    ReflectionProbes() = default;
+    ~ReflectionProbes();
+
+    ReflectionProbes(const ReflectionProbes&) = delete;
+    ReflectionProbes& operator=(const ReflectionProbes&) = delete;
+
+    // Returns the probe's id, captured over the next frames. radius bounds both where it's
+    // blended in and the parallax proxy.
+    int add(const glm::vec3& position, float radius);
+    void remove(int id);
+    // Recaptures one probe, or every probe with -1, after something near it changed
+    void invalidate(int id = -1);
+    // The world origin moved by delta (world_origin.h), the captures stay valid
+    void shiftOrigin(const glm::vec3& delta);
+    void release();
+
+    // Captures the faces due this frame, at most REFLECTION_PROBE_FACES_PER_FRAME, and prefilters
+    // a probe whose last face landed. Leaves the capture framebuffer bound. Returns the faces drawn.
+    int update(float dt, const CaptureFace& capture);
+    // The nearest captured probes into block, whose cubes bind() puts on REFLECTION_PROBE_UNIT on
+    void select(const glm::vec3& camera_position, LightBlock& block);
+    void bind() const;
+
+    bool empty() const { return live == 0; }
+    size_t count() const { return live; }
+    size_t capturedCount() const;
+    size_t pendingCount() const;
+
+private:
+    struct Probe {
+        glm::vec3 position{0.0f};
+        float radius = 0.0f;
+        GLuint cube = 0;       // Prefiltered, 0 until the first capture is done
+        bool live = false;     // Removed ones stay behind as holes so ids hold
+        bool dirty = false;    // Waiting for a capture
+        float age = 0.0f;      // Seconds since the last capture started
+    };
+
+    bool ready();
+    void prefilter(Probe& probe);
+
+    std::vector<Probe> probes;
+    size_t live = 0;
+    int capturing = -1;   // Probe whose faces are going into capture_cube
+    int capture_face = 0; // Its next face
+    size_t next_dirty = 0; // Round robin over the dirty probes
+
+    GLenum format = 0;     // RGBA16F, RGBA8 on WebGL2 without EXT_color_buffer_float
+    GLuint capture_cube = 0;
+    GLuint capture_depth = 0;
+    GLuint fbo = 0;
+    GLuint vao = 0;
+    std::unique_ptr<Shader> prefilter_shader;
+    bool failed = false;
+    GLuint bound[REFLECTION_PROBE_SLOTS] = {};
+};
+
+extern ReflectionProbes reflection_probes;
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define RENDER_GRAPH_KEEP_FRAMES 120 // Pooled targets no graph asked for in this many executes are deleted
+
+typedef int RenderResource; // Into the graph being built, RENDER_RESOURCE_NONE for none
+#define RENDER_RESOURCE_NONE (-1)
+
+// A transient target. Two with equal descriptions may share one texture.
+struct RenderTextureDesc {
+    int width = 0, height = 0;
+    GLenum internal_format = GL_RGBA8;
+
+    bool operator==(const RenderTextureDesc& other) const {
+        return width == other.width && height == other.height && internal_format == other.internal_format;
+    }
+};
+
+// Passes declared with the resources they read and write, instead of in a hand-kept order. Each
+// addPass() runs its setup right away to declare them; execute() then
+//   - culls every pass nothing needs: a pass is kept when it has a side effect, writes an imported
+//     resource, or writes something a kept pass reads (or writes over, it may blend)
+//   - orders the rest, a reader after the writers declared before it (or after every writer when
+//     none was) and a writer after the earlier accesses, ties in declaration order
+//   - gives each transient texture one from a pool for the span between its first and last use,
+//     so targets of a matching description whose spans don't overlap alias the same texture
+//   - runs the passes, each in a profiler scope of its name, and forgets them.
+// An aliased texture's contents are undefined at its first write, passes clear or overwrite
+// them. Pooled textures outlive the frame and are deleted once unused for RENDER_GRAPH_KEEP_FRAMES
+// executes, so a feature toggled off gives its targets back. Imported textures are only ordered
+// against, never pooled; id 0 stands for the scene framebuffer. GL thread only.
+class RenderGraph {
+public:
+    class Builder {
+    public:
+        RenderResource read(RenderResource resource);
+        RenderResource write(RenderResource resource);
+        // Never culled, for passes whose results leave the graph some other way
+        void sideEffect();
+
+    private:
+        friend class RenderGraph;
+        Builder(RenderGraph& graph, int pass) : graph(graph), pass(pass) {}
+        RenderGraph& graph;
+        int pass;
+    };
+
+    class Context {
+    public:
+        GLuint texture(RenderResource resource) const;
+        // Over the resources' textures, cached for as long as they stay pooled. 0 when incomplete,
+        // and the binding is left as it was either way.
+        GLuint framebuffer(std::initializer_list<RenderResource> colors, RenderResource depth = RENDER_RESOURCE_NONE);
+
+    private:
+        friend class RenderGraph;
+        explicit Context(RenderGraph& graph) : graph(graph) {}
+        RenderGraph& graph;
+    };
+
+    struct Stats {
+        int passes = 0, culled = 0;     // Last execute's
+        int transients = 0;             // Transient textures it asked for
+        uint64_t transient_bytes = 0;   // What they'd take unaliased
+        int pooled = 0;                 // Textures in the pool
+        uint64_t pooled_bytes = 0;
+    };
+
+    RenderGraph() = default;
+    ~RenderGraph();
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    RenderResource createTexture(const char* name, const RenderTextureDesc& desc);
+    RenderResource importTexture(const char* name, GLuint texture);
+    void addPass(const char* name, const std::function<void(Builder&)>& setup, std::function<void(Context&)> execute);
+
+    void execute();
+    // Deletes the pool and its framebuffers
+    void release();
+
+    const Stats& stats() const { return frame_stats; }
+
+private:
+    struct Resource {
+        const char* name = "";
+        RenderTextureDesc desc;
+        GLuint texture = 0;
+        bool imported = false;
+        std::vector<int> writers; // Passes, in declaration order
+        int first = -1, last = -1; // Positions in the execution order
+    };
+    struct Pass {
+        const char* name = "";
+        std::function<void(Context&)> run;
+        std::vector<RenderResource> reads, writes;
+        bool side_effect = false;
+    };
+    struct Dependency {
+        int pass;
+        bool needs; // Produces what the dependent reads or writes over, not just ordering
+    };
+    struct PooledTexture {
+        RenderTextureDesc desc;
+        GLuint texture = 0;
+        bool taken = false;
+        uint64_t used = 0; // executes when last given out
+    };
+
+    std::vector<std::vector<Dependency>> dependencies() const;
+    std::vector<int> order(const std::vector<std::vector<Dependency>>& dependencies, std::vector<bool>& kept);
+    GLuint acquire(const RenderTextureDesc& desc);
+    void trim();
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<PooledTexture> pool;
+    std::map<std::vector<GLuint>, GLuint> framebuffers; // Colour attachments then depth (or 0)
+    uint64_t executes = 0;
+    bool warned_cycle = false;
+    Stats frame_stats;
+};
+
+extern RenderGraph render_graph;
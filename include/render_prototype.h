@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+class Mesh;
+struct Impostor;
+
+#define RENDER_PROTOTYPE_NONE 0xffffffffu
+
+struct RenderLODLevel {
+    std::vector<std::shared_ptr<Mesh>> meshes;
+    std::shared_ptr<Impostor> impostor; // Set instead of meshes for the impostor tier
+    float maxDistance = 0.0f; // Authored switch distance at the reference projection (see LOD_REFERENCE_*)
+};
+
+// What every entity made from one template draws: its LOD levels, their meshes already carrying
+// the template's cull modes and material overrides (see material_registry). Immutable once made
+// and shared by a 32-bit id, so a hundred trees hold one set of levels between them and batching
+// can group by id. Entities in EntityManager keep theirs alive; when the last one goes its mesh
+// references are dropped and the id is reused.
+// Made and released on the main thread, read from anywhere in between.
+class RenderPrototypes {
+public:
+    RenderPrototypes() = default;
+
+    RenderPrototypes(const RenderPrototypes&) = delete;
+    RenderPrototypes& operator=(const RenderPrototypes&) = delete;
+
+    // The id of a live prototype with the same levels, or a new one unused until the first retain()
+    uint32_t create(std::vector<RenderLODLevel> levels);
+    void retain(uint32_t id);
+    void release(uint32_t id);
+
+    // Empty for RENDER_PROTOTYPE_NONE
+    const std::vector<RenderLODLevel>& levels(uint32_t id) const {
+        return id < prototypes.size() ? prototypes[id].levels : no_levels;
+    }
+    size_t liveCount() const { return prototypes.size() - free_ids.size(); }
+
+private:
+    struct Prototype {
+        std::vector<RenderLODLevel> levels;
+        uint32_t users = 0;
+    };
+    std::vector<Prototype> prototypes;
+    std::vector<uint32_t> free_ids;
+    std::unordered_multimap<size_t, uint32_t> by_hash; // Live ids by hashLevels()
+    static const std::vector<RenderLODLevel> no_levels;
+};
+
+extern RenderPrototypes render_prototypes;
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+
+// What an extra view draws (RenderView::passes)
+#define VIEW_PASS_CLEAR 1    // Colour and depth cleared inside the viewport first
+#define VIEW_PASS_ENTITIES 2 // The opaque entity meshes
+#define VIEW_PASS_SKY 4      // The sky behind them
+
+#define RENDER_VIEW_MAX 8             // Views per Renderer::renderViews() call, a bit each in the culling masks
+#define RENDER_VIEW_MERGE_OVERLAP 0.5f // Share of the smaller view's entities two views must share to draw one merged list
+
+// One extra view of the frame besides the main camera: split-screen, picture-in-picture, a
+// minimap or a probe face. Renderer::renderViews() culls each against the entity manager's
+// spatial index, and views that see mostly the same entities draw one merged, once-uploaded list.
+// They shade forward with the frame's directional lights and ambient, unshadowed: the light
+// clusters and the shadow atlas are planned for the main camera.
+struct RenderView {
+    glm::mat4 view{1.0f};
+    glm::mat4 projection{1.0f}; // Perspective or orthographic
+    glm::vec3 position{0.0f};
+    GLuint framebuffer = 0;     // Drawn into, left bound afterwards only by the caller
+    glm::ivec4 viewport{0};     // x, y, width, height within it
+    uint32_t passes = VIEW_PASS_CLEAR | VIEW_PASS_ENTITIES | VIEW_PASS_SKY;
+    glm::vec4 clear_color{0.0f, 0.0f, 0.0f, 1.0f};
+    float lod_bias = 0.0f;      // Coarser levels when positive, in halvings of the screen size
+    float min_pixels = 1.0f;    // Entities smaller than this in the view aren't drawn
+    bool far_shading = true;    // The cheaper shading tier, small views rarely need more
+};
+
+// A colour texture and depth to draw a view into and show elsewhere, e.g. through ImGui. Holds
+// the shading's linear output clamped to RGBA8, without the scene's tonemapping and encoding.
+// GL thread only.
+class ViewTarget {
+public:
+    ViewTarget() = default;
+    ~ViewTarget();
+
+    ViewTarget(const ViewTarget&) = delete;
+    ViewTarget& operator=(const ViewTarget&) = delete;
+
+    // (Re)creates it at the size, false if the framebuffer is incomplete
+    bool resize(int width, int height);
+    void release();
+
+    GLuint framebuffer() const { return fbo; }
+    GLuint colorTexture() const { return color; }
+    int width() const { return target_width; }
+    int height() const { return target_height; }
+
+private:
+    GLuint fbo = 0;
+    GLuint color = 0;
+    GLuint depth = 0;
+    int target_width = 0;
+    int target_height = 0;
+};
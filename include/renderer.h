@@ -1,60 +1,457 @@
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <unordered_map>
 #include "shader.h"
+#include "shader_variants.h"
 #include "light.h"
 #include "entity_manager.h"
+#include "frame_arena.h"
 #include "camera.h"
+#include "draw_list.h"
+#include "hiz.h"
+#include "occlusion_queries.h"
+#include "static_batches.h"
+#include "material_table.h"
+#include "oit.h"
+#include "gbuffer.h"
+#include "ssao.h"
+#include "shadowmap.h"
+#include "frame_uniforms.h"
+#include "light_clusters.h"
+#include "gpu_queries.h"
+#include "terrain.h"
+#include "foliage.h"
+#include "render_view.h"
+#include "frame_view.h"
 
 // Forward declarations
 class Mesh;
 struct Entity;
+struct Impostor;
+class GpuCulling;
+struct Frustum;
+
+// LOD selection. Positive bias picks coarser levels (each +1 halves the effective screen size).
+// With lod_auto_bias the bias follows frame time against lod_frame_budget_ms.
+#define LOD_MAX_BIAS 2.0f
+#define LOD_STATS_LEVELS 4
+extern float lod_bias;
+extern float lod_hysteresis;
+extern bool lod_auto_bias;
+extern float lod_frame_budget_ms;
+// Shadow views pick their own, usually coarser levels: this bias goes on top of lod_bias, and
+// they never draw finer than the camera view
+#define SHADOW_LOD_MAX_BIAS 4.0f
+extern float shadow_lod_bias;
+// Dithered cross-fade between levels instead of popping
+#define LOD_CROSSFADE_SECONDS 0.3f
+extern bool use_lod_crossfade;
+// Contribution culling: entities whose bounding sphere projects to fewer pixels than this across,
+// at the camera's fov and viewport height without the LOD bias, are dropped from the camera view.
+// Shadow views measure the same way from the camera, a caster's shadow seldom covers more than
+// the caster does, with their own usually larger threshold. 0 keeps everything. Static batch
+// chunks are merged geometry and don't take part.
+extern float small_object_cull_pixels;
+extern float shadow_small_object_cull_pixels;
+// Shading LOD: instances at or past shading_lod_far_level, or shading_lod_far_distance from the
+// camera, draw the opaque forward and G-buffer passes with pbr.fs' far tier. It drops parallax and
+// normal maps, shades with a cheaper specular and takes one shadow tap. CPU-listed draws only,
+// GPU-culled and static batch draws pick their LOD on the GPU or per chunk and stay full.
+#define SHADING_LOD_TIERS 2
+extern bool use_shading_lod;
+extern int shading_lod_far_level;
+extern float shading_lod_far_distance;
+// Sorted transparents (no weighted OIT): neighbours in the back-to-front order that share a mesh,
+// and with it the material, draw as one instanced call with their instances in that order, which
+// GL rasterizes in turn. Windows and leaf cards seen in rows collapse without reordering anything.
+extern bool use_sorted_instancing;
+
+// Depth prepass policy. The prepass lets the main pass shade each pixel once, at the cost of
+// submitting the geometry twice, which scenes with little overdraw never earn back. Whatever
+// the mode, the LOD cross-fades of the opaque variants dither in the prepass only and always
+// join it, and deferred shading takes the full prepass. Under a partial prepass the main pass
+// tests GL_LEQUAL and writes depth instead of GL_EQUAL, and SSAO and the Hi-Z only see the
+// depth the prepass laid down. GPU-culled and static batch draws join whole or not at all.
+enum DepthPrepassMode {
+    PREPASS_ALWAYS = 0, // Everything visible
+    PREPASS_NEVER,      // Only what has to dither there
+    PREPASS_HEAVY,      // Parallax and alpha-tested materials, the costliest to overdraw
+    PREPASS_AUTO,       // ALWAYS or NEVER, whichever the timer queries find cheaper
+    PREPASS_MODE_COUNT,
+};
+extern DepthPrepassMode depth_prepass_mode;
+extern const char* const DEPTH_PREPASS_MODE_NAMES[PREPASS_MODE_COUNT];
+// Share of the screen height a CPU-listed entity's bounding sphere must span to join the
+// prepass as an occluder, 0 admits everything
+extern float depth_prepass_min_screen_size;
+// Auto runs one setting and every PREPASS_AUTO_PROBE_INTERVAL frames tries the other for
+// PREPASS_AUTO_PROBE_FRAMES, switching when its prepass plus main pass GPU time comes out
+// PREPASS_AUTO_HYSTERESIS cheaper. Needs timer queries, ALWAYS on WebGL2.
+#define PREPASS_AUTO_PROBE_INTERVAL 300
+#define PREPASS_AUTO_PROBE_FRAMES 8
+#define PREPASS_AUTO_HYSTERESIS 0.1f
+
+// Entities per job_system range in the parallel per-frame loops
+#define LOD_JOB_GRAIN 1024
+#define CULL_JOB_GRAIN 512
+#define RECORD_JOB_GRAIN 256 // Also render list items or shadow candidates, when recording draws
 
 class Renderer {
 private:
-    std::unique_ptr<Shader> pbr_shader;
-    std::unique_ptr<Shader> shadow_shader;
+    std::unique_ptr<ShaderVariants> pbr_variants; // By MATERIAL_FLAG_* mask
+    std::unique_ptr<ShaderVariants> pbr_oit_variants; // The same writing the OIT targets, null if they failed
+    std::unique_ptr<ShaderVariants> pbr_gbuffer_variants; // The same writing the G-buffer, null if it failed
+    std::unique_ptr<ShaderVariants> pbr_skinned_variants; // Skinned from the bone palette (skinning.h), null if it failed
+    std::unique_ptr<ShaderVariants> pbr_terrain_variants; // Terrain chunks off the tile arrays (terrain.h), null if it failed
+    std::unique_ptr<ShaderVariants> pbr_foliage_variants; // Swaying foliage instances (foliage.h), null if it failed
+    std::unique_ptr<Shader> deferred_lighting_shader;      // pbr.fs lighting the G-buffer, null if it failed
+    std::unique_ptr<Shader> lightmap_bake_shader;          // pbr.vs/pbr.fs in lightmap space, null if it failed
+    // Depth passes come in pairs: MASKED materials (and the prepass' LOD fades) take the
+    // alpha-tested program, everything else the position-only one without a discard
+    struct DepthPrograms {
+        std::unique_ptr<Shader> opaque;
+        std::unique_ptr<Shader> masked;
+        // The same reading the vertex pulling pool (vertex_pulling.h), null when it isn't pooling
+        std::unique_ptr<Shader> pulled_opaque;
+        std::unique_ptr<Shader> pulled_masked;
+
+        Shader* get(bool masked_program, bool pulled) const {
+            if (pulled) return masked_program ? pulled_masked.get() : pulled_opaque.get();
+            return masked_program ? masked.get() : opaque.get();
+        }
+    };
+    DepthPrograms shadow_programs;
+    DepthPrograms shadow_cube_programs; // All point light faces at once, null without layered_rendering
+    // The same two skinning from the bone palette, null if they failed
+    DepthPrograms shadow_skinned_programs;
+    DepthPrograms shadow_skinned_cube_programs;
+    // And bending foliage, null if they failed
+    DepthPrograms shadow_foliage_programs;
+    DepthPrograms shadow_foliage_cube_programs;
     std::unique_ptr<Shader> unlit_shader;
-    std::unique_ptr<Shader> depth_prepass_shader;
-    std::vector<Entity*> visibleEntities;  // Cache culled entities
+    DepthPrograms depth_prepass_programs;
+    std::unique_ptr<Shader> impostor_shader;
+    std::unique_ptr<Shader> impostor_foliage_shader; // Cards placed by foliage instances, null if it failed
+    std::unique_ptr<Shader> shadow_moments_shader; // Null if it failed, SHADOW_FILTER_MOMENTS falls back then
+    std::unique_ptr<Shader> motion_shader; // Null if it failed, TAA then takes all motion from the camera
 
-    void bindMaterial(const Material* material);
-    void renderInstancedMesh(Mesh* mesh, const std::vector<glm::mat4>& matrices);
-    void drawMesh(Mesh* mesh, const glm::mat4& model);
+    // Camera-facing quad, instances come from instance_ring
+    GLuint impostorVAO = 0, impostorQuadVBO = 0;
+    // No attributes, fullscreen passes make their triangle from gl_VertexID
+    GLuint fullscreenVAO = 0;
+    // The camera view's entities for this frame, built once by cullEntities(). The prepass and
+    // the main pass both draw from it, so they always agree on what's visible and at which LOD.
+    struct RenderItem {
+        Entity* entity = nullptr;
+        uint32_t index = 0; // Into the EntityManager arrays
+        int lod = 0;        // Entity::current_lod when listed
+        glm::mat4 model{1.0f};
+        float distance = 0.0f; // To the camera, the transparent sort key
+        float radius = 0.0f;   // Of the world bounding sphere
+        uint32_t first_meshlet_cull = 0; // Its clustered meshes' entries in meshletCulls
+        uint32_t meshlet_cull_count = 0;
+    };
+    std::vector<RenderItem> renderList;
+    struct RenderListCounts {
+        int culled = 0;   // Occluded and too small included
+        int occluded = 0;
+        int too_small = 0;
+        int meshlets_tested = 0;
+        int meshlets_culled = 0;
+    } renderListCounts;
+    // The visible meshlet ranges of a listed mesh, culled once in cullEntities() so the prepass
+    // and the main pass draw the same clusters
+    struct MeshletCull {
+        const Mesh* mesh = nullptr;
+        uint32_t first_range = 0; // Into meshletRanges, range_count 0 = every cluster culled
+        uint32_t range_count = 0;
+    };
+    std::vector<MeshletCull> meshletCulls;
+    std::vector<MeshletRange> meshletRanges;
+    void cullItemMeshlets(const Frustum& frustum, bool testHiZ);
+    // Null for a mesh drawn whole, else its entry for the item
+    const MeshletCull* findMeshletCull(const RenderItem& item, const Mesh* mesh) const;
+    std::vector<uint32_t> frustumCandidates; // EntityManager::queryFrustum() scratch
+    enum : uint8_t { CANDIDATE_CULLED, CANDIDATE_TOO_SMALL, CANDIDATE_OCCLUDED, CANDIDATE_VISIBLE };
+    std::vector<uint8_t> candidateVisibility; // Per frustumCandidates entry, filled in parallel by the culling loops
+
+    // Built from the depth prepass, tested by the next frames' culls
+    HiZBuffer hiz;
+    OcclusionQueries occlusion_queries;
+    uint64_t occlusion_layout_version = 0;
+    std::vector<OcclusionQueries::Box> occlusionQueryBoxes; // This frame's frustum-visible entities
+    std::vector<TerrainChunk> terrainChunks;                // This frame's terrain.select()
+
+    // Per-pass submission lists, kept to reuse their buffers between frames
+    DrawList prepassDraws;
+    DrawList shadowDraws;
+    DrawList opaqueDraws;
+    DrawList transparentDraws; // Under weighted OIT only, the sorted path draws one by one
+    DrawList replayDraws;      // --replay-draws, see draw_capture.h
+    // renderViews(): a list per group of overlapping views, and the views' culling scratch
+    std::vector<std::unique_ptr<DrawList>> viewDraws;
+    std::vector<uint32_t> viewCandidates;
+    std::vector<uint8_t> viewMasks;   // Per entity index, a bit per view that found it, zero between calls
+    std::vector<uint32_t> viewTouched; // The entity indices with a mask bit set
+    WeightedBlendedOIT oit;
+    GBuffer gbuffer;
+    ScreenSpaceAO ssao;
+    bool ssaoActive = false; // This frame's SSAO was computed, the main pass reads it
+    // This frame's prepass: the mode auto and deferred shading resolved to, and the occluder size
+    DepthPrepassMode prepassMode = PREPASS_ALWAYS;
+    float prepassMinScreenSize = 0.0f;
+    // It drew every opaque, so the whole main pass can test GL_EQUAL without depth writes
+    bool prepassComplete = true;
+    // Whether a CPU-listed draw was in it. Those keep GL_EQUAL in a partial prepass, the rest
+    // test GL_LEQUAL and write their own depth.
+    bool inDepthPrepass(const RenderItem& item, const Material& material, float fade) const;
+    struct PrepassAuto {
+        bool enabled = true;   // The setting outside probes
+        float cost[2] = {};    // Smoothed prepass + main pass ms, without and with, 0 until measured
+        int frames = PREPASS_AUTO_PROBE_INTERVAL - 30; // Since the last probe, the first comes soon
+        int probe = 0;         // Frames left running the other setting
+        bool ran[GPU_QUERY_FRAMES] = {}; // With a prepass, by gpu_queries frame while it's in flight
+    } prepassAuto;
+    bool depthPrepassSetting(); // Auto's choice for this frame, probes included
+    // This frame's distinct main-pass materials, and per Mesh::draw_id (frame stamp, table id)
+    MaterialTable materialTable;
+    std::vector<std::pair<uint32_t, uint32_t>> meshMaterialCache;
+    uint32_t meshMaterialFrame = 0;
+
+    // LightBlock's lights as indices into lights, and their shadow importance
+    int frameLights[FRAME_UNIFORMS_MAX_LIGHTS] = {};
+    float frameLightImportance[FRAME_UNIFORMS_MAX_LIGHTS] = {};
+    const Light& frameLight(int index) const { return lights[frameLights[index]]; }
+    // Every local light, clustered for the main pass
+    LightClusters light_clusters;
+    std::vector<uint32_t> clusterLights; // Scene indices of the visible local lights
+
+    // This frame's atlas tile per shadow view, planShadowAtlas() scratch
+    ShadowTile shadowTiles[SHADOW_MAX_VIEWS];
+    std::vector<ShadowRequest> shadowRequests;
+
+    // Static casters' depth per shadow view and what it was rendered with (see renderShadowPass)
+    struct ShadowCacheEntry {
+        glm::mat4 light_space{0.0f};
+        ShadowTile tile;
+        uint32_t generation = 0; // shadow_map_generation it was rendered into
+        uint64_t static_version = 0;
+        bool static_batches = false;
+        bool valid = false;
+        int views = 0;   // Rendered in one pass from this entry's view on
+        int casters = 0; // CPU-list entity casters in it, for the stats
+    };
+    ShadowCacheEntry shadowCache[SHADOW_MAX_VIEWS];
+
+    // Time-sliced updates: what each light's views were last rendered with, by light and view
+    // within the light, and which of this frame's views render (see scheduleShadowUpdates)
+    struct ShadowViewHistory {
+        glm::mat4 light_space{0.0f};
+        float receiver_offset = 0.0f; // view_params.x
+        ShadowTile tile;
+        uint32_t generation = 0;
+        int light = -1; // Into lights
+        int light_type = -1;
+        glm::vec3 direction{0.0f}; // Cascades: the light's, and the box' centre and half size
+        glm::vec3 center{0.0f};
+        float box_radius = 0.0f;
+        uint64_t frame = 0;
+        int casters = 0; // Entity casters drawn, the view's cost for the caster budget
+        bool valid = false;
+    };
+    ShadowViewHistory shadowHistory[FRAME_UNIFORMS_MAX_LIGHTS][SHADOW_CUBE_FACES]; // Cube faces outnumber cascades
+    bool shadowViewDue[SHADOW_MAX_VIEWS] = {};
+    uint64_t shadowFrame = 0;
+    // Cascades' slice sphere and the box around it, from computeShadowViews()
+    struct CascadeBounds {
+        glm::vec3 center{0.0f};
+        float radius = 0.0f;
+        float box_radius = 0.0f;
+    };
+    CascadeBounds cascadeBounds[SHADOW_MAX_VIEWS];
+
+    // Static scenery, baked once and culled per chunk
+    StaticBatches static_batches;
+    bool static_batching_active = false;
+    bool staticBatchingActive();
+
+    // Created on first use when use_gpu_culling is set (see gpu_culling.h)
+    std::unique_ptr<GpuCulling> gpu_culling;
+    float frameProjectionScale = 1.0f; // LOD projection scale from selectLODs(), bias included
+    float framePixelScale = 1.0f; // The same without any bias, for the contribution culling
+    float frameShadowProjectionScale = 1.0f; // Same for the shadow views, shadow_lod_bias included
+    glm::vec3 frameCameraPosition{0.0f};
+    bool gpuCullingActive();
+
+    // Per-mesh instance data, fades parallel to matrices (see Entity::forEachLODMesh)
+    struct InstanceBatch {
+        FrameVector<glm::mat4> matrices;
+        FrameVector<float> fades;
+
+        void add(const glm::mat4& matrix, float fade) {
+            matrices.push_back(matrix);
+            fades.push_back(fade);
+        }
+        size_t size() const { return matrices.size(); }
+        bool empty() const { return matrices.empty(); }
+    };
+
+    // Per light proxy mesh, emissive (colour times intensity) parallel to matrices
+    struct LightProxyBatch {
+        FrameVector<glm::mat4> matrices;
+        FrameVector<glm::vec4> emissive;
+    };
+
+    // Which targets the material's pbr.fs variant writes
+    enum PbrOutput { PBR_FORWARD, PBR_OIT, PBR_GBUFFER, PBR_SKINNED, PBR_TERRAIN, PBR_FOLIAGE };
+    void bindMaterial(uint32_t material_id, PbrOutput output = PBR_FORWARD, bool far_shading = false);
+    void initImpostorQuad();
+    using ImpostorBatches = FrameMap<Impostor*, InstanceBatch>;
+    void renderImpostors(const ImpostorBatches& batches);
+    void addStaticImpostors(ImpostorBatches& batches);
+    // count instances, drawn in array order
+    void drawMesh(Mesh* mesh, const glm::mat4* models, GLsizei count);
+    // Every skinned instance, one instanced draw per model mesh. bind() applies a mesh's state
+    // and returns the program, which gets the draw's palette rows.
+    void drawSkinned(const std::function<const Shader&(const Mesh&)>& bind);
+    // renderViews() without putting the frame back, each view lit with frame_lights
+    int drawViews(EntityManager& entity_manager, const RenderView* views, size_t count,
+                  const LightBlock& frame_lights, const std::function<void()>& draw_sky);
+    static int shadowViewCount(const Light& light);
+    float shadowImportance(const Light& light, const Camera& camera, const Frustum& cameraFrustum) const;
+    void computeShadowViews(const Light& light, int first, ShadowBlock& shadow);
+    void planShadowAtlas(ShadowBlock& shadow);
+    // Marks the views that render this frame, the rest get their last matrix back
+    void scheduleShadowUpdates(ShadowBlock& shadow);
+    void recordShadowView(int light, int view, int casters);
+    // Moments of every view's tile, blurred and mipmapped, after the shadow pass
+    void resolveShadowMoments();
     
 public:
     Renderer();
-    ~Renderer() = default;
+    ~Renderer();
 
     // Debug stats
     struct RenderStats {
         int entitiesTotal = 0;
         int entitiesCulled = 0;
+        int entitiesOccluded = 0; // Part of entitiesCulled, rejected by the Hi-Z test or a query
+        int entitiesTooSmall = 0; // Part of entitiesCulled, below small_object_cull_pixels
+        int meshletsTested = 0;   // Clusters of the listed meshes tested by the CPU meshlet cull
+        int meshletsCulled = 0;
         int entitiesRendered = 0;
         int drawCalls = 0;
         int instancedDrawCalls = 0;
         int instancesRendered = 0;
         int materialChanges = 0;
         int trianglesRendered = 0;
+        int lodCounts[LOD_STATS_LEVELS] = {}; // Entities drawn per LOD level, last bucket collects the rest
+        int shadingTierCounts[SHADING_LOD_TIERS] = {}; // Entities drawn per shading tier, near first
+        int impostorsRendered = 0;
+        int submittedDrawCalls = 0; // GL calls the opaque batches took after merging
+        int staticChunksRendered = 0;
+        int staticChunksTotal = 0;
+        int stateChanges = 0;        // GL state calls made this frame up to the end of the main pass
+        int stateChangesSkipped = 0; // Redundant ones the state cache dropped
+        int uniformUploads = 0;        // glUniform calls made by Shader's setters, same window
+        int uniformUploadsSkipped = 0; // Unchanged values they dropped
+        // Entity casters per shadow view on the CPU list, summed over views. Written by
+        // updateFrameUniforms() and renderShadowPass(), which run before reset().
+        int shadowCastersDrawn = 0;
+        int shadowCastersCulled = 0;
+        int shadowViewsCached = 0; // Views whose static casters came from the cache
+        int shadowViewsReused = 0; // Views not rendered this frame, time-sliced
+        int shadowedLights = 0;
+        uint64_t shadowAtlasTexels = 0; // Covered by this frame's tiles
+        int clusterLights = 0;    // Local lights in the clusters
+        int clusterIndices = 0;   // Light references over all clusters, CPU assignment only
+        int clusterMaxLights = 0; // In the busiest cluster, CPU assignment only
         
         void reset() {
             entitiesTotal = 0;
             entitiesCulled = 0;
+            entitiesTooSmall = 0;
+            entitiesOccluded = 0;
+            meshletsTested = 0;
+            meshletsCulled = 0;
             entitiesRendered = 0;
             drawCalls = 0;
             instancedDrawCalls = 0;
             instancesRendered = 0;
             materialChanges = 0;
             trianglesRendered = 0;
+            for (int& count : lodCounts) count = 0;
+            for (int& count : shadingTierCounts) count = 0;
+            impostorsRendered = 0;
+            submittedDrawCalls = 0;
+            staticChunksRendered = 0;
+            staticChunksTotal = 0;
+            stateChanges = 0;
+            stateChangesSkipped = 0;
+            uniformUploads = 0;
+            uniformUploadsSkipped = 0;
         }
     };
     
     RenderStats stats;
     
-    void cullEntities(EntityManager& entity_manager, const glm::mat4& viewProj);
+    void cullEntities(EntityManager& entity_manager, const FrameView& frame);
+    // Picks every entity's LOD for this frame, call once before the shadow pass
+    void selectLODs(EntityManager& entity_manager, const Camera& camera, int viewportHeight, float frameTime);
+    // Nudges lod_bias towards the frame budget when lod_auto_bias is set
+    void updateLODBias(float frameTimeMs);
+    // Uploads this frame's transforms for GPU culling, call after selectLODs() (no-op on the CPU path)
+    void updateGpuCulling(EntityManager& entity_manager);
+    // The world origin moved by delta (world_origin.h), the occlusion history follows
+    void shiftOrigin(const glm::vec3& delta) { hiz.shiftOrigin(delta); }
+    // Depth of this frame's opaques under depth_prepass_mode, plus the Hi-Z and occlusion queries
     void renderDepthPrepass();
-    void renderShadowPass(EntityManager& entity_manager, const Light& light);
-    void setGlobalUniforms(const Camera& camera, int shadowLightIndex);
-    void drawUnlitMesh(Entity* entity, Mesh* mesh, const glm::vec3& color, int intensity);
+    // GPU milliseconds of the prepass and main pass bracket of a frame gpu_queries collected, for
+    // PREPASS_AUTO. Call before renderDepthPrepass().
+    void updateDepthPrepassTiming(uint64_t gpu_frame, double prepass_ms, double main_ms);
+    // What auto runs with outside its probes
+    bool autoDepthPrepass() const { return prepassAuto.enabled; }
+    // Ambient occlusion from the prepass depth when use_ssao is set, call right after it
+    void renderAmbientOcclusion();
+    // The froxel fog (volumetric_fog.h) when the frame uniforms turned it on, after the shadow
+    // pass. The main pass and the sky read the result.
+    void renderVolumetricFog();
+    // Fills and uploads the camera, light and shadow blocks once, before the shadow pass, and
+    // clusters the local lights. Lights get shadow atlas tiles by importance within
+    // shadow_texel_budget.
+    void updateFrameUniforms(const Camera& camera);
+    // Renders every shadow view updateFrameUniforms() planned
+    void renderShadowPass(EntityManager& entity_manager);
+    // Bakes every current light into the lightmap-UV meshes of static entities that no other
+    // entity draws, a layer each, and marks the lights baked. Call after renderShadowPass() so
+    // the lights shadowed this frame bake with their shadows. Returns the meshes baked.
+    int bakeLightmaps(EntityManager& entity_manager);
+    // Back to dynamic lighting everywhere
+    void clearLightmaps(EntityManager& entity_manager);
+    // Every light's proxy entity in view, unlit in its light's colour, one instanced draw per
+    // proxy mesh. Call after the depth prepass, which skips them.
+    void renderLightProxies(EntityManager& entity_manager);
+    // After the scene with TAA on: velocities of the visible entities that moved since last frame
+    void renderMotionVectors(EntityManager& entity_manager);
     void renderScene(EntityManager& entity_manager);
+    // Extra views of the scene (render_view.h), e.g. split-screen, picture-in-picture or a minimap.
+    // Each is culled against the spatial index; views seeing mostly the same entities share one
+    // list, uploaded once at the finest LOD any of them needs and submitted per view. Forward
+    // shaded with the frame's directional lights unshadowed, draw_sky draws VIEW_PASS_SKY. Call
+    // after renderScene(), whose material table the views share; the scene framebuffer, viewport
+    // and frame uniforms are back afterwards. Returns the views drawn, RENDER_VIEW_MAX at most.
+    int renderViews(EntityManager& entity_manager, const RenderView* views, size_t count, const std::function<void()>& draw_sky);
+    // The reflection probe faces due this frame (reflection_probes.h), each drawn as a view like
+    // renderViews() does. Returns the faces drawn.
+    int renderReflectionProbes(EntityManager& entity_manager, float dt, const std::function<void()>& draw_sky);
+};
+
+// The scalar RenderStats counters by name, for the benchmark output and telemetry
+struct RenderStatsCounter {
+    const char* name;
+    double (*read)(const Renderer::RenderStats& stats);
 };
+extern const RenderStatsCounter RENDER_STATS_COUNTERS[];
+extern const size_t RENDER_STATS_COUNTER_COUNT;
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "filesystem.h"
+#include "asset_fetch.h"
+#include "entity_manager.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define SCENE_FILE_VERSION 2
+#define SCENE_FILE_NO_MODEL 0xffffffffu // A template without a material model keeps its meshes' own
+
+class SceneLoader;
+struct MeshRequest;
+
+// A level as data instead of createEntity() calls in main(). The binary .scene file is what the
+// engine reads: a header of section offsets, then the models (paths under res/scene_models), the
+// templates (name, cull mode, static flag, shadow proxy level, optional material model), their LOD
+// levels, the instances of every template back to back as EntityTransforms, the lights, and a
+// string table the rest index into. It is memory-mapped and the instances are handed to
+// createEntities() straight from the mapping, one bulk insert per template, so even large levels
+// take milliseconds once their models are in. Cells and portals follow for portal_visibility.h,
+// with each cell's potentially visible set computed by the compiler.
+// The text format is the authoring side, one statement per line, '#' starts a comment:
+//
+//   model <name> <path>                     A model file, imported once however many use it
+//   template <name> [static] [cull none|back|front] [shadow_lod N] [material <model>]
+//   lod <distance> <model>                  The last template's next level, nearest first
+//   instance px py pz [rx ry rz [sx sy sz]] The last template's next entity, degrees
+//   light point <name> px py pz r g b intensity
+//   light dir <name> dx dy dz r g b intensity
+//   light spot <name> px py pz dx dy dz r g b intensity inner outer
+//   cell <name> minx miny minz maxx maxy maxz      A room or block for portal culling
+//   portal <cell> <cell> x y z x y z x y z x y z  The opening between two, corners in order
+//
+// Text scenes compile to cache/scenes/ on first load and again when the text changes.
+class SceneFile {
+public:
+    // --scene <file> loads a scene file, text or binary, in place of the built-in scene
+    int parseArg(int argc, char** argv, int i);
+    bool requested() const { return !requested_path.empty(); }
+
+    // The binary for a text scene, compiled when stale. Empty on a parse error after printing it.
+    static std::string compile(const std::string& text_path);
+    // Maps and checks a binary scene, false on anything malformed
+    bool open(const std::string& path);
+    void close();
+
+    // Steps that request the models, then create the lights and entities once they are in.
+    // Opens the requested file first, false when that fails.
+    bool addLoadSteps(SceneLoader& loader);
+
+    // Asks the asset loader for every model the open file references, its asset dependencies
+    void requestModels(AssetPriority priority);
+    bool modelsReady() const;
+    float modelsProgress() const;
+    const std::vector<std::shared_ptr<MeshRequest>>& modelRequests() const { return models; }
+    // One createEntities() per template once the models are in, the handles of what was made.
+    // origin is the local origin's place in the world (world_origin.h), the file's positions are
+    // rebased onto it in double precision.
+    std::vector<EntityHandle> createEntitiesFromFile(const glm::dvec3& origin = glm::dvec3(0.0)) const;
+
+    size_t entityCount() const;
+
+private:
+    struct Header;
+    struct Model;
+    struct Template;
+    struct Lod;
+    struct Light;
+    struct Cell;
+    struct CellPortal;
+
+    const char* string(uint32_t offset) const;
+    void createLights() const;
+    // Hands the cells, portals and sets to portal_visibility, rebased like the entities
+    void loadVisibility(const glm::dvec3& origin) const;
+
+    std::string requested_path;
+    MappedFile file;
+    const Header* header = nullptr;
+    std::vector<std::shared_ptr<MeshRequest>> models; // By model index, once requested
+};
+
+extern SceneFile scene_file;
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#define SCENE_LOAD_BUDGET_MS 8.0 // Per frame, shared by mesh uploads and load steps
+
+// Startup spread over frames, so the window keeps responding while the scene comes in. Steps run
+// in the order they were added, each called once per frame until it returns true; a step waiting
+// on downloads or imports returns false and the rest wait behind it. update() uploads staged
+// meshes, then runs steps until budget_ms is spent, always trying at least one. progress() counts
+// finished steps by weight, plus the waiting step's fraction when it has one. GL thread only.
+class SceneLoader {
+public:
+    void add(const std::string& name, float weight, std::function<bool()> step, std::function<float()> fraction = nullptr);
+
+    // Once per frame while !done()
+    void update(double budget_ms);
+    // Runs every step now, for runs that need the whole scene before their first frame
+    void finish();
+
+    bool done() const { return next >= steps.size(); }
+    float progress() const;
+    // The step being waited on, empty once done
+    const std::string& current() const;
+
+private:
+    struct Step {
+        std::string name;
+        float weight;
+        std::function<bool()> run;
+        std::function<float()> fraction;
+    };
+
+    std::vector<Step> steps;
+    size_t next = 0;
+};
+
+extern SceneLoader scene_loader;
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "entity_manager.h"
+
+struct Frustum;
+struct SceneMeshBvh; // scene_query.cpp
+
+#define SCENE_QUERY_LEAF_TRIANGLES 4 // Per mesh BVH leaf
+#define SCENE_QUERY_GRAIN 16         // Queries per parallelFor range in the batched forms
+
+enum SceneQueryFlags : uint8_t {
+    SCENE_QUERY_DYNAMIC = 1,   // Entities that can move
+    SCENE_QUERY_STATIC = 2,    // Entities drawn from static chunks, see EntityManager::setStatic()
+    SCENE_QUERY_TRIANGLES = 4, // Narrow to the LOD0 triangles of meshes that kept a CPU copy
+    SCENE_QUERY_DEFAULT = SCENE_QUERY_DYNAMIC | SCENE_QUERY_STATIC | SCENE_QUERY_TRIANGLES,
+};
+
+struct SceneRay {
+    glm::vec3 origin{0.0f};
+    glm::vec3 direction{0.0f, 0.0f, -1.0f}; // Normalised by the queries
+    float max_distance = FLT_MAX;
+};
+
+struct SceneHit {
+    EntityHandle entity; // Null on a miss
+    float distance = 0.0f;
+    glm::vec3 position{0.0f};
+    glm::vec3 normal{0.0f}; // World space, facing the ray
+    int mesh = -1;          // Into the entity's LOD0 meshes, -1 when its bounds were hit
+    int triangle = -1;      // In the mesh's index order, -1 when the mesh's bounds were hit
+};
+
+// Ray casts and overlap queries against the entities, for picking, editor tools and gameplay.
+// Candidates come from EntityManager's AABB trees, the same ones culling walks, then the
+// entity's world AABB decides. With SCENE_QUERY_TRIANGLES, entities whose LOD0 meshes kept
+// their positions (mesh_residency, see mesh_loader.h) are narrowed further to their triangles,
+// through a BVH per mesh built the first time a query reaches it and cached after. Meshes
+// without a CPU copy are answered by the bounds alone.
+// Frustum tests are conservative at every level, like culling's: only something wholly behind
+// one plane is outside.
+// Any thread may query, several at once, while nothing modifies the entity manager, e.g. from
+// jobs between the GL thread's updateTransforms() and its next writes. The batched forms spread
+// their queries across the job system.
+class SceneQuery {
+public:
+    SceneQuery() = default;
+    SceneQuery(const SceneQuery&) = delete;
+    SceneQuery& operator=(const SceneQuery&) = delete;
+
+    // The nearest hit along the ray, false with a null hit.entity if there's none
+    bool raycast(const SceneRay& ray, SceneHit& hit, uint8_t flags = SCENE_QUERY_DEFAULT) const;
+    void raycast(const SceneRay* rays, SceneHit* hits, size_t count, uint8_t flags = SCENE_QUERY_DEFAULT) const;
+
+    // Every entity touching the shape, in index order, returns the count
+    size_t overlapSphere(const glm::vec3& center, float radius, std::vector<EntityHandle>& out, uint8_t flags = SCENE_QUERY_DEFAULT) const;
+    size_t overlapBox(const glm::vec3& bmin, const glm::vec3& bmax, std::vector<EntityHandle>& out, uint8_t flags = SCENE_QUERY_DEFAULT) const;
+    size_t overlapFrustum(const Frustum& frustum, std::vector<EntityHandle>& out, uint8_t flags = SCENE_QUERY_DEFAULT) const;
+    // spheres are xyz centre, w radius, out[k] gets the entities touching spheres[k]
+    void overlapSpheres(const glm::vec4* spheres, std::vector<EntityHandle>* out, size_t count, uint8_t flags = SCENE_QUERY_DEFAULT) const;
+
+    // The ray through a point of the viewport, ndc in [-1, 1] with y up
+    static SceneRay screenRay(const glm::mat4& view, const glm::mat4& projection, const glm::vec2& ndc);
+
+    // --pick-triangles keeps mesh positions on the CPU so queries reach the triangles, returns
+    // the arguments taken, 0 if it isn't one
+    int parseArg(int argc, char** argv, int i);
+
+    size_t cachedMeshes() const;
+    // Drops every mesh BVH, call when the meshes are released
+    void clearCache();
+
+private:
+    struct CachedBvh {
+        std::weak_ptr<Mesh> mesh;
+        const void* data = nullptr; // The mesh's CPU copy it was built from, a reload replaces it
+        std::shared_ptr<const SceneMeshBvh> bvh; // Null when the mesh kept no CPU copy
+    };
+
+    std::shared_ptr<const SceneMeshBvh> meshBvh(const std::shared_ptr<Mesh>& mesh) const;
+    bool rayEntity(size_t index, const glm::vec3& origin, const glm::vec3& direction, float max_distance, bool triangles, SceneHit& hit) const;
+    // The entity touches the world space box, sphere or frustum, whichever is given
+    bool overlapEntity(size_t index, const glm::vec3& bmin, const glm::vec3& bmax, const glm::vec4* sphere, const Frustum* frustum, bool triangles) const;
+    bool wanted(size_t index, uint8_t flags) const;
+
+    mutable std::mutex cache_mutex;
+    mutable std::unordered_map<const Mesh*, CachedBvh> cache;
+    mutable size_t pruned_size = 0; // Cache size after the last sweep of expired meshes
+};
+
+extern SceneQuery scene_query;
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include "shader.h"
+
+// The scene renders offscreen into linear HDR colour at a scaled internal resolution, optionally
+// multisampled, and one fused post pass tonemaps, grades and upscales it into the window. Scene
+// passes return to scene_framebuffer instead of the default framebuffer, and the targets sized
+// from GL_VIEWPORT (SSAO, Hi-Z, G-buffer, OIT) follow the scaled size like they follow a window
+// resize. The window itself has no depth use and no multisampling.
+extern GLuint scene_framebuffer; // 0 while the scene renders straight to the window
+
+// Scales are per axis. With use_dynamic_resolution, resolution_scale follows the measured GPU
+// time against dynamic_resolution_budget_ms between the min and max, otherwise it's used as set.
+extern bool use_dynamic_resolution;
+extern float dynamic_resolution_budget_ms;
+extern float resolution_scale;
+extern float resolution_scale_min;
+extern float resolution_scale_max;
+#define RESOLUTION_SCALE_LOWEST 0.25f
+#define RESOLUTION_SCALE_STEP 0.05f // Scales snap to multiples, so the targets aren't remade every frame
+
+// Samples per pixel of the scene target, 0 or 1 for none, switchable at runtime. Clamped to
+// GL_MAX_SAMPLES, and none while TAA is active, which anti-aliases instead. Only the depth
+// prepass and the forward passes draw multisampled, into the one shared target: SSAO, Hi-Z, the
+// G-buffer and OIT work single-sampled from a depth resolve, and composite back into it.
+extern int scene_msaa_samples;
+#define SCENE_MAX_MSAA_SAMPLES 8
+
+// The post pass, in this order: exposure, tonemap, colour filter, saturation, contrast, gamma, dither
+enum Tonemapper {
+    TONEMAP_REINHARD = 0, // Per channel, the curve the forward pass applied before
+    TONEMAP_ACES,
+    TONEMAP_COUNT,
+};
+extern Tonemapper post_tonemapper;
+extern const char* const TONEMAPPER_NAMES[TONEMAP_COUNT];
+extern float post_exposure;   // Stops
+extern float post_contrast;   // 1 leaves it
+extern float post_saturation; // 1 leaves it, 0 is greyscale
+extern glm::vec3 post_color_filter;
+extern bool post_dithering;
+
+// Formats of the colour targets, by preset and by what the driver can render to. Compact keeps
+// HDR colour (scene target, TAA history) in R11G11B10F, half of RGBA16F's bandwidth, nothing
+// reading its alpha back; Full keeps RGBA16F there and gives the G-buffer normals RGBA16F instead
+// of RGB10A2. Albedo and material are RGBA8 and the OIT accumulation RGBA16F (its alpha sums the
+// weights) in both. A format the driver can't render to falls back to the next wider one, and
+// WebGL2 without EXT_color_buffer_float to RGBA8 colour. Switchable at runtime, the targets follow.
+enum RenderTargetQuality {
+    RENDER_TARGETS_COMPACT = 0,
+    RENDER_TARGETS_FULL,
+    RENDER_TARGETS_QUALITY_COUNT,
+};
+extern RenderTargetQuality render_target_quality;
+extern const char* const RENDER_TARGET_QUALITY_NAMES[RENDER_TARGETS_QUALITY_COUNT];
+
+struct RenderTargetFormats {
+    GLenum hdr_color = GL_RGBA16F;
+    GLenum gbuffer_albedo = GL_RGBA8;
+    GLenum gbuffer_normal = GL_RGB10_A2;
+    GLenum gbuffer_material = GL_RGBA8;
+};
+// For the current preset, probing each format once
+RenderTargetFormats renderTargetFormats();
+// What glTexImage2D takes with a colour format above
+void renderTargetTransfer(GLenum internal_format, GLenum& format, GLenum& type);
+const char* renderTargetFormatName(GLenum internal_format);
+
+// PID step towards the budget from the last measured frame, in milliseconds of GPU time. Needs
+// timer queries, see gl_extensions.timer_query.
+void updateDynamicResolution(double gpu_time_ms);
+
+// HDR colour in renderTargetFormats().hdr_color and depth-stencil in the
+// format other passes' depth copies expect. Without MSAA both are textures, the depth one sampled
+// as it is by the passes that only read it. With MSAA both are multisampled renderbuffers, the
+// colour resolves into the texture the post pass reads and the depth into one single-sampled
+// texture the readers share. GL thread only.
+class SceneTarget {
+public:
+    SceneTarget() = default;
+    ~SceneTarget();
+
+    SceneTarget(const SceneTarget&) = delete;
+    SceneTarget& operator=(const SceneTarget&) = delete;
+
+    // Before anything draws this frame. Binds the target and sets the viewport to its size, or
+    // the default framebuffer at full size when the target can't be made.
+    void begin(int window_width, int window_height);
+    // After the last scene pass, resolves and runs the post pass into the default framebuffer,
+    // or a window-sized output framebuffer, which it leaves bound at window size. A window-sized
+    // source (the TAA output) replaces the scene colour.
+    void present(GLuint source = 0, GLuint output = 0);
+
+    // This frame's render size
+    int width() const { return render_width; }
+    int height() const { return render_height; }
+    int samples() const { return target_samples; }
+    // Where the depth copies read from. With MSAA the first call resolves the depth once into a
+    // single-sampled copy the rest of the frame's copies share, until depthWritten().
+    GLuint depthFramebuffer();
+    // The depth as a texture for passes that sample it while drawing into their own targets
+    // (SSAO, Hi-Z, TAA), never while the scene framebuffer is bound: the target's own depth, the
+    // MSAA resolve above, or without a target one copy of the window's depth. Passes that read it
+    // with the scene framebuffer bound (G-buffer lighting, OIT, soft particles) copy it instead.
+    GLuint depthTexture();
+    // Draws after this change the depth, the next depthFramebuffer() resolves again
+    void depthWritten() { depth_resolved = false; }
+    // The single-sampled colour, only while the target has no MSAA
+    GLuint colorTexture() const { return resolve_fbo == 0 ? color_texture : 0; }
+    bool hdr() const { return color_format != GL_RGBA8; }
+    GLenum colorFormat() const { return color_format; }
+
+private:
+    bool init(int width, int height, int samples);
+    void release();
+
+    std::unique_ptr<Shader> post_shader;
+    GLuint vao = 0;
+    GLuint fbo = 0;
+    GLuint resolve_fbo = 0; // Only with MSAA
+    GLuint color_texture = 0; // What the post pass reads
+    GLuint color_renderbuffer = 0; // Only with MSAA
+    GLuint depth_renderbuffer = 0; // Only with MSAA
+    GLuint depth_texture = 0; // Only without MSAA
+    GLuint resolved_depth_texture = 0; // Only with MSAA, on resolve_fbo
+    GLuint window_depth_fbo = 0, window_depth_texture = 0; // Only without a target, made on first use
+    int window_depth_width = 0, window_depth_height = 0;
+    GLenum color_format = 0;
+    int target_width = 0, target_height = 0, target_samples = 0;
+    int render_width = 0, render_height = 0;
+    int window_width = 0, window_height = 0;
+    bool depth_resolved = false;
+    bool failed = false;
+};
+
+extern SceneTarget scene_target;
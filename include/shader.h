@@ -2,140 +2,284 @@
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "program_cache.h"
 #include <glm/gtc/type_ptr.hpp>
+#include <initializer_list>
 #include <string>
+#include <stdexcept>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+// A uniform's name with its FNV-1a hash. Setters take these, so a literal name costs a short
+// hash at most and never a std::string; a constant hashes at compile time:
+//   static constexpr UniformId MATERIAL_INDEX("materialIndex");
+// The name is only read on the program's first lookup, to ask the driver for the location.
+struct UniformId {
+    const char* name;
+    uint64_t hash;
+
+    constexpr UniformId(const char* name) : name(name), hash(hashName(name)) {}
+    // Built names, the string must outlive the call
+    UniformId(const std::string& name) : UniformId(name.c_str()) {}
+
+    static constexpr uint64_t hashName(const char* name) {
+        uint64_t hash = 1469598103934665603ull;
+        for (; *name; ++name) hash = (hash ^ (uint8_t)*name) * 1099511628211ull;
+        return hash;
+    }
+};
+
+// Locations past this are uploaded without a shadow copy, drivers hand out small ones
+#define SHADER_MAX_SHADOWED_LOCATION 1024
 
 class Shader {
 private:
     GLuint program_id = 0;
-    mutable std::unordered_map<std::string, GLint> uniform_cache;
+    // Keyed by UniformId::hash, a program's few dozen names don't collide in 64 bits
+    mutable std::unordered_map<uint64_t, GLint> uniform_cache;
+    // Last value the setters uploaded, by location (empty = never set)
+    mutable std::vector<std::vector<unsigned char>> uniform_values;
+    // Until finishLink(): the stages, kept for their compile logs, and the key to cache the binary under
+    std::vector<GLuint> stages;
+    uint64_t cache_key = 0;
+    bool link_checked = true;
     
 public:
+    // For the constructor that leaves compiling and linking running, see linkPending()
+    struct Deferred {};
+
     Shader(const std::string& vertex_source, const std::string& fragment_source) {
-        program_id = createShaderProgram(vertex_source, fragment_source);
-        if (program_id == 0) {
+        submit({{GL_VERTEX_SHADER, &vertex_source}, {GL_GEOMETRY_SHADER, nullptr}, {GL_FRAGMENT_SHADER, &fragment_source}});
+        if (!finishLink()) {
             throw std::runtime_error("Failed to create shader program");
         }
     }
     
+    // With a geometry stage, needs gl_extensions.layered_rendering
+    Shader(const std::string& vertex_source, const std::string& geometry_source, const std::string& fragment_source) {
+        submit({{GL_VERTEX_SHADER, &vertex_source}, {GL_GEOMETRY_SHADER, &geometry_source}, {GL_FRAGMENT_SHADER, &fragment_source}});
+        if (!finishLink()) {
+            throw std::runtime_error("Failed to create shader program");
+        }
+    }
+
+    // Hands both stages to the driver and returns without asking how they went, so several
+    // programs can compile at once. Nothing else may be called before finishLink() says it linked.
+    Shader(const std::string& vertex_source, const std::string& fragment_source, Deferred) {
+        submit({{GL_VERTEX_SHADER, &vertex_source}, {GL_GEOMETRY_SHADER, nullptr}, {GL_FRAGMENT_SHADER, &fragment_source}});
+    }
+
+    // Transform feedback program capturing the varyings, interleaved in this order. WebGL2 won't
+    // link without a fragment stage, though rasterizer discard never runs it.
+    Shader(const std::string& vertex_source, const std::string& fragment_source, const std::vector<const char*>& feedback_varyings) {
+        submit({{GL_VERTEX_SHADER, &vertex_source}, {GL_GEOMETRY_SHADER, nullptr}, {GL_FRAGMENT_SHADER, &fragment_source}},
+               &feedback_varyings);
+        if (!finishLink()) {
+            throw std::runtime_error("Failed to create transform feedback program");
+        }
+    }
+
+    // Compute program, needs gl_extensions.compute_shader
+    explicit Shader(const std::string& compute_source) {
+        submit({{GL_COMPUTE_SHADER, &compute_source}});
+        if (!finishLink()) {
+            throw std::runtime_error("Failed to create compute program");
+        }
+    }
+
     ~Shader() {
+        for (GLuint stage : stages) glDeleteShader(stage);
         if (program_id != 0) {
             glDeleteProgram(program_id);
         }
     }
+
+    // The driver is still compiling or linking. Only KHR_parallel_shader_compile can tell without
+    // blocking; without it this is always false and finishLink() waits.
+    bool linkPending() const {
+        if (link_checked || !gl_extensions.parallel_shader_compile) return false;
+        GLint done = GL_FALSE;
+        glGetProgramiv(program_id, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_FALSE;
+    }
+
+    // Waits for the link and checks it, false when it failed (the program is gone then)
+    bool finishLink() {
+        if (link_checked) return program_id != 0;
+        link_checked = true;
+
+        GLint success;
+        glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+        if (!success) {
+            // A stage that didn't compile explains the failed link better than the link log
+            for (GLuint stage : stages) logCompileErrors(stage);
+            GLchar info_log[512];
+            glGetProgramInfoLog(program_id, 512, nullptr, info_log);
+            printf("Shader program linking failed: %s\n", info_log);
+            glDeleteProgram(program_id);
+            program_id = 0;
+        } else {
+            program_cache.store(cache_key, program_id);
+        }
+        for (GLuint stage : stages) glDeleteShader(stage);
+        stages.clear();
+        return program_id != 0;
+    }
     
     Shader(const Shader&) = delete;
     Shader& operator=(const Shader&) = delete;
     
     void use() const {
-        glUseProgram(program_id);
+        gl_state.useProgram(program_id);
     }
     
     GLuint getProgram() const { return program_id; }
     
-    GLint getUniformLocation(const std::string& name) const {
-        if (auto it = uniform_cache.find(name); it != uniform_cache.end()) {
+    // Resolved on first use and cached, callers may also keep the location themselves
+    GLint getUniformLocation(UniformId id) const {
+        if (auto it = uniform_cache.find(id.hash); it != uniform_cache.end()) {
             return it->second;
         }
         
-        GLint location = glGetUniformLocation(program_id, name.c_str());
-        uniform_cache[name] = location;
+        GLint location = glGetUniformLocation(program_id, id.name);
+        uniform_cache[id.hash] = location;
         
         if (location == -1) {
-            printf("Warning: Uniform '%s' not found in shader\n", name.c_str());
+            printf("Warning: Uniform '%s' not found in shader\n", id.name);
         }
         
         return location;
     }
     
-    void setMat4(const std::string& name, const glm::mat4& value) const {
-        glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+    void setMat4(UniformId name, const glm::mat4& value) const {
+        GLint location = getUniformLocation(name);
+        if (uniformChanged(location, &value, sizeof(value))) glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
     }
     
-    void setMat3(const std::string& name, const glm::mat3& value) const {
-        glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+    void setMat3(UniformId name, const glm::mat3& value) const {
+        GLint location = getUniformLocation(name);
+        if (uniformChanged(location, &value, sizeof(value))) glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
     }
     
-    void setVec3(const std::string& name, const glm::vec3& value) const {
-        glUniform3fv(getUniformLocation(name), 1, glm::value_ptr(value));
+    void setVec2(UniformId name, const glm::vec2& value) const {
+        GLint location = getUniformLocation(name);
+        if (uniformChanged(location, &value, sizeof(value))) glUniform2fv(location, 1, glm::value_ptr(value));
+    }
+
+    void setVec3(UniformId name, const glm::vec3& value) const {
+        GLint location = getUniformLocation(name);
+        if (uniformChanged(location, &value, sizeof(value))) glUniform3fv(location, 1, glm::value_ptr(value));
     }
     
-    void setInt(const std::string& name, int value) const {
-        glUniform1i(getUniformLocation(name), value);
+    void setVec4Array(UniformId name, const glm::vec4* values, GLsizei count) const {
+        GLint location = getUniformLocation(name);
+        if (uniformChanged(location, values, sizeof(glm::vec4) * count)) glUniform4fv(location, count, reinterpret_cast<const GLfloat*>(values));
+    }
+
+    void setInt(UniformId name, int value) const {
+        GLint location = getUniformLocation(name);
+        if (uniformChanged(location, &value, sizeof(value))) glUniform1i(location, value);
     }
     
-    void setFloat(const std::string& name, float value) const {
-        glUniform1f(getUniformLocation(name), value);
+    void setFloat(UniformId name, float value) const {
+        GLint location = getUniformLocation(name);
+        if (uniformChanged(location, &value, sizeof(value))) glUniform1f(location, value);
     }
     
-    void setVec3Array(const std::string& name, const std::vector<glm::vec3>& values) const {
-        glUniform3fv(getUniformLocation(name), static_cast<GLsizei>(values.size()),
-                     reinterpret_cast<const GLfloat*>(values.data()));
+    void setVec3Array(UniformId name, const glm::vec3* values, GLsizei count) const {
+        GLint location = getUniformLocation(name);
+        if (uniformChanged(location, values, sizeof(glm::vec3) * count)) glUniform3fv(location, count, reinterpret_cast<const GLfloat*>(values));
+    }
+
+    void setVec3Array(UniformId name, const std::vector<glm::vec3>& values) const {
+        setVec3Array(name, values.data(), static_cast<GLsizei>(values.size()));
     }
     
-    void setFloatArray(const std::string& name, const std::vector<float>& values) const {
-        glUniform1fv(getUniformLocation(name), static_cast<GLsizei>(values.size()), values.data());
+    void setFloatArray(UniformId name, const float* values, GLsizei count) const {
+        GLint location = getUniformLocation(name);
+        if (uniformChanged(location, values, sizeof(float) * count)) glUniform1fv(location, count, values);
+    }
+
+    void setFloatArray(UniformId name, const std::vector<float>& values) const {
+        setFloatArray(name, values.data(), static_cast<GLsizei>(values.size()));
+    }
+
+    // Blocks the program doesn't declare (or the compiler dropped) are skipped
+    void bindUniformBlock(const std::string& name, GLuint binding) const {
+        GLuint index = glGetUniformBlockIndex(program_id, name.c_str());
+        if (index != GL_INVALID_INDEX) glUniformBlockBinding(program_id, index, binding);
     }
 
 private:
-    GLuint createShaderProgram(const std::string& vertex_source, const std::string& fragment_source) {
-        GLuint vertex_shader = compileShader(GL_VERTEX_SHADER, vertex_source);
-        if (vertex_shader == 0) return 0;
-        
-        GLuint fragment_shader = compileShader(GL_FRAGMENT_SHADER, fragment_source);
-        if (fragment_shader == 0) {
-            glDeleteShader(vertex_shader);
-            return 0;
+    // Whether value differs bit for bit from what the setters last uploaded to location, which then
+    // remembers it. Uniforms are program state, so an unchanged one needs no call at all, and
+    // the driver validates every glUniform it gets. The program must be current, as for any setter.
+    bool uniformChanged(GLint location, const void* value, size_t size) const {
+        if (location < 0) return false; // Not in the program, glUniform would ignore it anyway
+        if (location >= SHADER_MAX_SHADOWED_LOCATION) {
+            gl_state.countUniform(true);
+            return true;
         }
-        
-        GLuint program = linkShaderProgram(vertex_shader, fragment_shader);
-        
-        glDeleteShader(vertex_shader);
-        glDeleteShader(fragment_shader);
-        
-        return program;
+        if ((size_t)location >= uniform_values.size()) uniform_values.resize(location + 1);
+        std::vector<unsigned char>& shadow = uniform_values[location];
+        if (shadow.size() == size && memcmp(shadow.data(), value, size) == 0) {
+            gl_state.countUniform(false);
+            return false;
+        }
+        shadow.assign((const unsigned char*)value, (const unsigned char*)value + size);
+        gl_state.countUniform(true);
+        return true;
     }
-    
-    GLuint compileShader(GLenum shader_type, const std::string& source) {
-        GLuint shader = glCreateShader(shader_type);
-        const char* source_cstr = source.c_str();
-        glShaderSource(shader, 1, &source_cstr, nullptr);
-        glCompileShader(shader);
-        
-        GLint success;
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            GLchar info_log[512];
-            glGetShaderInfoLog(shader, 512, nullptr, info_log);
-            printf("Shader compilation failed (%s): %s\n",
-                   (shader_type == GL_VERTEX_SHADER) ? "VERTEX" : "FRAGMENT",
-                   info_log);
-            glDeleteShader(shader);
-            return 0;
+
+    // Compiles and links without a single status query, those wait for the driver. Absent stages
+    // are nullptr, they still count towards the cache key.
+    void submit(std::initializer_list<std::pair<GLenum, const std::string*>> sources,
+                const std::vector<const char*>* feedback_varyings = nullptr) {
+        std::vector<const std::string*> key_sources;
+        for (const auto& source : sources) key_sources.push_back(source.second);
+
+        // Unchanged sources on the same driver link from the binary saved last time
+        cache_key = program_cache.key(key_sources);
+        program_id = program_cache.load(cache_key);
+        if (program_id != 0) return;
+
+        program_id = glCreateProgram();
+        for (const auto& [type, source] : sources) {
+            if (!source) continue;
+            GLuint stage = glCreateShader(type);
+            const char* source_cstr = source->c_str();
+            glShaderSource(stage, 1, &source_cstr, nullptr);
+            glCompileShader(stage);
+            glAttachShader(program_id, stage);
+            stages.push_back(stage);
         }
-        
-        return shader;
+        if (feedback_varyings) {
+            glTransformFeedbackVaryings(program_id, (GLsizei)feedback_varyings->size(), feedback_varyings->data(),
+                                        GL_INTERLEAVED_ATTRIBS);
+        }
+        program_cache.prepare(program_id);
+        glLinkProgram(program_id);
+        link_checked = false;
     }
     
-    GLuint linkShaderProgram(GLuint vertex_shader, GLuint fragment_shader) {
-        GLuint program = glCreateProgram();
-        glAttachShader(program, vertex_shader);
-        glAttachShader(program, fragment_shader);
-        glLinkProgram(program);
-        
+    static void logCompileErrors(GLuint shader) {
         GLint success;
-        glGetProgramiv(program, GL_LINK_STATUS, &success);
-        if (!success) {
-            GLchar info_log[512];
-            glGetProgramInfoLog(program, 512, nullptr, info_log);
-            printf("Shader program linking failed: %s\n", info_log);
-            glDeleteProgram(program);
-            return 0;
-        }
-        
-        return program;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (success) return;
+
+        GLint shader_type = 0;
+        glGetShaderiv(shader, GL_SHADER_TYPE, &shader_type);
+        GLchar info_log[512];
+        glGetShaderInfoLog(shader, 512, nullptr, info_log);
+        printf("Shader compilation failed (%s): %s\n",
+               (shader_type == GL_VERTEX_SHADER) ? "VERTEX" : (shader_type == GL_COMPUTE_SHADER) ? "COMPUTE" :
+               (shader_type == GL_GEOMETRY_SHADER) ? "GEOMETRY" : "FRAGMENT",
+               info_log);
     }
 };
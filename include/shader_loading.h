@@ -1,5 +1,16 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
-std::string loadShaderFile(const std::string& path);
\ No newline at end of file
+#define SHADER_MAX_INCLUDE_DEPTH 8
+
+// Replaces the file's #version with the platform's, desktop_version overrides the GL 3.3 default.
+// #include "file" lines are resolved relative to the including file, each file spliced in once;
+// shared declarations live in res/shaders/include/. The files included are appended to
+// dependencies when given, for watching. The program cache keys on the result, includes and all.
+std::string loadShaderFile(const std::string& path, const char* desktop_version = "#version 330 core\n",
+                           std::vector<std::string>* dependencies = nullptr);
+
+// Inserts preprocessor lines ("#define NAME\n" ...) after the #version of a loaded source
+std::string addShaderDefines(const std::string& source, const std::string& defines);
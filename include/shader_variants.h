@@ -0,0 +1,59 @@
+#pragma once
+
+#include "shader.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Permutations of one vertex/fragment pair keyed by a feature bitmask. Bit i adds
+// "#define <feature_names[i]>" to both stages. The first get() of a mask starts its compile
+// without waiting, so everything a frame asks for compiles side by side; until poll() finds it
+// linked, get() hands out the compiled variant closest below the mask, or the all-features one.
+// setup then runs once per program (samplers, uniform blocks). The sources are watched by
+// asset_watcher and reload when edited. GL thread only.
+class ShaderVariants {
+public:
+    using Setup = std::function<void(Shader& shader, uint32_t features)>;
+
+    // Loads both sources and compiles the all-features variant, throws like Shader if it fails.
+    // defines go into every variant, e.g. a second set of the same shader for another pass.
+    ShaderVariants(const std::string& vertex_path, const std::string& fragment_path,
+                   std::vector<std::string> feature_names, Setup setup, std::string defines = {});
+    ~ShaderVariants();
+
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    // A variant that fails to compile falls back to the all-features one
+    Shader& get(uint32_t features);
+    // Once a frame: takes in the variants that finished. Without KHR_parallel_shader_compile it
+    // can't tell which have, and waits for all of last frame's requests at once.
+    void poll();
+
+    // Reads both sources again and recompiles every compiled mask in the background, the old
+    // programs draw until poll() swaps the new ones in. A mask whose new source fails keeps its
+    // old program, so a typo mid-edit doesn't take the shader down.
+    void reload();
+
+    uint32_t allFeatures() const { return (1u << feature_names.size()) - 1; }
+    size_t compiledCount() const { return variants.size(); }
+    size_t pendingCount() const { return pending.size(); }
+
+private:
+    std::string watchOwner() const;
+    std::string variantDefines(uint32_t features) const;
+    std::unique_ptr<Shader> compile(uint32_t features) const;
+    Shader& fallback(uint32_t features);
+
+    std::string vertex_path;
+    std::string fragment_path;
+    std::string vertex_source;
+    std::string fragment_source;
+    std::vector<std::string> feature_names;
+    Setup setup;
+    std::string defines;
+    std::unordered_map<uint32_t, std::unique_ptr<Shader>> variants; // Null for masks that failed
+    std::unordered_map<uint32_t, std::unique_ptr<Shader>> pending;  // Still compiling
+};
@@ -1,12 +1,178 @@
 #pragma once
 #include <glad/glad.h>
 #include <stdio.h>
+#include <cstdint>
+#include <string>
+#include <vector>
 
+// The shadow map is an atlas: SHADOW_LAYERS square pages, each shadow view gets a square tile.
+// Directional lights split the view into cascades, a view each. Point lights render a view per
+// cube face (+X, -X, +Y, -Y, +Z, -Z), spot lights a single one.
+#define SHADOW_CASCADES 4
+#define SHADOW_CUBE_FACES 6
+#define SHADOW_LAYERS 6
+#define SHADOW_MAX_VIEWS 16        // Views of every shadowed light together, ShadowBlock's size
+#define SHADOW_MIN_TILE 128        // Tiles don't shrink below this to meet the budget
+#define SHADOW_DISTANCE 200.0f     // Where the last cascade ends
+#define SHADOW_SPLIT_LAMBDA 0.75f  // Practical split scheme, 0 = uniform, 1 = logarithmic
+#define SHADOW_CASTER_DEPTH 100.0f // Casters this far towards the light from a cascade still land in it
+
+// Per atlas page, square and a power of two so tiles pack without gaps. Follow
+// shadow_settings.resolution once applied.
 extern unsigned int SHADOW_WIDTH;
 extern unsigned int SHADOW_HEIGHT;
+// Texels the frame's tiles may cover together, the atlas' capacity at most
+extern uint64_t shadow_texel_budget;
+// Local lights shadowed per frame, the most important ones. The rest shade unshadowed, or with
+// their baked shadows on lightmapped surfaces. Directional lights are always shadowed.
+extern int shadow_max_local_lights;
+#define SHADOW_BAKED_IMPORTANCE 0.5f // Baked lights' importance scale, static receivers have their shadows already
 extern GLuint shadowMapFBO;
-extern GLuint shadowMapTexture;
+extern GLuint shadowMapTexture; // GL_TEXTURE_2D_ARRAY, SHADOW_LAYERS layers
+// Bumped whenever the map, cache or moments textures are recreated, their contents are gone then
+extern uint32_t shadow_map_generation;
+
+enum ShadowDepthFormat {
+    SHADOW_DEPTH_16 = 0,
+    SHADOW_DEPTH_24 = 1,
+    SHADOW_DEPTH_32F = 2,
+};
+
+// Taps pbr.fs takes per shadowed fragment, ShadowBlock::filter_quality. The PCF filters take
+// fewer the more shadow texels a screen pixel spans, down to one where a pixel covers the kernel.
+enum ShadowFilterQuality {
+    SHADOW_FILTER_HARD = 0, // One hardware-compared tap
+    SHADOW_FILTER_PCF4 = 1, // Up to four taps
+    SHADOW_FILTER_SOFT = 2, // Up to ShadowSettings::max_filter_taps, past four only where the first four disagree
+    SHADOW_FILTER_MOMENTS = 3, // One trilinear lookup in blurred EVSM moments, see shadowMomentsTexture
+};
+#define SHADOW_FILTER_MAX_TAPS 16 // pbr.fs' Poisson disk
+
+enum ShadowPreset {
+    SHADOW_PRESET_LOW = 0,
+    SHADOW_PRESET_MEDIUM,
+    SHADOW_PRESET_HIGH,
+    SHADOW_PRESET_ULTRA,
+    SHADOW_PRESET_COUNT,
+};
+
+struct ShadowSettings {
+    unsigned int resolution = 2048; // Page size, a power of two
+#ifdef __EMSCRIPTEN__
+    ShadowDepthFormat depth_format = SHADOW_DEPTH_24;
+#else
+    ShadowDepthFormat depth_format = SHADOW_DEPTH_32F;
+#endif
+    ShadowFilterQuality filter_quality = SHADOW_FILTER_SOFT;
+    int max_filter_taps = 10; // SHADOW_FILTER_SOFT's cap, 1 to SHADOW_FILTER_MAX_TAPS
+
+    bool operator==(const ShadowSettings& other) const {
+        return resolution == other.resolution && depth_format == other.depth_format && filter_quality == other.filter_quality &&
+               max_filter_taps == other.max_filter_taps;
+    }
+    bool operator!=(const ShadowSettings& other) const { return !(*this == other); }
+};
+
+// What the map was created with. Change it through requestShadowSettings().
+extern ShadowSettings shadow_settings;
+extern const char* const SHADOW_PRESET_NAMES[SHADOW_PRESET_COUNT];
+
+ShadowSettings shadowPresetSettings(ShadowPreset preset);
+// Bytes of the map and its cache together
+uint64_t shadowMemoryBytes(const ShadowSettings& settings);
+// Takes effect at the next applyPendingShadowSettings(), between frames, so nothing in flight
+// still refers to the old textures. The resolution is rounded to a power of two and clamped to
+// what the GL supports.
+void requestShadowSettings(const ShadowSettings& settings);
+// The last request not applied yet, shadow_settings when there is none
+const ShadowSettings& requestedShadowSettings();
+// Recreates the map and cache if a request changed the resolution or depth format, and the
+// moments when the filter switches to or from SHADOW_FILTER_MOMENTS. Call before
+// the frame's first draw, callers' cached texture bindings are stale afterwards.
+void applyPendingShadowSettings();
+// "key = value" lines: preset (low, medium, high, ultra), then any of resolution,
+// depth_bits (16, 24, 32), filter (hard, pcf4, soft, moments) and filter_taps on top. '#' starts a comment. Returns
+// false, leaving settings alone, if the file can't be read.
+bool loadShadowSettings(const std::string& path, ShadowSettings& settings);
+
+// Static casters render into a cache of the same layout, each frame copies it into the map and
+// only draws the dynamic casters on top (see Renderer::renderShadowPass)
+extern bool use_shadow_cache;
+extern GLuint shadowCacheFBO;
+extern GLuint shadowCacheTexture;
+// SHADOW_FILTER_MOMENTS only: exponential variance moments (e^cd, e^2cd, -e^-cd, e^-2cd) of the
+// map, same layout plus mips down to SHADOW_MIN_TILE texels, built after the shadow pass by
+// Renderer::resolveShadowMoments(). The pyramid stops there, and tiles are aligned to their
+// power-of-two size, so no mip ever mixes two tiles. The blur target is one page, without mips.
+extern GLuint shadowMomentsTexture;
+extern GLuint shadowMomentsFBO;
+extern GLuint shadowMomentsBlurTexture;
+extern GLuint shadowMomentsBlurFBO;
+// EVSM warp exponents, positive then negative. 16-bit moments (WebGL) take smaller ones.
+extern float shadow_moment_exponents[2];
+// Float colour targets: always on desktop GL, WebGL needs EXT_color_buffer_float
+bool shadowMomentsSupported();
+
+// Point lights draw all cube faces in one layered pass when the GL has geometry shaders
+// (gl_extensions.layered_rendering), otherwise one pass per face
+extern bool use_layered_shadows;
+
+// Time-sliced updates. A view that skips a frame keeps its tile and the matrix it was rendered
+// with, so receivers reproject into the older depth. Cascades refresh every interval frames
+// (1 = every frame), and sooner once the camera leaves the margin their boxes are padded by.
+// Spot and point lights below shadow_round_robin_importance take turns, stalest first, within
+// shadow_caster_budget caster draws per frame; the stalest one always gets its turn.
+#define SHADOW_MAX_UPDATE_INTERVAL 8
+#define SHADOW_CASCADE_MARGIN 0.15f // Of the slice radius, on cascades with an interval above 1
+extern int shadow_cascade_intervals[SHADOW_CASCADES];
+extern float shadow_round_robin_importance;
+extern int shadow_caster_budget;
+
+// Texel rectangle of one view in the atlas
+struct ShadowTile {
+    int layer = 0;
+    int x = 0;
+    int y = 0;
+    int size = 0;
+
+    bool operator==(const ShadowTile& other) const {
+        return layer == other.layer && x == other.x && y == other.y && size == other.size;
+    }
+    bool overlaps(const ShadowTile& other) const {
+        return layer == other.layer && x < other.x + other.size && other.x < x + size &&
+               y < other.y + other.size && other.y < y + size;
+    }
+};
+
+// One light's share of the atlas, each of its views gets a size x size tile
+struct ShadowRequest {
+    int light = 0;
+    int views = 0;
+    float importance = 0.0f; // Screen coverage and distance, 0..1
+    int size = 0;            // Wanted size in, fitted size out, 0 = not shadowed this frame
+};
+
+// Halves the tiles largest for their light's importance until the requests fit
+// shadow_texel_budget. Requests that still don't fit, or would pass SHADOW_MAX_VIEWS, are
+// dropped from the least important on. Sizes come out as powers of two.
+void fitShadowRequests(std::vector<ShadowRequest>& requests);
+// Packs tiles along a Z-order curve through the pages. Calls must come in non-increasing size
+// order, which keeps every tile aligned to its size, so fitted requests always have room.
+ShadowTile allocateShadowTile(uint64_t& cursor, int size);
 
-// Shadow map initialization and cleanup
+// Shadow map initialization and cleanup, initShadowMap() creates it with shadow_settings
 void initShadowMap();
-void cleanupShadowMap();
\ No newline at end of file
+void cleanupShadowMap();
+// Bind the framebuffer with one page attached
+void bindShadowLayer(int layer);
+void bindShadowCacheLayer(int layer);
+// Bind the framebuffer with every layer attached, gl_Layer picks one. Needs layered_rendering.
+void bindShadowLayers();
+void bindShadowCacheLayers();
+// Bind the moments framebuffer on one page's level 0, and the blur page's
+void bindShadowMomentsLayer(int layer);
+void bindShadowMomentsBlur();
+// Clears the tile's depth, in the page bound with its layer attached
+void clearShadowTile(const ShadowTile& tile);
+// Blits the cached tile into the map's, leaves bindShadowLayer(tile.layer) bound
+void copyShadowCacheTile(const ShadowTile& tile);
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "entity_manager.h"
+
+#define SIM_STEP_SECONDS (1.0f / 60.0f)
+#define SIM_MAX_STEPS 5 // Per frame, a longer frame drops the rest rather than falling further behind
+
+extern bool use_sim_thread; // Native only, off (and always on the web) simulates inline on the GL thread
+
+// Turns frame times into whole SIM_STEP_SECONDS steps, carrying the remainder to the next frame
+struct FixedStepClock {
+    float accumulator = 0.0f; // Seconds into the next step
+
+    // The steps to run this frame, at most SIM_MAX_STEPS
+    int advance(float frame_time);
+    // How far the frame's time lies between the last step and the next, 0 to 1
+    float alpha() const { return accumulator / SIM_STEP_SECONDS; }
+};
+
+// Movement keys held this frame, sampled on the GL thread since GLFW input lives there
+enum SimKey : uint32_t {
+    SIM_KEY_FORWARD = 1 << 0,
+    SIM_KEY_BACK = 1 << 1,
+    SIM_KEY_LEFT = 1 << 2,
+    SIM_KEY_RIGHT = 1 << 3,
+    SIM_KEY_UP = 1 << 4,
+    SIM_KEY_DOWN = 1 << 5,
+    SIM_KEY_FAST = 1 << 6,
+};
+
+// Everything one simulation step reads, copied in by the GL thread
+struct SimInput {
+    uint64_t frame = 0;
+    float frame_time = 0.0f;
+    bool paused = false;
+    uint32_t keys = 0; // SimKey bits
+    float yaw = 0.0f;  // Degrees, mouse look stays on the GL thread
+    float speed_multiplier = 1.0f;
+    float friction = 1.0f;
+    bool physics = true; // Steps the physics world, see physics.h
+    // Set when the GL thread moved the camera itself (benchmark paths, capture replays), the
+    // simulation carries on from there instead of from its own position
+    bool sync_camera = false;
+    glm::vec3 camera_position{0.0f};
+    glm::vec3 camera_velocity{0.0f};
+    // The world origin moved this much since the last input (world_origin.h), the simulation's
+    // camera moves with it
+    glm::vec3 origin_shift{0.0f};
+};
+
+// One entity's new transform, components holding NO_CHANGE keep their value. target is the
+// step's own id for the entity, the applying side resolves it.
+struct TransformWrite {
+    uint32_t target = 0;
+    glm::vec3 position{0.0f};
+    glm::vec3 rotation{0.0f};
+    glm::vec3 scale{0.0f};
+};
+
+// What a step produced, applied by the GL thread before it culls and draws. frame is the input's,
+// 0 before any step has finished.
+struct RenderSnapshot {
+    uint64_t frame = 0;
+    glm::vec3 camera_position{0.0f};
+    glm::vec3 camera_velocity{0.0f};
+    std::vector<TransformWrite> transforms;
+    // The physics bodies that moved, written with EntityManager::setTransforms()
+    std::vector<EntityHandle> body_entities;
+    std::vector<EntityTransform> body_transforms;
+};
+
+// Runs the frame's simulation on its own thread while the GL thread draws the previous one.
+// exchange() waits for the step posted last frame, hands its snapshot to the GL thread, and posts
+// this frame's input for the next, so frame N+1 simulates while frame N is culled and submitted,
+// at one frame of latency. The two snapshots swap roles each exchange: the simulation writes one
+// while the GL thread reads the other, and neither is touched by both at once. The step owns all
+// the state it integrates, it only ever sees its inputs and writes its snapshot. Without the
+// thread exchange() runs the step inline and returns its snapshot straight away.
+class SimulationThread {
+public:
+    using Step = std::function<void(const SimInput& input, RenderSnapshot& snapshot)>;
+
+    ~SimulationThread() { stop(); }
+
+    void start(Step step, bool threaded);
+    // Switches between threaded and inline, an in-flight step finishes first
+    void setThreaded(bool threaded);
+    void stop();
+
+    // GL thread, once per frame. The snapshot stays valid until the next call.
+    const RenderSnapshot& exchange(const SimInput& input);
+
+    bool threaded() const { return thread.joinable(); }
+
+private:
+    void run();
+
+    Step step;
+    RenderSnapshot snapshots[2];
+    int writing = 0; // The simulation's, the other is the GL thread's
+    SimInput pending;
+    bool busy = false; // A step is posted and not finished
+    bool stopping = false;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake; // Posted input or stopping
+    std::condition_variable done; // Step finished
+};
+
+extern SimulationThread sim_thread;
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+class Mesh;
+
+#define SKIN_MAX_BONES 256        // Per model, the joint indices are bytes
+#define SKIN_MAX_INFLUENCES 4     // Per vertex, the heaviest are kept and renormalised
+#define SKIN_PALETTE_UNIT 16      // Texture unit of the bone palette in every pass
+#define SKIN_PALETTE_INITIAL_ROWS 16 // Instances, doubles when outgrown
+#define SKIN_JOB_GRAIN 4          // Instances per parallelFor range when sampling poses
+#define SKIN_DEFAULT_BLEND_SECONDS 0.25f
+#define SKIN_DEFAULT_TICKS_PER_SECOND 25.0 // For clips that don't say
+#define SKIN_BAKE_FPS 30.0f       // Frames per second of baked clips, played back interpolated
+#define SKIN_CROWD_SPACING 2.0f   // Metres between spawnCrowd()'s instances
+
+extern bool use_skinned_animation; // Off freezes every instance in its current pose
+
+// Nodes of a model's hierarchy, parents before their children, and the bones skinning reads
+struct Skeleton {
+    struct Node {
+        std::string name;
+        int parent = -1;
+        glm::vec3 translation{0.0f};
+        glm::quat rotation{1.0f, 0.0f, 0.0f, 0.0f};
+        glm::vec3 scale{1.0f};
+    };
+    struct Bone {
+        int node = 0;
+        glm::mat4 offset{1.0f}; // Mesh space to the bone's space at bind
+    };
+    std::vector<Node> nodes;
+    std::vector<Bone> bones;
+    glm::mat4 global_inverse{1.0f}; // Inverse of the root's transform, poses come out in model space
+};
+
+// Keyframed local transforms, key times in seconds
+struct AnimationClip {
+    struct Channel {
+        int node = 0;
+        std::vector<float> translation_times, rotation_times, scale_times;
+        std::vector<glm::vec3> translations;
+        std::vector<glm::quat> rotations;
+        std::vector<glm::vec3> scales;
+    };
+    std::string name;
+    float duration = 0.0f;
+    std::vector<Channel> channels;
+    std::vector<int> node_channels; // Per skeleton node, -1 keeps the bind pose
+};
+
+struct SkinnedModel {
+    std::string filepath;
+    std::vector<std::shared_ptr<Mesh>> meshes; // Unbatched, drawn by the renderer's skinned pass
+    Skeleton skeleton;
+    std::vector<AnimationClip> clips;
+
+    int findClip(const std::string& name) const; // -1 if there's none
+};
+
+// A clip sampled at SKIN_BAKE_FPS into a texture laid out like the palette, a row per frame,
+// and the crowd instances playing it
+struct BakedClip {
+    std::shared_ptr<SkinnedModel> model;
+    int clip = 0;
+    GLuint texture = 0;
+    int frames = 0;
+    std::vector<glm::mat4> transforms;
+    std::vector<glm::vec2> playback; // Per instance, seconds into the clip and speed
+};
+
+// Handle returned by loadAsync(). model is set on the GL thread once ready is.
+struct SkinnedModelRequest {
+    std::string filepath;
+    std::shared_ptr<SkinnedModel> model;
+    bool ready = false;
+    bool failed = false;
+};
+
+// Skeletal animation for models imported with their bones (VERTEX_SKINNED meshes). Every frame
+// update() samples each instance's clip, cross-fading from the previous one for a while after
+// play(), across the job system, and writes the bone matrices into one palette texture: a row
+// per instance, three RGBA32F texels per bone. The vertex shaders skin from it
+// (res/shaders/include/skinning.glsl) with four weighted bones per vertex, so the CPU only
+// touches bones, never vertices. Models import on the job system like AssetLoader's, without
+// the cooked cache or LODs. GL thread only, apart from the imports.
+// Crowds skip the per-instance sampling altogether: bakeClip() samples a clip once into its own
+// texture, and each crowd instance only has a time offset and speed, the shader picking and
+// interpolating the two frames around the shared animation time. A crowd instance costs about
+// what a static instance does, no CPU work and no palette row.
+class SkinnedAnimation {
+public:
+    // The instances of one model, in palette row order from first_row
+    struct Group {
+        std::shared_ptr<SkinnedModel> model;
+        int first_row = 0;
+        std::vector<glm::mat4> transforms;
+    };
+
+    std::shared_ptr<SkinnedModelRequest> loadAsync(const std::string& filepath);
+    // Uploads finished imports, call once per frame
+    void processUploads();
+
+    // Returns the instance's handle, clip -1 holds the bind pose
+    int addInstance(const std::shared_ptr<SkinnedModel>& model, const glm::mat4& transform, int clip = 0);
+    void setTransform(int instance, const glm::mat4& transform);
+    // Cross-fades to clip over blend_seconds, restarting it if it's already playing
+    void play(int instance, int clip, float blend_seconds = SKIN_DEFAULT_BLEND_SECONDS);
+
+    // Bakes clip into a texture, returns its index for addCrowdInstance() or -1 without the clip
+    int bakeClip(const std::shared_ptr<SkinnedModel>& model, int clip);
+    void addCrowdInstance(int baked, const glm::mat4& transform, float time_offset, float speed = 1.0f);
+    // count instances of a baked clip on a grid around center, offsets and speeds varied
+    void spawnCrowd(int baked, int count, const glm::vec3& center, float scale);
+
+    // Advances every instance by dt seconds and uploads the palette
+    void update(float dt);
+
+    // --crowd <count>, returns the arguments taken, 0 if it isn't one, -1 on a bad value
+    int parseArg(int argc, char** argv, int i);
+    int crowdRequested() const { return crowd_size; }
+
+    GLuint paletteTexture() const { return palette; }
+    const std::vector<Group>& groups() const { return draw_groups; }
+    const std::vector<BakedClip>& bakedClips() const { return baked; }
+    float crowdTime() const { return crowd_time; } // Shared by every crowd instance, in seconds
+    size_t instanceCount() const { return instances.size(); }
+    size_t crowdCount() const;
+    bool empty() const { return instances.empty() && crowdCount() == 0; }
+    size_t boneCount() const { return bones_sampled; }
+    void release();
+
+private:
+    struct Instance {
+        std::shared_ptr<SkinnedModel> model;
+        glm::mat4 transform{1.0f};
+        int clip = -1;
+        float time = 0.0f;
+        int previous_clip = -1; // Faded out over blend_duration
+        float previous_time = 0.0f;
+        float blend = 1.0f; // Of the current clip, 1 once the fade is done
+        float blend_duration = 0.0f;
+        int row = 0;
+    };
+    struct PendingModel; // Import results, skinning.cpp
+
+    void samplePose(const Instance& instance, glm::vec4* rows, std::vector<glm::mat4>& globals) const;
+    void rebuildGroups();
+    void ensurePaletteRows(int rows);
+
+    std::vector<Instance> instances;
+    std::vector<Group> draw_groups;
+    bool groups_dirty = false;
+    std::vector<glm::vec4> palette_data; // 3 * SKIN_MAX_BONES texels per row
+    GLuint palette = 0;
+    int palette_rows = 0;
+    size_t bones_sampled = 0;
+    std::vector<BakedClip> baked;
+    float crowd_time = 0.0f;
+    int crowd_size = 0;
+
+    std::mutex staged_mutex;
+    std::vector<std::shared_ptr<PendingModel>> staged;   // Imported, waiting for the GL thread
+    std::vector<std::shared_ptr<PendingModel>> fetching; // GL thread only, waiting on asset_fetch
+};
+
+extern SkinnedAnimation skinned_animation;
@@ -7,58 +7,15 @@
 #include <memory>
 #include <cstdio>
 
-static const float SKYBOX_VERTICES[] = {
-    // Positions
-    -1.0f,  1.0f, -1.0f,
-    -1.0f, -1.0f, -1.0f,
-     1.0f, -1.0f, -1.0f,
-     1.0f, -1.0f, -1.0f,
-     1.0f,  1.0f, -1.0f,
-    -1.0f,  1.0f, -1.0f,
-
-    -1.0f, -1.0f,  1.0f,
-    -1.0f, -1.0f, -1.0f,
-    -1.0f,  1.0f, -1.0f,
-    -1.0f,  1.0f, -1.0f,
-    -1.0f,  1.0f,  1.0f,
-    -1.0f, -1.0f,  1.0f,
-
-     1.0f, -1.0f, -1.0f,
-     1.0f, -1.0f,  1.0f,
-     1.0f,  1.0f,  1.0f,
-     1.0f,  1.0f,  1.0f,
-     1.0f,  1.0f, -1.0f,
-     1.0f, -1.0f, -1.0f,
-
-    -1.0f, -1.0f,  1.0f,
-    -1.0f,  1.0f,  1.0f,
-     1.0f,  1.0f,  1.0f,
-     1.0f,  1.0f,  1.0f,
-     1.0f, -1.0f,  1.0f,
-    -1.0f, -1.0f,  1.0f,
-
-    -1.0f,  1.0f, -1.0f,
-     1.0f,  1.0f, -1.0f,
-     1.0f,  1.0f,  1.0f,
-     1.0f,  1.0f,  1.0f,
-    -1.0f,  1.0f,  1.0f,
-    -1.0f,  1.0f, -1.0f,
-
-    -1.0f, -1.0f, -1.0f,
-    -1.0f, -1.0f,  1.0f,
-     1.0f, -1.0f, -1.0f,
-     1.0f, -1.0f, -1.0f,
-    -1.0f, -1.0f,  1.0f,
-     1.0f, -1.0f,  1.0f
-};
-
+// The sky as one fullscreen triangle on the far plane, after the opaques, from an sRGB cubemap
+// with a full mip chain (loadCubemap(), shared with the IBL prefilter)
 class Skybox {
 public:
-    GLuint VAO, VBO;
+    GLuint VAO; // No attributes, the triangle comes from gl_VertexID
     std::vector<GLuint> cubemap_texture;
     std::unique_ptr<Shader> skybox_shader;
     
-    Skybox() : VAO(0), VBO(0), cubemap_texture(0) {}
+    Skybox() : VAO(0), cubemap_texture(0) {}
     
     ~Skybox() {
         cleanup();
@@ -66,6 +23,6 @@ public:
     
     void bindSkybox(const char* faces[6]);
     void initShader();
-    void render(Camera* camera);
+    void render();
     void cleanup();
 };
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include "shader.h"
+
+// Screen-space ambient occlusion from the depth prepass, for contact shadows the ORM maps'
+// baked AO can't give between separate meshes. Runs at half resolution and is upsampled with
+// depth-aware weights, so edges don't bleed. The temporal option rotates the sample pattern every
+// frame and blends with the reprojected last result, fewer samples then converge to the quality
+// of more. pbr.fs multiplies it into the ambient term like the ORM occlusion.
+extern bool use_ssao;
+extern bool use_ssao_temporal;
+extern float ssao_radius;    // World units around each pixel
+extern float ssao_intensity; // Occlusion scale, 0 is none
+
+// Directions times steps per half-resolution pixel
+enum SsaoQuality {
+    SSAO_QUALITY_LOW = 0,
+    SSAO_QUALITY_MEDIUM,
+    SSAO_QUALITY_HIGH,
+    SSAO_QUALITY_COUNT,
+};
+extern SsaoQuality ssao_quality;
+extern const char* const SSAO_QUALITY_NAMES[SSAO_QUALITY_COUNT];
+
+#define SSAO_HISTORY_WEIGHT 0.85f    // Share of the reprojected result under use_ssao_temporal
+#define SSAO_HISTORY_DEPTH_TOLERANCE 0.05f // Relative view depth change that drops the history
+
+// This frame's depth is the scene target's (SceneTarget::depthTexture()), last frame's, for the
+// history test, a copy kept under use_ssao_temporal. Two half-resolution R8 results swapped
+// every frame and the full-resolution R8 upsample pbr.fs reads. All renderable on GL 3.3 and
+// WebGL2 without extensions. GL thread only.
+class ScreenSpaceAO {
+public:
+    ScreenSpaceAO() = default;
+    ~ScreenSpaceAO();
+
+    ScreenSpaceAO(const ScreenSpaceAO&) = delete;
+    ScreenSpaceAO& operator=(const ScreenSpaceAO&) = delete;
+
+    // After the depth prepass, with the scene framebuffer bound, which it leaves bound with the
+    // viewport restored. False when the targets or shaders can't be made.
+    bool compute(const glm::mat4& view, const glm::mat4& projection);
+    // The full-resolution result, 1 unoccluded
+    void bind(int unit) const;
+    // For frames it didn't run, the next one starts without a history
+    void resetHistory() { history_valid = false; }
+
+private:
+    bool init(int width, int height);
+    void release();
+
+    std::unique_ptr<Shader> ao_shader;
+    std::unique_ptr<Shader> upsample_shader;
+    GLuint vao = 0;
+    GLuint history_depth_fbo = 0, history_depth_texture = 0;
+    GLuint ao_fbos[2] = {}, ao_textures[2] = {};
+    GLuint output_fbo = 0, output_texture = 0;
+    int width = 0, height = 0;
+    int current = 0; // Into the pairs, this frame's
+    bool history_valid = false;
+    glm::mat4 history_view_projection{1.0f};
+    uint32_t frame = 0; // Rotates the temporal sample pattern
+    bool failed = false;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+#include "draw_list.h" // DrawElementsIndirectCommand
+
+class Mesh;
+class Material;
+class EntityManager;
+class HiZBuffer;
+class GeometryArena;
+struct Impostor;
+struct Frustum;
+
+// Static entities (EntityManager::setStatic) are drawn from baked chunks instead of being
+// culled, LOD-selected and batched one by one every frame
+extern bool use_static_batching;
+#define STATIC_CHUNK_SIZE 32.0f // World units per chunk cell edge
+
+// Static entities grouped by grid cell and LOD layout into chunks. Each chunk level owns fixed
+// instance ranges in per-vertex-source buffers and a slice of one indirect buffer, all uploaded
+// once by update(). Culling and LOD choice happen per chunk, a chunk level then draws as one
+// multi-draw per material run. No cross-fades, chunks switch levels with hysteresis only.
+// Past their members' coarsest level, chunks go on to HLOD proxy levels (hlod.h).
+// GL thread only.
+class StaticBatches {
+public:
+    struct Draw {
+        Mesh* mesh = nullptr;
+        const Material* material = nullptr;
+        int cull_mode = 0;
+        uint32_t source = 0; // Index into sources
+        uint32_t first_instance = 0;
+        uint32_t instance_count = 0;
+    };
+
+    // Draws sorted by material, cull mode and vertex source, so runs share a submission
+    struct Level {
+        std::vector<Draw> draws;
+        size_t first_command = 0;
+        std::unordered_map<Impostor*, std::vector<glm::mat4>> impostors;
+        int triangles = 0;
+        int instances = 0;
+    };
+
+    struct Chunk {
+        glm::vec3 bmin{0.0f}, bmax{0.0f};
+        float lod_radius = 0.0f;             // Largest member's world radius
+        std::vector<float> min_screen_sizes; // Per level, from the members' shared LOD layout
+        std::vector<Level> levels;
+        int entity_count = 0;
+        int current_lod = 0;
+        int shadow_lod = 0;        // Level the shadow views draw, see Entity::selectShadowLOD()
+        int shadow_proxy_lod = -1; // The members' Entity::shadow_proxy_lod
+        bool visible = false; // Last cull() result
+    };
+
+    StaticBatches() = default;
+    ~StaticBatches();
+
+    StaticBatches(const StaticBatches&) = delete;
+    StaticBatches& operator=(const StaticBatches&) = delete;
+
+    // Rebakes when the layout or a static entity changed since the last bake
+    void update(EntityManager& entity_manager);
+    void clear();
+
+    // Distance to the nearest point of the chunk, so no member gets less detail than it would alone.
+    // shadow_projection_scale picks the shadow levels the same way.
+    void selectLODs(const glm::vec3& camera_position, float projection_scale, float shadow_projection_scale, float hysteresis);
+    // Camera view: marks the chunks in the frustum and, with occlusion, not hidden in the Hi-Z buffer
+    void cull(const Frustum& frustum, const HiZBuffer* occlusion);
+
+    // Draws the visible chunks, or with a frustum every chunk inside it at its shadow level (shadow views).
+    // apply_state runs whenever the material or cull mode changes. Returns the GL draw calls.
+    int submit(const std::function<void(const Draw&)>& apply_state, const Frustum* frustum = nullptr);
+
+    const std::vector<Chunk>& getChunks() const { return chunks; }
+    int entityCount() const { return entity_count; }
+
+private:
+    // One vertex buffer (an arena, or a standalone mesh) behind a VAO of our own, whose
+    // instance attributes point at the static matrices
+    struct Source {
+        GLuint vao = 0;
+        GLuint vbo = 0;
+        GLuint ebo = 0;
+        GLuint instance_vbo = 0;
+        GLuint fade_vbo = 0;
+        uint32_t vertex_format = 0;
+        std::shared_ptr<GeometryArena> arena;
+        std::shared_ptr<Mesh> mesh; // Standalone meshes only, keeps the buffers alive
+        std::vector<glm::mat4> matrices;
+    };
+
+    uint32_t sourceFor(const std::shared_ptr<Mesh>& mesh);
+    void bindSource(Source& source);
+
+    std::vector<Chunk> chunks;
+    std::vector<Source> sources;
+    std::unordered_map<GLuint, uint32_t> source_index; // By vertex buffer
+    std::vector<std::shared_ptr<Mesh>> retained; // Meshes the draws point at
+    std::vector<DrawElementsIndirectCommand> commands;
+    GLuint indirect_buffer = 0;
+    int entity_count = 0;
+
+    bool built = false;
+    uint64_t built_layout_version = 0;
+    uint64_t built_static_version = 0;
+    bool built_hlod = false;
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "entity_manager.h"
+#include "light.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct Impostor;
+
+// Procedural scenes for scaling runs: a jittered grid of instances of the loaded models, with
+// the mix of LOD chains, material variants, lights and moving entities as knobs, so culling,
+// batching, instancing and shadow costs can be measured as curves over the instance count.
+// --stress <count> on the command line replaces the tree grid with one, the debug UI
+// regenerates it in place. Entities are named "stress_<model>".
+#define STRESS_SCENE_PRESET_COUNT 4
+extern const int STRESS_SCENE_PRESET_INSTANCES[STRESS_SCENE_PRESET_COUNT]; // 1k to 1M
+#define STRESS_SCENE_MAX_VARIANTS 16
+#define STRESS_SCENE_MOVER_GRAIN 1024 // Movers per job_system range
+
+struct StressSceneSettings {
+    int instances = 10000;
+    float spacing = 5.0f;          // Average distance between neighbours, the density's inverse square root
+    float lod_mix = 1.0f;          // Share of instances with their LOD chain, the rest draw LOD0 at any distance
+    int material_variants = 1;     // Tinted copies of each model's materials, 1 keeps only the originals
+    int lights = 0;                // Point lights over the field
+    float dynamic_fraction = 0.0f; // Share that moves every frame, the rest is static scenery
+    uint32_t seed = 1;
+};
+
+// A model the generator spawns, as the scene would create it
+struct StressModel {
+    std::string name;
+    std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>> lod_specs;
+    std::vector<int> cull_modes;
+    std::shared_ptr<Impostor> impostor;
+    int shadow_proxy_lod = -1;
+};
+
+class StressScene {
+public:
+    StressSceneSettings settings;
+
+    // A --stress option at argv[i]: how many arguments it took, 0 when it isn't one, -1 on a bad value
+    int parseArg(int argc, char** argv, int i);
+    // --stress was given, the scene should replace the tree grid
+    bool requested() const { return from_command_line; }
+
+    void setModels(std::vector<StressModel> models) { this->models = std::move(models); }
+    // Replaces the previous stress scene with one from settings
+    void generate();
+    void clear();
+    // Moves the dynamic share, once per frame before EntityManager::updateTransforms()
+    void update(float frame_time);
+
+    size_t entityCount() const { return entity_count; }
+    size_t dynamicCount() const { return movers.size(); }
+    size_t lightCount() const { return active_lights; }
+
+private:
+    struct Mover {
+        EntityHandle handle;
+        EntityTransform base;
+        float phase = 0.0f;
+    };
+
+    std::vector<StressModel> models;
+    std::vector<Mover> movers;
+    std::vector<EntityHandle> mover_handles;       // Per mover, for EntityManager::setTransforms()
+    std::vector<EntityTransform> mover_transforms; // Scratch, this frame's
+    // Lights only ever grow, the ones a smaller scene doesn't need are switched off and reused
+    std::vector<LightHandle> light_handles;
+    size_t active_lights = 0;
+    size_t entity_count = 0;
+    float time = 0.0f;
+    bool from_command_line = false;
+};
+
+extern StressScene stress_scene;
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "renderer.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#define TELEMETRY_DEFAULT_INTERVAL_S 10.0
+#define TELEMETRY_MAX_FILE_BYTES (8 * 1024 * 1024) // Then the file rotates
+#define TELEMETRY_ROTATED_FILES 3                  // <file>.1, newest, to <file>.3 are kept
+
+// Metrics for watching unattended instances, kiosks and render servers, from elsewhere. Every
+// interval update() takes a snapshot: wall, CPU and GPU frame-time percentiles over frame_stats'
+// window, the frame's RenderStats counters, the GPU time per profiler scope of the latest
+// profiled frame, GPU memory by category, and the load stages summed over every asset so far.
+// --telemetry <file> appends each as one JSON line, moving the file to <file>.1 once it passes
+// TELEMETRY_MAX_FILE_BYTES. --telemetry-port <port> serves the latest as Prometheus text over
+// HTTP, any path, from a background thread (native builds other than Windows). Between snapshots
+// update() only reads the clock, and the profiler callback keeps one frame's scope times.
+// GL thread only, the server only reads the text it is handed.
+class Telemetry {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Telemetry() = default;
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator=(const Telemetry&) = delete;
+
+    // --telemetry <file>, --telemetry-port <port>, --telemetry-interval <seconds>. Returns the
+    // arguments taken, 0 if it isn't one, -1 on a bad value.
+    int parseArg(int argc, char** argv, int i);
+    bool requested() const { return !file_path.empty() || port != 0; }
+
+    // After the profiler exists, opens the file and starts the server
+    void init();
+    // Once a frame after the swap, stats being the frame's
+    void update(const Renderer::RenderStats& stats);
+    // A last snapshot to the file, then stops the server
+    void shutdown(const Renderer::RenderStats& stats);
+
+    uint64_t snapshotCount() const { return snapshots; }
+
+private:
+    void snapshot(const Renderer::RenderStats& stats);
+    void appendLine(const std::string& line);
+    bool startServer();
+    void serve();
+
+    std::string file_path;
+    int port = 0;
+    double interval_s = TELEMETRY_DEFAULT_INTERVAL_S;
+    bool initialized = false;
+
+    std::ofstream out;
+    uint64_t file_bytes = 0;
+    Clock::time_point next_snapshot;
+    uint64_t snapshots = 0;
+    // GPU ms per scope name of the latest profiled frame, summed where a name repeats
+    std::vector<std::pair<const char*, double>> scope_gpu_ms;
+
+    std::mutex text_mutex;
+    std::string prometheus_text; // The latest snapshot, for the server
+    std::thread server;
+    std::atomic<bool> stopping{false};
+    int listen_socket = -1;
+};
+
+extern Telemetry telemetry;
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include "shader.h"
+
+// Temporal anti-aliasing and upscaling. The projection is jittered by a sub-pixel Halton offset
+// every frame, and a resolve pass accumulates the jittered samples into a history at window
+// resolution: reprojected along motion vectors, clamped to the current neighbourhood so stale
+// colours don't ghost. The scene then renders below native resolution (resolution_scale) at
+// close to native quality, and replaces MSAA, which the scene target drops while this is on.
+// Motion comes from the depth and last frame's camera for still geometry, and from a pass over
+// the entities that moved (previous world matrices) for the rest. Needs float colour targets,
+// so WebGL2 without EXT_color_buffer_float stays on MSAA.
+extern bool use_taa;
+#define TAA_JITTER_PHASES 8           // Halton (2, 3) samples before the pattern repeats
+#define TAA_BLEND 0.1f                // Share of a sample landing on the output pixel centre at native scale
+#define TAA_DEFAULT_RESOLUTION_SCALE 0.75f // What resolution_scale starts at with TAA
+#define TAA_NO_MOTION 64.0f           // Velocity clear value, "take the camera's motion from depth"
+
+// GL thread only. Per frame: jitter() before the projection is built, then after the scene the
+// renderer's motion pass between beginMotion() and endMotion(), then resolve().
+class TemporalAA {
+public:
+    TemporalAA() = default;
+    ~TemporalAA();
+
+    TemporalAA(const TemporalAA&) = delete;
+    TemporalAA& operator=(const TemporalAA&) = delete;
+
+    // This frame's offset in NDC for Camera::jitter at the given render size, 0 when off
+    glm::vec2 jitter(int render_width, int render_height);
+    bool active() const { return use_taa && !failed; }
+
+    // Copies the scene depth into the motion target, clears its velocities and binds it with
+    // depth testing against the copy. projection is the jittered one the scene used. False when off.
+    bool beginMotion(const glm::mat4& view, const glm::mat4& projection);
+    // Velocities are written by the caller with these: this frame's and last frame's unjittered view-projection
+    const glm::mat4& currentViewProjection() const { return current_view_projection; }
+    const glm::mat4& previousViewProjection() const { return history_view_projection; }
+    // Rebinds the scene framebuffer
+    void endMotion();
+
+    // Accumulates the scene colour into the next history at output size and returns it, for the
+    // post pass. 0 when off or beginMotion() didn't run this frame.
+    GLuint resolve(GLuint scene_color, int output_width, int output_height);
+    // Cuts, teleports and toggles start over instead of smearing
+    void resetHistory() { history_valid = false; }
+    // The world origin moved by delta (world_origin.h), which isn't a cut: last frame's
+    // view-projection follows so the history reprojects as before
+    void shiftOrigin(const glm::vec3& delta);
+
+private:
+    bool initMotion(int width, int height);
+    bool initHistory(int width, int height);
+    void release();
+    // For good: MSAA comes back, and native resolution unless dynamic resolution manages it
+    void fallBack();
+
+    std::unique_ptr<Shader> resolve_shader;
+    GLuint vao = 0;
+    GLuint motion_fbo = 0, velocity_texture = 0; // Render size
+    GLuint depth_texture = 0; // The scene target's, attached to motion_fbo, not owned
+    GLuint history_fbos[2] = {}, history_textures[2] = {};          // Output size
+    GLenum history_format = 0;
+    int render_width = 0, render_height = 0;
+    int output_width = 0, output_height = 0;
+    int current = 0; // Into the history pair, this frame's
+    uint32_t frame = 0;
+    glm::vec2 frame_jitter{0.0f};
+    glm::mat4 current_view_projection{1.0f};
+    glm::mat4 inverse_view_projection{1.0f}; // Jittered, for positions from depth
+    glm::mat4 history_view_projection{1.0f};
+    bool motion_ready = false;
+    bool history_valid = false;
+    bool failed = false;
+};
+
+extern TemporalAA temporal_aa;
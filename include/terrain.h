@@ -0,0 +1,123 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "material.h"
+
+struct Frustum;
+
+#define TERRAIN_GRID 32               // Quads along a chunk's side, every chunk draws the same grid
+#define TERRAIN_TILE_TEXELS 256       // Height and splat samples along a tile's side, plus a shared border row
+#define TERRAIN_TEXEL_SPACING 1.0f    // Metres between height samples
+#define TERRAIN_LEVELS 4              // Chunk sizes, TERRAIN_GRID samples up to a whole tile, doubling
+#define TERRAIN_LOD_RANGE 96.0f       // Metres the finest chunks reach, each coarser level twice the last
+#define TERRAIN_MORPH_START 0.7f      // Fraction of a level's range where its vertices start morphing
+#define TERRAIN_VIEW_TILES 3          // Tiles kept around the camera's, each way
+#define TERRAIN_MAX_TILES 64          // Resident tile layers, above the (2 * TERRAIN_VIEW_TILES + 2)^2 kept
+#define TERRAIN_UPLOADS_PER_FRAME 2   // Finished tiles taken in per update()
+#define TERRAIN_HEIGHT_UNIT 18        // Texture units of the tile arrays, past the bone palette and the particles' depth
+#define TERRAIN_SPLAT_UNIT 19
+#define TERRAIN_LAYERS 4              // Splat channels, each a tint of the terrain material
+#define TERRAIN_HEIGHT_RANGE 256.0f   // Metres a 16-bit height file spans, from 0
+#define TERRAIN_NOISE_HEIGHT 40.0f    // Metres the generated hills reach
+#define TERRAIN_NOISE_SCALE 400.0f    // Metres across the generated ground's broadest features
+#define TERRAIN_FLAT_RADIUS 60.0f     // Metres around the origin the generated ground stays at 0, the scene stands there
+
+static_assert(TERRAIN_GRID << (TERRAIN_LEVELS - 1) == TERRAIN_TILE_TEXELS, "the coarsest chunk is a whole tile");
+
+extern bool use_terrain; // Off hides it, resident tiles stay
+
+// One chunk to draw, the grid placed and morphed by pbr.vs' TERRAIN path
+struct TerrainChunk {
+    glm::vec2 origin{0.0f};   // World xz of the grid's first corner
+    float size = 0.0f;        // Metres along a side
+    float morph_start = 0.0f; // Camera distance where the vertices start moving onto the next level's grid
+    float tile_layer = 0.0f;  // Of the height and splat arrays
+    glm::vec2 tile_origin{0.0f};
+    float morph_scale = 0.0f; // 1 / morph length, 0 for the coarsest level that never morphs
+};
+
+// Heightmap terrain split into square tiles of TERRAIN_TILE_TEXELS samples, each streamed in and
+// out around the camera. A tile's heights and splat weights come from res/terrain/height_<x>_<z>.png
+// (16-bit greyscale, metres over TERRAIN_HEIGHT_RANGE) and splat_<x>_<z>.png (RGBA, a weight per
+// layer) when they're there, otherwise from noise, generated on the job system either way. They
+// land in one layer of an R32F and an RGBA8 texture array.
+// Geometry is CDLOD: every tile is a quadtree TERRAIN_LEVELS deep, subdivided where the camera is
+// within the next finer level's range, and each selected node draws the same TERRAIN_GRID grid,
+// instanced, scaled to the node. Vertices morph onto the coarser level's grid as they near the end
+// of their range, so neighbouring levels meet without cracks and switch without popping. Chunks
+// are frustum tested against their tile's height range. Drawn forward with the pbr.fs variants
+// after the deferred lighting, outside the depth prepass, so SSAO and Hi-Z don't see it; it
+// receives shadows without casting any. CPU-side collision isn't covered.
+// GL thread only, tiles are built on workers.
+class Terrain {
+public:
+    Terrain() = default;
+    ~Terrain();
+
+    Terrain(const Terrain&) = delete;
+    Terrain& operator=(const Terrain&) = delete;
+
+    // --terrain, in place of the level's ground quad. Returns the arguments taken, 0 if it isn't one.
+    int parseArg(int argc, char** argv, int i);
+    bool requested() const { return enabled; }
+
+    // Creates the grid, the tile arrays and the material. False if they failed, the terrain stays off.
+    bool init();
+    // Queues the tiles around the camera that aren't there, drops the ones far behind and uploads
+    // what finished. Outside the frame's state window, like the texture streamer.
+    void update(const glm::vec3& camera_position);
+
+    // The chunks to draw this frame
+    void select(const Frustum& frustum, const glm::vec3& camera_position, std::vector<TerrainChunk>& chunks) const;
+    // Binds the arrays and draws chunks with whichever terrain program is in use, returns the triangles
+    size_t draw(const std::vector<TerrainChunk>& chunks);
+
+    bool ready() const { return vao != 0; }
+    const Material& material() const { return terrain_material; }
+    size_t residentTiles() const { return tiles.size(); }
+    size_t pendingTiles() const;
+    void release();
+
+private:
+    struct TileKey {
+        int x = 0, z = 0;
+        bool operator<(const TileKey& other) const { return x != other.x ? x < other.x : z < other.z; }
+    };
+    struct Tile {
+        int layer = -1; // -1 while it's being built
+        float min_height = 0.0f, max_height = 0.0f;
+    };
+    // Built on a worker, handed to the GL thread
+    struct TileData {
+        TileKey key;
+        std::vector<float> heights;        // (TERRAIN_TILE_TEXELS + 1)^2
+        std::vector<unsigned char> splat;  // The same, RGBA
+        float min_height = 0.0f, max_height = 0.0f;
+    };
+
+    static std::unique_ptr<TileData> buildTile(TileKey key);
+    void selectNode(const Frustum& frustum, const glm::vec3& camera_position, const Tile& tile, const glm::vec2& tile_origin,
+                    const glm::vec2& origin, int level, std::vector<TerrainChunk>& chunks) const;
+
+    bool enabled = false;
+    GLuint vao = 0, grid_vbo = 0, grid_ebo = 0;
+    GLuint height_array = 0, splat_array = 0;
+    GLsizei index_count = 0;
+    Material terrain_material;
+
+    std::map<TileKey, Tile> tiles; // Resident and in flight
+    std::vector<int> free_layers;
+    mutable std::mutex finished_mutex;
+    std::deque<std::unique_ptr<TileData>> finished;
+    size_t in_flight = 0; // Jobs submitted, not yet taken in
+};
+
+extern Terrain terrain;
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+struct ImageData;
+
+extern bool use_texture_atlas; // Off draws every albedo map from its own texture again
+#define TEXTURE_ATLAS_MAX_SIZE 128 // Texels on the longer side, the streamer's whole tail so every level is there at once
+#define TEXTURE_ATLAS_LAYERS 64    // Per array, a new one starts when it fills
+#define TEXTURE_ATLAS_UNIT 10      // Free during the material passes, the deferred lighting's gNormal otherwise
+
+// Small albedo maps packed into RGBA8 texture arrays, a layer each, one array per texel size and
+// colour space.
+// Materials whose albedo map has a layer draw with the pbr.fs variant sampling the array at the
+// material table's layer, so props sharing an array switch materials without a texture bind.
+// Layers are whole textures with their own mip chains, so wrapping UVs work and nothing bleeds
+// between neighbours, which an atlas of UV rectangles would need padding against. The original
+// textures stay as they are for everything else (depth and shadow alpha tests, impostor bakes).
+// Mips are regenerated by flush() for the arrays that changed.
+// GL thread only.
+class TextureAtlas {
+public:
+    struct Slot {
+        int array = -1;
+        int layer = -1;
+        bool valid() const { return array >= 0; }
+    };
+
+    TextureAtlas() = default;
+    ~TextureAtlas();
+
+    TextureAtlas(const TextureAtlas&) = delete;
+    TextureAtlas& operator=(const TextureAtlas&) = delete;
+
+    // Copies level 0 of an uncompressed RGB(A) image up to TEXTURE_ATLAS_MAX_SIZE into a free
+    // layer, an invalid slot when it doesn't qualify. Call before an upload that takes the image.
+    Slot pack(const ImageData& image);
+    // Files the slot under the texture uploaded from the same image. A texture that already has
+    // one, e.g. the winner of an upload race, keeps it and the slot is freed.
+    void assign(GLuint texture, Slot slot);
+    // Frees the texture's layer, right before it is deleted
+    void remove(GLuint texture);
+
+    // The array and layer texture was packed into, false if it wasn't
+    bool find(GLuint texture, GLuint& array, int& layer) const;
+
+    // Regenerates the mips of arrays packed into since the last call, before drawing
+    void flush();
+
+    size_t arrayCount() const { return arrays.size(); }
+    size_t layerCount() const { return entries.size(); }
+    void release();
+
+private:
+    struct Array {
+        GLuint texture = 0;
+        int width = 0, height = 0;
+        bool srgb = false;
+        int used = 0; // Layers handed out, free_layers first
+        std::vector<int> free_layers;
+        bool dirty = false;
+    };
+
+    void freeSlot(Slot slot);
+
+    std::vector<Array> arrays;
+    std::unordered_map<GLuint, Slot> entries;
+};
+
+extern TextureAtlas texture_atlas;
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+struct SamplerDesc;
+class Material;
+
+// Refcounted GL textures keyed by source + sampler state, so models that share images
+// (e.g. every tree LOD) decode and upload them once.
+// contains() is safe from worker threads; acquire/insert/release are GL thread only.
+class TextureCache {
+public:
+    static std::string fileKey(const std::string& resolved_path, const SamplerDesc& sampler);
+    static std::string embeddedKey(const std::string& model_path, const std::string& texture_ref, const SamplerDesc& sampler);
+    static std::string ormKey(const std::string& model_path, const std::string& ao_path, const std::string& roughness_path,
+                              const std::string& metallic_path, const std::string& height_path,
+                              const std::string& specular_path, bool invert_height, const SamplerDesc& sampler);
+
+    bool contains(const std::string& key);
+
+    // Returns 0 if not resident, otherwise adds a reference. flags returns what insert() stored.
+    GLuint acquire(const std::string& key, uint32_t* flags = nullptr);
+
+    // Takes ownership of texture with one reference. If another upload of the same key won
+    // the race, texture is deleted and the resident one is returned instead.
+    GLuint insert(const std::string& key, GLuint texture, uint32_t flags = 0);
+
+    // Adds a reference to a resident texture, for materials shared between meshes
+    void retain(GLuint texture);
+
+    // Drops a reference, deleting the texture at zero. Untracked ids (default texture) are ignored.
+    void release(GLuint texture);
+
+    // Forgets every texture built from path, so the next acquire() misses and loads it again.
+    // Textures still referenced stay alive under their ids until released. Returns how many.
+    size_t evictSource(const std::string& path);
+
+    size_t size();
+
+private:
+    struct Entry {
+        GLuint texture = 0;
+        int refs = 0;
+        uint32_t flags = 0; // Caller-defined, e.g. whether a packed ORM map carries height
+    };
+
+    std::mutex cache_mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<GLuint, std::string> keys_by_texture;
+    std::unordered_map<GLuint, Entry> evicted; // Out of entries but still referenced
+};
+
+extern TextureCache texture_cache;
+
+// Releases every cached map referenced by the material
+void releaseMaterialTextures(Material& material);
+// Adds a reference to every cached map, call when copying a material onto another mesh
+void retainMaterialTextures(const Material& material);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+
+struct ImageData;
+
+// Compressed formats that core 3.3 glad doesn't define
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT   0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT  0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT  0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM     0x8E8C
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RG11_EAC            0x9272
+#define GL_COMPRESSED_RGB8_ETC2           0x9274
+#define GL_COMPRESSED_RGBA8_ETC2_EAC      0x9278
+#endif
+#ifndef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+#define GL_COMPRESSED_RGBA_ASTC_4x4_KHR   0x93B0
+#endif
+// Their sRGB-decoding twins
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT        0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT  0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT  0x8C4F
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM     0x8E8D
+#endif
+#ifndef GL_COMPRESSED_SRGB8_ETC2
+#define GL_COMPRESSED_SRGB8_ETC2                0x9275
+#define GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC     0x9279
+#endif
+#ifndef GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR
+#define GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR 0x93D0
+#endif
+
+// How a texture is sampled decides which block format it is cooked to
+enum TextureUsage {
+    TEXTURE_USAGE_COLOR,  // albedo/emissive: BC1, or BC3 with alpha
+    TEXTURE_USAGE_NORMAL, // tangent-space normals: BC5 (RG, z rebuilt in pbr.fs)
+    TEXTURE_USAGE_DATA    // packed ORM + height: BC3
+};
+
+struct TextureCompressionCaps {
+    bool s3tc = false; // BC1/BC3
+    bool s3tc_srgb = false; // Their sRGB twins, the others come with their format
+    bool rgtc = false; // BC4/BC5
+    bool bptc = false; // BC7
+    bool etc2 = false;
+    bool astc = false;
+};
+
+extern TextureCompressionCaps texture_compression_caps;
+extern bool use_texture_compression;
+
+// Queries supported formats, call on the GL thread once glad is loaded
+void initTextureCompression();
+bool isCompressedFormatSupported(GLenum format);
+// The sRGB-decoding twin of a colour block format, GL_SRGB8_ALPHA8 for GL_RGBA8. 0 when the
+// format has none or the GPU can't sample it.
+GLenum srgbFormat(GLenum format);
+// DXT5, BPTC, ETC2 EAC and ASTC store alpha, the others don't
+bool compressedFormatHasAlpha(GLenum format);
+// Whether the alpha test (alpha < 0.5) cuts any texel out. Compressed images can only tell
+// whether they store alpha at all, which counts as yes. Worker-safe.
+bool imageHasCutoutAlpha(const ImageData& image);
+
+// CPU block compression with a box-filtered mip chain. Returns an empty image when the
+// usage has no supported format. Safe on worker threads.
+ImageData compressImage(const ImageData& image, TextureUsage usage);
+
+// Replaces pixels with a box-filtered RGBA8 mip chain in image.levels (for streamed uploads).
+// Normal maps are renormalized per level. No-op for images that already carry a chain.
+void generateMipChain(ImageData& image, bool normals);
+
+// Halves the image until its longer side is at most max_size (0 = no limit): chains drop their
+// finest levels, single images are box-filtered down to RGBA8 like generateMipChain's levels.
+void limitImageSize(ImageData& image, int max_size, bool normals);
+
+// Loads <path>.ktx2 (or hand-made <path>.etc2.ktx2 / <path>.astc.ktx2 variants) when it is
+// newer than the source and the GPU supports its format. Otherwise decodes the source and,
+// on desktop, cooks <path>.ktx2 for next time. Falls back to plain pixels. Worker-safe.
+ImageData loadTextureImage(const std::string& path, TextureUsage usage);
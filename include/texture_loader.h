@@ -7,7 +7,78 @@
 #include "mesh.h"
 #include "material.h"
 
-// Texture loading functions
+class MappedFile;
+
+// One level of a mip chain: bytes of its own, or a view into the file ImageData::mapping holds
+struct ImageLevel {
+    std::vector<unsigned char> bytes;
+    const unsigned char* view = nullptr;
+    size_t view_size = 0;
+
+    ImageLevel() = default;
+    ImageLevel(std::vector<unsigned char> owned) : bytes(std::move(owned)) {}
+    ImageLevel(const unsigned char* data, size_t size) : view(data), view_size(size) {}
+
+    const unsigned char* data() const { return view ? view : bytes.data(); }
+    size_t size() const { return view ? view_size : bytes.size(); }
+};
+
+// Decoded pixels waiting for upload. Owns its buffer, move-only.
+struct ImageData {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    unsigned char* pixels = nullptr;
+
+    // Full mip chain instead of pixels, level 0 first: block-compressed when
+    // compressed_format is set, otherwise RGBA8 (see generateMipChain)
+    GLenum compressed_format = 0;
+    std::vector<ImageLevel> levels;
+    // Colour data, uploaded to the sRGB twin of its format so samples come back linear
+    bool srgb = false;
+    // The KTX2 file levels point into when they were read without a copy (see readKTX2)
+    std::shared_ptr<MappedFile> mapping;
+
+    ImageData() = default;
+    ~ImageData();
+    ImageData(ImageData&& other) noexcept;
+    ImageData& operator=(ImageData&& other) noexcept;
+    ImageData(const ImageData&) = delete;
+    ImageData& operator=(const ImageData&) = delete;
+
+    bool isCompressed() const { return compressed_format != 0 && !levels.empty(); }
+    bool hasMipChain() const { return !levels.empty(); }
+    bool valid() const { return (pixels != nullptr || hasMipChain()) && width > 0 && height > 0; }
+    static ImageData allocate(int width, int height, int channels);
+};
+
+// CPU decoding, safe on worker threads (desired_channels = 0 keeps the file's channel count)
+ImageData decodeImage(const std::string& path, int desired_channels = 0);
+ImageData decodeImageFromMemory(const unsigned char* data, unsigned int size, int desired_channels = 0);
+ImageData decodeImageFromARGB(const aiTexel* data, unsigned int width, unsigned int height);
+
+// Sampler state applied at upload (part of the texture cache key)
+struct SamplerDesc {
+    GLint wrap_s = GL_REPEAT;
+    GLint wrap_t = GL_REPEAT;
+    GLint min_filter = GL_LINEAR_MIPMAP_LINEAR;
+    GLint mag_filter = GL_LINEAR;
+    bool mipmaps = true;
+};
+
+// Longer side material textures are halved down to on load, 0 keeps them whole. 1024 keeps
+// low-memory devices within budget. Textures already resident keep their size.
+extern int texture_max_size;
+
+// Sized format the image is stored as: R8, RG8, RGB8 or RGBA8 by channel count, RGBA8 for
+// uncompressed chains, else the compressed format, each sRGB for colour data where there is one
+GLenum imageInternalFormat(const ImageData& image);
+
+// GL upload, returns default_texture_id for invalid images. Immutable storage where the driver
+// has it.
+GLuint uploadImage(const ImageData& image, const SamplerDesc& sampler = SamplerDesc());
+
+// Texture loading functions (loadTexture goes through texture_cache)
 GLuint loadTexture(const std::string& path);
 GLuint loadTextureFromMemory(unsigned char* data, unsigned int size);
 GLuint loadTextureFromARGB(aiTexel* data, unsigned int width, unsigned int height);
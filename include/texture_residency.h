@@ -0,0 +1,78 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct ImageData;
+struct Material;
+
+#ifdef __EMSCRIPTEN__
+#define TEXTURE_RESIDENCY_DEFAULT_BUDGET (256ull * 1024 * 1024)
+#else
+#define TEXTURE_RESIDENCY_DEFAULT_BUDGET (512ull * 1024 * 1024)
+#endif
+// Levels finer than the screen size asks for, minification filtering wants a little extra
+#define TEXTURE_RESIDENCY_BIAS 1
+// Frames a texture goes unseen before it falls back to its tail
+#define TEXTURE_RESIDENCY_GRACE_FRAMES 120
+
+extern bool use_texture_residency;
+extern uint64_t texture_residency_budget; // Bytes of managed levels, tails included
+
+// Keeps only the mip levels the screen needs. The renderer notes the projected size of every
+// drawn material each frame; update() turns that into the finest level worth having
+// (texture width / pixels, TEXTURE_RESIDENCY_BIAS finer), trims the targets by priority until
+// they fit texture_residency_budget, frees levels that are no longer wanted and streams wanted
+// ones back through the streamer's PBO ring. Only mip chains mapped from cooked KTX2 files are
+// managed: their levels cost nothing to keep around on the CPU, so any level can come back at
+// any time. They use mutable storage so an evicted level can be respecified as 0x0 and its
+// memory actually returned. GL thread only.
+class TextureResidency {
+public:
+    // Takes over a texture whose levels from resident_level down are allocated and uploaded
+    void manage(GLuint texture, std::shared_ptr<ImageData> image, GLenum internal_format, int resident_level);
+    // Right before a managed texture is deleted, unmanaged names are ignored
+    void forget(GLuint texture);
+
+    // The texture covers about pixels on screen this frame
+    void noteUsage(GLuint texture, float pixels);
+    void noteMaterial(const Material& material, float pixels);
+
+    // Evicts and streams toward this frame's targets, uploading at most budget_bytes
+    void update(size_t budget_bytes);
+
+    size_t managedCount() const { return textures.size(); }
+    uint64_t residentBytes() const { return resident_bytes; }
+    // Bytes the targets would take, at most the budget unless the tails alone exceed it
+    uint64_t targetBytes() const { return target_bytes; }
+    uint64_t evictedLevels() const { return evicted_levels; }
+
+private:
+    struct Managed {
+        std::shared_ptr<ImageData> image;
+        GLenum internal_format = 0;
+        int tail = 0;     // Always resident from here down
+        int resident = 0; // Finest resident level, the texture's base level
+        int target = 0;
+        float pixels = 0.0f; // Largest noted this frame
+        uint64_t last_seen = 0;
+        bool seen = false; // Noted at all yet
+    };
+
+    uint64_t levelBytes(const Managed& entry, int level) const;
+    uint64_t bytesFrom(const Managed& entry, int level) const;
+    void evict(GLuint texture, Managed& entry, int level);
+
+    std::unordered_map<GLuint, Managed> textures;
+    std::vector<GLuint> order; // Scratch, by priority
+    uint64_t frame = 1;
+    uint64_t resident_bytes = 0;
+    uint64_t target_bytes = 0;
+    uint64_t evicted_levels = 0;
+};
+
+extern TextureResidency texture_residency;
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+
+struct ImageData;
+struct SamplerDesc;
+
+// Levels at or below this size are uploaded immediately so a texture is usable at once
+#define TEXTURE_STREAM_TAIL_SIZE 128
+// Default per-frame upload budget for update()
+#define TEXTURE_STREAM_FRAME_BUDGET (4 * 1024 * 1024)
+#define TEXTURE_STREAM_RING_SLOTS 4
+
+extern bool use_texture_streaming;
+
+// Uploads mip chains smallest level first: the tail goes in right away, the larger levels
+// follow through a ring of pixel unpack buffers over later frames. Each ring slot is fenced
+// so it is only rewritten once the GPU has consumed it. With upload_context active the levels
+// go to its thread instead, all at once, each made the base level once its upload has signalled.
+// GL thread only.
+class TextureStreamer {
+public:
+    void init();
+    void shutdown();
+
+    // Allocates storage for every level, uploads the tail and queues the rest. Chains mapped
+    // from KTX2 files are handed to texture_residency instead of being queued.
+    // image must carry a mip chain (see generateMipChain); ownership moves to the streamer.
+    GLuint upload(ImageData&& image, const SamplerDesc& sampler);
+
+    // Streams queued levels until budget_bytes is spent or the ring is full
+    void update(size_t budget_bytes = TEXTURE_STREAM_FRAME_BUDGET);
+
+    // Copies one level through the ring and makes it the base level, allocating it first for
+    // mutable storage. False when every slot is still in flight. Used by texture_residency.
+    bool streamLevel(GLuint texture, const ImageData& image, int level, bool allocate);
+
+    // Drops queued levels of a texture that is being deleted
+    void cancel(GLuint texture);
+
+    size_t pendingCount() const { return pending.size() + background.size(); }
+
+private:
+    struct PendingTexture {
+        GLuint texture = 0;
+        std::shared_ptr<ImageData> image;
+        int next_level = 0; // Next level to stream, counting down to 0
+    };
+
+    struct RingSlot {
+        GLuint pbo = 0;
+        size_t capacity = 0;
+        GLsync fence = nullptr;
+    };
+
+    // A texture whose levels are with upload_context. The thread holds mutex while it writes a
+    // level, so cancel() can't return and let the texture's name be reused under it.
+    struct BackgroundTexture {
+        std::mutex mutex;
+        bool cancelled = false;
+    };
+
+    RingSlot* acquireSlot();
+    void uploadInBackground(const PendingTexture& entry);
+    void copyLevel(GLuint texture, const ImageData& image, int level, bool allocate, RingSlot& slot);
+    void uploadLevel(PendingTexture& entry, RingSlot& slot);
+
+    std::deque<PendingTexture> pending;
+    std::vector<RingSlot> ring;
+    size_t next_slot = 0;
+    std::unordered_map<GLuint, std::shared_ptr<BackgroundTexture>> background;
+};
+
+extern TextureStreamer texture_streamer;
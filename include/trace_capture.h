@@ -0,0 +1,80 @@
+#pragma once
+
+#include "profiler.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Captures a run of frames as Chrome trace-event JSON, for chrome://tracing or ui.perfetto.dev.
+// The main thread's track holds every profiler scope, the job system's workers and the asset
+// loader add spans on their own threads' tracks, and the scopes' GPU timestamps go on a GPU track
+// lined up with the CPU clock through GL_TIMESTAMP. The file is written once the last frame's GPU
+// times come back. WebGL2 has no timestamps, so its traces are CPU-only.
+#define TRACE_CAPTURE_FRAMES 60 // Frames per capture unless told otherwise
+
+class TraceCapture {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // GL thread. Captures the frames that begin after this one, turning the profiler on. False
+    // when a capture is already running.
+    bool start(const std::string& path, int frames = TRACE_CAPTURE_FRAMES);
+    bool capturing() const { return active.load(std::memory_order_relaxed); }
+
+    // Any thread: a span on the calling thread's track, dropped when not capturing. detail shows
+    // up as the event's argument, a file name for instance.
+    void event(const char* name, const char* category, Clock::time_point start, Clock::time_point end,
+               const std::string& detail = std::string());
+    // Any thread: the calling thread's track name, kept across captures
+    void nameThread(const std::string& name);
+
+private:
+    struct Event {
+        const char* name;
+        const char* category;
+        int thread;
+        double start_us, duration_us;
+        std::string detail;
+    };
+
+    void profiledFrame(const FrameProfiler::Frame& frame);
+    bool write();
+    double sinceEpoch(Clock::time_point time) const;
+
+    std::atomic<bool> active{false};
+    std::mutex mutex; // Guards events and thread_names, workers add to both
+    std::vector<Event> events;
+    std::vector<std::string> thread_names; // By track, empty for threads never named
+
+    std::string output_file;
+    int frames_wanted = 0;
+    uint64_t first_frame = 0, last_frame = 0; // gpu_queries.frame() ids captured
+    Clock::time_point epoch;  // The trace's zero
+    uint64_t gpu_epoch_ns = 0; // GPU clock at epoch, 0 leaves the GPU track out
+    bool registered = false;
+};
+
+extern TraceCapture trace_capture;
+
+// Times the rest of the enclosing block onto the calling thread's track while capturing
+class TraceScope {
+public:
+    TraceScope(const char* name, const char* category)
+        : name(name), category(category), start(trace_capture.capturing() ? TraceCapture::Clock::now() : TraceCapture::Clock::time_point()) {}
+    ~TraceScope() {
+        if (start != TraceCapture::Clock::time_point()) trace_capture.event(name, category, start, TraceCapture::Clock::now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    const char* category;
+    TraceCapture::Clock::time_point start;
+};
+
+#define TRACE_SCOPE(name, category) TraceScope PROFILE_CONCAT(trace_scope_, __LINE__)(name, category)
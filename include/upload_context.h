@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct GLFWwindow;
+
+// A second GL context, shared with the window's, current on a dedicated upload thread. Jobs run
+// there with it current and write into textures and buffers the GL thread created; each is fenced
+// once it ran, and its done callback runs on the GL thread in update() once that fence has
+// signalled, which is when the GL thread may use what it wrote. Jobs only reach the thread in
+// update(), after a flush, so objects the GL thread created or changed before submit() are
+// visible to them. Only objects are shared between the contexts, not state: vertex arrays and
+// framebuffers stay on the GL thread, and jobs set up their own bindings.
+// Under --upload-thread, native only; the web build streams through texture_streamer's pixel
+// unpack buffers. submit(), update() and shutdown() are GL thread only.
+class UploadContext {
+public:
+    UploadContext() = default;
+    UploadContext(const UploadContext&) = delete;
+    UploadContext& operator=(const UploadContext&) = delete;
+
+    // --upload-thread moves streamed texture levels off the GL thread
+    int parseArg(int argc, char** argv, int i);
+    bool requested() const { return enabled; }
+
+    // Creates the shared context and starts the thread, with window's context current. False
+    // when not requested or the context couldn't be made, uploads then stay on the GL thread.
+    bool init(GLFWwindow* window);
+    // Drops queued jobs, waits for the running one and destroys the context
+    void shutdown();
+
+    bool active() const { return context != nullptr; }
+
+    void submit(std::function<void()> job, std::function<void()> done);
+    // Once a frame: hands the new jobs to the thread and runs the done callbacks of finished ones
+    void update();
+
+    size_t pendingCount() const { return in_flight; }
+
+private:
+    struct Job {
+        std::function<void()> run;
+        std::function<void()> done;
+        GLsync fence = nullptr;
+    };
+
+    void threadMain();
+
+    bool enabled = false;
+    GLFWwindow* context = nullptr; // Hidden 1x1 window owning the shared context
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::deque<Job> submitted; // GL thread only, not yet flushed
+    std::deque<Job> queued;    // For the thread
+    std::deque<Job> finished;  // Fenced by the thread, oldest first
+    size_t in_flight = 0;      // GL thread only, submitted until done ran
+};
+
+extern UploadContext upload_context;
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "geometry_arena.h"
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#define VERTEX_PULL_INITIAL_VERTICES (256 * 1024)
+#define VERTEX_PULL_INITIAL_INDICES (1024 * 1024)
+
+// Storage buffer bindings res/shaders/include/vertex_pulling.glsl reads
+#define VERTEX_PULL_POSITION_BINDING 0
+#define VERTEX_PULL_UV_BINDING 1
+#define VERTEX_PULL_INDEX_BINDING 2
+#define VERTEX_PULL_INSTANCE_BINDING 3
+
+extern bool use_vertex_pulling; // Off draws the pooled meshes through their VAOs again
+
+// A mesh's place in the pool, index_count 0 = not pooled
+struct PulledGeometry {
+    uint32_t first_vertex = 0;
+    uint32_t vertex_count = 0;
+    uint32_t first_index = 0;
+    uint32_t index_count = 0;
+};
+
+// Layout glMultiDrawArraysIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawArraysIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+// Programmable vertex pulling for the depth-only passes, on GL 4.3 with ARB_shader_draw_parameters.
+// Under --vertex-pulling every uploaded mesh's positions, UVs and indices are also copied into three
+// storage buffers shared by all meshes, whatever their vertex format: positions and UVs as floats,
+// indices widened to 32 bits and rebased onto the pool's vertices. The prepass and shadow caster
+// DrawLists then draw with one empty VAO: each run of the same state is one
+// glMultiDrawArraysIndirect whose vertex shader reads the index at gl_VertexID, the vertex it names,
+// and the instance at gl_BaseInstanceARB + gl_InstanceID. Meshes of different arenas and vertex
+// formats (packed or not, half or float UVs, standalone buffers) share those draws, and no VAO is
+// bound between them. Lists holding a mesh that isn't pooled, the lit passes, and the skinned and
+// foliage casters keep their VAOs. GL thread only.
+class VertexPulling {
+public:
+    VertexPulling() = default;
+
+    VertexPulling(const VertexPulling&) = delete;
+    VertexPulling& operator=(const VertexPulling&) = delete;
+
+    // --vertex-pulling pools the meshes for the pulled depth passes
+    int parseArg(int argc, char** argv, int i);
+    bool requested() const { return enabled; }
+
+    static bool supported();
+    // Creates the pool when requested and supported, before any mesh is uploaded. False otherwise,
+    // meshes then aren't pooled.
+    bool init();
+    void release();
+
+    bool pooling() const { return vao != 0; }
+    bool active() const { return pooling() && use_vertex_pulling; }
+
+    // Copies a mesh's positions, UVs and indices in, growing the buffers if needed
+    bool add(const VertexLayout& layout, const void* vertices, size_t vertex_count, const void* indices, GLenum index_type,
+             size_t index_count, PulledGeometry& geometry);
+    void free(PulledGeometry& geometry);
+
+    // Binds the empty VAO and the pool's buffers, the caller binds the instances
+    void bind() const;
+
+    // A vertex shader source for the pulled path: its #version line swapped for GLSL 4.30 with the
+    // draw parameters and VERTEX_PULLING defined
+    static std::string pulledSource(const std::string& source);
+
+    size_t vertexCount() const { return vertex_ranges.used(); }
+    size_t indexCount() const { return index_ranges.used(); }
+
+private:
+    void growVertices(size_t min_vertices);
+    void growIndices(size_t min_indices);
+
+    bool enabled = false;
+    GLuint vao = 0; // No attributes, core profiles still want one bound to draw
+    GLuint position_buffer = 0;
+    GLuint uv_buffer = 0;
+    GLuint index_buffer = 0;
+    RangeAllocator vertex_ranges;
+    RangeAllocator index_ranges;
+};
+
+extern VertexPulling vertex_pulling;
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include "shader.h"
+
+struct LightBlock;
+
+extern bool use_volumetric_fog;
+extern bool use_volumetric_fog_temporal;   // Jitters the froxels in depth and blends with the last frame
+extern float volumetric_fog_density;       // Extinction per world unit at height 0
+extern float volumetric_fog_height_falloff; // Density falls by e every 1/falloff units above 0
+extern float volumetric_fog_anisotropy;    // Henyey-Greenstein g, positive scatters forward
+
+#define VOLUMETRIC_FOG_WIDTH 160        // Froxels across, ten per cluster tile (CLUSTER_X)
+#define VOLUMETRIC_FOG_HEIGHT 90        // Ten per CLUSTER_Y
+#define VOLUMETRIC_FOG_DEPTH 64         // Slices, on the clusters' exponential depth mapping
+#define VOLUMETRIC_FOG_UNIT 22          // Texture unit of the integrated volume, past the reflection probes
+#define VOLUMETRIC_FOG_HISTORY_WEIGHT 0.9f // Share of the reprojected last frame under use_volumetric_fog_temporal
+
+// Fog lit by the scene's lights in camera-aligned froxels, the view frustum cut like the light
+// clusters (light_clusters.h) but finer: VOLUMETRIC_FOG_WIDTH x HEIGHT x DEPTH cells, the same
+// log(depth) slice mapping, so each froxel walks the light list of the cluster it sits in. Once
+// per frame a scatter pass fills every froxel with its density and the light it scatters
+// towards the camera (directional and clustered lights, one shadow tap each, and the ambient
+// SH), and an integrate pass sums them front to back into in-scattered light and
+// transmittance. pbr.fs, the impostors and the sky then take one trilinear 3D lookup per pixel,
+// so the cost is the grid's and not the screen's. No compute shaders on GL 3.3 and WebGL2: both
+// passes are fullscreen triangles into a layer of the 3D target at a time, the integration
+// reading the scatter volume's earlier slices (a separate texture, layers of one texture can't
+// be read while another is drawn on WebGL2). Needs float colour targets like the atmosphere.
+// GL thread only.
+class VolumetricFog {
+public:
+    VolumetricFog() = default;
+    ~VolumetricFog();
+
+    VolumetricFog(const VolumetricFog&) = delete;
+    VolumetricFog& operator=(const VolumetricFog&) = delete;
+
+    // Turns the lookup on in the block when the fog is on and its targets exist, with the slice
+    // mapping of the clusters' depth scale and bias already in it
+    void fillLightBlock(LightBlock& block);
+    // After the shadow pass and the frame uniforms, with the shadow map on unit 4 and the light
+    // clusters on 6 to 8 as pbr.fs has them. Leaves the scene framebuffer bound and the viewport
+    // restored.
+    void render(const glm::mat4& view, const glm::mat4& view_projection);
+    // The integrated volume, rgb in-scattered light and a transmittance from the camera
+    void bind(int unit) const;
+    // For frames it didn't run, the next one starts without a history
+    void resetHistory() { history_valid = false; }
+    void release();
+
+private:
+    bool init();
+    GLuint createVolume();
+    void drawSlices(Shader& shader, GLuint target);
+
+    std::unique_ptr<Shader> scatter_shader;
+    std::unique_ptr<Shader> integrate_shader;
+    GLuint scatter_volumes[2] = {}; // This frame's and last frame's, swapped every frame
+    GLuint integrated_volume = 0;
+    GLuint fbo = 0;
+    GLuint vao = 0;
+    int current = 0;
+    bool failed = false;
+
+    bool history_valid = false;
+    glm::mat4 history_view{1.0f};
+    glm::mat4 history_view_projection{1.0f};
+    glm::vec2 history_depth{0.0f}; // The slice mapping's scale and bias last frame
+    glm::vec2 depth_mapping{0.0f}; // This frame's, from fillLightBlock()
+    uint32_t frame = 0;            // Steps the depth jitter
+};
+
+extern VolumetricFog volumetric_fog;
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "camera.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+
+#define WORLD_ORIGIN_REBASE_DISTANCE 2048.0f // Metres the camera strays along x or z before the origin follows
+#define WORLD_ORIGIN_SNAP 1024.0f            // Shifts are whole multiples, exact in floats
+
+extern bool use_origin_rebasing; // Off keeps the origin where it is however far the camera goes
+
+class Renderer;
+
+// Floating origin for large worlds. Everything on the CPU and GPU stays in single-precision floats
+// relative to a local origin, and the origin's own place in the world is a double. When the camera
+// strays WORLD_ORIGIN_REBASE_DISTANCE from it along x or z, the origin jumps to the camera's
+// nearest WORLD_ORIGIN_SNAP multiple and everything holding a position moves by the opposite:
+// the camera, the entities (children through their roots), the lights, the reflection probes, the
+// particle emitters, and the matrices TAA and Hi-Z keep from earlier frames, so the frame after a
+// shift reprojects like any other. Rendering then never sees a coordinate much past a few km,
+// where floats still resolve a fraction of a millimetre, and the streamed world (world_partition.h)
+// can be tens of km across without jitter. Heights aren't rebased, worlds are wide, not tall.
+// Systems laid out on a fixed ground frame (the terrain, foliage, physics bodies, skinned crowds)
+// don't follow a shift, nor do camera paths, so the caller holds the origin while any of them is in.
+// GL thread only.
+class WorldOrigin {
+public:
+    // The local origin's place in the world
+    const glm::dvec3& origin() const { return offset; }
+    glm::dvec3 toWorld(const glm::vec3& local) const { return offset + glm::dvec3(local); }
+    glm::vec3 toLocal(const glm::dvec3& world) const { return glm::vec3(world - offset); }
+
+    // Once a frame before the simulation input is built: the shift the camera's position calls
+    // for, zero when it's near enough or allowed is false
+    glm::vec3 rebaseFor(const glm::vec3& camera_position, bool allowed) const;
+    // Moves the origin by delta and everything listed above by -delta, the camera included
+    void shift(const glm::vec3& delta, Camera& camera, Renderer& renderer);
+
+    uint64_t shiftCount() const { return shifts; }
+
+private:
+    glm::dvec3 offset{0.0};
+    uint64_t shifts = 0;
+};
+
+extern WorldOrigin world_origin;
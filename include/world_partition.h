@@ -0,0 +1,91 @@
+#pragma once
+
+#include "scene_file.h"
+#include "entity_manager.h"
+#include <glm/glm.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#define WORLD_CELL_SIZE 64.0f          // Metres along a cell's side, the grid starts at the world origin
+#define WORLD_LOAD_RADIUS 160.0f       // Cells whose nearest point is closer than this get loaded
+#define WORLD_UNLOAD_MARGIN 48.0f      // And are only unloaded past the load radius plus this
+#define WORLD_MAX_LOADING 4            // Cells waiting on their models at once
+#define WORLD_DEFAULT_BUDGET_MB 512    // Estimated geometry of the resident cells without --world-budget
+#define WORLD_VIEW_PRIORITY 0.5f       // How much nearer a cell straight ahead counts than one behind
+
+extern bool use_world_streaming; // Off freezes the resident set, nothing loads or unloads
+
+// A large world split into square cells of WORLD_CELL_SIZE, each its own scene file (scene_file.h)
+// named cell_<x>_<z>.scene, or .scene.txt compiled on first load, in the world directory. A cell's
+// model table is its asset dependency list: loading a cell requests those models from the asset
+// loader, and once all of them are in its entities are created in one go from the mapped file.
+// Unloading removes the entities and drops the requests, so models no other cell uses leave with
+// the last entity (mesh_registry only holds weak references).
+// Around the camera, cells nearer than WORLD_LOAD_RADIUS are wanted and stay until they're past
+// the radius plus WORLD_UNLOAD_MARGIN, so walking along a border doesn't load and unload the same
+// cell over and over. Wanted cells load nearest first, with the ones in the view direction counted
+// nearer, at most WORLD_MAX_LOADING at a time and one instantiated per update. The resident set is
+// kept under a memory budget of estimated geometry bytes; a cell not loaded yet is estimated at
+// the average of those measured. Past the budget the lowest-priority cells aren't loaded, and
+// resident ones that lost to a better cell are unloaded, so memory and load time stay bounded
+// however large the world is. Cells are placed in world coordinates and created relative to the
+// floating origin (world_origin.h), so they stay precise far out; lights aren't streamed,
+// they belong in the --scene file. GL thread only, the models import on the job system.
+class WorldPartition {
+public:
+    WorldPartition() = default;
+
+    WorldPartition(const WorldPartition&) = delete;
+    WorldPartition& operator=(const WorldPartition&) = delete;
+
+    // --world <dir> streams the cells in dir, --world-budget <MB> sets the memory budget
+    int parseArg(int argc, char** argv, int i);
+    bool requested() const { return !directory.empty(); }
+
+    // Finds the cell files. False when the directory has none.
+    bool init();
+    // Once a frame: unloads what fell behind, starts the best cells that aren't there and
+    // instantiates one whose models are in
+    void update(const glm::vec3& camera_position, const glm::vec3& camera_front);
+    // Unloads every cell
+    void release();
+
+    size_t cellCount() const { return cells.size(); }
+    size_t residentCells() const { return resident; }
+    size_t loadingCells() const { return loading; }
+    uint64_t residentBytes() const { return resident_bytes; }
+    uint64_t budgetBytes() const { return budget_bytes; }
+
+private:
+    enum CellState { CELL_UNLOADED, CELL_LOADING, CELL_RESIDENT };
+
+    struct Cell {
+        std::string path;
+        CellState state = CELL_UNLOADED;
+        std::unique_ptr<SceneFile> scene;
+        std::vector<EntityHandle> entities;
+        uint64_t bytes = 0; // Estimated geometry, measured once it was resident
+        bool failed = false; // Its file didn't open, not tried again
+        float priority = 0.0f; // Effective distance this update, lower loads first
+    };
+
+    bool startLoad(Cell& cell);
+    void instantiate(Cell& cell);
+    void unload(Cell& cell);
+    uint64_t estimatedBytes(const Cell& cell) const;
+
+    std::string directory;
+    uint64_t budget_bytes = (uint64_t)WORLD_DEFAULT_BUDGET_MB * 1024 * 1024;
+    std::map<std::pair<int, int>, Cell> cells; // By grid coordinate
+    size_t resident = 0;
+    size_t loading = 0;
+    uint64_t resident_bytes = 0;
+    uint64_t measured_bytes = 0; // Of every cell measured, for the estimate of the others
+    size_t measured_cells = 0;
+};
+
+extern WorldPartition world_partition;
@@ -0,0 +1,60 @@
+// Multiple scattering LUT of atmosphere.glsl (Hillaire 2020, section 5.5), once per atmosphere:
+// the second order light arriving isotropically at each height and sun angle, summed over every
+// further order as the geometric series 1 / (1 - f). Drawn with hiz.vs.
+#include "include/atmosphere.glsl"
+
+#define MULTISCATTER_DIRECTIONS 8 // Squared, spread evenly over the sphere
+#define MULTISCATTER_STEPS 20
+
+uniform sampler2D transmittanceLut;
+
+out vec4 FragColor;
+
+void main() {
+    vec2 uv = (gl_FragCoord.xy - 0.5) / (MULTISCATTER_LUT_SIZE - 1.0);
+    float mu = uv.x * 2.0 - 1.0;
+    vec3 origin = vec3(0.0, mix(GROUND_RADIUS + 0.01, TOP_RADIUS - 0.01, uv.y), 0.0);
+    vec3 sunDirection = vec3(sqrt(max(1.0 - mu * mu, 0.0)), mu, 0.0);
+    const float isotropicPhase = 1.0 / (4.0 * ATMOSPHERE_PI);
+
+    vec3 luminance = vec3(0.0);
+    vec3 transfer = vec3(0.0);
+    for (int i = 0; i < MULTISCATTER_DIRECTIONS; ++i) {
+        for (int j = 0; j < MULTISCATTER_DIRECTIONS; ++j) {
+            float theta = 2.0 * ATMOSPHERE_PI * (float(i) + 0.5) / float(MULTISCATTER_DIRECTIONS);
+            float cosPhi = 1.0 - 2.0 * (float(j) + 0.5) / float(MULTISCATTER_DIRECTIONS);
+            float sinPhi = sqrt(max(1.0 - cosPhi * cosPhi, 0.0));
+            vec3 direction = vec3(sinPhi * cos(theta), cosPhi, sinPhi * sin(theta));
+
+            bool hitsGround;
+            float dt = rayLength(origin, direction, hitsGround) / float(MULTISCATTER_STEPS);
+            vec3 throughput = vec3(1.0);
+            vec3 L = vec3(0.0);
+            vec3 f = vec3(0.0);
+            for (int s = 0; s < MULTISCATTER_STEPS; ++s) {
+                vec3 position = origin + direction * ((float(s) + 0.5) * dt);
+                Medium m = sampleMedium(length(position) - GROUND_RADIUS);
+                vec3 scattering = m.rayleigh + vec3(m.mie);
+                vec3 extinction = max(m.extinction, vec3(1e-6));
+                vec3 stepTransmittance = exp(-extinction * dt);
+                // Energy-conserving over the step, the scattering integrated against the decay
+                vec3 S = scattering * isotropicPhase * sunTransmittance(transmittanceLut, position, sunDirection);
+                L += throughput * (S - S * stepTransmittance) / extinction;
+                f += throughput * (scattering - scattering * stepTransmittance) / extinction;
+                throughput *= stepTransmittance;
+            }
+            if (hitsGround) {
+                vec3 position = origin + direction * (dt * float(MULTISCATTER_STEPS));
+                vec3 normal = normalize(position);
+                L += throughput * sunTransmittance(transmittanceLut, position, sunDirection) *
+                     max(dot(normal, sunDirection), 0.0) * GROUND_ALBEDO / ATMOSPHERE_PI;
+            }
+            luminance += L;
+            transfer += f;
+        }
+    }
+    float sampleCount = float(MULTISCATTER_DIRECTIONS * MULTISCATTER_DIRECTIONS);
+    luminance /= sampleCount;
+    transfer /= sampleCount;
+    FragColor = vec4(luminance / max(1.0 - transfer, vec3(1e-3)), 1.0);
+}
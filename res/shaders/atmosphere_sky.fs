@@ -0,0 +1,53 @@
+// The sky from the sky-view LUT of atmosphere.glsl, a lookup or two per pixel. After skybox.vs
+// on the far plane, or with CUBE_FACE after hiz.vs into a face of the environment cube the IBL
+// is built from, which leaves the sun's disk to the directional light.
+#include "include/atmosphere.glsl"
+
+uniform sampler2D transmittanceLut;
+uniform sampler2D skyViewLut;
+uniform vec3 sunDirection;
+uniform vec3 sunIlluminance;
+uniform float sunDiskCos; // Cosine of the disk's angular radius
+
+#ifdef CUBE_FACE
+uniform int face;       // GL_TEXTURE_CUBE_MAP_POSITIVE_X + face
+uniform float faceSize;
+
+// Same face layout as the GL cube map lookup, as in ibl_prefilter.fs
+vec3 faceDirection(int f, vec2 st) {
+    if (f == 0) return vec3(1.0, -st.y, -st.x);
+    if (f == 1) return vec3(-1.0, -st.y, st.x);
+    if (f == 2) return vec3(st.x, 1.0, st.y);
+    if (f == 3) return vec3(st.x, -1.0, -st.y);
+    if (f == 4) return vec3(st.x, -st.y, 1.0);
+    return vec3(-st.x, -st.y, -1.0);
+}
+#else
+in vec3 TexCoords;
+
+#include "include/camera.glsl"
+#include "include/lights.glsl"
+#include "include/volumetric_fog.glsl"
+#endif
+
+out vec4 FragColor;
+
+void main() {
+#ifdef CUBE_FACE
+    vec3 direction = normalize(faceDirection(face, gl_FragCoord.xy / faceSize * 2.0 - 1.0));
+#else
+    vec3 direction = normalize(TexCoords);
+#endif
+    vec3 color = texture(skyViewLut, skyViewUV(direction)).rgb;
+
+#ifndef CUBE_FACE
+    // The disk through the air in front of it, its edge softened over a few percent of its radius
+    vec3 origin = vec3(0.0, GROUND_RADIUS + VIEW_ALTITUDE, 0.0);
+    float disk = smoothstep(sunDiskCos - (1.0 - sunDiskCos) * 0.1, sunDiskCos, dot(direction, sunDirection));
+    if (disk > 0.0 && raySphere(origin, direction, GROUND_RADIUS) < 0.0) {
+        color += disk * sunIlluminance * texture(transmittanceLut, transmittanceUV(length(origin), direction.y)).rgb;
+    }
+    color = applyVolumetricFogFar(color, direction);
+#endif
+    FragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,38 @@
+// Sky-view LUT of atmosphere.glsl: the sky's radiance around the viewer for the current sun,
+// single scattering marched per texel plus the multiple scattering LUT. Redrawn only when the sun
+// changes. Drawn with hiz.vs.
+#include "include/atmosphere.glsl"
+
+#define SKY_VIEW_STEPS 30
+
+uniform sampler2D transmittanceLut;
+uniform sampler2D multiscatterLut;
+uniform vec3 sunDirection;   // Towards the sun
+uniform vec3 sunIlluminance; // Colour and intensity at the top of the atmosphere
+
+out vec4 FragColor;
+
+void main() {
+    vec3 direction = skyViewDirection(gl_FragCoord.xy / SKY_VIEW_LUT_SIZE);
+    vec3 origin = vec3(0.0, GROUND_RADIUS + VIEW_ALTITUDE, 0.0);
+    bool hitsGround;
+    float dt = rayLength(origin, direction, hitsGround) / float(SKY_VIEW_STEPS);
+
+    float cosTheta = dot(direction, sunDirection);
+    float phaseR = rayleighPhase(cosTheta);
+    float phaseM = miePhase(cosTheta);
+    vec3 throughput = vec3(1.0);
+    vec3 L = vec3(0.0);
+    for (int s = 0; s < SKY_VIEW_STEPS; ++s) {
+        vec3 position = origin + direction * ((float(s) + 0.5) * dt);
+        Medium m = sampleMedium(length(position) - GROUND_RADIUS);
+        vec3 extinction = max(m.extinction, vec3(1e-6));
+        vec3 stepTransmittance = exp(-extinction * dt);
+        vec3 sun = sunTransmittance(transmittanceLut, position, sunDirection);
+        vec3 multiple = multipleScattering(multiscatterLut, position, sunDirection);
+        vec3 S = m.rayleigh * (phaseR * sun + multiple) + m.mie * (phaseM * sun + multiple);
+        L += throughput * (S - S * stepTransmittance) / extinction;
+        throughput *= stepTransmittance;
+    }
+    FragColor = vec4(L * sunIlluminance, 1.0);
+}
@@ -0,0 +1,21 @@
+// Transmittance LUT of atmosphere.glsl, once per atmosphere. Drawn with hiz.vs.
+#include "include/atmosphere.glsl"
+
+#define TRANSMITTANCE_STEPS 40
+
+out vec4 FragColor;
+
+void main() {
+    float r, mu;
+    transmittanceParams(gl_FragCoord.xy / TRANSMITTANCE_LUT_SIZE, r, mu);
+    vec3 origin = vec3(0.0, r, 0.0);
+    vec3 direction = vec3(sqrt(max(1.0 - mu * mu, 0.0)), mu, 0.0);
+    float dt = max(raySphere(origin, direction, TOP_RADIUS), 0.0) / float(TRANSMITTANCE_STEPS);
+
+    vec3 opticalDepth = vec3(0.0);
+    for (int i = 0; i < TRANSMITTANCE_STEPS; ++i) {
+        vec3 position = origin + direction * ((float(i) + 0.5) * dt);
+        opticalDepth += sampleMedium(length(position) - GROUND_RADIUS).extinction * dt;
+    }
+    FragColor = vec4(exp(-opticalDepth), 1.0);
+}
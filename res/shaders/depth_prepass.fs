@@ -1,12 +1,24 @@
+// ALPHA_TEST: MASKED materials and dithered LOD fades. Opaque draws get the empty body, which
+// drivers run as depth-only.
+#ifdef ALPHA_TEST
 in vec2 TexCoord;
+flat in float LodFade;
 uniform sampler2D albedoMap;
 uniform bool hasAlbedoMap;
 
+#include "include/lod_fade.glsl"
+
+#endif
+
 void main() {
+#ifdef ALPHA_TEST
+    if (lodFadeDiscard(LodFade)) discard;
+
     // Only test alpha for transparency
     if (hasAlbedoMap) {
         float alpha = texture(albedoMap, TexCoord).a;
         if (alpha < 0.5) discard;
     }
+#endif
     // Depth is written automatically - no color output needed
 }
\ No newline at end of file
@@ -1,13 +1,28 @@
+// Without ALPHA_TEST only the position is read, for opaque draws' depth-only program.
+// VERTEX_PULLING reads the same from the pool's storage buffers instead (vertex_pulling.h).
+#ifdef VERTEX_PULLING
+#include "include/vertex_pulling.glsl"
+#else
 layout(location = 0) in vec3 aPos;
+#ifdef ALPHA_TEST
 layout(location = 2) in vec2 aTexCoords;
-layout(location = 6) in mat4 instanceMatrix;
-
+layout(location = 10) in float aLodFade;
+#endif
+#endif
+#ifdef ALPHA_TEST
 out vec2 TexCoord;
+flat out float LodFade;
+#endif
 
-uniform mat4 view;
-uniform mat4 projection;
+#include "include/camera.glsl"
+#ifndef VERTEX_PULLING
+#include "include/instance.glsl"
+#endif
 
 void main() {
+#ifdef ALPHA_TEST
     TexCoord = aTexCoords;
-    gl_Position = projection * view * instanceMatrix * vec4(aPos, 1.0);
+    LodFade = aLodFade;
+#endif
+    gl_Position = projection * view * instanceModel() * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,26 @@
+// The source's base level is the previous mip, so lod 0 always reads it
+uniform sampler2D source;
+uniform int reduce; // 0 copies the depth texture 1:1
+
+out float Depth;
+
+void main() {
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    if (reduce == 0) {
+        Depth = texelFetch(source, coord, 0).r;
+        return;
+    }
+
+    ivec2 size = textureSize(source, 0);
+    ivec2 base = coord * 2;
+    // Odd sizes fold the last row or column into the last output texel
+    ivec2 last = min(base + 1 + ivec2(equal(coord, max(size / 2, 1) - 1)) * (size & 1), size - 1);
+
+    float depth = 0.0;
+    for (int y = base.y; y <= last.y; ++y) {
+        for (int x = base.x; x <= last.x; ++x) {
+            depth = max(depth, texelFetch(source, ivec2(x, y), 0).r);
+        }
+    }
+    Depth = depth;
+}
@@ -0,0 +1,90 @@
+// One face of one mip of the prefiltered specular cube, see ibl.h. Drawn with hiz.vs.
+uniform highp samplerCube environment; // The skybox, with mips
+uniform int face;                      // GL_TEXTURE_CUBE_MAP_POSITIVE_X + face
+uniform float faceSize;                // Of the target mip
+uniform float roughness;
+uniform float sourceSize;              // Of the skybox's top mip
+uniform int sampleCount;
+
+out vec4 FragColor;
+
+const float PI = 3.14159265359;
+
+// Same face layout as the GL cube map lookup, s and t in [-1, 1]
+vec3 faceDirection(int f, vec2 st) {
+    if (f == 0) return vec3(1.0, -st.y, -st.x);
+    if (f == 1) return vec3(-1.0, -st.y, st.x);
+    if (f == 2) return vec3(st.x, 1.0, st.y);
+    if (f == 3) return vec3(st.x, -1.0, -st.y);
+    if (f == 4) return vec3(st.x, -st.y, 1.0);
+    return vec3(-st.x, -st.y, -1.0);
+}
+
+float radicalInverse(uint bits) {
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10;
+}
+
+vec3 importanceSampleGGX(vec2 xi, vec3 N, float a) {
+    float phi = 2.0 * PI * xi.x;
+    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (a * a - 1.0) * xi.y));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    vec3 H = vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
+
+    vec3 up = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, N));
+    vec3 bitangent = cross(N, tangent);
+    return normalize(tangent * H.x + bitangent * H.y + N * H.z);
+}
+
+// The skybox is sRGB, sampling decodes it
+vec3 radiance(vec3 direction, float lod) {
+    return textureLod(environment, direction, lod).rgb;
+}
+
+void main() {
+    vec2 st = gl_FragCoord.xy / faceSize * 2.0 - 1.0;
+    vec3 N = normalize(faceDirection(face, st));
+
+    vec3 color;
+    if (roughness == 0.0) {
+        color = radiance(N, 0.0);
+    } else {
+        // V = N, the usual split-sum simplification
+        float a = roughness * roughness;
+        float texelSolidAngle = 4.0 * PI / (6.0 * sourceSize * sourceSize);
+        vec3 sum = vec3(0.0);
+        float weight = 0.0;
+        for (int i = 0; i < sampleCount; ++i) {
+            vec2 xi = vec2(float(i) / float(sampleCount), radicalInverse(uint(i)));
+            vec3 H = importanceSampleGGX(xi, N, a);
+            vec3 L = normalize(2.0 * dot(N, H) * H - N);
+            float NdotL = dot(N, L);
+            if (NdotL <= 0.0) continue;
+
+            // Reads the mip whose texels cover the sample's share of the lobe, so few samples
+            // don't alias (GPU Gems 3, ch. 20)
+            float NdotH = max(dot(N, H), 0.0);
+            float a2 = a * a;
+            float denom = NdotH * NdotH * (a2 - 1.0) + 1.0;
+            float D = a2 / (PI * denom * denom);
+            float pdf = D / 4.0 + 0.0001; // D * NdotH / (4 * HdotV) with V = N
+            float sampleSolidAngle = 1.0 / (float(sampleCount) * pdf + 0.0001);
+            float lod = max(0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0, 0.0);
+
+            sum += radiance(L, lod) * NdotL;
+            weight += NdotL;
+        }
+        color = sum / max(weight, 0.0001);
+    }
+#ifdef LINEAR_OUTPUT
+    // Reflection probes (reflection_probes.h) keep their float captures linear
+    FragColor = vec4(color, 1.0);
+#else
+    FragColor = vec4(pow(color, vec3(1.0 / 2.2)), 1.0);
+#endif
+}
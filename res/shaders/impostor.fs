@@ -0,0 +1,44 @@
+in vec2 FrameLocal[4];
+flat in vec2 FrameCell[4];
+in vec4 FrameWeights;
+in vec3 FragPos;
+in mat3 MeshToWorld;
+flat in float LodFade;
+
+out vec4 FragColor;
+
+uniform sampler2D albedoAtlas;
+uniform sampler2D normalDepthAtlas;
+uniform float frames;
+
+#include "include/camera.glsl"
+#include "include/lights.glsl"
+#include "include/volumetric_fog.glsl"
+#include "include/lod_fade.glsl"
+
+void main() {
+    if (lodFadeDiscard(LodFade)) discard;
+
+    // Half a texel of padding keeps samples inside their own frame
+    float inset = 0.5 / float(textureSize(albedoAtlas, 0).x) * frames;
+    vec4 albedo = vec4(0.0);
+    vec3 normal = vec3(0.0);
+    for (int k = 0; k < 4; k++) {
+        vec2 uv = (FrameCell[k] + clamp(FrameLocal[k], inset, 1.0 - inset)) / frames;
+        albedo += texture(albedoAtlas, uv) * FrameWeights[k];
+        normal += (texture(normalDepthAtlas, uv).xyz * 2.0 - 1.0) * FrameWeights[k];
+    }
+    if (albedo.a < 0.5) discard;
+    albedo.rgb /= albedo.a; // Empty texels are black, renormalise the blend
+
+    vec3 N = normalize(MeshToWorld * normal);
+    // First scene light only, the same cheap model pbr.fs uses at range
+    Light light = lights[0];
+    vec3 L = light.position.w < 0.5 ? normalize(-light.direction.xyz) : normalize(light.position.xyz - FragPos);
+    float NdotL = max(dot(N, L), 0.0);
+    float intensity = lightCount > 0 ? light.color.w : 0.0;
+    vec3 color = albedo.rgb * light.color.rgb * (intensity * 0.01) * NdotL;
+    color += vec3(0.2) * albedo.rgb;  // Ambient
+
+    FragColor = vec4(applyVolumetricFog(color, FragPos), 1.0);
+}
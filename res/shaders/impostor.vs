@@ -0,0 +1,72 @@
+layout(location = 0) in vec2 aCorner; // Quad corner in [-1, 1]
+layout(location = 10) in float aLodFade;
+
+out vec2 FrameLocal[4];
+flat out vec2 FrameCell[4];
+out vec4 FrameWeights;
+out vec3 FragPos;
+out mat3 MeshToWorld;
+flat out float LodFade;
+
+#include "include/camera.glsl"
+#ifdef FOLIAGE
+// Far cards don't sway
+#include "include/foliage.glsl"
+#else
+#include "include/instance.glsl"
+#endif
+
+uniform vec3 boundsCenter;
+uniform float boundsRadius;
+uniform float frames;
+
+// Must match impostorFrameDirection() / impostorFrameBasis() in impostor.cpp
+vec2 hemiOctEncode(vec3 d) {
+    d.y = max(d.y, 0.0);
+    d /= abs(d.x) + abs(d.y) + abs(d.z);
+    return vec2(d.x + d.z, d.x - d.z) * 0.5 + 0.5;
+}
+
+vec3 hemiOctDecode(vec2 uv) {
+    vec2 e = uv * 2.0 - 1.0;
+    vec2 p = vec2(e.x + e.y, e.x - e.y) * 0.5;
+    return normalize(vec3(p.x, max(1.0 - abs(p.x) - abs(p.y), 0.0), p.y));
+}
+
+void frameBasis(vec3 direction, out vec3 right, out vec3 up) {
+    vec3 worldUp = abs(direction.y) > 0.999 ? vec3(0.0, 0.0, -1.0) : vec3(0.0, 1.0, 0.0);
+    right = normalize(cross(-direction, worldUp));
+    up = cross(right, -direction);
+}
+
+void main() {
+    mat4 model = instanceModel();
+    float scale = length(model[0].xyz);
+    mat3 rotation = mat3(model) / scale;
+    vec3 centerWorld = (model * vec4(boundsCenter, 1.0)).xyz;
+
+    // View direction in mesh space picks the frames and orients the card
+    vec3 viewDir = normalize(transpose(rotation) * (viewPos - centerWorld));
+    vec3 right, up;
+    frameBasis(viewDir, right, up);
+    vec3 offset = (right * aCorner.x + up * aCorner.y) * boundsRadius;
+
+    // Bilinear blend of the four surrounding frames
+    vec2 grid = hemiOctEncode(viewDir) * (frames - 1.0);
+    vec2 base = clamp(floor(grid), vec2(0.0), vec2(frames - 2.0));
+    vec2 f = clamp(grid - base, 0.0, 1.0);
+    FrameWeights = vec4((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+
+    for (int k = 0; k < 4; k++) {
+        vec2 cell = base + vec2(float(k & 1), float(k >> 1));
+        vec3 frameRight, frameUp;
+        frameBasis(hemiOctDecode(cell / (frames - 1.0)), frameRight, frameUp);
+        FrameLocal[k] = vec2(dot(offset, frameRight), dot(offset, frameUp)) / boundsRadius * 0.5 + 0.5;
+        FrameCell[k] = cell;
+    }
+
+    MeshToWorld = rotation;
+    LodFade = aLodFade;
+    FragPos = (model * vec4(boundsCenter + offset, 1.0)).xyz;
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
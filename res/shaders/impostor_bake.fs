@@ -0,0 +1,22 @@
+in vec2 TexCoord;
+in vec3 Normal;
+in float FrameDepth;
+
+layout(location = 0) out vec4 outAlbedo;
+layout(location = 1) out vec4 outNormalDepth;
+
+uniform sampler2D albedoMap;
+uniform bool hasAlbedoMap;
+uniform vec3 baseColor;
+
+void main() {
+    vec4 albedo = hasAlbedoMap ? texture(albedoMap, TexCoord) : vec4(baseColor, 1.0);
+    if (albedo.a < 0.5) discard;
+
+    // Leaves are double sided, bake the side facing the frame
+    vec3 N = normalize(Normal);
+    if (!gl_FrontFacing) N = -N;
+
+    outAlbedo = vec4(albedo.rgb, 1.0);
+    outNormalDepth = vec4(N * 0.5 + 0.5, clamp(FrameDepth, 0.0, 1.0));
+}
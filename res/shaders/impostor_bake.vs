@@ -0,0 +1,20 @@
+layout(location = 0) in vec3 aPos;
+layout(location = 2) in vec2 aTexCoords;
+layout(location = 3) in vec3 aNormal;
+
+out vec2 TexCoord;
+out vec3 Normal;
+out float FrameDepth;
+
+uniform mat4 viewProjection;
+uniform vec3 frameDirection;
+uniform vec3 boundsCenter;
+uniform float boundsRadius;
+
+void main() {
+    TexCoord = aTexCoords;
+    Normal = aNormal;
+    // Distance towards the viewer across the bounding sphere, 0.5 at the centre
+    FrameDepth = dot(aPos - boundsCenter, frameDirection) / boundsRadius * 0.5 + 0.5;
+    gl_Position = viewProjection * vec4(aPos, 1.0);
+}
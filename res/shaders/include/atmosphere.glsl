@@ -0,0 +1,145 @@
+// An Earth-like atmosphere after Hillaire, "A Scalable and Production Ready Sky and Atmosphere
+// Rendering Technique" (EGSR 2020). Distances in km from the planet's centre, coefficients per
+// km. The LUT sizes must match atmosphere.h.
+#define ATMOSPHERE_PI 3.14159265359
+#define GROUND_RADIUS 6360.0
+#define TOP_RADIUS 6460.0
+#define TRANSMITTANCE_LUT_SIZE vec2(256.0, 64.0)
+#define MULTISCATTER_LUT_SIZE 32.0
+#define SKY_VIEW_LUT_SIZE vec2(192.0, 108.0)
+#define VIEW_ALTITUDE 0.2 // The scene spans metres, the viewer stays put at this height
+
+const vec3 RAYLEIGH_SCATTERING = vec3(5.802, 13.558, 33.1) * 1e-3;
+const float RAYLEIGH_SCALE_HEIGHT = 8.0;
+const float MIE_SCATTERING = 3.996e-3;
+const float MIE_EXTINCTION = 4.40e-3;
+const float MIE_SCALE_HEIGHT = 1.2;
+const float MIE_ASYMMETRY = 0.8;
+const vec3 OZONE_ABSORPTION = vec3(0.650, 1.881, 0.085) * 1e-3; // A tent 30 km wide around 25 km
+const vec3 GROUND_ALBEDO = vec3(0.3);
+
+struct Medium {
+    vec3 rayleigh;
+    float mie;
+    vec3 extinction;
+};
+
+Medium sampleMedium(float height) {
+    float rayleighDensity = exp(-height / RAYLEIGH_SCALE_HEIGHT);
+    float mieDensity = exp(-height / MIE_SCALE_HEIGHT);
+    float ozoneDensity = max(0.0, 1.0 - abs(height - 25.0) / 15.0);
+    Medium m;
+    m.rayleigh = RAYLEIGH_SCATTERING * rayleighDensity;
+    m.mie = MIE_SCATTERING * mieDensity;
+    m.extinction = m.rayleigh + MIE_EXTINCTION * mieDensity + OZONE_ABSORPTION * ozoneDensity;
+    return m;
+}
+
+// Distance along the ray to where it first crosses the sphere around the planet's centre, -1 if never
+float raySphere(vec3 origin, vec3 direction, float radius) {
+    float b = dot(origin, direction);
+    float c = dot(origin, origin) - radius * radius;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0) return -1.0;
+    float s = sqrt(discriminant);
+    if (-b - s > 0.0) return -b - s;
+    return -b + s > 0.0 ? -b + s : -1.0;
+}
+
+// Where the ray leaves the atmosphere or meets the ground, whichever comes first
+float rayLength(vec3 origin, vec3 direction, out bool hitsGround) {
+    float ground = raySphere(origin, direction, GROUND_RADIUS);
+    hitsGround = ground > 0.0;
+    return hitsGround ? ground : max(raySphere(origin, direction, TOP_RADIUS), 0.0);
+}
+
+float rayleighPhase(float cosTheta) {
+    return 3.0 / (16.0 * ATMOSPHERE_PI) * (1.0 + cosTheta * cosTheta);
+}
+
+// Cornette-Shanks
+float miePhase(float cosTheta) {
+    float g = MIE_ASYMMETRY;
+    float g2 = g * g;
+    float k = 3.0 / (8.0 * ATMOSPHERE_PI) * (1.0 - g2) / (2.0 + g2);
+    return k * (1.0 + cosTheta * cosTheta) / pow(1.0 + g2 - 2.0 * g * cosTheta, 1.5);
+}
+
+// Transmittance LUT: to the top of the atmosphere from radius r at view zenith cosine mu, with
+// Bruneton's mapping that spends the texels near the horizon
+vec2 transmittanceUV(float r, float mu) {
+    float H = sqrt(TOP_RADIUS * TOP_RADIUS - GROUND_RADIUS * GROUND_RADIUS);
+    float rho = sqrt(max(r * r - GROUND_RADIUS * GROUND_RADIUS, 0.0));
+    float discriminant = r * r * (mu * mu - 1.0) + TOP_RADIUS * TOP_RADIUS;
+    float d = max(0.0, -r * mu + sqrt(max(discriminant, 0.0)));
+    float dMin = TOP_RADIUS - r;
+    float dMax = rho + H;
+    return vec2((d - dMin) / (dMax - dMin), rho / H);
+}
+
+void transmittanceParams(vec2 uv, out float r, out float mu) {
+    float H = sqrt(TOP_RADIUS * TOP_RADIUS - GROUND_RADIUS * GROUND_RADIUS);
+    float rho = H * uv.y;
+    r = sqrt(rho * rho + GROUND_RADIUS * GROUND_RADIUS);
+    float dMin = TOP_RADIUS - r;
+    float dMax = rho + H;
+    float d = dMin + uv.x * (dMax - dMin);
+    mu = d == 0.0 ? 1.0 : clamp((H * H - rho * rho - d * d) / (2.0 * r * d), -1.0, 1.0);
+}
+
+// Sunlight reaching position, black in the planet's shadow
+vec3 sunTransmittance(sampler2D transmittanceLut, vec3 position, vec3 sunDirection) {
+    float r = length(position);
+    vec3 up = position / r;
+    if (raySphere(position, sunDirection, GROUND_RADIUS) > 0.0) return vec3(0.0);
+    return texture(transmittanceLut, transmittanceUV(r, dot(up, sunDirection))).rgb;
+}
+
+// Multiple scattering LUT: sun zenith cosine across, height up
+vec3 multipleScattering(sampler2D multiscatterLut, vec3 position, vec3 sunDirection) {
+    float r = length(position);
+    float mu = dot(position / r, sunDirection);
+    vec2 uv = vec2(mu * 0.5 + 0.5, (r - GROUND_RADIUS) / (TOP_RADIUS - GROUND_RADIUS));
+    // Texel centres at the ends
+    uv = (uv * (MULTISCATTER_LUT_SIZE - 1.0) + 0.5) / MULTISCATTER_LUT_SIZE;
+    return texture(multiscatterLut, uv).rgb;
+}
+
+// Sky-view LUT: azimuth across, the view zenith angle up with the horizon in the middle and the
+// rows packed towards it, where the sky changes fastest
+vec2 skyViewUV(vec3 direction) {
+    float r = GROUND_RADIUS + VIEW_ALTITUDE;
+    float horizonCos = sqrt(r * r - GROUND_RADIUS * GROUND_RADIUS) / r;
+    float beta = acos(horizonCos);
+    float zenithHorizonAngle = ATMOSPHERE_PI - beta;
+    float viewZenithAngle = acos(clamp(direction.y, -1.0, 1.0));
+    float v;
+    if (viewZenithAngle < zenithHorizonAngle) {
+        float coord = 1.0 - sqrt(max(1.0 - viewZenithAngle / zenithHorizonAngle, 0.0));
+        v = coord * 0.5;
+    } else {
+        float coord = sqrt(max((viewZenithAngle - zenithHorizonAngle) / beta, 0.0));
+        v = coord * 0.5 + 0.5;
+    }
+    float u = atan(direction.z, direction.x) / (2.0 * ATMOSPHERE_PI) + 0.5;
+    return vec2(u, (v * (SKY_VIEW_LUT_SIZE.y - 1.0) + 0.5) / SKY_VIEW_LUT_SIZE.y);
+}
+
+vec3 skyViewDirection(vec2 uv) {
+    float r = GROUND_RADIUS + VIEW_ALTITUDE;
+    float horizonCos = sqrt(r * r - GROUND_RADIUS * GROUND_RADIUS) / r;
+    float beta = acos(horizonCos);
+    float zenithHorizonAngle = ATMOSPHERE_PI - beta;
+    float v = clamp((uv.y * SKY_VIEW_LUT_SIZE.y - 0.5) / (SKY_VIEW_LUT_SIZE.y - 1.0), 0.0, 1.0);
+    float viewZenithAngle;
+    if (v < 0.5) {
+        float coord = 1.0 - v * 2.0;
+        viewZenithAngle = zenithHorizonAngle * (1.0 - coord * coord);
+    } else {
+        float coord = v * 2.0 - 1.0;
+        viewZenithAngle = zenithHorizonAngle + beta * coord * coord;
+    }
+    float azimuth = (uv.x - 0.5) * 2.0 * ATMOSPHERE_PI;
+    float s = sin(viewZenithAngle);
+    return vec3(s * cos(azimuth), cos(viewZenithAngle), s * sin(azimuth));
+}
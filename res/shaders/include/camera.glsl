@@ -0,0 +1,7 @@
+// Per-frame camera, must match CameraBlock in frame_uniforms.h
+layout(std140) uniform CameraBlock {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 viewPos;
+};
@@ -0,0 +1,43 @@
+// Foliage instances (foliage.h) in place of instance.glsl's transforms: slot 6 the base position,
+// slot 7 the yaw in turns and the scale over FOLIAGE_MAX_SCALE. Must match FoliageInstance.
+#define FOLIAGE_MAX_SCALE 4.0
+
+layout(location = 6) in vec3 foliagePosition;
+layout(location = 7) in vec2 foliageYawScale;
+
+uniform vec4 foliageWind;    // World xz direction, bend at the top in metres (0 is rigid), time in seconds
+uniform float foliageHeight; // Mesh-space height of the top the bend is measured at
+
+mat4 instanceModel() {
+    float yaw = foliageYawScale.x * 6.2831853;
+    float scale = foliageYawScale.y * FOLIAGE_MAX_SCALE;
+    float c = cos(yaw) * scale;
+    float s = sin(yaw) * scale;
+    return mat4(vec4(c, 0.0, -s, 0.0), vec4(0.0, scale, 0.0, 0.0), vec4(s, 0.0, c, 0.0), vec4(foliagePosition, 1.0));
+}
+
+// A yaw and a uniform scale, the rotation alone turns the normals
+mat3 instanceNormalMatrix() {
+    float yaw = foliageYawScale.x * 6.2831853;
+    return mat3(vec3(cos(yaw), 0.0, -sin(yaw)), vec3(0.0, 1.0, 0.0), vec3(sin(yaw), 0.0, cos(yaw)));
+}
+
+// Sways a mesh-space position downwind, quadratically with its height so the base stays put.
+// A steady lean plus two gusts out of phase across the field, each instance a little apart.
+vec3 foliageBend(vec3 position) {
+    if (foliageWind.z == 0.0) return position;
+    float h = clamp(position.y / foliageHeight, 0.0, 1.0);
+    float phase = dot(foliagePosition.xz, vec2(0.21, 0.17)) + foliageYawScale.x * 6.2831853;
+    float t = foliageWind.w;
+    float sway = 0.4 + 0.45 * sin(t * 1.3 + phase) + 0.15 * sin(t * 3.7 + phase * 2.3);
+    float bend = foliageWind.z * sway * h * h;
+
+    // Into mesh space, undoing the yaw and the scale
+    float yaw = foliageYawScale.x * 6.2831853;
+    float scale = foliageYawScale.y * FOLIAGE_MAX_SCALE;
+    vec2 direction = vec2(cos(yaw) * foliageWind.x - sin(yaw) * foliageWind.y, sin(yaw) * foliageWind.x + cos(yaw) * foliageWind.y);
+    position.xz += direction * (bend / max(scale, 1e-3));
+    // Roughly keeps the length, the tip dips as it leans
+    position.y -= 0.5 * bend * bend / max(scale * scale * foliageHeight, 1e-3) * h;
+    return position;
+}
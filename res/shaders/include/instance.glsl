@@ -0,0 +1,16 @@
+// Per-instance transform in slots 6-9, InstanceTransform in geometry_arena.h: the model matrix's
+// top three rows, then the inverse squared scale of each upper column relative to the largest
+layout(location = 6) in vec4 instanceRow0;
+layout(location = 7) in vec4 instanceRow1;
+layout(location = 8) in vec4 instanceRow2;
+layout(location = 9) in vec4 instanceNormalScale;
+
+mat4 instanceModel() {
+    return transpose(mat4(instanceRow0, instanceRow1, instanceRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+// Inverse transpose of the upper 3x3 up to a scale, entity matrices being translate * rotate * scale
+mat3 instanceNormalMatrix() {
+    mat3 upper = transpose(mat3(instanceRow0.xyz, instanceRow1.xyz, instanceRow2.xyz));
+    return mat3(upper[0] * instanceNormalScale.x, upper[1] * instanceNormalScale.y, upper[2] * instanceNormalScale.z);
+}
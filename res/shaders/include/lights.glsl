@@ -0,0 +1,24 @@
+#include "limits.glsl"
+
+// Must match GpuLight / LightBlock in frame_uniforms.h
+struct Light {
+    vec4 position;  // w = type: 0 directional, 1 point, 2 spot
+    vec4 color;     // w = intensity
+    vec4 direction; // w = inner cutoff cosine
+    vec4 cutoff;    // x = outer cutoff cosine, y = frame light index or -1, z = range, w = 1 if baked
+};
+layout(std140) uniform LightBlock {
+    Light lights[MAX_LIGHTS]; // Directional ones first, only those are shaded per fragment
+    int lightCount;
+    int clusterLightCount;
+    float clusterDepthScale;
+    float clusterDepthBias;
+    vec4 ambientSH[9];
+    float ambientIntensity;
+    float ambientSpecularLod;
+    int reflectionProbeCount;
+    int volumetricFog;                             // 1 when volumetricFog is bound
+    vec4 reflectionProbes[REFLECTION_PROBE_SLOTS]; // xyz centre, w radius
+    float volumetricDepthScale;                    // The froxel volume's w: log(depth) * scale + bias
+    float volumetricDepthBias;
+};
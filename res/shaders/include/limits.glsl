@@ -0,0 +1,4 @@
+// Must match FRAME_UNIFORMS_MAX_LIGHTS, REFLECTION_PROBE_SLOTS and SHADOW_MAX_VIEWS in frame_uniforms.h
+#define MAX_LIGHTS 8
+#define SHADOW_MAX_VIEWS 16
+#define REFLECTION_PROBE_SLOTS 2
@@ -0,0 +1,14 @@
+// Screen-door LOD cross-fade, shared by every pass that draws fading levels so the depth
+// prepass and the colour pass discard the same pixels and GL_EQUAL still passes.
+// fade > 0 keeps pixels below the threshold, fade < 0 keeps the complement, 0 keeps everything.
+bool lodFadeDiscard(float fade) {
+    if (fade == 0.0) return false;
+    const float bayer[16] = float[16](
+         0.0,  8.0,  2.0, 10.0,
+        12.0,  4.0, 14.0,  6.0,
+         3.0, 11.0,  1.0,  9.0,
+        15.0,  7.0, 13.0,  5.0);
+    ivec2 p = ivec2(gl_FragCoord.xy) & 3;
+    float threshold = (bayer[p.y * 4 + p.x] + 0.5) / 16.0;
+    return fade > 0.0 ? threshold >= fade : threshold < -fade;
+}
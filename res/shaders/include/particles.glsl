@@ -0,0 +1,53 @@
+// One particle step, shared by particle_update.vs (transform feedback) and particle_update.comp.
+// See particles.h: positionAge holds the position and the age in seconds, velocityLife the
+// velocity and the lifetime. A particle is dead once its age reaches its lifetime.
+uniform int firstParticle; // The emitter's range in the buffer
+uniform int particleCount;
+uniform int spawnCursor;   // The range's slots from here on, wrapping, respawn this step
+uniform int spawnCount;
+uniform int seed;
+uniform float deltaTime;
+uniform vec3 emitterPosition;
+uniform float spawnRadius;
+uniform vec2 lifetimeRange;
+uniform vec3 emitterVelocity;
+uniform float velocitySpread;
+uniform vec3 acceleration;
+uniform float drag;
+
+// PCG hash
+uint hashUint(uint x) {
+    uint state = x * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random01(inout uint state) {
+    state = hashUint(state);
+    return float(state >> 8u) / 16777216.0;
+}
+
+// Uniform within the unit sphere
+vec3 randomInSphere(inout uint state) {
+    float z = random01(state) * 2.0 - 1.0;
+    float angle = random01(state) * 6.2831853;
+    float r = sqrt(max(0.0, 1.0 - z * z));
+    return vec3(r * cos(angle), r * sin(angle), z) * pow(random01(state), 1.0 / 3.0);
+}
+
+void simulateParticle(int index, inout vec4 positionAge, inout vec4 velocityLife) {
+    int local = index - firstParticle;
+    if ((local - spawnCursor + particleCount) % particleCount < spawnCount) {
+        uint state = hashUint(uint(index) ^ hashUint(uint(seed)));
+        positionAge = vec4(emitterPosition + randomInSphere(state) * spawnRadius, 0.0);
+        velocityLife = vec4(emitterVelocity + randomInSphere(state) * velocitySpread,
+                            mix(lifetimeRange.x, lifetimeRange.y, random01(state)));
+        return;
+    }
+    // Dead, until the cursor comes round to its slot again
+    if (positionAge.w >= velocityLife.w) return;
+
+    vec3 velocity = (velocityLife.xyz + acceleration * deltaTime) * max(0.0, 1.0 - drag * deltaTime);
+    positionAge += vec4(velocity * deltaTime, deltaTime);
+    velocityLife.xyz = velocity;
+}
@@ -0,0 +1,13 @@
+#include "limits.glsl"
+
+// Must match ShadowBlock in frame_uniforms.h
+layout(std140) uniform ShadowBlock {
+    mat4 lightSpaceMatrices[SHADOW_MAX_VIEWS];
+    vec4 shadowTiles[SHADOW_MAX_VIEWS];      // Atlas tile in uv: xy corner, z size, w layer
+    vec4 shadowViewParams[SHADOW_MAX_VIEWS]; // x world receiver offset, y view depth where a cascade ends
+    ivec4 lightShadows[MAX_LIGHTS];          // x first view, y view count (0 = unshadowed), z kind
+    int shadowViewCount;
+    int shadowFilterQuality;
+    vec2 shadowMomentExponents;              // EVSM warps, positive and negative
+    int shadowMaxFilterTaps;
+};
@@ -0,0 +1,41 @@
+// Linear blend skinning from a bone palette (skinning.h). Each palette row is one instance's
+// bones, three texels per bone holding the top three rows of its matrix like InstanceTransform.
+// paletteBase is the draw's first row, the draw's instances following it in order.
+// With bakedFrames set the palette is a baked clip instead, a row per frame, and each instance
+// plays it from its own offset and speed against animationTime.
+layout(location = 12) in vec2 aPlayback; // Baked clips only, seconds into the clip and speed
+layout(location = 13) in uvec4 aJoints;
+layout(location = 14) in vec4 aWeights; // Normalised bytes summing to one
+
+uniform sampler2D bonePalette;
+uniform int paletteBase;
+uniform int bakedFrames; // 0 for the live palette
+uniform float bakedFps;
+uniform float animationTime;
+
+mat4 paletteMatrix(int bone, int row) {
+    int x = bone * 3;
+    return transpose(mat4(texelFetch(bonePalette, ivec2(x, row), 0),
+                          texelFetch(bonePalette, ivec2(x + 1, row), 0),
+                          texelFetch(bonePalette, ivec2(x + 2, row), 0),
+                          vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+// The weighted bones at one palette row
+mat4 blendBones(int row) {
+    return paletteMatrix(int(aJoints.x), row) * aWeights.x + paletteMatrix(int(aJoints.y), row) * aWeights.y +
+           paletteMatrix(int(aJoints.z), row) * aWeights.z + paletteMatrix(int(aJoints.w), row) * aWeights.w;
+}
+
+// Bind pose mesh space to the model's space at this frame's pose
+mat4 skinMatrix() {
+    if (bakedFrames == 0) return blendBones(paletteBase + gl_InstanceID);
+
+    // Between the two baked frames around the instance's time, the last one leading into the first
+    float frame = (aPlayback.x + animationTime * aPlayback.y) * bakedFps;
+    float whole = floor(frame);
+    int row = int(mod(whole, float(bakedFrames)));
+    int next = row + 1 == bakedFrames ? 0 : row + 1;
+    float t = frame - whole;
+    return blendBones(row) * (1.0 - t) + blendBones(next) * t;
+}
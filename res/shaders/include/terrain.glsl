@@ -0,0 +1,66 @@
+// Terrain chunks (terrain.h). The grid vertex comes in aPos.xz, 0 to TERRAIN_GRID, and slots 6 and
+// 7 carry the instance's TerrainChunk: origin xz, size and morph start, then the tile's layer,
+// its origin xz and one over the morph length. Must match terrain.h.
+#define TERRAIN_GRID 32.0
+#define TERRAIN_TILE_TEXELS 256
+#define TERRAIN_TEXEL_SPACING 1.0
+#define TERRAIN_UV_SCALE 0.25 // Material repeats per metre
+
+layout(location = 6) in vec4 terrainChunk0;
+layout(location = 7) in vec4 terrainChunk1;
+
+uniform sampler2DArray terrainHeights;
+uniform sampler2DArray terrainSplat;
+
+// What each splat channel tints the material's albedo to, linear: grass, rock, dirt, snow
+const vec3 TERRAIN_LAYER_TINTS[4] = vec3[4](vec3(0.16, 0.26, 0.07), vec3(0.32, 0.30, 0.27),
+                                            vec3(0.28, 0.20, 0.12), vec3(0.85, 0.86, 0.90));
+
+struct TerrainVertex {
+    vec3 position;
+    vec3 normal;
+    vec3 tangent;
+    vec3 tint;
+    vec2 uv;
+};
+
+// Bilinear between the tile's samples around a world xz, clamped to the tile
+float terrainHeight(vec2 world) {
+    vec2 texel = clamp((world - terrainChunk1.yz) / TERRAIN_TEXEL_SPACING, vec2(0.0), vec2(float(TERRAIN_TILE_TEXELS)));
+    ivec2 base = min(ivec2(texel), ivec2(TERRAIN_TILE_TEXELS - 1));
+    vec2 f = texel - vec2(base);
+    int layer = int(terrainChunk1.x);
+    float h00 = texelFetch(terrainHeights, ivec3(base, layer), 0).r;
+    float h10 = texelFetch(terrainHeights, ivec3(base + ivec2(1, 0), layer), 0).r;
+    float h01 = texelFetch(terrainHeights, ivec3(base + ivec2(0, 1), layer), 0).r;
+    float h11 = texelFetch(terrainHeights, ivec3(base + ivec2(1, 1), layer), 0).r;
+    return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+}
+
+TerrainVertex terrainVertex(vec2 grid) {
+    float spacing = terrainChunk0.z / TERRAIN_GRID;
+    vec2 world = terrainChunk0.xy + grid * spacing;
+
+    // CDLOD: towards the end of the level's range the odd vertices slide onto their even
+    // neighbours, which leaves the next coarser level's grid where that level takes over
+    float cameraDistance = length(vec3(world.x, terrainHeight(world), world.y) - viewPos);
+    float morph = clamp((cameraDistance - terrainChunk0.w) * terrainChunk1.w, 0.0, 1.0);
+    grid -= fract(grid * 0.5) * 2.0 * morph;
+    world = terrainChunk0.xy + grid * spacing;
+
+    TerrainVertex v;
+    v.position = vec3(world.x, terrainHeight(world), world.y);
+    // Differences at the chunk's own spacing, coarser levels get the smoother normals
+    float dx = terrainHeight(world + vec2(spacing, 0.0)) - terrainHeight(world - vec2(spacing, 0.0));
+    float dz = terrainHeight(world + vec2(0.0, spacing)) - terrainHeight(world - vec2(0.0, spacing));
+    v.normal = normalize(vec3(-dx, 2.0 * spacing, -dz));
+    v.tangent = normalize(vec3(2.0 * spacing, dx, 0.0));
+
+    ivec2 texel = clamp(ivec2((world - terrainChunk1.yz) / TERRAIN_TEXEL_SPACING + 0.5), ivec2(0), ivec2(TERRAIN_TILE_TEXELS));
+    vec4 weights = texelFetch(terrainSplat, ivec3(texel, int(terrainChunk1.x)), 0);
+    weights /= max(dot(weights, vec4(1.0)), 1e-4);
+    v.tint = weights.x * TERRAIN_LAYER_TINTS[0] + weights.y * TERRAIN_LAYER_TINTS[1] +
+             weights.z * TERRAIN_LAYER_TINTS[2] + weights.w * TERRAIN_LAYER_TINTS[3];
+    v.uv = world * TERRAIN_UV_SCALE;
+    return v;
+}
@@ -0,0 +1,40 @@
+// The vertex pulling pool (vertex_pulling.h) in place of vertex attributes, for VERTEX_PULLING
+// builds of the depth passes. Each draw is glMultiDrawArraysIndirect over the pooled indices, so
+// gl_VertexID walks the mesh's indices and the instance is the list's gl_BaseInstanceARB + gl_InstanceID.
+layout(std430, binding = 0) readonly buffer PulledPositions { float pulledPositions[]; };
+layout(std430, binding = 1) readonly buffer PulledUVs { vec2 pulledUVs[]; };
+layout(std430, binding = 2) readonly buffer PulledIndices { uint pulledIndices[]; };
+// InstanceTransform in geometry_arena.h, 14 words: three rows, then four halves with the fade last
+layout(std430, binding = 3) readonly buffer PulledInstances { float pulledInstances[]; };
+
+#define PULLED_INSTANCE_WORDS 14
+
+uint pulledVertex() {
+    return pulledIndices[gl_VertexID];
+}
+
+int pulledInstance() {
+    return (gl_BaseInstanceARB + gl_InstanceID) * PULLED_INSTANCE_WORDS;
+}
+
+vec3 pulledPosition() {
+    uint v = pulledVertex() * 3u;
+    return vec3(pulledPositions[v], pulledPositions[v + 1u], pulledPositions[v + 2u]);
+}
+
+vec4 pulledRow(int row) {
+    int base = pulledInstance() + row * 4;
+    return vec4(pulledInstances[base], pulledInstances[base + 1], pulledInstances[base + 2], pulledInstances[base + 3]);
+}
+
+mat4 instanceModel() {
+    return transpose(mat4(pulledRow(0), pulledRow(1), pulledRow(2), vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+float pulledLodFade() {
+    return unpackHalf2x16(floatBitsToUint(pulledInstances[pulledInstance() + 13])).y;
+}
+
+#define aPos pulledPosition()
+#define aTexCoords pulledUVs[pulledVertex()]
+#define aLodFade pulledLodFade()
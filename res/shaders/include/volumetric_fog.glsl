@@ -0,0 +1,33 @@
+// The froxel volume of volumetric_fog.h, after camera.glsl and lights.glsl. Must match
+// VOLUMETRIC_FOG_DEPTH there.
+#define VOLUMETRIC_FOG_DEPTH 64
+
+uniform sampler3D volumetricFog; // rgb in-scattered light, a transmittance, from the camera
+
+// View depth at slice coordinate f, 0 the near plane and VOLUMETRIC_FOG_DEPTH the far one
+float froxelDepth(float f) {
+    return exp((f / float(VOLUMETRIC_FOG_DEPTH) - volumetricDepthBias) / volumetricDepthScale);
+}
+
+// The view-space point at unit depth through ndc, the jitter in projection's third column
+vec3 froxelRay(vec2 ndc) {
+    return vec3((ndc.x + projection[2][0]) / projection[0][0], (ndc.y + projection[2][1]) / projection[1][1], -1.0);
+}
+
+// What the air between the camera and a surface at worldPos does to the light leaving it
+vec3 applyVolumetricFog(vec3 color, vec3 worldPos) {
+    if (volumetricFog == 0) return color;
+    vec4 clip = viewProjection * vec4(worldPos, 1.0);
+    float viewDepth = -(view * vec4(worldPos, 1.0)).z;
+    vec3 uvw = vec3(clip.xy / clip.w * 0.5 + 0.5, log(max(viewDepth, 1e-4)) * volumetricDepthScale + volumetricDepthBias);
+    vec4 fog = texture(volumetricFog, uvw);
+    return color * fog.a + fog.rgb;
+}
+
+// The same up to the far plane, for the sky in direction
+vec3 applyVolumetricFogFar(vec3 color, vec3 direction) {
+    if (volumetricFog == 0) return color;
+    vec4 clip = viewProjection * vec4(viewPos + direction, 1.0);
+    vec4 fog = texture(volumetricFog, vec3(clip.xy / clip.w * 0.5 + 0.5, 1.0));
+    return color * fog.a + fog.rgb;
+}
@@ -0,0 +1,30 @@
+// Copies one baked lightmap layer out of the scratch target, filling the padding around each
+// chart from its nearest baked texel so bilinear reads at chart edges don't pull in black.
+// Drawn with hiz.vs, see lightmap.h.
+uniform sampler2D scratch; // RGBM, alpha 0 where no chart covers
+uniform int radius;
+
+out vec4 FragColor;
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 texel = texelFetch(scratch, pixel, 0);
+    if (texel.a > 0.0) {
+        FragColor = texel;
+        return;
+    }
+
+    ivec2 last = textureSize(scratch, 0) - 1;
+    float nearest = 1e9;
+    FragColor = vec4(0.0);
+    for (int y = -radius; y <= radius; ++y) {
+        for (int x = -radius; x <= radius; ++x) {
+            vec4 neighbour = texelFetch(scratch, clamp(pixel + ivec2(x, y), ivec2(0), last), 0);
+            float distance = float(x * x + y * y);
+            if (neighbour.a > 0.0 && distance < nearest) {
+                nearest = distance;
+                FragColor = neighbour;
+            }
+        }
+    }
+}
@@ -0,0 +1,6 @@
+// Colour writes are masked, only the query's sample count matters
+out vec4 FragColor;
+
+void main() {
+    FragColor = vec4(1.0);
+}
@@ -0,0 +1,74 @@
+// Resolves the weighted blended OIT targets, see oit.h. With REDUCED_RESOLUTION they're smaller
+// than the scene and carry the additive particles too; the output is premultiplied then.
+uniform sampler2D accumTexture;
+uniform sampler2D weightTexture;
+
+out vec4 FragColor;
+
+#ifdef REDUCED_RESOLUTION
+#include "include/camera.glsl"
+
+uniform sampler2D additiveTexture;
+uniform highp sampler2D sceneDepth; // The scene's, full resolution
+uniform highp sampler2D lowDepth;   // What the targets were drawn against
+uniform int divisor;
+uniform float depthTolerance;       // OIT_UPSAMPLE_DEPTH_TOLERANCE
+
+// Eye distance back from the perspective depth, as in particle.fs
+float viewDistance(float depth) {
+    return projection[3][2] / ((depth * 2.0 - 1.0) + projection[2][2]);
+}
+
+void main() {
+    float distance = viewDistance(texelFetch(sceneDepth, ivec2(gl_FragCoord.xy), 0).r);
+
+    // The four low-resolution texels around the pixel and their bilinear weights
+    vec2 position = gl_FragCoord.xy / float(divisor) - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = position - vec2(base);
+    ivec2 last = textureSize(accumTexture, 0) - 1;
+    ivec2 coords[4];
+    float weights[4];
+    float worst = 0.0;
+    float best = 1e30;
+    int closest = 0;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        coords[i] = clamp(base + offset, ivec2(0), last);
+        weights[i] = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+        float difference = abs(viewDistance(texelFetch(lowDepth, coords[i], 0).r) - distance) / distance;
+        worst = max(worst, difference);
+        if (difference < best) {
+            best = difference;
+            closest = i;
+        }
+    }
+    // Across a silhouette only the texel drawn against this pixel's surface counts
+    if (worst > depthTolerance) {
+        for (int i = 0; i < 4; ++i) weights[i] = i == closest ? 1.0 : 0.0;
+    }
+
+    vec4 accum = vec4(0.0);
+    float weight = 0.0;
+    vec3 additive = vec3(0.0);
+    for (int i = 0; i < 4; ++i) {
+        accum += texelFetch(accumTexture, coords[i], 0) * weights[i];
+        weight += texelFetch(weightTexture, coords[i], 0).r * weights[i];
+        additive += texelFetch(additiveTexture, coords[i], 0).rgb * weights[i];
+    }
+    float coverage = 1.0 - accum.a;
+    if (coverage <= 0.0 && all(equal(additive, vec3(0.0)))) discard;
+    FragColor = vec4(accum.rgb / max(weight, 1e-5) * coverage + additive, coverage);
+}
+#else
+void main() {
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    vec4 accum = texelFetch(accumTexture, coord, 0);
+    float revealage = accum.a;
+    // Nothing transparent covers this pixel
+    if (revealage >= 1.0) discard;
+
+    float weight = texelFetch(weightTexture, coord, 0).r;
+    FragColor = vec4(accum.rgb / max(weight, 1e-5), 1.0 - revealage);
+}
+#endif
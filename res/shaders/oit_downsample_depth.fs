@@ -0,0 +1,16 @@
+// The farthest opaque depth of each block of pixels the reduced-resolution transparents cover
+// (oit.h), so they're only rejected where every pixel under them hides them
+uniform highp sampler2D sceneDepth;
+uniform int divisor;
+
+void main() {
+    ivec2 first = ivec2(gl_FragCoord.xy) * divisor;
+    ivec2 last = textureSize(sceneDepth, 0) - 1;
+    float farthest = 0.0;
+    for (int y = 0; y < divisor; ++y) {
+        for (int x = 0; x < divisor; ++x) {
+            farthest = max(farthest, texelFetch(sceneDepth, min(first + ivec2(x, y), last), 0).r);
+        }
+    }
+    gl_FragDepth = farthest;
+}
@@ -0,0 +1,8 @@
+// One step of the overdraw heat map, the stencil test picks the pixels it covers
+uniform vec3 heatColor;
+
+out vec4 FragColor;
+
+void main() {
+    FragColor = vec4(heatColor, 1.0);
+}
@@ -0,0 +1,41 @@
+// Soft round sprites, premultiplied (particles.h)
+in vec2 Corner;
+in vec4 Color;
+in float ViewDepth;
+
+#ifdef OIT_OUTPUT
+// Weighted blended OIT targets (oit.h), weighted the same way as pbr.fs
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out float OitWeight;
+#else
+out vec4 FragColor;
+#endif
+
+#include "include/camera.glsl"
+
+uniform sampler2D sceneDepth; // Copy of the opaques' depth
+uniform float softDistance;   // 0 = hard edges against the opaques
+uniform float sceneDepthScale; // sceneDepth's size over the target's, above 1 at reduced resolution
+
+void main() {
+    float r2 = dot(Corner, Corner);
+    if (r2 >= 1.0) discard;
+    float falloff = 1.0 - r2;
+    float alpha = Color.a * falloff * falloff;
+
+    if (softDistance > 0.0) {
+        // Eye distance back from the perspective depth
+        float depth = texelFetch(sceneDepth, ivec2(gl_FragCoord.xy * sceneDepthScale), 0).r;
+        float sceneDistance = projection[3][2] / ((depth * 2.0 - 1.0) + projection[2][2]);
+        alpha *= clamp((sceneDistance - ViewDepth) / softDistance, 0.0, 1.0);
+    }
+    if (alpha < 0.004) discard;
+
+#ifdef OIT_OUTPUT
+    float weight = clamp(pow(min(1.0, alpha * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+    FragColor = vec4(Color.rgb * alpha * weight, alpha);
+    OitWeight = alpha * weight;
+#else
+    FragColor = vec4(Color.rgb * alpha, alpha);
+#endif
+}
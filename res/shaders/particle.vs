@@ -0,0 +1,35 @@
+// Camera-facing quads, a triangle strip of four vertices per particle instanced straight from
+// the particle buffer (particles.h)
+layout(location = 0) in vec4 aPositionAge;
+layout(location = 1) in vec4 aVelocityLife;
+
+#include "include/camera.glsl"
+
+uniform vec2 sizeRange; // Half-size at birth and at death
+uniform vec4 colorStart;
+uniform vec4 colorEnd;
+
+out vec2 Corner;
+out vec4 Color;
+out float ViewDepth;
+
+void main() {
+    float life = aVelocityLife.w;
+    if (aPositionAge.w >= life) {
+        // Dead, all four corners on one point outside the clip volume
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    float t = aPositionAge.w / life;
+    Corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    Color = mix(colorStart, colorEnd, t);
+
+    // The camera's right and up in world space, the view matrix's first two rows
+    vec3 right = vec3(view[0][0], view[1][0], view[2][0]);
+    vec3 up = vec3(view[0][1], view[1][1], view[2][1]);
+    float size = mix(sizeRange.x, sizeRange.y, t);
+    vec4 viewPosition = view * vec4(aPositionAge.xyz + (right * Corner.x + up * Corner.y) * size, 1.0);
+    ViewDepth = -viewPosition.z;
+    gl_Position = projection * viewPosition;
+}
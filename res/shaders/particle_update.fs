@@ -0,0 +1,6 @@
+// Never runs, the rasterizer is off. WebGL2 needs a fragment stage to link.
+out vec4 FragColor;
+
+void main() {
+    FragColor = vec4(0.0);
+}
@@ -0,0 +1,17 @@
+// Transform feedback particle step (particles.h), drawn as points with the rasterizer off, a
+// vertex per particle of the emitter's range
+layout(location = 0) in vec4 aPositionAge;
+layout(location = 1) in vec4 aVelocityLife;
+
+out vec4 outPositionAge;
+out vec4 outVelocityLife;
+
+#include "include/particles.glsl"
+
+void main() {
+    vec4 positionAge = aPositionAge;
+    vec4 velocityLife = aVelocityLife;
+    simulateParticle(gl_VertexID, positionAge, velocityLife);
+    outPositionAge = positionAge;
+    outVelocityLife = velocityLife;
+}
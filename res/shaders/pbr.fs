@@ -1,72 +1,185 @@
+#ifdef DEFERRED_LIGHTING
+// Fullscreen after hiz.vs, the surface comes from the G-buffer (gbuffer.h) and FragPos from its depth
+vec3 FragPos;
+#else
 in vec4 vertexColor;
 in vec2 TexCoord;
 in vec3 FragPos;
 in vec3 Normal;
-in vec4 FragPosLightSpace;
 in mat3 TBN;
+flat in float LodFade;
+in vec2 LightmapUV;
+#endif
 
+#if defined(OIT_OUTPUT)
+// Weighted blended OIT targets (oit.h): weighted premultiplied colour plus coverage, and the weight
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out float OitWeight;
+#elif defined(GBUFFER_OUTPUT)
+// G-buffer targets, must match gbuffer.h
+layout(location = 0) out vec4 GAlbedo;   // rgb albedo, a ambient occlusion
+layout(location = 1) out vec4 GNormal;   // xy octahedral normal, z roughness, a 1 where written
+layout(location = 2) out vec4 GMaterial; // rgb emissive as e / (1 + e), a metallic
+#else
 out vec4 FragColor;
+#endif
 
 // Samplers
 uniform sampler2D albedoMap;
 uniform sampler2D normalMap;
 uniform sampler2D ormMap;
 uniform sampler2D emissiveMap;
-uniform sampler2DShadow shadowMap;
-
-// Material scalar properties
-uniform vec3 baseColor;
-uniform float metallic;
-uniform float roughness;
-uniform float ao;
-uniform vec3 emissive;
-uniform float heightScale;
-
-uniform bool hasAlbedoMap;
-uniform bool hasNormalMap;
-uniform bool hasEmissiveMap;
-uniform bool hasORMMap;
-uniform bool hasHeightMap;
+uniform sampler2DArrayShadow shadowMap; // Atlas, a tile per shadow view
+uniform sampler2DArray shadowMoments;   // Its EVSM moments, only bound with SHADOW_FILTER_MOMENTS
+// Light clusters (light_clusters.h): the local lights four texels a row, per cluster an offset
+// and count into the index list, and the list itself
+uniform samplerCube iblSpecular; // Prefiltered sky (ibl.h), only sampled with ambientSpecularLod > 0
+uniform sampler2D iblBrdf;
+// The nearest reflection probes (reflection_probes.h), linear, one sampler per REFLECTION_PROBE_SLOTS
+uniform samplerCube reflectionProbe0;
+uniform samplerCube reflectionProbe1;
+uniform sampler2D clusterLights;
+uniform highp usampler2D clusterGrid; // ES has no default precision for unsigned samplers
+uniform highp usampler2D clusterIndices;
+uniform sampler2DArray lightmapAtlas; // Baked lights (lightmap.h), a layer per mesh, RGBM
+uniform sampler2DArray albedoAtlas;   // Small albedo maps (texture_atlas.h), a layer each
+#if !defined(DEFERRED_LIGHTING) && !defined(LIGHTMAP_BAKE) && !defined(OIT_OUTPUT)
+// Screen-space AO of the opaques (ssao.h), or a white texel where it's off or doesn't apply
+uniform sampler2D ambientOcclusionMap;
+#endif
+#ifdef DEFERRED_LIGHTING
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gMaterial;
+uniform highp sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+#endif
+#ifdef LIGHTMAP_BAKE
+uniform sampler2D bakeLights; // Every light baked, four texels a row like clusterLights
+uniform int bakeLightCount;
+#endif
+
+// Texture features are compiled in per variant (PBR_FEATURES in renderer.cpp), so the
+// branches on them fold away along with the samples and the parallax loop
+#ifdef HAS_ALBEDO_MAP
+const bool hasAlbedoMap = true;
+#else
+const bool hasAlbedoMap = false;
+#endif
+#ifdef HAS_NORMAL_MAP
+const bool hasNormalMap = true;
+#else
+const bool hasNormalMap = false;
+#endif
+#ifdef HAS_ORM_MAP
+const bool hasORMMap = true;
+#else
+const bool hasORMMap = false;
+#endif
+#ifdef HAS_HEIGHT_MAP
+const bool hasHeightMap = true;
+#else
+const bool hasHeightMap = false;
+#endif
+#ifdef HAS_EMISSIVE_MAP
+const bool hasEmissiveMap = true;
+#else
+const bool hasEmissiveMap = false;
+#endif
+#ifdef HAS_LIGHTMAP
+const bool hasLightmap = true;
+#else
+const bool hasLightmap = false;
+#endif
+// The far shading tier (shading LOD in renderer.h): geometric normals without parallax, since
+// renderer.cpp drops the normal and height bits from its mask, a cheaper specular and one shadow tap
+#ifdef SHADING_LOD_FAR
+const bool farShading = true;
+#else
+const bool farShading = false;
+#endif
+
+// Must match lightmap.h
+#define LIGHTMAP_RGBM_RANGE 8.0
+
+// This frame's materials, must match GpuMaterial in material_table.h
+#define MATERIAL_SLOTS 256
+struct MaterialData {
+    vec4 baseColor; // w = metallic
+    vec4 emissive;  // w = roughness
+    float ao;
+    float heightScale;
+    int lightmapLayer;
+    int parallaxMaxLayers; // 0 = no parallax
+    int albedoLayer;       // In albedoAtlas, -1 samples albedoMap
+};
+layout(std140) uniform MaterialBlock {
+    MaterialData materials[MATERIAL_SLOTS];
+};
+uniform int materialIndex;
+
+// Albedo maps packed into texture_atlas.h's arrays are read from their layer there instead. The
+// layer is the same for the whole draw, so the branch stays uniform.
+vec4 sampleAlbedo(vec2 uv) {
+    int layer = materials[materialIndex].albedoLayer;
+    return layer >= 0 ? texture(albedoAtlas, vec3(uv, float(layer))) : texture(albedoMap, uv);
+}
 
 // Lighting
-#define MAX_LIGHTS 8
-uniform int lightCount;
-uniform vec3 viewPos;
-uniform int shadowLightIndex;
-uniform mat4 lightSpaceMatrix;
-
-uniform vec3 lightPositions[MAX_LIGHTS];
-uniform vec3 lightColors[MAX_LIGHTS];
-uniform float lightIntensities[MAX_LIGHTS];
-uniform vec3 lightDirections[MAX_LIGHTS];
-uniform float lightInnerCutoffs[MAX_LIGHTS];
-uniform float lightOuterCutoffs[MAX_LIGHTS];
-uniform float lightTypes[MAX_LIGHTS];
+#include "include/camera.glsl"
+#include "include/lights.glsl"
+
+// Must match light_clusters.h
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_INDEX_WIDTH 1024
+
+// Must match frame_uniforms.h
+#define SHADOW_KIND_CASCADES 1
+#define SHADOW_KIND_CUBE 2
+#define SHADOW_FILTER_HARD 0
+#define SHADOW_FILTER_PCF4 1
+#define SHADOW_FILTER_MOMENTS 3
+#define SHADOW_FILTER_MAX_TAPS 16
+#include "include/shadows.glsl"
+#include "include/volumetric_fog.glsl"
 
 const float PI = 3.14159265359;
 
 // PARALLAX OCCLUSION MAPPING
-vec2 parallaxMapping(vec2 texCoords, vec3 viewDir) { 
-    const float minLayers = 8.0;
-    const float maxLayers = 64.0;
-    float numLayers = mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir)));
+// Parallax occlusion, one layer per screen pixel the surface's relief shifts by: angle and distance
+// both come in through that, up to the material's cap. Gradients are main()'s, the loop isn't
+// uniform control flow. Must match material.h.
+#define PARALLAX_MAX_LAYERS 64
+#define PARALLAX_MIN_LAYERS 4.0
+#define PARALLAX_FADE_START 15.0 // The relief flattens out from here and is skipped past the end
+#define PARALLAX_FADE_END 20.0
+vec2 parallaxMapping(vec2 texCoords, vec3 viewDir, float heightScale, int maxLayers, vec2 uvDx, vec2 uvDy) {
+    vec2 P = viewDir.xy / viewDir.z * heightScale;
+    vec2 texels = vec2(textureSize(ormMap, 0));
+    float texelsPerPixel = max(max(length(uvDx * texels), length(uvDy * texels)), 1e-3);
+    float shiftPixels = length(P * texels) / texelsPerPixel;
+    // Under half a pixel of shift, the flat lookup is already right
+    if (shiftPixels < 0.5) return texCoords;
+    float numLayers = clamp(ceil(shiftPixels), PARALLAX_MIN_LAYERS, float(maxLayers));
+
     float layerDepth = 1.0 / numLayers;
     float currentLayerDepth = 0.0;
-    vec2 P = viewDir.xy / viewDir.z * heightScale;
     vec2 deltaTexCoords = P / numLayers;
-  
+
     vec2 currentTexCoords = texCoords;
-    float currentDepthMapValue = texture(ormMap, currentTexCoords).a;
-      
-    while (currentLayerDepth < currentDepthMapValue) {
+    float currentDepthMapValue = textureGrad(ormMap, currentTexCoords, uvDx, uvDy).a;
+    for (int i = 0; i < PARALLAX_MAX_LAYERS; ++i) {
+        if (currentLayerDepth >= currentDepthMapValue || float(i) >= numLayers) break;
         currentTexCoords -= deltaTexCoords;
-        currentDepthMapValue = texture(ormMap, currentTexCoords).a;  
-        currentLayerDepth += layerDepth;  
+        currentDepthMapValue = textureGrad(ormMap, currentTexCoords, uvDx, uvDy).a;
+        currentLayerDepth += layerDepth;
     }
     
     vec2 prevTexCoords = currentTexCoords + deltaTexCoords;
     float afterDepth = currentDepthMapValue - currentLayerDepth;
-    float beforeDepth = texture(ormMap, prevTexCoords).a - currentLayerDepth + layerDepth;
+    float beforeDepth = textureGrad(ormMap, prevTexCoords, uvDx, uvDy).a - currentLayerDepth + layerDepth;
     float weight = afterDepth / (afterDepth - beforeDepth);
     vec2 finalTexCoords = prevTexCoords * weight + currentTexCoords * (1.0 - weight);
 
@@ -74,11 +187,95 @@ vec2 parallaxMapping(vec2 texCoords, vec3 viewDir) {
 }
 
 // SHADOW MAPPING
-float calcShadow(vec4 fragLight, vec3 N, vec3 L) {
-    if (shadowLightIndex < 0) return 1.0;
+// Fade out near the view's edges. Cube faces meet their neighbours there, so they don't.
+float edgeFade(vec2 uv, int kind) {
+    if (kind == SHADOW_KIND_CUBE) return 1.0;
+    vec2 border = min(uv, 1.0 - uv);
+    return smoothstep(0.0, 0.1, min(border.x, border.y));
+}
+
+// Filter taps stay half a texel inside the tile so they never read a neighbour's depth
+float sampleShadowTile(vec2 uv, vec4 tile, vec2 texelSize, float depth) {
+    vec2 atlasUV = clamp(tile.xy + uv * tile.z, tile.xy + texelSize * 0.5, tile.xy + tile.z - texelSize * 0.5);
+    return texture(shadowMap, vec4(atlasUV, tile.w, depth));
+}
+
+// Screen-space derivatives of FragPos, taken in main() while control flow is still uniform
+vec3 fragPosDx;
+vec3 fragPosDy;
+
+// Upper bound on the lit fraction at depth t given the mean and mean square around it
+float chebyshevUpperBound(vec2 moments, float t, float minVariance) {
+    if (t <= moments.x) return 1.0;
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = t - moments.x;
+    float pMax = variance / (variance + d * d);
+    // Cuts off the tail where light bleeds through overlapping occluders
+    return clamp((pMax - 0.2) / 0.8, 0.0, 1.0);
+}
 
-    vec3 offsetPos = FragPos + N * 0.1;
-    vec4 offsetLight = lightSpaceMatrix * vec4(offsetPos, 1.0);
+// One trilinear lookup in the blurred moments. The gradients are the tile's, from FragPos' own,
+// since calcShadow() runs in non-uniform control flow.
+float momentShadow(int shadowView, vec3 proj, vec4 tile) {
+    mat4 lightSpace = lightSpaceMatrices[shadowView];
+    vec4 projDx = lightSpace * vec4(FragPos + fragPosDx, 1.0);
+    vec4 projDy = lightSpace * vec4(FragPos + fragPosDy, 1.0);
+    vec2 uvDx = ((projDx.xy / projDx.w) * 0.5 + 0.5 - proj.xy) * tile.z;
+    vec2 uvDy = ((projDy.xy / projDy.w) * 0.5 + 0.5 - proj.xy) * tile.z;
+
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMoments, 0).xy);
+    vec2 atlasUV = clamp(tile.xy + proj.xy * tile.z, tile.xy + texelSize * 0.5, tile.xy + tile.z - texelSize * 0.5);
+    vec4 moments = textureGrad(shadowMoments, vec3(atlasUV, tile.w), uvDx, uvDy);
+
+    // Same warp as shadow_moments.fs
+    float d = proj.z * 2.0 - 1.0;
+    float positive = exp(shadowMomentExponents.x * d);
+    float negative = -exp(-shadowMomentExponents.y * d);
+    vec2 depthScale = 0.0001 * shadowMomentExponents * vec2(positive, negative);
+    vec2 minVariance = depthScale * depthScale;
+    return min(chebyshevUpperBound(moments.xy, positive, minVariance.x),
+               chebyshevUpperBound(moments.zw, negative, minVariance.y));
+}
+
+// PCF taps for the fragment: the 2-texel kernel needs about four where a screen pixel covers one
+// shadow texel and fewer as the pixel grows, up to shadowMaxFilterTaps close to the light. The
+// texel footprint comes from FragPos' derivatives like momentShadow()'s gradients.
+int shadowFilterTaps(int shadowView, vec3 proj, vec4 tile, vec2 texelSize) {
+    mat4 lightSpace = lightSpaceMatrices[shadowView];
+    vec4 projDx = lightSpace * vec4(FragPos + fragPosDx, 1.0);
+    vec4 projDy = lightSpace * vec4(FragPos + fragPosDy, 1.0);
+    vec2 texelsDx = ((projDx.xy / projDx.w) * 0.5 + 0.5 - proj.xy) * tile.z / texelSize;
+    vec2 texelsDy = ((projDy.xy / projDy.w) * 0.5 + 0.5 - proj.xy) * tile.z / texelSize;
+    float footprint = max(max(length(texelsDx), length(texelsDy)), 0.001);
+    return clamp(int(ceil(4.0 / footprint)), 1, shadowMaxFilterTaps);
+}
+
+float calcShadow(int lightIndex, vec3 N, vec3 L) {
+    ivec4 info = lightShadows[lightIndex];
+    if (info.y == 0) return 1.0;
+
+    // The light's cascade whose slice reaches the fragment, or the cube face it is seen through
+    int shadowView = info.x;
+    float distanceFade = 1.0;
+    if (info.z == SHADOW_KIND_CUBE) {
+        vec3 d = FragPos - lights[lightIndex].position.xyz;
+        vec3 a = abs(d);
+        if (a.x >= a.y && a.x >= a.z) shadowView += d.x > 0.0 ? 0 : 1;
+        else if (a.y >= a.z) shadowView += d.y > 0.0 ? 2 : 3;
+        else shadowView += d.z > 0.0 ? 4 : 5;
+    } else if (info.z == SHADOW_KIND_CASCADES) {
+        int lastView = info.x + info.y - 1;
+        float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+        float lastSplit = shadowViewParams[lastView].y;
+        if (viewDepth > lastSplit) return 1.0;
+        while (shadowView < lastView && viewDepth > shadowViewParams[shadowView].y) shadowView++;
+        // Shadows fade out over the last tenth of their range instead of ending at a line
+        distanceFade = 1.0 - smoothstep(lastSplit * 0.9, lastSplit, viewDepth);
+    }
+    vec4 tile = shadowTiles[shadowView];
+
+    vec3 offsetPos = FragPos + N * shadowViewParams[shadowView].x;
+    vec4 offsetLight = lightSpaceMatrices[shadowView] * vec4(offsetPos, 1.0);
     
     vec3 proj = offsetLight.xyz / offsetLight.w;
     proj = proj * 0.5 + 0.5;
@@ -92,7 +289,21 @@ float calcShadow(vec4 fragLight, vec3 N, vec3 L) {
     float cosTheta = max(dot(N, L), 0.0);
     float bias = max(0.005 * (1.0 - cosTheta), 0.001);
 
-    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0));
+    // Offsets are in atlas texels, tile-relative uv steps scale by the tile's size
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    vec2 tileTexel = texelSize / tile.z;
+    float fade = edgeFade(proj.xy, info.z) * distanceFade;
+
+    // Blurred and mip-filtered once per map, so one lookup covers the whole footprint
+    if (shadowFilterQuality == SHADOW_FILTER_MOMENTS) {
+        return mix(1.0, momentShadow(shadowView, proj, tile), fade);
+    }
+
+    // The compare's bilinear filter alone, also where a screen pixel already spans the kernel
+    int taps = shadowFilterQuality == SHADOW_FILTER_HARD || farShading ? 1 : shadowFilterTaps(shadowView, proj, tile, texelSize);
+    if (taps == 1) {
+        return mix(1.0, sampleShadowTile(proj.xy, tile, texelSize, proj.z - bias), fade);
+    }
     
     // Quick 4-tap test first
     vec2 quickSamples[4] = vec2[](
@@ -104,40 +315,42 @@ float calcShadow(vec4 fragLight, vec3 N, vec3 L) {
     
     float quickShadow = 0.0;
     for (int i = 0; i < 4; i++) {
-        vec2 offset = quickSamples[i] * texelSize * 2.0;
-        quickShadow += texture(shadowMap, vec3(proj.xy + offset, proj.z - bias));
+        vec2 offset = quickSamples[i] * tileTexel * 2.0;
+        quickShadow += sampleShadowTile(proj.xy + offset, tile, texelSize, proj.z - bias);
     }
-    quickShadow /= 4.0;
     
     // If all 4 samples agree, skip expensive sampling
-    if (quickShadow < 0.01 || quickShadow > 0.99) {
-        // Fade out near edges
-        vec2 border = min(proj.xy, 1.0 - proj.xy);
-        float fade = smoothstep(0.0, 0.1, min(border.x, border.y));
-        
-        return mix(1.0, quickShadow, fade);
+    if (taps <= 4 || quickShadow < 0.04 || quickShadow > 3.96) {
+        return mix(1.0, quickShadow / 4.0, fade);
     }
     
-    // Poisson disk samples to reduce aliasing (6 samples)
-    vec2 poissonDisk[6] = vec2[](
+    // Poisson disk samples to reduce aliasing, as many as the footprint leaves after the quick ones
+    vec2 poissonDisk[SHADOW_FILTER_MAX_TAPS] = vec2[](
         vec2(-0.94201624, -0.39906216),
         vec2(0.94558609, -0.76890725),
         vec2(-0.094184101, -0.92938870),
         vec2(0.34495938, 0.29387760),
         vec2(-0.91588581, 0.45771432),
-        vec2(-0.81544232, -0.87912464)
+        vec2(-0.81544232, -0.87912464),
+        vec2(-0.38277543, 0.27676845),
+        vec2(0.97484398, 0.75648379),
+        vec2(0.44323325, -0.97511554),
+        vec2(0.53742981, -0.47373420),
+        vec2(-0.26496911, -0.41893023),
+        vec2(0.79197514, 0.19090188),
+        vec2(-0.24188840, 0.99706507),
+        vec2(-0.81409955, 0.91437590),
+        vec2(0.19984126, 0.78641367),
+        vec2(0.14383161, -0.14100790)
     );
 
-    float shadow = 0.0;
-    for (int i = 0; i < 6; ++i) {
-        vec2 offset = poissonDisk[i] * texelSize * 2.0;
-        shadow += texture(shadowMap, vec3(proj.xy + offset, proj.z - bias));
+    float shadow = quickShadow;
+    for (int i = 0; i < SHADOW_FILTER_MAX_TAPS - 4; ++i) {
+        if (i >= taps - 4) break;
+        vec2 offset = poissonDisk[i] * tileTexel * 2.0;
+        shadow += sampleShadowTile(proj.xy + offset, tile, texelSize, proj.z - bias);
     }
-    shadow /= 6.0;
-    
-    // Fade out near edges
-    vec2 border = min(proj.xy, 1.0 - proj.xy);
-    float fade = smoothstep(0.0, 0.1, min(border.x, border.y));
+    shadow /= float(taps);
     
     return mix(1.0, shadow, fade);
 }
@@ -174,48 +387,329 @@ float G_Smith(vec3 N, vec3 V, vec3 L, float roughness) {
     return ggx1 * ggx2;
 }
 
+#include "include/lod_fade.glsl"
+
+// Direction to the light from FragPos and its distance and cone falloff there, 0 out of range
+float lightAttenuation(Light light, out vec3 L) {
+    if (light.position.w == 0.0) {
+        L = normalize(-light.direction.xyz);
+        return 1.0;
+    }
+
+    L = normalize(light.position.xyz - FragPos);
+    float distance = length(light.position.xyz - FragPos);
+    // Windowed to zero at the range the clusters were built with
+    float falloff = clamp(1.0 - pow(distance / light.cutoff.z, 4.0), 0.0, 1.0);
+    float attenuation = falloff * falloff / (distance * distance);
+
+    if (light.position.w == 2.0) {
+        float theta = dot(L, normalize(-light.direction.xyz));
+        float epsilon = light.direction.w - light.cutoff.x;
+        attenuation *= clamp((theta - light.cutoff.x) / epsilon, 0.0, 1.0);
+    }
+    return attenuation;
+}
+
+// One light's Cook-Torrance contribution. frameIndex is the light's LightBlock slot, which its
+// shadow is filed under, -1 for none.
+vec3 shadeLight(Light light, int frameIndex, vec3 N, vec3 V, vec3 F0, vec3 albedo, float roughValue, float metalValue) {
+    vec3 L;
+    float attenuation = lightAttenuation(light, L);
+    if (attenuation == 0.0) return vec3(0.0);
+
+    vec3 H = normalize(V + L);
+    vec3 radiance = light.color.rgb * light.color.w * attenuation;
+
+    float NDF = D_GGX(N, H, roughValue);
+    vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0);
+
+    vec3 kS = F;
+    vec3 kD = vec3(1.0) - kS;
+    kD *= 1.0 - metalValue;
+
+    vec3 specular;
+    if (farShading) {
+        // G / (4 NdotV NdotL) taken at its 1/4 limit, no Smith term
+        specular = NDF * F * 0.25;
+    } else {
+        float G = G_Smith(N, V, L, roughValue);
+        vec3 numerator = NDF * G * F;
+        float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.0001;
+        specular = numerator / denominator;
+    }
+
+    float shadow = frameIndex >= 0 ? calcShadow(frameIndex, N, L) : 1.0;
+
+    float NdotL = max(dot(N, L), 0.0);
+    return (kD * albedo / PI + specular) * radiance * NdotL * shadow;
+}
+
+// AMBIENT
+// Irradiance over pi from the sky's SH, the basis constants are folded into the coefficients
+vec3 irradianceSH(vec3 n) {
+    return ambientSH[0].rgb +
+           ambientSH[1].rgb * n.y + ambientSH[2].rgb * n.z + ambientSH[3].rgb * n.x +
+           ambientSH[4].rgb * (n.x * n.y) + ambientSH[5].rgb * (n.y * n.z) +
+           ambientSH[6].rgb * (3.0 * n.z * n.z - 1.0) +
+           ambientSH[7].rgb * (n.x * n.z) + ambientSH[8].rgb * (n.x * n.x - n.y * n.y);
+}
+
+vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness) {
+    return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
+}
+
+#define REFLECTION_PROBE_LOD 4.0  // REFLECTION_PROBE_MIPS - 1 in reflection_probes.h
+#define REFLECTION_PROBE_FADE 0.3 // Share of a probe's radius it fades out over towards its edge
+
+// 1 well inside the probe's sphere, falling to 0 at its surface
+float probeWeight(vec4 probe) {
+    return clamp((1.0 - length(FragPos - probe.xyz) / probe.w) / REFLECTION_PROBE_FADE, 0.0, 1.0);
+}
+
+// Where R leaves the probe's sphere from FragPos, seen from the centre the probe was captured at,
+// so nearby reflections line up instead of sitting at infinity
+vec3 probeDirection(vec4 probe, vec3 R) {
+    vec3 o = FragPos - probe.xyz;
+    float b = dot(o, R);
+    float t = -b + sqrt(max(b * b - dot(o, o) + probe.w * probe.w, 0.0));
+    return o + R * t;
+}
+
+// The bound probes over the sky's reflection, normalised where they overlap, the sky filling in
+// where they fade
+vec3 probeReflection(vec3 R, float roughValue, vec3 sky) {
+    float w0 = probeWeight(reflectionProbes[0]);
+    float w1 = reflectionProbeCount > 1 ? probeWeight(reflectionProbes[1]) : 0.0;
+    float total = w0 + w1;
+    if (total == 0.0) return sky;
+
+    float lod = roughValue * REFLECTION_PROBE_LOD;
+    vec3 sum = vec3(0.0);
+    if (w0 > 0.0) sum += textureLod(reflectionProbe0, probeDirection(reflectionProbes[0], R), lod).rgb * w0;
+    if (w1 > 0.0) sum += textureLod(reflectionProbe1, probeDirection(reflectionProbes[1], R), lod).rgb * w1;
+    return total > 1.0 ? sum / total : sum + sky * (1.0 - total);
+}
+
+// A fixed cost whatever the sky: one SH evaluation, one prefiltered lookup and one LUT read, plus
+// a lookup per reflection probe in reach
+vec3 ambientLight(vec3 N, vec3 V, vec3 F0, vec3 albedo, float roughValue, float metalValue) {
+    vec3 irradiance = max(irradianceSH(N), vec3(0.0));
+    if (ambientSpecularLod == 0.0 && reflectionProbeCount == 0) return irradiance * albedo * ambientIntensity;
+
+    float NdotV = max(dot(N, V), 0.0);
+    vec3 F = fresnelSchlickRoughness(NdotV, F0, roughValue);
+    vec3 kD = (1.0 - F) * (1.0 - metalValue);
+    vec3 R = reflect(-V, N);
+    // Stored gamma encoded in RGBA8. Without it the probes fade out to the irradiance.
+    vec3 prefiltered = ambientSpecularLod > 0.0
+        ? pow(textureLod(iblSpecular, R, roughValue * ambientSpecularLod).rgb, vec3(2.2)) : irradiance;
+    if (reflectionProbeCount > 0) prefiltered = probeReflection(R, roughValue, prefiltered);
+    vec2 brdf = texture(iblBrdf, vec2(NdotV, roughValue)).rg;
+    vec3 specular = prefiltered * (F * brdf.x + brdf.y);
+    return (kD * irradiance * albedo + specular) * ambientIntensity;
+}
+
+// Octahedral normal packing, the unit vector folded onto a square in [-1, 1]
+vec2 signNotZero(vec2 v) {
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 encodeNormal(vec3 n) {
+    vec2 p = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+    return n.z <= 0.0 ? (1.0 - abs(p.yx)) * signNotZero(p) : p;
+}
+
+vec3 decodeNormal(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return normalize(n);
+}
+
+// Every light on one surface, tonemapped. Shared by the forward and deferred paths.
+// Lightmapped surfaces pass their baked light in with the emissive and skip the baked lights.
+vec3 shadeSurface(vec3 N, vec3 V, vec3 albedo, float aoValue, float roughValue, float metalValue, vec3 emissiveCol,
+                  bool skipBaked) {
+    vec3 F0 = mix(vec3(0.04), albedo, metalValue);
+    
+    // Lighting calculation
+    vec3 Lo = vec3(0.0);
+    
+    for (int i = 0; i < lightCount && i < MAX_LIGHTS; ++i) {
+        if (lights[i].position.w != 0.0) break;
+        if (skipBaked && lights[i].cutoff.w != 0.0) continue;
+        Lo += shadeLight(lights[i], i, N, V, F0, albedo, roughValue, metalValue);
+    }
+
+    // Local lights from the fragment's cluster
+    vec4 clip = viewProjection * vec4(FragPos, 1.0);
+    vec2 screen = clamp(clip.xy / clip.w * 0.5 + 0.5, 0.0, 0.999);
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    int slice = int(floor(log(max(viewDepth, 1e-4)) * clusterDepthScale + clusterDepthBias));
+    if (clusterLightCount > 0 && slice < CLUSTER_Z) {
+        ivec2 tile = ivec2(screen * vec2(CLUSTER_X, CLUSTER_Y));
+        uvec2 range = texelFetch(clusterGrid, ivec2(tile.y * CLUSTER_X + tile.x, max(slice, 0)), 0).xy;
+        for (uint k = 0u; k < range.y; ++k) {
+            uint entry = range.x + k;
+            int index = int(texelFetch(clusterIndices, ivec2(int(entry % uint(CLUSTER_INDEX_WIDTH)), int(entry / uint(CLUSTER_INDEX_WIDTH))), 0).r);
+            Light light;
+            light.position = texelFetch(clusterLights, ivec2(0, index), 0);
+            light.color = texelFetch(clusterLights, ivec2(1, index), 0);
+            light.direction = texelFetch(clusterLights, ivec2(2, index), 0);
+            light.cutoff = texelFetch(clusterLights, ivec2(3, index), 0);
+            if (skipBaked && light.cutoff.w != 0.0) continue;
+            Lo += shadeLight(light, int(light.cutoff.y), N, V, F0, albedo, roughValue, metalValue);
+        }
+    }
+    
+    vec3 ambient = ambientLight(N, V, F0, albedo, roughValue, metalValue) * aoValue;
+    // Linear HDR, the post pass tonemaps and encodes
+    return ambient + Lo + emissiveCol;
+}
+
+#ifdef DEFERRED_LIGHTING
+// MAIN
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    vec2 ndc = (gl_FragCoord.xy / vec2(textureSize(gDepth, 0))) * 2.0 - 1.0;
+    vec4 world = inverseViewProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    FragPos = world.xyz / world.w;
+    // Across a silhouette these span both surfaces, which only widens the moment filter there
+    fragPosDx = dFdx(FragPos);
+    fragPosDy = dFdy(FragPos);
+
+    // Sky, and the impostors that draw forward over it afterwards
+    vec4 normalSample = texelFetch(gNormal, pixel, 0);
+    if (normalSample.a == 0.0) discard;
+
+    vec4 albedoSample = texelFetch(gAlbedo, pixel, 0);
+    vec4 materialSample = texelFetch(gMaterial, pixel, 0);
+    vec3 N = decodeNormal(normalSample.xy * 2.0 - 1.0);
+    vec3 emissiveCol = materialSample.rgb / max(1.0 - materialSample.rgb, vec3(1.0 / 255.0));
+
+    // Lightmapped surfaces wrote 2/3 and folded their baked light into the emissive
+    vec3 color = shadeSurface(N, normalize(viewPos - FragPos), albedoSample.rgb, albedoSample.a,
+                              clamp(normalSample.z, 0.04, 1.0), materialSample.a, emissiveCol, normalSample.a < 0.9);
+    FragColor = vec4(applyVolumetricFog(color, FragPos), 1.0);
+}
+#elif defined(LIGHTMAP_BAKE)
+// MAIN
+// RGBM over LIGHTMAP_RGBM_RANGE, alpha never 0 so the dilation can tell baked texels apart
+vec4 encodeRGBM(vec3 color) {
+    color /= LIGHTMAP_RGBM_RANGE;
+    float m = clamp(max(max(color.r, color.g), color.b), 1.0 / 255.0, 1.0);
+    m = ceil(m * 255.0) / 255.0;
+    return vec4(clamp(color / m, 0.0, 1.0), m);
+}
+
+// Diffuse irradiance over pi from every baked light at this texel, with the shadows of the ones
+// that have atlas views this frame. Viewer independent, the specular stays dynamic-only.
+void main() {
+    fragPosDx = dFdx(FragPos);
+    fragPosDy = dFdy(FragPos);
+    vec3 N = normalize(Normal);
+
+    vec3 irradiance = vec3(0.0);
+    for (int i = 0; i < bakeLightCount; ++i) {
+        Light light;
+        light.position = texelFetch(bakeLights, ivec2(0, i), 0);
+        light.color = texelFetch(bakeLights, ivec2(1, i), 0);
+        light.direction = texelFetch(bakeLights, ivec2(2, i), 0);
+        light.cutoff = texelFetch(bakeLights, ivec2(3, i), 0);
+
+        vec3 L;
+        float attenuation = lightAttenuation(light, L);
+        float NdotL = max(dot(N, L), 0.0);
+        if (attenuation == 0.0 || NdotL == 0.0) continue;
+        int frameIndex = int(light.cutoff.y);
+        float shadow = frameIndex >= 0 ? calcShadow(frameIndex, N, L) : 1.0;
+        irradiance += light.color.rgb * light.color.w * attenuation * NdotL * shadow;
+    }
+    FragColor = encodeRGBM(irradiance / PI);
+}
+#else
 // MAIN
+// Coverage of this fragment, only below 1 for blended albedo texels under OIT_OUTPUT
+float fragmentAlpha = 1.0;
+
+#ifdef GBUFFER_OUTPUT
+void writeSurface(vec3 albedo, float aoValue, vec3 N, float roughValue, float metalValue, vec3 emissiveCol) {
+    GAlbedo = vec4(albedo, aoValue);
+    // Two alpha bits: 1 written, 2/3 written and lightmapped
+    GNormal = vec4(encodeNormal(N) * 0.5 + 0.5, roughValue, hasLightmap ? 2.0 / 3.0 : 1.0);
+    GMaterial = vec4(emissiveCol / (1.0 + emissiveCol), metalValue);
+}
+#else
+void writeColor(vec3 color) {
+#ifdef OIT_OUTPUT
+    // Favours near, opaque-ish fragments (McGuire & Bavoil's depth weight), clamped for 16F
+    float a = fragmentAlpha;
+    float weight = clamp(pow(min(1.0, a * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+    FragColor = vec4(color * a * weight, a);
+    OitWeight = a * weight;
+#else
+    FragColor = vec4(color, 1.0);
+#endif
+}
+#endif
+
 void main() {
     vec2 uv = TexCoord;
-    
-    // Alpha test first before any other sampling
+    fragPosDx = dFdx(FragPos);
+    fragPosDy = dFdy(FragPos);
+    vec2 uvDx = dFdx(TexCoord);
+    vec2 uvDy = dFdy(TexCoord);
+
+    MaterialData material = materials[materialIndex];
+    vec3 baseColor = material.baseColor.rgb;
+    float metallic = material.baseColor.w;
+    float roughness = material.emissive.w;
+    float ao = material.ao;
+    vec3 emissive = material.emissive.rgb;
+    float heightScale = material.heightScale;
+
+    // Alpha test first before any other sampling. Opaque variants skip both: the prepass already
+    // dithered the LOD fades and cut the texels out, and GL_EQUAL drops those fragments here.
+#ifdef OIT_OUTPUT
     if (hasAlbedoMap) {
-        float alpha = texture(albedoMap, uv).a;
-        if (alpha < 0.5) discard;
+        // Blended for real, only clear texels drop out
+        float alpha = sampleAlbedo(uv).a;
+        if (alpha < 0.004) discard;
+        fragmentAlpha = alpha;
     }
+#elif defined(ALPHA_MASKED)
+    // MASKED materials only (renderer.cpp), kept out of the other variants' source entirely so
+    // no driver turns early depth off for them
+    if (lodFadeDiscard(LodFade)) discard;
+    if (hasAlbedoMap && sampleAlbedo(uv).a < 0.5) discard;
+#endif
 
-    vec3 Vworld = normalize(viewPos - FragPos);
+    vec3 Vworld = viewPos - FragPos;
     float distToCam = length(Vworld);
+    Vworld /= max(distToCam, 1e-4);
 
-    if (distToCam > 25.0) {
-        vec3 albedo = hasAlbedoMap ? texture(albedoMap, TexCoord).rgb : baseColor;
-        vec3 N = normalize(Normal);
-        if (!gl_FrontFacing) N = -N;
-        
-        // Simple directional light only (no PBR, no shadows)
-        vec3 L = normalize(-lightDirections[0]);
-        float NdotL = max(dot(N, L), 0.0);
-        vec3 color = albedo * lightColors[0] * (lightIntensities[0] * 0.01) * NdotL;
-        color += vec3(0.2) * albedo;  // Ambient
-        
-        FragColor = vec4(pow(color, vec3(1.0/2.2)), 1.0);
-        return;  // Skip expensive PBR
-    }
-    
     // Do parallax before sampling textures
-    if (hasHeightMap && heightScale > 0.001 && distToCam < 20.0) {
+    heightScale *= 1.0 - smoothstep(PARALLAX_FADE_START, PARALLAX_FADE_END, distToCam);
+    if (hasHeightMap && heightScale > 0.001 && material.parallaxMaxLayers > 0) {
         vec3 Vts = normalize(transpose(TBN) * Vworld);
         if (abs(Vts.z) > 0.001) {
-            uv = parallaxMapping(TexCoord, Vts);
+            uv = parallaxMapping(TexCoord, Vts, heightScale, min(material.parallaxMaxLayers, PARALLAX_MAX_LAYERS), uvDx, uvDy);
         }
     }
     
     // Now sample everything else (only runs for visible pixels)
-    vec4 albedoSample = hasAlbedoMap ? texture(albedoMap, uv) : vec4(baseColor, 1.0);
+    vec4 albedoSample = hasAlbedoMap ? sampleAlbedo(uv) : vec4(baseColor, 1.0);
     vec3 albedo = albedoSample.rgb;
+#ifdef TERRAIN
+    // The splat layers' tints, blended per vertex by pbr.vs
+    albedo *= vertexColor.rgb;
+#endif
     
     vec3 ormSample = hasORMMap ? texture(ormMap, uv).rgb : vec3(ao, roughness, metallic);
     float aoValue = ormSample.r;
+#ifndef OIT_OUTPUT
+    aoValue *= texelFetch(ambientOcclusionMap, min(ivec2(gl_FragCoord.xy), textureSize(ambientOcclusionMap, 0) - 1), 0).r;
+#endif
     float roughValue = clamp(ormSample.g, 0.04, 1.0);
     float metalValue = clamp(ormSample.b, 0.0, 1.0);
     
@@ -223,64 +717,26 @@ void main() {
     
     vec3 N = normalize(Normal);
     if (hasNormalMap) {
-        vec3 nt = texture(normalMap, uv).rgb * 2.0 - 1.0;
+        // Only RG is trusted so two-channel (BC5) normal maps work, z is rebuilt
+        vec2 nxy = texture(normalMap, uv).rg * 2.0 - 1.0;
+        vec3 nt = vec3(nxy, sqrt(max(1.0 - dot(nxy, nxy), 0.0)));
         N = normalize(TBN * nt);
     }
     
     if (!gl_FrontFacing) N = -N;
-    
-    vec3 V = normalize(Vworld);
-    vec3 F0 = mix(vec3(0.04), albedo, metalValue);
-    
-    // Lighting calculation
-    vec3 Lo = vec3(0.0);
-    
-    for (int i = 0; i < lightCount && i < MAX_LIGHTS; ++i) {
-        vec3 L;
-        float attenuation = 1.0;
-        
-        if (lightTypes[i] == 0.0) {
-            L = normalize(-lightDirections[i]);
-        } else {
-            L = normalize(lightPositions[i] - FragPos);
-            float distance = length(lightPositions[i] - FragPos);
-            attenuation = 1.0 / (distance * distance);
-            if (attenuation < 0.0001) continue;
-            
-            if (lightTypes[i] == 2.0) {
-                float theta = dot(L, normalize(-lightDirections[i]));
-                float epsilon = lightInnerCutoffs[i] - lightOuterCutoffs[i];
-                float intensity = clamp((theta - lightOuterCutoffs[i]) / epsilon, 0.0, 1.0);
-                attenuation *= intensity;
-            }
-        }
-        
-        vec3 H = normalize(V + L);
-        vec3 radiance = lightColors[i] * lightIntensities[i] * attenuation;
-        
-        float NDF = D_GGX(N, H, roughValue);
-        float G = G_Smith(N, V, L, roughValue);
-        vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0);
-        
-        vec3 kS = F;
-        vec3 kD = vec3(1.0) - kS;
-        kD *= 1.0 - metalValue;
-        
-        vec3 numerator = NDF * G * F;
-        float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.0001;
-        vec3 specular = numerator / denominator;
-        
-        float shadow = (i == shadowLightIndex) ? calcShadow(FragPosLightSpace, N, L) : 1.0;
-        
-        float NdotL = max(dot(N, L), 0.0);
-        Lo += (kD * albedo / PI + specular) * radiance * NdotL * shadow;
+
+    // Baked lights arrive as diffuse irradiance over pi, lit like the emissive from here on
+    if (hasLightmap) {
+        vec4 baked = texture(lightmapAtlas, vec3(LightmapUV, float(material.lightmapLayer)));
+        emissiveCol += albedo * (1.0 - metalValue) * baked.rgb * baked.a * LIGHTMAP_RGBM_RANGE;
     }
-    
-    vec3 ambient = vec3(0.03) * albedo * aoValue;
-    vec3 color = ambient + Lo + emissiveCol;
-    
-    color = color / (color + vec3(1.0));
-    color = pow(color, vec3(1.0 / 2.2));
 
-    FragColor = vec4(color, 1.0);
-}
\ No newline at end of file
+#ifdef GBUFFER_OUTPUT
+    // Lit once per pixel by the deferred pass instead
+    writeSurface(albedo, aoValue, N, roughValue, metalValue, emissiveCol);
+#else
+    vec3 color = shadeSurface(N, normalize(Vworld), albedo, aoValue, roughValue, metalValue, emissiveCol, hasLightmap);
+    writeColor(applyVolumetricFog(color, FragPos));
+#endif
+}
+#endif
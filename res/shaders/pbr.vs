@@ -2,57 +2,88 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec4 aColor;
 layout (location = 2) in vec2 aTexCoords;
 layout (location = 3) in vec3 aNormal;
-layout (location = 4) in vec3 aTangent;
-layout (location = 5) in vec3 aBitangent;
-layout (location = 6) in mat4 instanceMatrix;
+layout (location = 4) in vec4 aTangent; // w = bitangent sign (1.0 for unpacked meshes)
+layout (location = 10) in float aLodFade;
+layout (location = 11) in vec2 aLightmapUV; // Only lightmapped meshes have it (lightmap.h)
 
 out vec4 vertexColor;
 out vec2 TexCoord;
 out vec3 FragPos;
 out vec3 Normal;
-out vec4 FragPosLightSpace;
 out mat3 TBN;
+flat out float LodFade;
+out vec2 LightmapUV;
 
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+#include "include/camera.glsl"
+#ifdef TERRAIN
+#include "include/terrain.glsl"
+#elif defined(FOLIAGE)
+#include "include/foliage.glsl"
+#else
+#include "include/instance.glsl"
+#endif
+#ifdef SKINNED
+#include "include/skinning.glsl"
+#endif
 
 void main() {
-    FragPos = vec3(instanceMatrix * vec4(aPos, 1.0));
+#ifdef TERRAIN
+    // Already in world space, the chunk places the grid
+    TerrainVertex terrain = terrainVertex(aPos.xz);
+    FragPos = terrain.position;
+    Normal = terrain.normal;
+    // v runs along +z, the other way from cross(N, T)
+    TBN = mat3(terrain.tangent, -cross(terrain.normal, terrain.tangent), terrain.normal);
+    TexCoord = terrain.uv;
+    LodFade = 0.0;
+    vertexColor = vec4(terrain.tint, 1.0);
+    LightmapUV = vec2(0.0);
+    gl_Position = viewProjection * vec4(FragPos, 1.0);
+#else
+#ifdef SKINNED
+    // Posed in model space first, bones being rigid their upper 3x3 also carries the normals
+    mat4 skin = skinMatrix();
+    vec3 position = vec3(skin * vec4(aPos, 1.0));
+    vec3 normal = mat3(skin) * aNormal;
+    vec3 tangent = mat3(skin) * aTangent.xyz;
+#else
+    vec3 position = aPos;
+    vec3 normal = aNormal;
+    vec3 tangent = aTangent.xyz;
+#endif
+#ifdef FOLIAGE
+    position = foliageBend(position);
+#endif
+    mat4 model = instanceModel();
+    FragPos = vec3(model * vec4(position, 1.0));
 
-    vec3 scale = vec3(
-        length(instanceMatrix[0].xyz),
-        length(instanceMatrix[1].xyz),
-        length(instanceMatrix[2].xyz)
-    );
-    
-    mat3 localNormalMatrix;
-    if (abs(scale.x - scale.y) < 0.01 && abs(scale.y - scale.z) < 0.01) {
-        // Uniform scale: just use rotation part
-        localNormalMatrix = mat3(instanceMatrix);
-    } else {
-        // Non-uniform scale: need proper inverse transpose
-        localNormalMatrix = mat3(transpose(inverse(instanceMatrix)));
-    }
+    // Scales come with the instance, no per-vertex inverse or lengths
+    mat3 localNormalMatrix = instanceNormalMatrix();
     
     // Transform normal and tangent to world space
-    vec3 N = normalize(localNormalMatrix * aNormal);
-    vec3 T = normalize(localNormalMatrix * aTangent);
+    vec3 N = normalize(localNormalMatrix * normal);
+    vec3 T = normalize(localNormalMatrix * tangent);
 
     // Re-orthogonalize T with respect to N using Gram-Schmidt process
     T = normalize(T - dot(T, N) * N);
 
-    // Compute bitangent from the corrected normal and tangent
-    vec3 B = cross(N, T);
+    // Compute bitangent from the corrected normal and tangent, flipped for mirrored UVs
+    vec3 B = cross(N, T) * (aTangent.w < 0.0 ? -1.0 : 1.0);
 
     // Create TBN matrix for tangent space calculations
     TBN = mat3(T, B, N);
     
-    Normal = localNormalMatrix * aNormal;
+    Normal = localNormalMatrix * normal;
     TexCoord = aTexCoords;
+    LodFade = aLodFade;
     vertexColor = aColor;
+    LightmapUV = aLightmapUV;
     
-    FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
-    
-    gl_Position = projection * view * instanceMatrix * vec4(aPos, 1.0);
+#ifdef LIGHTMAP_BAKE
+    // Rasterised in lightmap space, every chart texel gets a fragment at its world position
+    gl_Position = vec4(aLightmapUV * 2.0 - 1.0, 0.0, 1.0);
+#else
+    gl_Position = projection * view * model * vec4(position, 1.0);
+#endif
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,45 @@
+// Exposure, tonemapping, colour grading, gamma and dithering in one pass over the scene target,
+// upscaled by the bilinear fetch when it renders below the window's size. See scene_target.h.
+uniform sampler2D sceneColor;
+uniform vec2 outputSize;
+uniform float exposure;    // Linear scale, from stops
+uniform int tonemapper;    // TONEMAP_*
+uniform float contrast;
+uniform float saturation;
+uniform vec3 colorFilter;
+uniform bool dithering;
+
+#define TONEMAP_REINHARD 0
+#define TONEMAP_ACES 1
+
+out vec4 FragColor;
+
+// Narkowicz's fit of the ACES reference curve
+vec3 tonemapACES(vec3 x) {
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+// Triangular noise of about one 8-bit step, hides banding in dark gradients
+vec3 ditherNoise(vec2 pixel) {
+    vec3 a = fract(sin(vec3(dot(pixel, vec2(12.9898, 78.233)), dot(pixel, vec2(39.346, 11.135)),
+                            dot(pixel, vec2(73.156, 52.235)))) * 43758.5453);
+    vec3 b = fract(sin(vec3(dot(pixel, vec2(26.651, 36.341)), dot(pixel, vec2(63.726, 10.873)),
+                            dot(pixel, vec2(54.798, 91.214)))) * 43758.5453);
+    return (a + b - 1.0) / 255.0;
+}
+
+void main() {
+    vec3 color = texture(sceneColor, gl_FragCoord.xy / outputSize).rgb * exposure;
+
+    color = tonemapper == TONEMAP_ACES ? tonemapACES(color) : color / (color + vec3(1.0));
+
+    // Graded in display-referred linear, so the controls behave the same for either curve
+    color *= colorFilter;
+    float luma = dot(color, vec3(0.2126, 0.7152, 0.0722));
+    color = max(mix(vec3(luma), color, saturation), 0.0);
+    color = max((color - 0.18) * contrast + 0.18, 0.0);
+
+    color = pow(color, vec3(1.0 / 2.2));
+    if (dithering) color += ditherNoise(gl_FragCoord.xy);
+    FragColor = vec4(color, 1.0);
+}
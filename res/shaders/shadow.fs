@@ -1,11 +1,17 @@
+// MASKED casters cut out with ALPHA_TEST. Opaque ones get the empty body, which drivers run
+// as depth-only.
+#ifdef ALPHA_TEST
 in vec2 TexCoord;
 
 uniform sampler2D u_texture;
+#endif
 
 void main() {
+#ifdef ALPHA_TEST
     vec4 texColor = texture(u_texture, TexCoord);
     if (texColor.a < 0.5) {
         discard;
     }
+#endif
     // Depth automatically written to shadow map
-}
\ No newline at end of file
+}
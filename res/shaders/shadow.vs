@@ -1,12 +1,50 @@
+// Without ALPHA_TEST only the position is read, for opaque casters' depth-only program.
+// VERTEX_PULLING reads the same from the pool's storage buffers instead (vertex_pulling.h).
+#ifdef VERTEX_PULLING
+#include "include/vertex_pulling.glsl"
+#else
 layout(location = 0) in vec3 aPos;
+#ifdef ALPHA_TEST
 layout(location = 2) in vec2 aTexCoords;
-layout(location = 6) in mat4 instanceMatrix;
-
+#endif
+#endif
+#ifdef ALPHA_TEST
+#ifdef SHADOW_LAYERED
+out vec2 GeomTexCoord;
+#else
 out vec2 TexCoord;
+#endif
+#endif
 
-uniform mat4 lightSpaceMatrix;
+#include "include/shadows.glsl"
+#ifdef FOLIAGE
+#include "include/foliage.glsl"
+#elif !defined(VERTEX_PULLING)
+#include "include/instance.glsl"
+#endif
+#ifdef SKINNED
+#include "include/skinning.glsl"
+#endif
+uniform int shadowView; // Rendered into its tile through the viewport
 
 void main() {
+#ifdef SKINNED
+    vec4 position = skinMatrix() * vec4(aPos, 1.0);
+#elif defined(FOLIAGE)
+    vec4 position = vec4(foliageBend(aPos), 1.0);
+#else
+    vec4 position = vec4(aPos, 1.0);
+#endif
+#ifdef SHADOW_LAYERED
+    // World space, shadow_cube.gs projects it into each face
+#ifdef ALPHA_TEST
+    GeomTexCoord = aTexCoords;
+#endif
+    gl_Position = instanceModel() * position;
+#else
+#ifdef ALPHA_TEST
     TexCoord = aTexCoords;
-    gl_Position = lightSpaceMatrix * instanceMatrix * vec4(aPos, 1.0);
-}
\ No newline at end of file
+#endif
+    gl_Position = lightSpaceMatrices[shadowView] * instanceModel() * position;
+#endif
+}
@@ -0,0 +1,58 @@
+// Point light cube faces in one pass, each triangle goes to the faces whose frustum it touches.
+// With GS invocations (SHADOW_GS_INVOCATIONS, GL 4.0) each face runs as its own invocation.
+#define SHADOW_CUBE_FACES 6
+#ifdef SHADOW_GS_INVOCATIONS
+layout(triangles, invocations = SHADOW_CUBE_FACES) in;
+layout(triangle_strip, max_vertices = 3) out;
+#else
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 18) out;
+#endif
+
+#ifdef ALPHA_TEST
+in vec2 GeomTexCoord[];
+out vec2 TexCoord;
+#endif
+
+#include "include/shadows.glsl"
+uniform int firstView; // The +X face, the others follow
+
+// The viewport covers the whole page, so each face is moved into its tile here and clipped
+// to it with gl_ClipDistance 0-3
+void emitFace(int face) {
+    int view = firstView + face;
+    vec4 clip[3];
+    for (int i = 0; i < 3; ++i) clip[i] = lightSpaceMatrices[view] * gl_in[i].gl_Position;
+
+    // Skip the face when all three corners are outside the same clip plane
+    for (int axis = 0; axis < 3; ++axis) {
+        if (clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w && clip[2][axis] < -clip[2].w) return;
+        if (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w && clip[2][axis] > clip[2].w) return;
+    }
+
+    vec4 tile = shadowTiles[view];
+    for (int i = 0; i < 3; ++i) {
+        vec4 p = clip[i];
+        gl_ClipDistance[0] = p.w + p.x;
+        gl_ClipDistance[1] = p.w - p.x;
+        gl_ClipDistance[2] = p.w + p.y;
+        gl_ClipDistance[3] = p.w - p.y;
+        // NDC [-1, 1] to the tile's [corner, corner + size] in uv, then back to NDC
+        p.xy = p.xy * tile.z + p.w * (tile.xy * 2.0 + tile.z - 1.0);
+        gl_Layer = int(tile.w);
+        gl_Position = p;
+#ifdef ALPHA_TEST
+        TexCoord = GeomTexCoord[i];
+#endif
+        EmitVertex();
+    }
+    EndPrimitive();
+}
+
+void main() {
+#ifdef SHADOW_GS_INVOCATIONS
+    emitFace(gl_InvocationID);
+#else
+    for (int face = 0; face < SHADOW_CUBE_FACES; ++face) emitFace(face);
+#endif
+}
@@ -0,0 +1,38 @@
+// Turns shadow depth into EVSM moments and blurs them, one direction of the separable filter per
+// pass. Runs per atlas tile with the viewport on it, taps are clamped to the tile so no tile
+// bleeds into its neighbours.
+uniform sampler2DArray depthMap; // Compare mode off while this runs
+uniform sampler2D blurredRows;   // The first pass' output
+uniform int blurPass;            // 0 = depth to moments, blurred along x; 1 = along y
+uniform int layer;
+uniform ivec3 tileRect;          // Corner and size in texels
+uniform vec2 momentExponents;    // shadow_moment_exponents
+
+out vec4 Moments;
+
+// 5-tap Gaussian, sigma 1
+const float WEIGHTS[3] = float[](0.402620, 0.244201, 0.054489);
+
+// Must match momentShadow() in pbr.fs
+vec4 warpDepth(float depth) {
+    float d = depth * 2.0 - 1.0;
+    float positive = exp(momentExponents.x * d);
+    float negative = -exp(-momentExponents.y * d);
+    return vec4(positive, positive * positive, negative, negative * negative);
+}
+
+void main() {
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    ivec2 lo = tileRect.xy;
+    ivec2 hi = tileRect.xy + tileRect.z - 1;
+    ivec2 axis = blurPass == 0 ? ivec2(1, 0) : ivec2(0, 1);
+
+    vec4 sum = vec4(0.0);
+    for (int i = -2; i <= 2; ++i) {
+        ivec2 tap = clamp(coord + axis * i, lo, hi);
+        vec4 moments = blurPass == 0 ? warpDepth(texelFetch(depthMap, ivec3(tap, layer), 0).r)
+                                     : texelFetch(blurredRows, tap, 0);
+        sum += moments * WEIGHTS[abs(i)];
+    }
+    Moments = sum;
+}
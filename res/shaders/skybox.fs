@@ -1,6 +1,9 @@
 out vec4 FragColor;
 in vec3 TexCoords;
-uniform samplerCube skybox;
+uniform samplerCube skybox; // sRGB, decodes to linear like the scene target
+#include "include/camera.glsl"
+#include "include/lights.glsl"
+#include "include/volumetric_fog.glsl"
 void main() {
-    FragColor = texture(skybox, TexCoords);
+    FragColor = vec4(applyVolumetricFogFar(texture(skybox, TexCoords).rgb, normalize(TexCoords)), 1.0);
 }
@@ -1,9 +1,11 @@
-layout (location = 0) in vec3 aPos;
+// Fullscreen triangle on the far plane, no vertex buffers. Depth 1 fails GL_LEQUAL wherever the
+// scene drew, early, since nothing here writes depth.
 out vec3 TexCoords;
-uniform mat4 projection;
-uniform mat4 view;
+#include "include/camera.glsl"
 void main() {
-    TexCoords = aPos;
-    vec4 pos = projection * view * vec4(aPos, 1.0);
-    gl_Position = pos.xyww; // Make skybox always at far plane
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(corner, 1.0, 1.0);
+    // Back through the view-projection without its translation, to a direction
+    vec4 viewDir = inverse(projection) * gl_Position;
+    TexCoords = transpose(mat3(view)) * (viewDir.xyz / viewDir.w);
 }
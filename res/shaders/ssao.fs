@@ -0,0 +1,100 @@
+// Screen-space ambient occlusion at half resolution, see ssao.h. Each pixel reads the full-resolution
+// depth texel at twice its coordinate, which ssao_upsample.fs weighs it by again.
+uniform highp sampler2D depthMap;     // This frame's prepass depth
+uniform highp sampler2D historyDepth; // Last frame's, to tell disocclusions from the history
+uniform sampler2D historyAO;          // Last frame's result
+uniform mat4 projection;
+uniform mat4 inverseProjection;
+uniform mat4 reprojection; // View space to last frame's clip space
+uniform float radius;
+uniform float intensity;
+uniform int directions;
+uniform int steps;
+uniform int frameIndex;
+uniform float historyWeight; // 0 without a usable history
+uniform float historyTolerance;
+
+out float AO;
+
+const float PI = 3.14159265;
+
+vec3 viewPosition(ivec2 pixel, float depth) {
+    vec2 ndc = (vec2(pixel) + 0.5) / vec2(textureSize(depthMap, 0)) * 2.0 - 1.0;
+    vec4 position = inverseProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
+}
+
+vec3 viewPositionAt(ivec2 pixel) {
+    pixel = clamp(pixel, ivec2(0), textureSize(depthMap, 0) - 1);
+    return viewPosition(pixel, texelFetch(depthMap, pixel, 0).r);
+}
+
+// Distance along the view axis from a [0, 1] depth
+float linearDepth(float depth) {
+    return projection[3][2] / (depth * 2.0 - 1.0 + projection[2][2]);
+}
+
+// Jimenez's interleaved gradient noise, decorrelated between frames by the frame index
+float gradientNoise(vec2 pixel) {
+    pixel += float(frameIndex) * 5.588238;
+    return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy) * 2;
+    float depth = texelFetch(depthMap, pixel, 0).r;
+    if (depth >= 1.0) {
+        AO = 1.0;
+        return;
+    }
+    vec3 P = viewPosition(pixel, depth);
+
+    // Normal from whichever neighbour on each axis is nearer in depth, so edges don't blur it
+    vec3 right = viewPositionAt(pixel + ivec2(1, 0)) - P;
+    vec3 left = P - viewPositionAt(pixel - ivec2(1, 0));
+    vec3 up = viewPositionAt(pixel + ivec2(0, 1)) - P;
+    vec3 down = P - viewPositionAt(pixel - ivec2(0, 1));
+    vec3 dx = abs(right.z) < abs(left.z) ? right : left;
+    vec3 dy = abs(up.z) < abs(down.z) ? up : down;
+    vec3 N = normalize(cross(dx, dy));
+
+    // The radius in full-resolution pixels at this depth, capped so near surfaces stay cheap
+    float screenRadius = min(radius * projection[1][1] * 0.5 * float(textureSize(depthMap, 0).y) / -P.z, 256.0);
+    if (screenRadius < 1.0) {
+        AO = 1.0;
+        return;
+    }
+
+    float noise = gradientNoise(gl_FragCoord.xy);
+    float radius2 = radius * radius;
+    float occlusion = 0.0;
+    for (int d = 0; d < directions; ++d) {
+        float angle = (float(d) + noise) * PI / float(directions);
+        vec2 direction = vec2(cos(angle), sin(angle));
+        for (int s = 0; s < steps; ++s) {
+            float reach = (float(s) + fract(noise + float(s) * 0.618034)) / float(steps) * screenRadius + 1.0;
+            for (int side = -1; side <= 1; side += 2) {
+                vec3 v = viewPositionAt(pixel + ivec2(direction * reach * float(side))) - P;
+                float v2 = dot(v, v);
+                // Samples above the surface occlude, less towards the radius
+                float falloff = max(1.0 - v2 / radius2, 0.0);
+                occlusion += max(dot(N, v) * inversesqrt(max(v2, 1e-6)) - 0.1, 0.0) * falloff;
+            }
+        }
+    }
+    float ao = clamp(1.0 - occlusion * intensity / float(directions * steps * 2), 0.0, 1.0);
+
+    // Last frame's result where this surface was already visible
+    if (historyWeight > 0.0) {
+        vec4 clip = reprojection * vec4(P, 1.0);
+        vec3 previous = clip.xyz / clip.w * 0.5 + 0.5;
+        if (all(greaterThanEqual(previous.xy, vec2(0.0))) && all(lessThanEqual(previous.xy, vec2(1.0)))) {
+            float expected = linearDepth(previous.z);
+            float stored = linearDepth(texture(historyDepth, previous.xy).r);
+            if (abs(stored - expected) < expected * historyTolerance) {
+                ao = mix(ao, texture(historyAO, previous.xy).r, historyWeight);
+            }
+        }
+    }
+    AO = ao;
+}
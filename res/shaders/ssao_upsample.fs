@@ -0,0 +1,39 @@
+// Half-resolution SSAO to full resolution, see ssao.h. The four nearest half-resolution results
+// are weighed bilinearly and by how close the depth they were computed at is to this pixel's.
+uniform highp sampler2D depthMap;
+uniform sampler2D aoMap;
+uniform mat4 projection;
+
+out float AO;
+
+float linearDepth(float depth) {
+    return projection[3][2] / (depth * 2.0 - 1.0 + projection[2][2]);
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(depthMap, pixel, 0).r;
+    if (depth >= 1.0) {
+        AO = 1.0;
+        return;
+    }
+    float center = linearDepth(depth);
+
+    // The half-resolution texel over this pixel and its neighbours on the pixel's side
+    ivec2 halfSize = textureSize(aoMap, 0);
+    ivec2 base = min(pixel / 2, halfSize - 1);
+    ivec2 side = (pixel & 1) * 2 - 1;
+    ivec2 offsets[4] = ivec2[4](ivec2(0, 0), ivec2(side.x, 0), ivec2(0, side.y), side);
+    float bilinear[4] = float[4](9.0 / 16.0, 3.0 / 16.0, 3.0 / 16.0, 1.0 / 16.0);
+
+    float sum = 0.0;
+    float weights = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 coord = clamp(base + offsets[i], ivec2(0), halfSize - 1);
+        float sampleDepth = linearDepth(texelFetch(depthMap, coord * 2, 0).r);
+        float weight = bilinear[i] / (1e-3 + abs(sampleDepth - center) / center);
+        sum += texelFetch(aoMap, coord, 0).r * weight;
+        weights += weight;
+    }
+    AO = sum / weights;
+}
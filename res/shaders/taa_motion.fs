@@ -0,0 +1,9 @@
+in vec4 CurrentClip;
+in vec4 PreviousClip;
+
+out vec4 Velocity;
+
+void main() {
+    // In uv, this frame's position minus last frame's
+    Velocity = vec4((CurrentClip.xy / CurrentClip.w - PreviousClip.xy / PreviousClip.w) * 0.5, 0.0, 0.0);
+}
@@ -0,0 +1,19 @@
+// Motion vectors of the entities that moved, over the scene depth, see temporal_aa.h
+layout(location = 0) in vec3 aPos;
+
+#include "include/camera.glsl"
+#include "include/instance.glsl"
+
+uniform mat4 previousModel;
+uniform mat4 currentViewProjection;  // Unjittered
+uniform mat4 previousViewProjection; // Unjittered
+
+out vec4 CurrentClip;
+out vec4 PreviousClip;
+
+void main() {
+    // The prepass' expression, so the depth test against its depth passes exactly
+    gl_Position = projection * view * instanceModel() * vec4(aPos, 1.0);
+    CurrentClip = currentViewProjection * instanceModel() * vec4(aPos, 1.0);
+    PreviousClip = previousViewProjection * previousModel * vec4(aPos, 1.0);
+}
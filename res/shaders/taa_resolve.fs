@@ -0,0 +1,70 @@
+// Temporal accumulation at output resolution from the jittered render-resolution scene, see
+// temporal_aa.h
+uniform sampler2D sceneColor;  // Linear HDR, render size
+uniform sampler2D sceneDepth;
+uniform sampler2D velocityMap; // Unjittered uv motion of moved entities, TAA_NO_MOTION elsewhere
+uniform sampler2D history;     // Output size
+uniform vec2 outputSize;
+uniform vec2 renderSize;
+uniform vec2 jitterPixels;     // This frame's offset, in render pixels
+uniform mat4 inverseViewProjection;
+uniform mat4 previousViewProjection;
+uniform float blendFactor;
+uniform bool historyValid;
+
+#define TAA_NO_MOTION 64.0
+
+out vec4 FragColor;
+
+// Blends in a space where a single bright sample can't dominate its neighbours
+float luminanceWeight(vec3 color) {
+    return 1.0 / (1.0 + dot(color, vec3(0.2126, 0.7152, 0.0722)));
+}
+
+void main() {
+    vec2 uv = gl_FragCoord.xy / outputSize;
+
+    // The render sample nearest the output pixel centre, and how far off it landed this frame
+    vec2 renderPos = uv * renderSize - 0.5 + jitterPixels;
+    ivec2 maxTexel = ivec2(renderSize) - 1;
+    ivec2 nearest = clamp(ivec2(floor(renderPos + 0.5)), ivec2(0), maxTexel);
+    vec2 offset = renderPos - vec2(nearest);
+    // Blackman-Harris fitted as a Gaussian, in render pixels
+    float sampleWeight = exp(-2.29 * dot(offset, offset));
+
+    vec3 current = texelFetch(sceneColor, nearest, 0).rgb;
+    vec3 neighbourhoodMin = current;
+    vec3 neighbourhoodMax = current;
+    for (int y = -1; y <= 1; ++y) {
+        for (int x = -1; x <= 1; ++x) {
+            vec3 neighbour = texelFetch(sceneColor, clamp(nearest + ivec2(x, y), ivec2(0), maxTexel), 0).rgb;
+            neighbourhoodMin = min(neighbourhoodMin, neighbour);
+            neighbourhoodMax = max(neighbourhoodMax, neighbour);
+        }
+    }
+    // Where no history survives, the bilinear estimate at the pixel centre beats the nearest sample
+    vec3 filtered = texture(sceneColor, (uv * renderSize + jitterPixels) / renderSize).rgb;
+
+    // Where the sample's surface was last frame, from its entity's motion or from the camera's
+    vec2 velocity = texelFetch(velocityMap, nearest, 0).rg;
+    if (velocity.x >= TAA_NO_MOTION * 0.5) {
+        float depth = texelFetch(sceneDepth, nearest, 0).r;
+        vec2 sampleUV = (vec2(nearest) + 0.5) / renderSize;
+        vec4 world = inverseViewProjection * vec4(vec3(sampleUV, depth) * 2.0 - 1.0, 1.0);
+        vec4 previous = previousViewProjection * vec4(world.xyz / world.w, 1.0);
+        vec2 unjitteredUV = sampleUV - jitterPixels / renderSize;
+        velocity = unjitteredUV - (previous.xy / previous.w * 0.5 + 0.5);
+    }
+    vec2 historyUV = uv - velocity;
+
+    if (!historyValid || any(lessThan(historyUV, vec2(0.0))) || any(greaterThan(historyUV, vec2(1.0)))) {
+        FragColor = vec4(filtered, 1.0);
+        return;
+    }
+
+    vec3 previousColor = clamp(texture(history, historyUV).rgb, neighbourhoodMin, neighbourhoodMax);
+    float alpha = clamp(blendFactor * sampleWeight, 0.0, 1.0);
+    float currentWeight = alpha * luminanceWeight(current);
+    float historyWeight = (1.0 - alpha) * luminanceWeight(previousColor);
+    FragColor = vec4((current * currentWeight + previousColor * historyWeight) / max(currentWeight + historyWeight, 1e-5), 1.0);
+}
@@ -1,8 +1,7 @@
 out vec4 FragColor;
 
-uniform vec3 emissiveColor;
-uniform float emissiveIntensity;
+in vec3 Emissive;
 
 void main() {
-    FragColor = vec4(emissiveColor * emissiveIntensity, 1.0);
+    FragColor = vec4(Emissive, 1.0);
 }
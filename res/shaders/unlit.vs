@@ -1,9 +1,12 @@
 layout (location = 0) in vec3 aPos;
+layout (location = 12) in vec4 instanceEmissive; // Light colour times intensity
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+out vec3 Emissive;
+
+#include "include/camera.glsl"
+#include "include/instance.glsl"
 
 void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    Emissive = instanceEmissive.rgb;
+    gl_Position = viewProjection * instanceModel() * vec4(aPos, 1.0);
 }
@@ -0,0 +1,33 @@
+// One slice of the integrated froxel volume (volumetric_fog.h) after hiz.vs: the scatter
+// volume's slices summed front to back up to this one's middle, where the trilinear lookups
+// take it. Each slice's light is integrated over its length against its own extinction
+// (Hillaire 2015), so thick slices don't add more than they let through.
+#include "include/camera.glsl"
+#include "include/lights.glsl"
+#include "include/volumetric_fog.glsl"
+
+uniform sampler3D scatter;
+uniform int slice;
+uniform vec2 volumeSize;
+
+out vec4 FragColor;
+
+void main() {
+    ivec2 froxel = ivec2(gl_FragCoord.xy);
+    // Length along the ray per unit of view depth
+    float rayScale = length(froxelRay(gl_FragCoord.xy / volumeSize * 2.0 - 1.0));
+
+    vec3 scattered = vec3(0.0);
+    float transmittance = 1.0;
+    float sliceNear = froxelDepth(0.0);
+    for (int i = 0; i <= slice; ++i) {
+        float sliceFar = froxelDepth(i == slice ? float(i) + 0.5 : float(i + 1));
+        vec4 s = texelFetch(scatter, ivec3(froxel, i), 0);
+        float extinction = max(s.a, 1e-6);
+        float through = exp(-extinction * (sliceFar - sliceNear) * rayScale);
+        scattered += transmittance * s.rgb * (1.0 - through) / extinction;
+        transmittance *= through;
+        sliceNear = sliceFar;
+    }
+    FragColor = vec4(scattered, transmittance);
+}
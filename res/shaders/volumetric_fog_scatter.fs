@@ -0,0 +1,140 @@
+// One slice of the froxel volume (volumetric_fog.h) after hiz.vs: the light each froxel's fog
+// scatters towards the camera per unit length in rgb, its extinction in a. The lights are
+// pbr.fs' own, directional ones from the block and local ones from the cluster the froxel is
+// in, shadowed with a single compare in the atlas, which the volume's own blur softens.
+#include "include/camera.glsl"
+#include "include/lights.glsl"
+#include "include/volumetric_fog.glsl"
+
+// Must match light_clusters.h
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_INDEX_WIDTH 1024
+
+// Must match frame_uniforms.h
+#define SHADOW_KIND_CASCADES 1
+#define SHADOW_KIND_CUBE 2
+#include "include/shadows.glsl"
+
+uniform sampler2DArrayShadow shadowMap;
+uniform sampler2D clusterLights;
+uniform highp usampler2D clusterGrid;
+uniform highp usampler2D clusterIndices;
+uniform sampler3D history; // Last frame's scatter
+
+uniform int slice;
+uniform vec2 volumeSize;   // Froxels across and down
+uniform float sliceJitter; // Where in its slice the froxel is taken, 0.5 without the history
+uniform float density;
+uniform float heightFalloff;
+uniform float anisotropy;
+uniform float historyWeight; // 0 without a history
+uniform mat4 historyView;
+uniform mat4 historyViewProjection;
+uniform vec2 historyDepth; // Last frame's volumetricDepthScale and volumetricDepthBias
+
+out vec4 FragColor;
+
+const float PI = 3.14159265359;
+
+// Henyey-Greenstein, cosTheta between the light's travel and the direction to the camera
+float phase(float cosTheta) {
+    float g2 = anisotropy * anisotropy;
+    return (1.0 - g2) / (4.0 * PI * pow(max(1.0 + g2 - 2.0 * anisotropy * cosTheta, 1e-4), 1.5));
+}
+
+// The lit fraction of a point in the air: no normal to offset along, one tap
+float froxelShadow(int lightIndex, vec3 p, float viewDepth) {
+    ivec4 info = lightShadows[lightIndex];
+    if (info.y == 0) return 1.0;
+    int shadowView = info.x;
+    if (info.z == SHADOW_KIND_CUBE) {
+        vec3 d = p - lights[lightIndex].position.xyz;
+        vec3 a = abs(d);
+        if (a.x >= a.y && a.x >= a.z) shadowView += d.x > 0.0 ? 0 : 1;
+        else if (a.y >= a.z) shadowView += d.y > 0.0 ? 2 : 3;
+        else shadowView += d.z > 0.0 ? 4 : 5;
+    } else if (info.z == SHADOW_KIND_CASCADES) {
+        int lastView = info.x + info.y - 1;
+        if (viewDepth > shadowViewParams[lastView].y) return 1.0;
+        while (shadowView < lastView && viewDepth > shadowViewParams[shadowView].y) shadowView++;
+    }
+    vec4 light = lightSpaceMatrices[shadowView] * vec4(p, 1.0);
+    vec3 proj = light.xyz / light.w * 0.5 + 0.5;
+    if (any(lessThan(proj, vec3(0.0))) || any(greaterThan(proj, vec3(1.0)))) return 1.0;
+    vec4 tile = shadowTiles[shadowView];
+    return texture(shadowMap, vec4(tile.xy + proj.xy * tile.z, tile.w, proj.z - 0.001));
+}
+
+// Direction to the light and its falloff at p, as lightAttenuation() in pbr.fs
+float attenuation(Light light, vec3 p, out vec3 L) {
+    if (light.position.w == 0.0) {
+        L = normalize(-light.direction.xyz);
+        return 1.0;
+    }
+    vec3 toLight = light.position.xyz - p;
+    float distance = length(toLight);
+    L = toLight / max(distance, 1e-4);
+    float falloff = clamp(1.0 - pow(distance / light.cutoff.z, 4.0), 0.0, 1.0);
+    float result = falloff * falloff / max(distance * distance, 1e-4);
+    if (light.position.w == 2.0) {
+        float theta = dot(L, normalize(-light.direction.xyz));
+        result *= clamp((theta - light.cutoff.x) / (light.direction.w - light.cutoff.x), 0.0, 1.0);
+    }
+    return result;
+}
+
+void main() {
+    vec2 uv = gl_FragCoord.xy / volumeSize;
+    float viewDepth = froxelDepth(float(slice) + sliceJitter);
+    vec3 viewPoint = froxelRay(uv * 2.0 - 1.0) * viewDepth;
+    vec3 p = transpose(mat3(view)) * (viewPoint - view[3].xyz);
+    vec3 V = normalize(viewPos - p);
+
+    float extinction = density * exp(-heightFalloff * max(p.y, 0.0));
+    // Isotropic sky light, the SH's constant band is its mean radiance
+    vec3 radiance = ambientSH[0].rgb * ambientIntensity;
+
+    for (int i = 0; i < lightCount && i < MAX_LIGHTS; ++i) {
+        if (lights[i].position.w != 0.0) break;
+        vec3 L = normalize(-lights[i].direction.xyz);
+        radiance += lights[i].color.rgb * lights[i].color.w * phase(dot(-L, V)) * froxelShadow(i, p, viewDepth);
+    }
+
+    int clusterSlice = int(floor(log(viewDepth) * clusterDepthScale + clusterDepthBias));
+    if (clusterLightCount > 0 && clusterSlice >= 0 && clusterSlice < CLUSTER_Z) {
+        ivec2 tile = ivec2(clamp(uv, 0.0, 0.999) * vec2(CLUSTER_X, CLUSTER_Y));
+        uvec2 range = texelFetch(clusterGrid, ivec2(tile.y * CLUSTER_X + tile.x, clusterSlice), 0).xy;
+        for (uint k = 0u; k < range.y; ++k) {
+            uint entry = range.x + k;
+            int index = int(texelFetch(clusterIndices, ivec2(int(entry % uint(CLUSTER_INDEX_WIDTH)), int(entry / uint(CLUSTER_INDEX_WIDTH))), 0).r);
+            Light light;
+            light.position = texelFetch(clusterLights, ivec2(0, index), 0);
+            light.color = texelFetch(clusterLights, ivec2(1, index), 0);
+            light.direction = texelFetch(clusterLights, ivec2(2, index), 0);
+            light.cutoff = texelFetch(clusterLights, ivec2(3, index), 0);
+            vec3 L;
+            float falloff = attenuation(light, p, L);
+            if (falloff == 0.0) continue;
+            int frameIndex = int(light.cutoff.y);
+            float shadow = frameIndex >= 0 ? froxelShadow(frameIndex, p, viewDepth) : 1.0;
+            radiance += light.color.rgb * light.color.w * falloff * phase(dot(-L, V)) * shadow;
+        }
+    }
+
+    // White fog, everything it takes out of the light it scatters
+    vec4 result = vec4(radiance * extinction, extinction);
+
+    if (historyWeight > 0.0) {
+        vec4 clip = historyViewProjection * vec4(p, 1.0);
+        float depth = -(historyView * vec4(p, 1.0)).z;
+        if (clip.w > 0.0 && depth > 0.0) {
+            vec3 uvw = vec3(clip.xy / clip.w * 0.5 + 0.5, log(depth) * historyDepth.x + historyDepth.y);
+            if (all(greaterThanEqual(uvw, vec3(0.0))) && all(lessThanEqual(uvw, vec3(1.0)))) {
+                result = mix(result, texture(history, uvw), historyWeight);
+            }
+        }
+    }
+    FragColor = result;
+}
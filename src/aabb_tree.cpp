@@ -0,0 +1,343 @@
+#include "aabb_tree.h"
+#include "frustum.h"
+#include <algorithm>
+
+static float surfaceArea(const glm::vec3& bmin, const glm::vec3& bmax) {
+    glm::vec3 d = bmax - bmin;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static bool contains(const glm::vec3& outer_min, const glm::vec3& outer_max, const glm::vec3& bmin, const glm::vec3& bmax) {
+    return glm::all(glm::lessThanEqual(outer_min, bmin)) && glm::all(glm::lessThanEqual(bmax, outer_max));
+}
+
+static bool overlaps(const glm::vec3& amin, const glm::vec3& amax, const glm::vec3& bmin, const glm::vec3& bmax) {
+    return glm::all(glm::lessThanEqual(amin, bmax)) && glm::all(glm::lessThanEqual(bmin, amax));
+}
+
+// Per thread, so queries can run on several at once
+static std::vector<uint32_t>& traversalStack() {
+    thread_local std::vector<uint32_t> stack;
+    return stack;
+}
+
+// ============================================================================
+// NODE POOL
+// ============================================================================
+
+uint32_t AabbTree::allocateNode() {
+    if (free_list == AABB_TREE_NULL) {
+        nodes.emplace_back();
+        return (uint32_t)nodes.size() - 1;
+    }
+    uint32_t node = free_list;
+    free_list = nodes[node].parent;
+    nodes[node] = Node();
+    return node;
+}
+
+void AabbTree::freeNode(uint32_t node) {
+    nodes[node].parent = free_list;
+    nodes[node].height = -1;
+    free_list = node;
+}
+
+void AabbTree::clear() {
+    nodes.clear();
+    root = AABB_TREE_NULL;
+    free_list = AABB_TREE_NULL;
+    leaf_count = 0;
+}
+
+// ============================================================================
+// PROXIES
+// ============================================================================
+
+uint32_t AabbTree::insert(const glm::vec3& bmin, const glm::vec3& bmax, uint32_t user) {
+    uint32_t leaf = allocateNode();
+    glm::vec3 margin = (bmax - bmin) * AABB_TREE_MARGIN + glm::vec3(0.01f);
+    nodes[leaf].bmin = bmin - margin;
+    nodes[leaf].bmax = bmax + margin;
+    nodes[leaf].user = user;
+    nodes[leaf].height = 0;
+    insertLeaf(leaf);
+    leaf_count++;
+    return leaf;
+}
+
+void AabbTree::remove(uint32_t proxy) {
+    removeLeaf(proxy);
+    freeNode(proxy);
+    leaf_count--;
+}
+
+bool AabbTree::move(uint32_t proxy, const glm::vec3& bmin, const glm::vec3& bmax) {
+    if (contains(nodes[proxy].bmin, nodes[proxy].bmax, bmin, bmax)) return false;
+
+    removeLeaf(proxy);
+    glm::vec3 margin = (bmax - bmin) * AABB_TREE_MARGIN + glm::vec3(0.01f);
+    nodes[proxy].bmin = bmin - margin;
+    nodes[proxy].bmax = bmax + margin;
+    insertLeaf(proxy);
+    return true;
+}
+
+// ============================================================================
+// STRUCTURE
+// ============================================================================
+
+void AabbTree::insertLeaf(uint32_t leaf) {
+    if (root == AABB_TREE_NULL) {
+        root = leaf;
+        nodes[root].parent = AABB_TREE_NULL;
+        return;
+    }
+
+    // Walk down towards the sibling that grows the total surface area least
+    const glm::vec3 leaf_min = nodes[leaf].bmin, leaf_max = nodes[leaf].bmax;
+    uint32_t index = root;
+    while (!nodes[index].isLeaf()) {
+        const Node& node = nodes[index];
+        float area = surfaceArea(node.bmin, node.bmax);
+        float combined = surfaceArea(glm::min(node.bmin, leaf_min), glm::max(node.bmax, leaf_max));
+
+        // Cost of pairing with this node, and the minimum it pushes down to the children
+        float cost = 2.0f * combined;
+        float inheritance = 2.0f * (combined - area);
+
+        auto descendCost = [&](uint32_t child) {
+            const Node& c = nodes[child];
+            float grown = surfaceArea(glm::min(c.bmin, leaf_min), glm::max(c.bmax, leaf_max));
+            return c.isLeaf() ? grown + inheritance : grown - surfaceArea(c.bmin, c.bmax) + inheritance;
+        };
+        float cost1 = descendCost(node.child1);
+        float cost2 = descendCost(node.child2);
+
+        if (cost < cost1 && cost < cost2) break;
+        index = cost1 < cost2 ? node.child1 : node.child2;
+    }
+
+    // New parent above the sibling
+    uint32_t sibling = index;
+    uint32_t old_parent = nodes[sibling].parent;
+    uint32_t new_parent = allocateNode();
+    nodes[new_parent].parent = old_parent;
+    nodes[new_parent].bmin = glm::min(leaf_min, nodes[sibling].bmin);
+    nodes[new_parent].bmax = glm::max(leaf_max, nodes[sibling].bmax);
+    nodes[new_parent].height = nodes[sibling].height + 1;
+    nodes[new_parent].child1 = sibling;
+    nodes[new_parent].child2 = leaf;
+    nodes[sibling].parent = new_parent;
+    nodes[leaf].parent = new_parent;
+
+    if (old_parent == AABB_TREE_NULL) {
+        root = new_parent;
+    } else if (nodes[old_parent].child1 == sibling) {
+        nodes[old_parent].child1 = new_parent;
+    } else {
+        nodes[old_parent].child2 = new_parent;
+    }
+
+    // Refit and rebalance up to the root
+    for (index = nodes[leaf].parent; index != AABB_TREE_NULL; index = nodes[index].parent) {
+        index = balance(index);
+        const Node& c1 = nodes[nodes[index].child1];
+        const Node& c2 = nodes[nodes[index].child2];
+        nodes[index].height = 1 + std::max(c1.height, c2.height);
+        nodes[index].bmin = glm::min(c1.bmin, c2.bmin);
+        nodes[index].bmax = glm::max(c1.bmax, c2.bmax);
+    }
+}
+
+void AabbTree::removeLeaf(uint32_t leaf) {
+    if (leaf == root) {
+        root = AABB_TREE_NULL;
+        return;
+    }
+
+    // The sibling takes the parent's place
+    uint32_t parent = nodes[leaf].parent;
+    uint32_t grand_parent = nodes[parent].parent;
+    uint32_t sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+    if (grand_parent == AABB_TREE_NULL) {
+        root = sibling;
+        nodes[sibling].parent = AABB_TREE_NULL;
+        freeNode(parent);
+        return;
+    }
+
+    if (nodes[grand_parent].child1 == parent) {
+        nodes[grand_parent].child1 = sibling;
+    } else {
+        nodes[grand_parent].child2 = sibling;
+    }
+    nodes[sibling].parent = grand_parent;
+    freeNode(parent);
+
+    for (uint32_t index = grand_parent; index != AABB_TREE_NULL; index = nodes[index].parent) {
+        index = balance(index);
+        const Node& c1 = nodes[nodes[index].child1];
+        const Node& c2 = nodes[nodes[index].child2];
+        nodes[index].bmin = glm::min(c1.bmin, c2.bmin);
+        nodes[index].bmax = glm::max(c1.bmax, c2.bmax);
+        nodes[index].height = 1 + std::max(c1.height, c2.height);
+    }
+}
+
+// Rotates the taller child up when the subtree heights differ by more than one.
+// Returns the node now at this position.
+uint32_t AabbTree::balance(uint32_t a) {
+    Node& A = nodes[a];
+    if (A.isLeaf() || A.height < 2) return a;
+
+    uint32_t b = A.child1, c = A.child2;
+    int difference = nodes[c].height - nodes[b].height;
+    if (difference >= -1 && difference <= 1) return a;
+
+    // rise is the taller child, it swaps places with a; its taller child stays under it
+    bool rise_c = difference > 1;
+    uint32_t rise = rise_c ? c : b;
+    uint32_t other = rise_c ? b : c;
+    uint32_t f = nodes[rise].child1, g = nodes[rise].child2;
+
+    nodes[rise].child1 = a;
+    nodes[rise].parent = A.parent;
+    A.parent = rise;
+    if (nodes[rise].parent == AABB_TREE_NULL) {
+        root = rise;
+    } else if (nodes[nodes[rise].parent].child1 == a) {
+        nodes[nodes[rise].parent].child1 = rise;
+    } else {
+        nodes[nodes[rise].parent].child2 = rise;
+    }
+
+    uint32_t keep = nodes[f].height > nodes[g].height ? f : g;
+    uint32_t give = keep == f ? g : f;
+    nodes[rise].child2 = keep;
+    if (rise_c) {
+        A.child2 = give;
+    } else {
+        A.child1 = give;
+    }
+    nodes[give].parent = a;
+
+    A.bmin = glm::min(nodes[other].bmin, nodes[give].bmin);
+    A.bmax = glm::max(nodes[other].bmax, nodes[give].bmax);
+    A.height = 1 + std::max(nodes[other].height, nodes[give].height);
+    nodes[rise].bmin = glm::min(A.bmin, nodes[keep].bmin);
+    nodes[rise].bmax = glm::max(A.bmax, nodes[keep].bmax);
+    nodes[rise].height = 1 + std::max(A.height, nodes[keep].height);
+    return rise;
+}
+
+// ============================================================================
+// QUERIES
+// ============================================================================
+
+void AabbTree::collectLeaves(uint32_t node, std::vector<uint32_t>& out) const {
+    std::vector<uint32_t>& stack = traversalStack();
+    size_t base = stack.size();
+    stack.push_back(node);
+    while (stack.size() > base) {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        const Node& n = nodes[index];
+        if (n.isLeaf()) {
+            out.push_back(n.user);
+        } else {
+            stack.push_back(n.child1);
+            stack.push_back(n.child2);
+        }
+    }
+}
+
+void AabbTree::queryFrustum(const Frustum& frustum, std::vector<uint32_t>& out) const {
+    if (root == AABB_TREE_NULL) return;
+
+    std::vector<uint32_t>& stack = traversalStack();
+    stack.clear();
+    stack.push_back(root);
+    while (!stack.empty()) {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        const Node& node = nodes[index];
+
+        // Outside any plane rejects the subtree, inside all of them accepts it untested
+        bool inside = true;
+        bool outside = false;
+        for (int i = 0; i < 6 && !outside; i++) {
+            glm::vec3 normal(frustum.planes[i]);
+            glm::vec3 far_corner(normal.x >= 0.0f ? node.bmax.x : node.bmin.x, normal.y >= 0.0f ? node.bmax.y : node.bmin.y,
+                                 normal.z >= 0.0f ? node.bmax.z : node.bmin.z);
+            glm::vec3 near_corner(normal.x >= 0.0f ? node.bmin.x : node.bmax.x, normal.y >= 0.0f ? node.bmin.y : node.bmax.y,
+                                  normal.z >= 0.0f ? node.bmin.z : node.bmax.z);
+            if (glm::dot(normal, far_corner) + frustum.planes[i].w < 0.0f) outside = true;
+            else if (glm::dot(normal, near_corner) + frustum.planes[i].w < 0.0f) inside = false;
+        }
+        if (outside) continue;
+
+        if (node.isLeaf()) {
+            out.push_back(node.user);
+        } else if (inside) {
+            collectLeaves(index, out);
+        } else {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+void AabbTree::queryBox(const glm::vec3& bmin, const glm::vec3& bmax, std::vector<uint32_t>& out) const {
+    if (root == AABB_TREE_NULL) return;
+
+    std::vector<uint32_t>& stack = traversalStack();
+    stack.clear();
+    stack.push_back(root);
+    while (!stack.empty()) {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        const Node& node = nodes[index];
+        if (!overlaps(node.bmin, node.bmax, bmin, bmax)) continue;
+
+        if (node.isLeaf()) {
+            out.push_back(node.user);
+        } else {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+float AabbTree::rayEntry(const glm::vec3& bmin, const glm::vec3& bmax, const glm::vec3& origin, const glm::vec3& inverse_direction, float max_distance) {
+    // Slabs; an axis the ray runs parallel to gives infinities, which the min/max sort out
+    const glm::vec3 t0 = (bmin - origin) * inverse_direction;
+    const glm::vec3 t1 = (bmax - origin) * inverse_direction;
+    const glm::vec3 near = glm::min(t0, t1), far = glm::max(t0, t1);
+    const float entry = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+    const float exit = std::min(std::min(far.x, far.y), std::min(far.z, max_distance));
+    return entry <= exit ? entry : -1.0f;
+}
+
+void AabbTree::queryRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance, std::vector<std::pair<float, uint32_t>>& out) const {
+    if (root == AABB_TREE_NULL) return;
+
+    const glm::vec3 inverse_direction = 1.0f / direction;
+    std::vector<uint32_t>& stack = traversalStack();
+    stack.clear();
+    stack.push_back(root);
+    while (!stack.empty()) {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        const Node& node = nodes[index];
+        const float entry = rayEntry(node.bmin, node.bmax, origin, inverse_direction, max_distance);
+        if (entry < 0.0f) continue;
+
+        if (node.isLeaf()) {
+            out.emplace_back(entry, node.user);
+        } else {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
@@ -0,0 +1,248 @@
+#include "asset_fetch.h"
+#include "asset_pack.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#ifdef __EMSCRIPTEN__
+    #include <emscripten.h>
+    #include <emscripten/fetch.h>
+#endif
+
+AssetFetcher asset_fetch;
+
+bool AssetFetcher::init(const std::string& manifest_path) {
+#ifdef __EMSCRIPTEN__
+    std::ifstream in(manifest_path);
+    if (!in) {
+        printf("Asset fetch: no manifest at %s, assuming every asset was preloaded\n", manifest_path.c_str());
+        return false;
+    }
+
+    // Either "pack <url>", the files then being the pack's entries, or one "<size> <mtime> <path>"
+    // per line, the path last since it may hold spaces
+    std::string line;
+    if (std::getline(in, line) && line.compare(0, 5, "pack ") == 0) {
+        pack_url = line.substr(5);
+        if (!loadPackIndex()) return false;
+        active = true;
+        printf("Asset fetch: %zu files in %s\n", files.size(), pack_url.c_str());
+        return true;
+    }
+    in.clear();
+    in.seekg(0);
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        File file;
+        if (!(fields >> file.size >> file.mtime)) continue;
+        std::getline(fields >> std::ws, file.path);
+        if (file.path.empty()) continue;
+        files.push_back(std::move(file));
+    }
+    active = true;
+    printf("Asset fetch: %zu files in the manifest\n", files.size());
+    return true;
+#else
+    (void)manifest_path;
+    return false;
+#endif
+}
+
+void AssetFetcher::fetchPrefix(const std::string& prefix, AssetPriority priority) {
+    if (!active) return;
+    for (size_t i = 0; i < files.size(); ++i) {
+        File& file = files[i];
+        if (file.path.compare(0, prefix.size(), prefix) != 0) continue;
+        if (file.state == FILE_REMOTE || (file.state == FILE_QUEUED && priority < file.priority)) {
+            // A promoted file is queued again, its old entry is skipped when it comes up
+            file.state = FILE_QUEUED;
+            file.priority = priority;
+            Queued entry = {priority, next_order++, i};
+            auto it = std::upper_bound(queue.begin(), queue.end(), entry, [](const Queued& a, const Queued& b) {
+                return a.priority != b.priority ? a.priority < b.priority : a.order < b.order;
+            });
+            queue.insert(it, entry);
+        }
+    }
+    update();
+}
+
+void AssetFetcher::update() {
+    while (in_flight < ASSET_FETCH_MAX_IN_FLIGHT && !queue.empty()) {
+        Queued entry = queue.front();
+        queue.pop_front();
+        File& file = files[entry.file];
+        if (file.state != FILE_QUEUED || file.priority != entry.priority) continue;
+        start(entry.file);
+    }
+}
+
+bool AssetFetcher::ready(const std::string& prefix) const {
+    if (!active) return true;
+    for (const File& file : files) {
+        if (file.path.compare(0, prefix.size(), prefix) != 0) continue;
+        if (file.state != FILE_LOCAL && file.state != FILE_FAILED) return false;
+    }
+    return true;
+}
+
+void AssetFetcher::wait(const std::string& prefix) {
+    fetchPrefix(prefix, ASSET_PRIORITY_CRITICAL);
+    while (!ready(prefix)) {
+        update();
+        yield();
+    }
+}
+
+void AssetFetcher::yield() {
+#ifdef __EMSCRIPTEN__
+    // Needs ASYNCIFY, the fetch callbacks only run once the browser gets control back
+    emscripten_sleep(1);
+#endif
+}
+
+#ifdef __EMSCRIPTEN__
+
+// Spaces in the file names, the rest of res/ is URL-safe
+static std::string encodeURL(const std::string& path) {
+    std::string url;
+    for (char c : path) {
+        if (c == ' ') url += "%20";
+        else url += c;
+    }
+    return url;
+}
+
+static std::string byteRange(uint64_t offset, uint64_t size) {
+    return "bytes=" + std::to_string(offset) + "-" + std::to_string(offset + size - 1);
+}
+
+// Fetches size bytes of the pack at offset and waits for them, only while reading the index
+static bool fetchPackRange(const std::string& url, uint64_t offset, uint64_t size, std::vector<unsigned char>& out) {
+    struct Result {
+        std::vector<unsigned char>* out;
+        bool done = false;
+        bool ok = false;
+    } result;
+    result.out = &out;
+
+    const std::string range = byteRange(offset, size);
+    const char* headers[] = {"Range", range.c_str(), nullptr};
+    emscripten_fetch_attr_t attr;
+    emscripten_fetch_attr_init(&attr);
+    strcpy(attr.requestMethod, "GET");
+    attr.attributes = EMSCRIPTEN_FETCH_LOAD_TO_MEMORY;
+    attr.requestHeaders = headers;
+    attr.userData = &result;
+    attr.onsuccess = [](emscripten_fetch_t* fetch) {
+        Result* result = (Result*)fetch->userData;
+        result->out->assign((const unsigned char*)fetch->data, (const unsigned char*)fetch->data + fetch->numBytes);
+        result->ok = true;
+        result->done = true;
+        emscripten_fetch_close(fetch);
+    };
+    attr.onerror = [](emscripten_fetch_t* fetch) {
+        ((Result*)fetch->userData)->done = true;
+        emscripten_fetch_close(fetch);
+    };
+    emscripten_fetch(&attr, url.c_str());
+    while (!result.done) emscripten_sleep(1);
+    return result.ok && out.size() == size;
+}
+
+bool AssetFetcher::loadPackIndex() {
+    std::vector<unsigned char> bytes;
+    AssetPackHeader header;
+    if (!fetchPackRange(pack_url, 0, sizeof(header), bytes) || !AssetPack::readHeader(bytes.data(), bytes.size(), header)) {
+        printf("Asset fetch: %s isn't a version %d pack\n", pack_url.c_str(), ASSET_PACK_VERSION);
+        return false;
+    }
+    std::vector<AssetPackEntry> entries;
+    if (header.index_size > 0 &&
+        (!fetchPackRange(pack_url, sizeof(header), header.index_size, bytes) ||
+         !AssetPack::readIndex(bytes.data(), bytes.size(), header.entry_count, entries))) {
+        printf("Asset fetch: can't read the index of %s\n", pack_url.c_str());
+        return false;
+    }
+    for (AssetPackEntry& entry : entries) {
+        if (entry.compression != ASSET_PACK_STORED || entry.size == 0) continue;
+        File file;
+        file.path = std::move(entry.path);
+        file.size = entry.size;
+        file.mtime = entry.mtime;
+        file.offset = entry.offset;
+        files.push_back(std::move(file));
+    }
+    return true;
+}
+
+void AssetFetcher::start(size_t index) {
+    File& file = files[index];
+    file.state = FILE_FETCHING;
+    in_flight++;
+
+    // The cached copy lives in IndexedDB under the URL, so a new mtime is a new entry. Pack
+    // entries all share one file, the entry's offset in the URL keeps their cached copies apart.
+    const bool packed = !pack_url.empty();
+    const std::string url = packed ? pack_url + "?entry=" + std::to_string(file.offset) + "&v=" + std::to_string(file.mtime)
+                                   : encodeURL(file.path) + "?v=" + std::to_string(file.mtime);
+    const std::string range = byteRange(file.offset, file.size);
+    const char* headers[] = {"Range", range.c_str(), nullptr};
+    emscripten_fetch_attr_t attr;
+    emscripten_fetch_attr_init(&attr);
+    strcpy(attr.requestMethod, "GET");
+    attr.attributes = EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_PERSIST_FILE;
+    if (packed) attr.requestHeaders = headers; // Copied by emscripten_fetch
+    attr.userData = (void*)index;
+    attr.onsuccess = onSuccess;
+    attr.onerror = onError;
+    emscripten_fetch(&attr, url.c_str());
+}
+
+void AssetFetcher::onSuccess(emscripten_fetch_t* fetch) {
+    File& file = asset_fetch.files[(size_t)fetch->userData];
+    if (fetch->numBytes != file.size) {
+        // A server that ignores Range sends the whole pack
+        printf("Asset fetch: %s came back as %llu bytes instead of %llu\n", file.path.c_str(),
+               (unsigned long long)fetch->numBytes, (unsigned long long)file.size);
+        file.state = FILE_FAILED;
+        asset_fetch.in_flight--;
+        emscripten_fetch_close(fetch);
+        asset_fetch.update();
+        return;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(file.path).parent_path(), ec);
+    std::ofstream out(file.path, std::ios::binary | std::ios::trunc);
+    out.write(fetch->data, (std::streamsize)fetch->numBytes);
+    if (out) {
+        file.state = FILE_LOCAL;
+        asset_fetch.bytes_fetched += fetch->numBytes;
+    } else {
+        printf("Asset fetch: can't write %s\n", file.path.c_str());
+        file.state = FILE_FAILED;
+    }
+    asset_fetch.in_flight--;
+    emscripten_fetch_close(fetch);
+    asset_fetch.update();
+}
+
+void AssetFetcher::onError(emscripten_fetch_t* fetch) {
+    File& file = asset_fetch.files[(size_t)fetch->userData];
+    printf("Asset fetch: %s failed (HTTP %d)\n", file.path.c_str(), (int)fetch->status);
+    file.state = FILE_FAILED;
+    asset_fetch.in_flight--;
+    emscripten_fetch_close(fetch);
+    asset_fetch.update();
+}
+
+#else
+
+void AssetFetcher::start(size_t index) {
+    files[index].state = FILE_LOCAL;
+}
+
+#endif
@@ -0,0 +1,247 @@
+#include "asset_loader.h"
+#include "job_system.h"
+#include "mesh_registry.h"
+#include "mesh.h"
+#include "trace_capture.h"
+#include "gpu_memory.h"
+#include "load_stats.h"
+#include "asset_watcher.h"
+#include "entity_manager.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+
+AssetLoader asset_loader;
+
+// Standalone buffers are tracked unnamed at upload, arena-resident geometry stays the arena's
+static void tagMeshMemory(const Mesh& mesh, const std::string& asset) {
+    for (GLuint buffer : { mesh.VBO, mesh.EBO, mesh.instanceVBO, mesh.instanceFadeVBO, mesh.depthVBO }) {
+        if (!mesh.arena && buffer != 0) gpu_memory.tagBuffer(buffer, asset);
+    }
+    for (const auto& lod : mesh.lods) tagMeshMemory(*lod, asset);
+}
+
+// The model's directory, its materials and textures sit next to it. A model straight in
+// scene_models/ only needs its own file.
+static std::string modelFetchPrefix(const std::string& filepath) {
+    const std::filesystem::path dir = std::filesystem::path(filepath).parent_path();
+    if (dir.empty()) return "res/scene_models/" + filepath;
+    return "res/scene_models/" + dir.generic_string() + "/";
+}
+
+std::shared_ptr<MeshRequest> AssetLoader::loadMeshAsync(const std::string& filepath, AssetPriority priority) {
+    std::string key = MeshRegistry::normalizePath(filepath);
+
+    auto queued = in_flight.find(key);
+    if (queued != in_flight.end()) return queued->second;
+
+    // Declared and not started, whoever holds it sees it load
+    auto lazy = declared.find(key);
+    if (lazy != declared.end()) {
+        auto request = lazy->second.lock();
+        if (request && request->lazy) {
+            request->priority = priority;
+            require(request);
+            return request;
+        }
+        declared.erase(lazy);
+    }
+
+    auto resident = mesh_registry.find(key);
+    if (!resident.empty()) {
+        auto request = std::make_shared<MeshRequest>();
+        request->filepath = filepath;
+        request->meshes = std::move(resident);
+        request->instances = mesh_registry.instances(key);
+        request->ready = true;
+        return request;
+    }
+
+    auto request = std::make_shared<MeshRequest>();
+    request->filepath = filepath;
+    start(request, priority);
+    return request;
+}
+
+std::shared_ptr<MeshRequest> AssetLoader::declareMesh(const std::string& filepath, AssetPriority priority) {
+    std::string key = MeshRegistry::normalizePath(filepath);
+
+    auto queued = in_flight.find(key);
+    if (queued != in_flight.end()) return queued->second;
+    auto lazy = declared.find(key);
+    if (lazy != declared.end()) {
+        if (auto request = lazy->second.lock()) return request;
+    }
+
+    auto request = std::make_shared<MeshRequest>();
+    request->filepath = filepath;
+    request->priority = priority;
+    request->meshes = mesh_registry.find(key);
+    if (!request->meshes.empty()) {
+        request->instances = mesh_registry.instances(key);
+        request->ready = true;
+        return request;
+    }
+    request->lazy = true;
+    declared[key] = request;
+    return request;
+}
+
+void AssetLoader::require(const std::shared_ptr<MeshRequest>& request) {
+    if (!request || !request->lazy) return;
+    request->lazy = false;
+    std::string key = MeshRegistry::normalizePath(request->filepath);
+    declared.erase(key);
+
+    // Uploaded meanwhile through another request
+    auto resident = mesh_registry.find(key);
+    if (!resident.empty()) {
+        request->meshes = std::move(resident);
+        request->instances = mesh_registry.instances(key);
+        request->ready = true;
+        return;
+    }
+    start(request, request->priority);
+}
+
+void AssetLoader::start(const std::shared_ptr<MeshRequest>& request, AssetPriority priority) {
+    const std::string& filepath = request->filepath;
+    auto entry = std::make_shared<PendingMesh>();
+    entry->request = request;
+    entry->fetch_prefix = modelFetchPrefix(filepath);
+    in_flight[MeshRegistry::normalizePath(filepath)] = entry->request;
+    ++pending;
+
+    if (!asset_fetch.ready(entry->fetch_prefix)) {
+        asset_fetch.fetchPrefix(entry->fetch_prefix, priority);
+        fetching.push_back(entry);
+    } else {
+        submitImport(entry);
+    }
+}
+
+void AssetLoader::reloadMeshAsync(const std::string& filepath) {
+    std::string key = MeshRegistry::normalizePath(filepath);
+    if (in_flight.count(key) != 0) return;
+
+    auto entry = std::make_shared<PendingMesh>();
+    entry->request = std::make_shared<MeshRequest>();
+    entry->request->filepath = filepath;
+    entry->reload = true;
+    in_flight[key] = entry->request;
+    ++pending;
+    submitImport(entry);
+}
+
+// The model file and the textures its materials name, embedded ones aside
+static std::vector<std::string> modelSources(const MeshStaging& staging) {
+    std::vector<std::string> sources = {staging.source_path};
+    for (const SubMeshStaging& sub : staging.submeshes) {
+        const MaterialDesc& desc = sub.material;
+        for (const std::string* path : {&desc.albedo_path, &desc.normal_path, &desc.emissive_path, &desc.ao_path,
+                                        &desc.roughness_path, &desc.metallic_path, &desc.height_path, &desc.specular_path}) {
+            if (!path->empty() && (*path)[0] != '*') sources.push_back(*path);
+        }
+    }
+    return sources;
+}
+
+void AssetLoader::submitImport(const std::shared_ptr<PendingMesh>& entry) {
+    job_system.submit([this, entry]() {
+        const auto start = std::chrono::steady_clock::now();
+        entry->imported = importMeshStaging(entry->request->filepath, entry->staging);
+        trace_capture.event("Import mesh", "assets", start, std::chrono::steady_clock::now(), entry->request->filepath);
+        {
+            std::lock_guard<std::mutex> lock(staged_mutex);
+            staged.push_back(entry);
+        }
+        staged_cv.notify_one();
+    });
+}
+
+void AssetLoader::processUploads(double budget_ms) {
+    // Downloaded models go on to import, in the order they were asked for
+    asset_fetch.update();
+    for (auto it = fetching.begin(); it != fetching.end();) {
+        if (asset_fetch.ready((*it)->fetch_prefix)) {
+            submitImport(*it);
+            it = fetching.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(staged_mutex);
+        while (!staged.empty()) {
+            uploading.push_back(std::move(staged.front()));
+            staged.pop_front();
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed_ms = [&start]() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    // Sub-mesh granularity keeps a single large model from blowing the frame budget
+    bool uploaded_any = false;
+    while (!uploading.empty()) {
+        PendingMesh& entry = *uploading.front();
+        MeshRequest& request = *entry.request;
+
+        if (!entry.imported) {
+            printf("Failed to load mesh '%s'\n", request.filepath.c_str());
+            request.failed = true;
+        } else {
+            auto& submeshes = entry.staging.submeshes;
+            while (entry.next_submesh < submeshes.size()) {
+                if (uploaded_any && elapsed_ms() >= budget_ms) return;
+                const auto upload_start = std::chrono::steady_clock::now();
+                {
+                    LoadAssetScope asset(request.filepath);
+                    request.meshes.push_back(uploadSubMeshStaging(submeshes[entry.next_submesh++]));
+                }
+                trace_capture.event("Upload sub-mesh", "assets", upload_start, std::chrono::steady_clock::now(), request.filepath);
+                tagMeshMemory(*request.meshes.back(), request.filepath);
+                uploaded_any = true;
+            }
+            logLoadedMesh(request.filepath, request.meshes, entry.staging.from_cache);
+            const std::string filepath = request.filepath;
+            request.instances = entry.staging.instances;
+            if (!entry.reload) {
+                mesh_registry.add(filepath, request.meshes, request.instances);
+            } else if (mesh_registry.replace(filepath, request.meshes)) {
+                entity_manager.meshesReloaded();
+                // The request's meshes hold the old contents now, out they go
+                request.meshes.clear();
+                printf("Reloaded '%s'\n", filepath.c_str());
+            }
+            asset_watcher.watch("model " + filepath, modelSources(entry.staging),
+                                [filepath]() { asset_loader.reloadMeshAsync(filepath); });
+        }
+
+        request.ready = true;
+        in_flight.erase(MeshRegistry::normalizePath(request.filepath));
+        uploading.pop_front();
+        --pending;
+        ++completed;
+    }
+}
+
+void AssetLoader::finishAll() {
+    while (pending > 0) {
+        processUploads(1e9);
+        if (pending == 0) break;
+
+        // Nothing to import until a download lands
+        if (!fetching.empty() && pending == fetching.size()) {
+            asset_fetch.yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(staged_mutex);
+        staged_cv.wait(lock, [this] { return !staged.empty(); });
+    }
+}
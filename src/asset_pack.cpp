@@ -0,0 +1,198 @@
+#include "asset_pack.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+AssetPack asset_pack;
+
+// Offset, size, mtime, compression and path length ahead of each path
+#define ASSET_PACK_ENTRY_FIXED_SIZE (8 + 8 + 8 + 4 + 4)
+
+// The index's form of a path: relative to the executable path, forward slashes
+static std::string packKey(const std::string& path) {
+    std::filesystem::path key = std::filesystem::path(path).lexically_normal();
+    if (key.is_absolute()) key = key.lexically_relative(executable_path);
+    return key.generic_string();
+}
+
+int AssetPack::parseArg(int argc, char** argv, int i) {
+    if (std::string(argv[i]) != "--write-pack") return 0;
+    if (i + 1 >= argc) {
+        printf("--write-pack needs an output file\n");
+        return -1;
+    }
+    write_path = argv[i + 1];
+    return 2;
+}
+
+// ============================================================================
+// WRITING
+// ============================================================================
+
+bool AssetPack::write() const {
+    std::vector<AssetPackEntry> packed;
+    std::error_code ec;
+    // cache/ holds the cooked meshes and ORM maps, keyed on the mtimes packed with their sources
+    for (const char* root : {"res", "cache"}) {
+        const std::string root_path = buildAssetPath(root);
+        if (std::string(root) == "cache" && !std::filesystem::exists(root_path)) continue;
+        for (const auto& item : std::filesystem::recursive_directory_iterator(root_path, ec)) {
+            if (!item.is_regular_file()) continue;
+            AssetPackEntry entry;
+            entry.path = packKey(item.path().string());
+            entry.size = item.file_size();
+            entry.mtime = getFileModifiedTime(item.path().string());
+            packed.push_back(std::move(entry));
+        }
+        if (ec) break;
+    }
+    if (ec || packed.empty()) {
+        printf("Asset pack: nothing to pack under %s\n", buildAssetPath("res").c_str());
+        return false;
+    }
+    // Path order keeps a directory's files together, as the scene loads them
+    std::sort(packed.begin(), packed.end(), [](const AssetPackEntry& a, const AssetPackEntry& b) { return a.path < b.path; });
+
+    uint64_t index_size = 0;
+    for (const AssetPackEntry& entry : packed) index_size += ASSET_PACK_ENTRY_FIXED_SIZE + entry.path.size();
+    uint64_t offset = sizeof(AssetPackHeader) + index_size;
+    for (AssetPackEntry& entry : packed) {
+        offset = (offset + ASSET_PACK_ALIGNMENT - 1) / ASSET_PACK_ALIGNMENT * ASSET_PACK_ALIGNMENT;
+        entry.offset = offset;
+        offset += entry.size;
+    }
+
+    const std::string temp_path = write_path + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        printf("Asset pack: can't write %s\n", temp_path.c_str());
+        return false;
+    }
+
+    AssetPackHeader header = {};
+    memcpy(header.magic, ASSET_PACK_MAGIC, 4);
+    header.version = ASSET_PACK_VERSION;
+    header.entry_count = (uint32_t)packed.size();
+    header.index_size = index_size;
+    out.write((const char*)&header, sizeof(header));
+    for (const AssetPackEntry& entry : packed) {
+        const uint32_t path_length = (uint32_t)entry.path.size();
+        out.write((const char*)&entry.offset, sizeof(entry.offset));
+        out.write((const char*)&entry.size, sizeof(entry.size));
+        out.write((const char*)&entry.mtime, sizeof(entry.mtime));
+        out.write((const char*)&entry.compression, sizeof(entry.compression));
+        out.write((const char*)&path_length, sizeof(path_length));
+        out.write(entry.path.data(), path_length);
+    }
+
+    const std::vector<char> padding(ASSET_PACK_ALIGNMENT, 0);
+    uint64_t written = sizeof(AssetPackHeader) + index_size;
+    for (const AssetPackEntry& entry : packed) {
+        out.write(padding.data(), (std::streamsize)(entry.offset - written));
+        written = entry.offset;
+        if (entry.size == 0) continue;
+        MappedFile source(buildAssetPath(entry.path));
+        if (!source.isOpen() || source.size() != entry.size) {
+            printf("Asset pack: %s changed while packing\n", entry.path.c_str());
+            return false;
+        }
+        out.write((const char*)source.data(), (std::streamsize)source.size());
+        written += entry.size;
+    }
+    out.close();
+    if (!out) {
+        printf("Asset pack: can't write %s\n", temp_path.c_str());
+        return false;
+    }
+
+    std::filesystem::rename(temp_path, write_path, ec);
+    if (ec) {
+        printf("Asset pack: can't replace %s\n", write_path.c_str());
+        return false;
+    }
+    printf("Asset pack: %zu files, %.1f MB written to %s\n", packed.size(), written / (1024.0 * 1024.0), write_path.c_str());
+    return true;
+}
+
+// ============================================================================
+// READING
+// ============================================================================
+
+bool AssetPack::readHeader(const unsigned char* data, size_t size, AssetPackHeader& header) {
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    return memcmp(header.magic, ASSET_PACK_MAGIC, 4) == 0 && header.version == ASSET_PACK_VERSION;
+}
+
+bool AssetPack::readIndex(const unsigned char* data, size_t size, uint32_t count, std::vector<AssetPackEntry>& entries) {
+    entries.clear();
+    entries.reserve(count);
+    size_t at = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (size - at < ASSET_PACK_ENTRY_FIXED_SIZE) return false;
+        AssetPackEntry entry;
+        uint32_t path_length = 0;
+        memcpy(&entry.offset, data + at, 8);
+        memcpy(&entry.size, data + at + 8, 8);
+        memcpy(&entry.mtime, data + at + 16, 8);
+        memcpy(&entry.compression, data + at + 24, 4);
+        memcpy(&path_length, data + at + 28, 4);
+        at += ASSET_PACK_ENTRY_FIXED_SIZE;
+        if (size - at < path_length) return false;
+        entry.path.assign((const char*)data + at, path_length);
+        at += path_length;
+        entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+bool AssetPack::open(const std::string& path) {
+    entries.clear();
+    by_path.clear();
+    if (!file.open(path)) return false;
+
+    AssetPackHeader header;
+    const bool valid = readHeader(file.data(), file.size(), header) && header.index_size <= file.size() - sizeof(header) &&
+                       readIndex(file.data() + sizeof(header), (size_t)header.index_size, header.entry_count, entries);
+    if (!valid) {
+        printf("Asset pack: %s isn't a version %d pack, reading res/ from disk\n", path.c_str(), ASSET_PACK_VERSION);
+        entries.clear();
+        file.close();
+        return false;
+    }
+
+    size_t skipped = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const AssetPackEntry& entry = entries[i];
+        if (entry.compression != ASSET_PACK_STORED || entry.offset > file.size() || entry.size > file.size() - entry.offset) {
+            skipped++;
+            continue;
+        }
+        by_path.emplace(entry.path, i);
+    }
+    if (skipped > 0) printf("Asset pack: %zu entries of %s can't be read, those come from disk\n", skipped, path.c_str());
+    printf("Asset pack: %zu files mapped from %s\n", by_path.size(), path.c_str());
+    return true;
+}
+
+const AssetPackEntry* AssetPack::lookup(const std::string& path) const {
+    if (by_path.empty()) return nullptr;
+    auto it = by_path.find(packKey(path));
+    return it != by_path.end() ? &entries[it->second] : nullptr;
+}
+
+bool AssetPack::find(const std::string& path, const unsigned char*& data, size_t& size) const {
+    const AssetPackEntry* entry = lookup(path);
+    if (!entry) return false;
+    data = file.data() + entry->offset;
+    size = (size_t)entry->size;
+    return true;
+}
+
+int64_t AssetPack::modifiedTime(const std::string& path) const {
+    const AssetPackEntry* entry = lookup(path);
+    return entry ? entry->mtime : 0;
+}
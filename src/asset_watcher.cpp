@@ -0,0 +1,58 @@
+#include "asset_watcher.h"
+#include "filesystem.h"
+#include "texture_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <unordered_set>
+
+AssetWatcher asset_watcher;
+
+void AssetWatcher::watch(const std::string& owner, const std::vector<std::string>& paths, std::function<void()> reload) {
+#ifdef __EMSCRIPTEN__
+    (void)owner;
+    (void)paths;
+    (void)reload;
+#else
+    Owner& entry = owners[owner];
+    entry.paths = paths;
+    entry.reload = std::move(reload);
+    for (const std::string& path : paths) {
+        if (files.find(path) == files.end()) files[path] = getFileModifiedTime(path);
+    }
+#endif
+}
+
+void AssetWatcher::unwatch(const std::string& owner) {
+    owners.erase(owner);
+}
+
+void AssetWatcher::update() {
+#ifndef __EMSCRIPTEN__
+    if (!enabled || owners.empty()) return;
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_poll < std::chrono::milliseconds(ASSET_WATCH_INTERVAL_MS)) return;
+    last_poll = now;
+
+    std::unordered_set<std::string> changed;
+    for (auto& [path, mtime] : files) {
+        const int64_t current = getFileModifiedTime(path);
+        // A file mid-save can be missing for a moment, it counts once it's back
+        if (current == 0 || current == mtime) continue;
+        mtime = current;
+        changed.insert(path);
+        const size_t evicted = texture_cache.evictSource(path);
+        printf("Changed: %s%s\n", path.c_str(), evicted > 0 ? " (textures evicted)" : "");
+    }
+    if (changed.empty()) return;
+
+    // Reloads may watch again, so they run off a copy
+    std::vector<std::function<void()>> pending;
+    for (const auto& [owner, entry] : owners) {
+        const bool affected = std::any_of(entry.paths.begin(), entry.paths.end(),
+                                          [&](const std::string& path) { return changed.count(path) != 0; });
+        if (affected) pending.push_back(entry.reload);
+    }
+    for (const auto& reload : pending) reload();
+    reloads += pending.size();
+#endif
+}
@@ -0,0 +1,235 @@
+#include "atmosphere.h"
+#include "filesystem.h"
+#include "frame_uniforms.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "gpu_memory.h"
+#include "ibl.h"
+#include "mesh.h" // CullMode
+#include "profiler.h"
+#include "scene_target.h"
+#include "shader.h"
+#include "shader_loading.h"
+#include "volumetric_fog.h"
+
+#include <glm/gtc/constants.hpp>
+#include <cmath>
+#include <cstdio>
+
+Atmosphere atmosphere;
+bool use_atmosphere = true;
+float atmosphere_time_of_day = 10.0f;
+float atmosphere_sun_azimuth = 30.0f;
+float atmosphere_sun_illuminance = 8.0f;
+
+static constexpr UniformId U_SUN_DIRECTION("sunDirection");
+static constexpr UniformId U_SUN_ILLUMINANCE("sunIlluminance");
+static constexpr UniformId U_FACE("face");
+
+static constexpr PipelineState PIPELINE_LUT = PipelineState().depth(false).depthWrite(false).cull(CULL_NONE);
+
+static GLuint createLut(int width, int height, GLenum wrap_s) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_s);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gpu_memory.trackTexture(texture, textureLevelBytes(GL_RGBA16F, width, height), GPU_MEMORY_SKYBOX, "atmosphere");
+    return texture;
+}
+
+static void deleteTexture(GLuint& texture) {
+    if (texture == 0) return;
+    gpu_memory.releaseTexture(texture);
+    glDeleteTextures(1, &texture);
+    texture = 0;
+}
+
+Atmosphere::~Atmosphere() {
+    release();
+}
+
+void Atmosphere::release() {
+    deleteTexture(transmittance_lut);
+    deleteTexture(multiscatter_lut);
+    deleteTexture(sky_view_lut);
+    deleteTexture(environment);
+    if (fbo != 0) glDeleteFramebuffers(1, &fbo);
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+    fbo = vao = 0;
+    sky_view_shader.reset();
+    sky_shader.reset();
+    environment_shader.reset();
+    sun = glm::vec3(0.0f);
+    illuminance = -1.0f;
+}
+
+bool Atmosphere::init() {
+    if (ready()) return true;
+    if (failed) return false;
+    failed = true;
+
+#ifdef __EMSCRIPTEN__
+    if (!hasGLExtension("GL_EXT_color_buffer_float") && !hasGLExtension("EXT_color_buffer_float")) {
+        printf("Atmosphere needs EXT_color_buffer_float, keeping the cubemap sky\n");
+        return false;
+    }
+#endif
+
+    std::unique_ptr<Shader> transmittance_shader, multiscatter_shader;
+    try {
+        const std::string fullscreen = loadShaderFile(buildAssetPath("res/shaders/hiz.vs"));
+        const std::string sky = loadShaderFile(buildAssetPath("res/shaders/atmosphere_sky.fs"));
+        transmittance_shader = std::make_unique<Shader>(fullscreen, loadShaderFile(buildAssetPath("res/shaders/atmosphere_transmittance.fs")));
+        multiscatter_shader = std::make_unique<Shader>(fullscreen, loadShaderFile(buildAssetPath("res/shaders/atmosphere_multiscatter.fs")));
+        sky_view_shader = std::make_unique<Shader>(fullscreen, loadShaderFile(buildAssetPath("res/shaders/atmosphere_sky_view.fs")));
+        sky_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/skybox.vs")), sky);
+        environment_shader = std::make_unique<Shader>(fullscreen, addShaderDefines(sky, "#define CUBE_FACE\n"));
+    } catch (const std::exception& e) {
+        printf("Atmosphere shaders failed (%s), keeping the cubemap sky\n", e.what());
+        release();
+        return false;
+    }
+    bindFrameUniformBlocks(*sky_shader);
+    const float diskCos = std::cos(glm::radians(ATMOSPHERE_SUN_DISK_DEGREES * 0.5f));
+    for (Shader* shader : {sky_shader.get(), environment_shader.get()}) {
+        shader->use();
+        shader->setInt("transmittanceLut", 0);
+        shader->setInt("skyViewLut", 1);
+        shader->setFloat("sunDiskCos", diskCos);
+    }
+    environment_shader->setFloat("faceSize", (float)ATMOSPHERE_ENVIRONMENT_SIZE);
+    sky_shader->use();
+    sky_shader->setInt("volumetricFog", VOLUMETRIC_FOG_UNIT);
+    sky_view_shader->use();
+    sky_view_shader->setInt("transmittanceLut", 0);
+    sky_view_shader->setInt("multiscatterLut", 1);
+    multiscatter_shader->use();
+    multiscatter_shader->setInt("transmittanceLut", 0);
+
+    transmittance_lut = createLut(ATMOSPHERE_TRANSMITTANCE_WIDTH, ATMOSPHERE_TRANSMITTANCE_HEIGHT, GL_CLAMP_TO_EDGE);
+    multiscatter_lut = createLut(ATMOSPHERE_MULTISCATTER_SIZE, ATMOSPHERE_MULTISCATTER_SIZE, GL_CLAMP_TO_EDGE);
+    // Around in azimuth
+    sky_view_lut = createLut(ATMOSPHERE_SKY_VIEW_WIDTH, ATMOSPHERE_SKY_VIEW_HEIGHT, GL_REPEAT);
+
+    glGenTextures(1, &environment);
+    gl_state.bindTexture(0, GL_TEXTURE_CUBE_MAP, environment);
+    for (int face = 0; face < 6; ++face) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA16F, ATMOSPHERE_ENVIRONMENT_SIZE, ATMOSPHERE_ENVIRONMENT_SIZE, 0,
+                     GL_RGBA, GL_HALF_FLOAT, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    gpu_memory.trackTexture(environment, textureMipChainBytes(GL_RGBA16F, ATMOSPHERE_ENVIRONMENT_SIZE, ATMOSPHERE_ENVIRONMENT_SIZE, 6),
+                            GPU_MEMORY_SKYBOX, "atmosphere");
+
+    glGenFramebuffers(1, &fbo);
+    glGenVertexArrays(1, &vao);
+
+    // The sun-independent LUTs, once
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    gl_state.apply(PIPELINE_LUT.withProgram(transmittance_shader->getProgram()).withVertexArray(vao));
+    drawFullscreen(transmittance_lut, ATMOSPHERE_TRANSMITTANCE_WIDTH, ATMOSPHERE_TRANSMITTANCE_HEIGHT);
+    gl_state.apply(PIPELINE_LUT.withProgram(multiscatter_shader->getProgram()).withVertexArray(vao));
+    gl_state.bindTexture(0, GL_TEXTURE_2D, transmittance_lut);
+    drawFullscreen(multiscatter_lut, ATMOSPHERE_MULTISCATTER_SIZE, ATMOSPHERE_MULTISCATTER_SIZE);
+    const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    gl_state.apply(PipelineState());
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (!complete) {
+        printf("Atmosphere LUT framebuffer incomplete, keeping the cubemap sky\n");
+        release();
+        return false;
+    }
+
+    failed = false;
+    printf("Atmosphere: LUTs %dx%d transmittance, %dx%d multiple scattering, %dx%d sky view\n",
+           ATMOSPHERE_TRANSMITTANCE_WIDTH, ATMOSPHERE_TRANSMITTANCE_HEIGHT, ATMOSPHERE_MULTISCATTER_SIZE,
+           ATMOSPHERE_MULTISCATTER_SIZE, ATMOSPHERE_SKY_VIEW_WIDTH, ATMOSPHERE_SKY_VIEW_HEIGHT);
+    return true;
+}
+
+// Into target's top level on the bound framebuffer, with the bound program
+void Atmosphere::drawFullscreen(GLuint target, int width, int height) {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+    glViewport(0, 0, width, height);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+glm::vec3 Atmosphere::sunDirection() {
+    // Rising in -x at 6, noon ATMOSPHERE_SUN_TILT off the zenith, then turned by the azimuth
+    const float hourAngle = (atmosphere_time_of_day - 12.0f) / 24.0f * 2.0f * glm::pi<float>();
+    const float tilt = glm::radians(ATMOSPHERE_SUN_TILT);
+    const float azimuth = glm::radians(atmosphere_sun_azimuth);
+    const glm::vec3 path(std::sin(hourAngle), std::cos(hourAngle) * std::cos(tilt), std::cos(hourAngle) * std::sin(tilt));
+    return glm::normalize(glm::vec3(path.x * std::cos(azimuth) - path.z * std::sin(azimuth), path.y,
+                                    path.x * std::sin(azimuth) + path.z * std::cos(azimuth)));
+}
+
+bool Atmosphere::update() {
+    if (!use_atmosphere || !ready()) return false;
+    const glm::vec3 direction = sunDirection();
+    if (glm::length(direction - sun) < ATMOSPHERE_CHANGE_EPSILON && illuminance == atmosphere_sun_illuminance) return false;
+    PROFILE_SCOPE("atmosphere");
+    sun = direction;
+    illuminance = atmosphere_sun_illuminance;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    gl_state.apply(PIPELINE_LUT.withProgram(sky_view_shader->getProgram()).withVertexArray(vao));
+    sky_view_shader->setVec3(U_SUN_DIRECTION, sun);
+    sky_view_shader->setVec3(U_SUN_ILLUMINANCE, glm::vec3(illuminance));
+    gl_state.bindTexture(0, GL_TEXTURE_2D, transmittance_lut);
+    gl_state.bindTexture(1, GL_TEXTURE_2D, multiscatter_lut);
+    drawFullscreen(sky_view_lut, ATMOSPHERE_SKY_VIEW_WIDTH, ATMOSPHERE_SKY_VIEW_HEIGHT);
+
+    // The environment the ambient is built from, the same lookups into each face
+    gl_state.apply(PIPELINE_LUT.withProgram(environment_shader->getProgram()).withVertexArray(vao));
+    environment_shader->setVec3(U_SUN_DIRECTION, sun);
+    environment_shader->setVec3(U_SUN_ILLUMINANCE, glm::vec3(illuminance));
+    gl_state.bindTexture(1, GL_TEXTURE_2D, sky_view_lut);
+    glViewport(0, 0, ATMOSPHERE_ENVIRONMENT_SIZE, ATMOSPHERE_ENVIRONMENT_SIZE);
+    for (int face = 0; face < 6; ++face) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, environment, 0);
+        environment_shader->setInt(U_FACE, face);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    gl_state.bindTexture(0, GL_TEXTURE_CUBE_MAP, environment);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+    gl_state.apply(PipelineState());
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    sky_shader->use();
+    sky_shader->setVec3(U_SUN_DIRECTION, sun);
+    sky_shader->setVec3(U_SUN_ILLUMINANCE, glm::vec3(illuminance));
+
+    ibl.buildFromCubemap(environment, ATMOSPHERE_ENVIRONMENT_SIZE);
+    return true;
+}
+
+bool Atmosphere::render() {
+    if (!use_atmosphere || !ready()) return false;
+    PROFILE_SCOPE("skybox");
+    // On the far plane like the skybox, directions from the camera block
+    gl_state.apply(PipelineState().depth(true, GL_LEQUAL).depthWrite(false).cull(CULL_NONE)
+                       .withProgram(sky_shader->getProgram()).withVertexArray(vao));
+    gl_state.bindTexture(0, GL_TEXTURE_2D, transmittance_lut);
+    gl_state.bindTexture(1, GL_TEXTURE_2D, sky_view_lut);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    gl_state.apply(PipelineState());
+    return true;
+}
@@ -0,0 +1,142 @@
+#include "batch_render.h"
+#include "scene_target.h"
+#include "temporal_aa.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+BatchRender batch_render;
+
+#define BATCH_RENDER_STEP (1.0f / 60.0f) // Simulated seconds per frame, like a benchmark's
+
+static double steadySeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int BatchRender::parseArg(int argc, char** argv, int i) {
+    const std::string arg = argv[i];
+    auto takes = [&](int count) {
+        if (i + count < argc) return true;
+        printf("%s needs %d argument%s\n", arg.c_str(), count, count == 1 ? "" : "s");
+        return false;
+    };
+    if (arg == "--egl") {
+        use_egl = true;
+        return 1;
+    }
+    if (arg == "--render-jobs") {
+        if (!takes(1)) return -1;
+        jobs_file = argv[i + 1];
+        enabled = true;
+    } else if (arg == "--render-size") {
+        if (!takes(1)) return -1;
+        if (sscanf(argv[i + 1], "%dx%d", &image_width, &image_height) != 2 || image_width <= 0 || image_height <= 0) {
+            printf("--render-size needs WIDTHxHEIGHT, e.g. 512x512\n");
+            return -1;
+        }
+    } else if (arg == "--render-frames") {
+        if (!takes(1)) return -1;
+        frames_per_job = atoi(argv[i + 1]);
+        if (frames_per_job <= 0) {
+            printf("--render-frames needs a positive count\n");
+            return -1;
+        }
+    } else {
+        return 0;
+    }
+    return 2;
+}
+
+bool BatchRender::start() {
+    if (jobs_file != "-") {
+        jobs_stream.open(jobs_file);
+        if (!jobs_stream.is_open()) {
+            printf("Batch render: can't read jobs from %s\n", jobs_file.c_str());
+            return false;
+        }
+    }
+    if (!target.resize(image_width, image_height)) return false;
+    readback.setConsumer([this](const ReadbackFrame& image) {
+        if (writeFramePPM(image.name, image)) {
+            written++;
+        } else {
+            printf("Batch render: can't write %s\n", image.name.c_str());
+            failed++;
+        }
+    });
+
+    // Every image the same work for the same job: a resolution chasing the GPU time would vary
+    // them, and one frame per job leaves TAA only the last job's history
+    use_dynamic_resolution = false;
+    if (frames_per_job == 1) use_taa = false;
+
+    printf("Batch render: %dx%d, %d frame%s per job, jobs from %s\n", image_width, image_height, frames_per_job,
+           frames_per_job == 1 ? "" : "s", jobs_file == "-" ? "stdin" : jobs_file.c_str());
+    start_seconds = steadySeconds();
+    done = !nextJob();
+    return true;
+}
+
+bool BatchRender::nextJob() {
+    std::istream& in = jobs_file == "-" ? std::cin : static_cast<std::istream&>(jobs_stream);
+    std::string line;
+    while (std::getline(in, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        BatchRenderJob parsed;
+        if (!(fields >> parsed.output)) continue;
+        if (!(fields >> parsed.position.x >> parsed.position.y >> parsed.position.z >> parsed.yaw >> parsed.pitch)) {
+            printf("Batch render: line %d needs \"output x y z yaw pitch [fov]\", skipped\n", line_number);
+            continue;
+        }
+        fields >> parsed.fov;
+        job = parsed;
+        job_frame = 0;
+        return true;
+    }
+    return false;
+}
+
+float BatchRender::beginFrame() const {
+    return BATCH_RENDER_STEP;
+}
+
+void BatchRender::moveCamera(Camera& camera) const {
+    camera.position = job.position;
+    camera.velocity = glm::vec3(0.0f);
+    camera.yaw = job.yaw;
+    camera.pitch = job.pitch;
+    camera.fov = glm::radians(job.fov);
+    camera.aspect_ratio = (float)image_width / (float)image_height;
+    camera_update_vectors(&camera);
+}
+
+void BatchRender::endFrame() {
+    if (done || ++job_frame < frames_per_job) return;
+
+    // The images that landed go to the writers, this one follows in a later frame
+    readback.poll();
+    readback.capture(target.framebuffer(), image_width, image_height, (uint64_t)rendered, job.output, true);
+    rendered++;
+
+    if (!nextJob()) done = true;
+}
+
+bool BatchRender::finish() {
+    if (!enabled) return true;
+    readback.flush();
+
+    const double seconds = steadySeconds() - start_seconds;
+    printf("Batch render: %d images in %.2f s, %.1f images/s, %.2f ms per image", written.load(), seconds,
+           seconds > 0.0 ? written.load() / seconds : 0.0, written.load() > 0 ? seconds * 1000.0 / written.load() : 0.0);
+    if (failed.load() > 0) printf(", %d failed", failed.load());
+    printf("\n");
+
+    readback.release();
+    target.release();
+    return failed.load() == 0 && written.load() == rendered;
+}
@@ -0,0 +1,351 @@
+#include "benchmark.h"
+#include "gpu_queries.h"
+#include "scene_target.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+Benchmark benchmark;
+
+// ============================================================================
+// CAMERA PATH
+// ============================================================================
+
+bool CameraPath::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+
+    std::vector<CameraPathKey> loaded;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        std::istringstream fields(line);
+        CameraPathKey key;
+        if (!(fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)) {
+            printf("Camera path %s:%d: expected time x y z yaw pitch\n", path.c_str(), line_number);
+            return false;
+        }
+        loaded.push_back(key);
+    }
+    std::stable_sort(loaded.begin(), loaded.end(),
+                     [](const CameraPathKey& a, const CameraPathKey& b) { return a.time < b.time; });
+    keys = std::move(loaded);
+    return !keys.empty();
+}
+
+bool CameraPath::save(const std::string& path) const {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) return false;
+    out << "# time x y z yaw pitch\n";
+    char line[192];
+    for (const CameraPathKey& key : keys) {
+        snprintf(line, sizeof(line), "%.3f %.4f %.4f %.4f %.3f %.3f\n", key.time, key.position.x, key.position.y,
+                 key.position.z, key.yaw, key.pitch);
+        out << line;
+    }
+    return (bool)out;
+}
+
+void CameraPath::add(float time, const Camera& camera) {
+    CameraPathKey key;
+    key.time = time;
+    key.position = camera.position;
+    key.yaw = camera.yaw;
+    key.pitch = camera.pitch;
+    keys.push_back(key);
+}
+
+// Uniform Catmull-Rom between b and c
+template <typename T>
+static T catmullRom(const T& a, const T& b, const T& c, const T& d, float u) {
+    const float u2 = u * u, u3 = u2 * u;
+    return 0.5f * ((2.0f * b) + (c - a) * u + (2.0f * a - 5.0f * b + 4.0f * c - d) * u2 + (3.0f * b - a - 3.0f * c + d) * u3);
+}
+
+void CameraPath::apply(float time, Camera& camera) const {
+    if (keys.empty()) return;
+    const float t = keys.front().time + std::clamp(time, 0.0f, duration());
+    // First key after t, the segment runs from the one before it
+    size_t next = std::upper_bound(keys.begin(), keys.end(), t,
+                                   [](float value, const CameraPathKey& key) { return value < key.time; }) - keys.begin();
+    next = std::clamp<size_t>(next, 1, keys.size() - 1);
+    const CameraPathKey& a = keys[next >= 2 ? next - 2 : 0];
+    const CameraPathKey& b = keys[next - 1];
+    const CameraPathKey& c = keys[std::min(next, keys.size() - 1)];
+    const CameraPathKey& d = keys[std::min(next + 1, keys.size() - 1)];
+    const float span = c.time - b.time;
+    const float u = span > 0.0f ? std::clamp((t - b.time) / span, 0.0f, 1.0f) : 0.0f;
+
+    camera.position = catmullRom(a.position, b.position, c.position, d.position, u);
+    camera.yaw = catmullRom(a.yaw, b.yaw, c.yaw, d.yaw, u);
+    camera.pitch = std::clamp(catmullRom(a.pitch, b.pitch, c.pitch, d.pitch, u), -89.0f, 89.0f);
+    camera.velocity = glm::vec3(0.0f);
+    camera_update_vectors(&camera);
+}
+
+// ============================================================================
+// BENCHMARK
+// ============================================================================
+
+int Benchmark::parseArg(int argc, char** argv, int i) {
+    const std::string arg = argv[i];
+    auto takes = [&](int count) {
+        if (i + count < argc) return true;
+        printf("%s needs %d argument%s\n", arg.c_str(), count, count == 1 ? "" : "s");
+        return false;
+    };
+    if (arg == "--benchmark") {
+        if (!takes(2)) return -1;
+        scene_name = argv[i + 1];
+        path_file = argv[i + 2];
+        enabled = true;
+        return 3;
+    }
+    if (arg == "--frames") {
+        if (!takes(1)) return -1;
+        measured_frames = atoi(argv[i + 1]);
+        if (measured_frames <= 0) {
+            printf("--frames needs a positive count\n");
+            return -1;
+        }
+    } else if (arg == "--warmup") {
+        if (!takes(1)) return -1;
+        warmup_frames = std::max(0, atoi(argv[i + 1]));
+    } else if (arg == "--output") {
+        if (!takes(1)) return -1;
+        output_file = argv[i + 1];
+    } else if (arg == "--record-path") {
+        if (!takes(1)) return -1;
+        record_path = argv[i + 1];
+    } else {
+        return 0;
+    }
+    return 2;
+}
+
+bool Benchmark::validate() const {
+    // FOREST_SIZE sizes the forest, the --stress options the stress scene
+    if (enabled && scene_name != "forest" && scene_name != "stress") {
+        printf("Unknown benchmark scene %s, the built-in ones are forest and stress\n", scene_name.c_str());
+        return false;
+    }
+    if (enabled && recording()) {
+        printf("--record-path records an interactive session, it can't run with --benchmark\n");
+        return false;
+    }
+    return true;
+}
+
+static double steadySeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool Benchmark::start() {
+    if (!path.load(path_file)) {
+        printf("Benchmark: can't read a camera path from %s\n", path_file.c_str());
+        return false;
+    }
+    if (measured_frames == 0) measured_frames = (int)std::ceil(path.duration() / BENCHMARK_STEP) + 1;
+
+    // The scope times come from the profiler, and a resolution chasing the GPU time would
+    // change the work being measured
+    use_profiler = true;
+    use_dynamic_resolution = false;
+    profiler.addFrameCallback([this](const FrameProfiler::Frame& profiled) { profiledFrame(profiled); });
+
+    const size_t frames = (size_t)measured_frames;
+    wall_ms.reserve(frames);
+    cpu_ms.reserve(frames);
+    gpu_ms.reserve(frames);
+    counters.assign(RENDER_STATS_COUNTER_COUNT, Samples());
+    for (Samples& samples : counters) samples.reserve(frames);
+
+    const char* renderer_name = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    gl_renderer = renderer_name ? renderer_name : "";
+    printf("Benchmark: %s along %s, %d frames after %d warmup, %.1f s of path\n", scene_name.c_str(), path_file.c_str(),
+           measured_frames, warmup_frames, path.duration());
+    return true;
+}
+
+float Benchmark::beginFrame() {
+    if (frame == warmup_frames) first_gpu_frame = gpu_queries.frame();
+    return BENCHMARK_STEP;
+}
+
+void Benchmark::moveCamera(Camera& camera) const {
+    // The warmup holds the first key
+    path.apply(std::max(0, frame - warmup_frames) * BENCHMARK_STEP, camera);
+}
+
+void Benchmark::endFrame(const Renderer::RenderStats& stats) {
+    const double now = steadySeconds();
+    if (frame >= warmup_frames && frame < warmup_frames + measured_frames) {
+        if (last_frame_end >= 0.0) wall_ms.push_back((now - last_frame_end) * 1000.0);
+        for (size_t i = 0; i < RENDER_STATS_COUNTER_COUNT; ++i) counters[i].push_back(RENDER_STATS_COUNTERS[i].read(stats));
+    }
+    last_frame_end = now;
+    frame++;
+}
+
+void Benchmark::profiledFrame(const FrameProfiler::Frame& profiled) {
+    if (first_gpu_frame == UINT64_MAX || profiled.id < first_gpu_frame ||
+        profiled.id >= first_gpu_frame + (uint64_t)measured_frames) {
+        return;
+    }
+    cpu_ms.push_back(profiled.cpu_ms);
+    if (profiled.gpu_ms >= 0.0) {
+        gpu_ms.push_back(profiled.gpu_ms);
+    } else {
+        gpu_frames_missing++;
+    }
+
+    // Scopes that open several times a frame (per shadow view, say) count as their sum
+    std::unordered_map<const char*, std::pair<double, double>> sums;
+    for (const FrameProfiler::Scope& scope : profiled.scopes) {
+        auto& [cpu, gpu] = sums.emplace(scope.name, std::make_pair(0.0, -1.0)).first->second;
+        cpu += scope.cpu_ms;
+        if (scope.gpu_ms >= 0.0) gpu = std::max(gpu, 0.0) + scope.gpu_ms;
+    }
+    for (const auto& [name, sum] : sums) {
+        scope_cpu_ms[name].push_back(sum.first);
+        if (sum.second >= 0.0) scope_gpu_ms[name].push_back(sum.second);
+    }
+}
+
+// Nearest-rank percentiles
+struct BenchmarkSummary {
+    size_t count = 0;
+    double mean = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+};
+
+static BenchmarkSummary summarize(const std::vector<double>& samples) {
+    BenchmarkSummary summary;
+    summary.count = samples.size();
+    if (samples.empty()) return summary;
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) {
+        const size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    };
+    double total = 0.0;
+    for (double value : sorted) total += value;
+    summary.mean = total / sorted.size();
+    summary.p50 = percentile(50.0);
+    summary.p95 = percentile(95.0);
+    summary.p99 = percentile(99.0);
+    summary.max = sorted.back();
+    return summary;
+}
+
+static std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        if ((unsigned char)c >= 0x20) quoted += c;
+    }
+    return quoted + "\"";
+}
+
+bool Benchmark::write() const {
+    if (!enabled) return true;
+    if (!finished()) {
+        printf("Benchmark: interrupted after %d of %d frames, nothing written\n", std::max(0, frame - warmup_frames),
+               measured_frames);
+        return false;
+    }
+
+    // Group, name and samples, in output order
+    struct Row {
+        const char* group;
+        std::string name;
+        const Samples* samples;
+    };
+    std::vector<Row> rows = {
+        { "frame", "wall_ms", &wall_ms },
+        { "frame", "cpu_ms", &cpu_ms },
+        { "frame", "gpu_ms", &gpu_ms },
+    };
+    for (const auto& [name, samples] : scope_cpu_ms) rows.push_back({ "scope_cpu_ms", name, &samples });
+    for (const auto& [name, samples] : scope_gpu_ms) rows.push_back({ "scope_gpu_ms", name, &samples });
+    for (size_t i = 0; i < RENDER_STATS_COUNTER_COUNT; ++i) rows.push_back({ "counters", RENDER_STATS_COUNTERS[i].name, &counters[i] });
+
+    std::ofstream out(output_file, std::ios::trunc);
+    if (!out) {
+        printf("Benchmark: can't write %s\n", output_file.c_str());
+        return false;
+    }
+    const bool csv = output_file.size() >= 4 && output_file.compare(output_file.size() - 4, 4, ".csv") == 0;
+    char line[512];
+    if (csv) {
+        out << "group,name,samples,mean,p50,p95,p99,max\n";
+        for (const Row& row : rows) {
+            const BenchmarkSummary s = summarize(*row.samples);
+            snprintf(line, sizeof(line), "%s,%s,%zu,%.4f,%.4f,%.4f,%.4f,%.4f\n", row.group, row.name.c_str(), s.count, s.mean,
+                     s.p50, s.p95, s.p99, s.max);
+            out << line;
+        }
+    } else {
+        out << "{\n";
+        out << "  \"scene\": " << jsonString(scene_name) << ",\n";
+        out << "  \"camera_path\": " << jsonString(path_file) << ",\n";
+        out << "  \"gl_renderer\": " << jsonString(gl_renderer) << ",\n";
+        out << "  \"frames\": " << measured_frames << ",\n";
+        out << "  \"warmup_frames\": " << warmup_frames << ",\n";
+        out << "  \"step_ms\": " << BENCHMARK_STEP * 1000.0f << ",\n";
+        out << "  \"gpu_frames_missing\": " << gpu_frames_missing;
+        const char* group = nullptr;
+        for (const Row& row : rows) {
+            if (!group || strcmp(group, row.group) != 0) {
+                out << (group ? "\n  }" : "") << ",\n  " << jsonString(row.group) << ": {\n";
+                group = row.group;
+            } else {
+                out << ",\n";
+            }
+            const BenchmarkSummary s = summarize(*row.samples);
+            snprintf(line, sizeof(line),
+                     "\"samples\": %zu, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f", s.count,
+                     s.mean, s.p50, s.p95, s.p99, s.max);
+            out << "    " << jsonString(row.name) << ": { " << line << " }";
+        }
+        out << (group ? "\n  }" : "") << "\n}\n";
+    }
+    if (!out) {
+        printf("Benchmark: can't write %s\n", output_file.c_str());
+        return false;
+    }
+
+    const BenchmarkSummary wall = summarize(wall_ms), gpu = summarize(gpu_ms);
+    printf("Benchmark: wall %.2f ms mean, %.2f ms p99, GPU %.2f ms mean, %.2f ms p99, written to %s\n", wall.mean, wall.p99,
+           gpu.mean, gpu.p99, output_file.c_str());
+    return true;
+}
+
+void Benchmark::recordCamera(float frame_time, const Camera& camera) {
+    if (!recording()) return;
+    if (record_time >= record_next) {
+        recorded.add(record_time, camera);
+        record_next = record_time + CAMERA_RECORD_INTERVAL;
+    }
+    record_time += frame_time;
+}
+
+bool Benchmark::saveRecording() const {
+    if (!recording()) return true;
+    if (recorded.empty() || !recorded.save(record_path)) {
+        printf("Camera path: nothing written to %s\n", record_path.c_str());
+        return false;
+    }
+    printf("Camera path: %.1f s written to %s\n", recorded.duration(), record_path.c_str());
+    return true;
+}
@@ -0,0 +1,51 @@
+#include "debug_overlay.h"
+#include "imgui_impl_opengl3.h"
+
+float debug_overlay_hz = 30.0f;
+DebugOverlay debug_overlay;
+
+DebugOverlay::~DebugOverlay() {
+    invalidate();
+}
+
+bool DebugOverlay::due(double now) {
+    if (lists.empty() || debug_overlay_hz <= 0.0f) {
+        last_build = now;
+        return true;
+    }
+    if (now - last_build < 1.0 / debug_overlay_hz) return false;
+    // Keeps the cadence when a frame overshoots, unless it fell a whole period behind
+    last_build = now - last_build < 2.0 / debug_overlay_hz ? last_build + 1.0 / debug_overlay_hz : now;
+    return true;
+}
+
+void DebugOverlay::present(bool rebuilt) {
+    if (!rebuilt) {
+        if (!lists.empty()) ImGui_ImplOpenGL3_RenderDrawData(&cached);
+        return;
+    }
+    ImDrawData* draw_data = ImGui::GetDrawData();
+    // Applies the font atlas updates too, which the copy then leaves alone
+    ImGui_ImplOpenGL3_RenderDrawData(draw_data);
+    rebuild_count++;
+
+    invalidate();
+    if (debug_overlay_hz <= 0.0f || !draw_data || !draw_data->Valid) return;
+    for (ImDrawList* list : draw_data->CmdLists) lists.push_back(list->CloneOutput());
+    cached.Valid = true;
+    cached.CmdListsCount = (int)lists.size();
+    cached.TotalIdxCount = draw_data->TotalIdxCount;
+    cached.TotalVtxCount = draw_data->TotalVtxCount;
+    for (ImDrawList* list : lists) cached.CmdLists.push_back(list);
+    cached.DisplayPos = draw_data->DisplayPos;
+    cached.DisplaySize = draw_data->DisplaySize;
+    cached.FramebufferScale = draw_data->FramebufferScale;
+    cached.OwnerViewport = draw_data->OwnerViewport;
+    cached.Textures = nullptr;
+}
+
+void DebugOverlay::invalidate() {
+    for (ImDrawList* list : lists) IM_DELETE(list);
+    lists.clear();
+    cached.Clear();
+}
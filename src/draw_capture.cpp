@@ -0,0 +1,255 @@
+#include "draw_capture.h"
+#include "gl_extensions.h"
+#include "mesh.h"
+#include "mesh_registry.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+DrawCapture draw_capture;
+
+#define DRAW_CAPTURE_MAGIC "DRWC"
+#define DRAW_CAPTURE_VERSION 1
+
+struct DrawCaptureHeader {
+    char magic[4];
+    uint32_t version;
+    float camera[5]; // Position, yaw, pitch
+    uint32_t model_count; // Then each path as its length and bytes
+    uint32_t draw_count;  // Then the draws, all their matrices and all their fades
+    uint32_t instance_count;
+};
+
+int DrawCapture::parseArg(int argc, char** argv, int i) {
+    if (std::string(argv[i]) != "--replay-draws") return 0;
+    if (i + 1 >= argc) {
+        printf("--replay-draws needs a capture file\n");
+        return -1;
+    }
+    replay_path = argv[i + 1];
+    if (i + 2 >= argc || strncmp(argv[i + 2], "--", 2) == 0) return 2;
+    repeat = atoi(argv[i + 2]);
+    if (repeat <= 0) {
+        printf("--replay-draws needs a positive repeat count\n");
+        return -1;
+    }
+    return 3;
+}
+
+// ============================================================================
+// CAPTURE
+// ============================================================================
+
+void DrawCapture::request(const std::string& path) {
+    if (replay_active) return;
+    capture_path = path;
+}
+
+void DrawCapture::capture(const DrawList& list, const std::function<bool(const DrawList::Draw&)>& far_shading) {
+    // Meshes only point back at their model through the registry
+    struct MeshKey {
+        uint32_t model, submesh, lod;
+    };
+    std::unordered_map<const Mesh*, MeshKey> keys;
+    models.clear();
+    mesh_registry.forEach([&](const std::string& path, const std::vector<std::shared_ptr<Mesh>>& meshes) {
+        const uint32_t model = (uint32_t)models.size();
+        models.push_back(path);
+        for (uint32_t submesh = 0; submesh < meshes.size(); ++submesh) {
+            keys.emplace(meshes[submesh].get(), MeshKey{model, submesh, 0});
+            for (uint32_t lod = 0; lod < meshes[submesh]->lods.size(); ++lod) {
+                keys.emplace(meshes[submesh]->lods[lod].get(), MeshKey{model, submesh, lod + 1});
+            }
+        }
+    });
+
+    captured.clear();
+    matrices.clear();
+    fades.clear();
+    size_t skipped = 0;
+    for (const DrawList::Draw& draw : list.getDraws()) {
+        auto key = keys.find(draw.mesh);
+        if (key == keys.end()) {
+            skipped++;
+            continue;
+        }
+        if (draw.instance_count == 0) continue;
+        captured.push_back({key->second.model, key->second.submesh, key->second.lod, far_shading(draw) ? 1u : 0u, draw.instance_count});
+        for (uint32_t i = 0; i < draw.instance_count; ++i) {
+            matrices.push_back(list.instanceMatrix(draw, i));
+            fades.push_back(list.instanceFade(draw, i));
+        }
+    }
+    if (skipped > 0) printf("Draw capture: %zu draws of meshes outside the registry left out\n", skipped);
+    captured_this_frame = true;
+}
+
+void DrawCapture::endFrame(const Camera& camera) {
+    if (capture_path.empty() || replay_active) return;
+    if (!captured_this_frame) {
+        // GPU culling lists its draws on the GPU, there was nothing to take
+        printf("Draw capture: no CPU-listed opaque draws this frame, nothing written\n");
+    } else if (write(capture_path, camera)) {
+        printf("Draw capture: %zu draws, %zu instances written to %s\n", captured.size(), matrices.size(), capture_path.c_str());
+    }
+    capture_path.clear();
+    captured_this_frame = false;
+    captured.clear();
+    matrices.clear();
+    fades.clear();
+}
+
+bool DrawCapture::write(const std::string& path, const Camera& camera) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        printf("Draw capture: can't write %s\n", path.c_str());
+        return false;
+    }
+
+    DrawCaptureHeader header = {};
+    memcpy(header.magic, DRAW_CAPTURE_MAGIC, 4);
+    header.version = DRAW_CAPTURE_VERSION;
+    header.camera[0] = camera.position.x;
+    header.camera[1] = camera.position.y;
+    header.camera[2] = camera.position.z;
+    header.camera[3] = camera.yaw;
+    header.camera[4] = camera.pitch;
+    header.model_count = (uint32_t)models.size();
+    header.draw_count = (uint32_t)captured.size();
+    header.instance_count = (uint32_t)matrices.size();
+    out.write((const char*)&header, sizeof(header));
+    for (const std::string& model : models) {
+        const uint32_t length = (uint32_t)model.size();
+        out.write((const char*)&length, sizeof(length));
+        out.write(model.data(), length);
+    }
+    out.write((const char*)captured.data(), captured.size() * sizeof(CapturedDraw));
+    out.write((const char*)matrices.data(), matrices.size() * sizeof(glm::mat4));
+    out.write((const char*)fades.data(), fades.size() * sizeof(float));
+    return (bool)out;
+}
+
+// ============================================================================
+// REPLAY
+// ============================================================================
+
+bool DrawCapture::startReplay(Camera& camera) {
+    if (!gl_extensions.timestamp_query) {
+        printf("Draw replay: needs GL timestamp queries\n");
+        return false;
+    }
+
+    std::ifstream in(replay_path, std::ios::binary);
+    DrawCaptureHeader header = {};
+    if (!in || !in.read((char*)&header, sizeof(header)) || memcmp(header.magic, DRAW_CAPTURE_MAGIC, 4) != 0 ||
+        header.version != DRAW_CAPTURE_VERSION) {
+        printf("Draw replay: %s isn't a draw capture\n", replay_path.c_str());
+        return false;
+    }
+
+    models.resize(header.model_count);
+    for (std::string& model : models) {
+        uint32_t length = 0;
+        if (!in.read((char*)&length, sizeof(length)) || length > 4096) {
+            printf("Draw replay: %s is damaged\n", replay_path.c_str());
+            return false;
+        }
+        model.resize(length);
+        in.read(model.data(), length);
+    }
+    captured.resize(header.draw_count);
+    matrices.resize(header.instance_count);
+    fades.resize(header.instance_count);
+    in.read((char*)captured.data(), captured.size() * sizeof(CapturedDraw));
+    in.read((char*)matrices.data(), matrices.size() * sizeof(glm::mat4));
+    in.read((char*)fades.data(), fades.size() * sizeof(float));
+    if (!in) {
+        printf("Draw replay: %s is truncated\n", replay_path.c_str());
+        return false;
+    }
+
+    // Against the meshes this run loaded, so the draws find the same buffers and materials
+    std::vector<std::vector<std::shared_ptr<Mesh>>> model_meshes;
+    for (const std::string& model : models) model_meshes.push_back(mesh_registry.find(model));
+    const std::vector<std::shared_ptr<Mesh>> no_meshes;
+    draws.clear();
+    uint32_t first_instance = 0;
+    size_t missing = 0;
+    for (const CapturedDraw& draw : captured) {
+        if (first_instance + draw.instance_count > matrices.size()) break;
+        const auto& meshes = draw.model < model_meshes.size() ? model_meshes[draw.model] : no_meshes;
+        std::shared_ptr<Mesh> mesh = draw.submesh < meshes.size() ? meshes[draw.submesh] : nullptr;
+        if (mesh && draw.lod > 0) mesh = draw.lod <= mesh->lods.size() ? mesh->lods[draw.lod - 1] : nullptr;
+        if (mesh && mesh->isValid()) {
+            draws.push_back({mesh, draw.far_shading != 0, first_instance, draw.instance_count});
+        } else {
+            missing++;
+        }
+        first_instance += draw.instance_count;
+    }
+    if (missing > 0) printf("Draw replay: %zu draws name meshes this scene didn't load, skipped\n", missing);
+    if (draws.empty()) {
+        printf("Draw replay: nothing in %s to replay\n", replay_path.c_str());
+        return false;
+    }
+
+    camera_position = glm::vec3(header.camera[0], header.camera[1], header.camera[2]);
+    camera_yaw = header.camera[3];
+    camera_pitch = header.camera[4];
+    moveCamera(camera);
+    replay_active = true;
+    printf("Draw replay: %zu draws, %u instances, %d times a frame for %d frames\n", draws.size(), header.instance_count,
+           repeat, DRAW_REPLAY_FRAMES);
+    return true;
+}
+
+void DrawCapture::moveCamera(Camera& camera) const {
+    camera.position = camera_position;
+    camera.velocity = glm::vec3(0.0f);
+    camera.yaw = camera_yaw;
+    camera.pitch = camera_pitch;
+    camera_update_vectors(&camera);
+}
+
+void DrawCapture::beginReplay() {
+    begin_timestamp = gpu_queries.timestamp();
+}
+
+void DrawCapture::endReplay() {
+    const int end_timestamp = gpu_queries.timestamp();
+    if (frames_replayed < DRAW_REPLAY_FRAMES && begin_timestamp >= 0 && end_timestamp >= 0) {
+        pending.push_back({gpu_queries.frame(), begin_timestamp, end_timestamp});
+    }
+    begin_timestamp = -1;
+    frames_replayed++;
+}
+
+void DrawCapture::collect() {
+    for (const GpuQueryPool::Frame* frame : gpu_queries.collected()) {
+        auto it = std::find_if(pending.begin(), pending.end(), [&](const Pending& entry) { return entry.frame == frame->id; });
+        if (it == pending.end()) continue;
+        if (frame->valid && (size_t)it->end < frame->timestamps.size()) {
+            replay_ms.push_back((frame->timestamps[it->end] - frame->timestamps[it->begin]) / 1e6);
+        }
+        pending.erase(it);
+    }
+}
+
+bool DrawCapture::report() const {
+    if (!replay_active) return true;
+    if (replay_ms.empty()) {
+        printf("Draw replay: no GPU times came back\n");
+        return false;
+    }
+    std::vector<double> sorted = replay_ms;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (double ms : sorted) sum += ms;
+    const double mean = sum / sorted.size();
+    printf("Draw replay of %s, %zu frames x %d: mean %.3f ms, median %.3f ms, min %.3f ms, max %.3f ms (%.3f ms per issue)\n",
+           replay_path.c_str(), sorted.size(), repeat, mean, sorted[sorted.size() / 2], sorted.front(), sorted.back(), mean / repeat);
+    return true;
+}
@@ -0,0 +1,439 @@
+#include "draw_list.h"
+#include "mesh.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "job_system.h"
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+
+bool use_multi_draw_indirect = true;
+#ifdef __EMSCRIPTEN__
+int max_instances_per_draw = 16384;
+#else
+int max_instances_per_draw = 0;
+#endif
+
+static bool multiDrawAvailable() {
+    return use_multi_draw_indirect && gl_extensions.multi_draw_indirect;
+}
+
+DrawList::~DrawList() {
+    if (indirect_buffer != 0) glDeleteBuffers(1, &indirect_buffer);
+    if (pulled_instance_buffer != 0) glDeleteBuffers(1, &pulled_instance_buffer);
+    if (pulled_indirect_buffer != 0) glDeleteBuffers(1, &pulled_indirect_buffer);
+}
+
+void DrawList::clear() {
+    draws.clear();
+    packet_sources.clear();
+    packets.clear();
+    staged_matrices.clear();
+    staged_fades.clear();
+    max_depth = 0.0f;
+}
+
+void DrawList::add(Mesh* mesh, const void* state, uint32_t state_id, const glm::mat4& matrix, float fade, float depth,
+                   const MeshletRange* ranges, uint32_t range_count) {
+    if (!mesh || !mesh_pool.isValid(mesh->pool_handle)) return;
+
+    // Keys are built in upload(), once the depth range is known
+    packets.push_back({0, (uint32_t)packet_sources.size()});
+    packet_sources.push_back({mesh->pool_handle, state, state_id, depth, range_count > 0 ? ranges : nullptr, range_count});
+    staged_matrices.push_back(matrix);
+    staged_fades.push_back(fade);
+    max_depth = std::max(max_depth, depth);
+}
+
+void DrawList::Recorder::add(Mesh* mesh, const void* state, uint32_t state_id, const glm::mat4& matrix, float fade, float depth,
+                             const MeshletRange* ranges, uint32_t range_count) {
+    if (!mesh || !mesh_pool.isValid(mesh->pool_handle)) return;
+    sources.push_back({mesh->pool_handle, state, state_id, depth, range_count > 0 ? ranges : nullptr, range_count});
+    matrices.push_back(matrix);
+    fades.push_back(fade);
+    max_depth = std::max(max_depth, depth);
+}
+
+void DrawList::Recorder::clear() {
+    sources.clear();
+    matrices.clear();
+    fades.clear();
+    max_depth = 0.0f;
+}
+
+void DrawList::recordParallel(size_t count, size_t grain, const std::function<void(size_t begin, size_t end, Recorder& recorder)>& record) {
+    if (count == 0) return;
+    grain = std::max<size_t>(1, grain);
+    // parallelFor's ranges start at multiples of grain, or it runs everything as one range
+    const size_t ranges = (count + grain - 1) / grain;
+    if (recorders.size() < ranges) recorders.resize(ranges);
+    for (size_t r = 0; r < ranges; ++r) recorders[r].clear();
+    job_system.parallelFor(count, grain, [&](size_t begin, size_t end) {
+        record(begin, end, recorders[begin / grain]);
+    });
+
+    for (size_t r = 0; r < ranges; ++r) {
+        const Recorder& recorder = recorders[r];
+        for (size_t i = 0; i < recorder.sources.size(); ++i) packets.push_back({0, (uint32_t)(packet_sources.size() + i)});
+        packet_sources.insert(packet_sources.end(), recorder.sources.begin(), recorder.sources.end());
+        staged_matrices.insert(staged_matrices.end(), recorder.matrices.begin(), recorder.matrices.end());
+        staged_fades.insert(staged_fades.end(), recorder.fades.begin(), recorder.fades.end());
+        max_depth = std::max(max_depth, recorder.max_depth);
+    }
+}
+
+// Key layout, most significant first: state 19 | cull 2 | VAO 12 | 32-bit indices 1 | mesh 16 | depth 14.
+// Truncated ids can only cost merging, draws still compare the real mesh and state.
+#define DRAW_KEY_DEPTH_BITS 14
+
+static uint64_t packetKey(const MeshRecord& mesh, uint32_t state_id, uint32_t depth) {
+    return ((uint64_t)(state_id & 0x7ffff) << 45) | ((uint64_t)(mesh.cull_mode & 0x3) << 43) |
+           ((uint64_t)(mesh.vao & 0xfff) << 31) | ((uint64_t)(mesh.index_type == GL_UNSIGNED_INT) << 30) |
+           ((uint64_t)(mesh.draw_id & 0xffff) << DRAW_KEY_DEPTH_BITS) | depth;
+}
+
+// LSD radix sort, 8 bits per pass. Stable, and digits shared by every key skip their pass. Large
+// arrays split into chunks that count and scatter in parallel, each chunk's share of a digit
+// placed after the earlier chunks' so the order still holds.
+void DrawList::radixSort(std::vector<Packet>& packets, std::vector<Packet>& scratch) {
+    const size_t count = packets.size();
+    if (count < 2) return;
+    scratch.resize(count);
+    const size_t chunks = count < DRAW_PARALLEL_SORT_MIN ? 1 : std::min<size_t>(DRAW_SORT_MAX_CHUNKS, job_system.workerCount() + 1);
+    const size_t chunk_size = (count + chunks - 1) / chunks;
+    std::vector<size_t> offsets(chunks * 256); // Per chunk, per digit
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        job_system.parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                size_t* counts = &offsets[c * 256];
+                std::fill(counts, counts + 256, 0);
+                const size_t last = std::min(count, (c + 1) * chunk_size);
+                for (size_t i = c * chunk_size; i < last; ++i) counts[(packets[i].key >> shift) & 0xff]++;
+            }
+        });
+
+        const size_t first_digit = (packets[0].key >> shift) & 0xff;
+        size_t first_digit_count = 0;
+        for (size_t c = 0; c < chunks; ++c) first_digit_count += offsets[c * 256 + first_digit];
+        if (first_digit_count == count) continue;
+
+        size_t total = 0;
+        for (size_t digit = 0; digit < 256; ++digit) {
+            for (size_t c = 0; c < chunks; ++c) {
+                size_t& offset = offsets[c * 256 + digit];
+                size_t digit_count = offset;
+                offset = total;
+                total += digit_count;
+            }
+        }
+        job_system.parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                size_t* chunk_offsets = &offsets[c * 256];
+                const size_t last = std::min(count, (c + 1) * chunk_size);
+                for (size_t i = c * chunk_size; i < last; ++i) scratch[chunk_offsets[(packets[i].key >> shift) & 0xff]++] = packets[i];
+            }
+        });
+        packets.swap(scratch);
+    }
+}
+
+static GLuint streamVertexArray(const MeshRecord& mesh, DrawStream stream) {
+    switch (stream) {
+    case DRAW_STREAM_DEPTH: return mesh.depth_vao;
+    case DRAW_STREAM_SHADOW: return mesh.shadow_vao;
+    default: return mesh.vao;
+    }
+}
+
+// model * translate(offset) * scale(scale), so unorm positions land where the floats would
+static glm::mat4 foldQuantization(const glm::mat4& model, const PositionQuantization& quantization) {
+    glm::mat4 folded = model;
+    for (int i = 0; i < 3; ++i) folded[i] = model[i] * quantization.scale[i];
+    folded[3] = model * glm::vec4(quantization.offset, 1.0f);
+    return folded;
+}
+
+void DrawList::upload(DrawStream draw_stream) {
+    stream = draw_stream;
+    const float depth_scale = max_depth > 0.0f ? ((1 << DRAW_KEY_DEPTH_BITS) - 1) / max_depth : 0.0f;
+    job_system.parallelFor(packets.size(), DRAW_JOB_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t p = begin; p < end; ++p) {
+            Packet& packet = packets[p];
+            const PacketSource& source = packet_sources[packet.instance];
+            uint32_t depth = (uint32_t)std::clamp(source.depth * depth_scale, 0.0f, (float)((1 << DRAW_KEY_DEPTH_BITS) - 1));
+            packet.key = packetKey(mesh_pool[source.mesh], source.state_id, depth);
+        }
+    });
+    radixSort(packets, sort_scratch);
+
+    // Runs of the same mesh and state become one draw, counted into their VAO's slice
+    for (auto& [vao, segment] : segments) segment.count = 0;
+    draws.clear();
+    Segment* segment = nullptr;
+    uint64_t run_key = 0;
+    for (size_t p = 0; p < packets.size(); ++p) {
+        const PacketSource& source = packet_sources[packets[p].instance];
+        const uint64_t key = packets[p].key >> DRAW_KEY_DEPTH_BITS;
+        // Instances culled to meshlet ranges draw alone, the others' ranges differ
+        bool extends = !draws.empty() && key == run_key && draws.back().handle == source.mesh && draws.back().state == source.state &&
+                       !source.ranges && !draws.back().ranges &&
+                       (max_instances_per_draw <= 0 || draws.back().instance_count < (uint32_t)max_instances_per_draw);
+        if (!extends) {
+            const MeshRecord& mesh = mesh_pool[source.mesh];
+            segment = &segments[mesh.vao];
+            segment->instance_vbo = mesh.instance_vbo;
+            segment->fade_vbo = mesh.fade_vbo;
+
+            Draw draw;
+            draw.mesh = mesh.mesh;
+            draw.handle = source.mesh;
+            draw.state = source.state;
+            draw.cull_mode = mesh.cull_mode;
+            draw.first_instance = segment->count;
+            draw.first_packet = (uint32_t)p;
+            draw.ranges = source.ranges;
+            draw.range_count = source.range_count;
+            draw.index_count = mesh.index_count;
+            if (source.ranges) {
+                draw.index_count = 0;
+                for (uint32_t r = 0; r < source.range_count; ++r) draw.index_count += source.ranges[r].index_count;
+            }
+            draws.push_back(draw);
+            run_key = key;
+        }
+        segment->count++;
+        draws.back().instance_count++;
+    }
+
+    // Depth streams pull when every mesh is pooled, the VAO path stays for lists that aren't
+    pulled = vertex_pulling.active() && stream != DRAW_STREAM_FULL && !draws.empty();
+    for (size_t d = 0; d < draws.size() && pulled; ++d) pulled = mesh_pool[draws[d].handle].pulled_index_count != 0;
+    if (pulled) {
+        uploadPulled();
+        return;
+    }
+
+    // One reservation for the whole list, then every instance packed straight into its slot
+    uint32_t total = 0;
+    for (auto& [vao, slice] : segments) {
+        slice.base = total;
+        total += slice.count;
+    }
+    const InstanceRing::Reservation reservation = instance_ring.reserveInstances(total);
+    for (auto& [vao, slice] : segments) {
+        slice.range = reservation.range;
+        slice.range.matrix_offset += slice.base * sizeof(InstanceTransform);
+        slice.range.fade_offset += slice.base * sizeof(float);
+        slice.range.count = slice.count;
+    }
+    slots.resize(packets.size());
+    for (const Draw& draw : draws) {
+        const uint32_t first = segments[mesh_pool[draw.handle].vao].base + draw.first_instance;
+        for (uint32_t i = 0; i < draw.instance_count; ++i) slots[draw.first_packet + i] = first + i;
+    }
+    job_system.parallelFor(packets.size(), DRAW_JOB_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t p = begin; p < end; ++p) {
+            const uint32_t instance = packets[p].instance;
+            const PositionQuantization* quantization = nullptr;
+            if (stream == DRAW_STREAM_SHADOW) {
+                const MeshRecord& mesh = mesh_pool[packet_sources[instance].mesh];
+                if (mesh.shadow_quantization.valid()) quantization = &mesh.shadow_quantization;
+            }
+            reservation.transforms[slots[p]] = packInstanceTransform(
+                quantization ? foldQuantization(staged_matrices[instance], *quantization) : staged_matrices[instance]);
+            reservation.fades[slots[p]] = staged_fades[instance];
+        }
+    });
+    instance_ring.commit(reservation);
+
+    commands_uploaded = false;
+    if (!multiDrawAvailable()) return;
+
+    commands.clear();
+    commands.reserve(draws.size());
+    for (Draw& draw : draws) {
+        const MeshRecord& mesh = mesh_pool[draw.handle];
+        DrawElementsIndirectCommand command;
+        command.count = mesh.index_count;
+        command.instanceCount = draw.instance_count;
+        command.firstIndex = mesh.first_index;
+        command.baseVertex = mesh.base_vertex;
+        command.baseInstance = draw.first_instance;
+        draw.first_command = (uint32_t)commands.size();
+        draw.command_count = draw.ranges ? draw.range_count : 1;
+        if (!draw.ranges) {
+            commands.push_back(command);
+            continue;
+        }
+        for (uint32_t r = 0; r < draw.range_count; ++r) {
+            command.count = draw.ranges[r].index_count;
+            command.firstIndex = mesh.first_index + draw.ranges[r].first_index;
+            commands.push_back(command);
+        }
+    }
+    commands_uploaded = true;
+
+    if (indirect_buffer == 0) glGenBuffers(1, &indirect_buffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+// The instances go to the list's storage buffer in draw order, each draw's first one its base
+// instance, so the shader finds them at gl_BaseInstanceARB + gl_InstanceID
+void DrawList::uploadPulled() {
+    pulled_commands.clear();
+    pulled_commands.reserve(draws.size());
+    slots.resize(packets.size());
+    uint32_t total = 0;
+    for (Draw& draw : draws) {
+        const MeshRecord& mesh = mesh_pool[draw.handle];
+        DrawArraysIndirectCommand command;
+        command.count = mesh.pulled_index_count;
+        command.instanceCount = draw.instance_count;
+        command.first = mesh.pulled_first_index;
+        command.baseInstance = total;
+        // The pool keeps each mesh's indices in their order, so meshlet ranges address it too
+        draw.first_command = (uint32_t)pulled_commands.size();
+        draw.command_count = draw.ranges ? draw.range_count : 1;
+        if (!draw.ranges) pulled_commands.push_back(command);
+        for (uint32_t r = 0; r < draw.range_count && draw.ranges; ++r) {
+            command.count = draw.ranges[r].index_count;
+            command.first = mesh.pulled_first_index + draw.ranges[r].first_index;
+            pulled_commands.push_back(command);
+        }
+        for (uint32_t i = 0; i < draw.instance_count; ++i) slots[draw.first_packet + i] = total + i;
+        total += draw.instance_count;
+    }
+
+    // Positions are pulled as floats, so no quantization is folded in
+    pulled_instances.resize(total);
+    job_system.parallelFor(packets.size(), DRAW_JOB_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t p = begin; p < end; ++p) {
+            const uint32_t instance = packets[p].instance;
+            InstanceTransform& transform = pulled_instances[slots[p]];
+            transform = packInstanceTransform(staged_matrices[instance]);
+            transform.normal_scale[3] = glm::packHalf1x16(staged_fades[instance]);
+        }
+    });
+
+    if (pulled_instance_buffer == 0) glGenBuffers(1, &pulled_instance_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, pulled_instance_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, pulled_instances.size() * sizeof(InstanceTransform), pulled_instances.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if (pulled_indirect_buffer == 0) glGenBuffers(1, &pulled_indirect_buffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, pulled_indirect_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, pulled_commands.size() * sizeof(DrawArraysIndirectCommand), pulled_commands.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+const glm::mat4& DrawList::instanceMatrix(const Draw& draw, uint32_t instance) const {
+    return staged_matrices[packets[draw.first_packet + instance].instance];
+}
+
+float DrawList::instanceFade(const Draw& draw, uint32_t instance) const {
+    return staged_fades[packets[draw.first_packet + instance].instance];
+}
+
+int DrawList::submit(const std::function<void(const Draw&)>& apply_state) {
+    if (pulled) return submitPulled(apply_state);
+    const bool multi_draw = multiDrawAvailable() && commands_uploaded;
+    if (multi_draw) glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+
+    int calls = 0;
+    GLuint bound_vao = 0;
+    for (size_t first = 0; first < draws.size();) {
+        const Draw& head = draws[first];
+        const MeshRecord& head_mesh = mesh_pool[head.handle];
+        if (first == 0 || head.state != draws[first - 1].state || head.cull_mode != draws[first - 1].cull_mode) {
+            apply_state(head);
+        }
+
+        // Meshes of one arena can differ in their shadow VAO, whether their positions quantized
+        const GLuint vao = streamVertexArray(head_mesh, stream);
+        size_t end = first + 1;
+        while (end < draws.size() && draws[end].state == head.state && draws[end].cull_mode == head.cull_mode &&
+               mesh_pool[draws[end].handle].vao == head_mesh.vao && mesh_pool[draws[end].handle].index_type == head_mesh.index_type &&
+               streamVertexArray(mesh_pool[draws[end].handle], stream) == vao) {
+            end++;
+        }
+
+        // A depth or shadow VAO belongs to exactly one VAO, so the segments still go by VAO
+        const Segment& segment = segments[head_mesh.vao];
+        if (vao != bound_vao) {
+            gl_state.bindVertexArray(vao);
+            bound_vao = vao;
+        }
+        pointInstanceRange(segment.range);
+
+        if (multi_draw) {
+            const uint32_t command_end = draws[end - 1].first_command + draws[end - 1].command_count;
+            gl_extensions.MultiDrawElementsIndirect(GL_TRIANGLES, head_mesh.index_type,
+                                                    (const void*)(head.first_command * sizeof(DrawElementsIndirectCommand)),
+                                                    (GLsizei)(command_end - head.first_command), 0);
+            calls++;
+        } else {
+            uint32_t pointed_instance = 0;
+            for (size_t i = first; i < end; ++i) {
+                const Draw& draw = draws[i];
+                if (draw.instance_count == 0) continue;
+                const MeshRecord& mesh = mesh_pool[draw.handle];
+
+                if (gl_extensions.base_instance && draw.ranges) {
+                    const size_t index_size = getIndexSize(mesh.index_type);
+                    for (uint32_t r = 0; r < draw.range_count; ++r) {
+                        gl_extensions.DrawElementsInstancedBaseVertexBaseInstance(
+                            GL_TRIANGLES, draw.ranges[r].index_count, mesh.index_type,
+                            (const void*)(mesh.index_offset + draw.ranges[r].first_index * index_size),
+                            draw.instance_count, mesh.base_vertex, draw.first_instance);
+                        calls++;
+                    }
+                    continue;
+                } else if (gl_extensions.base_instance) {
+                    gl_extensions.DrawElementsInstancedBaseVertexBaseInstance(
+                        GL_TRIANGLES, mesh.index_count, mesh.index_type, (const void*)mesh.index_offset,
+                        draw.instance_count, mesh.base_vertex, draw.first_instance);
+                } else {
+                    if (draw.first_instance != pointed_instance) {
+                        pointInstanceRange(segment.range, draw.first_instance);
+                        pointed_instance = draw.first_instance;
+                    }
+                    drawMeshElements(*draw.mesh, draw.instance_count);
+                }
+                calls++;
+            }
+        }
+        // Other users of the VAO expect its own instance buffers
+        pointInstanceAttributes(segment.instance_vbo, segment.fade_vbo, 0);
+        first = end;
+    }
+
+    gl_state.bindVertexArray(0);
+    if (multi_draw) glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return calls;
+}
+
+// Nothing to rebind between meshes, so a run only ends where the state or cull mode does
+int DrawList::submitPulled(const std::function<void(const Draw&)>& apply_state) {
+    vertex_pulling.bind();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VERTEX_PULL_INSTANCE_BINDING, pulled_instance_buffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, pulled_indirect_buffer);
+
+    int calls = 0;
+    for (size_t first = 0; first < draws.size();) {
+        const Draw& head = draws[first];
+        apply_state(head);
+        size_t end = first + 1;
+        while (end < draws.size() && draws[end].state == head.state && draws[end].cull_mode == head.cull_mode) end++;
+        const uint32_t command_end = draws[end - 1].first_command + draws[end - 1].command_count;
+        gl_extensions.MultiDrawArraysIndirect(GL_TRIANGLES, (const void*)(head.first_command * sizeof(DrawArraysIndirectCommand)),
+                                              (GLsizei)(command_end - head.first_command), 0);
+        calls++;
+        first = end;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    gl_state.bindVertexArray(0);
+    return calls;
+}
@@ -1,7 +1,15 @@
+#define GLM_ENABLE_EXPERIMENTAL
 #include "entity_manager.h"
 #include "mesh_loader.h"
+#include "material_registry.h"
+#include "frustum.h"
+#include "job_system.h"
+#include "profiler.h"
 #include <cstdio>
 #include <cmath>
+#include <algorithm>
+#include <unordered_set>
+#include <glm/gtx/euler_angles.hpp>
 
 // Global entity manager instance
 EntityManager entity_manager;
@@ -9,7 +17,22 @@ EntityManager entity_manager;
 // Global triangle counter
 extern unsigned int total_triangles;
 
-size_t EntityManager::addEntity(Entity&& entity) {
+void EntityManager::reserve(size_t count) {
+    size_t total = entities.size() + count;
+    entities.reserve(total);
+    world_matrices.reserve(total);
+    previous_world_matrices.reserve(total);
+    world_spheres.reserve(total);
+    world_mins.reserve(total);
+    world_maxs.reserve(total);
+    flags.reserve(total);
+    dense_slots.reserve(total);
+    proxies.reserve(total);
+    parents.reserve(total);
+    if (free_slots.size() < count) handle_slots.reserve(handle_slots.size() + count - free_slots.size());
+}
+
+EntityHandle EntityManager::addEntity(Entity&& entity, bool is_static) {
     // Count triangles for this entity
     extern unsigned int total_triangles;
     
@@ -21,62 +44,536 @@ size_t EntityManager::addEntity(Entity&& entity) {
     }
     
     total_triangles += entity_triangles;
+    render_prototypes.retain(entity.prototype);
         
     entities.push_back(std::move(entity));
-    return entities.size() - 1;
+    world_matrices.emplace_back(1.0f);
+    previous_world_matrices.emplace_back(1.0f);
+    world_spheres.emplace_back(0.0f);
+    world_mins.emplace_back(0.0f);
+    world_maxs.emplace_back(0.0f);
+    flags.push_back(is_static ? ENTITY_FLAG_STATIC : 0);
+    if (is_static) static_version++;
+    proxies.push_back(AABB_TREE_NULL);
+    parents.push_back(ENTITY_NO_PARENT);
+
+    // Reuse a released handle slot before growing the table
+    EntityHandle handle;
+    if (!free_slots.empty()) {
+        handle.index = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        handle.index = (uint32_t)handle_slots.size();
+        handle_slots.emplace_back();
+    }
+    handle.generation = next_generation++;
+    if (next_generation == 0) next_generation = 1; // 0 stays the null handle
+
+    uint32_t dense = (uint32_t)(entities.size() - 1);
+    handle_slots[handle.index] = { dense, handle.generation };
+    dense_slots.push_back(handle.index);
+    name_index[entities.back().name].push_back(handle.index);
+    layout_version++;
+    structure_version++;
+
+    refreshTransform(dense);
+    return handle;
 }
 
-int EntityManager::findEntity(std::string name) {
-    for (size_t i = 0; i < entities.size(); i++) {
-        if (entities[i].active && entities[i].name == name) {
-            return i;
+void EntityManager::compact() {
+    // Indices are about to shift, the movers come to rest a frame early instead
+    for (uint32_t i : moved) previous_world_matrices[i] = world_matrices[i];
+    moved.clear();
+
+    size_t live = 0;
+    // Name entries go once per name below, thousands of removed "tree"s would be quadratic
+    std::unordered_set<std::string> removed_names;
+    for (size_t i = 0; i < entities.size(); ++i) {
+        uint32_t slot = dense_slots[i];
+        if (!entities[i].active) {
+            // Release the handle
+            removed_names.insert(entities[i].name);
+            render_prototypes.release(entities[i].prototype);
+            handle_slots[slot].generation = 0;
+            free_slots.push_back(slot);
+            treeOf(i).remove(proxies[i]);
+            if (flags[i] & ENTITY_FLAG_STATIC) static_version++;
+            if (parents[i] != ENTITY_NO_PARENT) parented_count--;
+            continue;
+        }
+
+        if (live != i) {
+            entities[live] = std::move(entities[i]);
+            world_matrices[live] = world_matrices[i];
+            previous_world_matrices[live] = previous_world_matrices[i];
+            world_spheres[live] = world_spheres[i];
+            world_mins[live] = world_mins[i];
+            world_maxs[live] = world_maxs[i];
+            flags[live] = flags[i];
+            dense_slots[live] = slot;
+            proxies[live] = proxies[i];
+            parents[live] = parents[i];
+            handle_slots[slot].dense = (uint32_t)live;
         }
+        live++;
+    }
+
+    // A released slot has generation 0 until it's reused
+    for (const std::string& name : removed_names) {
+        auto it = name_index.find(name);
+        if (it == name_index.end()) continue;
+        std::vector<uint32_t>& slots = it->second;
+        slots.erase(std::remove_if(slots.begin(), slots.end(), [&](uint32_t slot) { return handle_slots[slot].generation == 0; }),
+                    slots.end());
+        if (slots.empty()) name_index.erase(it);
     }
-    return -1;
+
+    // Destroying the tail releases the removed entities' meshes
+    entities.resize(live);
+    world_matrices.resize(live);
+    previous_world_matrices.resize(live);
+    world_spheres.resize(live);
+    world_mins.resize(live);
+    world_maxs.resize(live);
+    flags.resize(live);
+    dense_slots.resize(live);
+    proxies.resize(live);
+    parents.resize(live);
+    layout_version++;
+    structure_version++;
+
+    // Orphans become roots, and the dirty list held dense indices
+    dirty_roots.clear();
+    for (size_t i = 0; i < live; ++i) {
+        if (parents[i] != ENTITY_NO_PARENT && handle_slots[parents[i]].generation == 0) {
+            parents[i] = ENTITY_NO_PARENT;
+            parented_count--;
+            flags[i] |= ENTITY_FLAG_TRANSFORM_DIRTY;
+        }
+        if ((flags[i] & ENTITY_FLAG_TRANSFORM_DIRTY) && parents[i] == ENTITY_NO_PARENT) dirty_roots.push_back((uint32_t)i);
+    }
+    hierarchy_dirty = true;
 }
 
-bool EntityManager::updateEntity(std::string name, const glm::vec3& pos, const glm::vec3& rot, const glm::vec3& scale) {
-    int i = findEntity(name);
-    if (i == -1) return false;
+void EntityManager::refreshTransform(size_t index) {
+    const glm::mat4* parent_world = nullptr;
+    if (parents[index] != ENTITY_NO_PARENT) parent_world = &world_matrices[handle_slots[parents[index]].dense];
+    computeWorld(index, parent_world);
+    previous_world_matrices[index] = world_matrices[index]; // Outside the frame, so no motion
 
-    const float NO_CHANGE = std::numeric_limits<float>::max();
+    if (proxies[index] == AABB_TREE_NULL) {
+        proxies[index] = treeOf(index).insert(world_mins[index], world_maxs[index], dense_slots[index]);
+    } else {
+        treeOf(index).move(proxies[index], world_mins[index], world_maxs[index]);
+    }
+}
 
-    // Positions
-    if (pos.x != NO_CHANGE) entities[i].position.x = pos.x;
-    if (pos.y != NO_CHANGE) entities[i].position.y = pos.y;
-    if (pos.z != NO_CHANGE) entities[i].position.z = pos.z;
-    
-    // Rotations
-    if (rot.x != NO_CHANGE) entities[i].rotation.x = rot.x;
-    if (rot.y != NO_CHANGE) entities[i].rotation.y = rot.y;
-    if (rot.z != NO_CHANGE) entities[i].rotation.z = rot.z;
-    
-    // Scale
-    if (scale.x != NO_CHANGE) entities[i].scale.x = scale.x;
-    if (scale.y != NO_CHANGE) entities[i].scale.y = scale.y;
-    if (scale.z != NO_CHANGE) entities[i].scale.z = scale.z;
+void EntityManager::computeWorld(size_t index, const glm::mat4* parent_world) {
+    Entity& entity = entities[index];
+    glm::mat4 model = entity.getModelMatrix(&entity);
+    if (parent_world) model = *parent_world * model;
+    world_matrices[index] = model;
+    flags[index] = (flags[index] & ~ENTITY_FLAG_ACTIVE) | (entity.active ? ENTITY_FLAG_ACTIVE : 0);
+
+    glm::vec3 local_min = entity.bounds_min, local_max = entity.bounds_max;
+    if (entity.bounds_radius <= 0.0f) {
+        local_min = entity.bounds_center - glm::vec3(5.0f);
+        local_max = entity.bounds_center + glm::vec3(5.0f);
+    }
+    // Largest axis scale of the whole chain, which is getWorldRadius() for roots
+    float radius = entity.bounds_radius > 0.0f ? entity.bounds_radius : 5.0f;
+    float axis_scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    world_spheres[index] = glm::vec4(glm::vec3(model * glm::vec4(entity.bounds_center, 1.0f)), radius * axis_scale);
+
+    // Box around the transformed box: the centre moves, the extents project onto each axis
+    glm::vec3 center = glm::vec3(model * glm::vec4((local_min + local_max) * 0.5f, 1.0f));
+    glm::vec3 half = (local_max - local_min) * 0.5f;
+    glm::vec3 extent = glm::abs(glm::vec3(model[0])) * half.x + glm::abs(glm::vec3(model[1])) * half.y +
+                       glm::abs(glm::vec3(model[2])) * half.z;
+    world_mins[index] = center - extent;
+    world_maxs[index] = center + extent;
+}
+
+void EntityManager::markDirty(size_t index) {
+    if (flags[index] & ENTITY_FLAG_TRANSFORM_DIRTY) return;
+    if (flags[index] & ENTITY_FLAG_STATIC) static_version++; // Its chunk gets rebaked
+    flags[index] |= ENTITY_FLAG_TRANSFORM_DIRTY;
+    if (parents[index] == ENTITY_NO_PARENT) dirty_roots.push_back((uint32_t)index);
+}
+
+// ============================================================================
+// HIERARCHY
+// ============================================================================
+
+bool EntityManager::setParent(EntityHandle child, EntityHandle parent) {
+    if (!isValid(child) || (!parent.isNull() && !isValid(parent))) return false;
+    size_t index = indexOf(child);
+    uint32_t parent_slot = parent.isNull() ? ENTITY_NO_PARENT : parent.index;
+    if (parents[index] == parent_slot) return true;
 
+    // Refuse to hang an entity below its own subtree
+    for (uint32_t slot = parent_slot; slot != ENTITY_NO_PARENT; slot = parents[handle_slots[slot].dense]) {
+        if (slot == child.index) {
+            printf("Warning: '%s' can't be parented to its own descendant\n", entities[index].name.c_str());
+            return false;
+        }
+    }
+
+    if (parents[index] == ENTITY_NO_PARENT) parented_count++;
+    if (parent_slot == ENTITY_NO_PARENT) parented_count--;
+    parents[index] = parent_slot;
+    hierarchy_dirty = true;
+    structure_version++;
+
+    // Re-marked so a new root lands on the dirty list
+    flags[index] &= ~ENTITY_FLAG_TRANSFORM_DIRTY;
+    markDirty(index);
     return true;
 }
 
+EntityHandle EntityManager::getParent(EntityHandle child) const {
+    if (!isValid(child)) return EntityHandle();
+    uint32_t slot = parents[indexOf(child)];
+    if (slot == ENTITY_NO_PARENT) return EntityHandle();
+    return { slot, handle_slots[slot].generation };
+}
+
+void EntityManager::rebuildHierarchy() {
+    hierarchy_dirty = false;
+    hierarchy_order.clear();
+    hierarchy_parent.clear();
+    level_starts.clear();
+    if (parented_count == 0) return;
+
+    // Children grouped by parent, counting sort style
+    std::vector<uint32_t> child_start(entities.size() + 1, 0);
+    for (size_t i = 0; i < entities.size(); ++i) {
+        if (parents[i] != ENTITY_NO_PARENT) child_start[handle_slots[parents[i]].dense + 1]++;
+    }
+    for (size_t i = 0; i < entities.size(); ++i) child_start[i + 1] += child_start[i];
+    std::vector<uint32_t> children(parented_count);
+    std::vector<uint32_t> fill(child_start.begin(), child_start.end() - 1);
+    for (size_t i = 0; i < entities.size(); ++i) {
+        if (parents[i] != ENTITY_NO_PARENT) children[fill[handle_slots[parents[i]].dense]++] = (uint32_t)i;
+    }
+
+    // Breadth-first from the roots, so each level is one contiguous run
+    std::vector<uint32_t> frontier;
+    for (size_t i = 0; i < entities.size(); ++i) {
+        if (parents[i] == ENTITY_NO_PARENT && child_start[i + 1] > child_start[i]) frontier.push_back((uint32_t)i);
+    }
+    while (!frontier.empty()) {
+        level_starts.push_back(hierarchy_order.size());
+        std::vector<uint32_t> next;
+        for (uint32_t parent : frontier) {
+            for (uint32_t c = child_start[parent]; c < child_start[parent + 1]; ++c) {
+                hierarchy_order.push_back(children[c]);
+                hierarchy_parent.push_back(parent);
+                if (child_start[children[c] + 1] > child_start[children[c]]) next.push_back(children[c]);
+            }
+        }
+        frontier.swap(next);
+    }
+    level_starts.push_back(hierarchy_order.size());
+}
+
+void EntityManager::updateTransforms() {
+    PROFILE_SCOPE("transforms");
+    if (hierarchy_dirty) rebuildHierarchy();
+
+    // Last frame's movers are where they ended up, until they move again below
+    for (uint32_t i : moved) previous_world_matrices[i] = world_matrices[i];
+    moved.clear();
+
+    // Roots first. The list can hold repeats and entities parented since they were marked.
+    std::sort(dirty_roots.begin(), dirty_roots.end());
+    dirty_roots.erase(std::unique(dirty_roots.begin(), dirty_roots.end()), dirty_roots.end());
+    dirty_roots.erase(std::remove_if(dirty_roots.begin(), dirty_roots.end(), [&](uint32_t i) {
+        return parents[i] != ENTITY_NO_PARENT || !(flags[i] & ENTITY_FLAG_TRANSFORM_DIRTY);
+    }), dirty_roots.end());
+
+    job_system.parallelFor(dirty_roots.size(), TRANSFORM_PROPAGATION_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            uint32_t i = dirty_roots[k];
+            computeWorld(i, nullptr);
+            flags[i] = (flags[i] & ~ENTITY_FLAG_TRANSFORM_DIRTY) | ENTITY_FLAG_WORLD_CHANGED;
+        }
+    });
+    // The tree isn't thread safe, its moves stay on this thread
+    for (uint32_t i : dirty_roots) treeOf(i).move(proxies[i], world_mins[i], world_maxs[i]);
+
+    // Then one level at a time, skipping subtrees where nothing above changed
+    for (size_t level = 0; level + 1 < level_starts.size(); ++level) {
+        size_t first = level_starts[level];
+        size_t count = level_starts[level + 1] - first;
+        job_system.parallelFor(count, TRANSFORM_PROPAGATION_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t k = first + begin; k < first + end; ++k) {
+                uint32_t i = hierarchy_order[k], parent = hierarchy_parent[k];
+                if (!(flags[i] & ENTITY_FLAG_TRANSFORM_DIRTY) && !(flags[parent] & ENTITY_FLAG_WORLD_CHANGED)) continue;
+                computeWorld(i, &world_matrices[parent]);
+                flags[i] = (flags[i] & ~ENTITY_FLAG_TRANSFORM_DIRTY) | ENTITY_FLAG_WORLD_CHANGED;
+            }
+        });
+        for (size_t k = first; k < first + count; ++k) {
+            uint32_t i = hierarchy_order[k];
+            if (flags[i] & ENTITY_FLAG_WORLD_CHANGED) treeOf(i).move(proxies[i], world_mins[i], world_maxs[i]);
+        }
+    }
+
+    moved.assign(dirty_roots.begin(), dirty_roots.end());
+    for (uint32_t i : hierarchy_order) {
+        if (flags[i] & ENTITY_FLAG_WORLD_CHANGED) moved.push_back(i);
+    }
+    for (uint32_t i : moved) flags[i] &= ~ENTITY_FLAG_WORLD_CHANGED;
+    dirty_roots.clear();
+}
+
+void EntityManager::shiftOrigin(const glm::vec3& delta) {
+    const glm::vec4 offset(delta, 0.0f);
+    for (size_t i = 0; i < entities.size(); ++i) {
+        world_matrices[i][3] -= offset;
+        previous_world_matrices[i][3] -= offset;
+        if (parents[i] != ENTITY_NO_PARENT) continue;
+        entities[i].position -= delta;
+        markDirty(i);
+    }
+}
+
+uint32_t EntityManager::componentsOf(size_t index) const {
+    const Entity& entity = entities[index];
+    const uint8_t entity_flags = flags[index];
+    uint32_t components = 0;
+    if (entity_flags & ENTITY_FLAG_STATIC) components |= ENTITY_COMPONENT_STATIC;
+    if (entity_flags & ENTITY_FLAG_ANIMATED) components |= ENTITY_COMPONENT_ANIMATED;
+    if (entity_flags & ENTITY_FLAG_LIGHT_PROXY) {
+        components |= ENTITY_COMPONENT_LIGHT_PROXY;
+    } else if (!entity.lodLevels().empty()) {
+        components |= ENTITY_COMPONENT_RENDERABLE;
+    }
+    for (const auto& level : entity.lodLevels()) {
+        if (!level.meshes.empty() && (components & ENTITY_COMPONENT_RENDERABLE)) components |= ENTITY_COMPONENT_SHADOW_CASTER;
+        for (const auto& mesh : level.meshes) {
+            if (mesh && mesh->material.alphaMode == BLEND) components |= ENTITY_COMPONENT_BLENDED;
+        }
+    }
+    return components;
+}
+
+EntitySpan<uint32_t> EntityManager::query(uint32_t all, uint32_t none) {
+    CachedQuery& cached = query_cache[((uint64_t)all << 32) | none];
+    if (cached.version != structure_version) {
+        cached.indices.clear();
+        for (size_t i = 0; i < entities.size(); ++i) {
+            if (!entities[i].active) continue;
+            const uint32_t components = componentsOf(i);
+            if ((components & all) == all && !(components & none)) cached.indices.push_back((uint32_t)i);
+        }
+        cached.version = structure_version;
+    }
+    return { cached.indices.data(), cached.indices.size() };
+}
+
+// Tree leaves hold handle slots, turned back into dense indices here
+// Per thread, so queries can run on several at once
+static std::vector<uint32_t>& querySlots() {
+    thread_local std::vector<uint32_t> slots;
+    return slots;
+}
+
+void EntityManager::queryFrustum(const Frustum& frustum, std::vector<uint32_t>& out, bool include_static) const {
+    std::vector<uint32_t>& query_slots = querySlots();
+    query_slots.clear();
+    spatial_tree.queryFrustum(frustum, query_slots);
+    if (include_static) static_tree.queryFrustum(frustum, query_slots);
+    out.clear();
+    for (uint32_t slot : query_slots) out.push_back(handle_slots[slot].dense);
+    std::sort(out.begin(), out.end()); // Memory order, and the same order brute force gave
+}
+
+void EntityManager::queryBox(const glm::vec3& bmin, const glm::vec3& bmax, std::vector<uint32_t>& out) const {
+    std::vector<uint32_t>& query_slots = querySlots();
+    query_slots.clear();
+    spatial_tree.queryBox(bmin, bmax, query_slots);
+    static_tree.queryBox(bmin, bmax, query_slots);
+    out.clear();
+    for (uint32_t slot : query_slots) out.push_back(handle_slots[slot].dense);
+    std::sort(out.begin(), out.end());
+}
+
+void EntityManager::queryRay(const glm::vec3& origin, const glm::vec3& direction, float max_distance,
+                             std::vector<std::pair<float, uint32_t>>& out, bool include_static) const {
+    out.clear();
+    spatial_tree.queryRay(origin, direction, max_distance, out);
+    if (include_static) static_tree.queryRay(origin, direction, max_distance, out);
+    for (auto& candidate : out) candidate.second = handle_slots[candidate.second].dense;
+    std::sort(out.begin(), out.end());
+}
+
+// Drops every entity (and with them the last mesh references) while GL is still alive
+void EntityManager::clear() {
+    for (const Entity& entity : entities) render_prototypes.release(entity.prototype);
+    entities.clear();
+    world_matrices.clear();
+    previous_world_matrices.clear();
+    world_spheres.clear();
+    world_mins.clear();
+    world_maxs.clear();
+    flags.clear();
+    dense_slots.clear();
+    proxies.clear();
+    parents.clear();
+    hierarchy_order.clear();
+    hierarchy_parent.clear();
+    level_starts.clear();
+    hierarchy_dirty = false;
+    parented_count = 0;
+    dirty_roots.clear();
+    moved.clear();
+    spatial_tree.clear();
+    static_tree.clear();
+    static_version++;
+    handle_slots.clear();
+    free_slots.clear();
+    name_index.clear();
+    layout_version++;
+    structure_version++;
+    total_triangles = 0;
+}
+
+int EntityManager::findEntity(const std::string& name) const {
+    EntityHandle handle = findHandle(name);
+    return handle.isNull() ? -1 : (int)indexOf(handle);
+}
+
+// First live entity with the name, like the old linear search
+EntityHandle EntityManager::findHandle(const std::string& name) const {
+    auto it = name_index.find(name);
+    if (it == name_index.end()) return EntityHandle();
+    for (uint32_t slot : it->second) {
+        const HandleSlot& entry = handle_slots[slot];
+        if (entry.generation != 0 && entities[entry.dense].active) return { slot, entry.generation };
+    }
+    return EntityHandle();
+}
+
+bool EntityManager::updateEntity(const std::string& name, const glm::vec3& pos, const glm::vec3& rot, const glm::vec3& scale) {
+    return updateEntity(findHandle(name), pos, rot, scale);
+}
+
+bool EntityManager::updateEntity(EntityHandle handle, const glm::vec3& pos, const glm::vec3& rot, const glm::vec3& scale) {
+    if (!isValid(handle)) return false;
+
+    updateEntity(indexOf(handle), pos, rot, scale);
+    return true;
+}
+
+void EntityManager::setLightProxy(EntityHandle handle) {
+    if (!isValid(handle)) return;
+    flags[indexOf(handle)] |= ENTITY_FLAG_LIGHT_PROXY;
+    structure_version++;
+}
+
+bool EntityManager::setStatic(EntityHandle handle) {
+    if (!isValid(handle)) return false;
+    size_t index = indexOf(handle);
+    if (flags[index] & ENTITY_FLAG_STATIC) return true;
+
+    const Entity& entity = entities[index];
+    bool blended = false;
+    for (const auto& level : entity.lodLevels()) {
+        for (const auto& mesh : level.meshes) blended |= mesh && mesh->material.alphaMode == BLEND;
+    }
+    if ((flags[index] & ENTITY_FLAG_LIGHT_PROXY) || blended) {
+        printf("Warning: '%s' can't be static, it's a light proxy or has blended meshes\n", entity.name.c_str());
+        return false;
+    }
+
+    // Over to the static tree
+    spatial_tree.remove(proxies[index]);
+    flags[index] |= ENTITY_FLAG_STATIC;
+    proxies[index] = static_tree.insert(world_mins[index], world_maxs[index], dense_slots[index]);
+    static_version++;
+    layout_version++; // The GPU culling tables filter on it
+    structure_version++;
+    return true;
+}
+
+Entity* EntityManager::get(EntityHandle handle) {
+    return isValid(handle) ? &entities[indexOf(handle)] : nullptr;
+}
+
 void EntityManager::updateEntity(size_t index, const glm::vec3& pos, const glm::vec3& rot, const glm::vec3& scale) {        
 
     const float NO_CHANGE = std::numeric_limits<float>::max();
+    Entity& entity = entities[index];
+    bool changed = false;
+
+    // NO_CHANGE components and values equal to the current ones leave the cached matrix alone
+    auto apply = [&](float& current, float value) {
+        if (value == NO_CHANGE || value == current) return;
+        current = value;
+        changed = true;
+    };
 
     // Positions
-    if (pos.x != NO_CHANGE) entities[index].position.x = pos.x;
-    if (pos.y != NO_CHANGE) entities[index].position.y = pos.y;
-    if (pos.z != NO_CHANGE) entities[index].position.z = pos.z;
+    apply(entity.position.x, pos.x);
+    apply(entity.position.y, pos.y);
+    apply(entity.position.z, pos.z);
     
     // Rotations
-    if (rot.x != NO_CHANGE) entities[index].rotation.x = rot.x;
-    if (rot.y != NO_CHANGE) entities[index].rotation.y = rot.y;
-    if (rot.z != NO_CHANGE) entities[index].rotation.z = rot.z;
+    apply(entity.rotation.x, rot.x);
+    apply(entity.rotation.y, rot.y);
+    apply(entity.rotation.z, rot.z);
     
     // Scale
-    if (scale.x != NO_CHANGE) entities[index].scale.x = scale.x;
-    if (scale.y != NO_CHANGE) entities[index].scale.y = scale.y;
-    if (scale.z != NO_CHANGE) entities[index].scale.z = scale.z;
+    apply(entity.scale.x, scale.x);
+    apply(entity.scale.y, scale.y);
+    apply(entity.scale.z, scale.z);
+
+    // Applied by updateTransforms(), which also carries it down to the children
+    if (!changed) return;
+    markDirty(index);
+    if (!(flags[index] & (ENTITY_FLAG_ANIMATED | ENTITY_FLAG_STATIC))) {
+        flags[index] |= ENTITY_FLAG_ANIMATED;
+        structure_version++;
+    }
+}
+
+size_t EntityManager::setTransforms(const EntityHandle* handles, const EntityTransform* transforms, size_t count, uint8_t mask) {
+    // This call's newly dirty roots, queued together at the end
+    thread_local std::vector<uint32_t> roots;
+    roots.clear();
+    size_t written = 0;
+    bool static_moved = false;
+    bool first_move = false;
+    for (size_t k = 0; k < count; ++k) {
+        if (!isValid(handles[k])) continue;
+        const size_t index = indexOf(handles[k]);
+        Entity& entity = entities[index];
+        const EntityTransform& transform = transforms[k];
+        if (mask & TRANSFORM_POSITION) entity.position = transform.position;
+        if (mask & TRANSFORM_ROTATION) entity.rotation = transform.rotation;
+        if (mask & TRANSFORM_SCALE) entity.scale = transform.scale;
+        written++;
+        if (!(flags[index] & (ENTITY_FLAG_ANIMATED | ENTITY_FLAG_STATIC))) {
+            flags[index] |= ENTITY_FLAG_ANIMATED;
+            first_move = true;
+        }
+
+        // markDirty(), minus the shared state
+        if (flags[index] & ENTITY_FLAG_TRANSFORM_DIRTY) continue;
+        flags[index] |= ENTITY_FLAG_TRANSFORM_DIRTY;
+        static_moved |= (flags[index] & ENTITY_FLAG_STATIC) != 0;
+        if (parents[index] == ENTITY_NO_PARENT) roots.push_back((uint32_t)index);
+    }
+
+    if (!roots.empty() || static_moved || first_move) {
+        std::lock_guard<std::mutex> lock(dirty_mutex);
+        dirty_roots.insert(dirty_roots.end(), roots.begin(), roots.end());
+        if (static_moved) static_version++;
+        if (first_move) structure_version++;
+    }
+    return written;
 }
 
 size_t EntityManager::size() const { 
@@ -90,43 +587,37 @@ Entity* EntityManager::getEntityAt(size_t index) {
     return nullptr;
 }
 
-void createEntity(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs, glm::vec3 pos, glm::vec3 rotation, glm::vec3 scale, std::vector<int> cull_modes) {
+// Shared mesh setup plus the render prototype and local bounds every instance copies
+static Entity buildEntityPrototype(const EntityTemplate& entity_template, unsigned int& triangles) {
     Entity entity;
-    entity.name = name;
-    entity.position = pos;
-    entity.rotation = rotation;
-    entity.scale = scale;
+    entity.name = entity_template.name;
     entity.active = 1;
-    
-    extern unsigned int total_triangles;
-    unsigned int total_mesh_triangles = 0;
+    triangles = 0;
     
     // Create LOD levels from the specs
-    // Store materials from the first LOD to apply to corresponding meshes in other LODs
-    std::vector<Material> baseMaterials;
-    for (const auto& [maxDistance, meshes] : lodSpecs) {
+    // Materials from the first LOD (or the overrides) go to the corresponding meshes in other LODs,
+    // through material_registry's variants, as the meshes may be other templates' too
+    std::vector<const Material*> baseMaterials;
+    std::vector<int> baseIds;
+    std::vector<Entity::LODLevel> lod_levels;
+    for (const auto& [maxDistance, meshes] : entity_template.lod_specs) {
         Entity::LODLevel level;
         level.maxDistance = maxDistance;
         level.meshes = meshes;
         
-        // Save materials from first LOD, then apply them to all subsequent LODs
-        if (entity.lod_levels.empty()) {
-            // First LOD: save each mesh's material
-            for (const auto& mesh : meshes) {
-                if (mesh) {
-                    baseMaterials.push_back(mesh->material);
-                }
-            }
-        } else {
-            // Subsequent LODs: apply corresponding LOD0 material to each mesh
-            for (size_t i = 0; i < level.meshes.size(); ++i) {
-                if (level.meshes[i] && i < baseMaterials.size()) {
-                    level.meshes[i]->material = baseMaterials[i];
-                }
+        if (lod_levels.empty()) {
+            for (const auto& mesh : meshes) baseMaterials.push_back(mesh ? &mesh->material : nullptr);
+            for (size_t i = 0; i < baseMaterials.size() && i < entity_template.material_overrides.size(); ++i) {
+                if (entity_template.material_overrides[i]) baseMaterials[i] = entity_template.material_overrides[i];
             }
+            for (const Material* material : baseMaterials) baseIds.push_back(material ? (int)material_registry.intern(*material) : -1);
+        }
+        for (size_t i = 0; i < level.meshes.size() && i < baseIds.size(); ++i) {
+            if (baseIds[i] >= 0) level.meshes[i] = material_registry.withMaterial(level.meshes[i], (uint32_t)baseIds[i]);
         }
         
         // Apply cull modes
+        const std::vector<int>& cull_modes = entity_template.cull_modes;
         for (size_t i = 0; i < level.meshes.size(); ++i) {
             if (level.meshes[i]) {
                 if (i < cull_modes.size() && cull_modes[i]) {
@@ -134,25 +625,160 @@ void createEntity(std::string name, const std::vector<std::pair<float, std::vect
                 } else {
                     level.meshes[i]->cull_mode = CULL_NONE;
                 }
+                mesh_pool.update(*level.meshes[i]);
             }
         }
         
-        // Count triangles only for the first (highest detail) LOD
-        if (entity.lod_levels.empty()) {
+        // Count triangles and take bounds only from the first (highest detail) LOD
+        if (lod_levels.empty()) {
             for (const auto& mesh : level.meshes) {
                 if (mesh) {
-                    total_mesh_triangles += mesh->TRIANGLE_COUNT;
+                    triangles += mesh->TRIANGLE_COUNT;
                 }
             }
+            entity.bounds_radius = computeMeshesBounds(level.meshes, entity.bounds_center, entity.bounds_min, entity.bounds_max);
         }
         
-        entity.lod_levels.push_back(level);
+        lod_levels.push_back(std::move(level));
     }
     
-    total_triangles += total_mesh_triangles;
+    if (entity_template.impostor && !lod_levels.empty()) {
+        Entity::LODLevel level;
+        level.maxDistance = lod_levels.back().maxDistance;
+        level.impostor = entity_template.impostor;
+        lod_levels.push_back(std::move(level));
+    }
+    if (!lod_levels.empty()) entity.prototype = render_prototypes.create(std::move(lod_levels));
+    entity.shadow_proxy_lod = entity_template.shadow_proxy_lod;
+    return entity;
+}
+
+std::vector<EntityHandle> createEntities(const EntityTemplate& entity_template, const EntityTransform* transforms, size_t count) {
+    std::vector<EntityHandle> handles;
+    if (count == 0) return handles;
+
+    unsigned int triangles = 0;
+    const Entity prototype = buildEntityPrototype(entity_template, triangles);
+
+    // Same check setStatic() makes, once for the whole batch
+    bool is_static = entity_template.is_static;
+    for (const auto& level : prototype.lodLevels()) {
+        for (const auto& mesh : level.meshes) {
+            if (is_static && mesh && mesh->material.alphaMode == BLEND) {
+                printf("Warning: '%s' has blended meshes, created as dynamic\n", prototype.name.c_str());
+                is_static = false;
+            }
+        }
+    }
+
+    handles.reserve(count);
+    entity_manager.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        Entity entity = prototype;
+        entity.position = transforms[i].position;
+        entity.rotation = transforms[i].rotation;
+        entity.scale = transforms[i].scale;
+        handles.push_back(entity_manager.addEntity(std::move(entity), is_static));
+    }
+
+    extern unsigned int total_triangles;
+    total_triangles += triangles * (unsigned int)count;
+    printf("Created %zu '%s' entities with %zu LOD levels (%u triangles each)\n", count, prototype.name.c_str(),
+           prototype.lodLevels().size(), triangles);
+    return handles;
+}
+
+std::vector<EntityHandle> createNodeEntities(const EntityTemplate& entity_template, const std::vector<MeshNodeInstance>& instances,
+                                             const EntityTransform& root) {
+    Entity root_entity;
+    root_entity.position = root.position;
+    root_entity.rotation = root.rotation;
+    root_entity.scale = root.scale;
+    const glm::mat4 root_model = root_entity.getModelMatrix(&root_entity);
+
+    // Placements per sub-mesh, as the entity transforms getModelMatrix() rebuilds them into
+    std::vector<std::vector<EntityTransform>> placements;
+    for (const MeshNodeInstance& instance : instances) {
+        const glm::mat4 model = root_model * instance.transform;
+        EntityTransform transform;
+        transform.position = glm::vec3(model[3]);
+        glm::mat3 basis(model);
+        for (int axis = 0; axis < 3; ++axis) {
+            transform.scale[axis] = glm::length(basis[axis]);
+            if (transform.scale[axis] > 0.0f) basis[axis] /= transform.scale[axis];
+        }
+        // A mirroring node keeps a proper rotation, the flip goes to the x scale
+        if (glm::determinant(basis) < 0.0f) {
+            transform.scale.x = -transform.scale.x;
+            basis[0] = -basis[0];
+        }
+        float x = 0.0f, y = 0.0f, z = 0.0f;
+        glm::extractEulerAngleXYZ(glm::mat4(basis), x, y, z);
+        transform.rotation = glm::degrees(glm::vec3(x, y, z));
+
+        if (instance.submesh >= placements.size()) placements.resize(instance.submesh + 1);
+        placements[instance.submesh].push_back(transform);
+    }
+
+    std::vector<EntityHandle> handles;
+    handles.reserve(instances.size());
+    for (size_t submesh = 0; submesh < placements.size(); ++submesh) {
+        if (placements[submesh].empty()) continue;
+        EntityTemplate narrowed = entity_template;
+        narrowed.name = entity_template.name + "/" + std::to_string(submesh);
+        for (auto& [distance, meshes] : narrowed.lod_specs) {
+            meshes = submesh < meshes.size() ? std::vector<std::shared_ptr<Mesh>>{ meshes[submesh] } : std::vector<std::shared_ptr<Mesh>>{};
+        }
+        narrowed.cull_modes = { submesh < entity_template.cull_modes.size() ? entity_template.cull_modes[submesh] : CULL_NONE };
+        narrowed.material_overrides = { submesh < entity_template.material_overrides.size() ? entity_template.material_overrides[submesh] : nullptr };
+        const auto created = createEntities(narrowed, placements[submesh]);
+        handles.insert(handles.end(), created.begin(), created.end());
+    }
+    return handles;
+}
+
+EntityHandle createEntity(const std::string& name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs, glm::vec3 pos, glm::vec3 rotation, glm::vec3 scale, const std::vector<int>& cull_modes,
+                  std::shared_ptr<Impostor> impostor) {
+    EntityTemplate entity_template;
+    entity_template.name = name;
+    entity_template.lod_specs = lodSpecs;
+    entity_template.cull_modes = cull_modes;
+    entity_template.impostor = std::move(impostor);
+
+    unsigned int triangles = 0;
+    Entity entity = buildEntityPrototype(entity_template, triangles);
+    entity.position = pos;
+    entity.rotation = rotation;
+    entity.scale = scale;
+
+    extern unsigned int total_triangles;
+    total_triangles += triangles;
     
     printf("Created entity '%s' with %zu LOD levels (%u triangles)\n",
-           name.c_str(), lodSpecs.size(), total_mesh_triangles);
+           name.c_str(), entity.lodLevels().size(), triangles);
     
-    entity_manager.addEntity(std::move(entity));
-}
\ No newline at end of file
+    return entity_manager.addEntity(std::move(entity));
+}
+
+std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>> generatedLODSpecs(const std::vector<std::shared_ptr<Mesh>>& meshes, const std::vector<float>& distances) {
+    std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>> specs;
+    for (size_t level = 0; level < distances.size(); ++level) {
+        std::vector<std::shared_ptr<Mesh>> levelMeshes;
+        bool generated = level == 0;
+        for (const auto& mesh : meshes) {
+            if (level == 0 || mesh->lods.empty()) {
+                levelMeshes.push_back(mesh);
+            } else {
+                levelMeshes.push_back(mesh->lods[std::min(level, mesh->lods.size()) - 1]);
+                generated |= level <= mesh->lods.size();
+            }
+        }
+        // Past the end of every chain, the previous level already covers it
+        if (!generated) {
+            specs.back().first = distances.back();
+            break;
+        }
+        specs.push_back({distances[level], levelMeshes});
+    }
+    return specs;
+}
@@ -1,6 +1,8 @@
 #include "filesystem.h"
+#include "asset_pack.h"
 #include <cstdio>
 #include <filesystem>
+#include <system_error>
 
 // Emscripten Specific Includes
 #ifdef __EMSCRIPTEN__
@@ -18,6 +20,14 @@
     #include <limits.h>
 #endif
 
+// Memory mapping
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
 std::filesystem::path executable_path;
 
 std::filesystem::path getExecutableDirectory() {
@@ -89,4 +99,125 @@ std::string resolveTexturePath(const std::string& modelPath, const std::string&
 
     // Return texture relative to the model's directory
     return (mPath.parent_path() / tPath).string();
-}
\ No newline at end of file
+}
+
+int64_t getFileModifiedTime(const std::string& path) {
+    if (int64_t packed = asset_pack.modifiedTime(path)) return packed;
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(path, ec);
+    if (ec) return 0;
+    return static_cast<int64_t>(time.time_since_epoch().count());
+}
+
+// ============================================================================
+// MEMORY-MAPPED FILES
+// ============================================================================
+
+bool MappedFile::open(const std::string& path) {
+    close();
+
+    // A packed file is a view into the pack's own mapping
+    const unsigned char* packed = nullptr;
+    size_t packed_size = 0;
+    if (asset_pack.find(path, packed, packed_size) && packed_size > 0) {
+        data_ptr = packed;
+        data_size = packed_size;
+        borrowed = true;
+        return true;
+    }
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    file_handle = file;
+    mapping_handle = mapping;
+    data_ptr = static_cast<const unsigned char*>(view);
+    data_size = static_cast<size_t>(file_size.QuadPart);
+#elif defined(__EMSCRIPTEN__)
+    // MEMFS has no real mmap, so just read the whole file
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (length <= 0) {
+        fclose(file);
+        return false;
+    }
+
+    unsigned char* buffer = new unsigned char[length];
+    if (fread(buffer, 1, length, file) != (size_t)length) {
+        delete[] buffer;
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    data_ptr = buffer;
+    data_size = static_cast<size_t>(length);
+    heap_copy = true;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);  // The mapping stays valid after closing the descriptor
+    if (mapped == MAP_FAILED) return false;
+
+    data_ptr = static_cast<const unsigned char*>(mapped);
+    data_size = static_cast<size_t>(st.st_size);
+#endif
+
+    return true;
+}
+
+void MappedFile::close() {
+    if (!data_ptr) return;
+
+    if (borrowed) {
+        // The pack owns the mapping
+    } else if (heap_copy) {
+        delete[] data_ptr;
+    } else {
+#if defined(_WIN32)
+        UnmapViewOfFile(data_ptr);
+        CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+        mapping_handle = file_handle = nullptr;
+#elif !defined(__EMSCRIPTEN__)
+        munmap(const_cast<unsigned char*>(data_ptr), data_size);
+#endif
+    }
+
+    data_ptr = nullptr;
+    data_size = 0;
+    heap_copy = false;
+    borrowed = false;
+}
@@ -0,0 +1,682 @@
+#include "foliage.h"
+#include "draw_list.h"
+#include "filesystem.h"
+#include "frustum.h"
+#include "geometry_arena.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "gpu_culling.h"
+#include "gpu_memory.h"
+#include "impostor.h"
+#include "job_system.h"
+#include "mesh.h"
+#include "mesh_loader.h"
+#include "shader.h"
+#include "shader_loading.h"
+#include "stb_image.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+bool use_foliage = true;
+bool use_gpu_foliage_culling = true;
+float foliage_wind_strength = 1.0f;
+glm::vec2 foliage_wind_direction(1.0f, 0.3f);
+Foliage foliage;
+
+static constexpr UniformId U_FOLIAGE_WIND("foliageWind");
+static constexpr UniformId U_FOLIAGE_HEIGHT("foliageHeight");
+static constexpr UniformId U_FRUSTUM_PLANES("frustumPlanes");
+static constexpr UniformId U_CAMERA_POSITION("cameraPosition");
+static constexpr UniformId U_INSTANCE_COUNT("instanceCount");
+static constexpr UniformId U_TIER_COUNT("tierCount");
+static constexpr UniformId U_TIER_ENDS("tierEnds");
+static constexpr UniformId U_TIER_COMMANDS("tierCommands");
+static constexpr UniformId U_BOUNDS("bounds");
+
+#define FOLIAGE_SCATTER_GRAIN 4 // Cells per job
+
+Foliage::~Foliage() {
+    clear();
+}
+
+// Slots 6 and 7 of the bound VAO onto a foliage instance buffer from instance first
+static void pointFoliageInstances(GLuint instances, size_t first) {
+    const size_t base = first * sizeof(FoliageInstance);
+    glBindBuffer(GL_ARRAY_BUFFER, instances);
+    glEnableVertexAttribArray(6);
+    glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(FoliageInstance), (void*)(base + offsetof(FoliageInstance, position)));
+    glVertexAttribDivisor(6, 1);
+    glEnableVertexAttribArray(7);
+    glVertexAttribPointer(7, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(FoliageInstance), (void*)(base + offsetof(FoliageInstance, yaw)));
+    glVertexAttribDivisor(7, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void releaseBuffer(GLuint& buffer) {
+    if (buffer == 0) return;
+    gpu_memory.releaseBuffer(buffer);
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+void Foliage::clear() {
+    for (Layer& layer : layers) {
+        for (GLuint* buffer : { &layer.instance_vbo, &layer.visible_vbo, &layer.command_buffer, &layer.command_template }) {
+            releaseBuffer(*buffer);
+        }
+    }
+    for (Source& source : sources) {
+        if (source.vao != 0) glDeleteVertexArrays(1, &source.vao);
+    }
+    if (quad_vao != 0) glDeleteVertexArrays(1, &quad_vao);
+    for (GLuint* buffer : { &quad_vbo, &quad_ebo }) {
+        if (*buffer != 0) glDeleteBuffers(1, buffer);
+        *buffer = 0;
+    }
+    quad_vao = 0;
+    quad_instances = 0;
+    quad_first = 0;
+
+    layers.clear();
+    sources.clear();
+    source_index.clear();
+    shadow_runs.clear();
+    cull_shader.reset();
+    cull_shader_failed = false;
+    gpu_culled = false;
+    drawn_instances = drawn_triangles = 0;
+}
+
+uint32_t Foliage::sourceFor(const std::shared_ptr<Mesh>& mesh) {
+    GLuint vbo = mesh->arena ? mesh->arena->vbo : mesh->VBO;
+    auto it = source_index.find(vbo);
+    if (it != source_index.end()) return it->second;
+
+    Source source;
+    source.vertex_format = mesh->vertex_layout.format;
+    if (mesh->arena) {
+        source.arena = mesh->arena;
+    } else {
+        source.mesh = mesh;
+    }
+    sources.push_back(std::move(source));
+    source_index[vbo] = (uint32_t)sources.size() - 1;
+    return (uint32_t)sources.size() - 1;
+}
+
+// Binds the source's VAO, re-pointing the vertices if its arena grew into new buffers since and
+// the instances if they're another layer's or start elsewhere
+void Foliage::bindSource(Source& source, GLuint instances, size_t first) {
+    GLuint vbo = source.arena ? source.arena->vbo : source.mesh->VBO;
+    GLuint ebo = source.arena ? source.arena->ebo : source.mesh->EBO;
+    if (source.vao == 0) glGenVertexArrays(1, &source.vao);
+    gl_state.bindVertexArray(source.vao);
+    if (vbo != source.vbo || ebo != source.ebo) {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        setupVertexAttributes(getVertexLayout(source.vertex_format));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        source.vbo = vbo;
+        source.ebo = ebo;
+    }
+    if (instances != source.instances || first != source.first) {
+        pointFoliageInstances(instances, first);
+        source.instances = instances;
+        source.first = first;
+    }
+}
+
+void Foliage::bindQuad(GLuint instances, size_t first) {
+    if (quad_vao == 0) {
+        const float corners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+        const uint16_t indices[] = { 0, 1, 2, 2, 1, 3 };
+        glGenVertexArrays(1, &quad_vao);
+        glGenBuffers(1, &quad_vbo);
+        glGenBuffers(1, &quad_ebo);
+        gl_state.bindVertexArray(quad_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad_ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    gl_state.bindVertexArray(quad_vao);
+    if (instances != quad_instances || first != quad_first) {
+        pointFoliageInstances(instances, first);
+        quad_instances = instances;
+        quad_first = first;
+    }
+}
+
+// ============================================================================
+// SCATTER
+// ============================================================================
+
+// A greyscale image as 0 to 1 weights, row 0 at the area's low z
+static bool loadDensityMap(const std::string& path, std::vector<float>& weights, int& width, int& height) {
+    MappedFile file(buildAssetPath(path));
+    if (!file.isOpen()) return false;
+    int channels = 0;
+    stbi_uc* pixels = stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 1);
+    if (!pixels) return false;
+    weights.resize((size_t)width * height);
+    for (size_t i = 0; i < weights.size(); ++i) weights[i] = pixels[i] / 255.0f;
+    stbi_image_free(pixels);
+    return true;
+}
+
+bool Foliage::addLayer(const FoliageLayerDesc& desc) {
+    Layer layer;
+    layer.name = desc.name;
+    layer.wind = desc.wind;
+    layer.casts_shadows = desc.casts_shadows;
+
+    // Mesh levels, one left for the impostor. A level with nothing valid widens the one before it.
+    const int max_mesh_tiers = desc.impostor ? FOLIAGE_MAX_TIERS - 1 : FOLIAGE_MAX_TIERS;
+    for (const auto& [end_distance, meshes] : desc.lod_specs) {
+        Tier tier;
+        tier.end_distance = end_distance;
+        for (size_t index = 0; index < meshes.size(); ++index) {
+            const std::shared_ptr<Mesh>& mesh = meshes[index];
+            if (!mesh || !mesh->isValid()) continue;
+            Draw draw;
+            draw.mesh = mesh.get();
+            draw.cull_mode = index < desc.cull_modes.size() ? desc.cull_modes[index] : mesh->cull_mode;
+            draw.source = sourceFor(mesh);
+            tier.draws.push_back(draw);
+            layer.meshes.push_back(mesh);
+        }
+        if (tier.draws.empty()) {
+            if (!layer.tiers.empty()) layer.tiers.back().end_distance = end_distance;
+            continue;
+        }
+        if ((int)layer.tiers.size() == max_mesh_tiers) {
+            layer.tiers.back().end_distance = end_distance;
+            continue;
+        }
+        layer.tiers.push_back(std::move(tier));
+    }
+    layer.mesh_tiers = (int)layer.tiers.size();
+    if (layer.mesh_tiers == 0) {
+        printf("Foliage: %s has no valid mesh\n", desc.name.c_str());
+        return false;
+    }
+    if (desc.impostor && desc.impostor_distance > layer.tiers.back().end_distance) {
+        Tier tier;
+        tier.impostor = desc.impostor.get();
+        tier.end_distance = desc.impostor_distance;
+        layer.tiers.push_back(std::move(tier));
+        layer.impostor = desc.impostor;
+    }
+    layer.runs.resize(layer.tiers.size());
+
+    // One sphere over every level, and the finest level's top for the bend
+    glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+    float top = 0.0f;
+    for (const auto& mesh : layer.meshes) {
+        bmin = glm::min(bmin, mesh->bounds_min);
+        bmax = glm::max(bmax, mesh->bounds_max);
+    }
+    for (const Draw& draw : layer.tiers[0].draws) top = std::max(top, draw.mesh->bounds_max.y);
+    const glm::vec3 center = (bmin + bmax) * 0.5f;
+    layer.bounds = glm::vec4(center, glm::length(bmax - bmin) * 0.5f);
+    layer.height = top > 0.0f ? top : 1.0f;
+
+    std::vector<float> density_weights;
+    int map_width = 0, map_height = 0;
+    if (!desc.density_map.empty() && !loadDensityMap(desc.density_map, density_weights, map_width, map_height)) {
+        printf("Foliage: couldn't load density map %s, scattering evenly\n", desc.density_map.c_str());
+    }
+
+    // Cells over the area, each scattered on its own generator so the result doesn't depend on the workers
+    const glm::vec2 area = desc.area_max - desc.area_min;
+    const int cells_x = std::max(1, (int)std::ceil(area.x / FOLIAGE_CELL_SIZE));
+    const int cells_z = std::max(1, (int)std::ceil(area.y / FOLIAGE_CELL_SIZE));
+    std::vector<std::vector<FoliageInstance>> scattered((size_t)cells_x * cells_z);
+    if (desc.density > 0.0f && area.x > 0.0f && area.y > 0.0f) {
+        job_system.parallelFor(scattered.size(), FOLIAGE_SCATTER_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                const int cx = (int)(c % cells_x), cz = (int)(c / cells_x);
+                const glm::vec2 cell_min = desc.area_min + glm::vec2(cx, cz) * FOLIAGE_CELL_SIZE;
+                const glm::vec2 cell_size = glm::min(desc.area_max - cell_min, glm::vec2(FOLIAGE_CELL_SIZE));
+                const float expected = desc.density * cell_size.x * cell_size.y;
+                const int n = (int)std::ceil(std::sqrt(expected));
+                if (n == 0) continue;
+                const float keep = expected / (float)(n * n);
+                const glm::vec2 step = cell_size / (float)n;
+
+                std::mt19937 rng(desc.seed * 2654435761u ^ (uint32_t)cx * 73856093u ^ (uint32_t)cz * 19349663u);
+                std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+                std::vector<FoliageInstance>& out = scattered[c];
+                for (int j = 0; j < n; ++j) {
+                    for (int i = 0; i < n; ++i) {
+                        const glm::vec2 p = cell_min + (glm::vec2(i, j) + glm::vec2(unit(rng), unit(rng))) * step;
+                        const float yaw = unit(rng), scale = unit(rng), roll = unit(rng);
+                        float weight = keep;
+                        if (!density_weights.empty()) {
+                            const glm::vec2 uv = (p - desc.area_min) / area;
+                            const int mx = std::clamp((int)(uv.x * map_width), 0, map_width - 1);
+                            const int mz = std::clamp((int)(uv.y * map_height), 0, map_height - 1);
+                            weight *= density_weights[(size_t)mz * map_width + mx];
+                        }
+                        if (desc.rule) weight *= std::clamp(desc.rule(p), 0.0f, 1.0f);
+                        if (roll >= weight) continue;
+
+                        FoliageInstance instance;
+                        instance.position = glm::vec3(p.x, 0.0f, p.y);
+                        instance.yaw = (uint16_t)(yaw * 65535.0f);
+                        const float s = desc.min_scale + (desc.max_scale - desc.min_scale) * scale;
+                        instance.scale = (uint16_t)(std::clamp(s / FOLIAGE_MAX_SCALE, 0.0f, 1.0f) * 65535.0f + 0.5f);
+                        out.push_back(instance);
+                    }
+                }
+            }
+        });
+    }
+
+    // Cell after cell in one buffer, each cell's box over its instances at their scale and lean
+    std::vector<FoliageInstance> instances;
+    const float reach = layer.bounds.w + glm::length(glm::vec2(layer.bounds.x, layer.bounds.z));
+    for (const auto& cell_instances : scattered) {
+        if (cell_instances.empty()) continue;
+        Cell cell;
+        cell.first = (uint32_t)instances.size();
+        cell.count = (uint32_t)cell_instances.size();
+        cell.bmin = glm::vec3(FLT_MAX);
+        cell.bmax = glm::vec3(-FLT_MAX);
+        for (const FoliageInstance& instance : cell_instances) {
+            const float scale = instance.scale / 65535.0f * FOLIAGE_MAX_SCALE;
+            const float side = reach * scale + desc.wind;
+            const glm::vec3 low(-side, (layer.bounds.y - layer.bounds.w) * scale, -side);
+            const glm::vec3 high(side, (layer.bounds.y + layer.bounds.w) * scale, side);
+            cell.bmin = glm::min(cell.bmin, instance.position + low);
+            cell.bmax = glm::max(cell.bmax, instance.position + high);
+        }
+        instances.insert(instances.end(), cell_instances.begin(), cell_instances.end());
+        layer.cells.push_back(cell);
+    }
+    if (instances.empty()) {
+        printf("Foliage: %s scattered nothing\n", desc.name.c_str());
+        return false;
+    }
+    layer.instance_count = instances.size();
+
+    glGenBuffers(1, &layer.instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, layer.instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(FoliageInstance), instances.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    gpu_memory.trackBuffer(layer.instance_vbo, instances.size() * sizeof(FoliageInstance), GPU_MEMORY_INSTANCES, "foliage " + desc.name);
+
+    printf("Foliage: %s, %zu instances in %zu cells, %d mesh tiers%s\n", desc.name.c_str(), instances.size(),
+           layer.cells.size(), layer.mesh_tiers, layer.impostor ? " and impostors" : "");
+    layers.push_back(std::move(layer));
+    return true;
+}
+
+// ============================================================================
+// PER FRAME
+// ============================================================================
+
+void Foliage::update(float dt, const glm::vec3& camera_position) {
+    wind_time += dt;
+    for (Layer& layer : layers) {
+        for (Cell& cell : layer.cells) {
+            const glm::vec3 nearest = glm::clamp(camera_position, cell.bmin, cell.bmax);
+            const float distance = glm::length(camera_position - nearest);
+            cell.tier = -1;
+            for (size_t t = 0; t < layer.tiers.size(); ++t) {
+                if (distance < layer.tiers[t].end_distance) {
+                    cell.tier = (int)t;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void Foliage::cull(const Frustum& frustum, const glm::vec3& camera_position) {
+    gpu_culled = use_foliage && use_gpu_foliage_culling && !layers.empty() && gpuCullingReady();
+    for (Layer& layer : layers) {
+        for (auto& runs : layer.runs) runs.clear();
+        if (!use_foliage) {
+            for (Cell& cell : layer.cells) cell.visible = false;
+            continue;
+        }
+        for (Cell& cell : layer.cells) {
+            cell.visible = cell.tier >= 0 && frustum.aabbInFrustum(cell.bmin, cell.bmax);
+            if (!cell.visible) continue;
+            std::vector<Run>& runs = layer.runs[cell.tier];
+            if (!runs.empty() && runs.back().first + runs.back().count == cell.first) {
+                runs.back().count += cell.count;
+            } else {
+                runs.push_back({ cell.first, cell.count });
+            }
+        }
+        if (gpu_culled) cullGpu(layer, frustum, camera_position);
+    }
+}
+
+bool Foliage::gpuCullingReady() {
+    if (cull_shader) return true;
+    if (cull_shader_failed || !GpuCulling::supported()) return false;
+    try {
+        std::string source = loadShaderFile(buildAssetPath("res/shaders/foliage_cull.comp"), "#version 430 core\n");
+        cull_shader = std::make_unique<Shader>(source);
+    } catch (const std::exception& e) {
+        printf("Foliage: culling shader failed, culling per cell (%s)\n", e.what());
+        cull_shader_failed = true;
+    }
+    return cull_shader != nullptr;
+}
+
+void Foliage::cullGpu(Layer& layer, const Frustum& frustum, const glm::vec3& camera_position) {
+    // Built on first use: every tier gets a region of the visible buffer as large as the layer
+    if (layer.command_buffer == 0) {
+        std::vector<DrawElementsIndirectCommand> commands;
+        for (size_t t = 0; t < layer.tiers.size(); ++t) {
+            Tier& tier = layer.tiers[t];
+            tier.first_command = (uint32_t)commands.size();
+            DrawElementsIndirectCommand command = {};
+            command.baseInstance = (GLuint)(t * layer.instance_count);
+            if (tier.impostor) {
+                command.count = 6;
+                commands.push_back(command);
+                continue;
+            }
+            for (Draw& draw : tier.draws) {
+                command.count = draw.mesh->INDEX_COUNT;
+                command.firstIndex = (GLuint)(draw.mesh->geometry.indices.offset / getIndexSize(draw.mesh->index_type));
+                command.baseVertex = (GLint)draw.mesh->geometry.vertices.offset;
+                draw.command = (uint32_t)commands.size();
+                commands.push_back(command);
+            }
+        }
+        layer.command_bytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+        const size_t visible_bytes = layer.tiers.size() * layer.instance_count * sizeof(FoliageInstance);
+
+        glGenBuffers(1, &layer.command_template);
+        glGenBuffers(1, &layer.command_buffer);
+        glGenBuffers(1, &layer.visible_vbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, layer.command_template);
+        glBufferData(GL_COPY_WRITE_BUFFER, layer.command_bytes, commands.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, layer.command_buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, layer.command_bytes, commands.data(), GL_DYNAMIC_COPY);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, layer.visible_vbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, visible_bytes, nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        gpu_memory.trackBuffer(layer.visible_vbo, visible_bytes, GPU_MEMORY_INSTANCES, "foliage " + layer.name + " (visible)");
+    }
+
+    // Reset the instance counts
+    glBindBuffer(GL_COPY_READ_BUFFER, layer.command_template);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, layer.command_buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, layer.command_bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    float ends[FOLIAGE_MAX_TIERS] = {};
+    GLint firsts[FOLIAGE_MAX_TIERS + 1] = {};
+    const int tier_count = (int)layer.tiers.size();
+    for (int t = 0; t < tier_count; ++t) {
+        ends[t] = layer.tiers[t].end_distance;
+        firsts[t] = (GLint)layer.tiers[t].first_command;
+    }
+    firsts[tier_count] = (GLint)(layer.command_bytes / sizeof(DrawElementsIndirectCommand));
+
+    cull_shader->use();
+    cull_shader->setVec4Array(U_FRUSTUM_PLANES, frustum.planes, 6);
+    cull_shader->setVec3(U_CAMERA_POSITION, camera_position);
+    glUniform1ui(cull_shader->getUniformLocation(U_INSTANCE_COUNT), (GLuint)layer.instance_count);
+    cull_shader->setInt(U_TIER_COUNT, tier_count);
+    cull_shader->setFloatArray(U_TIER_ENDS, ends, FOLIAGE_MAX_TIERS);
+    glUniform1iv(cull_shader->getUniformLocation(U_TIER_COMMANDS), FOLIAGE_MAX_TIERS + 1, firsts);
+    cull_shader->setVec4Array(U_BOUNDS, &layer.bounds, 1);
+
+    GLuint bindings[] = { layer.instance_vbo, layer.command_buffer, layer.visible_vbo };
+    for (GLuint i = 0; i < 3; ++i) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, bindings[i]);
+
+    gl_extensions.DispatchCompute((GLuint)((layer.instance_count + FOLIAGE_CULL_GROUP_SIZE - 1) / FOLIAGE_CULL_GROUP_SIZE), 1, 1);
+    gl_extensions.MemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+// ============================================================================
+// DRAWING
+// ============================================================================
+
+static void setWind(const Shader& shader, float wind, float height, float time) {
+    glm::vec2 direction = foliage_wind_direction;
+    const float length = glm::length(direction);
+    direction = length > 0.0f ? direction / length : glm::vec2(1.0f, 0.0f);
+    const glm::vec4 value(direction, wind * foliage_wind_strength, time);
+    shader.setVec4Array(U_FOLIAGE_WIND, &value, 1);
+    shader.setFloat(U_FOLIAGE_HEIGHT, height);
+}
+
+int Foliage::drawMeshes(const Layer& layer, const Tier& tier, const std::vector<Run>& runs, const ApplyMesh& apply_state, bool indirect) {
+    if (!indirect && runs.empty()) return 0;
+    int calls = 0;
+    for (const Draw& draw : tier.draws) {
+        const Shader& shader = apply_state(*draw.mesh, draw.cull_mode);
+        setWind(shader, layer.wind, layer.height, wind_time);
+        Source& source = sources[draw.source];
+        const Mesh& mesh = *draw.mesh;
+
+        if (indirect) {
+            bindSource(source, layer.visible_vbo, 0);
+            gl_extensions.MultiDrawElementsIndirect(GL_TRIANGLES, mesh.index_type,
+                                                    (const void*)(uintptr_t)(draw.command * sizeof(DrawElementsIndirectCommand)), 1, 0);
+            calls++;
+            continue;
+        }
+        for (const Run& run : runs) {
+            if (gl_extensions.base_instance) {
+                bindSource(source, layer.instance_vbo, 0);
+                gl_extensions.DrawElementsInstancedBaseVertexBaseInstance(
+                    GL_TRIANGLES, mesh.INDEX_COUNT, mesh.index_type, (const void*)(uintptr_t)mesh.geometry.indices.offset,
+                    run.count, (GLint)mesh.geometry.vertices.offset, run.first);
+            } else {
+                bindSource(source, layer.instance_vbo, run.first);
+                drawMeshElements(mesh, run.count);
+            }
+            calls++;
+        }
+    }
+    return calls;
+}
+
+int Foliage::submit(const ApplyMesh& apply_state) {
+    drawn_instances = drawn_triangles = 0;
+    if (!use_foliage) return 0;
+
+    int calls = 0;
+    for (const Layer& layer : layers) {
+        if (gpu_culled) glBindBuffer(GL_DRAW_INDIRECT_BUFFER, layer.command_buffer);
+        for (int t = 0; t < layer.mesh_tiers; ++t) {
+            const Tier& tier = layer.tiers[t];
+            if (!gpu_culled) {
+                int triangles = 0;
+                for (const Draw& draw : tier.draws) triangles += (int)draw.mesh->TRIANGLE_COUNT;
+                for (const Run& run : layer.runs[t]) {
+                    drawn_instances += (int)run.count;
+                    drawn_triangles += triangles * (int)run.count;
+                }
+            }
+            calls += drawMeshes(layer, tier, layer.runs[t], apply_state, gpu_culled);
+        }
+    }
+    if (gpu_culled) glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    gl_state.bindVertexArray(0);
+    return calls;
+}
+
+int Foliage::submitImpostors(const ApplyImpostor& apply_state) {
+    if (!use_foliage) return 0;
+
+    int calls = 0;
+    for (const Layer& layer : layers) {
+        if (layer.mesh_tiers == (int)layer.tiers.size()) continue;
+        const Tier& tier = layer.tiers[layer.mesh_tiers];
+        const std::vector<Run>& runs = layer.runs[layer.mesh_tiers];
+        if (!gpu_culled && runs.empty()) continue;
+        apply_state(*tier.impostor);
+
+        if (gpu_culled) {
+            bindQuad(layer.visible_vbo, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, layer.command_buffer);
+            gl_extensions.MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT,
+                                                    (const void*)(uintptr_t)(tier.first_command * sizeof(DrawElementsIndirectCommand)), 1, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            calls++;
+            continue;
+        }
+        for (const Run& run : runs) {
+            if (gl_extensions.base_instance) {
+                bindQuad(layer.instance_vbo, 0);
+                gl_extensions.DrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, (const void*)0,
+                                                                          run.count, 0, run.first);
+            } else {
+                bindQuad(layer.instance_vbo, run.first);
+                glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, (const void*)0, run.count);
+            }
+            drawn_instances += (int)run.count;
+            drawn_triangles += 2 * (int)run.count;
+            calls++;
+        }
+    }
+    gl_state.bindVertexArray(0);
+    return calls;
+}
+
+int Foliage::submitShadows(const Frustum& frustum, const ApplyMesh& apply_state) {
+    if (!use_foliage) return 0;
+
+    int calls = 0;
+    for (const Layer& layer : layers) {
+        if (!layer.casts_shadows) continue;
+        shadow_runs.resize(std::max<size_t>(shadow_runs.size(), layer.mesh_tiers));
+        for (auto& runs : shadow_runs) runs.clear();
+        for (const Cell& cell : layer.cells) {
+            if (cell.tier < 0 || !frustum.aabbInFrustum(cell.bmin, cell.bmax)) continue;
+            std::vector<Run>& runs = shadow_runs[std::min(cell.tier, layer.mesh_tiers - 1)];
+            if (!runs.empty() && runs.back().first + runs.back().count == cell.first) {
+                runs.back().count += cell.count;
+            } else {
+                runs.push_back({ cell.first, cell.count });
+            }
+        }
+        for (int t = 0; t < layer.mesh_tiers; ++t) calls += drawMeshes(layer, layer.tiers[t], shadow_runs[t], apply_state, false);
+    }
+    gl_state.bindVertexArray(0);
+    return calls;
+}
+
+void Foliage::forEachMesh(const std::function<void(const Mesh&)>& fn) const {
+    for (const Layer& layer : layers) {
+        for (const auto& mesh : layer.meshes) fn(*mesh);
+    }
+}
+
+size_t Foliage::instanceCount() const {
+    size_t count = 0;
+    for (const Layer& layer : layers) count += layer.instance_count;
+    return count;
+}
+
+size_t Foliage::cellCount() const {
+    size_t count = 0;
+    for (const Layer& layer : layers) count += layer.cells.size();
+    return count;
+}
+
+size_t Foliage::visibleCells() const {
+    size_t count = 0;
+    for (const Layer& layer : layers) {
+        for (const Cell& cell : layer.cells) count += cell.visible ? 1 : 0;
+    }
+    return count;
+}
+
+// ============================================================================
+// GRASS
+// ============================================================================
+
+#define GRASS_BLADES 5
+#define GRASS_HEIGHT 0.5f     // Metres at scale 1
+#define GRASS_WIDTH 0.05f     // At the base, the tip narrows to a tenth
+#define GRASS_SPREAD 0.12f    // Radius the blades stand within
+#define GRASS_LEAN 0.15f      // Metres the tips curve out at most
+
+std::shared_ptr<Mesh> createGrassMesh(int segments) {
+    segments = std::max(segments, 1);
+    std::vector<float> vertices;
+    std::vector<uint16_t> indices;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    for (int b = 0; b < GRASS_BLADES; ++b) {
+        const float angle = (b + unit(rng) * 0.5f) * 3.14159265f / GRASS_BLADES;
+        const glm::vec3 across(std::cos(angle), 0.0f, std::sin(angle));
+        const glm::vec3 facing(-across.z, 0.0f, across.x);
+        const float r = GRASS_SPREAD * std::sqrt(unit(rng));
+        const float a = unit(rng) * 6.2831853f;
+        const glm::vec3 root(r * std::cos(a), 0.0f, r * std::sin(a));
+        const float lean = GRASS_LEAN * (0.3f + 0.7f * unit(rng));
+        const float height = GRASS_HEIGHT * (0.7f + 0.3f * unit(rng));
+        // Normals lean up, so both faces light like the ground they stand on
+        const glm::vec3 normal = glm::normalize(facing * 0.4f + glm::vec3(0.0f, 1.0f, 0.0f));
+
+        const uint16_t base = (uint16_t)(vertices.size() / MESH_FLOATS_PER_VERTEX);
+        for (int s = 0; s <= segments; ++s) {
+            const float t = (float)s / segments;
+            const float half = GRASS_WIDTH * 0.5f * (1.0f - 0.9f * t);
+            const glm::vec3 center = root + facing * (lean * t * t) + glm::vec3(0.0f, height * t, 0.0f);
+            const glm::vec3 up = glm::normalize(glm::vec3(0.0f, height, 0.0f) + facing * (2.0f * lean * t));
+            for (int side = 0; side < 2; ++side) {
+                const glm::vec3 p = center + across * (side == 0 ? -half : half);
+                const float v[MESH_FLOATS_PER_VERTEX] = {
+                    p.x, p.y, p.z,
+                    1.0f, 1.0f, 1.0f, 1.0f,
+                    (float)side, t,
+                    normal.x, normal.y, normal.z,
+                    across.x, across.y, across.z,
+                    up.x, up.y, up.z,
+                };
+                vertices.insert(vertices.end(), v, v + MESH_FLOATS_PER_VERTEX);
+            }
+            if (s == segments) continue;
+            const uint16_t i = (uint16_t)(base + s * 2);
+            const uint16_t quad[] = { i, (uint16_t)(i + 1), (uint16_t)(i + 2), (uint16_t)(i + 2), (uint16_t)(i + 1), (uint16_t)(i + 3) };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+
+    auto mesh = std::make_shared<Mesh>();
+    mesh->vertex_layout = getVertexLayout(VERTEX_HAS_COLOR);
+    mesh->index_type = GL_UNSIGNED_SHORT;
+    mesh->INDEX_COUNT = (unsigned int)indices.size();
+    mesh->TRIANGLE_COUNT = (unsigned int)indices.size() / 3;
+    mesh->cull_mode = CULL_NONE;
+    mesh->material = Material("grass");
+    mesh->material.base_color = glm::vec3(0.22f, 0.42f, 0.1f);
+    mesh->material.roughness = 0.85f;
+
+    glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+    for (size_t v = 0; v < vertices.size(); v += MESH_FLOATS_PER_VERTEX) {
+        const glm::vec3 p(vertices[v], vertices[v + 1], vertices[v + 2]);
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+    mesh->bounds_min = bmin;
+    mesh->bounds_max = bmax;
+    mesh->bounds_center = (bmin + bmax) * 0.5f;
+    mesh->bounds_radius = glm::length(bmax - bmin) * 0.5f;
+
+    uploadMeshBuffers(*mesh, vertices.data(), vertices.size() * sizeof(float), indices.data(), indices.size() * sizeof(uint16_t));
+    mesh_pool.create(*mesh);
+    return mesh;
+}
@@ -0,0 +1,57 @@
+#include "frame_arena.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+
+FrameArena frame_arena;
+
+FrameArena::~FrameArena() {
+    for (Block& block : blocks) std::free(block.data);
+}
+
+size_t FrameArena::capacity() const {
+    size_t total = 0;
+    for (const Block& block : blocks) total += block.size;
+    return total;
+}
+
+void FrameArena::addBlock(size_t min_bytes) {
+    Block block;
+    block.size = std::max<size_t>(FRAME_ARENA_BLOCK_BYTES, min_bytes);
+    block.data = static_cast<uint8_t*>(std::malloc(block.size));
+    if (!block.data) throw std::bad_alloc();
+    blocks.push_back(block);
+    offset = 0;
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment) {
+    if (blocks.empty()) addBlock(bytes + alignment);
+
+    // Align the address, not the offset, malloc only guarantees max_align_t
+    uintptr_t base = (uintptr_t)blocks.back().data;
+    size_t aligned = (size_t)(((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+    if (aligned + bytes > blocks.back().size) {
+        addBlock(std::max(bytes + alignment, blocks.back().size * 2));
+        base = (uintptr_t)blocks.back().data;
+        aligned = (size_t)(((base + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+    }
+
+    offset = aligned + bytes;
+    used += bytes;
+    peak = std::max(peak, used);
+    return blocks.back().data + aligned;
+}
+
+void FrameArena::reset() {
+    if (blocks.size() > 1) {
+        // Spilled this frame, next frame gets one block that holds all of it
+        size_t total = capacity();
+        for (Block& block : blocks) std::free(block.data);
+        blocks.clear();
+        addBlock(total);
+        printf("Frame arena grown to %zu KB\n", total / 1024);
+    }
+    offset = 0;
+    used = 0;
+}
@@ -0,0 +1,95 @@
+#include "frame_pacer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+FramePacer frame_pacer;
+
+int max_frames_in_flight = 2;
+float frame_rate_cap = 0.0f;
+
+void FramePacer::retire(int keep) {
+    while (count > 0) {
+        InFlight& frame = frames[oldest];
+        GLenum result = glClientWaitSync(frame.fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            if (count <= keep) return;
+            // Flushed so the wait can't outlast commands that were never sent
+            while (result == GL_TIMEOUT_EXPIRED) result = glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        }
+
+        const float latency = std::chrono::duration<float, std::milli>(Clock::now() - frame.input).count();
+        latency_ms = latency_ms == 0.0f ? latency : latency_ms + (latency - latency_ms) * FRAME_PACER_LATENCY_SMOOTHING;
+        glDeleteSync(frame.fence);
+        frame.fence = nullptr;
+        oldest = (oldest + 1) % FRAME_PACER_MAX_IN_FLIGHT;
+        count--;
+    }
+}
+
+void FramePacer::beginFrame() {
+#ifndef __EMSCRIPTEN__
+    const Clock::time_point start = Clock::now();
+
+    // With n frames allowed in flight, the one about to start may only begin once all but
+    // n - 1 of the earlier ones are done
+    const int limit = std::clamp(max_frames_in_flight, 0, FRAME_PACER_MAX_IN_FLIGHT);
+    retire(limit > 0 ? limit - 1 : FRAME_PACER_MAX_IN_FLIGHT);
+
+    if (frame_rate_cap > 0.0f) {
+        const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frame_rate_cap));
+        Clock::time_point now = Clock::now();
+        // A frame that ran long starts the schedule over instead of rushing the next ones
+        deadline = now > deadline + period ? now : deadline + period;
+        const auto spin = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(FRAME_PACER_SPIN_MS));
+        if (deadline - now > spin) std::this_thread::sleep_for(deadline - now - spin);
+        while (Clock::now() < deadline) std::this_thread::yield();
+    }
+
+    frame_input = last_poll;
+    waited_ms = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+#endif
+}
+
+void FramePacer::endFrame() {
+#ifndef __EMSCRIPTEN__
+    // Out of room only when frames in flight went unlimited, the oldest is then long done
+    if (count == FRAME_PACER_MAX_IN_FLIGHT) retire(FRAME_PACER_MAX_IN_FLIGHT - 1);
+    InFlight& frame = frames[(oldest + count) % FRAME_PACER_MAX_IN_FLIGHT];
+    frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame.input = frame_input;
+    count++;
+#endif
+}
+
+int FramePacer::parseArg(int argc, char** argv, int i) {
+    const std::string arg = argv[i];
+    if (arg == "--frames-in-flight") {
+        if (i + 1 >= argc || atoi(argv[i + 1]) < 1 || atoi(argv[i + 1]) > FRAME_PACER_MAX_IN_FLIGHT) {
+            printf("--frames-in-flight needs a count from 1 to %d\n", FRAME_PACER_MAX_IN_FLIGHT);
+            return -1;
+        }
+        max_frames_in_flight = atoi(argv[i + 1]);
+        return 2;
+    }
+    if (arg == "--fps-cap") {
+        if (i + 1 >= argc || atof(argv[i + 1]) <= 0.0) {
+            printf("--fps-cap needs a frame rate\n");
+            return -1;
+        }
+        frame_rate_cap = (float)atof(argv[i + 1]);
+        return 2;
+    }
+    return 0;
+}
+
+void FramePacer::release() {
+    for (InFlight& frame : frames) {
+        if (frame.fence) glDeleteSync(frame.fence);
+        frame.fence = nullptr;
+    }
+    oldest = count = 0;
+}
@@ -0,0 +1,186 @@
+#include "frame_readback.h"
+#include "job_system.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <thread>
+
+bool use_frame_recording = false;
+std::string frame_recording_dir = "capture";
+
+FrameRecorder frame_recorder;
+
+// ============================================================================
+// FRAME READBACK
+// ============================================================================
+
+FrameReadback::~FrameReadback() {
+    release();
+}
+
+bool FrameReadback::capture(GLuint framebuffer, int width, int height, uint64_t frame, const std::string& name, bool block) {
+    Slot& slot = slots[next_slot];
+    if (slot.fence && !deliver(slot, block)) {
+        dropped++;
+        return false;
+    }
+    if (queued.load() >= FRAME_READBACK_MAX_QUEUED) {
+        if (!block) {
+            dropped++;
+            return false;
+        }
+        while (queued.load() >= FRAME_READBACK_MAX_QUEUED) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    const size_t bytes = (size_t)width * height * 4;
+    if (slot.pbo == 0) glGenBuffers(1, &slot.pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    if (bytes > slot.capacity) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)bytes, nullptr, GL_STREAM_READ);
+        slot.capacity = bytes;
+    }
+
+    GLint read_framebuffer = 0;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint)read_framebuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.width = width;
+    slot.height = height;
+    slot.frame = frame;
+    slot.name = name;
+    next_slot = (next_slot + 1) % FRAME_READBACK_SLOTS;
+    captured++;
+    return true;
+}
+
+void FrameReadback::poll() {
+    // Oldest first, the consumer sees frames in order
+    for (int n = 0; n < FRAME_READBACK_SLOTS; ++n) {
+        Slot& slot = slots[(next_slot + n) % FRAME_READBACK_SLOTS];
+        if (slot.fence && !deliver(slot, false)) break;
+    }
+}
+
+bool FrameReadback::deliver(Slot& slot, bool wait) {
+    GLenum status = glClientWaitSync(slot.fence, 0, 0);
+    if (wait) {
+        while (status == GL_TIMEOUT_EXPIRED) status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    }
+    if (status == GL_TIMEOUT_EXPIRED) return false;
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    auto readback = std::make_shared<ReadbackFrame>();
+    readback->width = slot.width;
+    readback->height = slot.height;
+    readback->frame = slot.frame;
+    readback->name = slot.name;
+    const size_t bytes = (size_t)slot.width * slot.height * 4;
+    readback->pixels.resize(bytes);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+#ifdef __EMSCRIPTEN__
+    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)bytes, readback->pixels.data());
+#else
+    const uint8_t* data = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)bytes, GL_MAP_READ_BIT);
+    if (!data) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        printf("Frame readback: can't map frame %llu\n", (unsigned long long)slot.frame);
+        dropped++;
+        return true;
+    }
+    std::copy(data, data + bytes, readback->pixels.begin());
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+#endif
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (!consume) return true;
+    queued++;
+    job_system.submit([this, readback]() {
+        consume(*readback);
+        delivered++;
+        queued--;
+    });
+    return true;
+}
+
+void FrameReadback::flush() {
+    for (int n = 0; n < FRAME_READBACK_SLOTS; ++n) {
+        Slot& slot = slots[(next_slot + n) % FRAME_READBACK_SLOTS];
+        if (slot.fence) deliver(slot, true);
+    }
+    while (queued.load() > 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+void FrameReadback::release() {
+    for (Slot& slot : slots) {
+        if (slot.fence) glDeleteSync(slot.fence);
+        if (slot.pbo != 0) glDeleteBuffers(1, &slot.pbo);
+        slot = Slot();
+    }
+}
+
+bool writeFramePPM(const std::string& path, const ReadbackFrame& frame) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    fprintf(file, "P6\n%d %d\n255\n", frame.width, frame.height);
+    std::vector<uint8_t> row((size_t)frame.width * 3);
+    bool ok = true;
+    for (int y = frame.height - 1; y >= 0 && ok; --y) {
+        const uint8_t* src = frame.pixels.data() + (size_t)y * frame.width * 4;
+        for (int x = 0; x < frame.width; ++x) {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+        ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+    return fclose(file) == 0 && ok;
+}
+
+// ============================================================================
+// FRAME RECORDER
+// ============================================================================
+
+int FrameRecorder::parseArg(int argc, char** argv, int i) {
+    const std::string arg = argv[i];
+    if (arg != "--record-frames") return 0;
+    if (i + 1 >= argc) {
+        printf("--record-frames needs 1 argument\n");
+        return -1;
+    }
+    frame_recording_dir = argv[i + 1];
+    use_frame_recording = true;
+    return 2;
+}
+
+void FrameRecorder::captureFrame(int width, int height, uint64_t frame) {
+    if (!consumer_set) {
+        readback.setConsumer([](const ReadbackFrame& recorded) {
+            if (!writeFramePPM(recorded.name, recorded)) printf("Frame recorder: can't write %s\n", recorded.name.c_str());
+        });
+        consumer_set = true;
+    }
+    readback.poll();
+    if (!use_frame_recording) return;
+
+    if (created_dir != frame_recording_dir) {
+        std::error_code error;
+        std::filesystem::create_directories(frame_recording_dir, error);
+        created_dir = frame_recording_dir;
+    }
+    char file[32];
+    snprintf(file, sizeof(file), "frame_%06llu.ppm", (unsigned long long)frame);
+    readback.capture(0, width, height, frame, frame_recording_dir + "/" + file);
+}
+
+void FrameRecorder::release() {
+    readback.flush();
+    readback.release();
+}
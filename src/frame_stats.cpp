@@ -0,0 +1,60 @@
+#include "frame_stats.h"
+#include <algorithm>
+#include <cmath>
+
+float frame_hitch_threshold_ms = 33.3f; // Two missed vblanks at 60 Hz
+
+FrameStats frame_stats;
+
+void FrameTimeSeries::push(float ms) {
+    if (ms > frame_hitch_threshold_ms) ++hitches_total;
+    if (samples.size() < FRAME_STATS_HISTORY) {
+        samples.push_back(ms);
+        return;
+    }
+    samples[next] = ms;
+    next = (next + 1) % FRAME_STATS_HISTORY;
+}
+
+float FrameTimeSeries::latest() const {
+    if (samples.empty()) return 0.0f;
+    return samples[(next + samples.size() - 1) % samples.size()];
+}
+
+void FrameTimeSeries::clear() {
+    samples.clear();
+    next = 0;
+    hitches_total = 0;
+}
+
+FrameTimeSeries::Summary FrameTimeSeries::summarize(float hitch_threshold_ms) const {
+    Summary summary;
+    summary.samples = samples.size();
+    if (samples.empty()) return summary;
+
+    std::vector<float> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    // Nearest rank, so p99 of a short window is still a frame that happened
+    auto percentile = [&](float p) {
+        const size_t rank = (size_t)std::ceil(p / 100.0f * sorted.size());
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    };
+    double sum = 0.0;
+    for (float ms : sorted) sum += ms;
+    summary.mean = (float)(sum / sorted.size());
+    summary.p50 = percentile(50.0f);
+    summary.p95 = percentile(95.0f);
+    summary.p99 = percentile(99.0f);
+    summary.max = sorted.back();
+    summary.hitches = sorted.end() - std::upper_bound(sorted.begin(), sorted.end(), hitch_threshold_ms);
+    return summary;
+}
+
+void FrameTimeSeries::histogram(float range_ms, float* bins, int bin_count) const {
+    std::fill(bins, bins + bin_count, 0.0f);
+    if (bin_count <= 0 || range_ms <= 0.0f) return;
+    for (float ms : samples) {
+        const int bin = std::min(bin_count - 1, (int)(ms / range_ms * bin_count));
+        bins[std::max(0, bin)] += 1.0f;
+    }
+}
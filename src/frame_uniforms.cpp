@@ -0,0 +1,64 @@
+#include "frame_uniforms.h"
+#include "shader.h"
+
+#include <cstring>
+#include <cstdio>
+
+FrameUniforms frame_uniforms;
+
+static size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+FrameUniforms::~FrameUniforms() {
+    release();
+}
+
+void FrameUniforms::create() {
+    // Each range has to start on the driver's offset alignment
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment <= 0) alignment = 256;
+
+    light_offset = alignUp(sizeof(CameraBlock), (size_t)alignment);
+    shadow_offset = alignUp(light_offset + sizeof(LightBlock), (size_t)alignment);
+    total_bytes = shadow_offset + sizeof(ShadowBlock);
+    staging.assign(total_bytes, 0);
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)total_bytes, nullptr, GL_DYNAMIC_DRAW);
+
+    // Orphaning keeps the buffer name, so the ranges stay bound for good
+    glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, buffer, 0, sizeof(CameraBlock));
+    glBindBufferRange(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, buffer, (GLintptr)light_offset, sizeof(LightBlock));
+    glBindBufferRange(GL_UNIFORM_BUFFER, SHADOW_BLOCK_BINDING, buffer, (GLintptr)shadow_offset, sizeof(ShadowBlock));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    printf("Frame uniform buffer created (%zu bytes, %d byte range alignment)\n", total_bytes, alignment);
+}
+
+void FrameUniforms::update() {
+    if (buffer == 0) create();
+
+    std::memcpy(staging.data(), &camera, sizeof(CameraBlock));
+    std::memcpy(staging.data() + light_offset, &lights, sizeof(LightBlock));
+    std::memcpy(staging.data() + shadow_offset, &shadow, sizeof(ShadowBlock));
+
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)total_bytes, nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, (GLsizeiptr)total_bytes, staging.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void FrameUniforms::release() {
+    if (buffer != 0) glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    staging.clear();
+}
+
+void bindFrameUniformBlocks(const Shader& shader) {
+    shader.bindUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING);
+    shader.bindUniformBlock("LightBlock", LIGHT_BLOCK_BINDING);
+    shader.bindUniformBlock("ShadowBlock", SHADOW_BLOCK_BINDING);
+}
@@ -0,0 +1,15 @@
+#include "frame_view.h"
+
+FrameView frame_view;
+
+void FrameView::update(const glm::mat4& new_view, const glm::mat4& new_projection, const glm::vec3& new_position) {
+    const glm::mat4 previous = view_projection;
+    view = new_view;
+    projection = new_projection;
+    position = new_position;
+    view_projection = projection * view;
+    inverse_view_projection = glm::inverse(view_projection);
+    previous_view_projection = frame == 0 ? view_projection : previous;
+    frustum.extractFromMatrix(view_projection);
+    frame++;
+}
@@ -0,0 +1,100 @@
+#include "frustum.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define FRUSTUM_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define FRUSTUM_NEON
+#elif defined(__wasm_simd128__)
+    #include <wasm_simd128.h>
+    #define FRUSTUM_WASM_SIMD
+#endif
+
+void Frustum::spheresInFrustum(const glm::vec4* spheres, const uint32_t* indices, size_t count, uint8_t* visible) const {
+    size_t k = 0;
+#if defined(FRUSTUM_SSE2)
+    __m128 px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; ++p) {
+        px[p] = _mm_set1_ps(planes[p].x);
+        py[p] = _mm_set1_ps(planes[p].y);
+        pz[p] = _mm_set1_ps(planes[p].z);
+        pw[p] = _mm_set1_ps(planes[p].w);
+    }
+    for (; k + 4 <= count; k += 4) {
+        __m128 x = _mm_loadu_ps(&spheres[indices[k]].x);
+        __m128 y = _mm_loadu_ps(&spheres[indices[k + 1]].x);
+        __m128 z = _mm_loadu_ps(&spheres[indices[k + 2]].x);
+        __m128 r = _mm_loadu_ps(&spheres[indices[k + 3]].x);
+        _MM_TRANSPOSE4_PS(x, y, z, r);
+        const __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), r);
+        __m128 outside = _mm_setzero_ps();
+        for (int p = 0; p < 6; ++p) {
+            const __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, px[p]), _mm_mul_ps(y, py[p])), _mm_mul_ps(z, pz[p])), pw[p]);
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, neg_r));
+        }
+        const int mask = _mm_movemask_ps(outside);
+        for (int lane = 0; lane < 4; ++lane) visible[k + lane] = ((mask >> lane) & 1) ? 0 : 1;
+    }
+#elif defined(FRUSTUM_NEON)
+    float32x4_t px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; ++p) {
+        px[p] = vdupq_n_f32(planes[p].x);
+        py[p] = vdupq_n_f32(planes[p].y);
+        pz[p] = vdupq_n_f32(planes[p].z);
+        pw[p] = vdupq_n_f32(planes[p].w);
+    }
+    for (; k + 4 <= count; k += 4) {
+        // a0 b0 a2 b2 / a1 b1 a3 b3, then the halves recombined into one register per component
+        const float32x4x2_t ab = vtrnq_f32(vld1q_f32(&spheres[indices[k]].x), vld1q_f32(&spheres[indices[k + 1]].x));
+        const float32x4x2_t cd = vtrnq_f32(vld1q_f32(&spheres[indices[k + 2]].x), vld1q_f32(&spheres[indices[k + 3]].x));
+        const float32x4_t x = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+        const float32x4_t y = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+        const float32x4_t z = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+        const float32x4_t r = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+        const float32x4_t neg_r = vnegq_f32(r);
+        uint32x4_t outside = vdupq_n_u32(0);
+        for (int p = 0; p < 6; ++p) {
+            const float32x4_t d = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(x, px[p]), vmulq_f32(y, py[p])), vmulq_f32(z, pz[p])), pw[p]);
+            outside = vorrq_u32(outside, vcltq_f32(d, neg_r));
+        }
+        uint32_t lanes[4];
+        vst1q_u32(lanes, outside);
+        for (int lane = 0; lane < 4; ++lane) visible[k + lane] = lanes[lane] ? 0 : 1;
+    }
+#elif defined(FRUSTUM_WASM_SIMD)
+    v128_t px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; ++p) {
+        px[p] = wasm_f32x4_splat(planes[p].x);
+        py[p] = wasm_f32x4_splat(planes[p].y);
+        pz[p] = wasm_f32x4_splat(planes[p].z);
+        pw[p] = wasm_f32x4_splat(planes[p].w);
+    }
+    for (; k + 4 <= count; k += 4) {
+        const v128_t a = wasm_v128_load(&spheres[indices[k]].x);
+        const v128_t b = wasm_v128_load(&spheres[indices[k + 1]].x);
+        const v128_t c = wasm_v128_load(&spheres[indices[k + 2]].x);
+        const v128_t e = wasm_v128_load(&spheres[indices[k + 3]].x);
+        const v128_t ab_low = wasm_i32x4_shuffle(a, b, 0, 4, 1, 5);
+        const v128_t ce_low = wasm_i32x4_shuffle(c, e, 0, 4, 1, 5);
+        const v128_t ab_high = wasm_i32x4_shuffle(a, b, 2, 6, 3, 7);
+        const v128_t ce_high = wasm_i32x4_shuffle(c, e, 2, 6, 3, 7);
+        const v128_t x = wasm_i32x4_shuffle(ab_low, ce_low, 0, 1, 4, 5);
+        const v128_t y = wasm_i32x4_shuffle(ab_low, ce_low, 2, 3, 6, 7);
+        const v128_t z = wasm_i32x4_shuffle(ab_high, ce_high, 0, 1, 4, 5);
+        const v128_t neg_r = wasm_f32x4_neg(wasm_i32x4_shuffle(ab_high, ce_high, 2, 3, 6, 7));
+        v128_t outside = wasm_i32x4_splat(0);
+        for (int p = 0; p < 6; ++p) {
+            const v128_t d = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(x, px[p]), wasm_f32x4_mul(y, py[p])),
+                                                           wasm_f32x4_mul(z, pz[p])), pw[p]);
+            outside = wasm_v128_or(outside, wasm_f32x4_lt(d, neg_r));
+        }
+        const int mask = wasm_i32x4_bitmask(outside);
+        for (int lane = 0; lane < 4; ++lane) visible[k + lane] = ((mask >> lane) & 1) ? 0 : 1;
+    }
+#endif
+    for (; k < count; ++k) {
+        const glm::vec4& sphere = spheres[indices[k]];
+        visible[k] = sphereInFrustum(glm::vec3(sphere), sphere.w) ? 1 : 0;
+    }
+}
@@ -0,0 +1,62 @@
+#include "gbuffer.h"
+#include "gl_state.h"
+#include "scene_target.h"
+#include <cstdio>
+
+bool use_deferred_shading = false;
+
+GBuffer::Targets GBuffer::declare(RenderGraph& graph, int width, int height) const {
+    RenderTextureDesc desc;
+    desc.width = width;
+    desc.height = height;
+    const RenderTargetFormats formats = renderTargetFormats();
+    Targets targets;
+    desc.internal_format = formats.gbuffer_albedo;
+    targets.albedo = graph.createTexture("gbuffer albedo", desc);
+    desc.internal_format = formats.gbuffer_normal;
+    targets.normal = graph.createTexture("gbuffer normal", desc);
+    desc.internal_format = formats.gbuffer_material;
+    targets.material = graph.createTexture("gbuffer material", desc);
+    // Same format as the scene target's depth, which glBlitFramebuffer requires
+    desc.internal_format = GL_DEPTH24_STENCIL8;
+    targets.depth = graph.createTexture("gbuffer depth", desc);
+    return targets;
+}
+
+bool GBuffer::begin(RenderGraph::Context& context, const Targets& targets) {
+    if (failed) return false;
+
+    const GLuint fbo = context.framebuffer({ targets.albedo, targets.normal, targets.material }, targets.depth);
+    if (fbo == 0) {
+        printf("G-buffer incomplete, shading forward\n");
+        failed = true;
+        return false;
+    }
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != width || viewport[3] != height) {
+        width = viewport[2];
+        height = viewport[3];
+        printf("G-buffer: %dx%d\n", width, height);
+    }
+
+    // The opaques still draw under GL_EQUAL against the prepass depth
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_target.depthFramebuffer());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    // Only covered pixels get lit, the rest never needs its targets cleared to anything useful
+    gl_state.colorMask(true);
+    const GLfloat clear[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int target = 0; target < 3; ++target) glClearBufferfv(GL_COLOR, target, clear);
+    return true;
+}
+
+void GBuffer::end(RenderGraph::Context& context, const Targets& targets, int first_unit) {
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    gl_state.bindTextureUnit(first_unit, GL_TEXTURE_2D, context.texture(targets.albedo));
+    gl_state.bindTextureUnit(first_unit + 1, GL_TEXTURE_2D, context.texture(targets.normal));
+    gl_state.bindTextureUnit(first_unit + 2, GL_TEXTURE_2D, context.texture(targets.material));
+    gl_state.bindTextureUnit(first_unit + 3, GL_TEXTURE_2D, context.texture(targets.depth));
+}
@@ -0,0 +1,433 @@
+#include "geometry_arena.h"
+#include "mesh.h"
+#include "gl_state.h"
+#include "gpu_memory.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef __EMSCRIPTEN__
+bool use_geometry_arena = false;
+#else
+bool use_geometry_arena = true;
+#endif
+bool use_depth_streams = true;
+bool use_quantized_shadow_positions = true;
+
+#define QUANTIZED_POSITION_SIZE (3 * sizeof(uint16_t))
+
+GeometryArenas geometry_arenas;
+
+// ==== Range allocator ====
+
+bool RangeAllocator::allocate(size_t size, size_t& offset) {
+    if (size == 0) size = 1;
+    for (size_t i = 0; i < free_ranges.size(); ++i) {
+        GeometryRange& range = free_ranges[i];
+        if (range.size < size) continue;
+
+        offset = range.offset;
+        range.offset += size;
+        range.size -= size;
+        if (range.size == 0) free_ranges.erase(free_ranges.begin() + i);
+        used_size += size;
+        return true;
+    }
+    return false;
+}
+
+void RangeAllocator::free(const GeometryRange& range) {
+    size_t size = range.size == 0 ? 1 : range.size;
+    used_size -= std::min(used_size, size);
+    insertFree({range.offset, size});
+}
+
+void RangeAllocator::insertFree(const GeometryRange& range) {
+    auto next = std::lower_bound(free_ranges.begin(), free_ranges.end(), range.offset,
+                                 [](const GeometryRange& r, size_t offset) { return r.offset < offset; });
+    next = free_ranges.insert(next, range);
+
+    // Coalesce with the neighbours
+    auto after = next + 1;
+    if (after != free_ranges.end() && next->offset + next->size == after->offset) {
+        next->size += after->size;
+        free_ranges.erase(after);
+    }
+    if (next != free_ranges.begin()) {
+        auto before = next - 1;
+        if (before->offset + before->size == next->offset) {
+            before->size += next->size;
+            free_ranges.erase(next);
+        }
+    }
+}
+
+void RangeAllocator::grow(size_t new_capacity) {
+    if (new_capacity <= total) return;
+    insertFree({total, new_capacity - total});
+    total = new_capacity;
+}
+
+// ==== Attribute setup ====
+
+void setupVertexAttributes(const VertexLayout& layout) {
+    const GLsizei stride = layout.stride;
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)(0));
+
+    if (layout.format & VERTEX_HAS_COLOR) {
+        glEnableVertexAttribArray(1);
+        if (layout.format & VERTEX_PACKED) {
+            glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)(uintptr_t)layout.color_offset);
+        } else {
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)(uintptr_t)layout.color_offset);
+        }
+    } else {
+        // Colour-less meshes read the constant attribute value instead
+        glDisableVertexAttribArray(1);
+        glVertexAttrib4f(1, 1.0f, 1.0f, 1.0f, 1.0f);
+    }
+
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, (layout.format & VERTEX_HALF_UV) ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, stride,
+                          (void*)(uintptr_t)layout.uv_offset);
+
+    if (layout.format & VERTEX_PACKED) {
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(12));
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(16));
+    } else {
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)(9 * sizeof(float)));
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*)(12 * sizeof(float)));
+        glEnableVertexAttribArray(5);
+        glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, stride, (void*)(15 * sizeof(float)));
+    }
+
+    if (layout.format & VERTEX_LIGHTMAP_UV) {
+        glEnableVertexAttribArray(11);
+        if (layout.format & VERTEX_PACKED) {
+            glVertexAttribPointer(11, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)(uintptr_t)layout.lightmap_uv_offset);
+        } else {
+            glVertexAttribPointer(11, 2, GL_FLOAT, GL_FALSE, stride, (void*)(uintptr_t)layout.lightmap_uv_offset);
+        }
+    } else {
+        glDisableVertexAttribArray(11);
+    }
+
+    // Integer bone indices, normalized weights
+    if (layout.format & VERTEX_SKINNED) {
+        glEnableVertexAttribArray(13);
+        glVertexAttribIPointer(13, 4, GL_UNSIGNED_BYTE, stride, (void*)(uintptr_t)layout.skin_offset);
+        glEnableVertexAttribArray(14);
+        glVertexAttribPointer(14, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)(uintptr_t)(layout.skin_offset + 4));
+    } else {
+        glDisableVertexAttribArray(13);
+        glDisableVertexAttribArray(14);
+    }
+}
+
+uint32_t depthUVSize(const VertexLayout& layout) {
+    return (layout.format & VERTEX_HALF_UV) ? 2 * sizeof(uint16_t) : 2 * sizeof(float);
+}
+
+void setupDepthAttributes(const VertexLayout& layout, GLuint position_vbo, size_t position_offset, GLuint uv_vbo,
+                          size_t uv_offset) {
+    glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)position_offset);
+
+    glBindBuffer(GL_ARRAY_BUFFER, uv_vbo);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, (layout.format & VERTEX_HALF_UV) ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE,
+                          depthUVSize(layout), (void*)uv_offset);
+}
+
+void setupShadowAttributes(const VertexLayout& layout, GLuint position_vbo, size_t position_offset, GLuint uv_vbo,
+                           size_t uv_offset) {
+    glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, QUANTIZED_POSITION_SIZE, (void*)position_offset);
+
+    glBindBuffer(GL_ARRAY_BUFFER, uv_vbo);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, (layout.format & VERTEX_HALF_UV) ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE,
+                          depthUVSize(layout), (void*)uv_offset);
+}
+
+bool quantizePositions(const std::vector<glm::vec3>& positions, std::vector<uint16_t>& out, PositionQuantization& quantization) {
+    quantization = PositionQuantization();
+    out.clear();
+    glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+    for (const glm::vec3& p : positions) {
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+    const glm::vec3 extent = bmax - bmin;
+    const float widest = std::max(extent.x, std::max(extent.y, extent.z));
+    if (positions.empty() || widest <= 0.0f || widest / 65535.0f > SHADOW_POSITION_MAX_STEP) return false;
+
+    // A flat axis has zero scale and quantizes to 0
+    const glm::vec3 to_unorm(extent.x > 0.0f ? 65535.0f / extent.x : 0.0f, extent.y > 0.0f ? 65535.0f / extent.y : 0.0f,
+                             extent.z > 0.0f ? 65535.0f / extent.z : 0.0f);
+    out.resize(positions.size() * 3);
+    for (size_t i = 0; i < positions.size(); ++i) {
+        const glm::vec3 unorm = glm::clamp((positions[i] - bmin) * to_unorm, 0.0f, 65535.0f);
+        for (int axis = 0; axis < 3; ++axis) out[i * 3 + axis] = (uint16_t)std::lround(unorm[axis]);
+    }
+    quantization.offset = bmin;
+    quantization.scale = extent;
+    return true;
+}
+
+void extractDepthStreams(const VertexLayout& layout, const void* vertices, size_t count, std::vector<glm::vec3>& positions,
+                         std::vector<unsigned char>& uvs) {
+    // Both layouts lead with the float position
+    const unsigned char* src = static_cast<const unsigned char*>(vertices);
+    const uint32_t uv_size = depthUVSize(layout);
+    positions.resize(count);
+    uvs.resize(count * uv_size);
+    for (size_t i = 0; i < count; ++i, src += layout.stride) {
+        memcpy(&positions[i], src, sizeof(glm::vec3));
+        memcpy(uvs.data() + i * uv_size, src + layout.uv_offset, uv_size);
+    }
+}
+
+InstanceTransform packInstanceTransform(const glm::mat4& model) {
+    InstanceTransform packed;
+    for (int row = 0; row < 3; ++row) packed.rows[row] = glm::vec4(model[0][row], model[1][row], model[2][row], model[3][row]);
+
+    glm::vec3 scale(0.0f);
+    for (int i = 0; i < 3; ++i) {
+        const float length2 = glm::dot(glm::vec3(model[i]), glm::vec3(model[i]));
+        scale[i] = length2 > 0.0f ? 1.0f / length2 : 0.0f;
+    }
+    const float largest = std::max(scale.x, std::max(scale.y, scale.z));
+    if (largest > 0.0f) scale = glm::max(scale / largest, glm::vec3(6.103515625e-5f)); // Smallest normal half
+    for (int i = 0; i < 3; ++i) packed.normal_scale[i] = glm::packHalf1x16(scale[i]);
+    packed.normal_scale[3] = 0;
+    return packed;
+}
+
+void createInstanceBuffers(GLuint& instance_vbo, GLuint& fade_vbo, size_t max_instances) {
+    glGenBuffers(1, &instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, max_instances * sizeof(InstanceTransform), nullptr, GL_DYNAMIC_DRAW);
+    gpu_memory.trackBuffer(instance_vbo, max_instances * sizeof(InstanceTransform), GPU_MEMORY_INSTANCES, "instance attributes");
+
+    // Fade zero means fully drawn
+    std::vector<float> noFade(max_instances, 0.0f);
+    glGenBuffers(1, &fade_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, fade_vbo);
+    glBufferData(GL_ARRAY_BUFFER, max_instances * sizeof(float), noFade.data(), GL_DYNAMIC_DRAW);
+    gpu_memory.trackBuffer(fade_vbo, max_instances * sizeof(float), GPU_MEMORY_INSTANCES, "instance attributes");
+
+    pointInstanceAttributes(instance_vbo, fade_vbo, 0);
+}
+
+void pointInstanceAttributes(GLuint instance_vbo, GLuint fade_vbo, size_t first_instance) {
+    pointInstanceBytes(instance_vbo, first_instance * sizeof(InstanceTransform), fade_vbo, first_instance * sizeof(float));
+}
+
+void pointInstanceBytes(GLuint matrix_vbo, size_t matrix_offset, GLuint fade_vbo, size_t fade_offset) {
+    // Slots 6-8: the model matrix's rows, slot 9: its normal scales
+    const GLsizei stride = sizeof(InstanceTransform);
+
+    glBindBuffer(GL_ARRAY_BUFFER, matrix_vbo);
+    for (int i = 0; i < 3; i++) {
+        unsigned int loc = 6 + i;
+        glEnableVertexAttribArray(loc);
+        glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, stride, (void*)(matrix_offset + offsetof(InstanceTransform, rows) + i * sizeof(glm::vec4)));
+        glVertexAttribDivisor(loc, 1);
+    }
+    glEnableVertexAttribArray(9);
+    glVertexAttribPointer(9, 4, GL_HALF_FLOAT, GL_FALSE, stride, (void*)(matrix_offset + offsetof(InstanceTransform, normal_scale)));
+    glVertexAttribDivisor(9, 1);
+
+    // Slot 10: LOD cross-fade
+    glBindBuffer(GL_ARRAY_BUFFER, fade_vbo);
+    glEnableVertexAttribArray(10);
+    glVertexAttribPointer(10, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)fade_offset);
+    glVertexAttribDivisor(10, 1);
+}
+
+// ==== Arena ====
+
+// Copies the used prefix of a buffer into a larger one, returns the new buffer
+static GLuint resizeBuffer(GLuint old_buffer, size_t old_bytes, size_t new_bytes, const std::string& asset) {
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, new_bytes, nullptr, GL_STATIC_DRAW);
+    gpu_memory.trackBuffer(buffer, new_bytes, GPU_MEMORY_GEOMETRY, asset);
+    if (old_buffer != 0 && old_bytes > 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, old_buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_bytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if (old_buffer != 0) {
+        gpu_memory.releaseBuffer(old_buffer);
+        glDeleteBuffers(1, &old_buffer);
+    }
+    return buffer;
+}
+
+GeometryArena::GeometryArena(uint32_t vertex_format) : format(vertex_format) {
+    stride = getVertexLayout(format).stride;
+
+    glGenVertexArrays(1, &vao);
+    gl_state.bindVertexArray(vao);
+    createInstanceBuffers(instance_vbo, fade_vbo, 1);
+    if (use_depth_streams) {
+        depth_uv_size = depthUVSize(getVertexLayout(format));
+        glGenVertexArrays(1, &depth_vao);
+        gl_state.bindVertexArray(depth_vao);
+        pointInstanceAttributes(instance_vbo, fade_vbo, 0);
+        if (use_quantized_shadow_positions) {
+            glGenVertexArrays(1, &shadow_vao);
+            gl_state.bindVertexArray(shadow_vao);
+            pointInstanceAttributes(instance_vbo, fade_vbo, 0);
+        }
+    }
+    gl_state.bindVertexArray(0);
+
+    growVertices(GEOMETRY_ARENA_INITIAL_VERTICES);
+    growIndices(GEOMETRY_ARENA_INITIAL_INDEX_BYTES);
+}
+
+GeometryArena::~GeometryArena() {
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+    if (depth_vao != 0) glDeleteVertexArrays(1, &depth_vao);
+    if (shadow_vao != 0) glDeleteVertexArrays(1, &shadow_vao);
+    for (GLuint buffer : { vbo, ebo, instance_vbo, fade_vbo, position_vbo, depth_uv_vbo, quantized_position_vbo }) {
+        if (buffer == 0) continue;
+        gpu_memory.releaseBuffer(buffer);
+        glDeleteBuffers(1, &buffer);
+    }
+}
+
+void GeometryArena::growVertices(size_t min_vertices) {
+    size_t old_capacity = vertex_ranges.capacity();
+    size_t capacity = std::max(old_capacity * 2, min_vertices);
+    vbo = resizeBuffer(vbo, old_capacity * stride, capacity * stride, "arena " + std::to_string(format) + " vertices");
+    vertex_ranges.grow(capacity);
+
+    // Re-point the attributes at the new buffer
+    gl_state.bindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    setupVertexAttributes(getVertexLayout(format));
+
+    if (depth_vao != 0) {
+        const std::string asset = "arena " + std::to_string(format) + " depth streams";
+        position_vbo = resizeBuffer(position_vbo, old_capacity * sizeof(glm::vec3), capacity * sizeof(glm::vec3), asset);
+        depth_uv_vbo = resizeBuffer(depth_uv_vbo, old_capacity * depth_uv_size, capacity * depth_uv_size, asset);
+        gl_state.bindVertexArray(depth_vao);
+        setupDepthAttributes(getVertexLayout(format), position_vbo, 0, depth_uv_vbo, 0);
+    }
+    if (shadow_vao != 0) {
+        quantized_position_vbo = resizeBuffer(quantized_position_vbo, old_capacity * QUANTIZED_POSITION_SIZE,
+                                              capacity * QUANTIZED_POSITION_SIZE, "arena " + std::to_string(format) + " shadow positions");
+        gl_state.bindVertexArray(shadow_vao);
+        setupShadowAttributes(getVertexLayout(format), quantized_position_vbo, 0, depth_uv_vbo, 0);
+    }
+    gl_state.bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GeometryArena::growIndices(size_t min_bytes) {
+    size_t old_capacity = index_ranges.capacity();
+    size_t capacity = std::max(old_capacity * 2, (min_bytes + 3) & ~size_t(3));
+    ebo = resizeBuffer(ebo, old_capacity, capacity, "arena " + std::to_string(format) + " indices");
+    index_ranges.grow(capacity);
+
+    for (GLuint array : { vao, depth_vao, shadow_vao }) {
+        if (array == 0) continue;
+        gl_state.bindVertexArray(array);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    }
+    gl_state.bindVertexArray(0);
+}
+
+bool GeometryArena::allocate(const void* vertices, size_t vertex_bytes, const void* indices, size_t index_bytes,
+                             GeometryAllocation& allocation, PositionQuantization& quantization) {
+    quantization = PositionQuantization();
+    if (vertex_bytes % stride != 0) {
+        printf("Geometry arena: %zu vertex bytes isn't a multiple of the %u byte stride\n", vertex_bytes, stride);
+        return false;
+    }
+
+    size_t vertex_count = vertex_bytes / stride;
+    size_t index_size = (index_bytes + 3) & ~size_t(3); // Keeps every range 4-byte aligned
+
+    size_t vertex_offset = 0, index_offset = 0;
+    if (!vertex_ranges.allocate(vertex_count, vertex_offset)) {
+        growVertices(vertex_ranges.capacity() + vertex_count);
+        if (!vertex_ranges.allocate(vertex_count, vertex_offset)) return false;
+    }
+    if (!index_ranges.allocate(index_size, index_offset)) {
+        growIndices(index_ranges.capacity() + index_size);
+        if (!index_ranges.allocate(index_size, index_offset)) {
+            vertex_ranges.free({vertex_offset, vertex_count});
+            return false;
+        }
+    }
+
+    allocation.vertices = {vertex_offset, vertex_count};
+    allocation.indices = {index_offset, index_size};
+
+    // Copy targets, so the upload doesn't disturb whichever VAO is bound
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, vertex_offset * stride, vertex_bytes, vertices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, index_offset, index_bytes, indices);
+    if (depth_vao != 0) {
+        std::vector<glm::vec3> positions;
+        std::vector<unsigned char> uvs;
+        extractDepthStreams(getVertexLayout(format), vertices, vertex_count, positions, uvs);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, position_vbo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, vertex_offset * sizeof(glm::vec3), positions.size() * sizeof(glm::vec3), positions.data());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, depth_uv_vbo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, vertex_offset * depth_uv_size, uvs.size(), uvs.data());
+
+        std::vector<uint16_t> quantized;
+        if (shadow_vao != 0 && quantizePositions(positions, quantized, quantization)) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, quantized_position_vbo);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, vertex_offset * QUANTIZED_POSITION_SIZE, quantized.size() * sizeof(uint16_t),
+                            quantized.data());
+        }
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    allocations++;
+    return true;
+}
+
+void GeometryArena::free(const GeometryAllocation& allocation) {
+    vertex_ranges.free(allocation.vertices);
+    index_ranges.free(allocation.indices);
+    if (allocations > 0) allocations--;
+}
+
+// ==== Arenas ====
+
+std::shared_ptr<GeometryArena> GeometryArenas::get(uint32_t vertex_format) {
+    auto& arena = arenas[vertex_format];
+    if (!arena) arena = std::make_shared<GeometryArena>(vertex_format);
+    return arena;
+}
+
+void GeometryArenas::printStats() const {
+    for (const auto& [format, arena] : arenas) {
+        printf("Geometry arena 0x%x: %zu meshes, %zu/%zu vertices, %.1f/%.1f KB indices\n", format,
+               arena->allocations, arena->vertex_ranges.used(), arena->vertex_ranges.capacity(),
+               arena->index_ranges.used() / 1024.0f, arena->index_ranges.capacity() / 1024.0f);
+    }
+}
@@ -0,0 +1,60 @@
+#include "gl_backend.h"
+#include "gl_extensions.h"
+
+GLuint createBuffer(GLenum target, size_t bytes, const void* data, bool dynamic) {
+    GLuint buffer = 0;
+    if (gl_extensions.direct_state_access) {
+        gl_extensions.CreateBuffers(1, &buffer);
+        gl_extensions.NamedBufferStorage(buffer, (GLsizeiptr)bytes, data, dynamic ? GL_DYNAMIC_STORAGE_BIT : 0);
+        return buffer;
+    }
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+    glBufferData(target, (GLsizeiptr)bytes, data, dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    return buffer;
+}
+
+GLuint createTexture2D(GLsizei levels, GLenum internal_format, GLsizei width, GLsizei height) {
+    GLuint texture = 0;
+    if (gl_extensions.direct_state_access) {
+        gl_extensions.CreateTextures(GL_TEXTURE_2D, 1, &texture);
+        gl_extensions.TextureStorage2D(texture, levels, internal_format, width, height);
+        return texture;
+    }
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (gl_extensions.texture_storage) gl_extensions.TexStorage2D(GL_TEXTURE_2D, levels, internal_format, width, height);
+    return texture;
+}
+
+void uploadTexture2D(GLuint texture, GLint level, GLenum internal_format, GLsizei width, GLsizei height, GLenum format, GLenum type,
+                     const void* pixels) {
+    if (gl_extensions.direct_state_access) {
+        gl_extensions.TextureSubImage2D(texture, level, 0, 0, width, height, format, type, pixels);
+    } else if (gl_extensions.texture_storage) {
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, format, type, pixels);
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, level, internal_format, width, height, 0, format, type, pixels);
+    }
+}
+
+void uploadCompressedTexture2D(GLuint texture, GLint level, GLenum internal_format, GLsizei width, GLsizei height, GLsizei bytes,
+                               const void* data) {
+    if (gl_extensions.direct_state_access) {
+        gl_extensions.CompressedTextureSubImage2D(texture, level, 0, 0, width, height, internal_format, bytes, data);
+    } else if (gl_extensions.texture_storage) {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, internal_format, bytes, data);
+    } else {
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, width, height, 0, bytes, data);
+    }
+}
+
+void setTextureParameter(GLuint texture, GLenum target, GLenum name, GLint value) {
+    if (gl_extensions.direct_state_access) gl_extensions.TextureParameteri(texture, name, value);
+    else glTexParameteri(target, name, value);
+}
+
+void generateTextureMipmap(GLuint texture, GLenum target) {
+    if (gl_extensions.direct_state_access) gl_extensions.GenerateTextureMipmap(texture);
+    else glGenerateMipmap(target);
+}
@@ -0,0 +1,86 @@
+#include "gl_deletion_queue.h"
+#include "gpu_memory.h"
+
+GLDeletionQueue gl_deletion_queue;
+
+void GLDeletionQueue::deleteBuffer(GLuint buffer) {
+    if (buffer == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.buffers.push_back(buffer);
+}
+
+void GLDeletionQueue::deleteVertexArray(GLuint vertex_array) {
+    if (vertex_array == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.vertex_arrays.push_back(vertex_array);
+}
+
+void GLDeletionQueue::deleteTexture(GLuint texture) {
+    if (texture == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.textures.push_back(texture);
+}
+
+void GLDeletionQueue::defer(std::function<void()> release) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.releases.push_back(std::move(release));
+}
+
+void GLDeletionQueue::destroy(Batch& batch) {
+    // Releases may drop the last reference to more GL objects, those queue for a later frame
+    for (auto& release : batch.releases) release();
+    for (GLuint buffer : batch.buffers) gpu_memory.releaseBuffer(buffer);
+    for (GLuint texture : batch.textures) gpu_memory.releaseTexture(texture);
+    if (!batch.buffers.empty()) glDeleteBuffers((GLsizei)batch.buffers.size(), batch.buffers.data());
+    if (!batch.vertex_arrays.empty()) glDeleteVertexArrays((GLsizei)batch.vertex_arrays.size(), batch.vertex_arrays.data());
+    if (!batch.textures.empty()) glDeleteTextures((GLsizei)batch.textures.size(), batch.textures.data());
+    if (batch.fence) glDeleteSync(batch.fence);
+    batch = Batch();
+}
+
+void GLDeletionQueue::endFrame() {
+    // Taken out under the lock and destroyed outside it, releases may queue more
+    std::vector<Batch> signalled;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!in_flight.empty()) {
+            // Fences signal in order, the first one still pending holds back the rest
+            const GLenum status = glClientWaitSync(in_flight.front().fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED && status != GL_WAIT_FAILED) break;
+            signalled.push_back(std::move(in_flight.front()));
+            in_flight.pop_front();
+        }
+        if (!pending.empty()) {
+            pending.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            in_flight.push_back(std::move(pending));
+            pending = Batch();
+        }
+    }
+    for (Batch& batch : signalled) destroy(batch);
+}
+
+void GLDeletionQueue::release() {
+    // glDelete* leaves the objects to the driver until the GPU is done with them. Releases may
+    // queue more, so this goes until nothing is left.
+    for (;;) {
+        std::vector<Batch> batches;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Batch& batch : in_flight) batches.push_back(std::move(batch));
+            in_flight.clear();
+            if (!pending.empty()) batches.push_back(std::move(pending));
+            pending = Batch();
+        }
+        if (batches.empty()) return;
+        for (Batch& batch : batches) destroy(batch);
+    }
+}
+
+size_t GLDeletionQueue::pendingCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = pending.buffers.size() + pending.vertex_arrays.size() + pending.textures.size() + pending.releases.size();
+    for (const Batch& batch : in_flight) {
+        count += batch.buffers.size() + batch.vertex_arrays.size() + batch.textures.size() + batch.releases.size();
+    }
+    return count;
+}
@@ -0,0 +1,132 @@
+#include "gl_extensions.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/html5_webgl.h>
+#include <webgl/webgl2_ext.h>
+#endif
+
+GLExtensions gl_extensions;
+
+bool hasGLExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const char* ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (ext && strcmp(ext, name) == 0) return true;
+    }
+    return false;
+}
+
+void loadGLExtensions(GLADloadproc load) {
+    GLExtensions& ext = gl_extensions;
+    glGetIntegerv(GL_MAJOR_VERSION, &ext.major);
+    glGetIntegerv(GL_MINOR_VERSION, &ext.minor);
+
+#ifdef __EMSCRIPTEN__
+    // WebGL2 is ES 3.0, which has everything below in core
+    bool es3 = true;
+#else
+    bool es3 = false;
+#endif
+    auto atLeast = [&](int major, int minor) {
+        return !es3 && (ext.major > major || (ext.major == major && ext.minor >= minor));
+    };
+
+    if (es3 || atLeast(4, 2) || hasGLExtension("GL_ARB_texture_storage")) {
+        ext.TexStorage2D = (PFN_glTexStorage2D)load("glTexStorage2D");
+        ext.texture_storage = ext.TexStorage2D != nullptr;
+    }
+
+    if (atLeast(4, 2) || hasGLExtension("GL_ARB_base_instance")) {
+        ext.DrawElementsInstancedBaseVertexBaseInstance =
+            (PFN_glDrawElementsInstancedBaseVertexBaseInstance)load("glDrawElementsInstancedBaseVertexBaseInstance");
+        ext.base_instance = ext.DrawElementsInstancedBaseVertexBaseInstance != nullptr;
+    }
+#ifdef __EMSCRIPTEN__
+    // The same call as ARB_base_instance where the browser has the draft extension, which has to be
+    // enabled before use. Multi-draw indirect stays off, WebGL2 has no indirect buffers.
+    if (hasGLExtension("GL_WEBGL_draw_instanced_base_vertex_base_instance") &&
+        emscripten_webgl_enable_WEBGL_draw_instanced_base_vertex_base_instance(emscripten_webgl_get_current_context())) {
+        ext.DrawElementsInstancedBaseVertexBaseInstance = glDrawElementsInstancedBaseVertexBaseInstanceWEBGL;
+        ext.base_instance = true;
+    }
+#endif
+
+    // Indirect commands carry a base instance, which is only honoured with base_instance
+    if (ext.base_instance && (atLeast(4, 3) || hasGLExtension("GL_ARB_multi_draw_indirect"))) {
+        ext.MultiDrawElementsIndirect = (PFN_glMultiDrawElementsIndirect)load("glMultiDrawElementsIndirect");
+        ext.MultiDrawArraysIndirect = (PFN_glMultiDrawArraysIndirect)load("glMultiDrawArraysIndirect");
+        ext.multi_draw_indirect = ext.MultiDrawElementsIndirect != nullptr && ext.MultiDrawArraysIndirect != nullptr;
+    }
+    ext.shader_draw_parameters = atLeast(4, 6) || (!es3 && hasGLExtension("GL_ARB_shader_draw_parameters"));
+
+    if (atLeast(4, 3)) {
+        ext.DispatchCompute = (PFN_glDispatchCompute)load("glDispatchCompute");
+        ext.MemoryBarrier = (PFN_glMemoryBarrier)load("glMemoryBarrier");
+        ext.compute_shader = ext.DispatchCompute != nullptr && ext.MemoryBarrier != nullptr;
+    }
+
+    if (atLeast(4, 4) || (!es3 && hasGLExtension("GL_ARB_buffer_storage"))) {
+        ext.BufferStorage = (PFN_glBufferStorage)load("glBufferStorage");
+        ext.buffer_storage = ext.BufferStorage != nullptr;
+    }
+
+    // Only a status query that doesn't wait, drivers compile in the background until something asks
+    ext.parallel_shader_compile = hasGLExtension("GL_KHR_parallel_shader_compile") || hasGLExtension("KHR_parallel_shader_compile") ||
+                                  (!es3 && hasGLExtension("GL_ARB_parallel_shader_compile"));
+
+    // Drivers may support the calls and still offer no binary format to save in
+    if (atLeast(4, 1) || (!es3 && hasGLExtension("GL_ARB_get_program_binary"))) {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        ext.GetProgramBinary = (PFN_glGetProgramBinary)load("glGetProgramBinary");
+        ext.ProgramBinary = (PFN_glProgramBinary)load("glProgramBinary");
+        ext.ProgramParameteri = (PFN_glProgramParameteri)load("glProgramParameteri");
+        ext.program_binary = formats > 0 && ext.GetProgramBinary && ext.ProgramBinary && ext.ProgramParameteri;
+    }
+
+    ext.layered_rendering = atLeast(3, 2);
+    ext.geometry_shader_invocations = atLeast(4, 0);
+
+    // Some drivers expose the queries with a zero-bit counter
+    if (!es3 || hasGLExtension("GL_EXT_disjoint_timer_query_webgl2") || hasGLExtension("EXT_disjoint_timer_query_webgl2")) {
+        GLint bits = 0;
+        glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits);
+        ext.timer_query = bits > 0;
+    }
+    if (!es3 && ext.timer_query) {
+        GLint bits = 0;
+        glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+        ext.timestamp_query = bits > 0;
+    }
+
+    ext.pipeline_statistics = atLeast(4, 6) || (!es3 && hasGLExtension("GL_ARB_pipeline_statistics_query"));
+
+    if (atLeast(4, 5) || (!es3 && hasGLExtension("GL_ARB_direct_state_access"))) {
+        ext.CreateBuffers = (PFN_glCreateBuffers)load("glCreateBuffers");
+        ext.NamedBufferStorage = (PFN_glNamedBufferStorage)load("glNamedBufferStorage");
+        ext.CreateTextures = (PFN_glCreateTextures)load("glCreateTextures");
+        ext.TextureStorage2D = (PFN_glTextureStorage2D)load("glTextureStorage2D");
+        ext.TextureSubImage2D = (PFN_glTextureSubImage2D)load("glTextureSubImage2D");
+        ext.CompressedTextureSubImage2D = (PFN_glCompressedTextureSubImage2D)load("glCompressedTextureSubImage2D");
+        ext.TextureParameteri = (PFN_glTextureParameteri)load("glTextureParameteri");
+        ext.GenerateTextureMipmap = (PFN_glGenerateTextureMipmap)load("glGenerateTextureMipmap");
+        ext.BindTextureUnit = (PFN_glBindTextureUnit)load("glBindTextureUnit");
+        ext.direct_state_access = ext.CreateBuffers && ext.NamedBufferStorage && ext.CreateTextures && ext.TextureStorage2D &&
+                                  ext.TextureSubImage2D && ext.CompressedTextureSubImage2D && ext.TextureParameteri &&
+                                  ext.GenerateTextureMipmap && ext.BindTextureUnit;
+    }
+
+    printf("GL extensions: texture storage %s, base instance %s, multi-draw indirect %s, compute %s, draw parameters %s, "
+           "buffer storage %s, layered rendering %s, geometry shader invocations %s, timer queries %s, timestamps %s, parallel shader compile %s, program binaries %s, "
+           "pipeline statistics %s, direct state access %s\n",
+           ext.texture_storage ? "yes" : "no", ext.base_instance ? "yes" : "no", ext.multi_draw_indirect ? "yes" : "no",
+           ext.compute_shader ? "yes" : "no", ext.shader_draw_parameters ? "yes" : "no", ext.buffer_storage ? "yes" : "no",
+           ext.layered_rendering ? "yes" : "no", ext.geometry_shader_invocations ? "yes" : "no",
+           ext.timer_query ? "yes" : "no", ext.timestamp_query ? "yes" : "no",
+           ext.parallel_shader_compile ? "yes" : "no", ext.program_binary ? "yes" : "no",
+           ext.pipeline_statistics ? "yes" : "no", ext.direct_state_access ? "yes" : "no");
+}
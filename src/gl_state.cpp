@@ -0,0 +1,188 @@
+#include "gl_state.h"
+#include "mesh.h" // CullMode
+#include "gl_extensions.h"
+
+GLState gl_state;
+
+void GLState::invalidate() {
+    program = UNKNOWN;
+    vao = UNKNOWN;
+    active_unit = UNKNOWN;
+    for (int unit = 0; unit < GL_STATE_TEXTURE_UNITS; ++unit) {
+        textures_2d[unit] = UNKNOWN;
+        textures_cube[unit] = UNKNOWN;
+        textures_2d_array[unit] = UNKNOWN;
+    }
+    for (int8_t& state : enabled) state = -1;
+    cull_face = UNKNOWN;
+    depth_func = UNKNOWN;
+    depth_mask = -1;
+    blend_source = blend_destination = UNKNOWN;
+    blend_source_alpha = blend_destination_alpha = UNKNOWN;
+    color_mask = -1;
+}
+
+void GLState::useProgram(GLuint new_program) {
+    if (program == new_program) {
+        counters.skipped++;
+        return;
+    }
+    glUseProgram(new_program);
+    program = new_program;
+    counters.changes++;
+}
+
+void GLState::bindVertexArray(GLuint new_vao) {
+    if (vao == new_vao) {
+        counters.skipped++;
+        return;
+    }
+    glBindVertexArray(new_vao);
+    vao = new_vao;
+    counters.changes++;
+}
+
+void GLState::bindTexture(unsigned int unit, GLenum target, GLuint texture) {
+    if (active_unit != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_unit = unit;
+        counters.changes++;
+    }
+
+    GLuint* bound = boundTexture(unit, target);
+    if (bound && *bound == texture) {
+        counters.skipped++;
+        return;
+    }
+    glBindTexture(target, texture);
+    if (bound) *bound = texture;
+    counters.changes++;
+}
+
+void GLState::bindTextureUnit(unsigned int unit, GLenum target, GLuint texture) {
+    // Unbinding by name would clear every target of the unit, not just this one
+    if (!gl_extensions.direct_state_access || texture == 0) {
+        bindTexture(unit, target, texture);
+        return;
+    }
+    GLuint* bound = boundTexture(unit, target);
+    if (bound && *bound == texture) {
+        counters.skipped++;
+        return;
+    }
+    gl_extensions.BindTextureUnit(unit, texture);
+    if (bound) *bound = texture;
+    counters.changes++;
+}
+
+GLuint* GLState::boundTexture(unsigned int unit, GLenum target) {
+    if (unit >= GL_STATE_TEXTURE_UNITS) return nullptr;
+    if (target == GL_TEXTURE_2D) return &textures_2d[unit];
+    if (target == GL_TEXTURE_CUBE_MAP) return &textures_cube[unit];
+    if (target == GL_TEXTURE_2D_ARRAY) return &textures_2d_array[unit];
+    return nullptr;
+}
+
+GLState::Capability GLState::capabilityIndex(GLenum capability) {
+    switch (capability) {
+        case GL_CULL_FACE: return CAP_CULL_FACE;
+        case GL_DEPTH_TEST: return CAP_DEPTH_TEST;
+        case GL_BLEND: return CAP_BLEND;
+        default: return CAP_UNTRACKED;
+    }
+}
+
+void GLState::setEnabled(GLenum capability, bool enable) {
+    Capability index = capabilityIndex(capability);
+    if (index != CAP_UNTRACKED && enabled[index] == (int8_t)enable) {
+        counters.skipped++;
+        return;
+    }
+    if (enable) glEnable(capability);
+    else glDisable(capability);
+    if (index != CAP_UNTRACKED) enabled[index] = (int8_t)enable;
+    counters.changes++;
+}
+
+bool GLState::isEnabled(GLenum capability) {
+    Capability index = capabilityIndex(capability);
+    if (index == CAP_UNTRACKED) return glIsEnabled(capability) == GL_TRUE;
+    if (enabled[index] < 0) enabled[index] = glIsEnabled(capability) == GL_TRUE ? 1 : 0;
+    return enabled[index] == 1;
+}
+
+void GLState::setCullMode(int cull_mode) {
+    if (cull_mode == CULL_NONE) {
+        disable(GL_CULL_FACE);
+        return;
+    }
+    enable(GL_CULL_FACE);
+    cullFace(cull_mode == CULL_FRONT ? GL_FRONT : GL_BACK);
+}
+
+void GLState::cullFace(GLenum face) {
+    if (cull_face == face) {
+        counters.skipped++;
+        return;
+    }
+    glCullFace(face);
+    cull_face = face;
+    counters.changes++;
+}
+
+void GLState::depthFunc(GLenum func) {
+    if (depth_func == func) {
+        counters.skipped++;
+        return;
+    }
+    glDepthFunc(func);
+    depth_func = func;
+    counters.changes++;
+}
+
+void GLState::depthMask(bool write) {
+    if (depth_mask == (int8_t)write) {
+        counters.skipped++;
+        return;
+    }
+    glDepthMask(write ? GL_TRUE : GL_FALSE);
+    depth_mask = (int8_t)write;
+    counters.changes++;
+}
+
+void GLState::blendFuncSeparate(GLenum source_rgb, GLenum destination_rgb, GLenum source_alpha, GLenum destination_alpha) {
+    if (blend_source == source_rgb && blend_destination == destination_rgb &&
+        blend_source_alpha == source_alpha && blend_destination_alpha == destination_alpha) {
+        counters.skipped++;
+        return;
+    }
+    glBlendFuncSeparate(source_rgb, destination_rgb, source_alpha, destination_alpha);
+    blend_source = source_rgb;
+    blend_destination = destination_rgb;
+    blend_source_alpha = source_alpha;
+    blend_destination_alpha = destination_alpha;
+    counters.changes++;
+}
+
+void GLState::colorMask(bool write) {
+    if (color_mask == (int8_t)write) {
+        counters.skipped++;
+        return;
+    }
+    GLboolean value = write ? GL_TRUE : GL_FALSE;
+    glColorMask(value, value, value, value);
+    color_mask = (int8_t)write;
+    counters.changes++;
+}
+
+void GLState::apply(const PipelineState& state) {
+    if (state.program != 0) useProgram(state.program);
+    if (state.vertex_array != 0) bindVertexArray(state.vertex_array);
+    setEnabled(GL_DEPTH_TEST, state.depth_test);
+    depthFunc(state.depth_func);
+    depthMask(state.depth_write);
+    colorMask(state.color_write);
+    setEnabled(GL_BLEND, state.blend);
+    if (state.blend) blendFuncSeparate(state.blend_source, state.blend_destination, state.blend_source_alpha, state.blend_destination_alpha);
+    if (state.cull_mode != PIPELINE_CULL_PER_DRAW) setCullMode(state.cull_mode);
+}
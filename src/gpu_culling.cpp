@@ -0,0 +1,260 @@
+#include "gpu_culling.h"
+#include "gl_extensions.h"
+#include "geometry_arena.h"
+#include "draw_list.h"
+#include "entity_manager.h"
+#include "frustum.h"
+#include "hiz.h"
+#include "mesh.h"
+#include "shader_loading.h"
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdio>
+
+std::string buildAssetPath(const std::string& relative_path);
+
+bool use_gpu_culling = false;
+
+bool GpuCulling::supported() {
+    return gl_extensions.compute_shader && gl_extensions.multi_draw_indirect;
+}
+
+GpuCulling::GpuCulling() {
+    std::string source = loadShaderFile(buildAssetPath("res/shaders/gpu_cull.comp"), "#version 430 core\n");
+    cull_shader = std::make_unique<Shader>(source);
+    cull_shader->use();
+    cull_shader->setInt("hizPyramid", 0);
+}
+
+GpuCulling::~GpuCulling() {
+    for (GLuint buffer : { entity_buffer, level_buffer, level_slot_buffer, command_template_buffer, command_buffer,
+                           instance_buffer, fade_buffer, lod_state_buffer, capacity_buffer }) {
+        if (buffer != 0) glDeleteBuffers(1, &buffer);
+    }
+}
+
+void GpuCulling::uploadBuffer(GLuint& buffer, const void* data, size_t bytes) {
+    if (buffer == 0) glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    // Never empty, binding a zero-sized range is an error
+    glBufferData(GL_COPY_WRITE_BUFFER, std::max<size_t>(bytes, 16), data, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GpuCulling::rebuild(EntityManager& entity_manager, EntitySpan<uint32_t> members) {
+    entities.clear();
+    slots.clear();
+
+    std::vector<GpuLODLevel> levels;
+    std::vector<uint32_t> level_slots;
+    std::vector<uint32_t> capacities;
+    std::unordered_map<Mesh*, uint32_t> slot_of;
+
+    // LOD materials are per-mesh copies, merge the ones that bind identically
+    std::vector<const Material*> materials;
+    auto canonicalMaterial = [&](const Material* material) {
+        for (const Material* bound : materials) {
+            if (bound->bindsLike(*material)) return bound;
+        }
+        materials.push_back(material);
+        return material;
+    };
+
+    entity_data.clear();
+    for (uint32_t i : members) {
+        Entity* entity = entity_manager.getEntityAt(i);
+        if (!entity) continue;
+
+        GpuEntity record = {};
+        record.lod_first = (uint32_t)levels.size();
+
+        std::unordered_set<uint32_t> entity_slots;
+        for (size_t l = 0; l < entity->lodLevels().size(); ++l) {
+            const Entity::LODLevel& level = entity->lodLevels()[l];
+            if (level.meshes.empty()) continue; // Impostor tier, the previous level stays
+            if ((int)l <= entity->shadow_proxy_lod) record.shadow_lod_min = (uint32_t)levels.size() - record.lod_first;
+
+            GpuLODLevel gpu_level = {};
+            gpu_level.min_screen_size = entity->lodMinScreenSize(l);
+            gpu_level.slot_first = (uint32_t)level_slots.size();
+            for (const auto& mesh : level.meshes) {
+                if (!mesh || !mesh->isValid() || mesh->material.alphaMode == BLEND) continue;
+
+                auto [it, inserted] = slot_of.emplace(mesh.get(), (uint32_t)slots.size());
+                if (inserted) {
+                    slots.push_back({mesh.get(), canonicalMaterial(&mesh->material)});
+                    capacities.push_back(0);
+                }
+                level_slots.push_back(it->second);
+                if (entity_slots.insert(it->second).second) capacities[it->second]++;
+            }
+            gpu_level.slot_count = (uint32_t)level_slots.size() - gpu_level.slot_first;
+            levels.push_back(gpu_level);
+        }
+        record.lod_count = (uint32_t)levels.size() - record.lod_first;
+
+        entities.push_back(entity);
+        entity_data.push_back(record);
+    }
+
+    // Sort the draws so runs sharing state and VAO become single multi-draws
+    std::vector<uint32_t> order(slots.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto key = [&](uint32_t i) {
+        const Slot& slot = slots[i];
+        return std::make_tuple(slot.material, slot.mesh->cull_mode, slot.mesh->VAO, slot.mesh->index_type);
+    };
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return key(a) < key(b); });
+
+    std::vector<uint32_t> remap(slots.size());
+    std::vector<Slot> sorted_slots(slots.size());
+    std::vector<uint32_t> sorted_capacities(slots.size());
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        remap[order[i]] = i;
+        sorted_slots[i] = slots[order[i]];
+        sorted_capacities[i] = capacities[order[i]];
+    }
+    slots.swap(sorted_slots);
+    capacities.swap(sorted_capacities);
+    for (uint32_t& slot : level_slots) slot = remap[slot];
+
+    // Every slot owns a range of the instance buffer big enough for all entities that use it
+    std::vector<DrawElementsIndirectCommand> commands(slots.size());
+    instance_capacity = 0;
+    for (size_t i = 0; i < slots.size(); ++i) {
+        const Mesh* mesh = slots[i].mesh;
+        commands[i].count = mesh->INDEX_COUNT;
+        commands[i].instanceCount = 0;
+        commands[i].firstIndex = (GLuint)(mesh->geometry.indices.offset / getIndexSize(mesh->index_type));
+        commands[i].baseVertex = (GLint)mesh->geometry.vertices.offset;
+        commands[i].baseInstance = (GLuint)instance_capacity;
+        instance_capacity += capacities[i];
+    }
+
+    command_bytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+    uploadBuffer(level_buffer, levels.data(), levels.size() * sizeof(GpuLODLevel));
+    uploadBuffer(level_slot_buffer, level_slots.data(), level_slots.size() * sizeof(uint32_t));
+    uploadBuffer(capacity_buffer, capacities.data(), capacities.size() * sizeof(uint32_t));
+    uploadBuffer(command_template_buffer, commands.data(), command_bytes);
+    uploadBuffer(command_buffer, commands.data(), command_bytes);
+    uploadBuffer(instance_buffer, nullptr, instance_capacity * sizeof(InstanceTransform));
+    std::vector<float> no_fade(instance_capacity, 0.0f);
+    uploadBuffer(fade_buffer, no_fade.data(), no_fade.size() * sizeof(float));
+    std::vector<uint32_t> lod_state(entities.size(), 0);
+    uploadBuffer(lod_state_buffer, lod_state.data(), lod_state.size() * sizeof(uint32_t));
+    uploadBuffer(entity_buffer, nullptr, entity_data.size() * sizeof(GpuEntity));
+
+    source_layout_version = entity_manager.layoutVersion();
+    tables_valid = true;
+    printf("GPU culling: %zu entities, %zu draws, %zu instance slots\n", entities.size(), slots.size(), instance_capacity);
+}
+
+void GpuCulling::update(EntityManager& entity_manager, EntitySpan<uint32_t> members) {
+    if (!tables_valid || entity_manager.layoutVersion() != source_layout_version) rebuild(entity_manager, members);
+    if (entities.empty()) return;
+
+    EntitySpan<glm::mat4> matrices = entity_manager.worldMatrices();
+    EntitySpan<glm::vec4> spheres = entity_manager.worldSpheres();
+    EntitySpan<uint8_t> flags = entity_manager.entityFlags();
+    for (size_t i = 0; i < entities.size(); ++i) {
+        size_t index = entity_manager.indexOf(entities[i]);
+        GpuEntity& record = entity_data[i];
+        record.model = matrices[index];
+        record.sphere = spheres[index];
+        if (!(flags[index] & ENTITY_FLAG_ACTIVE)) record.sphere.w = -1.0f;
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, entity_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, entity_data.size() * sizeof(GpuEntity), entity_data.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GpuCulling::cull(const glm::mat4& view_projection, const glm::vec3& camera_position, float projection_scale,
+                      float hysteresis, bool update_lod, const HiZBuffer* occlusion, float min_screen_size) {
+    if (entities.empty() || slots.empty()) return;
+
+    // Reset the instance counts
+    glBindBuffer(GL_COPY_READ_BUFFER, command_template_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, command_buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, command_bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    Frustum frustum;
+    frustum.extractFromMatrix(view_projection);
+
+    cull_shader->use();
+    cull_shader->setVec4Array("frustumPlanes", frustum.planes, 6);
+    cull_shader->setVec3("cameraPosition", camera_position);
+    cull_shader->setFloat("projectionScale", projection_scale);
+    cull_shader->setFloat("hysteresis", hysteresis);
+    cull_shader->setFloat("minScreenSize", min_screen_size);
+    cull_shader->setInt("updateLOD", update_lod ? 1 : 0);
+    glUniform1ui(cull_shader->getUniformLocation("entityCount"), (GLuint)entities.size());
+
+    bool occlusion_ready = occlusion && occlusion->gpuReady();
+    cull_shader->setInt("useOcclusion", occlusion_ready ? 1 : 0);
+    if (occlusion_ready) {
+        gl_state.bindTexture(0, GL_TEXTURE_2D, occlusion->getTexture());
+        cull_shader->setInt("hizLevels", occlusion->getLevels());
+        cull_shader->setMat4("hizViewProjection", occlusion->getViewProjection());
+    }
+
+    GLuint bindings[] = { entity_buffer, level_buffer, level_slot_buffer, command_buffer,
+                          instance_buffer, lod_state_buffer, capacity_buffer };
+    for (GLuint i = 0; i < 7; ++i) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, bindings[i]);
+
+    gl_extensions.DispatchCompute((GLuint)((entities.size() + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE), 1, 1);
+    gl_extensions.MemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+int GpuCulling::submit(const std::function<void(const Slot&)>& apply_state) {
+    if (slots.empty()) return 0;
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+
+    int calls = 0;
+    GLuint bound_vao = 0;
+    std::vector<const Mesh*> repointed; // One mesh per VAO whose instance attributes now read instance_buffer
+    for (size_t first = 0; first < slots.size();) {
+        const Slot& head = slots[first];
+        const Mesh* mesh = head.mesh;
+        if (first == 0 || head.material != slots[first - 1].material || mesh->cull_mode != slots[first - 1].mesh->cull_mode) {
+            apply_state(head);
+        }
+
+        size_t end = first + 1;
+        while (end < slots.size() && slots[end].material == head.material && slots[end].mesh->cull_mode == mesh->cull_mode &&
+               slots[end].mesh->VAO == mesh->VAO && slots[end].mesh->index_type == mesh->index_type) {
+            end++;
+        }
+
+        if (mesh->VAO != bound_vao) {
+            gl_state.bindVertexArray(mesh->VAO);
+            bound_vao = mesh->VAO;
+            bool seen = std::any_of(repointed.begin(), repointed.end(), [&](const Mesh* m) { return m->VAO == mesh->VAO; });
+            if (!seen) {
+                pointInstanceAttributes(instance_buffer, fade_buffer, 0);
+                repointed.push_back(mesh);
+            }
+        }
+
+        gl_extensions.MultiDrawElementsIndirect(GL_TRIANGLES, mesh->index_type,
+                                                (const void*)(first * sizeof(DrawElementsIndirectCommand)),
+                                                (GLsizei)(end - first), 0);
+        calls++;
+        first = end;
+    }
+
+    // Hand the VAOs back to the CPU batch paths
+    for (const Mesh* mesh : repointed) {
+        gl_state.bindVertexArray(mesh->VAO);
+        pointInstanceAttributes(mesh->instanceVBO, mesh->instanceFadeVBO, 0);
+    }
+    gl_state.bindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return calls;
+}
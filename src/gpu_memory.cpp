@@ -0,0 +1,104 @@
+#include "gpu_memory.h"
+#include <algorithm>
+#include <cstdio>
+
+const char* const GPU_MEMORY_CATEGORY_NAMES[GPU_MEMORY_CATEGORY_COUNT] = {
+    "Geometry", "Instances", "Textures", "Shadows", "Skybox", "Streaming", "Particles", "Render targets",
+};
+
+uint64_t gpu_memory_budget = 0;
+
+GpuMemoryTracker gpu_memory;
+
+// Bytes per texel as stored, unsized formats as drivers typically store them
+static uint64_t texelBytes(GLenum internal_format) {
+    switch (internal_format) {
+        case GL_RED: case GL_R8:
+            return 1;
+        case GL_RG: case GL_RG8: case GL_R16F: case GL_DEPTH_COMPONENT16:
+            return 2;
+        case GL_RGB: case GL_RGB8: case GL_SRGB8: case GL_RGBA: case GL_RGBA8: case GL_SRGB8_ALPHA8:
+        case GL_RG16F: case GL_R32F: case GL_R11F_G11F_B10F: case GL_RGB10_A2:
+        case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F: case GL_DEPTH24_STENCIL8:
+            return 4;
+        case GL_RGBA16F: case GL_RG32F:
+            return 8;
+        case GL_RGBA32F:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+uint64_t textureLevelBytes(GLenum internal_format, int width, int height, int depth) {
+    return texelBytes(internal_format) * (uint64_t)std::max(1, width) * std::max(1, height) * std::max(1, depth);
+}
+
+uint64_t textureMipChainBytes(GLenum internal_format, int width, int height, int depth) {
+    uint64_t bytes = 0;
+    for (int level = 0;; ++level) {
+        const int w = std::max(1, width >> level), h = std::max(1, height >> level);
+        bytes += textureLevelBytes(internal_format, w, h, depth);
+        if (w == 1 && h == 1) return bytes;
+    }
+}
+
+void GpuMemoryTracker::track(uint64_t key, uint64_t bytes, GpuMemoryCategory category, const std::string& asset) {
+    release(key);
+    allocations[key] = { category, asset, bytes };
+    category_bytes[category] += bytes;
+    total_bytes += bytes;
+    peak_bytes = std::max(peak_bytes, total_bytes);
+
+    if (!overBudget()) return;
+    if (!warned) {
+        printf("GPU memory: %.1f MB allocated, over the %.1f MB budget (%s, %.1f MB for %s)\n",
+               total_bytes / (1024.0 * 1024.0), gpu_memory_budget / (1024.0 * 1024.0),
+               GPU_MEMORY_CATEGORY_NAMES[category], bytes / (1024.0 * 1024.0), asset.empty() ? "unnamed" : asset.c_str());
+    }
+    warned = true;
+}
+
+void GpuMemoryTracker::tag(uint64_t key, const std::string& asset) {
+    auto it = allocations.find(key);
+    if (it != allocations.end()) it->second.asset = asset;
+}
+
+void GpuMemoryTracker::release(uint64_t key) {
+    auto it = allocations.find(key);
+    if (it == allocations.end()) return;
+    category_bytes[it->second.category] -= it->second.bytes;
+    total_bytes -= it->second.bytes;
+    allocations.erase(it);
+    if (!overBudget()) warned = false;
+}
+
+void GpuMemoryTracker::trackBuffer(GLuint buffer, uint64_t bytes, GpuMemoryCategory category, const std::string& asset) {
+    if (buffer != 0) track(buffer, bytes, category, asset);
+}
+
+void GpuMemoryTracker::trackTexture(GLuint texture, uint64_t bytes, GpuMemoryCategory category, const std::string& asset) {
+    if (texture != 0) track(textureKey(texture), bytes, category, asset);
+}
+
+void GpuMemoryTracker::tagBuffer(GLuint buffer, const std::string& asset) { tag(buffer, asset); }
+void GpuMemoryTracker::tagTexture(GLuint texture, const std::string& asset) { tag(textureKey(texture), asset); }
+void GpuMemoryTracker::resizeTexture(GLuint texture, uint64_t bytes) {
+    auto it = allocations.find(textureKey(texture));
+    if (it == allocations.end()) return;
+    const Allocation allocation = it->second;
+    track(textureKey(texture), bytes, allocation.category, allocation.asset);
+}
+
+void GpuMemoryTracker::releaseBuffer(GLuint buffer) { release(buffer); }
+void GpuMemoryTracker::releaseTexture(GLuint texture) { release(textureKey(texture)); }
+
+std::vector<std::pair<std::string, uint64_t>> GpuMemoryTracker::assets(GpuMemoryCategory category) const {
+    std::unordered_map<std::string, uint64_t> by_asset;
+    for (const auto& [key, allocation] : allocations) {
+        if (allocation.category == category) by_asset[allocation.asset.empty() ? "(unnamed)" : allocation.asset] += allocation.bytes;
+    }
+    std::vector<std::pair<std::string, uint64_t>> sorted(by_asset.begin(), by_asset.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+    return sorted;
+}
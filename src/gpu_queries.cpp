@@ -0,0 +1,149 @@
+#include "gpu_queries.h"
+#include "gl_extensions.h"
+#include <algorithm>
+
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+GpuQueryPool gpu_queries;
+
+GpuQueryPool::~GpuQueryPool() {
+    release();
+}
+
+void GpuQueryPool::release() {
+    for (Slot& slot : slots) {
+        if (!slot.elapsed.empty()) glDeleteQueries((GLsizei)slot.elapsed.size(), slot.elapsed.data());
+        if (!slot.timestamps.empty()) glDeleteQueries((GLsizei)slot.timestamps.size(), slot.timestamps.data());
+        slot = Slot();
+    }
+    current = -1;
+    elapsed_open = false;
+    collected_frames.clear();
+    latest_frame = Frame();
+}
+
+// Grows in steps, the query objects are kept for the next frames in this slot
+static GLuint queryAt(std::vector<GLuint>& queries, size_t index) {
+    if (index >= queries.size()) {
+        const size_t old_size = queries.size();
+        queries.resize(std::max(index + 1, old_size * 2));
+        glGenQueries((GLsizei)(queries.size() - old_size), queries.data() + old_size);
+    }
+    return queries[index];
+}
+
+bool GpuQueryPool::finished(const Slot& slot) const {
+    // Results come back in submission order, the last of each kind stands for the rest
+    GLint available = 1;
+    if (slot.elapsed_used > 0) glGetQueryObjectiv(slot.elapsed[slot.elapsed_used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available && slot.timestamps_used > 0) {
+        glGetQueryObjectiv(slot.timestamps[slot.timestamps_used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    }
+    return available != 0;
+}
+
+void GpuQueryPool::collect(Slot& slot, bool valid) {
+    Frame& result = slot.result;
+    result.id = slot.frame;
+    result.valid = valid;
+    result.elapsed_ms.clear();
+    result.timestamps.clear();
+    if (valid) {
+        // Available, so none of these wait
+        for (size_t i = 0; i < slot.elapsed_used; ++i) {
+#ifdef __EMSCRIPTEN__
+            // WebGL2 has no 64-bit query results, 32 bits of nanoseconds last four seconds
+            GLuint ns = 0;
+            glGetQueryObjectuiv(slot.elapsed[i], GL_QUERY_RESULT, &ns);
+#else
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(slot.elapsed[i], GL_QUERY_RESULT, &ns);
+#endif
+            result.elapsed_ms.push_back(ns / 1000000.0);
+        }
+#ifndef __EMSCRIPTEN__
+        for (size_t i = 0; i < slot.timestamps_used; ++i) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(slot.timestamps[i], GL_QUERY_RESULT, &ns);
+            result.timestamps.push_back(ns);
+        }
+#endif
+        latest_frame = result;
+    }
+    slot.waiting = false;
+    collected_frames.push_back(&result);
+}
+
+void GpuQueryPool::beginFrame() {
+    collected_frames.clear();
+    current = -1;
+    elapsed_open = false;
+    current_frame = next_frame++;
+    if (!gl_extensions.timer_query) return;
+
+    // Reading the flag clears it, and whatever was in flight when it was raised is meaningless
+    bool disjoint = false;
+#ifdef __EMSCRIPTEN__
+    GLint disjoint_flag = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint_flag);
+    disjoint = disjoint_flag != 0;
+#endif
+
+    // Oldest first, the first slot is the one this frame reuses and can't wait any longer. The
+    // rest stop at the first still busy, so frames are reported in order.
+    for (int age = 0; age < GPU_QUERY_FRAMES; ++age) {
+        Slot& slot = slots[(current_frame + age) % GPU_QUERY_FRAMES];
+        if (!slot.waiting) continue;
+        if (disjoint) {
+            collect(slot, false);
+        } else if (finished(slot)) {
+            collect(slot, true);
+        } else if (age == 0) {
+            collect(slot, false);
+        } else {
+            break;
+        }
+    }
+
+    current = (int)(current_frame % GPU_QUERY_FRAMES);
+    Slot& slot = slots[current];
+    slot.frame = current_frame;
+    slot.elapsed_used = 0;
+    slot.timestamps_used = 0;
+}
+
+void GpuQueryPool::endFrame() {
+    if (current < 0) return;
+    endElapsed();
+    slots[current].waiting = true;
+    current = -1;
+}
+
+int GpuQueryPool::beginElapsed() {
+    if (current < 0 || elapsed_open) return -1;
+    Slot& slot = slots[current];
+    const size_t index = slot.elapsed_used++;
+    glBeginQuery(GL_TIME_ELAPSED, queryAt(slot.elapsed, index));
+    elapsed_open = true;
+    return (int)index;
+}
+
+void GpuQueryPool::endElapsed() {
+    if (!elapsed_open) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    elapsed_open = false;
+}
+
+int GpuQueryPool::timestamp() {
+    if (current < 0 || !gl_extensions.timestamp_query) return -1;
+#ifndef __EMSCRIPTEN__
+    Slot& slot = slots[current];
+    const size_t index = slot.timestamps_used++;
+    glQueryCounter(queryAt(slot.timestamps, index), GL_TIMESTAMP);
+    return (int)index;
+#else
+    return -1;
+#endif
+}
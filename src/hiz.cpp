@@ -0,0 +1,248 @@
+#include "hiz.h"
+#include "shader_loading.h"
+#include "scene_target.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+
+std::string buildAssetPath(const std::string& relative_path);
+
+#ifdef __EMSCRIPTEN__
+bool use_occlusion_culling = false;
+#else
+bool use_occlusion_culling = true;
+#endif
+
+HiZBuffer::~HiZBuffer() {
+    release();
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+}
+
+void HiZBuffer::release() {
+    if (pyramid_fbo != 0) { glDeleteFramebuffers(1, &pyramid_fbo); pyramid_fbo = 0; }
+    if (pyramid != 0) { glDeleteTextures(1, &pyramid); pyramid = 0; }
+    for (Readback& readback : readbacks) {
+        if (readback.pbo != 0) { glDeleteBuffers(1, &readback.pbo); readback.pbo = 0; }
+        readback.pending = false;
+    }
+    cpu_levels.clear();
+    cpu_sizes.clear();
+    built = false;
+}
+
+bool HiZBuffer::init(int new_width, int new_height) {
+    release();
+    width = new_width;
+    height = new_height;
+
+    if (!downsample_shader) {
+        try {
+            downsample_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/hiz.vs")),
+                                                         loadShaderFile(buildAssetPath("res/shaders/hiz_downsample.fs")));
+        } catch (const std::exception& e) {
+            printf("Hi-Z disabled: %s\n", e.what());
+            return false;
+        }
+        downsample_shader->use();
+        downsample_shader->setInt("source", 0);
+        glGenVertexArrays(1, &vao);
+    }
+
+    level_count = 1 + (int)std::floor(std::log2((float)std::max(width, height)));
+    glGenTextures(1, &pyramid);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, pyramid);
+    for (int level = 0; level < level_count; ++level) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, std::max(width >> level, 1), std::max(height >> level, 1), 0,
+                     GL_RED, GL_FLOAT, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &pyramid_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, pyramid_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid, 0);
+
+    readback_level = 0;
+    while (readback_level + 1 < level_count && std::max(width >> readback_level, 1) > HIZ_READBACK_WIDTH) readback_level++;
+    readback_width = std::max(width >> readback_level, 1);
+    readback_height = std::max(height >> readback_level, 1);
+#ifndef __EMSCRIPTEN__
+    for (Readback& readback : readbacks) {
+        glGenBuffers(1, &readback.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, readback_width * readback_height * sizeof(float), nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+#endif
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Hi-Z pyramid framebuffer incomplete (0x%x)\n", status);
+        release();
+        return false;
+    }
+
+    printf("Hi-Z pyramid: %dx%d, %d levels, CPU readback %dx%d\n", width, height, level_count, readback_width, readback_height);
+    return true;
+}
+
+void HiZBuffer::build(const glm::mat4& view_projection) {
+    if (failed) return;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != width || viewport[3] != height || pyramid == 0) {
+        if (!init(viewport[2], viewport[3])) {
+            failed = true;
+            return;
+        }
+    }
+
+    // The prepass depth, sampled where the scene target keeps it
+    const GLuint depth_texture = scene_target.depthTexture();
+
+    bool depth_test = gl_state.isEnabled(GL_DEPTH_TEST);
+    bool cull_face = gl_state.isEnabled(GL_CULL_FACE);
+    gl_state.disable(GL_DEPTH_TEST);
+    gl_state.disable(GL_CULL_FACE);
+    gl_state.colorMask(true);
+
+    downsample_shader->use();
+    gl_state.bindVertexArray(vao);
+    glBindFramebuffer(GL_FRAMEBUFFER, pyramid_fbo);
+
+    for (int level = 0; level < level_count; ++level) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid, level);
+        glViewport(0, 0, std::max(width >> level, 1), std::max(height >> level, 1));
+
+        if (level == 0) {
+            gl_state.bindTexture(0, GL_TEXTURE_2D, depth_texture);
+            downsample_shader->setInt("reduce", 0);
+        } else {
+            // Only the previous level is in the sampled range, so reading it isn't a feedback loop
+            gl_state.bindTexture(0, GL_TEXTURE_2D, pyramid);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+            downsample_shader->setInt("reduce", 1);
+        }
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    gl_state.bindTexture(0, GL_TEXTURE_2D, pyramid);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+
+    readBack(view_projection);
+
+    gl_state.bindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    gl_state.setEnabled(GL_DEPTH_TEST, depth_test);
+    gl_state.setEnabled(GL_CULL_FACE, cull_face);
+
+    built = true;
+    built_view_projection = view_projection;
+}
+
+void HiZBuffer::readBack(const glm::mat4& view_projection) {
+#ifndef __EMSCRIPTEN__
+    // Queue this frame's level, the copy lands while the GPU finishes the frame
+    Readback& queued = readbacks[readback_index];
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid, readback_level);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, queued.pbo);
+    glReadPixels(0, 0, readback_width, readback_height, GL_RED, GL_FLOAT, nullptr);
+    queued.view_projection = view_projection;
+    queued.pending = true;
+    readback_index ^= 1;
+
+    // Map last frame's, which should be complete by now
+    Readback& ready = readbacks[readback_index];
+    if (ready.pending) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, ready.pbo);
+        size_t bytes = readback_width * readback_height * sizeof(float);
+        const float* data = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (data) {
+            cpu_levels.resize(1);
+            cpu_sizes.assign(1, glm::ivec2(readback_width, readback_height));
+            cpu_levels[0].assign(data, data + readback_width * readback_height);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+            // Finish the pyramid on the CPU, same reduction as hiz_downsample.fs
+            while (cpu_sizes.back().x > 1 || cpu_sizes.back().y > 1) {
+                glm::ivec2 src_size = cpu_sizes.back();
+                glm::ivec2 size = glm::max(src_size / 2, glm::ivec2(1));
+                std::vector<float> level(size.x * size.y, 0.0f);
+                const std::vector<float>& src = cpu_levels.back();
+                for (int y = 0; y < size.y; ++y) {
+                    int y1 = std::min(y * 2 + 1 + ((y == size.y - 1) ? (src_size.y & 1) : 0), src_size.y - 1);
+                    for (int x = 0; x < size.x; ++x) {
+                        int x1 = std::min(x * 2 + 1 + ((x == size.x - 1) ? (src_size.x & 1) : 0), src_size.x - 1);
+                        float depth = 0.0f;
+                        for (int sy = y * 2; sy <= y1; ++sy) {
+                            for (int sx = x * 2; sx <= x1; ++sx) depth = std::max(depth, src[sy * src_size.x + sx]);
+                        }
+                        level[y * size.x + x] = depth;
+                    }
+                }
+                cpu_levels.push_back(std::move(level));
+                cpu_sizes.push_back(size);
+            }
+            cpu_view_projection = ready.view_projection;
+        }
+        ready.pending = false;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+#else
+    (void)view_projection;
+#endif
+}
+
+bool HiZBuffer::isOccluded(const glm::vec3& center, float radius) const {
+    if (cpu_levels.empty()) return false;
+
+    // Screen rectangle and nearest depth of the sphere's bounding box in the readback's view
+    glm::vec2 rect_min(1.0f), rect_max(-1.0f);
+    float nearest = 1.0f;
+    for (int i = 0; i < 8; ++i) {
+        glm::vec3 corner = center + radius * glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+        glm::vec4 clip = cpu_view_projection * glm::vec4(corner, 1.0f);
+        if (clip.w <= 0.0f) return false; // Crosses the camera plane
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        rect_min = glm::min(rect_min, glm::vec2(ndc));
+        rect_max = glm::max(rect_max, glm::vec2(ndc));
+        nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+    }
+    if (nearest <= 0.0f) return false;
+    rect_min = glm::clamp(rect_min * 0.5f + 0.5f, 0.0f, 1.0f);
+    rect_max = glm::clamp(rect_max * 0.5f + 0.5f, 0.0f, 1.0f);
+
+    // Level where the rectangle spans about two texels
+    glm::vec2 extent = (rect_max - rect_min) * glm::vec2(cpu_sizes[0]);
+    int level = (int)std::ceil(std::log2(std::max(std::max(extent.x, extent.y), 1.0f)));
+    level = std::clamp(level, 0, (int)cpu_levels.size() - 1);
+
+    const glm::ivec2 size = cpu_sizes[level];
+    glm::ivec2 lo = glm::clamp(glm::ivec2(rect_min * glm::vec2(size)), glm::ivec2(0), size - 1);
+    glm::ivec2 hi = glm::clamp(glm::ivec2(rect_max * glm::vec2(size)), glm::ivec2(0), size - 1);
+    const std::vector<float>& depths = cpu_levels[level];
+    for (int y = lo.y; y <= hi.y; ++y) {
+        for (int x = lo.x; x <= hi.x; ++x) {
+            if (nearest <= depths[y * size.x + x]) return false;
+        }
+    }
+    return true;
+}
+
+void HiZBuffer::shiftOrigin(const glm::vec3& delta) {
+    const glm::mat4 rebase = glm::translate(glm::mat4(1.0f), delta);
+    built_view_projection = built_view_projection * rebase;
+    cpu_view_projection = cpu_view_projection * rebase;
+    for (Readback& readback : readbacks) readback.view_projection = readback.view_projection * rebase;
+}
@@ -0,0 +1,224 @@
+#include "hlod.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include "mesh_loader.h"
+#include "gl_state.h"
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+bool use_hlod = true;
+
+namespace {
+
+struct Readback {
+    std::vector<unsigned char> vertices;
+    std::vector<uint32_t> indices;
+};
+
+// The mesh's vertices in its own layout and its indices widened, from the CPU copies when it
+// kept them, otherwise from its buffers
+bool readMesh(const Mesh& mesh, Readback& out) {
+    const size_t stride = mesh.vertex_layout.stride;
+    const size_t index_size = getIndexSize(mesh.index_type);
+    std::vector<unsigned char> index_bytes;
+    if (!mesh.vertices_data.empty() && !mesh.indices_data.empty()) {
+        out.vertices = mesh.vertices_data;
+        index_bytes = mesh.indices_data;
+    } else {
+        const GLuint vbo = mesh.arena ? mesh.arena->vbo : mesh.VBO;
+        const GLuint ebo = mesh.arena ? mesh.arena->ebo : mesh.EBO;
+        if (vbo == 0 || ebo == 0) return false;
+        size_t vertex_count = mesh.geometry.vertices.size;
+        if (!mesh.arena) {
+            GLint bytes = 0;
+            glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+            glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &bytes);
+            vertex_count = (size_t)bytes / stride;
+        }
+        if (vertex_count == 0) return false;
+        // COPY_READ takes element buffers on WebGL2 too, and leaves the bound VAO's alone
+        out.vertices.resize(vertex_count * stride);
+        glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr)(mesh.geometry.vertices.offset * stride), (GLsizeiptr)out.vertices.size(),
+                           out.vertices.data());
+        index_bytes.resize((size_t)mesh.INDEX_COUNT * index_size);
+        glBindBuffer(GL_COPY_READ_BUFFER, ebo);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr)mesh.geometry.indices.offset, (GLsizeiptr)index_bytes.size(), index_bytes.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+
+    const size_t vertex_count = out.vertices.size() / stride;
+    out.indices.resize(index_bytes.size() / index_size);
+    for (size_t i = 0; i < out.indices.size(); ++i) {
+        if (index_size == sizeof(uint16_t)) {
+            uint16_t index;
+            memcpy(&index, index_bytes.data() + i * index_size, sizeof(index));
+            out.indices[i] = index;
+        } else {
+            memcpy(&out.indices[i], index_bytes.data() + i * index_size, sizeof(uint32_t));
+        }
+        if (out.indices[i] >= vertex_count) return false;
+    }
+    return true;
+}
+
+glm::vec4 decodeSnorm10(uint32_t packed) {
+    auto component = [&](int shift, int bits) {
+        const int32_t mask = (1 << bits) - 1;
+        int32_t value = (int32_t)((packed >> shift) & (uint32_t)mask);
+        if (value & (1 << (bits - 1))) value -= 1 << bits; // Sign extend
+        return std::max((float)value / (float)((1 << (bits - 1)) - 1), -1.0f);
+    };
+    return glm::vec4(component(0, 10), component(10, 10), component(20, 10), component(30, 2));
+}
+
+uint32_t encodeSnorm10(const glm::vec4& value) {
+    auto component = [&](float v, int shift, int bits) {
+        const int32_t scale = (1 << (bits - 1)) - 1;
+        const int32_t quantized = (int32_t)std::round(glm::clamp(v, -1.0f, 1.0f) * (float)scale);
+        return ((uint32_t)quantized & (uint32_t)((1 << bits) - 1)) << shift;
+    };
+    return component(value.x, 0, 10) | component(value.y, 10, 10) | component(value.z, 20, 10) | component(value.w, 30, 2);
+}
+
+// One vertex into world space in place: the position, and the normal and tangent frame
+void transformVertex(unsigned char* vertex, const VertexLayout& layout, const glm::mat4& model, const glm::mat3& normal_matrix) {
+    glm::vec3 position;
+    memcpy(&position, vertex, sizeof(position));
+    position = glm::vec3(model * glm::vec4(position, 1.0f));
+    memcpy(vertex, &position, sizeof(position));
+
+    if (layout.format & VERTEX_PACKED) {
+        for (size_t offset : { (size_t)12, (size_t)16 }) {
+            uint32_t packed;
+            memcpy(&packed, vertex + offset, sizeof(packed));
+            glm::vec4 value = decodeSnorm10(packed);
+            const glm::mat3& basis = offset == 12 ? normal_matrix : glm::mat3(model);
+            const glm::vec3 moved = basis * glm::vec3(value);
+            const float length = glm::length(moved);
+            if (length > 0.0f) value = glm::vec4(moved / length, value.w);
+            packed = encodeSnorm10(value);
+            memcpy(vertex + offset, &packed, sizeof(packed));
+        }
+        return;
+    }
+    // Normal, tangent and bitangent after position, colour and uv
+    for (size_t first : { (size_t)9, (size_t)12, (size_t)15 }) {
+        glm::vec3 value;
+        memcpy(&value, vertex + first * sizeof(float), sizeof(value));
+        value = (first == 9 ? normal_matrix : glm::mat3(model)) * value;
+        const float length = glm::length(value);
+        if (length > 0.0f) value /= length;
+        memcpy(vertex + first * sizeof(float), &value, sizeof(value));
+    }
+}
+
+std::shared_ptr<Mesh> uploadProxy(const Mesh& source, const std::vector<unsigned char>& vertices, const std::vector<uint32_t>& indices) {
+    const size_t stride = source.vertex_layout.stride;
+    const size_t vertex_count = vertices.size() / stride;
+    auto mesh = std::make_shared<Mesh>();
+    mesh->vertex_layout = source.vertex_layout;
+    mesh->setMaterial(source.material);
+    mesh->cull_mode = source.cull_mode;
+    mesh->INDEX_COUNT = (unsigned int)indices.size();
+    mesh->TRIANGLE_COUNT = (unsigned int)indices.size() / 3;
+
+    glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+    for (size_t v = 0; v < vertex_count; ++v) {
+        glm::vec3 p;
+        memcpy(&p, vertices.data() + v * stride, sizeof(p));
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+    mesh->bounds_min = bmin;
+    mesh->bounds_max = bmax;
+    mesh->bounds_center = (bmin + bmax) * 0.5f;
+    mesh->bounds_radius = glm::length(bmax - bmin) * 0.5f;
+
+    if (vertex_count <= MESH_MAX_16BIT_VERTICES) {
+        std::vector<uint16_t> narrow(indices.begin(), indices.end());
+        mesh->index_type = GL_UNSIGNED_SHORT;
+        uploadMeshBuffers(*mesh, vertices.data(), vertices.size(), narrow.data(), narrow.size() * sizeof(uint16_t));
+    } else {
+        mesh->index_type = GL_UNSIGNED_INT;
+        uploadMeshBuffers(*mesh, vertices.data(), vertices.size(), indices.data(), indices.size() * sizeof(uint32_t));
+    }
+    mesh_pool.create(*mesh);
+    return mesh;
+}
+
+} // namespace
+
+std::vector<std::vector<HlodProxy>> buildHlodLevels(const std::vector<HlodPart>& parts) {
+    // Merged per material, cull mode and vertex format, each group in its parts' own layout
+    struct Group {
+        const Mesh* source = nullptr;
+        std::vector<unsigned char> vertices;
+        std::vector<uint32_t> indices;
+    };
+    std::map<std::tuple<const Material*, int, uint32_t>, Group> groups;
+    for (const HlodPart& part : parts) {
+        const Mesh& mesh = *part.mesh;
+        const VertexLayout& layout = mesh.vertex_layout;
+        if ((layout.format & (VERTEX_SKINNED | VERTEX_LIGHTMAP_UV)) || mesh.material.alphaMode == BLEND) return {};
+        Readback readback;
+        if (!readMesh(mesh, readback)) return {};
+
+        Group& group = groups[std::make_tuple(&mesh.material, mesh.cull_mode, layout.format)];
+        group.source = &mesh;
+        const size_t vertex_count = readback.vertices.size() / layout.stride;
+        for (const glm::mat4& model : part.models) {
+            const uint32_t base = (uint32_t)(group.vertices.size() / layout.stride);
+            const size_t first = group.vertices.size();
+            group.vertices.insert(group.vertices.end(), readback.vertices.begin(), readback.vertices.end());
+            const glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(model)));
+            for (size_t v = 0; v < vertex_count; ++v) {
+                transformVertex(group.vertices.data() + first + v * layout.stride, layout, model, normal_matrix);
+            }
+            // A mirroring transform turns the winding around
+            const bool flip = glm::determinant(glm::mat3(model)) < 0.0f;
+            for (size_t i = 0; i + 2 < readback.indices.size(); i += 3) {
+                group.indices.push_back(base + readback.indices[i]);
+                group.indices.push_back(base + readback.indices[i + (flip ? 2 : 1)]);
+                group.indices.push_back(base + readback.indices[i + (flip ? 1 : 2)]);
+            }
+        }
+    }
+    if (groups.empty()) return {};
+
+    std::vector<std::vector<HlodProxy>> levels(HLOD_LEVELS);
+    for (auto& [key, group] : groups) {
+        const size_t stride = group.source->vertex_layout.stride;
+        const size_t vertex_count = group.vertices.size() / stride;
+        // Each level goes on from the one before, so they stay nested
+        std::vector<uint32_t> indices = group.indices;
+        for (int level = 0; level < HLOD_LEVELS; ++level) {
+            const size_t target = std::max<size_t>(3, (size_t)(indices.size() / 3 * HLOD_TRIANGLE_RATIO) * 3);
+            simplifyMesh(indices, group.vertices.data(), vertex_count, stride, target, HLOD_MAX_ERROR * (float)(level + 1));
+
+            // Only the vertices the level still uses are uploaded
+            std::vector<uint32_t> remap(vertex_count, UINT32_MAX);
+            std::vector<unsigned char> vertices;
+            std::vector<uint32_t> compact(indices.size());
+            for (size_t i = 0; i < indices.size(); ++i) {
+                uint32_t& slot = remap[indices[i]];
+                if (slot == UINT32_MAX) {
+                    slot = (uint32_t)(vertices.size() / stride);
+                    vertices.insert(vertices.end(), group.vertices.begin() + indices[i] * stride,
+                                    group.vertices.begin() + (indices[i] + 1) * stride);
+                }
+                compact[i] = slot;
+            }
+            if (compact.empty()) break;
+            levels[level].push_back({ uploadProxy(*group.source, vertices, compact), group.source });
+        }
+    }
+    gl_state.bindVertexArray(0);
+    for (const auto& level : levels) {
+        if (level.size() != groups.size()) return {};
+    }
+    return levels;
+}
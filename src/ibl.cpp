@@ -0,0 +1,448 @@
+#include "ibl.h"
+#include "frame_uniforms.h"
+#include "filesystem.h"
+#include "shader_loading.h"
+#include "gl_state.h"
+#include "scene_target.h"
+#include "shader.h"
+#include "stb_image.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <filesystem>
+#include <system_error>
+
+ImageBasedLighting ibl;
+float ibl_intensity = 1.0f;
+
+// ============================================================================
+// COOKED IBL FORMAT
+// ============================================================================
+//
+//  CookedIblHeader
+//  float[27] SH, float[IBL_LUT_SIZE^2 * 2] LUT
+//  RGBA8 prefiltered texels, mip by mip, +X to -Z within a mip (absent when specular_mips is 0)
+
+static const char COOKED_IBL_MAGIC[4] = {'C', 'I', 'B', 'L'};
+
+struct CookedIblHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint32_t specular_size;
+    uint32_t specular_mips;
+    uint32_t lut_size;
+    uint32_t samples;
+};
+
+static const float PI = 3.14159265359f;
+
+static size_t specularBytes() {
+    size_t bytes = 0;
+    for (int mip = 0; mip < IBL_SPECULAR_MIPS; ++mip) {
+        size_t size = IBL_SPECULAR_SIZE >> mip;
+        bytes += size * size * 4 * 6;
+    }
+    return bytes;
+}
+
+// Same face layout as the GL cube map lookup, s and t in [-1, 1]. Must match ibl_prefilter.fs.
+static glm::vec3 faceDirection(int face, float s, float t) {
+    switch (face) {
+    case 0: return { 1.0f, -t, -s };
+    case 1: return { -1.0f, -t, s };
+    case 2: return { s, 1.0f, t };
+    case 3: return { s, -1.0f, -t };
+    case 4: return { s, -t, 1.0f };
+    default: return { -s, -t, -1.0f };
+    }
+}
+
+static float radicalInverse(uint32_t bits) {
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return (float)bits * 2.3283064365386963e-10f;
+}
+
+ImageBasedLighting::~ImageBasedLighting() {
+    if (specular_texture != 0) glDeleteTextures(1, &specular_texture);
+    if (lut_texture != 0) glDeleteTextures(1, &lut_texture);
+}
+
+void ImageBasedLighting::build(const char* const faces[6], GLuint cubemap) {
+    // FNV-1a over the face images themselves, so a re-exported sky with the same names rebuilds
+    uint64_t hash = 1469598103934665603ull;
+    for (int face = 0; face < 6; ++face) {
+        MappedFile file(faces[face]);
+        if (!file.isOpen()) {
+            hash = 0;
+            break;
+        }
+        for (size_t i = 0; i < file.size(); ++i) {
+            hash ^= file.data()[i];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+    const std::string cachePath = buildAssetPath(std::string("cache/ibl/") + name + ".ibl");
+    if (hash != 0 && loadCache(cachePath, hash)) {
+        uploadLut();
+        uploadSpecular();
+        printf("IBL loaded from cache '%s'\n", cachePath.c_str());
+        return;
+    }
+
+    const int sourceSize = projectSH(faces);
+    computeBrdfLut();
+    uploadLut();
+    if (sourceSize > 0 && !prefilter(cubemap, sourceSize)) specular.clear();
+    printf("IBL built: SH9%s\n", specular.empty() ? ", no specular" : ", prefiltered specular");
+    if (hash != 0 && sh_valid) writeCache(cachePath, hash);
+}
+
+// One face's radiance into the SH sums, a sample per cell of a columns x rows grid over it
+static void accumulateFaceSH(int face, int columns, int rows, const std::function<glm::vec3(int x, int y)>& radiance,
+                             glm::vec3 coefficients[9], float& totalWeight) {
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < columns; ++x) {
+            const float s = ((float)x + 0.5f) / (float)columns * 2.0f - 1.0f;
+            const float t = ((float)y + 0.5f) / (float)rows * 2.0f - 1.0f;
+            // Solid angle of the sample's patch of the face
+            const float weight = 4.0f / ((float)columns * (float)rows) / std::pow(1.0f + s * s + t * t, 1.5f);
+            const glm::vec3 d = glm::normalize(faceDirection(face, s, t));
+            const glm::vec3 sample = radiance(x, y);
+
+            const float basis[9] = {
+                0.282095f,
+                0.488603f * d.y, 0.488603f * d.z, 0.488603f * d.x,
+                1.092548f * d.x * d.y, 1.092548f * d.y * d.z, 0.315392f * (3.0f * d.z * d.z - 1.0f),
+                1.092548f * d.x * d.z, 0.546274f * (d.x * d.x - d.y * d.y)
+            };
+            for (int k = 0; k < 9; ++k) coefficients[k] += sample * basis[k] * weight;
+            totalWeight += weight;
+        }
+    }
+}
+
+int ImageBasedLighting::projectSH(const char* const faces[6]) {
+    glm::vec3 coefficients[9] = {};
+    float totalWeight = 0.0f;
+    int sourceSize = 0;
+
+    for (int face = 0; face < 6; ++face) {
+        int width, height, channels;
+        MappedFile file(faces[face]);
+        unsigned char* pixels =
+            file.isOpen() ? stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 3) : nullptr;
+        if (!pixels) {
+            printf("IBL: could not read '%s', ambient stays flat\n", faces[face]);
+            return 0;
+        }
+        sourceSize = width;
+
+        // A block of texels per sample, read at its centre
+        const int step = std::max(1, width / IBL_SH_FACE_SAMPLES);
+        accumulateFaceSH(face, width / step, height / step, [&](int x, int y) {
+            const unsigned char* p = pixels + ((size_t)(y * step + step / 2) * width + (x * step + step / 2)) * 3;
+            return glm::vec3(std::pow(p[0] / 255.0f, 2.2f), std::pow(p[1] / 255.0f, 2.2f), std::pow(p[2] / 255.0f, 2.2f));
+        }, coefficients, totalWeight);
+        stbi_image_free(pixels);
+    }
+
+    finishSH(coefficients, totalWeight);
+    return sourceSize;
+}
+
+// Convolved with the cosine lobe (Ramamoorthi & Hanrahan) and divided by pi, the basis
+// constants folded in so pbr.fs evaluates bare polynomials
+void ImageBasedLighting::finishSH(const glm::vec3 coefficients[9], float totalWeight) {
+    const float normalise = 4.0f * PI / totalWeight;
+    const float band[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+    const float constant[9] = { 0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f };
+    for (int k = 0; k < 9; ++k) sh[k] = coefficients[k] * normalise * band[k] * constant[k];
+    sh_valid = true;
+}
+
+void ImageBasedLighting::buildFromCubemap(GLuint cubemap, int size) {
+    // The SH from the first mip small enough, read back face by face
+    int mip = 0;
+    while ((size >> mip) > IBL_SH_FACE_SAMPLES && (size >> mip) > 1) mip++;
+    const int faceSize = size >> mip;
+    std::vector<float> texels((size_t)faceSize * faceSize * 4);
+    glm::vec3 coefficients[9] = {};
+    float totalWeight = 0.0f;
+
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    bool complete = true;
+    for (int face = 0; face < 6 && complete; ++face) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubemap, mip);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            complete = false;
+            break;
+        }
+        glReadPixels(0, 0, faceSize, faceSize, GL_RGBA, GL_FLOAT, texels.data());
+        accumulateFaceSH(face, faceSize, faceSize, [&](int x, int y) {
+            const float* p = texels.data() + ((size_t)y * faceSize + x) * 4;
+            return glm::vec3(p[0], p[1], p[2]);
+        }, coefficients, totalWeight);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glDeleteFramebuffers(1, &fbo);
+    if (!complete) {
+        printf("IBL: sky cubemap unreadable, ambient unchanged\n");
+        return;
+    }
+    finishSH(coefficients, totalWeight);
+
+    if (lut.empty()) {
+        computeBrdfLut();
+        uploadLut();
+    }
+    // Nothing goes to the cache, the sky will have moved on by the next run
+    if (!prefilter(cubemap, size, false)) specular.clear();
+}
+
+// Split-sum scale and bias on F0 per (NdotV, roughness), Karis' UE4 notes
+void ImageBasedLighting::computeBrdfLut() {
+    lut.assign((size_t)IBL_LUT_SIZE * IBL_LUT_SIZE * 2, 0.0f);
+    for (int y = 0; y < IBL_LUT_SIZE; ++y) {
+        const float roughness = ((float)y + 0.5f) / IBL_LUT_SIZE;
+        const float a = roughness * roughness;
+        const float k = a / 2.0f;
+        for (int x = 0; x < IBL_LUT_SIZE; ++x) {
+            const float NdotV = ((float)x + 0.5f) / IBL_LUT_SIZE;
+            const glm::vec3 V(std::sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV);
+
+            float scale = 0.0f, bias = 0.0f;
+            for (int i = 0; i < IBL_SAMPLES; ++i) {
+                const float phi = 2.0f * PI * (float)i / IBL_SAMPLES;
+                const float xi = radicalInverse((uint32_t)i);
+                const float cosTheta = std::sqrt((1.0f - xi) / (1.0f + (a * a - 1.0f) * xi));
+                const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+                const glm::vec3 H(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+                const glm::vec3 L = 2.0f * glm::dot(V, H) * H - V;
+
+                const float NdotL = L.z;
+                if (NdotL <= 0.0f) continue;
+                const float NdotH = std::max(H.z, 0.0f);
+                const float VdotH = std::max(glm::dot(V, H), 0.0f);
+                const float G = (NdotV / (NdotV * (1.0f - k) + k)) * (NdotL / (NdotL * (1.0f - k) + k));
+                const float visibility = G * VdotH / std::max(NdotH * NdotV, 1e-4f);
+                const float fresnel = std::pow(1.0f - VdotH, 5.0f);
+                scale += (1.0f - fresnel) * visibility;
+                bias += fresnel * visibility;
+            }
+            float* texel = &lut[((size_t)y * IBL_LUT_SIZE + x) * 2];
+            texel[0] = scale / IBL_SAMPLES;
+            texel[1] = bias / IBL_SAMPLES;
+        }
+    }
+}
+
+bool ImageBasedLighting::prefilter(GLuint cubemap, int source_size, bool read_back) {
+    std::unique_ptr<Shader> shader;
+    try {
+        shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/hiz.vs")),
+                                          loadShaderFile(buildAssetPath("res/shaders/ibl_prefilter.fs")));
+    } catch (const std::exception& e) {
+        printf("IBL prefilter shader failed (%s), ambient is diffuse only\n", e.what());
+        return false;
+    }
+
+    // Rough lobes read the sky's mips instead of thousands of texels, loadCubemap() made them
+    if (specular_texture == 0) glGenTextures(1, &specular_texture);
+    gl_state.bindTexture(0, GL_TEXTURE_CUBE_MAP, specular_texture);
+    for (int mip = 0; mip < IBL_SPECULAR_MIPS; ++mip) {
+        const int size = IBL_SPECULAR_SIZE >> mip;
+        for (int face = 0; face < 6; ++face) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, IBL_SPECULAR_MIPS - 1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    gl_state.bindTexture(0, GL_TEXTURE_CUBE_MAP, cubemap);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const bool depthTest = gl_state.isEnabled(GL_DEPTH_TEST);
+    const bool cullFace = gl_state.isEnabled(GL_CULL_FACE);
+    const bool blend = gl_state.isEnabled(GL_BLEND);
+    gl_state.disable(GL_DEPTH_TEST);
+    gl_state.disable(GL_CULL_FACE);
+    gl_state.disable(GL_BLEND);
+    gl_state.colorMask(true);
+
+    GLuint fbo, vao;
+    glGenFramebuffers(1, &fbo);
+    glGenVertexArrays(1, &vao);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    gl_state.bindVertexArray(vao);
+    shader->use();
+    shader->setInt("environment", 0);
+    shader->setFloat("sourceSize", (float)source_size);
+    shader->setInt("sampleCount", IBL_SAMPLES);
+
+    // Each face is read back for the cache as soon as it's drawn
+    if (read_back) specular.resize(specularBytes());
+    size_t offset = 0;
+    bool complete = true;
+    for (int mip = 0; mip < IBL_SPECULAR_MIPS && complete; ++mip) {
+        const int size = IBL_SPECULAR_SIZE >> mip;
+        glViewport(0, 0, size, size);
+        shader->setFloat("faceSize", (float)size);
+        shader->setFloat("roughness", (float)mip / (IBL_SPECULAR_MIPS - 1));
+        for (int face = 0; face < 6; ++face) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, specular_texture, mip);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                printf("IBL prefilter framebuffer incomplete, ambient is diffuse only\n");
+                complete = false;
+                break;
+            }
+            shader->setInt("face", face);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            if (!read_back) continue;
+            glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, specular.data() + offset);
+            offset += (size_t)size * size * 4;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glDeleteFramebuffers(1, &fbo);
+    gl_state.bindVertexArray(0);
+    glDeleteVertexArrays(1, &vao);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    gl_state.setEnabled(GL_DEPTH_TEST, depthTest);
+    gl_state.setEnabled(GL_CULL_FACE, cullFace);
+    gl_state.setEnabled(GL_BLEND, blend);
+
+    if (!complete) {
+        glDeleteTextures(1, &specular_texture);
+        specular_texture = 0;
+    }
+    return complete;
+}
+
+void ImageBasedLighting::uploadSpecular() {
+    if (specular.empty()) return;
+    if (specular_texture == 0) glGenTextures(1, &specular_texture);
+    gl_state.bindTexture(0, GL_TEXTURE_CUBE_MAP, specular_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    size_t offset = 0;
+    for (int mip = 0; mip < IBL_SPECULAR_MIPS; ++mip) {
+        const int size = IBL_SPECULAR_SIZE >> mip;
+        for (int face = 0; face < 6; ++face) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                         specular.data() + offset);
+            offset += (size_t)size * size * 4;
+        }
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, IBL_SPECULAR_MIPS - 1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+void ImageBasedLighting::uploadLut() {
+    if (lut_texture == 0) glGenTextures(1, &lut_texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, lut_texture);
+    // RG16F filters everywhere, and both APIs take float texels for it
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, IBL_LUT_SIZE, IBL_LUT_SIZE, 0, GL_RG, GL_FLOAT, lut.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+}
+
+bool ImageBasedLighting::loadCache(const std::string& path, uint64_t hash) {
+    MappedFile file(path);
+    if (!file.isOpen()) return false;
+
+    CookedIblHeader header;
+    if (file.size() < sizeof(header)) return false;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, COOKED_IBL_MAGIC, 4) != 0 || header.version != COOKED_IBL_VERSION ||
+        header.source_hash != hash || header.specular_size != IBL_SPECULAR_SIZE || header.lut_size != IBL_LUT_SIZE ||
+        header.samples != IBL_SAMPLES || (header.specular_mips != 0 && header.specular_mips != IBL_SPECULAR_MIPS)) {
+        printf("Cooked IBL '%s' is stale, rebuilding\n", path.c_str());
+        return false;
+    }
+
+    const size_t lutFloats = (size_t)IBL_LUT_SIZE * IBL_LUT_SIZE * 2;
+    const size_t specularSize = header.specular_mips != 0 ? specularBytes() : 0;
+    if (file.size() != sizeof(header) + sizeof(sh) + lutFloats * sizeof(float) + specularSize) return false;
+
+    const unsigned char* cursor = file.data() + sizeof(header);
+    memcpy(sh, cursor, sizeof(sh));
+    cursor += sizeof(sh);
+    lut.resize(lutFloats);
+    memcpy(lut.data(), cursor, lutFloats * sizeof(float));
+    cursor += lutFloats * sizeof(float);
+    specular.assign(cursor, cursor + specularSize);
+    sh_valid = true;
+    return true;
+}
+
+void ImageBasedLighting::writeCache(const std::string& path, uint64_t hash) const {
+    CookedIblHeader header;
+    memcpy(header.magic, COOKED_IBL_MAGIC, 4);
+    header.version = COOKED_IBL_VERSION;
+    header.source_hash = hash;
+    header.specular_size = IBL_SPECULAR_SIZE;
+    header.specular_mips = specular.empty() ? 0 : IBL_SPECULAR_MIPS;
+    header.lut_size = IBL_LUT_SIZE;
+    header.samples = IBL_SAMPLES;
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+    // Write to a temp file and rename so a crash never leaves a half-written cache entry
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            printf("Warning: Could not write cooked IBL '%s'\n", path.c_str());
+            return;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(sh), sizeof(sh));
+        out.write(reinterpret_cast<const char*>(lut.data()), lut.size() * sizeof(float));
+        out.write(reinterpret_cast<const char*>(specular.data()), specular.size());
+        if (!out) return;
+    }
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec) std::filesystem::remove(tempPath, ec);
+}
+
+void ImageBasedLighting::fillLightBlock(LightBlock& block) const {
+    for (int k = 0; k < 9; ++k) block.ambient_sh[k] = glm::vec4(sh_valid ? sh[k] : glm::vec3(0.0f), 0.0f);
+    // The flat ambient pbr.fs always had, until there is a sky to take it from
+    if (!sh_valid) block.ambient_sh[0] = glm::vec4(0.03f, 0.03f, 0.03f, 0.0f);
+    block.ambient_intensity = sh_valid ? ibl_intensity : 1.0f;
+    block.ambient_specular_lod = specular_texture != 0 ? (float)(IBL_SPECULAR_MIPS - 1) : 0.0f;
+}
+
+void ImageBasedLighting::bind(int unit) const {
+    if (specular_texture != 0) gl_state.bindTexture(unit, GL_TEXTURE_CUBE_MAP, specular_texture);
+    if (lut_texture != 0) gl_state.bindTexture(unit + 1, GL_TEXTURE_2D, lut_texture);
+}
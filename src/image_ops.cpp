@@ -0,0 +1,115 @@
+#include "image_ops.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define IMAGE_OPS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define IMAGE_OPS_NEON
+#elif defined(__wasm_simd128__)
+    #include <wasm_simd128.h>
+    #define IMAGE_OPS_WASM_SIMD
+#endif
+
+static inline unsigned char scalarChannel(const ChannelSource& src, size_t i) {
+    unsigned char v = src.plane ? src.plane[i] : src.constant;
+    return src.invert ? (unsigned char)(255 - v) : v;
+}
+
+static void interleaveScalar(const ChannelSource sources[4], unsigned char* out, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        out[i * 4 + 0] = scalarChannel(sources[0], i);
+        out[i * 4 + 1] = scalarChannel(sources[1], i);
+        out[i * 4 + 2] = scalarChannel(sources[2], i);
+        out[i * 4 + 3] = scalarChannel(sources[3], i);
+    }
+}
+
+#if defined(IMAGE_OPS_SSE2)
+
+static inline __m128i loadChannel16(const ChannelSource& src, size_t i) {
+    __m128i v = src.plane ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.plane + i))
+                          : _mm_set1_epi8((char)src.constant);
+    // 255 - x == ~x for bytes
+    return src.invert ? _mm_xor_si128(v, _mm_set1_epi8((char)0xFF)) : v;
+}
+
+void interleaveRGBA(const ChannelSource sources[4], unsigned char* out, size_t begin, size_t end) {
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m128i r = loadChannel16(sources[0], i);
+        __m128i g = loadChannel16(sources[1], i);
+        __m128i b = loadChannel16(sources[2], i);
+        __m128i a = loadChannel16(sources[3], i);
+
+        __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+        __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+        __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+        __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+
+        __m128i* dst = reinterpret_cast<__m128i*>(out + i * 4);
+        _mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+        _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+    }
+    interleaveScalar(sources, out, i, end);
+}
+
+#elif defined(IMAGE_OPS_NEON)
+
+static inline uint8x16_t loadChannel16(const ChannelSource& src, size_t i) {
+    uint8x16_t v = src.plane ? vld1q_u8(src.plane + i) : vdupq_n_u8(src.constant);
+    return src.invert ? vmvnq_u8(v) : v;
+}
+
+void interleaveRGBA(const ChannelSource sources[4], unsigned char* out, size_t begin, size_t end) {
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        uint8x16x4_t rgba;
+        rgba.val[0] = loadChannel16(sources[0], i);
+        rgba.val[1] = loadChannel16(sources[1], i);
+        rgba.val[2] = loadChannel16(sources[2], i);
+        rgba.val[3] = loadChannel16(sources[3], i);
+        vst4q_u8(out + i * 4, rgba);
+    }
+    interleaveScalar(sources, out, i, end);
+}
+
+#elif defined(IMAGE_OPS_WASM_SIMD)
+
+static inline v128_t loadChannel16(const ChannelSource& src, size_t i) {
+    v128_t v = src.plane ? wasm_v128_load(src.plane + i) : wasm_u8x16_splat(src.constant);
+    return src.invert ? wasm_v128_not(v) : v;
+}
+
+// Same unpacks as the SSE2 path, as shuffles
+void interleaveRGBA(const ChannelSource sources[4], unsigned char* out, size_t begin, size_t end) {
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        v128_t r = loadChannel16(sources[0], i);
+        v128_t g = loadChannel16(sources[1], i);
+        v128_t b = loadChannel16(sources[2], i);
+        v128_t a = loadChannel16(sources[3], i);
+
+        v128_t rg_lo = wasm_i8x16_shuffle(r, g, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+        v128_t rg_hi = wasm_i8x16_shuffle(r, g, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+        v128_t ba_lo = wasm_i8x16_shuffle(b, a, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+        v128_t ba_hi = wasm_i8x16_shuffle(b, a, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+
+        unsigned char* dst = out + i * 4;
+        wasm_v128_store(dst + 0, wasm_i16x8_shuffle(rg_lo, ba_lo, 0, 8, 1, 9, 2, 10, 3, 11));
+        wasm_v128_store(dst + 16, wasm_i16x8_shuffle(rg_lo, ba_lo, 4, 12, 5, 13, 6, 14, 7, 15));
+        wasm_v128_store(dst + 32, wasm_i16x8_shuffle(rg_hi, ba_hi, 0, 8, 1, 9, 2, 10, 3, 11));
+        wasm_v128_store(dst + 48, wasm_i16x8_shuffle(rg_hi, ba_hi, 4, 12, 5, 13, 6, 14, 7, 15));
+    }
+    interleaveScalar(sources, out, i, end);
+}
+
+#else
+
+void interleaveRGBA(const ChannelSource sources[4], unsigned char* out, size_t begin, size_t end) {
+    interleaveScalar(sources, out, begin, end);
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include "impostor.h"
+#include "mesh.h"
+#include "shader.h"
+#include "shader_loading.h"
+#include "filesystem.h"
+#include "scene_target.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <cstdio>
+
+Impostor::~Impostor() {
+    if (albedo_atlas != 0) glDeleteTextures(1, &albedo_atlas);
+    if (normal_depth_atlas != 0) glDeleteTextures(1, &normal_depth_atlas);
+}
+
+glm::vec3 impostorFrameDirection(int x, int y, int frames) {
+    // Grid points include the edges so the horizon views are baked exactly
+    glm::vec2 e = glm::vec2((float)x, (float)y) / (float)(frames - 1) * 2.0f - 1.0f;
+    glm::vec2 p = glm::vec2(e.x + e.y, e.x - e.y) * 0.5f;
+    float height = 1.0f - std::abs(p.x) - std::abs(p.y);
+    return glm::normalize(glm::vec3(p.x, std::max(height, 0.0f), p.y));
+}
+
+void impostorFrameBasis(const glm::vec3& direction, glm::vec3& right, glm::vec3& up) {
+    // Same axes glm::lookAt builds for an eye on this direction looking back at the centre
+    glm::vec3 world_up = std::abs(direction.y) > 0.999f ? glm::vec3(0, 0, -1) : glm::vec3(0, 1, 0);
+    right = glm::normalize(glm::cross(-direction, world_up));
+    up = glm::cross(right, -direction);
+}
+
+static GLuint createAtlasTexture(int size) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return texture;
+}
+
+std::shared_ptr<Impostor> bakeImpostor(const std::vector<std::shared_ptr<Mesh>>& meshes) {
+    auto impostor = std::make_shared<Impostor>();
+    glm::vec3 bounds_min, bounds_max;
+    impostor->radius = computeMeshesBounds(meshes, impostor->center, bounds_min, bounds_max);
+    if (impostor->radius <= 0.0f) {
+        printf("Warning: Cannot bake impostor for meshes without bounds\n");
+        return nullptr;
+    }
+
+    std::unique_ptr<Shader> bake_shader;
+    try {
+        bake_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/impostor_bake.vs")),
+                                               loadShaderFile(buildAssetPath("res/shaders/impostor_bake.fs")));
+    } catch (const std::exception& e) {
+        printf("Failed to create impostor bake shader: %s\n", e.what());
+        return nullptr;
+    }
+
+    const int frames = impostor->frames;
+    const int atlas_size = frames * IMPOSTOR_FRAME_SIZE;
+    impostor->albedo_atlas = createAtlasTexture(atlas_size);
+    impostor->normal_depth_atlas = createAtlasTexture(atlas_size);
+
+    GLuint fbo, depth_rbo;
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &depth_rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, atlas_size, atlas_size);
+
+    GLint previous_viewport[4];
+    glGetIntegerv(GL_VIEWPORT, previous_viewport);
+    GLboolean blend_enabled = glIsEnabled(GL_BLEND);
+    GLboolean cull_enabled = glIsEnabled(GL_CULL_FACE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, impostor->albedo_atlas, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, impostor->normal_depth_atlas, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rbo);
+    const GLenum draw_buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, draw_buffers);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Error: Impostor framebuffer is not complete\n");
+    } else {
+        glViewport(0, 0, atlas_size, atlas_size);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_BLEND);
+        glDisable(GL_CULL_FACE);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+
+        const float r = impostor->radius;
+        glm::mat4 frame_projection = glm::ortho(-r, r, -r, r, 0.0f, r * 4.0f);
+        const InstanceTransform identity = packInstanceTransform(glm::mat4(1.0f));
+
+        bake_shader->use();
+        bake_shader->setVec3("boundsCenter", impostor->center);
+        bake_shader->setFloat("boundsRadius", r);
+        bake_shader->setInt("albedoMap", 0);
+
+        for (int y = 0; y < frames; ++y) {
+            for (int x = 0; x < frames; ++x) {
+                glm::vec3 direction = impostorFrameDirection(x, y, frames);
+                glm::vec3 right, up;
+                impostorFrameBasis(direction, right, up);
+                glm::mat4 frame_view = glm::lookAt(impostor->center + direction * (r * 2.0f), impostor->center, up);
+
+                glViewport(x * IMPOSTOR_FRAME_SIZE, y * IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE);
+                bake_shader->setMat4("viewProjection", frame_projection * frame_view);
+                bake_shader->setVec3("frameDirection", direction);
+
+                for (const auto& mesh : meshes) {
+                    if (!mesh || !mesh->isValid()) continue;
+                    const Material& material = mesh->material;
+
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_2D, material.hasAlbedoMap() ? material.albedo_map : default_texture_id);
+                    bake_shader->setInt("hasAlbedoMap", material.hasAlbedoMap() ? 1 : 0);
+                    bake_shader->setVec3("baseColor", material.base_color);
+
+                    // The mesh VAO reads its instance matrix, draw it once at the origin
+                    glBindBuffer(GL_ARRAY_BUFFER, mesh->instanceVBO);
+                    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(identity), &identity);
+                    gl_state.bindVertexArray(mesh->VAO);
+                    pointInstanceAttributes(mesh->instanceVBO, mesh->instanceFadeVBO, 0);
+                    drawMeshElements(*mesh);
+                }
+            }
+        }
+        gl_state.bindVertexArray(0);
+
+        for (GLuint texture : { impostor->albedo_atlas, impostor->normal_depth_atlas }) {
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &depth_rbo);
+    glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2], previous_viewport[3]);
+    if (blend_enabled) glEnable(GL_BLEND);
+    if (cull_enabled) glEnable(GL_CULL_FACE);
+
+    printf("Baked %dx%d impostor atlas (%d frames, radius %.2f)\n", atlas_size, atlas_size, frames * frames, impostor->radius);
+    return impostor;
+}
@@ -0,0 +1,201 @@
+#include "instance_ring.h"
+#include "geometry_arena.h"
+#include "gl_extensions.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+InstanceRing instance_ring;
+
+// Blocks start on an instance boundary so first_instance offsets stay aligned
+#define INSTANCE_RING_ALIGNMENT sizeof(InstanceTransform)
+
+static size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+InstanceRing::~InstanceRing() {
+    release();
+}
+
+void InstanceRing::release() {
+    for (GLsync& fence : fences) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (!retired.empty()) glDeleteBuffers((GLsizei)retired.size(), retired.data());
+    retired.clear();
+    if (buffer != 0) glDeleteBuffers(1, &buffer); // Unmaps too
+    buffer = 0;
+    mapped = nullptr;
+    region_bytes = 0;
+    region = 0;
+    head = 0;
+}
+
+void InstanceRing::allocate(size_t bytes) {
+    if (buffer != 0) retired.push_back(buffer);
+    for (GLsync& fence : fences) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    region_bytes = bytes;
+    region = 0;
+    head = 0;
+    mapped = nullptr;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (gl_extensions.buffer_storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        gl_extensions.BufferStorage(GL_ARRAY_BUFFER, region_bytes * INSTANCE_RING_FRAMES, nullptr, flags);
+        mapped = (uint8_t*)glMapBufferRange(GL_ARRAY_BUFFER, 0, region_bytes * INSTANCE_RING_FRAMES, flags);
+        if (!mapped) printf("Instance ring: persistent map failed, falling back to orphaning\n");
+    }
+    if (!mapped) {
+        // Immutable storage can't be orphaned, start over with a mutable buffer
+        if (gl_extensions.buffer_storage) {
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        }
+        glBufferData(GL_ARRAY_BUFFER, region_bytes, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InstanceRing::beginFrame() {
+    // Last frame's outgrown buffers, GL keeps them alive until their draws finish
+    if (!retired.empty()) glDeleteBuffers((GLsizei)retired.size(), retired.data());
+    retired.clear();
+
+    if (buffer == 0) {
+        allocate(INSTANCE_RING_INITIAL_BYTES);
+        return;
+    }
+
+    head = 0;
+    if (mapped) {
+        region = (region + 1) % INSTANCE_RING_FRAMES;
+        GLsync& fence = fences[region];
+        if (fence) {
+            // Normally long signalled, the GPU is at most INSTANCE_RING_FRAMES - 1 frames behind
+            GLenum result = glClientWaitSync(fence, 0, 0);
+            while (result == GL_TIMEOUT_EXPIRED) result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, region_bytes, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+void InstanceRing::endFrame() {
+    if (!mapped) return;
+    if (fences[region]) glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+size_t InstanceRing::reserve(size_t bytes) {
+    if (buffer == 0) allocate(INSTANCE_RING_INITIAL_BYTES);
+    bytes = alignUp(bytes, INSTANCE_RING_ALIGNMENT);
+    if (head + bytes > region_bytes) {
+        // Earlier ranges keep pointing at the old buffer, which lives until the next frame
+        allocate(std::max(region_bytes * 2, alignUp(bytes, INSTANCE_RING_INITIAL_BYTES)));
+        printf("Instance ring grown to %zu KB per frame\n", region_bytes / 1024);
+    }
+
+    const size_t offset = (mapped ? region * region_bytes : 0) + head;
+    head += bytes;
+    return offset;
+}
+
+InstanceRing::Range InstanceRing::write(const glm::mat4* matrices, const float* fades, size_t count) {
+    Range range;
+    if (count == 0) return range;
+
+    const size_t matrix_bytes = count * sizeof(InstanceTransform);
+    const size_t fade_bytes = count * sizeof(float);
+    range.matrix_offset = reserve(matrix_bytes + fade_bytes);
+    range.buffer = buffer;
+    range.fade_offset = range.matrix_offset + matrix_bytes;
+    range.count = count;
+
+    if (mapped) {
+        InstanceTransform* out = (InstanceTransform*)(mapped + range.matrix_offset);
+        for (size_t i = 0; i < count; ++i) out[i] = packInstanceTransform(matrices[i]);
+        if (fades) {
+            memcpy(mapped + range.fade_offset, fades, fade_bytes);
+        } else {
+            memset(mapped + range.fade_offset, 0, fade_bytes);
+        }
+    } else {
+        packed.resize(count);
+        for (size_t i = 0; i < count; ++i) packed[i] = packInstanceTransform(matrices[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, range.matrix_offset, matrix_bytes, packed.data());
+        if (fades) {
+            glBufferSubData(GL_ARRAY_BUFFER, range.fade_offset, fade_bytes, fades);
+        } else {
+            std::vector<float> no_fade(count, 0.0f);
+            glBufferSubData(GL_ARRAY_BUFFER, range.fade_offset, fade_bytes, no_fade.data());
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    return range;
+}
+
+InstanceRing::Block InstanceRing::writeBytes(const void* data, size_t bytes) {
+    Block block;
+    if (bytes == 0) return block;
+
+    block.offset = reserve(bytes);
+    block.buffer = buffer;
+    if (mapped) {
+        memcpy(mapped + block.offset, data, bytes);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, block.offset, bytes, data);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    return block;
+}
+
+InstanceRing::Reservation InstanceRing::reserveInstances(size_t count) {
+    Reservation reservation;
+    if (count == 0) return reservation;
+
+    Range& range = reservation.range;
+    const size_t matrix_bytes = count * sizeof(InstanceTransform);
+    range.matrix_offset = reserve(matrix_bytes + count * sizeof(float));
+    range.buffer = buffer;
+    range.fade_offset = range.matrix_offset + matrix_bytes;
+    range.count = count;
+
+    if (mapped) {
+        reservation.transforms = (InstanceTransform*)(mapped + range.matrix_offset);
+        reservation.fades = (float*)(mapped + range.fade_offset);
+    } else {
+        packed.resize(count);
+        packed_fades.resize(count);
+        reservation.transforms = packed.data();
+        reservation.fades = packed_fades.data();
+    }
+    return reservation;
+}
+
+void InstanceRing::commit(const Reservation& reservation) {
+    const Range& range = reservation.range;
+    if (mapped || range.count == 0) return;
+    glBindBuffer(GL_ARRAY_BUFFER, range.buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, range.matrix_offset, range.count * sizeof(InstanceTransform), reservation.transforms);
+    glBufferSubData(GL_ARRAY_BUFFER, range.fade_offset, range.count * sizeof(float), reservation.fades);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void pointInstanceRange(const InstanceRing::Range& range, size_t first_instance) {
+    pointInstanceBytes(range.buffer, range.matrix_offset + first_instance * sizeof(InstanceTransform),
+                       range.buffer, range.fade_offset + first_instance * sizeof(float));
+}
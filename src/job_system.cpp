@@ -0,0 +1,243 @@
+#include "job_system.h"
+#include "trace_capture.h"
+
+#include <cstdio>
+#include <atomic>
+#include <algorithm>
+
+JobSystem job_system;
+
+// Index of the worker running on this thread, workers.size() (the shared queue) elsewhere
+static thread_local unsigned int current_worker = ~0u;
+
+void JobSystem::init(unsigned int thread_count) {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    // No pthreads without SharedArrayBuffer, run everything inline
+    (void)thread_count;
+    return;
+#else
+    if (!workers.empty()) return;
+
+    if (thread_count == 0) {
+        unsigned int hw = std::thread::hardware_concurrency();
+        thread_count = hw > 1 ? hw - 1 : 1;
+    }
+
+    stopping = false;
+    work_queues.clear();
+    for (unsigned int i = 0; i <= thread_count; ++i) work_queues.push_back(std::make_unique<WorkQueue>());
+    for (unsigned int i = 0; i < thread_count; ++i) {
+        workers.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+    printf("Job system started with %u worker threads\n", thread_count);
+#endif
+}
+
+void JobSystem::shutdown() {
+    if (workers.empty()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_cv.notify_all();
+
+    for (auto& worker : workers) worker.join();
+    workers.clear();
+    queue.clear();
+    long_jobs.clear();
+    work_queues.clear();
+    stealable = 0;
+}
+
+void JobSystem::submit(std::function<void()> job) {
+    if (workers.empty()) {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(std::move(job));
+    }
+    queue_cv.notify_one();
+}
+
+void JobSystem::waitIdle() {
+    if (workers.empty()) return;
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    idle_cv.wait(lock, [this] { return queue.empty() && active_jobs == 0; });
+}
+
+// ============================================================================
+// STEALABLE JOBS
+// ============================================================================
+
+size_t JobSystem::queueIndex() const {
+    return current_worker < workers.size() ? current_worker : workers.size();
+}
+
+void JobSystem::spawn(std::function<void()> job, JobCounter& counter) {
+    if (workers.empty()) {
+        job();
+        return;
+    }
+
+    counter.pending.fetch_add(1, std::memory_order_relaxed);
+    WorkQueue& own = *work_queues[queueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.jobs.push_back({std::move(job), &counter});
+    }
+    stealable.fetch_add(1);
+
+    // Taking the lock orders this against a worker about to sleep
+    { std::lock_guard<std::mutex> lock(queue_mutex); }
+    queue_cv.notify_one();
+}
+
+void JobSystem::spawnLong(std::function<void()> job, JobCounter& counter) {
+    if (workers.empty()) {
+        job();
+        return;
+    }
+
+    counter.pending.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        long_jobs.push_back({std::move(job), &counter});
+    }
+    queue_cv.notify_one();
+}
+
+// The long job counting down counter, if no worker has taken it yet
+bool JobSystem::popLong(const JobCounter& counter, StealableJob& job) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    for (auto it = long_jobs.begin(); it != long_jobs.end(); ++it) {
+        if (it->counter != &counter) continue;
+        job = std::move(*it);
+        long_jobs.erase(it);
+        return true;
+    }
+    return false;
+}
+
+// Newest job of our own queue first (still warm in cache), then the oldest of someone else's
+bool JobSystem::popStealable(size_t own, StealableJob& job) {
+    if (stealable.load() == 0) return false;
+
+    {
+        WorkQueue& queue = *work_queues[own];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty()) {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+            stealable.fetch_sub(1);
+            return true;
+        }
+    }
+
+    for (size_t offset = 1; offset < work_queues.size(); ++offset) {
+        WorkQueue& victim = *work_queues[(own + offset) % work_queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            stealable.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::runStealable(StealableJob& job) {
+    {
+        TRACE_SCOPE("Parallel job", "jobs");
+        job.fn();
+    }
+    job.counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::wait(JobCounter& counter) {
+    const size_t own = workers.empty() ? 0 : queueIndex();
+    while (!counter.done()) {
+        StealableJob job;
+        if (popStealable(own, job) || popLong(counter, job)) {
+            runStealable(job);
+        } else {
+            // What's left is running on other threads
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+    if (count == 0) return;
+    grain = std::max<size_t>(1, grain);
+    const size_t chunks = (count + grain - 1) / grain;
+    if (workers.empty() || chunks == 1) {
+        fn(0, count);
+        return;
+    }
+
+    // Helpers that start after the ranges ran out return straight away. wait() sees every
+    // helper finish, so the counters can live on this stack frame.
+    std::atomic<size_t> next{0};
+    auto runChunks = [&]() {
+        size_t chunk;
+        while ((chunk = next.fetch_add(1)) < chunks) {
+            size_t begin = chunk * grain;
+            fn(begin, std::min(count, begin + grain));
+        }
+    };
+
+    JobCounter counter;
+    size_t helpers = std::min<size_t>(workers.size(), chunks - 1);
+    for (size_t i = 0; i < helpers; ++i) spawn(runChunks, counter);
+    runChunks();
+    wait(counter);
+}
+
+void JobSystem::workerLoop(unsigned int index) {
+    current_worker = index;
+    trace_capture.nameThread("Worker " + std::to_string(index));
+    for (;;) {
+        StealableJob stolen;
+        if (popStealable(index, stolen)) {
+            runStealable(stolen);
+            continue;
+        }
+
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this] { return stopping || !long_jobs.empty() || !queue.empty() || stealable.load() > 0; });
+            if (stopping) return;
+            if (!long_jobs.empty()) {
+                // Frame work the main thread is overlapping, ahead of any import
+                stolen = std::move(long_jobs.front());
+                long_jobs.pop_front();
+                lock.unlock();
+                runStealable(stolen);
+                continue;
+            }
+            if (queue.empty()) continue; // Frame work arrived, go steal it
+
+            job = std::move(queue.front());
+            queue.pop_front();
+            ++active_jobs;
+        }
+
+        {
+            TRACE_SCOPE("Background job", "jobs");
+            job();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            --active_jobs;
+            if (queue.empty() && active_jobs == 0) idle_cv.notify_all();
+        }
+    }
+}
@@ -0,0 +1,317 @@
+#include "ktx2.h"
+#include "texture_loader.h"
+#include "texture_compression.h"
+#include "filesystem.h"
+#include "load_stats.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+static const unsigned char KTX2_IDENTIFIER[12] = {
+    0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+struct KTX2Header {
+    uint32_t vk_format;
+    uint32_t type_size;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t layer_count;
+    uint32_t face_count;
+    uint32_t level_count;
+    uint32_t supercompression_scheme;
+    uint32_t dfd_byte_offset;
+    uint32_t dfd_byte_length;
+    uint32_t kvd_byte_offset;
+    uint32_t kvd_byte_length;
+    uint64_t sgd_byte_offset;
+    uint64_t sgd_byte_length;
+};
+
+struct KTX2LevelIndex {
+    uint64_t byte_offset;
+    uint64_t byte_length;
+    uint64_t uncompressed_byte_length;
+};
+
+// ============================================================================
+// FORMAT TABLE
+// ============================================================================
+
+struct KTX2Format {
+    uint32_t vk_format;
+    GLenum gl_format;
+    uint32_t block_dim;   // 4 for the block formats, 1 for plain texels
+    uint32_t block_bytes;
+    uint8_t df_model;     // KHR_DF_MODEL_*
+    bool has_alpha;
+};
+
+static const KTX2Format KTX2_FORMATS[] = {
+    { 37,  GL_RGBA8,                         1, 4,  1,   true  }, // R8G8B8A8_UNORM (uncompressed)
+    { 131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,  4, 8,  128, false }, // BC1_RGB_UNORM
+    { 133, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 4, 8,  128, true  }, // BC1_RGBA_UNORM
+    { 137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 4, 16, 130, true  }, // BC3_UNORM
+    { 139, GL_COMPRESSED_RED_RGTC1,          4, 8,  131, false }, // BC4_UNORM
+    { 141, GL_COMPRESSED_RG_RGTC2,           4, 16, 132, false }, // BC5_UNORM
+    { 145, GL_COMPRESSED_RGBA_BPTC_UNORM,    4, 16, 134, true  }, // BC7_UNORM
+    { 147, GL_COMPRESSED_RGB8_ETC2,          4, 8,  161, false }, // ETC2_R8G8B8_UNORM
+    { 151, GL_COMPRESSED_RGBA8_ETC2_EAC,     4, 16, 161, true  }, // ETC2_R8G8B8A8_UNORM
+    { 155, GL_COMPRESSED_RG11_EAC,           4, 16, 161, false }, // EAC_R11G11_UNORM
+    { 157, GL_COMPRESSED_RGBA_ASTC_4x4_KHR,  4, 16, 162, true  }, // ASTC_4x4_UNORM
+};
+
+static const KTX2Format* findFormatByVk(uint32_t vk_format) {
+    for (const auto& f : KTX2_FORMATS) if (f.vk_format == vk_format) return &f;
+    return nullptr;
+}
+
+static const KTX2Format* findFormatByGL(GLenum gl_format) {
+    for (const auto& f : KTX2_FORMATS) if (f.gl_format == gl_format) return &f;
+    return nullptr;
+}
+
+GLenum ktx2FormatToGL(uint32_t vk_format) {
+    const KTX2Format* f = findFormatByVk(vk_format);
+    return f ? f->gl_format : 0;
+}
+
+uint32_t glFormatToKTX2(GLenum gl_format) {
+    const KTX2Format* f = findFormatByGL(gl_format);
+    return f ? f->vk_format : 0;
+}
+
+static size_t levelByteSize(const KTX2Format& format, uint32_t width, uint32_t height) {
+    const uint32_t d = format.block_dim;
+    return (size_t)((width + d - 1) / d) * ((height + d - 1) / d) * format.block_bytes;
+}
+
+// ============================================================================
+// READ
+// ============================================================================
+
+// faces images, one per face in GL_TEXTURE_CUBE_MAP_POSITIVE_X order for cubemaps. Each level
+// holds every face's image back to back.
+static bool readKTX2Faces(const std::string& path, ImageData* images, uint32_t face_count) {
+    LoadTimer timer(LOAD_STAGE_IMAGE_READ);
+    auto mapping = std::make_shared<MappedFile>(path);
+    const MappedFile& file = *mapping;
+    if (!file.isOpen() || file.size() < sizeof(KTX2_IDENTIFIER) + sizeof(KTX2Header)) return false;
+    timer.addBytesRead(file.size());
+    if (memcmp(file.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) return false;
+
+    KTX2Header header;
+    memcpy(&header, file.data() + sizeof(KTX2_IDENTIFIER), sizeof(header));
+
+    const KTX2Format* format = findFormatByVk(header.vk_format);
+    if (!format) {
+        printf("KTX2 '%s': unsupported vkFormat %u\n", path.c_str(), header.vk_format);
+        return false;
+    }
+    if (header.supercompression_scheme != 0) {
+        printf("KTX2 '%s': supercompressed files are not supported\n", path.c_str());
+        return false;
+    }
+    if (header.pixel_width == 0 || header.pixel_height == 0 || header.pixel_depth > 1 ||
+        header.layer_count > 1 || header.face_count != face_count ||
+        (face_count == 6 && header.pixel_width != header.pixel_height)) {
+        printf("KTX2 '%s': only single %s are supported here\n", path.c_str(), face_count == 6 ? "cubemaps" : "2D images");
+        return false;
+    }
+
+    uint32_t level_count = std::max(1u, header.level_count);
+    size_t index_offset = sizeof(KTX2_IDENTIFIER) + sizeof(KTX2Header);
+    if (index_offset + level_count * sizeof(KTX2LevelIndex) > file.size()) return false;
+
+    // Levels are views into the mapping, uploads read the file's pages directly
+    std::vector<std::vector<ImageLevel>> levels(face_count, std::vector<ImageLevel>(level_count));
+    for (uint32_t level = 0; level < level_count; ++level) {
+        KTX2LevelIndex index;
+        memcpy(&index, file.data() + index_offset + level * sizeof(KTX2LevelIndex), sizeof(index));
+
+        uint32_t w = std::max(1u, header.pixel_width >> level);
+        uint32_t h = std::max(1u, header.pixel_height >> level);
+        const size_t face_bytes = levelByteSize(*format, w, h);
+        if (index.byte_length != face_bytes * face_count ||
+            index.byte_offset + index.byte_length > file.size()) {
+            printf("KTX2 '%s': level %u is corrupt\n", path.c_str(), level);
+            return false;
+        }
+        for (uint32_t face = 0; face < face_count; ++face) {
+            const unsigned char* data = file.data() + index.byte_offset + face * face_bytes;
+            levels[face][level] = ImageLevel(data, face_bytes);
+        }
+    }
+
+    for (uint32_t face = 0; face < face_count; ++face) {
+        ImageData& image = images[face];
+        image = ImageData();
+        image.width = (int)header.pixel_width;
+        image.height = (int)header.pixel_height;
+        image.channels = format->has_alpha ? 4 : 3;
+
+        if (format->block_dim == 1) {
+            // Plain RGBA8: a full chain stays in levels, a lone base level becomes pixels
+            if (level_count > 1) {
+                image.levels = std::move(levels[face]);
+                image.mapping = mapping;
+            } else {
+                ImageData base = ImageData::allocate(image.width, image.height, 4);
+                memcpy(base.pixels, levels[face][0].data(), levels[face][0].size());
+                image = std::move(base);
+            }
+            continue;
+        }
+
+        image.compressed_format = format->gl_format;
+        image.levels = std::move(levels[face]);
+        image.mapping = mapping;
+    }
+    return true;
+}
+
+bool readKTX2(const std::string& path, ImageData& image) {
+    return readKTX2Faces(path, &image, 1);
+}
+
+bool readKTX2Cubemap(const std::string& path, ImageData faces[6]) {
+    return readKTX2Faces(path, faces, 6);
+}
+
+// ============================================================================
+// WRITE
+// ============================================================================
+
+// Basic data format descriptor (KDF 1.3) for the block formats we cook
+static std::vector<unsigned char> buildDFD(const KTX2Format& format) {
+    struct Sample { uint16_t bit_offset; uint8_t channel; uint8_t bit_length; };
+    std::vector<Sample> samples;
+    switch (format.df_model) {
+        case 1:   samples = { {0, 0, 7}, {8, 1, 7}, {16, 2, 7}, {24, 15, 7} }; break; // RGBA8
+        case 130: samples = { {0, 15, 63}, {64, 0, 63} }; break; // BC3: alpha block, then colour
+        case 132: samples = { {0, 0, 63}, {64, 1, 63} }; break;  // BC5: red, green
+        default:  samples = { {0, (uint8_t)(format.has_alpha ? 15 : 0), 63} }; break;
+    }
+    const bool blocks = format.block_dim > 1;
+
+    auto put32 = [](std::vector<unsigned char>& out, uint32_t v) {
+        for (int i = 0; i < 4; ++i) out.push_back((unsigned char)(v >> (i * 8)));
+    };
+
+    uint32_t block_size = 24 + 16 * (uint32_t)samples.size();
+    std::vector<unsigned char> dfd;
+    put32(dfd, 4 + block_size);                  // dfdTotalSize
+    put32(dfd, 0);                               // vendorId = Khronos, descriptorType = basic
+    put32(dfd, 2u | (block_size << 16));         // versionNumber = 2, descriptorBlockSize
+    dfd.push_back(format.df_model);              // colorModel
+    dfd.push_back(1);                            // colorPrimaries = BT709
+    dfd.push_back(1);                            // transferFunction = linear
+    dfd.push_back(0);                            // flags = straight alpha
+    if (blocks) dfd.insert(dfd.end(), {3, 3, 0, 0}); // 4x4x1x1 texel block
+    else dfd.insert(dfd.end(), {0, 0, 0, 0});
+    dfd.push_back((unsigned char)format.block_bytes);
+    dfd.insert(dfd.end(), 7, 0);                 // bytesPlane1-7
+
+    for (const Sample& s : samples) {
+        dfd.push_back((unsigned char)(s.bit_offset & 0xFF));
+        dfd.push_back((unsigned char)(s.bit_offset >> 8));
+        dfd.push_back(s.bit_length);             // bitLength - 1
+        dfd.push_back(s.channel);
+        dfd.insert(dfd.end(), 4, 0);             // samplePosition
+        put32(dfd, 0);                           // sampleLower
+        put32(dfd, blocks ? 0xFFFFFFFFu : 255u); // sampleUpper
+    }
+    return dfd;
+}
+
+static bool writeKTX2Faces(const std::string& path, const ImageData* images, uint32_t face_count) {
+    const ImageData& image = images[0];
+    for (uint32_t face = 0; face < face_count; ++face) {
+        const ImageData& other = images[face];
+        if (!other.valid() || other.width != image.width || other.height != image.height ||
+            other.compressed_format != image.compressed_format || other.levels.size() != image.levels.size()) return false;
+    }
+
+    // Uncompressed images are written as RGBA8, either the chain or just the base level
+    std::vector<std::vector<ImageLevel>> base_levels(face_count);
+    std::vector<const std::vector<ImageLevel>*> levels(face_count);
+    for (uint32_t face = 0; face < face_count; ++face) {
+        levels[face] = &images[face].levels;
+        if (!images[face].hasMipChain()) {
+            if (images[face].channels != 4) return false;
+            base_levels[face].emplace_back(images[face].pixels, (size_t)image.width * image.height * 4);
+            levels[face] = &base_levels[face];
+        }
+    }
+
+    const KTX2Format* format = findFormatByGL(image.isCompressed() ? image.compressed_format : GL_RGBA8);
+    if (!format) return false;
+
+    uint32_t level_count = (uint32_t)levels[0]->size();
+    std::vector<unsigned char> dfd = buildDFD(*format);
+
+    KTX2Header header = {};
+    header.vk_format = format->vk_format;
+    header.type_size = 1;
+    header.pixel_width = (uint32_t)image.width;
+    header.pixel_height = (uint32_t)image.height;
+    header.face_count = face_count;
+    header.level_count = level_count;
+    header.dfd_byte_offset = (uint32_t)(sizeof(KTX2_IDENTIFIER) + sizeof(KTX2Header) + level_count * sizeof(KTX2LevelIndex));
+    header.dfd_byte_length = (uint32_t)dfd.size();
+
+    // Mip data goes smallest level first, each aligned to the block size, faces in order within it
+    std::vector<KTX2LevelIndex> index(level_count);
+    uint64_t offset = header.dfd_byte_offset + header.dfd_byte_length;
+    for (int level = (int)level_count - 1; level >= 0; --level) {
+        offset = (offset + format->block_bytes - 1) / format->block_bytes * format->block_bytes;
+        index[level].byte_offset = offset;
+        index[level].byte_length = (*levels[0])[level].size() * face_count;
+        index[level].uncompressed_byte_length = index[level].byte_length;
+        offset += index[level].byte_length;
+    }
+
+    std::vector<unsigned char> bytes;
+    bytes.reserve((size_t)offset);
+    bytes.insert(bytes.end(), KTX2_IDENTIFIER, KTX2_IDENTIFIER + sizeof(KTX2_IDENTIFIER));
+    const unsigned char* h = reinterpret_cast<const unsigned char*>(&header);
+    bytes.insert(bytes.end(), h, h + sizeof(header));
+    const unsigned char* idx = reinterpret_cast<const unsigned char*>(index.data());
+    bytes.insert(bytes.end(), idx, idx + index.size() * sizeof(KTX2LevelIndex));
+    bytes.insert(bytes.end(), dfd.begin(), dfd.end());
+    for (int level = (int)level_count - 1; level >= 0; --level) {
+        bytes.resize((size_t)index[level].byte_offset, 0);
+        for (uint32_t face = 0; face < face_count; ++face) {
+            const ImageLevel& data = (*levels[face])[level];
+            bytes.insert(bytes.end(), data.data(), data.data() + data.size());
+        }
+    }
+
+    // Temp file + rename so a half-written cook is never picked up
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        if (!out) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool writeKTX2(const std::string& path, const ImageData& image) {
+    return writeKTX2Faces(path, &image, 1);
+}
+
+bool writeKTX2Cubemap(const std::string& path, const ImageData faces[6]) {
+    return writeKTX2Faces(path, faces, 6);
+}
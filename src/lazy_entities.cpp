@@ -0,0 +1,121 @@
+#include "lazy_entities.h"
+#include "asset_loader.h"
+#include "mesh_loader.h"
+#include "mesh.h"
+#include "gl_state.h"
+#include <cstdio>
+
+LazyEntities lazy_entities;
+
+std::shared_ptr<Mesh> LazyEntities::placeholderMesh() {
+    if (placeholder) return placeholder;
+
+    // A unit box, four vertices per face for flat normals, in the unpacked layout
+    static const glm::vec3 normals[6] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+    std::vector<float> vertices;
+    std::vector<uint16_t> indices;
+    for (const glm::vec3& normal : normals) {
+        const glm::vec3 tangent = std::abs(normal.y) > 0.5f ? glm::vec3(1, 0, 0) : glm::normalize(glm::cross(glm::vec3(0, 1, 0), normal));
+        const glm::vec3 bitangent = glm::cross(normal, tangent);
+        const uint16_t base = (uint16_t)(vertices.size() / MESH_FLOATS_PER_VERTEX);
+        for (int corner = 0; corner < 4; ++corner) {
+            const glm::vec2 uv((corner == 1 || corner == 2) ? 1.0f : 0.0f, corner >= 2 ? 1.0f : 0.0f);
+            const glm::vec3 position = 0.5f * normal + (uv.x - 0.5f) * tangent + (uv.y - 0.5f) * bitangent;
+            const float vertex[MESH_FLOATS_PER_VERTEX] = {
+                position.x, position.y, position.z, 1.0f, 1.0f, 1.0f, 1.0f, uv.x, uv.y,
+                normal.x, normal.y, normal.z, tangent.x, tangent.y, tangent.z, bitangent.x, bitangent.y, bitangent.z,
+            };
+            vertices.insert(vertices.end(), vertex, vertex + MESH_FLOATS_PER_VERTEX);
+        }
+        for (uint16_t index : { 0, 1, 2, 0, 2, 3 }) indices.push_back(base + index);
+    }
+
+    placeholder = std::make_shared<Mesh>();
+    placeholder->vertex_layout = getVertexLayout(VERTEX_HAS_COLOR);
+    placeholder->index_type = GL_UNSIGNED_SHORT;
+    placeholder->INDEX_COUNT = (unsigned int)indices.size();
+    placeholder->TRIANGLE_COUNT = (unsigned int)indices.size() / 3;
+    placeholder->bounds_min = glm::vec3(-0.5f);
+    placeholder->bounds_max = glm::vec3(0.5f);
+    placeholder->bounds_center = glm::vec3(0.0f);
+    placeholder->bounds_radius = glm::length(glm::vec3(0.5f));
+    placeholder->material = createDefaultMaterial();
+    placeholder->material.name = "lazy placeholder";
+    placeholder->material.base_color = LAZY_PLACEHOLDER_COLOR;
+    uploadMeshBuffers(*placeholder, vertices.data(), vertices.size() * sizeof(float), indices.data(), indices.size() * sizeof(uint16_t));
+    mesh_pool.create(*placeholder);
+    gl_state.bindVertexArray(0);
+    return placeholder;
+}
+
+std::vector<EntityHandle> LazyEntities::create(const std::shared_ptr<MeshRequest>& request, LazyTemplateFn build,
+                                               const std::vector<EntityTransform>& transforms) {
+    asset_loader.require(request);
+    if (request->ready) {
+        if (request->failed) return {};
+        return createEntities(build(request->meshes), transforms);
+    }
+
+    EntityTemplate placeholder_template;
+    placeholder_template.name = "placeholder " + request->filepath;
+    placeholder_template.lod_specs = { { 1000.0f, { placeholderMesh() } } };
+    placeholder_template.cull_modes = { CULL_BACK };
+
+    Waiting entry;
+    entry.request = request;
+    entry.build = std::move(build);
+    entry.placeholders = createEntities(placeholder_template, transforms);
+    waiting.push_back(std::move(entry));
+    return waiting.back().placeholders;
+}
+
+void LazyEntities::update() {
+    for (size_t w = 0; w < waiting.size();) {
+        Waiting& entry = waiting[w];
+        if (!entry.request->ready) {
+            ++w;
+            continue;
+        }
+
+        // Where the surviving placeholders stand now, and their current slots for one removal pass
+        std::vector<EntityTransform> transforms;
+        std::vector<uint8_t> doomed;
+        for (EntityHandle handle : entry.placeholders) {
+            const Entity* entity = entity_manager.get(handle);
+            if (!entity) continue;
+            transforms.push_back({ entity->position, entity->rotation, entity->scale });
+            const size_t index = entity_manager.indexOf(handle);
+            if (index >= doomed.size()) doomed.resize(index + 1, 0);
+            doomed[index] = 1;
+        }
+        if (!doomed.empty()) {
+            entity_manager.removeEntities([&doomed](const Entity& entity) {
+                const size_t index = entity_manager.indexOf(&entity);
+                return index < doomed.size() && doomed[index] != 0;
+            });
+        }
+
+        if (entry.request->failed) {
+            printf("'%s' failed to load, dropped %zu placeholders\n", entry.request->filepath.c_str(), transforms.size());
+        } else if (!transforms.empty()) {
+            createEntities(entry.build(entry.request->meshes), transforms);
+        }
+        waiting.erase(waiting.begin() + w);
+    }
+
+    // Nothing waits on a placeholder any more
+    if (waiting.empty() && placeholder && placeholder.use_count() == 1) placeholder.reset();
+}
+
+void LazyEntities::release() {
+    waiting.clear();
+    placeholder.reset();
+}
+
+size_t LazyEntities::placeholderCount() const {
+    size_t count = 0;
+    for (const Waiting& entry : waiting) {
+        for (EntityHandle handle : entry.placeholders) count += entity_manager.isValid(handle) ? 1 : 0;
+    }
+    return count;
+}
@@ -1,8 +1,74 @@
 #include "light.h"
 #include <cstdio>
+#include <cmath>
+#include <algorithm>
 #include <glm/gtx/euler_angles.hpp>
 
 std::vector<Light> lights;
+static std::vector<GpuLight> gpu_lights;
+static size_t dirty_begin = 0, dirty_end = 0;
+
+static GpuLight packLight(const Light& light, int frame_index) {
+    GpuLight gpu;
+    gpu.position = glm::vec4(light.position, (float)light.type);
+    gpu.color = glm::vec4(light.color, (float)light.intensity);
+    gpu.direction = glm::vec4(light.direction, light.inner_cutoff_cos);
+    gpu.cutoff = glm::vec4(light.outer_cutoff_cos, (float)frame_index, lightRange(light), light.baked ? 1.0f : 0.0f);
+    return gpu;
+}
+
+const std::vector<GpuLight>& gpuLights() {
+    return gpu_lights;
+}
+
+void markLightDirty(size_t index) {
+    if (index >= lights.size()) return;
+    if (gpu_lights.size() < lights.size()) {
+        // New lights start unshadowed, the frame slots are handed out per frame
+        GpuLight unshadowed;
+        unshadowed.cutoff.y = -1.0f;
+        gpu_lights.resize(lights.size(), unshadowed);
+    }
+    // Keeps the frame slot, only updateFrameUniforms() moves that
+    gpu_lights[index] = packLight(lights[index], (int)gpu_lights[index].cutoff.y);
+
+    if (dirty_begin == dirty_end) {
+        dirty_begin = index;
+        dirty_end = index + 1;
+    } else {
+        dirty_begin = std::min(dirty_begin, index);
+        dirty_end = std::max(dirty_end, index + 1);
+    }
+}
+
+void takeDirtyLights(size_t& begin, size_t& end) {
+    begin = dirty_begin;
+    end = dirty_end;
+    dirty_begin = dirty_end = 0;
+}
+
+void setLightFrameIndex(size_t index, int frame_index) {
+    if (index >= gpu_lights.size() || gpu_lights[index].cutoff.y == (float)frame_index) return;
+    gpu_lights[index].cutoff.y = (float)frame_index;
+    markLightDirty(index);
+}
+
+void setLightBaked(size_t index, bool baked) {
+    if (index >= lights.size() || lights[index].baked == baked) return;
+    lights[index].baked = baked;
+    markLightDirty(index);
+}
+
+static LightHandle addLight(const Light& light) {
+    lights.push_back(light);
+    markLightDirty(lights.size() - 1);
+    return LightHandle{ (uint32_t)(lights.size() - 1) };
+}
+
+float lightRange(const Light& light) {
+    const float peak = (float)light.intensity * std::max(light.color.r, std::max(light.color.g, light.color.b));
+    return std::clamp(std::sqrt(std::max(peak, 0.0f) / LIGHT_CUTOFF_RADIANCE), LIGHT_MIN_RANGE, LIGHT_MAX_RANGE);
+}
 
 glm::vec3 convertVecToEuler(glm::vec3 direction, glm::vec3 offset) {
     glm::mat4 rotationMatrix = glm::inverse(glm::lookAt(glm::vec3(0, 0, 0), direction, glm::vec3(0.0f, 1.0f, 0.0f)));
@@ -12,7 +78,7 @@ glm::vec3 convertVecToEuler(glm::vec3 direction, glm::vec3 offset) {
     return euler_rot;
 }
 
-void createDirLight(std::string name, glm::vec3 direction, glm::vec3 color, int intensity) {
+LightHandle createDirLight(std::string name, glm::vec3 direction, glm::vec3 color, int intensity) {
     Light light;
     light.color = color;
     light.intensity = intensity;
@@ -24,14 +90,15 @@ void createDirLight(std::string name, glm::vec3 direction, glm::vec3 color, int
 
     if (lights.size() >= MAX_LIGHTS) {
         printf("Warning: Exceeded maximum number of lights (%d). Additional lights will be ignored in shaders.\n", MAX_LIGHTS);
-        return;
+        return {};
     }
 
-    lights.push_back(light);
+    LightHandle handle = addLight(light);
     printf("Created directional light '%s'\n", name.c_str());
+    return handle;
 }
 
-void createSpotlight(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs, glm::vec3 position, glm::vec3 color, int intensity,
+LightHandle createSpotlight(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs, glm::vec3 position, glm::vec3 color, int intensity,
                     glm::vec3 direction, float inner_angle_deg, float outer_angle_deg,
                     glm::vec3 scale, std::vector<int> cull_mode) {
     Light light;
@@ -46,17 +113,21 @@ void createSpotlight(std::string name, const std::vector<std::pair<float, std::v
 
     if (lights.size() >= MAX_LIGHTS) {
         printf("Warning: Exceeded maximum number of lights (%d). Additional lights will be ignored in shaders.\n", MAX_LIGHTS);
-        return;
+        return {};
     }
 
-    lights.push_back(light);
+    LightHandle handle = addLight(light);
     glm::vec3 rotation = convertVecToEuler(light.direction, glm::vec3(0.0f));
 
-    if (!lodSpecs.empty()) createEntity(light.entity_name, lodSpecs, light.position, rotation, scale, cull_mode);
+    if (!lodSpecs.empty()) {
+        lights.back().entity = createEntity(light.entity_name, lodSpecs, light.position, rotation, scale, cull_mode);
+        entity_manager.setLightProxy(lights.back().entity);
+    }
     printf("Created spotlight '%s' with cone angles %.1f-%.1f degrees\n", name.c_str(), inner_angle_deg, outer_angle_deg);
+    return handle;
 }
 
-void createPointLight(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs,
+LightHandle createPointLight(std::string name, const std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>& lodSpecs,
                       glm::vec3 position, glm::vec3 color, int intensity,
                       glm::vec3 scale, std::vector<int> cull_mode) {
     Light light;
@@ -72,39 +143,61 @@ void createPointLight(std::string name, const std::vector<std::pair<float, std::
 
     if (lights.size() >= MAX_LIGHTS) {
         printf("Warning: Exceeded maximum number of lights (%d). Additional lights will be ignored in shaders.\n", MAX_LIGHTS);
-        return;
+        return {};
     }
 
-    lights.push_back(light);
-    if (!lodSpecs.empty()) createEntity(light.entity_name, lodSpecs, position, glm::vec3(0.0f), scale, cull_mode);
+    LightHandle handle = addLight(light);
+    if (!lodSpecs.empty()) {
+        lights.back().entity = createEntity(light.entity_name, lodSpecs, position, glm::vec3(0.0f), scale, cull_mode);
+        entity_manager.setLightProxy(lights.back().entity);
+    }
     printf("Created point light '%s' with intensity %d\n", name.c_str(), intensity);
+    return handle;
 }
 
-void updateLight(std::string name, glm::vec3 position, glm::vec3 color, int intensity, glm::vec3 rotation) {
-    int lightIndex = -1;
+LightHandle findLight(const std::string& name) {
     for (size_t i = 0; i < lights.size(); i++) {
-        if (lights[i].entity_name == name) {
-            lightIndex = i;
-            break;
-        }
+        if (lights[i].entity_name == name) return LightHandle{ (uint32_t)i };
     }
+    return {};
+}
+
+void updateLight(LightHandle handle, glm::vec3 position, glm::vec3 color, int intensity, glm::vec3 rotation) {
+    if (handle.isNull() || handle.index >= lights.size()) return;
+    Light& light = lights[handle.index];
+
+    if (!std::isnan(position.x)) light.position.x = position.x;
+    if (!std::isnan(position.y)) light.position.y = position.y;
+    if (!std::isnan(position.z)) light.position.z = position.z;
     
-    if (lightIndex == -1) {
+    if (!std::isnan(color.r)) light.color.r = color.r;
+    if (!std::isnan(color.g)) light.color.g = color.g;
+    if (!std::isnan(color.b)) light.color.b = color.b;
+    
+    if (intensity >= 0) light.intensity = intensity;
+
+    if (!std::isnan(rotation.x) && !std::isnan(rotation.y) && !std::isnan(rotation.z)) {
+        light.direction = glm::normalize(rotation);
+    }
+    markLightDirty(handle.index);
+}
+
+void updateLight(const std::string& name, glm::vec3 position, glm::vec3 color, int intensity, glm::vec3 rotation) {
+    LightHandle handle = findLight(name);
+    if (handle.isNull()) {
         printf("Warning: Light '%s' not found\n", name.c_str());
         return;
     }
-    
-    if (!isnan(position.x)) lights[lightIndex].position.x = position.x;
-    if (!isnan(position.y)) lights[lightIndex].position.y = position.y;
-    if (!isnan(position.z)) lights[lightIndex].position.z = position.z;
-    
-    if (!isnan(color.r)) lights[lightIndex].color.r = color.r;
-    if (!isnan(color.g)) lights[lightIndex].color.g = color.g;
-    if (!isnan(color.b)) lights[lightIndex].color.b = color.b;
-    
-    if (intensity >= 0) lights[lightIndex].intensity = intensity;
+    updateLight(handle, position, color, intensity, rotation);
+}
 
-    if (!isnan(rotation.x) && !isnan(rotation.y) && !isnan(rotation.z)) {
-        lights[lightIndex].direction = glm::normalize(rotation);
+void syncLightsToProxies() {
+    for (size_t i = 0; i < lights.size(); ++i) {
+        Light& light = lights[i];
+        if (entity_manager.getParent(light.entity).isNull()) continue;
+        const glm::vec3 position(entity_manager.worldMatrices()[entity_manager.indexOf(light.entity)][3]);
+        if (position == light.position) continue;
+        light.position = position;
+        markLightDirty(i);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,284 @@
+#include "light_clusters.h"
+#include "frame_uniforms.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "job_system.h"
+#include "profiler.h"
+#include "shader_loading.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+std::string buildAssetPath(const std::string& relative_path);
+
+bool use_gpu_light_clusters = false;
+
+LightClusters::~LightClusters() {
+    release();
+}
+
+void LightClusters::release() {
+    if (cpu_pending) {
+        job_system.wait(cpu_job);
+        cpu_pending = false;
+    }
+    for (GLuint* texture : { &light_texture, &grid_texture, &index_texture }) {
+        if (*texture != 0) { glDeleteTextures(1, texture); *texture = 0; }
+    }
+    for (GLuint* buffer : { &sphere_buffer, &bounds_buffer, &grid_buffer, &index_buffer, &counter_buffer }) {
+        if (*buffer != 0) { glDeleteBuffers(1, buffer); *buffer = 0; }
+    }
+    initialized = false;
+    lights_uploaded = false;
+}
+
+// Integer textures can't filter, the float one is only ever fetched too
+static GLuint createDataTexture(GLint internal_format, GLenum format, GLenum type, int width, int height) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+bool LightClusters::init() {
+    light_texture = createDataTexture(GL_RGBA32F, GL_RGBA, GL_FLOAT, 4, CLUSTER_MAX_LIGHTS);
+    grid_texture = createDataTexture(GL_RG32UI, GL_RG_INTEGER, GL_UNSIGNED_INT, CLUSTER_X * CLUSTER_Y, CLUSTER_Z);
+    index_texture = createDataTexture(GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, CLUSTER_INDEX_WIDTH,
+                                      CLUSTER_MAX_INDICES / CLUSTER_INDEX_WIDTH);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+
+    grid.assign(CLUSTER_COUNT, glm::uvec2(0));
+    slice_lights.resize(CLUSTER_Z);
+    slice_indices.resize(CLUSTER_Z);
+    initialized = true;
+    printf("Light clusters: %dx%dx%d, up to %d lights\n", CLUSTER_X, CLUSTER_Y, CLUSTER_Z, CLUSTER_MAX_LIGHTS);
+    return true;
+}
+
+void LightClusters::buildBounds(const glm::mat4& projection, float near_plane, float far_plane) {
+    bounds_projection = projection;
+    bounds_near = near_plane;
+    bounds_far = far_plane;
+    bounds_uploaded = false;
+
+    const float logRatio = std::log(far_plane / near_plane);
+    depth_scale = (float)CLUSTER_Z / logRatio;
+    depth_bias = -(float)CLUSTER_Z * std::log(near_plane) / logRatio;
+
+    // Each tile corner's ray through the near plane, scaled to the slice depths
+    const glm::mat4 inverseProjection = glm::inverse(projection);
+    auto cornerRay = [&](int x, int y) {
+        glm::vec4 point = inverseProjection * glm::vec4(2.0f * x / CLUSTER_X - 1.0f, 2.0f * y / CLUSTER_Y - 1.0f, -1.0f, 1.0f);
+        glm::vec3 onNear = glm::vec3(point) / point.w;
+        return onNear / -onNear.z; // At view depth 1
+    };
+
+    bounds.resize(CLUSTER_COUNT);
+    for (int z = 0; z < CLUSTER_Z; ++z) {
+        const float sliceNear = near_plane * std::pow(far_plane / near_plane, (float)z / CLUSTER_Z);
+        const float sliceFar = near_plane * std::pow(far_plane / near_plane, (float)(z + 1) / CLUSTER_Z);
+        for (int y = 0; y < CLUSTER_Y; ++y) {
+            for (int x = 0; x < CLUSTER_X; ++x) {
+                glm::vec3 lo(1e30f), hi(-1e30f);
+                for (int corner = 0; corner < 4; ++corner) {
+                    const glm::vec3 ray = cornerRay(x + (corner & 1), y + (corner >> 1));
+                    for (float depth : { sliceNear, sliceFar }) {
+                        lo = glm::min(lo, ray * depth);
+                        hi = glm::max(hi, ray * depth);
+                    }
+                }
+                ClusterBounds& box = bounds[(z * CLUSTER_Y + y) * CLUSTER_X + x];
+                box.min = glm::vec4(lo, 0.0f);
+                box.max = glm::vec4(hi, 0.0f);
+            }
+        }
+    }
+}
+
+void LightClusters::uploadLights(const std::vector<GpuLight>& lights, size_t begin, size_t end) {
+    if (!initialized && !init()) return;
+    if (!lights_uploaded) {
+        begin = 0;
+        end = lights.size();
+        lights_uploaded = true;
+    }
+    end = std::min<size_t>(end, std::min<size_t>(lights.size(), CLUSTER_MAX_LIGHTS));
+    if (begin >= end) return;
+
+    gl_state.bindTexture(0, GL_TEXTURE_2D, light_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint)begin, 4, (GLsizei)(end - begin), GL_RGBA, GL_FLOAT, lights.data() + begin);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+}
+
+void LightClusters::update(const std::vector<GpuLight>& lights, const uint32_t* visible, size_t visible_count,
+                           const glm::mat4& view, const glm::mat4& projection, float near_plane, float far_plane) {
+    finish();
+    if (!initialized && !init()) return;
+    if (projection != bounds_projection || near_plane != bounds_near || far_plane != bounds_far) {
+        buildBounds(projection, near_plane, far_plane);
+    }
+
+    // View-space spheres by scene index, spot lights keep their full range. The rest get a
+    // negative radius and reach nothing.
+    const size_t scene_count = std::min<size_t>(lights.size(), CLUSTER_MAX_LIGHTS);
+    spheres.assign(scene_count, glm::vec4(0.0f, 0.0f, 0.0f, -1.0f));
+    light_count = 0;
+    for (size_t v = 0; v < visible_count; ++v) {
+        const uint32_t i = visible[v];
+        if (i >= scene_count) continue;
+        spheres[i] = glm::vec4(glm::vec3(view * glm::vec4(glm::vec3(lights[i].position), 1.0f)), lights[i].cutoff.z);
+        light_count++;
+    }
+
+    const bool gpu = use_gpu_light_clusters && gl_extensions.compute_shader && !gpu_failed && assignOnGpu(spheres);
+    if (gpu) {
+        gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+        return;
+    }
+    cpu_pending = true;
+    // Not spawn(): the shadow pass' short waits would pop it off this thread's own queue
+    job_system.spawnLong([this]() { assignOnCpu(); }, cpu_job);
+}
+
+void LightClusters::finish() {
+    if (!cpu_pending) return;
+    {
+        PROFILE_SCOPE("light clusters wait");
+        job_system.wait(cpu_job);
+    }
+    cpu_pending = false;
+    uploadCpuAssignment();
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+}
+
+void LightClusters::assignOnCpu() {
+    // Bin the lights by the slices their depth range covers
+    for (auto& list : slice_lights) list.clear();
+    for (uint32_t i = 0; i < (uint32_t)spheres.size(); ++i) {
+        if (spheres[i].w < 0.0f) continue;
+        const float nearDepth = -spheres[i].z - spheres[i].w;
+        const float farDepth = -spheres[i].z + spheres[i].w;
+        if (farDepth <= bounds_near || nearDepth >= bounds_far) continue;
+        const int first = std::max(0, (int)std::floor(std::log(std::max(nearDepth, bounds_near)) * depth_scale + depth_bias));
+        const int last = std::min(CLUSTER_Z - 1, (int)std::floor(std::log(std::min(farDepth, bounds_far)) * depth_scale + depth_bias));
+        for (int z = first; z <= last; ++z) slice_lights[z].push_back(i);
+    }
+
+    // Each slice fills its clusters' counts and lists on its own
+    job_system.parallelFor(CLUSTER_Z, 1, [&](size_t begin, size_t end) {
+        for (size_t z = begin; z < end; ++z) {
+            std::vector<uint32_t>& list = slice_indices[z];
+            list.clear();
+            for (int c = 0; c < CLUSTER_X * CLUSTER_Y; ++c) {
+                const size_t cluster = z * CLUSTER_X * CLUSTER_Y + c;
+                const glm::vec3 lo(bounds[cluster].min), hi(bounds[cluster].max);
+                const uint32_t start = (uint32_t)list.size();
+                for (uint32_t i : slice_lights[z]) {
+                    const glm::vec3 center(spheres[i]);
+                    const glm::vec3 d = glm::clamp(center, lo, hi) - center;
+                    if (glm::dot(d, d) <= spheres[i].w * spheres[i].w) list.push_back(i);
+                }
+                grid[cluster] = glm::uvec2(start, (uint32_t)list.size() - start); // Offset made global below
+            }
+        }
+    });
+
+    // Slices back to back, cut off at the index list's capacity
+    indices.clear();
+    max_cluster_lights = 0;
+    for (int z = 0; z < CLUSTER_Z; ++z) {
+        const uint32_t sliceOffset = (uint32_t)indices.size();
+        const uint32_t room = CLUSTER_MAX_INDICES - sliceOffset;
+        const std::vector<uint32_t>& list = slice_indices[z];
+        indices.insert(indices.end(), list.begin(), list.begin() + std::min<size_t>(list.size(), room));
+        for (int c = 0; c < CLUSTER_X * CLUSTER_Y; ++c) {
+            glm::uvec2& entry = grid[z * CLUSTER_X * CLUSTER_Y + c];
+            max_cluster_lights = std::max(max_cluster_lights, (int)entry.y);
+            entry.y = std::min(entry.y, entry.x < room ? room - entry.x : 0u);
+            entry.x += sliceOffset;
+        }
+    }
+    index_count = (int)indices.size();
+    if (index_count > 0) {
+        // Whole rows, the tail of the last one is never read
+        const int rows = (index_count + CLUSTER_INDEX_WIDTH - 1) / CLUSTER_INDEX_WIDTH;
+        indices.resize((size_t)rows * CLUSTER_INDEX_WIDTH, 0);
+    }
+}
+
+void LightClusters::uploadCpuAssignment() {
+    gl_state.bindTexture(0, GL_TEXTURE_2D, grid_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_X * CLUSTER_Y, CLUSTER_Z, GL_RG_INTEGER, GL_UNSIGNED_INT, grid.data());
+    if (index_count > 0) {
+        const int rows = (index_count + CLUSTER_INDEX_WIDTH - 1) / CLUSTER_INDEX_WIDTH;
+        gl_state.bindTexture(0, GL_TEXTURE_2D, index_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_INDEX_WIDTH, rows, GL_RED_INTEGER, GL_UNSIGNED_INT, indices.data());
+    }
+}
+
+static void uploadStorage(GLuint& buffer, const void* data, size_t bytes) {
+    if (buffer == 0) glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(bytes, 16), data, GL_DYNAMIC_DRAW);
+}
+
+bool LightClusters::assignOnGpu(const std::vector<glm::vec4>& spheres) {
+    if (!assign_shader) {
+        try {
+            std::string source = loadShaderFile(buildAssetPath("res/shaders/light_clusters.comp"), "#version 430 core\n");
+            assign_shader = std::make_unique<Shader>(source);
+        } catch (const std::exception& e) {
+            printf("GPU light clusters disabled, assigning on the CPU: %s\n", e.what());
+            gpu_failed = true;
+            return false;
+        }
+        uploadStorage(grid_buffer, nullptr, sizeof(glm::uvec2) * CLUSTER_COUNT);
+        uploadStorage(index_buffer, nullptr, sizeof(uint32_t) * CLUSTER_MAX_INDICES);
+    }
+    if (!bounds_uploaded) {
+        uploadStorage(bounds_buffer, bounds.data(), bounds.size() * sizeof(ClusterBounds));
+        bounds_uploaded = true;
+    }
+    uploadStorage(sphere_buffer, spheres.data(), spheres.size() * sizeof(glm::vec4));
+    const uint32_t zero = 0;
+    uploadStorage(counter_buffer, &zero, sizeof(zero));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sphere_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bounds_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, grid_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, index_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, counter_buffer);
+    assign_shader->use();
+    glUniform1ui(assign_shader->getUniformLocation("lightCount"), (GLuint)spheres.size());
+    gl_extensions.DispatchCompute((CLUSTER_COUNT + CLUSTER_GROUP_SIZE - 1) / CLUSTER_GROUP_SIZE, 1, 1);
+    gl_extensions.MemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT);
+
+    // Buffer to texture copies stay on the GPU. The whole index list goes, its used length is
+    // only known there.
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, grid_buffer);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, grid_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_X * CLUSTER_Y, CLUSTER_Z, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, index_buffer);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, index_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_INDEX_WIDTH, CLUSTER_MAX_INDICES / CLUSTER_INDEX_WIDTH,
+                    GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    index_count = 0; // Not read back
+    max_cluster_lights = 0;
+    return true;
+}
+
+void LightClusters::bind(int first_unit) {
+    finish();
+    gl_state.bindTexture(first_unit, GL_TEXTURE_2D, light_texture);
+    gl_state.bindTexture(first_unit + 1, GL_TEXTURE_2D, grid_texture);
+    gl_state.bindTexture(first_unit + 2, GL_TEXTURE_2D, index_texture);
+}
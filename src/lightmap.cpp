@@ -0,0 +1,323 @@
+#include "lightmap.h"
+#include "mesh_loader.h"
+#include "mesh_registry.h"
+#include "frame_uniforms.h"
+#include "filesystem.h"
+#include "shader_loading.h"
+#include "gl_state.h"
+#include "scene_target.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <initializer_list>
+#include <mutex>
+#include <unordered_set>
+
+bool use_lightmaps = true;
+LightmapAtlas lightmap_atlas;
+
+// ============================================================================
+// IMPORT: LIGHTMAP UVS
+// ============================================================================
+
+static std::mutex requested_mutex;
+static std::unordered_set<std::string> requested_paths;
+
+void requestLightmapUVs(const std::string& filepath) {
+    std::lock_guard<std::mutex> lock(requested_mutex);
+    requested_paths.insert(MeshRegistry::normalizePath(filepath));
+}
+
+bool wantsLightmapUVs(const std::string& filepath) {
+    std::lock_guard<std::mutex> lock(requested_mutex);
+    return requested_paths.count(MeshRegistry::normalizePath(filepath)) != 0;
+}
+
+namespace {
+
+struct Chart {
+    std::vector<uint32_t> triangles;
+    int axis = 0; // Dominant normal axis, dropped by the projection
+    glm::vec2 min{FLT_MAX}, max{-FLT_MAX};
+    int x = 0, y = 0; // Packed corner in texels, padding included
+};
+
+uint32_t findRoot(std::vector<uint32_t>& parent, uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+glm::vec2 projectToAxis(const glm::vec3& p, int axis) {
+    if (axis == 0) return glm::vec2(p.z, p.y);
+    if (axis == 1) return glm::vec2(p.x, p.z);
+    return glm::vec2(p.x, p.y);
+}
+
+int chartTexels(float extent, float scale) {
+    return std::max(1, (int)std::ceil(extent * scale)) + 2 * LIGHTMAP_PADDING;
+}
+
+// Shelves filled tallest chart first, false once a shelf runs off the layer
+bool packCharts(std::vector<Chart>& charts, const std::vector<uint32_t>& order, float scale) {
+    int cursor_x = 0, shelf_y = 0, shelf_height = 0;
+    for (uint32_t index : order) {
+        Chart& chart = charts[index];
+        const int width = chartTexels(chart.max.x - chart.min.x, scale);
+        const int height = chartTexels(chart.max.y - chart.min.y, scale);
+        if (width > LIGHTMAP_SIZE) return false;
+        if (cursor_x + width > LIGHTMAP_SIZE) {
+            shelf_y += shelf_height;
+            cursor_x = 0;
+            shelf_height = 0;
+        }
+        if (shelf_y + height > LIGHTMAP_SIZE) return false;
+        chart.x = cursor_x;
+        chart.y = shelf_y;
+        cursor_x += width;
+        shelf_height = std::max(shelf_height, height);
+    }
+    return true;
+}
+
+} // namespace
+
+bool generateLightmapUVs(const char* name, SubMeshStaging& sub) {
+    const VertexLayout layout = getVertexLayout(sub.vertex_format);
+    const size_t vertex_count = sub.vertices.size() / layout.stride;
+    const size_t triangle_count = sub.indices.size() / 3;
+    if ((sub.vertex_format & VERTEX_LIGHTMAP_UV) || triangle_count == 0) return false;
+
+    // Every layout starts with a float3 position
+    auto position = [&](uint32_t vertex) {
+        glm::vec3 p;
+        memcpy(&p, &sub.vertices[(size_t)vertex * layout.stride], sizeof(p));
+        return p;
+    };
+
+    // Charts are the triangles joined through shared vertices that face the same axis direction,
+    // so a chart's projection never folds over itself on ordinary geometry
+    std::vector<uint32_t> parent(triangle_count);
+    std::vector<uint8_t> direction(triangle_count);
+    std::vector<uint32_t> first_user(vertex_count * 6, UINT32_MAX);
+    for (uint32_t t = 0; t < triangle_count; ++t) {
+        parent[t] = t;
+        const uint32_t* tri = &sub.indices[(size_t)t * 3];
+        glm::vec3 n = glm::cross(position(tri[1]) - position(tri[0]), position(tri[2]) - position(tri[0]));
+        glm::vec3 a = glm::abs(n);
+        int axis = a.x >= a.y && a.x >= a.z ? 0 : a.y >= a.z ? 1 : 2;
+        direction[t] = (uint8_t)(axis * 2 + (n[axis] < 0.0f ? 1 : 0));
+
+        for (int k = 0; k < 3; ++k) {
+            uint32_t& first = first_user[(size_t)tri[k] * 6 + direction[t]];
+            if (first == UINT32_MAX) first = t;
+            else parent[findRoot(parent, t)] = findRoot(parent, first);
+        }
+    }
+
+    std::vector<Chart> charts;
+    std::vector<uint32_t> chart_of_root(triangle_count, UINT32_MAX);
+    for (uint32_t t = 0; t < triangle_count; ++t) {
+        uint32_t root = findRoot(parent, t);
+        if (chart_of_root[root] == UINT32_MAX) {
+            chart_of_root[root] = (uint32_t)charts.size();
+            charts.emplace_back();
+            charts.back().axis = direction[t] / 2;
+        }
+        Chart& chart = charts[chart_of_root[root]];
+        chart.triangles.push_back(t);
+        for (int k = 0; k < 3; ++k) {
+            glm::vec2 p = projectToAxis(position(sub.indices[(size_t)t * 3 + k]), chart.axis);
+            chart.min = glm::min(chart.min, p);
+            chart.max = glm::max(chart.max, p);
+        }
+    }
+
+    // Even at a single texel each, this many charts don't fit
+    const size_t smallest = 1 + 2 * LIGHTMAP_PADDING;
+    if (charts.size() > (size_t)(LIGHTMAP_SIZE / smallest) * (LIGHTMAP_SIZE / smallest)) {
+        printf("Lightmap UVs for '%s' skipped: %zu charts don't fit one layer\n", name, charts.size());
+        return false;
+    }
+
+    // One texel density for the whole sub-mesh, starting from a guess at the packing efficiency
+    // and shrinking until the shelves fit
+    double area = 0.0;
+    for (const Chart& chart : charts) area += (double)(chart.max.x - chart.min.x) * (chart.max.y - chart.min.y);
+    std::vector<uint32_t> order(charts.size());
+    for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return charts[a].max.y - charts[a].min.y > charts[b].max.y - charts[b].min.y;
+    });
+    float scale = area > 0.0 ? (float)std::sqrt(0.7 * LIGHTMAP_SIZE * LIGHTMAP_SIZE / area) : 1.0f;
+    bool packed = false;
+    for (int attempt = 0; attempt < 64 && !packed; ++attempt) {
+        packed = packCharts(charts, order, scale);
+        if (!packed) scale *= 0.9f;
+    }
+    if (!packed) {
+        printf("Lightmap UVs for '%s' skipped: charts don't pack\n", name);
+        return false;
+    }
+
+    // Vertices on chart borders are duplicated, one copy per chart. The new layout is the old one
+    // with the lightmap uv appended, so each vertex copies over whole.
+    const uint32_t format = sub.vertex_format | VERTEX_LIGHTMAP_UV;
+    const VertexLayout out_layout = getVertexLayout(format);
+    std::vector<unsigned char> vertices;
+    vertices.reserve(sub.vertices.size() / layout.stride * out_layout.stride);
+    std::vector<uint32_t> remap(vertex_count, 0);
+    std::vector<uint32_t> remap_chart(vertex_count, UINT32_MAX);
+    uint32_t out_count = 0;
+    for (uint32_t c = 0; c < charts.size(); ++c) {
+        const Chart& chart = charts[c];
+        for (uint32_t t : chart.triangles) {
+            for (int k = 0; k < 3; ++k) {
+                unsigned int& index = sub.indices[(size_t)t * 3 + k];
+                if (remap_chart[index] != c) {
+                    remap_chart[index] = c;
+                    remap[index] = out_count++;
+
+                    glm::vec2 p = projectToAxis(position(index), chart.axis);
+                    glm::vec2 uv = (glm::vec2(chart.x, chart.y) + glm::vec2((float)LIGHTMAP_PADDING) +
+                                    (p - chart.min) * scale) / (float)LIGHTMAP_SIZE;
+                    const size_t at = vertices.size();
+                    vertices.resize(at + out_layout.stride);
+                    memcpy(&vertices[at], &sub.vertices[(size_t)index * layout.stride], layout.stride);
+                    if (format & VERTEX_PACKED) {
+                        uint16_t packed_uv[2] = { (uint16_t)std::lround(glm::clamp(uv.x, 0.0f, 1.0f) * 65535.0f),
+                                                  (uint16_t)std::lround(glm::clamp(uv.y, 0.0f, 1.0f) * 65535.0f) };
+                        memcpy(&vertices[at + out_layout.lightmap_uv_offset], packed_uv, sizeof(packed_uv));
+                    } else {
+                        memcpy(&vertices[at + out_layout.lightmap_uv_offset], &uv, sizeof(uv));
+                    }
+                }
+                index = remap[index];
+            }
+        }
+    }
+
+    printf("Lightmap UVs for '%s': %zu charts, %zu -> %u vertices\n", name, charts.size(), vertex_count, out_count);
+    sub.vertices = std::move(vertices);
+    sub.vertex_format = format;
+    return true;
+}
+
+// ============================================================================
+// ATLAS
+// ============================================================================
+
+LightmapAtlas::~LightmapAtlas() {
+    release();
+}
+
+void LightmapAtlas::release() {
+    for (GLuint* texture : { &texture, &scratch_texture, &lights_texture }) {
+        if (*texture != 0) { glDeleteTextures(1, texture); *texture = 0; }
+    }
+    for (GLuint* fbo : { &scratch_fbo, &layer_fbo }) {
+        if (*fbo != 0) { glDeleteFramebuffers(1, fbo); *fbo = 0; }
+    }
+    if (vao != 0) { glDeleteVertexArrays(1, &vao); vao = 0; }
+    dilate_shader.reset();
+    lights_capacity = 0;
+    layer_count = 0;
+}
+
+bool LightmapAtlas::init() {
+    try {
+        dilate_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/hiz.vs")),
+                                                 loadShaderFile(buildAssetPath("res/shaders/lightmap_dilate.fs")));
+    } catch (const std::exception& e) {
+        printf("Lightmap baking disabled: %s\n", e.what());
+        return false;
+    }
+    dilate_shader->use();
+    dilate_shader->setInt("radius", LIGHTMAP_PADDING);
+    glGenVertexArrays(1, &vao);
+
+    glGenTextures(1, &scratch_texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, scratch_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, LIGHTMAP_SIZE, LIGHTMAP_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &scratch_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, scratch_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scratch_texture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Lightmap bake target incomplete (0x%x)\n", status);
+        return false;
+    }
+    glGenFramebuffers(1, &layer_fbo);
+    return true;
+}
+
+bool LightmapAtlas::begin(int new_layer_count) {
+    if (failed) return false;
+    if (!dilate_shader && !init()) {
+        release();
+        failed = true;
+        return false;
+    }
+
+    if (texture != 0) glDeleteTextures(1, &texture);
+    layer_count = std::min(new_layer_count, LIGHTMAP_MAX_LAYERS);
+    glGenTextures(1, &texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, LIGHTMAP_SIZE, LIGHTMAP_SIZE, layer_count, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    // No mips, RGBM doesn't average and the charts' padding wouldn't survive them
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, 0);
+    return true;
+}
+
+void LightmapAtlas::uploadLights(const std::vector<GpuLight>& lights, int unit) {
+    const int count = std::max<int>((int)lights.size(), 1);
+    if (count > lights_capacity) {
+        if (lights_texture != 0) glDeleteTextures(1, &lights_texture);
+        glGenTextures(1, &lights_texture);
+        gl_state.bindTexture(unit, GL_TEXTURE_2D, lights_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 4, count, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        lights_capacity = count;
+    }
+    gl_state.bindTexture(unit, GL_TEXTURE_2D, lights_texture);
+    if (!lights.empty()) glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 4, (GLsizei)lights.size(), GL_RGBA, GL_FLOAT, lights.data());
+}
+
+void LightmapAtlas::beginLayer() {
+    glBindFramebuffer(GL_FRAMEBUFFER, scratch_fbo);
+    glViewport(0, 0, LIGHTMAP_SIZE, LIGHTMAP_SIZE);
+    gl_state.colorMask(true);
+    const GLfloat clear[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glClearBufferfv(GL_COLOR, 0, clear);
+}
+
+void LightmapAtlas::endLayer(int layer, int scratch_unit) {
+    glBindFramebuffer(GL_FRAMEBUFFER, layer_fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, layer);
+    dilate_shader->use();
+    dilate_shader->setInt("scratch", scratch_unit);
+    gl_state.bindTexture(scratch_unit, GL_TEXTURE_2D, scratch_texture);
+    gl_state.bindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+}
+
+void LightmapAtlas::bind(int unit) const {
+    if (texture != 0) gl_state.bindTexture(unit, GL_TEXTURE_2D_ARRAY, texture);
+}
@@ -0,0 +1,138 @@
+#include "load_stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+const char* const LOAD_STAGE_NAMES[LOAD_STAGE_COUNT] = {
+    "cooked_read", "mesh_decode", "assimp_read", "vertex_encode", "mesh_process", "cook_write", "image_read",
+    "orm_pack", "texture_compress", "mip_chain", "mesh_upload", "texture_upload", "generate_mipmap",
+};
+
+LoadStats load_stats;
+
+static thread_local LoadAssetScope* current_scope = nullptr;
+static thread_local LoadTimer* current_timer = nullptr;
+
+LoadAssetScope::LoadAssetScope(std::string asset) : asset(std::move(asset)), parent(current_scope) {
+    current_scope = this;
+}
+
+LoadAssetScope::~LoadAssetScope() {
+    current_scope = parent;
+}
+
+std::string LoadAssetScope::current() {
+    return current_scope ? current_scope->asset : std::string();
+}
+
+LoadTimer::LoadTimer(LoadStage stage) : stage(stage), start(std::chrono::steady_clock::now()), parent(current_timer) {
+    current_timer = this;
+}
+
+LoadTimer::~LoadTimer() {
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    current_timer = parent;
+    if (parent) parent->child_ms += ms;
+    load_stats.record(current_scope ? current_scope->asset : "(unattributed)", stage, std::max(0.0, ms - child_ms),
+                      bytes_read, bytes_uploaded);
+}
+
+int LoadStats::parseArg(int argc, char** argv, int i) {
+    if (std::string(argv[i]) != "--load-report") return 0;
+    if (i + 1 >= argc) {
+        printf("--load-report needs 1 argument\n");
+        return -1;
+    }
+    report_file = argv[i + 1];
+    return 2;
+}
+
+void LoadStats::record(const std::string& asset, LoadStage stage, double ms, uint64_t bytes_read, uint64_t bytes_uploaded) {
+    std::lock_guard<std::mutex> lock(mutex);
+    AssetTimes& times = assets[asset];
+    times.ms[stage] += ms;
+    times.total_ms += ms;
+    times.bytes_read += bytes_read;
+    times.bytes_uploaded += bytes_uploaded;
+}
+
+LoadStats::AssetTimes LoadStats::sum() const {
+    AssetTimes totals;
+    for (const auto& entry : assets) {
+        for (int stage = 0; stage < LOAD_STAGE_COUNT; ++stage) totals.ms[stage] += entry.second.ms[stage];
+        totals.total_ms += entry.second.total_ms;
+        totals.bytes_read += entry.second.bytes_read;
+        totals.bytes_uploaded += entry.second.bytes_uploaded;
+    }
+    return totals;
+}
+
+LoadStats::AssetTimes LoadStats::totals(size_t* asset_count) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (asset_count) *asset_count = assets.size();
+    return sum();
+}
+
+void LoadStats::report() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<const std::pair<const std::string, AssetTimes>*> sorted;
+    for (const auto& entry : assets) sorted.push_back(&entry);
+    const AssetTimes totals = sum();
+    std::sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b) { return a->second.total_ms > b->second.total_ms; });
+
+    // Thread time, so with parallel imports the total exceeds the wall time
+    const double mb = 1024.0 * 1024.0;
+    printf("Load report: %.1f ms over %zu assets, %.1f MB read, %.1f MB uploaded\n", totals.total_ms, assets.size(),
+           totals.bytes_read / mb, totals.bytes_uploaded / mb);
+    for (int stage = 0; stage < LOAD_STAGE_COUNT; ++stage) {
+        if (totals.ms[stage] > 0.0) printf("  %-17s %9.1f ms\n", LOAD_STAGE_NAMES[stage], totals.ms[stage]);
+    }
+    for (const auto* entry : sorted) {
+        const AssetTimes& times = entry->second;
+        std::string stages;
+        for (int stage = 0; stage < LOAD_STAGE_COUNT; ++stage) {
+            if (times.ms[stage] < 0.05) continue;
+            char part[48];
+            snprintf(part, sizeof(part), "%s%s %.1f", stages.empty() ? "" : ", ", LOAD_STAGE_NAMES[stage], times.ms[stage]);
+            stages += part;
+        }
+        printf("  %9.1f ms %8.2f MB read %8.2f MB up  %s  [%s]\n", times.total_ms, times.bytes_read / mb,
+               times.bytes_uploaded / mb, entry->first.c_str(), stages.c_str());
+    }
+
+    if (!report_file.empty() && writeJson(report_file)) printf("Load report written to %s\n", report_file.c_str());
+}
+
+static std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        if ((unsigned char)c >= 0x20) quoted += c;
+    }
+    return quoted + "\"";
+}
+
+bool LoadStats::writeJson(const std::string& path) const {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        printf("Load report: can't write %s\n", path.c_str());
+        return false;
+    }
+    out << "{\n  \"assets\": {";
+    bool first = true;
+    for (const auto& [asset, times] : assets) {
+        out << (first ? "\n" : ",\n") << "    " << jsonString(asset) << ": { \"total_ms\": " << times.total_ms
+            << ", \"bytes_read\": " << times.bytes_read << ", \"bytes_uploaded\": " << times.bytes_uploaded << ", \"stages_ms\": {";
+        bool first_stage = true;
+        for (int stage = 0; stage < LOAD_STAGE_COUNT; ++stage) {
+            if (times.ms[stage] <= 0.0) continue;
+            out << (first_stage ? " " : ", ") << "\"" << LOAD_STAGE_NAMES[stage] << "\": " << times.ms[stage];
+            first_stage = false;
+        }
+        out << " } }";
+        first = false;
+    }
+    out << "\n  }\n}\n";
+    return true;
+}
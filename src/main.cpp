@@ -17,13 +17,11 @@
  Checkered grass texture: "Green grass field pattern background for soccer and football. | Premium Photo" (https://ar.pinterest.com/pin/797629784037209282/) by Freepik is licensed under Creative Commons Attribution (http://creativecommons.org/licenses/by/4.0/).
 
  IMPLEMENTATION LIST
- 1. Physics
- 2. Complete PBR implementation (esp. IBL)
+ 1. Complete PBR implementation (local reflection probes, the sky is the only IBL source)
  
  BUGS & IMPROVEMENTS LIST
  1. Fix ImGui window mouse interaction
- 2. Use cascaded shadow maps for bigger shadow view distance
- 3. Passing meshes into light sources breaks the entire scene
+ 2. Passing meshes into light sources breaks the entire scene
 
  NOTES FOR OTHER DEVELOPERS
  1. If you try to export the textures here elsewhere it might look strange because I'd flipped the textures for them to work in OpenGL
@@ -46,6 +44,7 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
 #include <glm/gtx/euler_angles.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
 // Emscripten
 #ifdef __EMSCRIPTEN__
@@ -57,6 +56,10 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
 
 // Function prototypes
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -67,10 +70,23 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 // ============================================================================
 
 #include "texture_loader.h"
+#include "texture_compression.h"
+#include "texture_streamer.h"
+#include "upload_context.h"
+#include "telemetry.h"
+#include "texture_residency.h"
+#include "asset_loader.h"
+#include "lazy_entities.h"
 #include "camera.h"
 #include "color.h"
 #include "entity_manager.h"
 #include "filesystem.h"
+#include "geometry_arena.h"
+#include "gpu_culling.h"
+#include "hiz.h"
+#include "occlusion_queries.h"
+#include "gl_extensions.h"
+#include "job_system.h"
 #include "light.h"
 #include "material.h"
 #include "mesh_loader.h"
@@ -79,6 +95,59 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 #include "shader.h"
 #include "shadowmap.h"
 #include "skybox.h"
+#include "ibl.h"
+#include "lightmap.h"
+#include "ssao.h"
+#include "static_batches.h"
+#include "instance_ring.h"
+#include "gl_state.h"
+#include "frame_uniforms.h"
+#include "frame_arena.h"
+#include "impostor.h"
+#include "scene_target.h"
+#include "temporal_aa.h"
+#include "profiler.h"
+#include "gpu_queries.h"
+#include "pipeline_stats.h"
+#include "render_graph.h"
+#include "benchmark.h"
+#include "batch_render.h"
+#include "frame_readback.h"
+#include "stress_scene.h"
+#include "trace_capture.h"
+#include "gpu_memory.h"
+#include "frame_stats.h"
+#include "quality_governor.h"
+#include "load_stats.h"
+#include "draw_capture.h"
+#include "asset_fetch.h"
+#include "scene_loader.h"
+#include "scene_file.h"
+#include "world_partition.h"
+#include "world_origin.h"
+#include "asset_pack.h"
+#include "asset_watcher.h"
+#include "skinning.h"
+#include "particles.h"
+#include "sim_thread.h"
+#include "frame_pacer.h"
+#include "on_demand.h"
+#include "physics.h"
+#include "scene_query.h"
+#include "material_registry.h"
+#include "texture_atlas.h"
+#include "terrain.h"
+#include "foliage.h"
+#include "reflection_probes.h"
+#include "atmosphere.h"
+#include "volumetric_fog.h"
+#include "render_view.h"
+#include "frame_view.h"
+#include "debug_overlay.h"
+#include "portal_visibility.h"
+#include "hlod.h"
+#include "vertex_pulling.h"
+#include "gl_deletion_queue.h"
 
 // ============================================================================
 // GLOBAL VARIABLES
@@ -92,28 +161,64 @@ int WINDOW_HEIGHT = 600;
 bool firstMouse = true;
 double fps;
 bool paused = false;
-float update_count = 0;
 float frame_time = 1.0f;
 bool fullscreen = false;
 bool initialization_complete = false;  // Loading state tracker
 
 // Others
 bool debug_mode = false;
-
-// Performance queries
-GLuint shadowQueries[2] = {0, 0};
-GLuint mainQueries[2] = {0, 0};
-GLuint skyboxQueries[2] = {0, 0};
-int queryIndex = 0;
-int prevIndex = 0;
+bool bake_lightmaps_requested = false; // Baked after the next shadow pass
+
+// Top-down picture-in-picture around the camera, drawn as an extra view
+bool show_minimap = false;
+ViewTarget minimap;
+static const int MINIMAP_SIZE = 256;        // Pixels
+static const float MINIMAP_EXTENT = 40.0f;  // World units from the camera to the map's edge
+static const float MINIMAP_HEIGHT = 100.0f; // Looked down from this far above the camera
+
+// Performance queries, each frame's elapsed queries are issued in this order so a pass's index
+// in a gpu_queries frame is its enum
+enum GpuPass {
+    GPU_PASS_SHADOWS = 0,
+    GPU_PASS_PREPASS,
+    GPU_PASS_SSAO,
+    GPU_PASS_MAIN,
+    GPU_PASS_SKYBOX,
+    GPU_PASS_COUNT,
+};
+static const char* const GPU_PASS_NAMES[GPU_PASS_COUNT] = { "Shadows", "Prepass", "SSAO", "Main", "Skybox" };
 double shadowTime = 0.0;
 double mainTime = 0.0;
 double skyboxTime = 0.0;
+double prepassTime = 0.0;
+double ssaoTime = 0.0;
 
 // Player/camera
 glm::mat4 view;
 glm::mat4 projection;
 Camera global_camera;
+SceneHit picked; // Right click on the scene while the cursor's free
+
+// Scripted entities, resolved once after the scene is created. The simulation step names them
+// by their index here.
+enum ScriptedEntity {
+    SCRIPTED_CUBE = 0,
+    SCRIPTED_SPHERE,
+    SCRIPTED_STATUE,
+    SCRIPTED_INSTRUCTIONS,
+    SCRIPTED_CHARACTER_IDLE,
+    SCRIPTED_ENTITY_COUNT
+};
+EntityHandle scripted_entities[SCRIPTED_ENTITY_COUNT];
+
+// What the simulation step integrates, touched only by whichever thread runs it. The previous
+// values are the step before, rendering interpolates between the two.
+static struct {
+    FixedStepClock clock;
+    glm::vec3 camera_position{0.0f}, previous_camera_position{0.0f};
+    glm::vec3 camera_velocity{0.0f};
+    float update_count = 0.0f, previous_update_count = 0.0f; // In 60ths of a second
+} sim_state;
 
 // Scene stats
 unsigned int total_triangles = 0;
@@ -124,10 +229,8 @@ extern GLuint shadowMapFBO;
 extern GLuint shadowMapTexture;
 extern unsigned int SHADOW_WIDTH;
 extern unsigned int SHADOW_HEIGHT;
-glm::mat4 lightSpaceMatrix;
 
 // Game settings
-#define MAX_LIGHTS 8
 float mouse_sensitivity = 0.1f;
 
 // Skybox
@@ -185,20 +288,15 @@ void updateFPS(GLFWwindow* window) {
         frameCount = 0;
         fpsTimer = 0.0;
 
-        // Update performance query results - only on native platforms
-        #ifndef __EMSCRIPTEN__
-            GLuint64 shadowTimeNS = 0;
-            glGetQueryObjectui64v(shadowQueries[prevIndex], GL_QUERY_RESULT, &shadowTimeNS);
-            shadowTime = shadowTimeNS / 1000000.0;
-
-            GLuint64 skyboxTimeNS = 0;
-            glGetQueryObjectui64v(skyboxQueries[prevIndex], GL_QUERY_RESULT, &skyboxTimeNS);
-            skyboxTime = skyboxTimeNS / 1000000.0;
-
-            GLuint64 mainTimeNS = 0;
-            glGetQueryObjectui64v(mainQueries[prevIndex], GL_QUERY_RESULT, &mainTimeNS);
-            mainTime = mainTimeNS / 1000000.0;
-        #endif
+        // Displayed pass times, from the newest frame the query pool has back
+        const GpuQueryPool::Frame* timed = gpu_queries.latest();
+        if (timed && timed->elapsed_ms.size() >= GPU_PASS_COUNT) {
+            shadowTime = timed->elapsed_ms[GPU_PASS_SHADOWS];
+            prepassTime = timed->elapsed_ms[GPU_PASS_PREPASS];
+            ssaoTime = timed->elapsed_ms[GPU_PASS_SSAO];
+            mainTime = timed->elapsed_ms[GPU_PASS_MAIN];
+            skyboxTime = timed->elapsed_ms[GPU_PASS_SKYBOX];
+        }
     }
 }
 
@@ -229,6 +327,133 @@ std::vector<std::shared_ptr<Mesh>> loadMesh(const std::string& filepath);
 // MAIN LOOP CALLBACK
 // ============================================================================
 
+// Loading progress, on the loading screen and over the scene while the rest comes in
+static void loadProgressWindow(const ImVec2& position) {
+    ImGui::SetNextWindowPos(position);
+    ImGui::SetNextWindowSize(ImVec2(300, 0));
+    ImGui::Begin("Loading", nullptr, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse);
+    ImGui::Text("%s...", scene_loader.current().c_str());
+    char label[64];
+    snprintf(label, sizeof(label), "%zu / %zu meshes", asset_loader.completedCount(), asset_loader.requestedCount());
+    ImGui::ProgressBar(scene_loader.progress(), ImVec2(-1, 0), label);
+    ImGui::End();
+}
+
+// The cloud sky's faces, in GL_TEXTURE_CUBE_MAP_POSITIVE_X order
+static const std::string CLOUD_SKYBOX_DIR = "res/skyboxes/Cloud_skybox/";
+static void cloudSkyboxPaths(std::string paths[6]) {
+    const char* const names[6] = { "right", "left", "top", "bottom", "front", "back" };
+    for (int i = 0; i < 6; ++i) paths[i] = buildAssetPath(CLOUD_SKYBOX_DIR + "cloud_skybox_" + names[i] + ".png");
+}
+
+// The atmosphere and the ambient built from it follow the sun, redrawn only when it moved. The
+// directional lights turn with it and the reflection probes recapture. Turned off, the cloud
+// sky's ambient comes back from the IBL cache.
+static void updateSky() {
+    static bool atmosphere_drawn = false;
+    if (use_atmosphere && atmosphere.init()) {
+        if (!atmosphere_drawn) atmosphere.invalidate();
+        atmosphere_drawn = true;
+        if (!atmosphere.update()) return;
+        const glm::vec3 sun = Atmosphere::sunDirection();
+        for (size_t i = 0; i < lights.size(); ++i) {
+            if (lights[i].type != DIR_LIGHT) continue;
+            lights[i].direction = -sun;
+            markLightDirty(i);
+        }
+        reflection_probes.invalidate();
+    } else if (atmosphere_drawn) {
+        atmosphere_drawn = false;
+        std::string paths[6];
+        cloudSkyboxPaths(paths);
+        const char* faces[6] = { paths[0].c_str(), paths[1].c_str(), paths[2].c_str(), paths[3].c_str(), paths[4].c_str(), paths[5].c_str() };
+        ibl.build(faces, g_skybox->cubemap_texture[0]);
+        reflection_probes.invalidate();
+    }
+}
+
+// One frame of the game: the camera's motion from the held keys and the scripted entities.
+// Runs on the simulation thread when there is one, so it only reads its input and sim_state
+// and leaves everything else to the GL thread through the snapshot. The state advances in
+// whole SIM_STEP_SECONDS steps whatever the frame rate, the snapshot shows it interpolated
+// to the frame's time between the last two.
+static void simulateFrame(const SimInput& input, RenderSnapshot& snapshot) {
+    snapshot.frame = input.frame;
+    snapshot.transforms.clear();
+    sim_state.camera_position -= input.origin_shift;
+    sim_state.previous_camera_position -= input.origin_shift;
+    if (input.sync_camera) {
+        sim_state.camera_position = sim_state.previous_camera_position = input.camera_position;
+        sim_state.camera_velocity = input.camera_velocity;
+    }
+
+    if (!input.paused) {
+        float yaw_rad = input.yaw * M_PI / 180.0f;
+        float sin_yaw = sinf(yaw_rad);
+        float cos_yaw = cosf(yaw_rad);
+        glm::vec3 cam_offset = glm::vec3(0.0f);
+        float actual_cam_speed = SIM_STEP_SECONDS * input.speed_multiplier;
+        auto held = [&](uint32_t key) { return (input.keys & key) != 0; };
+
+        if (held(SIM_KEY_FAST)) {
+            actual_cam_speed *= 2;
+        }
+
+        if (held(SIM_KEY_FORWARD)) {
+            cam_offset = cam_offset + glm::vec3(cos_yaw, 0, sin_yaw);
+        }
+        if (held(SIM_KEY_BACK)) {
+            cam_offset = cam_offset + glm::vec3(-cos_yaw, 0, -sin_yaw);
+        }
+        if (held(SIM_KEY_LEFT)) {
+            cam_offset = cam_offset + glm::vec3(sin_yaw, 0, -cos_yaw);
+        }
+        if (held(SIM_KEY_RIGHT)) {
+            cam_offset = cam_offset + glm::vec3(-sin_yaw, 0, cos_yaw);
+        }
+
+        if (glm::length(cam_offset) > 0.0f) {
+            cam_offset = glm::normalize(cam_offset);
+        }
+
+        // Velocity is per step, so friction takes the same bite out of it at any frame rate
+        const int steps = sim_state.clock.advance(input.frame_time);
+        for (int step = 0; step < steps; ++step) {
+            sim_state.previous_camera_position = sim_state.camera_position;
+            sim_state.previous_update_count = sim_state.update_count;
+
+            glm::vec3& velocity = sim_state.camera_velocity;
+            velocity.x += cam_offset.x * actual_cam_speed;
+            velocity.z += cam_offset.z * actual_cam_speed;
+
+            if (held(SIM_KEY_UP)) {
+                velocity.y += actual_cam_speed;
+            }
+            if (held(SIM_KEY_DOWN)) {
+                velocity.y -= actual_cam_speed;
+            }
+
+            velocity *= input.friction;
+            sim_state.camera_position += velocity;
+            sim_state.update_count += SIM_STEP_SECONDS * 60.0f;
+
+            if (input.physics) physics_world.step(SIM_STEP_SECONDS);
+        }
+
+        // Lights follow their entities when the GL thread syncs the proxies
+        const float t = glm::mix(sim_state.previous_update_count, sim_state.update_count, sim_state.clock.alpha());
+        snapshot.transforms.push_back({ SCRIPTED_CUBE, VEC3_NO_CHANGE, glm::vec3(t * 0.1f, t * 0.1f, t * 0.1f), VEC3_NO_CHANGE });
+        snapshot.transforms.push_back({ SCRIPTED_SPHERE, glm::vec3(NO_CHANGE, 2.5f + sinf(t * 0.01f), NO_CHANGE), glm::vec3(t, 0, 0), VEC3_NO_CHANGE });
+        snapshot.transforms.push_back({ SCRIPTED_STATUE, VEC3_NO_CHANGE, glm::vec3(NO_CHANGE, t, NO_CHANGE), VEC3_NO_CHANGE });
+        snapshot.transforms.push_back({ SCRIPTED_INSTRUCTIONS, glm::vec3(NO_CHANGE, 2.0f + 0.05f * sinf(t * 0.05f), NO_CHANGE), VEC3_NO_CHANGE, VEC3_NO_CHANGE });
+        snapshot.transforms.push_back({ SCRIPTED_CHARACTER_IDLE, VEC3_NO_CHANGE, VEC3_NO_CHANGE, glm::vec3(0, t * 0.1f, 0) });
+    }
+
+    snapshot.camera_position = glm::mix(sim_state.previous_camera_position, sim_state.camera_position, sim_state.clock.alpha());
+    snapshot.camera_velocity = sim_state.camera_velocity;
+    physics_world.interpolate(sim_state.clock.alpha(), snapshot.body_entities, snapshot.body_transforms);
+}
+
 void emscripten_main_loop_callback() {
     if (!g_app_context || g_app_context->should_close) {
         #ifdef __EMSCRIPTEN__
@@ -241,8 +466,10 @@ void emscripten_main_loop_callback() {
     Renderer* renderer = g_app_context->renderer.get();
     Skybox* skybox = g_skybox;
     
-    // Show loading screen during initialization
+    // Show loading screen until the scene has something to render
     if (!initialization_complete) {
+        scene_loader.update(SCENE_LOAD_BUDGET_MS);
+
         glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
@@ -250,12 +477,7 @@ void emscripten_main_loop_callback() {
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
         
-        ImGui::SetNextWindowPos(ImVec2(WINDOW_WIDTH / 2 - 150, WINDOW_HEIGHT / 2 - 50));
-        ImGui::SetNextWindowSize(ImVec2(300, 100));
-        ImGui::Begin("Loading", nullptr, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize);
-        ImGui::Text("Initializing Engine...");
-        ImGui::ProgressBar(0.5f, ImVec2(-1, 0), "Loading Assets");
-        ImGui::End();
+        loadProgressWindow(ImVec2(WINDOW_WIDTH / 2 - 150, WINDOW_HEIGHT / 2 - 50));
         
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -264,137 +486,277 @@ void emscripten_main_loop_callback() {
         return;
     }
     
+    // Nothing changed for a while and the last frame is still on screen, wait for input instead
+    if (!benchmark.active() && !batch_render.active() && !draw_capture.replaying() && on_demand.idle()) return;
+
+    // Before anything reads this frame's input, so the GPU queue behind it stays short
+    frame_pacer.beginFrame();
     updateFPS(window);
+    const auto cpuFrameStart = std::chrono::steady_clock::now();
+    frame_stats.wall.push(frame_time * 1000.0f);
+    gpu_queries.beginFrame();
+    pipeline_stats.beginFrame();
+    profiler.beginFrame();
+    if (benchmark.active()) frame_time = benchmark.beginFrame();
+    if (batch_render.active()) frame_time = batch_render.beginFrame();
+    draw_capture.collect();
+    
+    // Stream the next batch of texture mips in
+    {
+        PROFILE_SCOPE("texture streaming");
+        upload_context.update();
+        texture_streamer.update();
+        // Then the levels last frame's screen sizes asked for, and out with the ones it didn't
+        texture_residency.update(TEXTURE_STREAM_FRAME_BUDGET);
+        // And the terrain tiles and world cells around the camera
+        terrain.update(global_camera.position);
+        world_partition.update(global_camera.position, global_camera.front);
+    }
+
+    // The rest of the scene, a step at a time
+    if (!scene_loader.done()) {
+        PROFILE_SCOPE("scene loading");
+        scene_loader.update(SCENE_LOAD_BUDGET_MS);
+    } else {
+        // Edited assets re-import and upload like the scene did. Stress scene variants borrow the
+        // meshes' buffers, a reload under them would free what they draw with.
+        PROFILE_SCOPE("hot reload");
+        if (stress_scene.entityCount() == 0) asset_watcher.update();
+        asset_loader.processUploads(SCENE_LOAD_BUDGET_MS);
+        lazy_entities.update();
+    }
     
-    if (!paused) {
-        float yaw_rad = global_camera.yaw * M_PI / 180.0f;
-        float sin_yaw = sinf(yaw_rad);
-        float cos_yaw = cosf(yaw_rad);
-        glm::vec3 cam_offset = glm::vec3(0.0f);
-        float actual_cam_speed = frame_time * global_camera.speed_multiplier;
-        
-        if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS) {
-            actual_cam_speed *= 2;
+    {
+        PROFILE_SCOPE("update");
+        // A benchmark's camera follows its path and a batch job's stands where the job puts it,
+        // the keys would only add drift
+        const bool keyboard = !benchmark.active() && !batch_render.active() && !draw_capture.replaying();
+        auto held = [&](int key) { return keyboard && glfwGetKey(window, key) == GLFW_PRESS; };
+
+        static uint64_t sim_frame = 0;
+        SimInput input;
+        input.frame = ++sim_frame;
+
+        // A streamed world moves its origin under a camera that strayed far (world_origin.h).
+        // Systems on a fixed ground frame, the scripted entities and camera paths hold it.
+        static uint64_t origin_shift_frame = 0;
+        static glm::vec3 last_origin_shift(0.0f);
+        bool can_rebase = keyboard && world_partition.requested() && !terrain.ready() && foliage.empty() &&
+                          physics_world.bodyCount() == 0 && skinned_animation.instanceCount() == 0;
+        for (EntityHandle scripted : scripted_entities) can_rebase = can_rebase && !entity_manager.isValid(scripted);
+        input.origin_shift = world_origin.rebaseFor(global_camera.position, can_rebase);
+        if (input.origin_shift != glm::vec3(0.0f)) {
+            world_origin.shift(input.origin_shift, global_camera, *renderer);
+            origin_shift_frame = input.frame;
+            last_origin_shift = input.origin_shift;
         }
-        
-        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-            cam_offset = cam_offset + glm::vec3(cos_yaw, 0, sin_yaw);
-        }
-        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-            cam_offset = cam_offset + glm::vec3(-cos_yaw, 0, -sin_yaw);
+        input.frame_time = frame_time;
+        input.paused = paused;
+        if (held(GLFW_KEY_W)) input.keys |= SIM_KEY_FORWARD;
+        if (held(GLFW_KEY_S)) input.keys |= SIM_KEY_BACK;
+        if (held(GLFW_KEY_A)) input.keys |= SIM_KEY_LEFT;
+        if (held(GLFW_KEY_D)) input.keys |= SIM_KEY_RIGHT;
+        if (held(GLFW_KEY_E)) input.keys |= SIM_KEY_UP;
+        if (held(GLFW_KEY_Q)) input.keys |= SIM_KEY_DOWN;
+        if (held(GLFW_KEY_LEFT_SHIFT) || held(GLFW_KEY_RIGHT_SHIFT)) input.keys |= SIM_KEY_FAST;
+        input.yaw = global_camera.yaw;
+        input.speed_multiplier = global_camera.speed_multiplier;
+        input.friction = global_camera.friction;
+        input.physics = use_physics;
+
+        if (!paused) {
+            // Path cameras place the camera here, the simulation picks up from wherever they left it
+            if (benchmark.active()) benchmark.moveCamera(global_camera);
+            if (draw_capture.replaying()) draw_capture.moveCamera(global_camera);
+            if (batch_render.active()) batch_render.moveCamera(global_camera);
+            input.sync_camera = !keyboard;
         }
-        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-            cam_offset = cam_offset + glm::vec3(sin_yaw, 0, -cos_yaw);
-        }
-        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-            cam_offset = cam_offset + glm::vec3(-sin_yaw, 0, cos_yaw);
-        }
-
-        if (glm::length(cam_offset) > 0.0f) {
-            cam_offset = glm::normalize(cam_offset);
+        // The first frame starts the simulation off where the camera was created
+        input.sync_camera = input.sync_camera || sim_frame == 1;
+        input.camera_position = global_camera.position;
+        input.camera_velocity = global_camera.velocity;
+
+        if (use_sim_thread != sim_thread.threaded()) sim_thread.setThreaded(use_sim_thread);
+        const RenderSnapshot& snapshot = sim_thread.exchange(input);
+
+        if (snapshot.frame != 0) {
+            if (keyboard) {
+                global_camera.position = snapshot.camera_position;
+                global_camera.velocity = snapshot.camera_velocity;
+                // A threaded step from before the shift still has the camera where it was
+                if (snapshot.frame < origin_shift_frame) global_camera.position -= last_origin_shift;
+            }
+            for (const TransformWrite& write : snapshot.transforms) {
+                entity_manager.updateEntity(scripted_entities[write.target], write.position, write.rotation, write.scale);
+            }
+            entity_manager.setTransforms(snapshot.body_entities.data(), snapshot.body_transforms.data(),
+                                         snapshot.body_entities.size(), TRANSFORM_POSITION | TRANSFORM_ROTATION);
         }
 
-        global_camera.velocity.x += cam_offset.x * actual_cam_speed;
-        global_camera.velocity.z += cam_offset.z * actual_cam_speed;
-        
-        if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
-            global_camera.velocity.y += actual_cam_speed;
-        }
-        if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
-            global_camera.velocity.y -= actual_cam_speed;
+        if (!paused) {
+            benchmark.recordCamera(frame_time, global_camera);
+            view = camera_get_view_matrix(&global_camera);
+            projection = camera_get_projection(&global_camera);
         }
-
-        global_camera.velocity *= global_camera.friction;
-        global_camera.position = global_camera.position + global_camera.velocity;
-        
-        view = camera_get_view_matrix(&global_camera);
-        projection = camera_get_projection(&global_camera);
-        
-        // ============================================================================
-        // UPDATE LIGHTS
-        // ============================================================================
-
-
-
-        // ============================================================================
-        // UPDATE ENTITIES
-        // ============================================================================
-
-        entity_manager.updateEntity("cube", VEC3_NO_CHANGE, glm::vec3(update_count * 0.1f, update_count * 0.1f, update_count * 0.1f), VEC3_NO_CHANGE);
-        entity_manager.updateEntity("sphere", glm::vec3(NO_CHANGE, 2.5f + sinf(update_count * 0.01f), NO_CHANGE), glm::vec3(update_count, 0, 0), VEC3_NO_CHANGE);
-        entity_manager.updateEntity("statue", VEC3_NO_CHANGE, glm::vec3(NO_CHANGE, update_count, NO_CHANGE), VEC3_NO_CHANGE);
-        entity_manager.updateEntity("instructions", glm::vec3(NO_CHANGE, 2.0f + 0.05f * sinf(update_count * 0.05f), NO_CHANGE), VEC3_NO_CHANGE, VEC3_NO_CHANGE);
-        entity_manager.updateEntity("character_idle", VEC3_NO_CHANGE, VEC3_NO_CHANGE, glm::vec3(0, update_count * 0.1f, 0));
-
-        update_count += frame_time * 60.0f;
     }
     
+    // Resolution scale from the newest frame the query pool collected, the prepass choice and
+    // the GPU frame-time series from every one of them
+    double newestGpuTime = -1.0;
+    for (const GpuQueryPool::Frame* timed : gpu_queries.collected()) {
+        if (!timed->valid || timed->elapsed_ms.size() < GPU_PASS_COUNT) continue;
+        renderer->updateDepthPrepassTiming(timed->id, timed->elapsed_ms[GPU_PASS_PREPASS], timed->elapsed_ms[GPU_PASS_MAIN]);
+        newestGpuTime = 0.0;
+        for (int pass = 0; pass < GPU_PASS_COUNT; ++pass) newestGpuTime += timed->elapsed_ms[pass];
+        frame_stats.gpu.push((float)newestGpuTime);
+    }
+    if (newestGpuTime >= 0.0) updateDynamicResolution(newestGpuTime);
+    // Before anything below reads the settings its steps change
+    quality_governor.update(frame_stats.cpu.latest(), newestGpuTime);
+
+    // The scene draws offscreen at the scaled size from here until present()
+    scene_target.begin(WINDOW_WIDTH, WINDOW_HEIGHT);
+    // A new sub-pixel offset every frame, paused or not, so a still image keeps converging
+    global_camera.jitter = temporal_aa.jitter(scene_target.width(), scene_target.height());
+    projection = camera_get_projection(&global_camera);
+    // Everything from culling to the lighting reads this frame's matrices and frustum from here
+    frame_view.update(view, projection, global_camera.position);
+
+    // Stencil too, depth and stencil share the attachment and the overdraw view counts in it
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    
-    // GPU timing queries - only on native platforms
-    #ifndef __EMSCRIPTEN__
-        glBeginQuery(GL_TIME_ELAPSED, shadowQueries[queryIndex]);
-    #endif
-    
-    int shadowLightIndex = -1;
-    for (size_t i = 0; i < lights.size(); i++) {
-        renderer->renderShadowPass(entity_manager, lights[i]);
-        shadowLightIndex = static_cast<int>(i);
-        break;
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    
+    // GPU pass timing and pipeline statistics, in GpuPass order
+    gpu_queries.beginElapsed();
+    pipeline_stats.beginPass();
+    
+    // Shadow settings changed last frame recreate the map now, before anything binds it
+    applyPendingShadowSettings();
+
+    // Texture uploads and ImGui bound things behind the cache's back
+    gl_state.invalidate();
+    gl_state.resetCounters();
+
+    // Every pass appends its instances from here on
+    instance_ring.beginFrame();
+
+    // This frame's transform changes, down the hierarchy, before anything reads world bounds
+    stress_scene.update(frame_time);
+    entity_manager.updateTransforms();
+    // Bone palettes for every pass, the shadow pass first
+    skinned_animation.update(paused ? 0.0f : frame_time);
+    // Simulated on the GPU, drawn with the transparents
+    particle_system.update(paused ? 0.0f : frame_time);
+    // Before the frame uniforms take the ambient and the lights
+    updateSky();
+    // Wind and the foliage cells' tiers, the shadow passes read them
+    foliage.update(paused ? 0.0f : frame_time, global_camera.position);
+    syncLightsToProxies();
+
+    // One LOD decision per entity per frame, shared by the shadow, prepass and main passes
+    renderer->updateLODBias(frame_time * 1000.0f);
+    renderer->selectLODs(entity_manager, global_camera, scene_target.height(), frame_time);
+    renderer->updateGpuCulling(entity_manager);
+
+    // Camera, lights and every shadowed light's atlas views go up in one buffer update shared
+    // by every pass below
+    renderer->updateFrameUniforms(global_camera);
+    renderer->renderShadowPass(entity_manager);
+    if (bake_lightmaps_requested) {
+        renderer->bakeLightmaps(entity_manager);
+        bake_lightmaps_requested = false;
     }
     
-    #ifndef __EMSCRIPTEN__
-        glEndQuery(GL_TIME_ELAPSED);
-        glBeginQuery(GL_TIME_ELAPSED, skyboxQueries[queryIndex]);
-    #endif
-    
-    #ifndef __EMSCRIPTEN__
-        glEndQuery(GL_TIME_ELAPSED);
-        glBeginQuery(GL_TIME_ELAPSED, mainQueries[queryIndex]);
-    #endif
+    pipeline_stats.endPass();
+    gpu_queries.endElapsed();
+    gpu_queries.beginElapsed();
+    pipeline_stats.beginPass();
 
     // Frustum culling and cache visible entities
-    renderer->cullEntities(entity_manager, projection * view);
+    portal_visibility.update(entity_manager, frame_view.view_projection, frame_view.position);
+    renderer->cullEntities(entity_manager, frame_view);
     
     // Eliminate overdraw by using depth pre-pass
     renderer->renderDepthPrepass();  // Use cached entities
+
+    pipeline_stats.endPass();
+    gpu_queries.endElapsed();
+    gpu_queries.beginElapsed();
+    pipeline_stats.beginPass();
+
+    // Contact occlusion from the prepass depth, read by the main pass
+    renderer->renderAmbientOcclusion();
+    // Lit fog in the froxels, read by the main pass and the sky
+    renderer->renderVolumetricFog();
+
+    pipeline_stats.endPass();
+    gpu_queries.endElapsed();
+    gpu_queries.beginElapsed();
+    pipeline_stats.beginPass();
     
-    renderer->setGlobalUniforms(global_camera, shadowLightIndex);
-    
+    // Depth writes resume, copies from here on resolve the multisampled depth again
+    scene_target.depthWritten();
+
     // Render light sources as unlit objects
-    for (size_t i = 0; i < entity_manager.size(); i++) {
-        Entity* entity = entity_manager.getEntityAt(i);
-        if (!entity || !entity->active) continue;
-
-        for (const auto& light : lights) {
-            if (entity->name == light.entity_name) {
-                for (const auto& meshPtr : entity->meshes) {
-                    if (meshPtr && meshPtr->isValid()) {
-                        renderer->drawUnlitMesh(entity, meshPtr.get(), light.color, light.intensity);
-                    }
-                }
-                break; 
-            }
-        }
-    }
+    pipeline_stats.beginOverdraw();
+    renderer->renderLightProxies(entity_manager);
 
     // Render rest of the scene
     renderer->renderScene(entity_manager);  // Use cached entities
+    pipeline_stats.endOverdraw();
+    draw_capture.endFrame(global_camera);
+    // Reflection probe faces due this frame, shaded with the scene's materials
+    renderer->renderReflectionProbes(entity_manager, paused ? 0.0f : frame_time, [skybox]() {
+        if (!atmosphere.render()) skybox->render();
+    });
+    if (show_minimap && minimap.resize(MINIMAP_SIZE, MINIMAP_SIZE)) {
+        RenderView top;
+        top.position = global_camera.position + glm::vec3(0.0f, MINIMAP_HEIGHT, 0.0f);
+        top.view = glm::lookAt(top.position, global_camera.position, glm::vec3(0.0f, 0.0f, -1.0f));
+        top.projection = glm::ortho(-MINIMAP_EXTENT, MINIMAP_EXTENT, -MINIMAP_EXTENT, MINIMAP_EXTENT, 0.1f, MINIMAP_HEIGHT * 2.0f);
+        top.framebuffer = minimap.framebuffer();
+        top.viewport = glm::ivec4(0, 0, MINIMAP_SIZE, MINIMAP_SIZE);
+        top.passes = VIEW_PASS_CLEAR | VIEW_PASS_ENTITIES;
+        top.clear_color = glm::vec4(0.1f, 0.12f, 0.1f, 1.0f);
+        top.lod_bias = 1.0f;
+        top.min_pixels = 2.0f;
+        renderer->renderViews(entity_manager, &top, 1, []() {});
+    }
+
+    // Velocities of what moved, the sky has none
+    renderer->renderMotionVectors(entity_manager);
+    instance_ring.endFrame();
+    frame_arena.reset();
+
+    pipeline_stats.endPass();
+    gpu_queries.endElapsed();
+    gpu_queries.beginElapsed();
+    pipeline_stats.beginPass();
+
+    // Render skybox last, only where nothing drew
+    if (!atmosphere.render()) skybox->render();
 
-    // Render skybox last
-    skybox->render(&global_camera);
+    pipeline_stats.endPass();
+    gpu_queries.endElapsed();
+    // Replaces the scene's colour, outside the timed passes
+    if (use_overdraw_view) pipeline_stats.drawOverdraw(scene_target.width(), scene_target.height());
 
+    // Upscaled outside the timed passes, the controller budgets the scene alone. A batch render
+    // presents into its offscreen target instead of the window.
+    scene_target.present(temporal_aa.resolve(scene_target.colorTexture(), WINDOW_WIDTH, WINDOW_HEIGHT), batch_render.outputFramebuffer());
+    // Recorded without the UI drawn over it, see frame_readback.h
     #ifndef __EMSCRIPTEN__
-        glEndQuery(GL_TIME_ELAPSED);
-        queryIndex = 1 - queryIndex;
-        prevIndex = 1 - queryIndex;
+        if (!batch_render.active()) frame_recorder.captureFrame(WINDOW_WIDTH, WINDOW_HEIGHT, gpu_queries.frame());
     #endif
 
+
     glfwPollEvents();
+    frame_pacer.inputPolled();
 
-    // Handle mouse input for pausing/unpausing
-    if (glfwGetInputMode(window, GLFW_CURSOR) == GLFW_CURSOR_NORMAL && !ImGui::GetIO().WantCaptureMouse) {
+    // Handle mouse input for pausing/unpausing, a benchmark or a batch never pauses
+    if (benchmark.active() || batch_render.active()) {
+        paused = false;
+    } else if (glfwGetInputMode(window, GLFW_CURSOR) == GLFW_CURSOR_NORMAL && !ImGui::GetIO().WantCaptureMouse) {
         if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
             firstMouse = true;
             // Only set cursor mode, don't force disable immediately on web
@@ -407,6 +769,18 @@ void emscripten_main_loop_callback() {
             #endif
             paused = false;
         }
+
+        static bool pick_held = false;
+        const bool pick_pressed = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+        if (pick_pressed && !pick_held) {
+            double cursor_x, cursor_y;
+            int window_width, window_height;
+            glfwGetCursorPos(window, &cursor_x, &cursor_y);
+            glfwGetWindowSize(window, &window_width, &window_height);
+            const glm::vec2 ndc((float)(2.0 * cursor_x / window_width - 1.0), (float)(1.0 - 2.0 * cursor_y / window_height));
+            scene_query.raycast(SceneQuery::screenRay(view, projection, ndc), picked);
+        }
+        pick_held = pick_pressed;
     } else if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
         paused = true;
@@ -415,7 +789,7 @@ void emscripten_main_loop_callback() {
     // Handle fullscreen entry/exit - only on native platforms
     #ifndef __EMSCRIPTEN__
         static bool fullscreen_toggle = false;
-        if (glfwGetKey(window, GLFW_KEY_ENTER) == GLFW_PRESS && glfwGetKey(window, GLFW_KEY_LEFT_ALT) && !fullscreen_toggle) {
+        if (!benchmark.active() && glfwGetKey(window, GLFW_KEY_ENTER) == GLFW_PRESS && glfwGetKey(window, GLFW_KEY_LEFT_ALT) && !fullscreen_toggle) {
             fullscreen_toggle = true;
             GLFWmonitor *monitor = glfwGetPrimaryMonitor();
             const GLFWvidmode *vm = glfwGetVideoMode(monitor);
@@ -443,34 +817,95 @@ void emscripten_main_loop_callback() {
 
     // Toggle debug mode
     static bool prevGravePressed = false;
-    if (glfwGetKey(window, GLFW_KEY_GRAVE_ACCENT) == GLFW_PRESS && !prevGravePressed) {
+    if (!benchmark.active() && glfwGetKey(window, GLFW_KEY_GRAVE_ACCENT) == GLFW_PRESS && !prevGravePressed) {
         debug_mode = !debug_mode;
+        debug_overlay.invalidate();
     }
     prevGravePressed = (glfwGetKey(window, GLFW_KEY_GRAVE_ACCENT) == GLFW_PRESS);
 
+    // Capture the next frames as a Chrome trace, see trace_capture.h
+    static bool prevTracePressed = false;
+    if (!benchmark.active() && glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS && !prevTracePressed) {
+        trace_capture.start("trace_frame" + std::to_string(gpu_queries.frame() + 1) + ".json");
+    }
+    prevTracePressed = (glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS);
+
+    // Start or stop recording frames, see frame_readback.h
+    static bool prevRecordPressed = false;
+    if (!benchmark.active() && glfwGetKey(window, GLFW_KEY_F10) == GLFW_PRESS && !prevRecordPressed) {
+        use_frame_recording = !use_frame_recording;
+        printf("Frame recording %s\n", use_frame_recording ? ("into " + frame_recording_dir).c_str() : "stopped");
+    }
+    prevRecordPressed = (glfwGetKey(window, GLFW_KEY_F10) == GLFW_PRESS);
+
+    // Capture the next frame's opaque draws for --replay-draws, see draw_capture.h
+    static bool prevDrawCapturePressed = false;
+    if (!benchmark.active() && glfwGetKey(window, GLFW_KEY_F11) == GLFW_PRESS && !prevDrawCapturePressed) {
+        draw_capture.request("draws_frame" + std::to_string(gpu_queries.frame() + 1) + ".bin");
+    }
+    prevDrawCapturePressed = (glfwGetKey(window, GLFW_KEY_F11) == GLFW_PRESS);
+
     // ImGui UI
-    if (debug_mode) {
+    if (!debug_mode && !scene_loader.done()) {
+        PROFILE_SCOPE("ui");
+        ImGui_ImplOpenGL3_NewFrame();
+        ImGui_ImplGlfw_NewFrame();
+        ImGui::NewFrame();
+        loadProgressWindow(ImVec2(10, WINDOW_HEIGHT - 70));
+        ImGui::Render();
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    }
+    // Between rebuilds the overlay redraws the last one's vertices, see debug_overlay.h
+    if (debug_mode && !debug_overlay.due(glfwGetTime())) {
+        PROFILE_SCOPE("ui");
+        debug_overlay.present(false);
+    } else if (debug_mode) {
+        PROFILE_SCOPE("ui");
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
+        if (!scene_loader.done()) loadProgressWindow(ImVec2(10, WINDOW_HEIGHT - 70));
         ImGui::SetNextWindowPos(ImVec2(10, 10));
         ImGui::Begin("General");
         ImGui::Text("FPS: %.1f", fps);
         ImGui::Text("Triangles: %u", total_triangles);
+        ImGui::SliderFloat("Overlay rate (Hz)", &debug_overlay_hz, 0.0f, DEBUG_OVERLAY_MAX_HZ, debug_overlay_hz <= 0.0f ? "every frame" : "%.0f");
         
-        #ifndef __EMSCRIPTEN__
+        if (gl_extensions.timer_query) {
             ImGui::Text("GPU Frame Time:");
             ImGui::Text("Shadows: %.3f ms", shadowTime);
             ImGui::Text("Skybox: %.3f ms", skyboxTime);
+            ImGui::Text("Prepass: %.3f ms", prepassTime);
+            ImGui::Text("SSAO: %.3f ms", ssaoTime);
             ImGui::Text("Main: %.3f ms", mainTime);
-            ImGui::Text("Total GPU: %.3f ms", shadowTime + skyboxTime + mainTime);
+            ImGui::Text("Total GPU: %.3f ms", shadowTime + skyboxTime + prepassTime + ssaoTime + mainTime);
+            ImGui::Checkbox("Dynamic resolution", &use_dynamic_resolution);
+            if (use_dynamic_resolution) {
+                ImGui::SliderFloat("GPU budget (ms)", &dynamic_resolution_budget_ms, 4.0f, 33.3f, "%.1f");
+                ImGui::SliderFloat("Min scale", &resolution_scale_min, RESOLUTION_SCALE_LOWEST, 1.0f);
+                ImGui::SliderFloat("Max scale", &resolution_scale_max, RESOLUTION_SCALE_LOWEST, 1.0f);
+            }
+        } else {
+            ImGui::Text("(GPU timing unavailable)");
+        }
+        #ifndef __EMSCRIPTEN__
             if (ImGui::Button("V-Sync ON")) glfwSwapInterval(1);
             if (ImGui::Button("V-Sync OFF")) glfwSwapInterval(0);
-        #else
-            ImGui::Text("(GPU timing disabled on Web)");
+            ImGui::SliderInt("Frames in flight", &max_frames_in_flight, 0, FRAME_PACER_MAX_IN_FLIGHT, max_frames_in_flight == 0 ? "driver" : "%d");
+            ImGui::SliderFloat("FPS cap", &frame_rate_cap, 0.0f, 240.0f, frame_rate_cap == 0.0f ? "off" : "%.0f");
+            ImGui::Text("Latency ~%.1f ms, waited %.1f ms", frame_pacer.latencyMs(), frame_pacer.waitedMs());
+            ImGui::Checkbox("On-demand rendering", &use_on_demand_rendering);
+            if (use_on_demand_rendering) ImGui::Text("Skipped %llu idle frames", (unsigned long long)on_demand.skippedFrames());
+            ImGui::Checkbox("Record frames (F10)", &use_frame_recording);
+            ImGui::SameLine();
+            ImGui::Text("%llu written, %llu dropped", (unsigned long long)frame_recorder.recordedCount(),
+                        (unsigned long long)frame_recorder.droppedCount());
         #endif
         ImGui::End();
         
+        // Beside the stats, collapsed until opened
+        profiler.drawWindow(WINDOW_WIDTH - 320 - 430, 10);
+
         ImGui::SetNextWindowPos(ImVec2(WINDOW_WIDTH - 320, 10));
         ImGui::Begin("Render Stats");
         ImGui::Text("Entities: %d total, %d culled, %d rendered", 
@@ -481,8 +916,45 @@ void emscripten_main_loop_callback() {
                     renderer->stats.drawCalls,
                     renderer->stats.instancedDrawCalls);
         ImGui::Text("Instances Rendered: %d", renderer->stats.instancesRendered);
+        ImGui::Text("Submitted Draw Calls: %d", renderer->stats.submittedDrawCalls);
         ImGui::Text("Material Changes: %d", renderer->stats.materialChanges);
+        ImGui::Text("Materials: %zu interned, %zu mesh variants", material_registry.size(), material_registry.variantCount());
+        ImGui::Text("GL State Changes: %d (%d skipped)", renderer->stats.stateChanges, renderer->stats.stateChangesSkipped);
+        ImGui::Text("Uniform Uploads: %d (%d skipped)", renderer->stats.uniformUploads, renderer->stats.uniformUploadsSkipped);
         ImGui::Text("Triangles Rendered: %d", renderer->stats.trianglesRendered);
+        ImGui::Text("Impostors Rendered: %d", renderer->stats.impostorsRendered);
+        ImGui::Text("Skinned: %zu instances, %zu bones, %zu in crowds", skinned_animation.instanceCount(),
+                    skinned_animation.boneCount(), skinned_animation.crowdCount());
+        ImGui::Text("Particles: %zu emitters, %zu slots (%s)", particle_system.emitterCount(), particle_system.particleCount(),
+                    particle_system.computeSimulation() ? "compute" : "transform feedback");
+        ImGui::Text("Physics: %zu bodies, %zu awake, %zu contacts, %zu islands, %.2f ms", physics_world.bodyCount(),
+                    physics_world.awakeCount(), physics_world.contactCount(), physics_world.islandCount(), physics_world.stepMs());
+        if (const Entity* entity = entity_manager.get(picked.entity)) {
+            ImGui::Text("Picked: %s, %.2f m away (mesh %d, triangle %d)", entity->name.c_str(), picked.distance, picked.mesh, picked.triangle);
+        }
+        ImGui::Text("Occluded: %d", renderer->stats.entitiesOccluded);
+        ImGui::Text("Too small: %d", renderer->stats.entitiesTooSmall);
+        ImGui::Text("Meshlets: %d culled of %d", renderer->stats.meshletsCulled, renderer->stats.meshletsTested);
+        ImGui::Text("Static Chunks: %d of %d drawn", renderer->stats.staticChunksRendered, renderer->stats.staticChunksTotal);
+        if (!portal_visibility.empty()) {
+            ImGui::Checkbox("Portal culling", &use_portal_culling);
+            ImGui::SameLine();
+            if (portal_visibility.active()) {
+                ImGui::Text("%zu of %zu cells visible", portal_visibility.visibleCount(), portal_visibility.cellCount());
+            } else {
+                ImGui::Text("outside the %zu cells", portal_visibility.cellCount());
+            }
+        }
+        ImGui::Text("Shadow Casters: %d drawn, %d culled", renderer->stats.shadowCastersDrawn, renderer->stats.shadowCastersCulled);
+        ImGui::Text("Shadow Views Cached: %d, %d reused", renderer->stats.shadowViewsCached, renderer->stats.shadowViewsReused);
+        ImGui::Text("Shadow Atlas: %d lights, %.1f of %.1f Mtexels", renderer->stats.shadowedLights,
+                    renderer->stats.shadowAtlasTexels / 1e6, shadow_texel_budget / 1e6);
+        ImGui::Text("Light Clusters: %d lights, %d references, %d in the busiest", renderer->stats.clusterLights,
+                    renderer->stats.clusterIndices, renderer->stats.clusterMaxLights);
+        ImGui::Text("Frame Arena: %zu of %zu KB peak", frame_arena.peakBytes() / 1024, frame_arena.capacity() / 1024);
+        ImGui::Text("Render Graph: %d passes, %d culled, %d targets in %.1f MB (%.1f MB unaliased)", render_graph.stats().passes,
+                    render_graph.stats().culled, render_graph.stats().pooled, render_graph.stats().pooled_bytes / (1024.0 * 1024.0),
+                    render_graph.stats().transient_bytes / (1024.0 * 1024.0));
         
         float cullEfficiency = renderer->stats.entitiesTotal > 0 
             ? (float)renderer->stats.entitiesCulled / renderer->stats.entitiesTotal * 100.0f 
@@ -494,41 +966,443 @@ void emscripten_main_loop_callback() {
             : 0.0f;
         ImGui::Text("Avg Instances Per Draw Call: %.1d", (int)avgInstancesPerCall);
 
+        // What the GPU did with the above, a few frames late
+        if (ImGui::CollapsingHeader("Pipeline Statistics")) {
+            if (gl_extensions.pipeline_statistics) ImGui::Checkbox("Per-pass counters", &use_pipeline_statistics);
+            if (ImGui::Checkbox("Overdraw view", &use_overdraw_view)) temporal_aa.resetHistory();
+            const PipelineStatistics::Frame* counted = pipeline_stats.latest();
+            if (use_pipeline_statistics && counted && counted->passes.size() >= GPU_PASS_COUNT &&
+                ImGui::BeginTable("pipeline_stats", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+                for (const char* header : { "Pass", "VS", "Prims in", "Prims out", "FS" }) ImGui::TableSetupColumn(header);
+                ImGui::TableHeadersRow();
+                for (int pass = 0; pass < GPU_PASS_COUNT; ++pass) {
+                    const PipelineStatistics::PassCounts& counts = counted->passes[pass];
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn(); ImGui::Text("%s", GPU_PASS_NAMES[pass]);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)counts.vertices);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)counts.primitives);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)counts.clipped_primitives);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)counts.fragments);
+                }
+                ImGui::EndTable();
+                // Against the render resolution, so it includes the pixels only the sky covers
+                const double pixels = (double)scene_target.width() * scene_target.height();
+                if (pixels > 0.0) {
+                    ImGui::Text("Main pass: %.2f fragments shaded per pixel", counted->passes[GPU_PASS_MAIN].fragments / pixels);
+                }
+            }
+            if (use_overdraw_view) {
+                if (counted && counted->overdraw >= 0.0) {
+                    ImGui::Text("Overdraw: %.2fx per covered sample (%d+ counted as %d)", counted->overdraw,
+                                OVERDRAW_LEVELS - 1, OVERDRAW_LEVELS - 1);
+                } else {
+                    #ifdef __EMSCRIPTEN__
+                        ImGui::Text("Overdraw: heat map only, WebGL2 has no sample counts");
+                    #else
+                        ImGui::Text("Overdraw: waiting for the GPU");
+                    #endif
+                }
+            }
+        }
+        if (!use_dynamic_resolution) ImGui::SliderFloat("Resolution scale", &resolution_scale, RESOLUTION_SCALE_LOWEST, 1.0f);
+        ImGui::Checkbox("Quality governor", &use_quality_governor);
+        if (use_quality_governor) {
+            ImGui::SliderFloat("Frame budget (ms)", &quality_budget_ms, 4.0f, 50.0f);
+            ImGui::Text("Degraded: %d of %d steps%s%s, %d so far", quality_governor.level(), QUALITY_STEP_COUNT,
+                        quality_governor.level() > 0 ? ", last " : "",
+                        quality_governor.level() > 0 ? QUALITY_STEP_NAMES[quality_governor.level() - 1] : "", quality_governor.degrades());
+        }
+        ImGui::Text("Render Resolution: %dx%d %s (%s)", scene_target.width(), scene_target.height(), scene_target.hdr() ? "HDR" : "LDR",
+                    renderTargetFormatName(scene_target.colorFormat()));
+        int targetQuality = (int)render_target_quality;
+        if (ImGui::Combo("Target formats", &targetQuality, RENDER_TARGET_QUALITY_NAMES, RENDER_TARGETS_QUALITY_COUNT)) {
+            render_target_quality = (RenderTargetQuality)targetQuality;
+        }
+        if (ImGui::Checkbox("TAA", &use_taa)) temporal_aa.resetHistory();
+        static const int msaaSampleCounts[] = { 0, 2, 4, 8 };
+        int msaaIndex = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (msaaSampleCounts[i] == scene_msaa_samples) msaaIndex = i;
+        }
+        if (ImGui::Combo("MSAA", &msaaIndex, "Off\0" "2x\0" "4x\0" "8x\0")) scene_msaa_samples = msaaSampleCounts[msaaIndex];
+        int tonemapper = (int)post_tonemapper;
+        if (ImGui::Combo("Tonemapper", &tonemapper, TONEMAPPER_NAMES, TONEMAP_COUNT)) post_tonemapper = (Tonemapper)tonemapper;
+        ImGui::SliderFloat("Exposure (EV)", &post_exposure, -4.0f, 4.0f);
+        ImGui::SliderFloat("Contrast", &post_contrast, 0.5f, 1.5f);
+        ImGui::SliderFloat("Saturation", &post_saturation, 0.0f, 2.0f);
+        ImGui::ColorEdit3("Color filter", &post_color_filter.x);
+        ImGui::Checkbox("Dithering", &post_dithering);
+        if (gl_extensions.multi_draw_indirect) ImGui::Checkbox("Multi-draw indirect", &use_multi_draw_indirect);
+        if (vertex_pulling.pooling()) ImGui::Checkbox("Vertex pulling", &use_vertex_pulling);
+        if (gl_extensions.base_instance) ImGui::Checkbox("Meshlet culling", &use_meshlet_culling);
+        if (gl_extensions.compute_shader) ImGui::Checkbox("GPU culling", &use_gpu_culling);
+        if (gl_extensions.compute_shader) ImGui::Checkbox("GPU light clusters", &use_gpu_light_clusters);
+        #ifndef __EMSCRIPTEN__
+            ImGui::Checkbox("Occlusion culling", &use_occlusion_culling);
+            ImGui::Checkbox("Simulation thread", &use_sim_thread);
+        #endif
+        ImGui::Checkbox("Occlusion queries", &use_occlusion_queries);
+        ImGui::Checkbox("Static batching", &use_static_batching);
+        if (use_static_batching) {
+            ImGui::SameLine();
+            ImGui::Checkbox("HLOD proxies", &use_hlod);
+        }
+        ImGui::Checkbox("Weighted OIT", &use_weighted_oit);
+        ImGui::SameLine();
+        ImGui::Checkbox("Sorted instancing", &use_sorted_instancing);
+        if (use_weighted_oit) {
+            int transparentResolution = (int)transparent_resolution;
+            if (ImGui::Combo("Transparent resolution", &transparentResolution, TRANSPARENT_RESOLUTION_NAMES,
+                             TRANSPARENT_RESOLUTION_COUNT)) {
+                transparent_resolution = (TransparentResolution)transparentResolution;
+            }
+        }
+        ImGui::Checkbox("Skeletal animation", &use_skinned_animation);
+        ImGui::Checkbox("Particles", &use_particles);
+        ImGui::SameLine();
+        ImGui::Checkbox("Soft", &use_soft_particles);
+        ImGui::Checkbox("Physics", &use_physics);
+        if (terrain.ready()) {
+            ImGui::Checkbox("Terrain", &use_terrain);
+            ImGui::SameLine();
+            ImGui::Text("%zu tiles, %zu building", terrain.residentTiles(), terrain.pendingTiles());
+        }
+        if (world_partition.cellCount() > 0) {
+            ImGui::Checkbox("World streaming", &use_world_streaming);
+            ImGui::SameLine();
+            ImGui::Text("%zu/%zu cells, %zu loading, %.0f/%.0f MB", world_partition.residentCells(), world_partition.cellCount(),
+                        world_partition.loadingCells(), world_partition.residentBytes() / (1024.0 * 1024.0),
+                        world_partition.budgetBytes() / (1024.0 * 1024.0));
+            ImGui::Checkbox("Origin rebasing", &use_origin_rebasing);
+            ImGui::SameLine();
+            ImGui::Text("origin %.0f, %.0f", world_origin.origin().x, world_origin.origin().z);
+        }
+        if (!foliage.empty()) {
+            ImGui::Checkbox("Foliage", &use_foliage);
+            ImGui::SameLine();
+            ImGui::Text("%zu instances, %zu/%zu cells", foliage.instanceCount(), foliage.visibleCells(), foliage.cellCount());
+            if (GpuCulling::supported()) ImGui::Checkbox("GPU foliage culling", &use_gpu_foliage_culling);
+            ImGui::SliderFloat("Wind", &foliage_wind_strength, 0.0f, 3.0f);
+        }
+        if (!reflection_probes.empty()) {
+            ImGui::Checkbox("Reflection probes", &use_reflection_probes);
+            ImGui::SameLine();
+            ImGui::Text("%zu/%zu captured", reflection_probes.capturedCount(), reflection_probes.count());
+            if (ImGui::Button("Recapture probes")) reflection_probes.invalidate();
+            ImGui::SliderFloat("Probe refresh (s)", &reflection_probe_refresh_seconds, 0.0f, 10.0f);
+        }
+        ImGui::Checkbox("Minimap", &show_minimap);
+        ImGui::Checkbox("Deferred shading", &use_deferred_shading);
+        int prepassMode = (int)depth_prepass_mode;
+        if (ImGui::Combo("Depth prepass", &prepassMode, DEPTH_PREPASS_MODE_NAMES, PREPASS_MODE_COUNT)) {
+            depth_prepass_mode = (DepthPrepassMode)prepassMode;
+        }
+        if (depth_prepass_mode == PREPASS_AUTO) {
+            ImGui::SameLine();
+            ImGui::TextUnformatted(renderer->autoDepthPrepass() ? "(on)" : "(off)");
+        }
+        ImGui::SliderFloat("Prepass min occluder", &depth_prepass_min_screen_size, 0.0f, 0.5f);
+        ImGui::SliderFloat("Sky ambient", &ibl_intensity, 0.0f, 2.0f);
+        ImGui::Checkbox("Atmosphere", &use_atmosphere);
+        if (use_atmosphere && atmosphere.ready()) {
+            ImGui::SliderFloat("Time of day", &atmosphere_time_of_day, 0.0f, 24.0f, "%.1f h");
+            ImGui::SliderFloat("Sun azimuth", &atmosphere_sun_azimuth, -180.0f, 180.0f);
+            ImGui::SliderFloat("Sun illuminance", &atmosphere_sun_illuminance, 0.5f, 30.0f);
+        }
+        ImGui::Checkbox("Volumetric fog", &use_volumetric_fog);
+        if (use_volumetric_fog) {
+            ImGui::SameLine();
+            ImGui::Checkbox("Temporal##fog", &use_volumetric_fog_temporal);
+            ImGui::SliderFloat("Fog density", &volumetric_fog_density, 0.0f, 0.1f, "%.4f");
+            ImGui::SliderFloat("Fog height falloff", &volumetric_fog_height_falloff, 0.0f, 0.5f);
+            ImGui::SliderFloat("Fog anisotropy", &volumetric_fog_anisotropy, -0.9f, 0.9f);
+        }
+        ImGui::Checkbox("SSAO", &use_ssao);
+        ImGui::SameLine();
+        ImGui::Checkbox("Temporal", &use_ssao_temporal);
+        int ssaoQuality = (int)ssao_quality;
+        if (ImGui::Combo("SSAO quality", &ssaoQuality, SSAO_QUALITY_NAMES, SSAO_QUALITY_COUNT)) {
+            ssao_quality = (SsaoQuality)ssaoQuality;
+        }
+        ImGui::SliderFloat("SSAO radius", &ssao_radius, 0.1f, 2.0f);
+        ImGui::SliderFloat("SSAO intensity", &ssao_intensity, 0.0f, 4.0f);
+        ImGui::Checkbox("Lightmaps", &use_lightmaps);
+        if (ImGui::Button("Bake lightmaps")) bake_lightmaps_requested = true;
+        ImGui::SameLine();
+        if (ImGui::Button("Clear lightmaps")) renderer->clearLightmaps(entity_manager);
+        ImGui::Checkbox("Static shadow cache", &use_shadow_cache);
+        ImGui::Checkbox("Layered point shadows", &use_layered_shadows);
+        const uint64_t shadowBudgetMin = (uint64_t)SHADOW_MIN_TILE * SHADOW_MIN_TILE;
+        const uint64_t shadowBudgetMax = (uint64_t)SHADOW_WIDTH * SHADOW_HEIGHT * SHADOW_LAYERS;
+        ImGui::SliderScalar("Shadow texel budget", ImGuiDataType_U64, &shadow_texel_budget, &shadowBudgetMin, &shadowBudgetMax);
+        for (int cascade = 1; cascade < SHADOW_CASCADES; ++cascade) {
+            char label[48];
+            snprintf(label, sizeof(label), "Cascade %d update interval", cascade);
+            ImGui::SliderInt(label, &shadow_cascade_intervals[cascade], 1, SHADOW_MAX_UPDATE_INTERVAL);
+        }
+        ImGui::SliderFloat("Round-robin importance", &shadow_round_robin_importance, 0.0f, 1.0f);
+        ImGui::SliderInt("Shadow caster budget", &shadow_caster_budget, 0, 4096);
+        ImGui::SliderInt("Shadowed local lights", &shadow_max_local_lights, 0, FRAME_UNIFORMS_MAX_LIGHTS);
+
+        // Edits a copy, the map is recreated between frames (applyPendingShadowSettings)
+        ShadowSettings shadowSettings = shadow_settings;
+        int shadowPreset = -1;
+        for (int preset = 0; preset < SHADOW_PRESET_COUNT; ++preset) {
+            if (shadowPresetSettings((ShadowPreset)preset) == shadowSettings) shadowPreset = preset;
+        }
+        if (ImGui::BeginCombo("Shadow quality", shadowPreset >= 0 ? SHADOW_PRESET_NAMES[shadowPreset] : "custom")) {
+            for (int preset = 0; preset < SHADOW_PRESET_COUNT; ++preset) {
+                if (ImGui::Selectable(SHADOW_PRESET_NAMES[preset], preset == shadowPreset)) {
+                    shadowSettings = shadowPresetSettings((ShadowPreset)preset);
+                }
+            }
+            ImGui::EndCombo();
+        }
+        static const unsigned int shadowResolutions[] = { 512, 1024, 2048, 4096 };
+        static const char* const shadowResolutionNames[] = { "512", "1024", "2048", "4096" };
+        int shadowResolution = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (shadowResolutions[i] == shadowSettings.resolution) shadowResolution = i;
+        }
+        if (ImGui::Combo("Shadow resolution", &shadowResolution, shadowResolutionNames, 4)) {
+            shadowSettings.resolution = shadowResolutions[shadowResolution];
+        }
+        int shadowDepth = (int)shadowSettings.depth_format;
+        if (ImGui::Combo("Shadow depth", &shadowDepth, "16-bit\0" "24-bit\0" "32-bit float\0")) {
+            shadowSettings.depth_format = (ShadowDepthFormat)shadowDepth;
+        }
+        int shadowFilter = (int)shadowSettings.filter_quality;
+        if (ImGui::Combo("Shadow filter", &shadowFilter, "Hard\0" "PCF 4-tap\0" "Soft\0" "Moments (EVSM)\0")) {
+            shadowSettings.filter_quality = (ShadowFilterQuality)shadowFilter;
+        }
+        if (shadowSettings.filter_quality == SHADOW_FILTER_SOFT) {
+            ImGui::SliderInt("Shadow filter taps", &shadowSettings.max_filter_taps, 1, SHADOW_FILTER_MAX_TAPS);
+        }
+        if (shadowSettings != shadow_settings) requestShadowSettings(shadowSettings);
+        ImGui::Text("Shadow Memory: %.1f MB", shadowMemoryBytes(shadow_settings) / (1024.0 * 1024.0));
+        ImGui::SliderInt("Instances per draw", &max_instances_per_draw, 0, 65536, max_instances_per_draw == 0 ? "Unlimited" : "%d");
+
+        // Applied by Generate, a regenerated scene replaces the last one
+        if (ImGui::CollapsingHeader("Stress scene")) {
+            StressSceneSettings& stress = stress_scene.settings;
+            static const char* const stressPresetNames[] = { "1k", "10k", "100k", "1M" };
+            for (int preset = 0; preset < STRESS_SCENE_PRESET_COUNT; ++preset) {
+                if (preset > 0) ImGui::SameLine();
+                if (ImGui::RadioButton(stressPresetNames[preset], stress.instances == STRESS_SCENE_PRESET_INSTANCES[preset])) {
+                    stress.instances = STRESS_SCENE_PRESET_INSTANCES[preset];
+                }
+            }
+            ImGui::SliderInt("Instances", &stress.instances, 1, STRESS_SCENE_PRESET_INSTANCES[STRESS_SCENE_PRESET_COUNT - 1], "%d", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderFloat("Spacing", &stress.spacing, 0.5f, 20.0f);
+            ImGui::SliderFloat("LOD chain share", &stress.lod_mix, 0.0f, 1.0f);
+            ImGui::SliderInt("Material variants", &stress.material_variants, 1, STRESS_SCENE_MAX_VARIANTS);
+            ImGui::SliderInt("Lights", &stress.lights, 0, MAX_LIGHTS);
+            ImGui::SliderFloat("Dynamic share", &stress.dynamic_fraction, 0.0f, 1.0f);
+            if (ImGui::Button("Generate")) stress_scene.generate();
+            ImGui::SameLine();
+            if (ImGui::Button("Clear")) stress_scene.clear();
+            ImGui::Text("%zu entities, %zu dynamic, %zu lights", stress_scene.entityCount(),
+                        stress_scene.dynamicCount(), stress_scene.lightCount());
+        }
+
         ImGui::End();
 
-        ImGui::SetNextWindowPos(ImVec2(WINDOW_WIDTH - 200, WINDOW_HEIGHT - 130));
+        ImGui::SetNextWindowPos(ImVec2(WINDOW_WIDTH - 220, WINDOW_HEIGHT - 300));
         ImGui::Begin("LOD Stats");
-        ImGui::Text("LOD Stats:");
-        int lod0_count = 0, lod1_count = 0, lod2_count = 0;
-        for (size_t i = 0; i < entity_manager.size(); i++) {
-            Entity* e = entity_manager.getEntityAt(i);
-            if (!e || !e->active) continue;
-            
-            float dist = glm::length(global_camera.position - e->position);
-            if (dist < 25.0f) lod0_count++;
-            else if (dist < 60.0f) lod1_count++;
-            else lod2_count++;
-        }
-        ImGui::Text("LOD0 (high): %d entities", lod0_count);
-        ImGui::Text("LOD1 (med): %d entities", lod1_count);
-        ImGui::Text("LOD2 (low): %d entities", lod2_count);
+        ImGui::Text("LOD Stats (rendered entities):");
+        for (int level = 0; level < LOD_STATS_LEVELS; level++) {
+            ImGui::Text("LOD%d%s: %d entities", level, level == LOD_STATS_LEVELS - 1 ? "+" : "",
+                        renderer->stats.lodCounts[level]);
+        }
+        ImGui::Text("Culled: %d (%d occluded, %d too small)", renderer->stats.entitiesCulled,
+                    renderer->stats.entitiesOccluded, renderer->stats.entitiesTooSmall);
+        ImGui::Text("Render prototypes: %zu", render_prototypes.liveCount());
+        ImGui::Checkbox("Cross-fade", &use_lod_crossfade);
+        ImGui::Checkbox("Auto bias", &lod_auto_bias);
+        ImGui::SliderFloat("Bias", &lod_bias, 0.0f, LOD_MAX_BIAS);
+        ImGui::SliderFloat("Shadow bias", &shadow_lod_bias, 0.0f, SHADOW_LOD_MAX_BIAS);
+        ImGui::SliderFloat("Min size (px)", &small_object_cull_pixels, 0.0f, 8.0f);
+        ImGui::SliderFloat("Shadow min size (px)", &shadow_small_object_cull_pixels, 0.0f, 16.0f);
+        ImGui::Text("Shading: %d near, %d far", renderer->stats.shadingTierCounts[0], renderer->stats.shadingTierCounts[1]);
+        ImGui::Checkbox("Shading LOD", &use_shading_lod);
+        if (use_shading_lod) {
+            ImGui::SliderInt("Far from LOD", &shading_lod_far_level, 1, LOD_STATS_LEVELS);
+            ImGui::SliderFloat("Far from (m)", &shading_lod_far_distance, 5.0f, 200.0f);
+        }
+        ImGui::End();
+
+        ImGui::SetNextWindowPos(ImVec2(10, WINDOW_HEIGHT - 310), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(360, 300), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowCollapsed(true, ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("GPU Memory")) {
+            const double mb = 1024.0 * 1024.0;
+            ImGui::Text("%.1f MB in %zu allocations, %.1f MB peak", gpu_memory.total() / mb, gpu_memory.count(), gpu_memory.peak() / mb);
+            int budgetMb = (int)(gpu_memory_budget / (1024 * 1024));
+            if (ImGui::SliderInt("Budget (MB)", &budgetMb, 0, 8192, budgetMb == 0 ? "Off" : "%d")) {
+                gpu_memory_budget = (uint64_t)budgetMb * 1024 * 1024;
+            }
+            if (gpu_memory.overBudget()) ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Over budget by %.1f MB", (gpu_memory.total() - gpu_memory_budget) / mb);
+            ImGui::Checkbox("Mip residency", &use_texture_residency);
+            ImGui::Text("%zu textures, %.1f MB resident, %.1f MB wanted, %llu levels evicted", texture_residency.managedCount(),
+                        texture_residency.residentBytes() / mb, texture_residency.targetBytes() / mb,
+                        (unsigned long long)texture_residency.evictedLevels());
+            int residencyMb = (int)(texture_residency_budget / (1024 * 1024));
+            if (ImGui::SliderInt("Mip budget (MB)", &residencyMb, 16, 4096)) texture_residency_budget = (uint64_t)residencyMb * 1024 * 1024;
+            ImGui::Checkbox("Albedo atlas", &use_texture_atlas);
+            ImGui::SameLine();
+            ImGui::Text("%zu small maps in %zu arrays", texture_atlas.layerCount(), texture_atlas.arrayCount());
+            static const char* textureSizes[] = {"Full", "2048", "1024", "512"};
+            int textureSize = texture_max_size == 0 ? 0 : texture_max_size >= 2048 ? 1 : texture_max_size >= 1024 ? 2 : 3;
+            if (ImGui::Combo("Max texture size", &textureSize, textureSizes, IM_ARRAYSIZE(textureSizes))) {
+                texture_max_size = textureSize == 0 ? 0 : 4096 >> textureSize;
+            }
+            if (ImGui::IsItemHovered()) ImGui::SetTooltip("Applies to textures loaded from now on");
+            for (int category = 0; category < GPU_MEMORY_CATEGORY_COUNT; ++category) {
+                const uint64_t bytes = gpu_memory.categoryBytes((GpuMemoryCategory)category);
+                if (!ImGui::TreeNode(GPU_MEMORY_CATEGORY_NAMES[category], "%s: %.1f MB", GPU_MEMORY_CATEGORY_NAMES[category], bytes / mb)) continue;
+                for (const auto& [asset, assetBytes] : gpu_memory.assets((GpuMemoryCategory)category)) {
+                    ImGui::Text("%8.2f MB  %s", assetBytes / mb, asset.c_str());
+                }
+                ImGui::TreePop();
+            }
+        }
         ImGui::End();
 
+        ImGui::SetNextWindowPos(ImVec2(380, WINDOW_HEIGHT - 310), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(420, 300), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowCollapsed(true, ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("Frame Times")) {
+            static int frameSeries = 0;
+            const FrameTimeSeries* series[] = { &frame_stats.wall, &frame_stats.cpu, &frame_stats.gpu };
+            const char* const seriesNames[] = { "Frame", "CPU", "GPU" };
+            if (ImGui::BeginTable("frame_time_stats", 7, ImGuiTableFlags_SizingFixedFit)) {
+                for (const char* column : { "ms", "mean", "p50", "p95", "p99", "max", "hitches" }) ImGui::TableSetupColumn(column);
+                ImGui::TableHeadersRow();
+                for (int i = 0; i < 3; ++i) {
+                    const FrameTimeSeries::Summary summary = series[i]->summarize(frame_hitch_threshold_ms);
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted(seriesNames[i]);
+                    for (float value : { summary.mean, summary.p50, summary.p95, summary.p99, summary.max }) {
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.2f", value);
+                    }
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%zu (%llu)", summary.hitches, (unsigned long long)series[i]->hitchesTotal());
+                }
+                ImGui::EndTable();
+            }
+            ImGui::SliderFloat("Hitch over (ms)", &frame_hitch_threshold_ms, 5.0f, 100.0f, "%.1f");
+            ImGui::SameLine();
+            if (ImGui::Button("Reset")) frame_stats.clear();
+            ImGui::Combo("Series", &frameSeries, seriesNames, 3);
+
+            // Scaled to the hitch threshold, so a hitch always reaches the top of the plot
+            const FrameTimeSeries& shown = *series[frameSeries];
+            const float range = frame_hitch_threshold_ms * 1.5f;
+            ImGui::PlotLines("##frame_times", shown.data(), shown.size(), shown.offset(), nullptr, 0.0f, range, ImVec2(-1, 80));
+            float bins[FRAME_STATS_HISTOGRAM_BINS];
+            shown.histogram(range, bins, FRAME_STATS_HISTOGRAM_BINS);
+            char overlay[64];
+            snprintf(overlay, sizeof(overlay), "0 - %.0f ms, last bin and over", range);
+            ImGui::PlotHistogram("##frame_histogram", bins, FRAME_STATS_HISTOGRAM_BINS, 0, overlay, 0.0f, FLT_MAX, ImVec2(-1, 80));
+        }
+        ImGui::End();
+
+        if (show_minimap && minimap.colorTexture() != 0) {
+            ImGui::SetNextWindowPos(ImVec2(WINDOW_WIDTH - MINIMAP_SIZE - 30, 10), ImGuiCond_FirstUseEver);
+            if (ImGui::Begin("Minimap", &show_minimap, ImGuiWindowFlags_AlwaysAutoResize)) {
+                // GL's rows run bottom up
+                ImGui::Image((ImTextureID)(intptr_t)minimap.colorTexture(), ImVec2((float)MINIMAP_SIZE, (float)MINIMAP_SIZE),
+                             ImVec2(0.0f, 1.0f), ImVec2(1.0f, 0.0f));
+            }
+            ImGui::End();
+        }
+
         // Send stuff over to ImGui for rendering
         ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        debug_overlay.present(true);
     }
 
-    glfwSwapBuffers(window);
+    // The swap waits on vsync and the GPU, which would only blur the CPU side
+    profiler.endFrame();
+    pipeline_stats.endFrame();
+    gpu_queries.endFrame();
+    frame_stats.cpu.push(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - cpuFrameStart).count());
+    // A batch's window is hidden, its images come back from the offscreen target
+    if (!batch_render.active()) glfwSwapBuffers(window);
+    frame_pacer.endFrame();
+    gl_deletion_queue.endFrame();
+    // Whatever else could make the next frame differ from this one, the camera's compared inside
+    const bool animating = !paused && (!skinned_animation.empty() || (use_particles && particle_system.particleCount() > 0) ||
+                                       (use_physics && physics_world.awakeCount() > 0));
+    on_demand.endFrame(global_camera, animating || entity_manager.movedEntities().size() > 0 || !scene_loader.done() ||
+                                      asset_loader.pendingCount() > 0 || texture_streamer.pendingCount() > 0);
+
+    telemetry.update(renderer->stats);
+    if (benchmark.active()) {
+        benchmark.endFrame(renderer->stats);
+        if (benchmark.finished()) glfwSetWindowShouldClose(window, GLFW_TRUE);
+    }
+    if (batch_render.active()) {
+        batch_render.endFrame();
+        if (batch_render.finished()) glfwSetWindowShouldClose(window, GLFW_TRUE);
+    }
+    if (draw_capture.finished()) glfwSetWindowShouldClose(window, GLFW_TRUE);
 }
 
 // ============================================================================
 // MAIN ENTRY POINT
 // ============================================================================
 
-int main() {
+int main(int argc, char** argv) {
     
     printf("Starting OpenGL 3D Engine...\n");
+    trace_capture.nameThread("Main");
+
+    // Benchmark runs and camera path recording, see benchmark.h, stress scenes, see stress_scene.h,
+    // the load report, see load_stats.h, draw replays, see draw_capture.h, the asset pack, see asset_pack.h,
+    // crowds, see skinning.h, particles, see particles.h, frame pacing, see frame_pacer.h,
+    // on-demand rendering, see on_demand.h, the physics pile, see physics.h, triangle
+    // picking, see scene_query.h, the terrain, see terrain.h, batch rendering, see batch_render.h,
+    // frame recording, see frame_readback.h, scene files, see scene_file.h, world streaming,
+    // see world_partition.h, and vertex pulling, see vertex_pulling.h
+    #ifndef __EMSCRIPTEN__
+        for (int i = 1; i < argc;) {
+            int taken = benchmark.parseArg(argc, argv, i);
+            if (taken == 0) taken = stress_scene.parseArg(argc, argv, i);
+            if (taken == 0) taken = load_stats.parseArg(argc, argv, i);
+            if (taken == 0) taken = telemetry.parseArg(argc, argv, i);
+            if (taken == 0) taken = draw_capture.parseArg(argc, argv, i);
+            if (taken == 0) taken = asset_pack.parseArg(argc, argv, i);
+            if (taken == 0) taken = skinned_animation.parseArg(argc, argv, i);
+            if (taken == 0) taken = particle_system.parseArg(argc, argv, i);
+            if (taken == 0) taken = frame_pacer.parseArg(argc, argv, i);
+            if (taken == 0) taken = on_demand.parseArg(argc, argv, i);
+            if (taken == 0) taken = physics_world.parseArg(argc, argv, i);
+            if (taken == 0) taken = scene_query.parseArg(argc, argv, i);
+            if (taken == 0) taken = terrain.parseArg(argc, argv, i);
+            if (taken == 0) taken = batch_render.parseArg(argc, argv, i);
+            if (taken == 0) taken = frame_recorder.parseArg(argc, argv, i);
+            if (taken == 0) taken = scene_file.parseArg(argc, argv, i);
+            if (taken == 0) taken = world_partition.parseArg(argc, argv, i);
+            if (taken == 0) taken = vertex_pulling.parseArg(argc, argv, i);
+            if (taken == 0) taken = upload_context.parseArg(argc, argv, i);
+            if (taken < 0) return -1;
+            if (taken == 0) {
+                printf("Unknown argument %s\n", argv[i]);
+                return -1;
+            }
+            i += taken;
+        }
+        if (!benchmark.validate()) return -1;
+        if (asset_pack.writeRequested()) return asset_pack.write() ? 0 : -1;
+        // A pack's files don't change under a running build
+        asset_watcher.enabled = !asset_pack.open(buildAssetPath(ASSET_PACK_FILE));
+    #else
+        (void)argc;
+        (void)argv;
+    #endif
 
     // Check build type
     #ifdef NDEBUG
@@ -565,9 +1439,21 @@ int main() {
     
     // Remove resizability
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+
+    // Benchmarks render into a window nobody sees, at the default size. A batch's window only
+    // holds the context, at the image size the passes' targets follow.
+    if (benchmark.active() || batch_render.active()) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    #ifndef __EMSCRIPTEN__
+        if (batch_render.active()) {
+            WINDOW_WIDTH = batch_render.width();
+            WINDOW_HEIGHT = batch_render.height();
+        }
+        if (batch_render.egl()) glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    #endif
     
-    // Anti-aliasing
-    glfwWindowHint(GLFW_SAMPLES, 4);
+    // Anti-aliasing happens in the offscreen scene target (scene_msaa_samples), the window only
+    // receives the post pass
+    glfwWindowHint(GLFW_SAMPLES, 0);
     
     GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "OpenGL 3D Engine by @mu-gua-here", NULL, NULL);
     if (!window) {
@@ -588,6 +1474,12 @@ int main() {
     }
     
     printf("OpenGL Version: %s\n", glGetString(GL_VERSION));
+    loadGLExtensions((GLADloadproc)glfwGetProcAddress);
+    initTextureCompression();
+    texture_streamer.init();
+    if (upload_context.requested()) upload_context.init(window);
+    // Before the renderer builds its pulled programs and any mesh uploads
+    if (vertex_pulling.requested()) vertex_pulling.init();
     
     #ifndef __EMSCRIPTEN__
         // Set up ImGui
@@ -613,13 +1505,6 @@ int main() {
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     
-    // Performance settings - GPU timing queries not supported on WebGL
-    #ifndef __EMSCRIPTEN__
-        glGenQueries(2, shadowQueries);
-        glGenQueries(2, mainQueries);
-        glGenQueries(2, skyboxQueries);
-    #endif
-
     // Find executable path
     std::filesystem::path executable_path = getExecutablePath();
 
@@ -635,6 +1520,9 @@ int main() {
         printf("Renderer error: %s\n", e.what());
         return -1;
     }
+    if (terrain.requested()) terrain.init();
+    if (world_partition.requested() && !world_partition.init()) return -1;
+    if (telemetry.requested()) telemetry.init();
     
     // Initialize camera
     global_camera = create_camera(static_cast<float>(WINDOW_WIDTH) / static_cast<float>(WINDOW_HEIGHT));
@@ -657,6 +1545,15 @@ int main() {
     // LOAD ASSETS
     // ============================================================================
     
+    // Loading runs as scene_loader steps from the main loop: the loading screen shows until the sky
+    // is in, then entities join the scene as their meshes arrive
+
+    // On web only shaders and settings were preloaded, the rest of res/ downloads as it is asked for
+    asset_fetch.init(buildAssetPath("res/asset_manifest.txt"));
+
+    // Imports run on the job system, GL uploads happen within the loader's frame budget
+    job_system.init();
+
     // LOAD SKYBOXES //
     
     // Initialise skybox
@@ -669,46 +1566,74 @@ int main() {
     #endif
     g_skybox->initShader();
     
-    // Cloud skybox
-    std::string cloud_skybox_paths[6] = {
-        buildAssetPath("res/skyboxes/Cloud_skybox/cloud_skybox_right.png"),   // GL_TEXTURE_CUBE_MAP_POSITIVE_X
-        buildAssetPath("res/skyboxes/Cloud_skybox/cloud_skybox_left.png"),    // GL_TEXTURE_CUBE_MAP_NEGATIVE_X
-        buildAssetPath("res/skyboxes/Cloud_skybox/cloud_skybox_top.png"),     // GL_TEXTURE_CUBE_MAP_POSITIVE_Y
-        buildAssetPath("res/skyboxes/Cloud_skybox/cloud_skybox_bottom.png"),  // GL_TEXTURE_CUBE_MAP_NEGATIVE_Y
-        buildAssetPath("res/skyboxes/Cloud_skybox/cloud_skybox_front.png"),   // GL_TEXTURE_CUBE_MAP_POSITIVE_Z
-        buildAssetPath("res/skyboxes/Cloud_skybox/cloud_skybox_back.png")     // GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
-    };
-    
-    const char* cloud_skybox[6] = {
-        cloud_skybox_paths[0].c_str(),
-        cloud_skybox_paths[1].c_str(),
-        cloud_skybox_paths[2].c_str(),
-        cloud_skybox_paths[3].c_str(),
-        cloud_skybox_paths[4].c_str(),
-        cloud_skybox_paths[5].c_str()
-    };
-    
-    g_skybox->bindSkybox(cloud_skybox);
+    scene_loader.add("Loading sky", 1.0f, []() {
+        asset_fetch.fetchPrefix(CLOUD_SKYBOX_DIR, ASSET_PRIORITY_CRITICAL);
+        if (!asset_fetch.ready(CLOUD_SKYBOX_DIR)) return false;
+
+        // Cloud skybox, drawn when the atmosphere is off or unavailable
+        std::string cloud_skybox_paths[6];
+        cloudSkyboxPaths(cloud_skybox_paths);
+        const char* cloud_skybox[6] = {
+            cloud_skybox_paths[0].c_str(),
+            cloud_skybox_paths[1].c_str(),
+            cloud_skybox_paths[2].c_str(),
+            cloud_skybox_paths[3].c_str(),
+            cloud_skybox_paths[4].c_str(),
+            cloud_skybox_paths[5].c_str()
+        };
+        
+        g_skybox->bindSkybox(cloud_skybox);
+        // Ambient from the same sky, cached under cache/ibl/ after the first run
+        ibl.build(cloud_skybox, g_skybox->cubemap_texture[0]);
+
+        // The scene renders from here on, empty until the entities below come in
+        initialization_complete = true;
+        return true;
+    });
     
     // LOAD OBJ MESHES //
 
-    printf("Loading meshes...\n");
-    
-    auto level_mesh = loadMesh("level/level.obj");
+    // Shared by the steps, which outlive main()'s stack on web
+    struct SceneRequests {
+        std::shared_ptr<MeshRequest> level, tree, tree_lod1, tree_lod2, cube, sphere, cone;
+        std::shared_ptr<MeshRequest> instructions, statue, plastic_table;
+        std::shared_ptr<SkinnedModelRequest> character;
+        EntityTemplate tree_template;
+    };
+    auto scene = std::make_shared<SceneRequests>();
 
-    auto tree_mesh = loadMesh("realistic_tree/tree.obj");
-    auto tree_mesh_lod1 = loadMesh("realistic_tree/tree_lod1.obj");  // 50% triangles
-    auto tree_mesh_lod2 = loadMesh("realistic_tree/tree_lod2.obj");  // 25% triangles
-    
-    auto instructions_mesh = loadMesh("instructions_panel/quad.obj");    
-    auto cube_mesh = loadMesh("cube/cube.obj");    
-    auto sphere_mesh = loadMesh("sphere/sphere.obj");    
-    auto cone_mesh = loadMesh("cone/cone.obj");
-    auto statue_mesh = loadMesh("statue/statue_of_myself.obj");
-    auto plastic_table = loadMesh("plastic_table/plastic_table.obj");
-    // auto character_idle = loadMesh("characters3d.com - Idle.fbx");
-    
-    printf("Meshes finished loading!\n");
+    // --scene: the level, its models and lights come from the file instead
+    if (scene_file.requested() && !scene_file.addLoadSteps(scene_loader)) return -1;
+
+    scene_loader.add("Requesting meshes", 0.1f, [scene]() {
+        if (scene_file.requested()) return true;
+        printf("Loading meshes...\n");
+
+        // Static scenery that gets baked lighting, its lightmap UVs are made at import.
+        // On web the priority orders the downloads, what the first frame shows comes first.
+        // The terrain takes the ground quad's place when it's up.
+        if (!terrain.ready()) {
+            requestLightmapUVs("level/level.obj");
+            scene->level = asset_loader.loadMeshAsync("level/level.obj", ASSET_PRIORITY_CRITICAL);
+        }
+
+        scene->tree = asset_loader.loadMeshAsync("realistic_tree/tree.obj", ASSET_PRIORITY_CRITICAL);
+        scene->tree_lod1 = asset_loader.loadMeshAsync("realistic_tree/tree_lod1.obj", ASSET_PRIORITY_CRITICAL);  // 50% triangles
+        scene->tree_lod2 = asset_loader.loadMeshAsync("realistic_tree/tree_lod2.obj", ASSET_PRIORITY_CRITICAL);  // 25% triangles
+        
+        scene->cube = asset_loader.loadMeshAsync("cube/cube.obj", ASSET_PRIORITY_BACKGROUND);    
+        scene->sphere = asset_loader.loadMeshAsync("sphere/sphere.obj", ASSET_PRIORITY_BACKGROUND);    
+        scene->cone = asset_loader.loadMeshAsync("cone/cone.obj", ASSET_PRIORITY_BACKGROUND);
+        // Only the commented-out entities below use these. Declared, they cost nothing until
+        // lazy_entities.create() first places one, then download and import while a
+        // placeholder stands in.
+        scene->instructions = asset_loader.declareMesh("instructions_panel/quad.obj");
+        scene->statue = asset_loader.declareMesh("statue/statue_of_myself.obj");
+        scene->plastic_table = asset_loader.declareMesh("plastic_table/plastic_table.obj");
+        // Keeps its bones, so it loads apart from the static meshes
+        scene->character = skinned_animation.loadAsync("characters3d.com - Idle.fbx");
+        return true;
+    });
     
     // ============================================================================
     // CREATE SCENE OBJECTS
@@ -717,46 +1642,183 @@ int main() {
     // CREATE LIGHT SOURCES //
     
     // createDirLight("sun", glm::vec3(1, -1, -1), glm::vec3(1, 1, 1), 10);
-    createPointLight("lamp", {{}}, glm::vec3(0, 20, 0), glm::vec3(1, 1, 1), 250,
-                    glm::vec3(1, 1, 1), std::vector<int>{CULL_BACK});
+    if (!scene_file.requested()) {
+        createPointLight("lamp", {{}}, glm::vec3(0, 20, 0), glm::vec3(1, 1, 1), 250,
+                        glm::vec3(1, 1, 1), std::vector<int>{CULL_BACK});
+    }
     /* createSpotlight("spotlight", {{}}, glm::vec3(-20, 20, -20), glm::vec3(1, 1, 1), 1000,
                     glm::vec3(1, -1, 1), 7.5f, 17.5f,
                     glm::vec3(1, 1, 1), std::vector<int>{CULL_BACK}, false); */
 
-    // Initialise shadow map
+    // Initialise shadow map, with the quality from the settings file when there is one
+    if (loadShadowSettings(buildAssetPath("res/shadow_settings.cfg"), shadow_settings)) {
+        printf("Loaded shadow settings from res/shadow_settings.cfg\n");
+    }
     initShadowMap();
     printf("Shadow map initialized successfully!\n");
 
     // CREATE ENTITIES //
     
-    createEntity("level", {{1000.0f, level_mesh}}, glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), glm::vec3(100, 100, 100), std::vector<int> {CULL_NONE});
-    for (int i = 0; i < 10; i++) {
-        for (int j = 0; j < 10; j++) {
-            createEntity("tree",
-            {
-                {25.0f, tree_mesh},       // LOD0: full detail
-                {50.0f, tree_mesh_lod1},  // LOD1: medium detail
-                {75.0f, tree_mesh_lod2}   // LOD2: low detail
-            },
-            glm::vec3(i * 5, 0, -j * 5),
-            glm::vec3(0, 0, 0),
-            glm::vec3(1, 1, 1),
-            {CULL_BACK, CULL_NONE});
+    scene_loader.add("Loading level", 2.0f, [scene]() {
+        if (!scene->level) return true;
+        if (!scene->level->ready) return false;
+        // Static scenery is baked into chunks once it is in
+        entity_manager.setStatic(createEntity("level", {{1000.0f, scene->level->meshes}}, glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), glm::vec3(100, 100, 100), std::vector<int> {CULL_NONE}));
+        return true;
+    });
+
+    scene_loader.add("Loading trees", 3.0f, [scene]() {
+        if (!scene->tree) return true;
+        if (!scene->tree->ready || !scene->tree_lod1->ready || !scene->tree_lod2->ready) return false;
+
+        // Far trees draw as camera-facing cards from a baked atlas
+        auto tree_impostor = bakeImpostor(scene->tree->meshes);
+
+        EntityTemplate& tree_template = scene->tree_template;
+        tree_template.name = "tree";
+        tree_template.lod_specs = {
+            // Cross-fading hides the switches, so these sit at half the old popping distances
+            {12.5f, scene->tree->meshes},       // LOD0: full detail
+            {25.0f, scene->tree_lod1->meshes},  // LOD1: medium detail
+            {75.0f, scene->tree_lod2->meshes}   // LOD2: low detail
+        };
+        tree_template.cull_modes = {CULL_BACK, CULL_NONE};
+        tree_template.impostor = tree_impostor;  // Impostor beyond LOD2
+        tree_template.shadow_proxy_lod = 2;     // Its silhouette is all a shadow map resolves
+        tree_template.is_static = true;
+
+        // The stress scene spawns the trees with the props once those are in
+        if (stress_scene.requested() || benchmark.scene() == "stress") return true;
+
+        // The forest is foliage, scattered over the old grid's square at its one tree per 25 m^2.
+        // FOREST_SIZE=1000 in the environment gives a million trees for scaling runs.
+        int forest_size = 10;
+        if (const char* size = getenv("FOREST_SIZE")) forest_size = std::max(1, atoi(size));
+        FoliageLayerDesc trees;
+        trees.name = "trees";
+        trees.lod_specs = tree_template.lod_specs;
+        trees.cull_modes = tree_template.cull_modes;
+        trees.impostor = tree_impostor;
+        trees.impostor_distance = 400.0f;
+        trees.area_min = glm::vec2(0.0f, -forest_size * 5.0f);
+        trees.area_max = glm::vec2(forest_size * 5.0f, 0.0f);
+        trees.density = 1.0f / 25.0f;
+        trees.min_scale = 0.8f;
+        trees.max_scale = 1.2f;
+        trees.wind = 0.3f;
+        foliage.addLayer(trees);
+
+        // Grass around the origin, thinning out before the generated terrain starts to climb
+        FoliageLayerDesc grass;
+        grass.name = "grass";
+        grass.lod_specs = {{20.0f, {createGrassMesh(3)}}, {50.0f, {createGrassMesh(1)}}};
+        grass.area_min = glm::vec2(-100.0f);
+        grass.area_max = glm::vec2(100.0f);
+        grass.density = 4.0f;
+        grass.rule = [](const glm::vec2& p) { return std::clamp((100.0f - glm::length(p)) / 40.0f, 0.0f, 1.0f); };
+        grass.min_scale = 0.7f;
+        grass.max_scale = 1.4f;
+        grass.wind = 0.15f;
+        grass.casts_shadows = false;
+        grass.seed = 2;
+        foliage.addLayer(grass);
+        return true;
+    }, [scene]() {
+        if (!scene->tree) return 1.0f;
+        return (scene->tree->ready + scene->tree_lod1->ready + scene->tree_lod2->ready) / 3.0f;
+    });
+
+    scene_loader.add("Loading props", 1.0f, [scene]() {
+        if (!scene->cube) return true;
+        if (!scene->cube->ready || !scene->sphere->ready || !scene->cone->ready) return false;
+
+        // The stress scene spawns the same models at a chosen scale, in place of the tree grid
+        const auto prop_lods = [](const std::vector<std::shared_ptr<Mesh>>& meshes) {
+            return generatedLODSpecs(meshes, {12.5f, 25.0f, 75.0f});
+        };
+        const EntityTemplate& tree_template = scene->tree_template;
+        stress_scene.setModels({
+            {"tree", tree_template.lod_specs, tree_template.cull_modes, tree_template.impostor, tree_template.shadow_proxy_lod},
+            {"cube", prop_lods(scene->cube->meshes), {CULL_BACK}, nullptr, -1},
+            {"sphere", prop_lods(scene->sphere->meshes), {CULL_BACK}, nullptr, -1},
+            {"cone", prop_lods(scene->cone->meshes), {CULL_BACK}, nullptr, -1},
+        });
+        if (stress_scene.requested() || benchmark.scene() == "stress") stress_scene.generate();
+
+        // --physics: cubes dropped onto the ground plane
+        if (physics_world.bodiesRequested() > 0) {
+            EntityTemplate physics_template;
+            physics_template.name = "physics_cube";
+            physics_template.lod_specs = prop_lods(scene->cube->meshes);
+            physics_template.cull_modes = {CULL_BACK};
+            physics_world.setGround(0.0f);
+            physics_world.spawnPile(physics_template, physics_world.bodiesRequested(), glm::vec3(-15, 0, 10));
         }
-    }
-    /* createEntity("instructions", instructions_mesh, glm::vec3(0, 2, 4), glm::vec3(0, 0, 0), glm::vec3(1, 1, 1), std::vector<int> {CULL_NONE});
-    createEntity("cube", cube_mesh, glm::vec3(5, 3, 0), glm::vec3(0, 0, 0), glm::vec3(1, 1, 1), std::vector<int> {CULL_BACK});
-    createEntity("sphere", sphere_mesh, glm::vec3(0, 2, -5), glm::vec3(0, 0, 0), glm::vec3(1, 1, 1), std::vector<int> {CULL_BACK});
-    createEntity("cone", cone_mesh, glm::vec3(50, 3, 0), glm::vec3(45, 135, 315), glm::vec3(1, 1, 1), std::vector<int>{CULL_BACK});
-    createEntity("statue", statue_mesh, glm::vec3(-5, 1.9, -4), glm::vec3(0, 0, 0), glm::vec3(0.1, 0.1, 0.1), std::vector<int>{CULL_BACK});
-    createEntity("plastic_table", plastic_table, glm::vec3(-5, 0, -4), glm::vec3(0, 0, 0), glm::vec3(0.5, 0.5, 0.5), std::vector<int>{CULL_BACK}); */
-    // createEntity("character_idle", character_idle, glm::vec3(5, 0, 5), glm::vec3(0, 0, 0), glm::vec3(0.1, 0.1, 0.1), std::vector<int>{CULL_BACK});
-
-    printf("Total triangles: %d\n", total_triangles);
-    printf("Active entities: %zu\n", entity_manager.size());
-    
-    // Mark initialization as complete
-    initialization_complete = true;
+        return true;
+    });
+    /* createEntity("instructions", generatedLODSpecs(scene->instructions->meshes, {12.5f, 25.0f, 75.0f}), glm::vec3(0, 2, 4), glm::vec3(0, 0, 0), glm::vec3(1, 1, 1), std::vector<int> {CULL_NONE});
+    createEntity("cube", generatedLODSpecs(scene->cube->meshes, {12.5f, 25.0f, 75.0f}), glm::vec3(5, 3, 0), glm::vec3(0, 0, 0), glm::vec3(1, 1, 1), std::vector<int> {CULL_BACK});
+    createEntity("sphere", generatedLODSpecs(scene->sphere->meshes, {12.5f, 25.0f, 75.0f}), glm::vec3(0, 2, -5), glm::vec3(0, 0, 0), glm::vec3(1, 1, 1), std::vector<int> {CULL_BACK});
+    createEntity("cone", generatedLODSpecs(scene->cone->meshes, {12.5f, 25.0f, 75.0f}), glm::vec3(50, 3, 0), glm::vec3(45, 135, 315), glm::vec3(1, 1, 1), std::vector<int>{CULL_BACK});
+    createEntity("statue", generatedLODSpecs(scene->statue->meshes, {12.5f, 25.0f, 75.0f}), glm::vec3(-5, 1.9, -4), glm::vec3(0, 0, 0), glm::vec3(0.1, 0.1, 0.1), std::vector<int>{CULL_BACK});
+    createEntity("plastic_table", generatedLODSpecs(scene->plastic_table->meshes, {12.5f, 25.0f, 75.0f}), glm::vec3(-5, 0, -4), glm::vec3(0, 0, 0), glm::vec3(0.5, 0.5, 0.5), std::vector<int>{CULL_BACK}); */
+    // createEntity("character_idle", generatedLODSpecs(character_idle_request->meshes, {12.5f, 25.0f, 75.0f}), glm::vec3(5, 0, 5), glm::vec3(0, 0, 0), glm::vec3(0.1, 0.1, 0.1), std::vector<int>{CULL_BACK});
+
+    scene_loader.add("Loading characters", 0.5f, [scene]() {
+        skinned_animation.processUploads();
+        if (!scene->character) return true;
+        if (!scene->character->ready) return false;
+        if (!scene->character->failed) {
+            const glm::mat4 transform = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(5, 0, 5)), glm::vec3(0.1f));
+            skinned_animation.addInstance(scene->character->model, transform);
+            // --crowd: the same clip baked once and played back by every instance
+            if (skinned_animation.crowdRequested() > 0) {
+                const int baked = skinned_animation.bakeClip(scene->character->model, 0);
+                if (baked >= 0) skinned_animation.spawnCrowd(baked, skinned_animation.crowdRequested(), glm::vec3(5, 0, 25), 0.1f);
+            }
+        }
+        return true;
+    });
+
+    // --particles 0 leaves the scene without
+    scene_loader.add("Starting particles", 0.05f, []() {
+        if (particle_system.particlesRequested() > 0) particle_system.spawnFire(glm::vec3(-5, 0, 8), particle_system.particlesRequested());
+        return true;
+    });
+
+    // Reflection probes over the middle of the scene and in the forest, captured a face a frame
+    // once the scene is in
+    scene_loader.add("Placing reflection probes", 0.05f, []() {
+        reflection_probes.add(glm::vec3(0.0f, 2.0f, 0.0f), 20.0f);
+        reflection_probes.add(glm::vec3(25.0f, 3.0f, -25.0f), 25.0f);
+        return true;
+    });
+
+    scene_loader.add("Finishing", 0.1f, []() {
+        if (asset_loader.pendingCount() > 0) return false;
+        printf("Meshes finished loading!\n");
+        load_stats.report();
+        geometry_arenas.printStats();
+
+        // Null handles for entities that weren't created make their updates no-ops
+        scripted_entities[SCRIPTED_CUBE] = entity_manager.findHandle("cube");
+        scripted_entities[SCRIPTED_SPHERE] = entity_manager.findHandle("sphere");
+        scripted_entities[SCRIPTED_STATUE] = entity_manager.findHandle("statue");
+        scripted_entities[SCRIPTED_INSTRUCTIONS] = entity_manager.findHandle("instructions");
+        scripted_entities[SCRIPTED_CHARACTER_IDLE] = entity_manager.findHandle("character_idle");
+
+        printf("Total triangles: %d\n", total_triangles);
+        printf("Active entities: %zu\n", entity_manager.size());
+        printf("Scene finished loading!\n");
+        return true;
+    });
+    
+    // Measured runs and batches want the whole scene from their first frame
+    if (benchmark.active() || batch_render.active() || draw_capture.replayRequested()) scene_loader.finish();
+    if (benchmark.active() && !benchmark.start()) return -1;
+    if (batch_render.active() && !batch_render.start()) return -1;
+    if (draw_capture.replayRequested() && !draw_capture.startReplay(global_camera)) return -1;
+
     printf("Initialization complete! Engine ready.\n");
     
     // ============================================================================
@@ -777,9 +1839,11 @@ int main() {
     
     #ifdef __EMSCRIPTEN__
         // Set Emscripten main loop but let browser handle the frame rate
+        sim_thread.start(simulateFrame, false);
         emscripten_set_main_loop(emscripten_main_loop_callback, 0, 1);
     #else
     // Native platform - traditional while loop
+    sim_thread.start(simulateFrame, use_sim_thread);
     while (!glfwWindowShouldClose(window)) {
         emscripten_main_loop_callback();
     }
@@ -790,7 +1854,38 @@ int main() {
     // ============================================================================
     
     #ifndef __EMSCRIPTEN__
+    const int exit_code = benchmark.write() && benchmark.saveRecording() && draw_capture.report() && batch_render.finish() ? 0 : 1;
+
     printf("Cleaning up...\n");
+    telemetry.shutdown(app_ctx.renderer->stats);
+    sim_thread.stop();
+    // Its last frames are written on the job system
+    frame_recorder.release();
+    // Its tiles build on the workers
+    terrain.release();
+    job_system.shutdown();
+    world_partition.release();
+    entity_manager.clear();
+    lazy_entities.release();
+    scene_query.clearCache();
+    material_registry.clear();
+    geometry_arenas.clear();
+    // What the meshes released above still holds, before the pools it returns to go away
+    gl_deletion_queue.release();
+    vertex_pulling.release();
+    instance_ring.release();
+    skinned_animation.release();
+    particle_system.release();
+    foliage.clear();
+    reflection_probes.release();
+    minimap.release();
+    render_graph.release();
+    atmosphere.release();
+    frame_pacer.release();
+    frame_uniforms.release();
+    upload_context.shutdown();
+    texture_streamer.shutdown();
+    texture_atlas.release();
     skybox.cleanup();
     
     if (default_texture_id != 0) {
@@ -799,9 +1894,8 @@ int main() {
     }
 
     // Cleanup GPU timers
-    glDeleteQueries(2, shadowQueries);
-    glDeleteQueries(2, mainQueries);
-    glDeleteQueries(2, skyboxQueries);
+    pipeline_stats.release();
+    gpu_queries.release();
     
     cleanupShadowMap();
     
@@ -812,9 +1906,10 @@ int main() {
     
     glfwDestroyWindow(window);
     glfwTerminate();
-    #endif
-    
+    return exit_code;
+    #else
     return 0;
+    #endif
 }
 
 // ============================================================================
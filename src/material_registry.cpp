@@ -0,0 +1,91 @@
+#include "material_registry.h"
+#include "mesh_loader.h"
+#include "texture_cache.h"
+
+#include <cstring>
+#include <functional>
+
+MaterialRegistry material_registry;
+
+static void hashCombine(size_t& seed, size_t value) {
+    seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+}
+
+static size_t hashFloat(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return std::hash<uint32_t>{}(bits);
+}
+
+size_t MaterialHash::operator()(const Material& material) const {
+    size_t seed = 0;
+    for (GLuint texture : { material.albedo_map, material.normal_map, material.orm_map, material.height_map,
+                            material.emissive_map }) {
+        hashCombine(seed, std::hash<GLuint>{}(texture));
+    }
+    for (float value : { material.base_color.r, material.base_color.g, material.base_color.b, material.metallic,
+                         material.roughness, material.ao, material.emissive.r, material.emissive.g,
+                         material.emissive.b, material.height_scale }) {
+        hashCombine(seed, hashFloat(value));
+    }
+    hashCombine(seed, std::hash<int>{}(material.parallax_max_layers));
+    hashCombine(seed, std::hash<int>{}(material.lightmap_layer));
+    return seed;
+}
+
+uint32_t MaterialRegistry::intern(const Material& material) {
+    auto found = ids.find(material);
+    if (found != ids.end()) return found->second;
+
+    const uint32_t id = (uint32_t)materials.size();
+    materials.push_back(material);
+    retainMaterialTextures(material);
+    ids.emplace(material, id);
+    return id;
+}
+
+std::shared_ptr<Mesh> MaterialRegistry::withMaterial(const std::shared_ptr<Mesh>& mesh, uint32_t id) {
+    if (!mesh || MaterialEqual{}(mesh->material, materials[id])) return mesh;
+
+    Variant& variant = variants[{mesh.get(), id}];
+    std::shared_ptr<Mesh> result = variant.mesh.lock();
+    if (!result || variant.source.lock() != mesh) {
+        result = createMeshVariant(mesh, materials[id]);
+        variant.source = mesh;
+        variant.mesh = result;
+    }
+    if (variants.size() > pruned_size * 2 + 64) prune();
+    return result;
+}
+
+void MaterialRegistry::refresh(const std::shared_ptr<Mesh>& mesh) {
+    for (auto& [key, variant] : variants) {
+        if (key.mesh != mesh.get() || variant.source.lock() != mesh) continue;
+        if (std::shared_ptr<Mesh> current = variant.mesh.lock()) {
+            // The rebuilt variant's contents move into the one entities hold, the old ones are
+            // freed with it
+            std::shared_ptr<Mesh> rebuilt = createMeshVariant(mesh, materials[key.material]);
+            current->swapContents(*rebuilt);
+        }
+    }
+    for (const auto& lod : mesh->lods) refresh(lod);
+}
+
+void MaterialRegistry::prune() {
+    for (auto it = variants.begin(); it != variants.end();) {
+        if (it->second.mesh.expired() || it->second.source.expired()) {
+            it = variants.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    pruned_size = variants.size();
+}
+
+void MaterialRegistry::clear() {
+    variants.clear();
+    pruned_size = 0;
+    ids.clear();
+    for (Material& material : materials) releaseMaterialTextures(material);
+    materials.clear();
+}
@@ -0,0 +1,119 @@
+#include "material_table.h"
+#include "material.h"
+#include "material_registry.h"
+#include "lightmap.h"
+#include "texture_atlas.h"
+
+#include <algorithm>
+
+MaterialTable::~MaterialTable() {
+    release();
+}
+
+uint32_t materialFeatures(const Material& material) {
+    return (material.hasAlbedoMap() ? MATERIAL_FLAG_ALBEDO_MAP : 0) |
+           (material.hasNormalMap() ? MATERIAL_FLAG_NORMAL_MAP : 0) |
+           (material.hasORMMap() ? MATERIAL_FLAG_ORM_MAP : 0) |
+           (material.hasHeightMap() ? MATERIAL_FLAG_HEIGHT_MAP : 0) |
+           (material.hasEmissiveMap() ? MATERIAL_FLAG_EMISSIVE_MAP : 0) |
+           (use_lightmaps && material.hasLightmap() ? MATERIAL_FLAG_LIGHTMAP : 0);
+}
+
+GpuMaterial MaterialTable::pack(const Material& material) {
+    GpuMaterial gpu;
+    gpu.base_color = glm::vec4(material.base_color, material.metallic);
+    gpu.emissive = glm::vec4(material.emissive, material.roughness);
+    gpu.ao = material.ao;
+    gpu.height_scale = material.height_scale;
+    gpu.lightmap_layer = material.lightmap_layer;
+    gpu.parallax_max_layers = std::clamp(material.parallax_max_layers, 0, PARALLAX_MAX_LAYERS);
+    GLuint atlas = 0;
+    if (!use_texture_atlas || !texture_atlas.find(material.albedo_map, atlas, gpu.albedo_layer)) gpu.albedo_layer = -1;
+    return gpu;
+}
+
+void MaterialTable::beginFrame() {
+    materials.clear();
+    hashes.clear();
+    std::fill(buckets.begin(), buckets.end(), 0u);
+    uploaded = 0;
+    scratch_id = UINT32_MAX;
+}
+
+void MaterialTable::rehash(size_t bucket_count) {
+    buckets.assign(bucket_count, 0u);
+    const size_t mask = bucket_count - 1;
+    for (uint32_t id = 0; id < materials.size(); ++id) {
+        size_t bucket = hashes[id] & mask;
+        while (buckets[bucket] != 0) bucket = (bucket + 1) & mask;
+        buckets[bucket] = id + 1;
+    }
+}
+
+uint32_t MaterialTable::idFor(const Material& material) {
+    if (buckets.empty()) rehash(MATERIAL_TABLE_SLOTS * 2);
+
+    const size_t hash = MaterialHash{}(material);
+    const size_t mask = buckets.size() - 1;
+    size_t bucket = hash & mask;
+    for (; buckets[bucket] != 0; bucket = (bucket + 1) & mask) {
+        uint32_t id = buckets[bucket] - 1;
+        if (hashes[id] == hash && materials[id]->bindsLike(material)) return id;
+    }
+
+    uint32_t id = (uint32_t)materials.size();
+    materials.push_back(&material);
+    hashes.push_back(hash);
+    buckets[bucket] = id + 1;
+    // Keep probes short, under half full
+    if (materials.size() * 2 > buckets.size()) rehash(buckets.size() * 2);
+    return id;
+}
+
+void MaterialTable::upload() {
+    const size_t slots = std::min<size_t>(materials.size(), MATERIAL_TABLE_SLOTS - 1);
+    if (buffer == 0) {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, MATERIAL_TABLE_SLOTS * sizeof(GpuMaterial), nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, buffer);
+    } else {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        // First write of the frame orphans, the previous frame's draws may still read it
+        if (uploaded == 0 && slots > 0) {
+            glBufferData(GL_UNIFORM_BUFFER, MATERIAL_TABLE_SLOTS * sizeof(GpuMaterial), nullptr, GL_DYNAMIC_DRAW);
+        }
+    }
+
+    if (slots > uploaded) {
+        GpuMaterial packed[MATERIAL_TABLE_SLOTS];
+        for (size_t i = uploaded; i < slots; ++i) packed[i - uploaded] = pack(*materials[i]);
+        glBufferSubData(GL_UNIFORM_BUFFER, (GLintptr)(uploaded * sizeof(GpuMaterial)),
+                        (GLsizeiptr)((slots - uploaded) * sizeof(GpuMaterial)), packed);
+        uploaded = slots;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+int MaterialTable::slotFor(uint32_t id) {
+    if (buffer == 0) upload();
+    if (id < MATERIAL_TABLE_SLOTS - 1) {
+        // Registered after upload(), e.g. a static chunk's material seen first at submit
+        if (id >= uploaded) upload();
+        return (int)id;
+    }
+
+    if (scratch_id != id) {
+        GpuMaterial packed = pack(*materials[id]);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, (MATERIAL_TABLE_SLOTS - 1) * sizeof(GpuMaterial), sizeof(GpuMaterial), &packed);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        scratch_id = id;
+    }
+    return MATERIAL_TABLE_SLOTS - 1;
+}
+
+void MaterialTable::release() {
+    if (buffer != 0) glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
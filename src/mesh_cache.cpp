@@ -0,0 +1,410 @@
+#include "mesh_cache.h"
+#include "mesh_loader.h"
+#include "filesystem.h"
+#include "mesh.h"
+#include "lightmap.h"
+#include "load_stats.h"
+#include "mesh_codec.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+
+// ============================================================================
+// COOKED MESH FORMAT
+// ============================================================================
+//
+//  CookedMeshHeader
+//  source path (path_length bytes)
+//  per sub-mesh: CookedSubMeshRecord + material record + lod count, then per LOD a
+//                CookedSubMeshRecord + float error
+//  per node instance (node instancing imports): uint32 sub-mesh + 16 floats, column-major
+//  vertex/index/meshlet blobs, each 16-byte aligned and referenced by absolute offset. Vertices
+//  and indices go through the mesh codecs, then LZ where the record's encoding says so; meshlets
+//  are stored raw.
+
+static const char COOKED_MESH_MAGIC[4] = {'C', 'M', 'S', 'H'};
+
+#define COOKED_VERTEX_LZ 0x1 // CookedSubMeshRecord::encoding
+#define COOKED_INDEX_LZ 0x2
+
+bool cooked_mesh_lz = true;
+
+struct CookedMeshHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t source_mtime;
+    uint32_t import_flags;
+    uint32_t submesh_count;
+    uint32_t path_length;
+    uint32_t lod_levels; // mesh_lod_levels at cook time
+    uint32_t instance_count; // MeshStaging::instances
+};
+
+struct CookedSubMeshRecord {
+    uint32_t vertex_count;
+    uint32_t vertex_format;
+    uint32_t index_count;
+    uint32_t triangle_count;
+    uint32_t vertex_stride;
+    uint32_t index_size;
+    uint64_t vertex_offset;
+    uint64_t index_offset;
+    float bounds[4]; // Bounding sphere, xyz centre and w radius
+    float bounds_min[3]; // AABB
+    float bounds_max[3];
+    uint32_t meshlet_count; // Meshlets as laid out in meshlets.h, 0 for meshes not split
+    uint32_t encoding; // COOKED_*_LZ
+    uint64_t meshlet_offset;
+    uint64_t vertex_encoded_bytes; // Stored sizes of the two blobs
+    uint64_t index_encoded_bytes;
+};
+
+namespace {
+
+class CookWriter {
+public:
+    std::vector<unsigned char> bytes;
+
+    void putBytes(const void* data, size_t size) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        bytes.insert(bytes.end(), p, p + size);
+    }
+
+    template <typename T>
+    void put(const T& value) { putBytes(&value, sizeof(T)); }
+
+    void putString(const std::string& str) {
+        put<uint32_t>(static_cast<uint32_t>(str.size()));
+        putBytes(str.data(), str.size());
+    }
+
+    void align(size_t alignment) {
+        while (bytes.size() % alignment != 0) bytes.push_back(0);
+    }
+};
+
+class CookReader {
+public:
+    CookReader(const unsigned char* data, size_t size) : data(data), size(size) {}
+
+    bool getBytes(void* out, size_t count) {
+        if (failed || cursor + count > size) { failed = true; return false; }
+        memcpy(out, data + cursor, count);
+        cursor += count;
+        return true;
+    }
+
+    template <typename T>
+    bool get(T& value) { return getBytes(&value, sizeof(T)); }
+
+    bool getString(std::string& str) {
+        uint32_t length = 0;
+        if (!get(length) || cursor + length > size) { failed = true; return false; }
+        str.assign(reinterpret_cast<const char*>(data + cursor), length);
+        cursor += length;
+        return true;
+    }
+
+    bool inBounds(uint64_t offset, uint64_t count) const { return offset + count <= size; }
+    bool ok() const { return !failed; }
+
+private:
+    const unsigned char* data;
+    size_t size;
+    size_t cursor = 0;
+    bool failed = false;
+};
+
+void writeMaterialRecord(CookWriter& w, const MaterialDesc& desc) {
+    w.putString(desc.name);
+    w.put<uint8_t>(desc.has_base_color ? 1 : 0);
+    w.put(desc.base_color);
+    w.put(desc.metallic);
+    w.put(desc.roughness);
+    w.put(desc.emissive);
+    w.put(desc.height_scale);
+    w.put<uint8_t>(desc.invert_height ? 1 : 0);
+    w.putString(desc.albedo_path);
+    w.putString(desc.normal_path);
+    w.putString(desc.emissive_path);
+    w.putString(desc.ao_path);
+    w.putString(desc.roughness_path);
+    w.putString(desc.metallic_path);
+    w.putString(desc.height_path);
+    w.putString(desc.specular_path);
+}
+
+bool readMaterialRecord(CookReader& r, MaterialDesc& desc) {
+    uint8_t has_base_color = 0, invert_height = 0;
+    r.getString(desc.name);
+    r.get(has_base_color);
+    r.get(desc.base_color);
+    r.get(desc.metallic);
+    r.get(desc.roughness);
+    r.get(desc.emissive);
+    r.get(desc.height_scale);
+    r.get(invert_height);
+    r.getString(desc.albedo_path);
+    r.getString(desc.normal_path);
+    r.getString(desc.emissive_path);
+    r.getString(desc.ao_path);
+    r.getString(desc.roughness_path);
+    r.getString(desc.metallic_path);
+    r.getString(desc.height_path);
+    r.getString(desc.specular_path);
+    desc.has_base_color = has_base_color != 0;
+    desc.invert_height = invert_height != 0;
+    return r.ok();
+}
+
+} // namespace
+
+std::string getCookedMeshPath(const std::string& filepath) {
+    std::string name = filepath;
+    for (char& c : name) {
+        if (c == '/' || c == '\\' || c == ' ' || c == ':') c = '_';
+    }
+    return buildAssetPath("cache/meshes/" + name + ".cmesh");
+}
+
+bool loadCookedMeshStaging(const std::string& filepath, const std::string& sourcePath, uint32_t importFlags, MeshStaging& staging) {
+    LoadTimer timer(LOAD_STAGE_COOKED_READ);
+    auto file = std::make_shared<MappedFile>(getCookedMeshPath(filepath));
+    if (!file->isOpen()) return false;
+    timer.addBytesRead(file->size());
+
+    CookReader reader(file->data(), file->size());
+    CookedMeshHeader header;
+    if (!reader.get(header) || memcmp(header.magic, COOKED_MESH_MAGIC, 4) != 0) return false;
+
+    if (header.version != COOKED_MESH_VERSION || header.import_flags != importFlags ||
+        header.lod_levels != mesh_lod_levels || header.source_mtime != getFileModifiedTime(sourcePath)) {
+        printf("Cooked mesh for '%s' is stale, re-importing\n", filepath.c_str());
+        return false;
+    }
+
+    std::string cookedSource(header.path_length, '\0');
+    if (!reader.getBytes(cookedSource.data(), header.path_length) || cookedSource != filepath) return false;
+
+    // Decodes a blob, through LZ first when the record says so, into dst
+    std::vector<unsigned char> unpacked;
+    auto decodeBlob = [&](uint64_t offset, uint64_t size, bool lz, auto&& decode) {
+        const unsigned char* src = file->data() + offset;
+        if (lz) {
+            if (!lzDecompress(src, (size_t)size, unpacked)) return false;
+            return decode(unpacked.data(), unpacked.size());
+        }
+        return decode(src, (size_t)size);
+    };
+
+    // Decoded here on the loading worker into the staging buffers the upload reads from
+    auto readGeometry = [&](const CookedSubMeshRecord& rec, SubMeshStaging& sub) {
+        // Cooked with the other vertex layout setting, re-import rather than mix formats
+        if (((rec.vertex_format & VERTEX_PACKED) != 0) != use_packed_vertices) {
+            printf("Cooked mesh for '%s' uses a different vertex format, re-importing\n", filepath.c_str());
+            return false;
+        }
+        if (((rec.vertex_format & VERTEX_LIGHTMAP_UV) != 0) != wantsLightmapUVs(filepath)) {
+            printf("Cooked mesh for '%s' differs in lightmap UVs, re-importing\n", filepath.c_str());
+            return false;
+        }
+
+        size_t vertex_bytes = (size_t)rec.vertex_count * rec.vertex_stride;
+        size_t index_bytes = (size_t)rec.index_count * rec.index_size;
+        size_t meshlet_bytes = (size_t)rec.meshlet_count * sizeof(Meshlet);
+        if (rec.vertex_stride != getVertexLayout(rec.vertex_format).stride ||
+            (rec.index_size != sizeof(uint16_t) && rec.index_size != sizeof(uint32_t)) ||
+            !reader.inBounds(rec.vertex_offset, rec.vertex_encoded_bytes) || !reader.inBounds(rec.index_offset, rec.index_encoded_bytes) ||
+            !reader.inBounds(rec.meshlet_offset, meshlet_bytes)) {
+            printf("Cooked mesh for '%s' is corrupt, re-importing\n", filepath.c_str());
+            return false;
+        }
+
+        LoadTimer decode_timer(LOAD_STAGE_MESH_DECODE);
+        sub.vertices.resize(vertex_bytes);
+        bool decoded = decodeBlob(rec.vertex_offset, rec.vertex_encoded_bytes, (rec.encoding & COOKED_VERTEX_LZ) != 0,
+                                  [&](const unsigned char* src, size_t size) {
+                                      return decodeVertexBuffer(sub.vertices.data(), rec.vertex_count, rec.vertex_stride, src, size);
+                                  });
+        void* indices = nullptr;
+        if (rec.index_size == sizeof(uint16_t)) {
+            sub.indices16.resize(rec.index_count);
+            indices = sub.indices16.data();
+        } else {
+            sub.indices.resize(rec.index_count);
+            indices = sub.indices.data();
+        }
+        decoded = decoded && decodeBlob(rec.index_offset, rec.index_encoded_bytes, (rec.encoding & COOKED_INDEX_LZ) != 0,
+                                        [&](const unsigned char* src, size_t size) {
+                                            return decodeIndexBuffer(indices, rec.index_count, rec.index_size, src, size);
+                                        });
+        if (!decoded) {
+            printf("Cooked mesh for '%s' is corrupt, re-importing\n", filepath.c_str());
+            return false;
+        }
+
+        sub.vertex_data = sub.vertices.data();
+        sub.vertex_bytes = vertex_bytes;
+        sub.vertex_format = rec.vertex_format;
+        sub.index_type = rec.index_size == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        sub.index_data = indices;
+        sub.index_bytes = index_bytes;
+        sub.meshlet_data = rec.meshlet_count > 0 ? reinterpret_cast<const Meshlet*>(file->data() + rec.meshlet_offset) : nullptr;
+        sub.meshlet_count = rec.meshlet_count;
+        sub.triangle_count = rec.triangle_count;
+        sub.bounds = glm::vec4(rec.bounds[0], rec.bounds[1], rec.bounds[2], rec.bounds[3]);
+        sub.bounds_min = glm::vec3(rec.bounds_min[0], rec.bounds_min[1], rec.bounds_min[2]);
+        sub.bounds_max = glm::vec3(rec.bounds_max[0], rec.bounds_max[1], rec.bounds_max[2]);
+        return true;
+    };
+
+    std::vector<SubMeshStaging> submeshes(header.submesh_count);
+    for (uint32_t i = 0; i < header.submesh_count; ++i) {
+        SubMeshStaging& sub = submeshes[i];
+        CookedSubMeshRecord rec;
+        uint32_t lod_count = 0;
+        if (!reader.get(rec) || !readMaterialRecord(reader, sub.material) || !reader.get(lod_count) ||
+            lod_count > header.lod_levels || !readGeometry(rec, sub)) return false;
+
+        sub.lods.resize(lod_count);
+        for (auto& lod : sub.lods) {
+            if (!reader.get(rec) || !reader.get(lod.lod_error) || !readGeometry(rec, lod)) return false;
+        }
+    }
+
+    std::vector<MeshNodeInstance> instances(header.instance_count);
+    for (MeshNodeInstance& instance : instances) {
+        if (!reader.get(instance.submesh) || !reader.get(instance.transform) || instance.submesh >= header.submesh_count) {
+            printf("Cooked mesh for '%s' is corrupt, re-importing\n", filepath.c_str());
+            return false;
+        }
+    }
+
+    for (auto& sub : submeshes) sub.images = decodeMaterialImages(sub.material, nullptr);
+
+    staging.submeshes = std::move(submeshes);
+    staging.instances = std::move(instances);
+    staging.mapping = std::move(file);
+    staging.from_cache = true;
+    return true;
+}
+
+bool writeCookedMesh(const std::string& filepath, const std::string& sourcePath, uint32_t importFlags, const MeshStaging& staging) {
+    LoadTimer timer(LOAD_STAGE_COOK_WRITE);
+    if (staging.submeshes.empty()) return false;
+
+    for (const auto& sub : staging.submeshes) {
+        if (sub.material.usesEmbeddedTextures()) {
+            printf("Not cooking '%s': embedded textures need the source scene\n", filepath.c_str());
+            return false;
+        }
+    }
+
+    CookWriter writer;
+    CookedMeshHeader header;
+    memcpy(header.magic, COOKED_MESH_MAGIC, 4);
+    header.version = COOKED_MESH_VERSION;
+    header.source_mtime = getFileModifiedTime(sourcePath);
+    header.import_flags = importFlags;
+    header.submesh_count = static_cast<uint32_t>(staging.submeshes.size());
+    header.path_length = static_cast<uint32_t>(filepath.size());
+    header.lod_levels = mesh_lod_levels;
+    header.instance_count = static_cast<uint32_t>(staging.instances.size());
+    writer.put(header);
+    writer.putBytes(filepath.data(), filepath.size());
+
+    // Stores an encoded blob, LZ-packed when that is smaller, and returns whether it was
+    std::vector<unsigned char> packed;
+    auto putBlob = [&](const std::vector<unsigned char>& encoded, uint64_t& offset, uint64_t& size) {
+        writer.align(16);
+        offset = writer.bytes.size();
+        if (cooked_mesh_lz) lzCompress(encoded.data(), encoded.size(), packed);
+        const bool lz = cooked_mesh_lz && packed.size() < encoded.size();
+        const std::vector<unsigned char>& blob = lz ? packed : encoded;
+        writer.putBytes(blob.data(), blob.size());
+        size = blob.size();
+        return lz;
+    };
+
+    // Records first, blob offsets are patched once the blobs are laid out
+    std::vector<std::pair<size_t, const SubMeshStaging*>> records;
+    auto putRecord = [&](const SubMeshStaging& sub) {
+        CookedSubMeshRecord rec = {};
+        rec.vertex_format = sub.vertex_format;
+        rec.vertex_stride = getVertexLayout(sub.vertex_format).stride;
+        rec.vertex_count = static_cast<uint32_t>(sub.vertex_bytes / rec.vertex_stride);
+        rec.index_size = static_cast<uint32_t>(getIndexSize(sub.index_type));
+        rec.index_count = static_cast<uint32_t>(sub.index_bytes / rec.index_size);
+        rec.triangle_count = sub.triangle_count;
+        rec.meshlet_count = static_cast<uint32_t>(sub.meshlet_count);
+        for (int k = 0; k < 4; ++k) rec.bounds[k] = sub.bounds[k];
+        for (int k = 0; k < 3; ++k) {
+            rec.bounds_min[k] = sub.bounds_min[k];
+            rec.bounds_max[k] = sub.bounds_max[k];
+        }
+        records.push_back({ writer.bytes.size(), &sub });
+        writer.put(rec);
+    };
+
+    for (const auto& sub : staging.submeshes) {
+        putRecord(sub);
+        writeMaterialRecord(writer, sub.material);
+        writer.put<uint32_t>(static_cast<uint32_t>(sub.lods.size()));
+        for (const auto& lod : sub.lods) {
+            putRecord(lod);
+            writer.put(lod.lod_error);
+        }
+    }
+    for (const MeshNodeInstance& instance : staging.instances) {
+        writer.put(instance.submesh);
+        writer.put(instance.transform);
+    }
+
+    size_t raw_bytes = 0;
+    for (const auto& [position, sub] : records) {
+        CookedSubMeshRecord rec;
+        memcpy(&rec, writer.bytes.data() + position, sizeof(rec));
+
+        std::vector<unsigned char> encoded;
+        encodeVertexBuffer(static_cast<const unsigned char*>(sub->vertex_data), rec.vertex_count, rec.vertex_stride, encoded);
+        if (putBlob(encoded, rec.vertex_offset, rec.vertex_encoded_bytes)) rec.encoding |= COOKED_VERTEX_LZ;
+        raw_bytes += sub->vertex_bytes;
+
+        encodeIndexBuffer(sub->index_data, rec.index_count, rec.index_size, encoded);
+        if (putBlob(encoded, rec.index_offset, rec.index_encoded_bytes)) rec.encoding |= COOKED_INDEX_LZ;
+        raw_bytes += sub->index_bytes;
+
+        writer.align(16);
+        rec.meshlet_offset = writer.bytes.size();
+        writer.putBytes(sub->meshlet_data, sub->meshlet_count * sizeof(Meshlet));
+
+        memcpy(writer.bytes.data() + position, &rec, sizeof(rec));
+    }
+
+    std::string cookedPath = getCookedMeshPath(filepath);
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(cookedPath).parent_path(), ec);
+
+    // Write to a temp file and rename so a crash never leaves a half-written cache entry
+    std::string tempPath = cookedPath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            printf("Warning: Could not write cooked mesh '%s'\n", cookedPath.c_str());
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(writer.bytes.data()), writer.bytes.size());
+        if (!out) return false;
+    }
+    std::filesystem::rename(tempPath, cookedPath, ec);
+    if (ec) {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+
+    printf("Cooked mesh '%s' (%zu KB, geometry %zu KB raw)\n", filepath.c_str(), writer.bytes.size() / 1024, raw_bytes / 1024);
+    return true;
+}
@@ -0,0 +1,234 @@
+#include "mesh_codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Bit widths the two header bits of a vertex group select
+const int VERTEX_GROUP_BITS[4] = { 0, 2, 4, 8 };
+
+uint8_t zigzag8(uint8_t delta) {
+    return (uint8_t)((delta << 1) ^ (uint8_t)((int8_t)delta >> 7));
+}
+
+uint8_t unzigzag8(uint8_t value) {
+    return (uint8_t)((value >> 1) ^ (uint8_t)-(int)(value & 1));
+}
+
+uint32_t zigzag32(uint32_t delta) {
+    return (delta << 1) ^ (uint32_t)-(int32_t)(delta >> 31);
+}
+
+uint32_t unzigzag32(uint32_t value) {
+    return (value >> 1) ^ (uint32_t)-(int32_t)(value & 1);
+}
+
+// Lengths past a nibble continue in bytes of 255 and a remainder
+void putLength(std::vector<unsigned char>& out, size_t value) {
+    if (value < 15) return;
+    value -= 15;
+    for (; value >= 255; value -= 255) out.push_back(255);
+    out.push_back((unsigned char)value);
+}
+
+} // namespace
+
+void encodeVertexBuffer(const unsigned char* vertices, size_t vertex_count, size_t stride, std::vector<unsigned char>& out) {
+    out.clear();
+    const size_t groups = (vertex_count + MESH_CODEC_GROUP_SIZE - 1) / MESH_CODEC_GROUP_SIZE;
+    // The tail of the last group stays zero, which packs for free
+    std::vector<uint8_t> plane(groups * MESH_CODEC_GROUP_SIZE, 0);
+
+    for (size_t k = 0; k < stride; ++k) {
+        uint8_t previous = 0;
+        for (size_t v = 0; v < vertex_count; ++v) {
+            const uint8_t byte = vertices[v * stride + k];
+            plane[v] = zigzag8((uint8_t)(byte - previous));
+            previous = byte;
+        }
+
+        // The plane's group headers, four to a byte, then the groups' packed bits
+        const size_t headers = out.size();
+        out.resize(out.size() + (groups + 3) / 4, 0);
+        for (size_t g = 0; g < groups; ++g) {
+            const uint8_t* values = &plane[g * MESH_CODEC_GROUP_SIZE];
+            uint8_t all = 0;
+            for (size_t i = 0; i < MESH_CODEC_GROUP_SIZE; ++i) all |= values[i];
+            const int mode = all == 0 ? 0 : all < 4 ? 1 : all < 16 ? 2 : 3;
+            out[headers + g / 4] |= (unsigned char)(mode << ((g % 4) * 2));
+
+            const int bits = VERTEX_GROUP_BITS[mode];
+            if (bits == 0) continue;
+            const int per_byte = 8 / bits;
+            for (size_t i = 0; i < MESH_CODEC_GROUP_SIZE; i += per_byte) {
+                uint8_t packed = 0;
+                for (int j = 0; j < per_byte; ++j) packed |= (uint8_t)(values[i + j] << (j * bits));
+                out.push_back(packed);
+            }
+        }
+    }
+}
+
+bool decodeVertexBuffer(unsigned char* dst, size_t vertex_count, size_t stride, const unsigned char* src, size_t size) {
+    const size_t groups = (vertex_count + MESH_CODEC_GROUP_SIZE - 1) / MESH_CODEC_GROUP_SIZE;
+    const size_t header_bytes = (groups + 3) / 4;
+    size_t cursor = 0;
+    uint8_t values[MESH_CODEC_GROUP_SIZE];
+
+    for (size_t k = 0; k < stride; ++k) {
+        if (header_bytes > size - cursor) return false;
+        const unsigned char* headers = src + cursor;
+        cursor += header_bytes;
+
+        uint8_t previous = 0;
+        for (size_t g = 0; g < groups; ++g) {
+            const int bits = VERTEX_GROUP_BITS[(headers[g / 4] >> ((g % 4) * 2)) & 3];
+            if (bits == 0) {
+                memset(values, 0, sizeof(values));
+            } else {
+                const size_t bytes = MESH_CODEC_GROUP_SIZE * bits / 8;
+                if (bytes > size - cursor) return false;
+                const uint8_t mask = (uint8_t)((1 << bits) - 1);
+                for (size_t i = 0; i < MESH_CODEC_GROUP_SIZE; ++i) {
+                    values[i] = (uint8_t)((src[cursor + i * bits / 8] >> ((i * bits) % 8)) & mask);
+                }
+                cursor += bytes;
+            }
+
+            const size_t first = g * MESH_CODEC_GROUP_SIZE;
+            const size_t last = std::min(vertex_count, first + MESH_CODEC_GROUP_SIZE);
+            for (size_t v = first; v < last; ++v) {
+                previous = (uint8_t)(previous + unzigzag8(values[v - first]));
+                dst[v * stride + k] = previous;
+            }
+        }
+    }
+    return cursor == size;
+}
+
+void encodeIndexBuffer(const void* indices, size_t index_count, size_t index_size, std::vector<unsigned char>& out) {
+    out.clear();
+    out.reserve(index_count + index_count / 4);
+    uint32_t previous = 0;
+    for (size_t i = 0; i < index_count; ++i) {
+        const uint32_t index = index_size == sizeof(uint16_t) ? static_cast<const uint16_t*>(indices)[i]
+                                                              : static_cast<const uint32_t*>(indices)[i];
+        uint32_t value = zigzag32(index - previous);
+        previous = index;
+        for (; value >= 0x80; value >>= 7) out.push_back((unsigned char)(value | 0x80));
+        out.push_back((unsigned char)value);
+    }
+}
+
+bool decodeIndexBuffer(void* dst, size_t index_count, size_t index_size, const unsigned char* src, size_t size) {
+    size_t cursor = 0;
+    uint32_t previous = 0;
+    for (size_t i = 0; i < index_count; ++i) {
+        uint32_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            if (cursor >= size || shift > 28) return false;
+            const unsigned char byte = src[cursor++];
+            value |= (uint32_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        const uint32_t index = previous + unzigzag32(value);
+        previous = index;
+        if (index_size == sizeof(uint16_t)) {
+            if (index > 0xffff) return false;
+            static_cast<uint16_t*>(dst)[i] = (uint16_t)index;
+        } else {
+            static_cast<uint32_t*>(dst)[i] = index;
+        }
+    }
+    return cursor == size;
+}
+
+// Sequences of a token (literal count and match length - MESH_LZ_MIN_MATCH, a nibble each),
+// their longer lengths, the literals, then the match's 16-bit offset back. The last sequence is
+// literals only and ends the block.
+void lzCompress(const unsigned char* data, size_t size, std::vector<unsigned char>& out) {
+    out.clear();
+    out.reserve(size / 2 + 16);
+    const uint64_t raw_size = size;
+    out.insert(out.end(), (const unsigned char*)&raw_size, (const unsigned char*)&raw_size + sizeof(raw_size));
+
+    auto emit = [&](size_t literal_begin, size_t literal_end, size_t match_length, size_t offset) {
+        const size_t literals = literal_end - literal_begin;
+        const size_t match = match_length > 0 ? match_length - MESH_LZ_MIN_MATCH : 0;
+        out.push_back((unsigned char)((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(match, 15)));
+        putLength(out, literals);
+        out.insert(out.end(), data + literal_begin, data + literal_end);
+        if (match_length == 0) return;
+        out.push_back((unsigned char)(offset & 0xff));
+        out.push_back((unsigned char)(offset >> 8));
+        putLength(out, match);
+    };
+
+    // Last position each hashed 4-byte word was seen at
+    std::vector<uint32_t> table((size_t)1 << MESH_LZ_HASH_BITS, UINT32_MAX);
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + MESH_LZ_MIN_MATCH <= size) {
+        uint32_t word;
+        memcpy(&word, data + pos, sizeof(word));
+        const uint32_t hash = (word * 2654435761u) >> (32 - MESH_LZ_HASH_BITS);
+        const uint32_t candidate = table[hash];
+        table[hash] = (uint32_t)pos;
+        if (candidate == UINT32_MAX || pos - candidate > 0xffff || memcmp(data + candidate, data + pos, MESH_LZ_MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+        size_t length = MESH_LZ_MIN_MATCH;
+        while (pos + length < size && data[candidate + length] == data[pos + length]) length++;
+        emit(anchor, pos, length, pos - candidate);
+        pos += length;
+        anchor = pos;
+    }
+    emit(anchor, size, 0, 0);
+}
+
+bool lzDecompress(const unsigned char* src, size_t size, std::vector<unsigned char>& out) {
+    uint64_t raw_size = 0;
+    if (size < sizeof(raw_size)) return false;
+    memcpy(&raw_size, src, sizeof(raw_size));
+    // Every byte of input expands to at most 255 + a match's worth, anything larger is corrupt
+    if (raw_size > (uint64_t)size * 270) return false;
+    out.resize((size_t)raw_size);
+
+    size_t cursor = sizeof(raw_size);
+    size_t produced = 0;
+    auto getLength = [&](size_t nibble, size_t& length) {
+        length = nibble;
+        if (nibble < 15) return true;
+        unsigned char byte;
+        do {
+            if (cursor >= size) return false;
+            byte = src[cursor++];
+            length += byte;
+        } while (byte == 255);
+        return true;
+    };
+
+    for (;;) {
+        if (cursor >= size) return false;
+        const unsigned char token = src[cursor++];
+        size_t literals = 0;
+        if (!getLength(token >> 4, literals) || literals > size - cursor || literals > out.size() - produced) return false;
+        memcpy(out.data() + produced, src + cursor, literals);
+        cursor += literals;
+        produced += literals;
+        if (cursor == size) return produced == out.size();
+
+        if (size - cursor < 2) return false;
+        const size_t offset = src[cursor] | ((size_t)src[cursor + 1] << 8);
+        cursor += 2;
+        size_t length = 0;
+        if (!getLength(token & 15, length)) return false;
+        length += MESH_LZ_MIN_MATCH;
+        if (offset == 0 || offset > produced || length > out.size() - produced) return false;
+        // Byte by byte, a match may overlap what it is writing
+        for (size_t i = 0; i < length; ++i) out[produced + i] = out[produced - offset + i];
+        produced += length;
+    }
+}
@@ -2,140 +2,178 @@
 #include "filesystem.h"
 #include "texture_loader.h"
 #include "material.h"
+#include "mesh.h"
+#include "mesh_cache.h"
+#include "texture_cache.h"
+#include "texture_compression.h"
+#include "texture_streamer.h"
+#include "texture_atlas.h"
+#include "image_ops.h"
+#include "job_system.h"
+#include "ktx2.h"
+#include "mesh_optimizer.h"
+#include "lightmap.h"
+#include "gl_state.h"
+#include "gl_backend.h"
+#include "gpu_memory.h"
+#include "load_stats.h"
+#include "asset_pack.h"
+#include "mesh_registry.h"
 
 #include <assimp/Importer.hpp>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 #include <algorithm>
 #include <functional>
+#include <mutex>
+#include <unordered_set>
 #include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
 #include "stb_image.h"
 
-unsigned char* load_greyscale_data(const std::string& path, const aiScene* scene, int& width, int& height) {
-    if (!path.empty() && path[0] == '*') {
+bool use_packed_vertices = true;
+unsigned int mesh_lod_levels = 2;
+MeshResidency mesh_residency = MESH_RESIDENCY_NONE;
+
+// Cached ORM maps remember whether they carry height in their cache flags
+#define ORM_FLAG_HAS_HEIGHT 1u
+// Texture cache flags of albedo textures
+#define ALBEDO_FLAG_CUTOUT 1u
+
+ImageData load_greyscale_data(const std::string& path, const aiScene* scene) {
+    if (path.empty()) return ImageData();
+
+    if (path[0] == '*') {
         int texIndex = std::atoi(path.c_str() + 1);
-        if (texIndex >= 0 && texIndex < (int)scene->mNumTextures) {
-            aiTexture* embeddedTex = scene->mTextures[texIndex];
-            if (embeddedTex->mHeight == 0) {
-                int channels;
-                unsigned char* data = stbi_load_from_memory((unsigned char*)embeddedTex->pcData, embeddedTex->mWidth, &width, &height, &channels, 1);
-                return data;
-            } else {
-                width = embeddedTex->mWidth;
-                height = embeddedTex->mHeight;
-                unsigned char* data = new unsigned char[width * height];
-                for (int i = 0; i < width * height; ++i) {
-                    float r = embeddedTex->pcData[i].r / 255.0f;
-                    float g = embeddedTex->pcData[i].g / 255.0f;
-                    float b = embeddedTex->pcData[i].b / 255.0f;
-                    float gray = 0.299f * r + 0.587f * g + 0.114f * b;
-                    data[i] = (unsigned char)(gray * 255.0f);
-                }
-                return data;
-            }
+        if (!scene || texIndex < 0 || texIndex >= (int)scene->mNumTextures) return ImageData();
+
+        aiTexture* embeddedTex = scene->mTextures[texIndex];
+        if (embeddedTex->mHeight == 0) {
+            return decodeImageFromMemory((unsigned char*)embeddedTex->pcData, embeddedTex->mWidth, 1);
+        }
+
+        ImageData image = ImageData::allocate(embeddedTex->mWidth, embeddedTex->mHeight, 1);
+        for (int i = 0; i < image.width * image.height; ++i) {
+            float r = embeddedTex->pcData[i].r / 255.0f;
+            float g = embeddedTex->pcData[i].g / 255.0f;
+            float b = embeddedTex->pcData[i].b / 255.0f;
+            float gray = 0.299f * r + 0.587f * g + 0.114f * b;
+            image.pixels[i] = (unsigned char)(gray * 255.0f);
         }
+        return image;
     }
-    if (!path.empty()) {
-        int channels;
-        return stbi_load(path.c_str(), &width, &height, &channels, 1);
+
+    return decodeImage(path, 1);
+}
+
+ORMImage packORMImage(const std::string& current_material_name, const std::string& ao_path,
+                      const std::string& roughness_path, const std::string& metallic_path, const std::string& height_path,
+                      const std::string& specular_path, bool invert_height, const aiScene* scene) {
+    // Decodes on this thread come off the pack's time, the workers' ones it waits for don't
+    LoadTimer timer(LOAD_STAGE_ORM_PACK);
+
+    // The five decodes are independent, spread them over the pool
+    const std::string* paths[5] = { &ao_path, &roughness_path, &metallic_path, &height_path, &specular_path };
+    ImageData decoded[5];
+    const std::string asset = LoadAssetScope::current();
+    job_system.parallelFor(5, 1, [&](size_t begin, size_t end) {
+        LoadAssetScope scope(asset);
+        for (size_t i = begin; i < end; ++i) decoded[i] = load_greyscale_data(*paths[i], scene);
+    });
+    ImageData& ao_data = decoded[0];
+    ImageData& roughness_data = decoded[1];
+    ImageData& metallic_data = decoded[2];
+    ImageData& height_data = decoded[3];
+    ImageData& specular_data = decoded[4];
+
+    // The first available channel decides the packed size
+    int width = 0, height = 0;
+    for (const ImageData* channel : {&ao_data, &roughness_data, &metallic_data, &height_data, &specular_data}) {
+        if (channel->valid()) { width = channel->width; height = channel->height; break; }
     }
-    return nullptr;
+    if (width == 0 || height == 0) return ORMImage();
+
+    // Channels that don't match the packed size fall back to their defaults
+    auto usable = [&](const ImageData& channel, const std::string& path) -> const unsigned char* {
+        if (!channel.valid()) return nullptr;
+        if (channel.width != width || channel.height != height) {
+            printf("Warning: '%s' is %dx%d, expected %dx%d for ORM packing of '%s'\n", path.c_str(),
+                   channel.width, channel.height, width, height, current_material_name.c_str());
+            return nullptr;
+        }
+        return channel.pixels;
+    };
+
+    const unsigned char* ao = usable(ao_data, ao_path);
+    const unsigned char* roughness = usable(roughness_data, roughness_path);
+    const unsigned char* metallic = usable(metallic_data, metallic_path);
+    const unsigned char* heights = usable(height_data, height_path);
+    const unsigned char* specular = roughness ? nullptr : usable(specular_data, specular_path);
+
+    ORMImage result;
+    result.hasHeightData = heights != nullptr;
+    result.image = ImageData::allocate(width, height, 4);
+    unsigned char* packed = result.image.pixels;
+
+    ChannelSource sources[4];
+    sources[0] = { ao, 255, false };
+    sources[1] = roughness ? ChannelSource{ roughness, 0, false } : ChannelSource{ specular, 255, specular != nullptr };
+    sources[2] = { metallic, 0, false };
+    sources[3] = { heights, 128, heights && invert_height };
+
+    // Row bands keep each job's writes contiguous
+    const size_t pixel_count = (size_t)width * height;
+    const size_t band = (size_t)width * 64;
+    job_system.parallelFor(pixel_count, band, [&](size_t begin, size_t end) {
+        interleaveRGBA(sources, packed, begin, end);
+    });
+
+    if (heights && invert_height) printf("Height map for '%s': Inverted during packing\n", current_material_name.c_str());
+    printf("Successfully created packed ORM map for '%s'%s\n", current_material_name.c_str(), invert_height ? " (height inverted)" : "");
+    return result;
 }
 
 ORMResult packORM(Material& mat, const std::string& current_material_name, const std::string& ao_path,
                   const std::string& roughness_path, const std::string& metallic_path, const std::string& height_path,
                   const std::string& specular_path, const aiScene* scene) {
-    int w_ao, h_ao, w_r, h_r, w_m, h_m, w_h, h_h, w_s, h_s;
-    unsigned char* ao_data = load_greyscale_data(ao_path, scene, w_ao, h_ao);
-    unsigned char* roughness_data = load_greyscale_data(roughness_path, scene, w_r, h_r);
-    unsigned char* metallic_data = load_greyscale_data(metallic_path, scene, w_m, h_m);
-    unsigned char* height_data = load_greyscale_data(height_path, scene, w_h, h_h);
-    unsigned char* specular_data = load_greyscale_data(specular_path, scene, w_s, h_s);
-    
-    if (!ao_data && !roughness_data && !metallic_data && !height_data && !specular_data) return { 0, false };
-
-    int width = 0, height = 0;
-    if (ao_data) { width = w_ao; height = h_ao; }
-    else if (roughness_data) { width = w_r; height = h_r; }
-    else if (metallic_data) { width = w_m; height = h_m; }
-    else if (height_data) { width = w_h; height = h_h; }
-    else if (specular_data) { width = w_s; height = h_s; }
-    
-    if (width == 0 || height == 0) return { 0, false };
-
-    size_t data_size = (size_t)width * height * 4;
-    unsigned char* packed_data = new unsigned char[data_size];
-    unsigned char* default_channel_data = new unsigned char[width * height];
-    
-    unsigned char* final_ao = ao_data;
-    if (!ao_data) { memset(default_channel_data, 255, width * height); final_ao = default_channel_data; }
-    
-    unsigned char* final_roughness = roughness_data;
-    if (!roughness_data && specular_data) {
-        final_roughness = new unsigned char[width * height];
-        for (int i = 0; i < width * height; ++i) final_roughness[i] = 255 - specular_data[i];
-    } else if (!roughness_data) {
-        memset(default_channel_data, 255, width * height);
-        final_roughness = default_channel_data;
+    // Embedded sources can't be keyed without the model path, so those bypass the cache
+    bool embedded = false;
+    for (const std::string* path : {&ao_path, &roughness_path, &metallic_path, &height_path, &specular_path}) {
+        embedded |= !path->empty() && (*path)[0] == '*';
     }
-    
-    unsigned char* final_metallic = metallic_data;
-    if (!metallic_data) { memset(default_channel_data, 0, width * height); final_metallic = default_channel_data; }
-    
-    bool hasHeightData = (height_data != nullptr);
-    unsigned char* final_height = height_data;
-    if (height_data && mat.invert_height) {
-        final_height = new unsigned char[width * height];
-        for (int i = 0; i < width * height; ++i) final_height[i] = 255 - height_data[i];
-        printf("Height map for '%s': Inverted during packing\n", current_material_name.c_str());
-    } else if (!height_data) {
-        memset(default_channel_data, 128, width * height);
-        final_height = default_channel_data;
-    }
-
-    for (int i = 0; i < width * height; ++i) {
-        packed_data[i * 4] = final_ao[i];
-        packed_data[i * 4 + 1] = final_roughness[i];
-        packed_data[i * 4 + 2] = final_metallic[i];
-        packed_data[i * 4 + 3] = final_height[i];
+
+    std::string key;
+    if (!embedded) {
+        key = TextureCache::ormKey("", ao_path, roughness_path, metallic_path, height_path, specular_path,
+                                   mat.invert_height, SamplerDesc());
+        uint32_t flags = 0;
+        GLuint cached = texture_cache.acquire(key, &flags);
+        if (cached != 0) return { cached, (flags & ORM_FLAG_HAS_HEIGHT) != 0 };
     }
-    
-    GLuint orm_texture_id;
-    glGenTextures(1, &orm_texture_id);
-    glBindTexture(GL_TEXTURE_2D, orm_texture_id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, packed_data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    if (ao_data) stbi_image_free(ao_data);
-    if (roughness_data && roughness_data != final_roughness) stbi_image_free(roughness_data);
-    if (metallic_data) stbi_image_free(metallic_data);
-    if (height_data) {
-        stbi_image_free(height_data);
-        if (mat.invert_height && final_height != height_data) delete[] final_height;
-    }
-    if (specular_data) stbi_image_free(specular_data);
-    if (!roughness_data && specular_data) delete[] final_roughness;
-    delete[] packed_data;
-    delete[] default_channel_data;
-    
-    printf("Successfully created packed ORM map for '%s'%s\n", current_material_name.c_str(), mat.invert_height ? " (height inverted)" : "");
-    return { orm_texture_id, hasHeightData };
+
+    ORMImage packed = packORMImage(current_material_name, ao_path, roughness_path, metallic_path,
+                                   height_path, specular_path, mat.invert_height, scene);
+    if (!packed.image.valid()) return { 0, false };
+
+    GLuint texture = uploadImage(packed.image);
+    if (!embedded) texture = texture_cache.insert(key, texture, packed.hasHeightData ? ORM_FLAG_HAS_HEIGHT : 0);
+    return { texture, packed.hasHeightData };
 }
 
-Material createMaterialFromAssimp(std::string modelPath, aiMaterial* material, const aiScene* scene) {
-    Material mat = createDefaultMaterial();
+MaterialDesc describeMaterialFromAssimp(const std::string& modelPath, aiMaterial* material) {
+    MaterialDesc desc;
+    desc.model_path = modelPath;
     aiString path, matName;
-    std::string aoPath, roughPath, metalPath, heightPath, specularPath;
-    std::string name = "unnamed";
 
-    if (material->Get(AI_MATKEY_NAME, matName) == AI_SUCCESS) name = matName.C_Str();
+    if (material->Get(AI_MATKEY_NAME, matName) == AI_SUCCESS) desc.name = matName.C_Str();
         
     float heightScale = 0.1f;
     bool foundHeightScale = false;
@@ -145,16 +183,16 @@ Material createMaterialFromAssimp(std::string modelPath, aiMaterial* material, c
     if (!foundHeightScale && material->Get(AI_MATKEY_BUMPSCALING, heightScale) == AI_SUCCESS) foundHeightScale = true;
     
     if (foundHeightScale) {
-        if (heightScale < 0.0f) { mat.invert_height = true; mat.height_scale = -heightScale; }
-        else { mat.invert_height = false; mat.height_scale = heightScale; }
-        mat.height_scale = glm::clamp(mat.height_scale, -0.1f, 0.1f);
+        if (heightScale < 0.0f) { desc.invert_height = true; desc.height_scale = -heightScale; }
+        else { desc.invert_height = false; desc.height_scale = heightScale; }
+        desc.height_scale = glm::clamp(desc.height_scale, -0.1f, 0.1f);
     }
     
-    std::string nameLower = name;
+    std::string nameLower = desc.name;
     std::transform(nameLower.begin(), nameLower.end(), nameLower.begin(), ::tolower);
     if (nameLower.find("_inverted") != std::string::npos || nameLower.find("_inv") != std::string::npos ||
         nameLower.find("_flipheight") != std::string::npos || nameLower.find("invert") != std::string::npos)
-        mat.invert_height = true;
+        desc.invert_height = true;
 
     auto resolveTexPath = [&](const aiString& aiPath) -> std::string {
         std::string texPath = aiPath.C_Str();
@@ -166,249 +204,765 @@ Material createMaterialFromAssimp(std::string modelPath, aiMaterial* material, c
     };
     
     if (material->GetTexture(aiTextureType_BASE_COLOR, 0, &path) == AI_SUCCESS ||
-        material->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS) {
-        std::string texPath = resolveTexPath(path);
-        if (!texPath.empty() && texPath[0] == '*') {
-            int texIndex = std::atoi(texPath.c_str() + 1);
-            if (texIndex >= 0 && texIndex < (int)scene->mNumTextures) {
-                aiTexture* embeddedTex = scene->mTextures[texIndex];
-                if (embeddedTex->mHeight == 0) {
-                    mat.albedo_map = loadTextureFromMemory((unsigned char*)embeddedTex->pcData, embeddedTex->mWidth);
-                } else {
-                    mat.albedo_map = loadTextureFromARGB(embeddedTex->pcData, embeddedTex->mWidth, embeddedTex->mHeight);
-                }
-            }
-        } else if (!texPath.empty()) mat.albedo_map = loadTexture(texPath);
-    }
+        material->GetTexture(aiTextureType_DIFFUSE, 0, &path) == AI_SUCCESS) desc.albedo_path = resolveTexPath(path);
     
-    if (!mat.hasAlbedoMap()) {
-        aiColor3D color;
-        if (material->Get(AI_MATKEY_BASE_COLOR, color) == AI_SUCCESS || material->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS)
-            mat.base_color = glm::vec3(color.r, color.g, color.b);
+    aiColor3D color;
+    if (material->Get(AI_MATKEY_BASE_COLOR, color) == AI_SUCCESS || material->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS) {
+        desc.has_base_color = true;
+        desc.base_color = glm::vec3(color.r, color.g, color.b);
     }
     
-    if (material->GetTexture(aiTextureType_NORMALS, 0, &path) == AI_SUCCESS || material->GetTexture(aiTextureType_HEIGHT, 0, &path) == AI_SUCCESS) {
-        std::string texPath = resolveTexPath(path);
-        if (!texPath.empty() && texPath[0] == '*') {
-            int texIndex = std::atoi(texPath.c_str() + 1);
-            if (texIndex >= 0 && texIndex < (int)scene->mNumTextures) {
-                aiTexture* embeddedTex = scene->mTextures[texIndex];
-                if (embeddedTex->mHeight == 0) {
-                    mat.normal_map = loadTextureFromMemory((unsigned char*)embeddedTex->pcData, embeddedTex->mWidth);
-                } else {
-                    mat.normal_map = loadTextureFromARGB(embeddedTex->pcData, embeddedTex->mWidth, embeddedTex->mHeight);
-                }
-            }
-        } else if (!texPath.empty()) mat.normal_map = loadTexture(texPath);
-    }
+    if (material->GetTexture(aiTextureType_NORMALS, 0, &path) == AI_SUCCESS || material->GetTexture(aiTextureType_HEIGHT, 0, &path) == AI_SUCCESS)
+        desc.normal_path = resolveTexPath(path);
     
-    if (material->GetTexture(aiTextureType_METALNESS, 0, &path) == AI_SUCCESS) metalPath = resolveTexPath(path);
-    if (metalPath.empty()) {
+    if (material->GetTexture(aiTextureType_METALNESS, 0, &path) == AI_SUCCESS) desc.metallic_path = resolveTexPath(path);
+    if (desc.metallic_path.empty()) {
         float metallicValue;
-        if (material->Get(AI_MATKEY_METALLIC_FACTOR, metallicValue) == AI_SUCCESS) mat.metallic = metallicValue;
+        if (material->Get(AI_MATKEY_METALLIC_FACTOR, metallicValue) == AI_SUCCESS) desc.metallic = metallicValue;
     }
     
     if (material->GetTexture(aiTextureType_DIFFUSE_ROUGHNESS, 0, &path) == AI_SUCCESS || material->GetTexture(aiTextureType_SHININESS, 0, &path) == AI_SUCCESS)
-        roughPath = resolveTexPath(path);
-    if (roughPath.empty() && material->GetTexture(aiTextureType_SPECULAR, 0, &path) == AI_SUCCESS) specularPath = resolveTexPath(path);
-    if (roughPath.empty() && specularPath.empty()) {
+        desc.roughness_path = resolveTexPath(path);
+    if (desc.roughness_path.empty() && material->GetTexture(aiTextureType_SPECULAR, 0, &path) == AI_SUCCESS) desc.specular_path = resolveTexPath(path);
+    if (desc.roughness_path.empty() && desc.specular_path.empty()) {
         float roughnessValue, shininessValue;
-        if (material->Get(AI_MATKEY_ROUGHNESS_FACTOR, roughnessValue) == AI_SUCCESS) mat.roughness = roughnessValue;
-        else if (material->Get(AI_MATKEY_SHININESS, shininessValue) == AI_SUCCESS) mat.roughness = 1.0f - glm::clamp(shininessValue / 1000.0f, 0.0f, 1.0f);
+        if (material->Get(AI_MATKEY_ROUGHNESS_FACTOR, roughnessValue) == AI_SUCCESS) desc.roughness = roughnessValue;
+        else if (material->Get(AI_MATKEY_SHININESS, shininessValue) == AI_SUCCESS) desc.roughness = 1.0f - glm::clamp(shininessValue / 1000.0f, 0.0f, 1.0f);
     }
     
     if (material->GetTexture(aiTextureType_AMBIENT_OCCLUSION, 0, &path) == AI_SUCCESS || material->GetTexture(aiTextureType_LIGHTMAP, 0, &path) == AI_SUCCESS ||
-        material->GetTexture(aiTextureType_AMBIENT, 0, &path) == AI_SUCCESS) aoPath = resolveTexPath(path);
+        material->GetTexture(aiTextureType_AMBIENT, 0, &path) == AI_SUCCESS) desc.ao_path = resolveTexPath(path);
     
     if (material->GetTexture(aiTextureType_DISPLACEMENT, 0, &path) == AI_SUCCESS || material->GetTexture(aiTextureType_HEIGHT, 0, &path) == AI_SUCCESS) {
-        heightPath = resolveTexPath(path);
-        std::string heightFileName = std::filesystem::path(heightPath).filename().string();
+        desc.height_path = resolveTexPath(path);
+        std::string heightFileName = std::filesystem::path(desc.height_path).filename().string();
         std::transform(heightFileName.begin(), heightFileName.end(), heightFileName.begin(), ::tolower);
         if (heightFileName.find("_inv") != std::string::npos || heightFileName.find("inverted") != std::string::npos) {
-            mat.invert_height = true;
+            desc.invert_height = true;
             printf("Height map '%s': Inversion enabled by filename\n", heightFileName.c_str());
         }
     }
     
-    if (!aoPath.empty() || !roughPath.empty() || !metalPath.empty() || !heightPath.empty() || !specularPath.empty()) {
-        ORMResult packed = packORM(mat, name, aoPath, roughPath, metalPath, heightPath, specularPath, scene);
-        mat.orm_map = packed.textureID;
-        if (packed.hasHeightData) mat.height_map = packed.textureID;
-    }
+    if (material->GetTexture(aiTextureType_EMISSIVE, 0, &path) == AI_SUCCESS || material->GetTexture(aiTextureType_EMISSION_COLOR, 0, &path) == AI_SUCCESS)
+        desc.emissive_path = resolveTexPath(path);
     
-    if (material->GetTexture(aiTextureType_EMISSIVE, 0, &path) == AI_SUCCESS || material->GetTexture(aiTextureType_EMISSION_COLOR, 0, &path) == AI_SUCCESS) {
-        std::string texPath = resolveTexPath(path);
-        if (!texPath.empty() && texPath[0] == '*') {
-            int texIndex = std::atoi(texPath.c_str() + 1);
-            if (texIndex >= 0 && texIndex < (int)scene->mNumTextures) {
-                aiTexture* embeddedTex = scene->mTextures[texIndex];
-                if (embeddedTex->mHeight == 0) {
-                    mat.emissive_map = loadTextureFromMemory((unsigned char*)embeddedTex->pcData, embeddedTex->mWidth);
-                } else {
-                    mat.emissive_map = loadTextureFromARGB(embeddedTex->pcData, embeddedTex->mWidth, embeddedTex->mHeight);
-                }
-            }
-        } else if (!texPath.empty()) mat.emissive_map = loadTexture(texPath);
+    aiColor3D emissiveColor;
+    if (material->Get(AI_MATKEY_COLOR_EMISSIVE, emissiveColor) == AI_SUCCESS) {
+        desc.emissive = glm::vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
+        float emissiveStrength;
+        if (material->Get(AI_MATKEY_EMISSIVE_INTENSITY, emissiveStrength) == AI_SUCCESS) desc.emissive *= emissiveStrength;
     }
     
-    if (!mat.hasEmissiveMap()) {
-        aiColor3D emissiveColor;
-        if (material->Get(AI_MATKEY_COLOR_EMISSIVE, emissiveColor) == AI_SUCCESS) {
-            mat.emissive = glm::vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
-            float emissiveStrength;
-            if (material->Get(AI_MATKEY_EMISSIVE_INTENSITY, emissiveStrength) == AI_SUCCESS) mat.emissive *= emissiveStrength;
+    return desc;
+}
+
+static ImageData decodeEmbeddedTexture(const std::string& texPath, const aiScene* scene) {
+    if (!scene) return ImageData();
+
+    int texIndex = std::atoi(texPath.c_str() + 1);
+    if (texIndex < 0 || texIndex >= (int)scene->mNumTextures) return ImageData();
+
+    aiTexture* embeddedTex = scene->mTextures[texIndex];
+    if (embeddedTex->mHeight == 0) {
+        return decodeImageFromMemory((unsigned char*)embeddedTex->pcData, embeddedTex->mWidth);
+    }
+    return decodeImageFromARGB(embeddedTex->pcData, embeddedTex->mWidth, embeddedTex->mHeight);
+}
+
+// Colour maps are flagged sRGB, and everything is cut down to texture_max_size
+static ImageData decodeMaterialTexture(const std::string& texPath, const aiScene* scene, TextureUsage usage) {
+    if (texPath.empty()) return ImageData();
+    ImageData image = texPath[0] != '*' ? loadTextureImage(texPath, usage) : decodeEmbeddedTexture(texPath, scene);
+    image.srgb = usage == TEXTURE_USAGE_COLOR;
+    limitImageSize(image, texture_max_size, usage == TEXTURE_USAGE_NORMAL);
+    return image;
+}
+
+static std::string materialTextureKey(const MaterialDesc& desc, const std::string& texPath) {
+    if (texPath.empty()) return "";
+    if (texPath[0] == '*') return TextureCache::embeddedKey(desc.model_path, texPath, SamplerDesc());
+    return TextureCache::fileKey(texPath, SamplerDesc());
+}
+
+static std::string materialORMKey(const MaterialDesc& desc) {
+    if (!desc.hasORMSources()) return "";
+    return TextureCache::ormKey(desc.model_path, desc.ao_path, desc.roughness_path, desc.metallic_path,
+                                desc.height_path, desc.specular_path, desc.invert_height, SamplerDesc());
+}
+
+// Packed ORM maps are cached on disk by source tuple, so cold starts skip the five decodes
+std::string getCookedORMPath(const std::string& orm_key) {
+    uint64_t hash = 1469598103934665603ull; // FNV-1a
+    for (unsigned char c : orm_key) { hash ^= c; hash *= 1099511628211ull; }
+    char name[32];
+    snprintf(name, sizeof(name), "orm_%016llx.ktx2", (unsigned long long)hash);
+    return buildAssetPath(std::string("cache/textures/") + name);
+}
+
+static ORMImage loadOrPackORMImage(const MaterialDesc& desc, const std::string& orm_key, const aiScene* scene) {
+    LoadAssetScope asset(desc.model_path + ":" + desc.name + " (ORM)");
+    // Embedded sources have no timestamp to validate against, always pack those
+    bool cacheable = true;
+    int64_t newest_source = 0;
+    for (const std::string* path : {&desc.ao_path, &desc.roughness_path, &desc.metallic_path, &desc.height_path, &desc.specular_path}) {
+        if (path->empty()) continue;
+        if ((*path)[0] == '*') cacheable = false;
+        else newest_source = std::max(newest_source, getFileModifiedTime(*path));
+    }
+
+    std::string cooked_path = cacheable ? getCookedORMPath(orm_key) : "";
+    if (cacheable) {
+        int64_t cooked_mtime = getFileModifiedTime(cooked_path);
+        ORMImage cached;
+        if (cooked_mtime != 0 && cooked_mtime >= newest_source && readKTX2(cooked_path, cached.image) &&
+            (!cached.image.isCompressed() || isCompressedFormatSupported(cached.image.compressed_format)) &&
+            cached.image.isCompressed() == (use_texture_compression && texture_compression_caps.s3tc)) {
+            cached.hasHeightData = !desc.height_path.empty() && getFileModifiedTime(desc.height_path) != 0;
+            printf("Loaded cooked ORM map for '%s'\n", desc.name.c_str());
+            return cached;
         }
     }
-    
-    mat.name = name;
+
+    ORMImage orm = packORMImage(desc.name, desc.ao_path, desc.roughness_path, desc.metallic_path,
+                                desc.height_path, desc.specular_path, desc.invert_height, scene);
+    if (use_texture_compression && orm.image.valid()) {
+        ImageData compressed = compressImage(orm.image, TEXTURE_USAGE_DATA);
+        if (compressed.valid()) orm.image = std::move(compressed);
+    }
+
+    if (cacheable && orm.image.valid()) {
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(cooked_path).parent_path(), ec);
+        writeKTX2(cooked_path, orm.image);
+    }
+    return orm;
+}
+
+MaterialImages decodeMaterialImages(const MaterialDesc& desc, const aiScene* scene) {
+    MaterialImages images;
+    images.albedo_key = materialTextureKey(desc, desc.albedo_path);
+    images.normal_key = materialTextureKey(desc, desc.normal_path);
+    images.emissive_key = materialTextureKey(desc, desc.emissive_path);
+    images.orm_key = materialORMKey(desc);
+
+    // Skip decoding anything that is already resident
+    auto decode = [&](const std::string& key, const std::string& texPath, TextureUsage usage) {
+        if (key.empty() || texture_cache.contains(key)) return ImageData();
+        return decodeMaterialTexture(texPath, scene, usage);
+    };
+    images.albedo = decode(images.albedo_key, desc.albedo_path, TEXTURE_USAGE_COLOR);
+    images.normal = decode(images.normal_key, desc.normal_path, TEXTURE_USAGE_NORMAL);
+    images.emissive = decode(images.emissive_key, desc.emissive_path, TEXTURE_USAGE_COLOR);
+    if (!images.orm_key.empty() && !texture_cache.contains(images.orm_key)) {
+        images.orm = loadOrPackORMImage(desc, images.orm_key, scene);
+        limitImageSize(images.orm.image, texture_max_size, false);
+    }
+
+    // Streamed uploads need the whole chain up front instead of glGenerateMipmap
+    if (use_texture_streaming) {
+        generateMipChain(images.albedo, false);
+        generateMipChain(images.normal, true);
+        generateMipChain(images.emissive, false);
+        generateMipChain(images.orm.image, false);
+    }
+    return images;
+}
+
+static GLuint uploadMaterialImage(ImageData& image) {
+    if (use_texture_streaming && image.hasMipChain()) return texture_streamer.upload(std::move(image), SamplerDesc());
+    return uploadImage(image);
+}
+
+// Returns the resident texture for key, or uploads image and caches it. If the texture
+// was evicted between decode and upload, file textures are decoded again here. flags, when
+// given, returns the cached flags: colour textures get ALBEDO_FLAG_CUTOUT at insert. atlas
+// offers the image to texture_atlas as well.
+static GLuint acquireMaterialTexture(const std::string& key, ImageData& image, const std::string& texPath, TextureUsage usage,
+                                     uint32_t* flags = nullptr, bool atlas = false) {
+    uint32_t unused = 0;
+    if (!flags) flags = &unused;
+    *flags = 0;
+    if (key.empty()) return default_texture_id;
+
+    GLuint cached = texture_cache.acquire(key, flags);
+    if (cached != 0) return cached;
+
+    // Embedded textures stay with their model
+    LoadAssetScope asset(texPath.empty() || texPath[0] == '*' ? LoadAssetScope::current() : texPath);
+
+    ImageData reloaded;
+    if (!image.valid() && !texPath.empty() && texPath[0] != '*') reloaded = decodeMaterialTexture(texPath, nullptr, usage);
+    ImageData& source = image.valid() ? image : reloaded;
+    if (!source.valid()) return default_texture_id;
+
+    // Before the upload, streamed ones take the image's chain
+    *flags = usage == TEXTURE_USAGE_COLOR && imageHasCutoutAlpha(source) ? ALBEDO_FLAG_CUTOUT : 0;
+    const TextureAtlas::Slot slot = atlas && use_texture_atlas ? texture_atlas.pack(source) : TextureAtlas::Slot();
+    GLuint texture = image.valid() ? uploadMaterialImage(image) : uploadImage(reloaded);
+    texture = texture_cache.insert(key, texture, *flags);
+    texture_atlas.assign(texture, slot);
+    return texture;
+}
+
+Material buildMaterialFromImages(const MaterialDesc& desc, MaterialImages& images) {
+    Material mat = createDefaultMaterial();
+    mat.height_scale = desc.height_scale;
+    mat.invert_height = desc.invert_height;
+    mat.metallic = desc.metallic;
+    mat.roughness = desc.roughness;
+
+    if (!desc.albedo_path.empty()) {
+        uint32_t flags = 0;
+        mat.albedo_map = acquireMaterialTexture(images.albedo_key, images.albedo, desc.albedo_path, TEXTURE_USAGE_COLOR, &flags, true);
+        // Cut-out texels make it an alpha-tested caster, the depth passes keep the rest depth-only
+        if (flags & ALBEDO_FLAG_CUTOUT) mat.alphaMode = MASKED;
+    }
+    if (!mat.hasAlbedoMap() && desc.has_base_color) mat.base_color = desc.base_color;
+
+    if (!desc.normal_path.empty()) mat.normal_map = acquireMaterialTexture(images.normal_key, images.normal, desc.normal_path, TEXTURE_USAGE_NORMAL);
+
+    if (!images.orm_key.empty()) {
+        uint32_t flags = 0;
+        mat.orm_map = texture_cache.acquire(images.orm_key, &flags);
+        if (mat.orm_map == 0 && images.orm.image.valid()) {
+            flags = images.orm.hasHeightData ? ORM_FLAG_HAS_HEIGHT : 0;
+            mat.orm_map = texture_cache.insert(images.orm_key, uploadMaterialImage(images.orm.image), flags);
+        }
+        if (mat.orm_map != 0 && (flags & ORM_FLAG_HAS_HEIGHT)) mat.height_map = mat.orm_map;
+    }
+
+    if (!desc.emissive_path.empty()) mat.emissive_map = acquireMaterialTexture(images.emissive_key, images.emissive, desc.emissive_path, TEXTURE_USAGE_COLOR);
+    if (!mat.hasEmissiveMap()) mat.emissive = desc.emissive;
+
+    mat.name = desc.name;
     return mat;
 }
 
-std::vector<std::shared_ptr<Mesh>> loadMesh(const std::string& filepath) {
-    Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile(buildAssetPath("res/scene_models/" + filepath),
-        aiProcess_Triangulate | 
-        aiProcess_GenSmoothNormals | 
-        aiProcess_JoinIdenticalVertices |
-        aiProcess_ImproveCacheLocality | 
-        aiProcess_OptimizeMeshes | 
-        aiProcess_CalcTangentSpace | 
-        aiProcess_PreTransformVertices);
+Material buildMaterial(const MaterialDesc& desc, const aiScene* scene) {
+    MaterialImages images = decodeMaterialImages(desc, scene);
+    return buildMaterialFromImages(desc, images);
+}
+
+Material createMaterialFromAssimp(std::string modelPath, aiMaterial* material, const aiScene* scene) {
+    return buildMaterial(describeMaterialFromAssimp(modelPath, material), scene);
+}
+
+void uploadMeshBuffers(Mesh& mesh, const void* vertices, size_t vertex_bytes, const void* indices, size_t index_bytes) {
+    if (vertex_pulling.pooling()) {
+        vertex_pulling.add(mesh.vertex_layout, vertices, vertex_bytes / mesh.vertex_layout.stride, indices, mesh.index_type,
+                           index_bytes / getIndexSize(mesh.index_type), mesh.pulled);
+    }
+    if (use_geometry_arena) {
+        std::shared_ptr<GeometryArena> arena = geometry_arenas.get(mesh.vertex_layout.format);
+        if (arena->allocate(vertices, vertex_bytes, indices, index_bytes, mesh.geometry, mesh.shadow_quantization)) {
+            mesh.arena = arena;
+            mesh.VAO = arena->vao;
+            mesh.instanceVBO = arena->instance_vbo;
+            mesh.instanceFadeVBO = arena->fade_vbo;
+            mesh.depthVAO = arena->depth_vao;
+            if (mesh.shadow_quantization.valid()) mesh.shadowVAO = arena->shadow_vao;
+            return;
+        }
+        printf("Geometry arena allocation failed, using standalone buffers\n");
+        mesh.geometry = GeometryAllocation();
+    }
+
+    glGenVertexArrays(1, &mesh.VAO);
+    gl_state.bindVertexArray(mesh.VAO);
+    mesh.VBO = createBuffer(GL_ARRAY_BUFFER, vertex_bytes, vertices);
+    mesh.EBO = createBuffer(GL_ELEMENT_ARRAY_BUFFER, index_bytes, indices);
+    // Created unbound on the DSA path, the attributes and the VAO's element buffer need them bound
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+    // The asset loader names them once it knows which model they came from
+    gpu_memory.trackBuffer(mesh.VBO, vertex_bytes, GPU_MEMORY_GEOMETRY, std::string());
+    gpu_memory.trackBuffer(mesh.EBO, index_bytes, GPU_MEMORY_GEOMETRY, std::string());
+
+    setupVertexAttributes(mesh.vertex_layout);
+
+    // Batches stream through instance_ring, the VAO's own buffers only hold a single instance
+    createInstanceBuffers(mesh.instanceVBO, mesh.instanceFadeVBO, 1);
+
+    if (use_depth_streams) {
+        std::vector<glm::vec3> positions;
+        std::vector<unsigned char> uvs;
+        extractDepthStreams(mesh.vertex_layout, vertices, vertex_bytes / mesh.vertex_layout.stride, positions, uvs);
+        const size_t position_bytes = positions.size() * sizeof(glm::vec3);
+        std::vector<uint16_t> quantized;
+        if (use_quantized_shadow_positions) quantizePositions(positions, quantized, mesh.shadow_quantization);
+        const size_t quantized_bytes = quantized.size() * sizeof(uint16_t);
+        const size_t depth_bytes = position_bytes + uvs.size() + quantized_bytes;
+
+        // Assembled here, so the buffer's storage can be created with its contents
+        std::vector<unsigned char> depth_data(depth_bytes);
+        memcpy(depth_data.data(), positions.data(), position_bytes);
+        if (!uvs.empty()) memcpy(depth_data.data() + position_bytes, uvs.data(), uvs.size());
+        if (quantized_bytes > 0) memcpy(depth_data.data() + position_bytes + uvs.size(), quantized.data(), quantized_bytes);
+
+        glGenVertexArrays(1, &mesh.depthVAO);
+        gl_state.bindVertexArray(mesh.depthVAO);
+        mesh.depthVBO = createBuffer(GL_ARRAY_BUFFER, depth_bytes, depth_data.data());
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+        gpu_memory.trackBuffer(mesh.depthVBO, depth_bytes, GPU_MEMORY_GEOMETRY, std::string());
+
+        setupDepthAttributes(mesh.vertex_layout, mesh.depthVBO, 0, mesh.depthVBO, position_bytes);
+        pointInstanceAttributes(mesh.instanceVBO, mesh.instanceFadeVBO, 0);
+
+        if (quantized_bytes > 0) {
+            glGenVertexArrays(1, &mesh.shadowVAO);
+            gl_state.bindVertexArray(mesh.shadowVAO);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+            setupShadowAttributes(mesh.vertex_layout, mesh.depthVBO, position_bytes + uvs.size(), mesh.depthVBO, position_bytes);
+            pointInstanceAttributes(mesh.instanceVBO, mesh.instanceFadeVBO, 0);
+        }
+    }
+
+    gl_state.bindVertexArray(0);
+}
+
+// ==== Vertex encoding ====
+
+uint32_t chooseVertexFormat(const aiMesh* mesh) {
+    if (!use_packed_vertices) return VERTEX_HAS_COLOR;
+
+    uint32_t format = VERTEX_PACKED;
+    if (mesh->HasVertexColors(0)) format |= VERTEX_HAS_COLOR;
+
+    bool half_uv = true;
+    if (mesh->HasTextureCoords(0)) {
+        for (unsigned int v = 0; v < mesh->mNumVertices && half_uv; ++v) {
+            const aiVector3D& uv = mesh->mTextureCoords[0][v];
+            half_uv = std::fabs(uv.x) <= MESH_HALF_UV_LIMIT && std::fabs(uv.y) <= MESH_HALF_UV_LIMIT;
+        }
+    }
+    if (half_uv) format |= VERTEX_HALF_UV;
+    return format;
+}
+
+void encodeVertices(const aiMesh* mesh, const VertexLayout& layout, std::vector<unsigned char>& out_bytes) {
+    out_bytes.assign((size_t)mesh->mNumVertices * layout.stride, 0);
+    unsigned char* out = out_bytes.data();
+
+    for (unsigned int v = 0; v < mesh->mNumVertices; ++v, out += layout.stride) {
+        glm::vec3 position(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z);
+        glm::vec4 color(1.0f);
+        glm::vec2 uv(0.0f);
+        glm::vec3 normal(0.0f, 0.0f, 1.0f);
+        glm::vec3 tangent(1.0f, 0.0f, 0.0f);
+        glm::vec3 bitangent(0.0f, 1.0f, 0.0f);
+
+        if (mesh->HasVertexColors(0)) {
+            const aiColor4D& c = mesh->mColors[0][v];
+            color = glm::vec4(c.r, c.g, c.b, c.a);
+        }
+        if (mesh->HasTextureCoords(0)) uv = glm::vec2(mesh->mTextureCoords[0][v].x, mesh->mTextureCoords[0][v].y);
+        if (mesh->HasNormals()) normal = glm::vec3(mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z);
+        if (mesh->HasTangentsAndBitangents()) {
+            tangent = glm::vec3(mesh->mTangents[v].x, mesh->mTangents[v].y, mesh->mTangents[v].z);
+            bitangent = glm::vec3(mesh->mBitangents[v].x, mesh->mBitangents[v].y, mesh->mBitangents[v].z);
+        }
+
+        if (!(layout.format & VERTEX_PACKED)) {
+            float* f = reinterpret_cast<float*>(out);
+            memcpy(f, &position, sizeof(position));
+            memcpy(f + 3, &color, sizeof(color));
+            memcpy(f + 7, &uv, sizeof(uv));
+            memcpy(f + 9, &normal, sizeof(normal));
+            memcpy(f + 12, &tangent, sizeof(tangent));
+            memcpy(f + 15, &bitangent, sizeof(bitangent));
+            continue;
+        }
+
+        auto safeNormalize = [](const glm::vec3& v, const glm::vec3& fallback) {
+            float len = glm::length(v);
+            return len > 1e-8f ? v / len : fallback;
+        };
+        normal = safeNormalize(normal, glm::vec3(0.0f, 0.0f, 1.0f));
+        tangent = safeNormalize(tangent, glm::vec3(1.0f, 0.0f, 0.0f));
+
+        // The shader rebuilds the bitangent as cross(N, T) * sign
+        float sign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+        uint32_t packed_normal = glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f));
+        uint32_t packed_tangent = glm::packSnorm3x10_1x2(glm::vec4(tangent, sign));
+
+        memcpy(out, &position, sizeof(position));
+        memcpy(out + 12, &packed_normal, sizeof(uint32_t));
+        memcpy(out + 16, &packed_tangent, sizeof(uint32_t));
+
+        if (layout.format & VERTEX_HALF_UV) {
+            uint32_t packed_uv = glm::packHalf2x16(uv);
+            memcpy(out + layout.uv_offset, &packed_uv, sizeof(uint32_t));
+        } else {
+            memcpy(out + layout.uv_offset, &uv, sizeof(uv));
+        }
 
+        if (layout.format & VERTEX_HAS_COLOR) {
+            uint32_t packed_color = glm::packUnorm4x8(glm::clamp(color, 0.0f, 1.0f));
+            memcpy(out + layout.color_offset, &packed_color, sizeof(uint32_t));
+        }
+    }
+}
+
+void finalizeSubMeshBuffers(SubMeshStaging& sub) {
+    const size_t stride = getVertexLayout(sub.vertex_format).stride;
+    const size_t vertex_count = sub.vertices.size() / stride;
+
+    // AABB and a sphere around its centre over the vertices this level's triangles use, so
+    // simplified LODs get their own bounds. Every layout starts with a float3 position.
+    glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+    for (unsigned int index : sub.indices) {
+        glm::vec3 p;
+        memcpy(&p, &sub.vertices[(size_t)index * stride], sizeof(p));
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+    if (!sub.indices.empty()) {
+        glm::vec3 center = (bmin + bmax) * 0.5f;
+        float radius_sq = 0.0f;
+        for (unsigned int index : sub.indices) {
+            glm::vec3 p;
+            memcpy(&p, &sub.vertices[(size_t)index * stride], sizeof(p));
+            radius_sq = std::max(radius_sq, glm::dot(p - center, p - center));
+        }
+        sub.bounds = glm::vec4(center, std::sqrt(radius_sq));
+        sub.bounds_min = bmin;
+        sub.bounds_max = bmax;
+    }
+
+    sub.triangle_count = static_cast<unsigned int>(sub.indices.size() / 3);
+    sub.vertex_data = sub.vertices.data();
+    sub.vertex_bytes = sub.vertices.size();
+    if (vertex_count <= MESH_MAX_16BIT_VERTICES) {
+        sub.index_type = GL_UNSIGNED_SHORT;
+        sub.indices16.assign(sub.indices.begin(), sub.indices.end());
+        sub.index_data = sub.indices16.data();
+        sub.index_bytes = sub.indices16.size() * sizeof(uint16_t);
+    } else {
+        sub.index_data = sub.indices.data();
+        sub.index_bytes = sub.indices.size() * sizeof(unsigned int);
+    }
+    for (auto& lod : sub.lods) finalizeSubMeshBuffers(lod);
+}
+
+// Meshlets of every level big enough to be worth culling in parts, after the optimizer's order
+static void buildSubMeshMeshlets(SubMeshStaging& sub) {
+    if (sub.indices.size() / 3 >= MESHLET_MIN_MESH_TRIANGLES) {
+        buildMeshlets(sub.indices.data(), sub.indices.size(), sub.vertices.data(), getVertexLayout(sub.vertex_format).stride, sub.meshlets);
+        sub.meshlet_data = sub.meshlets.data();
+        sub.meshlet_count = sub.meshlets.size();
+    }
+    for (auto& lod : sub.lods) buildSubMeshMeshlets(lod);
+}
+
+// Every level is simplified from the full mesh so its error is measured against the original
+static void generateSubMeshLODs(const char* name, SubMeshStaging& sub) {
+    const size_t stride = getVertexLayout(sub.vertex_format).stride;
+    const size_t vertex_count = sub.vertices.size() / stride;
+    size_t previous_count = sub.indices.size();
+    float target_ratio = 1.0f;
+
+    for (unsigned int level = 1; level <= mesh_lod_levels; ++level) {
+        target_ratio *= MESH_LOD_TRIANGLE_RATIO;
+        size_t target_count = (size_t)(sub.indices.size() / 3 * target_ratio) * 3;
+        if (target_count < MESH_LOD_MIN_TRIANGLES * 3) break;
+
+        SubMeshStaging lod;
+        lod.vertex_format = sub.vertex_format;
+        lod.indices = sub.indices;
+        lod.lod_error = simplifyMesh(lod.indices, sub.vertices.data(), vertex_count, stride, target_count, MESH_LOD_MAX_ERROR);
+
+        // Stalled on locked seams or the error limit, a near-identical level isn't worth drawing
+        if (lod.indices.size() > previous_count * 9 / 10) break;
+        previous_count = lod.indices.size();
+
+        lod.vertices = sub.vertices;
+        std::string lod_name = std::string(name) + " LOD" + std::to_string(level);
+        optimizeMesh(lod_name.c_str(), lod.indices, lod.vertices, stride);
+        sub.lods.push_back(std::move(lod));
+    }
+}
+
+// Assimp's reads of a model and the files it names (.mtl, .bin) go through MappedFile, so they
+// come out of the asset pack when one is open
+class MappedIOStream : public Assimp::IOStream {
+public:
+    explicit MappedIOStream(std::unique_ptr<MappedFile> file) : file(std::move(file)) {}
+
+    size_t Read(void* buffer, size_t size, size_t count) override {
+        if (size == 0) return 0;
+        count = std::min(count, (file->size() - position) / size);
+        memcpy(buffer, file->data() + position, size * count);
+        position += size * count;
+        return count;
+    }
+    size_t Write(const void*, size_t, size_t) override { return 0; }
+    aiReturn Seek(size_t offset, aiOrigin origin) override {
+        const size_t base = origin == aiOrigin_SET ? 0 : origin == aiOrigin_CUR ? position : file->size();
+        if (offset > file->size() - base) return aiReturn_FAILURE;
+        position = base + offset;
+        return aiReturn_SUCCESS;
+    }
+    size_t Tell() const override { return position; }
+    size_t FileSize() const override { return file->size(); }
+    void Flush() override {}
+
+private:
+    std::unique_ptr<MappedFile> file;
+    size_t position = 0;
+};
+
+class MappedIOSystem : public Assimp::IOSystem {
+public:
+    bool Exists(const char* path) const override {
+        const unsigned char* data;
+        size_t size;
+        std::error_code ec;
+        return asset_pack.find(path, data, size) || std::filesystem::is_regular_file(path, ec);
+    }
+    char getOsSeparator() const override { return '/'; }
+    Assimp::IOStream* Open(const char* path, const char* mode) override {
+        if (strchr(mode, 'w') || strchr(mode, 'a')) return nullptr;
+        auto file = std::make_unique<MappedFile>(path);
+        if (!file->isOpen()) return nullptr;
+        bytes_opened += file->size();
+        return new MappedIOStream(std::move(file));
+    }
+    void Close(Assimp::IOStream* stream) override { delete stream; }
+
+    uint64_t bytesOpened() const { return bytes_opened; }
+
+private:
+    uint64_t bytes_opened = 0;
+};
+
+const aiScene* readAssimpScene(Assimp::Importer& importer, const std::string& source_path, unsigned int flags) {
+    MappedIOSystem* io = new MappedIOSystem(); // The importer owns it
+    importer.SetIOHandler(io);
+    const aiScene* scene = nullptr;
+    {
+        LoadTimer timer(LOAD_STAGE_ASSIMP_READ);
+        scene = importer.ReadFile(source_path, flags);
+        timer.addBytesRead(io->bytesOpened());
+    }
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         printf("Assimp error: %s\n", importer.GetErrorString());
-        return {};
+        return nullptr;
     }
+    return scene;
+}
 
-    std::vector<std::shared_ptr<Mesh>> meshes;
-    std::function<void(aiNode*)> processNode = [&](aiNode* node) {
+static std::mutex instancing_mutex;
+static std::unordered_set<std::string> instancing_paths;
+
+void requestNodeInstancing(const std::string& filepath) {
+    std::lock_guard<std::mutex> lock(instancing_mutex);
+    instancing_paths.insert(MeshRegistry::normalizePath(filepath));
+}
+
+bool wantsNodeInstancing(const std::string& filepath) {
+    std::lock_guard<std::mutex> lock(instancing_mutex);
+    return instancing_paths.count(MeshRegistry::normalizePath(filepath)) != 0;
+}
+
+static glm::mat4 toGlm(const aiMatrix4x4& m) {
+    return glm::transpose(glm::make_mat4(&m.a1));
+}
+
+bool importMeshStaging(const std::string& filepath, MeshStaging& staging) {
+    staging = MeshStaging();
+    staging.filepath = filepath;
+    staging.source_path = buildAssetPath("res/scene_models/" + filepath);
+
+    LoadAssetScope asset(filepath);
+
+    // Lightmapped models stay flat, a shared mesh can't hold every placement's texels
+    const bool lightmap_uvs = wantsLightmapUVs(filepath);
+    const bool instanced = !lightmap_uvs && wantsNodeInstancing(filepath);
+    const unsigned int import_flags = instanced ? MESH_INSTANCED_IMPORT_FLAGS : MESH_IMPORT_FLAGS;
+
+    // Warm start: skip Assimp entirely if a valid cooked copy exists
+    if (loadCookedMeshStaging(filepath, staging.source_path, import_flags, staging)) return true;
+
+    Assimp::Importer importer;
+    const aiScene* scene = readAssimpScene(importer, staging.source_path, import_flags);
+    if (!scene) return false;
+
+    auto importMesh = [&](aiMesh* mesh) {
+        SubMeshStaging sub;
+        
+        {
+            LoadTimer timer(LOAD_STAGE_VERTEX_ENCODE);
+            sub.vertex_format = chooseVertexFormat(mesh);
+            encodeVertices(mesh, getVertexLayout(sub.vertex_format), sub.vertices);
+
+            sub.indices.reserve((size_t)mesh->mNumFaces * 3);
+            for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
+                const aiFace& face = mesh->mFaces[f];
+                sub.indices.insert(sub.indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
+            }
+        }
+
+        // Image decodes and packs inside are timed as their own stages
+        LoadTimer timer(LOAD_STAGE_MESH_PROCESS);
+
+        // Before the optimizer, which then orders the split vertices with the rest
+        if (lightmap_uvs) generateLightmapUVs(mesh->mName.C_Str(), sub);
+
+        const size_t stride = getVertexLayout(sub.vertex_format).stride;
+        if (optimize_imported_meshes) optimizeMesh(mesh->mName.C_Str(), sub.indices, sub.vertices, stride);
+        
+        sub.material = describeMaterialFromAssimp(filepath, scene->mMaterials[mesh->mMaterialIndex]);
+        sub.images = decodeMaterialImages(sub.material, scene);
+        generateSubMeshLODs(mesh->mName.C_Str(), sub);
+        finalizeSubMeshBuffers(sub);
+        buildSubMeshMeshlets(sub);
+        staging.submeshes.push_back(std::move(sub));
+    };
+
+    // Flat imports have every node's meshes already in place, one sub-mesh per reference.
+    // Instanced ones import each scene mesh the first time a node reaches it.
+    std::vector<uint32_t> scene_submeshes(scene->mNumMeshes, UINT32_MAX);
+    std::function<void(aiNode*, const glm::mat4&)> processNode = [&](aiNode* node, const glm::mat4& parent) {
+        const glm::mat4 transform = parent * toGlm(node->mTransformation);
         for (unsigned int i = 0; i < node->mNumMeshes; ++i) {
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            auto newMesh = std::make_shared<Mesh>();
-            
-            for (unsigned int v = 0; v < mesh->mNumVertices; ++v) {
-                newMesh->vertices_data.push_back(mesh->mVertices[v].x);
-                newMesh->vertices_data.push_back(mesh->mVertices[v].y);
-                newMesh->vertices_data.push_back(mesh->mVertices[v].z);
-                
-                if (mesh->HasVertexColors(0)) {
-                    aiColor4D color = mesh->mColors[0][v];
-                    newMesh->vertices_data.push_back(color.r);
-                    newMesh->vertices_data.push_back(color.g);
-                    newMesh->vertices_data.push_back(color.b);
-                    newMesh->vertices_data.push_back(color.a);
-                } else {
-                    newMesh->vertices_data.push_back(1.0f);
-                    newMesh->vertices_data.push_back(1.0f);
-                    newMesh->vertices_data.push_back(1.0f);
-                    newMesh->vertices_data.push_back(1.0f);
-                }
-                
-                if (mesh->HasTextureCoords(0)) {
-                    newMesh->vertices_data.push_back(mesh->mTextureCoords[0][v].x);
-                    newMesh->vertices_data.push_back(mesh->mTextureCoords[0][v].y);
-                } else {
-                    newMesh->vertices_data.push_back(0.0f);
-                    newMesh->vertices_data.push_back(0.0f);
-                }
-                
-                if (mesh->HasNormals()) {
-                    newMesh->vertices_data.push_back(mesh->mNormals[v].x);
-                    newMesh->vertices_data.push_back(mesh->mNormals[v].y);
-                    newMesh->vertices_data.push_back(mesh->mNormals[v].z);
-                } else {
-                    newMesh->vertices_data.push_back(0.0f);
-                    newMesh->vertices_data.push_back(0.0f);
-                    newMesh->vertices_data.push_back(1.0f);
-                }
-                
-                if (mesh->HasTangentsAndBitangents()) {
-                    newMesh->vertices_data.push_back(mesh->mTangents[v].x);
-                    newMesh->vertices_data.push_back(mesh->mTangents[v].y);
-                    newMesh->vertices_data.push_back(mesh->mTangents[v].z);
-                } else {
-                    newMesh->vertices_data.push_back(1.0f);
-                    newMesh->vertices_data.push_back(0.0f);
-                    newMesh->vertices_data.push_back(0.0f);
-                }
-                
-                if (mesh->HasTangentsAndBitangents()) {
-                    newMesh->vertices_data.push_back(mesh->mBitangents[v].x);
-                    newMesh->vertices_data.push_back(mesh->mBitangents[v].y);
-                    newMesh->vertices_data.push_back(mesh->mBitangents[v].z);
-                } else {
-                    newMesh->vertices_data.push_back(0.0f);
-                    newMesh->vertices_data.push_back(1.0f);
-                    newMesh->vertices_data.push_back(0.0f);
-                }
-            }
-            
-            for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
-                aiFace face = mesh->mFaces[f];
-                for (unsigned int j = 0; j < face.mNumIndices; ++j) newMesh->indices_data.push_back(face.mIndices[j]);
+            if (!instanced) {
+                importMesh(mesh);
+                continue;
             }
-            
-            aiMaterial* assimpMat = scene->mMaterials[mesh->mMaterialIndex];
-            newMesh->material = createMaterialFromAssimp(filepath, assimpMat, scene);
-            newMesh->TRIANGLE_COUNT = mesh->mNumFaces;
-            newMesh->INDEX_COUNT = static_cast<unsigned int>(newMesh->indices_data.size());
-            
-            glGenVertexArrays(1, &newMesh->VAO);
-            glGenBuffers(1, &newMesh->VBO);
-            glGenBuffers(1, &newMesh->EBO);
-            glBindVertexArray(newMesh->VAO);
-            glBindBuffer(GL_ARRAY_BUFFER, newMesh->VBO);
-            glBufferData(GL_ARRAY_BUFFER, newMesh->vertices_data.size() * sizeof(float), newMesh->vertices_data.data(), GL_STATIC_DRAW);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, newMesh->EBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, newMesh->indices_data.size() * sizeof(unsigned int), newMesh->indices_data.data(), GL_STATIC_DRAW);
-
-            constexpr GLsizei stride = 18 * sizeof(float);
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)(0));
-            glEnableVertexAttribArray(1);
-            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
-            glEnableVertexAttribArray(2);
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(7 * sizeof(float)));
-            glEnableVertexAttribArray(3);
-            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)(9 * sizeof(float)));
-            glEnableVertexAttribArray(4);
-            glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*)(12 * sizeof(float)));
-            glEnableVertexAttribArray(5);
-            glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, stride, (void*)(15 * sizeof(float)));
-
-            // Instance matrix attribute setup
-            glGenBuffers(1, &newMesh->instanceVBO); 
-            glBindBuffer(GL_ARRAY_BUFFER, newMesh->instanceVBO);
-
-            const size_t MAX_INSTANCES = 1000;  // Maximum instances per mesh
-            newMesh->maxInstances = MAX_INSTANCES;
-
-            glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
-
-            // Enable 4 slots (6, 7, 8, 9) for instance matrix
-            std::size_t matrixSize = sizeof(glm::mat4);
-            std::size_t vec4Size = sizeof(glm::vec4);
-
-            for (int i = 0; i < 4; i++) {
-                unsigned int loc = 6 + i;
-                glEnableVertexAttribArray(loc);
-                glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, matrixSize, (void*)(i * vec4Size));
-                glVertexAttribDivisor(loc, 1);
+            uint32_t& submesh = scene_submeshes[node->mMeshes[i]];
+            if (submesh == UINT32_MAX) {
+                submesh = (uint32_t)staging.submeshes.size();
+                importMesh(mesh);
             }
-
-            glBindVertexArray(0);
-            meshes.push_back(newMesh);
-            newMesh->maxInstances = MAX_INSTANCES;
+            staging.instances.push_back({ submesh, transform });
         }
 
-        for (unsigned int i = 0; i < node->mNumChildren; ++i) processNode(node->mChildren[i]);
+        for (unsigned int i = 0; i < node->mNumChildren; ++i) processNode(node->mChildren[i], transform);
     };
 
-    processNode(scene->mRootNode);
+    processNode(scene->mRootNode, glm::mat4(1.0f));
+    if (instanced) {
+        printf("'%s': %zu unique meshes placed %zu times\n", filepath.c_str(), staging.submeshes.size(), staging.instances.size());
+    }
+
+    // Cooking is plain file I/O, so it stays on the importing thread
+    writeCookedMesh(filepath, staging.source_path, import_flags, staging);
+    return true;
+}
+
+static std::shared_ptr<Mesh> uploadSubMeshGeometry(SubMeshStaging& sub) {
+    auto newMesh = std::make_shared<Mesh>();
+    newMesh->TRIANGLE_COUNT = sub.triangle_count;
+    newMesh->lod_error = sub.lod_error;
+    newMesh->bounds_center = glm::vec3(sub.bounds);
+    newMesh->bounds_radius = sub.bounds.w;
+    newMesh->bounds_min = sub.bounds_min;
+    newMesh->bounds_max = sub.bounds_max;
+    newMesh->index_type = sub.index_type;
+    newMesh->INDEX_COUNT = static_cast<unsigned int>(sub.index_bytes / getIndexSize(sub.index_type));
+    newMesh->vertex_layout = getVertexLayout(sub.vertex_format);
+    
+    LoadTimer timer(LOAD_STAGE_MESH_UPLOAD);
+    timer.addBytesUploaded(sub.vertex_bytes + sub.index_bytes);
+    uploadMeshBuffers(*newMesh, sub.vertex_data, sub.vertex_bytes, sub.index_data, sub.index_bytes);
+    if (sub.meshlet_count > 0) {
+        newMesh->meshlets = std::make_shared<const std::vector<Meshlet>>(sub.meshlet_data, sub.meshlet_data + sub.meshlet_count);
+    }
+    
+    // Copied out of the staged bytes, imported and cooked alike, before the staging goes
+    if (mesh_residency != MESH_RESIDENCY_NONE) {
+        const unsigned char* indices = static_cast<const unsigned char*>(sub.index_data);
+        newMesh->indices_data.assign(indices, indices + sub.index_bytes);
+    }
+    if (mesh_residency == MESH_RESIDENCY_FULL) {
+        const unsigned char* vertices = static_cast<const unsigned char*>(sub.vertex_data);
+        newMesh->vertices_data.assign(vertices, vertices + sub.vertex_bytes);
+    } else if (mesh_residency == MESH_RESIDENCY_POSITIONS) {
+        // Position is the leading 3 floats of either layout
+        const size_t stride = newMesh->vertex_layout.stride;
+        const unsigned char* vertices = static_cast<const unsigned char*>(sub.vertex_data);
+        newMesh->positions_data.resize(sub.vertex_bytes / stride);
+        for (size_t v = 0; v < newMesh->positions_data.size(); ++v) {
+            memcpy(&newMesh->positions_data[v], vertices + v * stride, sizeof(glm::vec3));
+        }
+    }
+
+    // The import's own buffers go now rather than with the whole staging record
+    sub.vertices = {};
+    sub.indices = {};
+    sub.meshlets = {};
+    sub.vertex_data = sub.index_data = nullptr;
+    sub.meshlet_data = nullptr;
+    sub.meshlet_count = 0;
+    mesh_pool.create(*newMesh);
+    return newMesh;
+}
+
+std::shared_ptr<Mesh> uploadSubMeshStaging(SubMeshStaging& sub) {
+    auto newMesh = uploadSubMeshGeometry(sub);
+    newMesh->material = buildMaterialFromImages(sub.material, sub.images);
+    sub.images = MaterialImages();
 
+    for (auto& lod : sub.lods) {
+        auto lodMesh = uploadSubMeshGeometry(lod);
+        lodMesh->setMaterial(newMesh->material);
+        newMesh->lods.push_back(std::move(lodMesh));
+    }
+    return newMesh;
+}
+
+std::vector<std::shared_ptr<Mesh>> uploadMeshStaging(MeshStaging& staging) {
+    LoadAssetScope asset(staging.filepath);
+    std::vector<std::shared_ptr<Mesh>> meshes;
+    meshes.reserve(staging.submeshes.size());
+    for (auto& sub : staging.submeshes) meshes.push_back(uploadSubMeshStaging(sub));
+    logLoadedMesh(staging.filepath, meshes, staging.from_cache);
+    staging.mapping.reset();
+    return meshes;
+}
+
+void logLoadedMesh(const std::string& filepath, const std::vector<std::shared_ptr<Mesh>>& meshes, bool from_cache) {
     size_t triangles = 0;
     for (const auto& mesh : meshes) triangles += mesh->TRIANGLE_COUNT;
-    printf("Loaded mesh from '%s' with %zu sub-meshes and %zu triangles\n", filepath.c_str(), meshes.size(), triangles);
+    printf("Loaded %smesh from '%s' with %zu sub-meshes and %zu triangles\n", from_cache ? "cooked " : "",
+           filepath.c_str(), meshes.size(), triangles);
+}
 
-    return meshes;
-}
\ No newline at end of file
+std::vector<std::shared_ptr<Mesh>> loadMesh(const std::string& filepath) {
+    MeshStaging staging;
+    if (!importMeshStaging(filepath, staging)) return {};
+    return uploadMeshStaging(staging);
+}
+
+std::shared_ptr<Mesh> createMeshVariant(const std::shared_ptr<Mesh>& source, const Material& material) {
+    auto variant = std::make_shared<Mesh>();
+    variant->vertex_layout = source->vertex_layout;
+    variant->TRIANGLE_COUNT = source->TRIANGLE_COUNT;
+    variant->INDEX_COUNT = source->INDEX_COUNT;
+    variant->index_type = source->index_type;
+    variant->VAO = source->VAO;
+    variant->VBO = source->VBO;
+    variant->EBO = source->EBO;
+    variant->instanceVBO = source->instanceVBO;
+    variant->instanceFadeVBO = source->instanceFadeVBO;
+    variant->depthVAO = source->depthVAO;
+    variant->depthVBO = source->depthVBO;
+    variant->shadowVAO = source->shadowVAO;
+    variant->shadow_quantization = source->shadow_quantization;
+    variant->pulled = source->pulled;
+    variant->meshlets = source->meshlets;
+    variant->arena = source->arena;
+    variant->geometry = source->geometry;
+    variant->cull_mode = source->cull_mode;
+    variant->lod_error = source->lod_error;
+    variant->bounds_center = source->bounds_center;
+    variant->bounds_radius = source->bounds_radius;
+    variant->bounds_min = source->bounds_min;
+    variant->bounds_max = source->bounds_max;
+    variant->geometry_owner = source->geometry_owner ? source->geometry_owner : source;
+    variant->setMaterial(material);
+    mesh_pool.create(*variant);
+    for (const auto& lod : source->lods) variant->lods.push_back(createMeshVariant(lod, material));
+    return variant;
+}
@@ -0,0 +1,544 @@
+#include "mesh_optimizer.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <unordered_map>
+
+bool optimize_imported_meshes = true;
+
+// ============================================================================
+// ANALYSIS
+// ============================================================================
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t index_count, size_t vertex_count, unsigned int cache_size) {
+    VertexCacheStats stats;
+    if (index_count < 3 || vertex_count == 0) return stats;
+
+    // FIFO: a vertex hits if it was inserted within the last cache_size misses
+    std::vector<size_t> inserted_at(vertex_count, 0);
+    size_t misses = 0;
+    for (size_t i = 0; i < index_count; ++i) {
+        unsigned int v = indices[i];
+        if (inserted_at[v] == 0 || misses + 1 - inserted_at[v] > cache_size) {
+            ++misses;
+            inserted_at[v] = misses;
+        }
+    }
+
+    stats.acmr = (float)misses / (float)(index_count / 3);
+    stats.atvr = (float)misses / (float)vertex_count;
+    return stats;
+}
+
+// ============================================================================
+// VERTEX CACHE (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+// ============================================================================
+
+namespace {
+
+constexpr int FORSYTH_CACHE_SIZE = 32;
+constexpr float FORSYTH_LAST_TRI_SCORE = 0.75f;
+constexpr float FORSYTH_DECAY_POWER = 1.5f;
+constexpr float FORSYTH_VALENCE_SCALE = 2.0f;
+constexpr float FORSYTH_VALENCE_POWER = 0.5f;
+
+float forsythVertexScore(int cache_position, unsigned int remaining_valence) {
+    if (remaining_valence == 0) return -1.0f;
+
+    float score = 0.0f;
+    if (cache_position >= 0) {
+        if (cache_position < 3) {
+            score = FORSYTH_LAST_TRI_SCORE;
+        } else {
+            float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cache_position - 3) * scaler, FORSYTH_DECAY_POWER);
+        }
+    }
+    return score + FORSYTH_VALENCE_SCALE * std::pow((float)remaining_valence, -FORSYTH_VALENCE_POWER);
+}
+
+} // namespace
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertex_count) {
+    const size_t triangle_count = indices.size() / 3;
+    if (triangle_count == 0 || vertex_count == 0) return;
+
+    // Vertex -> triangle adjacency (CSR)
+    std::vector<unsigned int> valence(vertex_count, 0);
+    for (unsigned int v : indices) ++valence[v];
+
+    std::vector<unsigned int> adjacency_offset(vertex_count + 1, 0);
+    for (size_t v = 0; v < vertex_count; ++v) adjacency_offset[v + 1] = adjacency_offset[v] + valence[v];
+    std::vector<unsigned int> adjacency(indices.size());
+    {
+        std::vector<unsigned int> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+        for (size_t t = 0; t < triangle_count; ++t) {
+            for (int k = 0; k < 3; ++k) adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+        }
+    }
+
+    std::vector<int> cache_position(vertex_count, -1);
+    std::vector<float> vertex_score(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v) vertex_score[v] = forsythVertexScore(-1, valence[v]);
+
+    std::vector<float> triangle_score(triangle_count);
+    std::vector<bool> emitted(triangle_count, false);
+    for (size_t t = 0; t < triangle_count; ++t) {
+        triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+    }
+
+    std::vector<unsigned int> cache, next_cache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    next_cache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+
+    size_t scan_cursor = 0;
+    long best = 0;
+    while (output.size() < indices.size()) {
+        if (best < 0) {
+            // Nothing adjacent to the cache left, restart from the next unused triangle
+            while (scan_cursor < triangle_count && emitted[scan_cursor]) ++scan_cursor;
+            if (scan_cursor == triangle_count) break;
+            best = (long)scan_cursor;
+        }
+
+        const unsigned int* tri = &indices[(size_t)best * 3];
+        output.insert(output.end(), tri, tri + 3);
+        emitted[best] = true;
+
+        // Remove the triangle from its vertices' remaining adjacency
+        for (int k = 0; k < 3; ++k) {
+            unsigned int v = tri[k];
+            unsigned int* begin = &adjacency[adjacency_offset[v]];
+            unsigned int* end = begin + valence[v];
+            unsigned int* it = std::find(begin, end, (unsigned int)best);
+            if (it != end) { std::swap(*it, *(end - 1)); --valence[v]; }
+        }
+
+        // New cache: this triangle's vertices at the front, then the rest in order
+        next_cache.assign(tri, tri + 3);
+        for (unsigned int v : cache) {
+            if (v != tri[0] && v != tri[1] && v != tri[2]) next_cache.push_back(v);
+        }
+        for (size_t i = FORSYTH_CACHE_SIZE; i < next_cache.size(); ++i) cache_position[next_cache[i]] = -1;
+        if (next_cache.size() > (size_t)FORSYTH_CACHE_SIZE) next_cache.resize(FORSYTH_CACHE_SIZE);
+        cache.swap(next_cache);
+
+        // Rescore cached vertices and their triangles, picking the best as we go
+        for (size_t i = 0; i < cache.size(); ++i) {
+            unsigned int v = cache[i];
+            cache_position[v] = (int)i;
+            vertex_score[v] = forsythVertexScore((int)i, valence[v]);
+        }
+        best = -1;
+        float best_score = -1.0f;
+        for (unsigned int v : cache) {
+            for (unsigned int a = 0; a < valence[v]; ++a) {
+                unsigned int t = adjacency[adjacency_offset[v] + a];
+                float score = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+                triangle_score[t] = score;
+                if (score > best_score) { best_score = score; best = (long)t; }
+            }
+        }
+    }
+
+    indices.swap(output);
+}
+
+// ============================================================================
+// OVERDRAW (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+// ============================================================================
+
+static glm::vec3 readPosition(const unsigned char* vertices, size_t stride, unsigned int v) {
+    glm::vec3 p;
+    memcpy(&p, vertices + (size_t)v * stride, sizeof(p));
+    return p;
+}
+
+void optimizeOverdraw(std::vector<unsigned int>& indices, const unsigned char* vertices, size_t vertex_count,
+                      size_t stride, float threshold) {
+    const size_t triangle_count = indices.size() / 3;
+    if (triangle_count < 2 || vertex_count == 0) return;
+
+    // Hard boundaries: triangles where the simulated cache missed every vertex
+    std::vector<size_t> clusters;
+    {
+        std::vector<size_t> inserted_at(vertex_count, 0);
+        size_t misses = 0;
+        for (size_t t = 0; t < triangle_count; ++t) {
+            int tri_misses = 0;
+            for (int k = 0; k < 3; ++k) {
+                unsigned int v = indices[t * 3 + k];
+                if (inserted_at[v] == 0 || misses + 1 - inserted_at[v] > MESH_OPT_STATS_CACHE_SIZE) {
+                    inserted_at[v] = ++misses;
+                    ++tri_misses;
+                }
+            }
+            if (t == 0 || tri_misses == 3) clusters.push_back(t);
+        }
+    }
+
+    // Soft boundaries: split large clusters wherever the running ACMR is already within
+    // threshold of the cluster's own, since breaking there costs little cache efficiency
+    std::vector<size_t> split_clusters;
+    for (size_t c = 0; c < clusters.size(); ++c) {
+        size_t begin = clusters[c];
+        size_t end = (c + 1 < clusters.size()) ? clusters[c + 1] : triangle_count;
+        VertexCacheStats whole = analyzeVertexCache(&indices[begin * 3], (end - begin) * 3, vertex_count);
+        const float limit = whole.acmr * threshold;
+
+        split_clusters.push_back(begin);
+        size_t sub_begin = begin;
+        for (size_t t = begin + 1; t < end; ++t) {
+            size_t length = t - sub_begin;
+            if (length < 32) continue;
+            VertexCacheStats part = analyzeVertexCache(&indices[sub_begin * 3], length * 3, vertex_count);
+            if (part.acmr <= limit) {
+                split_clusters.push_back(t);
+                sub_begin = t;
+            }
+        }
+    }
+
+    // Mesh centroid, then each cluster's area-weighted centroid and normal
+    glm::dvec3 mesh_center(0.0);
+    for (size_t v = 0; v < vertex_count; ++v) mesh_center += glm::dvec3(readPosition(vertices, stride, (unsigned int)v));
+    mesh_center /= (double)vertex_count;
+
+    struct ClusterSort { size_t begin, end; float key; };
+    std::vector<ClusterSort> sorted;
+    sorted.reserve(split_clusters.size());
+    for (size_t c = 0; c < split_clusters.size(); ++c) {
+        size_t begin = split_clusters[c];
+        size_t end = (c + 1 < split_clusters.size()) ? split_clusters[c + 1] : triangle_count;
+
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area_sum = 0.0f;
+        for (size_t t = begin; t < end; ++t) {
+            glm::vec3 a = readPosition(vertices, stride, indices[t * 3]);
+            glm::vec3 b = readPosition(vertices, stride, indices[t * 3 + 1]);
+            glm::vec3 d = readPosition(vertices, stride, indices[t * 3 + 2]);
+            glm::vec3 n = glm::cross(b - a, d - a); // length = 2 * area
+            float area = glm::length(n);
+            center += (a + b + d) * (area / 3.0f);
+            normal += n;
+            area_sum += area;
+        }
+        if (area_sum > 0.0f) center /= area_sum;
+        float normal_length = glm::length(normal);
+        if (normal_length > 0.0f) normal /= normal_length;
+
+        // Clusters facing away from the centre tend to occlude the rest, draw them first
+        sorted.push_back({ begin, end, glm::dot(center - glm::vec3(mesh_center), normal) });
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(), [](const ClusterSort& a, const ClusterSort& b) { return a.key > b.key; });
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    for (const auto& cluster : sorted) {
+        output.insert(output.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+    }
+    indices.swap(output);
+}
+
+// ============================================================================
+// VERTEX FETCH
+// ============================================================================
+
+void optimizeVertexFetch(std::vector<unsigned int>& indices, std::vector<unsigned char>& vertices, size_t stride) {
+    const size_t vertex_count = vertices.size() / stride;
+    if (vertex_count == 0) return;
+
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(vertex_count, unused);
+    std::vector<unsigned char> output(vertices.size());
+
+    unsigned int next = 0;
+    for (unsigned int& index : indices) {
+        if (remap[index] == unused) {
+            memcpy(&output[(size_t)next * stride], &vertices[(size_t)index * stride], stride);
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+
+    // Vertices no triangle references are dropped
+    output.resize((size_t)next * stride);
+    vertices.swap(output);
+}
+
+void optimizeMesh(const char* name, std::vector<unsigned int>& indices, std::vector<unsigned char>& vertices, size_t stride) {
+    size_t vertex_count = vertices.size() / stride;
+    if (indices.size() < 3 || vertex_count == 0) return;
+
+    VertexCacheStats before = analyzeVertexCache(indices.data(), indices.size(), vertex_count);
+
+    optimizeVertexCache(indices, vertex_count);
+    optimizeOverdraw(indices, vertices.data(), vertex_count, stride);
+    optimizeVertexFetch(indices, vertices, stride);
+
+    VertexCacheStats after = analyzeVertexCache(indices.data(), indices.size(), vertices.size() / stride);
+    printf("Optimized '%s': ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", name, before.acmr, after.acmr, before.atvr, after.atvr);
+}
+
+// ============================================================================
+// SIMPLIFICATION
+// ============================================================================
+
+namespace {
+
+struct Quadric {
+    // Upper triangle of the symmetric 4x4 error matrix
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+
+    void addPlane(const glm::dvec3& n, double d, double weight) {
+        a00 += weight * n.x * n.x; a01 += weight * n.x * n.y; a02 += weight * n.x * n.z; a03 += weight * n.x * d;
+        a11 += weight * n.y * n.y; a12 += weight * n.y * n.z; a13 += weight * n.y * d;
+        a22 += weight * n.z * n.z; a23 += weight * n.z * d;
+        a33 += weight * d * d;
+    }
+
+    void add(const Quadric& q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23;
+        a33 += q.a33;
+    }
+
+    double error(const glm::dvec3& p) const {
+        double e = a00 * p.x * p.x + 2 * a01 * p.x * p.y + 2 * a02 * p.x * p.z + 2 * a03 * p.x
+                 + a11 * p.y * p.y + 2 * a12 * p.y * p.z + 2 * a13 * p.y
+                 + a22 * p.z * p.z + 2 * a23 * p.z
+                 + a33;
+        return e > 0 ? e : 0;
+    }
+};
+
+enum VertexKind : unsigned char {
+    KIND_MANIFOLD, // Interior, collapses anywhere
+    KIND_BORDER,   // Open edge, collapses along the border only
+    KIND_LOCKED,   // Seam or non-manifold, never moves
+};
+
+// Open borders are weighted up so silhouettes survive longer than interior detail
+constexpr double SIMPLIFY_BORDER_WEIGHT = 10.0;
+
+inline uint64_t edgeKey(unsigned int a, unsigned int b) {
+    return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+struct PositionKey {
+    float x, y, z;
+    bool operator==(const PositionKey& o) const { return x == o.x && y == o.y && z == o.z; }
+};
+
+struct PositionKeyHash {
+    size_t operator()(const PositionKey& k) const {
+        uint32_t h[3];
+        memcpy(h, &k, sizeof(h));
+        return (size_t)(h[0] * 73856093u ^ h[1] * 19349663u ^ h[2] * 83492791u);
+    }
+};
+
+} // namespace
+
+float simplifyMesh(std::vector<unsigned int>& indices, const unsigned char* vertices, size_t vertex_count, size_t stride,
+                   size_t target_index_count, float target_error) {
+    if (indices.size() <= target_index_count || vertex_count == 0) return 0.0f;
+
+    // Normalise positions to the unit box so errors are relative to the mesh size
+    std::vector<glm::dvec3> positions(vertex_count);
+    glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+    for (size_t v = 0; v < vertex_count; ++v) {
+        glm::vec3 p = readPosition(vertices, stride, (unsigned int)v);
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+    glm::vec3 extent = bmax - bmin;
+    double scale = std::max(extent.x, std::max(extent.y, extent.z));
+    scale = scale > 0 ? 1.0 / scale : 1.0;
+    for (size_t v = 0; v < vertex_count; ++v) {
+        positions[v] = glm::dvec3(readPosition(vertices, stride, (unsigned int)v) - bmin) * scale;
+    }
+
+    // Vertices sharing a position are attribute seams of one topological vertex
+    std::vector<unsigned int> welded(vertex_count);
+    std::vector<unsigned int> weld_count(vertex_count, 0);
+    {
+        std::unordered_map<PositionKey, unsigned int, PositionKeyHash> first_at;
+        first_at.reserve(vertex_count);
+        for (size_t v = 0; v < vertex_count; ++v) {
+            glm::vec3 p = readPosition(vertices, stride, (unsigned int)v);
+            auto it = first_at.emplace(PositionKey{ p.x, p.y, p.z }, (unsigned int)v).first;
+            welded[v] = it->second;
+            ++weld_count[it->second];
+        }
+    }
+
+    std::vector<VertexKind> kind(vertex_count);
+    std::unordered_map<uint64_t, unsigned int> edge_faces;
+    auto classify = [&]() {
+        edge_faces.clear();
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int k = 0; k < 3; ++k) {
+                ++edge_faces[edgeKey(welded[indices[i + k]], welded[indices[i + (k + 1) % 3]])];
+            }
+        }
+
+        std::vector<unsigned char> border_edges(vertex_count, 0);
+        std::fill(kind.begin(), kind.end(), KIND_MANIFOLD);
+        for (const auto& [key, faces] : edge_faces) {
+            unsigned int a = (unsigned int)(key >> 32), b = (unsigned int)key;
+            if (faces == 1) {
+                ++border_edges[a];
+                ++border_edges[b];
+            } else if (faces > 2) {
+                kind[a] = kind[b] = KIND_LOCKED;
+            }
+        }
+        for (size_t v = 0; v < vertex_count; ++v) {
+            unsigned int w = welded[v];
+            if (weld_count[w] > 1 || kind[w] == KIND_LOCKED || border_edges[w] > 2) kind[v] = KIND_LOCKED;
+            else if (border_edges[w] > 0) kind[v] = KIND_BORDER;
+        }
+    };
+
+    auto isBorderEdge = [&](unsigned int a, unsigned int b) {
+        auto it = edge_faces.find(edgeKey(welded[a], welded[b]));
+        return it != edge_faces.end() && it->second == 1;
+    };
+
+    // Area-weighted face planes, plus perpendicular planes along open borders
+    classify();
+    std::vector<Quadric> quadrics(vertex_count);
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        const unsigned int tri[3] = { indices[i], indices[i + 1], indices[i + 2] };
+        glm::dvec3 n = glm::cross(positions[tri[1]] - positions[tri[0]], positions[tri[2]] - positions[tri[0]]);
+        double area = glm::length(n);
+        if (area <= 0) continue;
+        n /= area;
+
+        Quadric face;
+        face.addPlane(n, -glm::dot(n, positions[tri[0]]), area);
+        for (unsigned int v : tri) quadrics[v].add(face);
+
+        for (int k = 0; k < 3; ++k) {
+            unsigned int a = tri[k], b = tri[(k + 1) % 3];
+            if (!isBorderEdge(a, b)) continue;
+            glm::dvec3 edge = positions[b] - positions[a];
+            double length = glm::length(edge);
+            if (length <= 0) continue;
+            glm::dvec3 plane_n = glm::normalize(glm::cross(edge, n));
+            Quadric border;
+            border.addPlane(plane_n, -glm::dot(plane_n, positions[a]), length * length * SIMPLIFY_BORDER_WEIGHT);
+            quadrics[a].add(border);
+            quadrics[b].add(border);
+        }
+    }
+
+    const double max_cost = (double)target_error * target_error;
+    double result_cost = 0;
+
+    struct Collapse { unsigned int from, to; double cost; };
+    std::vector<Collapse> candidates;
+    std::vector<unsigned int> remap(vertex_count);
+    std::vector<unsigned char> touched(vertex_count);
+    std::vector<unsigned int> adjacency_offset(vertex_count + 1);
+    std::vector<unsigned int> adjacency;
+
+    // Each pass collapses an independent set of edges, cheapest first
+    while (indices.size() > target_index_count) {
+        // Vertex -> triangle adjacency for the flip test
+        std::fill(adjacency_offset.begin(), adjacency_offset.end(), 0);
+        for (unsigned int v : indices) ++adjacency_offset[v + 1];
+        for (size_t v = 0; v < vertex_count; ++v) adjacency_offset[v + 1] += adjacency_offset[v];
+        adjacency.resize(indices.size());
+        {
+            std::vector<unsigned int> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+            for (size_t i = 0; i < indices.size(); ++i) adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+        }
+
+        candidates.clear();
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int k = 0; k < 3; ++k) {
+                unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+                for (int dir = 0; dir < 2; ++dir) {
+                    unsigned int from = dir ? b : a, to = dir ? a : b;
+                    if (kind[from] == KIND_LOCKED) continue;
+                    if (kind[from] == KIND_BORDER && (kind[to] == KIND_MANIFOLD || !isBorderEdge(from, to))) continue;
+
+                    Quadric q = quadrics[from];
+                    q.add(quadrics[to]);
+                    double cost = q.error(positions[to]);
+                    if (cost <= max_cost) candidates.push_back({ from, to, cost });
+                }
+            }
+        }
+        if (candidates.empty()) break;
+        std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        for (size_t v = 0; v < vertex_count; ++v) remap[v] = (unsigned int)v;
+        std::fill(touched.begin(), touched.end(), 0);
+
+        const size_t triangles_needed = (indices.size() - target_index_count) / 3;
+        size_t triangles_removed = 0;
+        for (const Collapse& c : candidates) {
+            if (triangles_removed >= triangles_needed) break;
+            if (touched[c.from] || touched[c.to]) continue;
+
+            // Reject collapses that flip or badly skew any surviving triangle
+            bool flips = false;
+            size_t collapsed_faces = 0;
+            for (unsigned int a = adjacency_offset[c.from]; a < adjacency_offset[c.from + 1] && !flips; ++a) {
+                const unsigned int* tri = &indices[(size_t)adjacency[a] * 3];
+                if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) { ++collapsed_faces; continue; }
+
+                glm::dvec3 p[3], q[3];
+                for (int k = 0; k < 3; ++k) {
+                    p[k] = positions[tri[k]];
+                    q[k] = positions[tri[k] == c.from ? c.to : tri[k]];
+                }
+                glm::dvec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::dvec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+                flips = glm::dot(n0, n1) <= 0.25 * glm::length(n0) * glm::length(n1);
+            }
+            if (flips) continue;
+
+            remap[c.from] = c.to;
+            quadrics[c.to].add(quadrics[c.from]);
+            result_cost = std::max(result_cost, c.cost);
+            triangles_removed += collapsed_faces;
+
+            // Lock the one-ring so every triangle sees at most one collapse per pass
+            touched[c.to] = 1;
+            for (unsigned int a = adjacency_offset[c.from]; a < adjacency_offset[c.from + 1]; ++a) {
+                const unsigned int* tri = &indices[(size_t)adjacency[a] * 3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+            }
+        }
+        if (triangles_removed == 0) break;
+
+        size_t write = 0;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            unsigned int a = remap[indices[i]], b = remap[indices[i + 1]], d = remap[indices[i + 2]];
+            if (a == b || b == d || a == d) continue;
+            indices[write++] = a;
+            indices[write++] = b;
+            indices[write++] = d;
+        }
+        indices.resize(write);
+        classify();
+    }
+
+    return (float)std::sqrt(result_cost);
+}
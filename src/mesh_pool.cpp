@@ -0,0 +1,60 @@
+#include "mesh_pool.h"
+#include "mesh.h"
+
+MeshPool mesh_pool;
+
+static void fillRecord(MeshRecord& record, const Mesh& mesh) {
+    record.vao = mesh.VAO;
+    record.depth_vao = mesh.depthVertexArray();
+    record.shadow_vao = mesh.shadowVertexArray();
+    record.shadow_quantization = mesh.shadow_quantization;
+    record.pulled_first_index = mesh.pulled.first_index;
+    record.pulled_index_count = mesh.pulled.index_count;
+    record.instance_vbo = mesh.instanceVBO;
+    record.fade_vbo = mesh.instanceFadeVBO;
+    record.index_type = mesh.index_type;
+    record.index_count = mesh.INDEX_COUNT;
+    record.first_index = (uint32_t)(mesh.geometry.indices.offset / getIndexSize(mesh.index_type));
+    record.index_offset = (uintptr_t)mesh.geometry.indices.offset;
+    record.base_vertex = (int32_t)mesh.geometry.vertices.offset;
+    record.draw_id = mesh.draw_id;
+    record.cull_mode = (uint8_t)mesh.cull_mode;
+    record.bounds_min = mesh.bounds_min;
+    record.bounds_max = mesh.bounds_max;
+}
+
+MeshHandle MeshPool::create(Mesh& mesh) {
+    if (isValid(mesh.pool_handle)) {
+        update(mesh);
+        return mesh.pool_handle;
+    }
+
+    uint32_t slot;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        slot = (uint32_t)records.size();
+        records.emplace_back();
+        generations.push_back(1);
+    }
+    MeshRecord& record = records[slot];
+    fillRecord(record, mesh);
+    record.mesh = &mesh;
+    mesh.pool_handle = ((uint32_t)generations[slot] << MESH_HANDLE_SLOT_BITS) | slot;
+    return mesh.pool_handle;
+}
+
+void MeshPool::update(const Mesh& mesh) {
+    if (!isValid(mesh.pool_handle)) return;
+    fillRecord(records[mesh.pool_handle & MESH_HANDLE_SLOT_MASK], mesh);
+}
+
+void MeshPool::release(MeshHandle handle) {
+    if (!isValid(handle)) return;
+    const uint32_t slot = handle & MESH_HANDLE_SLOT_MASK;
+    records[slot] = MeshRecord();
+    // Skips 0 on wrapping, which would make the null handle valid
+    generations[slot] = generations[slot] == 0xff ? 1 : generations[slot] + 1;
+    free_slots.push_back(slot);
+}
@@ -0,0 +1,114 @@
+#include "mesh_registry.h"
+#include "mesh_loader.h"
+#include "material_registry.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <cstdio>
+
+MeshRegistry mesh_registry;
+
+std::string MeshRegistry::normalizePath(const std::string& filepath) {
+    return std::filesystem::path(filepath).lexically_normal().generic_string();
+}
+
+std::vector<std::shared_ptr<Mesh>> MeshRegistry::find(const std::string& filepath) {
+    auto it = entries.find(normalizePath(filepath));
+    if (it == entries.end()) return {};
+
+    std::vector<std::shared_ptr<Mesh>> meshes;
+    meshes.reserve(it->second.size());
+    for (const auto& weak : it->second) {
+        auto mesh = weak.lock();
+        if (!mesh) {
+            // Partially released models are re-imported as a whole
+            node_instances.erase(it->first);
+            entries.erase(it);
+            return {};
+        }
+        meshes.push_back(std::move(mesh));
+    }
+    return meshes;
+}
+
+void MeshRegistry::add(const std::string& filepath, const std::vector<std::shared_ptr<Mesh>>& meshes,
+                       const std::vector<MeshNodeInstance>& instances) {
+    if (meshes.empty()) return;
+    const std::string key = normalizePath(filepath);
+    entries[key] = std::vector<std::weak_ptr<Mesh>>(meshes.begin(), meshes.end());
+    if (instances.empty()) {
+        node_instances.erase(key);
+    } else {
+        node_instances[key] = instances;
+    }
+}
+
+std::vector<MeshNodeInstance> MeshRegistry::instances(const std::string& filepath) const {
+    auto it = node_instances.find(normalizePath(filepath));
+    if (it == node_instances.end()) return {};
+    return it->second;
+}
+
+bool MeshRegistry::replace(const std::string& filepath, const std::vector<std::shared_ptr<Mesh>>& fresh) {
+    auto meshes = find(filepath);
+    if (meshes.empty()) return false;
+    if (meshes.size() != fresh.size()) {
+        printf("'%s' now has %zu sub-meshes instead of %zu, only the first %zu are reloaded\n", filepath.c_str(),
+               fresh.size(), meshes.size(), std::min(meshes.size(), fresh.size()));
+    }
+    for (size_t i = 0; i < std::min(meshes.size(), fresh.size()); ++i) {
+        meshes[i]->swapContents(*fresh[i]);
+        // Variants copied the old contents' GL objects, which go with fresh
+        material_registry.refresh(meshes[i]);
+    }
+    return true;
+}
+
+std::vector<std::shared_ptr<Mesh>> MeshRegistry::load(const std::string& filepath) {
+    auto meshes = find(filepath);
+    if (!meshes.empty()) return meshes;
+
+    MeshStaging staging;
+    if (!importMeshStaging(filepath, staging)) return {};
+    std::vector<MeshNodeInstance> instances = staging.instances;
+    meshes = uploadMeshStaging(staging);
+    add(filepath, meshes, instances);
+    prune();
+    return meshes;
+}
+
+long MeshRegistry::useCount(const std::string& filepath) const {
+    auto it = entries.find(normalizePath(filepath));
+    if (it == entries.end() || it->second.empty()) return 0;
+    return it->second.front().use_count();
+}
+
+void MeshRegistry::forEach(const std::function<void(const std::string&, const std::vector<std::shared_ptr<Mesh>>&)>& fn) const {
+    std::vector<std::shared_ptr<Mesh>> meshes;
+    for (const auto& [path, weak_meshes] : entries) {
+        meshes.clear();
+        for (const auto& weak : weak_meshes) {
+            auto mesh = weak.lock();
+            if (!mesh) break;
+            meshes.push_back(std::move(mesh));
+        }
+        if (meshes.size() == weak_meshes.size()) fn(path, meshes);
+    }
+}
+
+size_t MeshRegistry::prune() {
+    size_t removed = 0;
+    for (auto it = entries.begin(); it != entries.end();) {
+        bool expired = false;
+        for (const auto& weak : it->second) expired |= weak.expired();
+        if (expired) {
+            node_instances.erase(it->first);
+            it = entries.erase(it);
+            ++removed;
+        } else {
+            ++it;
+        }
+    }
+    return removed;
+}
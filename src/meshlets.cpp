@@ -0,0 +1,138 @@
+#include "meshlets.h"
+#include "hiz.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+
+bool use_meshlet_culling = true;
+
+namespace {
+
+glm::vec3 vertexPosition(const unsigned char* vertices, size_t stride, unsigned int index) {
+    glm::vec3 p;
+    memcpy(&p, vertices + (size_t)index * stride, sizeof(p));
+    return p;
+}
+
+// Bounds and normal cone of the triangles in indices [first, first + count)
+Meshlet finishMeshlet(const unsigned int* indices, size_t first, size_t count, const unsigned char* vertices, size_t stride) {
+    Meshlet meshlet;
+    meshlet.first_index = (uint32_t)first;
+    meshlet.index_count = (uint32_t)count;
+
+    glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+    for (size_t i = first; i < first + count; ++i) {
+        const glm::vec3 p = vertexPosition(vertices, stride, indices[i]);
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+    meshlet.center = (bmin + bmax) * 0.5f;
+    float radius_sq = 0.0f;
+    for (size_t i = first; i < first + count; ++i) {
+        const glm::vec3 d = vertexPosition(vertices, stride, indices[i]) - meshlet.center;
+        radius_sq = std::max(radius_sq, glm::dot(d, d));
+    }
+    meshlet.radius = std::sqrt(radius_sq);
+
+    // Face normals from the winding, which is what back-face culling goes by
+    std::vector<glm::vec3> normals;
+    normals.reserve(count / 3);
+    glm::vec3 sum(0.0f);
+    for (size_t i = first; i + 2 < first + count; i += 3) {
+        const glm::vec3 a = vertexPosition(vertices, stride, indices[i]);
+        const glm::vec3 n = glm::cross(vertexPosition(vertices, stride, indices[i + 1]) - a, vertexPosition(vertices, stride, indices[i + 2]) - a);
+        const float length = glm::length(n);
+        if (length <= 0.0f) continue; // Degenerate, never rasterized
+        normals.push_back(n / length);
+        sum += normals.back();
+    }
+    const float sum_length = glm::length(sum);
+    if (normals.empty() || sum_length <= 1e-6f) return meshlet;
+
+    meshlet.cone_axis = sum / sum_length;
+    float min_dot = 1.0f;
+    for (const glm::vec3& n : normals) min_dot = std::min(min_dot, glm::dot(n, meshlet.cone_axis));
+    // Normals spreading past a hemisphere face every way, keep the cutoff at 1
+    if (min_dot > 0.0f) meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+    return meshlet;
+}
+
+} // namespace
+
+void buildMeshlets(const unsigned int* indices, size_t index_count, const unsigned char* vertices, size_t stride,
+                   std::vector<Meshlet>& meshlets) {
+    meshlets.clear();
+    index_count -= index_count % 3;
+    if (index_count == 0) return;
+
+    unsigned int max_index = 0;
+    for (size_t i = 0; i < index_count; ++i) max_index = std::max(max_index, indices[i]);
+    // Per vertex, the last meshlet that counted it, 0 for none
+    std::vector<uint32_t> stamps((size_t)max_index + 1, 0);
+    uint32_t stamp = 1;
+    size_t first = 0;
+    size_t vertex_count = 0;
+
+    for (size_t i = 0; i < index_count; i += 3) {
+        size_t fresh = 0;
+        for (size_t k = 0; k < 3; ++k) fresh += stamps[indices[i + k]] != stamp ? 1 : 0;
+        const size_t triangles = (i - first) / 3;
+        if (triangles > 0 && (vertex_count + fresh > MESHLET_MAX_VERTICES || triangles >= MESHLET_MAX_TRIANGLES)) {
+            meshlets.push_back(finishMeshlet(indices, first, i - first, vertices, stride));
+            first = i;
+            vertex_count = 0;
+            stamp++;
+        }
+        for (size_t k = 0; k < 3; ++k) {
+            if (stamps[indices[i + k]] == stamp) continue;
+            stamps[indices[i + k]] = stamp;
+            vertex_count++;
+        }
+    }
+    meshlets.push_back(finishMeshlet(indices, first, index_count - first, vertices, stride));
+}
+
+bool cullMeshlets(const Meshlet* meshlets, size_t count, const glm::mat4& model, bool back_faces, const MeshletView& view,
+                  std::vector<MeshletRange>& ranges, MeshletCullStats& stats) {
+    const float scale = std::max({glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))});
+    // A back face stays one under any transform that doesn't mirror, so the cones are tested in
+    // mesh space against the camera brought there
+    const bool cones = back_faces && glm::determinant(glm::mat3(model)) > 0.0f;
+    const glm::vec3 eye = cones ? glm::vec3(glm::inverse(model) * glm::vec4(view.camera_position, 1.0f)) : glm::vec3(0.0f);
+
+    const size_t first_range = ranges.size();
+    size_t visible = 0;
+    for (size_t m = 0; m < count; ++m) {
+        const Meshlet& meshlet = meshlets[m];
+        stats.tested++;
+        bool culled = false;
+        if (cones && meshlet.cone_cutoff < 1.0f) {
+            // Back-facing from every point of the bounding sphere
+            const glm::vec3 to_center = meshlet.center - eye;
+            culled = glm::dot(to_center, meshlet.cone_axis) >= meshlet.cone_cutoff * glm::length(to_center) + meshlet.radius;
+        }
+        if (!culled) {
+            const glm::vec3 center(model * glm::vec4(meshlet.center, 1.0f));
+            const float radius = meshlet.radius * scale;
+            culled = !view.frustum.sphereInFrustum(center, radius) || (view.hiz && view.hiz->isOccluded(center, radius));
+        }
+        if (culled) {
+            stats.culled++;
+            continue;
+        }
+
+        visible++;
+        if (ranges.size() > first_range && ranges.back().first_index + ranges.back().index_count == meshlet.first_index) {
+            ranges.back().index_count += meshlet.index_count;
+        } else {
+            ranges.push_back({meshlet.first_index, meshlet.index_count});
+        }
+    }
+    if (visible == count) {
+        ranges.resize(first_range);
+        return false;
+    }
+    return true;
+}
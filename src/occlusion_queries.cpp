@@ -0,0 +1,139 @@
+#include "occlusion_queries.h"
+#include "shader_loading.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <cstdio>
+
+std::string buildAssetPath(const std::string& relative_path);
+
+#ifdef __EMSCRIPTEN__
+bool use_occlusion_queries = true;
+#else
+bool use_occlusion_queries = false;
+#endif
+
+OcclusionQueries::~OcclusionQueries() {
+    clear();
+    if (vbo != 0) glDeleteBuffers(1, &vbo);
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+}
+
+void OcclusionQueries::clear() {
+    for (auto& [entity, query] : queries) {
+        if (query.id != 0) glDeleteQueries(1, &query.id);
+    }
+    queries.clear();
+}
+
+bool OcclusionQueries::init() {
+    try {
+        box_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/occlusion_box.vs")),
+                                              loadShaderFile(buildAssetPath("res/shaders/occlusion_box.fs")));
+    } catch (const std::exception& e) {
+        printf("Occlusion queries disabled: %s\n", e.what());
+        return false;
+    }
+
+    // Unit cube from -1 to 1, as plain triangles
+    static const float corners[8][3] = {
+        {-1, -1, -1}, { 1, -1, -1}, { 1,  1, -1}, {-1,  1, -1},
+        {-1, -1,  1}, { 1, -1,  1}, { 1,  1,  1}, {-1,  1,  1},
+    };
+    static const int faces[36] = {
+        0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,
+        0, 1, 5, 0, 5, 4,  3, 6, 2, 3, 7, 6,
+        0, 4, 7, 0, 7, 3,  1, 2, 6, 1, 6, 5,
+    };
+    float vertices[36 * 3];
+    for (int i = 0; i < 36; ++i) {
+        for (int c = 0; c < 3; ++c) vertices[i * 3 + c] = corners[faces[i]][c];
+    }
+
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    gl_state.bindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    gl_state.bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+void OcclusionQueries::collect() {
+    frame++;
+    for (auto& [entity, query] : queries) {
+        if (!query.pending) continue;
+
+        GLuint available = 0;
+        glGetQueryObjectuiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue; // Keep the previous answer rather than stall
+
+        GLuint any_samples = 0;
+        glGetQueryObjectuiv(query.id, GL_QUERY_RESULT, &any_samples);
+        query.occluded = any_samples == 0;
+        query.pending = false;
+    }
+}
+
+bool OcclusionQueries::wasOccluded(const Entity* entity) const {
+    auto it = queries.find(entity);
+    if (it == queries.end()) return false;
+    // Entities that left the frustum have no fresh answer, draw them until the next one
+    return it->second.occluded && it->second.issued_frame + 1 == frame;
+}
+
+void OcclusionQueries::issue(const std::vector<Box>& boxes, const glm::mat4& view_projection,
+                             const glm::vec3& camera_position) {
+    if (failed) return;
+    if (!box_shader && !init()) {
+        failed = true;
+        use_occlusion_queries = false;
+        return;
+    }
+
+    bool cull_face = gl_state.isEnabled(GL_CULL_FACE);
+    gl_state.disable(GL_CULL_FACE); // Back faces still count when the near plane clips the front
+    gl_state.depthMask(false);
+    gl_state.depthFunc(GL_LEQUAL);
+
+    box_shader->use();
+    gl_state.bindVertexArray(vao);
+
+    for (const Box& box : boxes) {
+        Query& query = queries[box.entity];
+        query.issued_frame = frame;
+
+        // From inside its cube an entity is always visible, and the box may be clipped away entirely
+        if (glm::length(camera_position - box.center) < box.radius * 1.75f) {
+            query.occluded = false;
+            continue;
+        }
+        // Still waiting on the last one, reuse that answer instead of stacking queries
+        if (query.pending) continue;
+
+        if (query.id == 0) glGenQueries(1, &query.id);
+        glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), box.center), glm::vec3(box.radius));
+        box_shader->setMat4("mvp", view_projection * model);
+
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, query.id);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        query.pending = true;
+    }
+
+    gl_state.bindVertexArray(0);
+    gl_state.depthMask(true);
+    gl_state.depthFunc(GL_LESS);
+    gl_state.setEnabled(GL_CULL_FACE, cull_face);
+
+    // Drop entities that haven't been tested in a while, they may not exist anymore
+    for (auto it = queries.begin(); it != queries.end();) {
+        if (it->second.issued_frame + OCCLUSION_QUERY_KEEP_FRAMES < frame) {
+            if (it->second.id != 0) glDeleteQueries(1, &it->second.id);
+            it = queries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
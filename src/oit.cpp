@@ -0,0 +1,182 @@
+#include "oit.h"
+#include "shader_loading.h"
+#include "scene_target.h"
+#include "mesh.h" // CullMode
+#include "frame_uniforms.h"
+#include <cstdio>
+
+std::string buildAssetPath(const std::string& relative_path);
+
+#ifdef __EMSCRIPTEN__
+bool use_weighted_oit = false;
+#else
+bool use_weighted_oit = true;
+#endif
+
+TransparentResolution transparent_resolution = TRANSPARENT_RESOLUTION_FULL;
+const char* const TRANSPARENT_RESOLUTION_NAMES[TRANSPARENT_RESOLUTION_COUNT] = { "Full", "Half", "Quarter" };
+static const int TRANSPARENT_RESOLUTION_DIVISORS[TRANSPARENT_RESOLUTION_COUNT] = { 1, 2, 4 };
+
+static constexpr UniformId U_DIVISOR("divisor");
+
+// Transparents test against the opaque depth without writing it, accumulating into both targets
+static constexpr PipelineState PIPELINE_ACCUMULATE =
+    PipelineState().depthWrite(false).blending(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA).cull(PIPELINE_CULL_PER_DRAW);
+// The resolved layer over the scene
+static constexpr PipelineState PIPELINE_COMPOSITE =
+    PipelineState().depth(false).depthWrite(false).blending(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA).cull(CULL_NONE);
+// The same premultiplied, the additive particles in the colour
+static constexpr PipelineState PIPELINE_UPSAMPLE =
+    PipelineState().depth(false).depthWrite(false).blending(GL_ONE, GL_ONE_MINUS_SRC_ALPHA).cull(CULL_NONE);
+// Depth only, every texel written
+static constexpr PipelineState PIPELINE_DOWNSAMPLE = PipelineState().depth(true, GL_ALWAYS).depthWrite(true).colorWrite(false).cull(CULL_NONE);
+// Additive particles over the low-resolution depth
+static constexpr PipelineState PIPELINE_ADDITIVE = PipelineState().depthWrite(false).blending(GL_ONE, GL_ONE).cull(CULL_NONE);
+
+WeightedBlendedOIT::~WeightedBlendedOIT() {
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+}
+
+WeightedBlendedOIT::Targets WeightedBlendedOIT::declare(RenderGraph& graph, int width, int height) const {
+    Targets targets;
+    targets.divisor = TRANSPARENT_RESOLUTION_DIVISORS[transparent_resolution];
+    RenderTextureDesc desc;
+    // Same format as the scene target's depth, which glBlitFramebuffer requires
+    desc.width = width;
+    desc.height = height;
+    desc.internal_format = GL_DEPTH24_STENCIL8;
+    targets.depth = graph.createTexture("oit depth", desc);
+
+    desc.width = (width + targets.divisor - 1) / targets.divisor;
+    desc.height = (height + targets.divisor - 1) / targets.divisor;
+    desc.internal_format = GL_RGBA16F;
+    targets.accum = graph.createTexture("oit accum", desc);
+    desc.internal_format = GL_R16F;
+    targets.weight = graph.createTexture("oit weight", desc);
+    if (targets.reduced()) {
+        desc.internal_format = GL_RGBA16F;
+        targets.additive = graph.createTexture("oit additive", desc);
+        desc.internal_format = GL_DEPTH_COMPONENT24;
+        targets.low_depth = graph.createTexture("oit low depth", desc);
+    }
+    return targets;
+}
+
+bool WeightedBlendedOIT::init() {
+    if (composite_shader) return true;
+    try {
+        composite_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/hiz.vs")),
+                                                    loadShaderFile(buildAssetPath("res/shaders/oit_composite.fs")));
+    } catch (const std::exception& e) {
+        printf("Weighted OIT disabled: %s\n", e.what());
+        return false;
+    }
+    composite_shader->use();
+    composite_shader->setInt("accumTexture", 0);
+    composite_shader->setInt("weightTexture", 1);
+    glGenVertexArrays(1, &vao);
+
+    // Reduced resolution is off without them, the full-resolution path stays
+    try {
+        const std::string fullscreen = loadShaderFile(buildAssetPath("res/shaders/hiz.vs"));
+        upsample_shader = std::make_unique<Shader>(fullscreen, addShaderDefines(loadShaderFile(buildAssetPath("res/shaders/oit_composite.fs")),
+                                                                                "#define REDUCED_RESOLUTION\n"));
+        downsample_shader = std::make_unique<Shader>(fullscreen, loadShaderFile(buildAssetPath("res/shaders/oit_downsample_depth.fs")));
+    } catch (const std::exception& e) {
+        printf("Reduced-resolution transparents disabled: %s\n", e.what());
+        upsample_shader.reset();
+        downsample_shader.reset();
+        return true;
+    }
+    bindFrameUniformBlocks(*upsample_shader);
+    upsample_shader->use();
+    upsample_shader->setInt("accumTexture", 0);
+    upsample_shader->setInt("weightTexture", 1);
+    upsample_shader->setInt("additiveTexture", 2);
+    upsample_shader->setInt("sceneDepth", 3);
+    upsample_shader->setInt("lowDepth", OIT_LOW_DEPTH_UNIT);
+    upsample_shader->setFloat("depthTolerance", OIT_UPSAMPLE_DEPTH_TOLERANCE);
+    downsample_shader->use();
+    downsample_shader->setInt("sceneDepth", 0);
+    return true;
+}
+
+bool WeightedBlendedOIT::begin(RenderGraph::Context& context, const Targets& targets) {
+    if (failed) return false;
+    if (!init()) {
+        failed = true;
+        return false;
+    }
+    if (targets.reduced() && !upsample_shader) return false;
+    const GLuint fbo = context.framebuffer({ targets.accum, targets.weight }, targets.reduced() ? targets.low_depth : targets.depth);
+    const GLuint depth_fbo = targets.reduced() ? context.framebuffer({}, targets.depth) : fbo;
+    if (fbo == 0 || depth_fbo == 0) {
+        printf("Weighted OIT framebuffer incomplete, using sorted transparency\n");
+        failed = true;
+        return false;
+    }
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != width || viewport[3] != height) {
+        width = viewport[2];
+        height = viewport[3];
+        printf("Weighted OIT targets: %dx%d\n", width, height);
+    }
+
+    // Transparents test against the finished opaque depth
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_target.depthFramebuffer());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depth_fbo);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    if (targets.reduced()) {
+        // Depth blits can't scale on WebGL2, the farthest of each block is drawn from the copy
+        const int divisor = targets.divisor;
+        glViewport(0, 0, (width + divisor - 1) / divisor, (height + divisor - 1) / divisor);
+        glBindFramebuffer(GL_FRAMEBUFFER, context.framebuffer({}, targets.low_depth));
+        gl_state.apply(PIPELINE_DOWNSAMPLE.withProgram(downsample_shader->getProgram()).withVertexArray(vao));
+        downsample_shader->setInt(U_DIVISOR, divisor);
+        gl_state.bindTexture(0, GL_TEXTURE_2D, context.texture(targets.depth));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    // Colour and weight add up, alpha multiplies by (1 - a) into the revealage. GL 3.3 and
+    // WebGL2 have no per-target blend state, but the weight target has no alpha to care.
+    gl_state.apply(PIPELINE_ACCUMULATE);
+
+    // Nothing accumulated, everything behind fully revealed
+    const GLfloat clear_accum[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    const GLfloat clear_weight[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glClearBufferfv(GL_COLOR, 0, clear_accum);
+    glClearBufferfv(GL_COLOR, 1, clear_weight);
+    if (targets.reduced()) {
+        // Nothing added where no additive particle draws
+        glBindFramebuffer(GL_FRAMEBUFFER, context.framebuffer({ targets.additive }, targets.low_depth));
+        glClearBufferfv(GL_COLOR, 0, clear_weight);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    }
+    return true;
+}
+
+void WeightedBlendedOIT::beginAdditive(RenderGraph::Context& context, const Targets& targets) {
+    glBindFramebuffer(GL_FRAMEBUFFER, context.framebuffer({ targets.additive }, targets.low_depth));
+    gl_state.apply(PIPELINE_ADDITIVE);
+}
+
+void WeightedBlendedOIT::composite(RenderGraph::Context& context, const Targets& targets) {
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+
+    if (targets.reduced()) {
+        glViewport(0, 0, width, height);
+        gl_state.apply(PIPELINE_UPSAMPLE.withProgram(upsample_shader->getProgram()).withVertexArray(vao));
+        upsample_shader->setInt(U_DIVISOR, targets.divisor);
+        gl_state.bindTexture(2, GL_TEXTURE_2D, context.texture(targets.additive));
+        gl_state.bindTexture(3, GL_TEXTURE_2D, context.texture(targets.depth));
+        gl_state.bindTexture(OIT_LOW_DEPTH_UNIT, GL_TEXTURE_2D, context.texture(targets.low_depth));
+    } else {
+        gl_state.apply(PIPELINE_COMPOSITE.withProgram(composite_shader->getProgram()).withVertexArray(vao));
+    }
+    gl_state.bindTexture(0, GL_TEXTURE_2D, context.texture(targets.accum));
+    gl_state.bindTexture(1, GL_TEXTURE_2D, context.texture(targets.weight));
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
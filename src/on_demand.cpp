@@ -0,0 +1,54 @@
+#include "on_demand.h"
+
+#include <GLFW/glfw3.h>
+#include <cmath>
+#include <string>
+
+OnDemandRenderer on_demand;
+
+bool use_on_demand_rendering = false;
+
+bool OnDemandRenderer::idle() {
+#ifndef __EMSCRIPTEN__
+    if (!use_on_demand_rendering) {
+        settle = ON_DEMAND_SETTLE_FRAMES; // Turning it on starts from a converged image
+        return false;
+    }
+    if (settle > 0) return false;
+
+    const double start = glfwGetTime();
+    glfwWaitEventsTimeout(ON_DEMAND_WAIT_SECONDS);
+    // GLFW doesn't say whether anything arrived, but only an event ends the wait early
+    if (glfwGetTime() - start < ON_DEMAND_WAIT_SECONDS * 0.9) invalidate();
+    skipped++;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void OnDemandRenderer::endFrame(const Camera& camera, bool scene_changed) {
+    const bool camera_changed = !has_camera ||
+                                glm::any(glm::greaterThan(glm::abs(camera.position - camera_position), glm::vec3(ON_DEMAND_CAMERA_EPSILON))) ||
+                                std::fabs(camera.yaw - camera_yaw) > ON_DEMAND_CAMERA_EPSILON ||
+                                std::fabs(camera.pitch - camera_pitch) > ON_DEMAND_CAMERA_EPSILON ||
+                                camera.fov != camera_fov || camera.aspect_ratio != camera_aspect;
+    has_camera = true;
+    camera_position = camera.position;
+    camera_yaw = camera.yaw;
+    camera_pitch = camera.pitch;
+    camera_fov = camera.fov;
+    camera_aspect = camera.aspect_ratio;
+
+    if (camera_changed || scene_changed) invalidate();
+    else if (settle > 0) settle--;
+}
+
+int OnDemandRenderer::parseArg(int argc, char** argv, int i) {
+    (void)argc;
+    if (std::string(argv[i]) == "--on-demand") {
+        use_on_demand_rendering = true;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,439 @@
+#include "particles.h"
+#include "frame_uniforms.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "gpu_memory.h"
+#include "mesh.h" // CullMode
+#include "profiler.h"
+#include "scene_target.h"
+#include "shader_loading.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+std::string buildAssetPath(const std::string& relative_path);
+
+ParticleSystem particle_system;
+bool use_particles = true;
+bool use_soft_particles = true;
+
+// Position and age, velocity and lifetime
+static constexpr size_t PARTICLE_BYTES = 2 * sizeof(glm::vec4);
+
+// Premultiplied output, tested against the opaques without writing depth
+static constexpr PipelineState PIPELINE_PARTICLES_ALPHA =
+    PipelineState().depthWrite(false).blending(GL_ONE, GL_ONE_MINUS_SRC_ALPHA).cull(CULL_NONE);
+static constexpr PipelineState PIPELINE_PARTICLES_ADDITIVE =
+    PipelineState().depthWrite(false).blending(GL_ONE, GL_ONE, GL_ZERO, GL_ONE).cull(CULL_NONE);
+// Weighted OIT's accumulate blend (oit.cpp)
+static constexpr PipelineState PIPELINE_PARTICLES_OIT =
+    PipelineState().depthWrite(false).blending(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA).cull(CULL_NONE);
+
+static constexpr UniformId U_FIRST_PARTICLE("firstParticle");
+static constexpr UniformId U_PARTICLE_COUNT("particleCount");
+static constexpr UniformId U_SPAWN_CURSOR("spawnCursor");
+static constexpr UniformId U_SPAWN_COUNT("spawnCount");
+static constexpr UniformId U_SEED("seed");
+static constexpr UniformId U_DELTA_TIME("deltaTime");
+static constexpr UniformId U_EMITTER_POSITION("emitterPosition");
+static constexpr UniformId U_SPAWN_RADIUS("spawnRadius");
+static constexpr UniformId U_LIFETIME_RANGE("lifetimeRange");
+static constexpr UniformId U_EMITTER_VELOCITY("emitterVelocity");
+static constexpr UniformId U_VELOCITY_SPREAD("velocitySpread");
+static constexpr UniformId U_ACCELERATION("acceleration");
+static constexpr UniformId U_DRAG("drag");
+static constexpr UniformId U_SIZE_RANGE("sizeRange");
+static constexpr UniformId U_COLOR_START("colorStart");
+static constexpr UniformId U_COLOR_END("colorEnd");
+static constexpr UniformId U_SOFT_DISTANCE("softDistance");
+static constexpr UniformId U_SCENE_DEPTH_SCALE("sceneDepthScale");
+
+void ParticleSystem::release() {
+    for (GLuint& buffer : buffers) {
+        if (buffer == 0) continue;
+        gpu_memory.releaseBuffer(buffer);
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+    for (GLuint& vao : simulate_vaos) {
+        if (vao != 0) { glDeleteVertexArrays(1, &vao); vao = 0; }
+    }
+    if (draw_vao != 0) { glDeleteVertexArrays(1, &draw_vao); draw_vao = 0; }
+    if (depth_fbo != 0) { glDeleteFramebuffers(1, &depth_fbo); depth_fbo = 0; }
+    if (depth_texture != 0) {
+        gpu_memory.releaseTexture(depth_texture);
+        glDeleteTextures(1, &depth_texture);
+        depth_texture = 0;
+    }
+    compute_shader.reset();
+    feedback_shader.reset();
+    draw_shader.reset();
+    draw_oit_shader.reset();
+    for (Emitter& emitter : emitters) emitter = Emitter();
+    particle_ranges = RangeAllocator();
+    current = 0;
+}
+
+bool ParticleSystem::init() {
+    if (draw_shader) return true;
+    if (failed) return false;
+
+    try {
+        if (gl_extensions.compute_shader) {
+            try {
+                compute_shader = std::make_unique<Shader>(
+                    loadShaderFile(buildAssetPath("res/shaders/particle_update.comp"), "#version 430 core\n"));
+            } catch (const std::exception& e) {
+                printf("Particle compute simulation failed (%s), using transform feedback\n", e.what());
+            }
+        }
+        if (!compute_shader) {
+            feedback_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/particle_update.vs")),
+                                                       loadShaderFile(buildAssetPath("res/shaders/particle_update.fs")),
+                                                       std::vector<const char*>{"outPositionAge", "outVelocityLife"});
+        }
+        const std::string vertex = loadShaderFile(buildAssetPath("res/shaders/particle.vs"));
+        const std::string fragment = loadShaderFile(buildAssetPath("res/shaders/particle.fs"));
+        draw_shader = std::make_unique<Shader>(vertex, fragment);
+        draw_oit_shader = std::make_unique<Shader>(vertex, addShaderDefines(fragment, "#define OIT_OUTPUT\n"));
+    } catch (const std::exception& e) {
+        printf("Particles disabled: %s\n", e.what());
+        compute_shader.reset();
+        feedback_shader.reset();
+        draw_shader.reset();
+        draw_oit_shader.reset();
+        failed = true;
+        return false;
+    }
+    for (const Shader* shader : { draw_shader.get(), draw_oit_shader.get() }) {
+        bindFrameUniformBlocks(*shader);
+        shader->use();
+        shader->setInt("sceneDepth", PARTICLE_DEPTH_UNIT);
+    }
+
+    // Lifetime zero, every slot starts dead
+    const std::vector<unsigned char> zeros((size_t)PARTICLE_CAPACITY * PARTICLE_BYTES, 0);
+    const int buffer_count = compute_shader ? 1 : 2;
+    for (int i = 0; i < buffer_count; ++i) {
+        glGenBuffers(1, &buffers[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, zeros.size(), zeros.data(), GL_DYNAMIC_COPY);
+        gpu_memory.trackBuffer(buffers[i], zeros.size(), GPU_MEMORY_PARTICLES, "particles");
+
+        if (compute_shader) continue;
+        glGenVertexArrays(1, &simulate_vaos[i]);
+        gl_state.bindVertexArray(simulate_vaos[i]);
+        for (GLuint location = 0; location < 2; ++location) {
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, PARTICLE_BYTES, (void*)(location * sizeof(glm::vec4)));
+        }
+    }
+    glGenVertexArrays(1, &draw_vao);
+    gl_state.bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    particle_ranges.grow(PARTICLE_CAPACITY);
+    printf("Particles: %d slots, simulated with %s\n", PARTICLE_CAPACITY,
+           compute_shader ? "compute" : "transform feedback");
+    return true;
+}
+
+void ParticleSystem::clearRange(const GeometryRange& range) {
+    const std::vector<unsigned char> zeros(range.size * PARTICLE_BYTES, 0);
+    for (GLuint buffer : buffers) {
+        if (buffer == 0) continue;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, range.offset * PARTICLE_BYTES, zeros.size(), zeros.data());
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+int ParticleSystem::createEmitter(const ParticleEmitterDesc& desc) {
+    if (!init()) return -1;
+
+    int slot = -1;
+    for (int i = 0; i < PARTICLE_MAX_EMITTERS && slot < 0; ++i) {
+        if (!emitters[i].used) slot = i;
+    }
+    if (slot < 0) {
+        printf("Particles: all %d emitters in use\n", PARTICLE_MAX_EMITTERS);
+        return -1;
+    }
+
+    // A slot comes round again after lifetime_max, when its particle has died
+    const size_t size = (size_t)std::ceil(std::max(desc.rate, 0.0f) * std::max(desc.lifetime_max, 0.0f)) + 1;
+    size_t offset = 0;
+    if (!particle_ranges.allocate(size, offset)) {
+        printf("Particles: no room for %zu more in the %d slot buffer\n", size, PARTICLE_CAPACITY);
+        return -1;
+    }
+
+    Emitter& emitter = emitters[slot];
+    emitter = Emitter();
+    emitter.desc = desc;
+    emitter.used = true;
+    emitter.range = {offset, size};
+    emitter.seed = (uint32_t)slot * 7919u;
+    // Whatever an earlier emitter left there would otherwise come back to life
+    clearRange(emitter.range);
+    return slot;
+}
+
+void ParticleSystem::destroyEmitter(int emitter) {
+    if (emitter < 0 || emitter >= PARTICLE_MAX_EMITTERS || !emitters[emitter].used) return;
+    particle_ranges.free(emitters[emitter].range);
+    emitters[emitter] = Emitter();
+}
+
+void ParticleSystem::setPosition(int emitter, const glm::vec3& position) {
+    if (emitter >= 0 && emitter < PARTICLE_MAX_EMITTERS) emitters[emitter].desc.position = position;
+}
+
+void ParticleSystem::shiftOrigin(const glm::vec3& delta) {
+    for (Emitter& emitter : emitters) {
+        if (emitter.used) emitter.desc.position -= delta;
+    }
+}
+
+void ParticleSystem::setActive(int emitter, bool active) {
+    if (emitter >= 0 && emitter < PARTICLE_MAX_EMITTERS) emitters[emitter].active = active;
+}
+
+size_t ParticleSystem::emitterCount() const {
+    size_t count = 0;
+    for (const Emitter& emitter : emitters) count += emitter.used ? 1 : 0;
+    return count;
+}
+
+void ParticleSystem::simulate(const Emitter& emitter, const Shader& shader, float dt) {
+    const ParticleEmitterDesc& desc = emitter.desc;
+    shader.setInt(U_FIRST_PARTICLE, (int)emitter.range.offset);
+    shader.setInt(U_PARTICLE_COUNT, (int)emitter.range.size);
+    shader.setInt(U_SPAWN_CURSOR, (int)emitter.spawn_cursor);
+    shader.setInt(U_SPAWN_COUNT, (int)emitter.spawn_count);
+    shader.setInt(U_SEED, (int)emitter.seed);
+    shader.setFloat(U_DELTA_TIME, dt);
+    shader.setVec3(U_EMITTER_POSITION, desc.position);
+    shader.setFloat(U_SPAWN_RADIUS, desc.spawn_radius);
+    shader.setVec2(U_LIFETIME_RANGE, glm::vec2(desc.lifetime_min, desc.lifetime_max));
+    shader.setVec3(U_EMITTER_VELOCITY, desc.velocity);
+    shader.setFloat(U_VELOCITY_SPREAD, desc.velocity_spread);
+    shader.setVec3(U_ACCELERATION, desc.acceleration);
+    shader.setFloat(U_DRAG, desc.drag);
+}
+
+void ParticleSystem::update(float dt) {
+    if (!use_particles || !draw_shader || dt <= 0.0f || emitterCount() == 0) return;
+    PROFILE_SCOPE("particle simulation");
+    dt = std::min(dt, PARTICLE_MAX_STEP);
+
+    // The only per-frame CPU work: how many each emitter spawns, and where
+    for (Emitter& emitter : emitters) {
+        if (!emitter.used) continue;
+        emitter.spawn_cursor = (emitter.spawn_cursor + emitter.spawn_count) % (uint32_t)emitter.range.size;
+        emitter.spawn_carry += emitter.active ? emitter.desc.rate * dt : 0.0f;
+        const float whole = std::floor(emitter.spawn_carry);
+        emitter.spawn_count = (uint32_t)std::min(whole, (float)emitter.range.size);
+        emitter.spawn_carry -= whole;
+        emitter.seed++;
+    }
+
+    if (compute_shader) {
+        compute_shader->use();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffers[0]);
+        for (const Emitter& emitter : emitters) {
+            if (!emitter.used) continue;
+            simulate(emitter, *compute_shader, dt);
+            gl_extensions.DispatchCompute((GLuint)((emitter.range.size + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE), 1, 1);
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+        // The draws read the results as instance attributes
+        gl_extensions.MemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+        return;
+    }
+
+    // One buffer into the other, a points draw per emitter range
+    const int next = 1 - current;
+    feedback_shader->use();
+    gl_state.bindVertexArray(simulate_vaos[current]);
+    glEnable(GL_RASTERIZER_DISCARD);
+    for (const Emitter& emitter : emitters) {
+        if (!emitter.used) continue;
+        simulate(emitter, *feedback_shader, dt);
+        glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers[next], emitter.range.offset * PARTICLE_BYTES,
+                          emitter.range.size * PARTICLE_BYTES);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, (GLint)emitter.range.offset, (GLsizei)emitter.range.size);
+        glEndTransformFeedback();
+    }
+    glDisable(GL_RASTERIZER_DISCARD);
+    // WebGL2 refuses a buffer bound for feedback anywhere else
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+    gl_state.bindVertexArray(0);
+    current = next;
+}
+
+bool ParticleSystem::ensureDepthCopy(int width, int height) {
+    if (depth_texture != 0 && width == depth_width && height == depth_height) return true;
+    if (depth_fbo != 0) glDeleteFramebuffers(1, &depth_fbo);
+    if (depth_texture != 0) {
+        gpu_memory.releaseTexture(depth_texture);
+        glDeleteTextures(1, &depth_texture);
+    }
+    depth_width = width;
+    depth_height = height;
+
+    // Same format as the scene target's depth, which glBlitFramebuffer requires
+    glGenTextures(1, &depth_texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, depth_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+    gpu_memory.trackTexture(depth_texture, (uint64_t)width * height * 4, GPU_MEMORY_PARTICLES, "soft particle depth");
+
+    glGenFramebuffers(1, &depth_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, depth_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Soft particle depth framebuffer incomplete (0x%x), particles keep hard edges\n", status);
+        use_soft_particles = false;
+        return false;
+    }
+    return true;
+}
+
+bool ParticleSystem::beginDraw() {
+    depth_copied = false;
+    if (!use_particles || !draw_shader || emitterCount() == 0) return false;
+    if (!use_soft_particles) return true;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (!ensureDepthCopy(viewport[2], viewport[3])) return true;
+
+    // The finished opaque depth, the transparents don't write any
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_target.depthFramebuffer());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depth_fbo);
+    glBlitFramebuffer(0, 0, depth_width, depth_height, 0, 0, depth_width, depth_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    depth_copied = true;
+    return true;
+}
+
+bool ParticleSystem::hasPass(ParticlePass pass) const {
+    if (!use_particles || !draw_shader) return false;
+    const ParticleBlend blend = pass == PARTICLE_PASS_ADDITIVE ? PARTICLE_BLEND_ADDITIVE : PARTICLE_BLEND_ALPHA;
+    for (const Emitter& emitter : emitters) {
+        if (emitter.used && emitter.desc.blend == blend) return true;
+    }
+    return false;
+}
+
+int ParticleSystem::draw(ParticlePass pass, const glm::vec3& camera_position) {
+    if (!hasPass(pass)) return 0;
+    PROFILE_SCOPE("particles");
+
+    const ParticleBlend blend = pass == PARTICLE_PASS_ADDITIVE ? PARTICLE_BLEND_ADDITIVE : PARTICLE_BLEND_ALPHA;
+    order.clear();
+    for (int i = 0; i < PARTICLE_MAX_EMITTERS; ++i) {
+        if (emitters[i].used && emitters[i].desc.blend == blend) order.push_back(i);
+    }
+    if (pass == PARTICLE_PASS_SORTED) {
+        auto distance2 = [&](int i) {
+            const glm::vec3 offset = emitters[i].desc.position - camera_position;
+            return glm::dot(offset, offset);
+        };
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return distance2(a) > distance2(b); });
+    }
+
+    const Shader& shader = pass == PARTICLE_PASS_OIT ? *draw_oit_shader : *draw_shader;
+    const PipelineState& state = pass == PARTICLE_PASS_OIT      ? PIPELINE_PARTICLES_OIT
+                                 : pass == PARTICLE_PASS_SORTED ? PIPELINE_PARTICLES_ALPHA
+                                                                : PIPELINE_PARTICLES_ADDITIVE;
+    gl_state.apply(state.withProgram(shader.getProgram()).withVertexArray(draw_vao));
+    gl_state.bindTexture(PARTICLE_DEPTH_UNIT, GL_TEXTURE_2D, depth_copied ? depth_texture : 0);
+    if (depth_copied) {
+        // Drawn at a fraction of the copy's size into the reduced-resolution OIT targets
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        shader.setFloat(U_SCENE_DEPTH_SCALE, viewport[2] > 0 ? (float)depth_width / (float)viewport[2] : 1.0f);
+    }
+
+    // No base instance on GL 3.3 and WebGL2, so each emitter points the attributes at its range
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[current]);
+    int calls = 0;
+    for (int index : order) {
+        const Emitter& emitter = emitters[index];
+        const ParticleEmitterDesc& desc = emitter.desc;
+        shader.setVec2(U_SIZE_RANGE, glm::vec2(desc.size_start, desc.size_end));
+        shader.setVec4Array(U_COLOR_START, &desc.color_start, 1);
+        shader.setVec4Array(U_COLOR_END, &desc.color_end, 1);
+        shader.setFloat(U_SOFT_DISTANCE, depth_copied ? desc.soft_distance : 0.0f);
+
+        const size_t offset = emitter.range.offset * PARTICLE_BYTES;
+        for (GLuint location = 0; location < 2; ++location) {
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, PARTICLE_BYTES, (void*)(offset + location * sizeof(glm::vec4)));
+            glVertexAttribDivisor(location, 1);
+        }
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)emitter.range.size);
+        calls++;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return calls;
+}
+
+void ParticleSystem::spawnFire(const glm::vec3& position, int particles) {
+    // Fire burns out fast and bright, smoke lingers: about a third of the slots go to the flames
+    ParticleEmitterDesc fire;
+    fire.position = position;
+    fire.spawn_radius = 0.35f;
+    fire.lifetime_min = 0.4f;
+    fire.lifetime_max = 1.0f;
+    fire.rate = particles / 3.0f / fire.lifetime_max;
+    fire.velocity = glm::vec3(0.0f, 1.5f, 0.0f);
+    fire.velocity_spread = 0.4f;
+    fire.acceleration = glm::vec3(0.0f, 1.0f, 0.0f);
+    fire.drag = 0.5f;
+    fire.size_start = 0.12f;
+    fire.size_end = 0.02f;
+    fire.color_start = glm::vec4(4.0f, 1.6f, 0.4f, 0.6f); // HDR, the post pass tonemaps it
+    fire.color_end = glm::vec4(1.5f, 0.2f, 0.05f, 0.0f);
+    fire.blend = PARTICLE_BLEND_ADDITIVE;
+    fire.soft_distance = 0.2f;
+    createEmitter(fire);
+
+    ParticleEmitterDesc smoke;
+    smoke.position = position + glm::vec3(0.0f, 0.8f, 0.0f);
+    smoke.spawn_radius = 0.3f;
+    smoke.lifetime_min = 3.0f;
+    smoke.lifetime_max = 6.0f;
+    smoke.rate = particles * 2.0f / 3.0f / smoke.lifetime_max;
+    smoke.velocity = glm::vec3(0.2f, 0.8f, 0.0f);
+    smoke.velocity_spread = 0.3f;
+    smoke.acceleration = glm::vec3(0.15f, 0.2f, 0.0f); // Buoyancy and a light breeze
+    smoke.drag = 0.3f;
+    smoke.size_start = 0.2f;
+    smoke.size_end = 1.2f;
+    smoke.color_start = glm::vec4(0.25f, 0.23f, 0.22f, 0.08f);
+    smoke.color_end = glm::vec4(0.5f, 0.5f, 0.5f, 0.0f);
+    smoke.blend = PARTICLE_BLEND_ALPHA;
+    smoke.soft_distance = 0.6f;
+    createEmitter(smoke);
+}
+
+int ParticleSystem::parseArg(int argc, char** argv, int i) {
+    if (std::string(argv[i]) != "--particles") return 0;
+    if (i + 1 >= argc || atoi(argv[i + 1]) < 0) {
+        printf("--particles needs a particle count\n");
+        return -1;
+    }
+    requested = atoi(argv[i + 1]);
+    return 2;
+}
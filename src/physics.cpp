@@ -0,0 +1,1103 @@
+#define GLM_ENABLE_EXPERIMENTAL
+#include "physics.h"
+#include "job_system.h"
+#include "mesh.h"
+#include "trace_capture.h"
+#include <glm/gtx/euler_angles.hpp>
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+PhysicsWorld physics_world;
+
+bool use_physics = true;
+
+namespace {
+
+using Body = PhysicsWorld::Body;
+using Manifold = PhysicsWorld::Manifold;
+using ContactPoint = PhysicsWorld::ContactPoint;
+
+// Entity::rotation turns about x, then y, then z in the model matrix
+glm::quat eulerToQuat(const glm::vec3& degrees) {
+    const glm::vec3 r = glm::radians(degrees);
+    return glm::angleAxis(r.x, glm::vec3(1, 0, 0)) * glm::angleAxis(r.y, glm::vec3(0, 1, 0)) * glm::angleAxis(r.z, glm::vec3(0, 0, 1));
+}
+
+glm::vec3 quatToEuler(const glm::quat& q) {
+    glm::vec3 r;
+    glm::extractEulerAngleXYZ(glm::mat4_cast(q), r.x, r.y, r.z);
+    return glm::degrees(r);
+}
+
+// Calls fn with every corner of the shape in body space, a sphere has none
+template <typename Fn>
+void forEachCorner(const Body& body, Fn&& fn) {
+    if (body.shape == PHYSICS_SHAPE_HULL) {
+        for (const glm::vec3& point : *body.hull) fn(point);
+        return;
+    }
+    const glm::vec3& h = body.half_extents;
+    for (int i = 0; i < 8; ++i) fn(glm::vec3(i & 1 ? h.x : -h.x, i & 2 ? h.y : -h.y, i & 4 ? h.z : -h.z));
+}
+
+// The shape's farthest point along d, body space in and out
+glm::vec3 localSupport(const Body& body, const glm::vec3& d) {
+    if (body.shape == PHYSICS_SHAPE_SPHERE) {
+        const float length = glm::length(d);
+        return length > 1e-12f ? d * (body.radius / length) : glm::vec3(body.radius, 0.0f, 0.0f);
+    }
+    if (body.shape == PHYSICS_SHAPE_HULL) {
+        glm::vec3 best = (*body.hull)[0];
+        float best_dot = glm::dot(best, d);
+        for (const glm::vec3& point : *body.hull) {
+            const float dot = glm::dot(point, d);
+            if (dot > best_dot) {
+                best = point;
+                best_dot = dot;
+            }
+        }
+        return best;
+    }
+    const glm::vec3& h = body.half_extents;
+    return glm::vec3(d.x >= 0.0f ? h.x : -h.x, d.y >= 0.0f ? h.y : -h.y, d.z >= 0.0f ? h.z : -h.z);
+}
+
+glm::vec3 support(const Body& body, const glm::vec3& d) {
+    return body.position + body.orientation * localSupport(body, glm::conjugate(body.orientation) * d);
+}
+
+// Support of the Minkowski difference a - b, which holds the origin when they overlap
+glm::vec3 minkowski(const Body& a, const Body& b, const glm::vec3& d) {
+    return support(a, d) - support(b, -d);
+}
+
+struct Simplex {
+    glm::vec3 points[4]; // Newest first
+    int count = 0;
+};
+
+bool sameDirection(const glm::vec3& a, const glm::vec3& b) {
+    return glm::dot(a, b) > 0.0f;
+}
+
+// Each case keeps the simplex's feature nearest the origin and aims d at the origin from it.
+// True once a tetrahedron encloses the origin.
+bool simplexLine(Simplex& s, glm::vec3& d) {
+    const glm::vec3 a = s.points[0], b = s.points[1];
+    const glm::vec3 ab = b - a, ao = -a;
+    if (sameDirection(ab, ao)) {
+        d = glm::cross(glm::cross(ab, ao), ab);
+        // The origin's on the segment, any direction across it will do
+        if (glm::dot(d, d) < 1e-12f) d = glm::cross(ab, std::fabs(ab.x) < 0.57f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f));
+    } else {
+        s.count = 1;
+        d = ao;
+    }
+    return false;
+}
+
+bool simplexTriangle(Simplex& s, glm::vec3& d) {
+    const glm::vec3 a = s.points[0], b = s.points[1], c = s.points[2];
+    const glm::vec3 ab = b - a, ac = c - a, ao = -a;
+    const glm::vec3 abc = glm::cross(ab, ac);
+    if (sameDirection(glm::cross(abc, ac), ao)) {
+        if (sameDirection(ac, ao)) {
+            s.points[1] = c;
+            s.count = 2;
+            d = glm::cross(glm::cross(ac, ao), ac);
+            return false;
+        }
+        s.count = 2;
+        return simplexLine(s, d);
+    }
+    if (sameDirection(glm::cross(ab, abc), ao)) {
+        s.count = 2;
+        return simplexLine(s, d);
+    }
+    if (sameDirection(abc, ao)) {
+        d = abc;
+    } else {
+        s.points[1] = c;
+        s.points[2] = b;
+        d = -abc;
+    }
+    return false;
+}
+
+bool simplexTetrahedron(Simplex& s, glm::vec3& d) {
+    const glm::vec3 a = s.points[0], b = s.points[1], c = s.points[2], e = s.points[3];
+    const glm::vec3 ab = b - a, ac = c - a, ae = e - a, ao = -a;
+    if (sameDirection(glm::cross(ab, ac), ao)) {
+        s.count = 3;
+        return simplexTriangle(s, d);
+    }
+    if (sameDirection(glm::cross(ac, ae), ao)) {
+        s.points[1] = c;
+        s.points[2] = e;
+        s.count = 3;
+        return simplexTriangle(s, d);
+    }
+    if (sameDirection(glm::cross(ae, ab), ao)) {
+        s.points[1] = e;
+        s.points[2] = b;
+        s.count = 3;
+        return simplexTriangle(s, d);
+    }
+    return true;
+}
+
+// True when the shapes overlap, s then a tetrahedron around the origin
+bool gjk(const Body& a, const Body& b, Simplex& s) {
+    glm::vec3 d = b.position - a.position;
+    if (glm::dot(d, d) < 1e-12f) d = glm::vec3(1.0f, 0.0f, 0.0f);
+    s.points[0] = minkowski(a, b, d);
+    s.count = 1;
+    d = glm::dot(s.points[0], s.points[0]) < 1e-12f ? glm::vec3(1.0f, 0.0f, 0.0f) : -s.points[0];
+    for (int iteration = 0; iteration < PHYSICS_GJK_ITERATIONS; ++iteration) {
+        const glm::vec3 point = minkowski(a, b, d);
+        if (glm::dot(point, d) <= 0.0f) return false;
+        for (int i = s.count; i > 0; --i) s.points[i] = s.points[i - 1];
+        s.points[0] = point;
+        s.count++;
+        bool enclosed = false;
+        if (s.count == 2) enclosed = simplexLine(s, d);
+        else if (s.count == 3) enclosed = simplexTriangle(s, d);
+        else enclosed = simplexTetrahedron(s, d);
+        if (enclosed) return true;
+    }
+    return false;
+}
+
+// Expands GJK's tetrahedron to the face of a - b nearest the origin: its normal points from a to
+// b, its distance is how deep they overlap
+bool epa(const Body& a, const Body& b, const Simplex& s, glm::vec3& normal, float& depth) {
+    thread_local std::vector<glm::vec3> polytope;
+    thread_local std::vector<int> faces; // Three vertices each, wound outward
+    thread_local std::vector<glm::vec4> normals; // Per face, the distance from the origin in w
+    thread_local std::vector<std::pair<int, int>> edges; // Horizon of the faces removed
+    polytope.assign(s.points, s.points + 4);
+    faces.assign({0, 1, 2, 0, 3, 1, 0, 2, 3, 1, 3, 2});
+    normals.clear();
+
+    auto addNormals = [&](size_t first_face) {
+        for (size_t f = first_face * 3; f < faces.size(); f += 3) {
+            const glm::vec3& p0 = polytope[faces[f]];
+            glm::vec3 n = glm::cross(polytope[faces[f + 1]] - p0, polytope[faces[f + 2]] - p0);
+            const float length = glm::length(n);
+            // Never nearest, never expanded
+            if (length < 1e-12f) {
+                normals.push_back(glm::vec4(0.0f, 0.0f, 0.0f, FLT_MAX));
+                continue;
+            }
+            n /= length;
+            float distance = glm::dot(n, p0);
+            if (distance < 0.0f) {
+                n = -n;
+                distance = -distance;
+                std::swap(faces[f + 1], faces[f + 2]);
+            }
+            normals.push_back(glm::vec4(n, distance));
+        }
+    };
+    addNormals(0);
+
+    size_t nearest = 0;
+    for (int iteration = 0; iteration < PHYSICS_EPA_ITERATIONS; ++iteration) {
+        nearest = 0;
+        for (size_t i = 1; i < normals.size(); ++i) {
+            if (normals[i].w < normals[nearest].w) nearest = i;
+        }
+        if (normals[nearest].w == FLT_MAX) return false;
+        const glm::vec3 n = glm::vec3(normals[nearest]);
+        const glm::vec3 point = minkowski(a, b, n);
+        if (glm::dot(n, point) - normals[nearest].w < PHYSICS_EPA_TOLERANCE) break;
+
+        // Every face the new point sees goes, and its edges that no other removed face shares
+        // are the horizon the new faces fan out from
+        edges.clear();
+        for (size_t i = 0; i < normals.size();) {
+            if (!sameDirection(glm::vec3(normals[i]), point - polytope[faces[i * 3]])) {
+                ++i;
+                continue;
+            }
+            for (int k = 0; k < 3; ++k) {
+                const std::pair<int, int> edge(faces[i * 3 + k], faces[i * 3 + (k + 1) % 3]);
+                auto reverse = std::find(edges.begin(), edges.end(), std::make_pair(edge.second, edge.first));
+                if (reverse != edges.end()) {
+                    *reverse = edges.back();
+                    edges.pop_back();
+                } else {
+                    edges.push_back(edge);
+                }
+            }
+            std::copy(faces.end() - 3, faces.end(), faces.begin() + i * 3);
+            faces.resize(faces.size() - 3);
+            normals[i] = normals.back();
+            normals.pop_back();
+        }
+        if (edges.empty()) break;
+
+        const size_t first_face = normals.size();
+        const int apex = (int)polytope.size();
+        polytope.push_back(point);
+        for (const auto& edge : edges) {
+            faces.push_back(edge.first);
+            faces.push_back(edge.second);
+            faces.push_back(apex);
+        }
+        addNormals(first_face);
+        nearest = 0;
+        for (size_t i = 1; i < normals.size(); ++i) {
+            if (normals[i].w < normals[nearest].w) nearest = i;
+        }
+    }
+
+    // Out of iterations, the nearest face so far is close enough
+    if (normals.empty() || normals[nearest].w == FLT_MAX) return false;
+    normal = glm::vec3(normals[nearest]);
+    depth = normals[nearest].w;
+    return true;
+}
+
+// The shape's world space corners within tolerance of its farthest along dir, with how far
+// short of it each falls. A sphere has its one farthest point.
+int featurePoints(const Body& body, const glm::vec3& dir, float tolerance, glm::vec3* points, float* shortfalls) {
+    if (body.shape == PHYSICS_SHAPE_SPHERE) {
+        points[0] = support(body, dir);
+        shortfalls[0] = 0.0f;
+        return 1;
+    }
+    const glm::vec3 local_dir = glm::conjugate(body.orientation) * dir;
+    float best = -FLT_MAX;
+    forEachCorner(body, [&](const glm::vec3& corner) { best = std::max(best, glm::dot(corner, local_dir)); });
+    int count = 0;
+    forEachCorner(body, [&](const glm::vec3& corner) {
+        const float shortfall = best - glm::dot(corner, local_dir);
+        if (shortfall > tolerance || count == PHYSICS_MAX_FEATURE_POINTS) return;
+        points[count] = body.position + body.orientation * corner;
+        shortfalls[count++] = shortfall;
+    });
+    return count;
+}
+
+// Keeps the four spanning the largest area: the deepest, the one farthest from it, then the
+// farthest on either side of the line through those two
+void reduceContacts(Manifold& m, const glm::vec3* points, const float* depths, int count) {
+    int picks[PHYSICS_MAX_CONTACTS];
+    int picked = 0;
+    if (count <= PHYSICS_MAX_CONTACTS) {
+        for (; picked < count; ++picked) picks[picked] = picked;
+    } else {
+        int deepest = 0, farthest = 0;
+        for (int i = 1; i < count; ++i) {
+            if (depths[i] > depths[deepest]) deepest = i;
+        }
+        for (int i = 1; i < count; ++i) {
+            if (glm::distance(points[i], points[deepest]) > glm::distance(points[farthest], points[deepest])) farthest = i;
+        }
+        int left = -1, right = -1;
+        float most = 0.0f, least = 0.0f;
+        const glm::vec3 edge = points[farthest] - points[deepest];
+        for (int i = 0; i < count; ++i) {
+            const float area = glm::dot(glm::cross(edge, points[i] - points[deepest]), m.normal);
+            if (area > most) { most = area; left = i; }
+            if (area < least) { least = area; right = i; }
+        }
+        picks[picked++] = deepest;
+        if (farthest != deepest) picks[picked++] = farthest;
+        if (left >= 0) picks[picked++] = left;
+        if (right >= 0) picks[picked++] = right;
+    }
+    for (int i = 0; i < picked; ++i) {
+        m.points[i].position = points[picks[i]];
+        m.points[i].depth = depths[picks[i]];
+    }
+    m.count = picked;
+}
+
+void computeTangents(Manifold& m) {
+    const glm::vec3 axis = std::fabs(m.normal.x) < 0.57f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    m.tangents[0] = glm::normalize(glm::cross(m.normal, axis));
+    m.tangents[1] = glm::cross(m.normal, m.tangents[0]);
+}
+
+// Orders a planar feature's points anticlockwise about the normal, as a polygon
+void sortPolygon(glm::vec3* points, int count, const Manifold& m) {
+    if (count < 3) return;
+    glm::vec3 center(0.0f);
+    for (int i = 0; i < count; ++i) center += points[i];
+    center /= (float)count;
+    std::sort(points, points + count, [&](const glm::vec3& p, const glm::vec3& q) {
+        const glm::vec3 dp = p - center, dq = q - center;
+        return std::atan2(glm::dot(dp, m.tangents[1]), glm::dot(dp, m.tangents[0])) <
+               std::atan2(glm::dot(dq, m.tangents[1]), glm::dot(dq, m.tangents[0]));
+    });
+}
+
+// Sutherland-Hodgman: clips the incident polygon (or segment, or point) in place to the
+// reference polygon's edges, both seen along the normal. Returns the points left.
+int clipToPolygon(const glm::vec3* reference, int reference_count, glm::vec3* points, int count, const Manifold& m) {
+    glm::vec3 clipped[PHYSICS_MAX_FEATURE_POINTS * 2];
+    for (int e = 0; e < reference_count && count > 0; ++e) {
+        const glm::vec3 r0 = reference[e], edge = reference[(e + 1) % reference_count] - r0;
+        auto inside = [&](const glm::vec3& p) { return glm::dot(glm::cross(edge, p - r0), m.normal); };
+        int out = 0;
+        for (int i = 0; i < count && out + 2 <= PHYSICS_MAX_FEATURE_POINTS * 2; ++i) {
+            const glm::vec3& current = points[i];
+            const glm::vec3& next = points[(i + 1) % count];
+            const float side_current = inside(current), side_next = inside(next);
+            if (side_current >= 0.0f) clipped[out++] = current;
+            if ((side_current >= 0.0f) != (side_next >= 0.0f)) {
+                clipped[out++] = current + (next - current) * (side_current / (side_current - side_next));
+            }
+        }
+        // The segment's two edges cross the same line twice
+        count = 0;
+        for (int i = 0; i < out; ++i) {
+            if (count == 0 || glm::distance(clipped[i], points[count - 1]) > 1e-4f) points[count++] = clipped[i];
+        }
+    }
+    return count;
+}
+
+// Contact points of two overlapping shapes from their normal and depth. Each shape's feature
+// facing the other is its corners within tolerance of its deepest: a face, an edge or a corner.
+// The one that's a face is the reference, the other feature is clipped to it and its points
+// kept where they reach through the reference face's plane. Two edges or two curved surfaces
+// leave one point midway between the two deepest.
+void buildContacts(const Body& a, const Body& b, float depth, Manifold& m) {
+    glm::vec3 features[2][PHYSICS_MAX_FEATURE_POINTS * 2];
+    float shortfalls[PHYSICS_MAX_FEATURE_POINTS];
+    const int counts[2] = {featurePoints(a, m.normal, PHYSICS_CONTACT_TOLERANCE, features[0], shortfalls),
+                           featurePoints(b, -m.normal, PHYSICS_CONTACT_TOLERANCE, features[1], shortfalls)};
+
+    const int reference = counts[0] >= 3 ? 0 : counts[1] >= 3 ? 1 : -1;
+    if (reference >= 0) {
+        const int incident = 1 - reference;
+        sortPolygon(features[0], counts[0], m);
+        sortPolygon(features[1], counts[1], m);
+        const int clipped = clipToPolygon(features[reference], counts[reference], features[incident], counts[incident], m);
+
+        // The reference face's plane, a's face at its farthest along the normal, b's at its nearest
+        float plane = glm::dot(features[reference][0], m.normal);
+        for (int i = 1; i < counts[reference]; ++i) {
+            const float height = glm::dot(features[reference][i], m.normal);
+            plane = reference == 0 ? std::max(plane, height) : std::min(plane, height);
+        }
+        const glm::vec3 toward_reference = reference == 0 ? -m.normal : m.normal;
+        glm::vec3 points[PHYSICS_MAX_FEATURE_POINTS * 2];
+        float depths[PHYSICS_MAX_FEATURE_POINTS * 2];
+        int count = 0;
+        for (int i = 0; i < clipped; ++i) {
+            const glm::vec3& point = features[incident][i];
+            const float height = glm::dot(point, m.normal);
+            const float point_depth = reference == 0 ? plane - height : height - plane;
+            if (point_depth < -PHYSICS_CONTACT_TOLERANCE) continue;
+            // Halfway back to the reference face
+            points[count] = point - toward_reference * (point_depth * 0.5f);
+            depths[count++] = point_depth;
+        }
+        if (count > 0) {
+            reduceContacts(m, points, depths, count);
+            return;
+        }
+    }
+    m.points[0].position = (support(a, m.normal) + support(b, -m.normal)) * 0.5f;
+    m.points[0].depth = depth;
+    m.count = 1;
+}
+
+// Separating axis test of two boxes: their six face normals and the nine edge cross products.
+// False when one separates them, else the axis of least overlap, from a to b. Edge axes have to
+// beat the faces clearly, so resting boxes don't flicker between the two.
+bool boxOverlap(const Body& a, const Body& b, glm::vec3& normal, float& depth) {
+    const glm::mat3 ra = glm::mat3_cast(a.orientation), rb = glm::mat3_cast(b.orientation);
+    const glm::vec3 offset = b.position - a.position;
+    depth = FLT_MAX;
+    auto test = [&](glm::vec3 axis, float preference) {
+        const float length = glm::length(axis);
+        if (length < 1e-5f) return true; // Parallel edges, a face axis covers them
+        axis /= length;
+        float extent = 0.0f;
+        for (int i = 0; i < 3; ++i) {
+            extent += a.half_extents[i] * std::fabs(glm::dot(ra[i], axis)) + b.half_extents[i] * std::fabs(glm::dot(rb[i], axis));
+        }
+        const float distance = glm::dot(offset, axis);
+        const float overlap = extent - std::fabs(distance);
+        if (overlap < 0.0f) return false;
+        if (overlap * preference < depth) {
+            depth = overlap * preference;
+            normal = distance < 0.0f ? -axis : axis;
+        }
+        return true;
+    };
+    for (int i = 0; i < 3; ++i) {
+        if (!test(ra[i], 1.0f) || !test(rb[i], 1.0f)) return false;
+    }
+    const float face_depth = depth;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            if (!test(glm::cross(ra[i], rb[j]), PHYSICS_EDGE_AXIS_PREFERENCE)) return false;
+        }
+    }
+    // The preference only picks the axis, the depth is the true overlap along it
+    if (depth < face_depth) depth /= PHYSICS_EDGE_AXIS_PREFERENCE;
+    return true;
+}
+
+// A sphere against a box, the normal from the box to the sphere's centre
+bool sphereBoxOverlap(const Body& sphere, const Body& box, glm::vec3& normal, float& depth) {
+    const glm::vec3 center = glm::conjugate(box.orientation) * (sphere.position - box.position);
+    const glm::vec3 closest = glm::clamp(center, -box.half_extents, box.half_extents);
+    const glm::vec3 outside = center - closest;
+    const float distance = glm::length(outside);
+    if (distance > 1e-6f) {
+        depth = sphere.radius - distance;
+        normal = box.orientation * (outside / distance);
+        return depth >= -PHYSICS_CONTACT_TOLERANCE;
+    }
+    // The centre's inside, out through the nearest face
+    const glm::vec3 gap = box.half_extents - glm::abs(center);
+    const int axis = gap.x < gap.y ? (gap.x < gap.z ? 0 : 2) : (gap.y < gap.z ? 1 : 2);
+    glm::vec3 local(0.0f);
+    local[axis] = center[axis] < 0.0f ? -1.0f : 1.0f;
+    normal = box.orientation * local;
+    depth = sphere.radius + gap[axis];
+    return true;
+}
+
+void collide(const Body& a, const Body& b, Manifold& m) {
+    m.count = 0;
+    float depth = 0.0f;
+    if (a.shape == PHYSICS_SHAPE_BOX && b.shape == PHYSICS_SHAPE_BOX) {
+        if (!boxOverlap(a, b, m.normal, depth)) return;
+        computeTangents(m);
+        buildContacts(a, b, depth, m);
+        return;
+    }
+    if ((a.shape == PHYSICS_SHAPE_SPHERE) != (b.shape == PHYSICS_SHAPE_SPHERE) &&
+        (a.shape == PHYSICS_SHAPE_BOX || b.shape == PHYSICS_SHAPE_BOX)) {
+        const bool sphere_first = a.shape == PHYSICS_SHAPE_SPHERE;
+        const Body& sphere = sphere_first ? a : b;
+        if (!sphereBoxOverlap(sphere, sphere_first ? b : a, m.normal, depth)) return;
+        if (sphere_first) m.normal = -m.normal;
+        computeTangents(m);
+        // On the sphere's surface, pulled back halfway into the box
+        const glm::vec3 toward_box = sphere_first ? m.normal : -m.normal;
+        m.points[0].position = sphere.position + toward_box * (sphere.radius - depth * 0.5f);
+        m.points[0].depth = depth;
+        m.count = 1;
+        return;
+    }
+    if (a.shape == PHYSICS_SHAPE_SPHERE && b.shape == PHYSICS_SHAPE_SPHERE) {
+        const glm::vec3 offset = b.position - a.position;
+        const float distance = glm::length(offset);
+        const float depth = a.radius + b.radius - distance;
+        if (depth < -PHYSICS_CONTACT_TOLERANCE) return;
+        m.normal = distance > 1e-6f ? offset / distance : glm::vec3(0.0f, 1.0f, 0.0f);
+        computeTangents(m);
+        m.points[0].position = a.position + m.normal * (a.radius - depth * 0.5f);
+        m.points[0].depth = depth;
+        m.count = 1;
+        return;
+    }
+
+    // Hulls, and hulls against anything
+    Simplex simplex;
+    if (!gjk(a, b, simplex) || !epa(a, b, simplex, m.normal, depth)) return;
+    computeTangents(m);
+    buildContacts(a, b, depth, m);
+}
+
+// The body against the ground plane, the normal pointing down into it
+void collideGround(const Body& body, float height, Manifold& m) {
+    m.count = 0;
+    if (body.aabb_min.y > height) return;
+    m.normal = glm::vec3(0.0f, -1.0f, 0.0f);
+    computeTangents(m);
+
+    glm::vec3 corners[PHYSICS_MAX_FEATURE_POINTS];
+    float shortfalls[PHYSICS_MAX_FEATURE_POINTS];
+    glm::vec3 points[PHYSICS_MAX_FEATURE_POINTS];
+    float depths[PHYSICS_MAX_FEATURE_POINTS];
+    int count = 0;
+    const int corner_count = featurePoints(body, m.normal, PHYSICS_CONTACT_TOLERANCE, corners, shortfalls);
+    for (int i = 0; i < corner_count; ++i) {
+        const float depth = height - corners[i].y;
+        if (depth < -PHYSICS_CONTACT_TOLERANCE) continue;
+        points[count] = corners[i] + glm::vec3(0.0f, depth * 0.5f, 0.0f);
+        depths[count++] = depth;
+    }
+    reduceContacts(m, points, depths, count);
+}
+
+// Extreme points of the meshes' CPU positions along directions spread over the sphere, around
+// center in the entity's scaled space. Null when no mesh kept its vertices.
+std::shared_ptr<const std::vector<glm::vec3>> buildHull(const std::vector<std::shared_ptr<Mesh>>& meshes, const glm::vec3& scale,
+                                                        const glm::vec3& center) {
+    glm::vec3 directions[PHYSICS_HULL_DIRECTIONS];
+    for (int i = 0; i < PHYSICS_HULL_DIRECTIONS; ++i) {
+        // Fibonacci sphere
+        const float y = 1.0f - 2.0f * (i + 0.5f) / PHYSICS_HULL_DIRECTIONS;
+        const float ring = std::sqrt(1.0f - y * y);
+        const float angle = i * glm::pi<float>() * (3.0f - std::sqrt(5.0f));
+        directions[i] = glm::vec3(std::cos(angle) * ring, y, std::sin(angle) * ring);
+    }
+    glm::vec3 best[PHYSICS_HULL_DIRECTIONS];
+    float best_dot[PHYSICS_HULL_DIRECTIONS];
+    std::fill(best_dot, best_dot + PHYSICS_HULL_DIRECTIONS, -FLT_MAX);
+
+    auto addPoint = [&](const glm::vec3& position) {
+        const glm::vec3 point = position * scale - center;
+        for (int i = 0; i < PHYSICS_HULL_DIRECTIONS; ++i) {
+            const float dot = glm::dot(point, directions[i]);
+            if (dot > best_dot[i]) {
+                best_dot[i] = dot;
+                best[i] = point;
+            }
+        }
+    };
+    for (const auto& mesh : meshes) {
+        if (!mesh) continue;
+        if (!mesh->positions_data.empty()) {
+            for (const glm::vec3& position : mesh->positions_data) addPoint(position);
+        } else if (!mesh->vertices_data.empty()) {
+            // The position leads every vertex in either layout
+            const size_t stride = mesh->vertex_layout.stride;
+            for (size_t offset = 0; offset + sizeof(glm::vec3) <= mesh->vertices_data.size(); offset += stride) {
+                glm::vec3 position;
+                memcpy(&position, mesh->vertices_data.data() + offset, sizeof(position));
+                addPoint(position);
+            }
+        }
+    }
+    if (best_dot[0] == -FLT_MAX) return nullptr;
+
+    auto hull = std::make_shared<std::vector<glm::vec3>>();
+    for (const glm::vec3& point : best) {
+        if (std::find(hull->begin(), hull->end(), point) == hull->end()) hull->push_back(point);
+    }
+    return hull;
+}
+
+void applyImpulse(Body& body, const glm::vec3& r, const glm::vec3& impulse) {
+    if (body.inverse_mass == 0.0f) return; // Static bodies are shared between islands, and don't move
+    body.velocity += impulse * body.inverse_mass;
+    body.angular_velocity += body.inverse_inertia_world * glm::cross(r, impulse);
+}
+
+glm::vec3 pointVelocity(const Body& body, const glm::vec3& r) {
+    return body.velocity + glm::cross(body.angular_velocity, r);
+}
+
+} // namespace
+
+int PhysicsWorld::addBody(EntityHandle handle, const RigidBodyDesc& desc) {
+    const Entity* entity = entity_manager.get(handle);
+    if (!entity || !entity_manager.getParent(handle).isNull() || entity->bounds_radius <= 0.0f) return -1;
+
+    Body body;
+    body.entity = handle;
+    body.used = true;
+    body.shape = desc.shape;
+    body.scale = entity->scale;
+    // A negative scale mirrors the bounds
+    const glm::vec3 scaled_min = entity->bounds_min * entity->scale, scaled_max = entity->bounds_max * entity->scale;
+    const glm::vec3 bmin = glm::min(scaled_min, scaled_max), bmax = glm::max(scaled_min, scaled_max);
+    body.offset = (bmin + bmax) * 0.5f;
+    body.half_extents = glm::max((bmax - bmin) * 0.5f, glm::vec3(PHYSICS_MIN_HALF_EXTENT));
+    body.radius = std::max(body.half_extents.x, std::max(body.half_extents.y, body.half_extents.z));
+    if (body.shape == PHYSICS_SHAPE_HULL) {
+        body.hull = buildHull(entity->meshes, entity->scale, body.offset);
+        if (body.hull) {
+            body.half_extents = glm::vec3(PHYSICS_MIN_HALF_EXTENT);
+            for (const glm::vec3& point : *body.hull) body.half_extents = glm::max(body.half_extents, glm::abs(point));
+        } else {
+            body.shape = PHYSICS_SHAPE_BOX;
+        }
+    }
+
+    body.orientation = body.previous_orientation = eulerToQuat(entity->rotation);
+    body.position = body.previous_position = entity->position + body.orientation * body.offset;
+    body.velocity = desc.velocity;
+    body.angular_velocity = desc.angular_velocity;
+    body.friction = desc.friction;
+    body.restitution = desc.restitution;
+    body.linear_damping = desc.linear_damping;
+    body.angular_damping = desc.angular_damping;
+    if (desc.mass > 0.0f) {
+        body.inverse_mass = 1.0f / desc.mass;
+        glm::vec3 inertia;
+        if (body.shape == PHYSICS_SHAPE_SPHERE) {
+            inertia = glm::vec3(0.4f * desc.mass * body.radius * body.radius);
+        } else {
+            // A solid box, for hulls the box around them
+            const glm::vec3 h2 = body.half_extents * body.half_extents;
+            inertia = desc.mass / 3.0f * glm::vec3(h2.y + h2.z, h2.x + h2.z, h2.x + h2.y);
+        }
+        body.inverse_inertia = 1.0f / inertia;
+    }
+    body.publish = body.inverse_mass > 0.0f;
+
+    std::lock_guard<std::mutex> lock(command_mutex);
+    const int id = next_id++;
+    added.emplace_back(id, std::move(body));
+    return id;
+}
+
+void PhysicsWorld::removeBody(int body) {
+    std::lock_guard<std::mutex> lock(command_mutex);
+    removed.push_back(body);
+}
+
+void PhysicsWorld::clear() {
+    std::lock_guard<std::mutex> lock(command_mutex);
+    clearing = true;
+    added.clear();
+    removed.clear();
+    next_id = 0;
+}
+
+void PhysicsWorld::setGround(float height) {
+    std::lock_guard<std::mutex> lock(command_mutex);
+    ground_changed = true;
+    pending_ground = height;
+}
+
+void PhysicsWorld::applyCommands() {
+    thread_local std::vector<std::pair<int, Body>> adding;
+    thread_local std::vector<int> removing;
+    bool clear_all = false;
+    {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        adding.swap(added);
+        removing.swap(removed);
+        clear_all = clearing;
+        clearing = false;
+        if (ground_changed) {
+            has_ground = true;
+            ground_height = pending_ground;
+            ground_changed = false;
+        }
+    }
+
+    if (clear_all) {
+        bodies.clear();
+        previous_manifolds.clear();
+    }
+    for (auto& entry : adding) {
+        if ((size_t)entry.first >= bodies.size()) bodies.resize(entry.first + 1);
+        bodies[entry.first] = std::move(entry.second);
+    }
+    for (int id : removing) {
+        if (id >= 0 && (size_t)id < bodies.size()) bodies[id] = Body();
+    }
+    adding.clear();
+    removing.clear();
+}
+
+void PhysicsWorld::broadphase() {
+    TRACE_SCOPE("Broadphase", "physics");
+    // Sweeps along whichever axis the bodies spread out along most, a pile on the ground
+    // overlaps everything along y
+    glm::vec3 sum(0.0f), sum_squares(0.0f);
+    size_t used = 0;
+    for (const Body& body : bodies) {
+        if (!body.used) continue;
+        const glm::vec3 center = (body.aabb_min + body.aabb_max) * 0.5f;
+        sum += center;
+        sum_squares += center * center;
+        ++used;
+    }
+    const glm::vec3 variance = used > 0 ? sum_squares / (float)used - (sum / (float)used) * (sum / (float)used) : glm::vec3(0.0f);
+    const int axis = variance.x >= variance.y ? (variance.x >= variance.z ? 0 : 2) : (variance.y >= variance.z ? 1 : 2);
+
+    proxies.clear();
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        if (bodies[i].used) proxies.push_back({bodies[i].aabb_min[axis], bodies[i].aabb_max[axis], (int)i});
+    }
+    // Bodies barely move between steps, the order's nearly sorted already
+    std::sort(proxies.begin(), proxies.end(), [](const Proxy& a, const Proxy& b) { return a.min < b.min; });
+
+    // Each range sweeps forward from its own proxies into its own list, ranges are grain-aligned
+    const size_t count = proxies.size();
+    range_pairs.resize((count + PHYSICS_PAIR_GRAIN - 1) / PHYSICS_PAIR_GRAIN);
+    job_system.parallelFor(count, PHYSICS_PAIR_GRAIN, [&](size_t begin, size_t end) {
+        std::vector<std::pair<int, int>>& out = range_pairs[begin / PHYSICS_PAIR_GRAIN];
+        out.clear();
+        for (size_t i = begin; i < end; ++i) {
+            const int ia = proxies[i].body;
+            const Body& a = bodies[ia];
+            for (size_t j = i + 1; j < count && proxies[j].min <= proxies[i].max; ++j) {
+                const int ib = proxies[j].body;
+                if (!moving(ia) && !moving(ib)) continue;
+                const Body& b = bodies[ib];
+                if (glm::any(glm::greaterThan(a.aabb_min, b.aabb_max)) || glm::any(glm::greaterThan(b.aabb_min, a.aabb_max))) continue;
+                out.emplace_back(std::min(ia, ib), std::max(ia, ib));
+            }
+        }
+    });
+
+    pairs.clear();
+    for (size_t r = 0; r * PHYSICS_PAIR_GRAIN < count; ++r) pairs.insert(pairs.end(), range_pairs[r].begin(), range_pairs[r].end());
+}
+
+void PhysicsWorld::narrowphase() {
+    TRACE_SCOPE("Narrowphase", "physics");
+    // Fills in a manifold's contact properties and the impulses its points had last step
+    auto finish = [&](Manifold& m) {
+        const Body& a = bodies[m.a];
+        const float friction_b = m.b >= 0 ? bodies[m.b].friction : PHYSICS_GROUND_FRICTION;
+        const float restitution_b = m.b >= 0 ? bodies[m.b].restitution : 0.0f;
+        m.friction = std::sqrt(a.friction * friction_b);
+        m.restitution = std::max(a.restitution, restitution_b);
+
+        const glm::quat to_a = glm::conjugate(a.orientation);
+        for (int i = 0; i < m.count; ++i) {
+            ContactPoint& point = m.points[i];
+            point.local_a = to_a * (point.position - a.position);
+            point.normal_impulse = point.tangent_impulse[0] = point.tangent_impulse[1] = 0.0f;
+        }
+        const uint64_t key = m.key();
+        auto previous = std::lower_bound(previous_manifolds.begin(), previous_manifolds.end(), key,
+                                         [](const Manifold& other, uint64_t k) { return other.key() < k; });
+        if (previous == previous_manifolds.end() || previous->key() != key) return;
+        for (int i = 0; i < m.count; ++i) {
+            ContactPoint& point = m.points[i];
+            for (int k = 0; k < previous->count; ++k) {
+                const ContactPoint& old = previous->points[k];
+                if (glm::distance(old.local_a, point.local_a) > PHYSICS_WARM_START_DISTANCE) continue;
+                point.normal_impulse = old.normal_impulse;
+                point.tangent_impulse[0] = old.tangent_impulse[0];
+                point.tangent_impulse[1] = old.tangent_impulse[1];
+                break;
+            }
+        }
+    };
+
+    pair_manifolds.resize(pairs.size());
+    job_system.parallelFor(pairs.size(), PHYSICS_PAIR_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Manifold& m = pair_manifolds[i];
+            m.a = pairs[i].first;
+            m.b = pairs[i].second;
+            collide(bodies[m.a], bodies[m.b], m);
+            if (m.count > 0) finish(m);
+        }
+    });
+
+    ground_manifolds.resize(bodies.size());
+    job_system.parallelFor(bodies.size(), PHYSICS_BODY_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Manifold& m = ground_manifolds[i];
+            m.a = (int)i;
+            m.b = -1;
+            m.count = 0;
+            if (!has_ground || !bodies[i].used || !moving((int)i)) continue;
+            collideGround(bodies[i], ground_height, m);
+            if (m.count > 0) finish(m);
+        }
+    });
+
+    manifolds.clear();
+    for (const Manifold& m : pair_manifolds) {
+        if (m.count > 0) manifolds.push_back(m);
+    }
+    for (const Manifold& m : ground_manifolds) {
+        if (m.count > 0) manifolds.push_back(m);
+    }
+    std::sort(manifolds.begin(), manifolds.end(), [](const Manifold& a, const Manifold& b) { return a.key() < b.key(); });
+}
+
+void PhysicsWorld::buildIslands() {
+    const size_t count = bodies.size();
+    island_parent.resize(count);
+    for (size_t i = 0; i < count; ++i) island_parent[i] = (int)i;
+    auto find = [&](int i) {
+        while (island_parent[i] != i) {
+            island_parent[i] = island_parent[island_parent[i]];
+            i = island_parent[i];
+        }
+        return i;
+    };
+    auto dynamic = [&](int i) { return i >= 0 && bodies[i].used && bodies[i].inverse_mass > 0.0f; };
+
+    // Static bodies and the ground hold up any number of islands without joining them
+    for (const Manifold& m : manifolds) {
+        if (!dynamic(m.a) || !dynamic(m.b)) continue;
+        const int ra = find(m.a), rb = find(m.b);
+        if (ra != rb) island_parent[std::max(ra, rb)] = std::min(ra, rb);
+    }
+
+    // An island with one awake body wakes the rest
+    island_of.assign(count, -1);
+    island_awake.assign(count, 0);
+    for (size_t i = 0; i < count; ++i) {
+        if (dynamic((int)i) && !bodies[i].asleep) island_awake[find((int)i)] = 1;
+    }
+
+    islands.clear();
+    for (size_t i = 0; i < count; ++i) {
+        if (!dynamic((int)i)) continue;
+        const int root = find((int)i);
+        if (!island_awake[root]) continue;
+        if (island_of[root] < 0) {
+            island_of[root] = (int)islands.size();
+            islands.emplace_back();
+        }
+        Body& body = bodies[i];
+        if (body.asleep) {
+            body.asleep = false;
+            body.rest_time = 0.0f;
+        }
+        islands[island_of[root]].body_count++;
+    }
+
+    // Counts to offsets, then each island's bodies and manifolds in order
+    uint32_t offset = 0;
+    for (Island& island : islands) {
+        island.first_body = offset;
+        offset += island.body_count;
+        island.body_count = 0;
+    }
+    island_bodies.resize(offset);
+    for (size_t i = 0; i < count; ++i) {
+        if (!dynamic((int)i) || island_of[find((int)i)] < 0) continue;
+        Island& island = islands[island_of[find((int)i)]];
+        island_bodies[island.first_body + island.body_count++] = (int)i;
+    }
+
+    auto islandOf = [&](const Manifold& m) { return island_of[find(dynamic(m.a) ? m.a : m.b)]; };
+    for (const Manifold& m : manifolds) {
+        const int island = islandOf(m);
+        if (island >= 0) islands[island].manifold_count++;
+    }
+    offset = 0;
+    for (Island& island : islands) {
+        island.first_manifold = offset;
+        offset += island.manifold_count;
+        island.manifold_count = 0;
+    }
+    island_manifolds.resize(offset);
+    for (size_t i = 0; i < manifolds.size(); ++i) {
+        const int index = islandOf(manifolds[i]);
+        if (index < 0) continue;
+        Island& island = islands[index];
+        island_manifolds[island.first_manifold + island.manifold_count++] = (int)i;
+    }
+}
+
+void PhysicsWorld::solveIsland(const Island& island, float dt) {
+    const int* body_ids = island_bodies.data() + island.first_body;
+    const int* manifold_ids = island_manifolds.data() + island.first_manifold;
+
+    for (uint32_t i = 0; i < island.body_count; ++i) {
+        Body& body = bodies[body_ids[i]];
+        body.velocity.y += PHYSICS_GRAVITY * dt;
+        body.velocity *= 1.0f / (1.0f + dt * body.linear_damping);
+        body.angular_velocity *= 1.0f / (1.0f + dt * body.angular_damping);
+        const glm::mat3 rotation = glm::mat3_cast(body.orientation);
+        body.inverse_inertia_world = rotation * glm::mat3(glm::vec3(body.inverse_inertia.x, 0.0f, 0.0f),
+                                                          glm::vec3(0.0f, body.inverse_inertia.y, 0.0f),
+                                                          glm::vec3(0.0f, 0.0f, body.inverse_inertia.z)) * glm::transpose(rotation);
+    }
+
+    // Effective masses and bias velocities, the bounces from the velocities before any impulse
+    for (uint32_t k = 0; k < island.manifold_count; ++k) {
+        Manifold& m = manifolds[manifold_ids[k]];
+        Body& a = bodies[m.a];
+        Body& b = m.b >= 0 ? bodies[m.b] : ground_body;
+        for (int i = 0; i < m.count; ++i) {
+            ContactPoint& point = m.points[i];
+            point.ra = point.position - a.position;
+            point.rb = point.position - b.position;
+            auto effectiveMass = [&](const glm::vec3& dir) {
+                const glm::vec3 ra_dir = glm::cross(point.ra, dir), rb_dir = glm::cross(point.rb, dir);
+                const float k_sum = a.inverse_mass + b.inverse_mass + glm::dot(ra_dir, a.inverse_inertia_world * ra_dir) +
+                                    glm::dot(rb_dir, b.inverse_inertia_world * rb_dir);
+                return k_sum > 0.0f ? 1.0f / k_sum : 0.0f;
+            };
+            point.normal_mass = effectiveMass(m.normal);
+            point.tangent_mass[0] = effectiveMass(m.tangents[0]);
+            point.tangent_mass[1] = effectiveMass(m.tangents[1]);
+
+            const float approach = glm::dot(pointVelocity(b, point.rb) - pointVelocity(a, point.ra), m.normal);
+            point.bias = PHYSICS_BAUMGARTE / dt * std::max(point.depth - PHYSICS_SLOP, 0.0f);
+            if (approach < -PHYSICS_BOUNCE_THRESHOLD) point.bias = std::max(point.bias, -m.restitution * approach);
+        }
+    }
+
+    // Last step's impulses applied up front
+    for (uint32_t k = 0; k < island.manifold_count; ++k) {
+        Manifold& m = manifolds[manifold_ids[k]];
+        Body& a = bodies[m.a];
+        Body& b = m.b >= 0 ? bodies[m.b] : ground_body;
+        for (int i = 0; i < m.count; ++i) {
+            const ContactPoint& point = m.points[i];
+            const glm::vec3 impulse = m.normal * point.normal_impulse + m.tangents[0] * point.tangent_impulse[0] +
+                                      m.tangents[1] * point.tangent_impulse[1];
+            applyImpulse(a, point.ra, -impulse);
+            applyImpulse(b, point.rb, impulse);
+        }
+    }
+
+    for (int iteration = 0; iteration < PHYSICS_SOLVER_ITERATIONS; ++iteration) {
+        for (uint32_t k = 0; k < island.manifold_count; ++k) {
+            Manifold& m = manifolds[manifold_ids[k]];
+            Body& a = bodies[m.a];
+            Body& b = m.b >= 0 ? bodies[m.b] : ground_body;
+            for (int i = 0; i < m.count; ++i) {
+                ContactPoint& point = m.points[i];
+                // Friction first, bounded by the normal impulse so far
+                for (int t = 0; t < 2; ++t) {
+                    const float speed = glm::dot(pointVelocity(b, point.rb) - pointVelocity(a, point.ra), m.tangents[t]);
+                    const float limit = m.friction * point.normal_impulse;
+                    const float previous = point.tangent_impulse[t];
+                    point.tangent_impulse[t] = glm::clamp(previous - speed * point.tangent_mass[t], -limit, limit);
+                    const glm::vec3 impulse = m.tangents[t] * (point.tangent_impulse[t] - previous);
+                    applyImpulse(a, point.ra, -impulse);
+                    applyImpulse(b, point.rb, impulse);
+                }
+
+                const float speed = glm::dot(pointVelocity(b, point.rb) - pointVelocity(a, point.ra), m.normal);
+                const float previous = point.normal_impulse;
+                point.normal_impulse = std::max(previous + (point.bias - speed) * point.normal_mass, 0.0f);
+                const glm::vec3 impulse = m.normal * (point.normal_impulse - previous);
+                applyImpulse(a, point.ra, -impulse);
+                applyImpulse(b, point.rb, impulse);
+            }
+        }
+    }
+
+    float rest_time = FLT_MAX;
+    for (uint32_t i = 0; i < island.body_count; ++i) {
+        Body& body = bodies[body_ids[i]];
+        body.position += body.velocity * dt;
+        const glm::vec3& w = body.angular_velocity;
+        body.orientation = glm::normalize(body.orientation + glm::quat(0.0f, w.x, w.y, w.z) * body.orientation * (0.5f * dt));
+        body.publish = true;
+
+        const bool resting = glm::dot(body.velocity, body.velocity) < PHYSICS_SLEEP_LINEAR * PHYSICS_SLEEP_LINEAR &&
+                             glm::dot(w, w) < PHYSICS_SLEEP_ANGULAR * PHYSICS_SLEEP_ANGULAR;
+        body.rest_time = resting ? body.rest_time + dt : 0.0f;
+        rest_time = std::min(rest_time, body.rest_time);
+    }
+    if (rest_time < PHYSICS_SLEEP_SECONDS) return;
+    for (uint32_t i = 0; i < island.body_count; ++i) {
+        Body& body = bodies[body_ids[i]];
+        body.asleep = true;
+        body.velocity = body.angular_velocity = glm::vec3(0.0f);
+    }
+}
+
+void PhysicsWorld::step(float dt) {
+    TRACE_SCOPE("Physics step", "physics");
+    const auto start = std::chrono::steady_clock::now();
+    applyCommands();
+
+    // Interpolation starts from here, and the broadphase sees every body where it is now
+    job_system.parallelFor(bodies.size(), PHYSICS_BODY_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Body& body = bodies[i];
+            if (!body.used) continue;
+            body.previous_position = body.position;
+            body.previous_orientation = body.orientation;
+            glm::vec3 extent;
+            if (body.shape == PHYSICS_SHAPE_SPHERE) {
+                extent = glm::vec3(body.radius);
+            } else {
+                const glm::mat3 rotation = glm::mat3_cast(body.orientation);
+                extent = glm::abs(rotation[0]) * body.half_extents.x + glm::abs(rotation[1]) * body.half_extents.y +
+                         glm::abs(rotation[2]) * body.half_extents.z;
+            }
+            extent += glm::vec3(PHYSICS_AABB_MARGIN);
+            body.aabb_min = body.position - extent;
+            body.aabb_max = body.position + extent;
+        }
+    });
+
+    broadphase();
+    narrowphase();
+    buildIslands();
+    {
+        TRACE_SCOPE("Solve islands", "physics");
+        job_system.parallelFor(islands.size(), PHYSICS_ISLAND_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) solveIsland(islands[i], dt);
+        });
+    }
+    previous_manifolds.swap(manifolds);
+
+    size_t used = 0;
+    for (const Body& body : bodies) used += body.used;
+    body_count.store(used, std::memory_order_relaxed);
+    awake_count.store(island_bodies.size(), std::memory_order_relaxed);
+    contact_count.store(previous_manifolds.size(), std::memory_order_relaxed);
+    island_count.store(islands.size(), std::memory_order_relaxed);
+    step_ms.store(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+}
+
+void PhysicsWorld::interpolate(float alpha, std::vector<EntityHandle>& entities, std::vector<EntityTransform>& transforms) {
+    entities.clear();
+    transforms.clear();
+    for (Body& body : bodies) {
+        if (!body.used || !body.publish) continue;
+        const glm::quat orientation = glm::slerp(body.previous_orientation, body.orientation, alpha);
+        const glm::vec3 position = glm::mix(body.previous_position, body.position, alpha);
+        EntityTransform transform;
+        transform.position = position - orientation * body.offset;
+        transform.rotation = quatToEuler(orientation);
+        transform.scale = body.scale;
+        entities.push_back(body.entity);
+        transforms.push_back(transform);
+        // Asleep the pose is final, one more write and it's left alone
+        body.publish = !body.asleep;
+    }
+}
+
+void PhysicsWorld::spawnPile(const EntityTemplate& entity_template, int count, const glm::vec3& center) {
+    glm::vec3 bounds_center, bmin, bmax;
+    if (count <= 0 || entity_template.lod_specs.empty() ||
+        computeMeshesBounds(entity_template.lod_specs[0].second, bounds_center, bmin, bmax) <= 0.0f) return;
+
+    // Columns on a square, layers stacked up from PHYSICS_DEMO_HEIGHT, each body nudged and
+    // turned a little so the pile collapses instead of standing
+    const glm::vec3 size = bmax - bmin;
+    const float spacing = std::max(size.x, std::max(size.y, size.z)) * 1.25f;
+    const int side = std::max(1, (int)std::ceil(std::cbrt((float)count)));
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> jitter(-0.1f, 0.1f);
+    std::uniform_real_distribution<float> tilt(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> turn(0.0f, 360.0f);
+    std::vector<EntityTransform> transforms((size_t)count);
+    for (int i = 0; i < count; ++i) {
+        const int column = i % (side * side), layer = i / (side * side);
+        EntityTransform& transform = transforms[i];
+        transform.position = center + glm::vec3((column % side - (side - 1) * 0.5f + jitter(rng)) * spacing,
+                                                PHYSICS_DEMO_HEIGHT + layer * spacing - bmin.y,
+                                                (column / side - (side - 1) * 0.5f + jitter(rng)) * spacing);
+        transform.rotation = glm::vec3(tilt(rng), turn(rng), tilt(rng));
+    }
+
+    const std::vector<EntityHandle> handles = createEntities(entity_template, transforms);
+    RigidBodyDesc desc;
+    for (EntityHandle handle : handles) addBody(handle, desc);
+    printf("Physics: dropped %d bodies\n", count);
+}
+
+int PhysicsWorld::parseArg(int argc, char** argv, int i) {
+    if (std::string(argv[i]) != "--physics") return 0;
+    if (i + 1 >= argc || atoi(argv[i + 1]) < 0) {
+        printf("--physics needs a body count\n");
+        return -1;
+    }
+    requested = atoi(argv[i + 1]);
+    return 2;
+}
@@ -0,0 +1,222 @@
+#include "pipeline_stats.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "scene_target.h"
+#include "shader_loading.h"
+#include <algorithm>
+#include <cstdio>
+
+std::string buildAssetPath(const std::string& relative_path);
+
+bool use_pipeline_statistics = false;
+bool use_overdraw_view = false;
+
+PipelineStatistics pipeline_stats;
+
+#define PIPELINE_COUNTERS 4 // Queries a pass, in PassCounts order
+
+static const GLenum PIPELINE_COUNTER_TARGETS[PIPELINE_COUNTERS] = {
+    GL_VERTEX_SHADER_INVOCATIONS_ARB,
+    GL_CLIPPING_INPUT_PRIMITIVES_ARB,
+    GL_CLIPPING_OUTPUT_PRIMITIVES_ARB,
+    GL_FRAGMENT_SHADER_INVOCATIONS_ARB,
+};
+
+// Black where nothing was shaded, blue through green for the cheap counts, then yellow to red,
+// and white for OVERDRAW_LEVELS - 1 or more
+static const float OVERDRAW_COLORS[OVERDRAW_LEVELS][3] = {
+    {0.0f, 0.0f, 0.0f}, {0.0f, 0.1f, 0.6f}, {0.0f, 0.5f, 0.2f}, {0.4f, 0.8f, 0.0f},
+    {1.0f, 0.9f, 0.0f}, {1.0f, 0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f},
+};
+
+PipelineStatistics::~PipelineStatistics() {
+    release();
+}
+
+void PipelineStatistics::release() {
+    for (Slot& slot : slots) {
+        if (!slot.passes.empty()) glDeleteQueries((GLsizei)slot.passes.size(), slot.passes.data());
+        if (slot.overdraw[0] != 0) glDeleteQueries(OVERDRAW_LEVELS, slot.overdraw);
+        slot = Slot();
+    }
+    heat_shader.reset();
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+    vao = 0;
+    current = -1;
+    statistics = pass_open = overdraw_open = overdraw_counted = false;
+    latest_frame = Frame();
+    latest_valid = false;
+}
+
+bool PipelineStatistics::finished(const Slot& slot) const {
+    // Results come back in submission order, the last query stands for the rest
+    GLint available = 1;
+    if (slot.passes_used > 0) {
+        glGetQueryObjectiv(slot.passes[slot.passes_used * PIPELINE_COUNTERS - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    }
+    if (available && slot.overdraw_used) {
+        glGetQueryObjectiv(slot.overdraw[OVERDRAW_LEVELS - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    }
+    return available != 0;
+}
+
+void PipelineStatistics::collect(Slot& slot) {
+    slot.waiting = false;
+#ifndef __EMSCRIPTEN__
+    Frame result;
+    result.id = slot.frame;
+    // Available, so none of these wait
+    for (size_t pass = 0; pass < slot.passes_used; ++pass) {
+        GLuint64 values[PIPELINE_COUNTERS] = {};
+        for (int counter = 0; counter < PIPELINE_COUNTERS; ++counter) {
+            glGetQueryObjectui64v(slot.passes[pass * PIPELINE_COUNTERS + counter], GL_QUERY_RESULT, &values[counter]);
+        }
+        result.passes.push_back({values[0], values[1], values[2], values[3]});
+    }
+    if (slot.overdraw_used) {
+        uint64_t shaded = 0, covered = 0;
+        for (int level = 1; level < OVERDRAW_LEVELS; ++level) {
+            GLuint64 samples = 0;
+            glGetQueryObjectui64v(slot.overdraw[level], GL_QUERY_RESULT, &samples);
+            result.overdraw_samples[level] = samples;
+            shaded += samples * level;
+            covered += samples;
+        }
+        result.overdraw = covered > 0 ? (double)shaded / covered : 0.0;
+    }
+    if (!latest_valid || result.id > latest_frame.id) {
+        latest_frame = std::move(result);
+        latest_valid = true;
+    }
+#endif
+}
+
+void PipelineStatistics::beginFrame() {
+    current = -1;
+    pass_open = overdraw_open = overdraw_counted = false;
+    statistics = use_pipeline_statistics && gl_extensions.pipeline_statistics;
+
+    const uint64_t frame = gpu_queries.frame();
+    for (int age = 0; age < GPU_QUERY_FRAMES; ++age) {
+        Slot& slot = slots[(frame + age) % GPU_QUERY_FRAMES];
+        if (!slot.waiting) continue;
+        if (finished(slot)) collect(slot);
+        else if (age == 0) slot.waiting = false; // Dropped, this frame needs the slot
+    }
+
+    current = (int)(frame % GPU_QUERY_FRAMES);
+    Slot& slot = slots[current];
+    slot.frame = frame;
+    slot.passes_used = 0;
+    slot.overdraw_used = false;
+}
+
+void PipelineStatistics::endFrame() {
+    if (current < 0) return;
+    endPass();
+    endOverdraw();
+    Slot& slot = slots[current];
+    slot.waiting = slot.passes_used > 0 || slot.overdraw_used;
+    current = -1;
+}
+
+void PipelineStatistics::beginPass() {
+    if (current < 0 || !statistics || pass_open) return;
+    Slot& slot = slots[current];
+    const size_t first = slot.passes_used++ * PIPELINE_COUNTERS;
+    if (first + PIPELINE_COUNTERS > slot.passes.size()) {
+        const size_t old_size = slot.passes.size();
+        slot.passes.resize(first + PIPELINE_COUNTERS);
+        glGenQueries((GLsizei)(slot.passes.size() - old_size), slot.passes.data() + old_size);
+    }
+    for (int counter = 0; counter < PIPELINE_COUNTERS; ++counter) {
+        glBeginQuery(PIPELINE_COUNTER_TARGETS[counter], slot.passes[first + counter]);
+    }
+    pass_open = true;
+}
+
+void PipelineStatistics::endPass() {
+    if (!pass_open) return;
+    for (int counter = 0; counter < PIPELINE_COUNTERS; ++counter) glEndQuery(PIPELINE_COUNTER_TARGETS[counter]);
+    pass_open = false;
+}
+
+void PipelineStatistics::beginOverdraw() {
+    if (current < 0 || !use_overdraw_view || overdraw_open) return;
+    // Every fragment that gets past the depth test, or finds it disabled, adds one
+    glEnable(GL_STENCIL_TEST);
+    glStencilMask(0xFF);
+    glStencilFunc(GL_ALWAYS, 0, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+    overdraw_open = true;
+    overdraw_counted = true;
+}
+
+void PipelineStatistics::endOverdraw() {
+    if (!overdraw_open) return;
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glDisable(GL_STENCIL_TEST);
+    overdraw_open = false;
+}
+
+bool PipelineStatistics::initOverdraw() {
+    if (heat_shader) return true;
+    if (overdraw_failed) return false;
+    try {
+        heat_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/hiz.vs")),
+                                               loadShaderFile(buildAssetPath("res/shaders/overdraw.fs")));
+    } catch (const std::exception& e) {
+        printf("Overdraw view disabled: %s\n", e.what());
+        overdraw_failed = true;
+        return false;
+    }
+    glGenVertexArrays(1, &vao);
+    return true;
+}
+
+void PipelineStatistics::drawOverdraw(int width, int height) {
+    endOverdraw();
+    if (!overdraw_counted || !initOverdraw()) return;
+    overdraw_counted = false;
+
+    const bool depth_test = gl_state.isEnabled(GL_DEPTH_TEST);
+    const bool cull_face = gl_state.isEnabled(GL_CULL_FACE);
+    const bool blend = gl_state.isEnabled(GL_BLEND);
+    gl_state.disable(GL_DEPTH_TEST);
+    gl_state.disable(GL_CULL_FACE);
+    gl_state.disable(GL_BLEND);
+    gl_state.colorMask(true);
+    gl_state.bindVertexArray(vao);
+    heat_shader->use();
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glViewport(0, 0, width, height);
+
+    // One fullscreen triangle per count, each landing only where the stencil holds it
+    glEnable(GL_STENCIL_TEST);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    Slot& slot = slots[current];
+#ifndef __EMSCRIPTEN__
+    if (slot.overdraw[0] == 0) glGenQueries(OVERDRAW_LEVELS, slot.overdraw);
+#endif
+    for (int level = 0; level < OVERDRAW_LEVELS; ++level) {
+        const bool last = level == OVERDRAW_LEVELS - 1;
+        glStencilFunc(last ? GL_LEQUAL : GL_EQUAL, level, 0xFF);
+        heat_shader->setVec3("heatColor", glm::vec3(OVERDRAW_COLORS[level][0], OVERDRAW_COLORS[level][1], OVERDRAW_COLORS[level][2]));
+#ifndef __EMSCRIPTEN__
+        if (level > 0) glBeginQuery(GL_SAMPLES_PASSED, slot.overdraw[level]);
+#endif
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+#ifndef __EMSCRIPTEN__
+        if (level > 0) glEndQuery(GL_SAMPLES_PASSED);
+#endif
+    }
+    glDisable(GL_STENCIL_TEST);
+#ifndef __EMSCRIPTEN__
+    slot.overdraw_used = true;
+#endif
+
+    gl_state.bindVertexArray(0);
+    gl_state.setEnabled(GL_DEPTH_TEST, depth_test);
+    gl_state.setEnabled(GL_CULL_FACE, cull_face);
+    gl_state.setEnabled(GL_BLEND, blend);
+}
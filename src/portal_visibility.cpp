@@ -0,0 +1,205 @@
+#include "portal_visibility.h"
+#include "entity_manager.h"
+#include "job_system.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+
+bool use_portal_culling = true;
+
+PortalVisibility portal_visibility;
+
+#define PORTAL_ASSIGN_GRAIN 4096
+
+namespace {
+
+// Normalized device x and y, empty when min passes max
+struct ScreenRect {
+    glm::vec2 min{1.0f}, max{-1.0f};
+
+    bool empty() const { return min.x > max.x || min.y > max.y; }
+    bool contains(const ScreenRect& other) const {
+        return !empty() && min.x <= other.min.x && min.y <= other.min.y && max.x >= other.max.x && max.y >= other.max.y;
+    }
+};
+
+std::vector<std::vector<uint32_t>> portalsPerCell(size_t cell_count, const std::vector<Portal>& portals) {
+    std::vector<std::vector<uint32_t>> result(cell_count);
+    for (uint32_t p = 0; p < (uint32_t)portals.size(); ++p) {
+        for (uint32_t cell : portals[p].cells) {
+            if (cell < cell_count) result[cell].push_back(p);
+        }
+    }
+    return result;
+}
+
+// From start with the whole screen, through every portal whose projection still overlaps the
+// rectangle narrowed so far. reached gets the union of the rectangles each cell was seen through.
+// A cell seen again only goes on when the new rectangle adds to what it had.
+void walkPortals(const std::vector<Portal>& portals, const std::vector<std::vector<uint32_t>>& cell_portals,
+                 const uint32_t* pvs_row, const glm::mat4& view_projection, uint32_t start, std::vector<ScreenRect>& reached) {
+    struct Step {
+        uint32_t cell;
+        ScreenRect rect;
+        int depth;
+    };
+    std::vector<Step> stack;
+    ScreenRect screen;
+    screen.min = glm::vec2(-1.0f);
+    screen.max = glm::vec2(1.0f);
+    reached[start] = screen;
+    stack.push_back({ start, screen, 0 });
+    while (!stack.empty()) {
+        const Step step = stack.back();
+        stack.pop_back();
+        if (step.depth >= PORTAL_MAX_DEPTH) continue;
+        for (uint32_t p : cell_portals[step.cell]) {
+            const Portal& portal = portals[p];
+            const uint32_t next = portal.cells[0] == step.cell ? portal.cells[1] : portal.cells[0];
+            if (next == PORTAL_NO_CELL || next == step.cell) continue;
+            if (pvs_row && !(pvs_row[next / 32] & (1u << (next % 32)))) continue;
+
+            // A corner at or behind the eye means the portal is around it, look through the lot
+            ScreenRect rect;
+            bool around = false;
+            for (const glm::vec3& corner : portal.corners) {
+                const glm::vec4 clip = view_projection * glm::vec4(corner, 1.0f);
+                if (clip.w < PORTAL_NEAR_W) {
+                    around = true;
+                    break;
+                }
+                const glm::vec2 ndc = glm::vec2(clip) / clip.w;
+                rect.min = rect.empty() ? ndc : glm::min(rect.min, ndc);
+                rect.max = rect.empty() ? ndc : glm::max(rect.max, ndc);
+            }
+            if (around) {
+                rect = step.rect;
+            } else {
+                rect.min = glm::max(rect.min, step.rect.min);
+                rect.max = glm::min(rect.max, step.rect.max);
+            }
+            if (rect.empty() || reached[next].contains(rect)) continue;
+
+            ScreenRect& seen = reached[next];
+            seen.min = seen.empty() ? rect.min : glm::min(seen.min, rect.min);
+            seen.max = seen.empty() ? rect.max : glm::max(seen.max, rect.max);
+            stack.push_back({ next, rect, step.depth + 1 });
+        }
+    }
+}
+
+} // namespace
+
+void PortalVisibility::load(std::vector<PortalCell> new_cells, std::vector<Portal> new_portals, std::vector<uint32_t> new_pvs) {
+    cells = std::move(new_cells);
+    portals = std::move(new_portals);
+    pvs = std::move(new_pvs);
+    if (pvs.size() != cells.size() * pvsWords(cells.size())) pvs = computePvs(cells, portals);
+    cell_portals = portalsPerCell(cells.size(), portals);
+    visible.assign(cells.size(), 0);
+    potentially_visible.assign(cells.size(), 0);
+    entity_layout = ~0ull;
+    camera_cell = PORTAL_NO_CELL;
+}
+
+void PortalVisibility::clear() {
+    load({}, {}, {});
+    entity_cells.clear();
+}
+
+void PortalVisibility::shiftOrigin(const glm::vec3& delta) {
+    for (PortalCell& cell : cells) {
+        cell.bmin -= delta;
+        cell.bmax -= delta;
+    }
+    for (Portal& portal : portals) {
+        for (glm::vec3& corner : portal.corners) corner -= delta;
+    }
+}
+
+std::vector<uint32_t> PortalVisibility::computePvs(const std::vector<PortalCell>& cells, const std::vector<Portal>& portals) {
+    const size_t words = pvsWords(cells.size());
+    std::vector<uint32_t> result(cells.size() * words, 0);
+    const std::vector<std::vector<uint32_t>> cell_portals = portalsPerCell(cells.size(), portals);
+
+    // The six faces of a cube around each sample, 90 degrees each so they cover every direction
+    static const glm::vec3 directions[6] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+    static const glm::vec3 ups[6] = { {0, 1, 0}, {0, 1, 0}, {0, 0, 1}, {0, 0, -1}, {0, 1, 0}, {0, 1, 0} };
+    const glm::mat4 face_projection = glm::perspective(glm::radians(90.0f), 1.0f, PORTAL_PVS_NEAR, PORTAL_PVS_FAR);
+
+    job_system.parallelFor(cells.size(), 1, [&](size_t begin, size_t end) {
+        std::vector<ScreenRect> reached(cells.size());
+        for (size_t c = begin; c < end; ++c) {
+            uint32_t* row = result.data() + c * words;
+            row[c / 32] |= 1u << (c % 32);
+            for (int sample = 0; sample < PORTAL_PVS_SAMPLES * PORTAL_PVS_SAMPLES * PORTAL_PVS_SAMPLES; ++sample) {
+                const glm::vec3 fraction((sample % PORTAL_PVS_SAMPLES + 0.5f) / PORTAL_PVS_SAMPLES,
+                                         (sample / PORTAL_PVS_SAMPLES % PORTAL_PVS_SAMPLES + 0.5f) / PORTAL_PVS_SAMPLES,
+                                         (sample / (PORTAL_PVS_SAMPLES * PORTAL_PVS_SAMPLES) + 0.5f) / PORTAL_PVS_SAMPLES);
+                const glm::vec3 eye = glm::mix(cells[c].bmin, cells[c].bmax, fraction);
+                for (int face = 0; face < 6; ++face) {
+                    std::fill(reached.begin(), reached.end(), ScreenRect());
+                    const glm::mat4 view_projection = face_projection * glm::lookAt(eye, eye + directions[face], ups[face]);
+                    walkPortals(portals, cell_portals, nullptr, view_projection, (uint32_t)c, reached);
+                    for (size_t other = 0; other < cells.size(); ++other) {
+                        if (!reached[other].empty()) row[other / 32] |= 1u << (other % 32);
+                    }
+                }
+            }
+        }
+    });
+    return result;
+}
+
+uint32_t PortalVisibility::cellContaining(const glm::vec3& bmin, const glm::vec3& bmax) const {
+    uint32_t best = PORTAL_NO_CELL;
+    float best_volume = 0.0f;
+    for (uint32_t c = 0; c < (uint32_t)cells.size(); ++c) {
+        const PortalCell& cell = cells[c];
+        if (glm::any(glm::lessThan(bmin, cell.bmin)) || glm::any(glm::greaterThan(bmax, cell.bmax))) continue;
+        const glm::vec3 size = cell.bmax - cell.bmin;
+        const float volume = size.x * size.y * size.z;
+        if (best == PORTAL_NO_CELL || volume < best_volume) {
+            best = c;
+            best_volume = volume;
+        }
+    }
+    return best;
+}
+
+void PortalVisibility::assignEntities(const EntityManager& entity_manager) {
+    EntitySpan<glm::vec3> mins = entity_manager.worldMins();
+    EntitySpan<glm::vec3> maxs = entity_manager.worldMaxs();
+    if (entity_manager.layoutVersion() != entity_layout || entity_cells.size() != mins.size()) {
+        entity_cells.resize(mins.size());
+        job_system.parallelFor(mins.size(), PORTAL_ASSIGN_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) entity_cells[i] = cellContaining(mins[i], maxs[i]);
+        });
+        entity_layout = entity_manager.layoutVersion();
+        return;
+    }
+    for (uint32_t i : entity_manager.movedEntities()) entity_cells[i] = cellContaining(mins[i], maxs[i]);
+}
+
+void PortalVisibility::update(const EntityManager& entity_manager, const glm::mat4& view_projection, const glm::vec3& camera_position) {
+    camera_cell = PORTAL_NO_CELL;
+    if (!use_portal_culling || cells.empty()) {
+        entity_layout = ~0ull; // Nothing tracked the movers meanwhile
+        return;
+    }
+    assignEntities(entity_manager);
+    camera_cell = cellAt(camera_position);
+    if (camera_cell == PORTAL_NO_CELL) return;
+
+    const size_t words = pvsWords(cells.size());
+    const uint32_t* row = pvs.data() + camera_cell * words;
+    for (size_t c = 0; c < cells.size(); ++c) potentially_visible[c] = (row[c / 32] >> (c % 32)) & 1u;
+
+    std::vector<ScreenRect> reached(cells.size());
+    walkPortals(portals, cell_portals, row, view_projection, camera_cell, reached);
+    for (size_t c = 0; c < cells.size(); ++c) visible[c] = reached[c].empty() ? 0 : 1;
+}
+
+size_t PortalVisibility::visibleCount() const {
+    if (camera_cell == PORTAL_NO_CELL) return cells.size();
+    return (size_t)std::count(visible.begin(), visible.end(), (uint8_t)1);
+}
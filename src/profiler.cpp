@@ -0,0 +1,231 @@
+#include "profiler.h"
+#include "imgui.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <unordered_map>
+
+bool use_profiler = true;
+
+FrameProfiler profiler;
+
+double FrameProfiler::sinceFrameStart() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+}
+
+void FrameProfiler::resolve(Pending& slot, const GpuQueryPool::Frame* gpu) {
+    slot.waiting = false;
+    Frame& frame = slot.frame;
+    auto stampAt = [&](size_t stamp, uint64_t& ns) {
+        const int index = stamp < slot.stamps.size() ? slot.stamps[stamp] : -1;
+        if (!gpu || index < 0 || index >= (int)gpu->timestamps.size()) return false;
+        ns = gpu->timestamps[index];
+        return true;
+    };
+    uint64_t start = 0, end = 0;
+    if (stampAt(0, start) && stampAt(1, end)) {
+        frame.gpu_ms = (end - start) / 1e6;
+        frame.gpu_start_ns = start;
+        for (size_t i = 0; i < frame.scopes.size(); ++i) {
+            uint64_t scope_start = 0, scope_end = 0;
+            if (!stampAt(2 + i * 2, scope_start) || !stampAt(3 + i * 2, scope_end)) continue;
+            frame.scopes[i].gpu_start_ms = (double)(int64_t)(scope_start - start) / 1e6;
+            frame.scopes[i].gpu_ms = (double)(int64_t)(scope_end - scope_start) / 1e6;
+        }
+    }
+    for (const auto& callback : on_frame) callback(frame);
+    if (frozen) return;
+    if (history.size() < PROFILER_HISTORY_FRAMES) {
+        history.push_back(frame);
+    } else {
+        history[history_next] = frame;
+        history_next = (history_next + 1) % PROFILER_HISTORY_FRAMES;
+    }
+}
+
+void FrameProfiler::beginFrame() {
+    current = -1;
+    open.clear();
+    if (!use_profiler) {
+        for (Pending& slot : pending) slot.waiting = false;
+        return;
+    }
+
+    // The pool just collected or dropped the frames these went with
+    for (const GpuQueryPool::Frame* gpu : gpu_queries.collected()) {
+        Pending& slot = pending[gpu->id % GPU_QUERY_FRAMES];
+        if (slot.waiting && slot.gpu_frame == gpu->id) resolve(slot, gpu->valid ? gpu : nullptr);
+    }
+
+    const uint64_t gpu_frame = gpu_queries.frame();
+    current = (int)(gpu_frame % GPU_QUERY_FRAMES);
+    Pending& slot = pending[current];
+    if (slot.waiting) resolve(slot, nullptr);
+
+    slot.frame.scopes.clear();
+    slot.frame.cpu_ms = 0.0;
+    slot.frame.gpu_ms = -1.0;
+    slot.frame.gpu_start_ns = 0;
+    slot.gpu_frame = gpu_frame;
+    slot.frame.id = gpu_frame;
+    owner = std::this_thread::get_id();
+    frame_start = std::chrono::steady_clock::now();
+    slot.frame.start = frame_start;
+    slot.stamps.assign(2, -1);
+    slot.stamps[0] = gpu_queries.timestamp();
+}
+
+void FrameProfiler::endFrame() {
+    if (current < 0) return;
+    Pending& slot = pending[current];
+    while (!open.empty()) pop(open.back());
+    slot.frame.cpu_ms = sinceFrameStart();
+    slot.stamps[1] = gpu_queries.timestamp();
+    current = -1;
+    // Nothing to wait for without timestamps
+    if (slot.stamps[1] < 0) {
+        resolve(slot, nullptr);
+    } else {
+        slot.waiting = true;
+    }
+}
+
+int FrameProfiler::push(const char* name) {
+    if (current < 0 || std::this_thread::get_id() != owner) return -1;
+    Pending& slot = pending[current];
+    if (slot.frame.scopes.size() >= PROFILER_MAX_SCOPES) return -1;
+
+    const int index = (int)slot.frame.scopes.size();
+    Scope scope;
+    scope.name = name;
+    scope.depth = (int)open.size();
+    scope.cpu_start_ms = sinceFrameStart();
+    slot.frame.scopes.push_back(scope);
+    open.push_back(index);
+    slot.stamps.resize(4 + index * 2, -1);
+    slot.stamps[2 + index * 2] = gpu_queries.timestamp();
+    return index;
+}
+
+void FrameProfiler::pop(int index) {
+    // Scopes still open when the frame ended were closed then
+    if (index < 0 || current < 0 || open.empty() || open.back() != index) return;
+    Pending& slot = pending[current];
+    Scope& scope = slot.frame.scopes[index];
+    scope.cpu_ms = sinceFrameStart() - scope.cpu_start_ms;
+    slot.stamps[3 + index * 2] = gpu_queries.timestamp();
+    open.pop_back();
+}
+
+// Stable per name, so a scope keeps its colour from frame to frame
+static ImU32 scopeColor(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (const char* c = name; *c; ++c) hash = (hash ^ (uint8_t)*c) * 16777619u;
+    return ImColor::HSV((hash % 360) / 360.0f, 0.55f, 0.75f);
+}
+
+void FrameProfiler::drawWindow(float x, float y) {
+    ImGui::SetNextWindowPos(ImVec2(x, y), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(420, 360), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowCollapsed(true, ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Profiler")) {
+        ImGui::End();
+        return;
+    }
+    ImGui::Checkbox("Record", &use_profiler);
+    ImGui::SameLine();
+    ImGui::Checkbox("Freeze", &frozen);
+    if (history.empty()) {
+        ImGui::Text("No frames yet");
+        ImGui::End();
+        return;
+    }
+
+    const int count = (int)history.size();
+    auto frameAt = [&](int age) -> const Frame& { // 0 is the newest
+        return history[(history_next + count - 1 - age + count) % count];
+    };
+    // Oldest first
+    std::vector<float> cpu(count), gpu(count);
+    for (int i = 0; i < count; ++i) {
+        cpu[i] = (float)frameAt(count - 1 - i).cpu_ms;
+        gpu[i] = (float)std::max(frameAt(count - 1 - i).gpu_ms, 0.0);
+    }
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), "CPU %.2f ms", cpu[count - 1]);
+    ImGui::PlotLines("##cpu", cpu.data(), count, 0, overlay, 0.0f, FLT_MAX, ImVec2(-1, 40));
+    snprintf(overlay, sizeof(overlay), "GPU %.2f ms", gpu[count - 1]);
+    ImGui::PlotLines("##gpu", gpu.data(), count, 0, overlay, 0.0f, FLT_MAX, ImVec2(-1, 40));
+
+    selected = std::min(selected, count - 1);
+    ImGui::SliderInt("Frames back", &selected, 0, count - 1);
+    const Frame& frame = frameAt(selected);
+
+    // Flame chart, a CPU and a GPU lane on one time axis, a row per nesting level
+    int depth = 1;
+    double span = std::max(frame.cpu_ms, frame.gpu_ms);
+    for (const Scope& scope : frame.scopes) depth = std::max(depth, scope.depth + 1);
+    span = std::max(span, 0.001);
+    const float row = ImGui::GetTextLineHeight() + 2.0f;
+    const float width = ImGui::GetContentRegionAvail().x;
+    ImDrawList* draw = ImGui::GetWindowDrawList();
+    const bool gpuTimed = frame.gpu_ms >= 0.0;
+    for (int lane = 0; lane < (gpuTimed ? 2 : 1); ++lane) {
+        ImGui::Text(lane == 0 ? "CPU %.2f ms" : "GPU %.2f ms", lane == 0 ? frame.cpu_ms : frame.gpu_ms);
+        const ImVec2 origin = ImGui::GetCursorScreenPos();
+        ImGui::Dummy(ImVec2(width, row * depth));
+        for (const Scope& scope : frame.scopes) {
+            const double start = lane == 0 ? scope.cpu_start_ms : scope.gpu_start_ms;
+            const double length = lane == 0 ? scope.cpu_ms : scope.gpu_ms;
+            if (length < 0.0) continue;
+            const ImVec2 min(origin.x + (float)(start / span) * width, origin.y + scope.depth * row);
+            const ImVec2 max(std::max(min.x + 1.0f, origin.x + (float)((start + length) / span) * width), min.y + row - 1.0f);
+            draw->AddRectFilled(min, max, scopeColor(scope.name));
+            if (max.x - min.x > ImGui::CalcTextSize(scope.name).x + 4.0f) {
+                draw->AddText(ImVec2(min.x + 2.0f, min.y), IM_COL32_WHITE, scope.name);
+            }
+            if (ImGui::IsMouseHoveringRect(min, max)) {
+                ImGui::SetTooltip("%s\nCPU %.3f ms\nGPU %.3f ms", scope.name, scope.cpu_ms, scope.gpu_ms);
+            }
+        }
+    }
+
+    // Averages over the ring, by scope name
+    struct Total {
+        double cpu = 0.0, gpu = 0.0;
+        int frames = 0;
+    };
+    std::unordered_map<const char*, Total> totals;
+    for (int i = 0; i < count; ++i) {
+        for (const Scope& scope : frameAt(i).scopes) {
+            Total& total = totals[scope.name];
+            total.cpu += scope.cpu_ms;
+            total.gpu += std::max(scope.gpu_ms, 0.0);
+            total.frames++;
+        }
+    }
+    if (ImGui::BeginTable("scopes", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_SizingStretchProp)) {
+        ImGui::TableSetupColumn("Scope");
+        ImGui::TableSetupColumn("CPU ms");
+        ImGui::TableSetupColumn("GPU ms");
+        ImGui::TableHeadersRow();
+        // In the selected frame's order, which keeps children under their parents
+        for (const Scope& scope : frame.scopes) {
+            auto it = totals.find(scope.name);
+            if (it == totals.end() || it->second.frames == 0) continue;
+            const Total& total = it->second;
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Indent(scope.depth * 8.0f + 0.001f);
+            ImGui::TextUnformatted(scope.name);
+            ImGui::Unindent(scope.depth * 8.0f + 0.001f);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", total.cpu / total.frames);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", total.gpu / total.frames);
+            it->second.frames = 0; // Once per name
+        }
+        ImGui::EndTable();
+    }
+    ImGui::End();
+}
@@ -0,0 +1,127 @@
+#include "program_cache.h"
+#include "gl_extensions.h"
+#include "filesystem.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+ProgramCache program_cache;
+
+#define PROGRAM_CACHE_MAGIC "PBIN"
+
+struct ProgramCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t format; // The driver's binary format enum
+    uint32_t length;
+};
+
+static void hashBytes(uint64_t& hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+uint64_t ProgramCache::key(const std::vector<const std::string*>& sources) {
+    if (driver.empty()) {
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+            const char* value = reinterpret_cast<const char*>(glGetString(name));
+            driver += value ? value : "";
+            driver += '\n';
+        }
+    }
+
+    // FNV-1a, each stage's length keeps "ab" + "c" apart from "a" + "bc"
+    uint64_t hash = 1469598103934665603ull;
+    hashBytes(hash, driver.data(), driver.size());
+    for (const std::string* source : sources) {
+        const uint64_t length = source ? source->size() : ~0ull;
+        hashBytes(hash, &length, sizeof(length));
+        if (source) hashBytes(hash, source->data(), source->size());
+    }
+    return hash;
+}
+
+std::string ProgramCache::path(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return buildAssetPath(std::string("cache/shaders/") + name);
+}
+
+GLuint ProgramCache::load(uint64_t key) {
+    if (!gl_extensions.program_binary) return 0;
+
+    const std::string file_path = path(key);
+    std::vector<char> binary;
+    ProgramCacheHeader header;
+    {
+        std::ifstream in(file_path, std::ios::binary);
+        if (!in || !in.read(reinterpret_cast<char*>(&header), sizeof(header))) return 0;
+        if (memcmp(header.magic, PROGRAM_CACHE_MAGIC, 4) != 0 || header.version != PROGRAM_CACHE_VERSION || header.key != key) {
+            return 0;
+        }
+        binary.resize(header.length);
+        if (!in.read(binary.data(), binary.size())) return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    gl_extensions.ProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        // Same strings, but the driver still wants it rebuilt
+        printf("Cached program binary '%s' was rejected, rebuilding\n", file_path.c_str());
+        glDeleteProgram(program);
+        std::error_code ec;
+        std::filesystem::remove(file_path, ec);
+        return 0;
+    }
+    return program;
+}
+
+void ProgramCache::prepare(GLuint program) const {
+    if (gl_extensions.program_binary) gl_extensions.ProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+void ProgramCache::store(uint64_t key, GLuint program) const {
+    if (!gl_extensions.program_binary) return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    gl_extensions.GetProgramBinary(program, length, &length, &format, binary.data());
+    if (length <= 0) return;
+
+    ProgramCacheHeader header;
+    memcpy(header.magic, PROGRAM_CACHE_MAGIC, 4);
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.format = format;
+    header.length = (uint32_t)length;
+
+    const std::string file_path = path(key);
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(file_path).parent_path(), ec);
+
+    // Write to a temp file and rename so a crash never leaves a half-written cache entry
+    std::string temp_path = file_path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            printf("Warning: Could not write program binary '%s'\n", file_path.c_str());
+            return;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(binary.data(), length);
+        if (!out) return;
+    }
+    std::filesystem::rename(temp_path, file_path, ec);
+    if (ec) std::filesystem::remove(temp_path, ec);
+}
@@ -0,0 +1,115 @@
+#include "quality_governor.h"
+#include "renderer.h"
+#include "scene_target.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+bool use_quality_governor = false;
+float quality_budget_ms = 16.6f;
+
+const char* const QUALITY_STEP_NAMES[QUALITY_STEP_COUNT] = {
+    "LOD bias", "Shadow update rate", "Shadow resolution", "Shadow filter taps", "Internal resolution",
+};
+
+QualityGovernor quality_governor;
+
+void QualityGovernor::update(float cpu_ms, double new_gpu_ms) {
+    if (!use_quality_governor) {
+        restoreAll();
+        return;
+    }
+    if (new_gpu_ms >= 0.0) gpu_ms = new_gpu_ms;
+    if (settle_frames > 0) {
+        settle_frames--;
+        return;
+    }
+
+    const double frame_ms = std::max((double)cpu_ms, gpu_ms);
+    over_frames = frame_ms > quality_budget_ms ? over_frames + 1 : 0;
+    under_frames = frame_ms < quality_budget_ms * QUALITY_RESTORE_HEADROOM ? under_frames + 1 : 0;
+
+    if (over_frames >= QUALITY_DEGRADE_FRAMES && applied < QUALITY_STEP_COUNT) {
+        apply((QualityStep)applied);
+        printf("Quality governor: %.1f ms over %.1f, %s down\n", frame_ms, quality_budget_ms, QUALITY_STEP_NAMES[applied]);
+        applied++;
+        degrade_count++;
+    } else if (under_frames >= QUALITY_RESTORE_FRAMES && applied > 0) {
+        applied--;
+        undo((QualityStep)applied);
+        printf("Quality governor: headroom at %.1f ms, %s restored\n", frame_ms, QUALITY_STEP_NAMES[applied]);
+    } else {
+        return;
+    }
+    over_frames = under_frames = 0;
+    settle_frames = QUALITY_SETTLE_FRAMES;
+}
+
+void QualityGovernor::restoreAll() {
+    while (applied > 0) {
+        applied--;
+        undo((QualityStep)applied);
+    }
+    over_frames = under_frames = settle_frames = 0;
+}
+
+void QualityGovernor::apply(QualityStep step) {
+    ShadowSettings shadows = requestedShadowSettings();
+    switch (step) {
+    case QUALITY_STEP_LOD_BIAS:
+        saved_lod_bias = lod_bias;
+        lod_bias = std::min(lod_bias + QUALITY_LOD_BIAS_STEP, LOD_MAX_BIAS);
+        break;
+    case QUALITY_STEP_SHADOW_INTERVAL:
+        for (int cascade = 0; cascade < SHADOW_CASCADES; ++cascade) {
+            saved_cascade_intervals[cascade] = shadow_cascade_intervals[cascade];
+            shadow_cascade_intervals[cascade] = std::max(shadow_cascade_intervals[cascade], QUALITY_SHADOW_INTERVAL);
+        }
+        break;
+    case QUALITY_STEP_SHADOW_RESOLUTION:
+        saved_shadow_resolution = shadows.resolution;
+        shadows.resolution = std::max(shadows.resolution / 2, 512u);
+        if (shadows != requestedShadowSettings()) requestShadowSettings(shadows);
+        break;
+    case QUALITY_STEP_SHADOW_TAPS:
+        saved_filter_taps = shadows.max_filter_taps;
+        shadows.max_filter_taps = std::min(shadows.max_filter_taps, QUALITY_SHADOW_TAPS);
+        if (shadows != requestedShadowSettings()) requestShadowSettings(shadows);
+        break;
+    case QUALITY_STEP_RESOLUTION: {
+        // Dynamic resolution keeps steering below a lower ceiling
+        float& scale = use_dynamic_resolution ? resolution_scale_max : resolution_scale;
+        saved_resolution_scale = scale;
+        scale = std::max(std::round(scale * QUALITY_RESOLUTION_SCALE / RESOLUTION_SCALE_STEP) * RESOLUTION_SCALE_STEP,
+                         RESOLUTION_SCALE_LOWEST);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void QualityGovernor::undo(QualityStep step) {
+    ShadowSettings shadows = requestedShadowSettings();
+    switch (step) {
+    case QUALITY_STEP_LOD_BIAS:
+        lod_bias = saved_lod_bias;
+        break;
+    case QUALITY_STEP_SHADOW_INTERVAL:
+        for (int cascade = 0; cascade < SHADOW_CASCADES; ++cascade) shadow_cascade_intervals[cascade] = saved_cascade_intervals[cascade];
+        break;
+    case QUALITY_STEP_SHADOW_RESOLUTION:
+        shadows.resolution = saved_shadow_resolution;
+        if (shadows != requestedShadowSettings()) requestShadowSettings(shadows);
+        break;
+    case QUALITY_STEP_SHADOW_TAPS:
+        shadows.max_filter_taps = saved_filter_taps;
+        if (shadows != requestedShadowSettings()) requestShadowSettings(shadows);
+        break;
+    case QUALITY_STEP_RESOLUTION:
+        (use_dynamic_resolution ? resolution_scale_max : resolution_scale) = saved_resolution_scale;
+        break;
+    default:
+        break;
+    }
+}
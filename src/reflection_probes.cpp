@@ -0,0 +1,318 @@
+#include "reflection_probes.h"
+#include "filesystem.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "gpu_memory.h"
+#include "shader.h"
+#include "shader_loading.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cstdio>
+
+ReflectionProbes reflection_probes;
+bool use_reflection_probes = true;
+float reflection_probe_refresh_seconds = 0.0f;
+
+// Looking down each GL cube face with the up vectors the cube map lookup implies
+static const glm::vec3 FACE_FORWARD[6] = {
+    { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+    { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f }
+};
+static const glm::vec3 FACE_UP[6] = {
+    { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f },
+    { 0.0f, 0.0f, -1.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }
+};
+
+static uint64_t probeBytes(GLenum format) {
+    uint64_t bytes = 0;
+    for (int mip = 0; mip < REFLECTION_PROBE_MIPS; ++mip) {
+        const int size = REFLECTION_PROBE_SIZE >> mip;
+        bytes += textureLevelBytes(format, size, size, 6);
+    }
+    return bytes;
+}
+
+static GLuint createProbeCube(GLenum format) {
+    GLuint cube;
+    glGenTextures(1, &cube);
+    gl_state.bindTexture(0, GL_TEXTURE_CUBE_MAP, cube);
+    for (int mip = 0; mip < REFLECTION_PROBE_MIPS; ++mip) {
+        const int size = REFLECTION_PROBE_SIZE >> mip;
+        for (int face = 0; face < 6; ++face) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, format, size, size, 0, GL_RGBA,
+                         format == GL_RGBA16F ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, REFLECTION_PROBE_MIPS - 1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    gpu_memory.trackTexture(cube, probeBytes(format), GPU_MEMORY_SKYBOX, "reflection probes");
+    return cube;
+}
+
+ReflectionProbes::~ReflectionProbes() {
+    release();
+}
+
+int ReflectionProbes::add(const glm::vec3& position, float radius) {
+    Probe probe;
+    probe.position = position;
+    probe.radius = std::max(radius, 0.01f);
+    probe.live = true;
+    probe.dirty = true;
+    live++;
+    for (size_t i = 0; i < probes.size(); ++i) {
+        if (!probes[i].live) {
+            probes[i] = probe;
+            return (int)i;
+        }
+    }
+    probes.push_back(probe);
+    return (int)probes.size() - 1;
+}
+
+void ReflectionProbes::remove(int id) {
+    if (id < 0 || id >= (int)probes.size() || !probes[id].live) return;
+    Probe& probe = probes[id];
+    if (probe.cube != 0) {
+        gpu_memory.releaseTexture(probe.cube);
+        glDeleteTextures(1, &probe.cube);
+    }
+    probe = Probe();
+    live--;
+    if (capturing == id) capturing = -1;
+}
+
+void ReflectionProbes::invalidate(int id) {
+    for (size_t i = 0; i < probes.size(); ++i) {
+        if (probes[i].live && (id < 0 || (int)i == id)) probes[i].dirty = true;
+    }
+}
+
+void ReflectionProbes::release() {
+    for (Probe& probe : probes) {
+        if (probe.cube == 0) continue;
+        gpu_memory.releaseTexture(probe.cube);
+        glDeleteTextures(1, &probe.cube);
+    }
+    probes.clear();
+    live = 0;
+    capturing = -1;
+    next_dirty = 0;
+    if (capture_cube != 0) {
+        gpu_memory.releaseTexture(capture_cube);
+        glDeleteTextures(1, &capture_cube);
+    }
+    if (capture_depth != 0) glDeleteRenderbuffers(1, &capture_depth);
+    if (fbo != 0) glDeleteFramebuffers(1, &fbo);
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+    capture_cube = capture_depth = fbo = vao = 0;
+    prefilter_shader.reset();
+    failed = false;
+    for (GLuint& cube : bound) cube = 0;
+}
+
+size_t ReflectionProbes::capturedCount() const {
+    size_t n = 0;
+    for (const Probe& probe : probes) n += probe.live && probe.cube != 0;
+    return n;
+}
+
+size_t ReflectionProbes::pendingCount() const {
+    size_t n = 0;
+    for (size_t i = 0; i < probes.size(); ++i) n += probes[i].live && (probes[i].dirty || (int)i == capturing);
+    return n;
+}
+
+// The capture target and the prefilter, made with the first capture
+bool ReflectionProbes::ready() {
+    if (fbo != 0) return true;
+    if (failed) return false;
+
+    try {
+        prefilter_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/hiz.vs")),
+                                                    addShaderDefines(loadShaderFile(buildAssetPath("res/shaders/ibl_prefilter.fs")),
+                                                                     "#define LINEAR_OUTPUT\n"));
+    } catch (const std::exception& e) {
+        printf("Reflection probe prefilter shader failed (%s), reflections stay on the sky\n", e.what());
+        failed = true;
+        return false;
+    }
+
+    static const bool float_targets = hasGLExtension("GL_EXT_color_buffer_float") || hasGLExtension("EXT_color_buffer_float");
+#ifdef __EMSCRIPTEN__
+    format = float_targets ? GL_RGBA16F : GL_RGBA8;
+#else
+    (void)float_targets;
+    format = GL_RGBA16F;
+#endif
+    capture_cube = createProbeCube(format);
+
+    glGenRenderbuffers(1, &capture_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, capture_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, capture_depth);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X, capture_cube, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Reflection probe framebuffer incomplete, reflections stay on the sky\n");
+        glDeleteFramebuffers(1, &fbo);
+        fbo = 0;
+        failed = true;
+        return false;
+    }
+    glGenVertexArrays(1, &vao);
+    printf("Reflection probes: %dx%d %s faces\n", REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE,
+           format == GL_RGBA16F ? "RGBA16F" : "RGBA8");
+    return true;
+}
+
+int ReflectionProbes::update(float dt, const CaptureFace& capture) {
+    if (!use_reflection_probes || live == 0 || failed) return 0;
+
+    if (reflection_probe_refresh_seconds > 0.0f) {
+        for (Probe& probe : probes) {
+            if (!probe.live) continue;
+            probe.age += dt;
+            if (probe.age >= reflection_probe_refresh_seconds) probe.dirty = true;
+        }
+    }
+
+    int faces = 0;
+    while (faces < REFLECTION_PROBE_FACES_PER_FRAME) {
+        if (capturing < 0) {
+            for (size_t n = 0; n < probes.size(); ++n) {
+                const size_t i = (next_dirty + n) % probes.size();
+                if (probes[i].live && probes[i].dirty) {
+                    capturing = (int)i;
+                    break;
+                }
+            }
+            if (capturing < 0) break;
+            next_dirty = (size_t)capturing + 1;
+            capture_face = 0;
+            probes[capturing].dirty = false;
+            probes[capturing].age = 0.0f;
+        }
+        if (!ready()) return faces;
+
+        const Probe& probe = probes[capturing];
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + capture_face, capture_cube, 0);
+        glViewport(0, 0, REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE);
+        gl_state.colorMask(true);
+        gl_state.depthMask(true);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        RenderView face;
+        face.view = glm::lookAt(probe.position, probe.position + FACE_FORWARD[capture_face], FACE_UP[capture_face]);
+        face.projection = glm::perspective(glm::radians(90.0f), 1.0f, REFLECTION_PROBE_NEAR, REFLECTION_PROBE_FAR);
+        face.position = probe.position;
+        face.framebuffer = fbo;
+        face.viewport = glm::ivec4(0, 0, REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE);
+        face.passes = VIEW_PASS_ENTITIES | VIEW_PASS_SKY;
+        face.min_pixels = REFLECTION_PROBE_MIN_PIXELS;
+        capture(face);
+        faces++;
+
+        if (++capture_face == 6) {
+            prefilter(probes[capturing]);
+            capturing = -1;
+        }
+    }
+    return faces;
+}
+
+// The finished capture's mips as the rough lobes' source, as ibl.cpp reads the sky's
+void ReflectionProbes::prefilter(Probe& probe) {
+    gl_state.bindTexture(0, GL_TEXTURE_CUBE_MAP, capture_cube);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    if (probe.cube == 0) probe.cube = createProbeCube(format);
+    gl_state.bindTexture(0, GL_TEXTURE_CUBE_MAP, capture_cube);
+
+    const bool depthTest = gl_state.isEnabled(GL_DEPTH_TEST);
+    const bool cullFace = gl_state.isEnabled(GL_CULL_FACE);
+    const bool blend = gl_state.isEnabled(GL_BLEND);
+    gl_state.disable(GL_DEPTH_TEST);
+    gl_state.disable(GL_CULL_FACE);
+    gl_state.disable(GL_BLEND);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
+    gl_state.bindVertexArray(vao);
+    prefilter_shader->use();
+    prefilter_shader->setInt("environment", 0);
+    prefilter_shader->setFloat("sourceSize", (float)REFLECTION_PROBE_SIZE);
+    prefilter_shader->setInt("sampleCount", REFLECTION_PROBE_SAMPLES);
+    for (int mip = 0; mip < REFLECTION_PROBE_MIPS; ++mip) {
+        const int size = REFLECTION_PROBE_SIZE >> mip;
+        glViewport(0, 0, size, size);
+        prefilter_shader->setFloat("faceSize", (float)size);
+        prefilter_shader->setFloat("roughness", (float)mip / (REFLECTION_PROBE_MIPS - 1));
+        for (int face = 0; face < 6; ++face) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, probe.cube, mip);
+            prefilter_shader->setInt("face", face);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+    }
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, capture_depth);
+    gl_state.bindVertexArray(0);
+
+    gl_state.setEnabled(GL_DEPTH_TEST, depthTest);
+    gl_state.setEnabled(GL_CULL_FACE, cullFace);
+    gl_state.setEnabled(GL_BLEND, blend);
+}
+
+void ReflectionProbes::select(const glm::vec3& camera_position, LightBlock& block) {
+    block.reflection_probe_count = 0;
+    for (GLuint& cube : bound) cube = 0;
+    if (!use_reflection_probes) return;
+
+    // Nearest by the distance to the sphere, so a large probe the camera is inside beats a small
+    // one whose centre happens to be closer
+    int nearest[REFLECTION_PROBE_SLOTS];
+    float nearestDistance[REFLECTION_PROBE_SLOTS];
+    int n = 0;
+    for (size_t i = 0; i < probes.size(); ++i) {
+        const Probe& probe = probes[i];
+        if (!probe.live || probe.cube == 0) continue;
+        const float distance = glm::length(probe.position - camera_position) - probe.radius;
+        int slot = n < REFLECTION_PROBE_SLOTS ? n++ : REFLECTION_PROBE_SLOTS;
+        while (slot > 0 && nearestDistance[slot - 1] > distance) {
+            if (slot < REFLECTION_PROBE_SLOTS) {
+                nearest[slot] = nearest[slot - 1];
+                nearestDistance[slot] = nearestDistance[slot - 1];
+            }
+            slot--;
+        }
+        if (slot < REFLECTION_PROBE_SLOTS) {
+            nearest[slot] = (int)i;
+            nearestDistance[slot] = distance;
+        }
+    }
+    for (int s = 0; s < n; ++s) {
+        const Probe& probe = probes[nearest[s]];
+        block.reflection_probes[s] = glm::vec4(probe.position, probe.radius);
+        bound[s] = probe.cube;
+    }
+    block.reflection_probe_count = n;
+}
+
+void ReflectionProbes::bind() const {
+    for (int s = 0; s < REFLECTION_PROBE_SLOTS; ++s) {
+        if (bound[s] != 0) gl_state.bindTexture(REFLECTION_PROBE_UNIT + s, GL_TEXTURE_CUBE_MAP, bound[s]);
+    }
+}
+
+void ReflectionProbes::shiftOrigin(const glm::vec3& delta) {
+    for (Probe& probe : probes) probe.position -= delta;
+}
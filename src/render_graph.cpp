@@ -0,0 +1,325 @@
+#include "render_graph.h"
+#include "gl_state.h"
+#include "gpu_memory.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cstdio>
+
+RenderGraph render_graph;
+
+// What glTexImage2D takes along with each internal format it can allocate
+static bool pixelTransfer(GLenum internal_format, GLenum& format, GLenum& type) {
+    switch (internal_format) {
+    case GL_RGBA8: format = GL_RGBA; type = GL_UNSIGNED_BYTE; return true;
+    case GL_R8: format = GL_RED; type = GL_UNSIGNED_BYTE; return true;
+    case GL_RGB10_A2: format = GL_RGBA; type = GL_UNSIGNED_INT_2_10_10_10_REV; return true;
+    case GL_RGBA16F: format = GL_RGBA; type = GL_HALF_FLOAT; return true;
+    case GL_R11F_G11F_B10F: format = GL_RGB; type = GL_HALF_FLOAT; return true;
+    case GL_RG16F: format = GL_RG; type = GL_HALF_FLOAT; return true;
+    case GL_R16F: format = GL_RED; type = GL_HALF_FLOAT; return true;
+    case GL_DEPTH24_STENCIL8: format = GL_DEPTH_STENCIL; type = GL_UNSIGNED_INT_24_8; return true;
+    case GL_DEPTH_COMPONENT24: format = GL_DEPTH_COMPONENT; type = GL_UNSIGNED_INT; return true;
+    case GL_DEPTH_COMPONENT32F: format = GL_DEPTH_COMPONENT; type = GL_FLOAT; return true;
+    default: return false;
+    }
+}
+
+RenderGraph::~RenderGraph() {
+    release();
+}
+
+void RenderGraph::release() {
+    for (auto& entry : framebuffers) glDeleteFramebuffers(1, &entry.second);
+    framebuffers.clear();
+    for (PooledTexture& pooled : pool) {
+        gpu_memory.releaseTexture(pooled.texture);
+        glDeleteTextures(1, &pooled.texture);
+    }
+    pool.clear();
+    resources.clear();
+    passes.clear();
+    frame_stats = Stats();
+}
+
+RenderResource RenderGraph::Builder::read(RenderResource resource) {
+    if (resource != RENDER_RESOURCE_NONE) graph.passes[pass].reads.push_back(resource);
+    return resource;
+}
+
+RenderResource RenderGraph::Builder::write(RenderResource resource) {
+    if (resource == RENDER_RESOURCE_NONE) return resource;
+    graph.passes[pass].writes.push_back(resource);
+    std::vector<int>& writers = graph.resources[resource].writers;
+    if (writers.empty() || writers.back() != pass) writers.push_back(pass);
+    return resource;
+}
+
+void RenderGraph::Builder::sideEffect() {
+    graph.passes[pass].side_effect = true;
+}
+
+GLuint RenderGraph::Context::texture(RenderResource resource) const {
+    return resource != RENDER_RESOURCE_NONE ? graph.resources[resource].texture : 0;
+}
+
+GLuint RenderGraph::Context::framebuffer(std::initializer_list<RenderResource> colors, RenderResource depth) {
+    std::vector<GLuint> key;
+    for (RenderResource color : colors) key.push_back(texture(color));
+    key.push_back(texture(depth));
+    if (std::find(key.begin(), key.end() - 1, 0u) != key.end() - 1) return 0;
+    if (depth != RENDER_RESOURCE_NONE && key.back() == 0) return 0;
+    auto found = graph.framebuffers.find(key);
+    if (found != graph.framebuffers.end()) return found->second;
+
+    GLint previous = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    std::vector<GLenum> draw_buffers;
+    for (size_t i = 0; i < colors.size(); ++i) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (GLenum)i, GL_TEXTURE_2D, key[i], 0);
+        draw_buffers.push_back(GL_COLOR_ATTACHMENT0 + (GLenum)i);
+    }
+    if (depth != RENDER_RESOURCE_NONE) {
+        const GLenum format = graph.resources[depth].desc.internal_format;
+        const bool stencil = format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, key.back(), 0);
+    }
+    if (draw_buffers.empty()) draw_buffers.push_back(GL_NONE);
+    glDrawBuffers((GLsizei)draw_buffers.size(), draw_buffers.data());
+
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)previous);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Render graph: framebuffer incomplete (0x%x)\n", status);
+        glDeleteFramebuffers(1, &fbo);
+        return 0;
+    }
+    graph.framebuffers[key] = fbo;
+    return fbo;
+}
+
+RenderResource RenderGraph::createTexture(const char* name, const RenderTextureDesc& desc) {
+    Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    resources.push_back(resource);
+    return (RenderResource)resources.size() - 1;
+}
+
+RenderResource RenderGraph::importTexture(const char* name, GLuint texture) {
+    Resource resource;
+    resource.name = name;
+    resource.texture = texture;
+    resource.imported = true;
+    resources.push_back(resource);
+    return (RenderResource)resources.size() - 1;
+}
+
+void RenderGraph::addPass(const char* name, const std::function<void(Builder&)>& setup, std::function<void(Context&)> execute) {
+    Pass pass;
+    pass.name = name;
+    pass.run = std::move(execute);
+    passes.push_back(std::move(pass));
+    Builder builder(*this, (int)passes.size() - 1);
+    setup(builder);
+}
+
+std::vector<std::vector<RenderGraph::Dependency>> RenderGraph::dependencies() const {
+    std::vector<std::vector<Dependency>> result(passes.size());
+    for (int p = 0; p < (int)passes.size(); ++p) {
+        auto add = [&](int other, bool needs) {
+            for (Dependency& dependency : result[p]) {
+                if (dependency.pass == other) {
+                    dependency.needs = dependency.needs || needs;
+                    return;
+                }
+            }
+            result[p].push_back({other, needs});
+        };
+        auto reads = [&](int pass, RenderResource resource) {
+            const std::vector<RenderResource>& list = passes[pass].reads;
+            return std::find(list.begin(), list.end(), resource) != list.end();
+        };
+
+        // A reader takes what the writers before it left, or what every writer makes when it
+        // was declared ahead of them
+        for (RenderResource resource : passes[p].reads) {
+            const std::vector<int>& writers = resources[resource].writers;
+            const bool earlier = !writers.empty() && writers.front() < p;
+            for (int writer : writers) {
+                if (writer != p && (!earlier || writer < p)) add(writer, true);
+            }
+        }
+        // A writer may blend over the earlier writes, and waits for whoever read them
+        for (RenderResource resource : passes[p].writes) {
+            const std::vector<int>& writers = resources[resource].writers;
+            for (int writer : writers) {
+                if (writer < p) add(writer, true);
+            }
+            if (writers.empty() || writers.front() >= p) continue;
+            for (int reader = writers.front() + 1; reader < p; ++reader) {
+                if (reads(reader, resource)) add(reader, false);
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<int> RenderGraph::order(const std::vector<std::vector<Dependency>>& dependencies, std::vector<bool>& kept) {
+    const int count = (int)passes.size();
+
+    // Back from the passes whose results leave the graph, through what they need
+    kept.assign(count, false);
+    std::vector<int> stack;
+    for (int p = 0; p < count; ++p) {
+        bool root = passes[p].side_effect;
+        for (RenderResource resource : passes[p].writes) root = root || resources[resource].imported;
+        if (root) {
+            kept[p] = true;
+            stack.push_back(p);
+        }
+    }
+    while (!stack.empty()) {
+        const int p = stack.back();
+        stack.pop_back();
+        for (const Dependency& dependency : dependencies[p]) {
+            if (!dependency.needs || kept[dependency.pass]) continue;
+            kept[dependency.pass] = true;
+            stack.push_back(dependency.pass);
+        }
+    }
+
+    // Earliest declared of the passes ready each time, so independent ones keep their order
+    std::vector<int> sorted;
+    std::vector<bool> done(count, false);
+    const int kept_count = (int)std::count(kept.begin(), kept.end(), true);
+    while ((int)sorted.size() < kept_count) {
+        int next = -1;
+        for (int p = 0; p < count && next < 0; ++p) {
+            if (!kept[p] || done[p]) continue;
+            bool ready = true;
+            for (const Dependency& dependency : dependencies[p]) {
+                if (kept[dependency.pass] && !done[dependency.pass]) ready = false;
+            }
+            if (ready) next = p;
+        }
+        if (next < 0) {
+            if (!warned_cycle) printf("Render graph: passes depend on each other, running them as declared\n");
+            warned_cycle = true;
+            sorted.clear();
+            for (int p = 0; p < count; ++p) {
+                if (kept[p]) sorted.push_back(p);
+            }
+            break;
+        }
+        done[next] = true;
+        sorted.push_back(next);
+    }
+    return sorted;
+}
+
+GLuint RenderGraph::acquire(const RenderTextureDesc& desc) {
+    for (PooledTexture& pooled : pool) {
+        if (pooled.taken || !(pooled.desc == desc)) continue;
+        pooled.taken = true;
+        pooled.used = executes;
+        return pooled.texture;
+    }
+
+    GLenum format, type;
+    if (!pixelTransfer(desc.internal_format, format, type) || desc.width <= 0 || desc.height <= 0) {
+        printf("Render graph: can't allocate a %dx%d target of format 0x%x\n", desc.width, desc.height, desc.internal_format);
+        return 0;
+    }
+    PooledTexture pooled;
+    pooled.desc = desc;
+    pooled.taken = true;
+    pooled.used = executes;
+    glGenTextures(1, &pooled.texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, pooled.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, desc.internal_format, desc.width, desc.height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+    gpu_memory.trackTexture(pooled.texture, textureLevelBytes(desc.internal_format, desc.width, desc.height),
+                            GPU_MEMORY_RENDER_TARGETS, "render graph");
+    pool.push_back(pooled);
+    return pooled.texture;
+}
+
+void RenderGraph::trim() {
+    for (size_t i = 0; i < pool.size();) {
+        PooledTexture& pooled = pool[i];
+        if (executes - pooled.used <= RENDER_GRAPH_KEEP_FRAMES) {
+            ++i;
+            continue;
+        }
+        for (auto it = framebuffers.begin(); it != framebuffers.end();) {
+            if (std::find(it->first.begin(), it->first.end(), pooled.texture) == it->first.end()) {
+                ++it;
+                continue;
+            }
+            glDeleteFramebuffers(1, &it->second);
+            it = framebuffers.erase(it);
+        }
+        gpu_memory.releaseTexture(pooled.texture);
+        glDeleteTextures(1, &pooled.texture);
+        pool.erase(pool.begin() + i);
+    }
+}
+
+void RenderGraph::execute() {
+    std::vector<bool> kept;
+    const std::vector<int> sorted = order(dependencies(), kept);
+
+    // Each transient's span over the passes that run
+    for (int position = 0; position < (int)sorted.size(); ++position) {
+        const Pass& pass = passes[sorted[position]];
+        for (const std::vector<RenderResource>* list : { &pass.reads, &pass.writes }) {
+            for (RenderResource resource : *list) {
+                Resource& used = resources[resource];
+                if (used.first < 0) used.first = position;
+                used.last = position;
+            }
+        }
+    }
+
+    // Taken at the start of a span and given back after its end, for a later span to reuse
+    frame_stats = Stats();
+    frame_stats.passes = (int)passes.size();
+    frame_stats.culled = (int)(passes.size() - sorted.size());
+    for (int position = 0; position < (int)sorted.size(); ++position) {
+        for (Resource& resource : resources) {
+            if (resource.imported || resource.first != position) continue;
+            resource.texture = acquire(resource.desc);
+            frame_stats.transients++;
+            frame_stats.transient_bytes += textureLevelBytes(resource.desc.internal_format, resource.desc.width, resource.desc.height);
+        }
+        for (const Resource& resource : resources) {
+            if (resource.imported || resource.last != position) continue;
+            for (PooledTexture& pooled : pool) {
+                if (pooled.texture == resource.texture) pooled.taken = false;
+            }
+        }
+    }
+
+    Context context(*this);
+    for (int p : sorted) {
+        const int scope = profiler.push(passes[p].name);
+        passes[p].run(context);
+        profiler.pop(scope);
+    }
+
+    executes++;
+    trim();
+    for (const PooledTexture& pooled : pool) {
+        frame_stats.pooled++;
+        frame_stats.pooled_bytes += textureLevelBytes(pooled.desc.internal_format, pooled.desc.width, pooled.desc.height);
+    }
+    resources.clear();
+    passes.clear();
+}
@@ -0,0 +1,67 @@
+#include "render_prototype.h"
+#include "mesh.h"
+#include "impostor.h"
+
+RenderPrototypes render_prototypes;
+
+const std::vector<RenderLODLevel> RenderPrototypes::no_levels;
+
+static size_t hashLevels(const std::vector<RenderLODLevel>& levels) {
+    size_t hash = levels.size();
+    auto mix = [&](size_t value) { hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2); };
+    for (const RenderLODLevel& level : levels) {
+        for (const auto& mesh : level.meshes) mix(std::hash<const Mesh*>()(mesh.get()));
+        mix(std::hash<const Impostor*>()(level.impostor.get()));
+        mix(std::hash<float>()(level.maxDistance));
+    }
+    return hash;
+}
+
+static bool sameLevels(const std::vector<RenderLODLevel>& a, const std::vector<RenderLODLevel>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].meshes != b[i].meshes || a[i].impostor != b[i].impostor || a[i].maxDistance != b[i].maxDistance) return false;
+    }
+    return true;
+}
+
+uint32_t RenderPrototypes::create(std::vector<RenderLODLevel> levels) {
+    const size_t hash = hashLevels(levels);
+    auto [first, last] = by_hash.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+        if (sameLevels(prototypes[it->second].levels, levels)) return it->second;
+    }
+
+    uint32_t id;
+    if (!free_ids.empty()) {
+        id = free_ids.back();
+        free_ids.pop_back();
+    } else {
+        id = (uint32_t)prototypes.size();
+        prototypes.emplace_back();
+    }
+    prototypes[id].levels = std::move(levels);
+    prototypes[id].users = 0;
+    by_hash.emplace(hash, id);
+    return id;
+}
+
+void RenderPrototypes::retain(uint32_t id) {
+    if (id < prototypes.size()) prototypes[id].users++;
+}
+
+void RenderPrototypes::release(uint32_t id) {
+    if (id >= prototypes.size() || prototypes[id].users == 0) return;
+    if (--prototypes[id].users > 0) return;
+    auto [first, last] = by_hash.equal_range(hashLevels(prototypes[id].levels));
+    for (auto it = first; it != last; ++it) {
+        if (it->second == id) {
+            by_hash.erase(it);
+            break;
+        }
+    }
+    // The meshes go now, so MeshRegistry can evict them
+    prototypes[id].levels.clear();
+    prototypes[id].levels.shrink_to_fit();
+    free_ids.push_back(id);
+}
@@ -0,0 +1,55 @@
+#include "render_view.h"
+#include "gl_state.h"
+#include "gpu_memory.h"
+#include "scene_target.h"
+
+#include <cstdio>
+
+ViewTarget::~ViewTarget() {
+    release();
+}
+
+bool ViewTarget::resize(int width, int height) {
+    if (fbo != 0 && width == target_width && height == target_height) return true;
+    release();
+
+    glGenTextures(1, &color);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gpu_memory.trackTexture(color, textureLevelBytes(GL_RGBA8, width, height), GPU_MEMORY_TEXTURES, "view target");
+
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    if (!complete) {
+        printf("View target %dx%d incomplete\n", width, height);
+        release();
+        return false;
+    }
+    target_width = width;
+    target_height = height;
+    return true;
+}
+
+void ViewTarget::release() {
+    if (color != 0) {
+        gpu_memory.releaseTexture(color);
+        glDeleteTextures(1, &color);
+    }
+    if (depth != 0) glDeleteRenderbuffers(1, &depth);
+    if (fbo != 0) glDeleteFramebuffers(1, &fbo);
+    fbo = color = depth = 0;
+    target_width = target_height = 0;
+}
@@ -5,17 +5,43 @@
 #include "mesh.h"
 #include "light.h"
 #include "shader_loading.h"
+#include "impostor.h"
+#include "scene_target.h"
+#include "temporal_aa.h"
+#include "frustum.h"
+#include "gpu_culling.h"
+#include "static_batches.h"
+#include "job_system.h"
+#include "instance_ring.h"
+#include "gl_state.h"
+#include "frame_uniforms.h"
+#include "ibl.h"
+#include "lightmap.h"
+#include "profiler.h"
+#include "draw_capture.h"
+#include "texture_residency.h"
+#include "skinning.h"
+#include "particles.h"
+#include "texture_atlas.h"
+#include "terrain.h"
+#include "foliage.h"
+#include "reflection_probes.h"
+#include "render_view.h"
+#include "render_graph.h"
+#include "portal_visibility.h"
+#include "volumetric_fog.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <cstdio>
 #include <unordered_map>
 #include <algorithm>
+#include <cmath>
+#include <atomic>
 
 // Extern declarations
 extern glm::mat4 view;
 extern glm::mat4 projection;
-extern glm::mat4 lightSpaceMatrix;
 extern GLuint shadowMapFBO;
 extern GLuint shadowMapTexture;
 extern unsigned int SHADOW_WIDTH;
@@ -26,538 +52,2509 @@ extern std::vector<Light> lights;
 
 std::string buildAssetPath(const std::string& relative_path);
 
-// Material batching hash functions
-struct MaterialHash {
-    size_t operator()(const Material* mat) const {
-        size_t h1 = std::hash<GLuint>{}(mat->albedo_map);
-        size_t h2 = std::hash<GLuint>{}(mat->normal_map);
-        size_t h3 = std::hash<GLuint>{}(mat->orm_map);
-        size_t h4 = std::hash<GLuint>{}(mat->emissive_map);
-        return h1 ^ (h2 << 1) ^ (h3 << 2) ^ (h4 << 3);
-    }
-};
+float lod_bias = 0.0f;
+float lod_hysteresis = 0.1f;
+bool lod_auto_bias = false;
+float lod_frame_budget_ms = 16.6f;
+float shadow_lod_bias = 1.0f;
+bool use_lod_crossfade = true;
+float small_object_cull_pixels = 1.0f;
+float shadow_small_object_cull_pixels = 4.0f;
+bool use_shading_lod = true;
+int shading_lod_far_level = 2;
+float shading_lod_far_distance = 40.0f;
+bool use_sorted_instancing = true;
+DepthPrepassMode depth_prepass_mode = PREPASS_ALWAYS;
+const char* const DEPTH_PREPASS_MODE_NAMES[PREPASS_MODE_COUNT] = { "Always", "Never", "Heavy materials", "Auto" };
+float depth_prepass_min_screen_size = 0.0f;
 
-struct MaterialEqual {
-    bool operator()(const Material* a, const Material* b) const {
-        return a->albedo_map == b->albedo_map &&
-               a->normal_map == b->normal_map &&
-               a->orm_map == b->orm_map &&
-               a->emissive_map == b->emissive_map &&
-               std::abs(a->metallic - b->metallic) < 0.01f &&
-               std::abs(a->roughness - b->roughness) < 0.01f;
-    }
+#define RENDER_STATS_COUNTER(field) { #field, [](const Renderer::RenderStats& stats) { return (double)stats.field; } }
+const RenderStatsCounter RENDER_STATS_COUNTERS[] = {
+    RENDER_STATS_COUNTER(entitiesTotal),
+    RENDER_STATS_COUNTER(entitiesCulled),
+    RENDER_STATS_COUNTER(entitiesOccluded),
+    RENDER_STATS_COUNTER(entitiesTooSmall),
+    RENDER_STATS_COUNTER(meshletsTested),
+    RENDER_STATS_COUNTER(meshletsCulled),
+    RENDER_STATS_COUNTER(entitiesRendered),
+    RENDER_STATS_COUNTER(drawCalls),
+    RENDER_STATS_COUNTER(instancedDrawCalls),
+    RENDER_STATS_COUNTER(instancesRendered),
+    RENDER_STATS_COUNTER(submittedDrawCalls),
+    RENDER_STATS_COUNTER(materialChanges),
+    RENDER_STATS_COUNTER(trianglesRendered),
+    RENDER_STATS_COUNTER(impostorsRendered),
+    RENDER_STATS_COUNTER(staticChunksRendered),
+    RENDER_STATS_COUNTER(stateChanges),
+    RENDER_STATS_COUNTER(stateChangesSkipped),
+    RENDER_STATS_COUNTER(uniformUploads),
+    RENDER_STATS_COUNTER(uniformUploadsSkipped),
+    RENDER_STATS_COUNTER(shadowCastersDrawn),
+    RENDER_STATS_COUNTER(shadowCastersCulled),
+    RENDER_STATS_COUNTER(shadowViewsCached),
+    RENDER_STATS_COUNTER(shadowViewsReused),
+    RENDER_STATS_COUNTER(shadowedLights),
+    RENDER_STATS_COUNTER(shadowAtlasTexels),
+    RENDER_STATS_COUNTER(clusterLights),
+    RENDER_STATS_COUNTER(clusterIndices),
+    RENDER_STATS_COUNTER(clusterMaxLights),
 };
+#undef RENDER_STATS_COUNTER
+const size_t RENDER_STATS_COUNTER_COUNT = sizeof(RENDER_STATS_COUNTERS) / sizeof(RENDER_STATS_COUNTERS[0]);
 
-// Frustum culling
-struct Frustum {
-    glm::vec4 planes[6];
-    
-    void extractFromMatrix(const glm::mat4& vp) {
-        planes[0] = glm::vec4(vp[0][3] + vp[0][0], vp[1][3] + vp[1][0], vp[2][3] + vp[2][0], vp[3][3] + vp[3][0]);
-        planes[1] = glm::vec4(vp[0][3] - vp[0][0], vp[1][3] - vp[1][0], vp[2][3] - vp[2][0], vp[3][3] - vp[3][0]);
-        planes[2] = glm::vec4(vp[0][3] + vp[0][1], vp[1][3] + vp[1][1], vp[2][3] + vp[2][1], vp[3][3] + vp[3][1]);
-        planes[3] = glm::vec4(vp[0][3] - vp[0][1], vp[1][3] - vp[1][1], vp[2][3] - vp[2][1], vp[3][3] - vp[3][1]);
-        planes[4] = glm::vec4(vp[0][3] + vp[0][2], vp[1][3] + vp[1][2], vp[2][3] + vp[2][2], vp[3][3] + vp[3][2]);
-        planes[5] = glm::vec4(vp[0][3] - vp[0][2], vp[1][3] - vp[1][2], vp[2][3] - vp[2][2], vp[3][3] - vp[3][2]);
-        
-        for (int i = 0; i < 6; i++) {
-            float len = glm::length(glm::vec3(planes[i]));
-            planes[i] /= len;
-        }
-    }
-    
-    bool sphereInFrustum(const glm::vec3& center, float radius) const {
-        for (int i = 0; i < 6; i++) {
-            if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius) 
-                return false;
-        }
-        return true;
-    }
-};
+// Uniforms set per draw, material, view or tile, hashed at compile time
+static constexpr UniformId U_MATERIAL_INDEX("materialIndex");
+static constexpr UniformId U_HAS_ALBEDO_MAP("hasAlbedoMap");
+static constexpr UniformId U_BOUNDS_CENTER("boundsCenter");
+static constexpr UniformId U_BOUNDS_RADIUS("boundsRadius");
+static constexpr UniformId U_FRAMES("frames");
+static constexpr UniformId U_SHADOW_VIEW("shadowView");
+static constexpr UniformId U_TILE_RECT("tileRect");
+static constexpr UniformId U_LAYER("layer");
+static constexpr UniformId U_BLUR_PASS("blurPass");
+static constexpr UniformId U_PREVIOUS_MODEL("previousModel");
+static constexpr UniformId U_PALETTE_BASE("paletteBase");
+static constexpr UniformId U_BAKED_FRAMES("bakedFrames");
+static constexpr UniformId U_BAKED_FPS("bakedFps");
+static constexpr UniformId U_ANIMATION_TIME("animationTime");
+
+// Fixed-function state of the passes (see PipelineState). Most pick programs and vertex arrays
+// per draw and cull as each mesh asks, those leave them to the draws.
+static constexpr PipelineState PIPELINE_SHADOW_CASTERS = PipelineState().colorWrite(false).cull(PIPELINE_CULL_PER_DRAW);
+static constexpr PipelineState PIPELINE_DEPTH_PREPASS = PipelineState().colorWrite(false).cull(PIPELINE_CULL_PER_DRAW);
+static constexpr PipelineState PIPELINE_FULLSCREEN = PipelineState().depth(false).depthWrite(false).cull(CULL_NONE);
+// Without a complete prepass the draws switch between these two themselves
+static constexpr PipelineState PIPELINE_OPAQUE = PipelineState().depth(true, GL_LEQUAL).cull(PIPELINE_CULL_PER_DRAW);
+static constexpr PipelineState PIPELINE_OPAQUE_PREPASSED = PIPELINE_OPAQUE.depth(true, GL_EQUAL).depthWrite(false);
+// Skinned meshes aren't in the prepass, they test and write their own depth after the opaques
+static constexpr PipelineState PIPELINE_SKINNED = PIPELINE_OPAQUE;
+// Nor is the terrain, whose chunks all wind the same way
+static constexpr PipelineState PIPELINE_TERRAIN = PIPELINE_OPAQUE.cull(CULL_BACK);
+// Nor is foliage, which culls per mesh like the opaques
+static constexpr PipelineState PIPELINE_FOLIAGE = PIPELINE_OPAQUE;
+// Captured draws over the scene's depth without writing it, so every issue shades the same pixels
+static constexpr PipelineState PIPELINE_DRAW_REPLAY = PIPELINE_OPAQUE.depthWrite(false);
+static constexpr PipelineState PIPELINE_TRANSPARENT_SORTED =
+    PipelineState().blending(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA).cull(PIPELINE_CULL_PER_DRAW);
+static constexpr PipelineState PIPELINE_LIGHT_PROXIES = PipelineState().cull(CULL_NONE);
+static constexpr PipelineState PIPELINE_MOTION_VECTORS = PipelineState().cull(PIPELINE_CULL_PER_DRAW);
+
+// Names of the MATERIAL_FLAG_* bits in pbr.fs, in bit order, then the shading tier and the alpha test
+static const char* const PBR_FEATURES[] = { "HAS_ALBEDO_MAP", "HAS_NORMAL_MAP", "HAS_ORM_MAP", "HAS_HEIGHT_MAP",
+                                            "HAS_EMISSIVE_MAP", "HAS_LIGHTMAP", "SHADING_LOD_FAR", "ALPHA_MASKED" };
+#define PBR_FEATURE_SHADING_LOD_FAR 64
+// Highest bit, so the masked draws sort after every opaque one
+#define PBR_FEATURE_ALPHA_MASKED 128
+
+// The variant a material draws with. The far tier never samples normal or height maps, and only
+// MASKED materials get the variant with a discard, the rest keep early depth rejection.
+static uint32_t pbrFeatures(const Material& material, bool far_shading) {
+    uint32_t features = materialFeatures(material);
+    if (material.alphaMode == MASKED && material.hasAlbedoMap()) features |= PBR_FEATURE_ALPHA_MASKED;
+    if (!far_shading) return features;
+    return (features & ~(uint32_t)(MATERIAL_FLAG_NORMAL_MAP | MATERIAL_FLAG_HEIGHT_MAP)) | PBR_FEATURE_SHADING_LOD_FAR;
+}
+
+// Draw sort state: the variant first so each program's draws run together, then the table id,
+// then the shading tier. Ids past 13 bits share a sort slot, the draw list still splits on the
+// material itself.
+static uint32_t materialSortState(uint32_t features, uint32_t material_id, bool far_shading = false) {
+    return (features << 14) | (std::min<uint32_t>(material_id, 0x1fff) << 1) | (far_shading ? 1u : 0u);
+}
+
+// Opaque draw state: the material, with the far shading tier in bit 0 and whether the depth
+// prepass drew it in bit 1, so neither merges across
+static const void* opaqueDrawState(const Material* material, bool far_shading, bool prepassed) {
+    return (const void*)((uintptr_t)material | (far_shading ? 1u : 0u) | (prepassed ? 2u : 0u));
+}
 
 Renderer::Renderer() {
     try {
-        std::string pbr_vert = loadShaderFile(buildAssetPath("res/shaders/pbr.vs"));
-        std::string pbr_frag = loadShaderFile(buildAssetPath("res/shaders/pbr.fs"));
+        // Texture units never change, so every variant's samplers are set once at link
+        auto pbr_setup = [](Shader& shader, uint32_t features) {
+            bindFrameUniformBlocks(shader);
+            shader.bindUniformBlock("MaterialBlock", MATERIAL_BLOCK_BINDING);
+            shader.use();
+            if (features & MATERIAL_FLAG_ALBEDO_MAP) {
+                shader.setInt("albedoMap", 0);
+                shader.setInt("albedoAtlas", TEXTURE_ATLAS_UNIT);
+            }
+            if (features & MATERIAL_FLAG_NORMAL_MAP) shader.setInt("normalMap", 1);
+            if (features & (MATERIAL_FLAG_ORM_MAP | MATERIAL_FLAG_HEIGHT_MAP)) shader.setInt("ormMap", 2);
+            if (features & MATERIAL_FLAG_EMISSIVE_MAP) shader.setInt("emissiveMap", 3);
+            if (features & MATERIAL_FLAG_LIGHTMAP) shader.setInt("lightmapAtlas", 15);
+            shader.setInt("shadowMap", 4);
+            shader.setInt("shadowMoments", 5);
+            shader.setInt("clusterLights", 6);
+            shader.setInt("clusterGrid", 7);
+            shader.setInt("clusterIndices", 8);
+            shader.setInt("iblSpecular", 13);
+            shader.setInt("iblBrdf", 14);
+            shader.setInt("reflectionProbe0", REFLECTION_PROBE_UNIT);
+            shader.setInt("reflectionProbe1", REFLECTION_PROBE_UNIT + 1);
+            // Shares the G-buffer's first unit, only the variants writing colour or the G-buffer read it
+            shader.setInt("ambientOcclusionMap", 9);
+            shader.setInt("volumetricFog", VOLUMETRIC_FOG_UNIT);
+        };
+        const std::vector<std::string> pbr_features(std::begin(PBR_FEATURES), std::end(PBR_FEATURES));
+        pbr_variants = std::make_unique<ShaderVariants>(buildAssetPath("res/shaders/pbr.vs"), buildAssetPath("res/shaders/pbr.fs"),
+                                                        pbr_features, pbr_setup);
+        // Without them blended materials just keep the sorted path
+        try {
+            pbr_oit_variants = std::make_unique<ShaderVariants>(buildAssetPath("res/shaders/pbr.vs"), buildAssetPath("res/shaders/pbr.fs"),
+                                                                pbr_features, pbr_setup, "#define OIT_OUTPUT\n");
+        } catch (const std::exception& e) {
+            printf("Weighted OIT shaders failed (%s), using sorted transparency\n", e.what());
+        }
+        try {
+            pbr_skinned_variants = std::make_unique<ShaderVariants>(
+                buildAssetPath("res/shaders/pbr.vs"), buildAssetPath("res/shaders/pbr.fs"), pbr_features,
+                [pbr_setup](Shader& shader, uint32_t features) {
+                    pbr_setup(shader, features);
+                    shader.setInt("bonePalette", SKIN_PALETTE_UNIT);
+                },
+                "#define SKINNED\n");
+        } catch (const std::exception& e) {
+            printf("Skinned shaders failed (%s), skinned models won't draw\n", e.what());
+        }
+        try {
+            pbr_terrain_variants = std::make_unique<ShaderVariants>(
+                buildAssetPath("res/shaders/pbr.vs"), buildAssetPath("res/shaders/pbr.fs"), pbr_features,
+                [pbr_setup](Shader& shader, uint32_t features) {
+                    pbr_setup(shader, features);
+                    shader.setInt("terrainHeights", TERRAIN_HEIGHT_UNIT);
+                    shader.setInt("terrainSplat", TERRAIN_SPLAT_UNIT);
+                },
+                "#define TERRAIN\n");
+        } catch (const std::exception& e) {
+            printf("Terrain shaders failed (%s), the terrain won't draw\n", e.what());
+        }
+        try {
+            pbr_foliage_variants = std::make_unique<ShaderVariants>(buildAssetPath("res/shaders/pbr.vs"), buildAssetPath("res/shaders/pbr.fs"),
+                                                                    pbr_features, pbr_setup, "#define FOLIAGE\n");
+        } catch (const std::exception& e) {
+            printf("Foliage shaders failed (%s), foliage won't draw\n", e.what());
+        }
+        // Deferred shading needs both halves, without them the opaques stay forward
+        try {
+            pbr_gbuffer_variants = std::make_unique<ShaderVariants>(buildAssetPath("res/shaders/pbr.vs"), buildAssetPath("res/shaders/pbr.fs"),
+                                                                    pbr_features, pbr_setup, "#define GBUFFER_OUTPUT\n");
+            deferred_lighting_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/hiz.vs")),
+                                                                addShaderDefines(loadShaderFile(buildAssetPath("res/shaders/pbr.fs")),
+                                                                                 "#define DEFERRED_LIGHTING\n"));
+            pbr_setup(*deferred_lighting_shader, 0);
+            deferred_lighting_shader->setInt("gAlbedo", 9);
+            deferred_lighting_shader->setInt("gNormal", 10);
+            deferred_lighting_shader->setInt("gMaterial", 11);
+            deferred_lighting_shader->setInt("gDepth", 12);
+        } catch (const std::exception& e) {
+            printf("Deferred shaders failed (%s), shading forward\n", e.what());
+            pbr_gbuffer_variants.reset();
+            deferred_lighting_shader.reset();
+        }
+        try {
+            lightmap_bake_shader = std::make_unique<Shader>(addShaderDefines(loadShaderFile(buildAssetPath("res/shaders/pbr.vs")),
+                                                                             "#define LIGHTMAP_BAKE\n"),
+                                                            addShaderDefines(loadShaderFile(buildAssetPath("res/shaders/pbr.fs")),
+                                                                             "#define LIGHTMAP_BAKE\n"));
+            pbr_setup(*lightmap_bake_shader, 0);
+            lightmap_bake_shader->setInt("bakeLights", 9);
+        } catch (const std::exception& e) {
+            printf("Lightmap bake shader failed (%s), lightmaps disabled\n", e.what());
+        }
+
         std::string shadow_vert = loadShaderFile(buildAssetPath("res/shaders/shadow.vs"));
         std::string shadow_frag = loadShaderFile(buildAssetPath("res/shaders/shadow.fs"));
         std::string unlit_vert = loadShaderFile(buildAssetPath("res/shaders/unlit.vs"));
         std::string unlit_frag = loadShaderFile(buildAssetPath("res/shaders/unlit.fs"));
         std::string prepass_vert = loadShaderFile(buildAssetPath("res/shaders/depth_prepass.vs"));
         std::string prepass_frag = loadShaderFile(buildAssetPath("res/shaders/depth_prepass.fs"));
+        std::string impostor_vert = loadShaderFile(buildAssetPath("res/shaders/impostor.vs"));
+        std::string impostor_frag = loadShaderFile(buildAssetPath("res/shaders/impostor.fs"));
+
+        // Both members of a depth pair from the same sources, the masked one with ALPHA_TEST
+        auto depthPrograms = [](const std::string& vert, const std::string& geom, const std::string& frag) {
+            auto define = [](const std::string& source) { return addShaderDefines(source, "#define ALPHA_TEST\n"); };
+            DepthPrograms programs;
+            if (geom.empty()) {
+                programs.opaque = std::make_unique<Shader>(vert, frag);
+                programs.masked = std::make_unique<Shader>(define(vert), define(frag));
+            } else {
+                programs.opaque = std::make_unique<Shader>(vert, geom, frag);
+                programs.masked = std::make_unique<Shader>(define(vert), define(geom), define(frag));
+            }
+            for (Shader* shader : { programs.opaque.get(), programs.masked.get() }) bindFrameUniformBlocks(*shader);
+            return programs;
+        };
+
+        // The prepass and plain shadow programs again over the vertex pulling pool. Losing them
+        // only turns vertex pulling off.
+        auto pulledPrograms = [&](DepthPrograms& programs, const std::string& vert, const std::string& geom, const std::string& frag,
+                                  const char* sampler) {
+            if (!vertex_pulling.pooling()) return;
+            try {
+                DepthPrograms pulled = depthPrograms(VertexPulling::pulledSource(vert), geom, frag);
+                pulled.masked->use();
+                pulled.masked->setInt(sampler, 0);
+                programs.pulled_opaque = std::move(pulled.opaque);
+                programs.pulled_masked = std::move(pulled.masked);
+            } catch (const std::exception& e) {
+                printf("Vertex pulling shaders failed (%s), depth passes keep their VAOs\n", e.what());
+                use_vertex_pulling = false;
+            }
+        };
 
-        pbr_shader = std::make_unique<Shader>(pbr_vert, pbr_frag);
-        shadow_shader = std::make_unique<Shader>(shadow_vert, shadow_frag);
+        shadow_programs = depthPrograms(shadow_vert, "", shadow_frag);
+        pulledPrograms(shadow_programs, shadow_vert, "", shadow_frag, "u_texture");
+        auto skinned = [](const std::string& source) { return addShaderDefines(source, "#define SKINNED\n"); };
+        try {
+            shadow_skinned_programs = depthPrograms(skinned(shadow_vert), "", shadow_frag);
+        } catch (const std::exception& e) {
+            printf("Skinned shadow shaders failed (%s), skinned models cast no shadows\n", e.what());
+        }
+        auto bending = [](const std::string& source) { return addShaderDefines(source, "#define FOLIAGE\n"); };
+        try {
+            shadow_foliage_programs = depthPrograms(bending(shadow_vert), "", shadow_frag);
+        } catch (const std::exception& e) {
+            printf("Foliage shadow shaders failed (%s), foliage casts no shadows\n", e.what());
+        }
         unlit_shader = std::make_unique<Shader>(unlit_vert, unlit_frag);
-        depth_prepass_shader =  std::make_unique<Shader>(prepass_vert, prepass_frag);
+        depth_prepass_programs = depthPrograms(prepass_vert, "", prepass_frag);
+        pulledPrograms(depth_prepass_programs, prepass_vert, "", prepass_frag, "albedoMap");
+        impostor_shader = std::make_unique<Shader>(impostor_vert, impostor_frag);
+        try {
+            impostor_foliage_shader = std::make_unique<Shader>(bending(impostor_vert), impostor_frag);
+            bindFrameUniformBlocks(*impostor_foliage_shader);
+            impostor_foliage_shader->use();
+            impostor_foliage_shader->setInt("albedoAtlas", 0);
+            impostor_foliage_shader->setInt("normalDepthAtlas", 1);
+            impostor_foliage_shader->setInt("volumetricFog", VOLUMETRIC_FOG_UNIT);
+        } catch (const std::exception& e) {
+            printf("Foliage impostor shader failed (%s), foliage impostor tiers won't draw\n", e.what());
+        }
         printf("Shaders created successfully. Main: %u, Shadow: %u, Unlit: %u, Prepass: %u\n",
-               pbr_shader->getProgram(), shadow_shader->getProgram(), unlit_shader->getProgram(), depth_prepass_shader->getProgram());
+               pbr_variants->get(pbr_variants->allFeatures()).getProgram(), shadow_programs.opaque->getProgram(), unlit_shader->getProgram(),
+               depth_prepass_programs.opaque->getProgram());
+
+        // Camera, light and shadow globals come from the shared blocks
+        for (Shader* shader : { unlit_shader.get(), impostor_shader.get() }) {
+            bindFrameUniformBlocks(*shader);
+        }
+
+        // Texture units never change, so the samplers are set once here
+        shadow_programs.masked->use();
+        shadow_programs.masked->setInt("u_texture", 0);
+        if (shadow_skinned_programs.opaque) {
+            for (Shader* shader : { shadow_skinned_programs.opaque.get(), shadow_skinned_programs.masked.get() }) {
+                shader->use();
+                shader->setInt("bonePalette", SKIN_PALETTE_UNIT);
+            }
+            shadow_skinned_programs.masked->setInt("u_texture", 0);
+        }
+        if (shadow_foliage_programs.masked) {
+            shadow_foliage_programs.masked->use();
+            shadow_foliage_programs.masked->setInt("u_texture", 0);
+        }
+
+        // Point light faces in one layered pass, they fall back to a pass per face without it
+        if (gl_extensions.layered_rendering) {
+            try {
+                const bool invocations = gl_extensions.geometry_shader_invocations;
+                const char* version = invocations ? "#version 400 core\n" : "#version 330 core\n";
+                std::string cube_vert = addShaderDefines(loadShaderFile(buildAssetPath("res/shaders/shadow.vs"), version), "#define SHADOW_LAYERED\n");
+                std::string cube_geom = loadShaderFile(buildAssetPath("res/shaders/shadow_cube.gs"), version);
+                if (invocations) cube_geom = addShaderDefines(cube_geom, "#define SHADOW_GS_INVOCATIONS\n");
+                std::string cube_frag = loadShaderFile(buildAssetPath("res/shaders/shadow.fs"), version);
+                shadow_cube_programs = depthPrograms(cube_vert, cube_geom, cube_frag);
+                shadow_cube_programs.masked->use();
+                shadow_cube_programs.masked->setInt("u_texture", 0);
+                pulledPrograms(shadow_cube_programs, cube_vert, cube_geom, cube_frag, "u_texture");
+                try {
+                    shadow_skinned_cube_programs = depthPrograms(skinned(cube_vert), cube_geom, cube_frag);
+                    for (Shader* shader : { shadow_skinned_cube_programs.opaque.get(), shadow_skinned_cube_programs.masked.get() }) {
+                        shader->use();
+                        shader->setInt("bonePalette", SKIN_PALETTE_UNIT);
+                    }
+                    shadow_skinned_cube_programs.masked->setInt("u_texture", 0);
+                } catch (const std::exception& e) {
+                    printf("Skinned layered shadow shaders failed (%s), skinned models cast no point light shadows\n", e.what());
+                }
+                try {
+                    shadow_foliage_cube_programs = depthPrograms(bending(cube_vert), cube_geom, cube_frag);
+                    shadow_foliage_cube_programs.masked->use();
+                    shadow_foliage_cube_programs.masked->setInt("u_texture", 0);
+                } catch (const std::exception& e) {
+                    printf("Foliage layered shadow shaders failed (%s), foliage casts no point light shadows\n", e.what());
+                }
+            } catch (const std::exception& e) {
+                printf("Layered shadow shaders failed (%s), point lights render a pass per face\n", e.what());
+            }
+        }
+        try {
+            shadow_moments_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/hiz.vs")),
+                                                             loadShaderFile(buildAssetPath("res/shaders/shadow_moments.fs")));
+            shadow_moments_shader->use();
+            shadow_moments_shader->setInt("depthMap", 0);
+            shadow_moments_shader->setInt("blurredRows", 1);
+        } catch (const std::exception& e) {
+            printf("Shadow moments shader failed (%s), the moments filter falls back to soft\n", e.what());
+        }
+        try {
+            motion_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/taa_motion.vs")),
+                                                     loadShaderFile(buildAssetPath("res/shaders/taa_motion.fs")));
+            bindFrameUniformBlocks(*motion_shader);
+        } catch (const std::exception& e) {
+            printf("Motion vector shader failed (%s), TAA reprojects by camera motion only\n", e.what());
+        }
+        depth_prepass_programs.masked->use();
+        depth_prepass_programs.masked->setInt("albedoMap", 0);
+        impostor_shader->use();
+        impostor_shader->setInt("albedoAtlas", 0);
+        impostor_shader->setInt("normalDepthAtlas", 1);
+        impostor_shader->setInt("volumetricFog", VOLUMETRIC_FOG_UNIT);
     } catch (const std::exception& e) {
         printf("Failed to create shaders: %s\n", e.what());
         throw;
     }
+
+    initImpostorQuad();
+    glGenVertexArrays(1, &fullscreenVAO);
 }
 
-void Renderer::cullEntities(EntityManager& entity_manager, const glm::mat4& viewProj) {
-    visibleEntities.clear();
-    
-    Frustum frustum;
-    frustum.extractFromMatrix(viewProj);
+Renderer::~Renderer() {
+    if (impostorVAO != 0) glDeleteVertexArrays(1, &impostorVAO);
+    if (fullscreenVAO != 0) glDeleteVertexArrays(1, &fullscreenVAO);
+    if (impostorQuadVBO != 0) glDeleteBuffers(1, &impostorQuadVBO);
+}
+
+void Renderer::initImpostorQuad() {
+    const float corners[8] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+    glGenVertexArrays(1, &impostorVAO);
+    glGenBuffers(1, &impostorQuadVBO);
+    gl_state.bindVertexArray(impostorVAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, impostorQuadVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+
+    // Same instance slots as meshes (matrix in 6-9, LOD fade in 10), pointed per batch
+    gl_state.bindVertexArray(0);
+}
+
+// Shared by the prepass and the main pass so both write identical depth for GL_EQUAL
+void Renderer::renderImpostors(const ImpostorBatches& batches) {
+    if (batches.empty()) return;
+
+    impostor_shader->use();
+
+    gl_state.disable(GL_CULL_FACE);
+    gl_state.bindVertexArray(impostorVAO);
+
+    for (const auto& [impostor, batch] : batches) {
+        if (batch.empty()) continue;
+
+        size_t count = batch.size();
+        pointInstanceRange(instance_ring.write(batch.matrices.data(), batch.fades.data(), count));
+
+        gl_state.bindTextureUnit(0, GL_TEXTURE_2D, impostor->albedo_atlas);
+        gl_state.bindTextureUnit(1, GL_TEXTURE_2D, impostor->normal_depth_atlas);
+        impostor_shader->setVec3(U_BOUNDS_CENTER, impostor->center);
+        impostor_shader->setFloat(U_BOUNDS_RADIUS, impostor->radius);
+        impostor_shader->setFloat(U_FRAMES, (float)impostor->frames);
+
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)count);
+        stats.instancedDrawCalls++;
+        stats.impostorsRendered += (int)count;
+        stats.trianglesRendered += 2 * (int)count;
+    }
+
+    gl_state.bindVertexArray(0);
+}
+
+static bool hasBlendedMeshes(const Entity& entity) {
+    for (const auto& level : entity.lodLevels()) {
+        for (const auto& mesh : level.meshes) {
+            if (mesh && mesh->material.alphaMode == BLEND) return true;
+        }
+    }
+    return false;
+}
+
+// The albedo the depth passes alpha-test a material against, 0 for casters that don't need it
+static GLuint alphaTestTexture(const Material& material) {
+    return material.alphaMode == MASKED && material.hasAlbedoMap() ? material.albedo_map : 0;
+}
+
+// Materials whose overdraw costs most: the parallax loop, and the discard that turns early depth off
+static bool heavyMaterial(const Material& material) {
+    return (material.hasHeightMap() && material.parallax_max_layers > 0) || alphaTestTexture(material) != 0;
+}
+
+// Sphere first, it's cheaper and rejects most
+static bool entityInFrustum(const Frustum& frustum, const EntityManager& entity_manager, size_t index) {
+    const glm::vec4& sphere = entity_manager.worldSpheres()[index];
+    return frustum.sphereInFrustum(glm::vec3(sphere), sphere.w) &&
+           frustum.aabbInFrustum(entity_manager.worldMins()[index], entity_manager.worldMaxs()[index]);
+}
+
+bool Renderer::gpuCullingActive() {
+    if (!use_gpu_culling) return false;
+    if (!gpu_culling) {
+        if (!GpuCulling::supported()) {
+            printf("GPU culling needs GL 4.3 compute and multi-draw indirect, staying on the CPU path\n");
+            use_gpu_culling = false;
+            return false;
+        }
+        try {
+            gpu_culling = std::make_unique<GpuCulling>();
+        } catch (const std::exception& e) {
+            printf("GPU culling disabled: %s\n", e.what());
+            use_gpu_culling = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Toggling changes which entities the per-entity paths, and the GPU tables, have to cover
+bool Renderer::staticBatchingActive() {
+    if (use_static_batching != static_batching_active) {
+        static_batching_active = use_static_batching;
+        if (gpu_culling) gpu_culling->invalidate();
+    }
+    return static_batching_active;
+}
+
+// Impostor tiers of the visible chunks, drawn with the per-entity ones
+void Renderer::addStaticImpostors(ImpostorBatches& batches) {
+    if (!staticBatchingActive()) return;
+    for (const StaticBatches::Chunk& chunk : static_batches.getChunks()) {
+        if (!chunk.visible) continue;
+        const StaticBatches::Level& level = chunk.levels[std::min<size_t>(chunk.current_lod, chunk.levels.size() - 1)];
+        for (const auto& [impostor, matrices] : level.impostors) {
+            for (const glm::mat4& model : matrices) batches[impostor].add(model, 0.0f);
+        }
+    }
+}
+
+void Renderer::updateGpuCulling(EntityManager& entity_manager) {
+    PROFILE_SCOPE("gpu culling upload");
+    if (!gpuCullingActive()) return;
+    const uint32_t skip = staticBatchingActive() ? ENTITY_COMPONENT_STATIC : 0u;
+    gpu_culling->update(entity_manager, entity_manager.query(ENTITY_COMPONENT_RENDERABLE, skip));
+}
+
+void Renderer::cullEntities(EntityManager& entity_manager, const FrameView& frame) {
+    PROFILE_SCOPE("cull");
+    renderList.clear();
+    renderListCounts = RenderListCounts();
+    occlusionQueryBoxes.clear();
+
+    const Frustum& frustum = frame.frustum;
+    const bool staticActive = staticBatchingActive();
+    if (staticActive) static_batches.cull(frustum, use_occlusion_culling ? &hiz : nullptr);
+    const bool noteTextures = texture_residency.managedCount() > 0;
+    if (staticActive && noteTextures) {
+        for (const StaticBatches::Chunk& chunk : static_batches.getChunks()) {
+            if (!chunk.visible) continue;
+            const glm::vec3 nearest = glm::clamp(frameCameraPosition, chunk.bmin, chunk.bmax);
+            const float pixels = lodScreenSize(chunk.lod_radius, glm::length(frameCameraPosition - nearest), framePixelScale);
+            const StaticBatches::Level& level = chunk.levels[std::min<size_t>(chunk.current_lod, chunk.levels.size() - 1)];
+            for (const StaticBatches::Draw& draw : level.draws) texture_residency.noteMaterial(*draw.material, pixels);
+        }
+    }
+    // Skinned instances aren't culled, their size goes by the bind pose
+    if (noteTextures) {
+        auto noteSkinned = [&](const SkinnedModel& skinned, const std::vector<glm::mat4>& transforms) {
+            for (const glm::mat4& model : transforms) {
+                const float scale = std::max({glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))});
+                for (const auto& mesh : skinned.meshes) {
+                    const glm::vec3 center(model * glm::vec4(mesh->bounds_center, 1.0f));
+                    const float pixels = lodScreenSize(mesh->bounds_radius * scale, glm::length(frameCameraPosition - center), framePixelScale);
+                    texture_residency.noteMaterial(mesh->material, pixels);
+                }
+            }
+        };
+        for (const SkinnedAnimation::Group& group : skinned_animation.groups()) noteSkinned(*group.model, group.transforms);
+        for (const BakedClip& clip : skinned_animation.bakedClips()) noteSkinned(*clip.model, clip.transforms);
+    }
+
+    // Culled per pass by the compute shader, only the blended entities it leaves out are listed
+    const bool gpuDriven = gpuCullingActive();
+    if (!gpuDriven) {
+        if (entity_manager.layoutVersion() != occlusion_layout_version) {
+            occlusion_queries.clear(); // Keyed by Entity*, which just moved
+            occlusion_layout_version = entity_manager.layoutVersion();
+        }
+        if (use_occlusion_queries) occlusion_queries.collect();
+    }
     
-    for (size_t i = 0; i < entity_manager.size(); i++) {
-        Entity* entity = entity_manager.getEntityAt(i);
-        if (!entity || !entity->active) continue;
-        
-        // Skip lights
-        bool is_light = false;
-        for (const auto& light : lights) {
-            if (entity->name == light.entity_name) {
-                is_light = true;
-                break;
+    // Only the tree and bounds arrays are touched until an entity survives the frustum
+    EntitySpan<uint8_t> flags = entity_manager.entityFlags();
+    EntitySpan<glm::vec4> spheres = entity_manager.worldSpheres();
+    entity_manager.queryFrustum(frustum, frustumCandidates, !staticActive);
+
+    // The exact tests are independent per candidate, spread them over the pool
+    candidateVisibility.resize(frustumCandidates.size());
+    const bool testHiZ = use_occlusion_culling && !gpuDriven;
+    const bool testPortals = portal_visibility.active();
+    job_system.parallelFor(frustumCandidates.size(), CULL_JOB_GRAIN, [&](size_t begin, size_t end) {
+        // The range's sphere tests in one batch, into the entries they are about to replace
+        frustum.spheresInFrustum(spheres.begin(), frustumCandidates.data() + begin, end - begin, candidateVisibility.data() + begin);
+        for (size_t k = begin; k < end; ++k) {
+            uint32_t i = frustumCandidates[k];
+            uint8_t result = CANDIDATE_CULLED;
+            // Skip inactive entities and lights, frustum cull since the tree only narrowed it down
+            // Rooms the portals don't lead to go first, they are the cheapest test
+            if ((flags[i] & (ENTITY_FLAG_ACTIVE | ENTITY_FLAG_LIGHT_PROXY)) == ENTITY_FLAG_ACTIVE && candidateVisibility[k] &&
+                (!testPortals || portal_visibility.entityVisible(i)) && frustum.aabbInFrustum(entity_manager.worldMins()[i], entity_manager.worldMaxs()[i])) {
+                const glm::vec3 center(spheres[i]);
+                if (lodScreenSize(spheres[i].w, glm::length(frameCameraPosition - center), framePixelScale) < small_object_cull_pixels) {
+                    result = CANDIDATE_TOO_SMALL;
+                } else {
+                    // Occlusion cull against the last Hi-Z readback
+                    result = testHiZ && hiz.isOccluded(center, spheres[i].w) ? CANDIDATE_OCCLUDED : CANDIDATE_VISIBLE;
+                }
             }
+            candidateVisibility[k] = result;
         }
-        if (is_light) continue;
-        
-        // Frustum cull
-        float radius = glm::length(entity->scale) * 5.0f;
-        if (frustum.sphereInFrustum(entity->position, radius)) {
-            visibleEntities.push_back(entity);
+    });
+
+    // Queries and the list stay in candidate order on this thread
+    int inFrustum = 0;
+    for (size_t k = 0; k < frustumCandidates.size(); ++k) {
+        if (candidateVisibility[k] == CANDIDATE_CULLED) continue;
+        uint32_t i = frustumCandidates[k];
+        Entity* entity = entity_manager.getEntityAt(i);
+        if (!entity) continue;
+        glm::vec3 center(spheres[i]);
+        // Occluded ones too, they are likely back soon
+        if (noteTextures && candidateVisibility[k] != CANDIDATE_TOO_SMALL) {
+            const float pixels = lodScreenSize(spheres[i].w, glm::length(frameCameraPosition - center), framePixelScale);
+            entity->forEachLODMesh([&](const std::shared_ptr<Mesh>& mesh, float) { texture_residency.noteMaterial(mesh->material, pixels); });
         }
+        if (gpuDriven && !hasBlendedMeshes(*entity)) continue;
+        inFrustum++;
+
+        if (candidateVisibility[k] == CANDIDATE_TOO_SMALL) {
+            renderListCounts.too_small++;
+            continue;
+        }
+        if (candidateVisibility[k] == CANDIDATE_OCCLUDED) {
+            renderListCounts.occluded++;
+            continue;
+        }
+        // Hidden entities are queried too, that's how they come back
+        if (use_occlusion_queries && !gpuDriven) {
+            occlusionQueryBoxes.push_back({entity, center, spheres[i].w});
+            if (occlusion_queries.wasOccluded(entity)) {
+                renderListCounts.occluded++;
+                continue;
+            }
+        }
+
+        RenderItem item;
+        item.entity = entity;
+        item.index = i;
+        item.lod = entity->current_lod;
+        item.model = entity_manager.worldMatrices()[i];
+        item.distance = glm::length(frameCameraPosition - glm::vec3(item.model[3]));
+        item.radius = spheres[i].w;
+        renderList.push_back(item);
     }
+    cullItemMeshlets(frustum, testHiZ);
+
+    // Everything the tree rejected counts as culled, lights and chunk members aside.
+    // The compute pass culls the opaque entities on the GPU, those are only counted on the CPU path.
+    const uint32_t chunked = staticActive ? ENTITY_COMPONENT_STATIC : 0u;
+    const int candidates = (int)entity_manager.query(ENTITY_COMPONENT_RENDERABLE, chunked).size();
+    renderListCounts.culled = renderListCounts.occluded + renderListCounts.too_small;
+    if (!gpuDriven) renderListCounts.culled += candidates - inFrustum;
 }   
 
-void Renderer::renderDepthPrepass() {
-    // Disable color writes, only write depth
-    glEnable(GL_DEPTH_TEST);
-    glDepthMask(GL_TRUE); 
-    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE); // Disable color
-    glDepthFunc(GL_LESS);
-    
-    depth_prepass_shader->use();
-    depth_prepass_shader->setMat4("view", view);
-    depth_prepass_shader->setMat4("projection", projection);
-    
-    // Frustum culling
-    Frustum frustum;
-    frustum.extractFromMatrix(projection * view);
-    
-    // Batch all opaque geometry
-    std::unordered_map<Mesh*, std::vector<glm::mat4>> depthBatches;
-    
-    for (Entity* entity : visibleEntities) {
-        glm::mat4 model = entity->getModelMatrix(entity);
-        float distance = glm::length(global_camera.position - entity->position);
-        
-        const auto& meshesToUse = entity->getMeshesForDistance(distance);
-        for (auto& meshPtr : meshesToUse) {
-            if (meshPtr && meshPtr->isValid()) {
-                depthBatches[meshPtr.get()].push_back(model);
+// Clustered meshes of the listed entities, at every level they draw this frame. Ranges need base
+// instance draws, so older drivers keep drawing them whole.
+void Renderer::cullItemMeshlets(const Frustum& frustum, bool testHiZ) {
+    meshletCulls.clear();
+    meshletRanges.clear();
+    if (!use_meshlet_culling || !gl_extensions.base_instance) return;
+
+    MeshletView view;
+    view.frustum = frustum;
+    view.camera_position = frameCameraPosition;
+    view.hiz = testHiZ ? &hiz : nullptr;
+    MeshletCullStats counts;
+    for (RenderItem& item : renderList) {
+        item.first_meshlet_cull = (uint32_t)meshletCulls.size();
+        item.entity->forEachLODLevel([&](const Entity::LODLevel& level, float) {
+            for (const auto& mesh : level.meshes) {
+                if (!mesh || !mesh->meshlets || !mesh->isValid() || mesh->material.alphaMode == BLEND) continue;
+                MeshletCull cull;
+                cull.mesh = mesh.get();
+                cull.first_range = (uint32_t)meshletRanges.size();
+                if (!cullMeshlets(mesh->meshlets->data(), mesh->meshlets->size(), item.model, mesh->cull_mode == CULL_BACK, view,
+                                  meshletRanges, counts)) {
+                    continue;
+                }
+                cull.range_count = (uint32_t)meshletRanges.size() - cull.first_range;
+                meshletCulls.push_back(cull);
+            }
+        });
+        item.meshlet_cull_count = (uint32_t)meshletCulls.size() - item.first_meshlet_cull;
+    }
+    renderListCounts.meshlets_tested = counts.tested;
+    renderListCounts.meshlets_culled = counts.culled;
+}
+
+const Renderer::MeshletCull* Renderer::findMeshletCull(const RenderItem& item, const Mesh* mesh) const {
+    for (uint32_t c = item.first_meshlet_cull; c < item.first_meshlet_cull + item.meshlet_cull_count; ++c) {
+        if (meshletCulls[c].mesh == mesh) return &meshletCulls[c];
+    }
+    return nullptr;
+}
+
+void Renderer::selectLODs(EntityManager& entity_manager, const Camera& camera, int viewportHeight, float frameTime) {
+    PROFILE_SCOPE("lod select");
+    float projectionScale = lodProjectionScale(camera.fov, (float)viewportHeight) * std::exp2(-lod_bias);
+    const float shadowProjectionScale = projectionScale * std::exp2(-shadow_lod_bias);
+    frameProjectionScale = projectionScale;
+    frameShadowProjectionScale = shadowProjectionScale;
+    framePixelScale = lodProjectionScale(camera.fov, (float)viewportHeight);
+    frameCameraPosition = camera.position;
+
+    // Chunks pick one level for all their members
+    const bool staticActive = staticBatchingActive();
+    if (staticActive) {
+        static_batches.update(entity_manager);
+        static_batches.selectLODs(camera.position, projectionScale, shadowProjectionScale, lod_hysteresis);
+    }
+
+    // Each entity only touches its own LOD state. The query is taken here, it isn't safe in jobs.
+    EntitySpan<uint32_t> selected = entity_manager.query(0, staticActive ? ENTITY_COMPONENT_STATIC : 0u);
+    EntitySpan<glm::vec4> spheres = entity_manager.worldSpheres();
+    job_system.parallelFor(selected.size(), LOD_JOB_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++) {
+            const uint32_t i = selected[n];
+            Entity* entity = entity_manager.getEntityAt(i);
+            if (!entity || entity->lodLevels().size() < 2) continue;
+
+            const glm::vec4& sphere = spheres[i];
+            const float distance = glm::length(camera.position - glm::vec3(sphere));
+            float screenSize = lodScreenSize(sphere.w, distance, projectionScale);
+
+            int previous = entity->current_lod;
+            entity->selectLOD(screenSize, lod_hysteresis);
+            entity->selectShadowLOD(lodScreenSize(sphere.w, distance, shadowProjectionScale), lod_hysteresis);
+            if (use_lod_crossfade && entity->current_lod != previous) {
+                // Restarting mid-fade drops the oldest level, which is at most a partial dither pop
+                entity->fade_from_lod = previous;
+                entity->lod_fade = 0.0f;
+            } else if (entity->fade_from_lod >= 0) {
+                entity->lod_fade += frameTime / LOD_CROSSFADE_SECONDS;
+                if (!use_lod_crossfade || entity->lod_fade >= 1.0f) entity->fade_from_lod = -1;
             }
         }
+    });
+}
+
+void Renderer::updateLODBias(float frameTimeMs) {
+    if (!lod_auto_bias) return;
+
+    // Slow steps so the bias doesn't chase single-frame spikes
+    if (frameTimeMs > lod_frame_budget_ms) {
+        lod_bias = std::min(lod_bias + 0.02f, LOD_MAX_BIAS);
+    } else if (frameTimeMs < lod_frame_budget_ms * 0.8f) {
+        lod_bias = std::max(lod_bias - 0.01f, 0.0f);
     }
+}
+
+bool Renderer::inDepthPrepass(const RenderItem& item, const Material& material, float fade) const {
+    if (prepassComplete) return true;
+    // The opaque variants don't dither their fades, only the prepass does
+    if (fade != 0.0f && alphaTestTexture(material) == 0) return true;
+    if (prepassMode == PREPASS_NEVER || (prepassMode == PREPASS_HEAVY && !heavyMaterial(material))) return false;
+    return prepassMinScreenSize <= 0.0f ||
+           lodScreenSize(item.radius, item.distance, lodProjectionScale(global_camera.fov, 1.0f)) >= prepassMinScreenSize;
+}
+
+bool Renderer::depthPrepassSetting() {
+    // Nothing to measure with
+    if (!gl_extensions.timer_query) return true;
+    PrepassAuto& state = prepassAuto;
+    if (state.probe > 0) {
+        state.probe--;
+        return !state.enabled;
+    }
+    if (++state.frames >= PREPASS_AUTO_PROBE_INTERVAL) {
+        state.frames = 0;
+        state.probe = PREPASS_AUTO_PROBE_FRAMES;
+    }
+    return state.enabled;
+}
+
+void Renderer::updateDepthPrepassTiming(uint64_t gpu_frame, double prepass_ms, double main_ms) {
+    if (depth_prepass_mode != PREPASS_AUTO) return;
+    PrepassAuto& state = prepassAuto;
+    // Collected frames are still within the ring
+    float& cost = state.cost[state.ran[gpu_frame % GPU_QUERY_FRAMES] ? 1 : 0];
+    const float measured = (float)(prepass_ms + main_ms);
+    cost = cost == 0.0f ? measured : glm::mix(cost, measured, 0.25f);
+
+    // Probes only refresh the other estimate, the switch waits until they're over
+    const float current = state.cost[state.enabled ? 1 : 0];
+    const float other = state.cost[state.enabled ? 0 : 1];
+    if (state.probe == 0 && current > 0.0f && other > 0.0f && other < current * (1.0f - PREPASS_AUTO_HYSTERESIS)) {
+        state.enabled = !state.enabled;
+        printf("Depth prepass auto: %s (%.2f ms against %.2f ms)\n", state.enabled ? "on" : "off", other, current);
+    }
+}
+
+void Renderer::renderDepthPrepass() {
+    PROFILE_SCOPE("prepass");
+    // The mode this frame runs, auto resolving to ALWAYS or NEVER. Deferred shading fills the
+    // G-buffer under GL_EQUAL and needs all of it.
+    const bool deferredWanted = use_deferred_shading && pbr_gbuffer_variants && deferred_lighting_shader;
+    DepthPrepassMode mode = depth_prepass_mode;
+    if (mode == PREPASS_AUTO) {
+        mode = depthPrepassSetting() ? PREPASS_ALWAYS : PREPASS_NEVER;
+        prepassAuto.ran[gpu_queries.frame() % GPU_QUERY_FRAMES] = mode == PREPASS_ALWAYS;
+    }
+    prepassMode = deferredWanted ? PREPASS_ALWAYS : mode;
+    prepassMinScreenSize = deferredWanted ? 0.0f : depth_prepass_min_screen_size;
+    prepassComplete = prepassMode == PREPASS_ALWAYS && prepassMinScreenSize <= 0.0f;
+    // The batched draws have no per-entity choice
+    const bool batchedDraws = prepassMode != PREPASS_NEVER;
+
+    // Only write depth
+    gl_state.apply(PIPELINE_DEPTH_PREPASS);
     
-    // Render depth-only
-    int lastCullMode = -1;
-    
-    for (auto& [mesh, matrices] : depthBatches) {
-        if (matrices.empty() || matrices.size() > mesh->maxInstances) continue;
-        
-        // Set cull mode
-        if (mesh->cull_mode != lastCullMode) {
-            switch (mesh->cull_mode) {
-                case CULL_NONE: glDisable(GL_CULL_FACE); break;
-                case CULL_BACK: glEnable(GL_CULL_FACE); glCullFace(GL_BACK); break;
-                case CULL_FRONT: glEnable(GL_CULL_FACE); glCullFace(GL_FRONT); break;
-            }
-            lastCullMode = mesh->cull_mode;
+    // Opaque draws run the depth-only program, the rest the alpha-tested one. albedo is the
+    // texture to test against, 0 for none (a LOD fade dithers without one).
+    // pulled picks the programs reading the vertex pulling pool, for a DrawList that pulls.
+    int lastHasAlbedo = -1;
+    const Shader* lastMasked = nullptr;
+    auto applyPrepassState = [&](int cull_mode, bool masked, GLuint albedo, bool pulled = false) {
+        gl_state.setCullMode(cull_mode);
+        Shader* program = depth_prepass_programs.get(masked, pulled);
+        program->use();
+        if (!masked) return;
+        if (albedo != 0) gl_state.bindTextureUnit(0, GL_TEXTURE_2D, albedo);
+        int hasAlbedo = albedo != 0 ? 1 : 0;
+        if (hasAlbedo != lastHasAlbedo || program != lastMasked) {
+            program->setInt(U_HAS_ALBEDO_MAP, hasAlbedo);
+            lastHasAlbedo = hasAlbedo;
+            lastMasked = program;
         }
-        
-        // Bind albedo for alpha testing
-        if (mesh->material.hasAlbedoMap()) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, mesh->material.albedo_map);
-            depth_prepass_shader->setInt("albedoMap", 0);
-            depth_prepass_shader->setInt("hasAlbedoMap", 1);
-        } else {
-            depth_prepass_shader->setInt("hasAlbedoMap", 0);
+    };
+    auto applyMaterialState = [&](int cull_mode, const Material& material) {
+        const GLuint albedo = alphaTestTexture(material);
+        applyPrepassState(cull_mode, albedo != 0, albedo);
+    };
+
+    if (gpuCullingActive()) {
+        // The camera view picks this frame's LODs, renderScene() reuses the same lists
+        const HiZBuffer* occlusion = use_occlusion_culling ? &hiz : nullptr;
+        gpu_culling->cull(frame_view.view_projection, frameCameraPosition, frameProjectionScale, lod_hysteresis, true, occlusion,
+                          small_object_cull_pixels * frameProjectionScale / framePixelScale);
+        if (!batchedDraws) {
+            if (use_occlusion_culling) hiz.build(frame_view.view_projection);
+            return;
         }
-        
-        // Upload instances
-        glBindBuffer(GL_ARRAY_BUFFER, mesh->instanceVBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, 
-                        matrices.size() * sizeof(glm::mat4), 
-                        matrices.data());
-        
-        glBindVertexArray(mesh->VAO);
-        glDrawElementsInstanced(GL_TRIANGLES, mesh->INDEX_COUNT, GL_UNSIGNED_INT, 0, matrices.size());
+        gpu_culling->submit([&](const GpuCulling::Slot& slot) {
+            applyMaterialState(slot.mesh->cull_mode, *slot.material);
+        });
+        if (staticBatchingActive()) {
+            static_batches.submit([&](const StaticBatches::Draw& draw) {
+                applyMaterialState(draw.cull_mode, *draw.material);
+            });
+            ImpostorBatches impostorBatches;
+            addStaticImpostors(impostorBatches);
+            renderImpostors(impostorBatches);
+        }
+        if (use_occlusion_culling) hiz.build(frame_view.view_projection);
+        return;
     }
-    glBindVertexArray(0);
+
+    // Depth-only, front to back. State is the alpha-test texture shifted up, with bit 0 set for
+    // the alpha-tested program, so every opaque draw shares state 0 and sorts first.
+    prepassDraws.clear();
+    prepassDraws.recordParallel(renderList.size(), RECORD_JOB_GRAIN, [&](size_t begin, size_t end, DrawList::Recorder& recorder) {
+        for (size_t k = begin; k < end; ++k) {
+            const RenderItem& item = renderList[k];
+            item.entity->forEachLODLevel([&](const Entity::LODLevel& level, float fade) {
+                for (auto& meshPtr : level.meshes) {
+                    if (meshPtr && meshPtr->isValid() && inDepthPrepass(item, meshPtr->material, fade)) {
+                        const MeshletCull* cull = findMeshletCull(item, meshPtr.get());
+                        if (cull && cull->range_count == 0) continue; // No cluster in view
+                        GLuint texture = alphaTestTexture(meshPtr->material);
+                        uint32_t state = (texture != 0 || fade != 0.0f) ? (texture << 1) | 1u : 0u;
+                        recorder.add(meshPtr.get(), (const void*)(uintptr_t)state, state, item.model, fade, item.distance,
+                                     cull ? &meshletRanges[cull->first_range] : nullptr, cull ? cull->range_count : 0);
+                    }
+                }
+            });
+        }
+    });
+    prepassDraws.upload(DRAW_STREAM_DEPTH);
+
+    // Impostors discard in the main pass too, a partial prepass leaves out the small quads
+    ImpostorBatches impostorBatches;
+    if (prepassComplete) {
+        for (const RenderItem& item : renderList) {
+            item.entity->forEachLODLevel([&](const Entity::LODLevel& level, float fade) {
+                if (level.impostor) impostorBatches[level.impostor.get()].add(item.model, fade);
+            });
+        }
+    }
+
+    const bool prepassPulled = prepassDraws.pulling();
+    prepassDraws.submit([&](const DrawList::Draw& draw) {
+        const uintptr_t state = (uintptr_t)draw.state;
+        applyPrepassState(draw.cull_mode, (state & 1) != 0, (GLuint)(state >> 1), prepassPulled);
+    });
+    if (staticBatchingActive() && batchedDraws) {
+        static_batches.submit([&](const StaticBatches::Draw& draw) {
+            applyMaterialState(draw.cull_mode, *draw.material);
+        });
+    }
+    if (prepassComplete) addStaticImpostors(impostorBatches);
+    renderImpostors(impostorBatches);
+
+    if (use_occlusion_queries) occlusion_queries.issue(occlusionQueryBoxes, frame_view.view_projection, frameCameraPosition);
+    if (use_occlusion_culling) hiz.build(frame_view.view_projection);
 }
 
-void Renderer::renderShadowPass(EntityManager& entity_manager, const Light& light) {
-    GLint viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
-    
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    
-    glm::mat4 lightProjection, lightView;
-    
+// Spot lights render one perspective view and point lights a 90 degree view per cube face.
+// Directional lights split the view frustum up to SHADOW_DISTANCE and fit an ortho box around
+// each slice's bounding sphere, snapped to the texels of that cascade's tile so it doesn't
+// shimmer as the camera moves. Time-sliced cascades pad the box by SHADOW_CASCADE_MARGIN so the
+// camera can move a little before they have to refresh. Views start at first, their tiles are
+// already allocated.
+void Renderer::computeShadowViews(const Light& light, int first, ShadowBlock& shadow) {
+    for (int v = first; v < first + shadowViewCount(light); ++v) shadow.view_params[v] = glm::vec4(0.1f, 1e30f, 0.0f, 0.0f);
+    if (light.type == POINT_LIGHT) {
+        static const glm::vec3 faceDirections[SHADOW_CUBE_FACES] = {
+            { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+        };
+        static const glm::vec3 faceUps[SHADOW_CUBE_FACES] = {
+            { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 }
+        };
+        glm::mat4 lightProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.5f, lightRange(light));
+        for (int face = 0; face < SHADOW_CUBE_FACES; ++face) {
+            shadow.light_space[first + face] = lightProjection * glm::lookAt(light.position, light.position + faceDirections[face], faceUps[face]);
+        }
+        return;
+    }
     if (light.type == SPOT_LIGHT) {
         glm::vec3 lightTarget = light.position + light.direction;
         glm::vec3 up = glm::abs(light.direction.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
-        lightView = glm::lookAt(light.position, lightTarget, up);
+        glm::mat4 lightView = glm::lookAt(light.position, lightTarget, up);
         float outerAngle = glm::degrees(glm::acos(light.outer_cutoff_cos));
-        lightProjection = glm::perspective(glm::radians(outerAngle * 2.0f), 1.0f, 0.5f, 100.0f);
-    } else if (light.type == POINT_LIGHT) {
-        glm::vec3 finalDir = glm::normalize(light.position);
-        glm::vec3 up = glm::abs(finalDir.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
-        lightProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.5f, 100.0f);
-        lightView = glm::lookAt(light.position, glm::vec3(0), up);
-    } else if (light.type == DIR_LIGHT) {
-        glm::vec3 finalDir = glm::normalize(light.direction);
-        glm::vec3 up = std::abs(finalDir.y) > 0.999f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
-        glm::mat4 shadowFocusProj = glm::perspective(glm::radians(global_camera.fov),
-                                                    global_camera.aspect_ratio, 0.1f, 50.0f);
-        glm::mat4 invVP = glm::inverse(shadowFocusProj * view);
-        
-        std::vector<glm::vec3> corners;
+        glm::mat4 lightProjection = glm::perspective(glm::radians(outerAngle * 2.0f), 1.0f, 0.5f, lightRange(light));
+        shadow.light_space[first] = lightProjection * lightView;
+        return;
+    }
+
+    glm::vec3 finalDir = glm::normalize(light.direction);
+    glm::vec3 up = std::abs(finalDir.y) > 0.999f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+    const float nearPlane = global_camera.near_plane;
+    const float farPlane = std::min(global_camera.far_plane, SHADOW_DISTANCE);
+
+    float sliceNear = nearPlane;
+    for (int cascade = 0; cascade < SHADOW_CASCADES; ++cascade) {
+        const float tileSize = (float)shadowTiles[first + cascade].size;
+        // Practical split scheme, logarithmic near the camera and closer to uniform further out
+        float p = (float)(cascade + 1) / SHADOW_CASCADES;
+        float logSplit = nearPlane * std::pow(farPlane / nearPlane, p);
+        float uniformSplit = nearPlane + (farPlane - nearPlane) * p;
+        float sliceFar = glm::mix(uniformSplit, logSplit, SHADOW_SPLIT_LAMBDA);
+
+        glm::mat4 sliceProj = glm::perspective(global_camera.fov, global_camera.aspect_ratio, sliceNear, sliceFar);
+        glm::mat4 invVP = glm::inverse(sliceProj * view);
+
+        glm::vec3 corners[8];
         glm::vec3 center(0.0f);
         for (unsigned int i = 0; i < 8; ++i) {
             glm::vec4 pt = invVP * glm::vec4((i&1)?1:-1, (i&2)?1:-1, (i&4)?1:-1, 1.0f);
-            glm::vec3 c = glm::vec3(pt / pt.w);
-            corners.push_back(c);
-            center += c;
+            corners[i] = glm::vec3(pt / pt.w);
+            center += corners[i];
         }
         center /= 8.0f;
 
+        // A sphere keeps the box size fixed as the camera turns, so only the snap moves it
         float radius = 0.0f;
         for (const auto& v : corners) radius = std::max(radius, glm::length(v - center));
         radius = std::ceil(radius * 16.0f) / 16.0f;
+        const float boxRadius = shadow_cascade_intervals[cascade] > 1 ? radius * (1.0f + SHADOW_CASCADE_MARGIN) : radius;
+        cascadeBounds[first + cascade] = { center, radius, boxRadius };
 
-        lightView = glm::lookAt(center - finalDir * radius, center, up);
-        lightProjection = glm::ortho(-radius, radius, -radius, radius, -radius * 5.0f, radius * 5.0f);
+        glm::mat4 lightView = glm::lookAt(center - finalDir * boxRadius, center, up);
+        glm::mat4 lightProjection = glm::ortho(-boxRadius, boxRadius, -boxRadius, boxRadius,
+                                               -std::max(boxRadius * 5.0f, SHADOW_CASTER_DEPTH), boxRadius * 5.0f);
 
         glm::mat4 tempShadowMatrix = lightProjection * lightView;
         glm::vec4 shadowOrigin = tempShadowMatrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-        shadowOrigin = shadowOrigin * (float)SHADOW_WIDTH / 2.0f;
+        shadowOrigin = shadowOrigin * tileSize / 2.0f;
         glm::vec4 roundedOrigin = glm::round(shadowOrigin);
         glm::vec4 roundOffset = roundedOrigin - shadowOrigin;
-        roundOffset = roundOffset * 2.0f / (float)SHADOW_WIDTH;
+        roundOffset = roundOffset * 2.0f / tileSize;
         roundOffset.z = 0.0f; roundOffset.w = 0.0f;
         lightProjection[3] += roundOffset;
+
+        shadow.light_space[first + cascade] = lightProjection * lightView;
+        // About four texels, what the old fixed 0.1 offset was on the single map
+        shadow.view_params[first + cascade] = glm::vec4(4.0f * (2.0f * boxRadius / tileSize), sliceFar, 0.0f, 0.0f);
+        sliceNear = sliceFar;
     }
+}
 
-    lightSpaceMatrix = lightProjection * lightView;
-    shadow_shader->use();
-    shadow_shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+int Renderer::shadowViewCount(const Light& light) {
+    return light.type == DIR_LIGHT ? SHADOW_CASCADES : light.type == POINT_LIGHT ? SHADOW_CUBE_FACES : 1;
+}
 
-    Frustum frustum;
-    frustum.extractFromMatrix(projection * view);
+// Directional lights cover the whole view. Spot and point lights weigh the screen height their
+// range sphere covers by their distance, none when the sphere is off screen.
+float Renderer::shadowImportance(const Light& light, const Camera& camera, const Frustum& cameraFrustum) const {
+    if (light.type == DIR_LIGHT) return 1.0f;
 
-    // Batch shadow rendering by mesh
-    std::unordered_map<Mesh*, std::vector<glm::mat4>> shadowBatches;
-    
-    for (size_t i = 0; i < entity_manager.size(); i++) {
-        Entity* entity = entity_manager.getEntityAt(i);
-        if (!entity || !entity->active) continue;
-        
-        bool is_light_entity = false;
-        for (const auto& l : lights) {
-            if (entity->name == l.entity_name) {
-                is_light_entity = true;
-                break;
-            }
+    // The sphere around what the light reaches: its range, or for a spot light the smallest
+    // sphere around its cone, so one pointing away from the view drops out
+    const float range = lightRange(light);
+    glm::vec3 center = light.position;
+    float radius = range;
+    if (light.type == SPOT_LIGHT) {
+        const float cosine = std::clamp(light.outer_cutoff_cos, 0.0f, 1.0f);
+        const glm::vec3 direction = glm::normalize(light.direction);
+        if (cosine >= 0.70710678f) {
+            // Narrow cones: the sphere through the apex and the cap's rim
+            radius = range / (2.0f * cosine);
+            center = light.position + direction * radius;
+        } else {
+            center = light.position + direction * (range * cosine);
+            radius = range * std::sqrt(1.0f - cosine * cosine);
         }
-        if (is_light_entity) continue;
+    }
+    if (!cameraFrustum.sphereInFrustum(center, radius)) return 0.0f;
 
-        float radius = glm::length(entity->scale) * 5.0f;
-        if (!frustum.sphereInFrustum(entity->position, radius)) {
-            continue;  // Skip shadow rendering for this entity
+    // Projected size of that sphere, falling off with distance in ranges
+    float distance = glm::length(center - camera.position);
+    float coverage = distance <= radius ? 1.0f : std::min(1.0f, radius / distance * projection[1][1]);
+    float importance = coverage / (1.0f + glm::length(light.position - camera.position) / range);
+    return light.baked ? importance * SHADOW_BAKED_IMPORTANCE : importance;
+}
+
+// Every light asks for a tile per view sized by its importance, fitShadowRequests() trims them
+// to the texel budget and the survivors are packed largest first, then fitted to their tiles
+void Renderer::planShadowAtlas(ShadowBlock& shadow) {
+    const int lightCount = frame_uniforms.lights.count;
+    shadowRequests.clear();
+    for (int i = 0; i < lightCount; ++i) {
+        ShadowRequest request;
+        request.light = i;
+        request.views = shadowViewCount(frameLight(i));
+        request.importance = frameLightImportance[i];
+        if (request.importance <= 0.0f) continue;
+        // Nearest power of two to the importance's share of a page
+        request.size = (int)std::exp2(std::round(std::log2((float)SHADOW_WIDTH * request.importance)));
+        shadowRequests.push_back(request);
+    }
+    // Only the shadow_max_local_lights most important local lights keep their requests
+    std::stable_sort(shadowRequests.begin(), shadowRequests.end(), [](const ShadowRequest& a, const ShadowRequest& b) {
+        return a.importance > b.importance;
+    });
+    int localRequests = 0;
+    shadowRequests.erase(std::remove_if(shadowRequests.begin(), shadowRequests.end(), [&](const ShadowRequest& request) {
+        return frameLight(request.light).type != DIR_LIGHT && localRequests++ >= shadow_max_local_lights;
+    }), shadowRequests.end());
+    fitShadowRequests(shadowRequests);
+    std::stable_sort(shadowRequests.begin(), shadowRequests.end(), [](const ShadowRequest& a, const ShadowRequest& b) {
+        return a.size > b.size;
+    });
+
+    for (glm::ivec4& info : shadow.lights) info = glm::ivec4(0);
+    uint64_t cursor = 0;
+    int viewCount = 0;
+    stats.shadowedLights = 0;
+    for (const ShadowRequest& request : shadowRequests) {
+        if (request.size == 0) continue;
+        const Light& light = frameLight(request.light);
+        const int first = viewCount;
+        for (int v = 0; v < request.views; ++v, ++viewCount) {
+            const ShadowTile tile = allocateShadowTile(cursor, request.size);
+            shadowTiles[viewCount] = tile;
+            shadow.tiles[viewCount] = glm::vec4((float)tile.x / SHADOW_WIDTH, (float)tile.y / SHADOW_HEIGHT,
+                                                (float)tile.size / SHADOW_WIDTH, (float)tile.layer);
         }
+        const int kind = light.type == DIR_LIGHT ? SHADOW_KIND_CASCADES : light.type == POINT_LIGHT ? SHADOW_KIND_CUBE : SHADOW_KIND_SINGLE;
+        shadow.lights[request.light] = glm::ivec4(first, request.views, kind, 0);
+        computeShadowViews(light, first, shadow);
+        stats.shadowedLights++;
+    }
+    shadow.view_count = viewCount;
+    shadow.filter_quality = shadow_settings.filter_quality;
+    if (shadow.filter_quality == SHADOW_FILTER_MOMENTS && (!shadow_moments_shader || shadowMomentsTexture == 0)) {
+        shadow.filter_quality = SHADOW_FILTER_SOFT;
+    }
+    shadow.moment_exponents = glm::vec2(shadow_moment_exponents[0], shadow_moment_exponents[1]);
+    shadow.max_filter_taps = shadow.filter_quality == SHADOW_FILTER_PCF4 ? 4 : std::clamp(shadow_settings.max_filter_taps, 1, SHADOW_FILTER_MAX_TAPS);
+    stats.shadowAtlasTexels = cursor;
+    scheduleShadowUpdates(shadow);
+}
 
-        glm::mat4 model = entity->getModelMatrix(entity);
-        for (const auto& mesh : entity->meshes) {
-            if (mesh && mesh->isValid()) {
-                shadowBatches[mesh.get()].push_back(model);
+// A view can skip this frame if its tile still holds what it last rendered there. Cascades are
+// due every shadow_cascade_intervals frames, or once their slice leaves the padded box. Local
+// lights above shadow_round_robin_importance are due every frame, the others share the caster
+// budget. Lights update all their views together, cascades one by one.
+void Renderer::scheduleShadowUpdates(ShadowBlock& shadow) {
+    shadowFrame++;
+    for (int v = 0; v < shadow.view_count; ++v) shadowViewDue[v] = true;
+
+    struct RoundRobin {
+        int light = 0;
+        uint64_t age = 0;
+        int cost = 0;
+    };
+    FrameVector<RoundRobin> candidates;
+    for (const ShadowRequest& request : shadowRequests) {
+        const int i = request.light;
+        const glm::ivec4& info = shadow.lights[i];
+        if (info.y == 0) continue;
+        const Light& light = frameLight(i);
+
+        bool reusable = true;
+        RoundRobin candidate;
+        candidate.light = i;
+        candidate.age = shadowFrame - shadowHistory[i][0].frame;
+        for (int k = 0; k < info.y; ++k) {
+            const ShadowViewHistory& history = shadowHistory[i][k];
+            reusable = reusable && history.valid && history.generation == shadow_map_generation &&
+                       history.light == frameLights[i] && history.light_type == light.type &&
+                       history.tile == shadowTiles[info.x + k];
+            candidate.cost += history.casters;
+        }
+        if (!reusable) continue;
+
+        if (info.z == SHADOW_KIND_CASCADES) {
+            const glm::vec3 direction = glm::normalize(light.direction);
+            for (int k = 0; k < info.y; ++k) {
+                const ShadowViewHistory& history = shadowHistory[i][k];
+                const CascadeBounds& bounds = cascadeBounds[info.x + k];
+                // The slice's sphere has to stay inside the old box across the light, along it
+                // the depth range has slack to spare
+                const glm::vec4 center = history.light_space * glm::vec4(bounds.center, 1.0f);
+                const float reach = 1.0f - bounds.radius / history.box_radius;
+                const bool covered = history.direction == direction && std::abs(center.x) <= reach && std::abs(center.y) <= reach;
+                const uint64_t interval = (uint64_t)std::clamp(shadow_cascade_intervals[k], 1, SHADOW_MAX_UPDATE_INTERVAL);
+                if (covered && shadowFrame - history.frame < interval) shadowViewDue[info.x + k] = false;
             }
+        } else if (request.importance < shadow_round_robin_importance) {
+            candidate.cost = std::max(candidate.cost, info.y); // Unknown costs, e.g. under GPU culling
+            candidates.push_back(candidate);
+            for (int k = 0; k < info.y; ++k) shadowViewDue[info.x + k] = false;
         }
     }
 
-    // Render shadow batches with minimal state changes
-    GLuint lastTexture = 0;
-    int lastCullMode = -1;
-    
-    for (auto& [mesh, matrices] : shadowBatches) {
-        if (matrices.empty()) continue;
-        
-        // Only change cull mode if different
-        if (mesh->cull_mode != lastCullMode) {
-            if (mesh->cull_mode == CULL_NONE) {
-                glDisable(GL_CULL_FACE);
+    // Stalest first, as many as fit the budget
+    std::sort(candidates.begin(), candidates.end(), [](const RoundRobin& a, const RoundRobin& b) { return a.age > b.age; });
+    int budget = shadow_caster_budget;
+    for (size_t c = 0; c < candidates.size(); ++c) {
+        if (c > 0 && candidates[c].cost > budget) continue;
+        budget -= candidates[c].cost;
+        const glm::ivec4& info = shadow.lights[candidates[c].light];
+        for (int k = 0; k < info.y; ++k) shadowViewDue[info.x + k] = true;
+    }
+
+    // The skipped views are sampled the way they were rendered
+    stats.shadowViewsReused = 0;
+    for (const ShadowRequest& request : shadowRequests) {
+        const glm::ivec4& info = shadow.lights[request.light];
+        for (int k = 0; k < info.y; ++k) {
+            if (shadowViewDue[info.x + k]) continue;
+            const ShadowViewHistory& history = shadowHistory[request.light][k];
+            shadow.light_space[info.x + k] = history.light_space;
+            shadow.view_params[info.x + k].x = history.receiver_offset;
+            stats.shadowViewsReused++;
+        }
+    }
+}
+
+// After rendering a view: what it was rendered with, and whatever else held its tile is gone
+void Renderer::recordShadowView(int light, int view, int casters) {
+    const ShadowBlock& shadow = frame_uniforms.shadow;
+    const glm::ivec4& info = shadow.lights[light];
+    const int v = info.x + view;
+    for (auto& lightHistory : shadowHistory) {
+        for (ShadowViewHistory& other : lightHistory) {
+            if (other.tile.overlaps(shadowTiles[v])) other.valid = false;
+        }
+    }
+
+    ShadowViewHistory& history = shadowHistory[light][view];
+    history.light_space = shadow.light_space[v];
+    history.receiver_offset = shadow.view_params[v].x;
+    history.tile = shadowTiles[v];
+    history.generation = shadow_map_generation;
+    history.light = frameLights[light];
+    history.light_type = frameLight(light).type;
+    if (info.z == SHADOW_KIND_CASCADES) {
+        history.direction = glm::normalize(frameLight(light).direction);
+        history.center = cascadeBounds[v].center;
+        history.box_radius = cascadeBounds[v].box_radius;
+    }
+    history.frame = shadowFrame;
+    history.casters = casters;
+    history.valid = true;
+}
+
+
+
+void Renderer::renderShadowPass(EntityManager& entity_manager) {
+    PROFILE_SCOPE("shadows");
+    const ShadowBlock& shadow = frame_uniforms.shadow;
+    stats.shadowCastersDrawn = 0;
+    stats.shadowCastersCulled = 0;
+    stats.shadowViewsCached = 0;
+    if (shadow.view_count == 0) return;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    gl_state.apply(PIPELINE_SHADOW_CASTERS);
+
+    // Render shadow batches with minimal state changes, casters cull their front faces. Only
+    // alpha-tested casters (a non-zero texture) take the masked program and bind their albedo.
+    // pulled picks the programs reading the vertex pulling pool, for a DrawList that pulls.
+    auto applyShadowState = [&](const DepthPrograms& programs, int cull_mode, GLuint texture, bool pulled = false) {
+        gl_state.setCullMode(cull_mode == CULL_NONE ? CULL_NONE : CULL_FRONT);
+        programs.get(texture != 0, pulled)->use();
+        if (texture != 0) gl_state.bindTextureUnit(0, GL_TEXTURE_2D, texture);
+    };
+
+    // Static batching moves static entities out of the per-entity paths into the chunks. GPU
+    // culling can't split its set, so without batching its static entities draw as dynamic.
+    // Returns the entity casters drawn from the CPU list.
+    enum CasterSet { CASTERS_ALL, CASTERS_STATIC, CASTERS_DYNAMIC };
+    auto drawCasters = [&](const DepthPrograms& programs, const glm::mat4& cullMatrix, const Frustum& frustum, CasterSet set) {
+        const bool staticBatches = staticBatchingActive();
+        const bool staticEntities = !staticBatches && set != CASTERS_DYNAMIC;
+        int drawn = 0;
+
+        if (gpuCullingActive()) {
+            if (set != CASTERS_STATIC) {
+                // No finer than the camera view's LODs, from this frame's cull or the last one
+                gpu_culling->cull(cullMatrix, frameCameraPosition, frameShadowProjectionScale, lod_hysteresis, false, nullptr,
+                                  shadow_small_object_cull_pixels * frameShadowProjectionScale / framePixelScale);
+                gpu_culling->submit([&](const GpuCulling::Slot& slot) {
+                    applyShadowState(programs, slot.mesh->cull_mode, alphaTestTexture(*slot.material));
+                });
+            }
+        } else if (staticEntities || set != CASTERS_STATIC) {
+            // State is the alpha-test texture, 0 for opaque casters
+            shadowDraws.clear();
+
+            EntitySpan<uint8_t> flags = entity_manager.entityFlags();
+            entity_manager.queryFrustum(frustum, frustumCandidates, staticEntities);
+            // Not for the cache either, the camera cell's set changes as it moves
+            const bool testPortals = set != CASTERS_STATIC && portal_visibility.active();
+            std::atomic<int> recorded{0};
+            candidateVisibility.resize(frustumCandidates.size());
+            shadowDraws.recordParallel(frustumCandidates.size(), RECORD_JOB_GRAIN, [&](size_t begin, size_t end, DrawList::Recorder& recorder) {
+                frustum.spheresInFrustum(entity_manager.worldSpheres().begin(), frustumCandidates.data() + begin, end - begin,
+                                         candidateVisibility.data() + begin);
+                int casters = 0;
+                for (size_t k = begin; k < end; ++k) {
+                    uint32_t i = frustumCandidates[k];
+                    if ((flags[i] & (ENTITY_FLAG_ACTIVE | ENTITY_FLAG_LIGHT_PROXY)) != ENTITY_FLAG_ACTIVE) continue;
+                    if ((flags[i] & ENTITY_FLAG_STATIC) ? !staticEntities : set == CASTERS_STATIC) continue;
+                    if (testPortals && !portal_visibility.entityPotentiallyVisible(i)) continue;
+                    const Entity* entity = entity_manager.getEntityAt(i);
+                    if (!entity) continue;
+
+                    if (!candidateVisibility[k] || !frustum.aabbInFrustum(entity_manager.worldMins()[i], entity_manager.worldMaxs()[i])) {
+                        continue;  // Outside this view
+                    }
+                    // Not into the cache, which outlives the camera position it would be measured from
+                    const glm::vec4& sphere = entity_manager.worldSpheres()[i];
+                    if (set != CASTERS_STATIC &&
+                        lodScreenSize(sphere.w, glm::length(frameCameraPosition - glm::vec3(sphere)), framePixelScale) < shadow_small_object_cull_pixels) {
+                        continue;  // Too small a shadow to see
+                    }
+                    casters++;
+
+                    const glm::mat4& model = entity_manager.worldMatrices()[i];
+                    for (const auto& mesh : entity->getShadowLODMeshes()) {
+                        if (mesh && mesh->isValid()) {
+                            GLuint texture = alphaTestTexture(mesh->material);
+                            recorder.add(mesh.get(), (const void*)(uintptr_t)texture, texture, model, 0.0f);
+                        }
+                    }
+                }
+                recorded += casters;
+            });
+            drawn += recorded.load();
+            shadowDraws.upload(DRAW_STREAM_SHADOW);
+            const bool pulled = shadowDraws.pulling();
+            shadowDraws.submit([&](const DrawList::Draw& draw) {
+                applyShadowState(programs, draw.cull_mode, (GLuint)(uintptr_t)draw.state, pulled);
+            });
+        }
+
+        if (staticBatches && set != CASTERS_DYNAMIC) {
+            static_batches.submit([&](const StaticBatches::Draw& draw) {
+                applyShadowState(programs, draw.cull_mode, alphaTestTexture(*draw.material));
+            }, &frustum);
+        }
+
+        // Skinned models pose every frame, so they never go into the cache
+        const DepthPrograms& skinned = &programs == &shadow_cube_programs ? shadow_skinned_cube_programs : shadow_skinned_programs;
+        if (set != CASTERS_STATIC && skinned.opaque) {
+            drawSkinned([&](const Mesh& mesh) -> const Shader& {
+                const GLuint texture = alphaTestTexture(mesh.material);
+                applyShadowState(skinned, mesh.cull_mode, texture);
+                return texture != 0 ? *skinned.masked : *skinned.opaque;
+            });
+        }
+        // Foliage sways, so it stays out of the cache too
+        const DepthPrograms& bending = &programs == &shadow_cube_programs ? shadow_foliage_cube_programs : shadow_foliage_programs;
+        if (set != CASTERS_STATIC && bending.opaque) {
+            foliage.submitShadows(frustum, [&](const Mesh& mesh, int cull_mode) -> const Shader& {
+                const GLuint texture = alphaTestTexture(mesh.material);
+                applyShadowState(bending, cull_mode, texture);
+                return texture != 0 ? *bending.masked : *bending.opaque;
+            });
+        }
+        return drawn;
+    };
+
+    // Renders views [first, first + count) in one pass of the given programs, which is more than
+    // one only for the layered point light faces. cullMatrix bounds all of them. Returns the
+    // entity casters drawn.
+    auto renderViews = [&](const DepthPrograms& programs, int first, int count, const glm::mat4& cullMatrix) {
+        PROFILE_SCOPE("shadow view");
+        Frustum frustum;
+        frustum.extractFromMatrix(cullMatrix);
+        // A single view reaches its tile through the viewport, layered ones place themselves
+        auto bindTarget = [&](bool cache) {
+            if (count > 1) {
+                cache ? bindShadowCacheLayers() : bindShadowLayers();
+                glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
             } else {
-                glEnable(GL_CULL_FACE);
-                glCullFace(GL_FRONT);
+                const ShadowTile& tile = shadowTiles[first];
+                cache ? bindShadowCacheLayer(tile.layer) : bindShadowLayer(tile.layer);
+                glViewport(tile.x, tile.y, tile.size, tile.size);
             }
-            lastCullMode = mesh->cull_mode;
+        };
+        auto clearTiles = [&](bool cache) {
+            for (int v = first; v < first + count; ++v) {
+                cache ? bindShadowCacheLayer(shadowTiles[v].layer) : bindShadowLayer(shadowTiles[v].layer);
+                clearShadowTile(shadowTiles[v]);
+            }
+        };
+
+        int drawn = 0;
+        if (use_shadow_cache) {
+            // Static casters stay in the cache until a view's matrix or tile, the static scene or
+            // the batching mode changes. They keep the LOD they were rendered at until then.
+            auto cached = [&](int v) {
+                const ShadowCacheEntry& entry = shadowCache[v];
+                return entry.valid && entry.generation == shadow_map_generation &&
+                       entry.light_space == shadow.light_space[v] && entry.tile == shadowTiles[v] &&
+                       entry.static_version == entity_manager.staticVersion() &&
+                       entry.static_batches == staticBatchingActive();
+            };
+            bool hit = shadowCache[first].views == count;
+            for (int v = first; v < first + count && hit; ++v) hit = cached(v);
+
+            if (!hit) {
+                clearTiles(true);
+                bindTarget(true);
+                const int casters = drawCasters(programs, cullMatrix, frustum, CASTERS_STATIC);
+                // Whatever else was cached under these tiles is gone
+                for (int v = first; v < first + count; ++v) {
+                    for (ShadowCacheEntry& other : shadowCache) {
+                        if (other.tile.overlaps(shadowTiles[v])) other.valid = false;
+                    }
+                }
+                for (int v = first; v < first + count; ++v) {
+                    ShadowCacheEntry& entry = shadowCache[v];
+                    entry.light_space = shadow.light_space[v];
+                    entry.tile = shadowTiles[v];
+                    entry.generation = shadow_map_generation;
+                    entry.static_version = entity_manager.staticVersion();
+                    entry.static_batches = staticBatchingActive();
+                    entry.views = v == first ? count : 0;
+                    entry.casters = v == first ? casters : 0;
+                    entry.valid = true;
+                }
+            } else {
+                stats.shadowViewsCached += count;
+            }
+            for (int v = first; v < first + count; ++v) copyShadowCacheTile(shadowTiles[v]);
+            bindTarget(false);
+            drawn = shadowCache[first].casters + drawCasters(programs, cullMatrix, frustum, CASTERS_DYNAMIC);
+        } else {
+            clearTiles(false);
+            bindTarget(false);
+            drawn = drawCasters(programs, cullMatrix, frustum, CASTERS_ALL);
         }
 
-        // Only bind texture if different
-        GLuint texture_to_use = mesh->material.hasAlbedoMap() ? mesh->material.albedo_map : default_texture_id;
-        if (texture_to_use != lastTexture) {
-            glBindTexture(GL_TEXTURE_2D, texture_to_use);
-            lastTexture = texture_to_use;
+        // Everything the spatial index doesn't return counts as culled too. Static casters drawn
+        // from the chunks were never candidates of the entity path.
+        if (!gpuCullingActive()) {
+            const uint32_t excluded = staticBatchingActive() ? ENTITY_COMPONENT_STATIC : 0u;
+            stats.shadowCastersDrawn += drawn;
+            stats.shadowCastersCulled += (int)entity_manager.query(ENTITY_COMPONENT_SHADOW_CASTER, excluded).size() - drawn;
         }
+        return drawn;
+    };
 
-        glBindBuffer(GL_ARRAY_BUFFER, mesh->instanceVBO);
-        glBufferData(GL_ARRAY_BUFFER, matrices.size() * sizeof(glm::mat4), matrices.data(), GL_DYNAMIC_DRAW);
+    for (int i = 0; i < frame_uniforms.lights.count; ++i) {
+        const glm::ivec4& info = shadow.lights[i];
+        if (info.y == 0) continue;
 
-        glBindVertexArray(mesh->VAO);
-        glDrawElementsInstanced(GL_TRIANGLES, mesh->INDEX_COUNT, GL_UNSIGNED_INT, 0, matrices.size());
+        if (info.z == SHADOW_KIND_CUBE && use_layered_shadows && shadow_cube_programs.opaque) {
+            if (!shadowViewDue[info.x]) continue; // Cube faces are scheduled together
+            // Every cube face in one traversal, culled against the light's range box. shadow_cube.gs
+            // drops each triangle from the faces whose frustum it misses and clips it to the tiles.
+            const float range = lightRange(frameLight(i));
+            glm::mat4 rangeBox = glm::ortho(-range, range, -range, range, -range, range) *
+                                 glm::translate(glm::mat4(1.0f), -frameLight(i).position);
+            for (const Shader* program : {shadow_cube_programs.opaque.get(), shadow_cube_programs.masked.get(),
+                                          shadow_cube_programs.pulled_opaque.get(), shadow_cube_programs.pulled_masked.get(),
+                                          shadow_skinned_cube_programs.opaque.get(), shadow_skinned_cube_programs.masked.get()}) {
+                if (!program) continue;
+                program->use();
+                program->setInt("firstView", info.x);
+            }
+            for (int plane = 0; plane < 4; ++plane) glEnable(GL_CLIP_DISTANCE0 + plane);
+            const int drawn = renderViews(shadow_cube_programs, info.x, info.y, rangeBox);
+            for (int face = 0; face < info.y; ++face) recordShadowView(i, face, face == 0 ? drawn : 0);
+            for (int plane = 0; plane < 4; ++plane) glDisable(GL_CLIP_DISTANCE0 + plane);
+        } else {
+            // Each cascade or face only draws the casters inside its own view. Cascade boxes
+            // reach SHADOW_CASTER_DEPTH towards the light so off-screen casters still land in them.
+            for (int v = info.x; v < info.x + info.y; ++v) {
+                if (!shadowViewDue[v]) continue;
+                for (const Shader* program : {shadow_programs.opaque.get(), shadow_programs.masked.get(),
+                                              shadow_programs.pulled_opaque.get(), shadow_programs.pulled_masked.get(),
+                                              shadow_skinned_programs.opaque.get(), shadow_skinned_programs.masked.get(),
+                                              shadow_foliage_programs.opaque.get(), shadow_foliage_programs.masked.get()}) {
+                    if (!program) continue;
+                    program->use();
+                    program->setInt(U_SHADOW_VIEW, v);
+                }
+                recordShadowView(i, v - info.x, renderViews(shadow_programs, v, 1, shadow.light_space[v]));
+            }
+        }
     }
 
-    glBindVertexArray(0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (shadow.filter_quality == SHADOW_FILTER_MOMENTS) resolveShadowMoments();
+
+    gl_state.bindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
     glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
-    glCullFace(GL_BACK);
-}
-
-void Renderer::setGlobalUniforms(const Camera& camera, int shadowLightIndex) {
-    std::vector<glm::vec3> positions, colors, directions;
-    std::vector<float> intensities, inner_cutoffs, outer_cutoffs, types;
-
-    for (const auto& light : lights) {
-        positions.push_back(light.position);
-        colors.push_back(light.color);
-        intensities.push_back(light.intensity);
-        directions.push_back(light.direction);
-        inner_cutoffs.push_back(light.inner_cutoff_cos);
-        outer_cutoffs.push_back(light.outer_cutoff_cos);
-        types.push_back((float)light.type);
-    }
-
-    pbr_shader->use();
-    pbr_shader->setInt("lightCount", (int)lights.size());
-    pbr_shader->setVec3Array("lightPositions", positions);
-    pbr_shader->setVec3Array("lightColors", colors);
-    pbr_shader->setFloatArray("lightIntensities", intensities);
-    pbr_shader->setVec3Array("lightDirections", directions);
-    pbr_shader->setFloatArray("lightInnerCutoffs", inner_cutoffs);
-    pbr_shader->setFloatArray("lightOuterCutoffs", outer_cutoffs);
-    pbr_shader->setFloatArray("lightTypes", types);
-    pbr_shader->setMat4("view", view);
-    pbr_shader->setMat4("projection", projection);
-    pbr_shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
-    pbr_shader->setVec3("viewPos", camera.position);
-    pbr_shader->setInt("shadowLightIndex", shadowLightIndex);
-}
-
-void Renderer::bindMaterial(const Material* material) {
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, material->hasAlbedoMap() ? material->albedo_map : default_texture_id);
-    pbr_shader->setInt("albedoMap", 0);
-    pbr_shader->setInt("hasAlbedoMap", material->hasAlbedoMap() ? 1 : 0);
-    
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, material->hasNormalMap() ? material->normal_map : default_texture_id);
-    pbr_shader->setInt("normalMap", 1);
-    pbr_shader->setInt("hasNormalMap", material->hasNormalMap() ? 1 : 0);
-
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, material->hasORMMap() ? material->orm_map : default_texture_id);
-    pbr_shader->setInt("ormMap", 2);
-    pbr_shader->setInt("hasORMMap", material->hasORMMap() ? 1 : 0);
-    pbr_shader->setInt("hasHeightMap", material->hasHeightMap() ? 1 : 0);
-
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, material->hasEmissiveMap() ? material->emissive_map : default_texture_id);
-    pbr_shader->setInt("emissiveMap", 3);
-    pbr_shader->setInt("hasEmissiveMap", material->hasEmissiveMap() ? 1 : 0);
-
-    // Ensure shadow map stays bound at texture unit 4
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
-    pbr_shader->setInt("shadowMap", 4);
-
-    // Set material properties
-    pbr_shader->setVec3("baseColor", material->base_color);
-    pbr_shader->setFloat("metallic", material->metallic);
-    pbr_shader->setFloat("roughness", material->roughness);
-    pbr_shader->setFloat("ao", material->ao);
-    pbr_shader->setVec3("emissive", material->emissive);
-    pbr_shader->setFloat("heightScale", material->height_scale);
+    gl_state.apply(PipelineState());
+}
+
+void Renderer::resolveShadowMoments() {
+    const ShadowBlock& shadow = frame_uniforms.shadow;
+
+    // Raw depth for texelFetch, the compare comes back for the other filters' next frame
+    gl_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, shadowMapTexture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    gl_state.bindTexture(1, GL_TEXTURE_2D, shadowMomentsBlurTexture);
+    gl_state.apply(PIPELINE_FULLSCREEN.withProgram(shadow_moments_shader->getProgram()).withVertexArray(fullscreenVAO));
+    shadow_moments_shader->setVec2("momentExponents", glm::vec2(shadow_moment_exponents[0], shadow_moment_exponents[1]));
+
+    // Rows into the blur page, then columns back into the tile. Views reused this frame keep theirs.
+    for (int v = 0; v < shadow.view_count; ++v) {
+        if (!shadowViewDue[v]) continue;
+        const ShadowTile& tile = shadowTiles[v];
+        glViewport(tile.x, tile.y, tile.size, tile.size);
+        glUniform3i(shadow_moments_shader->getUniformLocation(U_TILE_RECT), tile.x, tile.y, tile.size);
+        shadow_moments_shader->setInt(U_LAYER, tile.layer);
+
+        bindShadowMomentsBlur();
+        shadow_moments_shader->setInt(U_BLUR_PASS, 0);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        bindShadowMomentsLayer(tile.layer);
+        shadow_moments_shader->setInt(U_BLUR_PASS, 1);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    // Every page's whole pyramid, a fixed cost per frame however many fragments sample it
+    gl_state.bindTexture(5, GL_TEXTURE_2D_ARRAY, shadowMomentsTexture);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+    gl_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, shadowMapTexture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+}
+
+void Renderer::updateFrameUniforms(const Camera& camera) {
+    PROFILE_SCOPE("frame uniforms");
+    CameraBlock& camera_block = frame_uniforms.camera;
+    camera_block.view = frame_view.view;
+    camera_block.projection = frame_view.projection;
+    camera_block.view_projection = frame_view.view_projection;
+    camera_block.view_position = camera.position;
+
+    // Directional lights always make the frame lights, the local ones compete for the rest by
+    // shadow importance. The winners keep their scene order, so shadow slots stay put.
+    const Frustum& cameraFrustum = frame_view.frustum;
+    const size_t sceneLights = std::min<size_t>(lights.size(), MAX_LIGHTS);
+    FrameVector<std::pair<float, int>> candidates;
+    FrameVector<int> chosen;
+    FrameVector<float> importance(sceneLights, 1.0f);
+    for (size_t i = 0; i < sceneLights; ++i) {
+        if (lights[i].type == DIR_LIGHT) {
+            if (chosen.size() < FRAME_UNIFORMS_MAX_LIGHTS) chosen.push_back((int)i);
+            continue;
+        }
+        importance[i] = shadowImportance(lights[i], camera, cameraFrustum);
+        if (importance[i] > 0.0f) candidates.push_back({ importance[i], (int)i });
+    }
+    const size_t localSlots = std::min(candidates.size(), FRAME_UNIFORMS_MAX_LIGHTS - chosen.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + localSlots, candidates.end(),
+                      [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+                          return a.first > b.first || (a.first == b.first && a.second < b.second);
+                      });
+    const size_t directional = chosen.size();
+    for (size_t c = 0; c < localSlots; ++c) chosen.push_back(candidates[c].second);
+    std::sort(chosen.begin() + directional, chosen.end());
+
+    // The packed lights are kept by light.cpp and only repacked when one changes. Frame slots
+    // moving dirty just those lights, so a still scene uploads no light rows at all.
+    LightBlock& light_block = frame_uniforms.lights;
+    light_block.count = (int32_t)chosen.size();
+    FrameVector<int> frameIndexOf(sceneLights, -1);
+    for (int i = 0; i < light_block.count; i++) {
+        frameLights[i] = chosen[i];
+        frameLightImportance[i] = importance[chosen[i]];
+        frameIndexOf[chosen[i]] = i;
+    }
+    for (size_t i = 0; i < sceneLights; ++i) setLightFrameIndex(i, frameIndexOf[i]);
+    const std::vector<GpuLight>& packed = gpuLights();
+    for (int i = 0; i < light_block.count; i++) light_block.lights[i] = packed[chosen[i]];
+    size_t dirtyBegin, dirtyEnd;
+    takeDirtyLights(dirtyBegin, dirtyEnd);
+    light_clusters.uploadLights(packed, dirtyBegin, dirtyEnd);
+
+    // Every local light whose range reaches the view is clustered, the frame ones included.
+    // Importance is 0 exactly for the ones off screen, so they never take CLUSTER_MAX_LIGHTS slots.
+    clusterLights.clear();
+    for (size_t i = 0; i < sceneLights && i < CLUSTER_MAX_LIGHTS; ++i) {
+        if (lights[i].type != DIR_LIGHT && importance[i] > 0.0f) clusterLights.push_back((uint32_t)i);
+    }
+    light_clusters.update(packed, clusterLights.data(), clusterLights.size(), view, projection, camera.near_plane, camera.far_plane);
+    light_block.cluster_light_count = light_clusters.lightCount();
+    light_block.cluster_depth_scale = light_clusters.depthScale();
+    light_block.cluster_depth_bias = light_clusters.depthBias();
+    ibl.fillLightBlock(light_block);
+    volumetric_fog.fillLightBlock(light_block);
+    reflection_probes.select(camera.position, light_block);
+    stats.clusterLights = light_clusters.lightCount();
+
+    planShadowAtlas(frame_uniforms.shadow);
+
+    frame_uniforms.update();
+}
+
+void Renderer::renderAmbientOcclusion() {
+    PROFILE_SCOPE("ssao");
+    ssaoActive = use_ssao && ssao.compute(view, projection);
+    if (!ssaoActive) ssao.resetHistory();
+}
+
+void Renderer::renderVolumetricFog() {
+    if (!frame_uniforms.lights.volumetric_fog) return;
+    // The froxels read the shadows and the clusters from the units the main pass has them on
+    gl_state.bindTextureUnit(4, GL_TEXTURE_2D_ARRAY, shadowMapTexture);
+    light_clusters.bind(6);
+    volumetric_fog.render(frame_view.view, frame_view.view_projection);
+}
+
+void Renderer::bindMaterial(uint32_t material_id, PbrOutput output, bool far_shading) {
+    const Material* material = materialTable.material(material_id);
+    const uint32_t features = pbrFeatures(*material, far_shading);
+    ShaderVariants& variants = output == PBR_OIT       ? *pbr_oit_variants
+                               : output == PBR_GBUFFER ? *pbr_gbuffer_variants
+                               : output == PBR_SKINNED ? *pbr_skinned_variants
+                               : output == PBR_TERRAIN ? *pbr_terrain_variants
+                               : output == PBR_FOLIAGE ? *pbr_foliage_variants
+                                                       : *pbr_variants;
+    Shader& shader = variants.get(features);
+    shader.use();
+
+    // Samplers were set at link time and the shadow map sits on unit 4 for the whole pass.
+    // Only the textures the variant samples, materials sharing them skip these in the state cache.
+    // An albedo map with an atlas layer is read from its array, which small props share.
+    if (features & MATERIAL_FLAG_ALBEDO_MAP) {
+        GLuint atlas = 0;
+        int layer = 0;
+        if (use_texture_atlas && texture_atlas.find(material->albedo_map, atlas, layer)) {
+            gl_state.bindTextureUnit(TEXTURE_ATLAS_UNIT, GL_TEXTURE_2D_ARRAY, atlas);
+        } else {
+            gl_state.bindTextureUnit(0, GL_TEXTURE_2D, material->albedo_map);
+        }
+    }
+    if (features & MATERIAL_FLAG_NORMAL_MAP) gl_state.bindTextureUnit(1, GL_TEXTURE_2D, material->normal_map);
+    if (features & (MATERIAL_FLAG_ORM_MAP | MATERIAL_FLAG_HEIGHT_MAP)) {
+        gl_state.bindTextureUnit(2, GL_TEXTURE_2D, material->hasORMMap() ? material->orm_map : default_texture_id);
+    }
+    if (features & MATERIAL_FLAG_EMISSIVE_MAP) gl_state.bindTextureUnit(3, GL_TEXTURE_2D, material->emissive_map);
+
+    // Scalars are already in the material table
+    shader.setInt(U_MATERIAL_INDEX, materialTable.slotFor(material_id));
 }
 
 void Renderer::renderScene(EntityManager& entity_manager) {
+    PROFILE_SCOPE("scene");
     stats.reset();  // Reset at start of frame
-    
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-    glDepthFunc(GL_EQUAL);
-    glDepthMask(GL_FALSE);
 
-    Frustum frustum;
-    frustum.extractFromMatrix(projection * view);
+    // Mips of the albedo arrays packed into since the last frame
+    texture_atlas.flush();
+
+    // Variants earlier frames asked for that have finished compiling in the meantime
+    pbr_variants->poll();
+    if (pbr_oit_variants) pbr_oit_variants->poll();
+    if (pbr_gbuffer_variants) pbr_gbuffer_variants->poll();
+    if (pbr_skinned_variants) pbr_skinned_variants->poll();
+    if (pbr_terrain_variants) pbr_terrain_variants->poll();
+    if (pbr_foliage_variants) pbr_foliage_variants->poll();
     
-    std::vector<std::pair<float, std::pair<Mesh*, glm::mat4>>> transparentObjects;
-    std::unordered_map<const Material*, std::unordered_map<Mesh*, std::vector<glm::mat4>>> materialBatches;
+    // What the prepass skipped depth-tests and writes for itself
+    gl_state.apply(prepassComplete ? PIPELINE_OPAQUE_PREPASSED : PIPELINE_OPAQUE);
+
+    // Unit 4 is only ever the shadow map, 5 its moments, 6 to 8 the light clusters, 9 to 12 the
+    // G-buffer (9 the SSAO until the opaques are done), 13 and 14 the image-based ambient, 15
+    // the lightmaps and VOLUMETRIC_FOG_UNIT the fog, which the sky reads after this pass too
+    gl_state.bindTextureUnit(4, GL_TEXTURE_2D_ARRAY, shadowMapTexture);
+    if (shadowMomentsTexture != 0) gl_state.bindTextureUnit(5, GL_TEXTURE_2D_ARRAY, shadowMomentsTexture);
+    // Waits for the assignment updateFrameUniforms() started, if the shadow pass hasn't hidden it
+    light_clusters.bind(6);
+    stats.clusterIndices = light_clusters.indexCount();
+    stats.clusterMaxLights = light_clusters.maxClusterLights();
+    ibl.bind(13);
+    reflection_probes.bind();
+    lightmap_atlas.bind(15);
+    if (frame_uniforms.lights.volumetric_fog) volumetric_fog.bind(VOLUMETRIC_FOG_UNIT);
+    if (ssaoActive) {
+        ssao.bind(9);
+    } else {
+        gl_state.bindTextureUnit(9, GL_TEXTURE_2D, default_texture_id);
+    }
+
+    FrameVector<std::pair<float, std::pair<Mesh*, glm::mat4>>> transparentObjects;
+    ImpostorBatches impostorBatches;
+    const bool gpuDriven = gpuCullingActive();
+    const bool staticActive = staticBatchingActive();
     
-    for (size_t i = 0; i < entity_manager.size(); i++) {
-        Entity* entity = entity_manager.getEntityAt(i);
-        if (!entity || !entity->active) continue;
-        
-        stats.entitiesTotal++;  // COUNT TOTAL
-        
-        bool is_light = false;
-        for (const auto& light : lights) {
-            if (entity->name == light.entity_name) {
-                is_light = true;
-                break;
-            }
-        }
-        if (is_light) continue;
-        
-        float radius = glm::length(entity->scale) * 5.0f;
-        if (!frustum.sphereInFrustum(entity->position, radius)) {
-            stats.entitiesCulled++;  // COUNT CULLED
-            continue;
-        }
-        
+    stats.entitiesTotal = entity_manager.size();  // COUNT TOTAL
+    stats.entitiesCulled = renderListCounts.culled;  // COUNT CULLED
+    stats.entitiesOccluded = renderListCounts.occluded;
+    stats.entitiesTooSmall = renderListCounts.too_small;
+    stats.meshletsTested = renderListCounts.meshlets_tested;
+    stats.meshletsCulled = renderListCounts.meshlets_culled;
+
+    // CPU side of the main pass, listing, sorting and uploading the draws
+    const int batchingScope = profiler.push("batching");
+
+    // Materials are copied per mesh, the table merges the ones that bind identically. Its id
+    // is the draw sort state, resolved once per mesh per frame.
+    materialTable.beginFrame();
+    meshMaterialFrame++;
+    auto meshMaterialIndex = [&](const Mesh* mesh) {
+        if (mesh->draw_id >= meshMaterialCache.size()) meshMaterialCache.resize(mesh->draw_id + 1, {0, 0});
+        auto& cached = meshMaterialCache[mesh->draw_id];
+        if (cached.first != meshMaterialFrame) cached = {meshMaterialFrame, materialTable.idFor(mesh->material)};
+        return cached.second;
+    };
+
+    // The prepass drew from exactly this list, so every draw it took finds its depth under GL_EQUAL
+    opaqueDraws.clear();
+    for (const RenderItem& item : renderList) {
+        const Entity* entity = item.entity;
         stats.entitiesRendered++;  // COUNT RENDERED
+        stats.lodCounts[std::min(item.lod, LOD_STATS_LEVELS - 1)]++;
+        // Chosen with the geometric LOD, both levels of a cross-fade shade alike
+        const bool farShading = use_shading_lod && !gpuDriven &&
+                                (item.lod >= shading_lod_far_level || item.distance >= shading_lod_far_distance);
+        stats.shadingTierCounts[farShading ? 1 : 0]++;
         
-        glm::mat4 model = entity->getModelMatrix(entity);
-        
-        // Calculate distance for LOD selection
-        float distance = glm::length(global_camera.position - entity->position);
-        const auto& meshesToUse = entity->getMeshesForDistance(distance);  // USE LOD HERE!
-        
-        for (auto& meshPtr : meshesToUse) {  // Use LOD meshes
-            if (meshPtr && meshPtr->isValid()) {
+        const glm::mat4& model = item.model;
+        // Same meshes and fades as the prepass, so the dithered fragments pass GL_EQUAL
+        entity->forEachLODLevel([&](const Entity::LODLevel& level, float fade) {
+            if (level.impostor) impostorBatches[level.impostor.get()].add(model, fade);
+            for (auto& meshPtr : level.meshes) {
+                if (!meshPtr || !meshPtr->isValid()) continue;
                 if (meshPtr->material.alphaMode == BLEND) {
-                    transparentObjects.push_back({distance, {meshPtr.get(), model}});
-                } else {
-                    materialBatches[&meshPtr->material][meshPtr.get()].push_back(model);
+                    // Blended meshes don't dither, just switch to the incoming level
+                    if (fade >= 0.0f) transparentObjects.push_back({item.distance, {meshPtr.get(), model}});
+                } else if (!gpuDriven) {
+                    // Same clusters as the prepass took
+                    const MeshletCull* cull = findMeshletCull(item, meshPtr.get());
+                    if (cull && cull->range_count == 0) continue;
+                    uint32_t material = meshMaterialIndex(meshPtr.get());
+                    opaqueDraws.add(meshPtr.get(),
+                                    opaqueDrawState(materialTable.material(material), farShading, inDepthPrepass(item, meshPtr->material, fade)),
+                                    materialSortState(pbrFeatures(meshPtr->material, farShading), material, farShading), model, fade, item.distance,
+                                    cull ? &meshletRanges[cull->first_range] : nullptr, cull ? cull->range_count : 0);
                 }
             }
+        });
+    }
+
+    // Chunks count their members as a whole
+    if (staticActive) {
+        for (const StaticBatches::Chunk& chunk : static_batches.getChunks()) {
+            stats.staticChunksTotal++;
+            if (!chunk.visible) {
+                stats.entitiesCulled += chunk.entity_count;
+                continue;
+            }
+            const StaticBatches::Level& level = chunk.levels[std::min<size_t>(chunk.current_lod, chunk.levels.size() - 1)];
+            stats.staticChunksRendered++;
+            stats.entitiesRendered += chunk.entity_count;
+            stats.lodCounts[std::min(chunk.current_lod, LOD_STATS_LEVELS - 1)] += chunk.entity_count;
+            stats.shadingTierCounts[0] += chunk.entity_count;
+            stats.instancesRendered += level.instances;
+            stats.trianglesRendered += level.triangles;
         }
     }
     
-    int lastCullMode = -1;
-    
-    for (auto& [material, meshBatches] : materialBatches) {
-        bindMaterial(material);
-        stats.materialChanges++;  // COUNT MATERIAL CHANGES
-        
-        for (auto& [mesh, matrices] : meshBatches) {
-            if (mesh->cull_mode != lastCullMode) {
-                switch (mesh->cull_mode) {
-                    case CULL_NONE: glDisable(GL_CULL_FACE); break;
-                    case CULL_BACK: glEnable(GL_CULL_FACE); glCullFace(GL_BACK); break;
-                    case CULL_FRONT: glEnable(GL_CULL_FACE); glCullFace(GL_FRONT); break;
-                }
-                lastCullMode = mesh->cull_mode;
-            }
-            
-            if (matrices.size() == 1) {                
-                glBindVertexArray(mesh->VAO);
-                glDrawElements(GL_TRIANGLES, mesh->INDEX_COUNT, GL_UNSIGNED_INT, 0);
-                
-                stats.drawCalls++;  // COUNT DRAW CALL
-                stats.trianglesRendered += mesh->TRIANGLE_COUNT;
-            } else {
-                renderInstancedMesh(mesh, matrices);
-                
-                stats.instancedDrawCalls++;  // COUNT INSTANCED CALL
-                stats.instancesRendered += matrices.size();
-                stats.trianglesRendered += mesh->TRIANGLE_COUNT * matrices.size();
+    opaqueDraws.upload();
+
+    // Skinned meshes draw apart from the lists, their materials still go up with the frame's
+    const bool skinnedActive = pbr_skinned_variants && !skinned_animation.empty();
+    if (skinnedActive) {
+        auto countSkinned = [&](const SkinnedModel& model, size_t instances) {
+            if (instances == 0) return;
+            for (const auto& mesh : model.meshes) {
+                meshMaterialIndex(mesh.get());
+                stats.instancedDrawCalls++;
+                stats.instancesRendered += (int)instances;
+                stats.trianglesRendered += mesh->TRIANGLE_COUNT * (int)instances;
+            }
+        };
+        for (const SkinnedAnimation::Group& group : skinned_animation.groups()) countSkinned(*group.model, group.transforms.size());
+        for (const BakedClip& clip : skinned_animation.bakedClips()) countSkinned(*clip.model, clip.transforms.size());
+    }
+
+    // So do the terrain's, its chunks picked against the camera's own frustum
+    terrainChunks.clear();
+    uint32_t terrainMaterial = 0;
+    if (use_terrain && terrain.ready() && pbr_terrain_variants) {
+        const Frustum& frustum = frame_view.frustum;
+        terrain.select(frustum, frameCameraPosition, terrainChunks);
+        if (!terrainChunks.empty()) terrainMaterial = materialTable.idFor(terrain.material());
+    }
+
+    // And foliage's, its cells (or on the GPU its instances) culled against the same frustum
+    const bool foliageActive = use_foliage && !foliage.empty() && pbr_foliage_variants;
+    if (foliageActive) {
+        PROFILE_SCOPE("foliage cull");
+        foliage.forEachMesh([&](const Mesh& mesh) { materialTable.idFor(mesh.material); });
+        const Frustum& frustum = frame_view.frustum;
+        foliage.cull(frustum, frameCameraPosition);
+    }
+
+    // F11 takes the list as it was batched
+    if (draw_capture.capturePending() && !gpuDriven) {
+        draw_capture.capture(opaqueDraws, [](const DrawList::Draw& draw) { return ((uintptr_t)draw.state & 1) != 0; });
+    }
+    // A replay's list is built alongside, so its materials go up with the frame's
+    if (draw_capture.replaying()) {
+        replayDraws.clear();
+        const auto& captured = draw_capture.replayDraws();
+        for (uint32_t i = 0; i < captured.size(); ++i) {
+            Mesh* mesh = captured[i].mesh.get();
+            const void* state = opaqueDrawState(materialTable.material(meshMaterialIndex(mesh)), captured[i].far_shading, false);
+            // The draw's index as its sort state keeps the captured order and splits
+            for (uint32_t n = 0; n < captured[i].instance_count; ++n) {
+                const uint32_t instance = captured[i].first_instance + n;
+                replayDraws.add(mesh, state, i, draw_capture.replayMatrices()[instance], draw_capture.replayFades()[instance]);
             }
         }
+        replayDraws.upload();
     }
-    
-    glBindVertexArray(0);
-    
-    glDepthMask(GL_TRUE);
-    glDepthFunc(GL_LESS);
 
-    std::sort(transparentObjects.begin(), transparentObjects.end(), 
-              [](const auto& a, const auto& b) {
-        return a.first > b.first;
+    for (const DrawList::Draw& draw : opaqueDraws.getDraws()) {
+        if (draw.instance_count == 0) continue;
+        if (draw.instance_count == 1) {
+            stats.drawCalls++;  // COUNT DRAW CALL
+        } else {
+            stats.instancedDrawCalls++;  // COUNT INSTANCED CALL
+            stats.instancesRendered += draw.instance_count;
+        }
+        stats.trianglesRendered += draw.index_count / 3 * draw.instance_count;
+    }
+
+    // Every material the opaque list found goes up in one block write
+    materialTable.upload();
+    profiler.pop(batchingScope);
+
+    // From here the passes go through the render graph, ordered by what they read and write. The
+    // scene framebuffer is imported, so whatever draws into it is kept, and the G-buffer's and
+    // the weighted OIT's targets are transients whose depth copies share one texture.
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const RenderResource sceneColor = render_graph.importTexture("scene", 0);
+
+    // Deferred, the opaques only write their surface and one fullscreen pass lights each pixel
+    // once, however many triangles overlapped it. Impostors and blended meshes stay forward.
+    const bool deferredWanted = use_deferred_shading && pbr_gbuffer_variants && deferred_lighting_shader && prepassComplete &&
+                                gbuffer.available();
+    GBuffer::Targets gbufferTargets;
+    if (deferredWanted) gbufferTargets = gbuffer.declare(render_graph, viewport[2], viewport[3]);
+    bool deferred = false;
+    PbrOutput opaqueOutput = PBR_FORWARD;
+
+    uint32_t lastMaterial = UINT32_MAX;
+    auto applyOpaqueState = [&](const Material* material, int cull_mode, bool far_shading, bool prepassed) {
+        uint32_t id = materialTable.idFor(*material);
+        const uint32_t key = (id << 1) | (far_shading ? 1u : 0u);
+        if (key != lastMaterial) {
+            bindMaterial(id, opaqueOutput, far_shading);
+            stats.materialChanges++;  // COUNT MATERIAL CHANGES
+            lastMaterial = key;
+        }
+        gl_state.setCullMode(cull_mode);
+        // The prepass's dithered holes only stay open under GL_EQUAL
+        if (!prepassComplete) {
+            gl_state.depthFunc(prepassed ? GL_EQUAL : GL_LEQUAL);
+            gl_state.depthMask(!prepassed);
+        }
+    };
+
+    const bool batchesPrepassed = prepassMode != PREPASS_NEVER;
+    render_graph.addPass("opaque", [&](RenderGraph::Builder& pass) {
+        // The scene as well, it shades forward when the G-buffer can't be had
+        pass.write(sceneColor);
+        pass.write(gbufferTargets.albedo);
+        pass.write(gbufferTargets.normal);
+        pass.write(gbufferTargets.material);
+        pass.write(gbufferTargets.depth);
+    }, [&](RenderGraph::Context& context) {
+        deferred = deferredWanted && gbuffer.begin(context, gbufferTargets);
+        opaqueOutput = deferred ? PBR_GBUFFER : PBR_FORWARD;
+        if (gpuDriven) {
+            // Lists from the prepass cull, counts stay on the GPU
+            stats.submittedDrawCalls = gpu_culling->submit([&](const GpuCulling::Slot& slot) {
+                applyOpaqueState(slot.material, slot.mesh->cull_mode, false, batchesPrepassed);
+            });
+        } else {
+            stats.submittedDrawCalls = opaqueDraws.submit([&](const DrawList::Draw& draw) {
+                const uintptr_t state = (uintptr_t)draw.state;
+                applyOpaqueState((const Material*)(state & ~(uintptr_t)3), draw.cull_mode, (state & 1) != 0, (state & 2) != 0);
+            });
+        }
+        if (staticActive) {
+            stats.submittedDrawCalls += static_batches.submit([&](const StaticBatches::Draw& draw) {
+                applyOpaqueState(draw.material, draw.cull_mode, false, batchesPrepassed);
+            });
+        }
+        if (draw_capture.replaying()) {
+            PROFILE_SCOPE("draw replay");
+            gl_state.apply(PIPELINE_DRAW_REPLAY);
+            draw_capture.beginReplay();
+            for (int repeat = 0; repeat < draw_capture.repeatCount(); ++repeat) {
+                uint32_t boundMaterial = UINT32_MAX;
+                replayDraws.submit([&](const DrawList::Draw& draw) {
+                    const uintptr_t state = (uintptr_t)draw.state;
+                    const uint32_t id = materialTable.idFor(*(const Material*)(state & ~(uintptr_t)3));
+                    const uint32_t key = (id << 1) | (uint32_t)(state & 1);
+                    if (key != boundMaterial) {
+                        bindMaterial(id, opaqueOutput, (state & 1) != 0);
+                        boundMaterial = key;
+                    }
+                    gl_state.setCullMode(draw.cull_mode);
+                });
+            }
+            draw_capture.endReplay();
+        }
+        // Back to the pass's own state after the per-draw switches and the replay
+        gl_state.apply(prepassComplete ? PIPELINE_OPAQUE_PREPASSED : PIPELINE_OPAQUE);
     });
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    if (deferredWanted) {
+        render_graph.addPass("deferred lighting", [&](RenderGraph::Builder& pass) {
+            pass.read(gbufferTargets.albedo);
+            pass.read(gbufferTargets.normal);
+            pass.read(gbufferTargets.material);
+            pass.read(gbufferTargets.depth);
+            pass.write(sceneColor);
+        }, [&](RenderGraph::Context& context) {
+            if (!deferred) return;
+            gbuffer.end(context, gbufferTargets, 9);
+            gl_state.apply(PIPELINE_FULLSCREEN.withProgram(deferred_lighting_shader->getProgram()).withVertexArray(fullscreenVAO));
+            deferred_lighting_shader->setMat4("inverseViewProjection", frame_view.inverse_view_projection);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            stats.drawCalls++;
+            gl_state.apply(PIPELINE_OPAQUE_PREPASSED);
+        });
+    }
+
+    render_graph.addPass("forward", [&](RenderGraph::Builder& pass) { pass.write(sceneColor); }, [&](RenderGraph::Context&) {
+        // Forward after the deferred lighting, which would otherwise shade over them
+        if (skinnedActive) {
+            PROFILE_SCOPE("skinned");
+            gl_state.apply(PIPELINE_SKINNED);
+            // The SSAO came from the prepass depth, which doesn't have them
+            gl_state.bindTextureUnit(9, GL_TEXTURE_2D, default_texture_id);
+            uint32_t lastSkinned = UINT32_MAX;
+            drawSkinned([&](const Mesh& mesh) -> const Shader& {
+                const uint32_t id = materialTable.idFor(mesh.material);
+                if (id != lastSkinned) {
+                    bindMaterial(id, PBR_SKINNED);
+                    stats.materialChanges++;
+                    lastSkinned = id;
+                }
+                gl_state.setCullMode(mesh.cull_mode);
+                stats.submittedDrawCalls++;
+                return pbr_skinned_variants->get(pbrFeatures(*materialTable.material(id), false));
+            });
+            gl_state.apply(PIPELINE_OPAQUE_PREPASSED);
+        }
+
+        if (!terrainChunks.empty()) {
+            PROFILE_SCOPE("terrain");
+            gl_state.apply(PIPELINE_TERRAIN);
+            gl_state.bindTextureUnit(9, GL_TEXTURE_2D, default_texture_id);
+            bindMaterial(terrainMaterial, PBR_TERRAIN);
+            stats.materialChanges++;
+            stats.instancedDrawCalls++;
+            stats.submittedDrawCalls++;
+            stats.instancesRendered += (int)terrainChunks.size();
+            stats.trianglesRendered += (int)terrain.draw(terrainChunks);
+            gl_state.apply(PIPELINE_OPAQUE_PREPASSED);
+        }
+
+        if (foliageActive) {
+            PROFILE_SCOPE("foliage");
+            gl_state.apply(PIPELINE_FOLIAGE);
+            gl_state.bindTextureUnit(9, GL_TEXTURE_2D, default_texture_id);
+            uint32_t lastFoliage = UINT32_MAX;
+            const int calls = foliage.submit([&](const Mesh& mesh, int cull_mode) -> const Shader& {
+                const uint32_t id = materialTable.idFor(mesh.material);
+                if (id != lastFoliage) {
+                    bindMaterial(id, PBR_FOLIAGE);
+                    stats.materialChanges++;
+                    lastFoliage = id;
+                }
+                gl_state.setCullMode(cull_mode);
+                stats.submittedDrawCalls++;
+                return pbr_foliage_variants->get(pbrFeatures(*materialTable.material(id), false));
+            });
+            int cards = 0;
+            if (impostor_foliage_shader) {
+                impostor_foliage_shader->use();
+                gl_state.disable(GL_CULL_FACE);
+                cards = foliage.submitImpostors([&](const Impostor& impostor) {
+                    gl_state.bindTextureUnit(0, GL_TEXTURE_2D, impostor.albedo_atlas);
+                    gl_state.bindTextureUnit(1, GL_TEXTURE_2D, impostor.normal_depth_atlas);
+                    impostor_foliage_shader->setVec3(U_BOUNDS_CENTER, impostor.center);
+                    impostor_foliage_shader->setFloat(U_BOUNDS_RADIUS, impostor.radius);
+                    impostor_foliage_shader->setFloat(U_FRAMES, (float)impostor.frames);
+                });
+            }
+            stats.instancedDrawCalls += calls + cards;
+            stats.instancesRendered += foliage.drawnInstances();
+            stats.trianglesRendered += foliage.drawnTriangles();
+            gl_state.apply(PIPELINE_OPAQUE_PREPASSED);
+        }
+
+        // Under GL_EQUAL against the depth the prepass wrote for the same quads, when it drew them
+        addStaticImpostors(impostorBatches);
+        renderImpostors(impostorBatches);
+    });
+
+    // Weighted OIT doesn't care about order, so blended meshes batch and instance like the
+    // opaques. The sorted path stays for when its targets or shaders aren't available.
+    // At reduced resolution the additive particles go to their own target at the same size and
+    // come back in the same upsample.
+    const bool reducedAdditive = transparent_resolution != TRANSPARENT_RESOLUTION_FULL && particle_system.hasPass(PARTICLE_PASS_ADDITIVE);
+    const bool weightedWanted = use_weighted_oit && pbr_oit_variants && oit.available() &&
+                                (!transparentObjects.empty() || particle_system.hasPass(PARTICLE_PASS_SORTED) || reducedAdditive);
+    WeightedBlendedOIT::Targets oitTargets;
+    if (weightedWanted) oitTargets = oit.declare(render_graph, viewport[2], viewport[3]);
+    bool weightedOIT = false;
+    bool particles = false;
+    bool additiveDrawn = false;
+    render_graph.addPass("transparent", [&](RenderGraph::Builder& pass) {
+        // The opaque depth, copied for the OIT and the soft particles
+        pass.read(sceneColor);
+        pass.write(sceneColor);
+        pass.write(oitTargets.accum);
+        pass.write(oitTargets.weight);
+        pass.write(oitTargets.depth);
+        if (oitTargets.reduced()) {
+            pass.write(oitTargets.additive);
+            pass.write(oitTargets.low_depth);
+        }
+    }, [&](RenderGraph::Context& context) {
+        particles = particle_system.beginDraw();
+        const bool blendedParticles = particles && particle_system.hasPass(PARTICLE_PASS_SORTED);
+        const bool lowAdditive = particles && oitTargets.reduced() && particle_system.hasPass(PARTICLE_PASS_ADDITIVE);
+        weightedOIT = weightedWanted && (!transparentObjects.empty() || blendedParticles || lowAdditive) &&
+                      oit.begin(context, oitTargets);
+        if (weightedOIT) {
+            transparentDraws.clear();
+            for (auto& item : transparentObjects) {
+                Mesh* mesh = item.second.first;
+                uint32_t material = meshMaterialIndex(mesh);
+                transparentDraws.add(mesh, materialTable.material(material),
+                                     materialSortState(materialFeatures(mesh->material), material), item.second.second, 0.0f);
+            }
+            transparentDraws.upload();
+
+            for (const DrawList::Draw& draw : transparentDraws.getDraws()) {
+                if (draw.instance_count == 0) continue;
+                if (draw.instance_count == 1) {
+                    stats.drawCalls++;
+                } else {
+                    stats.instancedDrawCalls++;
+                    stats.instancesRendered += draw.instance_count;
+                }
+                stats.trianglesRendered += draw.mesh->TRIANGLE_COUNT * draw.instance_count;
+            }
+
+            uint32_t lastTransparent = UINT32_MAX;
+            stats.submittedDrawCalls += transparentDraws.submit([&](const DrawList::Draw& draw) {
+                uint32_t id = materialTable.idFor(*static_cast<const Material*>(draw.state));
+                if (id != lastTransparent) {
+                    bindMaterial(id, PBR_OIT);
+                    stats.materialChanges++;
+                    lastTransparent = id;
+                }
+                gl_state.setCullMode(draw.cull_mode);
+            });
+            if (blendedParticles) stats.submittedDrawCalls += particle_system.draw(PARTICLE_PASS_OIT, frameCameraPosition);
+            if (lowAdditive) {
+                oit.beginAdditive(context, oitTargets);
+                stats.submittedDrawCalls += particle_system.draw(PARTICLE_PASS_ADDITIVE, frameCameraPosition);
+                additiveDrawn = true;
+            }
+        } else {
+            std::sort(transparentObjects.begin(), transparentObjects.end(), 
+                      [](const auto& a, const auto& b) {
+                return a.first > b.first;
+            });
+            // The SSAO (or the G-buffer) is of the surfaces behind them
+            gl_state.bindTextureUnit(9, GL_TEXTURE_2D, default_texture_id);
+            gl_state.apply(PIPELINE_TRANSPARENT_SORTED);
+
+            // Sorted by distance, so only neighbours sharing a material skip the rebind, and only
+            // neighbours sharing the mesh draw together
+            uint32_t lastTransparent = UINT32_MAX;
+            FrameVector<glm::mat4> runMatrices;
+            for (size_t first = 0; first < transparentObjects.size();) {
+                Mesh* mesh = transparentObjects[first].second.first;
+                size_t end = first + 1;
+                if (use_sorted_instancing) {
+                    while (end < transparentObjects.size() && transparentObjects[end].second.first == mesh) ++end;
+                }
+                runMatrices.clear();
+                for (size_t i = first; i < end; ++i) runMatrices.push_back(transparentObjects[i].second.second);
+
+                uint32_t material = materialTable.idFor(mesh->material);
+                if (material != lastTransparent) {
+                    bindMaterial(material);
+                    stats.materialChanges++;
+                    lastTransparent = material;
+                }
+                const GLsizei count = (GLsizei)runMatrices.size();
+                drawMesh(mesh, runMatrices.data(), count);
+                if (count == 1) {
+                    stats.drawCalls++;
+                } else {
+                    stats.instancedDrawCalls++;
+                    stats.instancesRendered += count;
+                }
+                stats.trianglesRendered += mesh->TRIANGLE_COUNT * count;
+                first = end;
+            }
+            // Over the sorted meshes, whole emitters sorted among themselves
+            if (blendedParticles) stats.submittedDrawCalls += particle_system.draw(PARTICLE_PASS_SORTED, frameCameraPosition);
+        }
+    });
 
-    for (auto& item : transparentObjects) {
-        bindMaterial(&item.second.first->material);
-        stats.materialChanges++;
-        drawMesh(item.second.first, item.second.second);
-        stats.drawCalls++;
-        stats.trianglesRendered += item.second.first->TRIANGLE_COUNT;
+    if (weightedWanted) {
+        render_graph.addPass("oit composite", [&](RenderGraph::Builder& pass) {
+            pass.read(oitTargets.accum);
+            pass.read(oitTargets.weight);
+            if (oitTargets.reduced()) {
+                pass.read(oitTargets.additive);
+                pass.read(oitTargets.depth);
+                pass.read(oitTargets.low_depth);
+            }
+            pass.write(sceneColor);
+        }, [&](RenderGraph::Context& context) {
+            if (weightedOIT) oit.composite(context, oitTargets);
+        });
     }
 
-    glDisable(GL_BLEND);
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-}
+    render_graph.addPass("additive", [&](RenderGraph::Builder& pass) { pass.write(sceneColor); }, [&](RenderGraph::Context&) {
+        if (particles && !additiveDrawn) stats.submittedDrawCalls += particle_system.draw(PARTICLE_PASS_ADDITIVE, frameCameraPosition);
+    });
 
-void Renderer::renderInstancedMesh(Mesh* mesh, const std::vector<glm::mat4>& matrices) {
-    if (matrices.empty() || matrices.size() > mesh->maxInstances) return;
-    
-    // Upload instance matrices
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->instanceVBO);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, 
-                    matrices.size() * sizeof(glm::mat4), 
-                    matrices.data());
-    
-    // Draw instanced
-    glBindVertexArray(mesh->VAO);
-    glDrawElementsInstanced(GL_TRIANGLES, mesh->INDEX_COUNT, 
-                           GL_UNSIGNED_INT, 0, matrices.size());
-    glBindVertexArray(0);
+    render_graph.execute();
+
+    gl_state.apply(PipelineState());
+
+    stats.stateChanges = gl_state.getCounters().changes;
+    stats.stateChangesSkipped = gl_state.getCounters().skipped;
+    stats.uniformUploads = gl_state.getCounters().uniforms;
+    stats.uniformUploadsSkipped = gl_state.getCounters().uniforms_skipped;
 }
 
-void Renderer::drawMesh(Mesh* mesh, const glm::mat4& model) {
+void Renderer::drawMesh(Mesh* mesh, const glm::mat4* models, GLsizei count) {
     if (mesh->TRIANGLE_COUNT == 0 || !mesh->isValid()) return;
 
     // Handle culling
-    switch (mesh->cull_mode) {
-        case CULL_NONE: glDisable(GL_CULL_FACE); break;
-        case CULL_BACK: glEnable(GL_CULL_FACE); glCullFace(GL_BACK); break;
-        case CULL_FRONT: glEnable(GL_CULL_FACE); glCullFace(GL_FRONT); break;
+    gl_state.setCullMode(mesh->cull_mode);
+
+    // pbr.vs reads the instance matrix and derives the normal matrix from it, the material's
+    // variant is already bound
+    gl_state.bindVertexArray(mesh->VAO);
+    pointInstanceRange(instance_ring.write(models, nullptr, count));
+    drawMeshElements(*mesh, count);
+    pointInstanceAttributes(mesh->instanceVBO, mesh->instanceFadeVBO, 0);
+}
+
+void Renderer::drawSkinned(const std::function<const Shader&(const Mesh&)>& bind) {
+    if (!skinned_animation.groups().empty()) {
+        gl_state.bindTextureUnit(SKIN_PALETTE_UNIT, GL_TEXTURE_2D, skinned_animation.paletteTexture());
+        for (const SkinnedAnimation::Group& group : skinned_animation.groups()) {
+            const GLsizei count = (GLsizei)group.transforms.size();
+            const InstanceRing::Range range = instance_ring.write(group.transforms.data(), nullptr, count);
+            for (const auto& mesh : group.model->meshes) {
+                if (mesh->TRIANGLE_COUNT == 0 || !mesh->isValid()) continue;
+                const Shader& shader = bind(*mesh);
+                shader.setInt(U_BAKED_FRAMES, 0);
+                shader.setInt(U_PALETTE_BASE, group.first_row);
+                gl_state.bindVertexArray(mesh->VAO);
+                pointInstanceRange(range);
+                drawMeshElements(*mesh, count);
+                pointInstanceAttributes(mesh->instanceVBO, mesh->instanceFadeVBO, 0);
+            }
+        }
     }
 
-    // Calculate matrices
-    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+    // Crowds read their baked clip in the palette's place, per instance only a playback offset and speed
+    for (const BakedClip& clip : skinned_animation.bakedClips()) {
+        if (clip.transforms.empty()) continue;
+        gl_state.bindTextureUnit(SKIN_PALETTE_UNIT, GL_TEXTURE_2D, clip.texture);
+        const GLsizei count = (GLsizei)clip.transforms.size();
+        const InstanceRing::Range range = instance_ring.write(clip.transforms.data(), nullptr, count);
+        const InstanceRing::Block playback = instance_ring.writeBytes(clip.playback.data(), clip.playback.size() * sizeof(glm::vec2));
+        for (const auto& mesh : clip.model->meshes) {
+            if (mesh->TRIANGLE_COUNT == 0 || !mesh->isValid()) continue;
+            const Shader& shader = bind(*mesh);
+            shader.setInt(U_BAKED_FRAMES, clip.frames);
+            shader.setFloat(U_BAKED_FPS, SKIN_BAKE_FPS);
+            shader.setFloat(U_ANIMATION_TIME, skinned_animation.crowdTime());
+            gl_state.bindVertexArray(mesh->VAO);
+            pointInstanceRange(range);
+            // Slot 12: playback, only the skinned programs read it
+            glBindBuffer(GL_ARRAY_BUFFER, playback.buffer);
+            glEnableVertexAttribArray(12);
+            glVertexAttribPointer(12, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)playback.offset);
+            glVertexAttribDivisor(12, 1);
 
-    // Set mesh-specific uniforms ONLY
-    pbr_shader->setMat4("model", model);
-    pbr_shader->setMat3("normalMatrix", normalMatrix);
+            drawMeshElements(*mesh, count);
+            glDisableVertexAttribArray(12);
+            pointInstanceAttributes(mesh->instanceVBO, mesh->instanceFadeVBO, 0);
+        }
+    }
+}
 
-    // Draw
-    glBindVertexArray(mesh->VAO);
-    glDrawElements(GL_TRIANGLES, mesh->INDEX_COUNT, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+// The mesh and its generated levels, which share its vertices and so its lightmap UVs
+static void setLightmapLayer(Mesh* mesh, int layer) {
+    mesh->material.lightmap_layer = layer;
+    for (const auto& lod : mesh->lods) {
+        if (lod) lod->material.lightmap_layer = layer;
+    }
 }
 
-void Renderer::drawUnlitMesh(Entity* entity, Mesh* mesh, const glm::vec3& color, int intensity) {
-    if (!entity->active || mesh->TRIANGLE_COUNT == 0 || !mesh->isValid()) return;
-    
-    glDisable(GL_CULL_FACE);
-    unlit_shader->use();
-    
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), entity->position) *
-                      glm::rotate(glm::mat4(1.0f), glm::radians(entity->rotation.z), glm::vec3(0, 0, 1)) *
-                      glm::rotate(glm::mat4(1.0f), glm::radians(entity->rotation.y), glm::vec3(0, 1, 0)) *
-                      glm::rotate(glm::mat4(1.0f), glm::radians(entity->rotation.x), glm::vec3(1, 0, 0)) *
-                      glm::scale(glm::mat4(1.0f), entity->scale);
-    
-    unlit_shader->setMat4("model", model);
-    unlit_shader->setMat4("view", view);
-    unlit_shader->setMat4("projection", projection);
-    unlit_shader->setVec3("emissiveColor", color);
-    unlit_shader->setFloat("emissiveIntensity", intensity);
-    
-    glBindVertexArray(mesh->VAO);
-    glDrawElements(GL_TRIANGLES, mesh->INDEX_COUNT, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-    glEnable(GL_CULL_FACE);
-}
\ No newline at end of file
+void Renderer::clearLightmaps(EntityManager& entity_manager) {
+    for (size_t i = 0; i < entity_manager.size(); ++i) {
+        for (const auto& level : entity_manager.getEntityAt(i)->lodLevels()) {
+            for (const auto& mesh : level.meshes) {
+                if (mesh) setLightmapLayer(mesh.get(), -1);
+            }
+        }
+    }
+    for (size_t i = 0; i < lights.size(); ++i) setLightBaked(i, false);
+}
+
+int Renderer::bakeLightmaps(EntityManager& entity_manager) {
+    PROFILE_SCOPE("lightmap bake");
+    if (!lightmap_bake_shader) return 0;
+    clearLightmaps(entity_manager);
+
+    // A mesh's charts can only hold one placement's light, so meshes other entities also draw
+    // stay dynamic
+    const size_t shared = SIZE_MAX;
+    std::unordered_map<Mesh*, size_t> owners;
+    for (size_t i = 0; i < entity_manager.size(); ++i) {
+        for (const auto& level : entity_manager.getEntityAt(i)->lodLevels()) {
+            for (const auto& mesh : level.meshes) {
+                if (!mesh) continue;
+                auto [it, inserted] = owners.emplace(mesh.get(), i);
+                if (!inserted && it->second != i) it->second = shared;
+            }
+        }
+    }
+    std::vector<std::pair<Mesh*, size_t>> targets;
+    for (uint32_t i : entity_manager.query(ENTITY_COMPONENT_RENDERABLE | ENTITY_COMPONENT_STATIC)) {
+        const Entity* entity = entity_manager.getEntityAt(i);
+        for (const auto& mesh : entity->lodLevels()[0].meshes) {
+            if (mesh && mesh->isValid() && (mesh->vertex_layout.format & VERTEX_LIGHTMAP_UV) && owners[mesh.get()] == i) {
+                targets.push_back({ mesh.get(), i });
+            }
+        }
+    }
+    if (targets.empty()) {
+        printf("Lightmaps: no static meshes with lightmap UVs to bake\n");
+        return 0;
+    }
+    if (targets.size() > LIGHTMAP_MAX_LAYERS) {
+        printf("Lightmaps: %zu meshes, only the first %d get layers\n", targets.size(), LIGHTMAP_MAX_LAYERS);
+        targets.resize(LIGHTMAP_MAX_LAYERS);
+    }
+    if (!lightmap_atlas.begin((int)targets.size())) return 0;
+
+    // Every scene light, those with frame slots pointing at this frame's shadows
+    const size_t sceneLights = std::min<size_t>(lights.size(), MAX_LIGHTS);
+    const std::vector<GpuLight> bakeLights(gpuLights().begin(), gpuLights().begin() + sceneLights);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    gl_state.apply(PIPELINE_FULLSCREEN);
+    gl_state.bindTextureUnit(4, GL_TEXTURE_2D_ARRAY, shadowMapTexture);
+    if (shadowMomentsTexture != 0) gl_state.bindTextureUnit(5, GL_TEXTURE_2D_ARRAY, shadowMomentsTexture);
+    lightmap_atlas.uploadLights(bakeLights, 9);
+
+    for (size_t layer = 0; layer < targets.size(); ++layer) {
+        Mesh* mesh = targets[layer].first;
+        const glm::mat4 model = entity_manager.worldMatrices()[targets[layer].second];
+
+        lightmap_atlas.beginLayer();
+        lightmap_bake_shader->use();
+        lightmap_bake_shader->setInt("bakeLightCount", (int)bakeLights.size());
+        gl_state.bindVertexArray(mesh->VAO);
+        pointInstanceRange(instance_ring.write(&model, nullptr, 1));
+        // In bands, so one draw never runs every light over the whole layer
+        glEnable(GL_SCISSOR_TEST);
+        for (int y = 0; y < LIGHTMAP_SIZE; y += LIGHTMAP_BAKE_TILE) {
+            glScissor(0, y, LIGHTMAP_SIZE, LIGHTMAP_BAKE_TILE);
+            drawMeshElements(*mesh);
+            glFlush();
+        }
+        glDisable(GL_SCISSOR_TEST);
+        pointInstanceAttributes(mesh->instanceVBO, mesh->instanceFadeVBO, 0);
+
+        lightmap_atlas.endLayer((int)layer, 10);
+        setLightmapLayer(mesh, (int)layer);
+    }
+
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    gl_state.apply(PipelineState());
+    for (size_t i = 0; i < sceneLights; ++i) setLightBaked(i, true);
+
+    printf("Lightmaps: baked %zu lights into %zu meshes\n", sceneLights, targets.size());
+    return (int)targets.size();
+}
+
+void Renderer::renderLightProxies(EntityManager& entity_manager) {
+    PROFILE_SCOPE("light proxies");
+    const Frustum& frustum = frame_view.frustum;
+    FrameMap<Mesh*, LightProxyBatch> batches;
+    for (const Light& light : lights) {
+        const Entity* entity = entity_manager.get(light.entity);
+        if (!entity || !entity->active) continue;
+        const uint32_t index = entity_manager.indexOf(light.entity);
+        if (!entityInFrustum(frustum, entity_manager, index)) continue;
+        for (const auto& meshPtr : entity->getCurrentLODMeshes()) {
+            if (!meshPtr || !meshPtr->isValid() || meshPtr->TRIANGLE_COUNT == 0) continue;
+            LightProxyBatch& batch = batches[meshPtr.get()];
+            batch.matrices.push_back(entity_manager.worldMatrices()[index]);
+            batch.emissive.push_back(glm::vec4(light.color * (float)light.intensity, 1.0f));
+        }
+    }
+    if (batches.empty()) return;
+
+    gl_state.apply(PIPELINE_LIGHT_PROXIES.withProgram(unlit_shader->getProgram()));
+    for (const auto& [mesh, batch] : batches) {
+        gl_state.bindVertexArray(mesh->VAO);
+        pointInstanceRange(instance_ring.write(batch.matrices.data(), nullptr, batch.matrices.size()));
+        // Slot 12: emissive, only unlit.vs reads it
+        const InstanceRing::Block emissive = instance_ring.writeBytes(batch.emissive.data(), batch.emissive.size() * sizeof(glm::vec4));
+        glBindBuffer(GL_ARRAY_BUFFER, emissive.buffer);
+        glEnableVertexAttribArray(12);
+        glVertexAttribPointer(12, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)emissive.offset);
+        glVertexAttribDivisor(12, 1);
+
+        drawMeshElements(*mesh, (GLsizei)batch.matrices.size());
+        glDisableVertexAttribArray(12);
+        pointInstanceAttributes(mesh->instanceVBO, mesh->instanceFadeVBO, 0);
+    }
+    gl_state.apply(PipelineState());
+}
+
+void Renderer::renderMotionVectors(EntityManager& entity_manager) {
+    PROFILE_SCOPE("motion vectors");
+    if (!temporal_aa.beginMotion(view, projection)) return;
+
+    EntitySpan<uint32_t> moved = entity_manager.movedEntities();
+    if (motion_shader && moved.size() > 0) {
+        const Frustum& frustum = frame_view.frustum;
+        EntitySpan<uint8_t> flags = entity_manager.entityFlags();
+        gl_state.apply(PIPELINE_MOTION_VECTORS.withProgram(motion_shader->getProgram()));
+        motion_shader->setMat4("currentViewProjection", temporal_aa.currentViewProjection());
+        motion_shader->setMat4("previousViewProjection", temporal_aa.previousViewProjection());
+        // Pulled forward a little, so surfaces pass against their own prepass depth
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(-1.0f, -1.0f);
+        for (uint32_t index : moved) {
+            if (!(flags[index] & ENTITY_FLAG_ACTIVE) || !entityInFrustum(frustum, entity_manager, index)) continue;
+            const Entity* entity = entity_manager.getEntityAt(index);
+            const glm::mat4& model = entity_manager.worldMatrices()[index];
+            motion_shader->setMat4(U_PREVIOUS_MODEL, entity_manager.previousWorldMatrices()[index]);
+            for (const auto& meshPtr : entity->getCurrentLODMeshes()) {
+                Mesh* mesh = meshPtr.get();
+                if (!mesh || !mesh->isValid() || mesh->TRIANGLE_COUNT == 0) continue;
+                gl_state.setCullMode(mesh->cull_mode);
+                gl_state.bindVertexArray(mesh->VAO);
+                pointInstanceRange(instance_ring.write(&model, nullptr, 1));
+                drawMeshElements(*mesh);
+                pointInstanceAttributes(mesh->instanceVBO, mesh->instanceFadeVBO, 0);
+            }
+        }
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        gl_state.apply(PipelineState());
+    }
+
+    temporal_aa.endMotion();
+}
+
+namespace {
+
+// The frame's blocks and viewport, which extra views bend to themselves and put back
+struct SavedFrame {
+    CameraBlock camera;
+    LightBlock lights;
+    ShadowBlock shadow;
+    GLint viewport[4];
+};
+
+SavedFrame saveFrame() {
+    SavedFrame saved{frame_uniforms.camera, frame_uniforms.lights, frame_uniforms.shadow, {}};
+    glGetIntegerv(GL_VIEWPORT, saved.viewport);
+    return saved;
+}
+
+void restoreFrame(const SavedFrame& saved) {
+    frame_uniforms.camera = saved.camera;
+    frame_uniforms.lights = saved.lights;
+    frame_uniforms.shadow = saved.shadow;
+    frame_uniforms.update();
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glViewport(saved.viewport[0], saved.viewport[1], saved.viewport[2], saved.viewport[3]);
+}
+
+// Pixels per world unit at distance 1, or at any distance under an orthographic projection
+float viewPixelScale(const RenderView& view) {
+    return (float)view.viewport.w * view.projection[1][1] * 0.5f;
+}
+
+bool viewIsOrthographic(const RenderView& view) {
+    return view.projection[3][3] == 1.0f;
+}
+
+} // namespace
+
+int Renderer::drawViews(EntityManager& entity_manager, const RenderView* views, size_t count,
+                        const LightBlock& frame_lights, const std::function<void()>& draw_sky) {
+    count = std::min(count, (size_t)RENDER_VIEW_MAX);
+    if (count == 0) return 0;
+
+    EntitySpan<glm::vec4> spheres = entity_manager.worldSpheres();
+    EntitySpan<glm::mat4> matrices = entity_manager.worldMatrices();
+    EntitySpan<uint8_t> flags = entity_manager.entityFlags();
+
+    // Each view's frustum against the shared spatial index, into one bit per view on the entities
+    // it found; the entities any view found are listed once
+    if (viewMasks.size() < spheres.size()) viewMasks.resize(spheres.size(), 0);
+    viewTouched.clear();
+    uint32_t seen[RENDER_VIEW_MAX] = {};
+    for (size_t v = 0; v < count; ++v) {
+        if (!(views[v].passes & VIEW_PASS_ENTITIES)) continue;
+        Frustum frustum;
+        frustum.extractFromMatrix(views[v].projection * views[v].view);
+        viewCandidates.clear();
+        entity_manager.queryFrustum(frustum, viewCandidates);
+        for (uint32_t index : viewCandidates) {
+            if (!(flags[index] & ENTITY_FLAG_ACTIVE)) continue;
+            if (viewMasks[index] == 0) viewTouched.push_back(index);
+            viewMasks[index] |= (uint8_t)(1u << v);
+            seen[v]++;
+        }
+    }
+
+    // Views sharing most of what they see draw one list: the overlaps pairwise, then each view
+    // joins the first earlier group whose leader it overlaps enough
+    uint32_t shared[RENDER_VIEW_MAX][RENDER_VIEW_MAX] = {};
+    for (uint32_t index : viewTouched) {
+        const uint8_t mask = viewMasks[index];
+        if ((mask & (mask - 1)) == 0) continue;
+        for (size_t a = 0; a < count; ++a) {
+            if (!(mask & (1u << a))) continue;
+            for (size_t b = a + 1; b < count; ++b) {
+                if (mask & (1u << b)) shared[a][b]++;
+            }
+        }
+    }
+    int group[RENDER_VIEW_MAX];
+    size_t groupLeader[RENDER_VIEW_MAX];
+    uint8_t groupViews[RENDER_VIEW_MAX] = {};
+    int groups = 0;
+    for (size_t v = 0; v < count; ++v) {
+        group[v] = -1;
+        for (int g = 0; g < groups && seen[v] > 0; ++g) {
+            const size_t leader = groupLeader[g];
+            const uint32_t smaller = std::min(seen[leader], seen[v]);
+            if (smaller > 0 && (float)shared[leader][v] >= RENDER_VIEW_MERGE_OVERLAP * (float)smaller) {
+                group[v] = g;
+                break;
+            }
+        }
+        if (group[v] < 0) {
+            groupLeader[groups] = v;
+            group[v] = groups++;
+        }
+        groupViews[group[v]] |= (uint8_t)(1u << v);
+    }
+
+    // Each group's entities once, at the finest level any of its views that sees them calls for.
+    // Impostor levels and blended meshes are left out.
+    while (viewDraws.size() < (size_t)groups) viewDraws.push_back(std::make_unique<DrawList>());
+    float pixelScale[RENDER_VIEW_MAX];
+    for (size_t v = 0; v < count; ++v) pixelScale[v] = viewPixelScale(views[v]) * std::exp2(-views[v].lod_bias);
+    for (int g = 0; g < groups; ++g) {
+        DrawList& draws = *viewDraws[g];
+        draws.clear();
+        for (uint32_t index : viewTouched) {
+            const uint8_t mask = viewMasks[index] & groupViews[g];
+            if (mask == 0) continue;
+            const Entity* entity = entity_manager.getEntityAt(index);
+            if (!entity || entity->lodLevels().empty()) continue;
+
+            const glm::vec4& sphere = spheres[index];
+            float screenSize = 0.0f;
+            float depth = 0.0f;
+            bool visible = false;
+            for (size_t v = 0; v < count; ++v) {
+                if (!(mask & (1u << v))) continue;
+                const float distance = glm::length(glm::vec3(sphere) - views[v].position);
+                const float size = viewIsOrthographic(views[v]) ? 2.0f * sphere.w * pixelScale[v]
+                                                                 : lodScreenSize(sphere.w, distance, pixelScale[v]);
+                visible = visible || size >= views[v].min_pixels;
+                if (size > screenSize) {
+                    screenSize = size;
+                    depth = distance;
+                }
+            }
+            if (!visible) continue;
+
+            const int last = (int)entity->lodLevels().size() - 1;
+            int lod = last;
+            for (int i = 0; i < last; ++i) {
+                if (screenSize >= entity->lodMinScreenSize(i)) {
+                    lod = i;
+                    break;
+                }
+            }
+            for (const auto& meshPtr : entity->lodLevels()[lod].meshes) {
+                if (!meshPtr || !meshPtr->isValid() || meshPtr->material.alphaMode == BLEND) continue;
+                const uint32_t material = materialTable.idFor(meshPtr->material);
+                draws.add(meshPtr.get(), (const void*)(uintptr_t)material,
+                          materialSortState(pbrFeatures(meshPtr->material, true), material, true), matrices[index], 0.0f, depth);
+            }
+        }
+        draws.upload();
+    }
+    for (uint32_t index : viewTouched) viewMasks[index] = 0;
+
+    // Each view its own camera and target over its group's uploaded instances
+    for (size_t v = 0; v < count; ++v) {
+        const RenderView& view = views[v];
+        CameraBlock& cameraBlock = frame_uniforms.camera;
+        cameraBlock.view = view.view;
+        cameraBlock.projection = view.projection;
+        cameraBlock.view_projection = view.projection * view.view;
+        cameraBlock.view_position = view.position;
+        // Directional lights only and unshadowed, without probes reflecting probes
+        frame_uniforms.lights = frame_lights;
+        frame_uniforms.lights.cluster_light_count = 0;
+        frame_uniforms.lights.reflection_probe_count = 0;
+        frame_uniforms.lights.volumetric_fog = 0; // Froxels are the main camera's
+        for (glm::ivec4& light : frame_uniforms.shadow.lights) light.y = 0;
+        frame_uniforms.update();
+
+        glBindFramebuffer(GL_FRAMEBUFFER, view.framebuffer);
+        glViewport(view.viewport.x, view.viewport.y, view.viewport.z, view.viewport.w);
+        if (view.passes & VIEW_PASS_CLEAR) {
+            // Only inside the viewport, views may share a target
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(view.viewport.x, view.viewport.y, view.viewport.z, view.viewport.w);
+            gl_state.colorMask(true);
+            gl_state.depthMask(true);
+            glClearColor(view.clear_color.r, view.clear_color.g, view.clear_color.b, view.clear_color.a);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glDisable(GL_SCISSOR_TEST);
+        }
+
+        if ((view.passes & VIEW_PASS_ENTITIES) && seen[v] > 0) {
+            gl_state.apply(PIPELINE_OPAQUE);
+            gl_state.bindTextureUnit(9, GL_TEXTURE_2D, default_texture_id);
+            uint32_t boundMaterial = UINT32_MAX;
+            viewDraws[group[v]]->submit([&](const DrawList::Draw& draw) {
+                const uint32_t material = (uint32_t)(uintptr_t)draw.state;
+                if (material != boundMaterial) {
+                    bindMaterial(material, PBR_FORWARD, view.far_shading);
+                    boundMaterial = material;
+                }
+                gl_state.setCullMode(draw.cull_mode);
+            });
+            gl_state.apply(PipelineState());
+        }
+        if (view.passes & VIEW_PASS_SKY) draw_sky();
+    }
+    return (int)count;
+}
+
+int Renderer::renderViews(EntityManager& entity_manager, const RenderView* views, size_t count,
+                          const std::function<void()>& draw_sky) {
+    if (count == 0) return 0;
+    PROFILE_SCOPE("extra views");
+    const SavedFrame saved = saveFrame();
+    const int drawn = drawViews(entity_manager, views, count, saved.lights, draw_sky);
+    restoreFrame(saved);
+    return drawn;
+}
+
+int Renderer::renderReflectionProbes(EntityManager& entity_manager, float dt, const std::function<void()>& draw_sky) {
+    if (!use_reflection_probes || reflection_probes.empty()) return 0;
+    PROFILE_SCOPE("reflection probes");
+
+    const SavedFrame saved = saveFrame();
+    const int faces = reflection_probes.update(dt, [&](const RenderView& face) {
+        drawViews(entity_manager, &face, 1, saved.lights, draw_sky);
+    });
+    if (faces == 0) return 0;
+    restoreFrame(saved);
+    return faces;
+}
@@ -0,0 +1,588 @@
+#include "scene_file.h"
+#include "scene_loader.h"
+#include "asset_loader.h"
+#include "light.h"
+#include "mesh.h"
+#include "portal_visibility.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+SceneFile scene_file;
+
+static const char SCENE_FILE_MAGIC[4] = {'S', 'C', 'N', 'B'};
+
+enum SceneLightType : uint32_t {
+    SCENE_LIGHT_POINT = 0,
+    SCENE_LIGHT_DIRECTIONAL,
+    SCENE_LIGHT_SPOT,
+};
+
+// Every section is an array of 4-byte aligned records, strings are offsets into the string table
+struct SceneFile::Header {
+    char magic[4];
+    uint32_t version;
+    int64_t source_mtime; // Of the text it was compiled from
+    uint32_t model_count, models_offset;
+    uint32_t template_count, templates_offset;
+    uint32_t lod_count, lods_offset;
+    uint32_t instance_count, instances_offset;
+    uint32_t light_count, lights_offset;
+    uint32_t cell_count, cells_offset;
+    uint32_t portal_count, portals_offset;
+    uint32_t pvs_offset; // cell_count rows of PortalVisibility::pvsWords(cell_count) words
+    uint32_t strings_size, strings_offset;
+};
+
+struct SceneFile::Model {
+    uint32_t name;
+    uint32_t path;
+};
+
+struct SceneFile::Template {
+    uint32_t name;
+    uint32_t first_lod, lod_count;
+    uint32_t first_instance, instance_count;
+    int32_t cull_mode;
+    int32_t shadow_proxy_lod;
+    uint32_t material_model; // SCENE_FILE_NO_MODEL for none
+    uint32_t is_static;
+};
+
+struct SceneFile::Lod {
+    float distance;
+    uint32_t model;
+};
+
+struct SceneFile::Light {
+    uint32_t name;
+    uint32_t type; // SceneLightType
+    float position[3];
+    float direction[3];
+    float color[3];
+    int32_t intensity;
+    float inner_degrees, outer_degrees;
+};
+
+struct SceneFile::Cell {
+    uint32_t name;
+    float bmin[3], bmax[3];
+};
+
+struct SceneFile::CellPortal {
+    uint32_t cells[2];
+    float corners[12];
+};
+
+// The instances are createEntities()' own input, read in place
+static_assert(sizeof(EntityTransform) == 9 * sizeof(float), "EntityTransform is stored as nine packed floats");
+
+// ============================================================================
+// TEXT TO BINARY
+// ============================================================================
+
+namespace {
+
+class SceneWriter {
+public:
+    std::vector<unsigned char> bytes;
+
+    template <typename T>
+    void put(const T& value) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(&value);
+        bytes.insert(bytes.end(), p, p + sizeof(T));
+    }
+    void putBytes(const void* data, size_t size) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        bytes.insert(bytes.end(), p, p + size);
+    }
+    void align(size_t alignment) {
+        while (bytes.size() % alignment != 0) bytes.push_back(0);
+    }
+};
+
+std::string compiledScenePath(const std::string& text_path) {
+    std::string name = std::filesystem::path(text_path).stem().string();
+    for (char& c : name) {
+        if (c == '/' || c == '\\' || c == ' ' || c == ':' || c == '.') c = '_';
+    }
+    return buildAssetPath("cache/scenes/" + name + ".scene");
+}
+
+} // namespace
+
+std::string SceneFile::compile(const std::string& text_path) {
+    const std::string binary_path = compiledScenePath(text_path);
+    const int64_t source_mtime = getFileModifiedTime(text_path);
+    {
+        MappedFile existing(binary_path);
+        Header cached;
+        if (existing.isOpen() && existing.size() >= sizeof(Header)) {
+            memcpy(&cached, existing.data(), sizeof(Header));
+            if (memcmp(cached.magic, SCENE_FILE_MAGIC, 4) == 0 && cached.version == SCENE_FILE_VERSION &&
+                cached.source_mtime == source_mtime) {
+                return binary_path;
+            }
+        }
+    }
+
+    std::ifstream in(text_path);
+    if (!in.is_open()) {
+        printf("Scene file: can't read %s\n", text_path.c_str());
+        return "";
+    }
+
+    std::string strings(1, '\0'); // Offset 0 is the empty string
+    auto intern = [&](const std::string& text) {
+        const uint32_t offset = (uint32_t)strings.size();
+        strings += text;
+        strings += '\0';
+        return offset;
+    };
+
+    std::vector<Model> models;
+    std::unordered_map<std::string, uint32_t> model_index;
+    std::vector<Template> templates;
+    std::vector<Lod> lods;
+    std::vector<std::vector<EntityTransform>> instances; // Per template
+    std::vector<Light> lights;
+    std::vector<Cell> cells;
+    std::unordered_map<std::string, uint32_t> cell_index;
+    std::vector<CellPortal> cell_portals;
+
+    std::string line;
+    int line_number = 0;
+    auto fail = [&](const char* why) {
+        printf("Scene file: %s:%d: %s\n", text_path.c_str(), line_number, why);
+        return std::string();
+    };
+    auto findModel = [&](const std::string& name, uint32_t& index) {
+        auto found = model_index.find(name);
+        if (found == model_index.end()) return false;
+        index = found->second;
+        return true;
+    };
+
+    while (std::getline(in, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string keyword;
+        if (!(fields >> keyword)) continue;
+
+        if (keyword == "model") {
+            std::string name, path;
+            if (!(fields >> name >> path)) return fail("model needs a name and a path");
+            if (model_index.count(name)) return fail("model name used twice");
+            model_index[name] = (uint32_t)models.size();
+            models.push_back({intern(name), intern(path)});
+        } else if (keyword == "template") {
+            Template entry = {};
+            std::string name;
+            if (!(fields >> name)) return fail("template needs a name");
+            entry.name = intern(name);
+            entry.cull_mode = CULL_BACK;
+            entry.shadow_proxy_lod = -1;
+            entry.material_model = SCENE_FILE_NO_MODEL;
+            std::string option;
+            while (fields >> option) {
+                if (option == "static") {
+                    entry.is_static = 1;
+                } else if (option == "cull") {
+                    std::string mode;
+                    fields >> mode;
+                    if (mode == "none") entry.cull_mode = CULL_NONE;
+                    else if (mode == "back") entry.cull_mode = CULL_BACK;
+                    else if (mode == "front") entry.cull_mode = CULL_FRONT;
+                    else return fail("cull takes none, back or front");
+                } else if (option == "shadow_lod") {
+                    if (!(fields >> entry.shadow_proxy_lod)) return fail("shadow_lod needs a level");
+                } else if (option == "material") {
+                    std::string model;
+                    if (!(fields >> model) || !findModel(model, entry.material_model)) return fail("material needs a model declared before");
+                } else {
+                    return fail("unknown template option");
+                }
+            }
+            templates.push_back(entry);
+            instances.emplace_back();
+        } else if (keyword == "lod") {
+            if (templates.empty()) return fail("lod before any template");
+            Lod lod = {};
+            std::string model;
+            if (!(fields >> lod.distance >> model) || !findModel(model, lod.model)) return fail("lod needs a distance and a model declared before");
+            if (templates.back().lod_count > 0 && lods.back().distance >= lod.distance) return fail("lod distances must increase");
+            if (templates.back().lod_count == 0) templates.back().first_lod = (uint32_t)lods.size();
+            templates.back().lod_count++;
+            lods.push_back(lod);
+        } else if (keyword == "instance") {
+            if (templates.empty()) return fail("instance before any template");
+            EntityTransform transform;
+            if (!(fields >> transform.position.x >> transform.position.y >> transform.position.z)) return fail("instance needs a position");
+            if (fields >> transform.rotation.x) {
+                if (!(fields >> transform.rotation.y >> transform.rotation.z)) return fail("instance rotation needs three angles");
+                if (fields >> transform.scale.x) {
+                    if (!(fields >> transform.scale.y >> transform.scale.z)) return fail("instance scale needs three factors");
+                }
+            }
+            instances.back().push_back(transform);
+        } else if (keyword == "light") {
+            Light light = {};
+            std::string type, name;
+            if (!(fields >> type >> name)) return fail("light needs a type and a name");
+            light.name = intern(name);
+            float* vector = light.position;
+            if (type == "point") {
+                light.type = SCENE_LIGHT_POINT;
+            } else if (type == "dir") {
+                light.type = SCENE_LIGHT_DIRECTIONAL;
+                vector = light.direction;
+            } else if (type == "spot") {
+                light.type = SCENE_LIGHT_SPOT;
+            } else {
+                return fail("light types are point, dir and spot");
+            }
+            if (!(fields >> vector[0] >> vector[1] >> vector[2])) return fail("light needs a position or direction");
+            if (light.type == SCENE_LIGHT_SPOT && !(fields >> light.direction[0] >> light.direction[1] >> light.direction[2])) {
+                return fail("spot light needs a direction");
+            }
+            if (!(fields >> light.color[0] >> light.color[1] >> light.color[2] >> light.intensity)) return fail("light needs a colour and an intensity");
+            if (light.type == SCENE_LIGHT_SPOT && !(fields >> light.inner_degrees >> light.outer_degrees)) {
+                return fail("spot light needs inner and outer angles");
+            }
+            lights.push_back(light);
+        } else if (keyword == "cell") {
+            Cell cell = {};
+            std::string name;
+            if (!(fields >> name >> cell.bmin[0] >> cell.bmin[1] >> cell.bmin[2] >> cell.bmax[0] >> cell.bmax[1] >> cell.bmax[2])) {
+                return fail("cell needs a name and its box's corners");
+            }
+            if (cell_index.count(name)) return fail("cell name used twice");
+            if (cell.bmin[0] > cell.bmax[0] || cell.bmin[1] > cell.bmax[1] || cell.bmin[2] > cell.bmax[2]) return fail("cell box is inside out");
+            cell.name = intern(name);
+            cell_index[name] = (uint32_t)cells.size();
+            cells.push_back(cell);
+        } else if (keyword == "portal") {
+            CellPortal portal = {};
+            std::string first, second;
+            if (!(fields >> first >> second) || !cell_index.count(first) || !cell_index.count(second)) {
+                return fail("portal needs two cells declared before");
+            }
+            portal.cells[0] = cell_index[first];
+            portal.cells[1] = cell_index[second];
+            for (float& value : portal.corners) {
+                if (!(fields >> value)) return fail("portal needs four corners");
+            }
+            cell_portals.push_back(portal);
+        } else {
+            return fail("unknown statement");
+        }
+    }
+    for (size_t t = 0; t < templates.size(); ++t) {
+        if (templates[t].lod_count == 0) {
+            printf("Scene file: %s: template %s has no lod\n", text_path.c_str(), strings.c_str() + templates[t].name);
+            return "";
+        }
+    }
+
+    // Header first, patched once the sections are laid out
+    SceneWriter writer;
+    Header header = {};
+    memcpy(header.magic, SCENE_FILE_MAGIC, 4);
+    header.version = SCENE_FILE_VERSION;
+    header.source_mtime = source_mtime;
+    writer.put(header);
+
+    auto section = [&](uint32_t& offset, const void* data, size_t bytes) {
+        writer.align(8);
+        offset = (uint32_t)writer.bytes.size();
+        writer.putBytes(data, bytes);
+    };
+    header.model_count = (uint32_t)models.size();
+    section(header.models_offset, models.data(), models.size() * sizeof(Model));
+
+    writer.align(8);
+    header.instances_offset = (uint32_t)writer.bytes.size();
+    for (size_t t = 0; t < templates.size(); ++t) {
+        templates[t].first_instance = header.instance_count;
+        templates[t].instance_count = (uint32_t)instances[t].size();
+        header.instance_count += templates[t].instance_count;
+        writer.putBytes(instances[t].data(), instances[t].size() * sizeof(EntityTransform));
+    }
+    header.template_count = (uint32_t)templates.size();
+    section(header.templates_offset, templates.data(), templates.size() * sizeof(Template));
+    header.lod_count = (uint32_t)lods.size();
+    section(header.lods_offset, lods.data(), lods.size() * sizeof(Lod));
+    header.light_count = (uint32_t)lights.size();
+    section(header.lights_offset, lights.data(), lights.size() * sizeof(Light));
+    header.cell_count = (uint32_t)cells.size();
+    section(header.cells_offset, cells.data(), cells.size() * sizeof(Cell));
+    header.portal_count = (uint32_t)cell_portals.size();
+    section(header.portals_offset, cell_portals.data(), cell_portals.size() * sizeof(CellPortal));
+    std::vector<PortalCell> visibility_cells(cells.size());
+    for (size_t c = 0; c < cells.size(); ++c) {
+        visibility_cells[c].bmin = glm::vec3(cells[c].bmin[0], cells[c].bmin[1], cells[c].bmin[2]);
+        visibility_cells[c].bmax = glm::vec3(cells[c].bmax[0], cells[c].bmax[1], cells[c].bmax[2]);
+    }
+    std::vector<Portal> visibility_portals(cell_portals.size());
+    for (size_t p = 0; p < cell_portals.size(); ++p) {
+        visibility_portals[p].cells[0] = cell_portals[p].cells[0];
+        visibility_portals[p].cells[1] = cell_portals[p].cells[1];
+        for (int corner = 0; corner < 4; ++corner) {
+            const float* xyz = cell_portals[p].corners + corner * 3;
+            visibility_portals[p].corners[corner] = glm::vec3(xyz[0], xyz[1], xyz[2]);
+        }
+    }
+    const std::vector<uint32_t> pvs = PortalVisibility::computePvs(visibility_cells, visibility_portals);
+    section(header.pvs_offset, pvs.data(), pvs.size() * sizeof(uint32_t));
+    header.strings_size = (uint32_t)strings.size();
+    section(header.strings_offset, strings.data(), strings.size());
+    memcpy(writer.bytes.data(), &header, sizeof(header));
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(binary_path).parent_path(), ec);
+    // Write to a temp file and rename so a crash never leaves a half-written scene
+    const std::string temp_path = binary_path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            printf("Scene file: can't write %s\n", binary_path.c_str());
+            return "";
+        }
+        out.write(reinterpret_cast<const char*>(writer.bytes.data()), writer.bytes.size());
+        if (!out) return "";
+    }
+    std::filesystem::rename(temp_path, binary_path, ec);
+    if (ec) {
+        std::filesystem::remove(temp_path, ec);
+        return "";
+    }
+    printf("Scene file: compiled %s, %u entities from %u templates (%zu KB)\n", text_path.c_str(), header.instance_count,
+           header.template_count, writer.bytes.size() / 1024);
+    return binary_path;
+}
+
+// ============================================================================
+// BINARY
+// ============================================================================
+
+int SceneFile::parseArg(int argc, char** argv, int i) {
+    const std::string arg = argv[i];
+    if (arg != "--scene") return 0;
+    if (i + 1 >= argc) {
+        printf("--scene needs 1 argument\n");
+        return -1;
+    }
+    requested_path = argv[i + 1];
+    return 2;
+}
+
+bool SceneFile::open(const std::string& path) {
+    close();
+    if (!file.open(path) || file.size() < sizeof(Header)) {
+        printf("Scene file: can't read %s\n", path.c_str());
+        return false;
+    }
+    // Mapped files start page aligned, the sections are aligned within them
+    if ((uintptr_t)file.data() % alignof(Header) != 0) {
+        printf("Scene file: %s is not aligned for reading in place\n", path.c_str());
+        close();
+        return false;
+    }
+    const Header* candidate = reinterpret_cast<const Header*>(file.data());
+    // Counts in 64 bits: the PVS' cell_count * pvsWords(cell_count) reaches 2^59, times the record 2^61
+    auto fits = [&](uint32_t offset, uint64_t count, size_t record) {
+        return offset % 4 == 0 && (uint64_t)offset + count * record <= file.size();
+    };
+    bool valid = memcmp(candidate->magic, SCENE_FILE_MAGIC, 4) == 0 && candidate->version == SCENE_FILE_VERSION &&
+                 fits(candidate->models_offset, candidate->model_count, sizeof(Model)) &&
+                 fits(candidate->templates_offset, candidate->template_count, sizeof(Template)) &&
+                 fits(candidate->lods_offset, candidate->lod_count, sizeof(Lod)) &&
+                 fits(candidate->instances_offset, candidate->instance_count, sizeof(EntityTransform)) &&
+                 fits(candidate->lights_offset, candidate->light_count, sizeof(Light)) &&
+                 fits(candidate->cells_offset, candidate->cell_count, sizeof(Cell)) &&
+                 fits(candidate->portals_offset, candidate->portal_count, sizeof(CellPortal)) &&
+                 fits(candidate->pvs_offset, (uint64_t)candidate->cell_count * PortalVisibility::pvsWords(candidate->cell_count), sizeof(uint32_t)) &&
+                 (uint64_t)candidate->strings_offset + candidate->strings_size <= file.size() && candidate->strings_size > 0 &&
+                 file.data()[candidate->strings_offset + candidate->strings_size - 1] == '\0';
+
+    // Every index in range, so the loading steps never check again
+    auto inStrings = [&](uint32_t offset) { return offset < candidate->strings_size; };
+    if (valid) {
+        header = candidate;
+        const Model* model_records = reinterpret_cast<const Model*>(file.data() + header->models_offset);
+        for (uint32_t m = 0; m < header->model_count && valid; ++m) valid = inStrings(model_records[m].name) && inStrings(model_records[m].path);
+        const Template* templates = reinterpret_cast<const Template*>(file.data() + header->templates_offset);
+        const Lod* lods = reinterpret_cast<const Lod*>(file.data() + header->lods_offset);
+        for (uint32_t t = 0; t < header->template_count && valid; ++t) {
+            const Template& entry = templates[t];
+            valid = inStrings(entry.name) && entry.lod_count > 0 && (uint64_t)entry.first_lod + entry.lod_count <= header->lod_count &&
+                    (uint64_t)entry.first_instance + entry.instance_count <= header->instance_count &&
+                    (entry.material_model == SCENE_FILE_NO_MODEL || entry.material_model < header->model_count);
+            for (uint32_t l = 0; l < entry.lod_count && valid; ++l) valid = lods[entry.first_lod + l].model < header->model_count;
+        }
+        const Light* lights = reinterpret_cast<const Light*>(file.data() + header->lights_offset);
+        for (uint32_t l = 0; l < header->light_count && valid; ++l) valid = inStrings(lights[l].name) && lights[l].type <= SCENE_LIGHT_SPOT;
+        const Cell* cells = reinterpret_cast<const Cell*>(file.data() + header->cells_offset);
+        for (uint32_t c = 0; c < header->cell_count && valid; ++c) valid = inStrings(cells[c].name);
+        const CellPortal* portals = reinterpret_cast<const CellPortal*>(file.data() + header->portals_offset);
+        for (uint32_t p = 0; p < header->portal_count && valid; ++p) {
+            valid = portals[p].cells[0] < header->cell_count && portals[p].cells[1] < header->cell_count;
+        }
+    }
+    if (!valid) {
+        printf("Scene file: %s is malformed or from another version\n", path.c_str());
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SceneFile::close() {
+    header = nullptr;
+    models.clear();
+    file.close();
+}
+
+const char* SceneFile::string(uint32_t offset) const {
+    return reinterpret_cast<const char*>(file.data() + header->strings_offset + offset);
+}
+
+size_t SceneFile::entityCount() const {
+    return header ? header->instance_count : 0;
+}
+
+bool SceneFile::addLoadSteps(SceneLoader& loader) {
+    std::string path = requested_path;
+    if (std::filesystem::path(path).extension() != ".scene") path = compile(requested_path);
+    if (path.empty() || !open(path)) return false;
+
+    loader.add("Requesting scene models", 0.1f, [this]() {
+        requestModels(ASSET_PRIORITY_CRITICAL);
+        createLights();
+        loadVisibility(glm::dvec3(0.0));
+        return true;
+    });
+    loader.add("Loading scene file", 3.0f, [this]() {
+        if (!modelsReady()) return false;
+        createEntitiesFromFile();
+        return true;
+    }, [this]() { return modelsProgress(); });
+    return true;
+}
+
+void SceneFile::requestModels(AssetPriority priority) {
+    if (!header || !models.empty()) return;
+    const Model* model_records = reinterpret_cast<const Model*>(file.data() + header->models_offset);
+    for (uint32_t m = 0; m < header->model_count; ++m) {
+        models.push_back(asset_loader.loadMeshAsync(string(model_records[m].path), priority));
+    }
+}
+
+bool SceneFile::modelsReady() const {
+    for (const auto& model : models) {
+        if (!model->ready) return false;
+    }
+    return true;
+}
+
+float SceneFile::modelsProgress() const {
+    if (models.empty()) return 0.0f;
+    size_t ready = 0;
+    for (const auto& model : models) ready += model->ready ? 1 : 0;
+    return (float)ready / (float)models.size();
+}
+
+void SceneFile::createLights() const {
+    const Light* lights = reinterpret_cast<const Light*>(file.data() + header->lights_offset);
+    for (uint32_t l = 0; l < header->light_count; ++l) {
+        const Light& light = lights[l];
+        const glm::vec3 position(light.position[0], light.position[1], light.position[2]);
+        const glm::vec3 direction(light.direction[0], light.direction[1], light.direction[2]);
+        const glm::vec3 color(light.color[0], light.color[1], light.color[2]);
+        switch (light.type) {
+            case SCENE_LIGHT_POINT:
+                createPointLight(string(light.name), {{}}, position, color, light.intensity, glm::vec3(1.0f), std::vector<int>{CULL_BACK});
+                break;
+            case SCENE_LIGHT_DIRECTIONAL:
+                createDirLight(string(light.name), direction, color, light.intensity);
+                break;
+            case SCENE_LIGHT_SPOT:
+                createSpotlight(string(light.name), {{}}, position, color, light.intensity, direction, light.inner_degrees,
+                                light.outer_degrees, glm::vec3(1.0f), std::vector<int>{CULL_BACK});
+                break;
+        }
+    }
+}
+
+void SceneFile::loadVisibility(const glm::dvec3& origin) const {
+    if (header->cell_count == 0) return;
+    const Cell* cell_records = reinterpret_cast<const Cell*>(file.data() + header->cells_offset);
+    const CellPortal* portal_records = reinterpret_cast<const CellPortal*>(file.data() + header->portals_offset);
+    const uint32_t* pvs = reinterpret_cast<const uint32_t*>(file.data() + header->pvs_offset);
+    auto rebase = [&](const float* xyz) { return glm::vec3(glm::dvec3(xyz[0], xyz[1], xyz[2]) - origin); };
+
+    std::vector<PortalCell> cells(header->cell_count);
+    for (uint32_t c = 0; c < header->cell_count; ++c) {
+        cells[c].bmin = rebase(cell_records[c].bmin);
+        cells[c].bmax = rebase(cell_records[c].bmax);
+    }
+    std::vector<Portal> portals(header->portal_count);
+    for (uint32_t p = 0; p < header->portal_count; ++p) {
+        portals[p].cells[0] = portal_records[p].cells[0];
+        portals[p].cells[1] = portal_records[p].cells[1];
+        for (int corner = 0; corner < 4; ++corner) portals[p].corners[corner] = rebase(portal_records[p].corners + corner * 3);
+    }
+    portal_visibility.load(std::move(cells), std::move(portals),
+                           std::vector<uint32_t>(pvs, pvs + header->cell_count * PortalVisibility::pvsWords(header->cell_count)));
+    printf("Scene file: %u cells, %u portals\n", header->cell_count, header->portal_count);
+}
+
+std::vector<EntityHandle> SceneFile::createEntitiesFromFile(const glm::dvec3& origin) const {
+    const auto start = std::chrono::steady_clock::now();
+    const Template* templates = reinterpret_cast<const Template*>(file.data() + header->templates_offset);
+    const Lod* lods = reinterpret_cast<const Lod*>(file.data() + header->lods_offset);
+    const EntityTransform* instances = reinterpret_cast<const EntityTransform*>(file.data() + header->instances_offset);
+
+    std::vector<EntityHandle> created;
+    std::vector<EntityTransform> rebased;
+    for (uint32_t t = 0; t < header->template_count; ++t) {
+        const Template& entry = templates[t];
+        EntityTemplate entity_template;
+        entity_template.name = string(entry.name);
+        size_t mesh_count = 0;
+        for (uint32_t l = 0; l < entry.lod_count; ++l) {
+            const Lod& lod = lods[entry.first_lod + l];
+            const auto& meshes = models[lod.model]->meshes;
+            if (meshes.empty()) break;
+            entity_template.lod_specs.push_back({lod.distance, meshes});
+            mesh_count = std::max(mesh_count, meshes.size());
+        }
+        if (entity_template.lod_specs.empty()) {
+            printf("Scene file: template %s has no model that loaded, skipped\n", entity_template.name.c_str());
+            continue;
+        }
+        entity_template.cull_modes.assign(mesh_count, entry.cull_mode);
+        if (entry.material_model != SCENE_FILE_NO_MODEL && !models[entry.material_model]->meshes.empty()) {
+            const auto& source = models[entry.material_model]->meshes;
+            for (size_t i = 0; i < mesh_count; ++i) entity_template.material_overrides.push_back(&source[std::min(i, source.size() - 1)]->material);
+        }
+        entity_template.is_static = entry.is_static != 0;
+        entity_template.shadow_proxy_lod = entry.shadow_proxy_lod;
+        const EntityTransform* transforms = instances + entry.first_instance;
+        if (origin != glm::dvec3(0.0)) {
+            rebased.assign(transforms, transforms + entry.instance_count);
+            for (EntityTransform& transform : rebased) transform.position = glm::vec3(glm::dvec3(transform.position) - origin);
+            transforms = rebased.data();
+        }
+        const auto handles = createEntities(entity_template, transforms, entry.instance_count);
+        created.insert(created.end(), handles.begin(), handles.end());
+    }
+    printf("Scene file: %zu entities from %u templates in %.2f ms\n", created.size(), header->template_count,
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    return created;
+}
@@ -0,0 +1,56 @@
+#include "scene_loader.h"
+#include "asset_loader.h"
+#include "asset_fetch.h"
+#include "trace_capture.h"
+#include <algorithm>
+#include <chrono>
+
+SceneLoader scene_loader;
+
+void SceneLoader::add(const std::string& name, float weight, std::function<bool()> step, std::function<float()> fraction) {
+    steps.push_back({name, weight, std::move(step), std::move(fraction)});
+}
+
+void SceneLoader::update(double budget_ms) {
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed_ms = [&start]() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    asset_loader.processUploads(budget_ms);
+    while (!done()) {
+        const auto step_start = std::chrono::steady_clock::now();
+        const bool finished = steps[next].run();
+        trace_capture.event("Load step", "assets", step_start, std::chrono::steady_clock::now(), steps[next].name);
+        if (!finished) break;
+        next++;
+        if (elapsed_ms() >= budget_ms) break;
+    }
+}
+
+void SceneLoader::finish() {
+    while (!done()) {
+        asset_loader.finishAll();
+        update(1e9);
+        // Only a download can still be outstanding
+        if (!done()) asset_fetch.yield();
+    }
+}
+
+float SceneLoader::progress() const {
+    float total = 0.0f, finished = 0.0f;
+    for (size_t i = 0; i < steps.size(); ++i) {
+        total += steps[i].weight;
+        if (i < next) {
+            finished += steps[i].weight;
+        } else if (i == next && steps[i].fraction) {
+            finished += steps[i].weight * std::clamp(steps[i].fraction(), 0.0f, 1.0f);
+        }
+    }
+    return total > 0.0f ? finished / total : 1.0f;
+}
+
+const std::string& SceneLoader::current() const {
+    static const std::string none;
+    return done() ? none : steps[next].name;
+}
@@ -0,0 +1,513 @@
+#include "scene_query.h"
+#include "aabb_tree.h"
+#include "frustum.h"
+#include "job_system.h"
+#include "mesh_loader.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#define BVH_MAX_DEPTH 64 // Median splits halve every level, far beyond any mesh
+
+SceneQuery scene_query;
+
+// Triangles of one mesh in mesh space. Nodes are in depth-first order with both children of a
+// node next to each other, a leaf's triangles are contiguous in corners.
+struct SceneMeshBvh {
+    struct Node {
+        glm::vec3 bmin{0.0f};
+        uint32_t first = 0; // First child, or first triangle of a leaf
+        glm::vec3 bmax{0.0f};
+        uint32_t count = 0; // Triangles of a leaf, 0 for inner nodes
+    };
+    std::vector<Node> nodes;
+    std::vector<glm::vec3> corners;  // Three per triangle, in leaf order
+    std::vector<uint32_t> triangles; // Each one's index in the mesh
+};
+
+namespace {
+
+std::shared_ptr<const SceneMeshBvh> buildMeshBvh(const Mesh& mesh) {
+    const bool has_positions = !mesh.positions_data.empty();
+    const size_t stride = mesh.vertex_layout.stride;
+    const size_t vertex_count = has_positions ? mesh.positions_data.size() : (stride > 0 ? mesh.vertices_data.size() / stride : 0);
+    const size_t index_count = mesh.cpuIndexCount();
+    if (vertex_count == 0 || index_count < 3) return nullptr;
+
+    // Position is the leading 3 floats of either layout
+    auto position = [&](uint32_t vertex) {
+        if (has_positions) return mesh.positions_data[vertex];
+        glm::vec3 p;
+        memcpy(&p, mesh.vertices_data.data() + vertex * stride, sizeof(glm::vec3));
+        return p;
+    };
+
+    std::vector<glm::vec3> corners, centroids;
+    std::vector<uint32_t> source;
+    corners.reserve(index_count);
+    centroids.reserve(index_count / 3);
+    for (size_t i = 0; i + 2 < index_count; i += 3) {
+        const uint32_t a = mesh.cpuIndex(i), b = mesh.cpuIndex(i + 1), c = mesh.cpuIndex(i + 2);
+        if (a >= vertex_count || b >= vertex_count || c >= vertex_count) continue;
+        corners.push_back(position(a));
+        corners.push_back(position(b));
+        corners.push_back(position(c));
+        centroids.push_back((corners[corners.size() - 3] + corners[corners.size() - 2] + corners.back()) / 3.0f);
+        source.push_back((uint32_t)(i / 3));
+    }
+    if (source.empty()) return nullptr;
+
+    // Median splits along the longest axis of the centroids
+    auto bvh = std::make_shared<SceneMeshBvh>();
+    std::vector<uint32_t> order(source.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = (uint32_t)i;
+    struct Range {
+        uint32_t node, begin, end;
+    };
+    std::vector<Range> ranges{{0, 0, (uint32_t)order.size()}};
+    bvh->nodes.emplace_back();
+    while (!ranges.empty()) {
+        const Range range = ranges.back();
+        ranges.pop_back();
+        glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX), cmin(FLT_MAX), cmax(-FLT_MAX);
+        for (uint32_t i = range.begin; i < range.end; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                bmin = glm::min(bmin, corners[order[i] * 3 + k]);
+                bmax = glm::max(bmax, corners[order[i] * 3 + k]);
+            }
+            cmin = glm::min(cmin, centroids[order[i]]);
+            cmax = glm::max(cmax, centroids[order[i]]);
+        }
+        bvh->nodes[range.node].bmin = bmin;
+        bvh->nodes[range.node].bmax = bmax;
+
+        const uint32_t count = range.end - range.begin;
+        if (count <= SCENE_QUERY_LEAF_TRIANGLES) {
+            bvh->nodes[range.node].first = range.begin;
+            bvh->nodes[range.node].count = count;
+            continue;
+        }
+        const glm::vec3 extent = cmax - cmin;
+        const int axis = extent.x >= extent.y ? (extent.x >= extent.z ? 0 : 2) : (extent.y >= extent.z ? 1 : 2);
+        const uint32_t middle = range.begin + count / 2;
+        std::nth_element(order.begin() + range.begin, order.begin() + middle, order.begin() + range.end,
+                         [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+        const uint32_t child = (uint32_t)bvh->nodes.size();
+        bvh->nodes.emplace_back();
+        bvh->nodes.emplace_back();
+        bvh->nodes[range.node].first = child;
+        ranges.push_back({child, range.begin, middle});
+        ranges.push_back({child + 1, middle, range.end});
+    }
+
+    bvh->corners.resize(corners.size());
+    bvh->triangles.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        for (int k = 0; k < 3; ++k) bvh->corners[i * 3 + k] = corners[order[i] * 3 + k];
+        bvh->triangles[i] = source[order[i]];
+    }
+    return bvh;
+}
+
+// Möller-Trumbore, both sides. The distance along direction, -1 on a miss.
+float rayTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    const glm::vec3 edge1 = b - a, edge2 = c - a;
+    const glm::vec3 p = glm::cross(direction, edge2);
+    const float determinant = glm::dot(edge1, p);
+    if (std::fabs(determinant) < 1e-20f) return -1.0f;
+    const float inverse = 1.0f / determinant;
+    const glm::vec3 s = origin - a;
+    const float u = glm::dot(s, p) * inverse;
+    if (u < 0.0f || u > 1.0f) return -1.0f;
+    const glm::vec3 q = glm::cross(s, edge1);
+    const float v = glm::dot(direction, q) * inverse;
+    if (v < 0.0f || u + v > 1.0f) return -1.0f;
+    const float t = glm::dot(edge2, q) * inverse;
+    return t >= 0.0f ? t : -1.0f;
+}
+
+// The nearest triangle closer than distance, which it then holds
+bool rayBvh(const SceneMeshBvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float& distance,
+            uint32_t& triangle, glm::vec3& normal) {
+    const glm::vec3 inverse_direction = 1.0f / direction;
+    uint32_t stack[BVH_MAX_DEPTH * 2];
+    int top = 0;
+    stack[top++] = 0;
+    bool found = false;
+    while (top > 0) {
+        const SceneMeshBvh::Node& node = bvh.nodes[stack[--top]];
+        if (AabbTree::rayEntry(node.bmin, node.bmax, origin, inverse_direction, distance) < 0.0f) continue;
+
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                const glm::vec3* corner = &bvh.corners[i * 3];
+                const float t = rayTriangle(origin, direction, corner[0], corner[1], corner[2]);
+                if (t < 0.0f || t >= distance) continue;
+                distance = t;
+                triangle = bvh.triangles[i];
+                normal = glm::cross(corner[1] - corner[0], corner[2] - corner[0]);
+                found = true;
+            }
+            continue;
+        }
+        // The nearer child is popped first, so the farther one often gets skipped
+        const SceneMeshBvh::Node& first = bvh.nodes[node.first];
+        const SceneMeshBvh::Node& second = bvh.nodes[node.first + 1];
+        const float first_entry = AabbTree::rayEntry(first.bmin, first.bmax, origin, inverse_direction, distance);
+        const float second_entry = AabbTree::rayEntry(second.bmin, second.bmax, origin, inverse_direction, distance);
+        const bool first_nearer = first_entry >= 0.0f && (second_entry < 0.0f || first_entry <= second_entry);
+        if (first_nearer) {
+            if (second_entry >= 0.0f) stack[top++] = node.first + 1;
+            stack[top++] = node.first;
+        } else {
+            if (first_entry >= 0.0f) stack[top++] = node.first;
+            if (second_entry >= 0.0f) stack[top++] = node.first + 1;
+        }
+    }
+    return found;
+}
+
+// Calls test(corners) on every triangle whose leaf node passes node_test(bmin, bmax), true as
+// soon as one test does
+template <typename NodeTest, typename TriangleTest>
+bool anyTriangle(const SceneMeshBvh& bvh, NodeTest&& node_test, TriangleTest&& test) {
+    uint32_t stack[BVH_MAX_DEPTH * 2];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const SceneMeshBvh::Node& node = bvh.nodes[stack[--top]];
+        if (!node_test(node.bmin, node.bmax)) continue;
+        if (node.count == 0) {
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+            continue;
+        }
+        for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+            if (test(&bvh.corners[i * 3])) return true;
+        }
+    }
+    return false;
+}
+
+// Ericson's closest point on a triangle, Real-Time Collision Detection 5.1.5
+glm::vec3 closestOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    const glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    const float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+    const glm::vec3 bp = p - b;
+    const float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return b;
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+    const glm::vec3 cp = p - c;
+    const float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return c;
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    const float denominator = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+// Separating axes of a triangle and an axis-aligned box: the box's faces, the triangle's plane
+// and the nine edge pairs
+bool triangleOverlapsBox(const glm::vec3* corners, const glm::vec3& bmin, const glm::vec3& bmax) {
+    const glm::vec3 center = (bmin + bmax) * 0.5f, half = (bmax - bmin) * 0.5f;
+    const glm::vec3 v[3] = {corners[0] - center, corners[1] - center, corners[2] - center};
+    const glm::vec3 edges[3] = {v[1] - v[0], v[2] - v[1], v[0] - v[2]};
+    auto separated = [&](const glm::vec3& axis) {
+        const float p0 = glm::dot(v[0], axis), p1 = glm::dot(v[1], axis), p2 = glm::dot(v[2], axis);
+        const float radius = glm::dot(half, glm::abs(axis));
+        return std::min(p0, std::min(p1, p2)) > radius || std::max(p0, std::max(p1, p2)) < -radius;
+    };
+    for (int i = 0; i < 3; ++i) {
+        glm::vec3 axis(0.0f);
+        axis[i] = 1.0f;
+        if (separated(axis)) return false;
+        for (const glm::vec3& edge : edges) {
+            if (separated(glm::cross(axis, edge))) return false;
+        }
+    }
+    return !separated(glm::cross(edges[0], edges[1]));
+}
+
+bool boxesOverlap(const glm::vec3& amin, const glm::vec3& amax, const glm::vec3& bmin, const glm::vec3& bmax) {
+    return glm::all(glm::lessThanEqual(amin, bmax)) && glm::all(glm::lessThanEqual(bmin, amax));
+}
+
+// Bounds of a box carried through a transform
+void transformBox(const glm::mat4& transform, const glm::vec3& bmin, const glm::vec3& bmax, glm::vec3& out_min, glm::vec3& out_max) {
+    const glm::vec3 center = glm::vec3(transform * glm::vec4((bmin + bmax) * 0.5f, 1.0f));
+    const glm::vec3 half = (bmax - bmin) * 0.5f;
+    const glm::mat3 linear(transform);
+    const glm::vec3 extent = glm::abs(linear[0]) * half.x + glm::abs(linear[1]) * half.y + glm::abs(linear[2]) * half.z;
+    out_min = center - extent;
+    out_max = center + extent;
+}
+
+// The box face a ray enters through, or back along the ray from inside
+glm::vec3 entryNormal(const glm::vec3& bmin, const glm::vec3& bmax, const glm::vec3& origin, const glm::vec3& direction, float entry) {
+    if (entry <= 0.0f) return -direction;
+    const glm::vec3 inverse_direction = 1.0f / direction;
+    const glm::vec3 near = glm::min((bmin - origin) * inverse_direction, (bmax - origin) * inverse_direction);
+    const int axis = near.x >= near.y ? (near.x >= near.z ? 0 : 2) : (near.y >= near.z ? 1 : 2);
+    glm::vec3 normal(0.0f);
+    normal[axis] = direction[axis] > 0.0f ? -1.0f : 1.0f;
+    return normal;
+}
+
+} // namespace
+
+// ============================================================================
+// MESH BVHS
+// ============================================================================
+
+std::shared_ptr<const SceneMeshBvh> SceneQuery::meshBvh(const std::shared_ptr<Mesh>& mesh) const {
+    const void* data = !mesh->positions_data.empty() ? (const void*)mesh->positions_data.data() : (const void*)mesh->vertices_data.data();
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = cache.find(mesh.get());
+        if (it != cache.end() && !it->second.mesh.expired() && it->second.data == data) return it->second.bvh;
+    }
+
+    // Built outside the lock, two threads reaching a new mesh at once both build it
+    std::shared_ptr<const SceneMeshBvh> bvh = buildMeshBvh(*mesh);
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (cache.size() >= pruned_size * 2 + 64) {
+        for (auto it = cache.begin(); it != cache.end();) {
+            it = it->second.mesh.expired() ? cache.erase(it) : std::next(it);
+        }
+        pruned_size = cache.size();
+    }
+    CachedBvh& entry = cache[mesh.get()];
+    entry.mesh = mesh;
+    entry.data = data;
+    entry.bvh = bvh;
+    return bvh;
+}
+
+size_t SceneQuery::cachedMeshes() const {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return cache.size();
+}
+
+void SceneQuery::clearCache() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    cache.clear();
+    pruned_size = 0;
+}
+
+// ============================================================================
+// PER ENTITY
+// ============================================================================
+
+bool SceneQuery::wanted(size_t index, uint8_t flags) const {
+    const uint8_t entity_flags = entity_manager.entityFlags()[index];
+    if (!(entity_flags & ENTITY_FLAG_ACTIVE)) return false;
+    return (flags & ((entity_flags & ENTITY_FLAG_STATIC) ? SCENE_QUERY_STATIC : SCENE_QUERY_DYNAMIC)) != 0;
+}
+
+bool SceneQuery::rayEntity(size_t index, const glm::vec3& origin, const glm::vec3& direction, float max_distance, bool triangles, SceneHit& hit) const {
+    const glm::vec3& bmin = entity_manager.worldMins()[index];
+    const glm::vec3& bmax = entity_manager.worldMaxs()[index];
+    const float entry = AabbTree::rayEntry(bmin, bmax, origin, 1.0f / direction, max_distance);
+    if (entry < 0.0f) return false;
+
+    const Entity* entity = entity_manager.getEntityAt(index);
+    if (triangles && !entity->meshes.empty()) {
+        // In mesh space, the direction left unnormalised so distances stay the world's
+        const glm::mat4& world = entity_manager.worldMatrices()[index];
+        const glm::mat4 inverse = glm::inverse(world);
+        const glm::vec3 local_origin = glm::vec3(inverse * glm::vec4(origin, 1.0f));
+        const glm::vec3 local_direction = glm::mat3(inverse) * direction;
+        float distance = max_distance;
+        glm::vec3 local_normal(0.0f);
+        for (size_t m = 0; m < entity->meshes.size(); ++m) {
+            const std::shared_ptr<Mesh>& mesh = entity->meshes[m];
+            if (std::shared_ptr<const SceneMeshBvh> bvh = meshBvh(mesh)) {
+                uint32_t triangle = 0;
+                if (rayBvh(*bvh, local_origin, local_direction, distance, triangle, local_normal)) {
+                    hit.mesh = (int)m;
+                    hit.triangle = (int)triangle;
+                }
+            } else if (mesh->bounds_radius > 0.0f) {
+                // No CPU copy, the mesh's own box stands in
+                const float mesh_entry = AabbTree::rayEntry(mesh->bounds_min, mesh->bounds_max, local_origin, 1.0f / local_direction, distance);
+                if (mesh_entry >= 0.0f && mesh_entry < distance) {
+                    distance = mesh_entry;
+                    local_normal = entryNormal(mesh->bounds_min, mesh->bounds_max, local_origin, local_direction, mesh_entry);
+                    hit.mesh = (int)m;
+                    hit.triangle = -1;
+                }
+            }
+        }
+        if (hit.mesh < 0) return false;
+        hit.distance = distance;
+        hit.position = origin + direction * distance;
+        hit.normal = glm::normalize(glm::transpose(glm::mat3(inverse)) * local_normal);
+        if (glm::dot(hit.normal, direction) > 0.0f) hit.normal = -hit.normal;
+        return true;
+    }
+
+    hit.distance = entry;
+    hit.position = origin + direction * entry;
+    hit.normal = entryNormal(bmin, bmax, origin, direction, entry);
+    return true;
+}
+
+bool SceneQuery::overlapEntity(size_t index, const glm::vec3& bmin, const glm::vec3& bmax, const glm::vec4* sphere, const Frustum* frustum, bool triangles) const {
+    const glm::vec3& entity_min = entity_manager.worldMins()[index];
+    const glm::vec3& entity_max = entity_manager.worldMaxs()[index];
+    if (frustum) {
+        if (!frustum->aabbInFrustum(entity_min, entity_max)) return false;
+    } else if (sphere) {
+        const glm::vec3 center(*sphere);
+        if (glm::distance(glm::clamp(center, entity_min, entity_max), center) > sphere->w) return false;
+    } else if (!boxesOverlap(entity_min, entity_max, bmin, bmax)) {
+        return false;
+    }
+
+    const Entity* entity = entity_manager.getEntityAt(index);
+    if (!triangles || entity->meshes.empty()) return true;
+
+    // Mesh space for the tree walk: the query's box carried over, or the frustum's planes
+    const glm::mat4& world = entity_manager.worldMatrices()[index];
+    glm::vec3 local_min(0.0f), local_max(0.0f);
+    Frustum local_frustum;
+    if (frustum) {
+        const glm::mat4 transposed = glm::transpose(world);
+        for (int i = 0; i < 6; ++i) local_frustum.planes[i] = transposed * frustum->planes[i];
+    } else {
+        transformBox(glm::inverse(world), bmin, bmax, local_min, local_max);
+    }
+    auto node_test = [&](const glm::vec3& node_min, const glm::vec3& node_max) {
+        return frustum ? local_frustum.aabbInFrustum(node_min, node_max) : boxesOverlap(node_min, node_max, local_min, local_max);
+    };
+    // Exact in world space for spheres and boxes, a scaled entity would distort them in its
+    // own. Frustum planes survive the trip, and stay conservative.
+    auto triangle_test = [&](const glm::vec3* corners) {
+        if (frustum) {
+            for (int i = 0; i < 6; ++i) {
+                const glm::vec3 normal(local_frustum.planes[i]);
+                const float w = local_frustum.planes[i].w;
+                if (glm::dot(normal, corners[0]) + w < 0.0f && glm::dot(normal, corners[1]) + w < 0.0f &&
+                    glm::dot(normal, corners[2]) + w < 0.0f) return false;
+            }
+            return true;
+        }
+        glm::vec3 world_corners[3];
+        for (int k = 0; k < 3; ++k) world_corners[k] = glm::vec3(world * glm::vec4(corners[k], 1.0f));
+        if (sphere) {
+            const glm::vec3 center(*sphere);
+            return glm::distance(closestOnTriangle(center, world_corners[0], world_corners[1], world_corners[2]), center) <= sphere->w;
+        }
+        return triangleOverlapsBox(world_corners, bmin, bmax);
+    };
+
+    for (const std::shared_ptr<Mesh>& mesh : entity->meshes) {
+        if (std::shared_ptr<const SceneMeshBvh> bvh = meshBvh(mesh)) {
+            if (anyTriangle(*bvh, node_test, triangle_test)) return true;
+        } else if (mesh->bounds_radius <= 0.0f || node_test(mesh->bounds_min, mesh->bounds_max)) {
+            // No CPU copy, the mesh's own box stands in
+            return true;
+        }
+    }
+    return false;
+}
+
+// ============================================================================
+// QUERIES
+// ============================================================================
+
+bool SceneQuery::raycast(const SceneRay& ray, SceneHit& hit, uint8_t flags) const {
+    hit = SceneHit();
+    const float length = glm::length(ray.direction);
+    if (length <= 0.0f) return false;
+    const glm::vec3 direction = ray.direction / length;
+
+    thread_local std::vector<std::pair<float, uint32_t>> candidates;
+    entity_manager.queryRay(ray.origin, direction, ray.max_distance, candidates, (flags & SCENE_QUERY_STATIC) != 0);
+    float nearest = ray.max_distance;
+    for (const auto& candidate : candidates) {
+        // Nearest fat box first, none past the best hit can beat it
+        if (candidate.first > nearest) break;
+        if (!wanted(candidate.second, flags)) continue;
+        SceneHit entity_hit;
+        if (!rayEntity(candidate.second, ray.origin, direction, nearest, (flags & SCENE_QUERY_TRIANGLES) != 0, entity_hit)) continue;
+        if (entity_hit.distance >= nearest && !hit.entity.isNull()) continue;
+        nearest = entity_hit.distance;
+        hit = entity_hit;
+        hit.entity = entity_manager.handleAt(candidate.second);
+    }
+    return !hit.entity.isNull();
+}
+
+void SceneQuery::raycast(const SceneRay* rays, SceneHit* hits, size_t count, uint8_t flags) const {
+    job_system.parallelFor(count, SCENE_QUERY_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) raycast(rays[i], hits[i], flags);
+    });
+}
+
+size_t SceneQuery::overlapSphere(const glm::vec3& center, float radius, std::vector<EntityHandle>& out, uint8_t flags) const {
+    out.clear();
+    const glm::vec4 sphere(center, radius);
+    thread_local std::vector<uint32_t> candidates;
+    entity_manager.queryBox(center - glm::vec3(radius), center + glm::vec3(radius), candidates);
+    for (uint32_t index : candidates) {
+        if (wanted(index, flags) && overlapEntity(index, center - glm::vec3(radius), center + glm::vec3(radius), &sphere, nullptr, (flags & SCENE_QUERY_TRIANGLES) != 0)) {
+            out.push_back(entity_manager.handleAt(index));
+        }
+    }
+    return out.size();
+}
+
+size_t SceneQuery::overlapBox(const glm::vec3& bmin, const glm::vec3& bmax, std::vector<EntityHandle>& out, uint8_t flags) const {
+    out.clear();
+    thread_local std::vector<uint32_t> candidates;
+    entity_manager.queryBox(bmin, bmax, candidates);
+    for (uint32_t index : candidates) {
+        if (wanted(index, flags) && overlapEntity(index, bmin, bmax, nullptr, nullptr, (flags & SCENE_QUERY_TRIANGLES) != 0)) {
+            out.push_back(entity_manager.handleAt(index));
+        }
+    }
+    return out.size();
+}
+
+size_t SceneQuery::overlapFrustum(const Frustum& frustum, std::vector<EntityHandle>& out, uint8_t flags) const {
+    out.clear();
+    thread_local std::vector<uint32_t> candidates;
+    entity_manager.queryFrustum(frustum, candidates, (flags & SCENE_QUERY_STATIC) != 0);
+    for (uint32_t index : candidates) {
+        if (wanted(index, flags) && overlapEntity(index, glm::vec3(0.0f), glm::vec3(0.0f), nullptr, &frustum, (flags & SCENE_QUERY_TRIANGLES) != 0)) {
+            out.push_back(entity_manager.handleAt(index));
+        }
+    }
+    return out.size();
+}
+
+void SceneQuery::overlapSpheres(const glm::vec4* spheres, std::vector<EntityHandle>* out, size_t count, uint8_t flags) const {
+    job_system.parallelFor(count, SCENE_QUERY_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) overlapSphere(glm::vec3(spheres[i]), spheres[i].w, out[i], flags);
+    });
+}
+
+SceneRay SceneQuery::screenRay(const glm::mat4& view, const glm::mat4& projection, const glm::vec2& ndc) {
+    const glm::mat4 inverse = glm::inverse(projection * view);
+    glm::vec4 near_point = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+    glm::vec4 far_point = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+    near_point /= near_point.w;
+    far_point /= far_point.w;
+    SceneRay ray;
+    ray.origin = glm::vec3(near_point);
+    ray.direction = glm::normalize(glm::vec3(far_point - near_point));
+    return ray;
+}
+
+int SceneQuery::parseArg(int argc, char** argv, int i) {
+    (void)argc;
+    if (std::string(argv[i]) != "--pick-triangles") return 0;
+    if (mesh_residency == MESH_RESIDENCY_NONE) mesh_residency = MESH_RESIDENCY_POSITIONS;
+    return 1;
+}
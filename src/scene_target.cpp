@@ -0,0 +1,363 @@
+#include "scene_target.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "profiler.h"
+#include "shader_loading.h"
+#include "temporal_aa.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+
+std::string buildAssetPath(const std::string& relative_path);
+
+GLuint scene_framebuffer = 0;
+
+bool use_dynamic_resolution = false;
+float dynamic_resolution_budget_ms = 16.6f;
+float resolution_scale = TAA_DEFAULT_RESOLUTION_SCALE;
+float resolution_scale_min = 0.5f;
+float resolution_scale_max = 1.0f;
+
+int scene_msaa_samples = 4;
+
+RenderTargetQuality render_target_quality = RENDER_TARGETS_COMPACT;
+const char* const RENDER_TARGET_QUALITY_NAMES[RENDER_TARGETS_QUALITY_COUNT] = { "Compact", "Full" };
+
+Tonemapper post_tonemapper = TONEMAP_REINHARD;
+const char* const TONEMAPPER_NAMES[TONEMAP_COUNT] = { "Reinhard", "ACES" };
+float post_exposure = 0.0f;
+float post_contrast = 1.0f;
+float post_saturation = 1.0f;
+glm::vec3 post_color_filter(1.0f);
+bool post_dithering = true;
+
+SceneTarget scene_target;
+
+// Gains on the relative headroom, (budget - time) / budget. Kept low, GPU times are noisy and a
+// scale change shows up in them a frame or two late.
+#define RESOLUTION_PID_P 0.10f
+#define RESOLUTION_PID_I 0.02f
+#define RESOLUTION_PID_D 0.05f
+
+void updateDynamicResolution(double gpu_time_ms) {
+    static float integral = 0.0f;
+    static float previous_error = 0.0f;
+
+    const float lowest = std::clamp(resolution_scale_min, RESOLUTION_SCALE_LOWEST, 1.0f);
+    const float highest = std::clamp(resolution_scale_max, lowest, 1.0f);
+    if (!use_dynamic_resolution || gpu_time_ms <= 0.0 || dynamic_resolution_budget_ms <= 0.0f) {
+        integral = 0.0f;
+        previous_error = 0.0f;
+        return;
+    }
+
+    const float error = (dynamic_resolution_budget_ms - (float)gpu_time_ms) / dynamic_resolution_budget_ms;
+    const float derivative = error - previous_error;
+    previous_error = error;
+    // Held where its term alone spans the range, so it doesn't wind up while the scale is pinned
+    integral = std::clamp(integral + error, (lowest - highest) / RESOLUTION_PID_I, 0.0f);
+
+    const float output = std::clamp(highest + RESOLUTION_PID_P * error + RESOLUTION_PID_I * integral + RESOLUTION_PID_D * derivative,
+                                    lowest, highest);
+    // Moves a step only once the output is most of one away
+    if (std::fabs(output - resolution_scale) > RESOLUTION_SCALE_STEP * 0.75f) {
+        resolution_scale = std::clamp(std::round(output / RESOLUTION_SCALE_STEP) * RESOLUTION_SCALE_STEP, lowest, highest);
+    }
+}
+
+SceneTarget::~SceneTarget() {
+    release();
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+}
+
+void SceneTarget::release() {
+    for (GLuint* framebuffer : { &fbo, &resolve_fbo, &window_depth_fbo }) {
+        if (*framebuffer != 0) { glDeleteFramebuffers(1, framebuffer); *framebuffer = 0; }
+    }
+    for (GLuint* renderbuffer : { &color_renderbuffer, &depth_renderbuffer }) {
+        if (*renderbuffer != 0) { glDeleteRenderbuffers(1, renderbuffer); *renderbuffer = 0; }
+    }
+    for (GLuint* texture : { &color_texture, &depth_texture, &resolved_depth_texture, &window_depth_texture }) {
+        if (*texture != 0) { glDeleteTextures(1, texture); *texture = 0; }
+    }
+    target_width = target_height = target_samples = 0;
+    window_depth_width = window_depth_height = 0;
+}
+
+// Whether a small texture of the format makes a complete framebuffer, asked once per format
+static bool colorRenderable(GLenum internal_format) {
+    static std::map<GLenum, bool> answers;
+    auto found = answers.find(internal_format);
+    if (found != answers.end()) return found->second;
+
+    GLenum format, type;
+    renderTargetTransfer(internal_format, format, type);
+    GLint previous_framebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_framebuffer);
+    GLuint texture, framebuffer;
+    glGenTextures(1, &texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, 4, 4, 0, format, type, nullptr);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+    glDeleteTextures(1, &texture);
+    if (!complete) printf("%s isn't renderable here\n", renderTargetFormatName(internal_format));
+    answers[internal_format] = complete;
+    return complete;
+}
+
+RenderTargetFormats renderTargetFormats() {
+    RenderTargetFormats formats;
+#ifdef __EMSCRIPTEN__
+    static const bool float_targets = hasGLExtension("GL_EXT_color_buffer_float") || hasGLExtension("EXT_color_buffer_float");
+    if (!float_targets) {
+        static bool warned = false;
+        if (!warned) printf("No EXT_color_buffer_float, the scene target is RGBA8 and clips highlights\n");
+        warned = true;
+        formats.hdr_color = GL_RGBA8;
+        return formats;
+    }
+#endif
+    if (render_target_quality == RENDER_TARGETS_FULL) {
+        if (colorRenderable(GL_RGBA16F)) formats.gbuffer_normal = GL_RGBA16F;
+    } else if (colorRenderable(GL_R11F_G11F_B10F)) {
+        formats.hdr_color = GL_R11F_G11F_B10F;
+    }
+    return formats;
+}
+
+void renderTargetTransfer(GLenum internal_format, GLenum& format, GLenum& type) {
+    switch (internal_format) {
+    case GL_R11F_G11F_B10F: format = GL_RGB; type = GL_HALF_FLOAT; break;
+    case GL_RGBA16F: format = GL_RGBA; type = GL_HALF_FLOAT; break;
+    case GL_RGB10_A2: format = GL_RGBA; type = GL_UNSIGNED_INT_2_10_10_10_REV; break;
+    default: format = GL_RGBA; type = GL_UNSIGNED_BYTE; break;
+    }
+}
+
+const char* renderTargetFormatName(GLenum internal_format) {
+    switch (internal_format) {
+    case GL_R11F_G11F_B10F: return "R11G11B10F";
+    case GL_RGBA16F: return "RGBA16F";
+    case GL_RGB10_A2: return "RGB10A2";
+    case GL_RGBA8: return "RGBA8";
+    default: return "?";
+    }
+}
+
+static GLuint createRenderbuffer(GLenum format, int samples, int width, int height) {
+    GLuint renderbuffer;
+    glGenRenderbuffers(1, &renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+    if (samples > 1) glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, format, width, height);
+    else glRenderbufferStorage(GL_RENDERBUFFER, format, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    return renderbuffer;
+}
+
+// Single-sampled depth-stencil the depth copies can blit into and the readers sample
+static GLuint createDepthTexture(int width, int height) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+bool SceneTarget::init(int width, int height, int samples) {
+    release();
+
+    if (!post_shader) {
+        try {
+            post_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/hiz.vs")),
+                                                   loadShaderFile(buildAssetPath("res/shaders/post.fs")));
+        } catch (const std::exception& e) {
+            printf("Scene target disabled: %s\n", e.what());
+            return false;
+        }
+        post_shader->use();
+        post_shader->setInt("sceneColor", 0);
+        glGenVertexArrays(1, &vao);
+    }
+
+    color_format = renderTargetFormats().hdr_color;
+    GLenum transfer_format, transfer_type;
+    renderTargetTransfer(color_format, transfer_format, transfer_type);
+    glGenTextures(1, &color_texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, color_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, color_format, width, height, 0, transfer_format, transfer_type, nullptr);
+    // Linear, the post pass upscales with it
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+
+    // Depth in the format the copies blit into, the default framebuffer's too for when there's no target
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    if (samples > 1) {
+        color_renderbuffer = createRenderbuffer(color_format, samples, width, height);
+        depth_renderbuffer = createRenderbuffer(GL_DEPTH24_STENCIL8, samples, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_renderbuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+    } else {
+        depth_texture = createDepthTexture(width, height);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_texture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0);
+    }
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status == GL_FRAMEBUFFER_COMPLETE && samples > 1) {
+        glGenFramebuffers(1, &resolve_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, resolve_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_texture, 0);
+        resolved_depth_texture = createDepthTexture(width, height);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, resolved_depth_texture, 0);
+        status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Scene target incomplete (0x%x) at %d samples\n", status, samples);
+        release();
+        return false;
+    }
+
+    target_width = width;
+    target_height = height;
+    target_samples = samples;
+    printf("Scene target: %dx%d %s, %dx MSAA\n", width, height, renderTargetFormatName(color_format),
+           samples > 1 ? samples : 1);
+    return true;
+}
+
+void SceneTarget::begin(int new_window_width, int new_window_height) {
+    window_width = std::max(new_window_width, 1);
+    window_height = std::max(new_window_height, 1);
+
+    const float scale = std::clamp(resolution_scale, RESOLUTION_SCALE_LOWEST, 1.0f);
+    render_width = std::max((int)std::lround(window_width * scale), 1);
+    render_height = std::max((int)std::lround(window_height * scale), 1);
+
+    static GLint max_samples = -1;
+    if (max_samples < 0) glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+    int samples = std::clamp(scene_msaa_samples, 0, std::min((int)max_samples, SCENE_MAX_MSAA_SAMPLES));
+    if (samples < 2 || temporal_aa.active()) samples = 0;
+
+    scene_framebuffer = 0;
+    depth_resolved = false;
+    if (!failed && (fbo == 0 || render_width != target_width || render_height != target_height || samples != target_samples ||
+                    renderTargetFormats().hdr_color != color_format)) {
+        // Without multisampling before giving up on the target altogether
+        if (!init(render_width, render_height, samples) && (samples == 0 || !init(render_width, render_height, 0))) {
+            printf("Scene target unavailable, rendering straight to the window without post-processing\n");
+            failed = true;
+        }
+        // Keeps a fallback from being retried every frame
+        if (!failed && target_samples != samples) scene_msaa_samples = target_samples;
+    }
+    if (failed) {
+        render_width = window_width;
+        render_height = window_height;
+    } else {
+        scene_framebuffer = fbo;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glViewport(0, 0, render_width, render_height);
+}
+
+GLuint SceneTarget::depthFramebuffer() {
+    if (scene_framebuffer == 0 || resolve_fbo == 0) return scene_framebuffer;
+    if (!depth_resolved) {
+        GLint draw_framebuffer;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolve_fbo);
+        glBlitFramebuffer(0, 0, render_width, render_height, 0, 0, render_width, render_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+        depth_resolved = true;
+    }
+    return resolve_fbo;
+}
+
+GLuint SceneTarget::depthTexture() {
+    if (scene_framebuffer != 0) {
+        if (resolve_fbo == 0) return depth_texture;
+        depthFramebuffer();
+        return resolved_depth_texture;
+    }
+
+    // Straight to the window, whose depth can't be sampled: one copy for the frame's readers
+    if (window_depth_width != render_width || window_depth_height != render_height) {
+        if (window_depth_fbo != 0) glDeleteFramebuffers(1, &window_depth_fbo);
+        if (window_depth_texture != 0) glDeleteTextures(1, &window_depth_texture);
+        window_depth_texture = createDepthTexture(render_width, render_height);
+        glGenFramebuffers(1, &window_depth_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, window_depth_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, window_depth_texture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        window_depth_width = render_width;
+        window_depth_height = render_height;
+        depth_resolved = false;
+    }
+    if (!depth_resolved) {
+        GLint draw_framebuffer;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, window_depth_fbo);
+        glBlitFramebuffer(0, 0, render_width, render_height, 0, 0, render_width, render_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+        depth_resolved = true;
+    }
+    return window_depth_texture;
+}
+
+void SceneTarget::present(GLuint source, GLuint output) {
+    PROFILE_SCOPE("post");
+    if (scene_framebuffer == 0) return;
+
+    if (resolve_fbo != 0) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolve_fbo);
+        glBlitFramebuffer(0, 0, render_width, render_height, 0, 0, render_width, render_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, output);
+    glViewport(0, 0, window_width, window_height);
+    scene_framebuffer = 0;
+
+    const bool depth_test = gl_state.isEnabled(GL_DEPTH_TEST);
+    const bool cull_face = gl_state.isEnabled(GL_CULL_FACE);
+    const bool blend = gl_state.isEnabled(GL_BLEND);
+    gl_state.disable(GL_DEPTH_TEST);
+    gl_state.disable(GL_CULL_FACE);
+    gl_state.disable(GL_BLEND);
+    gl_state.colorMask(true);
+    gl_state.bindVertexArray(vao);
+
+    post_shader->use();
+    post_shader->setVec2("outputSize", glm::vec2((float)window_width, (float)window_height));
+    post_shader->setFloat("exposure", std::exp2(post_exposure));
+    post_shader->setInt("tonemapper", (int)post_tonemapper);
+    post_shader->setFloat("contrast", post_contrast);
+    post_shader->setFloat("saturation", post_saturation);
+    post_shader->setVec3("colorFilter", post_color_filter);
+    post_shader->setInt("dithering", post_dithering ? 1 : 0);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, source != 0 ? source : color_texture);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    gl_state.bindVertexArray(0);
+    gl_state.setEnabled(GL_DEPTH_TEST, depth_test);
+    gl_state.setEnabled(GL_CULL_FACE, cull_face);
+    gl_state.setEnabled(GL_BLEND, blend);
+}
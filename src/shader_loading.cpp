@@ -1,6 +1,6 @@
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <vector>
+#include <algorithm>
 #include <cstdio>
 #include <filesystem>
 #include "filesystem.h"
@@ -10,15 +10,61 @@
 // SHADER LOADING FUNCTIONS
 // ============================================================================
 
-std::string loadShaderFile(const std::string& path) {
-    std::ifstream file(path);
-    if (!file.is_open()) {
+// Appends path's lines to out with every #include "name" (relative to the including file)
+// replaced by that file's lines. A file already spliced into this source is skipped, so shared
+// files need no include guards. #line directives keep compile errors pointing into the right
+// file: the source string number is the file's index in sources, 0 being the top file.
+static bool expandIncludes(const std::string& path, std::string& out, std::vector<std::string>& sources, int depth) {
+    MappedFile file(path);
+    if (!file.isOpen()) {
         printf("Error: Could not open shader file: %s\n", path.c_str());
-        return "";
+        return false;
     }
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    std::string shader_content = buffer.str();
+    const int source_index = (int)sources.size() - 1;
+    const char* data = (const char*)file.data();
+    const size_t size = file.size();
+
+    int line_number = 0;
+    for (size_t begin = 0; begin < size;) {
+        size_t end = begin;
+        while (end < size && data[end] != '\n') end++;
+        const std::string line(data + begin, end - begin);
+        begin = end + 1;
+        line_number++;
+
+        const size_t directive = line.find_first_not_of(" \t");
+        if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0) {
+            out += line;
+            out += '\n';
+            continue;
+        }
+
+        const size_t open = line.find('"', directive + 8);
+        const size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+        if (close == std::string::npos || depth >= SHADER_MAX_INCLUDE_DEPTH) {
+            printf("Error: Bad #include in %s line %d\n", path.c_str(), line_number);
+            return false;
+        }
+        const std::string included = (std::filesystem::path(path).parent_path() / line.substr(open + 1, close - open - 1))
+                                         .lexically_normal().generic_string();
+        if (std::find(sources.begin(), sources.end(), included) != sources.end()) {
+            out += '\n'; // Keeps the numbering
+            continue;
+        }
+
+        sources.push_back(included);
+        out += "#line 1 " + std::to_string(sources.size() - 1) + "\n";
+        if (!expandIncludes(included, out, sources, depth + 1)) return false;
+        out += "#line " + std::to_string(line_number + 1) + " " + std::to_string(source_index) + "\n";
+    }
+    return true;
+}
+
+std::string loadShaderFile(const std::string& path, const char* desktop_version, std::vector<std::string>* dependencies) {
+    std::vector<std::string> sources = {path};
+    std::string shader_content;
+    if (!expandIncludes(path, shader_content, sources, 0)) return "";
+    if (dependencies) dependencies->insert(dependencies->end(), sources.begin() + 1, sources.end());
     
     // Remove existing #version directive if present
     size_t version_pos = shader_content.find("#version");
@@ -32,12 +78,30 @@ std::string loadShaderFile(const std::string& path) {
     // Prepend correct version for platform
     std::string version_string;
     #ifdef __EMSCRIPTEN__
+        // Array and 3D samplers have no default precision in ES fragment shaders
         version_string = "#version 300 es\n"
                         "precision highp float;\n"
-                        "precision highp int;\n";
+                        "precision highp int;\n"
+                        "precision highp sampler2DArray;\n"
+                        "precision highp sampler2DArrayShadow;\n"
+                        "precision highp sampler3D;\n";
+        (void)desktop_version;
     #else
-        version_string = "#version 330 core\n";
+        version_string = desktop_version;
     #endif
     
     return version_string + shader_content;
 }
+
+std::string addShaderDefines(const std::string& source, const std::string& defines) {
+    if (defines.empty()) return source;
+
+    // Right after #version, which has to stay the first line
+    size_t insert_pos = 0;
+    size_t version_pos = source.find("#version");
+    if (version_pos != std::string::npos) {
+        size_t newline_pos = source.find('\n', version_pos);
+        insert_pos = newline_pos == std::string::npos ? source.size() : newline_pos + 1;
+    }
+    return source.substr(0, insert_pos) + defines + source.substr(insert_pos);
+}
@@ -0,0 +1,113 @@
+#include "shader_variants.h"
+#include "shader_loading.h"
+#include "asset_watcher.h"
+#include <bitset>
+#include <cstdio>
+
+ShaderVariants::ShaderVariants(const std::string& vertex_path, const std::string& fragment_path,
+                               std::vector<std::string> feature_names, Setup setup, std::string defines)
+    : vertex_path(vertex_path),
+      fragment_path(fragment_path),
+      feature_names(std::move(feature_names)),
+      setup(std::move(setup)),
+      defines(std::move(defines)) {
+    // Included files are watched as well, the ones present now; a new #include takes a restart
+    std::vector<std::string> watched = {vertex_path, fragment_path};
+    vertex_source = loadShaderFile(vertex_path, "#version 330 core\n", &watched);
+    fragment_source = loadShaderFile(fragment_path, "#version 330 core\n", &watched);
+    variants[allFeatures()] = compile(allFeatures());
+    asset_watcher.watch(watchOwner(), watched, [this]() { reload(); });
+}
+
+ShaderVariants::~ShaderVariants() {
+    asset_watcher.unwatch(watchOwner());
+}
+
+// Sets of the same pair differ in their defines
+std::string ShaderVariants::watchOwner() const {
+    return "shaders " + vertex_path + " " + fragment_path + " " + defines;
+}
+
+void ShaderVariants::reload() {
+    std::string vertex = loadShaderFile(vertex_path);
+    std::string fragment = loadShaderFile(fragment_path);
+    if (vertex.empty() || fragment.empty()) return;
+    vertex_source = std::move(vertex);
+    fragment_source = std::move(fragment);
+
+    for (const auto& [features, shader] : variants) {
+        const std::string variant_defines = variantDefines(features);
+        pending[features] = std::make_unique<Shader>(addShaderDefines(vertex_source, variant_defines),
+                                                     addShaderDefines(fragment_source, variant_defines), Shader::Deferred{});
+    }
+    printf("Recompiling %zu variants of %s\n", pending.size(), fragment_path.c_str());
+}
+
+std::string ShaderVariants::variantDefines(uint32_t features) const {
+    std::string variant_defines = defines;
+    for (size_t i = 0; i < feature_names.size(); ++i) {
+        if (features & (1u << i)) variant_defines += "#define " + feature_names[i] + "\n";
+    }
+    return variant_defines;
+}
+
+std::unique_ptr<Shader> ShaderVariants::compile(uint32_t features) const {
+    const std::string variant_defines = variantDefines(features);
+    auto shader = std::make_unique<Shader>(addShaderDefines(vertex_source, variant_defines),
+                                           addShaderDefines(fragment_source, variant_defines));
+    if (setup) setup(*shader, features);
+    return shader;
+}
+
+Shader& ShaderVariants::get(uint32_t features) {
+    features &= allFeatures();
+    auto it = variants.find(features);
+    if (it != variants.end()) return it->second ? *it->second : *variants[allFeatures()];
+
+    if (pending.find(features) == pending.end()) {
+        const std::string variant_defines = variantDefines(features);
+        pending.emplace(features, std::make_unique<Shader>(addShaderDefines(vertex_source, variant_defines),
+                                                           addShaderDefines(fragment_source, variant_defines), Shader::Deferred{}));
+    }
+    return fallback(features);
+}
+
+// The compiled mask with the most of the wanted features and none it lacks, so it only samples
+// textures the material binds. The all-features variant when there is none.
+Shader& ShaderVariants::fallback(uint32_t features) {
+    Shader* best = nullptr;
+    int best_bits = -1;
+    for (const auto& [mask, shader] : variants) {
+        if (!shader || (mask & ~features) != 0) continue;
+        const int bits = (int)std::bitset<32>(mask).count();
+        if (bits > best_bits) {
+            best = shader.get();
+            best_bits = bits;
+        }
+    }
+    return best ? *best : *variants[allFeatures()];
+}
+
+void ShaderVariants::poll() {
+    for (auto it = pending.begin(); it != pending.end();) {
+        Shader& shader = *it->second;
+        if (shader.linkPending()) {
+            ++it;
+            continue;
+        }
+        const uint32_t features = it->first;
+        auto compiled = variants.find(features);
+        if (shader.finishLink()) {
+            if (setup) setup(shader, features);
+            variants[features] = std::move(it->second);
+            printf("Compiled shader variant 0x%02x (%zu variants)\n", features, variants.size());
+        } else if (compiled != variants.end() && compiled->second) {
+            printf("Shader variant 0x%02x failed to recompile, keeping the previous one\n", features);
+        } else {
+            // A failed mask keeps its empty slot, so it isn't retried every draw
+            printf("Shader variant 0x%02x failed, using the full variant\n", features);
+            variants.emplace(features, nullptr);
+        }
+        it = pending.erase(it);
+    }
+}
@@ -1,54 +1,487 @@
 #include "shadowmap.h"
+#include "gl_extensions.h"
+#include "scene_target.h"
+#include "gpu_memory.h"
+#include "filesystem.h"
 
-unsigned int SHADOW_WIDTH = 4096;
-unsigned int SHADOW_HEIGHT = 4096;
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+
+// Four 2048 layers fill as many texels as the single 4096 map did
+unsigned int SHADOW_WIDTH = 2048;
+unsigned int SHADOW_HEIGHT = 2048;
+ShadowSettings shadow_settings;
+static ShadowSettings pending_shadow_settings;
+static bool shadow_settings_pending = false;
+uint32_t shadow_map_generation = 0;
+const char* const SHADOW_PRESET_NAMES[SHADOW_PRESET_COUNT] = { "low", "medium", "high", "ultra" };
 GLuint shadowMapFBO = 0;
 GLuint shadowMapTexture = 0;
+GLuint shadowCacheFBO = 0;
+GLuint shadowCacheTexture = 0;
+GLuint shadowMomentsTexture = 0;
+GLuint shadowMomentsFBO = 0;
+GLuint shadowMomentsBlurTexture = 0;
+GLuint shadowMomentsBlurFBO = 0;
+float shadow_moment_exponents[2] = { 40.0f, 5.0f };
+bool use_shadow_cache = true;
+bool use_layered_shadows = true;
+int shadow_cascade_intervals[SHADOW_CASCADES] = { 1, 1, 2, 4 };
+float shadow_round_robin_importance = 0.25f;
+int shadow_caster_budget = 256;
+uint64_t shadow_texel_budget = 0; // Set to the capacity by initShadowMap()
+int shadow_max_local_lights = 4;
 
-void initShadowMap() {
-    // Create framebuffer
-    glGenFramebuffers(1, &shadowMapFBO);
-    
-    // Create depth texture
-    glGenTextures(1, &shadowMapTexture);
-    glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
-    #ifdef __EMSCRIPTEN__
-        // WebGL 2.0 requires specific formats
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
-    #else
-        // Desktop OpenGL
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    #endif
+// Depth array with a layer per atlas page, the map and its cache must match for the blit
+static GLuint createShadowArray(const char* name) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    // Sized formats, WebGL 2.0 requires them and they pin the depth on desktop too
+    GLenum internal_format = GL_DEPTH_COMPONENT24;
+    switch (shadow_settings.depth_format) {
+        case SHADOW_DEPTH_16:
+            internal_format = GL_DEPTH_COMPONENT16;
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT16, SHADOW_WIDTH, SHADOW_HEIGHT, SHADOW_LAYERS, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, NULL);
+            break;
+        case SHADOW_DEPTH_24:
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, SHADOW_WIDTH, SHADOW_HEIGHT, SHADOW_LAYERS, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+            break;
+        case SHADOW_DEPTH_32F:
+            internal_format = GL_DEPTH_COMPONENT32F;
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, SHADOW_WIDTH, SHADOW_HEIGHT, SHADOW_LAYERS, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+            break;
+    }
+    gpu_memory.trackTexture(texture, textureLevelBytes(internal_format, SHADOW_WIDTH, SHADOW_HEIGHT, SHADOW_LAYERS),
+                            GPU_MEMORY_SHADOWS, name);
 
     // GL_LINEAR for better filtering
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
     // Proper shadow comparison
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-    
-    // Attach depth texture to framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowMapTexture, 0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    return texture;
+}
+
+// Depth-only framebuffer on layer 0 of the texture
+static GLuint createShadowFBO(GLuint texture, const char* name) {
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0);
     #ifndef __EMSCRIPTEN__
         // These functions don't exist in WebGL
         glDrawBuffer(GL_NONE);
         glReadBuffer(GL_NONE);
     #endif
-    
+
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        printf("Error: Shadow map framebuffer is not complete\n");
+        printf("Error: %s framebuffer is not complete\n", name);
+    }
+    return fbo;
+}
+
+// WebGL can filter RGBA16F but not RGBA32F without another extension. Half floats hold e^2cd
+// up to c = 5.54.
+#ifdef __EMSCRIPTEN__
+static const GLenum SHADOW_MOMENTS_FORMAT = GL_RGBA16F;
+static const uint64_t SHADOW_MOMENTS_BYTES = 8;
+#else
+static const GLenum SHADOW_MOMENTS_FORMAT = GL_RGBA32F;
+static const uint64_t SHADOW_MOMENTS_BYTES = 16;
+#endif
+
+// Down to one texel per smallest tile
+static int shadowMomentLevels(unsigned int resolution) {
+    const unsigned int minTile = std::min<unsigned int>(SHADOW_MIN_TILE, resolution);
+    int levels = 1;
+    while ((1u << levels) <= minTile) levels++;
+    return levels;
+}
+
+bool shadowMomentsSupported() {
+#ifdef __EMSCRIPTEN__
+    static const bool supported = hasGLExtension("GL_EXT_color_buffer_float") || hasGLExtension("EXT_color_buffer_float");
+    return supported;
+#else
+    return true;
+#endif
+}
+
+static GLuint createMomentsFBO(GLuint texture, bool array, const char* name) {
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    if (array) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, 0);
+    } else {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    }
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Error: %s framebuffer is not complete\n", name);
+    }
+    return fbo;
+}
+
+static void initShadowMoments() {
+    if (shadow_settings.filter_quality != SHADOW_FILTER_MOMENTS) return;
+#ifdef __EMSCRIPTEN__
+    shadow_moment_exponents[0] = shadow_moment_exponents[1] = 5.54f;
+#else
+    shadow_moment_exponents[0] = 40.0f;
+    shadow_moment_exponents[1] = 5.0f;
+#endif
+
+    const int levels = shadowMomentLevels(SHADOW_WIDTH);
+    glGenTextures(1, &shadowMomentsTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMomentsTexture);
+    uint64_t momentsBytes = 0;
+    for (int level = 0; level < levels; ++level) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, SHADOW_MOMENTS_FORMAT, SHADOW_WIDTH >> level, SHADOW_HEIGHT >> level,
+                     SHADOW_LAYERS, 0, GL_RGBA, GL_FLOAT, NULL);
+        momentsBytes += textureLevelBytes(SHADOW_MOMENTS_FORMAT, SHADOW_WIDTH >> level, SHADOW_HEIGHT >> level, SHADOW_LAYERS);
+    }
+    gpu_memory.trackTexture(shadowMomentsTexture, momentsBytes, GPU_MEMORY_SHADOWS, "shadow moments");
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+    glGenTextures(1, &shadowMomentsBlurTexture);
+    glBindTexture(GL_TEXTURE_2D, shadowMomentsBlurTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, SHADOW_MOMENTS_FORMAT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
+    gpu_memory.trackTexture(shadowMomentsBlurTexture, textureLevelBytes(SHADOW_MOMENTS_FORMAT, SHADOW_WIDTH, SHADOW_HEIGHT),
+                            GPU_MEMORY_SHADOWS, "shadow moments blur");
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    shadowMomentsFBO = createMomentsFBO(shadowMomentsTexture, true, "Shadow moments");
+    shadowMomentsBlurFBO = createMomentsFBO(shadowMomentsBlurTexture, false, "Shadow moments blur");
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+static void cleanupShadowMoments() {
+    if (shadowMomentsFBO != 0) glDeleteFramebuffers(1, &shadowMomentsFBO);
+    if (shadowMomentsBlurFBO != 0) glDeleteFramebuffers(1, &shadowMomentsBlurFBO);
+    for (GLuint texture : { shadowMomentsTexture, shadowMomentsBlurTexture }) {
+        if (texture == 0) continue;
+        gpu_memory.releaseTexture(texture);
+        glDeleteTextures(1, &texture);
     }
-    
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    printf("Shadowmap initialized (%dx%d)\n", SHADOW_WIDTH, SHADOW_HEIGHT);
+    shadowMomentsFBO = shadowMomentsBlurFBO = 0;
+    shadowMomentsTexture = shadowMomentsBlurTexture = 0;
+}
+
+// Falls back to the softest depth filter where float targets can't be rendered
+static void checkMomentsSupport(ShadowSettings& settings) {
+    if (settings.filter_quality == SHADOW_FILTER_MOMENTS && !shadowMomentsSupported()) {
+        printf("Shadow moments need float render targets, using the soft filter\n");
+        settings.filter_quality = SHADOW_FILTER_SOFT;
+    }
+}
+
+// The largest power of two up to the request that the GL can allocate
+static unsigned int supportedShadowResolution(unsigned int requested) {
+    GLint maxSize = 2048;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    unsigned int resolution = 256;
+    while (resolution * 2 <= std::min<unsigned int>(requested, (unsigned int)maxSize)) resolution *= 2;
+    return resolution;
+}
+
+void initShadowMap() {
+    shadow_settings.resolution = supportedShadowResolution(shadow_settings.resolution);
+    checkMomentsSupport(shadow_settings);
+    SHADOW_WIDTH = SHADOW_HEIGHT = shadow_settings.resolution;
+    shadowMapTexture = createShadowArray("shadow atlas");
+    shadowCacheTexture = createShadowArray("static shadow cache");
+    shadowMapFBO = createShadowFBO(shadowMapTexture, "Shadow map");
+    shadowCacheFBO = createShadowFBO(shadowCacheTexture, "Shadow cache");
+    initShadowMoments();
+    shadow_map_generation++;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    shadow_texel_budget = (uint64_t)SHADOW_WIDTH * SHADOW_HEIGHT * SHADOW_LAYERS;
+    printf("Shadowmap initialized (%dx%d, %d layers, %d-bit depth)\n", SHADOW_WIDTH, SHADOW_HEIGHT, SHADOW_LAYERS,
+           shadow_settings.depth_format == SHADOW_DEPTH_16 ? 16 : shadow_settings.depth_format == SHADOW_DEPTH_24 ? 24 : 32);
+}
+
+ShadowSettings shadowPresetSettings(ShadowPreset preset) {
+    ShadowSettings settings;
+    switch (preset) {
+        case SHADOW_PRESET_LOW:
+            settings.resolution = 1024;
+            settings.depth_format = SHADOW_DEPTH_16;
+            settings.filter_quality = SHADOW_FILTER_HARD;
+            break;
+        case SHADOW_PRESET_MEDIUM:
+            settings.resolution = 2048;
+            settings.depth_format = SHADOW_DEPTH_16;
+            settings.filter_quality = SHADOW_FILTER_PCF4;
+            break;
+        case SHADOW_PRESET_HIGH:
+            settings.resolution = 2048;
+            settings.depth_format = SHADOW_DEPTH_24;
+            settings.filter_quality = SHADOW_FILTER_SOFT;
+            settings.max_filter_taps = 10;
+            break;
+        case SHADOW_PRESET_ULTRA:
+        default:
+            settings.resolution = 4096;
+            settings.depth_format = SHADOW_DEPTH_32F;
+            settings.filter_quality = SHADOW_FILTER_SOFT;
+            settings.max_filter_taps = SHADOW_FILTER_MAX_TAPS;
+            break;
+    }
+    return settings;
+}
+
+uint64_t shadowMemoryBytes(const ShadowSettings& settings) {
+    // Drivers keep 24-bit depth in 32-bit words
+    const uint64_t bytesPerTexel = settings.depth_format == SHADOW_DEPTH_16 ? 2 : 4;
+    const uint64_t pageTexels = (uint64_t)settings.resolution * settings.resolution;
+    uint64_t bytes = 2 * bytesPerTexel * pageTexels * SHADOW_LAYERS;
+    if (settings.filter_quality == SHADOW_FILTER_MOMENTS) {
+        uint64_t momentTexels = pageTexels; // The blur page
+        for (int level = 0; level < shadowMomentLevels(settings.resolution); ++level) {
+            momentTexels += (pageTexels >> (2 * level)) * SHADOW_LAYERS;
+        }
+        bytes += SHADOW_MOMENTS_BYTES * momentTexels;
+    }
+    return bytes;
+}
+
+void requestShadowSettings(const ShadowSettings& settings) {
+    pending_shadow_settings = settings;
+    shadow_settings_pending = true;
+}
+
+const ShadowSettings& requestedShadowSettings() {
+    return shadow_settings_pending ? pending_shadow_settings : shadow_settings;
+}
+
+void applyPendingShadowSettings() {
+    if (!shadow_settings_pending) return;
+    shadow_settings_pending = false;
+
+    ShadowSettings settings = pending_shadow_settings;
+    settings.resolution = supportedShadowResolution(settings.resolution);
+    checkMomentsSupport(settings);
+    if (settings == shadow_settings) return;
+
+    const bool recreate = settings.resolution != shadow_settings.resolution || settings.depth_format != shadow_settings.depth_format;
+    const bool moments = (settings.filter_quality == SHADOW_FILTER_MOMENTS) != (shadow_settings.filter_quality == SHADOW_FILTER_MOMENTS);
+    shadow_settings = settings;
+    if (!recreate) {
+        if (moments) {
+            cleanupShadowMoments();
+            initShadowMoments();
+            shadow_map_generation++;
+        }
+        return;
+    }
+
+    // The budget keeps its share of the atlas
+    const uint64_t oldCapacity = (uint64_t)SHADOW_WIDTH * SHADOW_HEIGHT * SHADOW_LAYERS;
+    const double budgetShare = oldCapacity > 0 ? (double)shadow_texel_budget / (double)oldCapacity : 1.0;
+    cleanupShadowMap();
+    initShadowMap();
+    shadow_texel_budget = (uint64_t)(budgetShare * (double)shadow_texel_budget);
+}
+
+static std::string lowerTrimmed(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    size_t end = text.find_last_not_of(" \t\r");
+    std::string result = begin == std::string::npos ? std::string() : text.substr(begin, end - begin + 1);
+    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return result;
+}
+
+bool loadShadowSettings(const std::string& path, ShadowSettings& settings) {
+    MappedFile mapped(path);
+    if (!mapped.isOpen()) return false;
+    std::istringstream file(std::string((const char*)mapped.data(), mapped.size()));
+
+    // The preset goes first wherever it is, the other keys override it
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) continue;
+        entries.emplace_back(lowerTrimmed(line.substr(0, equals)), lowerTrimmed(line.substr(equals + 1)));
+    }
+
+    ShadowSettings result = settings;
+    for (const auto& [key, value] : entries) {
+        if (key != "preset") continue;
+        for (int preset = 0; preset < SHADOW_PRESET_COUNT; ++preset) {
+            if (value == SHADOW_PRESET_NAMES[preset]) result = shadowPresetSettings((ShadowPreset)preset);
+        }
+    }
+    for (const auto& [key, value] : entries) {
+        if (key == "resolution") {
+            result.resolution = (unsigned int)std::max(1, std::atoi(value.c_str()));
+        } else if (key == "depth_bits") {
+            int bits = std::atoi(value.c_str());
+            if (bits == 16) result.depth_format = SHADOW_DEPTH_16;
+            else if (bits == 24) result.depth_format = SHADOW_DEPTH_24;
+            else if (bits == 32) result.depth_format = SHADOW_DEPTH_32F;
+            else printf("Shadow settings: unsupported depth_bits %s\n", value.c_str());
+        } else if (key == "filter") {
+            if (value == "hard") result.filter_quality = SHADOW_FILTER_HARD;
+            else if (value == "pcf4") result.filter_quality = SHADOW_FILTER_PCF4;
+            else if (value == "soft") result.filter_quality = SHADOW_FILTER_SOFT;
+            else if (value == "moments") result.filter_quality = SHADOW_FILTER_MOMENTS;
+            else printf("Shadow settings: unknown filter %s\n", value.c_str());
+        } else if (key == "filter_taps") {
+            result.max_filter_taps = std::clamp(std::atoi(value.c_str()), 1, SHADOW_FILTER_MAX_TAPS);
+        } else if (key != "preset") {
+            printf("Shadow settings: unknown key %s\n", key.c_str());
+        }
+    }
+    settings = result;
+    return true;
+}
+
+void bindShadowLayer(int layer) {
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMapTexture, 0, layer);
+}
+
+void bindShadowCacheLayer(int layer) {
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowCacheFBO);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowCacheTexture, 0, layer);
+}
+
+// WebGL has no layered attachments, gl_extensions.layered_rendering stays false there
+void bindShadowLayers() {
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+    #ifndef __EMSCRIPTEN__
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMapTexture, 0);
+    #endif
+}
+
+void bindShadowCacheLayers() {
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowCacheFBO);
+    #ifndef __EMSCRIPTEN__
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowCacheTexture, 0);
+    #endif
+}
+
+void bindShadowMomentsLayer(int layer) {
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowMomentsFBO);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadowMomentsTexture, 0, layer);
+}
+
+void bindShadowMomentsBlur() {
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowMomentsBlurFBO);
+}
+
+void clearShadowTile(const ShadowTile& tile) {
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(tile.x, tile.y, tile.size, tile.size);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+}
+
+void copyShadowCacheTile(const ShadowTile& tile) {
+    bindShadowCacheLayer(tile.layer);
+    bindShadowLayer(tile.layer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, shadowCacheFBO);
+    glBlitFramebuffer(tile.x, tile.y, tile.x + tile.size, tile.y + tile.size,
+                      tile.x, tile.y, tile.x + tile.size, tile.y + tile.size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+}
+
+static int floorPowerOfTwo(int value) {
+    int power = 1;
+    while (power * 2 <= value) power *= 2;
+    return power;
+}
+
+void fitShadowRequests(std::vector<ShadowRequest>& requests) {
+    const uint64_t capacity = (uint64_t)SHADOW_WIDTH * SHADOW_HEIGHT * SHADOW_LAYERS;
+    const uint64_t budget = std::min(shadow_texel_budget, capacity);
+    const int minTile = std::min<int>(SHADOW_MIN_TILE, (int)SHADOW_WIDTH);
+
+    int views = 0;
+    uint64_t texels = 0;
+    for (ShadowRequest& request : requests) {
+        request.size = std::clamp(floorPowerOfTwo(std::max(request.size, 1)), minTile, (int)SHADOW_WIDTH);
+        views += request.views;
+        texels += (uint64_t)request.views * request.size * request.size;
+    }
+
+    // Least important last, so shrinking and dropping both take from the back
+    std::stable_sort(requests.begin(), requests.end(), [](const ShadowRequest& a, const ShadowRequest& b) {
+        return a.importance > b.importance;
+    });
+    auto drop = [&](ShadowRequest& request) {
+        views -= request.views;
+        texels -= (uint64_t)request.views * request.size * request.size;
+        request.size = 0;
+    };
+    for (auto it = requests.rbegin(); it != requests.rend() && views > SHADOW_MAX_VIEWS; ++it) drop(*it);
+
+    while (texels > budget) {
+        // The tile largest for its importance that can still shrink, the least important of equals
+        ShadowRequest* largest = nullptr;
+        float largestRatio = 0.0f;
+        for (auto it = requests.rbegin(); it != requests.rend(); ++it) {
+            float ratio = (float)it->size / std::max(it->importance, 1e-3f);
+            if (it->size > minTile && ratio > largestRatio) {
+                largest = &*it;
+                largestRatio = ratio;
+            }
+        }
+        if (!largest) break;
+        texels -= (uint64_t)largest->views * largest->size * largest->size * 3 / 4;
+        largest->size /= 2;
+    }
+    for (auto it = requests.rbegin(); it != requests.rend() && texels > budget; ++it) {
+        if (it->size > 0) drop(*it);
+    }
+}
+
+// Z-order index to tile coordinates, the even bits are x and the odd ones y
+static int compactBits(uint64_t value) {
+    int result = 0;
+    for (int bit = 0; value != 0; ++bit, value >>= 2) result |= (int)(value & 1) << bit;
+    return result;
+}
+
+ShadowTile allocateShadowTile(uint64_t& cursor, int size) {
+    const uint64_t pageTexels = (uint64_t)SHADOW_WIDTH * SHADOW_HEIGHT;
+    const uint64_t tileTexels = (uint64_t)size * size;
+    ShadowTile tile;
+    tile.layer = (int)(cursor / pageTexels);
+    uint64_t index = (cursor % pageTexels) / tileTexels;
+    tile.x = compactBits(index) * size;
+    tile.y = compactBits(index >> 1) * size;
+    tile.size = size;
+    cursor += tileTexels;
+    return tile;
 }
 
 void cleanupShadowMap() {
     if (shadowMapFBO != 0) glDeleteFramebuffers(1, &shadowMapFBO);
-    if (shadowMapTexture != 0) glDeleteTextures(1, &shadowMapTexture);
+    if (shadowCacheFBO != 0) glDeleteFramebuffers(1, &shadowCacheFBO);
+    for (GLuint texture : { shadowMapTexture, shadowCacheTexture }) {
+        if (texture == 0) continue;
+        gpu_memory.releaseTexture(texture);
+        glDeleteTextures(1, &texture);
+    }
+    shadowMapFBO = shadowCacheFBO = 0;
+    shadowMapTexture = shadowCacheTexture = 0;
+    cleanupShadowMoments();
 }
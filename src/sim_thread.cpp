@@ -0,0 +1,98 @@
+#include "sim_thread.h"
+#include "trace_capture.h"
+
+#include <algorithm>
+#include <cstdio>
+
+SimulationThread sim_thread;
+
+#ifdef __EMSCRIPTEN__
+bool use_sim_thread = false; // The browser's frame callback can't block on another thread
+#else
+bool use_sim_thread = true;
+#endif
+
+int FixedStepClock::advance(float frame_time) {
+    accumulator += frame_time;
+    int steps = (int)(accumulator / SIM_STEP_SECONDS);
+    if (steps > SIM_MAX_STEPS) {
+        steps = SIM_MAX_STEPS;
+        accumulator = 0.0f;
+    } else {
+        accumulator -= steps * SIM_STEP_SECONDS;
+    }
+    accumulator = std::max(accumulator, 0.0f);
+    return steps;
+}
+
+void SimulationThread::start(Step new_step, bool run_threaded) {
+    stop();
+    step = std::move(new_step);
+    setThreaded(run_threaded);
+}
+
+void SimulationThread::setThreaded(bool run_threaded) {
+#ifdef __EMSCRIPTEN__
+    (void)run_threaded;
+#else
+    if (run_threaded == threaded()) return;
+    if (!run_threaded) {
+        stop();
+        return;
+    }
+    stopping = false;
+    busy = false;
+    thread = std::thread(&SimulationThread::run, this);
+    printf("Simulation thread started\n");
+#endif
+}
+
+void SimulationThread::stop() {
+    if (!thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+    // A step still posted never ran, the next inline one carries on from the state before it
+    busy = false;
+}
+
+const RenderSnapshot& SimulationThread::exchange(const SimInput& input) {
+    if (!thread.joinable()) {
+        step(input, snapshots[writing]);
+        return snapshots[writing];
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return !busy; });
+    // The finished snapshot is the GL thread's now, the next step writes over the one it had
+    const int finished = writing;
+    writing = 1 - writing;
+    pending = input;
+    busy = true;
+    lock.unlock();
+    wake.notify_one();
+    return snapshots[finished];
+}
+
+void SimulationThread::run() {
+    trace_capture.nameThread("Simulation");
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [this] { return busy || stopping; });
+        if (stopping) return;
+
+        const SimInput input = pending;
+        RenderSnapshot& snapshot = snapshots[writing];
+        lock.unlock();
+        {
+            TRACE_SCOPE("Simulation step", "simulation");
+            step(input, snapshot);
+        }
+        lock.lock();
+        busy = false;
+        done.notify_one();
+    }
+}
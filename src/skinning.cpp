@@ -0,0 +1,637 @@
+#include "skinning.h"
+#include "mesh_loader.h"
+#include "mesh_optimizer.h"
+#include "asset_fetch.h"
+#include "filesystem.h"
+#include "gl_state.h"
+#include "gpu_memory.h"
+#include "job_system.h"
+#include "load_stats.h"
+#include "trace_capture.h"
+
+#include <assimp/Importer.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define SKINNING_SSE2
+#elif defined(__wasm_simd128__)
+    #include <wasm_simd128.h>
+    #define SKINNING_WASM_SIMD
+#endif
+
+SkinnedAnimation skinned_animation;
+bool use_skinned_animation = true;
+
+// Bones need the hierarchy, so vertices stay in their meshes' spaces
+constexpr unsigned int SKINNED_IMPORT_FLAGS = (MESH_IMPORT_FLAGS & ~aiProcess_PreTransformVertices) | aiProcess_LimitBoneWeights;
+
+struct SkinnedAnimation::PendingModel {
+    std::shared_ptr<SkinnedModelRequest> request;
+    std::shared_ptr<SkinnedModel> model;
+    std::vector<SubMeshStaging> submeshes;
+    std::string fetch_prefix;
+    bool imported = false;
+};
+
+int SkinnedModel::findClip(const std::string& name) const {
+    for (size_t i = 0; i < clips.size(); ++i) {
+        if (clips[i].name == name) return (int)i;
+    }
+    return -1;
+}
+
+// ============================================================================
+// IMPORT
+// ============================================================================
+
+static glm::mat4 toGlm(const aiMatrix4x4& m) {
+    return glm::transpose(glm::make_mat4(&m.a1)); // Assimp's are row-major
+}
+
+static glm::mat4 composeTRS(const glm::vec3& t, const glm::quat& r, const glm::vec3& s) {
+    glm::mat4 m = glm::mat4_cast(r);
+    m[0] *= s.x;
+    m[1] *= s.y;
+    m[2] *= s.z;
+    m[3] = glm::vec4(t, 1.0f);
+    return m;
+}
+
+// The heaviest SKIN_MAX_INFLUENCES influences of one vertex
+struct VertexInfluences {
+    uint8_t bones[SKIN_MAX_INFLUENCES] = {};
+    float weights[SKIN_MAX_INFLUENCES] = {};
+
+    void add(uint8_t bone, float weight) {
+        int lightest = 0;
+        for (int i = 1; i < SKIN_MAX_INFLUENCES; ++i) {
+            if (weights[i] < weights[lightest]) lightest = i;
+        }
+        if (weight <= weights[lightest]) return;
+        bones[lightest] = bone;
+        weights[lightest] = weight;
+    }
+};
+
+static void importSkeleton(const aiScene* scene, Skeleton& skeleton, std::unordered_map<std::string, int>& node_index) {
+    std::function<void(const aiNode*, int)> addNode = [&](const aiNode* node, int parent) {
+        const int index = (int)skeleton.nodes.size();
+        Skeleton::Node entry;
+        entry.name = node->mName.C_Str();
+        entry.parent = parent;
+        aiVector3D scale, position;
+        aiQuaternion rotation;
+        node->mTransformation.Decompose(scale, rotation, position);
+        entry.translation = glm::vec3(position.x, position.y, position.z);
+        entry.rotation = glm::quat(rotation.w, rotation.x, rotation.y, rotation.z);
+        entry.scale = glm::vec3(scale.x, scale.y, scale.z);
+        node_index.emplace(entry.name, index); // The first of duplicate names wins, as in Assimp's lookups
+        skeleton.nodes.push_back(std::move(entry));
+        for (unsigned int i = 0; i < node->mNumChildren; ++i) addNode(node->mChildren[i], index);
+    };
+    addNode(scene->mRootNode, -1);
+    skeleton.global_inverse = glm::inverse(toGlm(scene->mRootNode->mTransformation));
+}
+
+static void importClips(const aiScene* scene, const std::unordered_map<std::string, int>& node_index, SkinnedModel& model) {
+    for (unsigned int a = 0; a < scene->mNumAnimations; ++a) {
+        const aiAnimation* anim = scene->mAnimations[a];
+        const double ticks = anim->mTicksPerSecond > 0.0 ? anim->mTicksPerSecond : SKIN_DEFAULT_TICKS_PER_SECOND;
+        AnimationClip clip;
+        clip.name = anim->mName.C_Str();
+        clip.duration = (float)(anim->mDuration / ticks);
+        clip.node_channels.assign(model.skeleton.nodes.size(), -1);
+
+        for (unsigned int c = 0; c < anim->mNumChannels; ++c) {
+            const aiNodeAnim* source = anim->mChannels[c];
+            auto node = node_index.find(source->mNodeName.C_Str());
+            if (node == node_index.end()) continue;
+            AnimationClip::Channel channel;
+            channel.node = node->second;
+            for (unsigned int k = 0; k < source->mNumPositionKeys; ++k) {
+                const aiVectorKey& key = source->mPositionKeys[k];
+                channel.translation_times.push_back((float)(key.mTime / ticks));
+                channel.translations.emplace_back(key.mValue.x, key.mValue.y, key.mValue.z);
+            }
+            for (unsigned int k = 0; k < source->mNumRotationKeys; ++k) {
+                const aiQuatKey& key = source->mRotationKeys[k];
+                channel.rotation_times.push_back((float)(key.mTime / ticks));
+                channel.rotations.emplace_back(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z);
+            }
+            for (unsigned int k = 0; k < source->mNumScalingKeys; ++k) {
+                const aiVectorKey& key = source->mScalingKeys[k];
+                channel.scale_times.push_back((float)(key.mTime / ticks));
+                channel.scales.emplace_back(key.mValue.x, key.mValue.y, key.mValue.z);
+            }
+            clip.node_channels[channel.node] = (int)clip.channels.size();
+            clip.channels.push_back(std::move(channel));
+        }
+        if (clip.name.empty()) clip.name = "clip " + std::to_string(a);
+        model.clips.push_back(std::move(clip));
+    }
+}
+
+static bool importSkinnedModel(const std::string& filepath, SkinnedModel& model, std::vector<SubMeshStaging>& submeshes) {
+    const std::string source_path = buildAssetPath("res/scene_models/" + filepath);
+    LoadAssetScope asset(filepath);
+
+    Assimp::Importer importer;
+    const aiScene* scene = readAssimpScene(importer, source_path, SKINNED_IMPORT_FLAGS);
+    if (!scene) return false;
+
+    std::unordered_map<std::string, int> node_index;
+    importSkeleton(scene, model.skeleton, node_index);
+
+    // Real bones by name, and one rigid bone per node for meshes that have none
+    std::unordered_map<std::string, int> bone_index;
+    std::unordered_map<int, int> rigid_bones;
+    auto addBone = [&](int node, const glm::mat4& offset) {
+        model.skeleton.bones.push_back({node, offset});
+        return (int)model.skeleton.bones.size() - 1;
+    };
+
+    // Same walk as importSkeleton(), so the nodes come up in index order
+    bool ok = true;
+    int next_node = 0;
+    std::function<void(const aiNode*)> processNode = [&](const aiNode* node) {
+        const int node_id = next_node++;
+        for (unsigned int i = 0; i < node->mNumMeshes && ok; ++i) {
+            const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            SubMeshStaging sub;
+            LoadTimer timer(LOAD_STAGE_VERTEX_ENCODE);
+            sub.vertex_format = chooseVertexFormat(mesh) | VERTEX_SKINNED;
+            const VertexLayout layout = getVertexLayout(sub.vertex_format);
+            encodeVertices(mesh, layout, sub.vertices);
+
+            // Unweighted vertices, and all of a boneless mesh, follow the mesh's own node
+            auto rigid = rigid_bones.find(node_id);
+            const int rigid_bone = rigid != rigid_bones.end() ? rigid->second : (rigid_bones[node_id] = addBone(node_id, glm::mat4(1.0f)));
+            std::vector<VertexInfluences> influences(mesh->mNumVertices);
+            for (unsigned int b = 0; b < mesh->mNumBones; ++b) {
+                const aiBone* bone = mesh->mBones[b];
+                auto bone_node = node_index.find(bone->mName.C_Str());
+                if (bone_node == node_index.end()) {
+                    printf("Skinning: %s has no node for bone %s\n", filepath.c_str(), bone->mName.C_Str());
+                    continue;
+                }
+                auto found = bone_index.find(bone->mName.C_Str());
+                const int index = found != bone_index.end() ? found->second
+                                                            : (bone_index[bone->mName.C_Str()] = addBone(bone_node->second, toGlm(bone->mOffsetMatrix)));
+                if (index >= SKIN_MAX_BONES) break;
+                for (unsigned int w = 0; w < bone->mNumWeights; ++w) {
+                    const aiVertexWeight& weight = bone->mWeights[w];
+                    if (weight.mVertexId < influences.size()) influences[weight.mVertexId].add((uint8_t)index, weight.mWeight);
+                }
+            }
+            if (model.skeleton.bones.size() > SKIN_MAX_BONES) {
+                printf("Skinning: %s has more than %d bones\n", filepath.c_str(), SKIN_MAX_BONES);
+                ok = false;
+                return;
+            }
+
+            // Bytes summing to exactly 255, the rounding error goes to the heaviest bone
+            for (size_t v = 0; v < influences.size(); ++v) {
+                const VertexInfluences& vertex = influences[v];
+                uint8_t* out = sub.vertices.data() + v * layout.stride + layout.skin_offset;
+                float total = 0.0f;
+                for (float w : vertex.weights) total += w;
+                if (total <= 0.0f) {
+                    const uint8_t bytes[8] = {(uint8_t)rigid_bone, 0, 0, 0, 255, 0, 0, 0};
+                    memcpy(out, bytes, sizeof(bytes));
+                    continue;
+                }
+                int sum = 0, heaviest = 0;
+                for (int i = 0; i < SKIN_MAX_INFLUENCES; ++i) {
+                    out[i] = vertex.bones[i];
+                    out[SKIN_MAX_INFLUENCES + i] = (uint8_t)std::lround(vertex.weights[i] / total * 255.0f);
+                    sum += out[SKIN_MAX_INFLUENCES + i];
+                    if (vertex.weights[i] > vertex.weights[heaviest]) heaviest = i;
+                }
+                out[SKIN_MAX_INFLUENCES + heaviest] = (uint8_t)(out[SKIN_MAX_INFLUENCES + heaviest] + (255 - sum));
+            }
+
+            sub.indices.reserve((size_t)mesh->mNumFaces * 3);
+            for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
+                const aiFace& face = mesh->mFaces[f];
+                sub.indices.insert(sub.indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
+            }
+            if (optimize_imported_meshes) optimizeMesh(mesh->mName.C_Str(), sub.indices, sub.vertices, layout.stride);
+
+            sub.material = describeMaterialFromAssimp(filepath, scene->mMaterials[mesh->mMaterialIndex]);
+            sub.images = decodeMaterialImages(sub.material, scene);
+            // Bounds are of the bind pose, the skinned pass doesn't cull by them
+            finalizeSubMeshBuffers(sub);
+            submeshes.push_back(std::move(sub));
+        }
+        for (unsigned int i = 0; i < node->mNumChildren && ok; ++i) processNode(node->mChildren[i]);
+    };
+    processNode(scene->mRootNode);
+    if (!ok) return false;
+
+    importClips(scene, node_index, model);
+    printf("Skinning: %s has %zu bones, %zu nodes and %zu clips\n", filepath.c_str(), model.skeleton.bones.size(),
+           model.skeleton.nodes.size(), model.clips.size());
+    return true;
+}
+
+std::shared_ptr<SkinnedModelRequest> SkinnedAnimation::loadAsync(const std::string& filepath) {
+    auto entry = std::make_shared<PendingModel>();
+    entry->request = std::make_shared<SkinnedModelRequest>();
+    entry->request->filepath = filepath;
+    entry->model = std::make_shared<SkinnedModel>();
+    entry->model->filepath = filepath;
+
+    // Same directory rule as AssetLoader's, the textures sit next to the model
+    const std::filesystem::path dir = std::filesystem::path(filepath).parent_path();
+    entry->fetch_prefix = dir.empty() ? "res/scene_models/" + filepath : "res/scene_models/" + dir.generic_string() + "/";
+    if (!asset_fetch.ready(entry->fetch_prefix)) asset_fetch.fetchPrefix(entry->fetch_prefix, ASSET_PRIORITY_SCENE);
+    fetching.push_back(entry);
+    processUploads();
+    return entry->request;
+}
+
+void SkinnedAnimation::processUploads() {
+    for (auto it = fetching.begin(); it != fetching.end();) {
+        if (!asset_fetch.ready((*it)->fetch_prefix)) {
+            ++it;
+            continue;
+        }
+        std::shared_ptr<PendingModel> entry = *it;
+        it = fetching.erase(it);
+        job_system.submit([this, entry]() {
+            const auto start = std::chrono::steady_clock::now();
+            entry->imported = importSkinnedModel(entry->request->filepath, *entry->model, entry->submeshes);
+            trace_capture.event("Import skinned model", "assets", start, std::chrono::steady_clock::now(), entry->request->filepath);
+            std::lock_guard<std::mutex> lock(staged_mutex);
+            staged.push_back(entry);
+        });
+    }
+
+    std::vector<std::shared_ptr<PendingModel>> ready;
+    {
+        std::lock_guard<std::mutex> lock(staged_mutex);
+        ready.swap(staged);
+    }
+    for (const auto& entry : ready) {
+        SkinnedModelRequest& request = *entry->request;
+        if (!entry->imported) {
+            printf("Skinning: failed to import %s\n", request.filepath.c_str());
+            request.failed = true;
+            request.ready = true;
+            continue;
+        }
+        {
+            LoadAssetScope asset(request.filepath);
+            for (SubMeshStaging& sub : entry->submeshes) entry->model->meshes.push_back(uploadSubMeshStaging(sub));
+        }
+        logLoadedMesh(request.filepath, entry->model->meshes, false);
+        request.model = entry->model;
+        request.ready = true;
+    }
+}
+
+// ============================================================================
+// INSTANCES
+// ============================================================================
+
+int SkinnedAnimation::addInstance(const std::shared_ptr<SkinnedModel>& model, const glm::mat4& transform, int clip) {
+    Instance instance;
+    instance.model = model;
+    instance.transform = transform;
+    instance.clip = clip < (int)model->clips.size() ? clip : -1;
+    instances.push_back(std::move(instance));
+    groups_dirty = true;
+    return (int)instances.size() - 1;
+}
+
+void SkinnedAnimation::setTransform(int instance, const glm::mat4& transform) {
+    instances[instance].transform = transform;
+}
+
+void SkinnedAnimation::play(int index, int clip, float blend_seconds) {
+    Instance& instance = instances[index];
+    if (clip >= (int)instance.model->clips.size()) clip = -1;
+    instance.previous_clip = instance.clip;
+    instance.previous_time = instance.time;
+    instance.clip = clip;
+    instance.time = 0.0f;
+    instance.blend_duration = blend_seconds;
+    instance.blend = blend_seconds > 0.0f ? 0.0f : 1.0f;
+}
+
+// Rows by model, so each model's instances draw together from consecutive rows
+void SkinnedAnimation::rebuildGroups() {
+    draw_groups.clear();
+    std::vector<size_t> order(instances.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return instances[a].model < instances[b].model; });
+    for (size_t row = 0; row < order.size(); ++row) {
+        Instance& instance = instances[order[row]];
+        instance.row = (int)row;
+        if (draw_groups.empty() || draw_groups.back().model != instance.model) {
+            Group group;
+            group.model = instance.model;
+            group.first_row = (int)row;
+            draw_groups.push_back(std::move(group));
+        }
+    }
+    groups_dirty = false;
+}
+
+// ============================================================================
+// SAMPLING
+// ============================================================================
+
+// Normalised lerp along the shorter arc. Between neighbouring keys and over a cross-fade it is
+// within a fraction of a degree of slerp, for a handful of vector instructions.
+static glm::quat blendRotation(const glm::quat& a, const glm::quat& b, float t) {
+#if defined(SKINNING_SSE2)
+    const __m128 va = _mm_set_ps(a.w, a.z, a.y, a.x);
+    __m128 vb = _mm_set_ps(b.w, b.z, b.y, b.x);
+    auto dot = [](__m128 x, __m128 y) {
+        __m128 m = _mm_mul_ps(x, y);
+        m = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    };
+    // Flips b's sign when the dot product is negative
+    const __m128 sign = _mm_and_ps(dot(va, vb), _mm_set1_ps(-0.0f));
+    vb = _mm_xor_ps(vb, sign);
+    __m128 r = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), _mm_set1_ps(t)));
+    r = _mm_div_ps(r, _mm_sqrt_ps(dot(r, r)));
+    float out[4];
+    _mm_storeu_ps(out, r);
+    return glm::quat(out[3], out[0], out[1], out[2]);
+#elif defined(SKINNING_WASM_SIMD)
+    const v128_t va = wasm_f32x4_make(a.x, a.y, a.z, a.w);
+    v128_t vb = wasm_f32x4_make(b.x, b.y, b.z, b.w);
+    auto dot = [](v128_t x, v128_t y) {
+        v128_t m = wasm_f32x4_mul(x, y);
+        m = wasm_f32x4_add(m, wasm_i32x4_shuffle(m, m, 1, 0, 3, 2));
+        return wasm_f32x4_add(m, wasm_i32x4_shuffle(m, m, 2, 3, 0, 1));
+    };
+    const v128_t sign = wasm_v128_and(dot(va, vb), wasm_f32x4_splat(-0.0f));
+    vb = wasm_v128_xor(vb, sign);
+    v128_t r = wasm_f32x4_add(va, wasm_f32x4_mul(wasm_f32x4_sub(vb, va), wasm_f32x4_splat(t)));
+    r = wasm_f32x4_div(r, wasm_f32x4_sqrt(dot(r, r)));
+    return glm::quat(wasm_f32x4_extract_lane(r, 3), wasm_f32x4_extract_lane(r, 0), wasm_f32x4_extract_lane(r, 1),
+                     wasm_f32x4_extract_lane(r, 2));
+#else
+    const glm::quat target = glm::dot(a, b) < 0.0f ? -b : b;
+    return glm::normalize(a + (target - a) * t);
+#endif
+}
+
+// Index of the key interval holding t and the position in it, clamped to the ends
+static size_t findKey(const std::vector<float>& times, float t, float& f) {
+    if (times.size() < 2 || t <= times.front()) {
+        f = 0.0f;
+        return 0;
+    }
+    const size_t next = std::upper_bound(times.begin(), times.end(), t) - times.begin();
+    if (next >= times.size()) {
+        f = 0.0f;
+        return times.size() - 1;
+    }
+    const float span = times[next] - times[next - 1];
+    f = span > 0.0f ? (t - times[next - 1]) / span : 0.0f;
+    return next - 1;
+}
+
+static glm::vec3 sampleVec3(const std::vector<float>& times, const std::vector<glm::vec3>& values, float t, const glm::vec3& bind) {
+    if (values.empty()) return bind;
+    float f;
+    const size_t i = findKey(times, t, f);
+    return f > 0.0f ? glm::mix(values[i], values[i + 1], f) : values[i];
+}
+
+static glm::quat sampleQuat(const std::vector<float>& times, const std::vector<glm::quat>& values, float t, const glm::quat& bind) {
+    if (values.empty()) return bind;
+    float f;
+    const size_t i = findKey(times, t, f);
+    return f > 0.0f ? blendRotation(values[i], values[i + 1], f) : values[i];
+}
+
+struct LocalPose {
+    glm::vec3 translation;
+    glm::quat rotation;
+    glm::vec3 scale;
+};
+
+static LocalPose sampleNode(const Skeleton::Node& node, const AnimationClip* clip, int index, float time) {
+    const int channel = clip ? clip->node_channels[index] : -1;
+    if (channel < 0) return {node.translation, node.rotation, node.scale};
+    const AnimationClip::Channel& c = clip->channels[channel];
+    return {sampleVec3(c.translation_times, c.translations, time, node.translation),
+            sampleQuat(c.rotation_times, c.rotations, time, node.rotation),
+            sampleVec3(c.scale_times, c.scales, time, node.scale)};
+}
+
+void SkinnedAnimation::samplePose(const Instance& instance, glm::vec4* rows, std::vector<glm::mat4>& globals) const {
+    const SkinnedModel& model = *instance.model;
+    const Skeleton& skeleton = model.skeleton;
+    const AnimationClip* clip = instance.clip >= 0 ? &model.clips[instance.clip] : nullptr;
+    const AnimationClip* previous = instance.blend < 1.0f && instance.previous_clip >= 0 ? &model.clips[instance.previous_clip] : nullptr;
+    const bool fading = instance.blend < 1.0f;
+
+    globals.resize(skeleton.nodes.size());
+    for (size_t i = 0; i < skeleton.nodes.size(); ++i) {
+        const Skeleton::Node& node = skeleton.nodes[i];
+        LocalPose pose = sampleNode(node, clip, (int)i, instance.time);
+        if (fading) {
+            const LocalPose from = sampleNode(node, previous, (int)i, instance.previous_time);
+            pose.translation = glm::mix(from.translation, pose.translation, instance.blend);
+            pose.rotation = blendRotation(from.rotation, pose.rotation, instance.blend);
+            pose.scale = glm::mix(from.scale, pose.scale, instance.blend);
+        }
+        const glm::mat4 local = composeTRS(pose.translation, pose.rotation, pose.scale);
+        globals[i] = node.parent >= 0 ? globals[node.parent] * local : local;
+    }
+
+    // Transposed into rows, InstanceTransform's layout, the bottom row being (0, 0, 0, 1)
+    for (size_t b = 0; b < skeleton.bones.size(); ++b) {
+        const Skeleton::Bone& bone = skeleton.bones[b];
+        const glm::mat4 m = glm::transpose(skeleton.global_inverse * globals[bone.node] * bone.offset);
+        rows[b * 3 + 0] = m[0];
+        rows[b * 3 + 1] = m[1];
+        rows[b * 3 + 2] = m[2];
+    }
+}
+
+static float advanceClipTime(const AnimationClip* clip, float time, float dt) {
+    if (!clip || clip->duration <= 0.0f) return 0.0f;
+    return std::fmod(time + dt, clip->duration);
+}
+
+void SkinnedAnimation::update(float dt) {
+    // Wrapped well before float precision blurs the frame, a crowd jumps once an hour
+    if (use_skinned_animation) crowd_time = std::fmod(crowd_time + dt, 3600.0f);
+    if (instances.empty()) return;
+    if (groups_dirty) rebuildGroups();
+    ensurePaletteRows((int)instances.size());
+    if (!use_skinned_animation) dt = 0.0f;
+
+    const size_t row_texels = 3 * SKIN_MAX_BONES;
+    palette_data.resize(instances.size() * row_texels);
+    job_system.parallelFor(instances.size(), SKIN_JOB_GRAIN, [&](size_t begin, size_t end) {
+        std::vector<glm::mat4> globals;
+        for (size_t i = begin; i < end; ++i) {
+            Instance& instance = instances[i];
+            const std::vector<AnimationClip>& clips = instance.model->clips;
+            instance.time = advanceClipTime(instance.clip >= 0 ? &clips[instance.clip] : nullptr, instance.time, dt);
+            if (instance.blend < 1.0f) {
+                instance.previous_time = advanceClipTime(instance.previous_clip >= 0 ? &clips[instance.previous_clip] : nullptr,
+                                                         instance.previous_time, dt);
+                instance.blend = instance.blend_duration > 0.0f ? std::min(1.0f, instance.blend + dt / instance.blend_duration) : 1.0f;
+            }
+            samplePose(instance, palette_data.data() + instance.row * row_texels, globals);
+        }
+    });
+
+    bones_sampled = 0;
+    for (Group& group : draw_groups) group.transforms.clear();
+    for (const Instance& instance : instances) {
+        bones_sampled += instance.model->skeleton.bones.size();
+        // Groups are in row order, so the group is the last one starting at or before the row
+        auto group = std::upper_bound(draw_groups.begin(), draw_groups.end(), instance.row,
+                                      [](int row, const Group& g) { return row < g.first_row; }) - 1;
+        const size_t slot = instance.row - group->first_row;
+        if (group->transforms.size() <= slot) group->transforms.resize(slot + 1);
+        group->transforms[slot] = instance.transform;
+    }
+
+    // Only as wide as the widest skeleton, rows are the instances in use
+    size_t width = 0;
+    for (const Group& group : draw_groups) width = std::max(width, group.model->skeleton.bones.size() * 3);
+    if (width == 0) return;
+    gl_state.bindTexture(SKIN_PALETTE_UNIT, GL_TEXTURE_2D, palette);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)row_texels);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)width, (GLsizei)instances.size(), GL_RGBA, GL_FLOAT, palette_data.data());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+// ============================================================================
+// BAKED CLIPS
+// ============================================================================
+
+int SkinnedAnimation::bakeClip(const std::shared_ptr<SkinnedModel>& model, int clip) {
+    if (clip < 0 || clip >= (int)model->clips.size()) return -1;
+    const AnimationClip& source = model->clips[clip];
+    const size_t width = model->skeleton.bones.size() * 3;
+    if (width == 0) return -1;
+
+    // The last frame leads back into the first, clips loop
+    BakedClip entry;
+    entry.model = model;
+    entry.clip = clip;
+    entry.frames = std::max(1, (int)std::lround(source.duration * SKIN_BAKE_FPS));
+    std::vector<glm::vec4> texels((size_t)entry.frames * width);
+    job_system.parallelFor(entry.frames, 1, [&](size_t begin, size_t end) {
+        std::vector<glm::mat4> globals;
+        Instance instance;
+        instance.model = model;
+        instance.clip = clip;
+        for (size_t f = begin; f < end; ++f) {
+            instance.time = f / SKIN_BAKE_FPS;
+            samplePose(instance, texels.data() + f * width, globals);
+        }
+    });
+
+    glGenTextures(1, &entry.texture);
+    gl_state.bindTexture(SKIN_PALETTE_UNIT, GL_TEXTURE_2D, entry.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, (GLsizei)width, entry.frames, 0, GL_RGBA, GL_FLOAT, texels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gpu_memory.trackTexture(entry.texture, textureLevelBytes(GL_RGBA32F, (int)width, entry.frames), GPU_MEMORY_INSTANCES,
+                            model->filepath + " baked clip");
+    printf("Skinning: baked %s of %s into %d frames\n", source.name.c_str(), model->filepath.c_str(), entry.frames);
+    baked.push_back(std::move(entry));
+    return (int)baked.size() - 1;
+}
+
+void SkinnedAnimation::addCrowdInstance(int index, const glm::mat4& transform, float time_offset, float speed) {
+    BakedClip& clip = baked[index];
+    clip.transforms.push_back(transform);
+    clip.playback.emplace_back(time_offset, speed);
+}
+
+void SkinnedAnimation::spawnCrowd(int index, int count, const glm::vec3& center, float scale) {
+    // Fixed seed, a benchmark sees the same crowd every run
+    std::mt19937 rng(1234u);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const float duration = baked[index].frames / SKIN_BAKE_FPS;
+    const int side = (int)std::ceil(std::sqrt((float)count));
+    for (int i = 0; i < count; ++i) {
+        const glm::vec3 cell((i % side - side * 0.5f) * SKIN_CROWD_SPACING, 0.0f, (i / side - side * 0.5f) * SKIN_CROWD_SPACING);
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), center + cell);
+        transform = glm::rotate(transform, unit(rng) * 6.2831853f, glm::vec3(0.0f, 1.0f, 0.0f));
+        transform = glm::scale(transform, glm::vec3(scale));
+        addCrowdInstance(index, transform, unit(rng) * duration, 0.8f + 0.4f * unit(rng));
+    }
+}
+
+size_t SkinnedAnimation::crowdCount() const {
+    size_t count = 0;
+    for (const BakedClip& clip : baked) count += clip.transforms.size();
+    return count;
+}
+
+int SkinnedAnimation::parseArg(int argc, char** argv, int i) {
+    if (std::string(argv[i]) != "--crowd") return 0;
+    if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+        printf("--crowd needs a positive instance count\n");
+        return -1;
+    }
+    crowd_size = atoi(argv[i + 1]);
+    return 2;
+}
+
+void SkinnedAnimation::ensurePaletteRows(int rows) {
+    if (palette != 0 && rows <= palette_rows) return;
+    if (palette != 0) {
+        gpu_memory.releaseTexture(palette);
+        glDeleteTextures(1, &palette);
+    }
+    palette_rows = std::max(SKIN_PALETTE_INITIAL_ROWS, palette_rows);
+    while (palette_rows < rows) palette_rows *= 2;
+
+    // Fetched texel by texel, never filtered
+    glGenTextures(1, &palette);
+    gl_state.bindTexture(SKIN_PALETTE_UNIT, GL_TEXTURE_2D, palette);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 3 * SKIN_MAX_BONES, palette_rows, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gpu_memory.trackTexture(palette, textureLevelBytes(GL_RGBA32F, 3 * SKIN_MAX_BONES, palette_rows), GPU_MEMORY_INSTANCES, "bone palette");
+}
+
+void SkinnedAnimation::release() {
+    instances.clear();
+    draw_groups.clear();
+    fetching.clear();
+    for (BakedClip& clip : baked) {
+        gpu_memory.releaseTexture(clip.texture);
+        glDeleteTextures(1, &clip.texture);
+    }
+    baked.clear();
+    if (palette != 0) {
+        gpu_memory.releaseTexture(palette);
+        glDeleteTextures(1, &palette);
+        palette = 0;
+    }
+    palette_rows = 0;
+}
@@ -1,7 +1,12 @@
 #include "skybox.h"
 #include "camera.h"
 #include "filesystem.h"
+#include "profiler.h"
 #include "shader_loading.h"
+#include "frame_uniforms.h"
+#include "gpu_memory.h"
+#include "volumetric_fog.h"
+#include "mesh.h" // CullMode
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -11,24 +16,12 @@
 
 // Forward declarations for external functions
 extern GLuint loadCubemap(const char* faces[6]);
-extern const float SKYBOX_VERTICES[];
 std::string skybox_vertex_shader;
 std::string skybox_fragment_shader;
 
 void Skybox::bindSkybox(const char* faces[6]) {
     cubemap_texture.push_back(loadCubemap(faces));
-    
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(SKYBOX_VERTICES), &SKYBOX_VERTICES, GL_STATIC_DRAW);
-    
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    
-    glBindVertexArray(0);
+    if (VAO == 0) glGenVertexArrays(1, &VAO);
 }
 
 void Skybox::initShader() {
@@ -37,6 +30,10 @@ void Skybox::initShader() {
         std::string skybox_frag = loadShaderFile(buildAssetPath("res/shaders/skybox.fs"));
         
         skybox_shader = std::make_unique<Shader>(skybox_vert, skybox_frag);
+        bindFrameUniformBlocks(*skybox_shader);
+        skybox_shader->use();
+        skybox_shader->setInt("skybox", 0);
+        skybox_shader->setInt("volumetricFog", VOLUMETRIC_FOG_UNIT);
         printf("Skybox shaders created successfully. ID: %u\n", skybox_shader->getProgram());
     } catch (const std::exception& e) {
         printf("Failed to create skybox shaders: %s\n", e.what());
@@ -44,39 +41,27 @@ void Skybox::initShader() {
     }
 }
 
-void Skybox::render(Camera* camera) {
-    glDepthFunc(GL_LEQUAL);
-    glDepthMask(GL_FALSE);
-    glDisable(GL_CULL_FACE);
-    
-    skybox_shader->use();
-    
-    // Get view matrix and remove translation
-    glm::mat4 skybox_view = glm::mat4(glm::mat3(camera_get_view_matrix(camera)));
-    glm::mat4 skybox_projection = camera_get_projection(camera);
-    
-    skybox_shader->setMat4("view", skybox_view);
-    skybox_shader->setMat4("projection", skybox_projection);
-    
-    glBindVertexArray(VAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap_texture[0]);
-    skybox_shader->setInt("skybox", 0);
+void Skybox::render() {
+    PROFILE_SCOPE("skybox");
+    // At the far plane behind everything drawn, directions from the camera block's projection and
+    // view rotation in the shader
+    const PipelineState pipeline = PipelineState().depth(true, GL_LEQUAL).depthWrite(false).cull(CULL_NONE)
+                                       .withProgram(skybox_shader->getProgram()).withVertexArray(VAO);
+    gl_state.apply(pipeline);
+    gl_state.bindTexture(0, GL_TEXTURE_CUBE_MAP, cubemap_texture[0]);
     
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
     
-    glDepthFunc(GL_LESS);
-    glDepthMask(GL_TRUE);
-    glEnable(GL_CULL_FACE);
+    gl_state.apply(PipelineState());
 }
 
 void Skybox::cleanup() {
     if (VAO != 0) glDeleteVertexArrays(1, &VAO);
-    if (VBO != 0) glDeleteBuffers(1, &VBO);
     for (GLuint tex : cubemap_texture) {
-        if (tex != 0) glDeleteTextures(1, &tex);
+        if (tex == 0) continue;
+        gpu_memory.releaseTexture(tex);
+        glDeleteTextures(1, &tex);
     }
     cubemap_texture.clear();
-    VAO = VBO = 0;
+    VAO = 0;
 }
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "ssao.h"
+#include "shader_loading.h"
+#include "scene_target.h"
+#include <algorithm>
+#include <cstdio>
+#include <initializer_list>
+
+std::string buildAssetPath(const std::string& relative_path);
+
+bool use_ssao = true;
+bool use_ssao_temporal = true;
+float ssao_radius = 0.5f;
+float ssao_intensity = 1.0f;
+SsaoQuality ssao_quality = SSAO_QUALITY_MEDIUM;
+
+const char* const SSAO_QUALITY_NAMES[SSAO_QUALITY_COUNT] = { "Low", "Medium", "High" };
+
+// Directions and steps along each, both ways
+static const int SSAO_DIRECTIONS[SSAO_QUALITY_COUNT] = { 2, 4, 6 };
+static const int SSAO_STEPS[SSAO_QUALITY_COUNT] = { 3, 4, 6 };
+
+ScreenSpaceAO::~ScreenSpaceAO() {
+    release();
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+}
+
+void ScreenSpaceAO::release() {
+    for (GLuint* fbo : { &history_depth_fbo, &ao_fbos[0], &ao_fbos[1], &output_fbo }) {
+        if (*fbo != 0) { glDeleteFramebuffers(1, fbo); *fbo = 0; }
+    }
+    for (GLuint* texture : { &history_depth_texture, &ao_textures[0], &ao_textures[1], &output_texture }) {
+        if (*texture != 0) { glDeleteTextures(1, texture); *texture = 0; }
+    }
+    history_valid = false;
+}
+
+static GLuint createTarget(GLint internal_format, GLenum format, GLenum type, int width, int height, GLint filter) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+static GLuint createFramebuffer(GLenum attachment, GLuint texture) {
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+    return fbo;
+}
+
+bool ScreenSpaceAO::init(int new_width, int new_height) {
+    release();
+    width = new_width;
+    height = new_height;
+
+    if (!ao_shader) {
+        try {
+            const std::string fullscreen = loadShaderFile(buildAssetPath("res/shaders/hiz.vs"));
+            ao_shader = std::make_unique<Shader>(fullscreen, loadShaderFile(buildAssetPath("res/shaders/ssao.fs")));
+            upsample_shader = std::make_unique<Shader>(fullscreen, loadShaderFile(buildAssetPath("res/shaders/ssao_upsample.fs")));
+        } catch (const std::exception& e) {
+            printf("SSAO disabled: %s\n", e.what());
+            ao_shader.reset();
+            return false;
+        }
+        ao_shader->use();
+        ao_shader->setInt("depthMap", 0);
+        ao_shader->setInt("historyDepth", 1);
+        ao_shader->setInt("historyAO", 2);
+        upsample_shader->use();
+        upsample_shader->setInt("depthMap", 0);
+        upsample_shader->setInt("aoMap", 1);
+        glGenVertexArrays(1, &vao);
+    }
+
+    const int half_width = std::max(width / 2, 1);
+    const int half_height = std::max(height / 2, 1);
+    // Same format as the scene target's depth, which glBlitFramebuffer requires
+    history_depth_texture = createTarget(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, width, height, GL_NEAREST);
+    history_depth_fbo = createFramebuffer(GL_DEPTH_STENCIL_ATTACHMENT, history_depth_texture);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    for (int i = 0; i < 2; ++i) {
+        // Linear, the history is read at reprojected positions
+        ao_textures[i] = createTarget(GL_R8, GL_RED, GL_UNSIGNED_BYTE, half_width, half_height, GL_LINEAR);
+        ao_fbos[i] = createFramebuffer(GL_COLOR_ATTACHMENT0, ao_textures[i]);
+        complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    }
+    output_texture = createTarget(GL_R8, GL_RED, GL_UNSIGNED_BYTE, width, height, GL_NEAREST);
+    output_fbo = createFramebuffer(GL_COLOR_ATTACHMENT0, output_texture);
+    complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    if (!complete) {
+        printf("SSAO framebuffers incomplete, ambient occlusion off\n");
+        release();
+        return false;
+    }
+
+    printf("SSAO targets: %dx%d, upsampled to %dx%d\n", half_width, half_height, width, height);
+    return true;
+}
+
+bool ScreenSpaceAO::compute(const glm::mat4& view, const glm::mat4& projection) {
+    if (failed) return false;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != width || viewport[3] != height || output_fbo == 0) {
+        if (!init(viewport[2], viewport[3])) {
+            failed = true;
+            return false;
+        }
+    }
+
+    const int previous = current;
+    current = 1 - current;
+    frame++;
+
+    const GLuint depth_texture = scene_target.depthTexture();
+
+    bool depth_test = gl_state.isEnabled(GL_DEPTH_TEST);
+    bool cull_face = gl_state.isEnabled(GL_CULL_FACE);
+    bool blend = gl_state.isEnabled(GL_BLEND);
+    gl_state.disable(GL_DEPTH_TEST);
+    gl_state.disable(GL_CULL_FACE);
+    gl_state.disable(GL_BLEND);
+    gl_state.colorMask(true);
+    gl_state.bindVertexArray(vao);
+
+    // Half resolution, each pixel from the full-resolution depth texel at twice its coordinate
+    const bool temporal = use_ssao_temporal && history_valid;
+    glBindFramebuffer(GL_FRAMEBUFFER, ao_fbos[current]);
+    glViewport(0, 0, std::max(width / 2, 1), std::max(height / 2, 1));
+    ao_shader->use();
+    ao_shader->setMat4("projection", projection);
+    ao_shader->setMat4("inverseProjection", glm::inverse(projection));
+    ao_shader->setMat4("reprojection", history_view_projection * glm::inverse(view));
+    ao_shader->setFloat("radius", ssao_radius);
+    ao_shader->setFloat("intensity", ssao_intensity);
+    ao_shader->setInt("directions", SSAO_DIRECTIONS[ssao_quality]);
+    ao_shader->setInt("steps", SSAO_STEPS[ssao_quality]);
+    // Without the history a still pattern, a rotating one would only flicker
+    ao_shader->setInt("frameIndex", use_ssao_temporal ? (int)(frame & 63u) : 0);
+    ao_shader->setFloat("historyWeight", temporal ? SSAO_HISTORY_WEIGHT : 0.0f);
+    ao_shader->setFloat("historyTolerance", SSAO_HISTORY_DEPTH_TOLERANCE);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, depth_texture);
+    gl_state.bindTexture(1, GL_TEXTURE_2D, history_depth_texture);
+    gl_state.bindTexture(2, GL_TEXTURE_2D, ao_textures[previous]);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, output_fbo);
+    glViewport(0, 0, width, height);
+    upsample_shader->use();
+    upsample_shader->setMat4("projection", projection);
+    gl_state.bindTexture(1, GL_TEXTURE_2D, ao_textures[current]);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // Next frame's history test compares against this depth
+    if (use_ssao_temporal) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_target.depthFramebuffer());
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, history_depth_fbo);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    gl_state.setEnabled(GL_DEPTH_TEST, depth_test);
+    gl_state.setEnabled(GL_CULL_FACE, cull_face);
+    gl_state.setEnabled(GL_BLEND, blend);
+
+    history_view_projection = projection * view;
+    history_valid = use_ssao_temporal;
+    return true;
+}
+
+void ScreenSpaceAO::bind(int unit) const {
+    gl_state.bindTexture(unit, GL_TEXTURE_2D, output_texture);
+}
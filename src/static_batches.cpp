@@ -0,0 +1,344 @@
+#include "static_batches.h"
+#include "entity_manager.h"
+#include "mesh.h"
+#include "impostor.h"
+#include "frustum.h"
+#include "hiz.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "hlod.h"
+#include <cstdio>
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <algorithm>
+
+bool use_static_batching = true;
+
+StaticBatches::~StaticBatches() {
+    clear();
+}
+
+void StaticBatches::clear() {
+    for (Source& source : sources) {
+        if (source.vao != 0) glDeleteVertexArrays(1, &source.vao);
+        for (GLuint buffer : { source.instance_vbo, source.fade_vbo }) {
+            if (buffer != 0) glDeleteBuffers(1, &buffer);
+        }
+    }
+    if (indirect_buffer != 0) glDeleteBuffers(1, &indirect_buffer);
+    indirect_buffer = 0;
+
+    chunks.clear();
+    sources.clear();
+    source_index.clear();
+    retained.clear();
+    commands.clear();
+    entity_count = 0;
+    built = false;
+}
+
+uint32_t StaticBatches::sourceFor(const std::shared_ptr<Mesh>& mesh) {
+    GLuint vbo = mesh->arena ? mesh->arena->vbo : mesh->VBO;
+    auto it = source_index.find(vbo);
+    if (it != source_index.end()) return it->second;
+
+    Source source;
+    source.vertex_format = mesh->vertex_layout.format;
+    if (mesh->arena) {
+        source.arena = mesh->arena;
+    } else {
+        source.mesh = mesh;
+    }
+    sources.push_back(std::move(source));
+    source_index[vbo] = (uint32_t)sources.size() - 1;
+    return (uint32_t)sources.size() - 1;
+}
+
+// Binds the source's VAO, re-pointing it first if its arena grew into new buffers since
+void StaticBatches::bindSource(Source& source) {
+    GLuint vbo = source.arena ? source.arena->vbo : source.mesh->VBO;
+    GLuint ebo = source.arena ? source.arena->ebo : source.mesh->EBO;
+    gl_state.bindVertexArray(source.vao);
+    if (vbo == source.vbo && ebo == source.ebo) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    setupVertexAttributes(getVertexLayout(source.vertex_format));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    source.vbo = vbo;
+    source.ebo = ebo;
+}
+
+void StaticBatches::update(EntityManager& entity_manager) {
+    if (built && built_layout_version == entity_manager.layoutVersion() &&
+        built_static_version == entity_manager.staticVersion() && built_hlod == use_hlod) return;
+
+    clear();
+    built = true;
+    built_hlod = use_hlod;
+    built_layout_version = entity_manager.layoutVersion();
+    built_static_version = entity_manager.staticVersion();
+
+    // Members share a cell and a LOD layout, so one threshold table fits the whole chunk
+    std::map<std::tuple<int, int, int, uint32_t, int>, size_t> chunk_of;
+    std::vector<std::vector<size_t>> members;
+    EntitySpan<glm::vec4> spheres = entity_manager.worldSpheres();
+    for (uint32_t i : entity_manager.query(ENTITY_COMPONENT_RENDERABLE | ENTITY_COMPONENT_STATIC)) {
+        Entity* entity = entity_manager.getEntityAt(i);
+        if (!entity) continue;
+
+        // Entities sharing a render prototype draw the same levels
+        glm::ivec3 cell = glm::ivec3(glm::floor(glm::vec3(spheres[i]) / STATIC_CHUNK_SIZE));
+        auto key = std::make_tuple(cell.x, cell.y, cell.z, entity->prototype, entity->shadow_proxy_lod);
+
+        auto [it, inserted] = chunk_of.emplace(key, chunks.size());
+        if (inserted) {
+            Chunk chunk;
+            chunk.bmin = entity_manager.worldMins()[i];
+            chunk.bmax = entity_manager.worldMaxs()[i];
+            for (size_t l = 0; l < entity->lodLevels().size(); ++l) chunk.min_screen_sizes.push_back(entity->lodMinScreenSize(l));
+            chunk.levels.resize(entity->lodLevels().size());
+            chunk.shadow_proxy_lod = entity->shadow_proxy_lod;
+            chunks.push_back(std::move(chunk));
+            members.emplace_back();
+        }
+        Chunk& chunk = chunks[it->second];
+        chunk.bmin = glm::min(chunk.bmin, entity_manager.worldMins()[i]);
+        chunk.bmax = glm::max(chunk.bmax, entity_manager.worldMaxs()[i]);
+        chunk.lod_radius = std::max(chunk.lod_radius, spheres[i].w);
+        chunk.entity_count++;
+        members[it->second].push_back(i);
+        entity_count++;
+    }
+
+    // Sorted into runs, with its slice of the indirect commands
+    auto finishLevel = [&](Level& level) {
+        std::sort(level.draws.begin(), level.draws.end(), [](const Draw& a, const Draw& b) {
+            return std::make_tuple(a.material, a.cull_mode, a.source, a.mesh->index_type) <
+                   std::make_tuple(b.material, b.cull_mode, b.source, b.mesh->index_type);
+        });
+
+        level.first_command = commands.size();
+        for (const Draw& draw : level.draws) {
+            DrawElementsIndirectCommand command;
+            command.count = draw.mesh->INDEX_COUNT;
+            command.instanceCount = draw.instance_count;
+            command.firstIndex = (GLuint)(draw.mesh->geometry.indices.offset / getIndexSize(draw.mesh->index_type));
+            command.baseVertex = (GLint)draw.mesh->geometry.vertices.offset;
+            command.baseInstance = draw.first_instance;
+            commands.push_back(command);
+        }
+    };
+
+    // Every level's instances, grouped per mesh within the chunk
+    int proxied = 0;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        Chunk& chunk = chunks[c];
+        std::vector<HlodPart> coarsest;
+        for (size_t l = 0; l < chunk.levels.size(); ++l) {
+            Level& level = chunk.levels[l];
+            std::map<Mesh*, std::pair<std::shared_ptr<Mesh>, std::vector<glm::mat4>>> batches;
+            for (size_t i : members[c]) {
+                const Entity::LODLevel& source = entity_manager.getEntityAt(i)->lodLevels()[l];
+                const glm::mat4& model = entity_manager.worldMatrices()[i];
+                if (source.impostor) level.impostors[source.impostor.get()].push_back(model);
+                for (const auto& mesh : source.meshes) {
+                    if (!mesh || !mesh->isValid()) continue;
+                    auto& batch = batches[mesh.get()];
+                    batch.first = mesh;
+                    batch.second.push_back(model);
+                }
+            }
+
+            for (auto& [mesh, batch] : batches) {
+                Draw draw;
+                draw.mesh = mesh;
+                draw.material = &mesh->material;
+                draw.cull_mode = mesh->cull_mode;
+                draw.source = sourceFor(batch.first);
+                Source& target = sources[draw.source];
+                draw.first_instance = (uint32_t)target.matrices.size();
+                draw.instance_count = (uint32_t)batch.second.size();
+                target.matrices.insert(target.matrices.end(), batch.second.begin(), batch.second.end());
+                level.draws.push_back(draw);
+                level.triangles += (int)(mesh->TRIANGLE_COUNT * draw.instance_count);
+                level.instances += (int)draw.instance_count;
+                if (l + 1 == chunk.levels.size()) coarsest.push_back({ batch.first, batch.second });
+                retained.push_back(std::move(batch.first));
+            }
+            for (const auto& [impostor, matrices] : level.impostors) level.instances += (int)matrices.size();
+            finishLevel(level);
+        }
+
+        // Proxy levels after the members' coarsest, unless that is already an impostor tier or
+        // gives way later than the first proxy would take over
+        const size_t last = chunk.levels.size() - 1;
+        const float threshold = std::max(chunk.min_screen_sizes[last], HLOD_SCREEN_PIXELS);
+        if (!use_hlod || chunk.entity_count < HLOD_MIN_MEMBERS || !chunk.levels[last].impostors.empty() || coarsest.empty() ||
+            (last > 0 && threshold >= chunk.min_screen_sizes[last - 1])) {
+            continue;
+        }
+        const std::vector<std::vector<HlodProxy>> proxies = buildHlodLevels(coarsest);
+        if (proxies.empty()) continue;
+        chunk.min_screen_sizes[last] = threshold;
+        float screen_size = threshold;
+        for (size_t h = 0; h < proxies.size(); ++h) {
+            screen_size *= HLOD_LEVEL_SCREEN_STEP;
+            chunk.min_screen_sizes.push_back(h + 1 < proxies.size() ? screen_size : 0.0f);
+            Level level;
+            for (const HlodProxy& proxy : proxies[h]) {
+                Draw draw;
+                draw.mesh = proxy.mesh.get();
+                draw.material = &proxy.source->material; // Runs with the members' draws of it
+                draw.cull_mode = proxy.source->cull_mode;
+                draw.source = sourceFor(proxy.mesh);
+                Source& target = sources[draw.source];
+                draw.first_instance = (uint32_t)target.matrices.size();
+                draw.instance_count = 1;
+                target.matrices.push_back(glm::mat4(1.0f));
+                level.draws.push_back(draw);
+                level.triangles += (int)proxy.mesh->TRIANGLE_COUNT;
+                level.instances++;
+                retained.push_back(proxy.mesh);
+            }
+            finishLevel(level);
+            chunk.levels.push_back(std::move(level));
+        }
+        proxied++;
+    }
+
+    // Uploaded once, nothing here changes until the next bake
+    for (Source& source : sources) {
+        glGenVertexArrays(1, &source.vao);
+        source.vbo = source.ebo = 0;
+        bindSource(source);
+
+        std::vector<float> no_fade(source.matrices.size(), 0.0f);
+        std::vector<InstanceTransform> transforms(source.matrices.size());
+        for (size_t i = 0; i < transforms.size(); ++i) transforms[i] = packInstanceTransform(source.matrices[i]);
+        glGenBuffers(1, &source.instance_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, source.instance_vbo);
+        glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(InstanceTransform), transforms.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &source.fade_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, source.fade_vbo);
+        glBufferData(GL_ARRAY_BUFFER, no_fade.size() * sizeof(float), no_fade.data(), GL_STATIC_DRAW);
+        pointInstanceAttributes(source.instance_vbo, source.fade_vbo, 0);
+
+        gl_state.bindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        source.matrices = std::vector<glm::mat4>();
+    }
+
+    if (gl_extensions.multi_draw_indirect && !commands.empty()) {
+        glGenBuffers(1, &indirect_buffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    if (entity_count > 0) {
+        printf("Static batches: %d entities in %zu chunks (%d with HLOD proxies), %zu draws over %zu vertex sources\n", entity_count,
+               chunks.size(), proxied, commands.size(), sources.size());
+    }
+}
+
+// Same rules as Entity::selectLOD() and Entity::selectShadowLOD()
+void StaticBatches::selectLODs(const glm::vec3& camera_position, float projection_scale, float shadow_projection_scale, float hysteresis) {
+    for (Chunk& chunk : chunks) {
+        int last = (int)chunk.levels.size() - 1;
+        if (last < 1) continue;
+
+        glm::vec3 nearest = glm::clamp(camera_position, chunk.bmin, chunk.bmax);
+        float distance = glm::length(camera_position - nearest);
+        auto pick = [&](float screen_size, int current) {
+            int target = last;
+            for (int i = 0; i < last; ++i) {
+                if (screen_size >= chunk.min_screen_sizes[i]) { target = i; break; }
+            }
+            current = std::min(current, last);
+            if (target > current && screen_size >= chunk.min_screen_sizes[current] * (1.0f - hysteresis)) {
+                target = current;
+            } else {
+                while (target < current && screen_size < chunk.min_screen_sizes[target] * (1.0f + hysteresis)) ++target;
+            }
+            return target;
+        };
+        chunk.current_lod = pick(lodScreenSize(chunk.lod_radius, distance, projection_scale), chunk.current_lod);
+
+        int shadow = pick(lodScreenSize(chunk.lod_radius, distance, shadow_projection_scale), chunk.shadow_lod);
+        shadow = std::min(std::max(shadow, std::max(chunk.current_lod, chunk.shadow_proxy_lod)), last);
+        while (shadow > 0 && chunk.levels[shadow].draws.empty()) --shadow; // Impostor tier
+        chunk.shadow_lod = shadow;
+    }
+}
+
+void StaticBatches::cull(const Frustum& frustum, const HiZBuffer* occlusion) {
+    for (Chunk& chunk : chunks) {
+        chunk.visible = frustum.aabbInFrustum(chunk.bmin, chunk.bmax);
+        if (chunk.visible && occlusion) {
+            glm::vec3 center = (chunk.bmin + chunk.bmax) * 0.5f;
+            chunk.visible = !occlusion->isOccluded(center, glm::length(chunk.bmax - chunk.bmin) * 0.5f);
+        }
+    }
+}
+
+int StaticBatches::submit(const std::function<void(const Draw&)>& apply_state, const Frustum* frustum) {
+    const bool multi_draw = use_multi_draw_indirect && gl_extensions.multi_draw_indirect && indirect_buffer != 0;
+    if (multi_draw) glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+
+    int calls = 0;
+    const Draw* last = nullptr;
+    uint32_t bound_source = UINT32_MAX;
+    for (const Chunk& chunk : chunks) {
+        if (frustum ? !frustum->aabbInFrustum(chunk.bmin, chunk.bmax) : !chunk.visible) continue;
+        const int lod = frustum ? chunk.shadow_lod : chunk.current_lod;
+        const Level& level = chunk.levels[std::min<size_t>(lod, chunk.levels.size() - 1)];
+
+        for (size_t first = 0; first < level.draws.size();) {
+            const Draw& head = level.draws[first];
+            if (!last || head.material != last->material || head.cull_mode != last->cull_mode) apply_state(head);
+            last = &head;
+
+            size_t end = first + 1;
+            while (end < level.draws.size() && level.draws[end].material == head.material &&
+                   level.draws[end].cull_mode == head.cull_mode && level.draws[end].source == head.source &&
+                   level.draws[end].mesh->index_type == head.mesh->index_type) {
+                end++;
+            }
+
+            Source& source = sources[head.source];
+            if (head.source != bound_source) {
+                bindSource(source);
+                bound_source = head.source;
+            }
+
+            if (multi_draw) {
+                gl_extensions.MultiDrawElementsIndirect(GL_TRIANGLES, head.mesh->index_type,
+                                                        (const void*)((level.first_command + first) * sizeof(DrawElementsIndirectCommand)),
+                                                        (GLsizei)(end - first), 0);
+                calls++;
+            } else {
+                for (size_t i = first; i < end; ++i) {
+                    const Draw& draw = level.draws[i];
+                    const Mesh* mesh = draw.mesh;
+                    if (gl_extensions.base_instance) {
+                        gl_extensions.DrawElementsInstancedBaseVertexBaseInstance(
+                            GL_TRIANGLES, mesh->INDEX_COUNT, mesh->index_type, (const void*)(uintptr_t)mesh->geometry.indices.offset,
+                            draw.instance_count, (GLint)mesh->geometry.vertices.offset, draw.first_instance);
+                    } else {
+                        // Our own VAO, nobody else expects these at zero
+                        pointInstanceAttributes(source.instance_vbo, source.fade_vbo, draw.first_instance);
+                        drawMeshElements(*mesh, draw.instance_count);
+                    }
+                    calls++;
+                }
+            }
+            first = end;
+        }
+    }
+
+    gl_state.bindVertexArray(0);
+    if (multi_draw) glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return calls;
+}
@@ -0,0 +1,184 @@
+#include "stress_scene.h"
+#include "impostor.h"
+#include "mesh.h"
+#include "mesh_loader.h"
+#include "material_registry.h"
+#include "job_system.h"
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <tuple>
+
+const int STRESS_SCENE_PRESET_INSTANCES[STRESS_SCENE_PRESET_COUNT] = { 1000, 10000, 100000, 1000000 };
+
+StressScene stress_scene;
+
+int StressScene::parseArg(int argc, char** argv, int i) {
+    const std::string arg = argv[i];
+    if (arg.compare(0, 8, "--stress") != 0) return 0;
+    if (i + 1 >= argc) {
+        printf("%s needs a value\n", arg.c_str());
+        return -1;
+    }
+    const char* value = argv[i + 1];
+    if (arg == "--stress") {
+        settings.instances = atoi(value);
+        from_command_line = true;
+        if (settings.instances <= 0) {
+            printf("--stress needs a positive instance count\n");
+            return -1;
+        }
+    } else if (arg == "--stress-spacing") {
+        settings.spacing = std::max(0.1f, (float)atof(value));
+    } else if (arg == "--stress-lod-mix") {
+        settings.lod_mix = std::clamp((float)atof(value), 0.0f, 1.0f);
+    } else if (arg == "--stress-variants") {
+        settings.material_variants = std::clamp(atoi(value), 1, STRESS_SCENE_MAX_VARIANTS);
+    } else if (arg == "--stress-lights") {
+        settings.lights = std::clamp(atoi(value), 0, MAX_LIGHTS);
+    } else if (arg == "--stress-dynamic") {
+        settings.dynamic_fraction = std::clamp((float)atof(value), 0.0f, 1.0f);
+    } else if (arg == "--stress-seed") {
+        settings.seed = (uint32_t)strtoul(value, nullptr, 10);
+    } else {
+        return 0;
+    }
+    return 2;
+}
+
+static bool isStressEntity(const Entity& entity) {
+    return entity.name.compare(0, 7, "stress_") == 0;
+}
+
+void StressScene::clear() {
+    entity_manager.removeEntities(isStressEntity);
+    movers.clear();
+    mover_handles.clear();
+    entity_count = 0;
+    // Dark and out of the way until a scene needs them again
+    for (LightHandle handle : light_handles) {
+        updateLight(handle, glm::vec3(0.0f, -1000.0f, 0.0f), glm::vec3(NAN), 0, glm::vec3(NAN));
+    }
+    active_lights = 0;
+}
+
+// Same textures, so only the uniforms differ: a hue step and a roughness step per variant
+static Material tintedMaterial(const Material& source, int variant) {
+    Material material = source;
+    const float hue = std::fmod(variant * 0.618034f, 1.0f);
+    const glm::vec3 tint = glm::clamp(glm::abs(glm::mod(hue * 6.0f + glm::vec3(0.0f, 4.0f, 2.0f), 6.0f) - 3.0f) - 1.0f, 0.0f, 1.0f);
+    material.base_color *= glm::mix(glm::vec3(1.0f), tint, 0.5f);
+    material.roughness = std::clamp(source.roughness + ((variant % 3) - 1) * 0.2f, 0.05f, 1.0f);
+    material.name = source.name + "_variant" + std::to_string(variant);
+    return material;
+}
+
+void StressScene::generate() {
+    clear();
+    if (models.empty() || settings.instances <= 0) return;
+    const auto start = std::chrono::steady_clock::now();
+
+    std::mt19937 rng(settings.seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    // Each model's LOD specs per material variant, variant 0 being the model's own meshes
+    const int variant_count = std::clamp(settings.material_variants, 1, STRESS_SCENE_MAX_VARIANTS);
+    std::vector<std::vector<std::vector<std::pair<float, std::vector<std::shared_ptr<Mesh>>>>>> variants(models.size());
+    for (size_t m = 0; m < models.size(); ++m) {
+        variants[m].push_back(models[m].lod_specs);
+        for (int v = 1; v < variant_count; ++v) {
+            auto specs = models[m].lod_specs;
+            for (auto& [distance, meshes] : specs) {
+                for (auto& mesh : meshes) {
+                    if (mesh) mesh = material_registry.withMaterial(mesh, material_registry.intern(tintedMaterial(mesh->material, v)));
+                }
+            }
+            variants[m].push_back(std::move(specs));
+        }
+    }
+
+    // One template per model, variant, LOD chain or not, and static or not
+    using TemplateKey = std::tuple<size_t, int, bool, bool>;
+    std::map<TemplateKey, std::vector<EntityTransform>> groups;
+    const int side = (int)std::ceil(std::sqrt((double)settings.instances));
+    const float extent = side * settings.spacing;
+    const glm::vec3 origin(-0.5f * extent, 0.0f, -0.5f * extent);
+    for (int i = 0; i < settings.instances; ++i) {
+        // One instance per grid cell, jittered inside it
+        EntityTransform transform;
+        transform.position = origin + glm::vec3(((i % side) + unit(rng)) * settings.spacing, 0.0f,
+                                                ((i / side) + unit(rng)) * settings.spacing);
+        transform.rotation.y = unit(rng) * 360.0f;
+        transform.scale = glm::vec3(0.8f + 0.4f * unit(rng));
+        const size_t model = std::min((size_t)(unit(rng) * models.size()), models.size() - 1);
+        const int variant = std::min((int)(unit(rng) * variant_count), variant_count - 1);
+        const bool lod_chain = unit(rng) < settings.lod_mix;
+        const bool dynamic = unit(rng) < settings.dynamic_fraction;
+        groups[{ model, variant, lod_chain, dynamic }].push_back(transform);
+    }
+
+    for (const auto& [key, transforms] : groups) {
+        const auto& [model_index, variant, lod_chain, dynamic] = key;
+        const StressModel& model = models[model_index];
+        EntityTemplate entity_template;
+        entity_template.name = "stress_" + model.name;
+        entity_template.lod_specs = variants[model_index][variant];
+        if (!lod_chain) entity_template.lod_specs.resize(1);
+        entity_template.cull_modes = model.cull_modes;
+        entity_template.impostor = lod_chain ? model.impostor : nullptr;
+        entity_template.shadow_proxy_lod = lod_chain ? model.shadow_proxy_lod : -1;
+        entity_template.is_static = !dynamic;
+        std::vector<EntityHandle> handles = createEntities(entity_template, transforms);
+        entity_count += handles.size();
+        if (!dynamic) continue;
+        for (size_t i = 0; i < handles.size(); ++i) movers.push_back({ handles[i], transforms[i], unit(rng) * glm::two_pi<float>() });
+    }
+
+    // Lights a few units up, anywhere over the field
+    const size_t light_count = (size_t)std::clamp(settings.lights, 0, MAX_LIGHTS);
+    for (size_t i = 0; i < light_count; ++i) {
+        const glm::vec3 position = origin + glm::vec3(unit(rng) * extent, 3.0f + 5.0f * unit(rng), unit(rng) * extent);
+        const glm::vec3 color = glm::mix(glm::vec3(1.0f), glm::vec3(unit(rng), unit(rng), unit(rng)), 0.5f);
+        const int intensity = 50 + (int)(100.0f * unit(rng));
+        if (i < light_handles.size()) {
+            updateLight(light_handles[i], position, color, intensity, glm::vec3(NAN));
+            continue;
+        }
+        LightHandle handle = createPointLight("stress_light", {}, position, color, intensity, glm::vec3(1.0f), {});
+        if (handle.isNull()) break;
+        light_handles.push_back(handle);
+    }
+    active_lights = std::min(light_count, light_handles.size());
+
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Stress scene: %zu entities (%zu dynamic) in %zu templates, %zu lights, %.1f x %.1f units, %.0f ms\n",
+           entity_count, movers.size(), groups.size(), active_lights, extent, extent, ms);
+}
+
+void StressScene::update(float frame_time) {
+    if (movers.empty()) return;
+    time += frame_time;
+    if (mover_handles.size() != movers.size()) {
+        mover_handles.clear();
+        for (const Mover& mover : movers) mover_handles.push_back(mover.handle);
+        mover_transforms.resize(movers.size());
+    }
+    // Each range writes its own movers, scale never changes
+    job_system.parallelFor(movers.size(), STRESS_SCENE_MOVER_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const Mover& mover = movers[i];
+            EntityTransform& transform = mover_transforms[i];
+            transform.position = mover.base.position;
+            transform.position.y += 0.5f * std::sin(time * 2.0f + mover.phase);
+            transform.rotation = mover.base.rotation;
+            transform.rotation.y += time * 45.0f;
+        }
+        entity_manager.setTransforms(mover_handles.data() + begin, mover_transforms.data() + begin, end - begin,
+                                     TRANSFORM_POSITION | TRANSFORM_ROTATION);
+    });
+}
@@ -0,0 +1,260 @@
+#include "telemetry.h"
+#include "frame_stats.h"
+#include "profiler.h"
+#include "gpu_memory.h"
+#include "load_stats.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define TELEMETRY_SERVER
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+Telemetry telemetry;
+
+namespace {
+
+// Appends printf-style, the snapshot is a few KB at most
+void appendf(std::string& out, const char* format, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length > 0) out.append(buffer, std::min((size_t)length, sizeof(buffer) - 1));
+}
+
+} // namespace
+
+int Telemetry::parseArg(int argc, char** argv, int i) {
+    const std::string arg = argv[i];
+    if (arg != "--telemetry" && arg != "--telemetry-port" && arg != "--telemetry-interval") return 0;
+    if (i + 1 >= argc) {
+        printf("%s needs 1 argument\n", arg.c_str());
+        return -1;
+    }
+    if (arg == "--telemetry") {
+        file_path = argv[i + 1];
+    } else if (arg == "--telemetry-port") {
+        port = atoi(argv[i + 1]);
+        if (port <= 0 || port > 65535) {
+            printf("--telemetry-port needs a port from 1 to 65535\n");
+            return -1;
+        }
+    } else {
+        interval_s = atof(argv[i + 1]);
+        if (interval_s <= 0.0) {
+            printf("--telemetry-interval needs a positive number of seconds\n");
+            return -1;
+        }
+    }
+    return 2;
+}
+
+void Telemetry::init() {
+    if (!requested() || initialized) return;
+    initialized = true;
+
+    profiler.addFrameCallback([this](const FrameProfiler::Frame& frame) {
+        scope_gpu_ms.clear();
+        for (const FrameProfiler::Scope& scope : frame.scopes) {
+            if (scope.gpu_ms < 0.0) continue;
+            auto it = std::find_if(scope_gpu_ms.begin(), scope_gpu_ms.end(),
+                                   [&scope](const auto& entry) { return entry.first == scope.name; });
+            if (it == scope_gpu_ms.end()) scope_gpu_ms.push_back({ scope.name, scope.gpu_ms });
+            else it->second += scope.gpu_ms;
+        }
+    });
+
+    if (!file_path.empty()) {
+        out.open(file_path, std::ios::app);
+        if (!out) printf("Could not open telemetry file %s\n", file_path.c_str());
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(file_path, ec);
+        file_bytes = ec ? 0 : (uint64_t)size;
+    }
+    if (port != 0 && !startServer()) port = 0;
+    next_snapshot = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval_s));
+    printf("Telemetry every %.1f s%s%s%s\n", interval_s, out.is_open() ? " to " : "", out.is_open() ? file_path.c_str() : "",
+           port != 0 ? ", served over HTTP" : "");
+}
+
+void Telemetry::update(const Renderer::RenderStats& stats) {
+    if (!initialized) return;
+    const Clock::time_point now = Clock::now();
+    if (now < next_snapshot) return;
+    next_snapshot = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval_s));
+    snapshot(stats);
+}
+
+void Telemetry::shutdown(const Renderer::RenderStats& stats) {
+    if (!initialized) return;
+    snapshot(stats);
+    initialized = false;
+    out.close();
+#ifdef TELEMETRY_SERVER
+    if (server.joinable()) {
+        stopping = true;
+        server.join();
+    }
+    if (listen_socket >= 0) close(listen_socket);
+    listen_socket = -1;
+#endif
+}
+
+void Telemetry::snapshot(const Renderer::RenderStats& stats) {
+    snapshots++;
+    const double unix_time = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string json, text;
+    appendf(json, "{\"time\": %.3f, \"frame_ms\": {", unix_time);
+
+    const std::pair<const char*, const FrameTimeSeries*> series[] = {
+        { "wall", &frame_stats.wall }, { "cpu", &frame_stats.cpu }, { "gpu", &frame_stats.gpu } };
+    for (size_t i = 0; i < 3; ++i) {
+        const FrameTimeSeries::Summary summary = series[i].second->summarize(frame_hitch_threshold_ms);
+        const char* name = series[i].first;
+        appendf(json, "%s\"%s\": {\"samples\": %zu, \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f, "
+                      "\"hitches\": %llu}", i > 0 ? ", " : "", name, summary.samples, summary.mean, summary.p50, summary.p95,
+                summary.p99, summary.max, (unsigned long long)series[i].second->hitchesTotal());
+        appendf(text, "engine_frame_ms{series=\"%s\",quantile=\"0.5\"} %.3f\n", name, summary.p50);
+        appendf(text, "engine_frame_ms{series=\"%s\",quantile=\"0.95\"} %.3f\n", name, summary.p95);
+        appendf(text, "engine_frame_ms{series=\"%s\",quantile=\"0.99\"} %.3f\n", name, summary.p99);
+        appendf(text, "engine_frame_ms_mean{series=\"%s\"} %.3f\n", name, summary.mean);
+        appendf(text, "engine_frame_ms_max{series=\"%s\"} %.3f\n", name, summary.max);
+        appendf(text, "engine_frame_hitches_total{series=\"%s\"} %llu\n", name, (unsigned long long)series[i].second->hitchesTotal());
+    }
+
+    json += "}, \"render\": {";
+    for (size_t i = 0; i < RENDER_STATS_COUNTER_COUNT; ++i) {
+        const double value = RENDER_STATS_COUNTERS[i].read(stats);
+        appendf(json, "%s\"%s\": %.0f", i > 0 ? ", " : "", RENDER_STATS_COUNTERS[i].name, value);
+        appendf(text, "engine_render_counter{name=\"%s\"} %.0f\n", RENDER_STATS_COUNTERS[i].name, value);
+    }
+
+    json += "}, \"gpu_ms\": {";
+    for (size_t i = 0; i < scope_gpu_ms.size(); ++i) {
+        appendf(json, "%s\"%s\": %.3f", i > 0 ? ", " : "", scope_gpu_ms[i].first, scope_gpu_ms[i].second);
+        appendf(text, "engine_gpu_scope_ms{scope=\"%s\"} %.3f\n", scope_gpu_ms[i].first, scope_gpu_ms[i].second);
+    }
+
+    appendf(json, "}, \"gpu_memory\": {\"total\": %llu, \"peak\": %llu", (unsigned long long)gpu_memory.total(),
+            (unsigned long long)gpu_memory.peak());
+    appendf(text, "engine_gpu_memory_bytes %llu\nengine_gpu_memory_peak_bytes %llu\n", (unsigned long long)gpu_memory.total(),
+            (unsigned long long)gpu_memory.peak());
+    for (int category = 0; category < GPU_MEMORY_CATEGORY_COUNT; ++category) {
+        const unsigned long long bytes = gpu_memory.categoryBytes((GpuMemoryCategory)category);
+        appendf(json, ", \"%s\": %llu", GPU_MEMORY_CATEGORY_NAMES[category], bytes);
+        appendf(text, "engine_gpu_memory_category_bytes{category=\"%s\"} %llu\n", GPU_MEMORY_CATEGORY_NAMES[category], bytes);
+    }
+
+    size_t asset_count = 0;
+    const LoadStats::AssetTimes load = load_stats.totals(&asset_count);
+    appendf(json, "}, \"load\": {\"assets\": %zu, \"total_ms\": %.1f, \"bytes_read\": %llu, \"bytes_uploaded\": %llu", asset_count,
+            load.total_ms, (unsigned long long)load.bytes_read, (unsigned long long)load.bytes_uploaded);
+    appendf(text, "engine_load_assets %zu\nengine_load_bytes_read_total %llu\nengine_load_bytes_uploaded_total %llu\n", asset_count,
+            (unsigned long long)load.bytes_read, (unsigned long long)load.bytes_uploaded);
+    for (int stage = 0; stage < LOAD_STAGE_COUNT; ++stage) {
+        appendf(json, ", \"%s_ms\": %.1f", LOAD_STAGE_NAMES[stage], load.ms[stage]);
+        appendf(text, "engine_load_ms_total{stage=\"%s\"} %.1f\n", LOAD_STAGE_NAMES[stage], load.ms[stage]);
+    }
+    json += "}}\n";
+
+    if (out.is_open()) appendLine(json);
+    if (port != 0) {
+        std::lock_guard<std::mutex> lock(text_mutex);
+        prometheus_text = std::move(text);
+    }
+}
+
+void Telemetry::appendLine(const std::string& line) {
+    if (file_bytes + line.size() > TELEMETRY_MAX_FILE_BYTES && file_bytes > 0) {
+        // <file>.2 to .3 and so on, the oldest falls off the end
+        out.close();
+        std::error_code ec;
+        for (int i = TELEMETRY_ROTATED_FILES - 1; i >= 1; --i) {
+            std::filesystem::rename(file_path + "." + std::to_string(i), file_path + "." + std::to_string(i + 1), ec);
+        }
+        std::filesystem::rename(file_path, file_path + ".1", ec);
+        out.open(file_path, std::ios::trunc);
+        file_bytes = 0;
+        if (!out) {
+            printf("Could not reopen telemetry file %s\n", file_path.c_str());
+            return;
+        }
+    }
+    out << line;
+    out.flush(); // A crash keeps everything up to the last snapshot
+    file_bytes += line.size();
+}
+
+bool Telemetry::startServer() {
+#ifdef TELEMETRY_SERVER
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_socket < 0) return false;
+    const int reuse = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t)port);
+    if (bind(listen_socket, (sockaddr*)&address, sizeof(address)) != 0 || listen(listen_socket, 4) != 0) {
+        printf("Telemetry could not listen on port %d: %s\n", port, strerror(errno));
+        close(listen_socket);
+        listen_socket = -1;
+        return false;
+    }
+    stopping = false;
+    server = std::thread(&Telemetry::serve, this);
+    printf("Telemetry metrics on http://0.0.0.0:%d/metrics\n", port);
+    return true;
+#else
+    printf("No telemetry server on this platform, --telemetry-port ignored\n");
+    return false;
+#endif
+}
+
+void Telemetry::serve() {
+#ifdef TELEMETRY_SERVER
+    while (!stopping) {
+        // Wakes up now and then to see whether it should stop
+        pollfd listening = { listen_socket, POLLIN, 0 };
+        if (poll(&listening, 1, 250) <= 0) continue;
+        const int client = accept(listen_socket, nullptr, nullptr);
+        if (client < 0) continue;
+
+        // The request is read and dropped, whatever it asks for gets the metrics
+        timeval timeout = { 1, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[1024];
+        if (recv(client, request, sizeof(request), 0) >= 0) {
+            std::string body;
+            {
+                std::lock_guard<std::mutex> lock(text_mutex);
+                body = prometheus_text;
+            }
+            std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                   std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+            size_t sent = 0;
+            while (sent < response.size()) {
+                const ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) break;
+                sent += (size_t)n;
+            }
+        }
+        close(client);
+    }
+#endif
+}
@@ -0,0 +1,260 @@
+#include "temporal_aa.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "profiler.h"
+#include "scene_target.h"
+#include "shader_loading.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <initializer_list>
+
+std::string buildAssetPath(const std::string& relative_path);
+
+bool use_taa = true;
+
+TemporalAA temporal_aa;
+
+TemporalAA::~TemporalAA() {
+    release();
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+}
+
+void TemporalAA::release() {
+    for (GLuint* fbo : { &motion_fbo, &history_fbos[0], &history_fbos[1] }) {
+        if (*fbo != 0) { glDeleteFramebuffers(1, fbo); *fbo = 0; }
+    }
+    for (GLuint* texture : { &velocity_texture, &history_textures[0], &history_textures[1] }) {
+        if (*texture != 0) { glDeleteTextures(1, texture); *texture = 0; }
+    }
+    depth_texture = 0;
+    render_width = render_height = output_width = output_height = 0;
+    history_valid = false;
+}
+
+void TemporalAA::fallBack() {
+    failed = true;
+    release();
+    if (!use_dynamic_resolution) resolution_scale = 1.0f;
+}
+
+// Radical inverse, the Halton sequence in one base
+static float halton(uint32_t index, uint32_t base) {
+    float result = 0.0f;
+    float fraction = 1.0f / base;
+    for (; index > 0; index /= base, fraction /= base) result += fraction * (index % base);
+    return result;
+}
+
+glm::vec2 TemporalAA::jitter(int width, int height) {
+    motion_ready = false;
+    if (!active() || width <= 0 || height <= 0) {
+        frame_jitter = glm::vec2(0.0f);
+        return frame_jitter;
+    }
+    // From 1, index 0 is the corner of every base
+    const uint32_t phase = frame++ % TAA_JITTER_PHASES + 1;
+    const glm::vec2 pixels(halton(phase, 2) - 0.5f, halton(phase, 3) - 0.5f);
+    frame_jitter = pixels * 2.0f / glm::vec2((float)width, (float)height);
+    return frame_jitter;
+}
+
+static GLuint createTarget(GLint internal_format, GLenum format, GLenum type, int width, int height, GLint filter) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+bool TemporalAA::initMotion(int width, int height) {
+    if (motion_fbo != 0) { glDeleteFramebuffers(1, &motion_fbo); motion_fbo = 0; }
+    if (velocity_texture != 0) { glDeleteTextures(1, &velocity_texture); velocity_texture = 0; }
+
+    if (!resolve_shader) {
+#ifdef __EMSCRIPTEN__
+        if (!hasGLExtension("GL_EXT_color_buffer_float") && !hasGLExtension("EXT_color_buffer_float")) {
+            printf("TAA needs EXT_color_buffer_float, staying on MSAA\n");
+            return false;
+        }
+#endif
+        try {
+            resolve_shader = std::make_unique<Shader>(loadShaderFile(buildAssetPath("res/shaders/hiz.vs")),
+                                                      loadShaderFile(buildAssetPath("res/shaders/taa_resolve.fs")));
+        } catch (const std::exception& e) {
+            printf("TAA disabled: %s\n", e.what());
+            return false;
+        }
+        resolve_shader->use();
+        resolve_shader->setInt("sceneColor", 0);
+        resolve_shader->setInt("sceneDepth", 1);
+        resolve_shader->setInt("velocityMap", 2);
+        resolve_shader->setInt("history", 3);
+        glGenVertexArrays(1, &vao);
+    }
+
+    velocity_texture = createTarget(GL_RG16F, GL_RG, GL_HALF_FLOAT, width, height, GL_NEAREST);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+    // The scene target's own depth, tested against without writing and sampled by the resolve
+    depth_texture = scene_target.depthTexture();
+    glGenFramebuffers(1, &motion_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, motion_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, velocity_texture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0);
+    const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    if (!complete) {
+        printf("TAA motion framebuffer incomplete, staying on MSAA\n");
+        return false;
+    }
+    render_width = width;
+    render_height = height;
+    return true;
+}
+
+bool TemporalAA::initHistory(int width, int height) {
+    for (int i = 0; i < 2; ++i) {
+        if (history_fbos[i] != 0) { glDeleteFramebuffers(1, &history_fbos[i]); history_fbos[i] = 0; }
+        if (history_textures[i] != 0) { glDeleteTextures(1, &history_textures[i]); history_textures[i] = 0; }
+    }
+
+    // The scene colour's, no alpha is kept
+    history_format = renderTargetFormats().hdr_color;
+    GLenum format, type;
+    renderTargetTransfer(history_format, format, type);
+    bool complete = true;
+    for (int i = 0; i < 2; ++i) {
+        // Linear, it's read at reprojected positions
+        history_textures[i] = createTarget(history_format, format, type, width, height, GL_LINEAR);
+        glGenFramebuffers(1, &history_fbos[i]);
+        glBindFramebuffer(GL_FRAMEBUFFER, history_fbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, history_textures[i], 0);
+        complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    }
+    gl_state.bindTexture(0, GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    if (!complete) {
+        printf("TAA history framebuffers incomplete, staying on MSAA\n");
+        return false;
+    }
+    output_width = width;
+    output_height = height;
+    history_valid = false;
+    printf("TAA history: %dx%d\n", width, height);
+    return true;
+}
+
+bool TemporalAA::beginMotion(const glm::mat4& view, const glm::mat4& projection) {
+    motion_ready = false;
+    if (!active() || scene_framebuffer == 0) {
+        history_valid = false;
+        return false;
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != render_width || viewport[3] != render_height || motion_fbo == 0) {
+        if (!initMotion(viewport[2], viewport[3])) {
+            fallBack();
+            return false;
+        }
+    }
+
+    // The jitter only moves the image, the motion is measured between unjittered views
+    glm::mat4 unjittered = projection;
+    unjittered[2][0] += frame_jitter.x;
+    unjittered[2][1] += frame_jitter.y;
+    current_view_projection = unjittered * view;
+    inverse_view_projection = glm::inverse(projection * view);
+    if (!history_valid) history_view_projection = current_view_projection;
+
+    // No copy: nothing after the opaques writes depth (the sky tests without writing), and the
+    // resolve samples it once the scene framebuffer is unbound. Reattached when the scene target
+    // remakes it.
+    glBindFramebuffer(GL_FRAMEBUFFER, motion_fbo);
+    if (scene_target.depthTexture() != depth_texture) {
+        depth_texture = scene_target.depthTexture();
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0);
+    }
+    gl_state.colorMask(true);
+    glClearColor(TAA_NO_MOTION, TAA_NO_MOTION, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    gl_state.enable(GL_DEPTH_TEST);
+    gl_state.depthMask(false);
+    gl_state.depthFunc(GL_LEQUAL);
+    gl_state.disable(GL_BLEND);
+    motion_ready = true;
+    return true;
+}
+
+void TemporalAA::endMotion() {
+    gl_state.depthMask(true);
+    gl_state.depthFunc(GL_LESS);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+}
+
+GLuint TemporalAA::resolve(GLuint scene_color, int new_output_width, int new_output_height) {
+    PROFILE_SCOPE("taa resolve");
+    if (!motion_ready || scene_color == 0) return 0;
+    motion_ready = false;
+
+    if (new_output_width != output_width || new_output_height != output_height || history_fbos[0] == 0 ||
+        renderTargetFormats().hdr_color != history_format) {
+        if (!initHistory(new_output_width, new_output_height)) {
+            fallBack();
+            return 0;
+        }
+    }
+
+    const int previous = current;
+    current = 1 - current;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    bool depth_test = gl_state.isEnabled(GL_DEPTH_TEST);
+    bool cull_face = gl_state.isEnabled(GL_CULL_FACE);
+    bool blend = gl_state.isEnabled(GL_BLEND);
+    gl_state.disable(GL_DEPTH_TEST);
+    gl_state.disable(GL_CULL_FACE);
+    gl_state.disable(GL_BLEND);
+    gl_state.colorMask(true);
+    gl_state.bindVertexArray(vao);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, history_fbos[current]);
+    glViewport(0, 0, output_width, output_height);
+    // A sample that lands on the pixel centre counts for more the fewer of them each pixel gets
+    const float scale = (float)render_width / (float)output_width;
+    resolve_shader->use();
+    resolve_shader->setVec2("outputSize", glm::vec2((float)output_width, (float)output_height));
+    resolve_shader->setVec2("renderSize", glm::vec2((float)render_width, (float)render_height));
+    resolve_shader->setVec2("jitterPixels", frame_jitter * 0.5f * glm::vec2((float)render_width, (float)render_height));
+    resolve_shader->setMat4("inverseViewProjection", inverse_view_projection);
+    resolve_shader->setMat4("previousViewProjection", history_view_projection);
+    resolve_shader->setFloat("blendFactor", std::min(TAA_BLEND / std::max(scale * scale, 0.01f), 0.5f));
+    resolve_shader->setInt("historyValid", history_valid ? 1 : 0);
+    gl_state.bindTexture(0, GL_TEXTURE_2D, scene_color);
+    gl_state.bindTexture(1, GL_TEXTURE_2D, depth_texture);
+    gl_state.bindTexture(2, GL_TEXTURE_2D, velocity_texture);
+    gl_state.bindTexture(3, GL_TEXTURE_2D, history_textures[previous]);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    gl_state.setEnabled(GL_DEPTH_TEST, depth_test);
+    gl_state.setEnabled(GL_CULL_FACE, cull_face);
+    gl_state.setEnabled(GL_BLEND, blend);
+
+    history_view_projection = current_view_projection;
+    history_valid = true;
+    return history_textures[current];
+}
+
+void TemporalAA::shiftOrigin(const glm::vec3& delta) {
+    history_view_projection = history_view_projection * glm::translate(glm::mat4(1.0f), delta);
+}
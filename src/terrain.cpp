@@ -0,0 +1,407 @@
+#include "terrain.h"
+#include "filesystem.h"
+#include "frustum.h"
+#include "gl_state.h"
+#include "gpu_memory.h"
+#include "instance_ring.h"
+#include "job_system.h"
+#include "stb_image.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+bool use_terrain = true;
+Terrain terrain;
+
+#define TERRAIN_TILE_SAMPLES (TERRAIN_TILE_TEXELS + 1)
+#define TERRAIN_NOISE_OCTAVES 6
+
+static_assert(sizeof(TerrainChunk) == 8 * sizeof(float), "two vec4 instance attributes, see terrain.glsl");
+
+Terrain::~Terrain() {
+    release();
+}
+
+int Terrain::parseArg(int argc, char** argv, int i) {
+    (void)argc;
+    if (std::string(argv[i]) != "--terrain") return 0;
+    enabled = true;
+    return 1;
+}
+
+// ============================================================================
+// TILES
+// ============================================================================
+
+static float latticeValue(int x, int z) {
+    uint32_t h = (uint32_t)x * 374761393u + (uint32_t)z * 668265263u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return (float)((h ^ (h >> 16)) & 0xffffff) / (float)0xffffff;
+}
+
+static float valueNoise(float x, float z) {
+    const float fx = std::floor(x), fz = std::floor(z);
+    const int ix = (int)fx, iz = (int)fz;
+    float tx = x - fx, tz = z - fz;
+    tx = tx * tx * (3.0f - 2.0f * tx);
+    tz = tz * tz * (3.0f - 2.0f * tz);
+    const float a = latticeValue(ix, iz) + (latticeValue(ix + 1, iz) - latticeValue(ix, iz)) * tx;
+    const float b = latticeValue(ix, iz + 1) + (latticeValue(ix + 1, iz + 1) - latticeValue(ix, iz + 1)) * tx;
+    return a + (b - a) * tz;
+}
+
+// Rolling hills, flattened towards the origin where the scene stands
+static float generatedHeight(float x, float z) {
+    float sum = 0.0f, amplitude = 0.5f, frequency = 1.0f / TERRAIN_NOISE_SCALE;
+    for (int octave = 0; octave < TERRAIN_NOISE_OCTAVES; ++octave) {
+        sum += valueNoise(x * frequency, z * frequency) * amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    float t = std::clamp((std::sqrt(x * x + z * z) - TERRAIN_FLAT_RADIUS) / TERRAIN_FLAT_RADIUS, 0.0f, 1.0f);
+    t = t * t * (3.0f - 2.0f * t);
+    return sum * TERRAIN_NOISE_HEIGHT * t;
+}
+
+// Fills a tile's heights from its file, false when there isn't one
+static bool loadHeightFile(const std::string& path, std::vector<float>& heights) {
+    MappedFile file(path);
+    if (!file.isOpen()) return false;
+    int width = 0, height = 0, channels = 0;
+    stbi_us* pixels = stbi_load_16_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 1);
+    if (!pixels) return false;
+    const bool fits = width == TERRAIN_TILE_SAMPLES && height == TERRAIN_TILE_SAMPLES;
+    if (fits) {
+        for (size_t i = 0; i < heights.size(); ++i) heights[i] = pixels[i] / 65535.0f * TERRAIN_HEIGHT_RANGE;
+    } else {
+        printf("Terrain: %s is %dx%d, tiles are %dx%d\n", path.c_str(), width, height, TERRAIN_TILE_SAMPLES, TERRAIN_TILE_SAMPLES);
+    }
+    stbi_image_free(pixels);
+    return fits;
+}
+
+static bool loadSplatFile(const std::string& path, std::vector<unsigned char>& splat) {
+    MappedFile file(path);
+    if (!file.isOpen()) return false;
+    int width = 0, height = 0, channels = 0;
+    stbi_uc* pixels = stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 4);
+    if (!pixels) return false;
+    const bool fits = width == TERRAIN_TILE_SAMPLES && height == TERRAIN_TILE_SAMPLES;
+    if (fits) memcpy(splat.data(), pixels, splat.size());
+    stbi_image_free(pixels);
+    return fits;
+}
+
+// Grass on the flats, rock on the slopes, dirt between and snow up high
+static void generateSplat(const std::vector<float>& heights, std::vector<unsigned char>& splat) {
+    auto at = [&](int x, int z) {
+        x = std::clamp(x, 0, TERRAIN_TILE_TEXELS);
+        z = std::clamp(z, 0, TERRAIN_TILE_TEXELS);
+        return heights[(size_t)z * TERRAIN_TILE_SAMPLES + x];
+    };
+    for (int z = 0; z < TERRAIN_TILE_SAMPLES; ++z) {
+        for (int x = 0; x < TERRAIN_TILE_SAMPLES; ++x) {
+            const float dx = (at(x + 1, z) - at(x - 1, z)) / (2.0f * TERRAIN_TEXEL_SPACING);
+            const float dz = (at(x, z + 1) - at(x, z - 1)) / (2.0f * TERRAIN_TEXEL_SPACING);
+            const float slope = std::sqrt(dx * dx + dz * dz);
+            const float h = at(x, z) / TERRAIN_NOISE_HEIGHT;
+
+            const float rock = std::clamp((slope - 0.4f) * 3.0f, 0.0f, 1.0f);
+            const float snow = std::clamp((h - 0.7f) * 5.0f, 0.0f, 1.0f) * (1.0f - rock);
+            const float dirt = std::clamp((slope - 0.15f) * 4.0f, 0.0f, 1.0f) * (1.0f - rock) * (1.0f - snow);
+            const float grass = std::max(0.0f, 1.0f - rock - snow - dirt);
+
+            unsigned char* texel = &splat[((size_t)z * TERRAIN_TILE_SAMPLES + x) * 4];
+            texel[0] = (unsigned char)(grass * 255.0f + 0.5f);
+            texel[1] = (unsigned char)(rock * 255.0f + 0.5f);
+            texel[2] = (unsigned char)(dirt * 255.0f + 0.5f);
+            texel[3] = (unsigned char)(snow * 255.0f + 0.5f);
+        }
+    }
+}
+
+std::unique_ptr<Terrain::TileData> Terrain::buildTile(TileKey key) {
+    auto data = std::make_unique<TileData>();
+    data->key = key;
+    data->heights.resize((size_t)TERRAIN_TILE_SAMPLES * TERRAIN_TILE_SAMPLES);
+    data->splat.resize(data->heights.size() * 4);
+
+    const std::string suffix = std::to_string(key.x) + "_" + std::to_string(key.z) + ".png";
+    if (!loadHeightFile(buildAssetPath("res/terrain/height_" + suffix), data->heights)) {
+        const float tile_size = TERRAIN_TILE_TEXELS * TERRAIN_TEXEL_SPACING;
+        for (int z = 0; z < TERRAIN_TILE_SAMPLES; ++z) {
+            for (int x = 0; x < TERRAIN_TILE_SAMPLES; ++x) {
+                data->heights[(size_t)z * TERRAIN_TILE_SAMPLES + x] =
+                    generatedHeight(key.x * tile_size + x * TERRAIN_TEXEL_SPACING, key.z * tile_size + z * TERRAIN_TEXEL_SPACING);
+            }
+        }
+    }
+    if (!loadSplatFile(buildAssetPath("res/terrain/splat_" + suffix), data->splat)) generateSplat(data->heights, data->splat);
+
+    const auto range = std::minmax_element(data->heights.begin(), data->heights.end());
+    data->min_height = *range.first;
+    data->max_height = *range.second;
+    return data;
+}
+
+// ============================================================================
+// RESOURCES
+// ============================================================================
+
+bool Terrain::init() {
+    if (vao != 0) return true;
+
+    // (TERRAIN_GRID + 1)^2 vertices, x and z in aPos, all the vertex data there is
+    std::vector<float> vertices;
+    vertices.reserve((size_t)(TERRAIN_GRID + 1) * (TERRAIN_GRID + 1) * 3);
+    for (int z = 0; z <= TERRAIN_GRID; ++z) {
+        for (int x = 0; x <= TERRAIN_GRID; ++x) vertices.insert(vertices.end(), {(float)x, 0.0f, (float)z});
+    }
+    std::vector<uint16_t> indices;
+    indices.reserve((size_t)TERRAIN_GRID * TERRAIN_GRID * 6);
+    for (int z = 0; z < TERRAIN_GRID; ++z) {
+        for (int x = 0; x < TERRAIN_GRID; ++x) {
+            const uint16_t i = (uint16_t)(z * (TERRAIN_GRID + 1) + x);
+            const uint16_t below = (uint16_t)(i + TERRAIN_GRID + 1);
+            // Counter-clockwise seen from above
+            indices.insert(indices.end(), {i, below, (uint16_t)(i + 1), (uint16_t)(i + 1), below, (uint16_t)(below + 1)});
+        }
+    }
+    index_count = (GLsizei)indices.size();
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &grid_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, grid_vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glGenBuffers(1, &grid_ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, grid_ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+    // Slots 6 and 7 per instance, pointed into the instance ring at each draw
+    for (GLuint slot : {6u, 7u}) {
+        glEnableVertexAttribArray(slot);
+        glVertexAttribDivisor(slot, 1);
+    }
+    glBindVertexArray(0);
+    gpu_memory.trackBuffer(grid_vbo, vertices.size() * sizeof(float), GPU_MEMORY_GEOMETRY, "terrain grid");
+    gpu_memory.trackBuffer(grid_ebo, indices.size() * sizeof(uint16_t), GPU_MEMORY_GEOMETRY, "terrain grid");
+
+    // Fetched texel by texel in the vertex shader, nothing filters them
+    auto createArray = [](GLenum internal_format, GLenum format, GLenum type) {
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internal_format, TERRAIN_TILE_SAMPLES, TERRAIN_TILE_SAMPLES, TERRAIN_MAX_TILES, 0,
+                     format, type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return texture;
+    };
+    height_array = createArray(GL_R32F, GL_RED, GL_FLOAT);
+    splat_array = createArray(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    const uint64_t layer_texels = (uint64_t)TERRAIN_TILE_SAMPLES * TERRAIN_TILE_SAMPLES * TERRAIN_MAX_TILES;
+    gpu_memory.trackTexture(height_array, layer_texels * 4, GPU_MEMORY_TEXTURES, "terrain heights");
+    gpu_memory.trackTexture(splat_array, layer_texels * 4, GPU_MEMORY_TEXTURES, "terrain splat");
+
+    free_layers.clear();
+    for (int layer = TERRAIN_MAX_TILES - 1; layer >= 0; --layer) free_layers.push_back(layer);
+
+    // The splat tints carry the colour, the material the response
+    terrain_material = Material("terrain");
+    terrain_material.roughness = 0.9f;
+
+    if (glGetError() != GL_NO_ERROR) {
+        printf("Terrain: couldn't create its buffers, leaving it off\n");
+        release();
+        return false;
+    }
+    printf("Terrain: %d x %d sample tiles, %d resident at most\n", TERRAIN_TILE_SAMPLES, TERRAIN_TILE_SAMPLES, TERRAIN_MAX_TILES);
+    return true;
+}
+
+size_t Terrain::pendingTiles() const {
+    std::lock_guard<std::mutex> lock(finished_mutex);
+    return in_flight;
+}
+
+void Terrain::release() {
+    // Workers building tiles write into finished
+    if (in_flight > 0) job_system.waitIdle();
+    {
+        std::lock_guard<std::mutex> lock(finished_mutex);
+        finished.clear();
+        in_flight = 0;
+    }
+    tiles.clear();
+    free_layers.clear();
+    if (height_array) {
+        gpu_memory.releaseTexture(height_array);
+        gpu_memory.releaseTexture(splat_array);
+        glDeleteTextures(1, &height_array);
+        glDeleteTextures(1, &splat_array);
+        height_array = splat_array = 0;
+    }
+    if (vao) {
+        gpu_memory.releaseBuffer(grid_vbo);
+        gpu_memory.releaseBuffer(grid_ebo);
+        glDeleteBuffers(1, &grid_vbo);
+        glDeleteBuffers(1, &grid_ebo);
+        glDeleteVertexArrays(1, &vao);
+        vao = grid_vbo = grid_ebo = 0;
+    }
+}
+
+// ============================================================================
+// STREAMING
+// ============================================================================
+
+void Terrain::update(const glm::vec3& camera_position) {
+    if (!ready() || !use_terrain) return;
+
+    const float tile_size = TERRAIN_TILE_TEXELS * TERRAIN_TEXEL_SPACING;
+    const int camera_x = (int)std::floor(camera_position.x / tile_size);
+    const int camera_z = (int)std::floor(camera_position.z / tile_size);
+
+    // One tile further than they're requested, so a camera on a border doesn't thrash them
+    for (auto it = tiles.begin(); it != tiles.end();) {
+        if (std::abs(it->first.x - camera_x) <= TERRAIN_VIEW_TILES + 1 && std::abs(it->first.z - camera_z) <= TERRAIN_VIEW_TILES + 1) {
+            ++it;
+            continue;
+        }
+        if (it->second.layer >= 0) free_layers.push_back(it->second.layer);
+        it = tiles.erase(it);
+    }
+
+    // Nearest first, the camera's own tile before the ring around it
+    for (int ring = 0; ring <= TERRAIN_VIEW_TILES; ++ring) {
+        for (int z = camera_z - ring; z <= camera_z + ring; ++z) {
+            for (int x = camera_x - ring; x <= camera_x + ring; ++x) {
+                if (std::max(std::abs(x - camera_x), std::abs(z - camera_z)) != ring) continue;
+                const TileKey key{x, z};
+                if (tiles.count(key)) continue;
+                tiles[key] = Tile();
+                {
+                    std::lock_guard<std::mutex> lock(finished_mutex);
+                    in_flight++;
+                }
+                job_system.submit([this, key]() {
+                    std::unique_ptr<TileData> data = buildTile(key);
+                    std::lock_guard<std::mutex> lock(finished_mutex);
+                    finished.push_back(std::move(data));
+                });
+            }
+        }
+    }
+
+    for (int uploads = 0; uploads < TERRAIN_UPLOADS_PER_FRAME; ++uploads) {
+        std::unique_ptr<TileData> data;
+        {
+            std::lock_guard<std::mutex> lock(finished_mutex);
+            if (finished.empty()) break;
+            data = std::move(finished.front());
+            finished.pop_front();
+            in_flight--;
+        }
+        // Dropped while it was being built, or built twice after coming back
+        auto it = tiles.find(data->key);
+        if (it == tiles.end() || it->second.layer >= 0) continue;
+        if (free_layers.empty()) {
+            tiles.erase(it);
+            continue;
+        }
+        Tile& tile = it->second;
+        tile.layer = free_layers.back();
+        free_layers.pop_back();
+        tile.min_height = data->min_height;
+        tile.max_height = data->max_height;
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, height_array);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, tile.layer, TERRAIN_TILE_SAMPLES, TERRAIN_TILE_SAMPLES, 1, GL_RED, GL_FLOAT,
+                        data->heights.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, splat_array);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, tile.layer, TERRAIN_TILE_SAMPLES, TERRAIN_TILE_SAMPLES, 1, GL_RGBA,
+                        GL_UNSIGNED_BYTE, data->splat.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+}
+
+// ============================================================================
+// SELECTION AND DRAWING
+// ============================================================================
+
+// Camera distance where chunks of a level end, level 0 the finest
+static float levelRange(int level) {
+    return TERRAIN_LOD_RANGE * (float)(1 << level);
+}
+
+static bool boxInSphere(const glm::vec3& bmin, const glm::vec3& bmax, const glm::vec3& center, float radius) {
+    const glm::vec3 nearest = glm::clamp(center, bmin, bmax);
+    const glm::vec3 d = nearest - center;
+    return glm::dot(d, d) <= radius * radius;
+}
+
+void Terrain::selectNode(const Frustum& frustum, const glm::vec3& camera_position, const Tile& tile, const glm::vec2& tile_origin,
+                         const glm::vec2& origin, int level, std::vector<TerrainChunk>& chunks) const {
+    const float size = TERRAIN_GRID * TERRAIN_TEXEL_SPACING * (float)(1 << level);
+    const glm::vec3 bmin(origin.x, tile.min_height, origin.y);
+    const glm::vec3 bmax(origin.x + size, tile.max_height, origin.y + size);
+    if (!frustum.aabbInFrustum(bmin, bmax)) return;
+
+    // Split where the camera is within reach of the finer level, its children can always draw
+    // themselves: beyond their range they morph all the way onto this level's grid
+    if (level > 0 && boxInSphere(bmin, bmax, camera_position, levelRange(level - 1))) {
+        const float half = size * 0.5f;
+        for (int child = 0; child < 4; ++child) {
+            const glm::vec2 child_origin = origin + glm::vec2((child & 1) ? half : 0.0f, (child & 2) ? half : 0.0f);
+            selectNode(frustum, camera_position, tile, tile_origin, child_origin, level - 1, chunks);
+        }
+        return;
+    }
+
+    TerrainChunk chunk;
+    chunk.origin = origin;
+    chunk.size = size;
+    chunk.tile_layer = (float)tile.layer;
+    chunk.tile_origin = tile_origin;
+    if (level < TERRAIN_LEVELS - 1) {
+        const float end = levelRange(level);
+        chunk.morph_start = end * TERRAIN_MORPH_START;
+        chunk.morph_scale = 1.0f / (end - chunk.morph_start);
+    }
+    chunks.push_back(chunk);
+}
+
+void Terrain::select(const Frustum& frustum, const glm::vec3& camera_position, std::vector<TerrainChunk>& chunks) const {
+    chunks.clear();
+    if (!ready() || !use_terrain) return;
+    const float tile_size = TERRAIN_TILE_TEXELS * TERRAIN_TEXEL_SPACING;
+    for (const auto& [key, tile] : tiles) {
+        if (tile.layer < 0) continue;
+        const glm::vec2 tile_origin(key.x * tile_size, key.z * tile_size);
+        selectNode(frustum, camera_position, tile, tile_origin, tile_origin, TERRAIN_LEVELS - 1, chunks);
+    }
+}
+
+size_t Terrain::draw(const std::vector<TerrainChunk>& chunks) {
+    if (chunks.empty()) return 0;
+    gl_state.bindTexture(TERRAIN_HEIGHT_UNIT, GL_TEXTURE_2D_ARRAY, height_array);
+    gl_state.bindTexture(TERRAIN_SPLAT_UNIT, GL_TEXTURE_2D_ARRAY, splat_array);
+    gl_state.bindVertexArray(vao);
+
+    const InstanceRing::Block block = instance_ring.writeBytes(chunks.data(), chunks.size() * sizeof(TerrainChunk));
+    glBindBuffer(GL_ARRAY_BUFFER, block.buffer);
+    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainChunk), (void*)block.offset);
+    glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainChunk), (void*)(block.offset + 4 * sizeof(float)));
+    glDrawElementsInstanced(GL_TRIANGLES, index_count, GL_UNSIGNED_SHORT, nullptr, (GLsizei)chunks.size());
+    return (size_t)index_count / 3 * chunks.size();
+}
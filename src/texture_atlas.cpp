@@ -0,0 +1,117 @@
+#include "texture_atlas.h"
+#include "texture_loader.h"
+#include "gpu_memory.h"
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cmath>
+
+bool use_texture_atlas = true;
+TextureAtlas texture_atlas;
+
+TextureAtlas::~TextureAtlas() {
+    release();
+}
+
+TextureAtlas::Slot TextureAtlas::pack(const ImageData& image) {
+    if (!image.valid() || image.isCompressed() || image.width > TEXTURE_ATLAS_MAX_SIZE || image.height > TEXTURE_ATLAS_MAX_SIZE) return Slot();
+    // Chains are RGBA8 (generateMipChain, RGBA8 KTX2 files), single levels keep their channels
+    const bool chain = image.hasMipChain();
+    if (!chain && image.channels != 3 && image.channels != 4) return Slot();
+
+    Slot slot;
+    for (size_t i = 0; i < arrays.size() && !slot.valid(); ++i) {
+        const Array& array = arrays[i];
+        if (array.width == image.width && array.height == image.height && array.srgb == image.srgb &&
+            (!array.free_layers.empty() || array.used < TEXTURE_ATLAS_LAYERS)) {
+            slot.array = (int)i;
+        }
+    }
+    if (!slot.valid()) {
+        Array array;
+        array.width = image.width;
+        array.height = image.height;
+        array.srgb = image.srgb;
+        const GLenum internal_format = image.srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+        glGenTextures(1, &array.texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+        const int levels = 1 + (int)std::floor(std::log2((float)std::max(image.width, image.height)));
+        for (int level = 0; level < levels; ++level) {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internal_format, std::max(1, image.width >> level), std::max(1, image.height >> level),
+                         TEXTURE_ATLAS_LAYERS, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        gpu_memory.trackTexture(array.texture, textureMipChainBytes(internal_format, image.width, image.height, TEXTURE_ATLAS_LAYERS),
+                                GPU_MEMORY_TEXTURES, "texture atlas");
+        slot.array = (int)arrays.size();
+        arrays.push_back(std::move(array));
+    }
+
+    Array& array = arrays[slot.array];
+    if (!array.free_layers.empty()) {
+        slot.layer = array.free_layers.back();
+        array.free_layers.pop_back();
+    } else {
+        slot.layer = array.used++;
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot.layer, image.width, image.height, 1,
+                    chain || image.channels == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE,
+                    chain ? image.levels[0].data() : image.pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    array.dirty = true;
+    return slot;
+}
+
+void TextureAtlas::assign(GLuint texture, Slot slot) {
+    if (!slot.valid()) return;
+    if (texture == 0 || entries.count(texture)) {
+        freeSlot(slot);
+        return;
+    }
+    entries[texture] = slot;
+}
+
+void TextureAtlas::remove(GLuint texture) {
+    auto it = entries.find(texture);
+    if (it == entries.end()) return;
+    freeSlot(it->second);
+    entries.erase(it);
+}
+
+void TextureAtlas::freeSlot(Slot slot) {
+    if (slot.valid() && slot.array < (int)arrays.size()) arrays[slot.array].free_layers.push_back(slot.layer);
+}
+
+bool TextureAtlas::find(GLuint texture, GLuint& array, int& layer) const {
+    auto it = entries.find(texture);
+    if (it == entries.end()) return false;
+    array = arrays[it->second.array].texture;
+    layer = it->second.layer;
+    return true;
+}
+
+// Inside the frame, so through gl_state, on the unit the arrays are drawn from anyway
+void TextureAtlas::flush() {
+    for (Array& array : arrays) {
+        if (!array.dirty) continue;
+        gl_state.bindTexture(TEXTURE_ATLAS_UNIT, GL_TEXTURE_2D_ARRAY, array.texture);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        array.dirty = false;
+    }
+}
+
+void TextureAtlas::release() {
+    for (Array& array : arrays) {
+        if (array.texture == 0) continue;
+        gpu_memory.releaseTexture(array.texture);
+        glDeleteTextures(1, &array.texture);
+    }
+    arrays.clear();
+    entries.clear();
+}
@@ -0,0 +1,149 @@
+#include "texture_cache.h"
+#include "texture_loader.h"
+#include "material.h"
+#include "texture_streamer.h"
+#include "texture_atlas.h"
+#include "gpu_memory.h"
+
+TextureCache texture_cache;
+
+static std::string samplerSuffix(const SamplerDesc& sampler) {
+    return "|" + std::to_string(sampler.wrap_s) + "," + std::to_string(sampler.wrap_t) + "," +
+           std::to_string(sampler.min_filter) + "," + std::to_string(sampler.mag_filter) + "," +
+           (sampler.mipmaps ? "m" : "-");
+}
+
+std::string TextureCache::fileKey(const std::string& resolved_path, const SamplerDesc& sampler) {
+    return "file:" + resolved_path + samplerSuffix(sampler);
+}
+
+std::string TextureCache::embeddedKey(const std::string& model_path, const std::string& texture_ref, const SamplerDesc& sampler) {
+    return "embedded:" + model_path + texture_ref + samplerSuffix(sampler);
+}
+
+std::string TextureCache::ormKey(const std::string& model_path, const std::string& ao_path, const std::string& roughness_path,
+                                 const std::string& metallic_path, const std::string& height_path,
+                                 const std::string& specular_path, bool invert_height, const SamplerDesc& sampler) {
+    // Embedded sources are only unique within their model
+    std::string key = "orm:";
+    for (const std::string* path : {&ao_path, &roughness_path, &metallic_path, &height_path, &specular_path}) {
+        if (!path->empty() && (*path)[0] == '*') key += model_path;
+        key += *path + ";";
+    }
+    return key + (invert_height ? "inv" : "") + samplerSuffix(sampler);
+}
+
+bool TextureCache::contains(const std::string& key) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return entries.count(key) != 0;
+}
+
+GLuint TextureCache::acquire(const std::string& key, uint32_t* flags) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = entries.find(key);
+    if (it == entries.end()) return 0;
+    ++it->second.refs;
+    if (flags) *flags = it->second.flags;
+    return it->second.texture;
+}
+
+GLuint TextureCache::insert(const std::string& key, GLuint texture, uint32_t flags) {
+    if (texture == 0 || texture == default_texture_id) return texture;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        texture_streamer.cancel(texture);
+        gpu_memory.releaseTexture(texture);
+        glDeleteTextures(1, &texture);
+        ++it->second.refs;
+        return it->second.texture;
+    }
+
+    entries[key] = { texture, 1, flags };
+    gpu_memory.tagTexture(texture, key.substr(0, key.find('|'))); // Without the sampler suffix
+    keys_by_texture[texture] = key;
+    return texture;
+}
+
+void TextureCache::retain(GLuint texture) {
+    if (texture == 0) return;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto key_it = keys_by_texture.find(texture);
+    if (key_it != keys_by_texture.end()) ++entries[key_it->second].refs;
+    auto evicted_it = evicted.find(texture);
+    if (evicted_it != evicted.end()) ++evicted_it->second.refs;
+}
+
+void TextureCache::release(GLuint texture) {
+    if (texture == 0) return;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto evicted_it = evicted.find(texture);
+    if (evicted_it != evicted.end()) {
+        if (--evicted_it->second.refs > 0) return;
+        texture_streamer.cancel(texture);
+        texture_atlas.remove(texture);
+        gpu_memory.releaseTexture(texture);
+        glDeleteTextures(1, &texture);
+        evicted.erase(evicted_it);
+        return;
+    }
+
+    auto key_it = keys_by_texture.find(texture);
+    if (key_it == keys_by_texture.end()) return;
+
+    auto it = entries.find(key_it->second);
+    if (--it->second.refs > 0) return;
+
+    texture_streamer.cancel(texture);
+    texture_atlas.remove(texture);
+    gpu_memory.releaseTexture(texture);
+    glDeleteTextures(1, &texture);
+    entries.erase(it);
+    keys_by_texture.erase(key_it);
+}
+
+size_t TextureCache::evictSource(const std::string& path) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    size_t count = 0;
+    for (auto it = entries.begin(); it != entries.end();) {
+        // Keys spell out their source paths, see fileKey() and ormKey()
+        if (it->first.find(path) == std::string::npos) {
+            ++it;
+            continue;
+        }
+        keys_by_texture.erase(it->second.texture);
+        evicted.emplace(it->second.texture, it->second);
+        it = entries.erase(it);
+        ++count;
+    }
+    return count;
+}
+
+size_t TextureCache::size() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return entries.size();
+}
+
+void releaseMaterialTextures(Material& material) {
+    texture_cache.release(material.albedo_map);
+    texture_cache.release(material.normal_map);
+    texture_cache.release(material.orm_map);
+    // height_map aliases orm_map when the ORM texture carries height
+    if (material.height_map != material.orm_map) texture_cache.release(material.height_map);
+    texture_cache.release(material.emissive_map);
+    texture_cache.release(material.specular_map);
+    material.albedo_map = material.normal_map = material.orm_map = 0;
+    material.height_map = material.emissive_map = material.specular_map = 0;
+}
+
+void retainMaterialTextures(const Material& material) {
+    texture_cache.retain(material.albedo_map);
+    texture_cache.retain(material.normal_map);
+    texture_cache.retain(material.orm_map);
+    if (material.height_map != material.orm_map) texture_cache.retain(material.height_map);
+    texture_cache.retain(material.emissive_map);
+    texture_cache.retain(material.specular_map);
+}
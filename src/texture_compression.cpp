@@ -0,0 +1,416 @@
+#include "texture_compression.h"
+#include "texture_loader.h"
+#include "ktx2.h"
+#include "filesystem.h"
+#include "load_stats.h"
+#include "stb_image.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+TextureCompressionCaps texture_compression_caps;
+bool use_texture_compression = true;
+
+// ============================================================================
+// CAPABILITIES
+// ============================================================================
+
+void initTextureCompression() {
+    TextureCompressionCaps caps;
+#ifndef __EMSCRIPTEN__
+    caps.rgtc = true; // Core since GL 3.0
+#endif
+
+    GLint extension_count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+    for (GLint i = 0; i < extension_count; ++i) {
+        const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (!name) continue;
+        // Substring matches cover the GL_EXT/ARB/KHR names and their WEBGL_ counterparts
+        if (strstr(name, "texture_compression_s3tc")) caps.s3tc = true;
+        if (strcmp(name, "GL_EXT_texture_sRGB") == 0 || strstr(name, "compressed_texture_s3tc_srgb")) caps.s3tc_srgb = true;
+        if (strstr(name, "texture_compression_rgtc")) caps.rgtc = true;
+        if (strstr(name, "texture_compression_bptc")) caps.bptc = true;
+        if (strstr(name, "compressed_texture_etc") || strstr(name, "ES3_compatibility")) caps.etc2 = true;
+        if (strstr(name, "texture_compression_astc_ldr") || strstr(name, "compressed_texture_astc")) caps.astc = true;
+    }
+
+    texture_compression_caps = caps;
+    printf("Texture compression: S3TC %s%s, RGTC %s, BPTC %s, ETC2 %s, ASTC %s\n",
+           caps.s3tc ? "yes" : "no", caps.s3tc && caps.s3tc_srgb ? " (sRGB)" : "", caps.rgtc ? "yes" : "no", caps.bptc ? "yes" : "no",
+           caps.etc2 ? "yes" : "no", caps.astc ? "yes" : "no");
+}
+
+GLenum srgbFormat(GLenum format) {
+    const TextureCompressionCaps& caps = texture_compression_caps;
+    switch (format) {
+        case GL_RGBA8:                        return GL_SRGB8_ALPHA8;
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return caps.s3tc && caps.s3tc_srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : 0;
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: return caps.s3tc && caps.s3tc_srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT : 0;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return caps.s3tc && caps.s3tc_srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : 0;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:   return caps.bptc ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : 0;
+        case GL_COMPRESSED_RGB8_ETC2:         return caps.etc2 ? GL_COMPRESSED_SRGB8_ETC2 : 0;
+        case GL_COMPRESSED_RGBA8_ETC2_EAC:    return caps.etc2 ? GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC : 0;
+        case GL_COMPRESSED_RGBA_ASTC_4x4_KHR: return caps.astc ? GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR : 0;
+        default:                              return 0;
+    }
+}
+
+bool isCompressedFormatSupported(GLenum format) {
+    const TextureCompressionCaps& caps = texture_compression_caps;
+    switch (format) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return caps.s3tc;
+        case GL_COMPRESSED_RED_RGTC1:
+        case GL_COMPRESSED_RG_RGTC2:          return caps.rgtc;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:   return caps.bptc;
+        case GL_COMPRESSED_RGB8_ETC2:
+        case GL_COMPRESSED_RGBA8_ETC2_EAC:
+        case GL_COMPRESSED_RG11_EAC:          return caps.etc2;
+        case GL_COMPRESSED_RGBA_ASTC_4x4_KHR: return caps.astc;
+        default:                              return false;
+    }
+}
+
+bool compressedFormatHasAlpha(GLenum format) {
+    return format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT || format == GL_COMPRESSED_RGBA_BPTC_UNORM ||
+           format == GL_COMPRESSED_RGBA8_ETC2_EAC || format == GL_COMPRESSED_RGBA_ASTC_4x4_KHR;
+}
+
+bool imageHasCutoutAlpha(const ImageData& image) {
+    if (image.isCompressed()) return compressedFormatHasAlpha(image.compressed_format);
+
+    // Streamed images keep their RGBA8 chain instead of pixels
+    const unsigned char* texels = image.pixels;
+    int channels = image.channels;
+    if (!texels && image.hasMipChain()) {
+        texels = image.levels[0].data();
+        channels = 4;
+    }
+    if (!texels || (channels != 2 && channels != 4)) return false;
+
+    const size_t count = (size_t)image.width * image.height;
+    for (size_t i = 0; i < count; ++i) {
+        if (texels[i * channels + channels - 1] < 128) return true;
+    }
+    return false;
+}
+
+static bool formatSuitsUsage(GLenum format, TextureUsage usage) {
+    bool two_channel = format == GL_COMPRESSED_RG_RGTC2 || format == GL_COMPRESSED_RG11_EAC;
+    bool has_alpha = compressedFormatHasAlpha(format);
+    switch (usage) {
+        case TEXTURE_USAGE_NORMAL: return two_channel;
+        case TEXTURE_USAGE_DATA:   return has_alpha;
+        default:                   return !two_channel && format != GL_COMPRESSED_RED_RGTC1;
+    }
+}
+
+// ============================================================================
+// BLOCK ENCODERS
+// ============================================================================
+
+// Reads a 4x4 block as RGBA8, clamping at the image edge
+static void fetchBlock(const unsigned char* rgba, int width, int height, int bx, int by, unsigned char block[16][4]) {
+    for (int y = 0; y < 4; ++y) {
+        int sy = std::min(by * 4 + y, height - 1);
+        for (int x = 0; x < 4; ++x) {
+            int sx = std::min(bx * 4 + x, width - 1);
+            memcpy(block[y * 4 + x], rgba + ((size_t)sy * width + sx) * 4, 4);
+        }
+    }
+}
+
+// BC4: two 8-bit endpoints and 3-bit indices in the 8-value interpolation mode
+static void encodeBC4(const unsigned char values[16], unsigned char out[8]) {
+    unsigned char lo = 255, hi = 0;
+    for (int i = 0; i < 16; ++i) { lo = std::min(lo, values[i]); hi = std::max(hi, values[i]); }
+
+    out[0] = hi;
+    out[1] = lo;
+    uint64_t bits = 0;
+    if (hi > lo) {
+        float range = (float)(hi - lo);
+        for (int i = 0; i < 16; ++i) {
+            // Ramp position 0 (lo) .. 7 (hi), remapped to BC4's index order
+            int r = (int)std::lround((values[i] - lo) / range * 7.0f);
+            uint64_t index = (r == 7) ? 0 : (r == 0) ? 1 : (uint64_t)(8 - r);
+            bits |= index << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; ++i) out[2 + i] = (unsigned char)(bits >> (8 * i));
+}
+
+static uint16_t packRGB565(const glm::vec3& c) {
+    int r = (int)std::lround(glm::clamp(c.r, 0.0f, 255.0f) * 31.0f / 255.0f);
+    int g = (int)std::lround(glm::clamp(c.g, 0.0f, 255.0f) * 63.0f / 255.0f);
+    int b = (int)std::lround(glm::clamp(c.b, 0.0f, 255.0f) * 31.0f / 255.0f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static glm::vec3 unpackRGB565(uint16_t c) {
+    return glm::vec3(((c >> 11) & 31) * 255.0f / 31.0f, ((c >> 5) & 63) * 255.0f / 63.0f, (c & 31) * 255.0f / 31.0f);
+}
+
+// BC1 colour block in 4-colour mode. Endpoints come from the bounding box, with its
+// diagonal picked by the sign of the colour covariance, inset slightly to cut error.
+static void encodeBC1(const unsigned char block[16][4], unsigned char out[8]) {
+    glm::vec3 colors[16];
+    glm::vec3 lo(255.0f), hi(0.0f), mean(0.0f);
+    for (int i = 0; i < 16; ++i) {
+        colors[i] = glm::vec3(block[i][0], block[i][1], block[i][2]);
+        lo = glm::min(lo, colors[i]);
+        hi = glm::max(hi, colors[i]);
+        mean += colors[i];
+    }
+    mean /= 16.0f;
+
+    // Flip green/blue extents that run against the dominant channel
+    glm::vec3 extent = hi - lo;
+    int axis = (extent.r >= extent.g && extent.r >= extent.b) ? 0 : (extent.g >= extent.b) ? 1 : 2;
+    glm::vec3 covariance(0.0f);
+    for (int i = 0; i < 16; ++i) {
+        glm::vec3 d = colors[i] - mean;
+        covariance += d * d[axis];
+    }
+    for (int c = 0; c < 3; ++c) {
+        if (covariance[c] < 0.0f) std::swap(lo[c], hi[c]);
+    }
+
+    glm::vec3 inset = (hi - lo) / 16.0f;
+    hi -= inset;
+    lo += inset;
+
+    uint16_t c0 = packRGB565(hi);
+    uint16_t c1 = packRGB565(lo);
+    if (c0 < c1) std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        glm::vec3 palette[4];
+        palette[0] = unpackRGB565(c0);
+        palette[1] = unpackRGB565(c1);
+        palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+        palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+
+        for (int i = 0; i < 16; ++i) {
+            uint32_t best = 0;
+            float best_dist = 1e30f;
+            for (uint32_t p = 0; p < 4; ++p) {
+                glm::vec3 d = colors[i] - palette[p];
+                float dist = glm::dot(d, d);
+                if (dist < best_dist) { best_dist = dist; best = p; }
+            }
+            indices |= best << (2 * i);
+        }
+    }
+
+    memcpy(out, &c0, 2);
+    memcpy(out + 2, &c1, 2);
+    memcpy(out + 4, &indices, 4);
+}
+
+static void compressLevel(const unsigned char* rgba, int width, int height, GLenum format, std::vector<unsigned char>& out) {
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+    size_t block_bytes = (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 8 : 16;
+    out.resize((size_t)blocks_x * blocks_y * block_bytes);
+
+    unsigned char block[16][4];
+    unsigned char channel[16];
+    unsigned char* dst = out.data();
+    for (int by = 0; by < blocks_y; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx, dst += block_bytes) {
+            fetchBlock(rgba, width, height, bx, by, block);
+            if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+                encodeBC1(block, dst);
+            } else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+                for (int i = 0; i < 16; ++i) channel[i] = block[i][3];
+                encodeBC4(channel, dst);
+                encodeBC1(block, dst + 8);
+            } else { // GL_COMPRESSED_RG_RGTC2
+                for (int i = 0; i < 16; ++i) channel[i] = block[i][0];
+                encodeBC4(channel, dst);
+                for (int i = 0; i < 16; ++i) channel[i] = block[i][1];
+                encodeBC4(channel, dst + 8);
+            }
+        }
+    }
+}
+
+// ============================================================================
+// MIP CHAIN
+// ============================================================================
+
+static std::vector<unsigned char> expandToRGBA(const ImageData& image) {
+    size_t pixel_count = (size_t)image.width * image.height;
+    std::vector<unsigned char> rgba(pixel_count * 4);
+    for (size_t i = 0; i < pixel_count; ++i) {
+        const unsigned char* src = image.pixels + i * image.channels;
+        unsigned char* dst = rgba.data() + i * 4;
+        switch (image.channels) {
+            case 1:  dst[0] = dst[1] = dst[2] = src[0]; dst[3] = 255; break;
+            case 2:  dst[0] = dst[1] = dst[2] = src[0]; dst[3] = src[1]; break;
+            case 3:  dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = 255; break;
+            default: memcpy(dst, src, 4); break;
+        }
+    }
+    return rgba;
+}
+
+// 2x2 box filter (edge texels repeat on odd sizes); normal maps are renormalized
+static std::vector<unsigned char> downsample(const std::vector<unsigned char>& src, int width, int height,
+                                             int new_width, int new_height, bool normals) {
+    std::vector<unsigned char> dst((size_t)new_width * new_height * 4);
+    for (int y = 0; y < new_height; ++y) {
+        int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+        for (int x = 0; x < new_width; ++x) {
+            int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+            const unsigned char* p[4] = {
+                &src[((size_t)y0 * width + x0) * 4], &src[((size_t)y0 * width + x1) * 4],
+                &src[((size_t)y1 * width + x0) * 4], &src[((size_t)y1 * width + x1) * 4]
+            };
+            unsigned char* out = &dst[((size_t)y * new_width + x) * 4];
+            for (int c = 0; c < 4; ++c) out[c] = (unsigned char)((p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4);
+
+            if (normals) {
+                glm::vec3 n = glm::vec3(out[0], out[1], out[2]) / 127.5f - 1.0f;
+                float len = glm::length(n);
+                n = len > 1e-5f ? n / len : glm::vec3(0.0f, 0.0f, 1.0f);
+                for (int c = 0; c < 3; ++c) out[c] = (unsigned char)std::lround((n[c] + 1.0f) * 127.5f);
+            }
+        }
+    }
+    return dst;
+}
+
+void generateMipChain(ImageData& image, bool normals) {
+    if (!image.valid() || image.hasMipChain()) return;
+    LoadTimer timer(LOAD_STAGE_MIP_CHAIN);
+
+    std::vector<unsigned char> rgba = expandToRGBA(image);
+    int w = image.width, h = image.height;
+    for (;;) {
+        if (w == 1 && h == 1) {
+            image.levels.push_back(std::move(rgba));
+            break;
+        }
+        int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+        std::vector<unsigned char> next = downsample(rgba, w, h, nw, nh, normals);
+        image.levels.push_back(std::move(rgba));
+        rgba = std::move(next);
+        w = nw;
+        h = nh;
+    }
+
+    stbi_image_free(image.pixels);
+    image.pixels = nullptr;
+    image.channels = 4;
+}
+
+void limitImageSize(ImageData& image, int max_size, bool normals) {
+    if (max_size <= 0 || !image.valid() || std::max(image.width, image.height) <= max_size) return;
+
+    if (image.hasMipChain()) {
+        size_t drop = 0;
+        while (drop + 1 < image.levels.size() && std::max(image.width >> drop, image.height >> drop) > max_size) drop++;
+        image.levels.erase(image.levels.begin(), image.levels.begin() + drop);
+        image.width = std::max(1, image.width >> drop);
+        image.height = std::max(1, image.height >> drop);
+        return;
+    }
+
+    std::vector<unsigned char> rgba = expandToRGBA(image);
+    int w = image.width, h = image.height;
+    while (std::max(w, h) > max_size) {
+        int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+        rgba = downsample(rgba, w, h, nw, nh, normals);
+        w = nw;
+        h = nh;
+    }
+    const bool srgb = image.srgb;
+    image = ImageData::allocate(w, h, 4);
+    image.srgb = srgb;
+    memcpy(image.pixels, rgba.data(), rgba.size());
+}
+
+ImageData compressImage(const ImageData& image, TextureUsage usage) {
+    if (!image.valid() || image.hasMipChain()) return ImageData();
+    LoadTimer timer(LOAD_STAGE_TEXTURE_COMPRESS);
+
+    std::vector<unsigned char> rgba = expandToRGBA(image);
+
+    GLenum format = 0;
+    if (usage == TEXTURE_USAGE_NORMAL) {
+        if (texture_compression_caps.rgtc) format = GL_COMPRESSED_RG_RGTC2;
+    } else if (texture_compression_caps.s3tc) {
+        bool opaque = true;
+        for (size_t i = 3; i < rgba.size() && opaque; i += 4) opaque = rgba[i] == 255;
+        format = (usage == TEXTURE_USAGE_COLOR && opaque) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    }
+    if (format == 0) return ImageData();
+
+    ImageData result;
+    result.width = image.width;
+    result.height = image.height;
+    result.channels = (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 3 : 4;
+    result.compressed_format = format;
+    result.srgb = image.srgb;
+
+    int w = image.width, h = image.height;
+    for (;;) {
+        result.levels.emplace_back();
+        compressLevel(rgba.data(), w, h, format, result.levels.back().bytes);
+        if (w == 1 && h == 1) break;
+
+        int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+        rgba = downsample(rgba, w, h, nw, nh, usage == TEXTURE_USAGE_NORMAL);
+        w = nw;
+        h = nh;
+    }
+    return result;
+}
+
+// ============================================================================
+// LOAD / COOK
+// ============================================================================
+
+ImageData loadTextureImage(const std::string& path, TextureUsage usage) {
+    LoadAssetScope asset(path);
+    if (use_texture_compression) {
+        int64_t source_mtime = getFileModifiedTime(path);
+        for (const char* suffix : {".ktx2", ".etc2.ktx2", ".astc.ktx2"}) {
+            std::string ktx_path = path + suffix;
+            int64_t ktx_mtime = getFileModifiedTime(ktx_path);
+            if (ktx_mtime == 0 || ktx_mtime < source_mtime) continue;
+
+            ImageData image;
+            if (!readKTX2(ktx_path, image)) continue;
+            if (!isCompressedFormatSupported(image.compressed_format) ||
+                !formatSuitsUsage(image.compressed_format, usage)) continue;
+
+            printf("Loaded compressed texture: %s\n", ktx_path.c_str());
+            return image;
+        }
+    }
+
+    ImageData image = decodeImage(path);
+
+#ifndef __EMSCRIPTEN__
+    // Cook on desktop only, the web build just picks up what was shipped
+    if (use_texture_compression && image.valid()) {
+        ImageData compressed = compressImage(image, usage);
+        if (compressed.valid()) {
+            if (writeKTX2(path + ".ktx2", compressed)) printf("Cooked texture: %s.ktx2\n", path.c_str());
+            return compressed;
+        }
+    }
+#endif
+
+    return image;
+}
@@ -1,122 +1,327 @@
 #include "texture_loader.h"
+#include "texture_cache.h"
+#include "texture_compression.h"
+#include "ktx2.h"
+#include "filesystem.h"
+#include "gpu_memory.h"
+#include "load_stats.h"
+#include "gl_extensions.h"
+#include "gl_backend.h"
 #include <glad/glad.h>
 #include <stb_image.h>
 #include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
 
 // Default texture ID (defined in main.cpp)
 extern GLuint default_texture_id;
 
-GLuint loadTexture(const std::string& path) {
-    GLuint textureID = 0;
-    glGenTextures(1, &textureID);
-    
-    int width, height, nrChannels;
-    unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
-    
-    if (data) {
-        GLenum format = (nrChannels == 4) ? GL_RGBA : (nrChannels == 3) ? GL_RGB : GL_RED;
-        
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        
-        // Set texture parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        
-        stbi_image_free(data);
-        printf("Loaded texture: %s\n", path.c_str());
-    } else {
-        printf("Failed to load texture: %s\n", path.c_str());
-        return default_texture_id;
+int texture_max_size = 0;
+
+// ============================================================================
+// IMAGE DECODING (CPU only, safe to call from worker threads)
+// ============================================================================
+
+// Pixel buffers are released with stbi_image_free, which is plain free() with the
+// default STBI_MALLOC, so buffers built by hand below are allocated with malloc.
+
+ImageData::~ImageData() {
+    if (pixels) stbi_image_free(pixels);
+}
+
+ImageData::ImageData(ImageData&& other) noexcept
+    : width(other.width), height(other.height), channels(other.channels), pixels(other.pixels),
+      compressed_format(other.compressed_format), levels(std::move(other.levels)), srgb(other.srgb),
+      mapping(std::move(other.mapping)) {
+    other.pixels = nullptr;
+    other.width = other.height = other.channels = 0;
+    other.compressed_format = 0;
+}
+
+ImageData& ImageData::operator=(ImageData&& other) noexcept {
+    if (this != &other) {
+        if (pixels) stbi_image_free(pixels);
+        width = other.width;
+        height = other.height;
+        channels = other.channels;
+        pixels = other.pixels;
+        compressed_format = other.compressed_format;
+        levels = std::move(other.levels);
+        mapping = std::move(other.mapping);
+        srgb = other.srgb;
+        other.pixels = nullptr;
+        other.width = other.height = other.channels = 0;
+        other.compressed_format = 0;
+    }
+    return *this;
+}
+
+ImageData ImageData::allocate(int width, int height, int channels) {
+    ImageData image;
+    image.width = width;
+    image.height = height;
+    image.channels = channels;
+    image.pixels = static_cast<unsigned char*>(malloc((size_t)width * height * channels));
+    return image;
+}
+
+ImageData decodeImage(const std::string& path, int desired_channels) {
+    LoadTimer timer(LOAD_STAGE_IMAGE_READ);
+    ImageData image;
+    int file_channels = 0;
+    MappedFile file(path);
+    if (file.isOpen()) {
+        timer.addBytesRead(file.size());
+        image.pixels = stbi_load_from_memory(file.data(), (int)file.size(), &image.width, &image.height, &file_channels,
+                                             desired_channels);
     }
+    image.channels = desired_channels ? desired_channels : file_channels;
     
-    return textureID;
+    if (image.pixels) printf("Loaded texture: %s\n", path.c_str());
+    else printf("Failed to load texture: %s\n", path.c_str());
+    return image;
 }
 
-GLuint loadTextureFromMemory(unsigned char* data, unsigned int size) {
-    if (!data) return default_texture_id;
+ImageData decodeImageFromMemory(const unsigned char* data, unsigned int size, int desired_channels) {
+    ImageData image;
+    if (!data) return image;
     
-    GLuint textureID = 0;
-    glGenTextures(1, &textureID);
+    LoadTimer timer(LOAD_STAGE_IMAGE_READ);
+    timer.addBytesRead(size);
+    int file_channels = 0;
+    image.pixels = stbi_load_from_memory(data, size, &image.width, &image.height, &file_channels, desired_channels);
+    image.channels = desired_channels ? desired_channels : file_channels;
     
-    int width, height, nrChannels;
-    unsigned char* image_data = stbi_load_from_memory(data, size, &width, &height, &nrChannels, 0);
+    if (!image.pixels) printf("Failed to load texture from memory\n");
+    return image;
+}
+
+ImageData decodeImageFromARGB(const aiTexel* data, unsigned int width, unsigned int height) {
+    if (!data) return ImageData();
     
-    if (image_data) {
-        GLenum format = (nrChannels == 4) ? GL_RGBA : (nrChannels == 3) ? GL_RGB : GL_RED;
-        
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, image_data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        
-        stbi_image_free(image_data);
-    } else {
-        printf("Failed to load texture from memory\n");
-        return default_texture_id;
+    // Convert ARGB to RGBA
+    ImageData image = ImageData::allocate(width, height, 4);
+    for (unsigned int i = 0; i < width * height; ++i) {
+        image.pixels[i * 4 + 0] = data[i].r;
+        image.pixels[i * 4 + 1] = data[i].g;
+        image.pixels[i * 4 + 2] = data[i].b;
+        image.pixels[i * 4 + 3] = data[i].a;
     }
-    
+    return image;
+}
+
+// ============================================================================
+// GL UPLOAD (GL thread only)
+// ============================================================================
+
+GLenum imageInternalFormat(const ImageData& image) {
+    if (image.isCompressed()) {
+        const GLenum srgb = image.srgb ? srgbFormat(image.compressed_format) : 0;
+        return srgb ? srgb : image.compressed_format;
+    }
+    if (image.hasMipChain() || image.channels == 4) return image.srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    if (image.channels == 3) return image.srgb ? GL_SRGB8 : GL_RGB8;
+    // No sized sRGB formats with fewer channels, greyscale stays linear
+    return image.channels == 2 ? GL_RG8 : GL_R8;
+}
+
+static GLsizei fullMipCount(int width, int height) {
+    return 1 + (GLsizei)std::floor(std::log2((float)std::max(width, height)));
+}
+
+// Uploads the pre-built mip chain as-is, no glGenerateMipmap
+static GLuint uploadMipChain(const ImageData& image, const SamplerDesc& sampler) {
+    LoadTimer timer(LOAD_STAGE_TEXTURE_UPLOAD);
+    const GLenum internal_format = imageInternalFormat(image);
+    GLsizei level_count = sampler.mipmaps ? (GLsizei)image.levels.size() : 1;
+    const GLuint textureID = createTexture2D(level_count, internal_format, image.width, image.height);
+    uint64_t bytes = 0;
+    for (GLsizei level = 0; level < level_count; ++level) {
+        int w = std::max(1, image.width >> level);
+        int h = std::max(1, image.height >> level);
+        const GLsizei size = (GLsizei)image.levels[level].size();
+        if (image.isCompressed()) {
+            uploadCompressedTexture2D(textureID, level, internal_format, w, h, size, image.levels[level].data());
+        } else {
+            uploadTexture2D(textureID, level, internal_format, w, h, GL_RGBA, GL_UNSIGNED_BYTE, image.levels[level].data());
+        }
+        bytes += image.isCompressed() ? (uint64_t)size : textureLevelBytes(internal_format, w, h);
+    }
+    // Named by the texture cache when it takes the texture in
+    gpu_memory.trackTexture(textureID, bytes, GPU_MEMORY_TEXTURES, std::string());
+    timer.addBytesUploaded(bytes);
+    setTextureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+
+    GLint min_filter = sampler.min_filter;
+    if (level_count == 1 && min_filter != GL_NEAREST && min_filter != GL_LINEAR) min_filter = GL_LINEAR;
+    setTextureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.wrap_s);
+    setTextureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.wrap_t);
+    setTextureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+    setTextureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampler.mag_filter);
+
     return textureID;
 }
 
-GLuint loadTextureFromARGB(aiTexel* data, unsigned int width, unsigned int height) {
-    if (!data) return default_texture_id;
+GLuint uploadImage(const ImageData& image, const SamplerDesc& sampler) {
+    if (!image.valid()) return default_texture_id;
+    if (image.hasMipChain()) return uploadMipChain(image, sampler);
     
-    GLuint textureID = 0;
-    glGenTextures(1, &textureID);
+    LoadTimer timer(LOAD_STAGE_TEXTURE_UPLOAD);
     
-    // Convert ARGB to RGBA
-    unsigned char* rgba_data = new unsigned char[width * height * 4];
-    for (unsigned int i = 0; i < width * height; ++i) {
-        rgba_data[i * 4 + 0] = data[i].r;
-        rgba_data[i * 4 + 1] = data[i].g;
-        rgba_data[i * 4 + 2] = data[i].b;
-        rgba_data[i * 4 + 3] = data[i].a;
+    // Sized, so RGB and greyscale images aren't left to the driver to pad out
+    GLenum internal_format = imageInternalFormat(image);
+    GLenum format = image.channels == 4 ? GL_RGBA : image.channels == 3 ? GL_RGB : image.channels == 2 ? GL_RG : GL_RED;
+    const unsigned char* pixels = image.pixels;
+#ifdef __EMSCRIPTEN__
+    // SRGB8 isn't renderable in WebGL2, so it can't have its mips generated
+    std::vector<unsigned char> expanded;
+    if (internal_format == GL_SRGB8 && sampler.mipmaps) {
+        expanded.resize((size_t)image.width * image.height * 4);
+        for (size_t i = 0; i < (size_t)image.width * image.height; ++i) {
+            expanded[i * 4 + 0] = pixels[i * 3 + 0];
+            expanded[i * 4 + 1] = pixels[i * 3 + 1];
+            expanded[i * 4 + 2] = pixels[i * 3 + 2];
+            expanded[i * 4 + 3] = 255;
+        }
+        internal_format = GL_SRGB8_ALPHA8;
+        format = GL_RGBA;
+        pixels = expanded.data();
     }
+#endif
     
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba_data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    // Immutable where there's texture storage, the whole chain in one allocation
+    const GLuint textureID = createTexture2D(sampler.mipmaps ? fullMipCount(image.width, image.height) : 1, internal_format,
+                                             image.width, image.height);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // RGB and RG rows needn't be 4-byte aligned
+    uploadTexture2D(textureID, 0, internal_format, image.width, image.height, format, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    timer.addBytesUploaded(textureLevelBytes(internal_format, image.width, image.height));
+    if (sampler.mipmaps) {
+        LoadTimer mipmaps(LOAD_STAGE_GENERATE_MIPMAP);
+        generateTextureMipmap(textureID, GL_TEXTURE_2D);
+    }
+    gpu_memory.trackTexture(textureID, sampler.mipmaps ? textureMipChainBytes(internal_format, image.width, image.height)
+                                                      : textureLevelBytes(internal_format, image.width, image.height),
+                            GPU_MEMORY_TEXTURES, std::string());
     
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Set texture parameters
+    setTextureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.wrap_s);
+    setTextureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.wrap_t);
+    setTextureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampler.min_filter);
+    setTextureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampler.mag_filter);
     
-    delete[] rgba_data;
     return textureID;
 }
 
+GLuint loadTexture(const std::string& path) {
+    std::string key = TextureCache::fileKey(path, SamplerDesc());
+    GLuint cached = texture_cache.acquire(key);
+    if (cached != 0) return cached;
+    return texture_cache.insert(key, uploadImage(decodeImage(path)));
+}
+
+GLuint loadTextureFromMemory(unsigned char* data, unsigned int size) {
+    return uploadImage(decodeImageFromMemory(data, size));
+}
+
+GLuint loadTextureFromARGB(aiTexel* data, unsigned int width, unsigned int height) {
+    return uploadImage(decodeImageFromARGB(data, width, height));
+}
+
+// Faces must decode to linear when sampled, a cube whose format has no sRGB twin here is skipped
+static bool srgbCubeFaces(const ImageData faces[6]) {
+    for (int i = 0; i < 6; ++i) {
+        if (!faces[i].valid() || faces[i].width != faces[0].width || faces[i].width != faces[i].height ||
+            faces[i].compressed_format != faces[0].compressed_format || faces[i].levels.size() != faces[0].levels.size()) return false;
+    }
+    return !faces[0].isCompressed() || srgbFormat(faces[0].compressed_format) != 0;
+}
+
 GLuint loadCubemap(const char* faces[6]) {
+    LoadAssetScope asset(faces[0]);
+    // Cooked as one KTX2 next to the first face, like loadTextureImage() does per texture
+    const std::string cooked_path = std::string(faces[0]) + ".cube.ktx2";
+    ImageData images[6];
+    bool loaded = false;
+    if (use_texture_compression) {
+        int64_t source_mtime = 0;
+        for (int i = 0; i < 6; ++i) source_mtime = std::max(source_mtime, getFileModifiedTime(faces[i]));
+        for (const char* suffix : {".cube.ktx2", ".etc2.cube.ktx2", ".astc.cube.ktx2"}) {
+            std::string ktx_path = std::string(faces[0]) + suffix;
+            int64_t ktx_mtime = getFileModifiedTime(ktx_path);
+            if (ktx_mtime == 0 || ktx_mtime < source_mtime) continue;
+            if (!readKTX2Cubemap(ktx_path, images) || !srgbCubeFaces(images) ||
+                (images[0].isCompressed() && !isCompressedFormatSupported(images[0].compressed_format))) continue;
+            printf("Loaded compressed cubemap: %s\n", ktx_path.c_str());
+            loaded = true;
+            break;
+        }
+    }
+
+    if (!loaded) {
+        for (int i = 0; i < 6; ++i) {
+            images[i] = decodeImage(faces[i], 4);
+            if (!images[i].valid()) printf("Failed to load cubemap face: %s\n", faces[i]);
+        }
+#ifndef __EMSCRIPTEN__
+        // Cook on desktop only, the web build just picks up what was shipped
+        if (use_texture_compression && srgbCubeFaces(images)) {
+            ImageData compressed[6];
+            for (int i = 0; i < 6; ++i) compressed[i] = compressImage(images[i], TEXTURE_USAGE_COLOR);
+            if (srgbCubeFaces(compressed)) {
+                if (writeKTX2Cubemap(cooked_path, compressed)) printf("Cooked cubemap: %s\n", cooked_path.c_str());
+                for (int i = 0; i < 6; ++i) images[i] = std::move(compressed[i]);
+            }
+        }
+#endif
+    }
+
+    LoadTimer timer(LOAD_STAGE_TEXTURE_UPLOAD);
     GLuint textureID = 0;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-    
-    for (unsigned int i = 0; i < 6; ++i) {
-        int width, height, nrChannels;
-        unsigned char* data = stbi_load(faces[i], &width, &height, &nrChannels, 0);
-        
-        if (data) {
-            GLenum format = (nrChannels == 4) ? GL_RGBA : (nrChannels == 3) ? GL_RGB : GL_RED;
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        } else {
-            printf("Failed to load cubemap face: %s\n", faces[i]);
+
+    // sRGB formats, so filtering and the IBL prefilter both see linear colour
+    int level_count = 1;
+    uint64_t bytes = 0;
+    if (srgbCubeFaces(images) && images[0].isCompressed()) {
+        const GLenum format = srgbFormat(images[0].compressed_format);
+        level_count = (int)images[0].levels.size();
+        for (int face = 0; face < 6; ++face) {
+            for (int level = 0; level < level_count; ++level) {
+                const int size = std::max(1, images[face].width >> level);
+                glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, format, size, size, 0,
+                                       (GLsizei)images[face].levels[level].size(), images[face].levels[level].data());
+                bytes += images[face].levels[level].size();
+            }
+        }
+        timer.addBytesUploaded(bytes);
+    } else {
+        for (int face = 0; face < 6; ++face) {
+            if (!images[face].valid() || images[face].hasMipChain()) continue;
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_SRGB8_ALPHA8, images[face].width, images[face].height, 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, images[face].pixels);
+            bytes += textureLevelBytes(GL_SRGB8_ALPHA8, images[face].width, images[face].height);
+        }
+        timer.addBytesUploaded(bytes);
+        // Once here, the IBL prefilter reads the same chain
+        if (srgbCubeFaces(images)) {
+            LoadTimer mipmaps(LOAD_STAGE_GENERATE_MIPMAP);
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+            level_count = 1 + (int)std::floor(std::log2((float)images[0].width));
+            bytes = 6 * textureMipChainBytes(GL_SRGB8_ALPHA8, images[0].width, images[0].height);
         }
     }
-    
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    gpu_memory.trackTexture(textureID, bytes, GPU_MEMORY_SKYBOX, faces[0]);
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, level_count > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    
+
     return textureID;
 }
@@ -0,0 +1,152 @@
+#include "texture_residency.h"
+#include "texture_streamer.h"
+#include "texture_loader.h"
+#include "gpu_memory.h"
+#include "material.h"
+
+#include <algorithm>
+#include <cmath>
+
+TextureResidency texture_residency;
+bool use_texture_residency = true;
+uint64_t texture_residency_budget = TEXTURE_RESIDENCY_DEFAULT_BUDGET;
+
+uint64_t TextureResidency::levelBytes(const Managed& entry, int level) const {
+    const ImageData& image = *entry.image;
+    if (image.isCompressed()) return image.levels[level].size();
+    return textureLevelBytes(entry.internal_format, std::max(1, image.width >> level), std::max(1, image.height >> level));
+}
+
+uint64_t TextureResidency::bytesFrom(const Managed& entry, int level) const {
+    uint64_t bytes = 0;
+    for (int i = level; i < (int)entry.image->levels.size(); ++i) bytes += levelBytes(entry, i);
+    return bytes;
+}
+
+void TextureResidency::manage(GLuint texture, std::shared_ptr<ImageData> image, GLenum internal_format, int resident_level) {
+    forget(texture);
+    Managed& entry = textures[texture];
+    entry.image = std::move(image);
+    entry.internal_format = internal_format;
+    entry.tail = resident_level;
+    entry.resident = resident_level;
+    entry.target = resident_level;
+    resident_bytes += bytesFrom(entry, resident_level);
+}
+
+void TextureResidency::forget(GLuint texture) {
+    auto it = textures.find(texture);
+    if (it == textures.end()) return;
+    resident_bytes -= bytesFrom(it->second, it->second.resident);
+    textures.erase(it);
+}
+
+void TextureResidency::noteUsage(GLuint texture, float pixels) {
+    if (texture == 0) return;
+    auto it = textures.find(texture);
+    if (it == textures.end()) return;
+    Managed& entry = it->second;
+    if (entry.last_seen != frame) entry.pixels = 0.0f;
+    entry.pixels = std::max(entry.pixels, pixels);
+    entry.last_seen = frame;
+    entry.seen = true;
+}
+
+void TextureResidency::noteMaterial(const Material& material, float pixels) {
+    noteUsage(material.albedo_map, pixels);
+    noteUsage(material.normal_map, pixels);
+    noteUsage(material.orm_map, pixels);
+    noteUsage(material.emissive_map, pixels);
+}
+
+void TextureResidency::evict(GLuint texture, Managed& entry, int level) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    // Respecified as 0x0 the driver can free the level, immutable storage couldn't
+    for (int i = entry.resident; i < level; ++i) {
+        if (entry.image->isCompressed()) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, entry.internal_format, 0, 0, 0, 0, nullptr);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, i, entry.internal_format, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+    resident_bytes -= bytesFrom(entry, entry.resident) - bytesFrom(entry, level);
+    evicted_levels += level - entry.resident;
+    entry.resident = level;
+    gpu_memory.resizeTexture(texture, bytesFrom(entry, level));
+}
+
+void TextureResidency::update(size_t budget_bytes) {
+    const uint64_t now = frame++;
+    if (textures.empty() || !use_texture_residency) return;
+
+    // Targets from the sizes noted last frame, unseen textures drop to their tail after a grace period
+    auto recent = [now](const Managed& entry) { return entry.seen && now - entry.last_seen <= TEXTURE_RESIDENCY_GRACE_FRAMES; };
+    order.clear();
+    for (auto& [texture, entry] : textures) {
+        entry.target = entry.tail;
+        if (recent(entry) && entry.pixels > 0.0f) {
+            const int size = std::max(entry.image->width, entry.image->height);
+            const float lod = std::log2(size / entry.pixels) - TEXTURE_RESIDENCY_BIAS;
+            int wanted = std::clamp((int)std::floor(lod), 0, entry.tail);
+            // Half a level of slack, so a size hovering at a boundary doesn't evict and reload
+            if (wanted == entry.resident + 1 && lod < wanted + 0.5f) wanted = entry.resident;
+            entry.target = wanted;
+        }
+        order.push_back(texture);
+    }
+    // Largest on screen first, unseen textures last
+    std::sort(order.begin(), order.end(), [&](GLuint a, GLuint b) {
+        const Managed& ea = textures.at(a);
+        const Managed& eb = textures.at(b);
+        const bool ra = recent(ea), rb = recent(eb);
+        if (ra != rb) return ra;
+        if (ea.pixels != eb.pixels) return ea.pixels > eb.pixels;
+        return a < b;
+    });
+
+    // Tails always stay, the finer levels go to the highest priorities until the budget runs out
+    uint64_t total = 0;
+    for (GLuint texture : order) {
+        const Managed& entry = textures.at(texture);
+        total += bytesFrom(entry, entry.tail);
+    }
+    for (GLuint texture : order) {
+        Managed& entry = textures.at(texture);
+        const uint64_t tail_bytes = bytesFrom(entry, entry.tail);
+        uint64_t extra = bytesFrom(entry, entry.target) - tail_bytes;
+        while (entry.target < entry.tail && total + extra > texture_residency_budget) {
+            entry.target++;
+            extra = bytesFrom(entry, entry.target) - tail_bytes;
+        }
+        total += extra;
+    }
+    target_bytes = total;
+
+    // Freeing is just respecification, lowest priority first
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        Managed& entry = textures.at(*it);
+        if (entry.resident < entry.target) evict(*it, entry, entry.target);
+    }
+
+    // One level per texture per pass, highest priority first, through the streamer's ring
+    size_t spent = 0;
+    bool progressed = true;
+    while (progressed) {
+        progressed = false;
+        for (GLuint texture : order) {
+            Managed& entry = textures.at(texture);
+            if (entry.resident <= entry.target) continue;
+            const int level = entry.resident - 1;
+            const uint64_t bytes = levelBytes(entry, level);
+            if (spent > 0 && spent + bytes > budget_bytes) return;
+            if (!texture_streamer.streamLevel(texture, *entry.image, level, true)) return;
+
+            entry.resident = level;
+            resident_bytes += bytes;
+            gpu_memory.resizeTexture(texture, bytesFrom(entry, level));
+            spent += bytes;
+            progressed = true;
+        }
+    }
+}
@@ -0,0 +1,269 @@
+#include "texture_streamer.h"
+#include "texture_loader.h"
+#include "gl_extensions.h"
+#include "trace_capture.h"
+#include "gpu_memory.h"
+#include "load_stats.h"
+#include "texture_residency.h"
+#include "upload_context.h"
+
+#include <algorithm>
+#include <cstring>
+
+TextureStreamer texture_streamer;
+bool use_texture_streaming = true;
+
+static int levelWidth(const ImageData& image, int level) { return std::max(1, image.width >> level); }
+static int levelHeight(const ImageData& image, int level) { return std::max(1, image.height >> level); }
+
+void TextureStreamer::init() {
+    if (!ring.empty()) return;
+    ring.resize(TEXTURE_STREAM_RING_SLOTS);
+    for (auto& slot : ring) glGenBuffers(1, &slot.pbo);
+}
+
+void TextureStreamer::shutdown() {
+    for (auto& slot : ring) {
+        if (slot.fence) glDeleteSync(slot.fence);
+        if (slot.pbo) {
+            gpu_memory.releaseBuffer(slot.pbo);
+            glDeleteBuffers(1, &slot.pbo);
+        }
+    }
+    ring.clear();
+    pending.clear();
+    background.clear();
+}
+
+GLuint TextureStreamer::upload(ImageData&& image, const SamplerDesc& sampler) {
+    if (!image.valid() || !image.hasMipChain()) return uploadImage(image, sampler);
+
+    const int level_count = sampler.mipmaps ? (int)image.levels.size() : 1;
+    const GLenum internal_format = imageInternalFormat(image);
+
+    // Mapped KTX2 chains go to the residency manager: mutable storage holding only the tail,
+    // finer levels are allocated and freed as the screen asks for them
+    const bool managed = use_texture_residency && image.mapping && level_count > 1;
+
+    // The tail is uploaded straight away, the rest streams in
+    int first_streamed = level_count;
+    for (int level = level_count - 1; level >= 0; --level) {
+        if (std::max(levelWidth(image, level), levelHeight(image, level)) > TEXTURE_STREAM_TAIL_SIZE && level != level_count - 1) break;
+        first_streamed = level;
+    }
+
+    LoadTimer timer(LOAD_STAGE_TEXTURE_UPLOAD);
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    // Storage for the whole chain up front, contents arrive level by level
+    const int first_allocated = managed ? first_streamed : 0;
+    uint64_t bytes = 0;
+    for (int level = first_allocated; level < level_count; ++level) {
+        bytes += image.isCompressed() ? image.levels[level].size()
+                                      : textureLevelBytes(internal_format, levelWidth(image, level), levelHeight(image, level));
+    }
+    gpu_memory.trackTexture(texture, bytes, GPU_MEMORY_TEXTURES, std::string());
+    timer.addBytesUploaded(bytes); // Streamed levels land over the next frames, counted here all the same
+    if (gl_extensions.texture_storage && !managed) {
+        gl_extensions.TexStorage2D(GL_TEXTURE_2D, level_count, internal_format, image.width, image.height);
+    } else {
+        for (int level = first_allocated; level < level_count; ++level) {
+            int w = levelWidth(image, level), h = levelHeight(image, level);
+            if (image.isCompressed()) {
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, w, h, 0, (GLsizei)image.levels[level].size(), nullptr);
+            } else {
+                glTexImage2D(GL_TEXTURE_2D, level, internal_format, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            }
+        }
+    }
+
+    // Upload the tail straight from client memory
+    for (int level = level_count - 1; level >= first_streamed; --level) {
+        int w = levelWidth(image, level), h = levelHeight(image, level);
+        if (image.isCompressed()) {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, internal_format,
+                                      (GLsizei)image.levels[level].size(), image.levels[level].data());
+        } else {
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, image.levels[level].data());
+        }
+    }
+
+    // Only sample what is resident; update() lowers the base level as data lands
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first_streamed);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+
+    GLint min_filter = sampler.min_filter;
+    if (level_count == 1 && min_filter != GL_NEAREST && min_filter != GL_LINEAR) min_filter = GL_LINEAR;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.wrap_s);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.wrap_t);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampler.mag_filter);
+
+    if (managed) {
+        // Every level stays a view into the mapping, any of them can be streamed again later
+        texture_residency.manage(texture, std::make_shared<ImageData>(std::move(image)), internal_format, first_streamed);
+    } else if (first_streamed > 0) {
+        PendingTexture entry;
+        entry.texture = texture;
+        entry.image = std::make_shared<ImageData>(std::move(image));
+        entry.next_level = first_streamed - 1;
+        entry.image->levels.resize(first_streamed); // Tail is resident, free its copies
+        pending.push_back(std::move(entry));
+    }
+
+    return texture;
+}
+
+TextureStreamer::RingSlot* TextureStreamer::acquireSlot() {
+    if (ring.empty()) init();
+
+    RingSlot& slot = ring[next_slot];
+    if (slot.fence) {
+        GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) return nullptr;
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+    }
+    next_slot = (next_slot + 1) % ring.size();
+    return &slot;
+}
+
+void TextureStreamer::copyLevel(GLuint texture, const ImageData& image, int level, bool allocate, RingSlot& slot) {
+    TRACE_SCOPE("Stream texture level", "assets");
+    const ImageLevel& bytes = image.levels[level]; // Possibly the mapped KTX2 file, copied once into the PBO
+    int w = levelWidth(image, level), h = levelHeight(image, level);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+    if (bytes.size() > slot.capacity) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes.size(), nullptr, GL_STREAM_DRAW);
+        gpu_memory.trackBuffer(slot.pbo, bytes.size(), GPU_MEMORY_STREAMING, "staging ring");
+        slot.capacity = bytes.size();
+    }
+#ifdef __EMSCRIPTEN__
+    glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, bytes.size(), bytes.data());
+#else
+    // The slot's fence has passed, so writing unsynchronized is safe
+    void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes.size(),
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (dst) {
+        memcpy(dst, bytes.data(), bytes.size());
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    } else {
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, bytes.size(), bytes.data());
+    }
+#endif
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    const GLenum internal_format = imageInternalFormat(image);
+    if (allocate) {
+        // Mutable storage: the level is specified along with its contents
+        if (image.isCompressed()) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, w, h, 0, (GLsizei)bytes.size(), nullptr);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, level, internal_format, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+    } else if (image.isCompressed()) {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, internal_format, (GLsizei)bytes.size(), nullptr);
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureStreamer::uploadLevel(PendingTexture& entry, RingSlot& slot) {
+    const int level = entry.next_level;
+    copyLevel(entry.texture, *entry.image, level, false, slot);
+
+    // Streamed data now lives in the PBO, drop the CPU copy
+    entry.image->levels[level] = ImageLevel();
+    --entry.next_level;
+}
+
+bool TextureStreamer::streamLevel(GLuint texture, const ImageData& image, int level, bool allocate) {
+    RingSlot* slot = acquireSlot();
+    if (!slot) return false;
+    copyLevel(texture, image, level, allocate, *slot);
+    return true;
+}
+
+void TextureStreamer::uploadInBackground(const PendingTexture& entry) {
+    auto state = std::make_shared<BackgroundTexture>();
+    background[entry.texture] = state;
+    const GLuint texture = entry.texture;
+    const std::shared_ptr<ImageData> image = entry.image;
+    for (int level = entry.next_level; level >= 0; --level) {
+        upload_context.submit(
+            [state, texture, image, level]() {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (state->cancelled) return;
+                TRACE_SCOPE("Upload texture level", "assets");
+                const ImageLevel& bytes = image->levels[level];
+                const int w = levelWidth(*image, level), h = levelHeight(*image, level);
+                glBindTexture(GL_TEXTURE_2D, texture);
+                if (image->isCompressed()) {
+                    glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, imageInternalFormat(*image),
+                                              (GLsizei)bytes.size(), bytes.data());
+                } else {
+                    glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, bytes.data());
+                }
+                glBindTexture(GL_TEXTURE_2D, 0);
+                image->levels[level] = ImageLevel();
+            },
+            [this, state, texture, level]() {
+                if (state->cancelled) return;
+                glBindTexture(GL_TEXTURE_2D, texture);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+                if (level == 0) background.erase(texture);
+            });
+    }
+}
+
+void TextureStreamer::update(size_t budget_bytes) {
+    // The upload thread takes every queued level at once, the frame's budget no longer applies
+    if (upload_context.active()) {
+        for (const PendingTexture& entry : pending) uploadInBackground(entry);
+        pending.clear();
+        return;
+    }
+
+    size_t spent = 0;
+    bool progressed = true;
+
+    // One level per texture per pass, so every queued texture sharpens at a similar rate
+    while (!pending.empty() && progressed) {
+        progressed = false;
+        for (auto it = pending.begin(); it != pending.end();) {
+            size_t bytes = it->image->levels[it->next_level].size();
+            if (spent > 0 && spent + bytes > budget_bytes) return;
+
+            RingSlot* slot = acquireSlot();
+            if (!slot) return;
+
+            uploadLevel(*it, *slot);
+            spent += bytes;
+            progressed = true;
+
+            if (it->next_level < 0) it = pending.erase(it);
+            else ++it;
+        }
+    }
+}
+
+void TextureStreamer::cancel(GLuint texture) {
+    texture_residency.forget(texture);
+    auto it = background.find(texture);
+    if (it != background.end()) {
+        const std::shared_ptr<BackgroundTexture> state = it->second;
+        background.erase(it);
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cancelled = true;
+    }
+    pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                 [texture](const PendingTexture& entry) { return entry.texture == texture; }),
+                  pending.end());
+}
@@ -0,0 +1,143 @@
+#include "trace_capture.h"
+#include "gl_extensions.h"
+#include "gpu_queries.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+TraceCapture trace_capture;
+
+#define TRACE_GPU_TRACK -1 // Events on the GPU process' one track instead of a thread's
+
+// The calling thread's track, handed out on first use
+static int threadTrack() {
+    static std::atomic<int> next_track{0};
+    static thread_local int track = next_track.fetch_add(1);
+    return track;
+}
+
+double TraceCapture::sinceEpoch(Clock::time_point time) const {
+    return std::chrono::duration<double, std::micro>(time - epoch).count();
+}
+
+bool TraceCapture::start(const std::string& path, int frames) {
+    if (capturing()) return false;
+    if (!registered) {
+        profiler.addFrameCallback([this](const FrameProfiler::Frame& frame) { profiledFrame(frame); });
+        registered = true;
+    }
+    use_profiler = true;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    events.clear();
+    output_file = path;
+    frames_wanted = std::max(1, frames);
+    first_frame = gpu_queries.frame() + 1;
+    last_frame = first_frame + frames_wanted - 1;
+
+    // Both clocks read back to back, the GPU's queued behind nothing but what's submitted
+    gpu_epoch_ns = 0;
+    if (gl_extensions.timestamp_query) {
+        GLint64 gpu_now = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+        gpu_epoch_ns = (uint64_t)gpu_now;
+    }
+    epoch = Clock::now();
+    active.store(true, std::memory_order_relaxed);
+    printf("Trace: capturing %d frames to %s\n", frames_wanted, output_file.c_str());
+    return true;
+}
+
+void TraceCapture::event(const char* name, const char* category, Clock::time_point start, Clock::time_point end,
+                         const std::string& detail) {
+    if (!capturing()) return;
+    const int track = threadTrack();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (start < epoch) start = epoch;
+    events.push_back({ name, category, track, sinceEpoch(start), std::chrono::duration<double, std::micro>(end - start).count(), detail });
+}
+
+void TraceCapture::nameThread(const std::string& name) {
+    const int track = threadTrack();
+    std::lock_guard<std::mutex> lock(mutex);
+    if ((int)thread_names.size() <= track) thread_names.resize(track + 1);
+    thread_names[track] = name;
+}
+
+void TraceCapture::profiledFrame(const FrameProfiler::Frame& frame) {
+    if (!capturing() || frame.id < first_frame) return;
+    const int track = threadTrack(); // Callbacks run on the profiler's thread
+    const std::string id = std::to_string(frame.id);
+    const double start_us = sinceEpoch(frame.start);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back({ "Frame", "frame", track, start_us, frame.cpu_ms * 1000.0, id });
+        for (const FrameProfiler::Scope& scope : frame.scopes) {
+            events.push_back({ scope.name, "cpu", track, start_us + scope.cpu_start_ms * 1000.0, scope.cpu_ms * 1000.0, std::string() });
+        }
+        if (gpu_epoch_ns != 0 && frame.gpu_start_ns != 0) {
+            const double gpu_start_us = (double)(int64_t)(frame.gpu_start_ns - gpu_epoch_ns) / 1000.0;
+            events.push_back({ "Frame", "frame", TRACE_GPU_TRACK, gpu_start_us, frame.gpu_ms * 1000.0, id });
+            for (const FrameProfiler::Scope& scope : frame.scopes) {
+                if (scope.gpu_ms < 0.0) continue;
+                events.push_back({ scope.name, "gpu", TRACE_GPU_TRACK, gpu_start_us + scope.gpu_start_ms * 1000.0,
+                                   scope.gpu_ms * 1000.0, std::string() });
+            }
+        }
+    }
+    if (frame.id < last_frame) return;
+
+    // Other threads kept going while the last frame's GPU times came back
+    active.store(false, std::memory_order_relaxed);
+    const double end_us = start_us + frame.cpu_ms * 1000.0;
+    std::lock_guard<std::mutex> lock(mutex);
+    events.erase(std::remove_if(events.begin(), events.end(), [&](const Event& event) {
+        return event.thread != TRACE_GPU_TRACK && event.start_us > end_us;
+    }), events.end());
+    write();
+    events.clear();
+}
+
+static std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        if ((unsigned char)c >= 0x20) quoted += c;
+    }
+    return quoted + "\"";
+}
+
+bool TraceCapture::write() {
+    std::ofstream out(output_file, std::ios::trunc);
+    if (!out) {
+        printf("Trace: can't write %s\n", output_file.c_str());
+        return false;
+    }
+
+    // CPU threads are process 1, the GPU process 2, tids count from 1
+    int tracks = (int)thread_names.size();
+    for (const Event& event : events) tracks = std::max(tracks, event.thread + 1);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+    out << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":2,\"tid\":0,\"args\":{\"name\":\"GPU\"}},\n";
+    out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":2,\"tid\":1,\"args\":{\"name\":\"Timestamps\"}}";
+    for (int track = 0; track < tracks; ++track) {
+        const bool named = track < (int)thread_names.size() && !thread_names[track].empty();
+        const std::string name = named ? thread_names[track] : "Thread " + std::to_string(track + 1);
+        out << ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << track + 1
+            << ",\"args\":{\"name\":" << jsonString(name) << "}}";
+    }
+    char timing[96];
+    for (const Event& event : events) {
+        const bool gpu = event.thread == TRACE_GPU_TRACK;
+        snprintf(timing, sizeof(timing), "\"ts\":%.3f,\"dur\":%.3f", event.start_us, event.duration_us);
+        out << ",\n{\"ph\":\"X\",\"name\":" << jsonString(event.name) << ",\"cat\":\"" << event.category << "\","
+            << timing << ",\"pid\":" << (gpu ? 2 : 1) << ",\"tid\":" << (gpu ? 1 : event.thread + 1);
+        if (!event.detail.empty()) out << ",\"args\":{\"detail\":" << jsonString(event.detail) << "}";
+        out << "}";
+    }
+    out << "\n]}\n";
+    printf("Trace: %zu events over %d frames written to %s\n", events.size(), frames_wanted, output_file.c_str());
+    return true;
+}
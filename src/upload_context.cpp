@@ -0,0 +1,121 @@
+#include "upload_context.h"
+
+#include <GLFW/glfw3.h>
+#include <cstdio>
+#include <string>
+
+UploadContext upload_context;
+
+int UploadContext::parseArg(int argc, char** argv, int i) {
+    (void)argc;
+    if (std::string(argv[i]) != "--upload-thread") return 0;
+    enabled = true;
+    return 1;
+}
+
+bool UploadContext::init(GLFWwindow* window) {
+    if (!enabled || active()) return false;
+#ifdef __EMSCRIPTEN__
+    (void)window;
+    printf("No shared contexts on WebGL, textures keep streaming on the GL thread\n");
+    return false;
+#else
+    // The window hints still ask for the window's version and profile
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    context = glfwCreateWindow(1, 1, "uploads", nullptr, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (!context) {
+        printf("Could not create a shared GL context, textures keep streaming on the GL thread\n");
+        return false;
+    }
+    stopping = false;
+    thread = std::thread(&UploadContext::threadMain, this);
+    printf("Upload thread: streamed texture levels upload on a shared context\n");
+    return true;
+#endif
+}
+
+void UploadContext::shutdown() {
+    if (!active()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+
+    for (Job& job : finished) glDeleteSync(job.fence);
+    finished.clear();
+    queued.clear();
+    submitted.clear();
+    in_flight = 0;
+#ifndef __EMSCRIPTEN__
+    glfwDestroyWindow(context);
+#endif
+    context = nullptr;
+}
+
+void UploadContext::submit(std::function<void()> job, std::function<void()> done) {
+    Job entry;
+    entry.run = std::move(job);
+    entry.done = std::move(done);
+    submitted.push_back(std::move(entry));
+    in_flight++;
+}
+
+void UploadContext::update() {
+    if (!active()) return;
+
+    std::vector<Job> signalled;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // The thread fences its jobs in order, the first one still pending holds back the rest
+        while (!finished.empty()) {
+            const GLenum status = glClientWaitSync(finished.front().fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED) break;
+            signalled.push_back(std::move(finished.front()));
+            finished.pop_front();
+        }
+    }
+
+    if (!submitted.empty()) {
+        // Whatever this thread did to the jobs' objects reaches the shared context with the flush
+        glFlush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Job& job : submitted) queued.push_back(std::move(job));
+        }
+        submitted.clear();
+        wake.notify_one();
+    }
+
+    for (Job& job : signalled) {
+        glDeleteSync(job.fence);
+        if (job.done) job.done();
+        in_flight--;
+    }
+}
+
+void UploadContext::threadMain() {
+#ifndef __EMSCRIPTEN__
+    glfwMakeContextCurrent(context);
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [this] { return stopping || !queued.empty(); });
+        if (stopping) break;
+        Job job = std::move(queued.front());
+        queued.pop_front();
+        lock.unlock();
+
+        job.run();
+        job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        // The GL thread waits on the fence, it has to reach the GPU
+        glFlush();
+
+        lock.lock();
+        finished.push_back(std::move(job));
+    }
+    lock.unlock();
+    glfwMakeContextCurrent(nullptr);
+#endif
+}
@@ -0,0 +1,175 @@
+#include "vertex_pulling.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "gpu_memory.h"
+#include "mesh.h"
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+bool use_vertex_pulling = true;
+
+VertexPulling vertex_pulling;
+
+namespace {
+
+// Copies the used prefix of a storage buffer into a larger one, returns the new buffer
+GLuint growBuffer(GLuint old_buffer, size_t old_bytes, size_t new_bytes, const char* asset) {
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, new_bytes, nullptr, GL_STATIC_DRAW);
+    gpu_memory.trackBuffer(buffer, new_bytes, GPU_MEMORY_GEOMETRY, asset);
+    if (old_buffer != 0 && old_bytes > 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, old_buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_bytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if (old_buffer != 0) {
+        gpu_memory.releaseBuffer(old_buffer);
+        glDeleteBuffers(1, &old_buffer);
+    }
+    return buffer;
+}
+
+} // namespace
+
+int VertexPulling::parseArg(int argc, char** argv, int i) {
+    (void)argc;
+    if (std::string(argv[i]) != "--vertex-pulling") return 0;
+    enabled = true;
+    return 1;
+}
+
+bool VertexPulling::supported() {
+    if (!gl_extensions.multi_draw_indirect || !gl_extensions.compute_shader || !gl_extensions.shader_draw_parameters) return false;
+    // GL 4.3 only promises storage blocks to compute and fragment shaders
+    GLint blocks = 0;
+    glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &blocks);
+    return blocks >= 4;
+}
+
+bool VertexPulling::init() {
+    if (!enabled) return false;
+    if (!supported()) {
+        printf("Vertex pulling needs GL 4.3 with ARB_shader_draw_parameters and vertex storage buffers, keeping VAOs\n");
+        return false;
+    }
+    glGenVertexArrays(1, &vao);
+    growVertices(VERTEX_PULL_INITIAL_VERTICES);
+    growIndices(VERTEX_PULL_INITIAL_INDICES);
+    printf("Vertex pulling: depth passes fetch from storage buffers\n");
+    return true;
+}
+
+void VertexPulling::release() {
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+    vao = 0;
+    for (GLuint* buffer : { &position_buffer, &uv_buffer, &index_buffer }) {
+        if (*buffer == 0) continue;
+        gpu_memory.releaseBuffer(*buffer);
+        glDeleteBuffers(1, buffer);
+        *buffer = 0;
+    }
+    vertex_ranges = RangeAllocator();
+    index_ranges = RangeAllocator();
+}
+
+void VertexPulling::growVertices(size_t min_vertices) {
+    const size_t old_capacity = vertex_ranges.capacity();
+    const size_t capacity = std::max(old_capacity * 2, min_vertices);
+    position_buffer = growBuffer(position_buffer, old_capacity * sizeof(glm::vec3), capacity * sizeof(glm::vec3), "pulled positions");
+    uv_buffer = growBuffer(uv_buffer, old_capacity * sizeof(glm::vec2), capacity * sizeof(glm::vec2), "pulled uvs");
+    vertex_ranges.grow(capacity);
+}
+
+void VertexPulling::growIndices(size_t min_indices) {
+    const size_t old_capacity = index_ranges.capacity();
+    const size_t capacity = std::max(old_capacity * 2, min_indices);
+    index_buffer = growBuffer(index_buffer, old_capacity * sizeof(uint32_t), capacity * sizeof(uint32_t), "pulled indices");
+    index_ranges.grow(capacity);
+}
+
+bool VertexPulling::add(const VertexLayout& layout, const void* vertices, size_t vertex_count, const void* indices, GLenum index_type,
+                        size_t index_count, PulledGeometry& geometry) {
+    geometry = PulledGeometry();
+    if (!pooling() || vertex_count == 0 || index_count == 0) return false;
+
+    size_t first_vertex = 0, first_index = 0;
+    if (!vertex_ranges.allocate(vertex_count, first_vertex)) {
+        growVertices(vertex_ranges.capacity() + vertex_count);
+        if (!vertex_ranges.allocate(vertex_count, first_vertex)) return false;
+    }
+    if (!index_ranges.allocate(index_count, first_index)) {
+        growIndices(index_ranges.capacity() + index_count);
+        if (!index_ranges.allocate(index_count, first_index)) {
+            vertex_ranges.free({first_vertex, vertex_count});
+            return false;
+        }
+    }
+
+    // Every layout leads with the float position, UVs are decoded from either width
+    const unsigned char* src = static_cast<const unsigned char*>(vertices);
+    std::vector<glm::vec3> positions(vertex_count);
+    std::vector<glm::vec2> uvs(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v, src += layout.stride) {
+        memcpy(&positions[v], src, sizeof(glm::vec3));
+        if (layout.format & VERTEX_HALF_UV) {
+            uint32_t packed;
+            memcpy(&packed, src + layout.uv_offset, sizeof(packed));
+            uvs[v] = glm::unpackHalf2x16(packed);
+        } else {
+            memcpy(&uvs[v], src + layout.uv_offset, sizeof(glm::vec2));
+        }
+    }
+    std::vector<uint32_t> rebased(index_count);
+    for (size_t i = 0; i < index_count; ++i) {
+        const uint32_t index = index_type == GL_UNSIGNED_SHORT ? static_cast<const uint16_t*>(indices)[i]
+                                                               : static_cast<const uint32_t*>(indices)[i];
+        rebased[i] = (uint32_t)first_vertex + index;
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, position_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, first_vertex * sizeof(glm::vec3), vertex_count * sizeof(glm::vec3), positions.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, uv_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, first_vertex * sizeof(glm::vec2), vertex_count * sizeof(glm::vec2), uvs.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, first_index * sizeof(uint32_t), index_count * sizeof(uint32_t), rebased.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    geometry.first_vertex = (uint32_t)first_vertex;
+    geometry.vertex_count = (uint32_t)vertex_count;
+    geometry.first_index = (uint32_t)first_index;
+    geometry.index_count = (uint32_t)index_count;
+    return true;
+}
+
+void VertexPulling::free(PulledGeometry& geometry) {
+    if (pooling() && geometry.index_count != 0) {
+        vertex_ranges.free({geometry.first_vertex, geometry.vertex_count});
+        index_ranges.free({geometry.first_index, geometry.index_count});
+    }
+    geometry = PulledGeometry();
+}
+
+void VertexPulling::bind() const {
+    gl_state.bindVertexArray(vao);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VERTEX_PULL_POSITION_BINDING, position_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VERTEX_PULL_UV_BINDING, uv_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VERTEX_PULL_INDEX_BINDING, index_buffer);
+}
+
+std::string VertexPulling::pulledSource(const std::string& source) {
+    const char* header = "#version 430 core\n"
+                         "#extension GL_ARB_shader_draw_parameters : require\n"
+                         "#define VERTEX_PULLING\n";
+    size_t body = 0;
+    if (source.compare(0, 8, "#version") == 0) {
+        const size_t newline = source.find('\n');
+        body = newline == std::string::npos ? source.size() : newline + 1;
+    }
+    return header + source.substr(body);
+}
@@ -0,0 +1,186 @@
+#include "volumetric_fog.h"
+#include "filesystem.h"
+#include "frame_uniforms.h"
+#include "gl_extensions.h"
+#include "gl_state.h"
+#include "gpu_memory.h"
+#include "light_clusters.h"
+#include "mesh.h" // CullMode
+#include "profiler.h"
+#include "scene_target.h"
+#include "shader_loading.h"
+
+#include <cmath>
+#include <cstdio>
+
+VolumetricFog volumetric_fog;
+bool use_volumetric_fog = true;
+bool use_volumetric_fog_temporal = true;
+float volumetric_fog_density = 0.01f;
+float volumetric_fog_height_falloff = 0.05f;
+float volumetric_fog_anisotropy = 0.4f;
+
+static constexpr UniformId U_SLICE("slice");
+static constexpr UniformId U_SLICE_JITTER("sliceJitter");
+static constexpr UniformId U_DENSITY("density");
+static constexpr UniformId U_HEIGHT_FALLOFF("heightFalloff");
+static constexpr UniformId U_ANISOTROPY("anisotropy");
+static constexpr UniformId U_HISTORY_WEIGHT("historyWeight");
+static constexpr UniformId U_HISTORY_VIEW("historyView");
+static constexpr UniformId U_HISTORY_VIEW_PROJECTION("historyViewProjection");
+static constexpr UniformId U_HISTORY_DEPTH("historyDepth");
+
+static constexpr PipelineState PIPELINE_FROXELS = PipelineState().depth(false).depthWrite(false).cull(CULL_NONE);
+
+VolumetricFog::~VolumetricFog() {
+    release();
+}
+
+void VolumetricFog::release() {
+    for (GLuint* volume : { &scatter_volumes[0], &scatter_volumes[1], &integrated_volume }) {
+        if (*volume == 0) continue;
+        gpu_memory.releaseTexture(*volume);
+        glDeleteTextures(1, volume);
+        *volume = 0;
+    }
+    if (fbo != 0) glDeleteFramebuffers(1, &fbo);
+    if (vao != 0) glDeleteVertexArrays(1, &vao);
+    fbo = vao = 0;
+    scatter_shader.reset();
+    integrate_shader.reset();
+    history_valid = false;
+}
+
+GLuint VolumetricFog::createVolume() {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    gl_state.bindTexture(0, GL_TEXTURE_3D, texture);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, VOLUMETRIC_FOG_WIDTH, VOLUMETRIC_FOG_HEIGHT, VOLUMETRIC_FOG_DEPTH, 0, GL_RGBA,
+                 GL_HALF_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    gpu_memory.trackTexture(texture, textureLevelBytes(GL_RGBA16F, VOLUMETRIC_FOG_WIDTH, VOLUMETRIC_FOG_HEIGHT, VOLUMETRIC_FOG_DEPTH),
+                            GPU_MEMORY_RENDER_TARGETS, "volumetric fog");
+    return texture;
+}
+
+bool VolumetricFog::init() {
+    if (integrated_volume != 0) return true;
+    if (failed) return false;
+    failed = true;
+
+#ifdef __EMSCRIPTEN__
+    if (!hasGLExtension("GL_EXT_color_buffer_float") && !hasGLExtension("EXT_color_buffer_float")) {
+        printf("Volumetric fog needs EXT_color_buffer_float, turned off\n");
+        return false;
+    }
+#endif
+
+    try {
+        const std::string fullscreen = loadShaderFile(buildAssetPath("res/shaders/hiz.vs"));
+        scatter_shader = std::make_unique<Shader>(fullscreen, loadShaderFile(buildAssetPath("res/shaders/volumetric_fog_scatter.fs")));
+        integrate_shader = std::make_unique<Shader>(fullscreen, loadShaderFile(buildAssetPath("res/shaders/volumetric_fog_integrate.fs")));
+    } catch (const std::exception& e) {
+        printf("Volumetric fog shaders failed (%s), turned off\n", e.what());
+        release();
+        return false;
+    }
+    const glm::vec2 size(VOLUMETRIC_FOG_WIDTH, VOLUMETRIC_FOG_HEIGHT);
+    for (Shader* shader : { scatter_shader.get(), integrate_shader.get() }) {
+        bindFrameUniformBlocks(*shader);
+        shader->use();
+        shader->setVec2("volumeSize", size);
+    }
+    // The units pbr.fs reads the shadow atlas and the clusters from
+    scatter_shader->setInt("shadowMap", 4);
+    scatter_shader->setInt("clusterLights", 6);
+    scatter_shader->setInt("clusterGrid", 7);
+    scatter_shader->setInt("clusterIndices", 8);
+    scatter_shader->setInt("history", 0);
+    integrate_shader->use();
+    integrate_shader->setInt("scatter", 0);
+
+    scatter_volumes[0] = createVolume();
+    scatter_volumes[1] = createVolume();
+    integrated_volume = createVolume();
+    glGenFramebuffers(1, &fbo);
+    glGenVertexArrays(1, &vao);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, integrated_volume, 0, 0);
+    const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    if (!complete) {
+        printf("Volumetric fog framebuffer incomplete, turned off\n");
+        release();
+        return false;
+    }
+
+    failed = false;
+    printf("Volumetric fog: %dx%dx%d froxels\n", VOLUMETRIC_FOG_WIDTH, VOLUMETRIC_FOG_HEIGHT, VOLUMETRIC_FOG_DEPTH);
+    return true;
+}
+
+void VolumetricFog::fillLightBlock(LightBlock& block) {
+    // The clusters' slices over CLUSTER_Z, so the volume's w runs 0 to 1 over the same range
+    depth_mapping = glm::vec2(block.cluster_depth_scale, block.cluster_depth_bias) / (float)CLUSTER_Z;
+    block.volumetric_depth_scale = depth_mapping.x;
+    block.volumetric_depth_bias = depth_mapping.y;
+    block.volumetric_fog = use_volumetric_fog && depth_mapping.x > 0.0f && init() ? 1 : 0;
+    if (!block.volumetric_fog) history_valid = false;
+}
+
+// Every slice of target with the bound program, which reads the slice from its uniform
+void VolumetricFog::drawSlices(Shader& shader, GLuint target) {
+    for (int slice = 0; slice < VOLUMETRIC_FOG_DEPTH; ++slice) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, 0, slice);
+        shader.setInt(U_SLICE, slice);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+}
+
+void VolumetricFog::render(const glm::mat4& view, const glm::mat4& view_projection) {
+    PROFILE_SCOPE("volumetric fog");
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, VOLUMETRIC_FOG_WIDTH, VOLUMETRIC_FOG_HEIGHT);
+
+    // A different point in each froxel's depth every frame, the history averaging them
+    const bool temporal = use_volumetric_fog_temporal;
+    const float jitter = temporal ? std::fmod(0.5f + (float)frame * 0.618034f, 1.0f) : 0.5f;
+    frame++;
+    current = 1 - current;
+
+    gl_state.apply(PIPELINE_FROXELS.withProgram(scatter_shader->getProgram()).withVertexArray(vao));
+    scatter_shader->setFloat(U_SLICE_JITTER, jitter);
+    scatter_shader->setFloat(U_DENSITY, volumetric_fog_density);
+    scatter_shader->setFloat(U_HEIGHT_FALLOFF, volumetric_fog_height_falloff);
+    scatter_shader->setFloat(U_ANISOTROPY, volumetric_fog_anisotropy);
+    scatter_shader->setFloat(U_HISTORY_WEIGHT, temporal && history_valid ? VOLUMETRIC_FOG_HISTORY_WEIGHT : 0.0f);
+    scatter_shader->setMat4(U_HISTORY_VIEW, history_view);
+    scatter_shader->setMat4(U_HISTORY_VIEW_PROJECTION, history_view_projection);
+    scatter_shader->setVec2(U_HISTORY_DEPTH, history_depth);
+    gl_state.bindTextureUnit(0, GL_TEXTURE_3D, scatter_volumes[1 - current]);
+    drawSlices(*scatter_shader, scatter_volumes[current]);
+
+    gl_state.apply(PIPELINE_FROXELS.withProgram(integrate_shader->getProgram()).withVertexArray(vao));
+    gl_state.bindTextureUnit(0, GL_TEXTURE_3D, scatter_volumes[current]);
+    drawSlices(*integrate_shader, integrated_volume);
+
+    gl_state.apply(PipelineState());
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    history_valid = true;
+    history_view = view;
+    history_view_projection = view_projection;
+    history_depth = depth_mapping;
+}
+
+void VolumetricFog::bind(int unit) const {
+    gl_state.bindTextureUnit(unit, GL_TEXTURE_3D, integrated_volume);
+}
@@ -0,0 +1,42 @@
+#include "world_origin.h"
+#include "renderer.h"
+#include "light.h"
+#include "particles.h"
+#include "reflection_probes.h"
+#include "portal_visibility.h"
+#include "temporal_aa.h"
+#include <cmath>
+#include <cstdio>
+
+bool use_origin_rebasing = true;
+
+WorldOrigin world_origin;
+
+glm::vec3 WorldOrigin::rebaseFor(const glm::vec3& camera_position, bool allowed) const {
+    if (!use_origin_rebasing || !allowed) return glm::vec3(0.0f);
+    if (std::fabs(camera_position.x) < WORLD_ORIGIN_REBASE_DISTANCE && std::fabs(camera_position.z) < WORLD_ORIGIN_REBASE_DISTANCE) {
+        return glm::vec3(0.0f);
+    }
+    return glm::vec3(std::round(camera_position.x / WORLD_ORIGIN_SNAP) * WORLD_ORIGIN_SNAP, 0.0f,
+                     std::round(camera_position.z / WORLD_ORIGIN_SNAP) * WORLD_ORIGIN_SNAP);
+}
+
+void WorldOrigin::shift(const glm::vec3& delta, Camera& camera, Renderer& renderer) {
+    if (delta == glm::vec3(0.0f)) return;
+    offset += glm::dvec3(delta);
+    shifts++;
+
+    camera.position -= delta;
+    entity_manager.shiftOrigin(delta);
+    for (size_t i = 0; i < lights.size(); ++i) {
+        if (lights[i].type == DIR_LIGHT) continue;
+        lights[i].position -= delta;
+        markLightDirty(i);
+    }
+    reflection_probes.shiftOrigin(delta);
+    portal_visibility.shiftOrigin(delta);
+    particle_system.shiftOrigin(delta);
+    temporal_aa.shiftOrigin(delta);
+    renderer.shiftOrigin(delta);
+    printf("World origin moved to %.0f, %.0f\n", offset.x, offset.z);
+}
@@ -0,0 +1,191 @@
+#include "world_partition.h"
+#include "world_origin.h"
+#include "asset_loader.h"
+#include "mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+bool use_world_streaming = true;
+
+WorldPartition world_partition;
+
+namespace {
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Vertex and index bytes of a mesh and its generated levels. Meshes outside an arena don't keep
+// their vertex count, a third of the indices stands in for it.
+uint64_t meshBytes(const Mesh& mesh) {
+    const uint64_t vertices = mesh.geometry.vertices.size != 0 ? mesh.geometry.vertices.size : mesh.INDEX_COUNT / 3;
+    uint64_t bytes = vertices * mesh.vertex_layout.stride + (uint64_t)mesh.INDEX_COUNT * getIndexSize(mesh.index_type);
+    for (const auto& lod : mesh.lods) bytes += meshBytes(*lod);
+    return bytes;
+}
+
+} // namespace
+
+int WorldPartition::parseArg(int argc, char** argv, int i) {
+    const std::string arg = argv[i];
+    if (arg != "--world" && arg != "--world-budget") return 0;
+    if (i + 1 >= argc) {
+        printf("%s needs 1 argument\n", arg.c_str());
+        return -1;
+    }
+    if (arg == "--world") {
+        directory = argv[i + 1];
+    } else {
+        const int megabytes = atoi(argv[i + 1]);
+        if (megabytes <= 0) {
+            printf("--world-budget needs a positive size in MB\n");
+            return -1;
+        }
+        budget_bytes = (uint64_t)megabytes * 1024 * 1024;
+    }
+    return 2;
+}
+
+bool WorldPartition::init() {
+    std::error_code ec;
+    for (const auto& item : std::filesystem::directory_iterator(directory, ec)) {
+        const std::string name = item.path().filename().string();
+        const bool text = endsWith(name, ".scene.txt");
+        if (!text && !endsWith(name, ".scene")) continue;
+        int x = 0, z = 0;
+        if (sscanf(name.c_str(), "cell_%d_%d.", &x, &z) != 2) continue;
+        // The text wins over a binary of the same cell, it's what gets edited
+        Cell& cell = cells[{x, z}];
+        if (cell.path.empty() || text) cell.path = item.path().string();
+    }
+    if (cells.empty()) {
+        printf("World: no cell_<x>_<z>.scene files in %s\n", directory.c_str());
+        return false;
+    }
+    printf("World: %zu cells of %.0f m in %s, %.0f MB budget\n", cells.size(), WORLD_CELL_SIZE, directory.c_str(),
+           budget_bytes / (1024.0 * 1024.0));
+    return true;
+}
+
+void WorldPartition::update(const glm::vec3& camera_position, const glm::vec3& camera_front) {
+    if (!use_world_streaming || cells.empty()) return;
+
+    // Cells are placed in the world, the camera is relative to the floating origin
+    const glm::dvec3 camera_world = world_origin.toWorld(camera_position);
+    const glm::vec2 eye((float)camera_world.x, (float)camera_world.z);
+    glm::vec2 forward(camera_front.x, camera_front.z);
+    forward = glm::length(forward) > 1e-4f ? glm::normalize(forward) : glm::vec2(0.0f);
+
+    // Wanted cells, by distance to their nearest point with the ones ahead counted nearer
+    std::vector<Cell*> wanted;
+    for (auto& [coord, cell] : cells) {
+        const glm::vec2 cell_min = glm::vec2(coord.first, coord.second) * WORLD_CELL_SIZE;
+        const glm::vec2 cell_max = cell_min + WORLD_CELL_SIZE;
+        const float distance = glm::length(glm::max(glm::max(cell_min - eye, eye - cell_max), glm::vec2(0.0f)));
+        const float radius = WORLD_LOAD_RADIUS + (cell.state == CELL_UNLOADED ? 0.0f : WORLD_UNLOAD_MARGIN);
+        if (distance >= radius || cell.failed) {
+            cell.priority = INFINITY;
+            continue;
+        }
+        const glm::vec2 to_center = (cell_min + cell_max) * 0.5f - eye;
+        const float facing = glm::length(to_center) > 1e-4f ? glm::dot(forward, glm::normalize(to_center)) : 1.0f;
+        cell.priority = distance * (1.0f - WORLD_VIEW_PRIORITY * facing);
+        wanted.push_back(&cell);
+    }
+    std::sort(wanted.begin(), wanted.end(), [](const Cell* a, const Cell* b) { return a->priority < b->priority; });
+
+    // The budget goes to the best cells, the camera's own always fits
+    uint64_t planned = 0;
+    size_t kept = 0;
+    for (; kept < wanted.size(); ++kept) {
+        const uint64_t bytes = estimatedBytes(*wanted[kept]);
+        if (kept > 0 && planned + bytes > budget_bytes) break;
+        planned += bytes;
+    }
+    for (size_t i = kept; i < wanted.size(); ++i) wanted[i]->priority = INFINITY;
+    wanted.resize(kept);
+    for (auto& [coord, cell] : cells) {
+        if (cell.state != CELL_UNLOADED && cell.priority == INFINITY) unload(cell);
+    }
+
+    for (Cell* cell : wanted) {
+        if (loading >= WORLD_MAX_LOADING) break;
+        if (cell->state == CELL_UNLOADED) startLoad(*cell);
+    }
+    // One cell's entities a frame keeps the hitch to a single bulk insert
+    for (Cell* cell : wanted) {
+        if (cell->state == CELL_LOADING && cell->scene->modelsReady()) {
+            instantiate(*cell);
+            break;
+        }
+    }
+}
+
+bool WorldPartition::startLoad(Cell& cell) {
+    std::string path = cell.path;
+    if (endsWith(path, ".txt")) path = SceneFile::compile(path);
+    cell.scene = std::make_unique<SceneFile>();
+    if (path.empty() || !cell.scene->open(path)) {
+        cell.scene.reset();
+        cell.failed = true;
+        return false;
+    }
+    cell.scene->requestModels(ASSET_PRIORITY_SCENE);
+    cell.state = CELL_LOADING;
+    loading++;
+    return true;
+}
+
+void WorldPartition::instantiate(Cell& cell) {
+    cell.entities = cell.scene->createEntitiesFromFile(world_origin.origin());
+    if (cell.bytes == 0) {
+        for (const auto& model : cell.scene->modelRequests()) {
+            for (const auto& mesh : model->meshes) cell.bytes += meshBytes(*mesh);
+        }
+        measured_bytes += cell.bytes;
+        measured_cells++;
+    }
+    cell.state = CELL_RESIDENT;
+    loading--;
+    resident++;
+    resident_bytes += cell.bytes;
+}
+
+void WorldPartition::unload(Cell& cell) {
+    if (cell.state == CELL_RESIDENT) {
+        // The handles' current slots, marked for one pass over the entities
+        std::vector<uint8_t> doomed;
+        for (EntityHandle handle : cell.entities) {
+            if (!entity_manager.isValid(handle)) continue;
+            const size_t index = entity_manager.indexOf(handle);
+            if (index >= doomed.size()) doomed.resize(index + 1, 0);
+            doomed[index] = 1;
+        }
+        if (!doomed.empty()) {
+            entity_manager.removeEntities([&doomed](const Entity& entity) {
+                const size_t index = entity_manager.indexOf(&entity);
+                return index < doomed.size() && doomed[index] != 0;
+            });
+        }
+        resident--;
+        resident_bytes -= cell.bytes;
+    } else if (cell.state == CELL_LOADING) {
+        loading--;
+    }
+    // Models only this cell used go once their requests and entities are gone
+    cell.entities.clear();
+    cell.scene.reset();
+    cell.state = CELL_UNLOADED;
+}
+
+uint64_t WorldPartition::estimatedBytes(const Cell& cell) const {
+    if (cell.bytes != 0) return cell.bytes;
+    return measured_cells > 0 ? measured_bytes / measured_cells : 0;
+}
+
+void WorldPartition::release() {
+    for (auto& [coord, cell] : cells) unload(cell);
+}
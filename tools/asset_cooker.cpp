@@ -0,0 +1,158 @@
+// asset_cooker: the engine's import pipeline run offline over res/scene_models, so a run of the
+// engine reads cooked meshes and textures instead of importing. No window, no GL context.
+//
+//   asset_cooker [--no-compress] [--no-mesh-lz] [--manifest <file>] [--write-pack <file>] [--load-report <file>]
+//
+// Every model goes through importMeshStaging() as the engine's asset loader would: Assimp, the
+// optimizer, LOD generation, ORM packing, block compression and mip chains. That leaves the cooked
+// mesh in cache/meshes/, packed ORM maps in cache/textures/ and <image>.ktx2 next to each source
+// image, keyed the way the runtime checks them, so outputs still up to date are read back rather
+// than rebuilt. Compression targets desktop GL (BC1/BC3/BC5 with sRGB twins), what the engine
+// itself cooks on first load; --no-compress skips it for targets that can't sample those.
+// --no-mesh-lz keeps the cooked vertex and index blobs to the mesh codecs alone.
+// The manifest lists every output, "<size> <mtime> <path>" like the web build's asset manifest,
+// cache/cook_manifest.txt by default. --write-pack then packs res/ and cache/ as the engine does.
+// Models are cooked one at a time, two of them may share a texture and the KTX2 writes aren't
+// atomic. The pipeline spreads each one across the job system.
+#include "mesh_loader.h"
+#include "mesh_cache.h"
+#include "texture_compression.h"
+#include "asset_pack.h"
+#include "filesystem.h"
+#include "job_system.h"
+#include "load_stats.h"
+#include "camera.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Globals main.cpp owns for the rest of the engine
+glm::mat4 view;
+glm::mat4 projection;
+Camera global_camera;
+unsigned int total_triangles = 0;
+GLuint default_texture_id = 0;
+
+#define COOK_MANIFEST_FILE "cache/cook_manifest.txt"
+
+static bool isModelFile(const std::filesystem::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return extension == ".obj" || extension == ".fbx" || extension == ".gltf" || extension == ".glb";
+}
+
+// Model paths relative to res/scene_models, as the engine names them
+static std::vector<std::string> findModels() {
+    std::vector<std::string> models;
+    const std::filesystem::path root = buildAssetPath("res/scene_models");
+    std::error_code ec;
+    for (const auto& item : std::filesystem::recursive_directory_iterator(root, ec)) {
+        if (item.is_regular_file() && isModelFile(item.path())) {
+            models.push_back(item.path().lexically_relative(root).generic_string());
+        }
+    }
+    std::sort(models.begin(), models.end());
+    return models;
+}
+
+static void addOutput(std::set<std::string>& outputs, const std::string& path) {
+    if (!path.empty() && std::filesystem::is_regular_file(path)) outputs.insert(path);
+}
+
+// What cooking staging left on disk, whether it was written now or read back
+static void collectOutputs(const MeshStaging& staging, std::set<std::string>& outputs) {
+    addOutput(outputs, getCookedMeshPath(staging.filepath));
+    for (const SubMeshStaging& sub : staging.submeshes) {
+        for (const std::string* path : {&sub.material.albedo_path, &sub.material.normal_path, &sub.material.emissive_path}) {
+            if (!path->empty() && (*path)[0] != '*') addOutput(outputs, *path + ".ktx2");
+        }
+        if (!sub.images.orm_key.empty()) addOutput(outputs, getCookedORMPath(sub.images.orm_key));
+    }
+}
+
+static bool writeManifest(const std::string& path, const std::set<std::string>& outputs) {
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        printf("Can't write the manifest %s\n", path.c_str());
+        return false;
+    }
+    for (const std::string& output : outputs) {
+        std::filesystem::path relative = std::filesystem::path(output).lexically_relative(executable_path);
+        out << std::filesystem::file_size(output, ec) << " " << getFileModifiedTime(output) << " " << relative.generic_string() << "\n";
+    }
+    return (bool)out;
+}
+
+int main(int argc, char** argv) {
+    std::string manifest_path = buildAssetPath(COOK_MANIFEST_FILE);
+    for (int i = 1; i < argc;) {
+        int taken = asset_pack.parseArg(argc, argv, i);
+        if (taken == 0) taken = load_stats.parseArg(argc, argv, i);
+        if (taken == 0 && strcmp(argv[i], "--no-compress") == 0) {
+            use_texture_compression = false;
+            taken = 1;
+        }
+        if (taken == 0 && strcmp(argv[i], "--no-mesh-lz") == 0) {
+            cooked_mesh_lz = false;
+            taken = 1;
+        }
+        if (taken == 0 && strcmp(argv[i], "--manifest") == 0) {
+            if (i + 1 >= argc) {
+                printf("--manifest needs an output file\n");
+                return -1;
+            }
+            manifest_path = argv[i + 1];
+            taken = 2;
+        }
+        if (taken < 0) return -1;
+        if (taken == 0) {
+            printf("Unknown argument %s\n", argv[i]);
+            return -1;
+        }
+        i += taken;
+    }
+
+    // No GL to ask, so the formats a desktop GL 3.3 driver samples, as initTextureCompression() finds them
+    TextureCompressionCaps caps;
+    caps.s3tc = true;
+    caps.s3tc_srgb = true;
+    caps.rgtc = true;
+    texture_compression_caps = caps;
+
+    job_system.init();
+    const auto start = std::chrono::steady_clock::now();
+
+    const std::vector<std::string> models = findModels();
+    std::set<std::string> outputs;
+    size_t failed = 0, submeshes = 0;
+    for (const std::string& model : models) {
+        MeshStaging staging;
+        if (!importMeshStaging(model, staging)) {
+            printf("Failed to cook %s\n", model.c_str());
+            failed++;
+            continue;
+        }
+        printf("Cooked %s: %zu sub-meshes%s\n", model.c_str(), staging.submeshes.size(), staging.from_cache ? ", up to date" : "");
+        submeshes += staging.submeshes.size();
+        collectOutputs(staging, outputs);
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Cooked %zu of %zu models, %zu sub-meshes, %zu files in %.1f s\n", models.size() - failed, models.size(), submeshes,
+           outputs.size(), seconds);
+    load_stats.report();
+
+    bool ok = failed == 0 && writeManifest(manifest_path, outputs);
+    if (ok && asset_pack.writeRequested()) ok = asset_pack.write();
+    job_system.shutdown();
+    return ok ? 0 : 1;
+}